@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * bayer_packing.cpp - Raw Bayer line packing benchmarks
+ */
+
+#include <stdint.h>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "libcamera/internal/bayer_format.h"
+#include "libcamera/internal/bayer_packing.h"
+
+using namespace libcamera;
+
+namespace {
+
+constexpr unsigned int kWidth = 4056;
+
+const BayerFormat kFormats[] = {
+	{ BayerFormat::RGGB, 10, BayerFormat::Packing::CSI2 },
+	{ BayerFormat::RGGB, 12, BayerFormat::Packing::CSI2 },
+	{ BayerFormat::RGGB, 10, BayerFormat::Packing::IPU3 },
+	{ BayerFormat::RGGB, 16, BayerFormat::Packing::None },
+};
+
+void BM_UnpackLine(benchmark::State &state)
+{
+	const BayerFormat &format = kFormats[state.range(0)];
+	std::vector<uint8_t> src(bayer::lineSize(format, kWidth), 0x5a);
+	std::vector<uint16_t> dst(kWidth);
+
+	for (auto _ : state) {
+		bayer::unpackLine(format, src.data(), dst.data(), kWidth);
+		benchmark::DoNotOptimize(dst.data());
+	}
+
+	state.SetLabel(format.toString());
+	state.SetItemsProcessed(state.iterations() * kWidth);
+	state.SetBytesProcessed(state.iterations() * src.size());
+}
+BENCHMARK(BM_UnpackLine)->DenseRange(0, 3);
+
+void BM_UnpackLineMsb8(benchmark::State &state)
+{
+	const BayerFormat &format = kFormats[state.range(0)];
+	std::vector<uint8_t> src(bayer::lineSize(format, kWidth), 0x5a);
+	std::vector<uint8_t> dst(kWidth);
+
+	for (auto _ : state) {
+		bayer::unpackLineMsb8(format, src.data(), dst.data(), kWidth);
+		benchmark::DoNotOptimize(dst.data());
+	}
+
+	state.SetLabel(format.toString());
+	state.SetItemsProcessed(state.iterations() * kWidth);
+	state.SetBytesProcessed(state.iterations() * src.size());
+}
+BENCHMARK(BM_UnpackLineMsb8)->DenseRange(0, 3);
+
+void BM_PackLine(benchmark::State &state)
+{
+	const BayerFormat &format = kFormats[state.range(0)];
+	std::vector<uint16_t> src(kWidth, 0x155);
+	std::vector<uint8_t> dst(bayer::lineSize(format, kWidth));
+
+	for (auto _ : state) {
+		bayer::packLine(format, src.data(), dst.data(), kWidth);
+		benchmark::DoNotOptimize(dst.data());
+	}
+
+	state.SetLabel(format.toString());
+	state.SetItemsProcessed(state.iterations() * kWidth);
+	state.SetBytesProcessed(state.iterations() * dst.size());
+}
+/* Packing to IPU3 isn't supported. */
+BENCHMARK(BM_PackLine)->Arg(0)->Arg(1)->Arg(3);
+
+} /* namespace */
+
+BENCHMARK_MAIN();
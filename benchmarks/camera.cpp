@@ -0,0 +1,584 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera.cpp - Camera capture benchmarks
+ *
+ * Capture frames from synthetic cameras, to measure the overhead of the
+ * libcamera core request handling without any hardware. The cameras are
+ * implemented by a pipeline handler that runs in its own thread and produces
+ * frames from a timer at a configurable rate, or as fast as requests are
+ * queued, with a round trip to an IPA running in a separate thread for every
+ * frame. No pixel data is produced, the frame size thus doesn't influence the
+ * results and is fixed.
+ *
+ * The benchmarks measure the process CPU time, which includes the application,
+ * pipeline handler and IPA threads.
+ */
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <libcamera/base/object.h>
+#include <libcamera/base/semaphore.h>
+#include <libcamera/base/signal.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/framebuffer_allocator.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/camera.h"
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/pipeline_handler.h"
+
+using namespace libcamera;
+
+namespace {
+
+constexpr unsigned int kBufferCount = 4;
+constexpr Size kFrameSize{ 640, 480 };
+
+class SyntheticCameraConfiguration : public CameraConfiguration
+{
+public:
+	Status validate() override
+	{
+		if (config_.empty())
+			return Invalid;
+
+		Status status = Valid;
+
+		if (config_.size() > 1) {
+			config_.resize(1);
+			status = Adjusted;
+		}
+
+		StreamConfiguration &cfg = config_[0];
+
+		if (cfg.pixelFormat != formats::NV12 || cfg.size != kFrameSize) {
+			cfg.pixelFormat = formats::NV12;
+			cfg.size = kFrameSize;
+			status = Adjusted;
+		}
+
+		if (!cfg.bufferCount) {
+			cfg.bufferCount = kBufferCount;
+			status = Adjusted;
+		}
+
+		const PixelFormatInfo &info = PixelFormatInfo::info(cfg.pixelFormat);
+		cfg.stride = info.stride(cfg.size.width, 0);
+		cfg.frameSize = info.frameSize(cfg.size);
+
+		return status;
+	}
+};
+
+/*
+ * The synthetic IPA computes controls from the statistics of every frame, and
+ * returns them to the pipeline handler through a signal, as the IPA proxies do
+ * for IPA modules running in a thread.
+ */
+class SyntheticIPA : public Object
+{
+public:
+	void processStats(unsigned int camera, uint32_t frame)
+	{
+		/* Emulate a trivial exposure control loop. */
+		exposure_ = (exposure_ * 7 + 10000 + frame % 100) / 8;
+
+		ControlList metadata(controls::controls);
+		metadata.set(controls::ExposureTime, exposure_);
+		metadata.set(controls::AnalogueGain, 1.0f);
+
+		metadataReady.emit(camera, frame, metadata);
+	}
+
+	void sync()
+	{
+	}
+
+	Signal<unsigned int, uint32_t, const ControlList &> metadataReady;
+
+private:
+	int32_t exposure_ = 10000;
+};
+
+class SyntheticPipelineHandler : public PipelineHandler
+{
+public:
+	SyntheticPipelineHandler(unsigned int fps)
+		: PipelineHandler(nullptr), fps_(fps)
+	{
+		ipa_.metadataReady.connect(this, &SyntheticPipelineHandler::metadataReady);
+		ipa_.moveToThread(&ipaThread_);
+		ipaThread_.start();
+	}
+
+	~SyntheticPipelineHandler()
+	{
+		ipaThread_.exit(0);
+		ipaThread_.wait();
+	}
+
+	std::shared_ptr<Camera> createCamera(const std::string &id);
+
+	bool match([[maybe_unused]] DeviceEnumerator *enumerator) override
+	{
+		return false;
+	}
+
+	CameraConfiguration *generateConfiguration(Camera *camera,
+						   const StreamRoles &roles) override;
+	int configure(Camera *camera, CameraConfiguration *config) override;
+
+	int exportFrameBuffers(Camera *camera, Stream *stream,
+			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+
+	int start(Camera *camera, const ControlList *controls) override;
+	void stop(Camera *camera) override;
+
+protected:
+	int queueRequestDevice(Camera *camera, Request *request) override;
+
+private:
+	struct CameraData {
+		unsigned int index;
+		Stream stream;
+		Timer *timer;
+		utils::time_point nextFrame;
+		uint32_t frame;
+		std::queue<Request *> queued;
+		std::map<uint32_t, Request *> processing;
+	};
+
+	void frameStart(CameraData *data);
+	void processFrame(CameraData *data, Request *request);
+	void metadataReady(unsigned int camera, uint32_t frame,
+			   const ControlList &metadata);
+	void cancelRequest(Request *request);
+
+	unsigned int fps_;
+
+	std::vector<std::unique_ptr<CameraData>> cameras_;
+	std::map<const Camera *, CameraData *> cameraData_;
+
+	Thread ipaThread_;
+	SyntheticIPA ipa_;
+};
+
+std::shared_ptr<Camera> SyntheticPipelineHandler::createCamera(const std::string &id)
+{
+	auto data = std::make_unique<CameraData>();
+	data->index = cameras_.size();
+	data->frame = 0;
+
+	/* Make the timer a child to move it to the pipeline handler thread. */
+	data->timer = new Timer(this);
+	data->timer->timeout.connect(this, [this, d = data.get()]() {
+		frameStart(d);
+	});
+
+	std::set<Stream *> streams{ &data->stream };
+	std::shared_ptr<Camera> camera =
+		Camera::create(std::make_unique<Camera::Private>(this), id, streams);
+
+	cameraData_[camera.get()] = data.get();
+	cameras_.push_back(std::move(data));
+
+	return camera;
+}
+
+CameraConfiguration *
+SyntheticPipelineHandler::generateConfiguration([[maybe_unused]] Camera *camera,
+						const StreamRoles &roles)
+{
+	CameraConfiguration *config = new SyntheticCameraConfiguration();
+
+	if (roles.empty())
+		return config;
+
+	StreamConfiguration cfg;
+	cfg.pixelFormat = formats::NV12;
+	cfg.size = kFrameSize;
+	cfg.bufferCount = kBufferCount;
+	config->addConfiguration(cfg);
+
+	config->validate();
+
+	return config;
+}
+
+int SyntheticPipelineHandler::configure(Camera *camera, CameraConfiguration *config)
+{
+	CameraData *data = cameraData_.at(camera);
+
+	config->at(0).setStream(&data->stream);
+
+	return 0;
+}
+
+int SyntheticPipelineHandler::exportFrameBuffers([[maybe_unused]] Camera *camera,
+						 Stream *stream,
+						 std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	const StreamConfiguration &cfg = stream->configuration();
+
+	for (unsigned int i = 0; i < cfg.bufferCount; i++) {
+		int fd = memfd_create("libcamera-benchmark", MFD_CLOEXEC);
+		if (fd < 0)
+			return -errno;
+
+		int ret = ftruncate(fd, cfg.frameSize);
+		if (ret < 0) {
+			ret = -errno;
+			close(fd);
+			return ret;
+		}
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(fd);
+		plane.offset = 0;
+		plane.length = cfg.frameSize;
+		close(fd);
+
+		std::vector<FrameBuffer::Plane> planes;
+		planes.push_back(std::move(plane));
+		buffers->push_back(std::make_unique<FrameBuffer>(std::move(planes)));
+	}
+
+	return cfg.bufferCount;
+}
+
+int SyntheticPipelineHandler::start(Camera *camera,
+				    [[maybe_unused]] const ControlList *controls)
+{
+	CameraData *data = cameraData_.at(camera);
+
+	data->frame = 0;
+
+	if (fps_) {
+		data->nextFrame = utils::clock::now();
+		data->timer->start(data->nextFrame);
+	}
+
+	return 0;
+}
+
+void SyntheticPipelineHandler::stop(Camera *camera)
+{
+	CameraData *data = cameraData_.at(camera);
+
+	data->timer->stop();
+
+	/*
+	 * Wait for the IPA to process all frames. The metadata it returns for
+	 * them is ignored, as the corresponding requests are cancelled.
+	 */
+	ipa_.invokeMethod(&SyntheticIPA::sync, ConnectionTypeBlocking);
+
+	for (const auto &[frame, request] : data->processing)
+		cancelRequest(request);
+	data->processing.clear();
+
+	while (!data->queued.empty()) {
+		cancelRequest(data->queued.front());
+		data->queued.pop();
+	}
+}
+
+int SyntheticPipelineHandler::queueRequestDevice(Camera *camera, Request *request)
+{
+	CameraData *data = cameraData_.at(camera);
+
+	/* Without a frame rate, capture frames as soon as requests are queued. */
+	if (!fps_) {
+		processFrame(data, request);
+		return 0;
+	}
+
+	data->queued.push(request);
+
+	return 0;
+}
+
+void SyntheticPipelineHandler::frameStart(CameraData *data)
+{
+	/* Frames are dropped when no request is available, as with sensors. */
+	if (!data->queued.empty()) {
+		processFrame(data, data->queued.front());
+		data->queued.pop();
+	} else {
+		data->frame++;
+	}
+
+	data->nextFrame += std::chrono::nanoseconds(1000000000 / fps_);
+	data->timer->start(data->nextFrame);
+}
+
+void SyntheticPipelineHandler::processFrame(CameraData *data, Request *request)
+{
+	uint32_t frame = data->frame++;
+
+	data->processing[frame] = request;
+
+	ipa_.invokeMethod(&SyntheticIPA::processStats, ConnectionTypeQueued,
+			  data->index, frame);
+}
+
+void SyntheticPipelineHandler::metadataReady(unsigned int camera, uint32_t frame,
+					     const ControlList &metadata)
+{
+	CameraData *data = cameras_[camera].get();
+
+	auto iter = data->processing.find(frame);
+	if (iter == data->processing.end())
+		return;
+
+	Request *request = iter->second;
+	data->processing.erase(iter);
+
+	uint64_t timestamp = utils::clock::now().time_since_epoch().count();
+
+	request->metadata().merge(metadata);
+	request->metadata().set(controls::SensorTimestamp, timestamp);
+
+	/* Fill the buffer metadata as V4L2VideoDevice does on dequeue. */
+	for (const auto &[stream, buffer] : request->buffers()) {
+		FrameMetadata &bufferMetadata = buffer->_d()->metadata();
+		bufferMetadata.status = FrameMetadata::FrameSuccess;
+		bufferMetadata.sequence = frame;
+		bufferMetadata.timestamp = timestamp;
+
+		completeBuffer(request, buffer);
+	}
+
+	completeRequest(request);
+}
+
+void SyntheticPipelineHandler::cancelRequest(Request *request)
+{
+	for (const auto &[stream, buffer] : request->buffers()) {
+		buffer->cancel();
+		completeBuffer(request, buffer);
+	}
+
+	completeRequest(request);
+}
+
+/*
+ * The capture session runs in the benchmark thread. Requests completed in the
+ * pipeline handler thread are handed over to it through a queue, and requeued
+ * to their camera.
+ */
+class CaptureSession
+{
+public:
+	~CaptureSession();
+
+	int init(unsigned int fps, unsigned int numCameras);
+	int start();
+	void stop();
+
+	Request *waitRequest();
+	int requeue(Request *request);
+
+private:
+	void requestCompleted(Request *request);
+
+	std::shared_ptr<SyntheticPipelineHandler> pipe_;
+	Thread pipelineThread_;
+
+	std::vector<std::shared_ptr<Camera>> cameras_;
+	std::vector<std::unique_ptr<CameraConfiguration>> configs_;
+	std::vector<std::unique_ptr<FrameBufferAllocator>> allocators_;
+	std::vector<std::unique_ptr<Request>> requests_;
+
+	Semaphore semaphore_;
+	std::mutex lock_;
+	std::queue<Request *> completed_;
+};
+
+int CaptureSession::init(unsigned int fps, unsigned int numCameras)
+{
+	pipe_ = std::make_shared<SyntheticPipelineHandler>(fps);
+
+	for (unsigned int i = 0; i < numCameras; i++)
+		cameras_.push_back(pipe_->createCamera("synthetic" + std::to_string(i)));
+
+	pipe_->moveToThread(&pipelineThread_);
+	pipelineThread_.start();
+
+	for (unsigned int i = 0; i < numCameras; i++) {
+		std::shared_ptr<Camera> &camera = cameras_[i];
+
+		int ret = camera->acquire();
+		if (ret)
+			return ret;
+
+		std::unique_ptr<CameraConfiguration> config =
+			camera->generateConfiguration({ StreamRole::Viewfinder });
+		if (!config)
+			return -EINVAL;
+
+		ret = camera->configure(config.get());
+		if (ret)
+			return ret;
+
+		Stream *stream = config->at(0).stream();
+
+		auto allocator = std::make_unique<FrameBufferAllocator>(camera);
+		ret = allocator->allocate(stream);
+		if (ret < 0)
+			return ret;
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator->buffers(stream)) {
+			std::unique_ptr<Request> request = camera->createRequest(i);
+			if (!request)
+				return -ENOMEM;
+
+			ret = request->addBuffer(stream, buffer.get());
+			if (ret)
+				return ret;
+
+			requests_.push_back(std::move(request));
+		}
+
+		camera->requestCompleted.connect(this, &CaptureSession::requestCompleted);
+
+		configs_.push_back(std::move(config));
+		allocators_.push_back(std::move(allocator));
+	}
+
+	return 0;
+}
+
+CaptureSession::~CaptureSession()
+{
+	for (std::shared_ptr<Camera> &camera : cameras_)
+		camera->release();
+
+	requests_.clear();
+	allocators_.clear();
+	configs_.clear();
+	cameras_.clear();
+
+	pipelineThread_.exit(0);
+	pipelineThread_.wait();
+}
+
+int CaptureSession::start()
+{
+	for (std::shared_ptr<Camera> &camera : cameras_) {
+		int ret = camera->start();
+		if (ret)
+			return ret;
+	}
+
+	for (std::unique_ptr<Request> &request : requests_) {
+		int ret = cameras_[request->cookie()]->queueRequest(request.get());
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+void CaptureSession::stop()
+{
+	for (std::shared_ptr<Camera> &camera : cameras_)
+		camera->stop();
+}
+
+Request *CaptureSession::waitRequest()
+{
+	semaphore_.acquire();
+
+	std::lock_guard<std::mutex> locker(lock_);
+	Request *request = completed_.front();
+	completed_.pop();
+
+	return request;
+}
+
+int CaptureSession::requeue(Request *request)
+{
+	request->reuse(Request::ReuseBuffers);
+	return cameras_[request->cookie()]->queueRequest(request);
+}
+
+void CaptureSession::requestCompleted(Request *request)
+{
+	if (request->status() != Request::RequestComplete)
+		return;
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		completed_.push(request);
+	}
+
+	semaphore_.release();
+}
+
+/*
+ * Capture frames from range(1) cameras at range(0) frames per second each, or
+ * as fast as possible if range(0) is 0. Every iteration waits for a request to
+ * complete and requeues it, the items processed are the captured frames.
+ */
+void BM_Capture(benchmark::State &state)
+{
+	unsigned int fps = state.range(0);
+	unsigned int numCameras = state.range(1);
+
+	CaptureSession session;
+
+	int ret = session.init(fps, numCameras);
+	if (ret) {
+		state.SkipWithError("Failed to initialize the cameras");
+		return;
+	}
+
+	ret = session.start();
+	if (ret) {
+		state.SkipWithError("Failed to start the cameras");
+		return;
+	}
+
+	for (auto _ : state) {
+		Request *request = session.waitRequest();
+
+		if (session.requeue(request)) {
+			state.SkipWithError("Failed to queue request");
+			break;
+		}
+	}
+
+	session.stop();
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Capture)
+	->ArgNames({ "fps", "cameras" })
+	->ArgsProduct({ { 0, 1000 }, { 1, 4 } })
+	->UseRealTime()
+	->MeasureProcessCPUTime();
+
+} /* namespace */
+
+BENCHMARK_MAIN();
@@ -0,0 +1,144 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * controls.cpp - ControlList and ControlSerializer benchmarks
+ */
+
+#include <stdint.h>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "libcamera/internal/byte_stream_buffer.h"
+#include "libcamera/internal/control_serializer.h"
+
+using namespace libcamera;
+
+namespace {
+
+const ControlInfoMap &infoMap()
+{
+	static const ControlInfoMap infoMap({
+		{ &controls::AeEnable, ControlInfo(false, true, true) },
+		{ &controls::AnalogueGain, ControlInfo(1.0f, 16.0f, 1.0f) },
+		{ &controls::Brightness, ControlInfo(-1.0f, 1.0f, 0.0f) },
+		{ &controls::ColourGains, ControlInfo(0.0f, 32.0f, 1.0f) },
+		{ &controls::Contrast, ControlInfo(0.0f, 32.0f, 1.0f) },
+		{ &controls::ExposureTime, ControlInfo(1, 1000000, 10000) },
+		{ &controls::FrameDurationLimits,
+		  ControlInfo(INT64_C(1000), INT64_C(1000000), INT64_C(33333)) },
+		{ &controls::Saturation, ControlInfo(0.0f, 32.0f, 1.0f) },
+	}, controls::controls);
+
+	return infoMap;
+}
+
+/* Fill a list with the typical per-frame controls of an application. */
+void fillList(ControlList &list)
+{
+	list.set(controls::AeEnable, false);
+	list.set(controls::AnalogueGain, 2.0f);
+	list.set(controls::Brightness, 0.5f);
+	list.set(controls::ColourGains, Span<const float>({ 1.5f, 1.2f }));
+	list.set(controls::ExposureTime, 10000);
+	list.set(controls::FrameDurationLimits,
+		 Span<const int64_t>({ 33333, 33333 }));
+}
+
+void BM_ControlListSet(benchmark::State &state)
+{
+	ControlList list(infoMap());
+
+	for (auto _ : state) {
+		fillList(list);
+		list.clear();
+	}
+
+	state.SetItemsProcessed(state.iterations() * 6);
+}
+BENCHMARK(BM_ControlListSet);
+
+void BM_ControlListGet(benchmark::State &state)
+{
+	ControlList list(infoMap());
+	fillList(list);
+
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(list.get(controls::AeEnable));
+		benchmark::DoNotOptimize(list.get(controls::AnalogueGain));
+		benchmark::DoNotOptimize(list.get(controls::Brightness));
+		benchmark::DoNotOptimize(list.get(controls::ColourGains));
+		benchmark::DoNotOptimize(list.get(controls::ExposureTime));
+		benchmark::DoNotOptimize(list.get(controls::FrameDurationLimits));
+	}
+
+	state.SetItemsProcessed(state.iterations() * 6);
+}
+BENCHMARK(BM_ControlListGet);
+
+void BM_ControlListMerge(benchmark::State &state)
+{
+	ControlList source(infoMap());
+	fillList(source);
+
+	for (auto _ : state) {
+		ControlList list(infoMap());
+		list.set(controls::Contrast, 1.0f);
+		list.merge(source);
+		benchmark::DoNotOptimize(list);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ControlListMerge);
+
+/*
+ * Serialize a control list and deserialize it on the other side, as done for
+ * every frame by the IPA proxies.
+ */
+void BM_ControlSerializerRoundTrip(benchmark::State &state)
+{
+	ControlSerializer serializer(ControlSerializer::Role::Proxy);
+	ControlSerializer deserializer(ControlSerializer::Role::Worker);
+
+	std::vector<uint8_t> infoData(ControlSerializer::binarySize(infoMap()));
+	ByteStreamBuffer infoBuffer(infoData.data(), infoData.size());
+	if (serializer.serialize(infoMap(), infoBuffer) < 0) {
+		state.SkipWithError("Failed to serialize the ControlInfoMap");
+		return;
+	}
+
+	ByteStreamBuffer infoReader(const_cast<const uint8_t *>(infoData.data()),
+				    infoData.size());
+	if (deserializer.deserialize<ControlInfoMap>(infoReader).empty()) {
+		state.SkipWithError("Failed to deserialize the ControlInfoMap");
+		return;
+	}
+
+	ControlList list(infoMap());
+	fillList(list);
+
+	std::vector<uint8_t> listData;
+
+	for (auto _ : state) {
+		listData.resize(ControlSerializer::binarySize(list));
+		ByteStreamBuffer writer(listData.data(), listData.size());
+		serializer.serialize(list, writer);
+
+		ByteStreamBuffer reader(const_cast<const uint8_t *>(listData.data()),
+					listData.size());
+		ControlList result = deserializer.deserialize<ControlList>(reader);
+		benchmark::DoNotOptimize(result);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ControlSerializerRoundTrip);
+
+} /* namespace */
+
+BENCHMARK_MAIN();
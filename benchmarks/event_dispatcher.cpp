@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * event_dispatcher.cpp - Event dispatcher benchmarks
+ *
+ * The event dispatcher implementation is selected with the
+ * LIBCAMERA_EVENT_DISPATCHER environment variable, run the benchmarks with
+ * each value to compare them.
+ */
+
+#include <memory>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/event_notifier.h>
+#include <libcamera/base/semaphore.h>
+#include <libcamera/base/thread.h>
+
+using namespace libcamera;
+
+namespace {
+
+/*
+ * Signal an eventfd watched by a thread sleeping in its event dispatcher, and
+ * wait for the notifier slot to run in that thread.
+ */
+void BM_EventNotifierWakeup(benchmark::State &state)
+{
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0) {
+		state.SkipWithError("Failed to create eventfd");
+		return;
+	}
+
+	Thread thread;
+	Semaphore semaphore;
+	EventNotifier notifier(fd, EventNotifier::Read);
+
+	notifier.activated.connect(&notifier, [&]() {
+		uint64_t value;
+		if (read(fd, &value, sizeof(value)) == sizeof(value))
+			semaphore.release();
+	});
+	notifier.moveToThread(&thread);
+	thread.start();
+
+	for (auto _ : state) {
+		uint64_t value = 1;
+		if (write(fd, &value, sizeof(value)) != sizeof(value)) {
+			state.SkipWithError("Failed to write eventfd");
+			break;
+		}
+
+		semaphore.acquire();
+	}
+
+	/* The thread must be stopped before destroying the notifier. */
+	thread.exit(0);
+	thread.wait();
+
+	close(fd);
+}
+BENCHMARK(BM_EventNotifierWakeup)->UseRealTime();
+
+/*
+ * Run one iteration of event processing with range(0) idle notifiers
+ * registered, to measure the cost of processEvents() itself.
+ */
+void BM_ProcessEventsIdle(benchmark::State &state)
+{
+	EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+	std::vector<std::unique_ptr<EventNotifier>> notifiers;
+	std::vector<int> fds;
+
+	for (int64_t i = 0; i < state.range(0); i++) {
+		int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd < 0) {
+			state.SkipWithError("Failed to create eventfd");
+			break;
+		}
+
+		fds.push_back(fd);
+		notifiers.push_back(std::make_unique<EventNotifier>(fd, EventNotifier::Read));
+	}
+
+	for (auto _ : state) {
+		dispatcher->interrupt();
+		dispatcher->processEvents();
+	}
+
+	notifiers.clear();
+	for (int fd : fds)
+		close(fd);
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ProcessEventsIdle)->Arg(1)->Arg(8)->Arg(64);
+
+} /* namespace */
+
+BENCHMARK_MAIN();
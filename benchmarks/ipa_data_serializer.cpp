@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_data_serializer.cpp - IPADataSerializer benchmarks
+ */
+
+#include <stdint.h>
+#include <tuple>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <libcamera/ipa/core_ipa_interface.h>
+#include <libcamera/ipa/core_ipa_serializer.h>
+
+#include "libcamera/internal/ipa_data_serializer.h"
+
+using namespace libcamera;
+
+namespace {
+
+template<typename T>
+void roundTrip(benchmark::State &state, const T &in)
+{
+	std::vector<uint8_t> buf;
+	std::vector<FileDescriptor> fds;
+
+	for (auto _ : state) {
+		std::tie(buf, fds) = IPADataSerializer<T>::serialize(in);
+		T out = IPADataSerializer<T>::deserialize(buf, fds);
+		benchmark::DoNotOptimize(out);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * buf.size());
+}
+
+void BM_SerializeSensorInfo(benchmark::State &state)
+{
+	IPACameraSensorInfo info;
+	info.model = "imx219";
+	info.bitsPerPixel = 10;
+	info.activeAreaSize = { 3280, 2464 };
+	info.analogCrop = { 0, 0, 3280, 2464 };
+	info.outputSize = { 1640, 1232 };
+	info.pixelRate = 182400000;
+	info.lineLength = 3448;
+	info.minFrameLength = 1250;
+	info.maxFrameLength = 65535;
+
+	roundTrip(state, info);
+}
+BENCHMARK(BM_SerializeSensorInfo);
+
+void BM_SerializeStreams(benchmark::State &state)
+{
+	std::vector<IPAStream> streams;
+	for (int64_t i = 0; i < state.range(0); i++)
+		streams.emplace_back(0x32315659, Size(1920, 1080));
+
+	roundTrip(state, streams);
+}
+BENCHMARK(BM_SerializeStreams)->Arg(1)->Arg(4);
+
+void BM_SerializeVector(benchmark::State &state)
+{
+	std::vector<uint32_t> values(state.range(0), 42);
+
+	roundTrip(state, values);
+}
+BENCHMARK(BM_SerializeVector)->Arg(16)->Arg(1024);
+
+} /* namespace */
+
+BENCHMARK_MAIN();
@@ -0,0 +1,104 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * object.cpp - Object method invocation benchmarks
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <libcamera/base/object.h>
+#include <libcamera/base/semaphore.h>
+#include <libcamera/base/thread.h>
+
+using namespace libcamera;
+
+namespace {
+
+class InvokedObject : public Object
+{
+public:
+	void method(int value)
+	{
+		value_ = value;
+	}
+
+	void release(Semaphore *semaphore)
+	{
+		semaphore->release();
+	}
+
+private:
+	int value_;
+};
+
+/* Invoke a method of an object bound to the current thread. */
+void BM_InvokeDirect(benchmark::State &state)
+{
+	InvokedObject object;
+
+	for (auto _ : state)
+		object.invokeMethod(&InvokedObject::method,
+				    ConnectionTypeDirect, 42);
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_InvokeDirect);
+
+/*
+ * Invoke a method of an object bound to another thread, and wait for it to
+ * complete. This measures the round trip through the thread's message queue
+ * and event dispatcher.
+ */
+void BM_InvokeBlocking(benchmark::State &state)
+{
+	Thread thread;
+	InvokedObject object;
+
+	object.moveToThread(&thread);
+	thread.start();
+
+	for (auto _ : state)
+		object.invokeMethod(&InvokedObject::method,
+				    ConnectionTypeBlocking, 42);
+
+	thread.exit(0);
+	thread.wait();
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_InvokeBlocking)->UseRealTime();
+
+/*
+ * Queue range(0) method invocations to an object bound to another thread,
+ * and wait for all of them to complete.
+ */
+void BM_InvokeQueued(benchmark::State &state)
+{
+	Thread thread;
+	InvokedObject object;
+	Semaphore semaphore;
+
+	object.moveToThread(&thread);
+	thread.start();
+
+	for (auto _ : state) {
+		for (int64_t i = 0; i < state.range(0); i++)
+			object.invokeMethod(&InvokedObject::method,
+					    ConnectionTypeQueued, 42);
+
+		object.invokeMethod(&InvokedObject::release,
+				    ConnectionTypeQueued, &semaphore);
+		semaphore.acquire();
+	}
+
+	thread.exit(0);
+	thread.wait();
+
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_InvokeQueued)->Arg(1)->Arg(16)->Arg(256)->UseRealTime();
+
+} /* namespace */
+
+BENCHMARK_MAIN();
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * pixel_format.cpp - PixelFormatInfo lookup benchmarks
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <libcamera/formats.h>
+
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/v4l2_pixelformat.h"
+
+using namespace libcamera;
+
+namespace {
+
+void BM_PixelFormatInfo(benchmark::State &state)
+{
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(PixelFormatInfo::info(formats::NV12));
+		benchmark::DoNotOptimize(PixelFormatInfo::info(formats::SRGGB10_CSI2P));
+	}
+
+	state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_PixelFormatInfo);
+
+void BM_PixelFormatInfoV4L2(benchmark::State &state)
+{
+	const V4L2PixelFormat nv12(V4L2_PIX_FMT_NV12);
+	const V4L2PixelFormat srggb10p(V4L2_PIX_FMT_SRGGB10P);
+
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(PixelFormatInfo::info(nv12));
+		benchmark::DoNotOptimize(PixelFormatInfo::info(srggb10p));
+	}
+
+	state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_PixelFormatInfoV4L2);
+
+void BM_PixelFormatInfoName(benchmark::State &state)
+{
+	const std::string name("NV12");
+
+	for (auto _ : state)
+		benchmark::DoNotOptimize(PixelFormatInfo::info(name));
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PixelFormatInfoName);
+
+} /* namespace */
+
+BENCHMARK_MAIN();
@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * signal.cpp - Signal emission benchmarks
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <libcamera/base/object.h>
+#include <libcamera/base/signal.h>
+
+using namespace libcamera;
+
+namespace {
+
+class Receiver : public Object
+{
+public:
+	void slot(int value)
+	{
+		benchmark::DoNotOptimize(value);
+	}
+};
+
+class PlainReceiver
+{
+public:
+	void slot(int value)
+	{
+		benchmark::DoNotOptimize(value);
+	}
+};
+
+/* Emit a signal connected to range(0) slots of a plain class. */
+void BM_SignalEmit(benchmark::State &state)
+{
+	Signal<int> signal;
+	PlainReceiver receiver;
+
+	for (int64_t i = 0; i < state.range(0); i++)
+		signal.connect(&receiver, &PlainReceiver::slot);
+
+	for (auto _ : state)
+		signal.emit(42);
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SignalEmit)->Arg(0)->Arg(1)->Arg(4);
+
+/*
+ * Emit a signal connected to an Object bound to the current thread, the slot
+ * is called synchronously.
+ */
+void BM_SignalEmitObject(benchmark::State &state)
+{
+	Signal<int> signal;
+	Receiver receiver;
+
+	signal.connect(&receiver, &Receiver::slot);
+
+	for (auto _ : state)
+		signal.emit(42);
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SignalEmitObject);
+
+/* Emit the same signal from multiple threads concurrently. */
+void BM_SignalEmitThreads(benchmark::State &state)
+{
+	static Signal<int> signal;
+	static PlainReceiver receiver;
+
+	if (state.thread_index() == 0)
+		signal.connect(&receiver, &PlainReceiver::slot);
+
+	for (auto _ : state)
+		signal.emit(42);
+
+	if (state.thread_index() == 0)
+		signal.disconnect();
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SignalEmitThreads)->ThreadRange(1, 8);
+
+/* Connect and disconnect a slot. */
+void BM_SignalConnect(benchmark::State &state)
+{
+	Signal<int> signal;
+	PlainReceiver receiver;
+
+	for (auto _ : state) {
+		signal.connect(&receiver, &PlainReceiver::slot);
+		signal.disconnect(&receiver, &PlainReceiver::slot);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SignalConnect);
+
+} /* namespace */
+
+BENCHMARK_MAIN();
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * v4l2_buffer_cache.cpp - V4L2BufferCache benchmarks
+ */
+
+#include <memory>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <libcamera/file_descriptor.h>
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/v4l2_videodevice.h"
+
+using namespace libcamera;
+
+namespace {
+
+/*
+ * Create buffers with distinct dmabuf-like file descriptors. The cache only
+ * looks at the file descriptor numbers and lengths, a memfd is good enough.
+ */
+std::vector<std::unique_ptr<FrameBuffer>> createBuffers(unsigned int count,
+							unsigned int numPlanes)
+{
+	std::vector<std::unique_ptr<FrameBuffer>> buffers;
+
+	int fd = memfd_create("libcamera-benchmark", MFD_CLOEXEC);
+	if (fd < 0)
+		return buffers;
+
+	for (unsigned int i = 0; i < count; i++) {
+		std::vector<FrameBuffer::Plane> planes;
+
+		for (unsigned int j = 0; j < numPlanes; j++) {
+			FrameBuffer::Plane plane;
+			plane.fd = FileDescriptor(fd);
+			plane.offset = 0;
+			plane.length = 4096;
+			planes.push_back(std::move(plane));
+		}
+
+		buffers.push_back(std::make_unique<FrameBuffer>(std::move(planes)));
+	}
+
+	close(fd);
+
+	return buffers;
+}
+
+/*
+ * Cycle through range(0) buffers with a cache of the same size, all lookups
+ * hit the cache after the first round.
+ */
+void BM_BufferCacheHit(benchmark::State &state)
+{
+	auto buffers = createBuffers(state.range(0), state.range(1));
+	if (buffers.empty()) {
+		state.SkipWithError("Failed to create buffers");
+		return;
+	}
+
+	V4L2BufferCache cache(buffers.size());
+	unsigned int i = 0;
+
+	for (auto _ : state) {
+		int index = cache.get(*buffers[i]);
+		cache.put(index);
+		i = (i + 1) % buffers.size();
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BufferCacheHit)->Args({ 4, 1 })->Args({ 16, 1 })->Args({ 16, 3 });
+
+/*
+ * Cycle through twice as many buffers as the cache has entries, all lookups
+ * miss the cache.
+ */
+void BM_BufferCacheMiss(benchmark::State &state)
+{
+	auto buffers = createBuffers(state.range(0) * 2, 1);
+	if (buffers.empty()) {
+		state.SkipWithError("Failed to create buffers");
+		return;
+	}
+
+	V4L2BufferCache cache(state.range(0));
+	unsigned int i = 0;
+
+	for (auto _ : state) {
+		int index = cache.get(*buffers[i]);
+		cache.put(index);
+		i = (i + 1) % buffers.size();
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BufferCacheMiss)->Arg(4)->Arg(16);
+
+} /* namespace */
+
+BENCHMARK_MAIN();
@@ -7,7 +7,9 @@
 
 #pragma once
 
-#include <memory>
+#include <atomic>
+#include <cstddef>
+#include <new>
 #include <tuple>
 #include <type_traits>
 #include <utility>
@@ -27,8 +29,23 @@ class BoundMethodPackBase
 {
 public:
 	virtual ~BoundMethodPackBase() = default;
+
+	virtual BoundMethodPackBase *moveTo(void *storage, std::size_t size) = 0;
 };
 
+template<typename Pack>
+BoundMethodPackBase *moveBoundMethodPack(Pack &&pack, void *storage,
+					 std::size_t size)
+{
+	using PackType = std::remove_reference_t<Pack>;
+
+	if (sizeof(PackType) <= size &&
+	    alignof(PackType) <= alignof(std::max_align_t))
+		return new (storage) PackType(std::move(pack));
+
+	return new PackType(std::move(pack));
+}
+
 template<typename R, typename... Args>
 class BoundMethodPack : public BoundMethodPackBase
 {
@@ -43,8 +60,13 @@ public:
 		return ret_;
 	}
 
+	BoundMethodPackBase *moveTo(void *storage, std::size_t size) override
+	{
+		return moveBoundMethodPack(std::move(*this), storage, size);
+	}
+
 	std::tuple<typename std::remove_reference_t<Args>...> args_;
-	R ret_;
+	R ret_{};
 };
 
 template<typename... Args>
@@ -60,6 +82,11 @@ public:
 	{
 	}
 
+	BoundMethodPackBase *moveTo(void *storage, std::size_t size) override
+	{
+		return moveBoundMethodPack(std::move(*this), storage, size);
+	}
+
 	std::tuple<typename std::remove_reference_t<Args>...> args_;
 };
 
@@ -67,7 +94,8 @@ class BoundMethodBase
 {
 public:
 	BoundMethodBase(void *obj, Object *object, ConnectionType type)
-		: obj_(obj), object_(object), connectionType_(type)
+		: obj_(obj), object_(object), connected_(true),
+		  connectionType_(type)
 	{
 	}
 	virtual ~BoundMethodBase() = default;
@@ -78,14 +106,17 @@ public:
 
 	Object *object() const { return object_; }
 
+	bool connected() const { return connected_.load(std::memory_order_acquire); }
+	void disconnect() { connected_.store(false, std::memory_order_release); }
+
 	virtual void invokePack(BoundMethodPackBase *pack) = 0;
 
 protected:
-	bool activatePack(std::shared_ptr<BoundMethodPackBase> pack,
-			  bool deleteMethod);
+	bool activatePack(BoundMethodPackBase *pack, bool deleteMethod);
 
 	void *obj_;
 	Object *object_;
+	std::atomic<bool> connected_;
 
 private:
 	ConnectionType connectionType_;
@@ -145,9 +176,9 @@ public:
 		if (!this->object_)
 			return func_(args...);
 
-		auto pack = std::make_shared<PackType>(args...);
-		bool sync = BoundMethodBase::activatePack(pack, deleteMethod);
-		return sync ? pack->returnValue() : R();
+		PackType pack(args...);
+		bool sync = BoundMethodBase::activatePack(&pack, deleteMethod);
+		return sync ? pack.returnValue() : R();
 	}
 
 	R invoke(Args... args) override
@@ -180,9 +211,9 @@ public:
 			return (obj->*func_)(args...);
 		}
 
-		auto pack = std::make_shared<PackType>(args...);
-		bool sync = BoundMethodBase::activatePack(pack, deleteMethod);
-		return sync ? pack->returnValue() : R();
+		PackType pack(args...);
+		bool sync = BoundMethodBase::activatePack(&pack, deleteMethod);
+		return sync ? pack.returnValue() : R();
 	}
 
 	R invoke(Args... args) override
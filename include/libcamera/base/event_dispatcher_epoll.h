@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * event_dispatcher_epoll.h - Epoll-based event dispatcher
+ */
+
+#pragma once
+
+#include <map>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include <libcamera/base/private.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/utils.h>
+
+struct epoll_event;
+
+namespace libcamera {
+
+class EventNotifier;
+class Timer;
+
+class EventDispatcherEpoll final : public EventDispatcher
+{
+public:
+	EventDispatcherEpoll();
+	~EventDispatcherEpoll();
+
+	void registerEventNotifier(EventNotifier *notifier);
+	void unregisterEventNotifier(EventNotifier *notifier);
+
+	void registerTimer(Timer *timer);
+	void unregisterTimer(Timer *timer);
+
+	void processEvents();
+	void interrupt();
+
+private:
+	struct EventNotifierSetEpoll {
+		uint32_t events() const;
+		EventNotifier *notifiers[3];
+	};
+
+	using TimerMap = std::multimap<utils::time_point, Timer *>;
+
+	struct TimerEntry {
+		TimerMap::iterator deadline;
+		TimerMap::iterator wakeup;
+	};
+
+	void updateNotifiers(int fd, const EventNotifierSetEpoll &set, int op);
+	void processInterrupt();
+	void processNotifiers(const struct epoll_event &event);
+	void processTimers();
+	void armTimer();
+
+	std::unordered_map<int, EventNotifierSetEpoll> notifiers_;
+	std::vector<int> staleFds_;
+
+	TimerMap timers_;
+	TimerMap wakeups_;
+	std::unordered_map<Timer *, TimerEntry> timerEntries_;
+	utils::time_point armedDeadline_;
+
+	std::vector<struct epoll_event> events_;
+
+	int epollfd_;
+	int eventfd_;
+	int timerfd_;
+
+	bool processingEvents_;
+};
+
+} /* namespace libcamera */
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <list>
 #include <map>
 #include <vector>
@@ -14,6 +15,7 @@
 #include <libcamera/base/private.h>
 
 #include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/utils.h>
 
 struct pollfd;
 
@@ -37,6 +39,8 @@ public:
 	void processEvents();
 	void interrupt();
 
+	void setBusyPoll(utils::duration duration, unsigned int budget);
+
 private:
 	struct EventNotifierSetPoll {
 		short events() const;
@@ -44,6 +48,7 @@ private:
 	};
 
 	int poll(std::vector<struct pollfd> *pollfds);
+	int busyPoll(std::vector<struct pollfd> *pollfds, bool *woken);
 	void processInterrupt(const struct pollfd &pfd);
 	void processNotifiers(const std::vector<struct pollfd> &pollfds);
 	void processTimers();
@@ -53,6 +58,13 @@ private:
 	int eventfd_;
 
 	bool processingEvents_;
+
+	utils::duration busyPollDuration_;
+	utils::duration busyPollBudget_;
+	utils::duration busyPollSpent_;
+	utils::time_point busyPollWindowStart_;
+	std::atomic<int> busyPollState_;
+	bool active_;
 };
 
 } /* namespace libcamera */
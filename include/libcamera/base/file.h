@@ -26,6 +26,10 @@ public:
 	enum class MapFlag {
 		NoOption = 0,
 		Private = (1 << 0),
+		Populate = (1 << 1),
+		Sequential = (1 << 2),
+		WillNeed = (1 << 3),
+		HugePages = (1 << 4),
 	};
 
 	using MapFlags = Flags<MapFlag>;
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * global_configuration.h - System-wide libcamera configuration
+ */
+
+#pragma once
+
+#include <istream>
+#include <map>
+#include <string>
+
+#include <libcamera/base/private.h>
+
+namespace libcamera {
+
+class GlobalConfiguration
+{
+public:
+	static const char *option(const char *name);
+
+	static const GlobalConfiguration &instance();
+
+	const std::string &path() const { return path_; }
+	const std::string &profile() const { return profile_; }
+	const std::string &error() const { return error_; }
+
+private:
+	GlobalConfiguration();
+
+	int parse(std::istream &file, std::map<std::string, std::string> *values);
+
+	std::string path_;
+	std::string profile_;
+	std::string error_;
+
+	std::map<std::string, std::string> options_;
+};
+
+} /* namespace libcamera */
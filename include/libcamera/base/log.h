@@ -7,7 +7,11 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <memory>
+#include <ostream>
+#include <stdint.h>
 #include <sstream>
 
 #include <libcamera/base/private.h>
@@ -62,20 +66,20 @@ public:
 	LogMessage(LogMessage &&);
 	~LogMessage();
 
-	std::ostream &stream() { return msgStream_; }
+	std::ostream &stream() { return *msgStream_; }
 
 	const utils::time_point &timestamp() const { return timestamp_; }
 	LogSeverity severity() const { return severity_; }
 	const LogCategory &category() const { return category_; }
 	const std::string &fileInfo() const { return fileInfo_; }
-	const std::string msg() const { return msgStream_.str(); }
+	const std::string msg() const { return msgStream_->str(); }
 
 private:
 	LIBCAMERA_DISABLE_COPY(LogMessage)
 
 	void init(const char *fileName, unsigned int line);
 
-	std::ostringstream msgStream_;
+	std::unique_ptr<std::ostringstream> msgStream_;
 	const LogCategory &category_;
 	LogSeverity severity_;
 	utils::time_point timestamp_;
@@ -99,13 +103,63 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
 		const char *fileName = __builtin_FILE(),
 		unsigned int line = __builtin_LINE());
 
+class LogRateLimiter
+{
+public:
+	static constexpr unsigned int kBurst = 10;
+	static constexpr std::chrono::seconds kInterval{ 5 };
+
+	struct Summary {
+		unsigned int suppressed;
+	};
+
+	constexpr LogRateLimiter()
+		: windowStart_(0), count_(0), suppressed_(0)
+	{
+	}
+
+	bool check();
+	static Summary summary();
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(LogRateLimiter)
+
+	std::atomic<int64_t> windowStart_;
+	std::atomic<unsigned int> count_;
+	std::atomic<unsigned int> suppressed_;
+};
+
+std::ostream &operator<<(std::ostream &out, const LogRateLimiter::Summary &summary);
+
 #ifndef __DOXYGEN__
+class LogVoidify
+{
+public:
+	void operator&(std::ostream &) {}
+};
+
 #define _LOG_CATEGORY(name) logCategory##name
 
+#ifdef LIBCAMERA_LOG_NO_DEBUG
+#define _LOG_MIN_SEVERITY LogInfo
+#else
+#define _LOG_MIN_SEVERITY LogDebug
+#endif
+
+/*
+ * Check the severity before creating the message, to skip formatting the
+ * message operands when it would be discarded. Severities below the build
+ * minimum are compiled out.
+ */
+#define _LOG_ENABLED(cat, sev) \
+	((sev) >= _LOG_MIN_SEVERITY && (sev) >= (cat).severity())
+
 #define _LOG1(severity) \
-	_log(nullptr, Log##severity).stream()
+	!_LOG_ENABLED(LogCategory::defaultCategory(), Log##severity) ? (void)0 : \
+	LogVoidify() & _log(nullptr, Log##severity).stream()
 #define _LOG2(category, severity) \
-	_log(&_LOG_CATEGORY(category)(), Log##severity).stream()
+	!_LOG_ENABLED(_LOG_CATEGORY(category)(), Log##severity) ? (void)0 : \
+	LogVoidify() & _log(&_LOG_CATEGORY(category)(), Log##severity).stream()
 
 /*
  * Expand the LOG() macro to _LOG1() or _LOG2() based on the number of
@@ -113,8 +167,30 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
  */
 #define _LOG_MACRO(_1, _2, NAME, ...) NAME
 #define LOG(...) _LOG_MACRO(__VA_ARGS__, _LOG2, _LOG1)(__VA_ARGS__)
+
+/*
+ * Each expansion of the lambda has a distinct type, and thus its own rate
+ * limiter, shared by all the threads logging from the call site.
+ */
+#define _LOG_RATELIMITER() \
+	([]() -> LogRateLimiter & { static LogRateLimiter limiter; return limiter; }())
+
+#define _LOG_RATELIMITED1(severity) \
+	!_LOG_ENABLED(LogCategory::defaultCategory(), Log##severity) || \
+	!_LOG_RATELIMITER().check() ? (void)0 : \
+	LogVoidify() & _log(nullptr, Log##severity).stream() \
+	<< LogRateLimiter::summary()
+#define _LOG_RATELIMITED2(category, severity) \
+	!_LOG_ENABLED(_LOG_CATEGORY(category)(), Log##severity) || \
+	!_LOG_RATELIMITER().check() ? (void)0 : \
+	LogVoidify() & _log(&_LOG_CATEGORY(category)(), Log##severity).stream() \
+	<< LogRateLimiter::summary()
+
+#define LOG_RATELIMITED(...) \
+	_LOG_MACRO(__VA_ARGS__, _LOG_RATELIMITED2, _LOG_RATELIMITED1)(__VA_ARGS__)
 #else /* __DOXYGEN___ */
 #define LOG(category, severity)
+#define LOG_RATELIMITED(category, severity)
 #endif /* __DOXYGEN__ */
 
 #ifndef NDEBUG
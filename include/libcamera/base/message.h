@@ -8,12 +8,15 @@
 #pragma once
 
 #include <atomic>
+#include <cstddef>
+#include <memory>
 
 #include <libcamera/base/bound_method.h>
 
 namespace libcamera {
 
 class BoundMethodBase;
+class MessageQueue;
 class Object;
 class Semaphore;
 class Thread;
@@ -38,10 +41,16 @@ public:
 	static Type registerMessageType();
 
 private:
+	friend class MessageQueue;
 	friend class Thread;
 
 	Type type_;
 	Object *receiver_;
+	Message *next_;
+
+	Message *receiverPrev_;
+	Message *receiverNext_;
+	std::unique_ptr<Message> *slot_;
 
 	static std::atomic_uint nextUserType_;
 };
@@ -49,21 +58,27 @@ private:
 class InvokeMessage : public Message
 {
 public:
-	InvokeMessage(BoundMethodBase *method,
-		      std::shared_ptr<BoundMethodPackBase> pack,
+	static constexpr std::size_t kInlinePackSize = 128;
+
+	InvokeMessage(BoundMethodBase *method, BoundMethodPackBase *pack,
 		      Semaphore *semaphore = nullptr,
 		      bool deleteMethod = false);
 	~InvokeMessage();
 
+	static void *operator new(std::size_t size);
+	static void operator delete(void *ptr, std::size_t size);
+
 	Semaphore *semaphore() const { return semaphore_; }
 
 	void invoke();
 
 private:
 	BoundMethodBase *method_;
-	std::shared_ptr<BoundMethodPackBase> pack_;
+	BoundMethodPackBase *pack_;
 	Semaphore *semaphore_;
 	bool deleteMethod_;
+
+	alignas(std::max_align_t) unsigned char packStorage_[kInlinePackSize];
 };
 
 } /* namespace libcamera */
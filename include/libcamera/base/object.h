@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <list>
 #include <memory>
 #include <vector>
@@ -16,6 +17,7 @@
 namespace libcamera {
 
 class Message;
+class MessageQueue;
 template<typename... Args>
 class Signal;
 class SignalBase;
@@ -50,6 +52,7 @@ protected:
 	virtual void message(Message *msg);
 
 private:
+	friend class MessageQueue;
 	friend class SignalBase;
 	friend class Thread;
 
@@ -63,7 +66,9 @@ private:
 
 	Thread *thread_;
 	std::list<SignalBase *> signals_;
-	unsigned int pendingMessages_;
+	std::atomic<unsigned int> pendingMessages_;
+	Message *queuedMessagesHead_;
+	Message *queuedMessagesTail_;
 };
 
 } /* namespace libcamera */
@@ -8,7 +8,7 @@
 #pragma once
 
 #include <functional>
-#include <list>
+#include <memory>
 #include <type_traits>
 #include <vector>
 
@@ -23,15 +23,15 @@ public:
 	void disconnect(Object *object);
 
 protected:
-	using SlotList = std::list<BoundMethodBase *>;
+	using SlotList = std::vector<std::shared_ptr<BoundMethodBase>>;
 
 	void connect(BoundMethodBase *slot);
-	void disconnect(std::function<bool(SlotList::iterator &)> match);
+	void disconnect(std::function<bool(BoundMethodBase *)> match);
 
-	SlotList slots();
+	std::shared_ptr<const SlotList> slots() const;
 
 private:
-	SlotList slots_;
+	std::shared_ptr<const SlotList> slots_;
 };
 
 template<typename... Args>
@@ -88,7 +88,7 @@ public:
 
 	void disconnect()
 	{
-		SignalBase::disconnect([]([[maybe_unused]] SlotList::iterator &iter) {
+		SignalBase::disconnect([]([[maybe_unused]] BoundMethodBase *slot) {
 			return true;
 		});
 	}
@@ -96,18 +96,15 @@ public:
 	template<typename T>
 	void disconnect(T *obj)
 	{
-		SignalBase::disconnect([obj](SlotList::iterator &iter) {
-			return (*iter)->match(obj);
+		SignalBase::disconnect([obj](BoundMethodBase *slot) {
+			return slot->match(obj);
 		});
 	}
 
 	template<typename T, typename R>
 	void disconnect(T *obj, R (T::*func)(Args...))
 	{
-		SignalBase::disconnect([obj, func](SlotList::iterator &iter) {
-			BoundMethodArgs<R, Args...> *slot =
-				static_cast<BoundMethodArgs<R, Args...> *>(*iter);
-
+		SignalBase::disconnect([obj, func](BoundMethodBase *slot) {
 			if (!slot->match(obj))
 				return false;
 
@@ -117,32 +114,45 @@ public:
 			 * cast it to BoundMethodMember<T, Args...> to match
 			 * func.
 			 */
-			return static_cast<BoundMethodMember<T, R, Args...> *>(slot)->match(func);
+			return static_cast<BoundMethodMember<T, R, Args...> *>(
+				static_cast<BoundMethodArgs<R, Args...> *>(slot))->match(func);
 		});
 	}
 
 	template<typename R>
 	void disconnect(R (*func)(Args...))
 	{
-		SignalBase::disconnect([func](SlotList::iterator &iter) {
-			BoundMethodArgs<R, Args...> *slot =
-				static_cast<BoundMethodArgs<R, Args...> *>(*iter);
-
+		SignalBase::disconnect([func](BoundMethodBase *slot) {
 			if (!slot->match(nullptr))
 				return false;
 
-			return static_cast<BoundMethodStatic<R, Args...> *>(slot)->match(func);
+			return static_cast<BoundMethodStatic<R, Args...> *>(
+				static_cast<BoundMethodArgs<R, Args...> *>(slot))->match(func);
 		});
 	}
 
 	void emit(Args... args)
 	{
 		/*
-		 * Make a copy of the slots list as the slot could call the
-		 * disconnect operation, invalidating the iterator.
+		 * The slots list is never modified in place, connect() and
+		 * disconnect() replace it with a new list. Holding a reference
+		 * to the current list keeps it valid even if a slot connects
+		 * or disconnects the signal.
 		 */
-		for (BoundMethodBase *slot : slots())
-			static_cast<BoundMethodArgs<void, Args...> *>(slot)->activate(args...);
+		std::shared_ptr<const SlotList> slots = SignalBase::slots();
+		if (!slots)
+			return;
+
+		for (const std::shared_ptr<BoundMethodBase> &slot : *slots) {
+			/*
+			 * Skip the slots disconnected by a previous slot, their
+			 * receiver may have been deleted.
+			 */
+			if (!slot->connected())
+				continue;
+
+			static_cast<BoundMethodArgs<void, Args...> *>(slot.get())->activate(args...);
+		}
 	}
 };
 
@@ -9,8 +9,10 @@
 
 #include <memory>
 #include <mutex>
+#include <string>
 #include <sys/types.h>
 #include <thread>
+#include <vector>
 
 #include <libcamera/base/private.h>
 
@@ -32,6 +34,12 @@ using MutexLocker = std::unique_lock<std::mutex>;
 class Thread
 {
 public:
+	enum class SchedulingPolicy {
+		Default,
+		Normal,
+		Fifo,
+	};
+
 	Thread();
 	virtual ~Thread();
 
@@ -41,12 +49,20 @@ public:
 
 	bool isRunning();
 
+	void setName(const std::string &name);
+	std::string name() const;
+	void setCpuAffinity(const std::vector<unsigned int> &cpus);
+	void setScheduling(SchedulingPolicy policy, int priority);
+
+	static void setCurrentName(const std::string &name);
+
 	Signal<> finished;
 
 	static Thread *current();
 	static pid_t currentId();
 
 	EventDispatcher *eventDispatcher();
+	void setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher);
 
 	void dispatchMessages(Message::Type type = Message::Type::None);
 
@@ -55,6 +71,8 @@ protected:
 	virtual void run();
 
 private:
+	static EventDispatcher *createEventDispatcher();
+
 	void startThread();
 	void finishThread();
 
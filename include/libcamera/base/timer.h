@@ -33,6 +33,9 @@ public:
 
 	std::chrono::steady_clock::time_point deadline() const { return deadline_; }
 
+	void setSlack(std::chrono::microseconds slack) { slack_ = slack; }
+	std::chrono::microseconds slack() const { return slack_; }
+
 	Signal<> timeout;
 
 protected:
@@ -44,6 +47,7 @@ private:
 
 	bool running_;
 	std::chrono::steady_clock::time_point deadline_;
+	std::chrono::microseconds slack_;
 };
 
 } /* namespace libcamera */
@@ -7,16 +7,21 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <set>
+#include <stddef.h>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include <libcamera/base/class.h>
 #include <libcamera/base/object.h>
 #include <libcamera/base/signal.h>
+#include <libcamera/base/span.h>
 
 #include <libcamera/controls.h>
+#include <libcamera/geometry.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 #include <libcamera/transform.h>
@@ -65,13 +70,27 @@ public:
 	std::size_t size() const;
 
 	Transform transform;
+	bool keepAllocations;
+	unsigned int pipelineDepth;
+	unsigned int zslFrames;
+	int64_t minFrameDuration;
+	Rectangle sensorCrop;
 
 protected:
 	CameraConfiguration();
 
+	static bool resetBufferConstraints(StreamConfiguration *cfg);
+
 	std::vector<StreamConfiguration> config_;
 };
 
+struct BufferPoolUsage {
+	std::string name;
+	const Stream *stream;
+	unsigned int count;
+	size_t size;
+};
+
 class Camera final : public Object, public std::enable_shared_from_this<Camera>,
 		     public Extensible
 {
@@ -85,9 +104,15 @@ public:
 	const std::string &id() const;
 
 	Signal<Request *, FrameBuffer *> bufferCompleted;
+	Signal<Request *, const ControlList &> metadataAvailable;
 	Signal<Request *> requestCompleted;
+	Signal<Span<Request *const>> requestsCompleted;
 	Signal<> disconnected;
 
+	Signal<int> configureCompleted;
+	Signal<int> startCompleted;
+	Signal<int> stopCompleted;
+
 	int acquire();
 	int release();
 
@@ -95,14 +120,26 @@ public:
 	const ControlList &properties() const;
 
 	const std::set<Stream *> &streams() const;
+	std::vector<BufferPoolUsage> bufferUsage() const;
+
 	std::unique_ptr<CameraConfiguration> generateConfiguration(const StreamRoles &roles = {});
 	int configure(CameraConfiguration *config);
+	int configureAsync(CameraConfiguration *config);
 
 	std::unique_ptr<Request> createRequest(uint64_t cookie = 0);
 	int queueRequest(Request *request);
+	int queueRequests(Span<Request *const> requests);
+
+	int setRequestBatching(unsigned int count,
+			       std::chrono::microseconds window = {});
+	int completionFd();
+	int setCompletionQueueDepth(unsigned int depth);
+	std::vector<Request *> takeCompletedRequests();
 
 	int start(const ControlList *controls = nullptr);
+	int startAsync(const ControlList *controls = nullptr);
 	int stop();
+	int stopAsync();
 
 private:
 	LIBCAMERA_DISABLE_COPY(Camera)
@@ -114,6 +151,11 @@ private:
 	friend class PipelineHandler;
 	void disconnect();
 	void requestComplete(Request *request);
+	void flushCompletedRequests();
+
+	void configureAsyncHandler(CameraConfiguration *config);
+	void startAsyncHandler(const ControlList &controls);
+	void stopAsyncHandler();
 
 	friend class FrameBufferAllocator;
 	int exportFrameBuffers(Stream *stream,
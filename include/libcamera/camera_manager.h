@@ -38,6 +38,8 @@ public:
 		       const std::vector<dev_t> &devnums);
 	void removeCamera(std::shared_ptr<Camera> camera);
 
+	std::string metrics() const;
+
 	static const std::string &version() { return version_; }
 
 	Signal<std::shared_ptr<Camera>> cameraAdded;
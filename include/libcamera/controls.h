@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <libcamera/base/class.h>
@@ -127,6 +128,9 @@ public:
 	ControlValue(const ControlValue &other);
 	ControlValue &operator=(const ControlValue &other);
 
+	ControlValue(ControlValue &&other) noexcept;
+	ControlValue &operator=(ControlValue &&other) noexcept;
+
 	ControlType type() const { return type_; }
 	bool isNone() const { return type_ == ControlTypeNone; }
 	bool isArray() const { return isArray_; }
@@ -196,11 +200,13 @@ public:
 		     std::size_t numElements = 1);
 
 private:
+	static constexpr std::size_t kInlineStorageSize = 40;
+
 	ControlType type_ : 8;
 	bool isArray_;
 	std::size_t numElements_ : 32;
 	union {
-		uint64_t value_;
+		alignas(uint64_t) uint8_t value_[kInlineStorageSize];
 		void *storage_;
 	};
 
@@ -299,7 +305,50 @@ private:
 	std::vector<ControlValue> values_;
 };
 
-using ControlIdMap = std::unordered_map<unsigned int, const ControlId *>;
+class ControlIdMap : private std::unordered_map<unsigned int, const ControlId *>
+{
+public:
+	using Map = std::unordered_map<unsigned int, const ControlId *>;
+
+	ControlIdMap() = default;
+	ControlIdMap(std::initializer_list<Map::value_type> init);
+
+	using Map::key_type;
+	using Map::mapped_type;
+	using Map::value_type;
+	using Map::size_type;
+	using Map::const_iterator;
+
+	using Map::cbegin;
+	using Map::cend;
+	using Map::empty;
+	using Map::size;
+
+	const_iterator begin() const { return Map::begin(); }
+	const_iterator end() const { return Map::end(); }
+	const_iterator find(unsigned int id) const { return Map::find(id); }
+
+	const ControlId *lookup(unsigned int id) const
+	{
+		if (id < dense_.size())
+			return dense_[id];
+		if (id < kMaxDenseId)
+			return nullptr;
+
+		auto it = Map::find(id);
+		return it != Map::end() ? it->second : nullptr;
+	}
+
+	const ControlId *at(unsigned int id) const;
+	size_type count(unsigned int id) const { return lookup(id) ? 1 : 0; }
+
+	void set(unsigned int id, const ControlId *control);
+
+private:
+	static constexpr unsigned int kMaxDenseId = 1024;
+
+	std::vector<const ControlId *> dense_;
+};
 
 class ControlInfoMap : private std::unordered_map<const ControlId *, ControlInfo>
 {
@@ -348,7 +397,7 @@ private:
 class ControlList
 {
 private:
-	using ControlListMap = std::unordered_map<unsigned int, ControlValue>;
+	using ControlListMap = std::vector<std::pair<unsigned int, ControlValue>>;
 
 public:
 	ControlList();
@@ -412,6 +461,8 @@ private:
 	const ControlValue *find(unsigned int id) const;
 	ControlValue *find(unsigned int id);
 
+	ControlListMap::const_iterator lookup(unsigned int id) const;
+
 	const ControlValidator *validator_;
 	const ControlIdMap *idmap_;
 	const ControlInfoMap *infoMap_;
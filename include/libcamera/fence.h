@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * fence.h - Synchronization fence
+ */
+
+#pragma once
+
+#include <libcamera/base/class.h>
+
+#include <libcamera/file_descriptor.h>
+
+namespace libcamera {
+
+class Fence
+{
+public:
+	explicit Fence(FileDescriptor fd);
+
+	bool isValid() const { return fd_.isValid(); }
+	const FileDescriptor &fd() const { return fd_; }
+
+	FileDescriptor release() { return std::move(fd_); }
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(Fence)
+
+	FileDescriptor fd_;
+};
+
+} /* namespace libcamera */
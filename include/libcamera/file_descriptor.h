@@ -7,7 +7,7 @@
 
 #pragma once
 
-#include <memory>
+#include <atomic>
 #include <sys/types.h>
 
 namespace libcamera {
@@ -18,17 +18,18 @@ public:
 	explicit FileDescriptor(const int &fd = -1);
 	explicit FileDescriptor(int &&fd);
 	FileDescriptor(const FileDescriptor &other);
-	FileDescriptor(FileDescriptor &&other);
+	FileDescriptor(FileDescriptor &&other) noexcept;
 	~FileDescriptor();
 
 	FileDescriptor &operator=(const FileDescriptor &other);
-	FileDescriptor &operator=(FileDescriptor &&other);
+	FileDescriptor &operator=(FileDescriptor &&other) noexcept;
 
 	bool isValid() const { return fd_ != nullptr; }
 	int fd() const { return fd_ ? fd_->fd() : -1; }
 	FileDescriptor dup() const;
 
 	ino_t inode() const;
+	static ino_t inode(int fd);
 
 private:
 	class Descriptor
@@ -38,12 +39,20 @@ private:
 		~Descriptor();
 
 		int fd() const { return fd_; }
+		ino_t inode();
+
+		void ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+		bool unref() { return refs_.fetch_sub(1, std::memory_order_acq_rel) == 1; }
 
 	private:
 		int fd_;
+		std::atomic<unsigned int> refs_;
+		std::atomic<ino_t> inode_;
 	};
 
-	std::shared_ptr<Descriptor> fd_;
+	void release();
+
+	Descriptor *fd_;
 };
 
 } /* namespace libcamera */
@@ -7,8 +7,10 @@
 
 #pragma once
 
+#include <array>
 #include <assert.h>
 #include <limits>
+#include <memory>
 #include <stdint.h>
 #include <vector>
 
@@ -19,9 +21,12 @@
 
 namespace libcamera {
 
+class Fence;
 class Request;
 
 struct FrameMetadata {
+	static constexpr unsigned int kMaxPlanes = 4;
+
 	enum Status {
 		FrameSuccess,
 		FrameError,
@@ -35,14 +40,16 @@ struct FrameMetadata {
 	Status status;
 	unsigned int sequence;
 	uint64_t timestamp;
+	unsigned int discarded;
 
-	Span<Plane> planes() { return planes_; }
-	Span<const Plane> planes() const { return planes_; }
+	Span<Plane> planes() { return { planes_.data(), numPlanes_ }; }
+	Span<const Plane> planes() const { return { planes_.data(), numPlanes_ }; }
 
 private:
 	friend class FrameBuffer;
 
-	std::vector<Plane> planes_;
+	std::array<Plane, kMaxPlanes> planes_ = {};
+	unsigned int numPlanes_ = 0;
 };
 
 class FrameBuffer final : public Extensible
@@ -57,7 +64,7 @@ public:
 		unsigned int length;
 	};
 
-	FrameBuffer(const std::vector<Plane> &planes, unsigned int cookie = 0);
+	FrameBuffer(std::vector<Plane> planes, unsigned int cookie = 0);
 
 	const std::vector<Plane> &planes() const { return planes_; }
 	Request *request() const;
@@ -66,6 +73,8 @@ public:
 	unsigned int cookie() const { return cookie_; }
 	void setCookie(unsigned int cookie) { cookie_ = cookie; }
 
+	std::unique_ptr<Fence> releaseFence();
+
 	void cancel() { metadata_.status = FrameMetadata::FrameCancelled; }
 
 private:
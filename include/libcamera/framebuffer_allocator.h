@@ -22,10 +22,16 @@ class Stream;
 class FrameBufferAllocator
 {
 public:
+	enum class Heap {
+		Cma,
+		System,
+	};
+
 	FrameBufferAllocator(std::shared_ptr<Camera> camera);
 	~FrameBufferAllocator();
 
 	int allocate(Stream *stream);
+	int allocate(Stream *stream, Heap heap, unsigned int count = 0);
 	int free(Stream *stream);
 
 	bool allocated() const { return !buffers_.empty(); }
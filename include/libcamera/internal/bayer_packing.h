@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * bayer_packing.h - Conversion of raw Bayer lines between packings
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "libcamera/internal/bayer_format.h"
+
+namespace libcamera {
+
+namespace bayer {
+
+unsigned int lineSize(const BayerFormat &format, unsigned int width);
+
+int unpackLine(const BayerFormat &format, const uint8_t *src, uint16_t *dst,
+	       unsigned int width);
+int unpackLineMsb8(const BayerFormat &format, const uint8_t *src, uint8_t *dst,
+		   unsigned int width);
+int packLine(const BayerFormat &format, const uint16_t *src, uint8_t *dst,
+	     unsigned int width);
+
+} /* namespace bayer */
+
+} /* namespace libcamera */
@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <type_traits>
+#include <vector>
 
 #include <libcamera/base/class.h>
 #include <libcamera/base/span.h>
@@ -21,11 +22,12 @@ class ByteStreamBuffer
 public:
 	ByteStreamBuffer(const uint8_t *base, size_t size);
 	ByteStreamBuffer(uint8_t *base, size_t size);
+	ByteStreamBuffer(std::vector<uint8_t> &storage);
 	ByteStreamBuffer(ByteStreamBuffer &&other);
 	ByteStreamBuffer &operator=(ByteStreamBuffer &&other);
 
-	const uint8_t *base() const { return base_; }
-	uint32_t offset() const { return (write_ ? write_ : read_) - base_; }
+	const uint8_t *base() const;
+	uint32_t offset() const { return offset_; }
 	size_t size() const { return size_; }
 	bool overflow() const { return overflow_; }
 
@@ -69,6 +71,8 @@ private:
 	LIBCAMERA_DISABLE_COPY(ByteStreamBuffer)
 
 	void setOverflow();
+	bool reserve(size_t size);
+	uint8_t *writeLocation();
 
 	int read(uint8_t *data, size_t size);
 	const uint8_t *read(size_t size, size_t count);
@@ -77,11 +81,14 @@ private:
 	ByteStreamBuffer *parent_;
 
 	const uint8_t *base_;
+	std::vector<uint8_t> *storage_;
+	size_t start_;
 	size_t size_;
+	size_t offset_;
 	bool overflow_;
 
-	const uint8_t *read_;
-	uint8_t *write_;
+	bool write_;
+	bool growable_;
 };
 
 } /* namespace libcamera */
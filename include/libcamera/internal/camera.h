@@ -7,20 +7,32 @@
 
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <list>
 #include <memory>
+#include <queue>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <libcamera/base/class.h>
+#include <libcamera/base/span.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
 
 #include <libcamera/camera.h>
 
+#include "libcamera/internal/camera_configuration_cache.h"
+#include "libcamera/internal/metrics.h"
+
 namespace libcamera {
 
 class CameraControlValidator;
+class FrameBuffer;
 class PipelineHandler;
+class SessionRecorder;
 class Stream;
 
 class Camera::Private : public Extensible::Private
@@ -34,13 +46,44 @@ public:
 	PipelineHandler *pipe() { return pipe_.get(); }
 
 	std::list<Request *> queuedRequests_;
+	std::queue<Request *> waitingRequests_;
 	ControlInfoMap controlInfo_;
 	ControlList properties_;
 
 	uint32_t requestSequence_;
 
+	const std::vector<Request *> &takePendingRequests();
+	int validateBufferAllocation(const Stream *stream) const;
+
+	void setBufferPool(const std::string &name, const Stream *stream,
+			   unsigned int count, size_t size);
+	void setBufferPool(const std::string &name, const Stream *stream,
+			   const std::vector<std::unique_ptr<FrameBuffer>> &buffers);
+	void clearBufferPool(const std::string &name, const Stream *stream = nullptr);
+	std::vector<BufferPoolUsage> bufferPools() const;
+
 	const CameraControlValidator *validator() const { return validator_.get(); }
 
+	CameraConfigurationCache *configurationCache() const { return &configurationCache_; }
+
+	struct Metrics {
+		Metrics(const std::string &id);
+
+		MetricCounter requestsQueued;
+		MetricCounter requestsCompleted;
+		MetricCounter requestsCancelled;
+		MetricCounter framesDropped;
+		MetricCounter requestsDiscarded;
+		MetricGauge requestsInFlight;
+		MetricHistogram requestLatency;
+	};
+
+	Metrics *metrics() const { return metrics_.get(); }
+
+	static constexpr unsigned int kLatencyStages = 4;
+	void recordLatencies(const std::array<int64_t, kLatencyStages> &latencies);
+	void reportLatencies();
+
 private:
 	enum State {
 		CameraAvailable,
@@ -60,6 +103,10 @@ private:
 	void disconnect();
 	void setState(State state);
 
+	int validateRequest(const Request *request) const;
+	void queuePendingRequests(Span<Request *const> requests);
+	std::vector<Request *> trimCompletedQueue();
+
 	std::shared_ptr<PipelineHandler> pipe_;
 	std::string id_;
 	std::set<Stream *> streams_;
@@ -69,6 +116,30 @@ private:
 	std::atomic<State> state_;
 
 	std::unique_ptr<CameraControlValidator> validator_;
+	std::unique_ptr<Metrics> metrics_;
+
+	std::atomic<Request *> pendingRequests_;
+	std::vector<Request *> takenRequests_;
+
+	std::array<std::vector<int64_t>, kLatencyStages> latencySamples_;
+	unsigned int latencyIndex_;
+
+	unsigned int batchCount_;
+	std::chrono::microseconds batchWindow_;
+	std::vector<Request *> completedBatch_;
+	Timer batchTimer_;
+
+	Mutex completedLock_;
+	std::vector<Request *> completedQueue_;
+	unsigned int completionQueueDepth_;
+	int completionFd_;
+
+	std::unique_ptr<SessionRecorder> recorder_;
+
+	mutable Mutex bufferPoolsLock_;
+	std::vector<BufferPoolUsage> bufferPools_;
+
+	mutable CameraConfigurationCache configurationCache_;
 };
 
 } /* namespace libcamera */
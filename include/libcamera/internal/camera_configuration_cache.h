@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera_configuration_cache.h - Cache of validated camera configurations
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <string>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/thread.h>
+
+#include <libcamera/camera.h>
+
+namespace libcamera {
+
+class CameraConfigurationCache
+{
+public:
+	static constexpr unsigned int kDefaultSize = 16;
+
+	CameraConfigurationCache(unsigned int size = kDefaultSize);
+
+	template<typename T, typename Func>
+	CameraConfiguration::Status validate(T *config, Func &&func)
+	{
+		std::string key = CameraConfigurationCache::key(*config);
+
+		{
+			MutexLocker locker(mutex_);
+
+			const Entry *entry = find(key);
+			if (entry) {
+				*config = static_cast<const T &>(*entry->config);
+				return entry->status;
+			}
+		}
+
+		CameraConfiguration::Status status = func();
+		store(key, std::make_unique<T>(*config), status);
+
+		return status;
+	}
+
+	void clear();
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(CameraConfigurationCache)
+
+	struct Entry {
+		std::string key;
+		std::unique_ptr<CameraConfiguration> config;
+		CameraConfiguration::Status status;
+	};
+
+	static std::string key(const CameraConfiguration &config);
+
+	const Entry *find(const std::string &key);
+	void store(const std::string &key,
+		   std::unique_ptr<CameraConfiguration> config,
+		   CameraConfiguration::Status status);
+
+	unsigned int size_;
+
+	Mutex mutex_;
+	std::list<Entry> entries_;
+};
+
+} /* namespace libcamera */
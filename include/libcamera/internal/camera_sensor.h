@@ -7,12 +7,14 @@
 
 #pragma once
 
+#include <limits.h>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include <libcamera/base/class.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
 
 #include <libcamera/controls.h>
 #include <libcamera/geometry.h>
@@ -46,9 +48,17 @@ public:
 	}
 
 	V4L2SubdeviceFormat getFormat(const std::vector<unsigned int> &mbusCodes,
-				      const Size &size) const;
+				      const Size &size,
+				      utils::Duration frameDuration = {}) const;
+	utils::Duration minFrameDuration(const Size &size) const;
 	int setFormat(V4L2SubdeviceFormat *format);
 
+	bool supportsEmbeddedData() const { return embeddedDataPad_ != UINT_MAX; }
+	int embeddedDataFormat(V4L2SubdeviceFormat *format) const;
+
+	bool supportsAnalogCrop() const { return analogCropSupported_; }
+	int setAnalogCrop(Rectangle *crop);
+
 	const ControlInfoMap &controls() const;
 	ControlList getControls(const std::vector<uint32_t> &ids);
 	int setControls(ControlList *ctrls);
@@ -77,6 +87,7 @@ private:
 	const MediaEntity *entity_;
 	std::unique_ptr<V4L2Subdevice> subdev_;
 	unsigned int pad_;
+	unsigned int embeddedDataPad_;
 
 	std::string model_;
 	std::string id_;
@@ -88,6 +99,7 @@ private:
 
 	Size pixelArraySize_;
 	Rectangle activeArea_;
+	bool analogCropSupported_;
 	const BayerFormat *bayerFormat_;
 
 	ControlList properties_;
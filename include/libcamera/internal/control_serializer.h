@@ -9,6 +9,7 @@
 
 #include <map>
 #include <memory>
+#include <stdint.h>
 #include <vector>
 
 #include <libcamera/controls.h>
@@ -41,6 +42,14 @@ public:
 	bool isCached(const ControlInfoMap &infoMap);
 
 private:
+	struct ListState {
+		uint32_t sequence = 0;
+		ControlList list;
+	};
+
+	static uint32_t listKey(uint32_t handle, uint32_t idMapType);
+	static bool isInline(const ControlValue &value);
+
 	static size_t binarySize(const ControlValue &value);
 	static size_t binarySize(const ControlInfo &info);
 
@@ -57,6 +66,10 @@ private:
 	std::vector<std::unique_ptr<ControlIdMap>> controlIdMaps_;
 	std::map<unsigned int, ControlInfoMap> infoMaps_;
 	std::map<const ControlInfoMap *, unsigned int> infoMapHandles_;
+
+	std::map<uint32_t, ListState> sentLists_;
+	std::map<uint32_t, ListState> receivedLists_;
+	std::vector<std::pair<unsigned int, const ControlValue *>> delta_;
 };
 
 } /* namespace libcamera */
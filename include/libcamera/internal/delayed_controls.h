@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 #include <unordered_map>
+#include <vector>
 
 #include <libcamera/controls.h>
 
@@ -27,6 +28,9 @@ public:
 	DelayedControls(V4L2Device *device,
 			const std::unordered_map<uint32_t, ControlParams> &controlParams);
 
+	int addDevice(V4L2Device *device,
+		      const std::unordered_map<uint32_t, ControlParams> &controlParams);
+
 	void reset();
 
 	bool push(const ControlList &controls);
@@ -67,9 +71,25 @@ private:
 		}
 	};
 
-	V4L2Device *device_;
-	/* \todo Evaluate if we should index on ControlId * or unsigned int */
-	std::unordered_map<const ControlId *, ControlParams> controlParams_;
+	struct Control {
+		const ControlId *id;
+		ControlParams params;
+		unsigned int device;
+		ControlRingBuffer values;
+	};
+
+	struct Device {
+		V4L2Device *device;
+		ControlList batch;
+	};
+
+	unsigned int registerControls(unsigned int device,
+				      const std::unordered_map<uint32_t, ControlParams> &controlParams);
+
+	std::vector<Device> devices_;
+	std::vector<Control> controls_;
+	/* Map of the numerical V4L2 control ids to their index in controls_ */
+	std::unordered_map<unsigned int, unsigned int> indices_;
 	unsigned int maxDelay_;
 
 	bool running_;
@@ -77,8 +97,6 @@ private:
 
 	uint32_t queueCount_;
 	uint32_t writeCount_;
-	/* \todo Evaluate if we should index on ControlId * or unsigned int */
-	std::unordered_map<const ControlId *, ControlRingBuffer> values_;
 };
 
 } /* namespace libcamera */
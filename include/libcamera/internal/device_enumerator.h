@@ -7,11 +7,13 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include <libcamera/base/signal.h>
+#include <libcamera/base/timer.h>
 
 namespace libcamera {
 
@@ -36,6 +38,7 @@ class DeviceEnumerator
 public:
 	static std::unique_ptr<DeviceEnumerator> create();
 
+	DeviceEnumerator();
 	virtual ~DeviceEnumerator();
 
 	virtual int init() = 0;
@@ -51,7 +54,12 @@ protected:
 	void removeDevice(const std::string &deviceNode);
 
 private:
+	static constexpr std::chrono::milliseconds kAddDelay{ 100 };
+
+	void addTimeout();
+
 	std::vector<std::shared_ptr<MediaDevice>> devices_;
+	Timer addTimer_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Raspberry Pi (Trading) Limited
+ *
+ * dma_heaps.h - Helper class for dma-heap allocations.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/flags.h>
+
+#include <libcamera/file_descriptor.h>
+
+namespace libcamera {
+
+class FrameBuffer;
+struct StreamConfiguration;
+
+class DmaHeap
+{
+public:
+	enum class DmaHeapFlag {
+		Cma = 1 << 0,
+		System = 1 << 1,
+	};
+
+	using DmaHeapFlags = Flags<DmaHeapFlag>;
+
+	DmaHeap(DmaHeapFlags type = DmaHeapFlag::Cma);
+	~DmaHeap();
+
+	static std::shared_ptr<DmaHeap> instance(DmaHeapFlags type = DmaHeapFlag::Cma);
+
+	bool isValid() const { return dmaHeapHandle_ > -1; }
+	FileDescriptor alloc(const char *name, std::size_t size);
+	std::unique_ptr<FrameBuffer> allocFrameBuffer(const char *name,
+						      const StreamConfiguration &cfg);
+	void release(FileDescriptor fd, std::size_t size);
+
+	void setRetentionLimit(std::size_t limit);
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(DmaHeap)
+
+	void trim(std::size_t limit);
+
+	int dmaHeapHandle_;
+
+	std::mutex lock_;
+	std::multimap<std::size_t, FileDescriptor> pool_;
+	std::size_t poolSize_;
+	std::size_t retentionLimit_;
+};
+
+LIBCAMERA_FLAGS_ENABLE_OPERATORS(DmaHeap::DmaHeapFlag)
+
+} /* namespace libcamera */
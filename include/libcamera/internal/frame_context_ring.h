@@ -0,0 +1,88 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * frame_context_ring.h - Fixed-capacity per-frame context storage
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+namespace libcamera {
+
+template<typename T>
+class FrameContextRing
+{
+public:
+	FrameContextRing(unsigned int capacity = 0)
+	{
+		reset(capacity);
+	}
+
+	void reset(unsigned int capacity)
+	{
+		slots_.clear();
+		slots_.resize(capacity);
+	}
+
+	void clear()
+	{
+		for (Slot &slot : slots_)
+			slot.used = false;
+	}
+
+	unsigned int capacity() const { return slots_.size(); }
+
+	T *alloc(unsigned int frame)
+	{
+		if (slots_.empty())
+			return nullptr;
+
+		Slot &slot = slots_[frame % slots_.size()];
+		if (slot.used)
+			return nullptr;
+
+		slot.frame = frame;
+		slot.used = true;
+
+		return &slot.context;
+	}
+
+	void release(unsigned int frame)
+	{
+		if (slots_.empty())
+			return;
+
+		Slot &slot = slots_[frame % slots_.size()];
+		if (slot.used && slot.frame == frame)
+			slot.used = false;
+	}
+
+	T *get(unsigned int frame)
+	{
+		if (slots_.empty())
+			return nullptr;
+
+		Slot &slot = slots_[frame % slots_.size()];
+		if (!slot.used || slot.frame != frame)
+			return nullptr;
+
+		return &slot.context;
+	}
+
+private:
+	LIBCAMERA_DISABLE_COPY(FrameContextRing)
+
+	struct Slot {
+		T context;
+		unsigned int frame = 0;
+		bool used = false;
+	};
+
+	std::vector<Slot> slots_;
+};
+
+} /* namespace libcamera */
@@ -7,8 +7,15 @@
 
 #pragma once
 
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
 #include <libcamera/base/class.h>
 
+#include <libcamera/fence.h>
 #include <libcamera/framebuffer.h>
 
 namespace libcamera {
@@ -23,9 +30,26 @@ public:
 	void setRequest(Request *request) { request_ = request; }
 	bool isContiguous() const { return isContiguous_; }
 
+	Fence *fence() const { return fence_.get(); }
+	void setFence(std::unique_ptr<Fence> fence) { fence_ = std::move(fence); }
+
+	FrameMetadata &metadata() { return LIBCAMERA_O_PTR()->metadata_; }
+
 private:
+	friend class MappedFrameBuffer;
+
+	struct Mapping {
+		std::shared_ptr<uint8_t> address;
+		size_t length;
+		int prot;
+	};
+
+	std::unique_ptr<Fence> fence_;
 	Request *request_;
 	bool isContiguous_;
+
+	mutable std::mutex mappingsLock_;
+	mutable std::map<int, Mapping> mappings_;
 };
 
 } /* namespace libcamera */
@@ -7,10 +7,14 @@
 
 #pragma once
 
+#include <future>
+#include <map>
 #include <stdint.h>
+#include <string>
 #include <vector>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
 
 #include <libcamera/ipa/ipa_interface.h>
 #include <libcamera/ipa/ipa_module_info.h>
@@ -38,7 +42,7 @@ public:
 		if (!m)
 			return nullptr;
 
-		std::unique_ptr<T> proxy = std::make_unique<T>(m, !self_->isSignatureValid(m));
+		std::unique_ptr<T> proxy = std::make_unique<T>(m, !self_->checkSignature(m));
 		if (!proxy->isValid()) {
 			LOG(IPAManager, Error) << "Failed to load proxy";
 			return nullptr;
@@ -47,6 +51,9 @@ public:
 		return proxy;
 	}
 
+	static void prefetch(PipelineHandler *pipe, uint32_t minVersion,
+			     uint32_t maxVersion);
+
 private:
 	static IPAManager *self_;
 
@@ -57,13 +64,27 @@ private:
 	IPAModule *module(PipelineHandler *pipe, uint32_t minVersion,
 			  uint32_t maxVersion);
 
+	bool checkSignature(IPAModule *ipa);
 	bool isSignatureValid(IPAModule *ipa) const;
 
 	std::vector<IPAModule *> modules_;
 
+	Mutex prefetchLock_;
+	std::map<IPAModule *, std::shared_future<bool>> prefetches_;
+
 #if HAVE_IPA_PUBKEY
+	std::string signatureCacheKey(IPAModule *ipa) const;
+	void loadSignatureCache() const;
+	void storeSignatureCache(const std::string &key, bool valid) const;
+
 	static const uint8_t publicKeyData_[];
+	static const size_t publicKeySize_;
 	static const PubKey pubKey_;
+
+	mutable Mutex signatureLock_;
+	mutable bool signatureCacheLoaded_ = false;
+	mutable std::string signatureCachePath_;
+	mutable std::map<std::string, bool> signatureCache_;
 #endif
 };
 
@@ -13,6 +13,8 @@
 
 #include <libcamera/ipa/ipa_interface.h>
 
+#include "libcamera/internal/metrics.h"
+
 namespace libcamera {
 
 class IPAModule;
@@ -39,6 +41,8 @@ protected:
 	bool valid_;
 	ProxyState state_;
 
+	MetricHistogram callDuration_;
+
 private:
 	IPAModule *ipam_;
 };
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_proxy_worker_pool.h - Pool of pre-started IPA proxy worker processes
+ */
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <libcamera/base/thread.h>
+
+namespace libcamera {
+
+class IPCUnixSocket;
+class Process;
+
+class IPAProxyWorkerPool
+{
+public:
+	struct Worker {
+		std::unique_ptr<Process> process;
+		std::unique_ptr<IPCUnixSocket> socket;
+	};
+
+	IPAProxyWorkerPool();
+	~IPAProxyWorkerPool();
+
+	static IPAProxyWorkerPool *instance();
+
+	static Worker start(const std::string &modulePath,
+			    const std::string &workerPath);
+
+	Worker acquire(const std::string &modulePath,
+		       const std::string &workerPath);
+	void clear();
+
+	unsigned int size() const { return size_; }
+
+private:
+	static IPAProxyWorkerPool *self_;
+
+	unsigned int size_;
+
+	Mutex mutex_;
+	std::map<std::tuple<Thread *, std::string, std::string>,
+		 std::list<Worker>> spares_;
+};
+
+} /* namespace libcamera */
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_recorder.h - Recording of the calls to an IPA module
+ */
+
+#pragma once
+
+#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace libcamera {
+
+class IPARecorder
+{
+public:
+	enum RecordType : uint32_t {
+		Init = 1,
+		Configure = 2,
+		MapBuffers = 3,
+		UnmapBuffers = 4,
+		Start = 5,
+		Stop = 6,
+		Event = 7,
+	};
+
+	struct BufferInfo {
+		uint32_t id;
+		uint32_t length;
+	};
+
+	static constexpr uint32_t kMagic = 0x5249434c; /* "LCIR" */
+	static constexpr uint32_t kVersion = 1;
+
+	int open(const std::string &path);
+	bool isOpen() const { return file_.is_open(); }
+	void close();
+
+	int write(RecordType type, const std::vector<std::vector<uint8_t>> &fields);
+
+private:
+	std::ofstream file_;
+};
+
+class IPARecording
+{
+public:
+	struct Record {
+		IPARecorder::RecordType type;
+		std::vector<std::vector<uint8_t>> fields;
+	};
+
+	int open(const std::string &path);
+	int read(Record *record);
+
+private:
+	std::ifstream file_;
+};
+
+} /* namespace libcamera */
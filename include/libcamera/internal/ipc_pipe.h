@@ -7,9 +7,12 @@
 
 #pragma once
 
+#include <map>
+#include <stdint.h>
 #include <vector>
 
 #include <libcamera/base/signal.h>
+#include <libcamera/base/span.h>
 
 #include <libcamera/file_descriptor.h>
 
@@ -17,6 +20,8 @@
 
 namespace libcamera {
 
+class IPCFdTable;
+
 class IPCMessage
 {
 public:
@@ -28,9 +33,10 @@ public:
 	IPCMessage();
 	IPCMessage(uint32_t cmd);
 	IPCMessage(const Header &header);
-	IPCMessage(IPCUnixSocket::Payload &payload);
+	IPCMessage(IPCUnixSocket::Payload &payload, IPCFdTable *fdTable = nullptr);
 
 	IPCUnixSocket::Payload payload() const;
+	int send(IPCUnixSocket *socket, IPCFdTable *fdTable = nullptr) const;
 
 	Header &header() { return header_; }
 	std::vector<uint8_t> &data() { return data_; }
@@ -47,6 +53,48 @@ private:
 	std::vector<FileDescriptor> fds_;
 };
 
+class IPCFdTable
+{
+public:
+	IPCFdTable();
+
+	void release(const FileDescriptor &fd);
+	void releaseAll();
+
+private:
+	friend class IPCMessage;
+
+	enum EntryType : uint32_t {
+		EntryCached,
+		EntryNew,
+		EntryRelease,
+	};
+
+	struct Entry {
+		uint32_t handle;
+		uint32_t type;
+	};
+
+	struct SentFd {
+		uint32_t handle;
+		uint64_t lastUse;
+		FileDescriptor fd;
+	};
+
+	bool pending(const std::vector<FileDescriptor> &fds) const;
+	void encode(const std::vector<FileDescriptor> &fds,
+		    std::vector<Entry> *entries, std::vector<int32_t> *sendFds);
+	void decode(Span<const Entry> entries, std::vector<int32_t> &fds,
+		    std::vector<FileDescriptor> *decodedFds);
+	void reset();
+
+	std::map<int, SentFd> sent_;
+	std::vector<uint32_t> released_;
+	std::map<uint32_t, FileDescriptor> received_;
+	uint32_t nextHandle_;
+	uint64_t lastUse_;
+};
+
 class IPCPipe
 {
 public:
@@ -60,6 +108,8 @@ public:
 
 	virtual int sendAsync(const IPCMessage &data) = 0;
 
+	virtual void releaseFds() {}
+
 	Signal<const IPCMessage &> recv;
 
 protected:
@@ -29,6 +29,8 @@ public:
 
 	int sendAsync(const IPCMessage &data) override;
 
+	void releaseFds() override;
+
 private:
 	struct CallData {
 		IPCUnixSocket::Payload *response;
@@ -36,12 +38,12 @@ private:
 	};
 
 	void readyRead();
-	int call(const IPCUnixSocket::Payload &message,
-		 IPCUnixSocket::Payload *response, uint32_t seq);
+	int call(const IPCMessage &message, IPCUnixSocket::Payload *response);
 
 	std::unique_ptr<Process> proc_;
 	std::unique_ptr<IPCUnixSocket> socket_;
 	std::map<uint32_t, CallData> callData_;
+	IPCFdTable fdTable_;
 };
 
 } /* namespace libcamera */
@@ -7,11 +7,13 @@
 
 #pragma once
 
+#include <atomic>
 #include <stdint.h>
 #include <sys/types.h>
 #include <vector>
 
 #include <libcamera/base/signal.h>
+#include <libcamera/base/span.h>
 
 namespace libcamera {
 
@@ -33,26 +35,61 @@ public:
 	void close();
 	bool isBound() const;
 
+	int enableSharedMemory(unsigned int size);
+
 	int send(const Payload &payload);
+	int send(Span<const Span<const uint8_t>> data, Span<const int32_t> fds);
 	int receive(Payload *payload);
 
 	Signal<> readyRead;
+	Signal<> disconnected;
 
 private:
+	enum MessageType : uint8_t {
+		MessageInline,
+		MessageSeparate,
+		MessageShared,
+		MessageSetup,
+	};
+
 	struct Header {
 		uint32_t data;
 		uint8_t fds;
+		uint8_t type;
+		uint32_t offset;
 	};
 
-	int sendData(const void *buffer, size_t length, const int32_t *fds, unsigned int num);
+	struct Ring {
+		uint8_t *data;
+		std::atomic<uint32_t> *consumed;
+		uint32_t position;
+	};
+
+	int sendData(const Header *hdr, Span<const Span<const uint8_t>> data,
+		     const int32_t *fds, unsigned int num);
 	int recvData(void *buffer, size_t length, int32_t *fds, unsigned int num);
+	int recvHeader();
+
+	int mapSharedMemory(int fd, unsigned int size, unsigned int index);
+	void unmapSharedMemory();
+	int sendShared(Span<const Span<const uint8_t>> data, Span<const int32_t> fds,
+		       uint32_t length);
+	int receiveShared(Payload *payload);
 
 	void dataNotifier();
 
 	int fd_;
 	bool headerReceived_;
 	struct Header header_;
+	std::vector<int32_t> headerFds_;
+	std::vector<uint8_t> rxBuffer_;
 	EventNotifier *notifier_;
+
+	void *shm_;
+	size_t shmSize_;
+	uint32_t ringSize_;
+	Ring tx_;
+	Ring rx_;
 };
 
 } /* namespace libcamera */
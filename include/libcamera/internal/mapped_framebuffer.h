@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <memory>
 #include <stdint.h>
 #include <vector>
 
@@ -38,6 +39,7 @@ protected:
 	int error_;
 	std::vector<Plane> planes_;
 	std::vector<Plane> maps_;
+	std::shared_ptr<void> resources_;
 
 private:
 	LIBCAMERA_DISABLE_COPY(MappedBuffer)
@@ -7,7 +7,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -21,6 +23,8 @@
 
 namespace libcamera {
 
+class MediaRequest;
+
 class MediaDevice : protected Loggable
 {
 public:
@@ -53,6 +57,9 @@ public:
 	MediaLink *link(const MediaPad *source, const MediaPad *sink);
 	int disableLinks();
 
+	int allocateRequests(unsigned int count,
+			     std::vector<std::unique_ptr<MediaRequest>> *requests);
+
 	Signal<> disconnected;
 
 protected:
@@ -75,6 +82,7 @@ private:
 
 	friend int MediaLink::setEnabled(bool enable);
 	int setupLink(const MediaLink *link, unsigned int flags);
+	int syncLinks();
 
 	std::string driver_;
 	std::string deviceNode_;
@@ -84,9 +92,13 @@ private:
 
 	int fd_;
 	bool valid_;
-	bool acquired_;
+	std::atomic<bool> acquired_;
 	bool lockOwner_;
 
+	__u64 topologyVersion_;
+	unsigned int numLinks_;
+	bool linksSynced_;
+
 	std::map<unsigned int, MediaObject *> objects_;
 	std::vector<MediaEntity *> entities_;
 };
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * media_request.h - Media Controller request
+ */
+
+#pragma once
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/signal.h>
+
+namespace libcamera {
+
+class EventNotifier;
+
+class MediaRequest
+{
+public:
+	explicit MediaRequest(int fd);
+	~MediaRequest();
+
+	int fd() const { return fd_; }
+
+	int queue();
+	int reinit();
+
+	Signal<MediaRequest *> completed;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(MediaRequest)
+
+	void requestCompleted();
+
+	int fd_;
+	EventNotifier *notifier_;
+};
+
+} /* namespace libcamera */
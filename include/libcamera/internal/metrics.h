@@ -0,0 +1,188 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * metrics.h - Runtime metrics registry
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/utils.h>
+
+namespace libcamera {
+
+class EventNotifier;
+
+class Metric
+{
+public:
+	enum class Type {
+		Counter,
+		Gauge,
+		Histogram,
+	};
+
+	virtual ~Metric();
+
+	static std::string label(const std::string &name, const std::string &value);
+
+	Type type() const { return type_; }
+	const std::string &name() const { return name_; }
+	const std::string &help() const { return help_; }
+	const std::string &labels() const { return labels_; }
+
+protected:
+	Metric(Type type, const std::string &name, const std::string &help,
+	       const std::string &labels);
+
+	void registerMetric();
+	void unregisterMetric();
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(Metric)
+
+	friend class MetricsRegistry;
+	virtual void format(std::ostream &out) const = 0;
+
+	Type type_;
+	std::string name_;
+	std::string help_;
+	std::string labels_;
+};
+
+class MetricCounter final : public Metric
+{
+public:
+	MetricCounter(const std::string &name, const std::string &help,
+		      const std::string &labels = {});
+	~MetricCounter();
+
+	void inc(uint64_t value = 1)
+	{
+		value_.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+	void format(std::ostream &out) const override;
+
+	std::atomic<uint64_t> value_;
+};
+
+class MetricGauge final : public Metric
+{
+public:
+	MetricGauge(const std::string &name, const std::string &help,
+		    const std::string &labels = {});
+	~MetricGauge();
+
+	void set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+	void add(int64_t value)
+	{
+		value_.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+	void format(std::ostream &out) const override;
+
+	std::atomic<int64_t> value_;
+};
+
+class MetricHistogram final : public Metric
+{
+public:
+	class Timer
+	{
+	public:
+		Timer(MetricHistogram &histogram)
+			: histogram_(histogram), start_(utils::clock::now())
+		{
+		}
+
+		~Timer()
+		{
+			auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+				utils::clock::now() - start_);
+			histogram_.observe(duration.count());
+		}
+
+	private:
+		MetricHistogram &histogram_;
+		utils::time_point start_;
+	};
+
+	static std::vector<uint64_t> exponentialBounds(uint64_t start, unsigned int factor,
+						       unsigned int count);
+
+	MetricHistogram(const std::string &name, const std::string &help,
+			const std::string &labels,
+			const std::vector<uint64_t> &bounds);
+	~MetricHistogram();
+
+	void observe(uint64_t value);
+
+	uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+	uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+
+private:
+	void format(std::ostream &out) const override;
+
+	std::vector<uint64_t> bounds_;
+	std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+	std::atomic<uint64_t> count_;
+	std::atomic<uint64_t> sum_;
+};
+
+class MetricsRegistry
+{
+public:
+	static MetricsRegistry *instance();
+
+	std::string format() const;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(MetricsRegistry)
+
+	friend class Metric;
+
+	MetricsRegistry() = default;
+
+	void add(Metric *metric);
+	void remove(Metric *metric);
+
+	mutable Mutex mutex_;
+	std::vector<Metric *> metrics_;
+};
+
+class MetricsServer
+{
+public:
+	MetricsServer();
+	~MetricsServer();
+
+	int listen(const std::string &path);
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(MetricsServer)
+
+	void connectionRequested();
+
+	std::string path_;
+	int fd_;
+	std::unique_ptr<EventNotifier> notifier_;
+};
+
+} /* namespace libcamera */
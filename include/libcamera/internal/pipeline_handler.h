@@ -55,11 +55,15 @@ public:
 
 	virtual int start(Camera *camera, const ControlList *controls) = 0;
 	virtual void stop(Camera *camera) = 0;
+	virtual void releaseDevice(Camera *camera);
 	bool hasPendingRequests(const Camera *camera) const;
 
 	void queueRequest(Request *request);
+	void queuePendingRequests(Camera *camera);
+	void cancelWaitingRequests(Camera *camera);
 
 	bool completeBuffer(Request *request, FrameBuffer *buffer);
+	void metadataAvailable(Request *request, const ControlList &metadata);
 	void completeRequest(Request *request);
 
 	const char *name() const { return name_; }
@@ -76,6 +80,11 @@ private:
 	void mediaDeviceDisconnected(MediaDevice *media);
 	virtual void disconnect();
 
+	void doQueueRequest(Request *request);
+	void doQueueRequests(Camera *camera);
+
+	void recordLatencies(Request *request);
+
 	std::vector<std::shared_ptr<MediaDevice>> mediaDevices_;
 	std::vector<std::weak_ptr<Camera>> cameras_;
 
@@ -12,6 +12,7 @@
 #include <vector>
 
 #include <libcamera/base/signal.h>
+#include <libcamera/base/thread.h>
 
 namespace libcamera {
 
@@ -60,6 +61,7 @@ public:
 	~ProcessManager();
 
 	void registerProcess(Process *proc);
+	void unregisterProcess(Process *proc);
 
 	static ProcessManager *instance();
 
@@ -72,7 +74,13 @@ private:
 
 	void sighandler();
 
+	/*
+	 * Processes are registered from the pipeline handler threads, and
+	 * reaped from the thread of the signal notifier.
+	 */
+	Mutex mutex_;
 	std::list<Process *> processes_;
+	std::list<pid_t> orphans_;
 
 	struct sigaction oldsa_;
 	EventNotifier *sigEvent_;
@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * request.h - Request class private data
+ */
+
+#pragma once
+
+#include <libcamera/base/class.h>
+
+#include <libcamera/request.h>
+
+namespace libcamera {
+
+class Request::Private : public Extensible::Private
+{
+	LIBCAMERA_DECLARE_PUBLIC(Request)
+
+public:
+	Private();
+
+	Request *pendingNext_;
+};
+
+} /* namespace libcamera */
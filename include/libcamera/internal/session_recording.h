@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * session_recording.h - Recording of camera capture sessions
+ */
+
+#pragma once
+
+#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/span.h>
+
+#include <libcamera/controls.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/control_serializer.h"
+
+namespace libcamera {
+
+class Camera;
+class Request;
+
+namespace session {
+
+static constexpr uint32_t kMagic = 0x5253434c; /* "LCSR" */
+static constexpr uint32_t kVersion = 1;
+static constexpr unsigned int kMaxPlanes = 4;
+
+struct Header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t streams;
+	uint32_t controlsSize;
+	uint32_t propertiesSize;
+	uint32_t idSize;
+};
+
+struct Stream {
+	uint32_t pixelFormat;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t frameSize;
+	uint32_t bufferCount;
+	uint64_t modifier;
+};
+
+struct Plane {
+	uint32_t length;
+	uint32_t bytesused;
+	uint64_t offset;
+};
+
+struct Buffer {
+	uint32_t stream;
+	uint32_t sequence;
+	uint32_t planes;
+	uint32_t reserved;
+	Plane plane[kMaxPlanes];
+};
+
+struct Request {
+	uint32_t size;
+	uint32_t buffers;
+	uint64_t timestamp;
+	uint32_t metadataSize;
+	uint32_t reserved;
+};
+
+} /* namespace session */
+
+class SessionRecorder
+{
+public:
+	SessionRecorder();
+
+	int open(const std::string &path, Camera *camera,
+		 const std::vector<const Stream *> &streams);
+	void write(libcamera::Request *request);
+
+private:
+	std::ofstream file_;
+	ControlSerializer serializer_;
+	std::vector<const Stream *> streams_;
+};
+
+class SessionRecording
+{
+public:
+	SessionRecording();
+
+	int open(const std::string &path);
+
+	const std::string &cameraId() const { return cameraId_; }
+	const std::vector<session::Stream> &streams() const { return streams_; }
+	const ControlInfoMap &controls() const { return controls_; }
+	const ControlList &properties() const { return properties_; }
+	const std::vector<const session::Request *> &requests() const { return requests_; }
+
+	const session::Buffer *buffers(const session::Request *request) const;
+	ControlList metadata(const session::Request *request);
+	Span<const uint8_t> data(const session::Request *request,
+				 const session::Plane &plane) const;
+
+private:
+	File file_;
+	Span<uint8_t> mem_;
+	ControlSerializer serializer_;
+
+	std::string cameraId_;
+	std::vector<session::Stream> streams_;
+	ControlInfoMap controls_;
+	ControlList properties_;
+	std::vector<const session::Request *> requests_;
+};
+
+} /* namespace libcamera */
@@ -0,0 +1,123 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * software_statistics.h - CPU-based image statistics
+ */
+
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/object.h>
+#include <libcamera/base/signal.h>
+
+#include <libcamera/controls.h>
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "libcamera/internal/tile_processor.h"
+
+namespace libcamera {
+
+class FrameBuffer;
+
+class SoftwareStatistics : public Object
+{
+public:
+	static constexpr unsigned int kHistogramBins = 64;
+	static constexpr Size kMaxGrid{ 16, 16 };
+
+	SoftwareStatistics();
+	~SoftwareStatistics();
+
+	static bool isSupported(const PixelFormat &pixelFormat);
+
+	int configure(const PixelFormat &pixelFormat, const Size &size,
+		      unsigned int stride);
+
+	int start();
+	void stop();
+
+	int queueBuffer(FrameBuffer *buffer, const Size &grid);
+
+	Signal<FrameBuffer *, const ControlList &> statisticsReady;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(SoftwareStatistics)
+
+	enum class Layout {
+		Packed422,
+		SemiPlanar,
+		Planar,
+		RGB,
+	};
+
+	struct FormatLayout {
+		Layout layout;
+		/* Offsets of the Y, U and V, or R, G and B components. */
+		std::array<unsigned int, 3> components;
+		unsigned int bytesPerPixel;
+	};
+
+	static const std::map<PixelFormat, FormatLayout> formatLayouts_;
+
+	struct Job {
+		FrameBuffer *buffer;
+		Size grid;
+		ControlList statistics;
+		bool done;
+	};
+
+	struct Accumulator {
+		std::array<int32_t, kHistogramBins> histogram;
+		std::vector<uint64_t> sums;
+		std::vector<uint32_t> counts;
+		uint64_t gradient;
+		uint64_t gradientCount;
+	};
+
+	void run();
+	void compute(Job &job);
+	template<Layout L>
+	void accumulateLine(const std::array<const uint8_t *, 3> &lines,
+			    Accumulator *acc, unsigned int row) const;
+
+	void jobDone();
+
+	Size size_;
+	Layout layout_;
+	std::array<unsigned int, 3> components_;
+	unsigned int bytesPerPixel_;
+	unsigned int step_;
+
+	/* Planes are stored in Y, U, V order for YUV formats. */
+	unsigned int numPlanes_;
+	std::array<unsigned int, 3> planes_;
+	std::array<unsigned int, 3> strides_;
+	std::array<unsigned int, 3> planeOffsets_;
+	std::array<unsigned int, 3> planeSizes_;
+	std::array<unsigned int, 3> verticalSubSampling_;
+
+	/* The zone columns of the sampled pixels for the current grid. */
+	Size grid_;
+	std::vector<unsigned int> zoneColumns_;
+
+	TileProcessor tiles_;
+
+	std::thread thread_;
+	std::mutex lock_;
+	std::condition_variable cv_;
+	std::deque<Job> jobs_;
+	bool running_;
+};
+
+} /* namespace libcamera */
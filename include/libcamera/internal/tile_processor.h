@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * tile_processor.h - Parallel tile-based processing of images on the CPU
+ */
+
+#pragma once
+
+#include <functional>
+
+#include <libcamera/base/span.h>
+
+/*
+ * Build the per-pixel kernels of the software image stages for multiple
+ * instruction sets, selected at runtime based on the CPU capabilities.
+ */
+#if defined(__x86_64__) && defined(__GLIBC__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define LIBCAMERA_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+#ifndef LIBCAMERA_TARGET_CLONES
+#define LIBCAMERA_TARGET_CLONES
+#endif
+
+namespace libcamera {
+
+class TileProcessor
+{
+public:
+	struct Tile {
+		unsigned int index;
+		unsigned int start;
+		unsigned int end;
+	};
+
+	using Operation = std::function<void(const Tile &)>;
+
+	TileProcessor();
+	TileProcessor(unsigned int rows, unsigned int rowBytes,
+		      unsigned int alignment = 1);
+
+	unsigned int rows() const { return rows_; }
+	unsigned int tileRows() const { return tileRows_; }
+	unsigned int tileCount() const { return tileCount_; }
+
+	void run(Span<const Operation> operations) const;
+	void run(const Operation &operation) const;
+
+	static unsigned int concurrency();
+
+private:
+	unsigned int rows_;
+	unsigned int tileRows_;
+	unsigned int tileCount_;
+};
+
+} /* namespace libcamera */
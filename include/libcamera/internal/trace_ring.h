@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * trace_ring.h - Built-in binary trace ring buffer
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace libcamera {
+
+class TraceRing
+{
+public:
+	enum Event : uint32_t {
+		RequestQueue = 0,
+		RequestComplete = 1,
+		BufferQueue = 2,
+		BufferDequeue = 3,
+		IpaCallBegin = 4,
+		IpaCallEnd = 5,
+		FrameStart = 6,
+	};
+
+	class Scope
+	{
+	public:
+		Scope(const char *name)
+			: name_(name)
+		{
+			record(IpaCallBegin, name_);
+		}
+
+		~Scope()
+		{
+			record(IpaCallEnd, name_);
+		}
+
+	private:
+		const char *name_;
+	};
+
+	static bool enabled();
+
+	static void record(Event event, uint64_t arg0 = 0, uint64_t arg1 = 0)
+	{
+		if (enabled())
+			write(event, arg0, arg1);
+	}
+
+	static void record(Event event, const void *arg0, uint64_t arg1 = 0)
+	{
+		record(event, reinterpret_cast<uintptr_t>(arg0), arg1);
+	}
+
+private:
+	static void write(Event event, uint64_t arg0, uint64_t arg1);
+};
+
+} /* namespace libcamera */
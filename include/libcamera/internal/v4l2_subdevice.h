@@ -52,7 +52,7 @@ public:
 	int getSelection(unsigned int pad, unsigned int target,
 			 Rectangle *rect);
 	int setSelection(unsigned int pad, unsigned int target,
-			 Rectangle *rect);
+			 Rectangle *rect, Whence whence = ActiveFormat);
 
 	Formats formats(unsigned int pad);
 
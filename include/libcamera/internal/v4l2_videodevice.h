@@ -8,10 +8,11 @@
 #pragma once
 
 #include <array>
-#include <atomic>
+#include <list>
 #include <memory>
 #include <stdint.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <linux/videodev2.h>
@@ -19,6 +20,8 @@
 #include <libcamera/base/class.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/signal.h>
+#include <libcamera/base/span.h>
+#include <libcamera/base/utils.h>
 
 #include <libcamera/framebuffer.h>
 #include <libcamera/geometry.h>
@@ -34,6 +37,8 @@ class EventNotifier;
 class FileDescriptor;
 class MediaDevice;
 class MediaEntity;
+class MediaRequest;
+struct StreamConfiguration;
 
 struct V4L2Capability final : v4l2_capability {
 	const char *driver() const
@@ -118,6 +123,11 @@ struct V4L2Capability final : v4l2_capability {
 class V4L2BufferCache
 {
 public:
+	struct Stats {
+		unsigned int hits;
+		unsigned int misses;
+	};
+
 	V4L2BufferCache(unsigned int numEntries);
 	V4L2BufferCache(const std::vector<std::unique_ptr<FrameBuffer>> &buffers);
 	~V4L2BufferCache();
@@ -125,17 +135,24 @@ public:
 	int get(const FrameBuffer &buffer);
 	void put(unsigned int index);
 
+	unsigned int size() const { return cache_.size(); }
+	void grow(unsigned int numEntries);
+	bool thrashing() const { return thrashing_; }
+
+	const Stats &stats() const { return stats_; }
+
 private:
 	class Entry
 	{
 	public:
 		Entry();
-		Entry(bool free, uint64_t lastUsed, const FrameBuffer &buffer);
 
+		void assign(const FrameBuffer &buffer, std::size_t key);
 		bool operator==(const FrameBuffer &buffer) const;
 
 		bool free_;
-		uint64_t lastUsed_;
+		std::size_t hash_;
+		std::list<unsigned int>::iterator lru_;
 
 	private:
 		struct Plane {
@@ -151,10 +168,21 @@ private:
 		std::vector<Plane> planes_;
 	};
 
-	std::atomic<uint64_t> lastUsedCounter_;
+	static std::size_t hash(const FrameBuffer &buffer);
+
+	void init(unsigned int numEntries);
+	void account(bool hit);
+
 	std::vector<Entry> cache_;
-	/* \todo Expose the miss counter through an instrumentation API. */
-	unsigned int missCounter_;
+	std::list<unsigned int> freeList_;
+	std::list<unsigned int> usedList_;
+	std::unordered_map<std::size_t, unsigned int> index_;
+
+	Stats stats_;
+
+	unsigned int windowLookups_;
+	unsigned int windowMisses_;
+	bool thrashing_;
 };
 
 class V4L2DeviceFormat
@@ -171,6 +199,9 @@ public:
 	std::array<Plane, 3> planes;
 	unsigned int planesCount = 0;
 
+	void applyConstraints(const StreamConfiguration &cfg);
+	bool adjustConstraints(StreamConfiguration *cfg) const;
+
 	const std::string toString() const;
 };
 
@@ -179,6 +210,13 @@ class V4L2VideoDevice : public V4L2Device
 public:
 	using Formats = std::map<V4L2PixelFormat, std::vector<SizeRange>>;
 
+	enum class CacheHint {
+		CpuReadWrite,
+		CpuRead,
+		CpuWrite,
+		DeviceOnly,
+	};
+
 	explicit V4L2VideoDevice(const std::string &deviceNode);
 	explicit V4L2VideoDevice(const MediaEntity *entity);
 	~V4L2VideoDevice();
@@ -198,6 +236,10 @@ public:
 	int setFormat(V4L2DeviceFormat *format);
 	Formats formats(uint32_t code = 0);
 
+	std::vector<utils::Duration> frameIntervals(V4L2PixelFormat pixelFormat,
+						    const Size &size);
+	int setFrameInterval(utils::Duration *interval);
+
 	int setSelection(unsigned int target, Rectangle *rect);
 
 	int allocateBuffers(unsigned int count,
@@ -207,8 +249,15 @@ public:
 	int importBuffers(unsigned int count);
 	int releaseBuffers();
 
-	int queueBuffer(FrameBuffer *buffer);
+	bool supportsRequests() const { return supportsRequests_; }
+	bool supportsCacheHints() const { return supportsCacheHints_; }
+	void setCacheHint(CacheHint hint) { cacheHint_ = hint; }
+
+	int queueBuffer(FrameBuffer *buffer, const MediaRequest *request = nullptr);
 	Signal<FrameBuffer *> bufferReady;
+	Signal<Span<FrameBuffer *const>> buffersReady;
+
+	void setBatchedDequeue(bool enable) { batchedDequeue_ = enable; }
 
 	int streamOn();
 	int streamOff();
@@ -238,6 +287,7 @@ private:
 	int createBuffers(unsigned int count,
 			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
 	std::unique_ptr<FrameBuffer> createBuffer(unsigned int index);
+	void growImportedBuffers();
 	FileDescriptor exportDmabufFd(unsigned int index, unsigned int plane);
 
 	void bufferAvailable();
@@ -251,11 +301,20 @@ private:
 	enum v4l2_memory memoryType_;
 
 	V4L2BufferCache *cache_;
+	bool cacheGrowable_;
 	std::map<unsigned int, FrameBuffer *> queuedBuffers_;
+	std::vector<FrameBuffer *> readyBuffers_;
 
 	EventNotifier *fdBufferNotifier_;
 
 	bool streaming_;
+	bool batchedDequeue_;
+	bool supportsRequests_;
+	bool supportsCacheHints_;
+	CacheHint cacheHint_;
+
+	struct Metrics;
+	std::unique_ptr<Metrics> metrics_;
 };
 
 class V4L2M2MDevice
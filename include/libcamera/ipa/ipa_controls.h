@@ -13,7 +13,7 @@
 extern "C" {
 #endif
 
-#define IPA_CONTROLS_FORMAT_VERSION	1
+#define IPA_CONTROLS_FORMAT_VERSION	2
 
 enum ipa_controls_id_map_type {
 	IPA_CONTROL_ID_MAP_CONTROLS,
@@ -28,7 +28,8 @@ struct ipa_controls_header {
 	uint32_t size;
 	uint32_t data_offset;
 	enum ipa_controls_id_map_type id_map_type;
-	uint32_t reserved[2];
+	uint32_t sequence;
+	uint32_t base;
 };
 
 struct ipa_control_value_entry {
@@ -36,8 +37,10 @@ struct ipa_control_value_entry {
 	uint8_t type;
 	uint8_t is_array;
 	uint16_t count;
-	uint32_t offset;
-	uint32_t padding[1];
+	union {
+		uint32_t offset;
+		uint8_t value[8];
+	};
 };
 
 struct ipa_control_info_entry {
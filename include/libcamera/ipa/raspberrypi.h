@@ -7,8 +7,11 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <linux/v4l2-controls.h>
+
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
 
@@ -45,9 +48,39 @@ static const ControlInfoMap Controls({
 		{ &controls::ColourCorrectionMatrix, ControlInfo(-16.0f, 16.0f) },
 		{ &controls::ScalerCrop, ControlInfo(Rectangle{}, Rectangle(65535, 65535, 65535, 65535), Rectangle{}) },
 		{ &controls::FrameDurationLimits, ControlInfo(INT64_C(1000), INT64_C(1000000000)) },
-		{ &controls::draft::NoiseReductionMode, ControlInfo(controls::draft::NoiseReductionModeValues) }
+		{ &controls::draft::NoiseReductionMode, ControlInfo(controls::draft::NoiseReductionModeValues) },
+		{ &controls::draft::ConvergedState, ControlInfo(static_cast<uint8_t>(0), static_cast<uint8_t>(255)) }
 	}, controls::controls);
 
+/*
+ * ISP configuration tables shared between the IPA and the pipeline handler
+ *
+ * The configuration structures of the ISP controls are written by the IPA to
+ * a buffer shared with the pipeline handler, instead of being stored in the
+ * ISP ControlList, to avoid serialising them when the IPA is isolated. The
+ * buffer holds one IspTable per bcm2835-isp control, and the ControlList
+ * only carries the generation number of the table for each control. The
+ * pipeline handler uses the generation number to check that the table hasn't
+ * been overwritten by the IPA before being applied.
+ */
+struct IspTable {
+	uint32_t generation;
+	uint32_t size;
+	uint8_t data[504];
+};
+
+static constexpr unsigned int IspTableCount = 16;
+static constexpr size_t IspTablesSize = sizeof(IspTable) * IspTableCount;
+
+static inline IspTable *ispTable(IspTable *tables, unsigned int id)
+{
+	unsigned int index = id - V4L2_CID_USER_BCM2835_ISP_BASE;
+	if (!tables || index >= IspTableCount)
+		return nullptr;
+
+	return &tables[index];
+}
+
 } /* namespace RPi */
 
 } /* namespace libcamera */
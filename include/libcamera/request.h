@@ -7,26 +7,32 @@
 
 #pragma once
 
+#include <chrono>
 #include <map>
 #include <memory>
 #include <stdint.h>
 #include <string>
-#include <unordered_set>
+#include <vector>
 
 #include <libcamera/base/class.h>
 #include <libcamera/base/signal.h>
 
 #include <libcamera/controls.h>
+#include <libcamera/fence.h>
 
 namespace libcamera {
 
 class Camera;
 class CameraControlValidator;
+class EventNotifier;
 class FrameBuffer;
 class Stream;
+class Timer;
 
-class Request
+class Request : public Extensible
 {
+	LIBCAMERA_DECLARE_PRIVATE()
+
 public:
 	enum Status {
 		RequestPending,
@@ -49,7 +55,8 @@ public:
 	ControlList &controls() { return *controls_; }
 	ControlList &metadata() { return *metadata_; }
 	const BufferMap &buffers() const { return bufferMap_; }
-	int addBuffer(const Stream *stream, FrameBuffer *buffer);
+	int addBuffer(const Stream *stream, FrameBuffer *buffer,
+		      std::unique_ptr<Fence> fence = nullptr);
 	FrameBuffer *findBuffer(const Stream *stream) const;
 
 	uint32_t sequence() const { return sequence_; }
@@ -70,11 +77,30 @@ private:
 
 	bool completeBuffer(FrameBuffer *buffer);
 
+	void prepare(std::chrono::milliseconds timeout);
+	void notifierActivated(FrameBuffer *buffer);
+	void timeout();
+	void abortPrepare();
+	void emitPrepareCompleted();
+
+	Signal<> prepared;
+
 	Camera *camera_;
 	ControlList *controls_;
 	ControlList *metadata_;
 	BufferMap bufferMap_;
-	std::unordered_set<FrameBuffer *> pending_;
+	std::vector<BufferMap::node_type> spareNodes_;
+	std::vector<FrameBuffer *> pending_;
+
+	std::map<FrameBuffer *, std::unique_ptr<EventNotifier>> notifiers_;
+	std::unique_ptr<Timer> timer_;
+	bool prepared_;
+
+	/* Timestamps of the processing stages, in nanoseconds */
+	uint64_t queuedTime_;
+	uint64_t firstBufferTime_;
+	uint64_t lastBufferTime_;
+	uint64_t completedTime_;
 
 	uint32_t sequence_;
 	const uint64_t cookie_;
@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * request_fan_out.h - Share completed requests between multiple consumers
+ */
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/signal.h>
+
+namespace libcamera {
+
+class Camera;
+class Request;
+
+class RequestFanOut
+{
+public:
+	static constexpr unsigned int kMaxConsumers = 32;
+
+	RequestFanOut(std::shared_ptr<Camera> camera, unsigned int consumers);
+	~RequestFanOut();
+
+	unsigned int consumers() const { return consumers_; }
+
+	void setMaxHeld(unsigned int count);
+	void setTimeout(std::chrono::milliseconds timeout);
+
+	void start();
+	void stop();
+
+	void release(unsigned int consumer, Request *request);
+
+	unsigned int dropped() const;
+	unsigned int timedOut() const;
+
+	Signal<Request *> requestReady;
+	Signal<Request *> requestReleased;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(RequestFanOut)
+
+	struct Entry {
+		uint32_t holders;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
+	void requestCompleted(Request *request);
+	void expire(std::vector<Request *> *released);
+	void recycle(Request *request);
+
+	std::shared_ptr<Camera> camera_;
+	unsigned int consumers_;
+
+	mutable std::mutex lock_;
+	std::map<Request *, Entry> held_;
+	bool requeue_;
+	unsigned int maxHeld_;
+	std::chrono::milliseconds timeout_;
+
+	unsigned int dropped_;
+	unsigned int timedOut_;
+};
+
+} /* namespace libcamera */
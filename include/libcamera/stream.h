@@ -33,7 +33,9 @@ public:
 	SizeRange range(const PixelFormat &pixelformat) const;
 
 private:
-	std::map<PixelFormat, std::vector<SizeRange>> formats_;
+	class Formats;
+
+	std::shared_ptr<const Formats> formats_;
 };
 
 struct StreamConfiguration {
@@ -47,6 +49,10 @@ struct StreamConfiguration {
 
 	unsigned int bufferCount;
 
+	unsigned int strideAlign;
+	unsigned int heightAlign;
+	unsigned int planeAlign;
+
 	Stream *stream() const { return stream_; }
 	void setStream(Stream *stream) { stream_ = stream; }
 	const StreamFormats &formats() const { return formats_; }
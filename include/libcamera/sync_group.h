@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * sync_group.h - Match requests across synchronised cameras
+ */
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/signal.h>
+
+namespace libcamera {
+
+class Camera;
+class Request;
+
+class SyncGroup
+{
+public:
+	SyncGroup(const std::vector<std::shared_ptr<Camera>> &cameras,
+		  std::chrono::nanoseconds tolerance);
+	~SyncGroup();
+
+	const std::vector<std::shared_ptr<Camera>> &cameras() const { return cameras_; }
+	std::chrono::nanoseconds tolerance() const { return tolerance_; }
+
+	void flush();
+
+	Signal<const std::vector<Request *> &> groupCompleted;
+	Signal<Request *> requestUnmatched;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(SyncGroup)
+
+	struct Entry {
+		Request *request;
+		uint64_t timestamp;
+	};
+
+	void requestCompleted(unsigned int index, Request *request);
+	void match(std::vector<std::vector<Request *>> *groups,
+		   std::vector<Request *> *unmatched);
+
+	std::vector<std::shared_ptr<Camera>> cameras_;
+	std::chrono::nanoseconds tolerance_;
+
+	std::mutex lock_;
+	std::vector<std::deque<Entry>> queues_;
+};
+
+} /* namespace libcamera */
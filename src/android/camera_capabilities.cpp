@@ -11,7 +11,9 @@
 #include <array>
 #include <cmath>
 #include <map>
+#include <tuple>
 #include <type_traits>
+#include <utility>
 
 #include <hardware/camera3.h>
 
@@ -41,6 +43,12 @@ const std::vector<Size> camera3Resolutions = {
 	{ 1920, 1080 }
 };
 
+/*
+ * \var kHighSpeedFps
+ * \brief The frame rates supported for constrained high speed video recording
+ */
+constexpr std::array<unsigned int, 2> kHighSpeedFps = { 120, 240 };
+
 /*
  * \struct Camera3Format
  * \brief Data associated with an Android format identifier
@@ -331,6 +339,46 @@ bool CameraCapabilities::validateBurstCaptureCapability()
 	return false;
 }
 
+bool CameraCapabilities::validateYuvReprocessingCapability()
+{
+	camera_metadata_ro_entry_t entry;
+	bool found;
+
+	const char *noMode = "YUV reprocessing capability unavailable: ";
+
+	found = staticMetadata_->getEntry(ANDROID_REQUEST_MAX_NUM_INPUT_STREAMS, &entry);
+	if (!found || *entry.data.i32 < 1) {
+		LOG(HAL, Info) << noMode << "no input stream";
+		return false;
+	}
+
+	found = staticMetadata_->getEntry(ANDROID_SCALER_AVAILABLE_INPUT_OUTPUT_FORMATS_MAP,
+					  &entry);
+	if (!found || entry.data.i32[0] != HAL_PIXEL_FORMAT_YCbCr_420_888) {
+		LOG(HAL, Info) << noMode << "missing YUV input format";
+		return false;
+	}
+
+	if (!staticMetadata_->hasEntry(ANDROID_REPROCESS_MAX_CAPTURE_STALL)) {
+		LOG(HAL, Info) << noMode << "missing max capture stall";
+		return false;
+	}
+
+	return true;
+}
+
+bool CameraCapabilities::validateConstrainedHighSpeedVideoCapability()
+{
+	if (!staticMetadata_->hasEntry(ANDROID_CONTROL_AVAILABLE_HIGH_SPEED_VIDEO_CONFIGURATIONS)) {
+		LOG(HAL, Info)
+			<< "Constrained high speed video capability unavailable: "
+			<< "no stream reaches " << kHighSpeedFps.front() << " FPS";
+		return false;
+	}
+
+	return true;
+}
+
 std::set<camera_metadata_enum_android_request_available_capabilities>
 CameraCapabilities::computeCapabilities()
 {
@@ -351,6 +399,12 @@ CameraCapabilities::computeCapabilities()
 	if (rawStreamAvailable_)
 		capabilities.insert(ANDROID_REQUEST_AVAILABLE_CAPABILITIES_RAW);
 
+	if (validateYuvReprocessingCapability())
+		capabilities.insert(ANDROID_REQUEST_AVAILABLE_CAPABILITIES_YUV_REPROCESSING);
+
+	if (validateConstrainedHighSpeedVideoCapability())
+		capabilities.insert(ANDROID_REQUEST_AVAILABLE_CAPABILITIES_CONSTRAINED_HIGH_SPEED_VIDEO);
+
 	return capabilities;
 }
 
@@ -386,6 +440,7 @@ int CameraCapabilities::initialize(std::shared_ptr<Camera> camera,
 	facing_ = facing;
 	rawStreamAvailable_ = false;
 	maxFrameDuration_ = 0;
+	highSpeedConfigurations_.clear();
 
 	/* Acquire the camera and initialize available stream configurations. */
 	int ret = camera_->acquire();
@@ -530,6 +585,17 @@ int CameraCapabilities::initializeStreamConfigurations()
 	 * metadata.
 	 */
 	Size maxJpegSize;
+
+	/*
+	 * Several Android formats can map to the same libcamera format (for
+	 * instance NV12 for both HAL_PIXEL_FORMAT_YCbCr_420_888 and
+	 * HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED). Cache the supported
+	 * resolutions and frame durations to validate and configure the camera
+	 * only once for each of them.
+	 */
+	std::map<PixelFormat, std::vector<Size>> resolutionsCache;
+	std::map<std::pair<PixelFormat, Size>, std::pair<int64_t, int64_t>> frameDurationsCache;
+
 	for (const auto &format : camera3FormatsMap) {
 		int androidFormat = format.first;
 		const Camera3Format &camera3Format = format.second;
@@ -600,53 +666,80 @@ int CameraCapabilities::initializeStreamConfigurations()
 				<< camera3Format.name << " to "
 				<< mappedFormat.toString();
 
-		std::vector<Size> resolutions;
 		const PixelFormatInfo &info = PixelFormatInfo::info(mappedFormat);
-		switch (info.colourEncoding) {
-		case PixelFormatInfo::ColourEncodingRAW:
-			if (info.bitsPerPixel != 16)
-				continue;
+		if (info.colourEncoding == PixelFormatInfo::ColourEncodingRAW &&
+		    info.bitsPerPixel != 16)
+			continue;
 
-			rawStreamAvailable_ = true;
-			resolutions = initializeRawResolutions(mappedFormat);
-			break;
+		auto cached = resolutionsCache.find(mappedFormat);
+		if (cached == resolutionsCache.end()) {
+			std::vector<Size> resolutions;
 
-		case PixelFormatInfo::ColourEncodingYUV:
-		case PixelFormatInfo::ColourEncodingRGB:
-			/*
-			 * We support enumerating RGB streams here to allow
-			 * mapping IMPLEMENTATION_DEFINED format to RGB.
-			 */
-			resolutions = initializeYUVResolutions(mappedFormat,
-							       cameraResolutions);
-			break;
+			switch (info.colourEncoding) {
+			case PixelFormatInfo::ColourEncodingRAW:
+				resolutions = initializeRawResolutions(mappedFormat);
+				break;
+
+			case PixelFormatInfo::ColourEncodingYUV:
+			case PixelFormatInfo::ColourEncodingRGB:
+				/*
+				 * We support enumerating RGB streams here to
+				 * allow mapping IMPLEMENTATION_DEFINED format
+				 * to RGB.
+				 */
+				resolutions = initializeYUVResolutions(mappedFormat,
+								       cameraResolutions);
+				break;
+			}
+
+			cached = resolutionsCache.emplace(mappedFormat,
+							  std::move(resolutions)).first;
 		}
 
+		if (info.colourEncoding == PixelFormatInfo::ColourEncodingRAW)
+			rawStreamAvailable_ = true;
+
+		const std::vector<Size> &resolutions = cached->second;
+
 		for (const Size &res : resolutions) {
-			/*
-			 * Configure the Camera with the collected format and
-			 * resolution to get an updated list of controls.
-			 *
-			 * \todo Avoid the need to configure the camera when
-			 * redesigning the configuration API.
-			 */
-			cfg.size = res;
-			int ret = camera_->configure(cameraConfig.get());
-			if (ret)
-				return ret;
-
-			const ControlInfoMap &controls = camera_->controls();
-			const auto frameDurations = controls.find(
-				&controls::FrameDurationLimits);
-			if (frameDurations == controls.end()) {
-				LOG(HAL, Error)
-					<< "Camera does not report frame durations";
-				return -EINVAL;
+			int64_t minFrameDuration;
+			int64_t maxFrameDuration;
+
+			auto durations = frameDurationsCache.find({ mappedFormat, res });
+			if (durations != frameDurationsCache.end()) {
+				std::tie(minFrameDuration, maxFrameDuration) =
+					durations->second;
+			} else {
+				/*
+				 * Configure the Camera with the collected
+				 * format and resolution to get an updated list
+				 * of controls.
+				 *
+				 * \todo Avoid the need to configure the camera
+				 * when redesigning the configuration API.
+				 */
+				cfg.pixelFormat = mappedFormat;
+				cfg.size = res;
+				int ret = camera_->configure(cameraConfig.get());
+				if (ret)
+					return ret;
+
+				const ControlInfoMap &controls = camera_->controls();
+				const auto frameDurations = controls.find(
+					&controls::FrameDurationLimits);
+				if (frameDurations == controls.end()) {
+					LOG(HAL, Error)
+						<< "Camera does not report frame durations";
+					return -EINVAL;
+				}
+
+				minFrameDuration = frameDurations->second.min().get<int64_t>() * 1000;
+				maxFrameDuration = frameDurations->second.max().get<int64_t>() * 1000;
+
+				frameDurationsCache[{ mappedFormat, res }] =
+					{ minFrameDuration, maxFrameDuration };
 			}
 
-			int64_t minFrameDuration = frameDurations->second.min().get<int64_t>() * 1000;
-			int64_t maxFrameDuration = frameDurations->second.max().get<int64_t>() * 1000;
-
 			/*
 			 * Cap min frame duration to 30 FPS.
 			 *
@@ -667,6 +760,19 @@ int CameraCapabilities::initializeStreamConfigurations()
 			 * control to be specified for each Request. Defer this
 			 * to the in-development configuration API rework.
 			 */
+			/*
+			 * Record the IMPLEMENTATION_DEFINED sizes the camera
+			 * can produce at high frame rates, before capping the
+			 * frame durations, for constrained high speed video
+			 * recording. Android limits high speed video to 1080p.
+			 */
+			unsigned int maxFps = static_cast<unsigned int>
+					      (floor(1e9 / minFrameDuration + 0.05f));
+			if (androidFormat == HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED &&
+			    res.width <= 1920 && res.height <= 1080 &&
+			    maxFps >= kHighSpeedFps.front())
+				highSpeedConfigurations_.push_back({ res, maxFps });
+
 			if (minFrameDuration < 1e9 / 30.0)
 				minFrameDuration = 1e9 / 30.0;
 
@@ -1308,6 +1414,32 @@ int CameraCapabilities::initializeStaticMetadata()
 			<< entry.minFrameDurationNsec << "]"
 			<< "@" << fps;
 	}
+
+	/*
+	 * Reprocessing is implemented by the HAL post-processors, which
+	 * consume semi-planar YUV input buffers. As the JPEG encoder doesn't
+	 * scale, restrict the input stream to the largest YUV size, for which
+	 * a JPEG stream is always available.
+	 */
+	bool yuvReprocessing = false;
+	if (!maxYUVSize.isNull()) {
+		const PixelFormat yuvFormat = toPixelFormat(HAL_PIXEL_FORMAT_YCbCr_420_888);
+		yuvReprocessing = yuvFormat == formats::NV12 ||
+				  yuvFormat == formats::NV21;
+	}
+
+	if (yuvReprocessing) {
+		availableStreamConfigurations.push_back(HAL_PIXEL_FORMAT_YCbCr_420_888);
+		availableStreamConfigurations.push_back(maxYUVSize.width);
+		availableStreamConfigurations.push_back(maxYUVSize.height);
+		availableStreamConfigurations.push_back(
+			ANDROID_SCALER_AVAILABLE_STREAM_CONFIGURATIONS_INPUT);
+
+		LOG(HAL, Debug)
+			<< "Input Stream: YCbCr_420_888 ("
+			<< maxYUVSize.toString() << ")";
+	}
+
 	staticMetadata_->addEntry(ANDROID_SCALER_AVAILABLE_STREAM_CONFIGURATIONS,
 				  availableStreamConfigurations);
 
@@ -1341,13 +1473,45 @@ int CameraCapabilities::initializeStaticMetadata()
 	staticMetadata_->addEntry(ANDROID_SCALER_AVAILABLE_STALL_DURATIONS,
 				  availableStallDurations);
 
+	/*
+	 * Constrained high speed video configurations. The framework submits
+	 * requests in batches of one request per frame of a 30 FPS stream,
+	 * and both the fixed [fps, fps] and the variable [30, fps] ranges are
+	 * required for each size.
+	 */
+	std::vector<int32_t> highSpeedVideoConfigurations;
+	for (const auto &entry : highSpeedConfigurations_) {
+		for (unsigned int fps : kHighSpeedFps) {
+			if (fps > entry.maxFps)
+				break;
+
+			for (unsigned int rangeMin : { 30U, fps }) {
+				highSpeedVideoConfigurations.push_back(entry.resolution.width);
+				highSpeedVideoConfigurations.push_back(entry.resolution.height);
+				highSpeedVideoConfigurations.push_back(rangeMin);
+				highSpeedVideoConfigurations.push_back(fps);
+				highSpeedVideoConfigurations.push_back(fps / 30);
+			}
+
+			LOG(HAL, Debug)
+				<< "High Speed Stream: ("
+				<< entry.resolution.toString() << ")@" << fps;
+		}
+	}
+
+	if (!highSpeedVideoConfigurations.empty()) {
+		staticMetadata_->addEntry(ANDROID_CONTROL_AVAILABLE_HIGH_SPEED_VIDEO_CONFIGURATIONS,
+					  highSpeedVideoConfigurations);
+		availableCharacteristicsKeys_.insert(
+			ANDROID_CONTROL_AVAILABLE_HIGH_SPEED_VIDEO_CONFIGURATIONS);
+	}
+
 	uint8_t croppingType = ANDROID_SCALER_CROPPING_TYPE_CENTER_ONLY;
 	staticMetadata_->addEntry(ANDROID_SCALER_CROPPING_TYPE, croppingType);
 
 	/* Request static metadata. */
-	int32_t partialResultCount = 1;
 	staticMetadata_->addEntry(ANDROID_REQUEST_PARTIAL_RESULT_COUNT,
-				  partialResultCount);
+				  kPartialResultCount);
 
 	{
 		/* Default the value to 2 if not reported by the camera. */
@@ -1359,11 +1523,36 @@ int CameraCapabilities::initializeStaticMetadata()
 					  maxPipelineDepth);
 	}
 
-	/* LIMITED does not support reprocessing. */
-	uint32_t maxNumInputStreams = 0;
+	int32_t maxNumInputStreams = yuvReprocessing ? 1 : 0;
 	staticMetadata_->addEntry(ANDROID_REQUEST_MAX_NUM_INPUT_STREAMS,
 				  maxNumInputStreams);
 
+	if (yuvReprocessing) {
+		/* YUV input buffers can be reprocessed to YUV and JPEG. */
+		int32_t inputOutputFormatsMap[] = {
+			HAL_PIXEL_FORMAT_YCbCr_420_888, 2,
+			HAL_PIXEL_FORMAT_BLOB, HAL_PIXEL_FORMAT_YCbCr_420_888,
+		};
+		staticMetadata_->addEntry(ANDROID_SCALER_AVAILABLE_INPUT_OUTPUT_FORMATS_MAP,
+					  inputOutputFormatsMap);
+
+		/*
+		 * Reprocessing requests don't go through the camera, but
+		 * they complete in order with the capture requests and delay
+		 * them by the time required to post-process the input buffer.
+		 */
+		int32_t maxCaptureStall = 1;
+		staticMetadata_->addEntry(ANDROID_REPROCESS_MAX_CAPTURE_STALL,
+					  maxCaptureStall);
+
+		availableCharacteristicsKeys_.insert({
+			ANDROID_REPROCESS_MAX_CAPTURE_STALL,
+			ANDROID_SCALER_AVAILABLE_INPUT_OUTPUT_FORMATS_MAP,
+		});
+		availableRequestKeys_.insert(ANDROID_REPROCESS_EFFECTIVE_EXPOSURE_FACTOR);
+		availableResultKeys_.insert(ANDROID_REPROCESS_EFFECTIVE_EXPOSURE_FACTOR);
+	}
+
 	/* Number of { RAW, YUV, JPEG } supported output streams */
 	int32_t numOutStreams[] = { rawStreamAvailable_, 2, 1 };
 	staticMetadata_->addEntry(ANDROID_REQUEST_MAX_NUM_OUTPUT_STREAMS,
@@ -1406,6 +1595,9 @@ int CameraCapabilities::initializeStaticMetadata()
 			<< " entries and " << dataCount << " bytes used";
 	}
 
+	/* The framework queries the static metadata often, sort it once. */
+	staticMetadata_->sort();
+
 	return 0;
 }
 
@@ -1422,6 +1614,28 @@ PixelFormat CameraCapabilities::toPixelFormat(int format) const
 	return it->second;
 }
 
+/*
+ * Return the highest frame rate at which a stream of \a size can be recorded in
+ * constrained high speed mode, or 0 if the size isn't supported by that mode.
+ */
+unsigned int CameraCapabilities::maxHighSpeedFps(const Size &size) const
+{
+	for (const auto &entry : highSpeedConfigurations_) {
+		if (entry.resolution != size)
+			continue;
+
+		unsigned int maxFps = 0;
+		for (unsigned int fps : kHighSpeedFps) {
+			if (fps <= entry.maxFps)
+				maxFps = fps;
+		}
+
+		return maxFps;
+	}
+
+	return 0;
+}
+
 std::unique_ptr<CameraMetadata> CameraCapabilities::requestTemplateManual() const
 {
 	if (!capabilities_.count(ANDROID_REQUEST_AVAILABLE_CAPABILITIES_MANUAL_SENSOR)) {
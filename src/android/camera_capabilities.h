@@ -23,6 +23,12 @@
 class CameraCapabilities
 {
 public:
+	/*
+	 * Results are delivered in two parts, the 3A results as soon as the
+	 * IPA has produced them, and the complete metadata with the buffers.
+	 */
+	static constexpr int32_t kPartialResultCount = 2;
+
 	CameraCapabilities() = default;
 
 	int initialize(std::shared_ptr<libcamera::Camera> camera,
@@ -31,6 +37,11 @@ public:
 	CameraMetadata *staticMetadata() const { return staticMetadata_.get(); }
 	libcamera::PixelFormat toPixelFormat(int format) const;
 	unsigned int maxJpegBufferSize() const { return maxJpegBufferSize_; }
+	bool supportsReprocessing() const
+	{
+		return capabilities_.count(ANDROID_REQUEST_AVAILABLE_CAPABILITIES_YUV_REPROCESSING);
+	}
+	unsigned int maxHighSpeedFps(const libcamera::Size &size) const;
 
 	std::unique_ptr<CameraMetadata> requestTemplateManual() const;
 	std::unique_ptr<CameraMetadata> requestTemplatePreview() const;
@@ -47,9 +58,16 @@ private:
 		int64_t maxFrameDurationNsec;
 	};
 
+	struct HighSpeedConfiguration {
+		libcamera::Size resolution;
+		unsigned int maxFps;
+	};
+
 	bool validateManualSensorCapability();
 	bool validateManualPostProcessingCapability();
 	bool validateBurstCaptureCapability();
+	bool validateYuvReprocessingCapability();
+	bool validateConstrainedHighSpeedVideoCapability();
 
 	std::set<camera_metadata_enum_android_request_available_capabilities>
 		computeCapabilities();
@@ -76,6 +94,7 @@ private:
 	std::set<camera_metadata_enum_android_request_available_capabilities> capabilities_;
 
 	std::vector<Camera3StreamConfiguration> streamConfigurations_;
+	std::vector<HighSpeedConfiguration> highSpeedConfigurations_;
 	std::map<int, libcamera::PixelFormat> formatsMap_;
 	std::unique_ptr<CameraMetadata> staticMetadata_;
 	unsigned int maxJpegBufferSize_;
@@ -9,7 +9,6 @@
 
 #include <algorithm>
 #include <fstream>
-#include <sys/mman.h>
 #include <unistd.h>
 #include <vector>
 
@@ -22,9 +21,10 @@
 #include <libcamera/formats.h>
 #include <libcamera/property_ids.h>
 
+#include "libcamera/internal/formats.h"
+
 #include "system/graphics.h"
 
-#include "camera_buffer.h"
 #include "camera_hal_config.h"
 #include "camera_ops.h"
 #include "camera_request.h"
@@ -35,6 +35,12 @@ LOG_DECLARE_CATEGORY(HAL)
 
 namespace {
 
+/*
+ * Number of input buffers the HAL can hold, one being reprocessed while the
+ * next one is queued.
+ */
+constexpr uint32_t kMaxInputBuffers = 2;
+
 /*
  * \struct Camera3StreamConfig
  * \brief Data to store StreamConfiguration associated with camera3_stream(s)
@@ -245,8 +251,11 @@ bool validateCropRotate(const camera3_stream_configuration_t &streamList)
 
 CameraDevice::CameraDevice(unsigned int id, std::shared_ptr<Camera> camera)
 	: id_(id), state_(State::Stopped), camera_(std::move(camera)),
-	  facing_(CAMERA_FACING_FRONT), orientation_(0)
+	  inputStream_(nullptr), highSpeed_(false), batchSize_(1),
+	  facing_(CAMERA_FACING_FRONT), orientation_(0),
+	  jpegEncoder_(CameraConfigData::JpegEncoder::LibJpeg)
 {
+	camera_->metadataAvailable.connect(this, &CameraDevice::metadataAvailable);
 	camera_->requestCompleted.connect(this, &CameraDevice::requestComplete);
 
 	maker_ = "libcamera";
@@ -373,6 +382,9 @@ int CameraDevice::initialize(const CameraConfigData *cameraConfigData)
 		orientation_ = 0;
 	}
 
+	if (cameraConfigData)
+		jpegEncoder_ = cameraConfigData->jpegEncoder;
+
 	return capabilities_.initialize(camera_, orientation_, facing_);
 }
 
@@ -424,6 +436,27 @@ void CameraDevice::flush()
 	worker_.stop();
 	camera_->stop();
 
+	/*
+	 * Abort the requests of an incomplete batch, they have not been queued
+	 * to the camera.
+	 */
+	for (CaptureRequest *request : batch_) {
+		Camera3RequestDescriptor *descriptor =
+			reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+
+		descriptor->lastInBatch_ = request == batch_.back();
+		abortRequest(descriptor);
+		completeDescriptor(descriptor);
+	}
+	batch_.clear();
+
+	/*
+	 * The framework may free the buffers of the flushed requests, drop
+	 * the FrameBuffers wrapping them.
+	 */
+	for (CameraStream &cameraStream : streams_)
+		cameraStream.clearFrameBuffers();
+
 	MutexLocker stateLock(stateMutex_);
 	state_ = State::Stopped;
 }
@@ -437,7 +470,10 @@ void CameraDevice::stop()
 	worker_.stop();
 	camera_->stop();
 
-	descriptors_ = {};
+	postProcessorPool_.cancel();
+
+	descriptors_.clear();
+	batch_.clear();
 	streams_.clear();
 
 	state_ = State::Stopped;
@@ -495,8 +531,16 @@ const camera_metadata_t *CameraDevice::constructDefaultRequestSettings(int type)
 		captureIntent = ANDROID_CONTROL_CAPTURE_INTENT_MANUAL;
 		requestTemplate = capabilities_.requestTemplateManual();
 		break;
-	/* \todo Implement templates generation for the remaining use cases. */
 	case CAMERA3_TEMPLATE_ZERO_SHUTTER_LAG:
+		if (!capabilities_.supportsReprocessing()) {
+			LOG(HAL, Error) << "Zero shutter lag is not supported";
+			return nullptr;
+		}
+
+		captureIntent = ANDROID_CONTROL_CAPTURE_INTENT_ZERO_SHUTTER_LAG;
+		requestTemplate = capabilities_.requestTemplateStill();
+		break;
+	/* \todo Implement templates generation for the remaining use cases. */
 	default:
 		LOG(HAL, Error) << "Unsupported template request type: " << type;
 		return nullptr;
@@ -514,6 +558,43 @@ const camera_metadata_t *CameraDevice::constructDefaultRequestSettings(int type)
 	return requestTemplates_[type]->getMetadata();
 }
 
+/*
+ * Check that the streams satisfy the constrained high speed mode requirements:
+ * one or two IMPLEMENTATION_DEFINED output streams of the same size, listed in
+ * the high speed video configurations.
+ */
+bool CameraDevice::validateHighSpeedStreams(const camera3_stream_configuration_t &streamList) const
+{
+	if (streamList.num_streams > 2) {
+		LOG(HAL, Error) << "Too many high speed streams";
+		return false;
+	}
+
+	const camera3_stream_t &first = *streamList.streams[0];
+	for (unsigned int i = 0; i < streamList.num_streams; ++i) {
+		const camera3_stream_t &stream = *streamList.streams[i];
+
+		if (stream.stream_type != CAMERA3_STREAM_OUTPUT ||
+		    stream.format != HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED) {
+			LOG(HAL, Error) << "Invalid high speed stream type or format";
+			return false;
+		}
+
+		if (stream.width != first.width || stream.height != first.height) {
+			LOG(HAL, Error) << "High speed streams sizes are not identical";
+			return false;
+		}
+	}
+
+	if (!capabilities_.maxHighSpeedFps({ first.width, first.height })) {
+		LOG(HAL, Error) << "Unsupported high speed stream size "
+				<< first.width << "x" << first.height;
+		return false;
+	}
+
+	return true;
+}
+
 /*
  * Inspect the stream_list to produce a list of StreamConfiguration to
  * be use to configure the Camera.
@@ -533,6 +614,11 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 		return -EINVAL;
 #endif
 
+	highSpeed_ = stream_list->operation_mode ==
+		     CAMERA3_STREAM_CONFIGURATION_CONSTRAINED_HIGH_SPEED_MODE;
+	if (highSpeed_ && !validateHighSpeedStreams(*stream_list))
+		return -EINVAL;
+
 	/*
 	 * Generate an empty configuration, and construct a StreamConfiguration
 	 * for each camera3_stream to add to it.
@@ -548,14 +634,17 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 	 * ensure the required entries are available without further
 	 * reallocation.
 	 */
+	postProcessorPool_.cancel();
 	streams_.clear();
 	streams_.reserve(stream_list->num_streams);
+	inputStream_ = nullptr;
 
 	std::vector<Camera3StreamConfig> streamConfigs;
 	streamConfigs.reserve(stream_list->num_streams);
 
-	/* First handle all non-MJPEG streams. */
+	/* First handle all non-MJPEG output streams. */
 	camera3_stream_t *jpegStream = nullptr;
+	camera3_stream_t *inputStream = nullptr;
 	for (unsigned int i = 0; i < stream_list->num_streams; ++i) {
 		camera3_stream_t *stream = stream_list->streams[i];
 		Size size(stream->width, stream->height);
@@ -582,10 +671,51 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 			LOG(HAL, Error) << "Rotation is not supported";
 			return -EINVAL;
 		}
+
+		/*
+		 * Input streams are not backed by a libcamera stream, their
+		 * buffers are read by the post-processors when reprocessing.
+		 */
+		if (stream->stream_type == CAMERA3_STREAM_INPUT) {
+			if (inputStream) {
+				LOG(HAL, Error)
+					<< "Multiple input streams are not supported";
+				return -EINVAL;
+			}
+
+			if (stream->format != HAL_PIXEL_FORMAT_YCbCr_420_888) {
+				LOG(HAL, Error)
+					<< "Unsupported input stream format";
+				return -EINVAL;
+			}
+
+			stream->usage |= GRALLOC_USAGE_SW_READ_OFTEN;
+			stream->max_buffers = kMaxInputBuffers;
+			stream->priv = nullptr;
+			inputStream = stream;
+			continue;
+		}
+
+		if (stream->stream_type == CAMERA3_STREAM_BIDIRECTIONAL) {
+			LOG(HAL, Error) << "Bidirectional streams are not supported";
+			return -EINVAL;
+		}
+
+		CameraStream::Type type = CameraStream::Type::Direct;
 #if defined(OS_CHROMEOS)
+		/*
+		 * Rotated YUV streams are produced by the YUV post-processor,
+		 * which crops, scales and rotates an internal buffer of the
+		 * same size in a single software pass.
+		 */
 		if (stream->crop_rotate_scale_degrees != CAMERA3_STREAM_ROTATION_0) {
-			LOG(HAL, Error) << "Rotation is not supported";
-			return -EINVAL;
+			if (stream->format == HAL_PIXEL_FORMAT_BLOB) {
+				LOG(HAL, Error)
+					<< "Rotation is not supported for JPEG streams";
+				return -EINVAL;
+			}
+
+			type = CameraStream::Type::Internal;
 		}
 #endif
 
@@ -602,13 +732,18 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 		}
 
 		Camera3StreamConfig streamConfig;
-		streamConfig.streams = { { stream, CameraStream::Type::Direct } };
+		streamConfig.streams = { { stream, type } };
 		streamConfig.config.size = size;
 		streamConfig.config.pixelFormat = format;
 		streamConfigs.push_back(std::move(streamConfig));
 
-		/* This stream will be produced by hardware. */
-		stream->usage |= GRALLOC_USAGE_HW_CAMERA_WRITE;
+		if (type == CameraStream::Type::Internal) {
+			/* This stream will be produced by software. */
+			stream->usage |= GRALLOC_USAGE_SW_WRITE_OFTEN;
+		} else {
+			/* This stream will be produced by hardware. */
+			stream->usage |= GRALLOC_USAGE_HW_CAMERA_WRITE;
+		}
 	}
 
 	/* Now handle the MJPEG streams, adding a new stream if required. */
@@ -724,34 +859,52 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 		}
 	}
 
-	config_ = std::move(config);
-	return 0;
-}
-
-std::unique_ptr<FrameBuffer>
-CameraDevice::createFrameBuffer(const buffer_handle_t camera3buffer,
-				PixelFormat pixelFormat, const Size &size)
-{
-	CameraBuffer buf(camera3buffer, pixelFormat, size, PROT_READ);
-	if (!buf.isValid()) {
-		LOG(HAL, Fatal) << "Failed to create CameraBuffer";
-		return nullptr;
+	/*
+	 * Reprocessing requests are served by the post-processors, configure
+	 * the streams that can be produced from the input stream buffers.
+	 */
+	if (inputStream) {
+		StreamConfiguration input;
+		input.pixelFormat = capabilities_.toPixelFormat(inputStream->format);
+		input.size = { inputStream->width, inputStream->height };
+		input.stride = PixelFormatInfo::info(input.pixelFormat)
+				       .stride(input.size.width, 0);
+
+		for (CameraStream &cameraStream : streams_) {
+			ret = cameraStream.configureReprocessing(input);
+			if (ret) {
+				LOG(HAL, Error)
+					<< "Failed to configure stream reprocessing";
+				return ret;
+			}
+		}
 	}
 
-	std::vector<FrameBuffer::Plane> planes(buf.numPlanes());
-	for (size_t i = 0; i < buf.numPlanes(); ++i) {
-		FileDescriptor fd{ camera3buffer->data[i] };
-		if (!fd.isValid()) {
-			LOG(HAL, Fatal) << "No valid fd";
-			return nullptr;
-		}
+	inputStream_ = inputStream;
 
-		planes[i].fd = fd;
-		planes[i].offset = buf.offset(i);
-		planes[i].length = buf.size(i);
+	/*
+	 * In constrained high speed mode the framework keeps a batch being
+	 * captured while the next one is queued, make sure enough buffers are
+	 * requested for both.
+	 */
+	if (highSpeed_) {
+		const camera3_stream_t *stream = stream_list->streams[0];
+		unsigned int maxBatchSize =
+			capabilities_.maxHighSpeedFps({ stream->width, stream->height }) / 30;
+
+		for (CameraStream &cameraStream : streams_) {
+			camera3_stream_t *camera3Stream = cameraStream.camera3Stream();
+			camera3Stream->max_buffers = std::max(camera3Stream->max_buffers,
+							      2 * maxBatchSize);
+		}
 	}
 
-	return std::make_unique<FrameBuffer>(planes);
+	ret = buildResultMetadataTemplate();
+	if (ret)
+		return ret;
+
+	config_ = std::move(config);
+	return 0;
 }
 
 int CameraDevice::processControls(Camera3RequestDescriptor *descriptor)
@@ -809,6 +962,20 @@ int CameraDevice::processControls(Camera3RequestDescriptor *descriptor)
 		controls.set(controls::draft::TestPatternMode, testPatternMode);
 	}
 
+	/*
+	 * In constrained high speed mode the sensor has to run at the frame
+	 * rate requested for the recording session.
+	 *
+	 * \todo Translate the AE target FPS range in all modes.
+	 */
+	if (highSpeed_ &&
+	    settings.getEntry(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, &entry)) {
+		const int32_t *data = entry.data.i32;
+		controls.set(controls::FrameDurationLimits,
+			     { static_cast<int64_t>(1000000 / data[1]),
+			       static_cast<int64_t>(1000000 / data[0]) });
+	}
+
 	return 0;
 }
 
@@ -841,6 +1008,27 @@ bool CameraDevice::isValidRequest(camera3_capture_request_t *camera3Request) con
 		return false;
 	}
 
+	if (camera3Request->input_buffer) {
+		const camera3_stream_buffer_t *inputBuffer =
+			camera3Request->input_buffer;
+
+		if (!inputStream_ || inputBuffer->stream != inputStream_) {
+			LOG(HAL, Error) << "Invalid input stream";
+			return false;
+		}
+
+		if (!inputBuffer->buffer || !(*inputBuffer->buffer)) {
+			LOG(HAL, Error) << "Invalid input native handle";
+			return false;
+		}
+
+		/* The settings of the captured frame are always provided. */
+		if (!camera3Request->settings) {
+			LOG(HAL, Error) << "No settings for reprocessing request";
+			return false;
+		}
+	}
+
 	for (uint32_t i = 0; i < camera3Request->num_output_buffers; i++) {
 		const camera3_stream_buffer_t &outputBuffer =
 			camera3Request->output_buffers[i];
@@ -900,6 +1088,9 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 	auto descriptor = std::make_unique<Camera3RequestDescriptor>(camera_.get(),
 								     camera3Request);
 
+	if (descriptor->isReprocess())
+		return processReprocessRequest(std::move(descriptor));
+
 	/*
 	 * \todo The Android request model is incremental, settings passed in
 	 * previous requests are to be effective until overridden explicitly in
@@ -948,15 +1139,14 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 
 		case CameraStream::Type::Direct:
 			/*
-			 * Create a libcamera buffer using the dmabuf
-			 * descriptors of the camera3Buffer for each stream and
-			 * associate it with the Camera3RequestDescriptor for
-			 * lifetime management only.
+			 * Retrieve the libcamera buffer wrapping the dmabuf
+			 * descriptors of the camera3Buffer from the stream
+			 * cache, and associate it with the
+			 * Camera3RequestDescriptor to keep it alive until the
+			 * request completes.
 			 */
 			buffer.frameBuffer =
-				createFrameBuffer(*buffer.camera3Buffer,
-						  cameraStream->configuration().pixelFormat,
-						  cameraStream->configuration().size);
+				cameraStream->frameBuffer(*buffer.camera3Buffer);
 			frameBuffer = buffer.frameBuffer.get();
 			acquireFence = buffer.fence;
 			LOG(HAL, Debug) << ss.str() << " (direct)";
@@ -1007,7 +1197,7 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 		Camera3RequestDescriptor *rawDescriptor = descriptor.get();
 		{
 			MutexLocker descriptorsLock(descriptorsMutex_);
-			descriptors_.push(std::move(descriptor));
+			descriptors_.push_back(std::move(descriptor));
 		}
 		abortRequest(rawDescriptor);
 		completeDescriptor(rawDescriptor);
@@ -1030,16 +1220,174 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 
 	CaptureRequest *request = descriptor->request_.get();
 
+	if (!highSpeed_) {
+		{
+			MutexLocker descriptorsLock(descriptorsMutex_);
+			descriptors_.push_back(std::move(descriptor));
+		}
+
+		worker_.queueRequest(request);
+
+		return 0;
+	}
+
+	/*
+	 * In constrained high speed mode the framework submits the requests
+	 * in batches of one request per frame of a 30 FPS stream. Queue them
+	 * to the worker as a group and deliver their results together.
+	 */
+	if (batch_.empty()) {
+		camera_metadata_ro_entry_t entry;
+		batchSize_ = 1;
+		if (descriptor->settings_.getEntry(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, &entry))
+			batchSize_ = std::max(entry.data.i32[1] / 30, 1);
+	}
+
+	descriptor->lastInBatch_ = batch_.size() + 1 == batchSize_;
+
+	{
+		MutexLocker descriptorsLock(descriptorsMutex_);
+		descriptors_.push_back(std::move(descriptor));
+	}
+
+	batch_.push_back(request);
+	if (batch_.size() < batchSize_)
+		return 0;
+
+	worker_.queueRequests(batch_);
+	batch_.clear();
+
+	return 0;
+}
+
+/*
+ * Reprocessing requests don't involve the camera, the output buffers are
+ * produced from the input buffer by the post-processors. The request settings
+ * are the result metadata of the capture that produced the input buffer, and
+ * are reported back as the request result metadata.
+ */
+int CameraDevice::processReprocessRequest(std::unique_ptr<Camera3RequestDescriptor> descriptor)
+{
+	camera3_stream_buffer_t *inputBuffer = descriptor->inputBuffer_.get();
+
+	LOG(HAL, Debug) << "Reprocessing request " << descriptor->frameNumber_
+			<< " with " << descriptor->buffers_.size() << " streams";
+
+	if (inputBuffer->acquire_fence != -1) {
+		int ret = CameraStream::waitFence(inputBuffer->acquire_fence);
+		if (ret < 0) {
+			LOG(HAL, Error) << "Failed waiting for input fence: "
+					<< inputBuffer->acquire_fence;
+			return ret;
+		}
+
+		::close(inputBuffer->acquire_fence);
+		inputBuffer->acquire_fence = -1;
+	}
+
+	descriptor->inputFrameBuffer_ = CameraStream::createFrameBuffer(
+		*inputBuffer->buffer,
+		capabilities_.toPixelFormat(inputStream_->format),
+		{ inputStream_->width, inputStream_->height });
+	if (!descriptor->inputFrameBuffer_) {
+		LOG(HAL, Error) << "Failed to create input frame buffer";
+		return -ENOMEM;
+	}
+
+	descriptor->resultMetadata_ =
+		std::make_unique<CameraMetadata>(descriptor->settings_);
+
+	camera_metadata_ro_entry_t entry;
+	uint64_t sensorTimestamp = 0;
+	if (descriptor->settings_.getEntry(ANDROID_SENSOR_TIMESTAMP, &entry))
+		sensorTimestamp = *entry.data.i64;
+
+	Camera3RequestDescriptor *rawDescriptor = descriptor.get();
+
+	MutexLocker stateLock(stateMutex_);
+
+	{
+		MutexLocker descriptorsLock(descriptorsMutex_);
+		descriptors_.push_back(std::move(descriptor));
+	}
+
+	if (state_ == State::Flushing) {
+		abortRequest(rawDescriptor);
+		completeDescriptor(rawDescriptor);
+
+		return 0;
+	}
+
 	{
 		MutexLocker descriptorsLock(descriptorsMutex_);
-		descriptors_.push(std::move(descriptor));
+		notifyShutter(rawDescriptor->frameNumber_, sensorTimestamp);
+		rawDescriptor->shutterNotified_ = true;
 	}
 
-	worker_.queueRequest(request);
+	MutexLocker locker(rawDescriptor->streamsProcessMutex_);
+
+	for (auto &buffer : rawDescriptor->buffers_) {
+		buffer.srcBuffer = rawDescriptor->inputFrameBuffer_.get();
+
+		int ret = buffer.stream->process(&buffer);
+		if (ret) {
+			setBufferStatus(buffer, Camera3RequestDescriptor::Status::Error);
+			continue;
+		}
+
+		rawDescriptor->pendingStreamsToProcess_.insert(
+			{ buffer.stream, &buffer });
+	}
+
+	if (rawDescriptor->pendingStreamsToProcess_.empty()) {
+		locker.unlock();
+		completeDescriptor(rawDescriptor);
+	}
 
 	return 0;
 }
 
+/*
+ * Deliver the 3A results of a request as a partial result as soon as the IPA
+ * has produced them, without waiting for the request buffers to complete. The
+ * shutter notification has to precede any result, the partial result is thus
+ * only sent early once the sensor timestamp is known, and when the shutter of
+ * all the previous requests has been notified as the framework requires
+ * shutter notifications in order. Otherwise it is sent at request completion
+ * time.
+ */
+void CameraDevice::metadataAvailable(Request *request,
+				     [[maybe_unused]] const ControlList &metadata)
+{
+	Camera3RequestDescriptor *descriptor =
+		reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+
+	if (!request->metadata().contains(controls::SensorTimestamp))
+		return;
+
+	MutexLocker descriptorsLock(descriptorsMutex_);
+
+	if (descriptor->partialResultSent_)
+		return;
+
+	for (const auto &previous : descriptors_) {
+		if (previous.get() == descriptor)
+			break;
+
+		if (!previous->shutterNotified_)
+			return;
+	}
+
+	if (!descriptor->shutterNotified_) {
+		uint64_t sensorTimestamp = static_cast<uint64_t>(request->metadata()
+								 .get(controls::SensorTimestamp));
+		notifyShutter(descriptor->frameNumber_, sensorTimestamp);
+		descriptor->shutterNotified_ = true;
+	}
+
+	sendPartialResult(descriptor);
+}
+
 void CameraDevice::requestComplete(Request *request)
 {
 	Camera3RequestDescriptor *descriptor =
@@ -1072,28 +1420,53 @@ void CameraDevice::requestComplete(Request *request)
 
 	/*
 	 * If the Request has failed, abort the request by notifying the error
-	 * and complete the request with all buffers in error state.
+	 * and complete the request with all buffers in error state. A request
+	 * can't be aborted once its partial result has been sent, report the
+	 * result and the buffers as failed instead.
 	 */
 	if (request->status() != Request::RequestComplete) {
 		LOG(HAL, Error) << "Request " << request->cookie()
 				<< " not successfully completed: "
 				<< request->status();
 
-		abortRequest(descriptor);
+		bool partialResultSent;
+		{
+			MutexLocker descriptorsLock(descriptorsMutex_);
+			partialResultSent = descriptor->partialResultSent_;
+		}
+
+		if (partialResultSent) {
+			notifyError(descriptor->frameNumber_, nullptr,
+				    CAMERA3_MSG_ERROR_RESULT);
+			for (auto &buffer : descriptor->buffers_)
+				setBufferStatus(buffer, Camera3RequestDescriptor::Status::Error);
+		} else {
+			abortRequest(descriptor);
+		}
+
 		completeDescriptor(descriptor);
 
 		return;
 	}
 
 	/*
-	 * Notify shutter as soon as we have verified we have a valid request.
-	 *
-	 * \todo The shutter event notification should be sent to the framework
-	 * as soon as possible, earlier than request completion time.
+	 * Notify shutter as soon as we have verified we have a valid request,
+	 * and send the 3A results if they haven't been delivered early by
+	 * metadataAvailable().
 	 */
-	uint64_t sensorTimestamp = static_cast<uint64_t>(request->metadata()
-							 .get(controls::SensorTimestamp));
-	notifyShutter(descriptor->frameNumber_, sensorTimestamp);
+	{
+		MutexLocker descriptorsLock(descriptorsMutex_);
+
+		if (!descriptor->shutterNotified_) {
+			uint64_t sensorTimestamp = static_cast<uint64_t>(request->metadata()
+									 .get(controls::SensorTimestamp));
+			notifyShutter(descriptor->frameNumber_, sensorTimestamp);
+			descriptor->shutterNotified_ = true;
+		}
+
+		if (!descriptor->partialResultSent_)
+			sendPartialResult(descriptor);
+	}
 
 	LOG(HAL, Debug) << "Request " << request->cookie() << " completed with "
 			<< descriptor->buffers_.size() << " streams";
@@ -1172,46 +1545,137 @@ void CameraDevice::completeDescriptor(Camera3RequestDescriptor *descriptor)
 
 void CameraDevice::sendCaptureResults()
 {
-	while (!descriptors_.empty() && !descriptors_.front()->isPending()) {
-		auto descriptor = std::move(descriptors_.front());
-		descriptors_.pop();
+	while (!descriptors_.empty()) {
+		/*
+		 * Deliver the results in order, a whole batch at a time in
+		 * constrained high speed mode.
+		 */
+		auto last = std::find_if(descriptors_.begin(), descriptors_.end(),
+					 [](const auto &descriptor) {
+						 return descriptor->isPending() ||
+							descriptor->lastInBatch_;
+					 });
+		if (last == descriptors_.end() || (*last)->isPending())
+			return;
 
-		camera3_capture_result_t captureResult = {};
+		size_t count = last - descriptors_.begin() + 1;
+		while (count--) {
+			std::unique_ptr<Camera3RequestDescriptor> descriptor =
+				std::move(descriptors_.front());
+			descriptors_.pop_front();
 
-		captureResult.frame_number = descriptor->frameNumber_;
+			sendCaptureResult(descriptor.get());
+		}
+	}
+}
 
-		if (descriptor->resultMetadata_)
-			captureResult.result =
-				descriptor->resultMetadata_->getMetadata();
+void CameraDevice::sendCaptureResult(Camera3RequestDescriptor *descriptor)
+{
+	camera3_capture_result_t captureResult = {};
 
-		std::vector<camera3_stream_buffer_t> resultBuffers;
-		resultBuffers.reserve(descriptor->buffers_.size());
+	captureResult.frame_number = descriptor->frameNumber_;
 
-		for (const auto &buffer : descriptor->buffers_) {
-			camera3_buffer_status status = CAMERA3_BUFFER_STATUS_ERROR;
+	if (descriptor->resultMetadata_)
+		captureResult.result =
+			descriptor->resultMetadata_->getMetadata();
 
-			if (buffer.status == Camera3RequestDescriptor::Status::Success)
-				status = CAMERA3_BUFFER_STATUS_OK;
+	std::vector<camera3_stream_buffer_t> resultBuffers;
+	resultBuffers.reserve(descriptor->buffers_.size());
 
-			/*
-			 * Pass the buffer fence back to the camera framework as
-			 * a release fence. This instructs the framework to wait
-			 * on the acquire fence in case we haven't done so
-			 * ourselves for any reason.
-			 */
-			resultBuffers.push_back({ buffer.stream->camera3Stream(),
-						  buffer.camera3Buffer, status,
-						  -1, buffer.fence });
-		}
+	for (const auto &buffer : descriptor->buffers_) {
+		camera3_buffer_status status = CAMERA3_BUFFER_STATUS_ERROR;
+
+		if (buffer.status == Camera3RequestDescriptor::Status::Success)
+			status = CAMERA3_BUFFER_STATUS_OK;
+
+		/*
+		 * Pass the buffer fence back to the camera framework as
+		 * a release fence. This instructs the framework to wait
+		 * on the acquire fence in case we haven't done so
+		 * ourselves for any reason.
+		 */
+		resultBuffers.push_back({ buffer.stream->camera3Stream(),
+					  buffer.camera3Buffer, status,
+					  -1, buffer.fence });
+	}
+
+	captureResult.num_output_buffers = resultBuffers.size();
+	captureResult.output_buffers = resultBuffers.data();
+	captureResult.input_buffer = descriptor->inputBuffer_.get();
+
+	if (descriptor->status_ == Camera3RequestDescriptor::Status::Success)
+		captureResult.partial_result = CameraCapabilities::kPartialResultCount;
+
+	callbacks_->process_capture_result(callbacks_, &captureResult);
 
-		captureResult.num_output_buffers = resultBuffers.size();
-		captureResult.output_buffers = resultBuffers.data();
+	/*
+	 * The camera framework copies the result metadata, recycle the
+	 * pack for the next requests.
+	 */
+	std::unique_ptr<CameraMetadata> &resultMetadata =
+		descriptor->resultMetadata_;
+	if (resultMetadata && resultMetadata->isValid())
+		resultMetadataPool_.push_back(std::move(resultMetadata));
+}
+
+/*
+ * Send the 3A results of a request, produced from the partial result template,
+ * as the first partial result. The framework copies the metadata, the pack is
+ * reused for all requests. The caller shall hold the descriptorsMutex_.
+ */
+void CameraDevice::sendPartialResult(Camera3RequestDescriptor *descriptor)
+{
+	const ControlList &metadata = descriptor->request_->metadata();
+	const CameraMetadata &settings = descriptor->settings_;
+	camera_metadata_ro_entry_t entry;
+
+	if (!partialResultMetadata_.copyFrom(partialResultTemplate_)) {
+		LOG(HAL, Error) << "Failed to allocate partial result metadata";
+		return;
+	}
+
+	if (settings.getEntry(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, &entry))
+		/*
+		 * \todo Retrieve the AE FPS range from the libcamera metadata.
+		 * As libcamera does not support that control, as a temporary
+		 * workaround return what the framework asked.
+		 */
+		partialResultMetadata_.addEntry(ANDROID_CONTROL_AE_TARGET_FPS_RANGE,
+						entry.data.i32, 2);
+
+	if (settings.getEntry(ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER, &entry))
+		partialResultMetadata_.updateEntry(ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER,
+						   *entry.data.u8);
+
+	/* The libcamera 3A states share the values of the Android ones. */
+	if (metadata.contains(controls::draft::AeState)) {
+		uint8_t aeState = metadata.get(controls::draft::AeState);
+		partialResultMetadata_.updateEntry(ANDROID_CONTROL_AE_STATE, aeState);
+	}
+
+	if (metadata.contains(controls::draft::AfState)) {
+		uint8_t afState = metadata.get(controls::draft::AfState);
+		partialResultMetadata_.updateEntry(ANDROID_CONTROL_AF_STATE, afState);
+	}
 
-		if (descriptor->status_ == Camera3RequestDescriptor::Status::Success)
-			captureResult.partial_result = 1;
+	if (metadata.contains(controls::draft::AwbState)) {
+		uint8_t awbState = metadata.get(controls::draft::AwbState);
+		partialResultMetadata_.updateEntry(ANDROID_CONTROL_AWB_STATE, awbState);
+	}
 
-		callbacks_->process_capture_result(callbacks_, &captureResult);
+	if (!partialResultMetadata_.isValid()) {
+		LOG(HAL, Error) << "Failed to construct partial result metadata";
+		return;
 	}
+
+	camera3_capture_result_t captureResult = {};
+	captureResult.frame_number = descriptor->frameNumber_;
+	captureResult.result = partialResultMetadata_.getMetadata();
+	captureResult.partial_result = 1;
+
+	callbacks_->process_capture_result(callbacks_, &captureResult);
+
+	descriptor->partialResultSent_ = true;
 }
 
 void CameraDevice::setBufferStatus(Camera3RequestDescriptor::StreamBuffer &streamBuffer,
@@ -1284,158 +1748,236 @@ void CameraDevice::notifyError(uint32_t frameNumber, camera3_stream_t *stream,
 }
 
 /*
- * Produce a set of fixed result metadata.
+ * Build the templates from which the result metadata of every request is
+ * produced. They contain the entries whose value doesn't depend on the request,
+ * and placeholders for the dynamic entries that are always reported, which are
+ * updated in place by getResultMetadata() and sendPartialResult(). Space is
+ * reserved for the optional dynamic entries and the JPEG metadata set by the
+ * post-processor, so that the result metadata packs recycled from completed
+ * requests never need to be reallocated.
+ *
+ * The 3A entries are delivered in the first partial result, and are thus
+ * stored in a separate template.
  */
-std::unique_ptr<CameraMetadata>
-CameraDevice::getResultMetadata(const Camera3RequestDescriptor &descriptor) const
+int CameraDevice::buildResultMetadataTemplate()
 {
-	const ControlList &metadata = descriptor.request_->metadata();
-	const CameraMetadata &settings = descriptor.settings_;
-	camera_metadata_ro_entry_t entry;
-	bool found;
-
 	/*
 	 * \todo Keep this in sync with the actual number of entries.
-	 * Currently: 40 entries, 156 bytes
-	 *
-	 * Reserve more space for the JPEG metadata set by the post-processor.
-	 * Currently:
-	 * ANDROID_JPEG_GPS_COORDINATES (double x 3) = 24 bytes
-	 * ANDROID_JPEG_GPS_PROCESSING_METHOD (byte x 32) = 32 bytes
-	 * ANDROID_JPEG_GPS_TIMESTAMP (int64) = 8 bytes
-	 * ANDROID_JPEG_SIZE (int32_t) = 4 bytes
-	 * ANDROID_JPEG_QUALITY (byte) = 1 byte
-	 * ANDROID_JPEG_ORIENTATION (int32_t) = 4 bytes
-	 * ANDROID_JPEG_THUMBNAIL_QUALITY (byte) = 1 byte
-	 * ANDROID_JPEG_THUMBNAIL_SIZE (int32 x 2) = 8 bytes
-	 * Total bytes for JPEG metadata: 82
+	 * Currently: 14 entries, 8 bytes
 	 */
-	std::unique_ptr<CameraMetadata> resultMetadata =
-		std::make_unique<CameraMetadata>(44, 166);
-	if (!resultMetadata->isValid()) {
-		LOG(HAL, Error) << "Failed to allocate result metadata";
-		return nullptr;
+	CameraMetadata partialResult(14, 8);
+	if (!partialResult.isValid()) {
+		LOG(HAL, Error) << "Failed to allocate partial result metadata template";
+		return -ENOMEM;
 	}
 
-	/*
-	 * \todo The value of the results metadata copied from the settings
-	 * will have to be passed to the libcamera::Camera and extracted
-	 * from libcamera::Request::metadata.
-	 */
-
-	uint8_t value = ANDROID_COLOR_CORRECTION_ABERRATION_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_COLOR_CORRECTION_ABERRATION_MODE,
-				 value);
-
-	value = ANDROID_CONTROL_AE_ANTIBANDING_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_CONTROL_AE_ANTIBANDING_MODE, value);
+	uint8_t value = ANDROID_CONTROL_AE_ANTIBANDING_MODE_OFF;
+	partialResult.addEntry(ANDROID_CONTROL_AE_ANTIBANDING_MODE, value);
 
 	int32_t value32 = 0;
-	resultMetadata->addEntry(ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION,
-				 value32);
+	partialResult.addEntry(ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION,
+			       value32);
 
 	value = ANDROID_CONTROL_AE_LOCK_OFF;
-	resultMetadata->addEntry(ANDROID_CONTROL_AE_LOCK, value);
+	partialResult.addEntry(ANDROID_CONTROL_AE_LOCK, value);
 
 	value = ANDROID_CONTROL_AE_MODE_ON;
-	resultMetadata->addEntry(ANDROID_CONTROL_AE_MODE, value);
+	partialResult.addEntry(ANDROID_CONTROL_AE_MODE, value);
 
-	if (settings.getEntry(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, &entry))
-		/*
-		 * \todo Retrieve the AE FPS range from the libcamera metadata.
-		 * As libcamera does not support that control, as a temporary
-		 * workaround return what the framework asked.
-		 */
-		resultMetadata->addEntry(ANDROID_CONTROL_AE_TARGET_FPS_RANGE,
-					 entry.data.i32, 2);
-
-	found = settings.getEntry(ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER, &entry);
-	value = found ? *entry.data.u8 :
-			(uint8_t)ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER_IDLE;
-	resultMetadata->addEntry(ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER, value);
+	/* Updated from the request settings by sendPartialResult(). */
+	value = ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER_IDLE;
+	partialResult.addEntry(ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER, value);
 
+	/* Updated from the libcamera metadata by sendPartialResult(). */
 	value = ANDROID_CONTROL_AE_STATE_CONVERGED;
-	resultMetadata->addEntry(ANDROID_CONTROL_AE_STATE, value);
+	partialResult.addEntry(ANDROID_CONTROL_AE_STATE, value);
 
 	value = ANDROID_CONTROL_AF_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_CONTROL_AF_MODE, value);
+	partialResult.addEntry(ANDROID_CONTROL_AF_MODE, value);
 
+	/* Updated from the libcamera metadata by sendPartialResult(). */
 	value = ANDROID_CONTROL_AF_STATE_INACTIVE;
-	resultMetadata->addEntry(ANDROID_CONTROL_AF_STATE, value);
+	partialResult.addEntry(ANDROID_CONTROL_AF_STATE, value);
 
 	value = ANDROID_CONTROL_AF_TRIGGER_IDLE;
-	resultMetadata->addEntry(ANDROID_CONTROL_AF_TRIGGER, value);
+	partialResult.addEntry(ANDROID_CONTROL_AF_TRIGGER, value);
 
 	value = ANDROID_CONTROL_AWB_MODE_AUTO;
-	resultMetadata->addEntry(ANDROID_CONTROL_AWB_MODE, value);
+	partialResult.addEntry(ANDROID_CONTROL_AWB_MODE, value);
 
 	value = ANDROID_CONTROL_AWB_LOCK_OFF;
-	resultMetadata->addEntry(ANDROID_CONTROL_AWB_LOCK, value);
+	partialResult.addEntry(ANDROID_CONTROL_AWB_LOCK, value);
 
+	/* Updated from the libcamera metadata by sendPartialResult(). */
 	value = ANDROID_CONTROL_AWB_STATE_CONVERGED;
-	resultMetadata->addEntry(ANDROID_CONTROL_AWB_STATE, value);
+	partialResult.addEntry(ANDROID_CONTROL_AWB_STATE, value);
+
+	value = ANDROID_CONTROL_MODE_AUTO;
+	partialResult.addEntry(ANDROID_CONTROL_MODE, value);
+
+	if (!partialResult.isValid()) {
+		LOG(HAL, Error) << "Failed to construct partial result metadata template";
+		return -EINVAL;
+	}
+
+	partialResult.sort();
+
+	if (!partialResultTemplate_.copyFrom(partialResult)) {
+		LOG(HAL, Error) << "Failed to store partial result metadata template";
+		return -ENOMEM;
+	}
+
+	/*
+	 * \todo Keep this in sync with the actual number of entries.
+	 * Currently: 26 entries, 148 bytes
+	 *
+	 * Reserve more space for the JPEG metadata set by the post-processor.
+	 * Currently:
+	 * ANDROID_JPEG_GPS_COORDINATES (double x 3) = 24 bytes
+	 * ANDROID_JPEG_GPS_PROCESSING_METHOD (byte x 32) = 32 bytes
+	 * ANDROID_JPEG_GPS_TIMESTAMP (int64) = 8 bytes
+	 * ANDROID_JPEG_SIZE (int32_t) = 4 bytes
+	 * ANDROID_JPEG_QUALITY (byte) = 1 byte
+	 * ANDROID_JPEG_ORIENTATION (int32_t) = 4 bytes
+	 * ANDROID_JPEG_THUMBNAIL_QUALITY (byte) = 1 byte
+	 * ANDROID_JPEG_THUMBNAIL_SIZE (int32 x 2) = 8 bytes
+	 * Total bytes for JPEG metadata: 82
+	 */
+	CameraMetadata resultMetadata(30, 158);
+	if (!resultMetadata.isValid()) {
+		LOG(HAL, Error) << "Failed to allocate result metadata template";
+		return -ENOMEM;
+	}
+
+	/*
+	 * \todo The value of the results metadata copied from the settings
+	 * will have to be passed to the libcamera::Camera and extracted
+	 * from libcamera::Request::metadata.
+	 */
+
+	value = ANDROID_COLOR_CORRECTION_ABERRATION_MODE_OFF;
+	resultMetadata.addEntry(ANDROID_COLOR_CORRECTION_ABERRATION_MODE,
+				value);
 
 	value = ANDROID_CONTROL_CAPTURE_INTENT_PREVIEW;
-	resultMetadata->addEntry(ANDROID_CONTROL_CAPTURE_INTENT, value);
+	resultMetadata.addEntry(ANDROID_CONTROL_CAPTURE_INTENT, value);
 
 	value = ANDROID_CONTROL_EFFECT_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_CONTROL_EFFECT_MODE, value);
-
-	value = ANDROID_CONTROL_MODE_AUTO;
-	resultMetadata->addEntry(ANDROID_CONTROL_MODE, value);
+	resultMetadata.addEntry(ANDROID_CONTROL_EFFECT_MODE, value);
 
 	value = ANDROID_CONTROL_SCENE_MODE_DISABLED;
-	resultMetadata->addEntry(ANDROID_CONTROL_SCENE_MODE, value);
+	resultMetadata.addEntry(ANDROID_CONTROL_SCENE_MODE, value);
 
 	value = ANDROID_CONTROL_VIDEO_STABILIZATION_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_CONTROL_VIDEO_STABILIZATION_MODE, value);
+	resultMetadata.addEntry(ANDROID_CONTROL_VIDEO_STABILIZATION_MODE, value);
 
 	value = ANDROID_FLASH_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_FLASH_MODE, value);
+	resultMetadata.addEntry(ANDROID_FLASH_MODE, value);
 
 	value = ANDROID_FLASH_STATE_UNAVAILABLE;
-	resultMetadata->addEntry(ANDROID_FLASH_STATE, value);
-
-	if (settings.getEntry(ANDROID_LENS_APERTURE, &entry))
-		resultMetadata->addEntry(ANDROID_LENS_APERTURE, entry.data.f, 1);
+	resultMetadata.addEntry(ANDROID_FLASH_STATE, value);
 
 	float focal_length = 1.0;
-	resultMetadata->addEntry(ANDROID_LENS_FOCAL_LENGTH, focal_length);
+	resultMetadata.addEntry(ANDROID_LENS_FOCAL_LENGTH, focal_length);
 
 	value = ANDROID_LENS_STATE_STATIONARY;
-	resultMetadata->addEntry(ANDROID_LENS_STATE, value);
+	resultMetadata.addEntry(ANDROID_LENS_STATE, value);
 
 	value = ANDROID_LENS_OPTICAL_STABILIZATION_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_LENS_OPTICAL_STABILIZATION_MODE,
-				 value);
+	resultMetadata.addEntry(ANDROID_LENS_OPTICAL_STABILIZATION_MODE,
+				value);
 
+	/* Updated from the libcamera metadata by getResultMetadata(). */
 	value32 = ANDROID_SENSOR_TEST_PATTERN_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_SENSOR_TEST_PATTERN_MODE, value32);
+	resultMetadata.addEntry(ANDROID_SENSOR_TEST_PATTERN_MODE, value32);
 
 	value = ANDROID_STATISTICS_FACE_DETECT_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_STATISTICS_FACE_DETECT_MODE, value);
+	resultMetadata.addEntry(ANDROID_STATISTICS_FACE_DETECT_MODE, value);
 
 	value = ANDROID_STATISTICS_LENS_SHADING_MAP_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_STATISTICS_LENS_SHADING_MAP_MODE,
-				 value);
+	resultMetadata.addEntry(ANDROID_STATISTICS_LENS_SHADING_MAP_MODE,
+				value);
 
 	value = ANDROID_STATISTICS_HOT_PIXEL_MAP_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_STATISTICS_HOT_PIXEL_MAP_MODE, value);
+	resultMetadata.addEntry(ANDROID_STATISTICS_HOT_PIXEL_MAP_MODE, value);
 
 	value = ANDROID_STATISTICS_SCENE_FLICKER_NONE;
-	resultMetadata->addEntry(ANDROID_STATISTICS_SCENE_FLICKER, value);
+	resultMetadata.addEntry(ANDROID_STATISTICS_SCENE_FLICKER, value);
 
 	value = ANDROID_NOISE_REDUCTION_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_NOISE_REDUCTION_MODE, value);
+	resultMetadata.addEntry(ANDROID_NOISE_REDUCTION_MODE, value);
 
 	/* 33.3 msec */
 	const int64_t rolling_shutter_skew = 33300000;
-	resultMetadata->addEntry(ANDROID_SENSOR_ROLLING_SHUTTER_SKEW,
-				 rolling_shutter_skew);
+	resultMetadata.addEntry(ANDROID_SENSOR_ROLLING_SHUTTER_SKEW,
+				rolling_shutter_skew);
+
+	/* Updated from the libcamera metadata by getResultMetadata(). */
+	const int64_t timestamp = 0;
+	resultMetadata.addEntry(ANDROID_SENSOR_TIMESTAMP, timestamp);
+
+	if (!resultMetadata.isValid()) {
+		LOG(HAL, Error) << "Failed to construct result metadata template";
+		return -EINVAL;
+	}
+
+	/*
+	 * Sort the template, the entries added by getResultMetadata() are
+	 * appended after the sorted ones.
+	 */
+	resultMetadata.sort();
+
+	/*
+	 * Copy the template with copyFrom(), the copy assignment operator
+	 * would shrink the capacity to the entries currently used.
+	 */
+	if (!resultMetadataTemplate_.copyFrom(resultMetadata)) {
+		LOG(HAL, Error) << "Failed to store result metadata template";
+		return -ENOMEM;
+	}
+
+	MutexLocker descriptorsLock(descriptorsMutex_);
+	resultMetadataPool_.clear();
+
+	return 0;
+}
+
+/*
+ * Produce the result metadata for a request from the template built at
+ * configuration time. The metadata pack is recycled from a previously
+ * completed request when possible, and only the dynamic entries are updated.
+ */
+std::unique_ptr<CameraMetadata>
+CameraDevice::getResultMetadata(const Camera3RequestDescriptor &descriptor)
+{
+	const ControlList &metadata = descriptor.request_->metadata();
+	const CameraMetadata &settings = descriptor.settings_;
+	camera_metadata_ro_entry_t entry;
+
+	std::unique_ptr<CameraMetadata> resultMetadata;
+
+	{
+		MutexLocker descriptorsLock(descriptorsMutex_);
+		if (!resultMetadataPool_.empty()) {
+			resultMetadata = std::move(resultMetadataPool_.back());
+			resultMetadataPool_.pop_back();
+		}
+	}
+
+	if (!resultMetadata)
+		resultMetadata = std::make_unique<CameraMetadata>();
+
+	if (!resultMetadata->copyFrom(resultMetadataTemplate_)) {
+		LOG(HAL, Error) << "Failed to allocate result metadata";
+		return nullptr;
+	}
+
+	if (settings.getEntry(ANDROID_LENS_APERTURE, &entry))
+		resultMetadata->addEntry(ANDROID_LENS_APERTURE, entry.data.f, 1);
 
 	/* Add metadata tags reported by libcamera. */
 	const int64_t timestamp = metadata.get(controls::SensorTimestamp);
-	resultMetadata->addEntry(ANDROID_SENSOR_TIMESTAMP, timestamp);
+	resultMetadata->updateEntry(ANDROID_SENSOR_TIMESTAMP, timestamp);
 
 	if (metadata.contains(controls::draft::PipelineDepth)) {
 		uint8_t pipeline_depth =
@@ -1467,8 +2009,8 @@ CameraDevice::getResultMetadata(const Camera3RequestDescriptor &descriptor) cons
 	if (metadata.contains(controls::draft::TestPatternMode)) {
 		const int32_t testPatternMode =
 			metadata.get(controls::draft::TestPatternMode);
-		resultMetadata->addEntry(ANDROID_SENSOR_TEST_PATTERN_MODE,
-					 testPatternMode);
+		resultMetadata->updateEntry(ANDROID_SENSOR_TEST_PATTERN_MODE,
+					    testPatternMode);
 	}
 
 	/*
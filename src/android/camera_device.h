@@ -7,10 +7,10 @@
 
 #pragma once
 
+#include <deque>
 #include <map>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <vector>
 
 #include <hardware/camera3.h>
@@ -28,13 +28,14 @@
 #include <libcamera/stream.h>
 
 #include "camera_capabilities.h"
+#include "camera_hal_config.h"
 #include "camera_metadata.h"
 #include "camera_stream.h"
 #include "camera_worker.h"
+#include "post_processor_pool.h"
 #include "jpeg/encoder.h"
 
 class Camera3RequestDescriptor;
-struct CameraConfigData;
 
 class CameraDevice : protected libcamera::Loggable
 {
@@ -58,13 +59,17 @@ public:
 	const std::string &model() const { return model_; }
 	int facing() const { return facing_; }
 	int orientation() const { return orientation_; }
+	CameraConfigData::JpegEncoder jpegEncoder() const { return jpegEncoder_; }
 	unsigned int maxJpegBufferSize() const;
+	PostProcessorPool *postProcessorPool() { return &postProcessorPool_; }
 
 	void setCallbacks(const camera3_callback_ops_t *callbacks);
 	const camera_metadata_t *getStaticMetadata();
 	const camera_metadata_t *constructDefaultRequestSettings(int type);
 	int configureStreams(camera3_stream_configuration_t *stream_list);
 	int processCaptureRequest(camera3_capture_request_t *request);
+	void metadataAvailable(libcamera::Request *request,
+			       const libcamera::ControlList &metadata);
 	void requestComplete(libcamera::Request *request);
 	void streamProcessingComplete(Camera3RequestDescriptor::StreamBuffer *bufferStream,
 				      Camera3RequestDescriptor::Status status);
@@ -85,22 +90,23 @@ private:
 
 	void stop();
 
-	std::unique_ptr<libcamera::FrameBuffer>
-	createFrameBuffer(const buffer_handle_t camera3buffer,
-			  libcamera::PixelFormat pixelFormat,
-			  const libcamera::Size &size);
 	void abortRequest(Camera3RequestDescriptor *descriptor) const;
 	bool isValidRequest(camera3_capture_request_t *request) const;
 	void notifyShutter(uint32_t frameNumber, uint64_t timestamp);
 	void notifyError(uint32_t frameNumber, camera3_stream_t *stream,
 			 camera3_error_msg_code code) const;
 	int processControls(Camera3RequestDescriptor *descriptor);
+	int processReprocessRequest(std::unique_ptr<Camera3RequestDescriptor> descriptor);
+	bool validateHighSpeedStreams(const camera3_stream_configuration_t &streamList) const;
 	void completeDescriptor(Camera3RequestDescriptor *descriptor);
 	void sendCaptureResults();
+	void sendCaptureResult(Camera3RequestDescriptor *descriptor);
+	void sendPartialResult(Camera3RequestDescriptor *descriptor);
 	void setBufferStatus(Camera3RequestDescriptor::StreamBuffer &buffer,
 			     Camera3RequestDescriptor::Status status);
+	int buildResultMetadataTemplate();
 	std::unique_ptr<CameraMetadata> getResultMetadata(
-		const Camera3RequestDescriptor &descriptor) const;
+		const Camera3RequestDescriptor &descriptor);
 
 	unsigned int id_;
 	camera3_device_t camera3Device_;
@@ -118,15 +124,32 @@ private:
 	const camera3_callback_ops_t *callbacks_;
 
 	std::vector<CameraStream> streams_;
-
-	libcamera::Mutex descriptorsMutex_; /* Protects descriptors_. */
-	std::queue<std::unique_ptr<Camera3RequestDescriptor>> descriptors_;
+	camera3_stream_t *inputStream_;
+
+	/* Request batching in constrained high speed mode. */
+	bool highSpeed_;
+	unsigned int batchSize_;
+	std::vector<CaptureRequest *> batch_;
+	PostProcessorPool postProcessorPool_;
+
+	/*
+	 * Protects descriptors_, resultMetadataPool_ and
+	 * partialResultMetadata_.
+	 */
+	libcamera::Mutex descriptorsMutex_;
+	std::deque<std::unique_ptr<Camera3RequestDescriptor>> descriptors_;
+	std::vector<std::unique_ptr<CameraMetadata>> resultMetadataPool_;
+	CameraMetadata partialResultMetadata_;
+
+	CameraMetadata resultMetadataTemplate_;
+	CameraMetadata partialResultTemplate_;
 
 	std::string maker_;
 	std::string model_;
 
 	int facing_;
 	int orientation_;
+	CameraConfigData::JpegEncoder jpegEncoder_;
 
 	CameraMetadata lastSettings_;
 };
@@ -42,6 +42,8 @@ private:
 	int parseValueBlock();
 	int parseCameraLocation(CameraConfigData *cameraConfigData,
 				const std::string &location);
+	int parseJpegEncoder(CameraConfigData *cameraConfigData,
+			     const std::string &encoder);
 	int parseCameraConfigData(const std::string &cameraId);
 	int parseCameras();
 	int parseEntry();
@@ -132,6 +134,19 @@ int CameraHalConfig::Private::parseCameraLocation(CameraConfigData *cameraConfig
 	return 0;
 }
 
+int CameraHalConfig::Private::parseJpegEncoder(CameraConfigData *cameraConfigData,
+					       const std::string &encoder)
+{
+	if (encoder == "libjpeg")
+		cameraConfigData->jpegEncoder = CameraConfigData::JpegEncoder::LibJpeg;
+	else if (encoder == "v4l2")
+		cameraConfigData->jpegEncoder = CameraConfigData::JpegEncoder::V4L2M2M;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
 int CameraHalConfig::Private::parseCameraConfigData(const std::string &cameraId)
 {
 	int ret = parseValueBlock();
@@ -180,6 +195,13 @@ int CameraHalConfig::Private::parseCameraConfigData(const std::string &cameraId)
 					return -EINVAL;
 				}
 				cameraConfigData.rotation = ret;
+			} else if (key == "jpeg-encoder") {
+				ret = parseJpegEncoder(&cameraConfigData, value);
+				if (ret) {
+					LOG(HALConfig, Error)
+						<< "Unknown JPEG encoder: " << value;
+					return -EINVAL;
+				}
 			} else {
 				LOG(HALConfig, Error)
 					<< "Unknown key: " << key;
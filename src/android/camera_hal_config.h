@@ -13,8 +13,14 @@
 #include <libcamera/base/class.h>
 
 struct CameraConfigData {
+	enum class JpegEncoder {
+		LibJpeg,
+		V4L2M2M,
+	};
+
 	int facing = -1;
 	int rotation = -1;
+	JpegEncoder jpegEncoder = JpegEncoder::LibJpeg;
 };
 
 class CameraHalConfig final : public libcamera::Extensible
@@ -7,6 +7,8 @@
 
 #include "camera_metadata.h"
 
+#include <algorithm>
+
 #include <libcamera/base/log.h>
 
 using namespace libcamera;
@@ -30,6 +32,8 @@ CameraMetadata::CameraMetadata(const camera_metadata_t *metadata)
 {
 	metadata_ = clone_camera_metadata(metadata);
 	valid_ = metadata_ != nullptr;
+
+	buildIndex();
 }
 
 CameraMetadata::CameraMetadata(const CameraMetadata &other)
@@ -54,9 +58,79 @@ CameraMetadata &CameraMetadata::operator=(const CameraMetadata &other)
 	metadata_ = clone_camera_metadata(other.getMetadata());
 	valid_ = metadata_ != nullptr;
 
+	/* Cloning preserves the order of the entries. */
+	if (valid_)
+		index_ = other.index_;
+	else
+		index_.clear();
+
 	return *this;
 }
 
+/*
+ * \brief Replace the content of the container with a copy of \a other
+ * \param[in] other The metadata pack to copy
+ *
+ * Unlike the copy assignment operator, the existing buffer is reused when its
+ * capacity is large enough to hold the capacity of \a other, which avoids any
+ * memory allocation when recycling metadata packs. The entry and data capacity
+ * of the container are never reduced.
+ *
+ * \return True if the copy was successful, false otherwise
+ */
+bool CameraMetadata::copyFrom(const CameraMetadata &other)
+{
+	if (this == &other)
+		return valid_;
+
+	if (!other.metadata_) {
+		valid_ = false;
+		return false;
+	}
+
+	size_t entryCapacity = get_camera_metadata_entry_capacity(other.metadata_);
+	size_t dataCapacity = get_camera_metadata_data_capacity(other.metadata_);
+
+	if (metadata_) {
+		entryCapacity = std::max(entryCapacity,
+					 get_camera_metadata_entry_capacity(metadata_));
+		dataCapacity = std::max(dataCapacity,
+					get_camera_metadata_data_capacity(metadata_));
+	}
+
+	size_t size = calculate_camera_metadata_size(entryCapacity, dataCapacity);
+
+	if (!metadata_ || get_camera_metadata_size(metadata_) < size) {
+		if (metadata_)
+			free_camera_metadata(metadata_);
+
+		metadata_ = allocate_camera_metadata(entryCapacity, dataCapacity);
+		size = metadata_ ? get_camera_metadata_size(metadata_) : 0;
+	}
+
+	if (!metadata_) {
+		valid_ = false;
+		index_.clear();
+		return false;
+	}
+
+	place_camera_metadata(metadata_, size, entryCapacity, dataCapacity);
+	valid_ = !append_camera_metadata(metadata_, other.metadata_);
+	resized_ = false;
+
+	/*
+	 * Appending to an empty pack preserves the order of the entries, copy
+	 * the index instead of rebuilding it. The vector storage is reused as
+	 * well when recycling metadata packs.
+	 */
+	if (valid_)
+		index_ = other.index_;
+	else
+		index_.clear();
+
+	return valid_;
+}
+
 std::tuple<size_t, size_t> CameraMetadata::usage() const
 {
 	size_t currentEntryCount = get_camera_metadata_entry_count(metadata_);
@@ -67,12 +141,76 @@ std::tuple<size_t, size_t> CameraMetadata::usage() const
 
 bool CameraMetadata::getEntry(uint32_t tag, camera_metadata_ro_entry_t *entry) const
 {
-	if (find_camera_metadata_ro_entry(metadata_, tag, entry))
+	const size_t *index = findIndex(tag);
+	if (!index)
+		return false;
+
+	if (get_camera_metadata_ro_entry(metadata_, *index, entry))
 		return false;
 
 	return true;
 }
 
+/*
+ * \brief Sort the entries of the metadata pack by tag
+ *
+ * Sorting lets consumers of the raw camera_metadata_t, such as the camera
+ * framework, look entries up with a binary search instead of a linear scan.
+ * It is worth doing for packs that are queried many times, such as the static
+ * metadata. Entries added after sorting are appended unsorted.
+ */
+void CameraMetadata::sort()
+{
+	if (!valid_)
+		return;
+
+	if (sort_camera_metadata(metadata_)) {
+		LOG(CameraMetadata, Error) << "Failed to sort metadata";
+		return;
+	}
+
+	buildIndex();
+}
+
+void CameraMetadata::buildIndex()
+{
+	index_.clear();
+
+	if (!metadata_)
+		return;
+
+	size_t count = get_camera_metadata_entry_count(metadata_);
+	index_.reserve(count);
+
+	for (size_t i = 0; i < count; i++) {
+		camera_metadata_ro_entry_t entry;
+		if (get_camera_metadata_ro_entry(metadata_, i, &entry))
+			continue;
+
+		index_.emplace_back(entry.tag, i);
+	}
+
+	/*
+	 * Keep the first entry of duplicated tags, as the linear lookup of
+	 * find_camera_metadata_entry() would.
+	 */
+	std::stable_sort(index_.begin(), index_.end(),
+			 [](const auto &a, const auto &b) { return a.first < b.first; });
+	index_.erase(std::unique(index_.begin(), index_.end(),
+				 [](const auto &a, const auto &b) { return a.first == b.first; }),
+		     index_.end());
+}
+
+const size_t *CameraMetadata::findIndex(uint32_t tag) const
+{
+	auto it = std::lower_bound(index_.begin(), index_.end(), tag,
+				   [](const auto &item, uint32_t key) { return item.first < key; });
+	if (it == index_.end() || it->first != tag)
+		return nullptr;
+
+	return &it->second;
+}
+
 /*
  * \brief Resize the metadata container, if necessary
  * \param[in] count Number of entries to add to the container
@@ -153,8 +291,15 @@ bool CameraMetadata::addEntry(uint32_t tag, const void *data, size_t count,
 		return false;
 	}
 
-	if (!add_camera_metadata_entry(metadata_, tag, data, count))
+	if (!add_camera_metadata_entry(metadata_, tag, data, count)) {
+		/* The new entry has been appended at the end of the pack. */
+		auto it = std::lower_bound(index_.begin(), index_.end(), tag,
+					   [](const auto &item, uint32_t key) { return item.first < key; });
+		if (it == index_.end() || it->first != tag)
+			index_.emplace(it, tag, get_camera_metadata_entry_count(metadata_) - 1);
+
 		return true;
+	}
 
 	const char *name = get_camera_metadata_tag_name(tag);
 	if (name)
@@ -176,8 +321,8 @@ bool CameraMetadata::updateEntry(uint32_t tag, const void *data, size_t count,
 		return false;
 
 	camera_metadata_entry_t entry;
-	int ret = find_camera_metadata_entry(metadata_, tag, &entry);
-	if (ret) {
+	const size_t *index = findIndex(tag);
+	if (!index || get_camera_metadata_entry(metadata_, *index, &entry)) {
 		const char *name = get_camera_metadata_tag_name(tag);
 		LOG(CameraMetadata, Error)
 			<< "Failed to update tag "
@@ -206,8 +351,8 @@ bool CameraMetadata::updateEntry(uint32_t tag, const void *data, size_t count,
 		return false;
 	}
 
-	ret = update_camera_metadata_entry(metadata_, entry.index, data,
-					   count, nullptr);
+	int ret = update_camera_metadata_entry(metadata_, entry.index, data,
+					       count, nullptr);
 	if (!ret)
 		return true;
 
@@ -8,6 +8,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <utility>
 #include <vector>
 
 #include <system/camera_metadata.h>
@@ -23,6 +24,8 @@ public:
 
 	CameraMetadata &operator=(const CameraMetadata &other);
 
+	bool copyFrom(const CameraMetadata &other);
+
 	std::tuple<size_t, size_t> usage() const;
 	bool resized() const { return resized_; }
 
@@ -88,7 +91,11 @@ public:
 	camera_metadata_t *getMetadata();
 	const camera_metadata_t *getMetadata() const;
 
+	void sort();
+
 private:
+	void buildIndex();
+	const size_t *findIndex(uint32_t tag) const;
 	bool resize(size_t count, size_t size);
 	bool addEntry(uint32_t tag, const void *data, size_t count,
 		      size_t elementSize);
@@ -98,4 +105,10 @@ private:
 	camera_metadata_t *metadata_;
 	bool valid_;
 	bool resized_;
+
+	/*
+	 * Index of the entries of metadata_, as (tag, entry index) pairs
+	 * sorted by tag, to avoid the linear lookups of unsorted packs.
+	 */
+	std::vector<std::pair<uint32_t, size_t>> index_;
 };
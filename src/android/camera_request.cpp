@@ -40,6 +40,14 @@ Camera3RequestDescriptor::Camera3RequestDescriptor(
 		buffers_.emplace_back(stream, buffer, this);
 	}
 
+	/*
+	 * Copy the input buffer of reprocessing requests, it has to be
+	 * returned to the framework with the capture result.
+	 */
+	if (camera3Request->input_buffer)
+		inputBuffer_ = std::make_unique<camera3_stream_buffer_t>(
+			*camera3Request->input_buffer);
+
 	/* Clone the controls associated with the camera3 request. */
 	settings_ = CameraMetadata(camera3Request->settings);
 
@@ -44,7 +44,7 @@ public:
 
 		CameraStream *stream;
 		buffer_handle_t *camera3Buffer;
-		std::unique_ptr<libcamera::FrameBuffer> frameBuffer;
+		std::shared_ptr<libcamera::FrameBuffer> frameBuffer;
 		int fence;
 		Status status = Status::Success;
 		libcamera::FrameBuffer *internalBuffer = nullptr;
@@ -65,16 +65,26 @@ public:
 	~Camera3RequestDescriptor();
 
 	bool isPending() const { return !complete_; }
+	bool isReprocess() const { return inputBuffer_ != nullptr; }
 
 	uint32_t frameNumber_ = 0;
 
 	std::vector<StreamBuffer> buffers_;
 
+	/* The input buffer of reprocessing requests. */
+	std::unique_ptr<camera3_stream_buffer_t> inputBuffer_;
+	std::unique_ptr<libcamera::FrameBuffer> inputFrameBuffer_;
+
 	CameraMetadata settings_;
 	std::unique_ptr<CaptureRequest> request_;
 	std::unique_ptr<CameraMetadata> resultMetadata_;
 
 	bool complete_ = false;
+	/* Protected by CameraDevice::descriptorsMutex_. */
+	bool shutterNotified_ = false;
+	bool partialResultSent_ = false;
+	/* Results are delivered per batch in constrained high speed mode. */
+	bool lastInBatch_ = true;
 	Status status_ = Status::Success;
 
 private:
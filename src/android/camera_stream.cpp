@@ -11,6 +11,7 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/poll.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <libcamera/formats.h>
@@ -28,6 +29,44 @@ using namespace libcamera;
 
 LOG_DECLARE_CATEGORY(HAL)
 
+namespace {
+
+/*
+ * Return the clockwise rotation, in degrees, to be applied by the
+ * post-processor to the frames of a stream. Android defines stream rotations
+ * counterclockwise.
+ */
+unsigned int streamRotation([[maybe_unused]] const camera3_stream_t *stream)
+{
+#if defined(OS_CHROMEOS)
+	switch (stream->crop_rotate_scale_degrees) {
+	case CAMERA3_STREAM_ROTATION_90:
+		return 270;
+	case CAMERA3_STREAM_ROTATION_270:
+		return 90;
+	default:
+		break;
+	}
+#endif
+
+	return 0;
+}
+
+std::vector<ino_t> handleInodes(buffer_handle_t camera3Buffer)
+{
+	std::vector<ino_t> inodes(camera3Buffer->numFds);
+
+	for (int i = 0; i < camera3Buffer->numFds; ++i) {
+		struct stat st;
+		if (fstat(camera3Buffer->data[i], &st) == 0)
+			inodes[i] = st.st_ino;
+	}
+
+	return inodes;
+}
+
+} /* namespace */
+
 /*
  * \class CameraStream
  * \brief Map a camera3_stream_t to a StreamConfiguration
@@ -53,7 +92,9 @@ CameraStream::CameraStream(CameraDevice *const cameraDevice,
 			   CameraConfiguration *config, Type type,
 			   camera3_stream_t *camera3Stream, unsigned int index)
 	: cameraDevice_(cameraDevice), config_(config), type_(type),
-	  camera3Stream_(camera3Stream), index_(index)
+	  camera3Stream_(camera3Stream), index_(index),
+	  priority_(PostProcessorPool::Priority::High),
+	  reprocessPriority_(PostProcessorPool::Priority::High)
 {
 }
 
@@ -74,52 +115,15 @@ Stream *CameraStream::stream() const
 int CameraStream::configure()
 {
 	if (type_ == Type::Internal || type_ == Type::Mapped) {
-		const PixelFormat outFormat =
-			cameraDevice_->capabilities()->toPixelFormat(camera3Stream_->format);
-		StreamConfiguration output = configuration();
-		output.pixelFormat = outFormat;
-		output.size.width = camera3Stream_->width;
-		output.size.height = camera3Stream_->height;
-
-		switch (outFormat) {
-		case formats::NV12:
-			postProcessor_ = std::make_unique<PostProcessorYuv>();
-			break;
-
-		case formats::MJPEG:
-			postProcessor_ = std::make_unique<PostProcessorJpeg>(cameraDevice_);
-			break;
-
-		default:
-			LOG(HAL, Error) << "Unsupported format: " << outFormat;
+		postProcessor_ = createPostProcessor(configuration(), &priority_);
+		if (!postProcessor_)
 			return -EINVAL;
-		}
-
-		int ret = postProcessor_->configure(configuration(), output);
-		if (ret)
-			return ret;
-
-		worker_ = std::make_unique<PostProcessorWorker>(postProcessor_.get());
-		postProcessor_->processComplete.connect(
-			this, [&](Camera3RequestDescriptor::StreamBuffer *streamBuffer,
-				  PostProcessor::Status status) {
-				Camera3RequestDescriptor::Status bufferStatus;
-
-				if (status == PostProcessor::Status::Success)
-					bufferStatus = Camera3RequestDescriptor::Status::Success;
-				else
-					bufferStatus = Camera3RequestDescriptor::Status::Error;
-
-				cameraDevice_->streamProcessingComplete(streamBuffer,
-									bufferStatus);
-			});
-
-		worker_->start();
 	}
 
+	mutex_ = std::make_unique<std::mutex>();
+
 	if (type_ == Type::Internal) {
 		allocator_ = std::make_unique<FrameBufferAllocator>(cameraDevice_->camera());
-		mutex_ = std::make_unique<std::mutex>();
 
 		int ret = allocator_->allocate(stream());
 		if (ret < 0)
@@ -135,6 +139,98 @@ int CameraStream::configure()
 	return 0;
 }
 
+/*
+ * \brief Configure the stream to be produced from reprocessing input buffers
+ * \param[in] input The format and size of the input stream buffers
+ *
+ * Reprocessing requests are served by a dedicated post-processor that produces
+ * the stream from the input buffer instead of a libcamera stream buffer. Only
+ * YUV and JPEG streams can be reprocessed, other streams are left untouched.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int CameraStream::configureReprocessing(const StreamConfiguration &input)
+{
+	if (camera3Stream_->format != HAL_PIXEL_FORMAT_YCbCr_420_888 &&
+	    camera3Stream_->format != HAL_PIXEL_FORMAT_BLOB)
+		return 0;
+
+	/* The JPEG encoder doesn't scale. */
+	if (camera3Stream_->format == HAL_PIXEL_FORMAT_BLOB &&
+	    input.size != Size(camera3Stream_->width, camera3Stream_->height)) {
+		LOG(HAL, Info)
+			<< "JPEG stream can't be reprocessed from "
+			<< input.size.toString() << " input";
+		return 0;
+	}
+
+	reprocessor_ = createPostProcessor(input, &reprocessPriority_);
+	if (!reprocessor_)
+		return -EINVAL;
+
+	return 0;
+}
+
+std::unique_ptr<PostProcessor>
+CameraStream::createPostProcessor(const StreamConfiguration &input,
+				  PostProcessorPool::Priority *priority)
+{
+	const PixelFormat outFormat =
+		cameraDevice_->capabilities()->toPixelFormat(camera3Stream_->format);
+	StreamConfiguration output = input;
+	output.pixelFormat = outFormat;
+	output.size.width = camera3Stream_->width;
+	output.size.height = camera3Stream_->height;
+
+	std::unique_ptr<PostProcessor> postProcessor;
+
+	switch (outFormat) {
+	case formats::NV12:
+	case formats::NV21:
+	case formats::YUV420:
+	case formats::YVU420:
+		postProcessor = std::make_unique<PostProcessorYuv>(
+			streamRotation(camera3Stream_));
+		*priority = PostProcessorPool::Priority::High;
+		dstFormat_ = outFormat;
+		dstSize_ = output.size;
+		break;
+
+	case formats::MJPEG:
+		postProcessor = std::make_unique<PostProcessorJpeg>(cameraDevice_);
+		*priority = PostProcessorPool::Priority::Low;
+		/* The JPEG blob is mapped with the source layout. */
+		dstFormat_ = configuration().pixelFormat;
+		dstSize_ = configuration().size;
+		break;
+
+	default:
+		LOG(HAL, Error) << "Unsupported format: " << outFormat;
+		return nullptr;
+	}
+
+	int ret = postProcessor->configure(input, output);
+	if (ret)
+		return nullptr;
+
+	postProcessor->processComplete.connect(this, &CameraStream::postProcessingComplete);
+
+	return postProcessor;
+}
+
+void CameraStream::postProcessingComplete(Camera3RequestDescriptor::StreamBuffer *streamBuffer,
+					  PostProcessor::Status status)
+{
+	Camera3RequestDescriptor::Status bufferStatus;
+
+	if (status == PostProcessor::Status::Success)
+		bufferStatus = Camera3RequestDescriptor::Status::Success;
+	else
+		bufferStatus = Camera3RequestDescriptor::Status::Error;
+
+	cameraDevice_->streamProcessingComplete(streamBuffer, bufferStatus);
+}
+
 int CameraStream::waitFence(int fence)
 {
 	/*
@@ -166,7 +262,20 @@ int CameraStream::waitFence(int fence)
 
 int CameraStream::process(Camera3RequestDescriptor::StreamBuffer *streamBuffer)
 {
-	ASSERT(type_ != Type::Direct);
+	PostProcessor *postProcessor = postProcessor_.get();
+	PostProcessorPool::Priority priority = priority_;
+
+	if (streamBuffer->request->isReprocess()) {
+		postProcessor = reprocessor_.get();
+		priority = reprocessPriority_;
+
+		if (!postProcessor) {
+			LOG(HAL, Error) << "Stream can't be reprocessed";
+			return -EINVAL;
+		}
+	}
+
+	ASSERT(postProcessor);
 
 	/* Handle waiting on fences on the destination buffer. */
 	if (streamBuffer->fence != -1) {
@@ -181,28 +290,20 @@ int CameraStream::process(Camera3RequestDescriptor::StreamBuffer *streamBuffer)
 		streamBuffer->fence = -1;
 	}
 
-	const StreamConfiguration &output = configuration();
 	streamBuffer->dstBuffer = std::make_unique<CameraBuffer>(
-		*streamBuffer->camera3Buffer, output.pixelFormat, output.size,
+		*streamBuffer->camera3Buffer, dstFormat_, dstSize_,
 		PROT_READ | PROT_WRITE);
 	if (!streamBuffer->dstBuffer->isValid()) {
 		LOG(HAL, Error) << "Failed to create destination buffer";
 		return -EINVAL;
 	}
 
-	worker_->queueRequest(streamBuffer);
+	cameraDevice_->postProcessorPool()->queue(postProcessor, streamBuffer,
+						  priority);
 
 	return 0;
 }
 
-void CameraStream::flush()
-{
-	if (!postProcessor_)
-		return;
-
-	worker_->flush();
-}
-
 FrameBuffer *CameraStream::getBuffer()
 {
 	if (!allocator_)
@@ -231,86 +332,96 @@ void CameraStream::putBuffer(FrameBuffer *buffer)
 	buffers_.push_back(buffer);
 }
 
-CameraStream::PostProcessorWorker::PostProcessorWorker(PostProcessor *postProcessor)
-	: postProcessor_(postProcessor)
-{
-}
-
-CameraStream::PostProcessorWorker::~PostProcessorWorker()
+/*
+ * \brief Retrieve the FrameBuffer wrapping a buffer of a Direct stream
+ * \param[in] camera3Buffer The gralloc handle of the buffer
+ *
+ * Creating a FrameBuffer requires mapping the gralloc buffer to retrieve its
+ * planes layout, and duplicating its file descriptors. As the Android
+ * framework cycles through a fixed set of buffers, FrameBuffers are cached
+ * per gralloc handle and reused for the following requests. This also lets
+ * the V4L2 buffer cache match the buffers, as their file descriptors don't
+ * change.
+ *
+ * A handle may be reused for a different buffer once the original buffer has
+ * been freed. The cache entries are thus validated against the inodes of the
+ * handle dmabufs.
+ *
+ * \return The FrameBuffer, or nullptr if it can't be created
+ */
+std::shared_ptr<FrameBuffer> CameraStream::frameBuffer(buffer_handle_t camera3Buffer)
 {
-	{
-		libcamera::MutexLocker lock(mutex_);
-		state_ = State::Stopped;
-	}
+	std::vector<ino_t> inodes = handleInodes(camera3Buffer);
 
-	cv_.notify_one();
-	wait();
-}
+	std::lock_guard<std::mutex> locker(*mutex_);
 
-void CameraStream::PostProcessorWorker::start()
-{
-	{
-		libcamera::MutexLocker lock(mutex_);
-		ASSERT(state_ != State::Running);
-		state_ = State::Running;
-	}
+	auto it = frameBuffers_.find(camera3Buffer);
+	if (it != frameBuffers_.end() && it->second.inodes == inodes)
+		return it->second.buffer;
 
-	Thread::start();
-}
+	const StreamConfiguration &config = configuration();
+	std::shared_ptr<FrameBuffer> buffer =
+		createFrameBuffer(camera3Buffer, config.pixelFormat, config.size);
+	if (!buffer)
+		return nullptr;
 
-void CameraStream::PostProcessorWorker::queueRequest(Camera3RequestDescriptor::StreamBuffer *dest)
-{
-	{
-		MutexLocker lock(mutex_);
-		ASSERT(state_ == State::Running);
-		requests_.push(dest);
+	/*
+	 * Drop the entries not in use by any pending request when the cache
+	 * outgrows the number of buffers the framework is expected to cycle
+	 * through, as they likely belong to buffers that have been freed.
+	 */
+	if (frameBuffers_.size() >= 2 * camera3Stream_->max_buffers) {
+		for (auto iter = frameBuffers_.begin(); iter != frameBuffers_.end();) {
+			if (iter->second.buffer.use_count() == 1)
+				iter = frameBuffers_.erase(iter);
+			else
+				++iter;
+		}
 	}
 
-	cv_.notify_one();
+	frameBuffers_[camera3Buffer] = { std::move(inodes), buffer };
+
+	return buffer;
 }
 
-void CameraStream::PostProcessorWorker::run()
+/*
+ * \brief Drop all the cached FrameBuffers
+ *
+ * FrameBuffers in use by pending requests stay valid until the requests
+ * complete.
+ */
+void CameraStream::clearFrameBuffers()
 {
-	MutexLocker locker(mutex_);
-
-	while (1) {
-		cv_.wait(locker, [&] {
-			return state_ != State::Running || !requests_.empty();
-		});
-
-		if (state_ != State::Running)
-			break;
+	if (!mutex_)
+		return;
 
-		Camera3RequestDescriptor::StreamBuffer *streamBuffer = requests_.front();
-		requests_.pop();
-		locker.unlock();
+	std::lock_guard<std::mutex> locker(*mutex_);
 
-		postProcessor_->process(streamBuffer);
+	frameBuffers_.clear();
+}
 
-		locker.lock();
+std::unique_ptr<FrameBuffer>
+CameraStream::createFrameBuffer(buffer_handle_t camera3Buffer,
+				const PixelFormat &pixelFormat, const Size &size)
+{
+	CameraBuffer buf(camera3Buffer, pixelFormat, size, PROT_READ);
+	if (!buf.isValid()) {
+		LOG(HAL, Fatal) << "Failed to create CameraBuffer";
+		return nullptr;
 	}
 
-	if (state_ == State::Flushing) {
-		std::queue<Camera3RequestDescriptor::StreamBuffer *> requests =
-			std::move(requests_);
-		locker.unlock();
-
-		while (!requests.empty()) {
-			postProcessor_->processComplete.emit(
-				requests.front(), PostProcessor::Status::Error);
-			requests.pop();
+	std::vector<FrameBuffer::Plane> planes(buf.numPlanes());
+	for (size_t i = 0; i < buf.numPlanes(); ++i) {
+		FileDescriptor fd{ camera3Buffer->data[i] };
+		if (!fd.isValid()) {
+			LOG(HAL, Fatal) << "No valid fd";
+			return nullptr;
 		}
 
-		locker.lock();
-		state_ = State::Stopped;
+		planes[i].fd = fd;
+		planes[i].offset = buf.offset(i);
+		planes[i].length = buf.size(i);
 	}
-}
-
-void CameraStream::PostProcessorWorker::flush()
-{
-	libcamera::MutexLocker lock(mutex_);
-	state_ = State::Flushing;
-	lock.unlock();
 
-	cv_.notify_one();
+	return std::make_unique<FrameBuffer>(std::move(planes));
 }
@@ -7,16 +7,14 @@
 
 #pragma once
 
-#include <condition_variable>
+#include <map>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <sys/types.h>
 #include <vector>
 
 #include <hardware/camera3.h>
 
-#include <libcamera/base/thread.h>
-
 #include <libcamera/camera.h>
 #include <libcamera/framebuffer.h>
 #include <libcamera/framebuffer_allocator.h>
@@ -25,6 +23,7 @@
 
 #include "camera_request.h"
 #include "post_processor.h"
+#include "post_processor_pool.h"
 
 class CameraDevice;
 
@@ -125,42 +124,32 @@ public:
 	libcamera::Stream *stream() const;
 
 	int configure();
+	int configureReprocessing(const libcamera::StreamConfiguration &input);
 	int process(Camera3RequestDescriptor::StreamBuffer *streamBuffer);
 	libcamera::FrameBuffer *getBuffer();
 	void putBuffer(libcamera::FrameBuffer *buffer);
-	void flush();
-
-private:
-	class PostProcessorWorker : public libcamera::Thread
-	{
-	public:
-		enum class State {
-			Stopped,
-			Running,
-			Flushing,
-		};
-
-		PostProcessorWorker(PostProcessor *postProcessor);
-		~PostProcessorWorker();
 
-		void start();
-		void queueRequest(Camera3RequestDescriptor::StreamBuffer *request);
-		void flush();
+	std::shared_ptr<libcamera::FrameBuffer> frameBuffer(buffer_handle_t camera3Buffer);
+	void clearFrameBuffers();
 
-	protected:
-		void run() override;
+	static int waitFence(int fence);
+	static std::unique_ptr<libcamera::FrameBuffer>
+	createFrameBuffer(buffer_handle_t camera3Buffer,
+			  const libcamera::PixelFormat &pixelFormat,
+			  const libcamera::Size &size);
 
-	private:
-		PostProcessor *postProcessor_;
-
-		libcamera::Mutex mutex_;
-		std::condition_variable cv_;
-
-		std::queue<Camera3RequestDescriptor::StreamBuffer *> requests_;
-		State state_ = State::Stopped;
+private:
+	struct CachedFrameBuffer {
+		/* Inodes of the dmabufs of the gralloc handle. */
+		std::vector<ino_t> inodes;
+		std::shared_ptr<libcamera::FrameBuffer> buffer;
 	};
 
-	int waitFence(int fence);
+	std::unique_ptr<PostProcessor>
+	createPostProcessor(const libcamera::StreamConfiguration &input,
+			    PostProcessorPool::Priority *priority);
+	void postProcessingComplete(Camera3RequestDescriptor::StreamBuffer *streamBuffer,
+				    PostProcessor::Status status);
 
 	CameraDevice *const cameraDevice_;
 	const libcamera::CameraConfiguration *config_;
@@ -175,7 +164,14 @@ private:
 	 * an std::vector in CameraDevice.
 	 */
 	std::unique_ptr<std::mutex> mutex_;
+	/* FrameBuffers wrapping the buffers of a Direct stream. */
+	std::map<buffer_handle_t, CachedFrameBuffer> frameBuffers_;
 	std::unique_ptr<PostProcessor> postProcessor_;
-
-	std::unique_ptr<PostProcessorWorker> worker_;
+	PostProcessorPool::Priority priority_;
+	/* Post-processor producing the stream from reprocessing input buffers. */
+	std::unique_ptr<PostProcessor> reprocessor_;
+	PostProcessorPool::Priority reprocessPriority_;
+	/* Format and size used to map the destination buffers. */
+	libcamera::PixelFormat dstFormat_;
+	libcamera::Size dstSize_;
 };
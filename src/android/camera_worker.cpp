@@ -53,6 +53,7 @@ void CaptureRequest::queue()
  */
 CameraWorker::CameraWorker()
 {
+	setName("CameraWorker");
 	worker_.moveToThread(this);
 }
 
@@ -71,6 +72,7 @@ void CameraWorker::run()
 {
 	exec();
 	dispatchMessages(Message::Type::InvokeMessage);
+	worker_.flush();
 }
 
 void CameraWorker::queueRequest(CaptureRequest *request)
@@ -80,21 +82,40 @@ void CameraWorker::queueRequest(CaptureRequest *request)
 			     request);
 }
 
+/*
+ * Queue a batch of requests with a single message to the worker thread. The
+ * requests are queued to the camera in order, back to back as soon as their
+ * fences have been signalled.
+ */
+void CameraWorker::queueRequests(const std::vector<CaptureRequest *> &requests)
+{
+	worker_.invokeMethod(&Worker::processRequests, ConnectionTypeQueued,
+			     requests);
+}
+
 /*
  * \class CameraWorker::Worker
  * \brief Process a CaptureRequest handling acquisition fences
+ *
+ * The acquisition fences of all requests are waited on concurrently through
+ * the event loop of the worker thread. Requests are queued to the camera in
+ * the order they have been received, as soon as all their fences, and all the
+ * fences of the requests received before them, have been signalled. A request
+ * whose fences do not signal in time is dropped.
  */
+
+/*
+ * \todo Better characterize the timeout. Currently equal to the one used by
+ * the Rockchip Camera HAL on ChromeOS.
+ */
+static constexpr unsigned int kFenceTimeoutMs = 300;
+
 int CameraWorker::Worker::waitFence(int fence)
 {
-	/*
-	 * \todo Better characterize the timeout. Currently equal to the one
-	 * used by the Rockchip Camera HAL on ChromeOS.
-	 */
-	constexpr unsigned int timeoutMs = 300;
 	struct pollfd fds = { fence, POLLIN, 0 };
 
 	do {
-		int ret = poll(&fds, 1, timeoutMs);
+		int ret = poll(&fds, 1, kFenceTimeoutMs);
 		if (ret == 0)
 			return -ETIME;
 
@@ -111,19 +132,132 @@ int CameraWorker::Worker::waitFence(int fence)
 
 void CameraWorker::Worker::processRequest(CaptureRequest *request)
 {
-	/* Wait on all fences before queuing the Request. */
+	addRequest(request);
+	queueReadyRequests();
+}
+
+void CameraWorker::Worker::processRequests(const std::vector<CaptureRequest *> &requests)
+{
+	for (CaptureRequest *request : requests)
+		addRequest(request);
+
+	queueReadyRequests();
+}
+
+void CameraWorker::Worker::addRequest(CaptureRequest *request)
+{
+	std::unique_ptr<PendingRequest> pending = std::make_unique<PendingRequest>();
+	pending->request = request;
+	pending->pendingFences = 0;
+	pending->failed = false;
+
 	for (int fence : request->fences()) {
 		if (fence == -1)
 			continue;
 
-		int ret = waitFence(fence);
-		close(fence);
-		if (ret < 0) {
-			LOG(HAL, Error) << "Failed waiting for fence: "
-					<< fence << ": " << strerror(-ret);
-			return;
-		}
+		std::unique_ptr<EventNotifier> notifier =
+			std::make_unique<EventNotifier>(fence, EventNotifier::Read);
+		notifier->activated.connect(this, [this, p = pending.get(), n = notifier.get()]() {
+			fenceSignalled(p, n);
+		});
+
+		pending->fences.push_back(std::move(notifier));
+		pending->pendingFences++;
+	}
+
+	if (pending->pendingFences) {
+		pending->timer = std::make_unique<Timer>();
+		pending->timer->timeout.connect(this, [this, p = pending.get()]() {
+			fenceTimeout(p);
+		});
+		/* Precision isn't needed, allow coalescing with other timers. */
+		pending->timer->setSlack(std::chrono::milliseconds(kFenceTimeoutMs / 10));
+		pending->timer->start(kFenceTimeoutMs);
 	}
 
-	request->queue();
+	pending_.push_back(std::move(pending));
+}
+
+void CameraWorker::Worker::fenceSignalled(PendingRequest *pending,
+					  EventNotifier *fence)
+{
+	fence->setEnabled(false);
+
+	if (--pending->pendingFences)
+		return;
+
+	pending->timer->stop();
+	queueReadyRequests();
+}
+
+void CameraWorker::Worker::fenceTimeout(PendingRequest *pending)
+{
+	for (std::unique_ptr<EventNotifier> &fence : pending->fences) {
+		if (!fence->enabled())
+			continue;
+
+		LOG(HAL, Error) << "Failed waiting for fence: " << fence->fd()
+				<< ": " << strerror(ETIME);
+		fence->setEnabled(false);
+	}
+
+	pending->failed = true;
+	queueReadyRequests();
+}
+
+void CameraWorker::Worker::queueReadyRequests()
+{
+	while (!pending_.empty()) {
+		const PendingRequest *pending = pending_.front().get();
+		if (pending->pendingFences && !pending->failed)
+			break;
+
+		completeRequest();
+	}
+}
+
+/*
+ * Queue the oldest pending request to the camera, unless waiting for its
+ * fences failed, and release its fences.
+ */
+void CameraWorker::Worker::completeRequest()
+{
+	std::unique_ptr<PendingRequest> pending = std::move(pending_.front());
+	pending_.pop_front();
+
+	for (std::unique_ptr<EventNotifier> &fence : pending->fences) {
+		int fd = fence->fd();
+		fence.reset();
+		close(fd);
+	}
+
+	if (!pending->failed)
+		pending->request->queue();
+}
+
+/*
+ * Wait synchronously for the fences of all the pending requests, and queue
+ * them. This is called when the worker thread stops, after the event loop
+ * exits, to ensure that all requests received by the worker reach the camera
+ * and get completed.
+ */
+void CameraWorker::Worker::flush()
+{
+	while (!pending_.empty()) {
+		PendingRequest *pending = pending_.front().get();
+
+		for (std::unique_ptr<EventNotifier> &fence : pending->fences) {
+			if (pending->failed || !fence->enabled())
+				continue;
+
+			int ret = waitFence(fence->fd());
+			if (ret < 0) {
+				LOG(HAL, Error) << "Failed waiting for fence: "
+						<< fence->fd() << ": " << strerror(-ret);
+				pending->failed = true;
+			}
+		}
+
+		completeRequest();
+	}
 }
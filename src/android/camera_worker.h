@@ -7,11 +7,15 @@
 
 #pragma once
 
+#include <deque>
 #include <memory>
 #include <stdint.h>
+#include <vector>
 
+#include <libcamera/base/event_notifier.h>
 #include <libcamera/base/object.h>
 #include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/framebuffer.h>
@@ -52,6 +56,7 @@ public:
 	void stop();
 
 	void queueRequest(CaptureRequest *request);
+	void queueRequests(const std::vector<CaptureRequest *> &requests);
 
 protected:
 	void run() override;
@@ -61,9 +66,27 @@ private:
 	{
 	public:
 		void processRequest(CaptureRequest *request);
+		void processRequests(const std::vector<CaptureRequest *> &requests);
+		void flush();
 
 	private:
+		struct PendingRequest {
+			CaptureRequest *request;
+			std::vector<std::unique_ptr<libcamera::EventNotifier>> fences;
+			std::unique_ptr<libcamera::Timer> timer;
+			unsigned int pendingFences;
+			bool failed;
+		};
+
 		int waitFence(int fence);
+		void addRequest(CaptureRequest *request);
+		void fenceSignalled(PendingRequest *pending,
+				    libcamera::EventNotifier *fence);
+		void fenceTimeout(PendingRequest *pending);
+		void queueReadyRequests();
+		void completeRequest();
+
+		std::deque<std::unique_ptr<PendingRequest>> pending_;
 	};
 
 	Worker worker_;
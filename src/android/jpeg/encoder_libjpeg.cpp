@@ -7,11 +7,14 @@
 
 #include "encoder_libjpeg.h"
 
+#include <algorithm>
 #include <fcntl.h>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string.h>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
@@ -66,6 +69,128 @@ const struct JPEGPixelFormatInfo &findPixelInfo(const PixelFormat &format)
 	return iter->second;
 }
 
+/*
+ * Locate the frame header, the scan header and the entropy-coded data in a
+ * complete JPEG stream produced by libjpeg. The stream consists of the SOI
+ * marker, a sequence of marker segments up to and including the SOS segment,
+ * the entropy-coded data and the EOI marker.
+ */
+bool parseStream(const unsigned char *data, unsigned long size,
+		 unsigned long *sof, unsigned long *sos, unsigned long *scan)
+{
+	if (size < 4 || data[0] != 0xff || data[1] != 0xd8 ||
+	    data[size - 2] != 0xff || data[size - 1] != 0xd9)
+		return false;
+
+	*sof = 0;
+
+	unsigned long pos = 2;
+	while (pos + 4 <= size) {
+		if (data[pos] != 0xff)
+			return false;
+
+		unsigned char marker = data[pos + 1];
+		unsigned int length = (data[pos + 2] << 8) | data[pos + 3];
+
+		if (marker >= 0xc0 && marker <= 0xc2)
+			*sof = pos;
+
+		if (marker == 0xda) {
+			*sos = pos;
+			*scan = pos + 2 + length;
+			return *sof && *scan <= size - 2;
+		}
+
+		pos += 2 + length;
+	}
+
+	return false;
+}
+
+/*
+ * libjpeg destination manager writing to memory provided by the caller. The
+ * output is written to a fixed buffer, or to a vector that grows as needed.
+ * Unlike jpeg_mem_dest(), a fixed buffer is never reallocated: output that
+ * doesn't fit is discarded and reported as an overflow.
+ */
+struct Destination {
+	Destination(Span<uint8_t> output)
+		: buffer(output), vector(nullptr), overflow(false), size(0)
+	{
+	}
+
+	Destination(std::vector<uint8_t> *output)
+		: vector(output), overflow(false), size(0)
+	{
+	}
+
+	void attach(struct jpeg_compress_struct *compress)
+	{
+		mgr.init_destination = &Destination::init;
+		mgr.empty_output_buffer = &Destination::empty;
+		mgr.term_destination = &Destination::term;
+		compress->dest = &mgr;
+	}
+
+	/* Must be the first member, libjpeg only knows about mgr. */
+	struct jpeg_destination_mgr mgr;
+
+	Span<uint8_t> buffer;
+	std::vector<uint8_t> *vector;
+	bool overflow;
+	unsigned long size;
+
+	JOCTET discard[4096];
+
+private:
+	static Destination *from(j_compress_ptr compress)
+	{
+		return reinterpret_cast<Destination *>(compress->dest);
+	}
+
+	static void init(j_compress_ptr compress)
+	{
+		Destination *dst = from(compress);
+
+		if (dst->vector) {
+			if (dst->vector->empty())
+				dst->vector->resize(sizeof(dst->discard));
+			dst->buffer = *dst->vector;
+		}
+
+		dst->mgr.next_output_byte = dst->buffer.data();
+		dst->mgr.free_in_buffer = dst->buffer.size();
+	}
+
+	/* Called by libjpeg when the whole buffer has been filled. */
+	static boolean empty(j_compress_ptr compress)
+	{
+		Destination *dst = from(compress);
+
+		if (dst->vector) {
+			size_t used = dst->vector->size();
+			dst->vector->resize(used * 2);
+			dst->buffer = *dst->vector;
+			dst->mgr.next_output_byte = dst->buffer.data() + used;
+			dst->mgr.free_in_buffer = dst->buffer.size() - used;
+			return TRUE;
+		}
+
+		dst->overflow = true;
+		dst->mgr.next_output_byte = dst->discard;
+		dst->mgr.free_in_buffer = sizeof(dst->discard);
+		return TRUE;
+	}
+
+	static void term(j_compress_ptr compress)
+	{
+		Destination *dst = from(compress);
+
+		if (!dst->overflow)
+			dst->size = dst->buffer.size() - dst->mgr.free_in_buffer;
+	}
+};
+
 } /* namespace */
 
 EncoderLibJpeg::EncoderLibJpeg()
@@ -87,59 +212,134 @@ int EncoderLibJpeg::configure(const StreamConfiguration &cfg)
 	if (info.colorSpace == JCS_UNKNOWN)
 		return -ENOTSUP;
 
-	compress_.image_width = cfg.size.width;
-	compress_.image_height = cfg.size.height;
-	compress_.in_color_space = info.colorSpace;
-
-	compress_.input_components = info.colorSpace == JCS_GRAYSCALE ? 1 : 3;
-
-	jpeg_set_defaults(&compress_);
-
 	pixelFormatInfo_ = &info.pixelFormatInfo;
+	colorSpace_ = info.colorSpace;
+	width_ = cfg.size.width;
+	height_ = cfg.size.height;
 
 	nv_ = pixelFormatInfo_->numPlanes() == 2;
 	nvSwap_ = info.nvSwap;
 
+	if (nv_) {
+		unsigned int cStride = pixelFormatInfo_->stride(width_, 1);
+
+		horzSubSample_ = 2 * width_ / cStride;
+		vertSubSample_ = pixelFormatInfo_->planes[1].verticalSubSampling;
+	}
+
+	/*
+	 * The raw data API passes the luma rows to libjpeg in place, which
+	 * then reads full DCT blocks. Use it only when the lines don't need
+	 * padding.
+	 */
+	rawInput_ = nv_ && width_ % DCTSIZE == 0;
+
+	setupCompress(&compress_, height_);
+
+	mcuWidth_ = compress_.comp_info[0].h_samp_factor * DCTSIZE;
+	mcuHeight_ = compress_.comp_info[0].v_samp_factor * DCTSIZE;
+
+	/*
+	 * Split large images in horizontal strips of MCU rows, encoded
+	 * concurrently and stitched together with restart markers. The
+	 * restart interval is stored on 16 bits, fall back to a single strip
+	 * if it would overflow.
+	 */
+	unsigned int mcuRows = (height_ + mcuHeight_ - 1) / mcuHeight_;
+	unsigned int mcusPerRow = (width_ + mcuWidth_ - 1) / mcuWidth_;
+	unsigned int numStrips = std::min({ kMaxStrips,
+					    std::thread::hardware_concurrency(),
+					    height_ / kMinStripHeight });
+	numStrips = std::max(numStrips, 1U);
+
+	stripHeight_ = (mcuRows + numStrips - 1) / numStrips * mcuHeight_;
+	numStrips_ = (height_ + stripHeight_ - 1) / stripHeight_;
+
+	if (stripHeight_ / mcuHeight_ * mcusPerRow > 0xffff)
+		numStrips_ = 1;
+
+	/*
+	 * Start with a strip buffer estimate of 4 bits per pixel, the buffers
+	 * grow if needed and keep their size for the next frames.
+	 */
+	stripBuffers_.resize(numStrips_);
+	for (std::vector<uint8_t> &buffer : stripBuffers_)
+		buffer.resize(width_ * stripHeight_ / 2);
+
 	return 0;
 }
 
-void EncoderLibJpeg::compressRGB(const std::vector<Span<uint8_t>> &planes)
+void EncoderLibJpeg::setupCompress(struct jpeg_compress_struct *compress,
+				   unsigned int height)
+{
+	compress->image_width = width_;
+	compress->image_height = height;
+	compress->in_color_space = colorSpace_;
+
+	compress->input_components = colorSpace_ == JCS_GRAYSCALE ? 1 : 3;
+
+	jpeg_set_defaults(compress);
+
+	if (!rawInput_)
+		return;
+
+	/*
+	 * Encode the chroma planes at their native resolution instead of
+	 * letting libjpeg downsample them to 4:2:0.
+	 */
+	compress->raw_data_in = TRUE;
+	compress->comp_info[0].h_samp_factor = horzSubSample_;
+	compress->comp_info[0].v_samp_factor = vertSubSample_;
+	compress->comp_info[1].h_samp_factor = 1;
+	compress->comp_info[1].v_samp_factor = 1;
+	compress->comp_info[2].h_samp_factor = 1;
+	compress->comp_info[2].v_samp_factor = 1;
+}
+
+void EncoderLibJpeg::compressImage(struct jpeg_compress_struct *compress,
+				   const std::vector<Span<uint8_t>> &planes,
+				   unsigned int yStart)
+{
+	if (rawInput_)
+		compressNVRaw(compress, planes, yStart);
+	else if (nv_)
+		compressNV(compress, planes, yStart);
+	else
+		compressRGB(compress, planes, yStart);
+}
+
+void EncoderLibJpeg::compressRGB(struct jpeg_compress_struct *compress,
+				 const std::vector<Span<uint8_t>> &planes,
+				 unsigned int yStart)
 {
 	unsigned char *src = const_cast<unsigned char *>(planes[0].data());
 	/* \todo Stride information should come from buffer configuration. */
-	unsigned int stride = pixelFormatInfo_->stride(compress_.image_width, 0);
+	unsigned int stride = pixelFormatInfo_->stride(width_, 0);
 
 	JSAMPROW row_pointer[1];
 
-	while (compress_.next_scanline < compress_.image_height) {
-		row_pointer[0] = &src[compress_.next_scanline * stride];
-		jpeg_write_scanlines(&compress_, row_pointer, 1);
+	while (compress->next_scanline < compress->image_height) {
+		unsigned int y = yStart + compress->next_scanline;
+		row_pointer[0] = &src[y * stride];
+		jpeg_write_scanlines(compress, row_pointer, 1);
 	}
 }
 
 /*
  * Compress the incoming buffer from a supported NV format.
  * This naively unpacks the semi-planar NV12 to a YUV888 format for libjpeg.
+ * It is only used when the image width prevents using the raw data API.
  */
-void EncoderLibJpeg::compressNV(const std::vector<Span<uint8_t>> &planes)
+void EncoderLibJpeg::compressNV(struct jpeg_compress_struct *compress,
+				const std::vector<Span<uint8_t>> &planes,
+				unsigned int yStart)
 {
-	uint8_t tmprowbuf[compress_.image_width * 3];
+	uint8_t tmprowbuf[width_ * 3];
 
-	/*
-	 * \todo Use the raw api, and only unpack the cb/cr samples to new line
-	 * buffers. If possible, see if we can set appropriate pixel strides
-	 * too to save even that copy.
-	 *
-	 * Possible hints at:
-	 * https://sourceforge.net/p/libjpeg/mailman/message/30815123/
-	 */
-	unsigned int y_stride = pixelFormatInfo_->stride(compress_.image_width, 0);
-	unsigned int c_stride = pixelFormatInfo_->stride(compress_.image_width, 1);
+	unsigned int y_stride = pixelFormatInfo_->stride(width_, 0);
+	unsigned int c_stride = pixelFormatInfo_->stride(width_, 1);
 
-	unsigned int horzSubSample = 2 * compress_.image_width / c_stride;
-	unsigned int vertSubSample = pixelFormatInfo_->planes[1].verticalSubSampling;
-
-	unsigned int c_inc = horzSubSample == 1 ? 2 : 0;
+	unsigned int c_inc = horzSubSample_ == 1 ? 2 : 0;
 	unsigned int cb_pos = nvSwap_ ? 1 : 0;
 	unsigned int cr_pos = nvSwap_ ? 0 : 1;
 
@@ -149,14 +349,14 @@ void EncoderLibJpeg::compressNV(const std::vector<Span<uint8_t>> &planes)
 	JSAMPROW row_pointer[1];
 	row_pointer[0] = &tmprowbuf[0];
 
-	for (unsigned int y = 0; y < compress_.image_height; y++) {
+	for (unsigned int y = yStart; y < yStart + compress->image_height; y++) {
 		unsigned char *dst = &tmprowbuf[0];
 
 		const unsigned char *src_y = src + y * y_stride;
-		const unsigned char *src_cb = src_c + (y / vertSubSample) * c_stride + cb_pos;
-		const unsigned char *src_cr = src_c + (y / vertSubSample) * c_stride + cr_pos;
+		const unsigned char *src_cb = src_c + (y / vertSubSample_) * c_stride + cb_pos;
+		const unsigned char *src_cr = src_c + (y / vertSubSample_) * c_stride + cr_pos;
 
-		for (unsigned int x = 0; x < compress_.image_width; x += 2) {
+		for (unsigned int x = 0; x < width_; x += 2) {
 			dst[0] = *src_y;
 			dst[1] = *src_cb;
 			dst[2] = *src_cr;
@@ -174,10 +374,215 @@ void EncoderLibJpeg::compressNV(const std::vector<Span<uint8_t>> &planes)
 			dst += 3;
 		}
 
-		jpeg_write_scanlines(&compress_, row_pointer, 1);
+		jpeg_write_scanlines(compress, row_pointer, 1);
 	}
 }
 
+/*
+ * Compress the incoming buffer from a supported NV format using the raw data
+ * API. The luma rows are passed to libjpeg in place, and only the chroma
+ * samples are de-interleaved, one iMCU row at a time.
+ */
+void EncoderLibJpeg::compressNVRaw(struct jpeg_compress_struct *compress,
+				   const std::vector<Span<uint8_t>> &planes,
+				   unsigned int yStart)
+{
+	unsigned int yStride = pixelFormatInfo_->stride(width_, 0);
+	unsigned int cStride = pixelFormatInfo_->stride(width_, 1);
+
+	unsigned int cWidth = (width_ + horzSubSample_ - 1) / horzSubSample_;
+	unsigned int cHeight = (height_ + vertSubSample_ - 1) / vertSubSample_;
+	unsigned int lumaRows = vertSubSample_ * DCTSIZE;
+
+	/* libjpeg reads full DCT blocks, pad the chroma lines accordingly. */
+	unsigned int cPadded = (cWidth + DCTSIZE - 1) / DCTSIZE * DCTSIZE;
+
+	unsigned int cbPos = nvSwap_ ? 1 : 0;
+	unsigned int crPos = nvSwap_ ? 0 : 1;
+
+	unsigned char *src = planes[0].data();
+	const unsigned char *srcC = planes[1].data();
+
+	std::vector<unsigned char> cbBuf(cPadded * DCTSIZE);
+	std::vector<unsigned char> crBuf(cPadded * DCTSIZE);
+
+	JSAMPROW yRows[2 * DCTSIZE];
+	JSAMPROW cbRows[DCTSIZE];
+	JSAMPROW crRows[DCTSIZE];
+	JSAMPARRAY data[3] = { yRows, cbRows, crRows };
+
+	for (unsigned int i = 0; i < DCTSIZE; i++) {
+		cbRows[i] = &cbBuf[i * cPadded];
+		crRows[i] = &crBuf[i * cPadded];
+	}
+
+	while (compress->next_scanline < compress->image_height) {
+		unsigned int y = yStart + compress->next_scanline;
+
+		/* Replicate the last line past the bottom of the image. */
+		for (unsigned int i = 0; i < lumaRows; i++) {
+			unsigned int row = std::min(y + i, height_ - 1);
+			yRows[i] = src + row * yStride;
+		}
+
+		for (unsigned int i = 0; i < DCTSIZE; i++) {
+			unsigned int row = std::min(y / vertSubSample_ + i, cHeight - 1);
+			const unsigned char *line = srcC + row * cStride;
+			unsigned char *cb = cbRows[i];
+			unsigned char *cr = crRows[i];
+
+			for (unsigned int x = 0; x < cWidth; x++) {
+				cb[x] = line[x * 2 + cbPos];
+				cr[x] = line[x * 2 + crPos];
+			}
+
+			for (unsigned int x = cWidth; x < cPadded; x++) {
+				cb[x] = cb[cWidth - 1];
+				cr[x] = cr[cWidth - 1];
+			}
+		}
+
+		jpeg_write_raw_data(compress, data, lumaRows);
+	}
+}
+
+void EncoderLibJpeg::encodeStrip(Strip &strip,
+				 const std::vector<Span<uint8_t>> &planes,
+				 Span<const uint8_t> exifData,
+				 unsigned int quality)
+{
+	struct jpeg_compress_struct compress;
+	struct jpeg_error_mgr jerr;
+
+	compress.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&compress);
+
+	setupCompress(&compress, strip.height);
+	jpeg_set_quality(&compress, quality, TRUE);
+
+	/*
+	 * The first strip is exactly one restart interval long. Setting the
+	 * interval makes libjpeg write the DRI marker for the whole image,
+	 * without any RST marker in the strip.
+	 */
+	if (strip.y == 0)
+		compress.restart_interval = strip.height / mcuHeight_
+					  * ((width_ + mcuWidth_ - 1) / mcuWidth_);
+
+	Destination destination = strip.buffer ? Destination(strip.buffer)
+					       : Destination(strip.output);
+	destination.attach(&compress);
+
+	jpeg_start_compress(&compress, TRUE);
+
+	if (strip.y == 0 && exifData.size())
+		jpeg_write_marker(&compress, JPEG_APP0 + 1,
+				  static_cast<const JOCTET *>(exifData.data()),
+				  exifData.size());
+
+	compressImage(&compress, planes, strip.y);
+
+	jpeg_finish_compress(&compress);
+	jpeg_destroy_compress(&compress);
+
+	strip.data = destination.overflow ? nullptr : destination.buffer.data();
+	strip.size = destination.size;
+}
+
+/*
+ * Encode the image as independent strips in parallel, and assemble them in a
+ * single baseline JPEG stream. Each strip is exactly one restart interval:
+ * restart markers reset the DC predictors, and all strips share the same
+ * quantization and Huffman tables, so the entropy-coded segments can be
+ * concatenated as-is. The first strip is encoded directly in the destination
+ * buffer with its headers, the image height is then patched and the other
+ * strips appended.
+ */
+int EncoderLibJpeg::encodeStrips(const std::vector<Span<uint8_t>> &planes,
+				 Span<uint8_t> dest, Span<const uint8_t> exifData,
+				 unsigned int quality)
+{
+	std::vector<Strip> strips(numStrips_);
+	for (unsigned int i = 0; i < numStrips_; i++) {
+		Strip &strip = strips[i];
+		strip.y = i * stripHeight_;
+		strip.height = std::min(stripHeight_, height_ - strip.y);
+		strip.output = dest;
+		strip.buffer = i ? &stripBuffers_[i] : nullptr;
+	}
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < numStrips_; i++)
+		threads.emplace_back(&EncoderLibJpeg::encodeStrip, this,
+				     std::ref(strips[i]), std::cref(planes),
+				     exifData, quality);
+
+	encodeStrip(strips[0], planes, exifData, quality);
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	std::vector<unsigned long> scans(numStrips_);
+	unsigned long sof = 0;
+	unsigned long size = 0;
+
+	for (unsigned int i = 0; i < numStrips_; i++) {
+		const Strip &strip = strips[i];
+		unsigned long stripSof, stripSos;
+
+		if (!strip.data) {
+			LOG(JPEG, Error) << "JPEG output exceeds buffer size "
+					 << dest.size();
+			return -ENOSPC;
+		}
+
+		if (!parseStream(strip.data, strip.size, &stripSof, &stripSos,
+				 &scans[i])) {
+			LOG(JPEG, Error) << "Invalid JPEG stream for strip " << i;
+			return -EINVAL;
+		}
+
+		if (i == 0) {
+			sof = stripSof;
+			/* Headers, DRI marker and first entropy-coded segment. */
+			size += strip.size - 2;
+		} else {
+			/* RSTn marker and entropy-coded segment. */
+			size += 2 + strip.size - scans[i] - 2;
+		}
+	}
+
+	/* EOI marker. */
+	size += 2;
+
+	if (size > dest.size()) {
+		LOG(JPEG, Error) << "JPEG output of " << size
+				 << " bytes exceeds buffer size " << dest.size();
+		return -ENOSPC;
+	}
+
+	unsigned char *out = dest.data();
+
+	out[sof + 5] = height_ >> 8;
+	out[sof + 6] = height_ & 0xff;
+	out += strips[0].size - 2;
+
+	for (unsigned int i = 1; i < numStrips_; i++) {
+		const Strip &strip = strips[i];
+
+		*out++ = 0xff;
+		*out++ = 0xd0 + ((i - 1) & 7);
+
+		memcpy(out, strip.data + scans[i], strip.size - scans[i] - 2);
+		out += strip.size - scans[i] - 2;
+	}
+
+	*out++ = 0xff;
+	*out++ = 0xd9;
+
+	return size;
+}
+
 int EncoderLibJpeg::encode(const FrameBuffer &source, Span<uint8_t> dest,
 			   Span<const uint8_t> exifData, unsigned int quality)
 {
@@ -195,20 +600,22 @@ int EncoderLibJpeg::encode(const std::vector<Span<uint8_t>> &src,
 			   Span<uint8_t> dest, Span<const uint8_t> exifData,
 			   unsigned int quality)
 {
-	unsigned char *destination = dest.data();
-	unsigned long size = dest.size();
+	ASSERT(src.size() == pixelFormatInfo_->numPlanes());
+
+	LOG(JPEG, Debug) << "JPEG Encode Starting:" << width_ << "x" << height_
+			 << " in " << numStrips_ << " strip(s)";
+
+	if (numStrips_ > 1)
+		return encodeStrips(src, dest, exifData, quality);
 
 	jpeg_set_quality(&compress_, quality, TRUE);
 
 	/*
-	 * The jpeg_mem_dest will reallocate if the required size is not
-	 * sufficient. That means the output won't be written to the correct
-	 * buffers.
-	 *
-	 * \todo Implement our own custom memory destination to prevent
-	 * reallocation and prefer failure with correct reporting.
+	 * Write directly to the destination buffer, and report failure if the
+	 * output doesn't fit instead of reallocating the buffer.
 	 */
-	jpeg_mem_dest(&compress_, &destination, &size);
+	Destination destination(dest);
+	destination.attach(&compress_);
 
 	jpeg_start_compress(&compress_, TRUE);
 
@@ -218,17 +625,15 @@ int EncoderLibJpeg::encode(const std::vector<Span<uint8_t>> &src,
 				  static_cast<const JOCTET *>(exifData.data()),
 				  exifData.size());
 
-	LOG(JPEG, Debug) << "JPEG Encode Starting:" << compress_.image_width
-			 << "x" << compress_.image_height;
-
-	ASSERT(src.size() == pixelFormatInfo_->numPlanes());
-
-	if (nv_)
-		compressNV(src);
-	else
-		compressRGB(src);
+	compressImage(&compress_, src, 0);
 
 	jpeg_finish_compress(&compress_);
 
-	return size;
+	if (destination.overflow) {
+		LOG(JPEG, Error) << "JPEG output exceeds buffer size "
+				 << dest.size();
+		return -ENOSPC;
+	}
+
+	return destination.size;
 }
@@ -32,14 +32,65 @@ public:
 		   unsigned int quality);
 
 private:
-	void compressRGB(const std::vector<libcamera::Span<uint8_t>> &planes);
-	void compressNV(const std::vector<libcamera::Span<uint8_t>> &planes);
+	static constexpr unsigned int kMaxStrips = 4;
+	static constexpr unsigned int kMinStripHeight = 256;
+
+	struct Strip {
+		unsigned int y;
+		unsigned int height;
+		libcamera::Span<uint8_t> output;
+		std::vector<uint8_t> *buffer;
+		unsigned char *data;
+		unsigned long size;
+	};
+
+	void setupCompress(struct jpeg_compress_struct *compress,
+			   unsigned int height);
+	void compressImage(struct jpeg_compress_struct *compress,
+			   const std::vector<libcamera::Span<uint8_t>> &planes,
+			   unsigned int yStart);
+	void compressRGB(struct jpeg_compress_struct *compress,
+			 const std::vector<libcamera::Span<uint8_t>> &planes,
+			 unsigned int yStart);
+	void compressNV(struct jpeg_compress_struct *compress,
+			const std::vector<libcamera::Span<uint8_t>> &planes,
+			unsigned int yStart);
+	void compressNVRaw(struct jpeg_compress_struct *compress,
+			   const std::vector<libcamera::Span<uint8_t>> &planes,
+			   unsigned int yStart);
+
+	void encodeStrip(Strip &strip,
+			 const std::vector<libcamera::Span<uint8_t>> &planes,
+			 libcamera::Span<const uint8_t> exifData,
+			 unsigned int quality);
+	int encodeStrips(const std::vector<libcamera::Span<uint8_t>> &planes,
+			 libcamera::Span<uint8_t> destination,
+			 libcamera::Span<const uint8_t> exifData,
+			 unsigned int quality);
 
 	struct jpeg_compress_struct compress_;
 	struct jpeg_error_mgr jerr_;
 
 	const libcamera::PixelFormatInfo *pixelFormatInfo_;
+	J_COLOR_SPACE colorSpace_;
+	unsigned int width_;
+	unsigned int height_;
 
 	bool nv_;
 	bool nvSwap_;
+	bool rawInput_;
+	unsigned int horzSubSample_;
+	unsigned int vertSubSample_;
+
+	unsigned int mcuWidth_;
+	unsigned int mcuHeight_;
+	unsigned int stripHeight_;
+	unsigned int numStrips_;
+
+	/*
+	 * Output buffers of the strips other than the first one, which is
+	 * written to the destination directly. They are kept across frames,
+	 * and their size acts as an estimate of the strip sizes.
+	 */
+	std::vector<std::vector<uint8_t>> stripBuffers_;
 };
@@ -0,0 +1,434 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * encoder_v4l2m2m.cpp - JPEG encoding using a V4L2 memory-to-memory device
+ */
+
+#include "encoder_v4l2m2m.h"
+
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/controls.h>
+#include <libcamera/formats.h>
+
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+#include "libcamera/internal/v4l2_pixelformat.h"
+#include "libcamera/internal/v4l2_videodevice.h"
+
+using namespace libcamera;
+using namespace std::chrono_literals;
+
+LOG_DECLARE_CATEGORY(JPEG)
+
+namespace {
+
+/* Maximum time to wait for the hardware to encode a frame. */
+constexpr std::chrono::milliseconds kEncodeTimeout = 1000ms;
+
+/* Number of source buffers kept imported in the output queue. */
+constexpr unsigned int kNumOutputBuffers = 4;
+
+/*
+ * Check if a video device node is a memory-to-memory device, without going
+ * through V4L2VideoDevice to avoid logging errors for unrelated devices.
+ */
+bool isM2MDevice(const std::string &deviceNode)
+{
+	int fd = open(deviceNode.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	struct v4l2_capability caps = {};
+	int ret = ioctl(fd, VIDIOC_QUERYCAP, &caps);
+	close(fd);
+	if (ret < 0)
+		return false;
+
+	uint32_t deviceCaps = caps.capabilities & V4L2_CAP_DEVICE_CAPS
+			    ? caps.device_caps : caps.capabilities;
+
+	return deviceCaps & (V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE);
+}
+
+} /* namespace */
+
+EncoderV4L2M2M::EncoderV4L2M2M()
+	: stride_(0), quality_(-1), device_(this), outputDone_(false),
+	  captureDone_(false)
+{
+	/*
+	 * The post-processing threads don't run an event loop. Operate the
+	 * device from a dedicated thread, and wait for the encoding to
+	 * complete with a condition variable.
+	 */
+	thread_.setName("JPEG-V4L2");
+	device_.moveToThread(&thread_);
+	thread_.start();
+}
+
+EncoderV4L2M2M::~EncoderV4L2M2M()
+{
+	device_.invokeMethod(&Device::stop, ConnectionTypeBlocking);
+
+	thread_.exit();
+	thread_.wait();
+}
+
+/*
+ * Look for a V4L2 M2M device able to encode the stream configuration to JPEG.
+ * The device is only probed here, it is opened in the encoder thread at the
+ * first encode() call, as its event notifiers are bound to the thread that
+ * creates them.
+ *
+ * Return 0 on success, -ENODEV if no suitable device is available
+ */
+int EncoderV4L2M2M::configure(const StreamConfiguration &cfg)
+{
+	device_.invokeMethod(&Device::stop, ConnectionTypeBlocking);
+	deviceNode_.clear();
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(cfg.pixelFormat);
+	if (!info.isValid())
+		return -ENOTSUP;
+
+	pixelFormat_ = cfg.pixelFormat;
+	size_ = cfg.size;
+	stride_ = cfg.stride ? cfg.stride : info.stride(size_.width, 0);
+
+	DIR *dir = opendir("/dev");
+	if (!dir) {
+		int ret = -errno;
+		LOG(JPEG, Error) << "Failed to open /dev: " << strerror(-ret);
+		return ret;
+	}
+
+	std::vector<std::string> nodes;
+	struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		if (!strncmp(ent->d_name, "video", 5))
+			nodes.push_back(std::string("/dev/") + ent->d_name);
+	}
+
+	closedir(dir);
+
+	std::sort(nodes.begin(), nodes.end());
+
+	for (const std::string &node : nodes) {
+		if (probe(node)) {
+			deviceNode_ = node;
+			break;
+		}
+	}
+
+	if (deviceNode_.empty()) {
+		LOG(JPEG, Info)
+			<< "No V4L2 JPEG encoder for " << size_.toString()
+			<< "-" << pixelFormat_.toString();
+		return -ENODEV;
+	}
+
+	LOG(JPEG, Info) << "Using V4L2 JPEG encoder " << deviceNode_;
+
+	return 0;
+}
+
+/*
+ * Set the JPEG format on the capture queue and the source format on the
+ * output queue. The format of the coded side is set first, as encoders
+ * validate the raw format against it.
+ */
+int EncoderV4L2M2M::setFormats(V4L2M2MDevice *m2m)
+{
+	const V4L2PixelFormat jpegFormat{ V4L2_PIX_FMT_JPEG };
+
+	V4L2DeviceFormat format;
+	format.fourcc = jpegFormat;
+	format.size = size_;
+
+	int ret = m2m->capture()->setFormat(&format);
+	if (ret < 0)
+		return ret;
+
+	if (format.fourcc != jpegFormat || format.size != size_)
+		return -EINVAL;
+
+	const V4L2PixelFormat videoFormat =
+		V4L2PixelFormat::fromPixelFormat(pixelFormat_);
+
+	format = {};
+	format.fourcc = videoFormat;
+	format.size = size_;
+	format.planesCount = 1;
+	format.planes[0].bpl = stride_;
+
+	ret = m2m->output()->setFormat(&format);
+	if (ret < 0)
+		return ret;
+
+	/* The source buffers are imported, the layout must match. */
+	if (format.fourcc != videoFormat || format.size != size_ ||
+	    format.planes[0].bpl != stride_)
+		return -EINVAL;
+
+	return 0;
+}
+
+bool EncoderV4L2M2M::probe(const std::string &deviceNode)
+{
+	if (!isM2MDevice(deviceNode))
+		return false;
+
+	V4L2M2MDevice m2m(deviceNode);
+	if (m2m.open() < 0)
+		return false;
+
+	int ret = setFormats(&m2m);
+	if (ret < 0)
+		LOG(JPEG, Debug)
+			<< deviceNode << " can't encode " << size_.toString()
+			<< "-" << pixelFormat_.toString() << " to JPEG";
+
+	return ret == 0;
+}
+
+int EncoderV4L2M2M::start()
+{
+	m2m_ = std::make_unique<V4L2M2MDevice>(deviceNode_);
+
+	int ret = m2m_->open();
+	if (ret < 0)
+		goto error;
+
+	ret = setFormats(m2m_.get());
+	if (ret < 0) {
+		LOG(JPEG, Error) << "Failed to set formats on " << deviceNode_;
+		goto error;
+	}
+
+	ret = m2m_->output()->importBuffers(kNumOutputBuffers);
+	if (ret < 0)
+		goto error;
+
+	ret = m2m_->capture()->allocateBuffers(1, &captureBuffers_);
+	if (ret < 0)
+		goto error;
+
+	m2m_->output()->bufferReady.connect(this, &EncoderV4L2M2M::outputBufferReady);
+	m2m_->capture()->bufferReady.connect(this, &EncoderV4L2M2M::captureBufferReady);
+
+	ret = m2m_->output()->streamOn();
+	if (ret < 0)
+		goto error;
+
+	ret = m2m_->capture()->streamOn();
+	if (ret < 0)
+		goto error;
+
+	quality_ = -1;
+
+	return 0;
+
+error:
+	LOG(JPEG, Error) << "Failed to start V4L2 JPEG encoder: "
+			 << strerror(-ret);
+	stop();
+	return ret;
+}
+
+void EncoderV4L2M2M::stop()
+{
+	if (!m2m_)
+		return;
+
+	m2m_->capture()->streamOff();
+	m2m_->output()->streamOff();
+
+	m2m_->capture()->releaseBuffers();
+	m2m_->output()->releaseBuffers();
+	captureBuffers_.clear();
+
+	m2m_.reset();
+}
+
+/* Queue the capture and source buffers to start encoding a frame. */
+int EncoderV4L2M2M::queue(FrameBuffer *input, unsigned int quality)
+{
+	setQuality(quality);
+
+	int ret = m2m_->capture()->queueBuffer(captureBuffers_[0].get());
+	if (ret < 0)
+		return ret;
+
+	ret = m2m_->output()->queueBuffer(input);
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	return 0;
+}
+
+void EncoderV4L2M2M::setQuality(unsigned int quality)
+{
+	if (static_cast<int>(quality) == quality_)
+		return;
+
+	quality_ = quality;
+
+	V4L2VideoDevice *capture = m2m_->capture();
+	if (!capture->controls().count(V4L2_CID_JPEG_COMPRESSION_QUALITY)) {
+		LOG(JPEG, Debug) << "JPEG quality can't be set on " << deviceNode_;
+		return;
+	}
+
+	ControlList ctrls(capture->controls());
+	ctrls.set(V4L2_CID_JPEG_COMPRESSION_QUALITY,
+		  ControlValue(static_cast<int32_t>(quality)));
+
+	if (capture->setControls(&ctrls) < 0)
+		LOG(JPEG, Warning) << "Failed to set JPEG quality to " << quality;
+}
+
+void EncoderV4L2M2M::outputBufferReady([[maybe_unused]] FrameBuffer *buffer)
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		outputDone_ = true;
+	}
+
+	cv_.notify_one();
+}
+
+void EncoderV4L2M2M::captureBufferReady([[maybe_unused]] FrameBuffer *buffer)
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		captureDone_ = true;
+	}
+
+	cv_.notify_one();
+}
+
+int EncoderV4L2M2M::encode(const FrameBuffer &source, Span<uint8_t> dest,
+			   Span<const uint8_t> exifData, unsigned int quality)
+{
+	if (deviceNode_.empty())
+		return -ENODEV;
+
+	/* Open the device if not done yet. */
+	if (!m2m_) {
+		int ret = device_.invokeMethod(&Device::start,
+					       ConnectionTypeBlocking);
+		if (ret < 0)
+			return ret;
+	}
+
+	/*
+	 * Import the source buffer through a FrameBuffer that shares its
+	 * dmabufs, as queuing and dequeuing a buffer overwrites its metadata.
+	 */
+	FrameBuffer input(source.planes());
+	for (auto [i, plane] : utils::enumerate(input.planes()))
+		input._d()->metadata().planes()[i].bytesused = plane.length;
+
+	FrameBuffer *output = captureBuffers_[0].get();
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		outputDone_ = false;
+		captureDone_ = false;
+	}
+
+	int ret = device_.invokeMethod(&Device::queue, ConnectionTypeBlocking,
+				       &input, quality);
+	if (ret < 0)
+		return ret;
+
+	bool done;
+
+	{
+		std::unique_lock<std::mutex> locker(mutex_);
+		done = cv_.wait_for(locker, kEncodeTimeout, [&]() {
+			return outputDone_ && captureDone_;
+		});
+	}
+
+	if (!done) {
+		LOG(JPEG, Error) << "Timeout encoding frame on " << deviceNode_;
+		device_.invokeMethod(&Device::stop, ConnectionTypeBlocking);
+		return -ETIMEDOUT;
+	}
+
+	const FrameMetadata &metadata = output->metadata();
+	if (metadata.status != FrameMetadata::FrameSuccess) {
+		LOG(JPEG, Error) << "Failed to encode frame on " << deviceNode_;
+		return -EIO;
+	}
+
+	MappedFrameBuffer mapped(output, MappedFrameBuffer::MapFlag::Read);
+	if (!mapped.isValid()) {
+		LOG(JPEG, Error) << "Failed to map JPEG buffer: "
+				 << strerror(mapped.error());
+		return mapped.error();
+	}
+
+	const uint8_t *jpeg = mapped.planes()[0].data();
+	size_t jpegSize = std::min<size_t>(metadata.planes()[0].bytesused,
+					   mapped.planes()[0].size());
+
+	if (jpegSize < 2 || jpeg[0] != 0xff || jpeg[1] != 0xd8) {
+		LOG(JPEG, Error) << "Invalid JPEG stream from " << deviceNode_;
+		return -EINVAL;
+	}
+
+	/*
+	 * Insert the Exif data in an APP1 segment right after the SOI marker,
+	 * hardware encoders don't produce it.
+	 */
+	size_t app1Size = exifData.size() ? exifData.size() + 4 : 0;
+	size_t size = jpegSize + app1Size;
+
+	if (exifData.size() + 2 > 0xffff) {
+		LOG(JPEG, Error) << "Exif data too large";
+		return -EINVAL;
+	}
+
+	if (size > dest.size()) {
+		LOG(JPEG, Error) << "JPEG output of " << size
+				 << " bytes exceeds buffer size " << dest.size();
+		return -ENOSPC;
+	}
+
+	uint8_t *out = dest.data();
+	memcpy(out, jpeg, 2);
+	out += 2;
+
+	if (app1Size) {
+		unsigned int length = exifData.size() + 2;
+
+		*out++ = 0xff;
+		*out++ = 0xe1;
+		*out++ = length >> 8;
+		*out++ = length & 0xff;
+		memcpy(out, exifData.data(), exifData.size());
+		out += exifData.size();
+	}
+
+	memcpy(out, jpeg + 2, jpegSize - 2);
+
+	return size;
+}
@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * encoder_v4l2m2m.h - JPEG encoding using a V4L2 memory-to-memory device
+ */
+
+#pragma once
+
+#include "encoder.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/object.h>
+#include <libcamera/base/thread.h>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+namespace libcamera {
+class V4L2M2MDevice;
+} /* namespace libcamera */
+
+class EncoderV4L2M2M : public Encoder
+{
+public:
+	EncoderV4L2M2M();
+	~EncoderV4L2M2M();
+
+	int configure(const libcamera::StreamConfiguration &cfg) override;
+	int encode(const libcamera::FrameBuffer &source,
+		   libcamera::Span<uint8_t> destination,
+		   libcamera::Span<const uint8_t> exifData,
+		   unsigned int quality) override;
+
+private:
+	/*
+	 * The M2M device is operated from the encoder thread, which runs its
+	 * event notifiers.
+	 */
+	class Device : public libcamera::Object
+	{
+	public:
+		Device(EncoderV4L2M2M *encoder)
+			: encoder_(encoder)
+		{
+		}
+
+		int start() { return encoder_->start(); }
+		void stop() { encoder_->stop(); }
+		int queue(libcamera::FrameBuffer *input, unsigned int quality)
+		{
+			return encoder_->queue(input, quality);
+		}
+
+	private:
+		EncoderV4L2M2M *encoder_;
+	};
+
+	int setFormats(libcamera::V4L2M2MDevice *m2m);
+	bool probe(const std::string &deviceNode);
+
+	int start();
+	void stop();
+	int queue(libcamera::FrameBuffer *input, unsigned int quality);
+	void setQuality(unsigned int quality);
+
+	void outputBufferReady(libcamera::FrameBuffer *buffer);
+	void captureBufferReady(libcamera::FrameBuffer *buffer);
+
+	libcamera::PixelFormat pixelFormat_;
+	libcamera::Size size_;
+	unsigned int stride_;
+
+	std::string deviceNode_;
+	std::unique_ptr<libcamera::V4L2M2MDevice> m2m_;
+	std::vector<std::unique_ptr<libcamera::FrameBuffer>> captureBuffers_;
+	int quality_;
+
+	libcamera::Thread thread_;
+	Device device_;
+
+	/* Protects the done flags, set in the encoder thread. */
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool outputDone_;
+	bool captureDone_;
+};
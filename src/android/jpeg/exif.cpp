@@ -8,9 +8,11 @@
 #include "exif.h"
 
 #include <cmath>
+#include <errno.h>
 #include <iomanip>
 #include <map>
 #include <sstream>
+#include <string.h>
 #include <tuple>
 #include <uchar.h>
 
@@ -31,6 +33,62 @@ enum class _ExifTag {
 	OFFSET_TIME_DIGITIZED    = 0x9012,
 };
 
+namespace {
+
+/* Header of the Exif APP1 segment, followed by the TIFF structure. */
+const uint8_t exifHeader[] = { 'E', 'x', 'i', 'f', 0, 0 };
+
+/*
+ * Conversion of the values of the fields that ExifTemplate can patch, shared
+ * with the Exif setters to guarantee identical encodings.
+ */
+uint16_t orientationValue(int orientation)
+{
+	switch (orientation) {
+	case 0:
+	default:
+		return 1;
+	case 90:
+		return 6;
+	case 180:
+		return 3;
+	case 270:
+		return 8;
+	}
+}
+
+std::string dateTimeString(const struct tm &tm)
+{
+	char str[20];
+	strftime(str, sizeof(str), "%Y:%m:%d %H:%M:%S", &tm);
+	return str;
+}
+
+/* Return the timezone offset as [+-]hh:mm, or an empty string if unknown. */
+std::string offsetTimeString(const struct tm &tm)
+{
+	char str[20];
+	int r = strftime(str, sizeof(str), "%z", &tm);
+	if (r <= 0)
+		return {};
+
+	std::string tz(str);
+	tz.insert(3, 1, ':');
+	return tz;
+}
+
+ExifRational exposureTimeValue(uint64_t nsec)
+{
+	return { static_cast<ExifLong>(nsec), 1000000000 };
+}
+
+ExifRational apertureValue(float size)
+{
+	return { static_cast<ExifLong>(size * 10000), 10000 };
+}
+
+} /* namespace */
+
 /*
  * The Exif class should be instantiated and specific properties set
  * through the exposed public API.
@@ -295,21 +353,17 @@ void Exif::setTimestamp(time_t timestamp, std::chrono::milliseconds msec)
 	struct tm tm;
 	localtime_r(&timestamp, &tm);
 
-	char str[20];
-	strftime(str, sizeof(str), "%Y:%m:%d %H:%M:%S", &tm);
-	std::string ts(str);
+	std::string ts = dateTimeString(tm);
 
 	setString(EXIF_IFD_0, EXIF_TAG_DATE_TIME, EXIF_FORMAT_ASCII, ts);
 	setString(EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_ORIGINAL, EXIF_FORMAT_ASCII, ts);
 	setString(EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_DIGITIZED, EXIF_FORMAT_ASCII, ts);
 
 	/* Query and set timezone information if available. */
-	int r = strftime(str, sizeof(str), "%z", &tm);
-	if (r <= 0)
+	std::string tz = offsetTimeString(tm);
+	if (tz.empty())
 		return;
 
-	std::string tz(str);
-	tz.insert(3, 1, ':');
 	setString(EXIF_IFD_EXIF,
 		  static_cast<ExifTag>(_ExifTag::OFFSET_TIME),
 		  EXIF_FORMAT_ASCII, tz);
@@ -410,24 +464,7 @@ void Exif::setGPSMethod(const std::string &method)
 
 void Exif::setOrientation(int orientation)
 {
-	int value;
-	switch (orientation) {
-	case 0:
-	default:
-		value = 1;
-		break;
-	case 90:
-		value = 6;
-		break;
-	case 180:
-		value = 3;
-		break;
-	case 270:
-		value = 8;
-		break;
-	}
-
-	setShort(EXIF_IFD_0, EXIF_TAG_ORIENTATION, value);
+	setShort(EXIF_IFD_0, EXIF_TAG_ORIENTATION, orientationValue(orientation));
 }
 
 /*
@@ -452,14 +489,12 @@ void Exif::setFocalLength(float length)
 
 void Exif::setExposureTime(uint64_t nsec)
 {
-	ExifRational rational = { static_cast<ExifLong>(nsec), 1000000000 };
-	setRational(EXIF_IFD_EXIF, EXIF_TAG_EXPOSURE_TIME, rational);
+	setRational(EXIF_IFD_EXIF, EXIF_TAG_EXPOSURE_TIME, exposureTimeValue(nsec));
 }
 
 void Exif::setAperture(float size)
 {
-	ExifRational rational = { static_cast<ExifLong>(size * 10000), 10000 };
-	setRational(EXIF_IFD_EXIF, EXIF_TAG_FNUMBER, rational);
+	setRational(EXIF_IFD_EXIF, EXIF_TAG_FNUMBER, apertureValue(size));
 }
 
 void Exif::setISO(uint16_t iso)
@@ -523,3 +558,291 @@ std::u16string Exif::utf8ToUtf16(const std::string &str)
 
 	return 0;
 }
+
+/*
+ * \brief Locate the value of a tag in the generated Exif data
+ * \param[in] ifd The IFD containing the tag
+ * \param[in] tag The tag
+ * \param[in] size The expected size of the value in bytes
+ *
+ * This function allows updating fixed-size fields of Exif data generated once
+ * and used as a template, without regenerating the whole data. It walks the
+ * TIFF structure of the data generated by the last call to generate().
+ *
+ * \return The offset of the value relative to the start of data(), or a
+ * negative error code if the tag can't be found or its size doesn't match
+ * \a size
+ */
+int Exif::valueOffset(ExifIfd ifd, ExifTag tag, size_t size) const
+{
+	static constexpr unsigned int kEntrySize = 12;
+
+	if (size_ < sizeof(exifHeader) + 8 ||
+	    memcmp(exifData_, exifHeader, sizeof(exifHeader)))
+		return -EINVAL;
+
+	const uint8_t *tiff = exifData_ + sizeof(exifHeader);
+	const size_t tiffSize = size_ - sizeof(exifHeader);
+
+	/* Return the number of entries of the IFD at \a offset, or 0. */
+	auto entries = [&](uint32_t offset) -> unsigned int {
+		if (offset + 2 > tiffSize)
+			return 0;
+
+		unsigned int count = exif_get_short(tiff + offset, order_);
+		if (offset + 2 + count * kEntrySize + 4 > tiffSize)
+			return 0;
+
+		return count;
+	};
+
+	auto findEntry = [&](uint32_t offset, uint16_t id) -> const uint8_t * {
+		unsigned int count = entries(offset);
+		for (unsigned int i = 0; i < count; i++) {
+			const uint8_t *entry = tiff + offset + 2 + i * kEntrySize;
+			if (exif_get_short(entry, order_) == id)
+				return entry;
+		}
+
+		return nullptr;
+	};
+
+	uint32_t offset = exif_get_long(tiff + 4, order_);
+	const uint8_t *entry;
+
+	switch (ifd) {
+	case EXIF_IFD_0:
+		break;
+
+	case EXIF_IFD_1: {
+		unsigned int count = entries(offset);
+		if (!count)
+			return -ENOENT;
+
+		offset = exif_get_long(tiff + offset + 2 + count * kEntrySize,
+				       order_);
+		if (!offset)
+			return -ENOENT;
+		break;
+	}
+
+	case EXIF_IFD_EXIF:
+	case EXIF_IFD_GPS:
+		entry = findEntry(offset, ifd == EXIF_IFD_EXIF
+					  ? EXIF_TAG_EXIF_IFD_POINTER
+					  : EXIF_TAG_GPS_INFO_IFD_POINTER);
+		if (!entry)
+			return -ENOENT;
+
+		offset = exif_get_long(entry + 8, order_);
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	entry = findEntry(offset, tag);
+	if (!entry)
+		return -ENOENT;
+
+	ExifFormat format = static_cast<ExifFormat>(exif_get_short(entry + 2, order_));
+	size_t valueSize = exif_format_get_size(format)
+			 * exif_get_long(entry + 4, order_);
+	if (valueSize != size)
+		return -EINVAL;
+
+	/* Values of up to 4 bytes are stored in the entry itself. */
+	size_t value = valueSize <= 4 ? entry + 8 - tiff
+				      : exif_get_long(entry + 8, order_);
+	if (value + valueSize > tiffSize)
+		return -EINVAL;
+
+	return sizeof(exifHeader) + value;
+}
+
+/*
+ * \brief Locate the thumbnail in the generated Exif data
+ *
+ * \return The offset of the thumbnail relative to the start of data(), or a
+ * negative error code if the data contains no thumbnail
+ */
+int Exif::thumbnailOffset() const
+{
+	int offset = valueOffset(EXIF_IFD_1, EXIF_TAG_JPEG_INTERCHANGE_FORMAT, 4);
+	if (offset < 0)
+		return offset;
+
+	size_t thumbnail = sizeof(exifHeader) + exif_get_long(exifData_ + offset, order_);
+	if (thumbnail > size_)
+		return -EINVAL;
+
+	return thumbnail;
+}
+
+/*
+ * The ExifTemplate class stores Exif data generated once, and patches the
+ * fields that vary from frame to frame in place. This avoids creating all the
+ * entries and serialising them for every capture.
+ *
+ * Only fixed-size fields can be patched: the timestamps, orientation, exposure
+ * time, aperture and ISO sensitivity. The template is created from an Exif
+ * instance that contains all those fields, with placeholder values. When
+ * created with a thumbnail, the template expects libexif to store the
+ * thumbnail at the end of the data, and replaces it for every frame.
+ *
+ * All the fields must be set for every frame, as they retain the values of the
+ * previous frame otherwise.
+ */
+ExifTemplate::ExifTemplate()
+	: order_(EXIF_BYTE_ORDER_INTEL), orientation_(-1), exposureTime_(-1),
+	  aperture_(-1), iso_(-1), thumbnailOffset_(0), thumbnailLength_(-1)
+{
+	dateTime_.fill(-1);
+	offsetTime_.fill(-1);
+}
+
+/*
+ * \brief Create the template from Exif entries
+ * \param[in] exif The Exif instance holding all the template entries
+ * \param[in] thumbnail Whether to create a template with a thumbnail
+ *
+ * \return 0 on success or a negative error code if the template can't be
+ * created, in which case Exif data must be generated for every frame
+ */
+int ExifTemplate::create(Exif *exif, bool thumbnail)
+{
+	/* The placeholder must exist until the data is generated. */
+	static const unsigned char placeholder[] = { 0 };
+
+	data_.clear();
+
+	if (thumbnail)
+		exif->setThumbnail(placeholder, Exif::Compression::JPEG);
+
+	if (exif->generate() != 0)
+		return -EINVAL;
+
+	order_ = exif->byteOrder();
+
+	auto locate = [&](ExifIfd ifd, ExifTag tag, size_t size, int *offset) {
+		*offset = exif->valueOffset(ifd, tag, size);
+		return *offset >= 0;
+	};
+
+	/* The date strings are 19 characters long, plus the terminating 0. */
+	if (!locate(EXIF_IFD_0, EXIF_TAG_ORIENTATION, 2, &orientation_) ||
+	    !locate(EXIF_IFD_0, EXIF_TAG_DATE_TIME, 20, &dateTime_[0]) ||
+	    !locate(EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_ORIGINAL, 20, &dateTime_[1]) ||
+	    !locate(EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_DIGITIZED, 20, &dateTime_[2]) ||
+	    !locate(EXIF_IFD_EXIF, EXIF_TAG_EXPOSURE_TIME, 8, &exposureTime_) ||
+	    !locate(EXIF_IFD_EXIF, EXIF_TAG_FNUMBER, 8, &aperture_) ||
+	    !locate(EXIF_IFD_EXIF, EXIF_TAG_ISO_SPEED_RATINGS, 2, &iso_)) {
+		LOG(EXIF, Debug) << "Exif fields can't be located in template";
+		return -EINVAL;
+	}
+
+	/* The timezone strings are optional, [+-]hh:mm plus the terminating 0. */
+	static const std::array<_ExifTag, 3> offsetTimeTags = {
+		_ExifTag::OFFSET_TIME,
+		_ExifTag::OFFSET_TIME_ORIGINAL,
+		_ExifTag::OFFSET_TIME_DIGITIZED,
+	};
+	for (unsigned int i = 0; i < offsetTimeTags.size(); i++)
+		offsetTime_[i] = exif->valueOffset(EXIF_IFD_EXIF,
+						   static_cast<ExifTag>(offsetTimeTags[i]),
+						   7);
+
+	Span<const uint8_t> data = exif->data();
+
+	if (thumbnail) {
+		int offset = exif->thumbnailOffset();
+		if (offset < 0 || static_cast<size_t>(offset) + sizeof(placeholder) != data.size() ||
+		    !locate(EXIF_IFD_1, EXIF_TAG_JPEG_INTERCHANGE_FORMAT_LENGTH, 4,
+			    &thumbnailLength_)) {
+			LOG(EXIF, Debug) << "Unsupported thumbnail layout in template";
+			return -EINVAL;
+		}
+
+		thumbnailOffset_ = offset;
+	} else {
+		thumbnailOffset_ = data.size();
+		thumbnailLength_ = -1;
+	}
+
+	data_.assign(data.begin(), data.end());
+
+	LOG(EXIF, Debug) << "Created EXIF template (" << data_.size() << " bytes)";
+
+	return 0;
+}
+
+void ExifTemplate::patchShort(int offset, uint16_t value)
+{
+	exif_set_short(data_.data() + offset, order_, value);
+}
+
+void ExifTemplate::patchRational(int offset, ExifRational value)
+{
+	exif_set_rational(data_.data() + offset, order_, value);
+}
+
+void ExifTemplate::patchString(int offset, const std::string &value)
+{
+	/* Copy the terminating 0, the size has been checked by the caller. */
+	memcpy(data_.data() + offset, value.c_str(), value.size() + 1);
+}
+
+void ExifTemplate::setOrientation(int orientation)
+{
+	patchShort(orientation_, orientationValue(orientation));
+}
+
+void ExifTemplate::setTimestamp(time_t timestamp)
+{
+	struct tm tm;
+	localtime_r(&timestamp, &tm);
+
+	std::string ts = dateTimeString(tm);
+	if (ts.size() == 19) {
+		for (int offset : dateTime_)
+			patchString(offset, ts);
+	}
+
+	std::string tz = offsetTimeString(tm);
+	if (tz.size() == 6) {
+		for (int offset : offsetTime_) {
+			if (offset >= 0)
+				patchString(offset, tz);
+		}
+	}
+}
+
+void ExifTemplate::setExposureTime(uint64_t nsec)
+{
+	patchRational(exposureTime_, exposureTimeValue(nsec));
+}
+
+void ExifTemplate::setAperture(float size)
+{
+	patchRational(aperture_, apertureValue(size));
+}
+
+void ExifTemplate::setISO(uint16_t iso)
+{
+	patchShort(iso_, iso);
+}
+
+/*
+ * Replace the thumbnail stored at the end of the data. This is only valid for
+ * templates created with a thumbnail.
+ */
+void ExifTemplate::setThumbnail(Span<const unsigned char> thumbnail)
+{
+	if (thumbnailLength_ < 0)
+		return;
+
+	data_.resize(thumbnailOffset_);
+	data_.insert(data_.end(), thumbnail.begin(), thumbnail.end());
+
+	exif_set_long(data_.data() + thumbnailLength_, order_, thumbnail.size());
+}
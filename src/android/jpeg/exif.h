@@ -7,9 +7,11 @@
 
 #pragma once
 
+#include <array>
 #include <chrono>
 #include <string>
 #include <time.h>
+#include <vector>
 
 #include <libexif/exif-data.h>
 
@@ -78,6 +80,10 @@ public:
 	libcamera::Span<const uint8_t> data() const { return { exifData_, size_ }; }
 	[[nodiscard]] int generate();
 
+	ExifByteOrder byteOrder() const { return order_; }
+	int valueOffset(ExifIfd ifd, ExifTag tag, size_t size) const;
+	int thumbnailOffset() const;
+
 private:
 	ExifEntry *createEntry(ExifIfd ifd, ExifTag tag);
 	ExifEntry *createEntry(ExifIfd ifd, ExifTag tag, ExifFormat format,
@@ -107,3 +113,39 @@ private:
 	unsigned char *exifData_;
 	unsigned int size_;
 };
+
+class ExifTemplate
+{
+public:
+	ExifTemplate();
+
+	int create(Exif *exif, bool thumbnail);
+	bool isValid() const { return !data_.empty(); }
+
+	void setOrientation(int orientation);
+	void setTimestamp(time_t timestamp);
+	void setExposureTime(uint64_t nsec);
+	void setAperture(float size);
+	void setISO(uint16_t iso);
+	void setThumbnail(libcamera::Span<const unsigned char> thumbnail);
+
+	libcamera::Span<const uint8_t> data() const { return data_; }
+
+private:
+	void patchShort(int offset, uint16_t value);
+	void patchRational(int offset, ExifRational value);
+	void patchString(int offset, const std::string &value);
+
+	std::vector<uint8_t> data_;
+	ExifByteOrder order_;
+
+	int orientation_;
+	std::array<int, 3> dateTime_;
+	std::array<int, 3> offsetTime_;
+	int exposureTime_;
+	int aperture_;
+	int iso_;
+
+	size_t thumbnailOffset_;
+	int thumbnailLength_;
+};
@@ -8,14 +8,19 @@
 #include "post_processor_jpeg.h"
 
 #include <chrono>
+#include <functional>
+#include <string.h>
+#include <thread>
 
 #include "../camera_device.h"
 #include "../camera_metadata.h"
 #include "../camera_request.h"
 #include "encoder_libjpeg.h"
+#include "encoder_v4l2m2m.h"
 #include "exif.h"
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
 
 #include <libcamera/formats.h>
 
@@ -24,8 +29,101 @@ using namespace std::chrono_literals;
 
 LOG_DEFINE_CATEGORY(JPEG)
 
+namespace {
+
+/*
+ * Insert the Exif data in an APP1 segment of the JPEG stream stored in
+ * \a buffer, after the SOI marker and the JFIF APP0 segment if present.
+ *
+ * Return the size of the resulting stream, or a negative error code if the
+ * stream is invalid or the buffer too small
+ */
+int insertExif(Span<uint8_t> buffer, size_t size, Span<const uint8_t> exifData)
+{
+	if (exifData.empty())
+		return size;
+
+	if (exifData.size() + 2 > 0xffff)
+		return -EINVAL;
+
+	const size_t segmentSize = exifData.size() + 4;
+	if (size + segmentSize > buffer.size())
+		return -ENOSPC;
+
+	uint8_t *data = buffer.data();
+	if (size < 4 || data[0] != 0xff || data[1] != 0xd8)
+		return -EINVAL;
+
+	size_t pos = 2;
+	if (data[2] == 0xff && data[3] == 0xe0 && size >= 6)
+		pos += 2 + ((data[4] << 8) | data[5]);
+	if (pos > size)
+		return -EINVAL;
+
+	memmove(data + pos + segmentSize, data + pos, size - pos);
+
+	const unsigned int length = exifData.size() + 2;
+	data[pos] = 0xff;
+	data[pos + 1] = 0xe1;
+	data[pos + 2] = length >> 8;
+	data[pos + 3] = length & 0xff;
+	memcpy(data + pos + 4, exifData.data(), exifData.size());
+
+	return size + segmentSize;
+}
+
+/*
+ * Insert the Exif data in an APP1 segment in front of the JPEG stream of
+ * \a size bytes stored at offset \a reserve in \a buffer. The stream has been
+ * encoded after a gap reserved for the segment, which is padded to fill the
+ * gap exactly, to avoid moving the compressed image. Only the SOI marker and
+ * the JFIF APP0 segment are moved to the start of the buffer. If the Exif data
+ * doesn't fit in the gap, the stream is moved and the Exif data inserted with
+ * insertExif().
+ *
+ * Return the size of the resulting stream, or a negative error code if the
+ * stream is invalid or the buffer too small
+ */
+int placeExif(Span<uint8_t> buffer, size_t reserve, size_t size,
+	      Span<const uint8_t> exifData)
+{
+	uint8_t *data = buffer.data();
+	uint8_t *stream = data + reserve;
+
+	if (size < 4 || stream[0] != 0xff || stream[1] != 0xd8)
+		return -EINVAL;
+
+	size_t header = 2;
+	if (stream[2] == 0xff && stream[3] == 0xe0 && size >= 6)
+		header += 2 + ((stream[4] << 8) | stream[5]);
+	if (header > size)
+		return -EINVAL;
+
+	if (exifData.empty() || exifData.size() + 4 > reserve ||
+	    reserve - 2 > 0xffff) {
+		if (reserve)
+			memmove(data, stream, size);
+		return insertExif(buffer, size, exifData);
+	}
+
+	memmove(data, stream, header);
+
+	uint8_t *segment = data + header;
+	const unsigned int length = reserve - 2;
+	segment[0] = 0xff;
+	segment[1] = 0xe1;
+	segment[2] = length >> 8;
+	segment[3] = length & 0xff;
+	memcpy(segment + 4, exifData.data(), exifData.size());
+	memset(segment + 4 + exifData.size(), 0, reserve - 4 - exifData.size());
+
+	return size + reserve;
+}
+
+} /* namespace */
+
 PostProcessorJpeg::PostProcessorJpeg(CameraDevice *const device)
-	: cameraDevice_(device)
+	: cameraDevice_(device), exifReserve_(0)
 {
 }
 
@@ -46,11 +144,116 @@ int PostProcessorJpeg::configure(const StreamConfiguration &inCfg,
 
 	thumbnailer_.configure(inCfg.size, inCfg.pixelFormat);
 
+	createExifTemplates();
+
+	/*
+	 * Use the hardware encoder if selected in the HAL configuration file,
+	 * and fall back to libjpeg if it can't handle the stream.
+	 */
+	if (cameraDevice_->jpegEncoder() == CameraConfigData::JpegEncoder::V4L2M2M) {
+		encoder_ = std::make_unique<EncoderV4L2M2M>();
+
+		int ret = encoder_->configure(inCfg);
+		if (!ret)
+			return 0;
+
+		LOG(JPEG, Warning)
+			<< "V4L2 JPEG encoder unavailable, falling back to libjpeg";
+	}
+
 	encoder_ = std::make_unique<EncoderLibJpeg>();
 
 	return encoder_->configure(inCfg);
 }
 
+/* Set the Exif fields that are identical for all frames of the stream. */
+void PostProcessorJpeg::setStaticExif(Exif *exif) const
+{
+	exif->setMake(cameraDevice_->maker());
+	exif->setModel(cameraDevice_->model());
+	exif->setSize(streamSize_);
+	exif->setFlash(Exif::Flash::FlashNotPresent);
+	exif->setWhiteBalance(Exif::WhiteBalance::Auto);
+	exif->setFocalLength(1.0);
+}
+
+/*
+ * Serialise the Exif data once per stream, with placeholders for the per-frame
+ * fields. Frames that only need the fields supported by ExifTemplate are then
+ * patched in place, others fall back to generating the Exif data from scratch.
+ */
+void PostProcessorJpeg::createExifTemplates()
+{
+	for (auto [i, tmpl] : utils::enumerate(exifTemplates_)) {
+		Exif exif;
+		setStaticExif(&exif);
+		exif.setOrientation(0);
+		exif.setTimestamp(std::time(nullptr), 0ms);
+		exif.setExposureTime(0);
+		exif.setAperture(0.0);
+		exif.setISO(100);
+
+		if (tmpl.create(&exif, i == 1) < 0)
+			LOG(JPEG, Debug)
+				<< "Exif template " << i
+				<< " unavailable, generating Exif per frame";
+	}
+}
+
+/*
+ * Generate the Exif data for a frame, and return it in \a data. The data
+ * references either the patched template or exifData_, and is valid until the
+ * next call. Return 0 on success or a negative error code otherwise.
+ */
+int PostProcessorJpeg::generateExif(const ExifFields &fields,
+				    Span<const unsigned char> thumbnail,
+				    Span<const uint8_t> *data)
+{
+	ExifTemplate &tmpl = exifTemplates_[!thumbnail.empty()];
+
+	if (tmpl.isValid() && fields.aperture && !fields.gpsTimestamp &&
+	    !fields.gpsCoordinates && !fields.gpsMethod) {
+		tmpl.setOrientation(fields.orientation);
+		tmpl.setTimestamp(fields.timestamp);
+		tmpl.setExposureTime(fields.exposureTime);
+		tmpl.setAperture(*fields.aperture);
+		tmpl.setISO(fields.iso);
+		if (!thumbnail.empty())
+			tmpl.setThumbnail(thumbnail);
+
+		*data = tmpl.data();
+		return 0;
+	}
+
+	Exif exif;
+	setStaticExif(&exif);
+	exif.setOrientation(fields.orientation);
+	exif.setTimestamp(fields.timestamp, 0ms);
+	exif.setExposureTime(fields.exposureTime);
+	if (fields.aperture)
+		exif.setAperture(*fields.aperture);
+	exif.setISO(fields.iso);
+
+	if (fields.gpsTimestamp)
+		exif.setGPSDateTimestamp(*fields.gpsTimestamp);
+	if (fields.gpsCoordinates)
+		exif.setGPSLocation(fields.gpsCoordinates->data());
+	if (fields.gpsMethod)
+		exif.setGPSMethod(*fields.gpsMethod);
+
+	if (!thumbnail.empty())
+		exif.setThumbnail(thumbnail, Exif::Compression::JPEG);
+
+	int ret = exif.generate();
+	if (ret)
+		return ret;
+
+	exifData_.assign(exif.data().begin(), exif.data().end());
+	*data = exifData_;
+
+	return 0;
+}
+
 void PostProcessorJpeg::generateThumbnail(const FrameBuffer &source,
 					  const Size &targetSize,
 					  unsigned int quality,
@@ -112,46 +315,41 @@ void PostProcessorJpeg::process(Camera3RequestDescriptor::StreamBuffer *streamBu
 	camera_metadata_ro_entry_t entry;
 	int ret;
 
-	/* Set EXIF metadata for various tags. */
-	Exif exif;
-	exif.setMake(cameraDevice_->maker());
-	exif.setModel(cameraDevice_->model());
+	/* Collect the per-frame EXIF fields. */
+	ExifFields exifFields = {};
 
 	ret = requestMetadata.getEntry(ANDROID_JPEG_ORIENTATION, &entry);
 
 	const uint32_t jpegOrientation = ret ? *entry.data.i32 : 0;
 	resultMetadata->addEntry(ANDROID_JPEG_ORIENTATION, jpegOrientation);
-	exif.setOrientation(jpegOrientation);
+	exifFields.orientation = jpegOrientation;
 
-	exif.setSize(streamSize_);
 	/*
 	 * We set the frame's EXIF timestamp as the time of encode.
 	 * Since the precision we need for EXIF timestamp is only one
 	 * second, it is good enough.
 	 */
-	exif.setTimestamp(std::time(nullptr), 0ms);
+	exifFields.timestamp = std::time(nullptr);
 
 	ret = resultMetadata->getEntry(ANDROID_SENSOR_EXPOSURE_TIME, &entry);
-	exif.setExposureTime(ret ? *entry.data.i64 : 0);
+	exifFields.exposureTime = ret ? *entry.data.i64 : 0;
 	ret = requestMetadata.getEntry(ANDROID_LENS_APERTURE, &entry);
 	if (ret)
-		exif.setAperture(*entry.data.f);
+		exifFields.aperture = *entry.data.f;
 
 	ret = resultMetadata->getEntry(ANDROID_SENSOR_SENSITIVITY, &entry);
-	exif.setISO(ret ? *entry.data.i32 : 100);
-
-	exif.setFlash(Exif::Flash::FlashNotPresent);
-	exif.setWhiteBalance(Exif::WhiteBalance::Auto);
-
-	exif.setFocalLength(1.0);
+	exifFields.iso = ret ? *entry.data.i32 : 100;
 
 	ret = requestMetadata.getEntry(ANDROID_JPEG_GPS_TIMESTAMP, &entry);
 	if (ret) {
-		exif.setGPSDateTimestamp(*entry.data.i64);
+		exifFields.gpsTimestamp = *entry.data.i64;
 		resultMetadata->addEntry(ANDROID_JPEG_GPS_TIMESTAMP,
 					 *entry.data.i64);
 	}
 
+	std::vector<unsigned char> thumbnail;
+	std::thread thumbnailThread;
+
 	ret = requestMetadata.getEntry(ANDROID_JPEG_THUMBNAIL_SIZE, &entry);
 	if (ret) {
 		const int32_t *data = entry.data.i32;
@@ -162,40 +360,87 @@ void PostProcessorJpeg::process(Camera3RequestDescriptor::StreamBuffer *streamBu
 		uint8_t quality = ret ? *entry.data.u8 : 95;
 		resultMetadata->addEntry(ANDROID_JPEG_THUMBNAIL_QUALITY, quality);
 
-		if (thumbnailSize != Size(0, 0)) {
-			std::vector<unsigned char> thumbnail;
-			generateThumbnail(source, thumbnailSize, quality, &thumbnail);
-			if (!thumbnail.empty())
-				exif.setThumbnail(thumbnail, Exif::Compression::JPEG);
-		}
+		/*
+		 * Generate the thumbnail concurrently with the encoding of the
+		 * main image, the Exif data is inserted in the JPEG stream
+		 * afterwards.
+		 */
+		if (thumbnailSize != Size(0, 0))
+			thumbnailThread = std::thread(&PostProcessorJpeg::generateThumbnail,
+						      this, std::cref(source),
+						      thumbnailSize, quality,
+						      &thumbnail);
 
 		resultMetadata->addEntry(ANDROID_JPEG_THUMBNAIL_SIZE, data, 2);
 	}
 
 	ret = requestMetadata.getEntry(ANDROID_JPEG_GPS_COORDINATES, &entry);
 	if (ret) {
-		exif.setGPSLocation(entry.data.d);
+		exifFields.gpsCoordinates = { entry.data.d[0], entry.data.d[1],
+					      entry.data.d[2] };
 		resultMetadata->addEntry(ANDROID_JPEG_GPS_COORDINATES,
 					 entry.data.d, 3);
 	}
 
 	ret = requestMetadata.getEntry(ANDROID_JPEG_GPS_PROCESSING_METHOD, &entry);
 	if (ret) {
-		std::string method(entry.data.u8, entry.data.u8 + entry.count);
-		exif.setGPSMethod(method);
+		exifFields.gpsMethod = std::string(entry.data.u8,
+						   entry.data.u8 + entry.count);
 		resultMetadata->addEntry(ANDROID_JPEG_GPS_PROCESSING_METHOD,
 					 entry.data.u8, entry.count);
 	}
 
-	if (exif.generate() != 0)
-		LOG(JPEG, Error) << "Failed to generate valid EXIF data";
-
 	ret = requestMetadata.getEntry(ANDROID_JPEG_QUALITY, &entry);
 	const uint8_t quality = ret ? *entry.data.u8 : 95;
 	resultMetadata->addEntry(ANDROID_JPEG_QUALITY, quality);
 
-	int jpeg_size = encoder_->encode(source, destination->plane(0),
-					 exif.data(), quality);
+	const size_t maxJpegSize =
+		destination->jpegBufferSize(cameraDevice_->maxJpegBufferSize())
+		- sizeof(struct camera3_jpeg_blob);
+	Span<const uint8_t> exifData;
+	int jpeg_size;
+
+	if (thumbnailThread.joinable()) {
+		/*
+		 * Encode the main image after a gap sized from the Exif data of
+		 * the previous frames, to insert the Exif data without moving
+		 * the image.
+		 */
+		Span<uint8_t> output = destination->plane(0).subspan(0, maxJpegSize);
+		size_t reserve = std::min(exifReserve_, output.size());
+
+		jpeg_size = encoder_->encode(source, output.subspan(reserve),
+					     {}, quality);
+
+		thumbnailThread.join();
+
+		if (generateExif(exifFields, thumbnail, &exifData) != 0) {
+			LOG(JPEG, Error) << "Failed to generate valid EXIF data";
+			exifData = {};
+		}
+
+		if (jpeg_size >= 0)
+			jpeg_size = placeExif(output, reserve, jpeg_size, exifData);
+
+		/*
+		 * Leave a margin for the thumbnail size variations, within the
+		 * maximum APP1 segment size.
+		 */
+		if (!exifData.empty()) {
+			size_t segmentSize = exifData.size() + 4;
+			exifReserve_ = std::min<size_t>(segmentSize + segmentSize / 8 + 256,
+							0xffff + 2);
+		}
+	} else {
+		if (generateExif(exifFields, {}, &exifData) != 0) {
+			LOG(JPEG, Error) << "Failed to generate valid EXIF data";
+			exifData = {};
+		}
+
+		jpeg_size = encoder_->encode(source, destination->plane(0),
+					     exifData, quality);
+	}
+
 	if (jpeg_size < 0) {
 		LOG(JPEG, Error) << "Failed to encode stream image";
 		processComplete.emit(streamBuffer, PostProcessor::Status::Error);
@@ -203,9 +448,7 @@ void PostProcessorJpeg::process(Camera3RequestDescriptor::StreamBuffer *streamBu
 	}
 
 	/* Fill in the JPEG blob header. */
-	uint8_t *resultPtr = destination->plane(0).data()
-			   + destination->jpegBufferSize(cameraDevice_->maxJpegBufferSize())
-			   - sizeof(struct camera3_jpeg_blob);
+	uint8_t *resultPtr = destination->plane(0).data() + maxJpegSize;
 	auto *blob = reinterpret_cast<struct camera3_jpeg_blob *>(resultPtr);
 	blob->jpeg_blob_id = CAMERA3_JPEG_BLOB_ID;
 	blob->jpeg_size = jpeg_size;
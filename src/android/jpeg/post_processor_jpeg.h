@@ -9,8 +9,15 @@
 
 #include "../post_processor.h"
 #include "encoder_libjpeg.h"
+#include "exif.h"
 #include "thumbnailer.h"
 
+#include <array>
+#include <optional>
+#include <string>
+#include <time.h>
+#include <vector>
+
 #include <libcamera/geometry.h>
 
 class CameraDevice;
@@ -25,6 +32,24 @@ public:
 	void process(Camera3RequestDescriptor::StreamBuffer *streamBuffer) override;
 
 private:
+	/* Exif fields that vary from frame to frame. */
+	struct ExifFields {
+		time_t timestamp;
+		int orientation;
+		uint64_t exposureTime;
+		std::optional<float> aperture;
+		uint16_t iso;
+		std::optional<int64_t> gpsTimestamp;
+		std::optional<std::array<double, 3>> gpsCoordinates;
+		std::optional<std::string> gpsMethod;
+	};
+
+	void setStaticExif(Exif *exif) const;
+	void createExifTemplates();
+	int generateExif(const ExifFields &fields,
+			 libcamera::Span<const unsigned char> thumbnail,
+			 libcamera::Span<const uint8_t> *data);
+
 	void generateThumbnail(const libcamera::FrameBuffer &source,
 			       const libcamera::Size &targetSize,
 			       unsigned int quality,
@@ -35,4 +60,11 @@ private:
 	libcamera::Size streamSize_;
 	EncoderLibJpeg thumbnailEncoder_;
 	Thumbnailer thumbnailer_;
+
+	/* Templates without and with a thumbnail, indexed by thumbnail presence. */
+	std::array<ExifTemplate, 2> exifTemplates_;
+	std::vector<uint8_t> exifData_;
+
+	/* Estimated size of the APP1 segment, reserved before the image. */
+	size_t exifReserve_;
 };
@@ -7,10 +7,13 @@
 
 #include "thumbnailer.h"
 
+#include <libyuv/scale.h>
+
 #include <libcamera/base/log.h>
 
 #include <libcamera/formats.h>
 
+#include "libcamera/internal/formats.h"
 #include "libcamera/internal/mapped_framebuffer.h"
 
 using namespace libcamera;
@@ -62,35 +65,25 @@ void Thumbnailer::createThumbnail(const FrameBuffer &source,
 	ASSERT(frame.planes().size() == 2);
 	ASSERT(tw % 2 == 0 && th % 2 == 0);
 
-	/* Image scaling block implementing nearest-neighbour algorithm. */
-	unsigned char *src = frame.planes()[0].data();
-	unsigned char *srcC = frame.planes()[1].data();
-	unsigned char *srcCb, *srcCr;
-	unsigned char *dstY, *srcY;
+	const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat_);
 
 	size_t dstSize = (th * tw) + ((th / 2) * tw);
 	destination->resize(dstSize);
 	unsigned char *dst = destination->data();
 	unsigned char *dstC = dst + th * tw;
 
-	for (unsigned int y = 0; y < th; y += 2) {
-		unsigned int sourceY = (sh * y + th / 2) / th;
-
-		dstY = dst + y * tw;
-		srcY = src + sw * sourceY;
-		srcCb = srcC + (sourceY / 2) * sw + 0;
-		srcCr = srcC + (sourceY / 2) * sw + 1;
-
-		for (unsigned int x = 0; x < tw; x += 2) {
-			unsigned int sourceX = (sw * x + tw / 2) / tw;
-
-			dstY[x] = srcY[sourceX];
-			dstY[tw + x] = srcY[sw + sourceX];
-			dstY[x + 1] = srcY[sourceX + 1];
-			dstY[tw + x + 1] = srcY[sw + sourceX + 1];
-
-			dstC[(y / 2) * tw + x + 0] = srcCb[(sourceX / 2) * 2];
-			dstC[(y / 2) * tw + x + 1] = srcCr[(sourceX / 2) * 2];
-		}
+	/*
+	 * Downscale with a box filter, which averages all the source pixels
+	 * covered by each destination pixel and avoids the aliasing of
+	 * nearest-neighbour sampling. libyuv provides SIMD implementations
+	 * for the common architectures.
+	 */
+	int ret = libyuv::NV12Scale(frame.planes()[0].data(), info.stride(sw, 0),
+				    frame.planes()[1].data(), info.stride(sw, 1),
+				    sw, sh, dst, tw, dstC, tw, tw, th,
+				    libyuv::FilterMode::kFilterBox);
+	if (ret) {
+		LOG(Thumbnailer, Error) << "Failed NV12 scaling: " << ret;
+		destination->clear();
 	}
 }
@@ -0,0 +1,178 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * post_processor_pool.cpp - Pool of post-processing worker threads
+ */
+
+#include "post_processor_pool.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "post_processor.h"
+
+using namespace libcamera;
+
+/*
+ * \class PostProcessorPool
+ * \brief Run the post-processing of all the streams of a camera device
+ *
+ * The pool runs post-processing jobs from all the CameraStream instances of a
+ * CameraDevice on a shared set of worker threads, sized according to the
+ * number of CPUs.
+ *
+ * A PostProcessor isn't reentrant, its jobs are thus run one at a time and in
+ * order. Jobs of different post-processors run concurrently on any idle
+ * worker. A job is preferably left to the worker that ran the previous job of
+ * the same post-processor if that worker is idle, as some encoders bind
+ * resources to the thread that uses them, but is otherwise picked by the first
+ * available worker.
+ *
+ * High priority jobs, used for preview and video streams, are always picked
+ * before low priority jobs, used for still captures. The number of low
+ * priority jobs in flight is bounded to leave one worker available to high
+ * priority jobs, so that bursts of still captures don't starve the preview.
+ */
+
+PostProcessorPool::Worker::Worker(PostProcessorPool *pool, unsigned int index)
+	: pool_(pool), index_(index)
+{
+	setName("PostProcessor");
+}
+
+void PostProcessorPool::Worker::run()
+{
+	pool_->run(index_);
+}
+
+PostProcessorPool::PostProcessorPool()
+	: inFlight_(0), lowInFlight_(0), running_(true)
+{
+	unsigned int numWorkers = std::clamp(std::thread::hardware_concurrency(),
+					     kMinWorkers, kMaxWorkers);
+
+	maxLowInFlight_ = numWorkers - 1;
+	idle_.resize(numWorkers, false);
+
+	for (unsigned int i = 0; i < numWorkers; i++) {
+		workers_.push_back(std::make_unique<Worker>(this, i));
+		workers_.back()->start();
+	}
+}
+
+PostProcessorPool::~PostProcessorPool()
+{
+	{
+		MutexLocker locker(mutex_);
+		running_ = false;
+	}
+
+	cv_.notify_all();
+
+	for (std::unique_ptr<Worker> &worker : workers_)
+		worker->wait();
+}
+
+/*
+ * Queue the post-processing of \a streamBuffer by \a postProcessor. The
+ * completion is signalled through PostProcessor::processComplete, from one of
+ * the worker threads.
+ */
+void PostProcessorPool::queue(PostProcessor *postProcessor,
+			      Camera3RequestDescriptor::StreamBuffer *streamBuffer,
+			      Priority priority)
+{
+	{
+		MutexLocker locker(mutex_);
+		queues_[static_cast<unsigned int>(priority)].push_back(
+			{ postProcessor, streamBuffer, priority });
+	}
+
+	cv_.notify_all();
+}
+
+/*
+ * Drop all the pending jobs and wait for the jobs in flight to complete. This
+ * must be called before destroying the post-processors.
+ */
+void PostProcessorPool::cancel()
+{
+	MutexLocker locker(mutex_);
+
+	for (std::deque<Job> &queue : queues_)
+		queue.clear();
+
+	idleCv_.wait(locker, [&]() { return inFlight_ == 0; });
+
+	lastWorker_.clear();
+}
+
+bool PostProcessorPool::takeJob(unsigned int worker, Job *job)
+{
+	for (std::deque<Job> &queue : queues_) {
+		if (&queue == &queues_[static_cast<unsigned int>(Priority::Low)] &&
+		    lowInFlight_ >= maxLowInFlight_)
+			break;
+
+		for (auto iter = queue.begin(); iter != queue.end(); ++iter) {
+			PostProcessor *postProcessor = iter->postProcessor;
+
+			/* Keep the jobs of each post-processor serialized. */
+			if (busy_.count(postProcessor))
+				continue;
+
+			auto last = lastWorker_.find(postProcessor);
+			if (last != lastWorker_.end() && last->second != worker &&
+			    idle_[last->second])
+				continue;
+
+			*job = *iter;
+			queue.erase(iter);
+
+			busy_.insert(postProcessor);
+			lastWorker_[postProcessor] = worker;
+			inFlight_++;
+			if (job->priority == Priority::Low)
+				lowInFlight_++;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void PostProcessorPool::run(unsigned int worker)
+{
+	MutexLocker locker(mutex_);
+
+	while (1) {
+		Job job;
+
+		idle_[worker] = true;
+		cv_.wait(locker, [&]() {
+			return !running_ || takeJob(worker, &job);
+		});
+		idle_[worker] = false;
+
+		if (!running_)
+			break;
+
+		locker.unlock();
+		job.postProcessor->process(job.streamBuffer);
+		locker.lock();
+
+		busy_.erase(job.postProcessor);
+		inFlight_--;
+		if (job.priority == Priority::Low)
+			lowInFlight_--;
+
+		/*
+		 * Wake up all workers, as the next job of the post-processor
+		 * may now be picked, possibly along with a low priority job.
+		 */
+		cv_.notify_all();
+		idleCv_.notify_all();
+	}
+}
@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * post_processor_pool.h - Pool of post-processing worker threads
+ */
+
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include <libcamera/base/thread.h>
+
+#include "camera_request.h"
+
+class PostProcessor;
+
+class PostProcessorPool
+{
+public:
+	enum class Priority {
+		High,
+		Low,
+	};
+
+	PostProcessorPool();
+	~PostProcessorPool();
+
+	void queue(PostProcessor *postProcessor,
+		   Camera3RequestDescriptor::StreamBuffer *streamBuffer,
+		   Priority priority);
+	void cancel();
+
+private:
+	class Worker : public libcamera::Thread
+	{
+	public:
+		Worker(PostProcessorPool *pool, unsigned int index);
+
+	protected:
+		void run() override;
+
+	private:
+		PostProcessorPool *pool_;
+		unsigned int index_;
+	};
+
+	struct Job {
+		PostProcessor *postProcessor;
+		Camera3RequestDescriptor::StreamBuffer *streamBuffer;
+		Priority priority;
+	};
+
+	static constexpr unsigned int kMinWorkers = 2;
+	static constexpr unsigned int kMaxWorkers = 4;
+
+	bool takeJob(unsigned int worker, Job *job);
+	void run(unsigned int worker);
+
+	libcamera::Mutex mutex_;
+	std::condition_variable cv_;
+	std::condition_variable idleCv_;
+
+	std::array<std::deque<Job>, 2> queues_;
+	std::set<PostProcessor *> busy_;
+	std::map<PostProcessor *, unsigned int> lastWorker_;
+	std::vector<bool> idle_;
+	unsigned int inFlight_;
+	unsigned int lowInFlight_;
+	unsigned int maxLowInFlight_;
+	bool running_;
+
+	std::vector<std::unique_ptr<Worker>> workers_;
+};
@@ -7,6 +7,11 @@
 
 #include "post_processor_yuv.h"
 
+#include <utility>
+
+#include <libyuv/convert.h>
+#include <libyuv/convert_from.h>
+#include <libyuv/rotate.h>
 #include <libyuv/scale.h>
 
 #include <libcamera/base/log.h>
@@ -22,30 +27,100 @@ using namespace libcamera;
 
 LOG_DEFINE_CATEGORY(YUV)
 
+namespace {
+
+bool isSemiPlanar(const PixelFormat &format)
+{
+	return format == formats::NV12 || format == formats::NV21;
+}
+
+bool isPlanar(const PixelFormat &format)
+{
+	return format == formats::YUV420 || format == formats::YVU420;
+}
+
+/* Tell if the chroma components are stored in the V, U order. */
+bool isSwapped(const PixelFormat &format)
+{
+	return format == formats::NV21 || format == formats::YVU420;
+}
+
+} /* namespace */
+
+/*
+ * The post-processor crops the source to the aspect ratio of the destination,
+ * scales it, rotates it clockwise by \a rotation degrees and converts it to
+ * the destination format. Source images are stored in NV12 or NV21, and
+ * destination images in NV12, NV21, YUV420 or YVU420.
+ *
+ * Cropping is free, as it only offsets the source pointers. The other
+ * operations are performed in as few libyuv passes as possible:
+ *
+ * - Scaling without conversion or rotation is done in a single NV12Scale()
+ *   pass (the chroma order is irrelevant to scaling).
+ * - Conversion to a planar format, with or without rotation, is done by
+ *   NV12ToI420Rotate(), after scaling to an intermediate buffer if needed.
+ * - Swapping the chroma order without rotation is done by NV21ToNV12(), after
+ *   scaling to an intermediate buffer if needed.
+ * - Rotation to a semi-planar format goes through an intermediate I420 image,
+ *   as libyuv can't rotate semi-planar images to semi-planar images.
+ */
+PostProcessorYuv::PostProcessorYuv(unsigned int rotation)
+	: rotation_(rotation), sourceSwapped_(false),
+	  destinationSwapped_(false), destinationPlanar_(false)
+{
+}
+
 int PostProcessorYuv::configure(const StreamConfiguration &inCfg,
 				const StreamConfiguration &outCfg)
 {
-	if (inCfg.pixelFormat != outCfg.pixelFormat) {
+	if (!isSemiPlanar(inCfg.pixelFormat)) {
+		LOG(YUV, Error) << "Unsupported format " << inCfg.pixelFormat
+				<< " (only NV12 and NV21 are supported)";
+		return -EINVAL;
+	}
+
+	if (!isSemiPlanar(outCfg.pixelFormat) && !isPlanar(outCfg.pixelFormat)) {
 		LOG(YUV, Error) << "Pixel format conversion is not supported"
 				<< " (from " << inCfg.pixelFormat.toString()
 				<< " to " << outCfg.pixelFormat.toString() << ")";
 		return -EINVAL;
 	}
 
-	if (inCfg.size < outCfg.size) {
+	if (outCfg.size.width % 2 || outCfg.size.height % 2) {
+		LOG(YUV, Error) << "Odd destination sizes are not supported ("
+				<< outCfg.size.toString() << ")";
+		return -EINVAL;
+	}
+
+	if (rotation_ % 90 || rotation_ >= 360) {
+		LOG(YUV, Error) << "Unsupported rotation " << rotation_;
+		return -EINVAL;
+	}
+
+	/*
+	 * Up-scaling is refused when not rotating, but is unavoidable along
+	 * one axis when rotating by 90 or 270 degrees into a destination of
+	 * the same size as the source.
+	 */
+	if (rotation_ % 180 == 0 && inCfg.size < outCfg.size) {
 		LOG(YUV, Error) << "Up-scaling is not supported"
 				<< " (from " << inCfg.size.toString()
 				<< " to " << outCfg.size.toString() << ")";
 		return -EINVAL;
 	}
 
-	if (inCfg.pixelFormat != formats::NV12) {
-		LOG(YUV, Error) << "Unsupported format " << inCfg.pixelFormat
-				<< " (only NV12 is supported)";
-		return -EINVAL;
-	}
+	sourceSwapped_ = isSwapped(inCfg.pixelFormat);
+	destinationSwapped_ = isSwapped(outCfg.pixelFormat);
+	destinationPlanar_ = isPlanar(outCfg.pixelFormat);
 
 	calculateLengths(inCfg, outCfg);
+
+	LOG(YUV, Debug)
+		<< "Converting " << inCfg.toString() << " to "
+		<< outCfg.toString() << ", crop " << crop_.toString()
+		<< ", rotation " << rotation_;
+
 	return 0;
 }
 
@@ -66,20 +141,15 @@ void PostProcessorYuv::process(Camera3RequestDescriptor::StreamBuffer *streamBuf
 		return;
 	}
 
-	int ret = libyuv::NV12Scale(sourceMapped.planes()[0].data(),
-				    sourceStride_[0],
-				    sourceMapped.planes()[1].data(),
-				    sourceStride_[1],
-				    sourceSize_.width, sourceSize_.height,
-				    destination->plane(0).data(),
-				    destinationStride_[0],
-				    destination->plane(1).data(),
-				    destinationStride_[1],
-				    destinationSize_.width,
-				    destinationSize_.height,
-				    libyuv::FilterMode::kFilterBilinear);
+	/* Crop by offsetting the source pointers. */
+	const uint8_t *srcY = sourceMapped.planes()[0].data()
+			    + crop_.y * sourceStride_[0] + crop_.x;
+	const uint8_t *srcUV = sourceMapped.planes()[1].data()
+			     + crop_.y / 2 * sourceStride_[1] + crop_.x;
+
+	int ret = convert(srcY, srcUV, destination);
 	if (ret) {
-		LOG(YUV, Error) << "Failed NV12 scaling: " << ret;
+		LOG(YUV, Error) << "Failed YUV conversion: " << ret;
 		processComplete.emit(streamBuffer, PostProcessor::Status::Error);
 		return;
 	}
@@ -87,15 +157,112 @@ void PostProcessorYuv::process(Camera3RequestDescriptor::StreamBuffer *streamBuf
 	processComplete.emit(streamBuffer, PostProcessor::Status::Success);
 }
 
+int PostProcessorYuv::convert(const uint8_t *srcY, const uint8_t *srcUV,
+			      CameraBuffer *destination)
+{
+	const bool swap = sourceSwapped_ != destinationSwapped_;
+	const bool scale = crop_.size() != scaledSize_;
+	int ret;
+
+	uint8_t *dstY = destination->plane(0).data();
+	uint8_t *dstU = destination->plane(1).data();
+	uint8_t *dstV = destinationPlanar_ ? destination->plane(2).data() : nullptr;
+
+	/* Scale and copy in a single pass. */
+	if (!rotation_ && !destinationPlanar_ && !swap)
+		return libyuv::NV12Scale(srcY, sourceStride_[0],
+					 srcUV, sourceStride_[1],
+					 crop_.width, crop_.height,
+					 dstY, destinationStride_[0],
+					 dstU, destinationStride_[1],
+					 scaledSize_.width, scaledSize_.height,
+					 libyuv::FilterMode::kFilterBilinear);
+
+	int srcStrideY = sourceStride_[0];
+	int srcStrideUV = sourceStride_[1];
+
+	if (scale) {
+		uint8_t *scaledY = scaleBuffer_.data();
+		uint8_t *scaledUV = scaledY + scaledSize_.width * scaledSize_.height;
+
+		ret = libyuv::NV12Scale(srcY, srcStrideY, srcUV, srcStrideUV,
+					crop_.width, crop_.height,
+					scaledY, scaledSize_.width,
+					scaledUV, scaledSize_.width,
+					scaledSize_.width, scaledSize_.height,
+					libyuv::FilterMode::kFilterBilinear);
+		if (ret)
+			return ret;
+
+		srcY = scaledY;
+		srcUV = scaledUV;
+		srcStrideY = scaledSize_.width;
+		srcStrideUV = scaledSize_.width;
+	}
+
+	const libyuv::RotationMode mode =
+		static_cast<libyuv::RotationMode>(rotation_);
+
+	/* Deinterleave, and rotate if needed, in a single pass. */
+	if (destinationPlanar_) {
+		if (swap)
+			std::swap(dstU, dstV);
+
+		return libyuv::NV12ToI420Rotate(srcY, srcStrideY,
+						srcUV, srcStrideUV,
+						dstY, destinationStride_[0],
+						dstU, destinationStride_[1],
+						dstV, destinationStride_[2],
+						scaledSize_.width,
+						scaledSize_.height, mode);
+	}
+
+	/* Swap the chroma order without rotation. */
+	if (!rotation_)
+		return libyuv::NV21ToNV12(srcY, srcStrideY, srcUV, srcStrideUV,
+					  dstY, destinationStride_[0],
+					  dstU, destinationStride_[1],
+					  destinationSize_.width,
+					  destinationSize_.height);
+
+	/* Rotate to I420 and interleave the chroma planes back. */
+	const unsigned int chromaWidth = destinationSize_.width / 2;
+	const unsigned int chromaHeight = destinationSize_.height / 2;
+	uint8_t *rotatedY = rotateBuffer_.data();
+	uint8_t *rotatedU = rotatedY + destinationSize_.width * destinationSize_.height;
+	uint8_t *rotatedV = rotatedU + chromaWidth * chromaHeight;
+
+	ret = libyuv::NV12ToI420Rotate(srcY, srcStrideY, srcUV, srcStrideUV,
+				       rotatedY, destinationSize_.width,
+				       rotatedU, chromaWidth,
+				       rotatedV, chromaWidth,
+				       scaledSize_.width, scaledSize_.height,
+				       mode);
+	if (ret)
+		return ret;
+
+	if (swap)
+		std::swap(rotatedU, rotatedV);
+
+	return libyuv::I420ToNV12(rotatedY, destinationSize_.width,
+				  rotatedU, chromaWidth,
+				  rotatedV, chromaWidth,
+				  dstY, destinationStride_[0],
+				  dstU, destinationStride_[1],
+				  destinationSize_.width, destinationSize_.height);
+}
+
 bool PostProcessorYuv::isValidBuffers(const FrameBuffer &source,
 				      const CameraBuffer &destination) const
 {
+	const unsigned int destinationPlanes = destinationPlanar_ ? 3 : 2;
+
 	if (source.planes().size() != 2) {
 		LOG(YUV, Error) << "Invalid number of source planes: "
 				<< source.planes().size();
 		return false;
 	}
-	if (destination.numPlanes() != 2) {
+	if (destination.numPlanes() != destinationPlanes) {
 		LOG(YUV, Error) << "Invalid number of destination planes: "
 				<< destination.numPlanes();
 		return false;
@@ -112,15 +279,16 @@ bool PostProcessorYuv::isValidBuffers(const FrameBuffer &source,
 			<< sourceLength_[1] << "}";
 		return false;
 	}
-	if (destination.plane(0).size() < destinationLength_[0] ||
-	    destination.plane(1).size() < destinationLength_[1]) {
+
+	for (unsigned int i = 0; i < destinationPlanes; i++) {
+		if (destination.plane(i).size() >= destinationLength_[i])
+			continue;
+
 		LOG(YUV, Error)
-			<< "The destination planes lengths are too small, actual size: {"
-			<< destination.plane(0).size() << ", "
-			<< destination.plane(1).size()
-			<< "}, expected size: {"
-			<< sourceLength_[0] << ", "
-			<< sourceLength_[1] << "}";
+			<< "The destination plane " << i
+			<< " length is too small, actual size: "
+			<< destination.plane(i).size()
+			<< ", expected size: " << destinationLength_[i];
 		return false;
 	}
 
@@ -133,14 +301,46 @@ void PostProcessorYuv::calculateLengths(const StreamConfiguration &inCfg,
 	sourceSize_ = inCfg.size;
 	destinationSize_ = outCfg.size;
 
-	const PixelFormatInfo &nv12Info = PixelFormatInfo::info(formats::NV12);
+	/* The destination is rotated after scaling. */
+	scaledSize_ = rotation_ % 180
+		    ? Size(destinationSize_.height, destinationSize_.width)
+		    : destinationSize_;
+
+	/*
+	 * Crop the largest centered region of the source with the aspect
+	 * ratio of the scaled image, aligned to the chroma subsampling.
+	 */
+	Size cropSize = sourceSize_.boundedToAspectRatio(scaledSize_)
+				   .alignedDownTo(2, 2);
+	crop_ = cropSize.centeredTo(Rectangle(sourceSize_).center());
+	crop_.x &= ~1;
+	crop_.y &= ~1;
+
+	const PixelFormatInfo &inInfo = PixelFormatInfo::info(inCfg.pixelFormat);
 	for (unsigned int i = 0; i < 2; i++) {
 		sourceStride_[i] = inCfg.stride;
-		destinationStride_[i] = nv12Info.stride(destinationSize_.width, i, 1);
+		sourceLength_[i] = inInfo.planeSize(sourceSize_.height, i,
+						    sourceStride_[i]);
+	}
 
-		sourceLength_[i] = nv12Info.planeSize(sourceSize_.height, i,
-						      sourceStride_[i]);
-		destinationLength_[i] = nv12Info.planeSize(destinationSize_.height, i,
-							   destinationStride_[i]);
+	const PixelFormatInfo &outInfo = PixelFormatInfo::info(outCfg.pixelFormat);
+	for (unsigned int i = 0; i < outInfo.numPlanes(); i++) {
+		destinationStride_[i] = outInfo.stride(destinationSize_.width, i, 1);
+		destinationLength_[i] = outInfo.planeSize(destinationSize_.height, i,
+							  destinationStride_[i]);
 	}
+
+	const PixelFormatInfo &nv12Info = PixelFormatInfo::info(formats::NV12);
+	const PixelFormatInfo &i420Info = PixelFormatInfo::info(formats::YUV420);
+	const bool swap = sourceSwapped_ != destinationSwapped_;
+
+	scaleBuffer_.clear();
+	rotateBuffer_.clear();
+
+	if (crop_.size() != scaledSize_ &&
+	    (rotation_ || destinationPlanar_ || swap))
+		scaleBuffer_.resize(nv12Info.frameSize(scaledSize_, 1));
+
+	if (rotation_ && !destinationPlanar_)
+		rotateBuffer_.resize(i420Info.frameSize(destinationSize_, 1));
 }
@@ -9,12 +9,15 @@
 
 #include "../post_processor.h"
 
+#include <stdint.h>
+#include <vector>
+
 #include <libcamera/geometry.h>
 
 class PostProcessorYuv : public PostProcessor
 {
 public:
-	PostProcessorYuv() = default;
+	PostProcessorYuv(unsigned int rotation = 0);
 
 	int configure(const libcamera::StreamConfiguration &incfg,
 		      const libcamera::StreamConfiguration &outcfg) override;
@@ -25,11 +28,27 @@ private:
 			    const CameraBuffer &destination) const;
 	void calculateLengths(const libcamera::StreamConfiguration &inCfg,
 			      const libcamera::StreamConfiguration &outCfg);
+	int convert(const uint8_t *srcY, const uint8_t *srcUV,
+		    CameraBuffer *destination);
+
+	/* Clockwise rotation, in degrees. */
+	const unsigned int rotation_;
+
+	bool sourceSwapped_;
+	bool destinationSwapped_;
+	bool destinationPlanar_;
 
 	libcamera::Size sourceSize_;
+	libcamera::Rectangle crop_;
+	libcamera::Size scaledSize_;
 	libcamera::Size destinationSize_;
 	unsigned int sourceLength_[2] = {};
-	unsigned int destinationLength_[2] = {};
+	unsigned int destinationLength_[3] = {};
 	unsigned int sourceStride_[2] = {};
-	unsigned int destinationStride_[2] = {};
+	unsigned int destinationStride_[3] = {};
+
+	/* Intermediate NV12 image, at the scaled size. */
+	std::vector<uint8_t> scaleBuffer_;
+	/* Intermediate I420 image, at the destination size. */
+	std::vector<uint8_t> rotateBuffer_;
 };
@@ -0,0 +1,431 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * broker_client.cpp - Camera broker client
+ */
+
+#include "broker_client.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/object.h>
+#include <libcamera/base/thread.h>
+
+#include "broker_protocol.h"
+
+/**
+ * \file broker_client.h
+ * \brief Client of the camera broker daemon
+ */
+
+namespace libcamera {
+
+using namespace broker;
+
+LOG_DEFINE_CATEGORY(BrokerClient)
+
+class BrokerClient::Private : public Object
+{
+public:
+	enum class State {
+		Disconnected,
+		Connecting,
+		Connected,
+	};
+
+	Private(BrokerClient *client);
+
+	void bind(int fd);
+	void send(const IPCUnixSocket::Payload &payload);
+	void close();
+	void setState(State state);
+
+	BrokerClient *client_;
+	Thread thread_;
+	IPCUnixSocket socket_;
+
+	Mutex mutex_;
+	std::condition_variable cv_;
+	State state_;
+
+	StreamConfiguration config_;
+	unsigned int bufferCount_;
+	std::vector<std::unique_ptr<FrameBuffer>> buffers_;
+
+private:
+	void readyRead();
+	void hangup();
+
+	void streamInfo(const IPCUnixSocket::Payload &payload);
+	void bufferInfo(IPCUnixSocket::Payload &payload);
+	void frameReady(const IPCUnixSocket::Payload &payload);
+};
+
+BrokerClient::Private::Private(BrokerClient *client)
+	: client_(client), state_(State::Disconnected), bufferCount_(0)
+{
+	thread_.setName("BrokerClient");
+	moveToThread(&thread_);
+
+	socket_.readyRead.connect(this, &Private::readyRead);
+	socket_.disconnected.connect(this, &Private::hangup);
+}
+
+void BrokerClient::Private::bind(int fd)
+{
+	socket_.bind(fd);
+}
+
+void BrokerClient::Private::send(const IPCUnixSocket::Payload &payload)
+{
+	int ret = socket_.send(payload);
+	if (ret < 0)
+		LOG(BrokerClient, Error)
+			<< "Failed to send message: " << strerror(-ret);
+}
+
+void BrokerClient::Private::close()
+{
+	socket_.close();
+}
+
+void BrokerClient::Private::setState(State state)
+{
+	{
+		MutexLocker locker(mutex_);
+		state_ = state;
+	}
+
+	cv_.notify_all();
+}
+
+void BrokerClient::Private::readyRead()
+{
+	IPCUnixSocket::Payload payload;
+	int ret = socket_.receive(&payload);
+	if (ret < 0) {
+		LOG(BrokerClient, Error)
+			<< "Failed to receive message: " << strerror(-ret);
+		return;
+	}
+
+	MessageType type;
+	if (!messageType(payload, &type)) {
+		LOG(BrokerClient, Error) << "Invalid message";
+		return;
+	}
+
+	switch (type) {
+	case MessageType::StreamInfo:
+		streamInfo(payload);
+		break;
+
+	case MessageType::BufferInfo:
+		bufferInfo(payload);
+		break;
+
+	case MessageType::FrameReady:
+		frameReady(payload);
+		break;
+
+	default:
+		LOG(BrokerClient, Error) << "Unexpected message type "
+					 << static_cast<uint32_t>(type);
+		break;
+	}
+}
+
+void BrokerClient::Private::hangup()
+{
+	LOG(BrokerClient, Info) << "Broker disconnected";
+
+	setState(State::Disconnected);
+	client_->disconnected.emit();
+}
+
+void BrokerClient::Private::streamInfo(const IPCUnixSocket::Payload &payload)
+{
+	StreamInfoMessage info;
+	if (!deserialize(payload, &info)) {
+		LOG(BrokerClient, Error) << "Invalid stream information";
+		return;
+	}
+
+	config_.pixelFormat = PixelFormat(info.pixelFormat, info.modifier);
+	config_.size = Size(info.width, info.height);
+	config_.stride = info.stride;
+	config_.frameSize = info.frameSize;
+	config_.bufferCount = info.bufferCount;
+
+	bufferCount_ = info.bufferCount;
+	buffers_.clear();
+}
+
+void BrokerClient::Private::bufferInfo(IPCUnixSocket::Payload &payload)
+{
+	BufferInfoMessage info;
+	if (!deserialize(payload, &info) || info.index != buffers_.size() ||
+	    info.numPlanes > kMaxPlanes || info.numPlanes != payload.fds.size()) {
+		LOG(BrokerClient, Error) << "Invalid buffer information";
+		for (int32_t fd : payload.fds)
+			::close(fd);
+		return;
+	}
+
+	std::vector<FrameBuffer::Plane> planes(info.numPlanes);
+	for (unsigned int i = 0; i < info.numPlanes; ++i) {
+		planes[i].fd = FileDescriptor(std::move(payload.fds[i]));
+		planes[i].offset = info.planes[i].offset;
+		planes[i].length = info.planes[i].length;
+	}
+
+	buffers_.push_back(std::make_unique<FrameBuffer>(planes, info.index));
+
+	if (buffers_.size() == bufferCount_)
+		setState(State::Connected);
+}
+
+void BrokerClient::Private::frameReady(const IPCUnixSocket::Payload &payload)
+{
+	FrameReadyMessage message;
+	if (!deserialize(payload, &message) || message.index >= buffers_.size()) {
+		LOG(BrokerClient, Error) << "Invalid frame";
+		return;
+	}
+
+	FrameBuffer *buffer = buffers_[message.index].get();
+
+	BrokerClient::Frame frame;
+	frame.buffer = buffer;
+	frame.status = static_cast<FrameMetadata::Status>(message.status);
+	frame.sequence = message.sequence;
+	frame.timestamp = message.timestamp;
+	frame.bytesused.assign(message.bytesused,
+			       message.bytesused + buffer->planes().size());
+
+	client_->frameReady.emit(frame);
+}
+
+/**
+ * \class BrokerClient
+ * \brief Receive frames from a camera owned by the camera broker daemon
+ *
+ * The camera broker daemon owns a camera and distributes its frames to
+ * multiple processes without copies. The BrokerClient connects to the daemon
+ * and exposes the stream configuration and the shared buffers, in a way
+ * similar to the Camera class.
+ *
+ * Frames are signalled through the frameReady signal after start() has been
+ * called. The buffers are shared with all other clients and must only be
+ * mapped for reading. Every frame shall be returned with releaseFrame() as
+ * soon as possible, as the daemon stops sending frames to clients that hold
+ * too many of them, and only requeues a buffer to the camera once all clients
+ * have released it.
+ *
+ * The frameReady and disconnected signals are emitted from an internal
+ * thread. Their slots shall not call disconnect().
+ */
+
+/**
+ * \struct BrokerClient::Frame
+ * \brief A frame received from the broker
+ *
+ * \var BrokerClient::Frame::buffer
+ * \brief The buffer containing the frame
+ *
+ * \var BrokerClient::Frame::status
+ * \brief Status of the frame
+ *
+ * \var BrokerClient::Frame::sequence
+ * \brief Frame sequence number
+ *
+ * \var BrokerClient::Frame::timestamp
+ * \brief Time when the frame was captured, in nanoseconds
+ *
+ * \var BrokerClient::Frame::bytesused
+ * \brief Number of bytes used in each plane of the buffer
+ */
+
+BrokerClient::BrokerClient()
+	: d_(std::make_unique<Private>(this))
+{
+}
+
+BrokerClient::~BrokerClient()
+{
+	disconnect();
+}
+
+/**
+ * \brief Connect to the broker daemon
+ * \param[in] path The path of the broker socket
+ *
+ * Connect to the daemon and wait until the stream configuration and all
+ * buffers have been received.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int BrokerClient::connect(const std::string &path)
+{
+	static constexpr std::chrono::seconds kTimeout{ 5 };
+	int ret;
+
+	if (d_->thread_.isRunning())
+		return -EBUSY;
+
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	strcpy(addr.sun_path, path.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (::connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+		      sizeof(addr)) < 0) {
+		ret = -errno;
+		LOG(BrokerClient, Error)
+			<< "Failed to connect to " << path << ": " << strerror(-ret);
+		::close(fd);
+		return ret;
+	}
+
+	d_->setState(Private::State::Connecting);
+
+	d_->thread_.start();
+	d_->invokeMethod(&Private::bind, ConnectionTypeBlocking, fd);
+
+	bool connected;
+	{
+		MutexLocker locker(d_->mutex_);
+		connected = d_->cv_.wait_for(locker, kTimeout, [&] {
+			return d_->state_ != Private::State::Connecting;
+		});
+		connected = connected && d_->state_ == Private::State::Connected;
+	}
+
+	if (!connected) {
+		LOG(BrokerClient, Error) << "Failed to receive stream information";
+		disconnect();
+		return -ETIMEDOUT;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Disconnect from the broker daemon
+ *
+ * All frames held by the client are implicitly released, and the buffers
+ * become invalid.
+ */
+void BrokerClient::disconnect()
+{
+	if (!d_->thread_.isRunning())
+		return;
+
+	d_->invokeMethod(&Private::close, ConnectionTypeBlocking);
+	d_->thread_.exit();
+	d_->thread_.wait();
+
+	d_->setState(Private::State::Disconnected);
+	d_->buffers_.clear();
+}
+
+/**
+ * \brief Retrieve the configuration of the stream distributed by the broker
+ * \return The stream configuration
+ */
+const StreamConfiguration &BrokerClient::configuration() const
+{
+	return d_->config_;
+}
+
+/**
+ * \brief Retrieve the buffers shared by the broker
+ *
+ * The buffers are valid until the client disconnects.
+ *
+ * \return The shared buffers
+ */
+const std::vector<std::unique_ptr<FrameBuffer>> &BrokerClient::buffers() const
+{
+	return d_->buffers_;
+}
+
+/**
+ * \brief Start receiving frames
+ * \return 0 on success or a negative error code otherwise
+ */
+int BrokerClient::start()
+{
+	if (!d_->thread_.isRunning())
+		return -ENOTCONN;
+
+	ControlMessage message = { MessageType::Start };
+	d_->invokeMethod(&Private::send, ConnectionTypeQueued, serialize(message));
+
+	return 0;
+}
+
+/**
+ * \brief Stop receiving frames
+ *
+ * All frames held by the client are implicitly released.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int BrokerClient::stop()
+{
+	if (!d_->thread_.isRunning())
+		return -ENOTCONN;
+
+	ControlMessage message = { MessageType::Stop };
+	d_->invokeMethod(&Private::send, ConnectionTypeQueued, serialize(message));
+
+	return 0;
+}
+
+/**
+ * \brief Return a frame to the broker
+ * \param[in] buffer The buffer of the frame
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int BrokerClient::releaseFrame(FrameBuffer *buffer)
+{
+	if (!d_->thread_.isRunning())
+		return -ENOTCONN;
+
+	if (buffer->cookie() >= d_->buffers_.size() ||
+	    d_->buffers_[buffer->cookie()].get() != buffer)
+		return -EINVAL;
+
+	ReleaseFrameMessage message = { MessageType::ReleaseFrame,
+					static_cast<uint32_t>(buffer->cookie()) };
+	d_->invokeMethod(&Private::send, ConnectionTypeQueued, serialize(message));
+
+	return 0;
+}
+
+/**
+ * \var BrokerClient::frameReady
+ * \brief Signal emitted when a frame is received
+ */
+
+/**
+ * \var BrokerClient::disconnected
+ * \brief Signal emitted when the broker closes the connection
+ */
+
+} /* namespace libcamera */
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * broker_client.h - Camera broker client
+ */
+
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/signal.h>
+
+#include <libcamera/framebuffer.h>
+#include <libcamera/stream.h>
+
+namespace libcamera {
+
+class BrokerClient
+{
+public:
+	struct Frame {
+		FrameBuffer *buffer;
+		FrameMetadata::Status status;
+		unsigned int sequence;
+		uint64_t timestamp;
+		std::vector<unsigned int> bytesused;
+	};
+
+	BrokerClient();
+	~BrokerClient();
+
+	int connect(const std::string &path);
+	void disconnect();
+
+	const StreamConfiguration &configuration() const;
+	const std::vector<std::unique_ptr<FrameBuffer>> &buffers() const;
+
+	int start();
+	int stop();
+	int releaseFrame(FrameBuffer *buffer);
+
+	Signal<const Frame &> frameReady;
+	Signal<> disconnected;
+
+private:
+	class Private;
+	std::unique_ptr<Private> d_;
+};
+
+} /* namespace libcamera */
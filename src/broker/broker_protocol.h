@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * broker_protocol.h - Camera broker IPC protocol
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+#include "libcamera/internal/ipc_unixsocket.h"
+
+namespace libcamera {
+
+namespace broker {
+
+/*
+ * The broker daemon and its clients communicate through a SOCK_SEQPACKET Unix
+ * socket. Every message is a fixed-size structure starting with its type,
+ * optionally followed by file descriptors.
+ *
+ * On connection, the daemon sends a StreamInfo message followed by one
+ * BufferInfo message per buffer, carrying one dmabuf file descriptor per
+ * plane. Clients then send Start to receive FrameReady messages, and return
+ * every received frame with a ReleaseFrame message once done with it. Buffers
+ * are shared with all clients and must only be read.
+ */
+
+static constexpr unsigned int kMaxPlanes = 4;
+
+enum class MessageType : uint32_t {
+	StreamInfo,
+	BufferInfo,
+	Start,
+	Stop,
+	FrameReady,
+	ReleaseFrame,
+};
+
+struct StreamInfoMessage {
+	MessageType type;
+	uint32_t pixelFormat;
+	uint64_t modifier;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t frameSize;
+	uint32_t bufferCount;
+};
+
+struct BufferInfoMessage {
+	MessageType type;
+	uint32_t index;
+	uint32_t numPlanes;
+	struct {
+		uint32_t offset;
+		uint32_t length;
+	} planes[kMaxPlanes];
+};
+
+struct ControlMessage {
+	MessageType type;
+};
+
+struct FrameReadyMessage {
+	MessageType type;
+	uint32_t index;
+	uint32_t status;
+	uint32_t sequence;
+	uint64_t timestamp;
+	uint32_t bytesused[kMaxPlanes];
+};
+
+struct ReleaseFrameMessage {
+	MessageType type;
+	uint32_t index;
+};
+
+template<typename T>
+IPCUnixSocket::Payload serialize(const T &message)
+{
+	static_assert(std::is_trivially_copyable_v<T>);
+
+	IPCUnixSocket::Payload payload;
+	payload.data.resize(sizeof(message));
+	memcpy(payload.data.data(), &message, sizeof(message));
+
+	return payload;
+}
+
+template<typename T>
+bool deserialize(const IPCUnixSocket::Payload &payload, T *message)
+{
+	static_assert(std::is_trivially_copyable_v<T>);
+
+	if (payload.data.size() != sizeof(*message))
+		return false;
+
+	memcpy(message, payload.data.data(), sizeof(*message));
+
+	return true;
+}
+
+static inline bool messageType(const IPCUnixSocket::Payload &payload,
+			       MessageType *type)
+{
+	if (payload.data.size() < sizeof(*type))
+		return false;
+
+	memcpy(type, payload.data.data(), sizeof(*type));
+
+	return true;
+}
+
+} /* namespace broker */
+
+} /* namespace libcamera */
@@ -0,0 +1,382 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera_broker.cpp - Distribute frames of a camera to multiple processes
+ */
+
+#include "camera_broker.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <libcamera/base/event_notifier.h>
+#include <libcamera/base/log.h>
+
+#include "broker_protocol.h"
+
+using namespace libcamera;
+using namespace libcamera::broker;
+
+LOG_DEFINE_CATEGORY(Broker)
+
+CameraBroker::CameraBroker(std::shared_ptr<Camera> camera)
+	: camera_(camera), stream_(nullptr), listenFd_(-1), notifier_(nullptr),
+	  running_(false)
+{
+}
+
+CameraBroker::~CameraBroker()
+{
+	stop();
+}
+
+int CameraBroker::start(const std::string &path, StreamRole role,
+			const Size &size)
+{
+	int ret;
+
+	config_ = camera_->generateConfiguration({ role });
+	if (!config_ || config_->size() != 1) {
+		LOG(Broker, Error) << "Failed to generate configuration";
+		return -EINVAL;
+	}
+
+	StreamConfiguration &cfg = config_->at(0);
+	if (!size.isNull())
+		cfg.size = size;
+
+	if (config_->validate() == CameraConfiguration::Invalid) {
+		LOG(Broker, Error) << "Invalid configuration " << cfg.toString();
+		return -EINVAL;
+	}
+
+	ret = camera_->configure(config_.get());
+	if (ret < 0) {
+		LOG(Broker, Error) << "Failed to configure camera";
+		return ret;
+	}
+
+	stream_ = cfg.stream();
+
+	allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
+	ret = allocator_->allocate(stream_);
+	if (ret < 0) {
+		LOG(Broker, Error) << "Failed to allocate buffers";
+		return ret;
+	}
+
+	const std::vector<std::unique_ptr<FrameBuffer>> &buffers =
+		allocator_->buffers(stream_);
+
+	for (unsigned int i = 0; i < buffers.size(); ++i) {
+		if (buffers[i]->planes().size() > kMaxPlanes) {
+			LOG(Broker, Error) << "Too many planes";
+			return -EINVAL;
+		}
+
+		std::unique_ptr<Request> request = camera_->createRequest(i);
+		if (!request)
+			return -ENOMEM;
+
+		ret = request->addBuffer(stream_, buffers[i].get());
+		if (ret < 0)
+			return ret;
+
+		requests_.push_back(std::move(request));
+	}
+
+	refcounts_.assign(requests_.size(), 0);
+
+	/* Create the socket clients connect to. */
+	listenFd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listenFd_ < 0) {
+		ret = -errno;
+		LOG(Broker, Error) << "Failed to create socket: " << strerror(-ret);
+		return ret;
+	}
+
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		LOG(Broker, Error) << "Socket path too long";
+		return -ENAMETOOLONG;
+	}
+	strcpy(addr.sun_path, path.c_str());
+
+	unlink(path.c_str());
+
+	if (bind(listenFd_, reinterpret_cast<struct sockaddr *>(&addr),
+		 sizeof(addr)) < 0 ||
+	    listen(listenFd_, 8) < 0) {
+		ret = -errno;
+		LOG(Broker, Error)
+			<< "Failed to listen on " << path << ": " << strerror(-ret);
+		return ret;
+	}
+
+	path_ = path;
+
+	notifier_ = new EventNotifier(listenFd_, EventNotifier::Read, this);
+	notifier_->activated.connect(this, &CameraBroker::acceptSession);
+
+	camera_->requestCompleted.connect(this, &CameraBroker::requestComplete);
+
+	ret = camera_->start();
+	if (ret < 0) {
+		LOG(Broker, Error) << "Failed to start camera";
+		return ret;
+	}
+
+	running_ = true;
+
+	for (std::unique_ptr<Request> &request : requests_) {
+		ret = camera_->queueRequest(request.get());
+		if (ret < 0) {
+			LOG(Broker, Error) << "Failed to queue request";
+			return ret;
+		}
+	}
+
+	LOG(Broker, Info)
+		<< "Streaming " << cfg.toString() << " from " << camera_->id()
+		<< " on " << path_;
+
+	return 0;
+}
+
+void CameraBroker::stop()
+{
+	if (running_) {
+		camera_->stop();
+		running_ = false;
+	}
+
+	camera_->requestCompleted.disconnect(this);
+
+	for (Session *session : sessions_)
+		delete session;
+	sessions_.clear();
+
+	delete notifier_;
+	notifier_ = nullptr;
+
+	if (listenFd_ != -1) {
+		::close(listenFd_);
+		listenFd_ = -1;
+		unlink(path_.c_str());
+	}
+
+	requests_.clear();
+	refcounts_.clear();
+	allocator_.reset();
+}
+
+void CameraBroker::acceptSession()
+{
+	int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		LOG(Broker, Error) << "Failed to accept client: " << strerror(errno);
+		return;
+	}
+
+	Session *session = new Session();
+	session->socket_.bind(fd);
+	session->socket_.readyRead.connect(this, [this, session]() {
+		sessionReady(session);
+	});
+	session->socket_.disconnected.connect(this, [this, session]() {
+		closeSession(session);
+	});
+
+	if (setupSession(session) < 0) {
+		delete session;
+		return;
+	}
+
+	sessions_.push_back(session);
+
+	LOG(Broker, Debug) << sessions_.size() << " clients connected";
+}
+
+int CameraBroker::setupSession(Session *session)
+{
+	const StreamConfiguration &cfg = stream_->configuration();
+
+	StreamInfoMessage info = {};
+	info.type = MessageType::StreamInfo;
+	info.pixelFormat = cfg.pixelFormat.fourcc();
+	info.modifier = cfg.pixelFormat.modifier();
+	info.width = cfg.size.width;
+	info.height = cfg.size.height;
+	info.stride = cfg.stride;
+	info.frameSize = cfg.frameSize;
+	info.bufferCount = requests_.size();
+
+	int ret = session->socket_.send(serialize(info));
+	if (ret < 0)
+		return ret;
+
+	/*
+	 * Share all buffers upfront, clients then identify frames by buffer
+	 * index only.
+	 */
+	for (const std::unique_ptr<Request> &request : requests_) {
+		FrameBuffer *buffer = request->buffers().begin()->second;
+
+		BufferInfoMessage bufferInfo = {};
+		bufferInfo.type = MessageType::BufferInfo;
+		bufferInfo.index = request->cookie();
+		bufferInfo.numPlanes = buffer->planes().size();
+
+		std::vector<int32_t> fds;
+		for (unsigned int i = 0; i < buffer->planes().size(); ++i) {
+			const FrameBuffer::Plane &plane = buffer->planes()[i];
+			bufferInfo.planes[i].offset = plane.offset;
+			bufferInfo.planes[i].length = plane.length;
+			fds.push_back(plane.fd.fd());
+		}
+
+		IPCUnixSocket::Payload payload = serialize(bufferInfo);
+		payload.fds = std::move(fds);
+
+		ret = session->socket_.send(payload);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+void CameraBroker::sessionReady(Session *session)
+{
+	IPCUnixSocket::Payload payload;
+	int ret = session->socket_.receive(&payload);
+	if (ret < 0) {
+		LOG(Broker, Error) << "Failed to receive message: " << strerror(-ret);
+		return;
+	}
+
+	MessageType type;
+	if (!messageType(payload, &type)) {
+		LOG(Broker, Error) << "Invalid message";
+		return;
+	}
+
+	switch (type) {
+	case MessageType::Start:
+		session->streaming_ = true;
+		break;
+
+	case MessageType::Stop:
+		session->streaming_ = false;
+
+		/* Frames held by a stopped client are implicitly released. */
+		releaseFrames(session);
+		break;
+
+	case MessageType::ReleaseFrame: {
+		ReleaseFrameMessage release;
+		if (!deserialize(payload, &release)) {
+			LOG(Broker, Error) << "Invalid release message";
+			break;
+		}
+
+		releaseFrame(session, release.index);
+		break;
+	}
+
+	default:
+		LOG(Broker, Error) << "Unexpected message type "
+				   << static_cast<uint32_t>(type);
+		break;
+	}
+}
+
+void CameraBroker::closeSession(Session *session)
+{
+	sessions_.remove(session);
+	releaseFrames(session);
+
+	LOG(Broker, Debug)
+		<< "Client disconnected, " << session->dropped_
+		<< " frames dropped, " << sessions_.size() << " clients remaining";
+
+	/* The session socket is still in use by the caller, delete later. */
+	session->deleteLater();
+}
+
+void CameraBroker::requestComplete(Request *request)
+{
+	if (request->status() == Request::RequestCancelled)
+		return;
+
+	unsigned int index = request->cookie();
+	FrameBuffer *buffer = request->buffers().begin()->second;
+	const FrameMetadata &metadata = buffer->metadata();
+
+	FrameReadyMessage frame = {};
+	frame.type = MessageType::FrameReady;
+	frame.index = index;
+	frame.status = metadata.status;
+	frame.sequence = metadata.sequence;
+	frame.timestamp = metadata.timestamp;
+	for (unsigned int i = 0; i < metadata.planes().size() && i < kMaxPlanes; ++i)
+		frame.bytesused[i] = metadata.planes()[i].bytesused;
+
+	IPCUnixSocket::Payload payload = serialize(frame);
+
+	/*
+	 * Send the frame to all streaming clients, the buffer is requeued to
+	 * the camera when the last of them releases it.
+	 */
+	for (Session *session : sessions_) {
+		if (!session->streaming_)
+			continue;
+
+		if (session->frames_.size() >= kMaxHeldFrames) {
+			session->dropped_++;
+			continue;
+		}
+
+		if (session->socket_.send(payload) < 0)
+			continue;
+
+		session->frames_.insert(index);
+		refcounts_[index]++;
+	}
+
+	if (!refcounts_[index])
+		queueRequest(index);
+}
+
+void CameraBroker::releaseFrame(Session *session, unsigned int index)
+{
+	if (!session->frames_.erase(index)) {
+		LOG(Broker, Warning) << "Frame " << index << " not held by client";
+		return;
+	}
+
+	if (!--refcounts_[index])
+		queueRequest(index);
+}
+
+void CameraBroker::releaseFrames(Session *session)
+{
+	std::set<unsigned int> frames = session->frames_;
+	for (unsigned int index : frames)
+		releaseFrame(session, index);
+}
+
+void CameraBroker::queueRequest(unsigned int index)
+{
+	if (!running_)
+		return;
+
+	Request *request = requests_[index].get();
+	request->reuse(Request::ReuseBuffers);
+	camera_->queueRequest(request);
+}
@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera_broker.h - Distribute frames of a camera to multiple processes
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/object.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/framebuffer_allocator.h>
+#include <libcamera/geometry.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/ipc_unixsocket.h"
+
+namespace libcamera {
+class EventNotifier;
+} /* namespace libcamera */
+
+class CameraBroker : public libcamera::Object
+{
+public:
+	CameraBroker(std::shared_ptr<libcamera::Camera> camera);
+	~CameraBroker();
+
+	int start(const std::string &path, libcamera::StreamRole role,
+		  const libcamera::Size &size);
+	void stop();
+
+private:
+	/*
+	 * Maximum number of frames a client can hold. Frames are not sent to
+	 * clients that hold more, to prevent a slow client from starving the
+	 * camera and the other clients.
+	 */
+	static constexpr unsigned int kMaxHeldFrames = 2;
+
+	class Session : public libcamera::Object
+	{
+	public:
+		libcamera::IPCUnixSocket socket_;
+		bool streaming_ = false;
+		std::set<unsigned int> frames_;
+		unsigned int dropped_ = 0;
+	};
+
+	void acceptSession();
+	int setupSession(Session *session);
+	void sessionReady(Session *session);
+	void closeSession(Session *session);
+
+	void requestComplete(libcamera::Request *request);
+	void releaseFrame(Session *session, unsigned int index);
+	void releaseFrames(Session *session);
+	void queueRequest(unsigned int index);
+
+	std::shared_ptr<libcamera::Camera> camera_;
+	std::unique_ptr<libcamera::CameraConfiguration> config_;
+	std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
+	libcamera::Stream *stream_;
+
+	std::vector<std::unique_ptr<libcamera::Request>> requests_;
+	/* Number of sessions holding each frame, indexed by request cookie. */
+	std::vector<unsigned int> refcounts_;
+
+	std::string path_;
+	int listenFd_;
+	libcamera::EventNotifier *notifier_;
+	std::list<Session *> sessions_;
+	bool running_;
+};
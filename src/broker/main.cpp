@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * main.cpp - libcamera camera broker daemon
+ */
+
+#include <atomic>
+#include <getopt.h>
+#include <iostream>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+
+#include <libcamera/camera_manager.h>
+
+#include "camera_broker.h"
+
+using namespace libcamera;
+
+namespace {
+
+std::atomic<bool> exitRequested = false;
+
+void signalHandler([[maybe_unused]] int signal)
+{
+	exitRequested = true;
+}
+
+void usage(const char *argv0)
+{
+	std::cout
+		<< "Usage: " << argv0 << " [options]" << std::endl
+		<< std::endl
+		<< "Options:" << std::endl
+		<< "  -c, --camera <id>      Camera to distribute (default: first camera)" << std::endl
+		<< "  -r, --role <role>      Stream role: viewfinder, video or still (default: video)" << std::endl
+		<< "  -s, --socket <path>    Path of the socket clients connect to" << std::endl
+		<< "                         (default: /run/libcamera-broker.sock)" << std::endl
+		<< "  -S, --size <WxH>       Stream size (default: role default)" << std::endl
+		<< "  -h, --help             Display this help message" << std::endl;
+}
+
+} /* namespace */
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{ "camera", required_argument, nullptr, 'c' },
+		{ "role", required_argument, nullptr, 'r' },
+		{ "socket", required_argument, nullptr, 's' },
+		{ "size", required_argument, nullptr, 'S' },
+		{ "help", no_argument, nullptr, 'h' },
+		{},
+	};
+
+	std::string cameraId;
+	std::string path = "/run/libcamera-broker.sock";
+	StreamRole role = StreamRole::VideoRecording;
+	Size size;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "c:r:s:S:h", options, nullptr)) != -1) {
+		switch (opt) {
+		case 'c':
+			cameraId = optarg;
+			break;
+
+		case 'r':
+			if (!strcmp(optarg, "viewfinder")) {
+				role = StreamRole::Viewfinder;
+			} else if (!strcmp(optarg, "video")) {
+				role = StreamRole::VideoRecording;
+			} else if (!strcmp(optarg, "still")) {
+				role = StreamRole::StillCapture;
+			} else {
+				std::cerr << "Invalid role " << optarg << std::endl;
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 's':
+			path = optarg;
+			break;
+
+		case 'S':
+			if (sscanf(optarg, "%ux%u", &size.width, &size.height) != 2) {
+				std::cerr << "Invalid size " << optarg << std::endl;
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	CameraManager cm;
+	int ret = cm.start();
+	if (ret) {
+		std::cerr << "Failed to start camera manager: "
+			  << strerror(-ret) << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::shared_ptr<Camera> camera;
+	if (!cameraId.empty())
+		camera = cm.get(cameraId);
+	else if (!cm.cameras().empty())
+		camera = cm.cameras().front();
+
+	if (!camera) {
+		std::cerr << "Camera not found" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (camera->acquire()) {
+		std::cerr << "Failed to acquire camera " << camera->id() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	struct sigaction sa = {};
+	sa.sa_handler = &signalHandler;
+	sigaction(SIGINT, &sa, nullptr);
+	sigaction(SIGTERM, &sa, nullptr);
+
+	/* Clients disconnecting while a frame is sent must not kill us. */
+	signal(SIGPIPE, SIG_IGN);
+
+	ret = EXIT_SUCCESS;
+
+	{
+		CameraBroker broker(camera);
+
+		if (broker.start(path, role, size) < 0) {
+			ret = EXIT_FAILURE;
+		} else {
+			/*
+			 * The signal handler interrupts the event dispatcher,
+			 * check for exit requests after every iteration.
+			 */
+			EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+			while (!exitRequested)
+				dispatcher->processEvents();
+		}
+
+		broker.stop();
+	}
+
+	camera->release();
+	camera.reset();
+	cm.stop();
+
+	return ret;
+}
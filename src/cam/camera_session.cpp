@@ -14,6 +14,7 @@
 #include <libcamera/property_ids.h>
 
 #include "camera_session.h"
+#include "encoder_sink.h"
 #include "event_loop.h"
 #include "file_sink.h"
 #ifdef HAVE_KMS
@@ -28,9 +29,9 @@ CameraSession::CameraSession(CameraManager *cm,
 			     const std::string &cameraId,
 			     unsigned int cameraIndex,
 			     const OptionsParser::Options &options)
-	: options_(options), cameraIndex_(cameraIndex), last_(0),
+	: options_(options), cameraIndex_(cameraIndex), displayView_(0), last_(0),
 	  queueCount_(0), captureCount_(0), captureLimit_(0),
-	  printMetadata_(false)
+	  printMetadata_(false), loop_(nullptr), printStats_(false)
 {
 	char *endptr;
 	unsigned long index = strtoul(cameraId.c_str(), &endptr, 10);
@@ -71,8 +72,8 @@ CameraSession::CameraSession(CameraManager *cm,
 
 #ifdef HAVE_KMS
 	if (options_.isSet(OptDisplay)) {
-		if (options_.isSet(OptFile)) {
-			std::cerr << "--display and --file options are mutually exclusive"
+		if (options_.isSet(OptFile) || options_.isSet(OptEncode)) {
+			std::cerr << "--display is mutually exclusive with --file and --encode"
 				  << std::endl;
 			return;
 		}
@@ -114,10 +115,23 @@ CameraSession::CameraSession(CameraManager *cm,
 
 CameraSession::~CameraSession()
 {
+	stop();
+
 	if (camera_)
 		camera_->release();
 }
 
+/*
+ * Sessions displaying on the same connector share a display, created by the
+ * caller, in which they each own a view.
+ */
+void CameraSession::setDisplay(std::shared_ptr<KMSDisplay> display,
+			       unsigned int view)
+{
+	display_ = std::move(display);
+	displayView_ = view;
+}
+
 void CameraSession::listControls() const
 {
 	for (const auto &ctrl : camera_->controls()) {
@@ -162,7 +176,63 @@ void CameraSession::infoConfiguration() const
 	}
 }
 
+/*
+ * Each session runs in its own thread, with its own event loop and frame sink,
+ * so that multiple cameras don't compete for a single thread to process
+ * completed requests, write files or commit frames to the display.
+ */
 int CameraSession::start()
+{
+	std::promise<int> started;
+	std::future<int> result = started.get_future();
+
+	thread_ = std::thread(&CameraSession::run, this, &started);
+
+	int ret = result.get();
+	if (ret < 0)
+		thread_.join();
+
+	return ret;
+}
+
+void CameraSession::stop()
+{
+	if (!thread_.joinable())
+		return;
+
+	/*
+	 * Exit the event loop from within, as exiting it before it starts
+	 * running would be ignored.
+	 */
+	loop_->callLater([this]() { loop_->exit(); });
+	thread_.join();
+}
+
+void CameraSession::run(std::promise<int> *started)
+{
+	EventLoop loop;
+	loop_ = &loop;
+
+	int ret = setup();
+	started->set_value(ret);
+	if (ret < 0) {
+		loop_ = nullptr;
+		return;
+	}
+
+	if (printStats_) {
+		statsStart_ = clock::now();
+		loop.addTimerEvent(std::chrono::seconds(1),
+				   [this]() { printStats(); });
+	}
+
+	loop.exec();
+
+	teardown();
+	loop_ = nullptr;
+}
+
+int CameraSession::setup()
 {
 	int ret;
 
@@ -170,6 +240,15 @@ int CameraSession::start()
 	captureCount_ = 0;
 	captureLimit_ = options_[OptCapture].toInteger();
 	printMetadata_ = options_.isSet(OptMetadata);
+	printStats_ = options_.isSet(OptStats);
+
+	queueTimes_.clear();
+	latencySum_ = clock::duration::zero();
+	latencyMax_ = clock::duration::zero();
+	statsFrames_ = 0;
+	statsDropped_ = 0;
+	totalDropped_ = 0;
+	lastSequence_ = -1;
 
 	ret = camera_->configure(config_.get());
 	if (ret < 0) {
@@ -187,16 +266,40 @@ int CameraSession::start()
 	camera_->requestCompleted.connect(this, &CameraSession::requestComplete);
 
 #ifdef HAVE_KMS
-	if (options_.isSet(OptDisplay))
-		sink_ = std::make_unique<KMSSink>(options_[OptDisplay].toString());
+	if (display_)
+		sink_ = std::make_unique<KMSSink>(display_, displayView_);
 #endif
 
-	if (options_.isSet(OptFile)) {
-		if (!options_[OptFile].toString().empty())
-			sink_ = std::make_unique<FileSink>(streamNames_,
-							   options_[OptFile]);
-		else
-			sink_ = std::make_unique<FileSink>(streamNames_);
+	if (options_.isSet(OptEncode)) {
+		std::string codecName = options_[OptEncode].toString();
+		EncoderSink::Codec codec;
+
+		if (codecName.empty() || codecName == "h264") {
+			codec = EncoderSink::H264;
+		} else if (codecName == "hevc") {
+			codec = EncoderSink::HEVC;
+		} else {
+			std::cerr << "Unsupported codec " << codecName << std::endl;
+			return -EINVAL;
+		}
+
+		std::string filename;
+		if (options_.isSet(OptFile))
+			filename = options_[OptFile].toString();
+		if (filename.empty() || filename.back() == '/')
+			filename += "cam" + std::to_string(cameraIndex_) + "."
+				  + EncoderSink::extension(codec);
+
+		sink_ = std::make_unique<EncoderSink>(filename, codec);
+	} else if (options_.isSet(OptFile)) {
+		uint64_t preallocate = options_.isSet(OptContainer) ?
+				       options_[OptContainer].toInteger() : 0;
+
+		sink_ = std::make_unique<FileSink>(streamNames_,
+						   options_[OptFile].toString(),
+						   options_.isSet(OptDirectIO),
+						   options_.isSet(OptContainer),
+						   preallocate << 20);
 	}
 
 	if (sink_) {
@@ -215,7 +318,7 @@ int CameraSession::start()
 	return startCapture();
 }
 
-void CameraSession::stop()
+void CameraSession::teardown()
 {
 	int ret = camera_->stop();
 	if (ret)
@@ -329,6 +432,9 @@ int CameraSession::queueRequest(Request *request)
 
 	queueCount_++;
 
+	if (printStats_)
+		queueTimes_[request] = clock::now();
+
 	return camera_->queueRequest(request);
 }
 
@@ -338,13 +444,14 @@ void CameraSession::requestComplete(Request *request)
 		return;
 
 	/*
-	 * Defer processing of the completed request to the event loop, to avoid
-	 * blocking the camera manager thread.
+	 * Defer processing of the completed request to the event loop of the
+	 * session, to avoid blocking the camera manager thread.
 	 */
-	EventLoop::instance()->callLater([=]() { processRequest(request); });
+	clock::time_point completed = clock::now();
+	loop_->callLater([=]() { processRequest(request, completed); });
 }
 
-void CameraSession::processRequest(Request *request)
+void CameraSession::processRequest(Request *request, clock::time_point completed)
 {
 	/*
 	 * If we've reached the capture limit, we're done. This doesn't
@@ -367,6 +474,23 @@ void CameraSession::processRequest(Request *request)
 	fps = last_ != 0 && fps ? 1000000000.0 / fps : 0.0;
 	last_ = ts;
 
+	if (printStats_) {
+		auto queued = queueTimes_.find(request);
+		if (queued != queueTimes_.end()) {
+			clock::duration latency = completed - queued->second;
+			latencySum_ += latency;
+			latencyMax_ = std::max(latencyMax_, latency);
+		}
+
+		/* Count the frames dropped by the camera from sequence gaps. */
+		int64_t sequence = buffers.begin()->second->metadata().sequence;
+		if (lastSequence_ >= 0 && sequence > lastSequence_ + 1)
+			statsDropped_ += sequence - lastSequence_ - 1;
+		lastSequence_ = sequence;
+
+		statsFrames_++;
+	}
+
 	bool requeue = true;
 
 	std::stringstream info;
@@ -397,7 +521,8 @@ void CameraSession::processRequest(Request *request)
 			requeue = false;
 	}
 
-	std::cout << info.str() << std::endl;
+	if (!printStats_)
+		std::cout << info.str() << std::endl;
 
 	if (printMetadata_) {
 		const ControlList &requestMetadata = request->metadata();
@@ -426,6 +551,8 @@ void CameraSession::processRequest(Request *request)
 		return;
 
 	request->reuse(Request::ReuseBuffers);
+	if (printStats_)
+		queueTimes_[request] = clock::now();
 	camera_->queueRequest(request);
 }
 
@@ -434,3 +561,29 @@ void CameraSession::sinkRelease(Request *request)
 	request->reuse(Request::ReuseBuffers);
 	queueRequest(request);
 }
+
+void CameraSession::printStats()
+{
+	clock::time_point now = clock::now();
+	double elapsed = std::chrono::duration<double>(now - statsStart_).count();
+	statsStart_ = now;
+
+	double fps = elapsed > 0 ? statsFrames_ / elapsed : 0.0;
+	double latencyAvg = statsFrames_
+			  ? std::chrono::duration<double, std::milli>(latencySum_).count() / statsFrames_
+			  : 0.0;
+	double latencyMax = std::chrono::duration<double, std::milli>(latencyMax_).count();
+
+	totalDropped_ += statsDropped_;
+
+	std::cout << "cam" << cameraIndex_ << ": "
+		  << std::fixed << std::setprecision(2) << fps << " fps, latency "
+		  << latencyAvg << " ms avg " << latencyMax << " ms max, "
+		  << statsDropped_ << " dropped (" << totalDropped_ << " total)"
+		  << std::endl;
+
+	latencySum_ = clock::duration::zero();
+	latencyMax_ = clock::duration::zero();
+	statsFrames_ = 0;
+	statsDropped_ = 0;
+}
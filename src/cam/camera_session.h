@@ -7,9 +7,14 @@
 
 #pragma once
 
+#include <chrono>
+#include <future>
+#include <map>
 #include <memory>
 #include <stdint.h>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <libcamera/base/signal.h>
@@ -23,7 +28,9 @@
 
 #include "options.h"
 
+class EventLoop;
 class FrameSink;
+class KMSDisplay;
 
 class CameraSession
 {
@@ -39,6 +46,8 @@ public:
 	libcamera::Camera *camera() { return camera_.get(); }
 	libcamera::CameraConfiguration *config() { return config_.get(); }
 
+	void setDisplay(std::shared_ptr<KMSDisplay> display, unsigned int view);
+
 	void listControls() const;
 	void listProperties() const;
 	void infoConfiguration() const;
@@ -49,12 +58,19 @@ public:
 	libcamera::Signal<> captureDone;
 
 private:
+	using clock = std::chrono::steady_clock;
+
+	void run(std::promise<int> *started);
+	int setup();
+	void teardown();
 	int startCapture();
 
 	int queueRequest(libcamera::Request *request);
 	void requestComplete(libcamera::Request *request);
-	void processRequest(libcamera::Request *request);
+	void processRequest(libcamera::Request *request,
+			    clock::time_point completed);
 	void sinkRelease(libcamera::Request *request);
+	void printStats();
 
 	const OptionsParser::Options &options_;
 	std::shared_ptr<libcamera::Camera> camera_;
@@ -64,6 +80,9 @@ private:
 	std::unique_ptr<FrameSink> sink_;
 	unsigned int cameraIndex_;
 
+	std::shared_ptr<KMSDisplay> display_;
+	unsigned int displayView_;
+
 	uint64_t last_;
 
 	unsigned int queueCount_;
@@ -73,4 +92,19 @@ private:
 
 	std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
 	std::vector<std::unique_ptr<libcamera::Request>> requests_;
+
+	/* The session runs in its own thread, with its own event loop. */
+	std::thread thread_;
+	EventLoop *loop_;
+
+	/* Statistics, accessed from the session thread only. */
+	bool printStats_;
+	std::unordered_map<const libcamera::Request *, clock::time_point> queueTimes_;
+	clock::time_point statsStart_;
+	clock::duration latencySum_;
+	clock::duration latencyMax_;
+	unsigned int statsFrames_;
+	unsigned int statsDropped_;
+	unsigned int totalDropped_;
+	int64_t lastSequence_;
 };
@@ -21,6 +21,7 @@
 #include <libcamera/geometry.h>
 #include <libcamera/pixel_format.h>
 
+#include <libdrm/drm_fourcc.h>
 #include <libdrm/drm_mode.h>
 
 #include "event_loop.h"
@@ -246,8 +247,15 @@ Plane::Plane(Device *dev, const drmModePlane *plane)
 
 bool Plane::supportsFormat(const libcamera::PixelFormat &format) const
 {
-	return std::find(formats_.begin(), formats_.end(), format.fourcc())
-		!= formats_.end();
+	if (std::find(formats_.begin(), formats_.end(), format.fourcc()) ==
+	    formats_.end())
+		return false;
+
+	/* Planes that don't report modifiers only support linear buffers. */
+	if (formatModifiers_.empty())
+		return format.modifier() == DRM_FORMAT_MOD_LINEAR;
+
+	return formatModifiers_.count({ format.fourcc(), format.modifier() });
 }
 
 int Plane::setup()
@@ -273,9 +281,47 @@ int Plane::setup()
 		return -EINVAL;
 	}
 
+	pv = propertyValue("IN_FORMATS");
+	if (pv)
+		parseFormatModifiers(pv->value());
+
 	return 0;
 }
 
+void Plane::parseFormatModifiers(uint32_t blobId)
+{
+	drmModePropertyBlobRes *blob = drmModeGetPropertyBlob(device()->fd(), blobId);
+	if (!blob)
+		return;
+
+	/*
+	 * The IN_FORMATS blob stores a list of formats and a list of
+	 * modifiers. Each modifier has a bitmask of the formats it applies to,
+	 * relative to an offset in the formats list.
+	 */
+	const uint8_t *data = static_cast<const uint8_t *>(blob->data);
+	const auto *header = reinterpret_cast<const drm_format_modifier_blob *>(data);
+	const auto *formats = reinterpret_cast<const uint32_t *>(data + header->formats_offset);
+	const auto *modifiers = reinterpret_cast<const drm_format_modifier *>(data + header->modifiers_offset);
+
+	for (uint32_t i = 0; i < header->count_modifiers; ++i) {
+		const drm_format_modifier &modifier = modifiers[i];
+
+		for (unsigned int bit = 0; bit < 64; ++bit) {
+			if (!(modifier.formats & (1ULL << bit)))
+				continue;
+
+			uint32_t index = modifier.offset + bit;
+			if (index >= header->count_formats)
+				break;
+
+			formatModifiers_.emplace(formats[index], modifier.modifier);
+		}
+	}
+
+	drmModeFreePropertyBlob(blob);
+}
+
 FrameBuffer::FrameBuffer(Device *dev)
 	: Object(dev, 0, Object::TypeFb)
 {
@@ -376,6 +422,8 @@ int AtomicRequest::commit(unsigned int flags)
 		drmFlags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
 	if (flags & FlagAsync)
 		drmFlags |= DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK;
+	if (flags & FlagTestOnly)
+		drmFlags |= DRM_MODE_ATOMIC_TEST_ONLY;
 
 	return drmModeAtomicCommit(dev_->fd(), request_, drmFlags, this);
 }
@@ -632,8 +680,20 @@ std::unique_ptr<FrameBuffer> Device::createFrameBuffer(
 		++i;
 	}
 
-	ret = drmModeAddFB2(fd_, size.width, size.height, format.fourcc(), handles,
-			    strides.data(), offsets, &fb->id_, 0);
+	if (format.modifier() != DRM_FORMAT_MOD_LINEAR) {
+		uint64_t modifiers[4] = {};
+		for (unsigned int j = 0; j < planes.size(); ++j)
+			modifiers[j] = format.modifier();
+
+		ret = drmModeAddFB2WithModifiers(fd_, size.width, size.height,
+						 format.fourcc(), handles,
+						 strides.data(), offsets,
+						 modifiers, &fb->id_,
+						 DRM_MODE_FB_MODIFIERS);
+	} else {
+		ret = drmModeAddFB2(fd_, size.width, size.height, format.fourcc(),
+				    handles, strides.data(), offsets, &fb->id_, 0);
+	}
 	if (ret < 0) {
 		ret = -errno;
 		std::cerr
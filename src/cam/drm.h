@@ -11,6 +11,7 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <set>
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -222,8 +223,11 @@ protected:
 private:
 	friend class Device;
 
+	void parseFormatModifiers(uint32_t blobId);
+
 	Type type_;
 	std::vector<uint32_t> formats_;
+	std::set<std::pair<uint32_t, uint64_t>> formatModifiers_;
 	std::vector<const Crtc *> possibleCrtcs_;
 	uint32_t possibleCrtcsMask_;
 };
@@ -251,6 +255,7 @@ public:
 	enum Flags {
 		FlagAllowModeset = (1 << 0),
 		FlagAsync = (1 << 1),
+		FlagTestOnly = (1 << 2),
 	};
 
 	AtomicRequest(Device *dev);
@@ -0,0 +1,567 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * encoder_sink.cpp - Video encoder sink using a V4L2 memory-to-memory encoder
+ */
+
+#include "encoder_sink.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include "event_loop.h"
+
+using namespace libcamera;
+
+namespace {
+
+/* Maximum time to wait for the encoder to flush the last frames, in ms. */
+constexpr int kDrainTimeout = 1000;
+
+/*
+ * The V4L2 pixel formats matching the libcamera formats the encoders
+ * commonly accept. All planes must be stored in a single dmabuf.
+ */
+const std::map<PixelFormat, uint32_t> kSourceFormats = {
+	{ formats::NV12, V4L2_PIX_FMT_NV12 },
+	{ formats::NV21, V4L2_PIX_FMT_NV21 },
+	{ formats::YUV420, V4L2_PIX_FMT_YUV420 },
+	{ formats::YVU420, V4L2_PIX_FMT_YVU420 },
+	{ formats::YUYV, V4L2_PIX_FMT_YUYV },
+};
+
+int xioctl(int fd, unsigned long request, void *arg)
+{
+	int ret;
+
+	do {
+		ret = ioctl(fd, request, arg);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret < 0 ? -errno : ret;
+}
+
+bool supportsFormat(int fd, enum v4l2_buf_type type, uint32_t fourcc)
+{
+	struct v4l2_fmtdesc desc = {};
+	desc.type = type;
+
+	while (!xioctl(fd, VIDIOC_ENUM_FMT, &desc)) {
+		if (desc.pixelformat == fourcc)
+			return true;
+		desc.index++;
+	}
+
+	return false;
+}
+
+} /* namespace */
+
+EncoderSink::EncoderSink(const std::string &filename, Codec codec)
+	: filename_(filename), codec_(codec), fd_(-1), streaming_(false),
+	  stream_(nullptr), stride_(0), sourceFormat_(0), codedFormat_(0),
+	  framesEncoded_(0), bytesWritten_(0)
+{
+}
+
+EncoderSink::~EncoderSink()
+{
+	stop();
+
+	if (fd_ >= 0)
+		close(fd_);
+}
+
+const char *EncoderSink::extension(Codec codec)
+{
+	return codec == HEVC ? "hevc" : "h264";
+}
+
+int EncoderSink::configure(const CameraConfiguration &config)
+{
+	int ret = FrameSink::configure(config);
+	if (ret < 0)
+		return ret;
+
+	const StreamConfiguration &cfg = config.at(0);
+
+	auto format = kSourceFormats.find(cfg.pixelFormat);
+	if (format == kSourceFormats.end()) {
+		std::cerr << "Pixel format " << cfg.pixelFormat.toString()
+			  << " not supported by the encoder sink" << std::endl;
+		return -EINVAL;
+	}
+
+	stream_ = cfg.stream();
+	size_ = cfg.size;
+	stride_ = cfg.stride;
+	sourceFormat_ = format->second;
+	codedFormat_ = codec_ == HEVC ? V4L2_PIX_FMT_HEVC : V4L2_PIX_FMT_H264;
+
+	if (fd_ < 0) {
+		ret = openEncoder(sourceFormat_, codedFormat_);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = setFormats();
+	if (ret < 0)
+		return ret;
+
+	setControls();
+
+	bufferIndices_.clear();
+
+	return 0;
+}
+
+/*
+ * Find a memory-to-memory encoder that converts the source format to the coded
+ * format. Only the multi-planar API is supported, as used by all stateful
+ * encoders in mainline and downstream kernels.
+ */
+int EncoderSink::openEncoder(uint32_t sourceFormat, uint32_t codedFormat)
+{
+	DIR *dir = opendir("/dev");
+	if (!dir)
+		return -errno;
+
+	std::vector<std::string> nodes;
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != nullptr) {
+		if (!strncmp(ent->d_name, "video", 5))
+			nodes.push_back(std::string("/dev/") + ent->d_name);
+	}
+	closedir(dir);
+
+	std::sort(nodes.begin(), nodes.end());
+
+	for (const std::string &node : nodes) {
+		int fd = open(node.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		struct v4l2_capability caps = {};
+		uint32_t deviceCaps = 0;
+		if (!xioctl(fd, VIDIOC_QUERYCAP, &caps))
+			deviceCaps = caps.capabilities & V4L2_CAP_DEVICE_CAPS
+				   ? caps.device_caps : caps.capabilities;
+
+		if ((deviceCaps & V4L2_CAP_VIDEO_M2M_MPLANE) &&
+		    (deviceCaps & V4L2_CAP_STREAMING) &&
+		    supportsFormat(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, sourceFormat) &&
+		    supportsFormat(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, codedFormat)) {
+			std::cout << "Using encoder " << caps.card << " ("
+				  << node << ")" << std::endl;
+			fd_ = fd;
+			return 0;
+		}
+
+		close(fd);
+	}
+
+	std::cerr << "No " << extension(codec_) << " encoder found"
+		  << std::endl;
+	return -ENODEV;
+}
+
+int EncoderSink::setFormats()
+{
+	/*
+	 * The coded format is set first, as stateful encoders derive the
+	 * supported raw formats and sizes from it.
+	 */
+	struct v4l2_format fmt = {};
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	fmt.fmt.pix_mp.width = size_.width;
+	fmt.fmt.pix_mp.height = size_.height;
+	fmt.fmt.pix_mp.pixelformat = codedFormat_;
+	fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+	fmt.fmt.pix_mp.num_planes = 1;
+
+	int ret = xioctl(fd_, VIDIOC_S_FMT, &fmt);
+	if (ret < 0) {
+		std::cerr << "Failed to set encoder coded format: "
+			  << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	fmt = {};
+	fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	fmt.fmt.pix_mp.width = size_.width;
+	fmt.fmt.pix_mp.height = size_.height;
+	fmt.fmt.pix_mp.pixelformat = sourceFormat_;
+	fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+	fmt.fmt.pix_mp.num_planes = 1;
+	fmt.fmt.pix_mp.plane_fmt[0].bytesperline = stride_;
+
+	ret = xioctl(fd_, VIDIOC_S_FMT, &fmt);
+	if (ret < 0) {
+		std::cerr << "Failed to set encoder source format: "
+			  << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	/* The camera buffers are imported as-is, the layout must match. */
+	if (fmt.fmt.pix_mp.pixelformat != sourceFormat_ ||
+	    fmt.fmt.pix_mp.width != size_.width ||
+	    fmt.fmt.pix_mp.height != size_.height ||
+	    fmt.fmt.pix_mp.plane_fmt[0].bytesperline != stride_) {
+		std::cerr << "Encoder doesn't support the camera frame layout"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+void EncoderSink::setControls()
+{
+	/*
+	 * Target about 0.125 bits per pixel at 30fps, a reasonable quality for
+	 * recordings. Not all encoders support all controls, ignore failures.
+	 */
+	struct v4l2_control ctrl = {};
+	ctrl.id = V4L2_CID_MPEG_VIDEO_BITRATE;
+	ctrl.value = std::min<uint64_t>(static_cast<uint64_t>(size_.width) *
+					size_.height * 30 / 8, INT32_MAX);
+	xioctl(fd_, VIDIOC_S_CTRL, &ctrl);
+
+	/* Repeat the stream headers to make recordings cut at any point playable. */
+	ctrl.id = V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER;
+	ctrl.value = 1;
+	xioctl(fd_, VIDIOC_S_CTRL, &ctrl);
+}
+
+void EncoderSink::mapBuffer(FrameBuffer *buffer)
+{
+	const std::vector<FrameBuffer::Plane> &planes = buffer->planes();
+
+	for (const FrameBuffer::Plane &plane : planes) {
+		if (plane.fd.fd() != planes[0].fd.fd()) {
+			std::cerr << "Multi-dmabuf frames not supported by the encoder sink"
+				  << std::endl;
+			return;
+		}
+	}
+
+	unsigned int index = bufferIndices_.size();
+	bufferIndices_[buffer] = index;
+}
+
+int EncoderSink::start()
+{
+	int ret = FrameSink::start();
+	if (ret < 0)
+		return ret;
+
+	if (fd_ < 0 || bufferIndices_.empty())
+		return -EINVAL;
+
+	file_.open(filename_, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file_.is_open()) {
+		std::cerr << "Failed to open " << filename_ << std::endl;
+		return -EIO;
+	}
+
+	/* Import the camera buffers, zero-copy, in the encoder output queue. */
+	struct v4l2_requestbuffers rb = {};
+	rb.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	rb.memory = V4L2_MEMORY_DMABUF;
+	rb.count = bufferIndices_.size();
+
+	ret = xioctl(fd_, VIDIOC_REQBUFS, &rb);
+	if (ret < 0 || rb.count < bufferIndices_.size()) {
+		std::cerr << "Failed to allocate encoder output buffers" << std::endl;
+		releaseBuffers();
+		return ret < 0 ? ret : -ENOMEM;
+	}
+
+	rb = {};
+	rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	rb.memory = V4L2_MEMORY_MMAP;
+	rb.count = kNumCaptureBuffers;
+
+	ret = xioctl(fd_, VIDIOC_REQBUFS, &rb);
+	if (ret < 0 || !rb.count) {
+		std::cerr << "Failed to allocate encoder capture buffers" << std::endl;
+		releaseBuffers();
+		return ret < 0 ? ret : -ENOMEM;
+	}
+
+	for (unsigned int i = 0; i < rb.count; ++i) {
+		struct v4l2_plane plane = {};
+		struct v4l2_buffer buf = {};
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		buf.m.planes = &plane;
+		buf.length = 1;
+
+		ret = xioctl(fd_, VIDIOC_QUERYBUF, &buf);
+		if (ret < 0) {
+			releaseBuffers();
+			return ret;
+		}
+
+		void *data = mmap(nullptr, plane.length, PROT_READ, MAP_SHARED,
+				  fd_, plane.m.mem_offset);
+		if (data == MAP_FAILED) {
+			ret = -errno;
+			releaseBuffers();
+			return ret;
+		}
+
+		captureBuffers_.push_back({ data, plane.length });
+
+		ret = queueCapture(i);
+		if (ret < 0) {
+			releaseBuffers();
+			return ret;
+		}
+	}
+
+	pending_.assign(bufferIndices_.size(), nullptr);
+
+	for (enum v4l2_buf_type type : { V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
+					 V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE }) {
+		ret = xioctl(fd_, VIDIOC_STREAMON, &type);
+		if (ret < 0) {
+			std::cerr << "Failed to start encoder: " << strerror(-ret)
+				  << std::endl;
+			releaseBuffers();
+			return ret;
+		}
+	}
+
+	streaming_ = true;
+	framesEncoded_ = 0;
+	bytesWritten_ = 0;
+
+	EventLoop::instance()->addEvent(fd_, EventLoop::Read,
+					std::bind(&EncoderSink::encoderEvent, this));
+
+	return 0;
+}
+
+int EncoderSink::stop()
+{
+	if (!streaming_)
+		return 0;
+
+	drain();
+	releaseBuffers();
+
+	file_.close();
+
+	std::cout << "Encoded " << framesEncoded_ << " frames, "
+		  << std::fixed << std::setprecision(2)
+		  << bytesWritten_ / 1000000.0 << " MB written to "
+		  << filename_ << std::endl;
+
+	return FrameSink::stop();
+}
+
+bool EncoderSink::processRequest(Request *request)
+{
+	FrameBuffer *buffer = request->findBuffer(stream_);
+	if (!buffer)
+		return true;
+
+	auto it = bufferIndices_.find(buffer);
+	if (it == bufferIndices_.end() || !streaming_)
+		return true;
+
+	const std::vector<FrameBuffer::Plane> &planes = buffer->planes();
+	const FrameMetadata &metadata = buffer->metadata();
+
+	/*
+	 * All planes are stored in the same dmabuf. Pass the whole range
+	 * from the first plane to the end of the last one.
+	 */
+	const FrameBuffer::Plane &last = planes.back();
+	unsigned int length = last.offset + last.length;
+	unsigned int bytesused = last.offset + metadata.planes().back().bytesused;
+
+	struct v4l2_plane plane = {};
+	plane.m.fd = planes[0].fd.fd();
+	plane.length = length;
+	plane.bytesused = bytesused;
+	plane.data_offset = planes[0].offset;
+
+	struct v4l2_buffer buf = {};
+	buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	buf.memory = V4L2_MEMORY_DMABUF;
+	buf.index = it->second;
+	buf.m.planes = &plane;
+	buf.length = 1;
+	buf.field = V4L2_FIELD_NONE;
+	buf.timestamp.tv_sec = metadata.timestamp / 1000000000;
+	buf.timestamp.tv_usec = metadata.timestamp / 1000 % 1000000;
+
+	int ret = xioctl(fd_, VIDIOC_QBUF, &buf);
+	if (ret < 0) {
+		std::cerr << "Failed to queue frame to encoder: "
+			  << strerror(-ret) << std::endl;
+		return true;
+	}
+
+	/* The request is released when the encoder is done with the frame. */
+	pending_[it->second] = request;
+
+	return false;
+}
+
+void EncoderSink::encoderEvent()
+{
+	bool last;
+
+	while (dequeueCapture(&last) == 0)
+		;
+
+	while (dequeueOutput() == 0)
+		;
+}
+
+int EncoderSink::dequeueOutput()
+{
+	struct v4l2_plane plane = {};
+	struct v4l2_buffer buf = {};
+	buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	buf.memory = V4L2_MEMORY_DMABUF;
+	buf.m.planes = &plane;
+	buf.length = 1;
+
+	int ret = xioctl(fd_, VIDIOC_DQBUF, &buf);
+	if (ret < 0)
+		return ret;
+
+	if (buf.index >= pending_.size())
+		return 0;
+
+	Request *request = pending_[buf.index];
+	pending_[buf.index] = nullptr;
+
+	if (request)
+		requestProcessed.emit(request);
+
+	return 0;
+}
+
+int EncoderSink::dequeueCapture(bool *last)
+{
+	struct v4l2_plane plane = {};
+	struct v4l2_buffer buf = {};
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.m.planes = &plane;
+	buf.length = 1;
+
+	int ret = xioctl(fd_, VIDIOC_DQBUF, &buf);
+	if (ret < 0)
+		return ret;
+
+	*last = buf.flags & V4L2_BUF_FLAG_LAST;
+
+	const CaptureBuffer &capture = captureBuffers_[buf.index];
+	size_t offset = std::min<size_t>(plane.data_offset, plane.bytesused);
+	size_t size = std::min<size_t>(plane.bytesused, capture.length) - offset;
+
+	if (size) {
+		file_.write(static_cast<const char *>(capture.data) + offset, size);
+		bytesWritten_ += size;
+		framesEncoded_++;
+	}
+
+	if (*last)
+		return 0;
+
+	return queueCapture(buf.index);
+}
+
+int EncoderSink::queueCapture(unsigned int index)
+{
+	struct v4l2_plane plane = {};
+	struct v4l2_buffer buf = {};
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = index;
+	buf.m.planes = &plane;
+	buf.length = 1;
+
+	return xioctl(fd_, VIDIOC_QBUF, &buf);
+}
+
+/*
+ * Ask the encoder to encode all the frames queued so far, and write the
+ * resulting bitstream until the last buffer is flagged.
+ */
+void EncoderSink::drain()
+{
+	struct v4l2_encoder_cmd cmd = {};
+	cmd.cmd = V4L2_ENC_CMD_STOP;
+
+	if (xioctl(fd_, VIDIOC_ENCODER_CMD, &cmd) < 0)
+		return;
+
+	while (true) {
+		struct pollfd pfd = { fd_, POLLIN, 0 };
+		int ret = poll(&pfd, 1, kDrainTimeout);
+		if (ret <= 0 || !(pfd.revents & POLLIN))
+			break;
+
+		bool last = false;
+		while (dequeueCapture(&last) == 0 && !last)
+			;
+
+		if (last)
+			break;
+	}
+}
+
+void EncoderSink::releaseBuffers()
+{
+	for (enum v4l2_buf_type type : { V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+					 V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE })
+		xioctl(fd_, VIDIOC_STREAMOFF, &type);
+	streaming_ = false;
+
+	for (const CaptureBuffer &buffer : captureBuffers_)
+		munmap(buffer.data, buffer.length);
+	captureBuffers_.clear();
+
+	for (enum v4l2_buf_type type : { V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+					 V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE }) {
+		struct v4l2_requestbuffers rb = {};
+		rb.type = type;
+		rb.memory = type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE
+			  ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+		rb.count = 0;
+		xioctl(fd_, VIDIOC_REQBUFS, &rb);
+	}
+
+	/*
+	 * The camera is stopped before the sink, requests still held by the
+	 * encoder are simply dropped.
+	 */
+	pending_.clear();
+}
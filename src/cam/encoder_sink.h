@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * encoder_sink.h - Video encoder sink using a V4L2 memory-to-memory encoder
+ */
+
+#pragma once
+
+#include <fstream>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "frame_sink.h"
+
+namespace libcamera {
+class Stream;
+} /* namespace libcamera */
+
+class EncoderSink : public FrameSink
+{
+public:
+	enum Codec {
+		H264,
+		HEVC,
+	};
+
+	EncoderSink(const std::string &filename, Codec codec);
+	~EncoderSink();
+
+	static const char *extension(Codec codec);
+
+	int configure(const libcamera::CameraConfiguration &config) override;
+
+	void mapBuffer(libcamera::FrameBuffer *buffer) override;
+
+	int start() override;
+	int stop() override;
+
+	bool processRequest(libcamera::Request *request) override;
+
+private:
+	/* Number of bitstream buffers on the encoder capture queue. */
+	static constexpr unsigned int kNumCaptureBuffers = 4;
+
+	struct CaptureBuffer {
+		void *data;
+		size_t length;
+	};
+
+	int openEncoder(uint32_t sourceFormat, uint32_t codedFormat);
+	int setFormats();
+	void setControls();
+	void encoderEvent();
+	int dequeueOutput();
+	int dequeueCapture(bool *last);
+	int queueCapture(unsigned int index);
+	void drain();
+	void releaseBuffers();
+
+	std::string filename_;
+	Codec codec_;
+	std::ofstream file_;
+
+	int fd_;
+	bool streaming_;
+
+	const libcamera::Stream *stream_;
+	libcamera::Size size_;
+	unsigned int stride_;
+	uint32_t sourceFormat_;
+	uint32_t codedFormat_;
+
+	/* Camera buffers, imported in the encoder output queue by index. */
+	std::map<libcamera::FrameBuffer *, unsigned int> bufferIndices_;
+	std::vector<libcamera::Request *> pending_;
+	std::vector<CaptureBuffer> captureBuffers_;
+
+	unsigned int framesEncoded_;
+	uint64_t bytesWritten_;
+};
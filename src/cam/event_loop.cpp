@@ -12,29 +12,51 @@
 #include <event2/thread.h>
 #include <iostream>
 
+/*
+ * The first event loop is the main loop of the application. Additional event
+ * loops can be created, for instance to run camera sessions in separate
+ * threads. Each thread can have at most one event loop, owned by the thread
+ * that creates it.
+ */
 EventLoop *EventLoop::instance_ = nullptr;
+thread_local EventLoop *EventLoop::current_ = nullptr;
+std::atomic_uint EventLoop::count_ = 0;
 
 EventLoop::EventLoop()
 {
-	assert(!instance_);
+	assert(!current_);
+
+	if (count_++ == 0)
+		evthread_use_pthreads();
 
-	evthread_use_pthreads();
 	base_ = event_base_new();
-	instance_ = this;
+
+	if (!instance_)
+		instance_ = this;
+	current_ = this;
 }
 
 EventLoop::~EventLoop()
 {
-	instance_ = nullptr;
+	if (instance_ == this)
+		instance_ = nullptr;
+	if (current_ == this)
+		current_ = nullptr;
 
 	events_.clear();
 	event_base_free(base_);
-	libevent_global_shutdown();
+
+	if (--count_ == 0)
+		libevent_global_shutdown();
 }
 
+/*
+ * Return the event loop of the calling thread, or the main event loop if the
+ * thread has no event loop.
+ */
 EventLoop *EventLoop::instance()
 {
-	return instance_;
+	return current_ ? current_ : instance_;
 }
 
 int EventLoop::exec()
@@ -84,6 +106,30 @@ void EventLoop::addEvent(int fd, EventType type,
 	events_.push_back(std::move(event));
 }
 
+void EventLoop::addTimerEvent(const std::chrono::microseconds period,
+			      const std::function<void()> &callback)
+{
+	std::unique_ptr<Event> event = std::make_unique<Event>(callback);
+	event->event_ = event_new(base_, -1, EV_PERSIST, &EventLoop::Event::dispatch,
+				  event.get());
+	if (!event->event_) {
+		std::cerr << "Failed to create timer event" << std::endl;
+		return;
+	}
+
+	struct timeval tv;
+	tv.tv_sec = period.count() / 1000000ULL;
+	tv.tv_usec = period.count() % 1000000ULL;
+
+	int ret = event_add(event->event_, &tv);
+	if (ret < 0) {
+		std::cerr << "Failed to add timer event" << std::endl;
+		return;
+	}
+
+	events_.push_back(std::move(event));
+}
+
 void EventLoop::dispatchCallback([[maybe_unused]] evutil_socket_t fd,
 				 [[maybe_unused]] short flags, void *param)
 {
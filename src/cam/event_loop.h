@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <list>
@@ -37,6 +39,9 @@ public:
 	void addEvent(int fd, EventType type,
 		      const std::function<void()> &handler);
 
+	void addTimerEvent(const std::chrono::microseconds period,
+			   const std::function<void()> &handler);
+
 private:
 	struct Event {
 		Event(const std::function<void()> &callback);
@@ -49,6 +54,8 @@ private:
 	};
 
 	static EventLoop *instance_;
+	static thread_local EventLoop *current_;
+	static std::atomic_uint count_;
 
 	struct event_base *base_;
 	int exitCode_;
@@ -5,29 +5,110 @@
  * file_sink.cpp - File Sink
  */
 
+#include <algorithm>
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <sstream>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
 
+#include "event_loop.h"
 #include "file_sink.h"
 #include "image.h"
 
 using namespace libcamera;
 
+namespace {
+
+/*
+ * The container file starts with a header block describing the streams,
+ * followed by one record per buffer. Each record starts with a header block,
+ * followed by the planes data, padded to the block size. All fields are in
+ * native endianness, utils/cam-container.py parses the format.
+ */
+constexpr char kContainerMagic[8] = { 'L', 'C', 'A', 'M', 'R', 'A', 'W', '\0' };
+constexpr char kContainerRecordMagic[4] = { 'L', 'C', 'F', 'R' };
+constexpr uint32_t kContainerVersion = 1;
+
+struct ContainerStream {
+	char name[32];
+	uint32_t fourcc;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint64_t modifier;
+	uint32_t frameSize;
+	uint32_t reserved;
+};
+
+struct ContainerHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t blockSize;
+	uint32_t numStreams;
+	uint32_t reserved;
+	/* Followed by numStreams ContainerStream entries. */
+};
+
+struct ContainerRecordHeader {
+	char magic[4];
+	uint32_t stream;
+	uint64_t recordSize;
+	uint64_t timestamp;
+	uint32_t sequence;
+	uint32_t status;
+	uint32_t numPlanes;
+	uint32_t metadataSize;
+	uint32_t planeLengths[4];
+	uint32_t reserved[2];
+};
+
+static_assert(sizeof(ContainerStream) == 64);
+static_assert(sizeof(ContainerHeader) == 24);
+static_assert(sizeof(ContainerRecordHeader) == 64);
+
+alignas(4096) const uint8_t zeroes[4096] = {};
+
+size_t alignUp(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+} /* namespace */
+
 FileSink::FileSink(const std::map<const libcamera::Stream *, std::string> &streamNames,
-		   const std::string &pattern)
-	: streamNames_(streamNames), pattern_(pattern)
+		   const std::string &pattern, bool directIO, bool container,
+		   uint64_t preallocate)
+	: streamNames_(streamNames), pattern_(pattern), loop_(nullptr),
+	  running_(false), directIO_(directIO), bounce_(false),
+#ifdef HAVE_LIBURING
+	  ringValid_(false),
+#endif
+	  container_(container), preallocate_(preallocate), fd_(-1),
+	  offset_(0), framesDropped_(0), framesWritten_(0), writeErrors_(0),
+	  bytesWritten_(0)
 {
+	if (pattern_.empty() || pattern_.back() == '/')
+		pattern_ += container_ ? "frames.raw" : "frame-#.bin";
+
+	/*
+	 * Without a '#' to expand, all frames are concatenated in a single
+	 * file.
+	 */
+	singleFile_ = pattern_.find_first_of('#') == std::string::npos;
 }
 
 FileSink::~FileSink()
 {
+	stop();
 }
 
 int FileSink::configure(const libcamera::CameraConfiguration &config)
@@ -36,6 +117,52 @@ int FileSink::configure(const libcamera::CameraConfiguration &config)
 	if (ret < 0)
 		return ret;
 
+	if (container_ && !singleFile_) {
+		std::cerr << "container output requires a file name without '#'"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	if (!container_)
+		return 0;
+
+	size_t size = sizeof(ContainerHeader)
+		    + config.size() * sizeof(ContainerStream);
+	if (size > kRecordHeaderSize) {
+		std::cerr << "too many streams for container output" << std::endl;
+		return -EINVAL;
+	}
+
+	containerHeader_.assign(kRecordHeaderSize, 0);
+
+	ContainerHeader *header =
+		reinterpret_cast<ContainerHeader *>(containerHeader_.data());
+	memcpy(header->magic, kContainerMagic, sizeof(header->magic));
+	header->version = kContainerVersion;
+	header->blockSize = kRecordHeaderSize;
+	header->numStreams = config.size();
+
+	ContainerStream *streams =
+		reinterpret_cast<ContainerStream *>(header + 1);
+
+	streamIndices_.clear();
+
+	for (unsigned int i = 0; i < config.size(); ++i) {
+		const StreamConfiguration &cfg = config.at(i);
+		ContainerStream &stream = streams[i];
+
+		strncpy(stream.name, streamNames_[cfg.stream()].c_str(),
+			sizeof(stream.name) - 1);
+		stream.fourcc = cfg.pixelFormat.fourcc();
+		stream.modifier = cfg.pixelFormat.modifier();
+		stream.width = cfg.size.width;
+		stream.height = cfg.size.height;
+		stream.stride = cfg.stride;
+		stream.frameSize = cfg.frameSize;
+
+		streamIndices_[cfg.stream()] = i;
+	}
+
 	return 0;
 }
 
@@ -48,50 +175,319 @@ void FileSink::mapBuffer(FrameBuffer *buffer)
 	mappedBuffers_[buffer] = std::move(image);
 }
 
+int FileSink::start()
+{
+	int ret = FrameSink::start();
+	if (ret < 0)
+		return ret;
+
+	if (container_) {
+		ret = openContainer();
+		if (ret < 0)
+			return ret;
+	} else if (singleFile_) {
+		bool direct;
+
+		fd_ = openFile(pattern_, O_CREAT | O_WRONLY, &direct);
+		if (fd_ < 0)
+			return fd_;
+
+		/*
+		 * Append to the existing content. Direct I/O requires aligned
+		 * offsets, the index records where each frame is stored.
+		 */
+		offset_ = lseek(fd_, 0, SEEK_END);
+		if (direct)
+			offset_ = alignUp(offset_, kDirectIOAlignment);
+
+		std::string indexName = pattern_ + ".idx";
+		index_.open(indexName, std::ios::out | std::ios::app);
+		if (!index_) {
+			std::cerr << "failed to open index file " << indexName
+				  << std::endl;
+			close(fd_);
+			fd_ = -1;
+			return -EIO;
+		}
+
+		if (index_.tellp() == 0)
+			index_ << "# stream sequence offset plane-lengths..."
+			       << std::endl;
+	}
+
+#ifdef HAVE_LIBURING
+	ret = io_uring_queue_init(kQueueDepth, &ring_, 0);
+	if (ret < 0)
+		std::cerr << "io_uring unavailable (" << strerror(-ret)
+			  << "), falling back to pwritev" << std::endl;
+	ringValid_ = ret == 0;
+#endif
+
+	lastSequence_.clear();
+	framesDropped_ = 0;
+	framesWritten_ = 0;
+	writeErrors_ = 0;
+	bytesWritten_ = 0;
+	startTime_ = std::chrono::steady_clock::now();
+
+	loop_ = EventLoop::instance();
+	running_ = true;
+	thread_ = std::thread(&FileSink::run, this);
+
+	return 0;
+}
+
+int FileSink::openContainer()
+{
+	bool direct;
+
+	fd_ = openFile(pattern_, O_CREAT | O_WRONLY | O_TRUNC, &direct);
+	if (fd_ < 0)
+		return fd_;
+
+	/*
+	 * Preallocate the file without changing its size, so that a capture
+	 * shorter than expected doesn't leave garbage at the end.
+	 */
+	if (preallocate_ &&
+	    fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, preallocate_) < 0) {
+		int ret = -errno;
+		std::cerr << "failed to preallocate " << pattern_ << ": "
+			  << strerror(-ret) << std::endl;
+	}
+
+	void *data;
+	if (posix_memalign(&data, kDirectIOAlignment, kRecordHeaderSize)) {
+		close(fd_);
+		fd_ = -1;
+		return -ENOMEM;
+	}
+
+	/* Direct I/O requires an aligned copy of the header. */
+	std::unique_ptr<uint8_t, FreeDeleter> block(static_cast<uint8_t *>(data));
+	memcpy(data, containerHeader_.data(), kRecordHeaderSize);
+
+	ssize_t ret = pwrite(fd_, data, kRecordHeaderSize, 0);
+	if (ret != static_cast<ssize_t>(kRecordHeaderSize)) {
+		ret = ret < 0 ? -errno : -EIO;
+		std::cerr << "failed to write container header: "
+			  << strerror(-ret) << std::endl;
+		close(fd_);
+		fd_ = -1;
+		return ret;
+	}
+
+	offset_ = kRecordHeaderSize;
+
+	return 0;
+}
+
+int FileSink::stop()
+{
+	if (!thread_.joinable())
+		return 0;
+
+	/* Let the writer thread complete the pending writes. */
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		running_ = false;
+	}
+	cv_.notify_one();
+
+	thread_.join();
+
+#ifdef HAVE_LIBURING
+	if (ringValid_) {
+		io_uring_queue_exit(&ring_);
+		ringValid_ = false;
+	}
+#endif
+
+	if (fd_ >= 0) {
+		close(fd_);
+		fd_ = -1;
+	}
+
+	if (index_.is_open())
+		index_.close();
+
+	std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - startTime_;
+	double megabytes = bytesWritten_ / 1000000.0;
+
+	std::cout << "Wrote " << framesWritten_ << " frames, "
+		  << std::fixed << std::setprecision(2) << megabytes << " MB in "
+		  << elapsed.count() << " s ("
+		  << (elapsed.count() ? megabytes / elapsed.count() : 0.0)
+		  << " MB/s), " << framesDropped_ << " frames dropped";
+	if (writeErrors_)
+		std::cout << ", " << writeErrors_ << " write errors";
+	std::cout << std::endl;
+
+	return FrameSink::stop();
+}
+
 bool FileSink::processRequest(Request *request)
 {
-	for (auto [stream, buffer] : request->buffers())
-		writeBuffer(stream, buffer);
+	/*
+	 * Account for the frames missed by the camera, usually because all
+	 * buffers were waiting to be written to disk.
+	 */
+	for (auto [stream, buffer] : request->buffers()) {
+		unsigned int sequence = buffer->metadata().sequence;
+
+		auto it = lastSequence_.find(stream);
+		if (it != lastSequence_.end() && sequence > it->second + 1)
+			framesDropped_ += sequence - it->second - 1;
+
+		lastSequence_[stream] = sequence;
+	}
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		queue_.push_back(request);
+	}
+	cv_.notify_one();
+
+	/* The request is released once written, from the writer thread. */
+	return false;
+}
+
+void FileSink::run()
+{
+	while (true) {
+		std::deque<Request *> requests;
+
+		{
+			std::unique_lock<std::mutex> locker(mutex_);
+			cv_.wait(locker, [&] { return !running_ || !queue_.empty(); });
+			if (queue_.empty())
+				break;
 
-	return true;
+			requests.swap(queue_);
+		}
+
+		writeRequests(requests);
+
+		for (Request *request : requests)
+			loop_->callLater([this, request]() {
+				requestProcessed.emit(request);
+			});
+	}
 }
 
-void FileSink::writeBuffer(const Stream *stream, FrameBuffer *buffer)
+/*
+ * Write all the buffers of a batch of requests. When the writer falls behind,
+ * batches grow, and the writes of multiple frames are in flight concurrently.
+ */
+void FileSink::writeRequests(const std::deque<Request *> &requests)
 {
-	std::string filename;
-	size_t pos;
-	int fd, ret = 0;
+	std::vector<Write> writes;
+
+	for (Request *request : requests) {
+		for (auto [stream, buffer] : request->buffers()) {
+			Write write = {};
+			write.request = request;
+			write.stream = stream;
+			write.buffer = buffer;
+			write.fd = -1;
+			writes.push_back(std::move(write));
+		}
+	}
+
+	if (stagingBuffers_.size() < writes.size())
+		stagingBuffers_.resize(writes.size());
+
+	for (unsigned int i = 0; i < writes.size(); ++i) {
+		Write &write = writes[i];
+
+		if (singleFile_) {
+			write.fd = fd_;
+			write.direct = fcntl(fd_, F_GETFL) & O_DIRECT;
+		} else {
+			std::string filename = pattern_;
+			size_t pos = filename.find_first_of('#');
+			std::stringstream ss;
+			ss << streamNames_[write.stream] << "-" << std::setw(6)
+			   << std::setfill('0') << write.buffer->metadata().sequence;
+			filename.replace(pos, 1, ss.str());
 
-	if (!pattern_.empty())
-		filename = pattern_;
+			write.fd = openFile(filename, O_CREAT | O_WRONLY | O_TRUNC,
+					    &write.direct);
+			if (write.fd < 0) {
+				write.result = write.fd;
+				continue;
+			}
+		}
+
+		int ret = prepareWrite(write, stagingBuffers_[i]);
+		if (ret < 0) {
+			write.result = ret;
+			continue;
+		}
+
+		if (singleFile_) {
+			write.offset = offset_;
+			offset_ += write.paddedLength;
+		}
+	}
 
-	if (filename.empty() || filename.back() == '/')
-		filename += "frame-#.bin";
+	submitWrites(writes);
 
-	pos = filename.find_first_of('#');
-	if (pos != std::string::npos) {
-		std::stringstream ss;
-		ss << streamNames_[stream] << "-" << std::setw(6)
-		   << std::setfill('0') << buffer->metadata().sequence;
-		filename.replace(pos, 1, ss.str());
+	for (unsigned int i = 0; i < writes.size(); ++i)
+		completeWrite(writes[i], stagingBuffers_[i]);
+}
+
+int FileSink::openFile(const std::string &filename, int flags, bool *direct)
+{
+	int fd = -1;
+
+	*direct = directIO_;
+
+	if (*direct) {
+		fd = open(filename.c_str(), flags | O_DIRECT,
+			  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+		if (fd == -1 && errno == EINVAL) {
+			std::cerr << "direct I/O not supported for " << filename
+				  << ", disabling it" << std::endl;
+			directIO_ = false;
+			*direct = false;
+		}
 	}
 
-	fd = open(filename.c_str(), O_CREAT | O_WRONLY |
-		  (pos == std::string::npos ? O_APPEND : O_TRUNC),
-		  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+	if (!*direct)
+		fd = open(filename.c_str(), flags,
+			  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+
 	if (fd == -1) {
-		ret = -errno;
+		int ret = -errno;
 		std::cerr << "failed to open file " << filename << ": "
 			  << strerror(-ret) << std::endl;
-		return;
+		return ret;
 	}
 
-	Image *image = mappedBuffers_[buffer].get();
+	return fd;
+}
+
+/*
+ * Build the I/O vector for a buffer. Direct I/O writes the aligned part of
+ * the planes straight from the mapped buffer, and copies the rest through a
+ * staging buffer, padded to the alignment. In container mode, the record
+ * header is stored at the beginning of the staging buffer.
+ */
+int FileSink::prepareWrite(Write &write, StagingBuffer &staging)
+{
+	const FrameMetadata &metadata = write.buffer->metadata();
+
+	write.image = mappedBuffers_[write.buffer].get();
+	write.image->beginAccess();
 
-	for (unsigned int i = 0; i < buffer->planes().size(); ++i) {
-		const FrameMetadata::Plane &meta = buffer->metadata().planes()[i];
+	write.planeLengths.clear();
+	write.length = 0;
 
-		Span<uint8_t> data = image->data(i);
+	for (unsigned int i = 0; i < write.buffer->planes().size(); ++i) {
+		const FrameMetadata::Plane &meta = metadata.planes()[i];
+		Span<uint8_t> data = write.image->data(i);
 		unsigned int length = std::min<unsigned int>(meta.bytesused, data.size());
 
 		if (meta.bytesused > data.size())
@@ -99,19 +495,278 @@ void FileSink::writeBuffer(const Stream *stream, FrameBuffer *buffer)
 				  << " larger than plane size " << data.size()
 				  << std::endl;
 
-		ret = ::write(fd, data.data(), length);
+		write.planeLengths.push_back(length);
+		write.length += length;
+	}
+
+	size_t headerSize = container_ ? kRecordHeaderSize : 0;
+	size_t stagingSize = headerSize + alignUp(write.length, kDirectIOAlignment);
+	if ((write.direct || container_) && staging.size < stagingSize) {
+		void *data;
+		if (posix_memalign(&data, kDirectIOAlignment, stagingSize))
+			data = nullptr;
+
+		staging.data.reset(static_cast<uint8_t *>(data));
+		staging.size = data ? stagingSize : 0;
+
+		if (!data)
+			return -ENOMEM;
+	}
+
+	write.iov.clear();
+	write.paddedLength = 0;
+
+	if (container_) {
+		fillRecordHeader(write, staging.data.get());
+		write.iov.push_back({ staging.data.get(), kRecordHeaderSize });
+	}
+
+	uint8_t *stage = staging.data.get() + headerSize;
+	size_t staged = 0;
+
+	for (unsigned int i = 0; i < write.planeLengths.size(); ++i) {
+		uint8_t *data = write.image->data(i).data();
+		size_t length = write.planeLengths[i];
+
+		if (!write.direct) {
+			write.iov.push_back({ data, length });
+			continue;
+		}
+
+		/*
+		 * Once data has been staged, the following planes must be
+		 * staged too to keep the file contiguous.
+		 */
+		if (!staged && !bounce_ &&
+		    !(reinterpret_cast<uintptr_t>(data) % kDirectIOAlignment)) {
+			size_t head = length - length % kDirectIOAlignment;
+			if (head)
+				write.iov.push_back({ data, head });
+
+			data += head;
+			length -= head;
+		}
+
+		memcpy(stage + staged, data, length);
+		staged += length;
+	}
+
+	if (staged) {
+		size_t padded = alignUp(staged, kDirectIOAlignment);
+		memset(stage + staged, 0, padded - staged);
+		write.iov.push_back({ stage, padded });
+	} else if (container_) {
+		/* Records are aligned, to allow direct I/O on replay. */
+		size_t padding = alignUp(write.length, kDirectIOAlignment) - write.length;
+		if (padding)
+			write.iov.push_back({ const_cast<uint8_t *>(zeroes), padding });
+	}
+
+	for (const struct iovec &iov : write.iov)
+		write.paddedLength += iov.iov_len;
+
+	return 0;
+}
+
+/*
+ * The record header describes the buffer, and carries the request metadata
+ * as text, in the same format as printed by the --metadata option.
+ */
+void FileSink::fillRecordHeader(const Write &write, uint8_t *data)
+{
+	const FrameMetadata &metadata = write.buffer->metadata();
+	ContainerRecordHeader *header = reinterpret_cast<ContainerRecordHeader *>(data);
+
+	memset(data, 0, kRecordHeaderSize);
+	memcpy(header->magic, kContainerRecordMagic, sizeof(header->magic));
+	header->stream = streamIndices_[write.stream];
+	header->recordSize = kRecordHeaderSize
+			   + alignUp(write.length, kDirectIOAlignment);
+	header->timestamp = metadata.timestamp;
+	header->sequence = metadata.sequence;
+	header->status = metadata.status;
+	header->numPlanes = std::min<size_t>(write.planeLengths.size(),
+					     std::size(header->planeLengths));
+	for (unsigned int i = 0; i < header->numPlanes; ++i)
+		header->planeLengths[i] = write.planeLengths[i];
+
+	std::stringstream ss;
+	for (const auto &[id, value] : write.request->metadata()) {
+		const ControlId *ctrl = controls::controls.at(id);
+		ss << ctrl->name() << " = " << value.toString() << "\n";
+	}
+
+	std::string text = ss.str();
+	size_t size = std::min(text.size(), kRecordHeaderSize - sizeof(*header));
+	memcpy(data + sizeof(*header), text.data(), size);
+	header->metadataSize = size;
+}
+
+void FileSink::submitWrites(std::vector<Write> &writes)
+{
+#ifdef HAVE_LIBURING
+	std::vector<Write *> pending;
+
+	for (Write &write : writes) {
+		if (!write.result)
+			pending.push_back(&write);
+	}
+
+	for (size_t i = 0; ringValid_ && i < pending.size(); i += kQueueDepth) {
+		unsigned int count = std::min<size_t>(kQueueDepth, pending.size() - i);
+
+		for (unsigned int j = 0; j < count; ++j) {
+			Write *write = pending[i + j];
+			struct io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+
+			io_uring_prep_writev(sqe, write->fd, write->iov.data(),
+					     write->iov.size(), write->offset);
+			io_uring_sqe_set_data(sqe, write);
+			write->result = -EINPROGRESS;
+		}
+
+		unsigned int submitted = 0;
+		int error = 0;
+
+		while (submitted < count) {
+			int ret = io_uring_submit(&ring_);
+			if (ret <= 0) {
+				error = ret < 0 ? ret : -EAGAIN;
+				break;
+			}
+
+			submitted += ret;
+		}
+
+		for (unsigned int j = 0; j < submitted; ++j) {
+			struct io_uring_cqe *cqe;
+			int ret;
+
+			do {
+				ret = io_uring_wait_cqe(&ring_, &cqe);
+			} while (ret == -EINTR);
+
+			if (ret < 0) {
+				error = ret;
+				break;
+			}
+
+			Write *write = static_cast<Write *>(io_uring_cqe_get_data(cqe));
+			write->result = cqe->res;
+			io_uring_cqe_seen(&ring_, cqe);
+		}
+
+		/*
+		 * Tear the ring down on errors, as it may still reference
+		 * writes that are about to be completed synchronously.
+		 */
+		if (error) {
+			std::cerr << "io_uring error: " << strerror(-error)
+				  << ", falling back to pwritev" << std::endl;
+			io_uring_queue_exit(&ring_);
+			ringValid_ = false;
+		}
+	}
+
+	/* Complete the writes not handled by io_uring synchronously. */
+	for (Write *write : pending) {
+		if (write->result == -EINPROGRESS)
+			write->result = 0;
+	}
+#endif
+
+	for (Write &write : writes) {
+		if (!write.result)
+			write.result = writeSync(write);
+	}
+}
+
+/* Write the buffer, or its remaining part, with pwritev(). */
+ssize_t FileSink::writeSync(Write &write, size_t done)
+{
+	while (done < write.paddedLength) {
+		std::vector<struct iovec> iov;
+		size_t skip = done;
+
+		for (const struct iovec &vec : write.iov) {
+			if (skip >= vec.iov_len) {
+				skip -= vec.iov_len;
+				continue;
+			}
+
+			iov.push_back({ static_cast<uint8_t *>(vec.iov_base) + skip,
+					vec.iov_len - skip });
+			skip = 0;
+		}
+
+		ssize_t ret = pwritev(write.fd, iov.data(), iov.size(),
+				      write.offset + done);
 		if (ret < 0) {
-			ret = -errno;
-			std::cerr << "write error: " << strerror(-ret)
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (ret == 0)
+			return -EIO;
+
+		done += ret;
+	}
+
+	return done;
+}
+
+void FileSink::completeWrite(Write &write, StagingBuffer &staging)
+{
+	/*
+	 * Some dmabuf exporters don't support direct I/O from their mappings.
+	 * Copy all data through the staging buffer in that case, the padded
+	 * size, and thus the file layout, doesn't change.
+	 */
+	if (write.result == -EFAULT && write.direct) {
+		if (!bounce_)
+			std::cerr << "direct I/O from mapped buffers failed, "
+				  << "using a staging buffer" << std::endl;
+		bounce_ = true;
+
+		write.image->endAccess();
+		write.result = prepareWrite(write, staging);
+		if (!write.result)
+			write.result = writeSync(write);
+	} else if (write.result >= 0 &&
+		   static_cast<size_t>(write.result) < write.paddedLength) {
+		write.result = writeSync(write, write.result);
+	}
+
+	if (write.image)
+		write.image->endAccess();
+
+	if (write.result < 0) {
+		if (write.fd >= 0)
+			std::cerr << "write error: " << strerror(-write.result)
+				  << std::endl;
+		writeErrors_++;
+	} else {
+		framesWritten_++;
+		bytesWritten_ += write.length;
+
+		/* Remove the padding at the end of the file. */
+		if (!singleFile_ && write.paddedLength != write.length &&
+		    ftruncate(write.fd, write.length) < 0) {
+			int ret = -errno;
+			std::cerr << "failed to truncate file: " << strerror(-ret)
 				  << std::endl;
-			break;
-		} else if (ret != (int)length) {
-			std::cerr << "write error: only " << ret
-				  << " bytes written instead of "
-				  << length << std::endl;
-			break;
+		}
+
+		if (index_.is_open()) {
+			index_ << streamNames_[write.stream] << " "
+			       << write.buffer->metadata().sequence << " "
+			       << write.offset;
+			for (unsigned int length : write.planeLengths)
+				index_ << " " << length;
+			index_ << "\n";
 		}
 	}
 
-	close(fd);
+	if (!singleFile_ && write.fd >= 0)
+		close(write.fd);
 }
@@ -7,34 +7,134 @@
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <stdint.h>
 #include <string>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 
 #include <libcamera/stream.h>
 
 #include "frame_sink.h"
 
+class EventLoop;
 class Image;
 
 class FileSink : public FrameSink
 {
 public:
 	FileSink(const std::map<const libcamera::Stream *, std::string> &streamNames,
-		 const std::string &pattern = "");
+		 const std::string &pattern = "", bool directIO = false,
+		 bool container = false, uint64_t preallocate = 0);
 	~FileSink();
 
 	int configure(const libcamera::CameraConfiguration &config) override;
 
 	void mapBuffer(libcamera::FrameBuffer *buffer) override;
 
+	int start() override;
+	int stop() override;
+
 	bool processRequest(libcamera::Request *request) override;
 
 private:
-	void writeBuffer(const libcamera::Stream *stream,
-			 libcamera::FrameBuffer *buffer);
+	/* Alignment of buffers, offsets and sizes for O_DIRECT writes. */
+	static constexpr size_t kDirectIOAlignment = 4096;
+	static constexpr unsigned int kQueueDepth = 16;
+	/* Size of the container file and record headers. */
+	static constexpr size_t kRecordHeaderSize = kDirectIOAlignment;
+
+	struct FreeDeleter {
+		void operator()(void *ptr) { free(ptr); }
+	};
+
+	struct StagingBuffer {
+		std::unique_ptr<uint8_t, FreeDeleter> data;
+		size_t size = 0;
+	};
+
+	struct Write {
+		libcamera::Request *request;
+		const libcamera::Stream *stream;
+		libcamera::FrameBuffer *buffer;
+		Image *image;
+
+		int fd;
+		bool direct;
+		off_t offset;
+		std::vector<unsigned int> planeLengths;
+		size_t length;
+		size_t paddedLength;
+		std::vector<struct iovec> iov;
+		ssize_t result;
+	};
+
+	void run();
+	void writeRequests(const std::deque<libcamera::Request *> &requests);
+
+	int openFile(const std::string &filename, int flags, bool *direct);
+	int openContainer();
+	int prepareWrite(Write &write, StagingBuffer &staging);
+	void fillRecordHeader(const Write &write, uint8_t *data);
+	void submitWrites(std::vector<Write> &writes);
+	ssize_t writeSync(Write &write, size_t done = 0);
+	void completeWrite(Write &write, StagingBuffer &staging);
 
 	std::map<const libcamera::Stream *, std::string> streamNames_;
 	std::string pattern_;
 	std::map<libcamera::FrameBuffer *, std::unique_ptr<Image>> mappedBuffers_;
+
+	/*
+	 * Writer thread and the queue of requests shared with it. Processed
+	 * requests are released through the event loop of the thread that
+	 * started the sink.
+	 */
+	std::thread thread_;
+	EventLoop *loop_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<libcamera::Request *> queue_;
+	bool running_;
+
+	/* Accessed by the writer thread only while it runs. */
+	bool directIO_;
+	bool bounce_;
+	std::vector<StagingBuffer> stagingBuffers_;
+#ifdef HAVE_LIBURING
+	struct io_uring ring_;
+	bool ringValid_;
+#endif
+
+	/*
+	 * Single file mode, with an index of the frames in a sidecar file, or
+	 * in a container with a header per frame.
+	 */
+	bool singleFile_;
+	bool container_;
+	uint64_t preallocate_;
+	std::map<const libcamera::Stream *, unsigned int> streamIndices_;
+	std::vector<uint8_t> containerHeader_;
+	int fd_;
+	off_t offset_;
+	std::ofstream index_;
+
+	/* Statistics, framesDropped_ is accessed by the event loop thread. */
+	std::map<const libcamera::Stream *, unsigned int> lastSequence_;
+	unsigned int framesDropped_;
+	unsigned int framesWritten_;
+	unsigned int writeErrors_;
+	uint64_t bytesWritten_;
+	std::chrono::steady_clock::time_point startTime_;
 };
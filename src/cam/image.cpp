@@ -10,8 +10,10 @@
 #include <assert.h>
 #include <errno.h>
 #include <iostream>
+#include <linux/dma-buf.h>
 #include <map>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
@@ -25,11 +27,15 @@ std::unique_ptr<Image> Image::fromFrameBuffer(const FrameBuffer *buffer, MapMode
 
 	int mmapFlags = 0;
 
-	if (mode & MapMode::ReadOnly)
+	if (mode & MapMode::ReadOnly) {
 		mmapFlags |= PROT_READ;
+		image->syncFlags_ |= DMA_BUF_SYNC_READ;
+	}
 
-	if (mode & MapMode::WriteOnly)
+	if (mode & MapMode::WriteOnly) {
 		mmapFlags |= PROT_WRITE;
+		image->syncFlags_ |= DMA_BUF_SYNC_WRITE;
+	}
 
 	struct MappedBufferInfo {
 		uint8_t *address = nullptr;
@@ -75,6 +81,7 @@ std::unique_ptr<Image> Image::fromFrameBuffer(const FrameBuffer *buffer, MapMode
 
 			info.address = static_cast<uint8_t *>(address);
 			image->maps_.emplace_back(info.address, info.mapLength);
+			image->fds_.push_back(fd);
 		}
 
 		image->planes_.emplace_back(info.address + plane.offset, plane.length);
@@ -83,7 +90,10 @@ std::unique_ptr<Image> Image::fromFrameBuffer(const FrameBuffer *buffer, MapMode
 	return image;
 }
 
-Image::Image() = default;
+Image::Image()
+	: syncFlags_(0), accessing_(false)
+{
+}
 
 Image::~Image()
 {
@@ -107,3 +117,44 @@ Span<const uint8_t> Image::data(unsigned int plane) const
 	assert(plane <= planes_.size());
 	return planes_[plane];
 }
+
+/*
+ * Cached dmabuf heaps require CPU access to be bracketed by cache maintenance
+ * operations. beginAccess() and endAccess() shall be called before and after
+ * accessing the image data for every frame.
+ */
+void Image::beginAccess()
+{
+	if (accessing_)
+		return;
+
+	sync(DMA_BUF_SYNC_START | syncFlags_);
+	accessing_ = true;
+}
+
+void Image::endAccess()
+{
+	if (!accessing_)
+		return;
+
+	sync(DMA_BUF_SYNC_END | syncFlags_);
+	accessing_ = false;
+}
+
+void Image::sync(uint64_t flags)
+{
+	struct dma_buf_sync sync = {};
+	sync.flags = flags;
+
+	for (int fd : fds_) {
+		int ret;
+		do {
+			ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+		} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+		/* Not all buffers are dmabufs, ignore ENOTTY. */
+		if (ret < 0 && errno != ENOTTY)
+			std::cerr << "Failed to synchronize dmabuf: "
+				  << strerror(errno) << std::endl;
+	}
+}
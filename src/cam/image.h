@@ -36,13 +36,22 @@ public:
 	libcamera::Span<uint8_t> data(unsigned int plane);
 	libcamera::Span<const uint8_t> data(unsigned int plane) const;
 
+	void beginAccess();
+	void endAccess();
+
 private:
 	LIBCAMERA_DISABLE_COPY(Image)
 
 	Image();
 
+	void sync(uint64_t flags);
+
 	std::vector<libcamera::Span<uint8_t>> maps_;
 	std::vector<libcamera::Span<uint8_t>> planes_;
+
+	std::vector<int> fds_;
+	uint64_t syncFlags_;
+	bool accessing_;
 };
 
 namespace libcamera {
@@ -0,0 +1,572 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Ideas on Board Oy
+ *
+ * kms_display.cpp - KMS display shared by multiple sinks
+ */
+
+#include "kms_display.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <iostream>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libcamera/formats.h>
+
+/* Maximum time to wait for the last page flip when stopping, in ms. */
+static constexpr int kFlipTimeout = 100;
+
+KMSDisplay::Flip::~Flip()
+{
+	if (outFence_ != -1)
+		close(outFence_);
+}
+
+/*
+ * The display is shared by all the camera sessions that show their viewfinder
+ * on the same connector. Each session owns a view, displayed on its own plane
+ * in a tile of the screen, and the frames of all views are committed together
+ * in a single atomic request, so that all planes are updated in the same page
+ * flip.
+ *
+ * The display must be created from the main thread, as page flip events are
+ * handled by the event loop of the thread that opens the DRM device, and must
+ * keep being handled when individual sessions stop.
+ */
+KMSDisplay::KMSDisplay(const std::string &connectorName)
+	: connector_(nullptr), crtc_(nullptr), mode_(nullptr),
+	  hasOutFence_(false), startedViews_(0), pipelineEnabled_(false)
+{
+	int ret = dev_.init();
+	if (ret < 0)
+		return;
+
+	/*
+	 * Find the requested connector. If no specific connector is requested,
+	 * pick the first connected connector or, if no connector is connected,
+	 * the first connector with unknown status.
+	 */
+	for (const DRM::Connector &conn : dev_.connectors()) {
+		if (!connectorName.empty()) {
+			if (conn.name() != connectorName)
+				continue;
+
+			connector_ = &conn;
+			break;
+		}
+
+		if (conn.status() == DRM::Connector::Connected) {
+			connector_ = &conn;
+			break;
+		}
+
+		if (!connector_ && conn.status() == DRM::Connector::Unknown)
+			connector_ = &conn;
+	}
+
+	if (!connector_) {
+		if (!connectorName.empty())
+			std::cerr
+				<< "Connector " << connectorName << " not found"
+				<< std::endl;
+		else
+			std::cerr << "No connected connector found" << std::endl;
+		return;
+	}
+
+	dev_.requestComplete.connect(this, &KMSDisplay::requestComplete);
+}
+
+/*
+ * Reserve a view on the display. All views must be added before the first one
+ * is configured, as the display is divided in tiles based on the number of
+ * views.
+ */
+unsigned int KMSDisplay::addView()
+{
+	std::lock_guard<std::mutex> lock(lock_);
+
+	View view{};
+	views_.push_back(view);
+
+	return views_.size() - 1;
+}
+
+int KMSDisplay::configureView(unsigned int index,
+			      const libcamera::PixelFormat &format,
+			      const libcamera::Size &size, ReleaseFunction release,
+			      libcamera::PixelFormat *planeFormat)
+{
+	if (!connector_)
+		return -EINVAL;
+
+	std::lock_guard<std::mutex> lock(lock_);
+
+	if (index >= views_.size())
+		return -EINVAL;
+
+	View &view = views_[index];
+	view.plane = nullptr;
+
+	if (!mode_) {
+		int ret = selectMode(size);
+		if (ret < 0)
+			return ret;
+	}
+
+	/*
+	 * Find a CRTC suitable for the connector at the end of the pipeline
+	 * when configuring the first view. All other views share the same CRTC
+	 * and use its remaining planes.
+	 */
+	if (crtc_) {
+		view.plane = findPlane(crtc_, format, planeFormat);
+	} else {
+		for (const DRM::Encoder *encoder : connector_->encoders()) {
+			for (const DRM::Crtc *crtc : encoder->possibleCrtcs()) {
+				view.plane = findPlane(crtc, format, planeFormat);
+				if (view.plane) {
+					crtc_ = crtc;
+					break;
+				}
+			}
+
+			if (crtc_)
+				break;
+		}
+
+		/* Out-fences are optional, drivers without them are still usable. */
+		if (crtc_)
+			hasOutFence_ = crtc_->property("OUT_FENCE_PTR") != nullptr;
+	}
+
+	if (!view.plane) {
+		std::cerr
+			<< "Unable to find display pipeline for format "
+			<< format.toString() << std::endl;
+
+		return -EPIPE;
+	}
+
+	std::cout
+		<< "Using KMS plane " << view.plane->id() << ", CRTC " << crtc_->id()
+		<< ", connector " << connector_->name()
+		<< " (" << connector_->id() << ")" << std::endl;
+
+	view.size = size;
+	view.release = std::move(release);
+
+	return 0;
+}
+
+/*
+ * Find a plane of the CRTC that isn't used by another view and supports the
+ * requested format. If the format has an alpha channel, also consider the X
+ * variant. Primary planes are preferred, as the CRTC needs one to be enabled
+ * on some devices, and cursor planes are never used.
+ */
+const DRM::Plane *KMSDisplay::findPlane(const DRM::Crtc *crtc,
+					const libcamera::PixelFormat &format,
+					libcamera::PixelFormat *planeFormat) const
+{
+	libcamera::PixelFormat xFormat;
+
+	switch (format) {
+	case libcamera::formats::ABGR8888:
+		xFormat = libcamera::formats::XBGR8888;
+		break;
+	case libcamera::formats::ARGB8888:
+		xFormat = libcamera::formats::XRGB8888;
+		break;
+	case libcamera::formats::BGRA8888:
+		xFormat = libcamera::formats::BGRX8888;
+		break;
+	case libcamera::formats::RGBA8888:
+		xFormat = libcamera::formats::RGBX8888;
+		break;
+	}
+
+	for (DRM::Plane::Type type : { DRM::Plane::TypePrimary, DRM::Plane::TypeOverlay }) {
+		for (const DRM::Plane *plane : crtc->planes()) {
+			if (plane->type() != type)
+				continue;
+
+			auto used = std::find_if(views_.begin(), views_.end(),
+						 [&](const View &view) {
+							 return view.plane == plane;
+						 });
+			if (used != views_.end())
+				continue;
+
+			if (plane->supportsFormat(format)) {
+				*planeFormat = format;
+				return plane;
+			}
+
+			if (plane->supportsFormat(xFormat)) {
+				*planeFormat = xFormat;
+				return plane;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+/*
+ * Select the display mode and divide the display in a grid of equally sized
+ * tiles, one per view.
+ */
+int KMSDisplay::selectMode(const libcamera::Size &size)
+{
+	const std::vector<DRM::Mode> &modes = connector_->modes();
+	if (modes.empty()) {
+		std::cerr
+			<< "Connector " << connector_->name() << " has no mode"
+			<< std::endl;
+		return -EINVAL;
+	}
+
+	/*
+	 * With a single view, use the mode matching the frame size if there's
+	 * one. Otherwise use the preferred mode, the frames will be scaled or
+	 * cropped to fit their tile.
+	 */
+	auto iter = modes.end();
+	if (views_.size() == 1)
+		iter = std::find_if(modes.begin(), modes.end(),
+				    [&](const DRM::Mode &mode) {
+					    return mode.hdisplay == size.width &&
+						   mode.vdisplay == size.height;
+				    });
+	if (iter == modes.end())
+		iter = std::find_if(modes.begin(), modes.end(),
+				    [](const DRM::Mode &mode) {
+					    return mode.type & DRM_MODE_TYPE_PREFERRED;
+				    });
+	if (iter == modes.end())
+		iter = modes.begin();
+
+	mode_ = &*iter;
+
+	const unsigned int count = views_.size();
+	unsigned int columns = 1;
+	while (columns * columns < count)
+		columns++;
+	const unsigned int rows = (count + columns - 1) / columns;
+
+	const libcamera::Size tileSize(mode_->hdisplay / columns,
+				       mode_->vdisplay / rows);
+
+	for (unsigned int i = 0; i < count; ++i)
+		views_[i].tile = libcamera::Rectangle((i % columns) * tileSize.width,
+						      (i / columns) * tileSize.height,
+						      tileSize);
+
+	return 0;
+}
+
+/*
+ * Select the position of the frames in the view's tile. KMS doesn't report
+ * whether a plane can scale, so test a configuration that scales the frames to
+ * fill the tile, preserving their aspect ratio, and fall back to direct
+ * scanout of the frames at their native size, centered and cropped to the
+ * tile.
+ */
+int KMSDisplay::configureScanout(View &view, const DRM::FrameBuffer *drmBuffer)
+{
+	const libcamera::Size tile = view.tile.size();
+	const libcamera::Point center = view.tile.center();
+	int ret;
+
+	if (view.size != tile) {
+		view.src = libcamera::Rectangle(view.size);
+		view.dst = tile.boundedToAspectRatio(view.size).centeredTo(center);
+
+		DRM::AtomicRequest request(&dev_);
+		setupPipeline(&request);
+		setupPlane(&request, view, drmBuffer);
+
+		ret = request.commit(DRM::AtomicRequest::FlagTestOnly |
+				     DRM::AtomicRequest::FlagAllowModeset);
+		if (ret == 0) {
+			std::cout
+				<< "Scaling " << view.size.toString() << " to "
+				<< view.dst.toString() << std::endl;
+			return 0;
+		}
+
+		std::cout
+			<< "Plane " << view.plane->id()
+			<< " can't scale, using direct scanout" << std::endl;
+	}
+
+	const libcamera::Size visible = view.size.boundedTo(tile);
+	view.src = visible.centeredTo({ static_cast<int>(view.size.width / 2),
+					static_cast<int>(view.size.height / 2) });
+	view.dst = visible.centeredTo(center);
+
+	DRM::AtomicRequest request(&dev_);
+	setupPipeline(&request);
+	setupPlane(&request, view, drmBuffer);
+
+	ret = request.commit(DRM::AtomicRequest::FlagTestOnly |
+			     DRM::AtomicRequest::FlagAllowModeset);
+	if (ret < 0) {
+		std::cerr
+			<< "Display pipeline configuration rejected: "
+			<< strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	return 0;
+}
+
+void KMSDisplay::setupPipeline(DRM::AtomicRequest *request)
+{
+	request->addProperty(connector_, "CRTC_ID", crtc_->id());
+
+	request->addProperty(crtc_, "ACTIVE", 1);
+	request->addProperty(crtc_, "MODE_ID", mode_->toBlob(&dev_));
+}
+
+void KMSDisplay::setupPlane(DRM::AtomicRequest *request, const View &view,
+			    const DRM::FrameBuffer *drmBuffer)
+{
+	const DRM::Plane *plane = view.plane;
+
+	request->addProperty(plane, "FB_ID", drmBuffer->id());
+	request->addProperty(plane, "CRTC_ID", crtc_->id());
+	request->addProperty(plane, "SRC_X", view.src.x << 16);
+	request->addProperty(plane, "SRC_Y", view.src.y << 16);
+	request->addProperty(plane, "SRC_W", view.src.width << 16);
+	request->addProperty(plane, "SRC_H", view.src.height << 16);
+	request->addProperty(plane, "CRTC_X", view.dst.x);
+	request->addProperty(plane, "CRTC_Y", view.dst.y);
+	request->addProperty(plane, "CRTC_W", view.dst.width);
+	request->addProperty(plane, "CRTC_H", view.dst.height);
+}
+
+int KMSDisplay::startView(unsigned int index, const DRM::FrameBuffer *drmBuffer)
+{
+	std::lock_guard<std::mutex> lock(lock_);
+
+	View &view = views_[index];
+	if (!view.plane)
+		return -EINVAL;
+
+	/*
+	 * Disable all CRTCs and planes to start from a known valid state when
+	 * starting the first view.
+	 */
+	if (!startedViews_) {
+		DRM::AtomicRequest request(&dev_);
+
+		for (const DRM::Crtc &crtc : dev_.crtcs())
+			request.addProperty(&crtc, "ACTIVE", 0);
+
+		for (const DRM::Plane &plane : dev_.planes()) {
+			request.addProperty(&plane, "CRTC_ID", 0);
+			request.addProperty(&plane, "FB_ID", 0);
+		}
+
+		int ret = request.commit(DRM::AtomicRequest::FlagAllowModeset);
+		if (ret < 0) {
+			std::cerr
+				<< "Failed to disable CRTCs and planes: "
+				<< strerror(-ret) << std::endl;
+			return ret;
+		}
+
+		pipelineEnabled_ = false;
+	}
+
+	int ret = configureScanout(view, drmBuffer);
+	if (ret < 0)
+		return ret;
+
+	view.started = true;
+	startedViews_++;
+
+	return 0;
+}
+
+int KMSDisplay::stopView(unsigned int index)
+{
+	std::lock_guard<std::mutex> lock(lock_);
+
+	View &view = views_[index];
+	if (!view.started)
+		return 0;
+
+	/*
+	 * Let the last frame reach the screen before disabling the plane, and
+	 * the display pipeline when stopping the last view.
+	 */
+	if (queued_ && queued_->outFence_ != -1) {
+		struct pollfd pfd = { queued_->outFence_, POLLIN, 0 };
+		poll(&pfd, 1, kFlipTimeout);
+	}
+
+	DRM::AtomicRequest request(&dev_);
+
+	request.addProperty(view.plane, "CRTC_ID", 0);
+	request.addProperty(view.plane, "FB_ID", 0);
+
+	if (startedViews_ == 1) {
+		request.addProperty(connector_, "CRTC_ID", 0);
+		request.addProperty(crtc_, "ACTIVE", 0);
+		request.addProperty(crtc_, "MODE_ID", 0);
+	}
+
+	int ret = request.commit(DRM::AtomicRequest::FlagAllowModeset);
+	if (ret < 0) {
+		std::cerr
+			<< "Failed to stop display pipeline: "
+			<< strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	if (--startedViews_ == 0)
+		pipelineEnabled_ = false;
+
+	/*
+	 * The frames held by the view are given back by the sink when it frees
+	 * its buffers, drop them without releasing them.
+	 */
+	view.started = false;
+	view.enabled = false;
+	view.release = nullptr;
+	view.pendingBuffer = nullptr;
+	view.pending = nullptr;
+	view.queued = nullptr;
+	view.active = nullptr;
+
+	return 0;
+}
+
+void KMSDisplay::queueFrame(unsigned int index, libcamera::Request *camRequest,
+			    const DRM::FrameBuffer *drmBuffer)
+{
+	std::lock_guard<std::mutex> lock(lock_);
+
+	View &view = views_[index];
+
+	/*
+	 * Only one page flip can be in flight. Frames that arrive in the
+	 * meantime replace the pending frame of their view, whose request is
+	 * given back to the camera right away. This bounds the display latency
+	 * to one frame without holding more than three camera buffers per view.
+	 */
+	if (view.pending)
+		view.release(view.pending);
+
+	view.pending = camRequest;
+	view.pendingBuffer = drmBuffer;
+
+	if (!queued_)
+		commitFrames();
+}
+
+/*
+ * Commit the pending frames of all views in a single atomic request. Views
+ * displayed for the first time get their plane set up, and the display
+ * pipeline is enabled with the first frame.
+ */
+void KMSDisplay::commitFrames()
+{
+	std::unique_ptr<Flip> flip = std::make_unique<Flip>(&dev_);
+	DRM::AtomicRequest *drmRequest = flip->drmRequest_.get();
+	unsigned int flags = DRM::AtomicRequest::FlagAsync;
+	bool empty = true;
+
+	for (View &view : views_) {
+		if (!view.pending)
+			continue;
+
+		if (view.enabled) {
+			drmRequest->addProperty(view.plane, "FB_ID",
+						view.pendingBuffer->id());
+		} else {
+			if (!pipelineEnabled_ &&
+			    !(flags & DRM::AtomicRequest::FlagAllowModeset)) {
+				setupPipeline(drmRequest);
+				flags |= DRM::AtomicRequest::FlagAllowModeset;
+			}
+
+			setupPlane(drmRequest, view, view.pendingBuffer);
+		}
+
+		empty = false;
+	}
+
+	if (empty)
+		return;
+
+	/*
+	 * The out-fence is only requested at commit time, as pending frames
+	 * may be dropped without ever being committed.
+	 */
+	if (hasOutFence_)
+		drmRequest->addProperty(crtc_, "OUT_FENCE_PTR",
+					reinterpret_cast<uintptr_t>(&flip->outFence_));
+
+	int ret = drmRequest->commit(flags);
+	if (ret < 0) {
+		std::cerr
+			<< "Failed to commit atomic request: "
+			<< strerror(-ret) << std::endl;
+
+		for (View &view : views_) {
+			if (!view.pending)
+				continue;
+
+			view.release(view.pending);
+			view.pending = nullptr;
+		}
+
+		return;
+	}
+
+	for (View &view : views_) {
+		if (!view.pending)
+			continue;
+
+		view.queued = view.pending;
+		view.pending = nullptr;
+		view.enabled = true;
+	}
+
+	pipelineEnabled_ = true;
+	queued_ = std::move(flip);
+}
+
+void KMSDisplay::requestComplete(DRM::AtomicRequest *request)
+{
+	std::lock_guard<std::mutex> lock(lock_);
+
+	/* Page flips completing after stopView() have nothing left to release. */
+	if (!queued_ || queued_->drmRequest_.get() != request)
+		return;
+
+	/* The queued frames become active, completing the active ones. */
+	for (View &view : views_) {
+		if (!view.queued)
+			continue;
+
+		if (view.active)
+			view.release(view.active);
+
+		view.active = view.queued;
+		view.queued = nullptr;
+	}
+
+	queued_.reset();
+
+	/* Queue the frames that were received in the meantime, if any. */
+	commitFrames();
+}
@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Ideas on Board Oy
+ *
+ * kms_display.h - KMS display shared by multiple sinks
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "drm.h"
+
+namespace libcamera {
+class Request;
+} /* namespace libcamera */
+
+class KMSDisplay
+{
+public:
+	using ReleaseFunction = std::function<void(libcamera::Request *)>;
+
+	KMSDisplay(const std::string &connectorName);
+
+	bool isValid() const { return connector_ != nullptr; }
+	DRM::Device *device() { return &dev_; }
+
+	unsigned int addView();
+
+	int configureView(unsigned int index, const libcamera::PixelFormat &format,
+			  const libcamera::Size &size, ReleaseFunction release,
+			  libcamera::PixelFormat *planeFormat);
+	int startView(unsigned int index, const DRM::FrameBuffer *drmBuffer);
+	int stopView(unsigned int index);
+
+	void queueFrame(unsigned int index, libcamera::Request *camRequest,
+			const DRM::FrameBuffer *drmBuffer);
+
+private:
+	struct View {
+		const DRM::Plane *plane;
+		libcamera::Size size;
+		ReleaseFunction release;
+
+		/* Area of the display allocated to the view. */
+		libcamera::Rectangle tile;
+		/* Source crop and destination rectangle of the frames on the plane. */
+		libcamera::Rectangle src;
+		libcamera::Rectangle dst;
+
+		bool started;
+		/* Whether the plane has been enabled by a page flip. */
+		bool enabled;
+
+		const DRM::FrameBuffer *pendingBuffer;
+		libcamera::Request *pending;
+		libcamera::Request *queued;
+		libcamera::Request *active;
+	};
+
+	class Flip
+	{
+	public:
+		Flip(DRM::Device *dev)
+			: drmRequest_(std::make_unique<DRM::AtomicRequest>(dev)),
+			  outFence_(-1)
+		{
+		}
+
+		~Flip();
+
+		std::unique_ptr<DRM::AtomicRequest> drmRequest_;
+		/* Signalled when the frames reach the screen. */
+		int outFence_;
+	};
+
+	const DRM::Plane *findPlane(const DRM::Crtc *crtc,
+				    const libcamera::PixelFormat &format,
+				    libcamera::PixelFormat *planeFormat) const;
+	int selectMode(const libcamera::Size &size);
+	int configureScanout(View &view, const DRM::FrameBuffer *drmBuffer);
+	void setupPipeline(DRM::AtomicRequest *request);
+	void setupPlane(DRM::AtomicRequest *request, const View &view,
+			const DRM::FrameBuffer *drmBuffer);
+	void commitFrames();
+	void requestComplete(DRM::AtomicRequest *request);
+
+	DRM::Device dev_;
+
+	const DRM::Connector *connector_;
+	const DRM::Crtc *crtc_;
+	const DRM::Mode *mode_;
+	bool hasOutFence_;
+
+	std::mutex lock_;
+	std::vector<View> views_;
+	unsigned int startedViews_;
+	bool pipelineEnabled_;
+
+	/* Only one page flip, covering all views, can be in flight. */
+	std::unique_ptr<Flip> queued_;
+};
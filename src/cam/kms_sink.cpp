@@ -8,12 +8,10 @@
 #include "kms_sink.h"
 
 #include <array>
-#include <algorithm>
-#include <assert.h>
-#include <iostream>
+#include <errno.h>
 #include <memory>
 #include <stdint.h>
-#include <string.h>
+#include <utility>
 
 #include <libcamera/camera.h>
 #include <libcamera/formats.h>
@@ -21,48 +19,17 @@
 #include <libcamera/stream.h>
 
 #include "drm.h"
+#include "event_loop.h"
+#include "kms_display.h"
 
-KMSSink::KMSSink(const std::string &connectorName)
-	: connector_(nullptr), crtc_(nullptr), plane_(nullptr), mode_(nullptr)
+/*
+ * The sink displays the frames of one camera in a view of a display, which may
+ * be shared with other sinks.
+ */
+KMSSink::KMSSink(std::shared_ptr<KMSDisplay> display, unsigned int view)
+	: display_(std::move(display)), view_(view),
+	  loop_(EventLoop::instance())
 {
-	int ret = dev_.init();
-	if (ret < 0)
-		return;
-
-	/*
-	 * Find the requested connector. If no specific connector is requested,
-	 * pick the first connected connector or, if no connector is connected,
-	 * the first connector with unknown status.
-	 */
-	for (const DRM::Connector &conn : dev_.connectors()) {
-		if (!connectorName.empty()) {
-			if (conn.name() != connectorName)
-				continue;
-
-			connector_ = &conn;
-			break;
-		}
-
-		if (conn.status() == DRM::Connector::Connected) {
-			connector_ = &conn;
-			break;
-		}
-
-		if (!connector_ && conn.status() == DRM::Connector::Unknown)
-			connector_ = &conn;
-	}
-
-	if (!connector_) {
-		if (!connectorName.empty())
-			std::cerr
-				<< "Connector " << connectorName << " not found"
-				<< std::endl;
-		else
-			std::cerr << "No connected connector found" << std::endl;
-		return;
-	}
-
-	dev_.requestComplete.connect(this, &KMSSink::requestComplete);
 }
 
 void KMSSink::mapBuffer(libcamera::FrameBuffer *buffer)
@@ -92,7 +59,7 @@ void KMSSink::mapBuffer(libcamera::FrameBuffer *buffer)
 		strides[i] = stride_ * uvStrideMultiplier / 2;
 
 	std::unique_ptr<DRM::FrameBuffer> drmBuffer =
-		dev_.createFrameBuffer(*buffer, format_, size_, strides);
+		display_->device()->createFrameBuffer(*buffer, format_, size_, strides);
 	if (!drmBuffer)
 		return;
 
@@ -103,159 +70,44 @@ void KMSSink::mapBuffer(libcamera::FrameBuffer *buffer)
 
 int KMSSink::configure(const libcamera::CameraConfiguration &config)
 {
-	if (!connector_)
+	if (!display_->isValid())
 		return -EINVAL;
 
-	crtc_ = nullptr;
-	plane_ = nullptr;
-	mode_ = nullptr;
-
 	const libcamera::StreamConfiguration &cfg = config.at(0);
 
-	const std::vector<DRM::Mode> &modes = connector_->modes();
-	const auto iter = std::find_if(modes.begin(), modes.end(),
-				       [&](const DRM::Mode &mode) {
-					       return mode.hdisplay == cfg.size.width &&
-						      mode.vdisplay == cfg.size.height;
-				       });
-	if (iter == modes.end()) {
-		std::cerr
-			<< "No mode matching " << cfg.size.toString()
-			<< std::endl;
-		return -EINVAL;
-	}
-
-	int ret = configurePipeline(cfg.pixelFormat);
+	int ret = display_->configureView(view_, cfg.pixelFormat, cfg.size,
+					  [this](libcamera::Request *request) {
+						  release(request);
+					  },
+					  &format_);
 	if (ret < 0)
 		return ret;
 
-	mode_ = &*iter;
 	size_ = cfg.size;
 	stride_ = cfg.stride;
 
 	return 0;
 }
 
-int KMSSink::configurePipeline(const libcamera::PixelFormat &format)
-{
-	/*
-	 * If the requested format has an alpha channel, also consider the X
-	 * variant.
-	 */
-	libcamera::PixelFormat xFormat;
-
-	switch (format) {
-	case libcamera::formats::ABGR8888:
-		xFormat = libcamera::formats::XBGR8888;
-		break;
-	case libcamera::formats::ARGB8888:
-		xFormat = libcamera::formats::XRGB8888;
-		break;
-	case libcamera::formats::BGRA8888:
-		xFormat = libcamera::formats::BGRX8888;
-		break;
-	case libcamera::formats::RGBA8888:
-		xFormat = libcamera::formats::RGBX8888;
-		break;
-	}
-
-	/*
-	 * Find a CRTC and plane suitable for the request format and the
-	 * connector at the end of the pipeline. Restrict the search to primary
-	 * planes for now.
-	 */
-	for (const DRM::Encoder *encoder : connector_->encoders()) {
-		for (const DRM::Crtc *crtc : encoder->possibleCrtcs()) {
-			for (const DRM::Plane *plane : crtc->planes()) {
-				if (plane->type() != DRM::Plane::TypePrimary)
-					continue;
-
-				if (plane->supportsFormat(format)) {
-					crtc_ = crtc;
-					plane_ = plane;
-					format_ = format;
-					break;
-				}
-
-				if (plane->supportsFormat(xFormat)) {
-					crtc_ = crtc;
-					plane_ = plane;
-					format_ = xFormat;
-					break;
-				}
-			}
-		}
-	}
-
-	if (!crtc_) {
-		std::cerr
-			<< "Unable to find display pipeline for format "
-			<< format.toString() << std::endl;
-
-		return -EPIPE;
-	}
-
-	std::cout
-		<< "Using KMS plane " << plane_->id() << ", CRTC " << crtc_->id()
-		<< ", connector " << connector_->name()
-		<< " (" << connector_->id() << ")" << std::endl;
-
-	return 0;
-}
-
 int KMSSink::start()
 {
-	std::unique_ptr<DRM::AtomicRequest> request;
-
 	int ret = FrameSink::start();
 	if (ret < 0)
 		return ret;
 
-	/* Disable all CRTCs and planes to start from a known valid state. */
-	request = std::make_unique<DRM::AtomicRequest>(&dev_);
-
-	for (const DRM::Crtc &crtc : dev_.crtcs())
-		request->addProperty(&crtc, "ACTIVE", 0);
-
-	for (const DRM::Plane &plane : dev_.planes()) {
-		request->addProperty(&plane, "CRTC_ID", 0);
-		request->addProperty(&plane, "FB_ID", 0);
-	}
-
-	ret = request->commit(DRM::AtomicRequest::FlagAllowModeset);
-	if (ret < 0) {
-		std::cerr
-			<< "Failed to disable CRTCs and planes: "
-			<< strerror(-ret) << std::endl;
-		return ret;
-	}
+	if (buffers_.empty())
+		return -EINVAL;
 
-	return 0;
+	return display_->startView(view_, buffers_.begin()->second.get());
 }
 
 int KMSSink::stop()
 {
-	/* Display pipeline. */
-	DRM::AtomicRequest request(&dev_);
-
-	request.addProperty(connector_, "CRTC_ID", 0);
-	request.addProperty(crtc_, "ACTIVE", 0);
-	request.addProperty(crtc_, "MODE_ID", 0);
-	request.addProperty(plane_, "CRTC_ID", 0);
-	request.addProperty(plane_, "FB_ID", 0);
-
-	int ret = request.commit(DRM::AtomicRequest::FlagAllowModeset);
-	if (ret < 0) {
-		std::cerr
-			<< "Failed to stop display pipeline: "
-			<< strerror(-ret) << std::endl;
+	int ret = display_->stopView(view_);
+	if (ret < 0)
 		return ret;
-	}
 
 	/* Free all buffers. */
-	pending_.reset();
-	queued_.reset();
-	active_.reset();
 	buffers_.clear();
 
 	return FrameSink::stop();
@@ -263,79 +115,23 @@ int KMSSink::stop()
 
 bool KMSSink::processRequest(libcamera::Request *camRequest)
 {
-	/*
-	 * Perform a very crude rate adaptation by simply dropping the request
-	 * if the display queue is full.
-	 */
-	if (pending_)
-		return true;
-
 	libcamera::FrameBuffer *buffer = camRequest->buffers().begin()->second;
 	auto iter = buffers_.find(buffer);
 	if (iter == buffers_.end())
 		return true;
 
-	DRM::FrameBuffer *drmBuffer = iter->second.get();
-
-	unsigned int flags = DRM::AtomicRequest::FlagAsync;
-	DRM::AtomicRequest *drmRequest = new DRM::AtomicRequest(&dev_);
-	drmRequest->addProperty(plane_, "FB_ID", drmBuffer->id());
-
-	if (!active_ && !queued_) {
-		/* Enable the display pipeline on the first frame. */
-		drmRequest->addProperty(connector_, "CRTC_ID", crtc_->id());
-
-		drmRequest->addProperty(crtc_, "ACTIVE", 1);
-		drmRequest->addProperty(crtc_, "MODE_ID", mode_->toBlob(&dev_));
-
-		drmRequest->addProperty(plane_, "CRTC_ID", crtc_->id());
-		drmRequest->addProperty(plane_, "SRC_X", 0 << 16);
-		drmRequest->addProperty(plane_, "SRC_Y", 0 << 16);
-		drmRequest->addProperty(plane_, "SRC_W", mode_->hdisplay << 16);
-		drmRequest->addProperty(plane_, "SRC_H", mode_->vdisplay << 16);
-		drmRequest->addProperty(plane_, "CRTC_X", 0);
-		drmRequest->addProperty(plane_, "CRTC_Y", 0);
-		drmRequest->addProperty(plane_, "CRTC_W", mode_->hdisplay);
-		drmRequest->addProperty(plane_, "CRTC_H", mode_->vdisplay);
-
-		flags |= DRM::AtomicRequest::FlagAllowModeset;
-	}
-
-	pending_ = std::make_unique<Request>(drmRequest, camRequest);
-
-	std::lock_guard<std::mutex> lock(lock_);
-
-	if (!queued_) {
-		int ret = drmRequest->commit(flags);
-		if (ret < 0) {
-			std::cerr
-				<< "Failed to commit atomic request: "
-				<< strerror(-ret) << std::endl;
-			/* \todo Implement error handling */
-		}
-
-		queued_ = std::move(pending_);
-	}
+	display_->queueFrame(view_, camRequest, iter->second.get());
 
 	return false;
 }
 
-void KMSSink::requestComplete(DRM::AtomicRequest *request)
+/*
+ * Requests are released by the display from the thread handling page flip
+ * events. Give them back to the camera session from its own event loop.
+ */
+void KMSSink::release(libcamera::Request *request)
 {
-	std::lock_guard<std::mutex> lock(lock_);
-
-	assert(queued_ && queued_->drmRequest_.get() == request);
-
-	/* Complete the active request, if any. */
-	if (active_)
-		requestProcessed.emit(active_->camRequest_);
-
-	/* The queued request becomes active. */
-	active_ = std::move(queued_);
-
-	/* Queue the pending request, if any. */
-	if (pending_) {
-		pending_->drmRequest_->commit(DRM::AtomicRequest::FlagAsync);
-		queued_ = std::move(pending_);
-	}
+	loop_->callLater([this, request]() {
+		requestProcessed.emit(request);
+	});
 }
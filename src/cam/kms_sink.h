@@ -7,13 +7,8 @@
 
 #pragma once
 
-#include <list>
+#include <map>
 #include <memory>
-#include <mutex>
-#include <string>
-#include <utility>
-
-#include <libcamera/base/signal.h>
 
 #include <libcamera/geometry.h>
 #include <libcamera/pixel_format.h>
@@ -21,10 +16,13 @@
 #include "drm.h"
 #include "frame_sink.h"
 
+class EventLoop;
+class KMSDisplay;
+
 class KMSSink : public FrameSink
 {
 public:
-	KMSSink(const std::string &connectorName);
+	KMSSink(std::shared_ptr<KMSDisplay> display, unsigned int view);
 
 	void mapBuffer(libcamera::FrameBuffer *buffer) override;
 
@@ -35,36 +33,15 @@ public:
 	bool processRequest(libcamera::Request *request) override;
 
 private:
-	class Request
-	{
-	public:
-		Request(DRM::AtomicRequest *drmRequest, libcamera::Request *camRequest)
-			: drmRequest_(drmRequest), camRequest_(camRequest)
-		{
-		}
-
-		std::unique_ptr<DRM::AtomicRequest> drmRequest_;
-		libcamera::Request *camRequest_;
-	};
+	void release(libcamera::Request *request);
 
-	int configurePipeline(const libcamera::PixelFormat &format);
-	void requestComplete(DRM::AtomicRequest *request);
-
-	DRM::Device dev_;
-
-	const DRM::Connector *connector_;
-	const DRM::Crtc *crtc_;
-	const DRM::Plane *plane_;
-	const DRM::Mode *mode_;
+	std::shared_ptr<KMSDisplay> display_;
+	unsigned int view_;
+	EventLoop *loop_;
 
 	libcamera::PixelFormat format_;
 	libcamera::Size size_;
 	unsigned int stride_;
 
 	std::map<libcamera::FrameBuffer *, std::unique_ptr<DRM::FrameBuffer>> buffers_;
-
-	std::mutex lock_;
-	std::unique_ptr<Request> pending_;
-	std::unique_ptr<Request> queued_;
-	std::unique_ptr<Request> active_;
 };
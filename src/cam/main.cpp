@@ -8,6 +8,8 @@
 #include <atomic>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <signal.h>
 #include <string.h>
 
@@ -16,6 +18,9 @@
 
 #include "camera_session.h"
 #include "event_loop.h"
+#ifdef HAVE_KMS
+#include "kms_display.h"
+#endif
 #include "main.h"
 #include "options.h"
 #include "stream_options.h"
@@ -144,9 +149,27 @@ int CamApp::parseOptions(int argc, char *argv[])
 			 "to write files, using the default file name. Otherwise it sets the\n"
 			 "full file path and name. The first '#' character in the file name\n"
 			 "is expanded to the camera index, stream name and frame sequence number.\n"
+			 "Without a '#', all frames are written to the same file, and indexed\n"
+			 "in a sidecar file with a '.idx' suffix.\n"
 			 "The default file name is 'frame-#.bin'.",
 			 "file", ArgumentOptional, "filename", false,
 			 OptCamera);
+	parser.addOption(OptEncode, OptionString,
+			 "Encode the first stream with a V4L2 hardware encoder\n"
+			 "The <codec> is 'h264' (default) or 'hevc'. The elementary stream is\n"
+			 "written to the file set by --file, or to 'cam<index>.<codec>'.",
+			 "encode", ArgumentOptional, "codec", false,
+			 OptCamera);
+	parser.addOption(OptContainer, OptionInteger,
+			 "Write captured frames to a single container file with --file\n"
+			 "Each frame is stored with its sequence, timestamp and metadata.\n"
+			 "The optional <size> preallocates the file, in MiB.",
+			 "container", ArgumentOptional, "size", false,
+			 OptCamera);
+	parser.addOption(OptDirectIO, OptionNone,
+			 "Bypass the page cache when writing frames to disk",
+			 "direct-io", ArgumentNone, nullptr, false,
+			 OptCamera);
 	parser.addOption(OptStream, &streamKeyValue,
 			 "Set configuration of a camera stream", "stream", true,
 			 OptCamera);
@@ -158,6 +181,11 @@ int CamApp::parseOptions(int argc, char *argv[])
 			 "Print the metadata for completed requests",
 			 "metadata", ArgumentNone, nullptr, false,
 			 OptCamera);
+	parser.addOption(OptStats, OptionNone,
+			 "Print the frame rate, request latency and dropped frames every second\n"
+			 "instead of a line per frame",
+			 "stats", ArgumentNone, nullptr, false,
+			 OptCamera);
 
 	options_ = parser.parse(argc, argv);
 	if (!options_.valid())
@@ -183,8 +211,12 @@ void CamApp::cameraRemoved(std::shared_ptr<Camera> cam)
 
 void CamApp::captureDone()
 {
+	/*
+	 * This is called from the camera session threads, possibly before the
+	 * main loop starts running. Exit the loop from within.
+	 */
 	if (--loopUsers_ == 0)
-		EventLoop::instance()->exit(0);
+		loop_.callLater([this]() { loop_.exit(0); });
 }
 
 int CamApp::run()
@@ -243,18 +275,42 @@ int CamApp::run()
 		}
 	}
 
+#ifdef HAVE_KMS
+	/*
+	 * Sessions displaying their viewfinder on the same connector share a
+	 * display, composited in a single atomic commit per page flip. Create
+	 * the displays from the main thread to handle page flip events in the
+	 * main event loop.
+	 */
+	std::map<std::string, std::shared_ptr<KMSDisplay>> displays;
+
+	for (const auto &session : sessions) {
+		const OptionsParser::Options &options = session->options();
+		if (!options.isSet(OptCapture) || !options.isSet(OptDisplay))
+			continue;
+
+		const std::string connector = options[OptDisplay].toString();
+		std::shared_ptr<KMSDisplay> &display = displays[connector];
+		if (!display)
+			display = std::make_shared<KMSDisplay>(connector);
+
+		session->setDisplay(display, display->addView());
+	}
+#endif
+
 	/* 4. Start capture. */
 	for (const auto &session : sessions) {
 		if (!session->options().isSet(OptCapture))
 			continue;
 
+		/* Sessions may complete capture before start() returns. */
+		loopUsers_++;
+
 		ret = session->start();
 		if (ret) {
 			std::cout << "Failed to start camera session" << std::endl;
 			return ret;
 		}
-
-		loopUsers_++;
 	}
 
 	/* 5. Enable hotplug monitoring. */
@@ -21,4 +21,8 @@ enum {
 	OptListControls = 256,
 	OptStrictFormats = 257,
 	OptMetadata = 258,
+	OptDirectIO = 259,
+	OptContainer = 260,
+	OptStats = 261,
+	OptEncode = 262,
 };
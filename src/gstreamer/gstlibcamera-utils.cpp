@@ -8,6 +8,8 @@
 
 #include "gstlibcamera-utils.h"
 
+#include <gst/allocators/allocators.h>
+
 #include <libcamera/formats.h>
 
 using namespace libcamera;
@@ -129,8 +131,33 @@ gst_libcamera_stream_formats_to_caps(const StreamFormats &formats)
 	return caps;
 }
 
+/*
+ * Create caps listing, before each raw video structure of the given caps, a
+ * copy carrying the memory:DMABuf feature. This lets downstream elements that
+ * import dmabufs select them, while others still negotiate system memory.
+ */
+GstCaps *
+gst_libcamera_caps_add_dmabuf_feature(GstCaps *caps)
+{
+	GstCaps *result = gst_caps_new_empty();
+
+	for (guint i = 0; i < gst_caps_get_size(caps); i++) {
+		GstStructure *s = gst_caps_get_structure(caps, i);
+
+		if (gst_structure_has_name(s, "video/x-raw"))
+			gst_caps_append_structure_full(result, gst_structure_copy(s),
+						       gst_caps_features_new(GST_CAPS_FEATURE_MEMORY_DMABUF,
+									     nullptr));
+
+		gst_caps_append_structure(result, gst_structure_copy(s));
+	}
+
+	return result;
+}
+
 GstCaps *
-gst_libcamera_stream_configuration_to_caps(const StreamConfiguration &stream_cfg)
+gst_libcamera_stream_configuration_to_caps(const StreamConfiguration &stream_cfg,
+					   bool use_dmabuf)
 {
 	GstCaps *caps = gst_caps_new_empty();
 	GstStructure *s = bare_structure_from_format(stream_cfg.pixelFormat);
@@ -139,14 +166,20 @@ gst_libcamera_stream_configuration_to_caps(const StreamConfiguration &stream_cfg
 			  "width", G_TYPE_INT, stream_cfg.size.width,
 			  "height", G_TYPE_INT, stream_cfg.size.height,
 			  nullptr);
-	gst_caps_append_structure(caps, s);
+
+	if (use_dmabuf && gst_structure_has_name(s, "video/x-raw"))
+		gst_caps_append_structure_full(caps, s,
+					       gst_caps_features_new(GST_CAPS_FEATURE_MEMORY_DMABUF,
+								     nullptr));
+	else
+		gst_caps_append_structure(caps, s);
 
 	return caps;
 }
 
 void
 gst_libcamera_configure_stream_from_caps(StreamConfiguration &stream_cfg,
-					 GstCaps *caps)
+					 GstCaps *caps, bool *use_dmabuf)
 {
 	GstVideoFormat gst_format = pixel_format_to_gst_format(stream_cfg.pixelFormat);
 	guint i;
@@ -196,10 +229,15 @@ gst_libcamera_configure_stream_from_caps(StreamConfiguration &stream_cfg,
 	}
 
 	/* Prefer reliable fixed value over ranges */
-	if (best_fixed >= 0)
-		s = gst_caps_get_structure(caps, best_fixed);
-	else
-		s = gst_caps_get_structure(caps, best_in_range);
+	guint index = best_fixed >= 0 ? best_fixed : best_in_range;
+	s = gst_caps_get_structure(caps, index);
+
+	if (use_dmabuf) {
+		GstCapsFeatures *features = gst_caps_get_features(caps, index);
+		*use_dmabuf = features &&
+			      gst_caps_features_contains(features,
+							 GST_CAPS_FEATURE_MEMORY_DMABUF);
+	}
 
 	if (gst_structure_has_name(s, "video/x-raw")) {
 		const gchar *format = gst_video_format_to_string(gst_format);
@@ -189,18 +189,37 @@ gst_libcamera_allocator_class_init(GstLibcameraAllocatorClass *klass)
 
 GstLibcameraAllocator *
 gst_libcamera_allocator_new(std::shared_ptr<Camera> camera,
-			    CameraConfiguration *config_)
+			    CameraConfiguration *config_,
+			    const std::vector<guint> &extra_buffers)
 {
 	auto *self = GST_LIBCAMERA_ALLOCATOR(g_object_new(GST_TYPE_LIBCAMERA_ALLOCATOR,
 							  nullptr));
 
 	self->fb_allocator = new FrameBufferAllocator(camera);
-	for (StreamConfiguration &streamCfg : *config_) {
+	for (gsize i = 0; i < config_->size(); i++) {
+		StreamConfiguration &streamCfg = config_->at(i);
 		Stream *stream = streamCfg.stream();
-		gint ret;
+		gint ret = 0;
+
+		/*
+		 * When downstream holds on to buffers, allocate the extra
+		 * buffers it needs on top of the ones the camera cycles
+		 * through, otherwise capture would stall. Exported buffers are
+		 * limited by the device, allocate from the CMA dma-heap in that
+		 * case, as contiguous memory can be imported by all devices.
+		 */
+		if (i < extra_buffers.size() && extra_buffers[i]) {
+			ret = self->fb_allocator->allocate(stream, FrameBufferAllocator::Heap::Cma,
+							   streamCfg.bufferCount + extra_buffers[i]);
+			if (ret <= 0)
+				GST_WARNING("Failed to allocate %u buffers from dma-heap, "
+					    "falling back to exported buffers",
+					    streamCfg.bufferCount + extra_buffers[i]);
+		}
 
-		ret = self->fb_allocator->allocate(stream);
-		if (ret == 0)
+		if (ret <= 0)
+			ret = self->fb_allocator->allocate(stream);
+		if (ret <= 0)
 			return nullptr;
 
 		GQueue *pool = g_queue_new();
@@ -19,12 +19,27 @@ struct _GstLibcameraPad {
 	StreamRole role;
 	GstLibcameraPool *pool;
 	GQueue pending_buffers;
+	guint max_pending_buffers;
+	GstLibcameraPadLeaky leaky;
 	GstClockTime latency;
+	GstClockTime reported_latency;
+
+	/* Interval between the last captured buffers. */
+	GstClockTime last_pts;
+	GstClockTime buffer_interval;
+
+	/* Last QoS event received from downstream. */
+	gboolean qos_valid;
+	GstQOSType qos_type;
+	gdouble qos_proportion;
+	GstClockTimeDiff qos_diff;
 };
 
 enum {
 	PROP_0,
-	PROP_STREAM_ROLE
+	PROP_STREAM_ROLE,
+	PROP_MAX_PENDING_BUFFERS,
+	PROP_LEAKY,
 };
 
 G_DEFINE_TYPE(GstLibcameraPad, gst_libcamera_pad, GST_TYPE_PAD)
@@ -40,6 +55,12 @@ gst_libcamera_pad_set_property(GObject *object, guint prop_id,
 	case PROP_STREAM_ROLE:
 		self->role = (StreamRole)g_value_get_enum(value);
 		break;
+	case PROP_MAX_PENDING_BUFFERS:
+		self->max_pending_buffers = g_value_get_uint(value);
+		break;
+	case PROP_LEAKY:
+		self->leaky = (GstLibcameraPadLeaky)g_value_get_enum(value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -57,6 +78,12 @@ gst_libcamera_pad_get_property(GObject *object, guint prop_id, GValue *value,
 	case PROP_STREAM_ROLE:
 		g_value_set_enum(value, self->role);
 		break;
+	case PROP_MAX_PENDING_BUFFERS:
+		g_value_set_uint(value, self->max_pending_buffers);
+		break;
+	case PROP_LEAKY:
+		g_value_set_enum(value, self->leaky);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -71,9 +98,50 @@ gst_libcamera_pad_query(GstPad *pad, GstObject *parent, GstQuery *query)
 	if (query->type != GST_QUERY_LATENCY)
 		return gst_pad_query_default(pad, parent, query);
 
-	/* TRUE here means live, we assumes that max latency is the same as min
-	 * as we have no idea that duration of frames. */
-	gst_query_set_latency(query, TRUE, self->latency, self->latency);
+	GLibLocker lock(GST_OBJECT(self));
+
+	/*
+	 * TRUE here means live. The minimum latency is the time between the
+	 * start of exposure and the buffer being ready to be pushed. Buffers
+	 * can then wait in the pending queue, which bounds the maximum latency
+	 * if it is limited.
+	 */
+	GstClockTime min_latency = self->latency;
+	GstClockTime max_latency = GST_CLOCK_TIME_NONE;
+	if (self->max_pending_buffers)
+		max_latency = min_latency + self->max_pending_buffers * self->buffer_interval;
+
+	self->reported_latency = min_latency;
+
+	gst_query_set_latency(query, TRUE, min_latency, max_latency);
+	return TRUE;
+}
+
+static gboolean
+gst_libcamera_pad_event(GstPad *pad, GstObject *parent, GstEvent *event)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+
+	if (GST_EVENT_TYPE(event) != GST_EVENT_QOS)
+		return gst_pad_event_default(pad, parent, event);
+
+	GstQOSType type;
+	gdouble proportion;
+	GstClockTimeDiff diff;
+	gst_event_parse_qos(event, &type, &proportion, &diff, nullptr);
+
+	GST_LOG_OBJECT(self, "QoS type %d proportion %f diff %" GST_STIME_FORMAT,
+		       type, proportion, GST_STIME_ARGS(diff));
+
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		self->qos_valid = TRUE;
+		self->qos_type = type;
+		self->qos_proportion = proportion;
+		self->qos_diff = diff;
+	}
+
+	gst_event_unref(event);
 	return TRUE;
 }
 
@@ -81,6 +149,10 @@ static void
 gst_libcamera_pad_init(GstLibcameraPad *self)
 {
 	GST_PAD_QUERYFUNC(self) = gst_libcamera_pad_query;
+	GST_PAD_EVENTFUNC(self) = gst_libcamera_pad_event;
+
+	self->reported_latency = GST_CLOCK_TIME_NONE;
+	self->last_pts = GST_CLOCK_TIME_NONE;
 }
 
 static GType
@@ -100,6 +172,23 @@ gst_libcamera_stream_role_get_type()
 	return type;
 }
 
+static GType
+gst_libcamera_pad_leaky_get_type()
+{
+	static GType type = 0;
+	static const GEnumValue values[] = {
+		{ GST_LIBCAMERA_PAD_LEAKY_NONE, "Not leaky", "no" },
+		{ GST_LIBCAMERA_PAD_LEAKY_UPSTREAM, "Leaky on upstream (new buffers)", "upstream" },
+		{ GST_LIBCAMERA_PAD_LEAKY_DOWNSTREAM, "Leaky on downstream (old buffers)", "downstream" },
+		{ 0, NULL, NULL }
+	};
+
+	if (!type)
+		type = g_enum_register_static("GstLibcameraPadLeaky", values);
+
+	return type;
+}
+
 static void
 gst_libcamera_pad_class_init(GstLibcameraPadClass *klass)
 {
@@ -117,6 +206,26 @@ gst_libcamera_pad_class_init(GstLibcameraPadClass *klass)
 						     | G_PARAM_READWRITE
 						     | G_PARAM_STATIC_STRINGS));
 	g_object_class_install_property(object_class, PROP_STREAM_ROLE, spec);
+
+	spec = g_param_spec_uint("max-pending-buffers", "Max Pending Buffers",
+				 "Maximum number of captured buffers waiting to be pushed (0 = unlimited)",
+				 0, G_MAXUINT, 0,
+				 (GParamFlags)(GST_PARAM_MUTABLE_PLAYING
+					       | G_PARAM_CONSTRUCT
+					       | G_PARAM_READWRITE
+					       | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_MAX_PENDING_BUFFERS, spec);
+
+	spec = g_param_spec_enum("leaky", "Leaky",
+				 "Where to drop buffers when the pending queue is full, "
+				 "capture is throttled if not leaky",
+				 gst_libcamera_pad_leaky_get_type(),
+				 GST_LIBCAMERA_PAD_LEAKY_NONE,
+				 (GParamFlags)(GST_PARAM_MUTABLE_PLAYING
+					       | G_PARAM_CONSTRUCT
+					       | G_PARAM_READWRITE
+					       | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_LEAKY, spec);
 }
 
 StreamRole
@@ -161,7 +270,34 @@ gst_libcamera_pad_queue_buffer(GstPad *pad, GstBuffer *buffer)
 	auto *self = GST_LIBCAMERA_PAD(pad);
 	GLibLocker lock(GST_OBJECT(self));
 
+	GstClockTime pts = GST_BUFFER_PTS(buffer);
+	if (GST_CLOCK_TIME_IS_VALID(pts) && GST_CLOCK_TIME_IS_VALID(self->last_pts) &&
+	    pts > self->last_pts)
+		self->buffer_interval = pts - self->last_pts;
+	self->last_pts = pts;
+
+	if (self->max_pending_buffers &&
+	    self->pending_buffers.length >= self->max_pending_buffers) {
+		switch (self->leaky) {
+		case GST_LIBCAMERA_PAD_LEAKY_UPSTREAM:
+			GST_DEBUG_OBJECT(self, "Queue full, dropping new buffer");
+			gst_buffer_unref(buffer);
+			return;
+		case GST_LIBCAMERA_PAD_LEAKY_DOWNSTREAM:
+			GST_DEBUG_OBJECT(self, "Queue full, dropping old buffer");
+			gst_buffer_unref(GST_BUFFER(g_queue_pop_tail(&self->pending_buffers)));
+			break;
+		default:
+			break;
+		}
+	}
+
 	g_queue_push_head(&self->pending_buffers, buffer);
+
+	/* Wake up the streaming thread of the pad. */
+	GstTask *task = GST_PAD_TASK(pad);
+	if (task)
+		gst_libcamera_resume_task(task);
 }
 
 GstFlowReturn
@@ -189,10 +325,100 @@ gst_libcamera_pad_has_pending(GstPad *pad)
 	return self->pending_buffers.length > 0;
 }
 
+/*
+ * A non-leaky pad is full when its pending queue has reached its maximum size.
+ * Capture is throttled until it drains. Leaky pads are never full.
+ */
+bool
+gst_libcamera_pad_is_full(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+	GLibLocker lock(GST_OBJECT(self));
+	return self->leaky == GST_LIBCAMERA_PAD_LEAKY_NONE &&
+	       self->max_pending_buffers &&
+	       self->pending_buffers.length >= self->max_pending_buffers;
+}
+
+/*
+ * Pause the streaming thread of the pad if there's no buffer left to push.
+ * This is done with the object lock held, to synchronize with
+ * gst_libcamera_pad_queue_buffer() that resumes it.
+ */
+void
+gst_libcamera_pad_pause_task_if_idle(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+	GLibLocker lock(GST_OBJECT(self));
+
+	GstTask *task = GST_PAD_TASK(pad);
+	if (task && !self->pending_buffers.length)
+		gst_task_pause(task);
+}
+
 void
+gst_libcamera_pad_clear_pending(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+	GLibLocker lock(GST_OBJECT(self));
+
+	GstBuffer *buffer;
+	while ((buffer = GST_BUFFER(g_queue_pop_tail(&self->pending_buffers))))
+		gst_buffer_unref(buffer);
+}
+
+/*
+ * Update the measured latency. Return true if it exceeds the latency last
+ * reported to downstream by more than one buffer interval, in which case the
+ * pipeline latency should be recalculated.
+ */
+bool
 gst_libcamera_pad_set_latency(GstPad *pad, GstClockTime latency)
 {
 	auto *self = GST_LIBCAMERA_PAD(pad);
 	GLibLocker lock(GST_OBJECT(self));
 	self->latency = latency;
+
+	if (!GST_CLOCK_TIME_IS_VALID(self->reported_latency))
+		return false;
+
+	return latency > self->reported_latency + self->buffer_interval;
+}
+
+/*
+ * Compute the minimum interval between buffers requested by downstream. A
+ * QoS proportion above 1.0 means downstream is too slow for the current rate,
+ * the interval is then scaled by the proportion. Throttling requests apply
+ * until downstream changes them. Return 0 if downstream keeps up.
+ */
+GstClockTime
+gst_libcamera_pad_take_qos_interval(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+	GLibLocker lock(GST_OBJECT(self));
+
+	if (!self->qos_valid)
+		return 0;
+
+	if (self->qos_type == GST_QOS_TYPE_THROTTLE)
+		return self->qos_diff > 0 ? self->qos_diff : 0;
+
+	/* Every other QoS event is only accounted for once. */
+	self->qos_valid = FALSE;
+
+	if (self->qos_proportion <= 1.0)
+		return 0;
+
+	return static_cast<GstClockTime>(self->buffer_interval * self->qos_proportion);
+}
+
+void
+gst_libcamera_pad_reset_qos(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+	GLibLocker lock(GST_OBJECT(self));
+
+	self->qos_valid = FALSE;
+	self->last_pts = GST_CLOCK_TIME_NONE;
+	self->buffer_interval = 0;
+	self->reported_latency = GST_CLOCK_TIME_NONE;
 }
@@ -14,6 +14,12 @@
 
 #include <libcamera/stream.h>
 
+typedef enum {
+	GST_LIBCAMERA_PAD_LEAKY_NONE,
+	GST_LIBCAMERA_PAD_LEAKY_UPSTREAM,
+	GST_LIBCAMERA_PAD_LEAKY_DOWNSTREAM,
+} GstLibcameraPadLeaky;
+
 #define GST_TYPE_LIBCAMERA_PAD gst_libcamera_pad_get_type()
 G_DECLARE_FINAL_TYPE(GstLibcameraPad, gst_libcamera_pad, GST_LIBCAMERA, PAD, GstPad)
 
@@ -31,4 +37,14 @@ GstFlowReturn gst_libcamera_pad_push_pending(GstPad *pad);
 
 bool gst_libcamera_pad_has_pending(GstPad *pad);
 
-void gst_libcamera_pad_set_latency(GstPad *pad, GstClockTime latency);
+bool gst_libcamera_pad_is_full(GstPad *pad);
+
+void gst_libcamera_pad_pause_task_if_idle(GstPad *pad);
+
+void gst_libcamera_pad_clear_pending(GstPad *pad);
+
+bool gst_libcamera_pad_set_latency(GstPad *pad, GstClockTime latency);
+
+GstClockTime gst_libcamera_pad_take_qos_interval(GstPad *pad);
+
+void gst_libcamera_pad_reset_qos(GstPad *pad);
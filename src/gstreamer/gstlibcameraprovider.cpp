@@ -8,6 +8,10 @@
 
 #include "gstlibcameraprovider.h"
 
+#include <map>
+#include <set>
+#include <string>
+
 #include <libcamera/camera.h>
 #include <libcamera/camera_manager.h>
 
@@ -152,6 +156,94 @@ gst_libcamera_device_new(const std::shared_ptr<Camera> &camera)
 				       nullptr));
 }
 
+/* Used for C++ object with destructors. */
+struct GstLibcameraProviderState {
+	GstLibcameraProvider *provider_;
+
+	/*
+	 * The camera manager is kept alive while the provider is started.
+	 * Subsequent probes and the libcamerasrc elements opening the devices
+	 * then reuse the enumerated cameras instead of starting a new camera
+	 * manager.
+	 */
+	std::shared_ptr<CameraManager> cm_;
+
+	/*
+	 * Generating the device caps requires a configuration for the camera,
+	 * which is costly. Devices are thus created once per camera and cached
+	 * for later probes. The announced_ set stores the IDs of the devices
+	 * added to the started provider. Both are protected by the lock_.
+	 */
+	GMutex lock_;
+	std::map<std::string, GstDevice *> devices_;
+	std::set<std::string> announced_;
+
+	GstDevice *device(const std::shared_ptr<Camera> &camera);
+	void announce(const std::shared_ptr<Camera> &camera);
+	void cameraAdded(std::shared_ptr<Camera> camera);
+	void cameraRemoved(std::shared_ptr<Camera> camera);
+};
+
+/* Retrieve the cached device for \a camera, or create it. Call with lock_ held. */
+GstDevice *GstLibcameraProviderState::device(const std::shared_ptr<Camera> &camera)
+{
+	auto it = devices_.find(camera->id());
+	if (it != devices_.end())
+		return it->second;
+
+	GstDevice *dev = gst_libcamera_device_new(camera);
+	if (!dev)
+		return nullptr;
+
+	devices_[camera->id()] = GST_DEVICE(g_object_ref_sink(dev));
+
+	return dev;
+}
+
+/* Add the device for \a camera to the started provider. Call with lock_ held. */
+void GstLibcameraProviderState::announce(const std::shared_ptr<Camera> &camera)
+{
+	if (announced_.count(camera->id()))
+		return;
+
+	GstDevice *dev = device(camera);
+	if (!dev) {
+		GST_ERROR_OBJECT(provider_, "Failed to add camera '%s'",
+				 camera->id().c_str());
+		return;
+	}
+
+	announced_.insert(camera->id());
+	gst_device_provider_device_add(GST_DEVICE_PROVIDER(provider_), dev);
+}
+
+void GstLibcameraProviderState::cameraAdded(std::shared_ptr<Camera> camera)
+{
+	GLibLocker locker(&lock_);
+
+	GST_INFO_OBJECT(provider_, "Camera '%s' added", camera->id().c_str());
+	announce(camera);
+}
+
+void GstLibcameraProviderState::cameraRemoved(std::shared_ptr<Camera> camera)
+{
+	GLibLocker locker(&lock_);
+
+	GST_INFO_OBJECT(provider_, "Camera '%s' removed", camera->id().c_str());
+
+	auto it = devices_.find(camera->id());
+	if (it == devices_.end())
+		return;
+
+	GstDevice *dev = it->second;
+	devices_.erase(it);
+
+	if (announced_.erase(camera->id()))
+		gst_device_provider_device_remove(GST_DEVICE_PROVIDER(provider_), dev);
+
+	gst_object_unref(dev);
+}
+
 /**
  * \struct _GstLibcameraProvider
  * \brief libcamera GstDeviceProvider implementation
@@ -162,6 +254,8 @@ gst_libcamera_device_new(const std::shared_ptr<Camera> &camera)
 
 struct _GstLibcameraProvider {
 	GstDeviceProvider parent;
+
+	GstLibcameraProviderState *state;
 };
 
 G_DEFINE_TYPE_WITH_CODE(GstLibcameraProvider, gst_libcamera_provider,
@@ -173,16 +267,16 @@ static GList *
 gst_libcamera_provider_probe(GstDeviceProvider *provider)
 {
 	GstLibcameraProvider *self = GST_LIBCAMERA_PROVIDER(provider);
+	GstLibcameraProviderState *state = self->state;
 	std::shared_ptr<CameraManager> cm;
 	GList *devices = nullptr;
 	gint ret;
 
 	GST_INFO_OBJECT(self, "Probing cameras using libcamera");
 
-	/* \todo Move the CameraMananger start()/stop() calls into
-	 * GstDeviceProvider start()/stop() virtual function when CameraMananger
-	 * gains monitoring support. Meanwhile we need to cycle start()/stop()
-	 * to ensure every probe() calls return the latest list.
+	/*
+	 * Reuse the camera manager of the started provider or of a running
+	 * libcamerasrc element if there's one, or start a new one otherwise.
 	 */
 	cm = gst_libcamera_get_camera_manager(ret);
 	if (ret) {
@@ -191,38 +285,121 @@ gst_libcamera_provider_probe(GstDeviceProvider *provider)
 		return nullptr;
 	}
 
+	GLibLocker locker(&state->lock_);
+
 	for (const std::shared_ptr<Camera> &camera : cm->cameras()) {
 		GST_INFO_OBJECT(self, "Found camera '%s'", camera->id().c_str());
 
-		GstDevice *dev = gst_libcamera_device_new(camera);
+		GstDevice *dev = state->device(camera);
 		if (!dev) {
 			GST_ERROR_OBJECT(self, "Failed to add camera '%s'",
 					 camera->id().c_str());
+			g_list_free_full(devices, gst_object_unref);
 			return nullptr;
 		}
 
-		devices = g_list_append(devices,
-					g_object_ref_sink(dev));
+		devices = g_list_append(devices, gst_object_ref(dev));
 	}
 
 	return devices;
 }
 
+static gboolean
+gst_libcamera_provider_start(GstDeviceProvider *provider)
+{
+	GstLibcameraProvider *self = GST_LIBCAMERA_PROVIDER(provider);
+	GstLibcameraProviderState *state = self->state;
+	gint ret;
+
+	GST_INFO_OBJECT(self, "Starting camera monitoring");
+
+	state->cm_ = gst_libcamera_get_camera_manager(ret);
+	if (ret) {
+		GST_ERROR_OBJECT(self, "Failed to start the camera manager: %s",
+				 g_strerror(-ret));
+		state->cm_.reset();
+		return FALSE;
+	}
+
+	GLibLocker locker(&state->lock_);
+
+	state->cm_->cameraAdded.connect(state, &GstLibcameraProviderState::cameraAdded);
+	state->cm_->cameraRemoved.connect(state, &GstLibcameraProviderState::cameraRemoved);
+
+	for (const std::shared_ptr<Camera> &camera : state->cm_->cameras())
+		state->announce(camera);
+
+	return TRUE;
+}
+
+static void
+gst_libcamera_provider_stop(GstDeviceProvider *provider)
+{
+	GstLibcameraProvider *self = GST_LIBCAMERA_PROVIDER(provider);
+	GstLibcameraProviderState *state = self->state;
+
+	GST_INFO_OBJECT(self, "Stopping camera monitoring");
+
+	if (!state->cm_)
+		return;
+
+	state->cm_->cameraAdded.disconnect(state);
+	state->cm_->cameraRemoved.disconnect(state);
+
+	{
+		GLibLocker locker(&state->lock_);
+
+		for (const std::string &id : state->announced_)
+			gst_device_provider_device_remove(provider, state->devices_[id]);
+
+		state->announced_.clear();
+	}
+
+	state->cm_.reset();
+}
+
 static void
 gst_libcamera_provider_init(GstLibcameraProvider *self)
 {
 	GstDeviceProvider *provider = GST_DEVICE_PROVIDER(self);
+	GstLibcameraProviderState *state = new GstLibcameraProviderState();
+
+	g_mutex_init(&state->lock_);
+
+	/* C-style friend. */
+	state->provider_ = self;
+	self->state = state;
 
 	/* Avoid devices being duplicated. */
 	gst_device_provider_hide_provider(provider, "v4l2deviceprovider");
 }
 
+static void
+gst_libcamera_provider_finalize(GObject *object)
+{
+	GstLibcameraProvider *self = GST_LIBCAMERA_PROVIDER(object);
+	gpointer klass = gst_libcamera_provider_parent_class;
+
+	for (const auto &[id, dev] : self->state->devices_)
+		gst_object_unref(dev);
+
+	g_mutex_clear(&self->state->lock_);
+	delete self->state;
+
+	G_OBJECT_CLASS(klass)->finalize(object);
+}
+
 static void
 gst_libcamera_provider_class_init(GstLibcameraProviderClass *klass)
 {
 	GstDeviceProviderClass *provider_class = GST_DEVICE_PROVIDER_CLASS(klass);
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
 
 	provider_class->probe = gst_libcamera_provider_probe;
+	provider_class->start = gst_libcamera_provider_start;
+	provider_class->stop = gst_libcamera_provider_stop;
+
+	object_class->finalize = gst_libcamera_provider_finalize;
 
 	gst_device_provider_class_set_metadata(provider_class,
 					       "libcamera Device Provider",
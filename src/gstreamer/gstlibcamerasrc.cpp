@@ -14,7 +14,6 @@
  *    + Prevent the main thread from accessing streaming thread
  *  - Implement renegotiation (even if slow)
  *  - Implement GstElement::request-new-pad (multi stream)
- *    + Evaluate if a single streaming thread is fine
  *  - Add application driven request (snapshot)
  *  - Add framerate control
  *  - Add buffer importation support
@@ -29,13 +28,16 @@
 
 #include "gstlibcamerasrc.h"
 
+#include <algorithm>
 #include <queue>
+#include <stdlib.h>
 #include <vector>
 
 #include <gst/base/base.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/camera_manager.h>
+#include <libcamera/control_ids.h>
 
 #include "gstlibcameraallocator.h"
 #include "gstlibcamerapad.h"
@@ -53,6 +55,7 @@ struct RequestWrap {
 
 	void attachBuffer(GstBuffer *buffer);
 	GstBuffer *detachBuffer(Stream *stream);
+	void recycle();
 
 	std::unique_ptr<Request> request_;
 	std::map<Stream *, GstBuffer *> buffers_;
@@ -71,6 +74,18 @@ RequestWrap::~RequestWrap()
 	}
 }
 
+/* Release the remaining buffers and prepare the request to be queued again. */
+void RequestWrap::recycle()
+{
+	for (std::pair<Stream *const, GstBuffer *> &item : buffers_) {
+		if (item.second)
+			gst_buffer_unref(item.second);
+	}
+
+	buffers_.clear();
+	request_->reuse();
+}
+
 void RequestWrap::attachBuffer(GstBuffer *buffer)
 {
 	FrameBuffer *fb = gst_libcamera_buffer_get_frame_buffer(buffer);
@@ -108,9 +123,36 @@ struct GstLibcameraSrcState {
 	std::shared_ptr<Camera> cam_;
 	std::unique_ptr<CameraConfiguration> config_;
 	std::vector<GstPad *> srcpads_;
-	std::queue<std::unique_ptr<RequestWrap>> requests_;
 	guint group_id_;
 
+	/*
+	 * Requests are allocated once when streaming starts, and move from
+	 * freeRequests_ to queuedRequests_ and back as they get queued and
+	 * complete. Both queues are protected by the object lock.
+	 */
+	std::vector<std::unique_ptr<RequestWrap>> requestPool_;
+	std::queue<RequestWrap *> freeRequests_;
+	std::queue<RequestWrap *> queuedRequests_;
+
+	/*
+	 * Downstream QoS sets the minimum interval between requests, applied
+	 * by raising the minimum frame duration when the camera supports it,
+	 * or by delaying request submission otherwise. The QoS state is
+	 * protected by the object lock.
+	 */
+	GstClockTime qosInterval_;
+
+	bool hasFrameDurationLimits_;
+	int64_t minFrameDuration_;
+	int64_t maxFrameDuration_;
+	int64_t qosFrameDuration_;
+
+	GstClock *qosClock_;
+	GstClockID qosClockId_;
+	GstClockTime lastQueueTime_;
+
+	void recycleRequest(RequestWrap *wrap);
+	void applyQosInterval(Request *request, GstClockTime interval);
 	void requestCompleted(Request *request);
 };
 
@@ -121,6 +163,7 @@ struct _GstLibcameraSrc {
 	GstTask *task;
 
 	gchar *camera_name;
+	gboolean qos;
 
 	GstLibcameraSrcState *state;
 	GstLibcameraAllocator *allocator;
@@ -129,14 +172,17 @@ struct _GstLibcameraSrc {
 
 enum {
 	PROP_0,
-	PROP_CAMERA_NAME
+	PROP_CAMERA_NAME,
+	PROP_QOS,
 };
 
 G_DEFINE_TYPE_WITH_CODE(GstLibcameraSrc, gst_libcamera_src, GST_TYPE_ELEMENT,
 			GST_DEBUG_CATEGORY_INIT(source_debug, "libcamerasrc", 0,
 						"libcamera Source"))
 
-#define TEMPLATE_CAPS GST_STATIC_CAPS("video/x-raw; image/jpeg")
+#define TEMPLATE_CAPS GST_STATIC_CAPS("video/x-raw; " \
+				      "video/x-raw(" GST_CAPS_FEATURE_MEMORY_DMABUF "); " \
+				      "image/jpeg")
 
 /* For the simple case, we have a src pad that is always present. */
 GstStaticPadTemplate src_template = {
@@ -148,51 +194,99 @@ GstStaticPadTemplate request_src_template = {
 	"src_%u", GST_PAD_SRC, GST_PAD_REQUEST, TEMPLATE_CAPS
 };
 
+/* Must be called with the object lock held. */
+void
+GstLibcameraSrcState::recycleRequest(RequestWrap *wrap)
+{
+	wrap->recycle();
+	freeRequests_.push(wrap);
+}
+
+/*
+ * Set the minimum frame duration of the camera to the QoS interval. Must be
+ * called with the object lock held.
+ */
+void
+GstLibcameraSrcState::applyQosInterval(Request *request, GstClockTime interval)
+{
+	int64_t duration = std::clamp<int64_t>(GST_TIME_AS_USECONDS(interval),
+					       minFrameDuration_, maxFrameDuration_);
+
+	/*
+	 * Ignore variations smaller than an eighth of the current duration, to
+	 * avoid updating the limits for every request, but always restore the
+	 * nominal limits.
+	 */
+	int64_t delta = std::abs(duration - qosFrameDuration_);
+	if (!delta || (duration != minFrameDuration_ && delta <= qosFrameDuration_ / 8))
+		return;
+
+	GST_DEBUG_OBJECT(src_, "Setting minimum frame duration to %" G_GINT64_FORMAT "us",
+			 duration);
+
+	request->controls().set(controls::FrameDurationLimits,
+				{ duration, maxFrameDuration_ });
+	qosFrameDuration_ = duration;
+}
+
 void
 GstLibcameraSrcState::requestCompleted(Request *request)
 {
-	GLibLocker lock(GST_OBJECT(src_));
+	bool latencyChanged = false;
 
-	GST_DEBUG_OBJECT(src_, "buffers are ready");
+	{
+		GLibLocker lock(GST_OBJECT(src_));
 
-	std::unique_ptr<RequestWrap> wrap = std::move(requests_.front());
-	requests_.pop();
+		GST_DEBUG_OBJECT(src_, "buffers are ready");
 
-	g_return_if_fail(wrap->request_.get() == request);
+		RequestWrap *wrap = queuedRequests_.front();
+		queuedRequests_.pop();
 
-	if ((request->status() == Request::RequestCancelled)) {
-		GST_DEBUG_OBJECT(src_, "Request was cancelled");
-		return;
-	}
+		g_return_if_fail(wrap->request_.get() == request);
 
-	GstBuffer *buffer;
-	for (GstPad *srcpad : srcpads_) {
-		Stream *stream = gst_libcamera_pad_get_stream(srcpad);
-		buffer = wrap->detachBuffer(stream);
+		if ((request->status() == Request::RequestCancelled)) {
+			GST_DEBUG_OBJECT(src_, "Request was cancelled");
+			recycleRequest(wrap);
+			return;
+		}
 
-		FrameBuffer *fb = gst_libcamera_buffer_get_frame_buffer(buffer);
+		GstBuffer *buffer;
+		for (GstPad *srcpad : srcpads_) {
+			Stream *stream = gst_libcamera_pad_get_stream(srcpad);
+			buffer = wrap->detachBuffer(stream);
+
+			FrameBuffer *fb = gst_libcamera_buffer_get_frame_buffer(buffer);
+
+			if (GST_ELEMENT_CLOCK(src_)) {
+				GstClockTime gst_base_time = GST_ELEMENT(src_)->base_time;
+				GstClockTime gst_now = gst_clock_get_time(GST_ELEMENT_CLOCK(src_));
+				/* \todo Need to expose which reference clock the timestamp relates to. */
+				GstClockTime sys_now = g_get_monotonic_time() * 1000;
+
+				/* Deduced from: sys_now - sys_base_time == gst_now - gst_base_time */
+				GstClockTime sys_base_time = sys_now - (gst_now - gst_base_time);
+				GST_BUFFER_PTS(buffer) = fb->metadata().timestamp - sys_base_time;
+				if (gst_libcamera_pad_set_latency(srcpad, sys_now - fb->metadata().timestamp))
+					latencyChanged = true;
+			} else {
+				GST_BUFFER_PTS(buffer) = 0;
+			}
 
-		if (GST_ELEMENT_CLOCK(src_)) {
-			GstClockTime gst_base_time = GST_ELEMENT(src_)->base_time;
-			GstClockTime gst_now = gst_clock_get_time(GST_ELEMENT_CLOCK(src_));
-			/* \todo Need to expose which reference clock the timestamp relates to. */
-			GstClockTime sys_now = g_get_monotonic_time() * 1000;
+			GST_BUFFER_OFFSET(buffer) = fb->metadata().sequence;
+			GST_BUFFER_OFFSET_END(buffer) = fb->metadata().sequence;
 
-			/* Deduced from: sys_now - sys_base_time == gst_now - gst_base_time */
-			GstClockTime sys_base_time = sys_now - (gst_now - gst_base_time);
-			GST_BUFFER_PTS(buffer) = fb->metadata().timestamp - sys_base_time;
-			gst_libcamera_pad_set_latency(srcpad, sys_now - fb->metadata().timestamp);
-		} else {
-			GST_BUFFER_PTS(buffer) = 0;
+			gst_libcamera_pad_queue_buffer(srcpad, buffer);
 		}
 
-		GST_BUFFER_OFFSET(buffer) = fb->metadata().sequence;
-		GST_BUFFER_OFFSET_END(buffer) = fb->metadata().sequence;
+		recycleRequest(wrap);
 
-		gst_libcamera_pad_queue_buffer(srcpad, buffer);
+		gst_libcamera_resume_task(this->src_->task);
 	}
 
-	gst_libcamera_resume_task(this->src_->task);
+	/* Post the message without the object lock, the bin queries latency. */
+	if (latencyChanged)
+		gst_element_post_message(GST_ELEMENT(src_),
+					 gst_message_new_latency(GST_OBJECT(src_)));
 }
 
 static bool
@@ -256,24 +350,185 @@ gst_libcamera_src_open(GstLibcameraSrc *self)
 	return true;
 }
 
+/*
+ * Each pad pushes its buffers from its own streaming thread, so that a
+ * downstream element blocking on one pad doesn't stall the other streams.
+ */
+static void
+gst_libcamera_src_pad_task_run(gpointer user_data)
+{
+	GstPad *srcpad = GST_PAD(user_data);
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(GST_PAD_PARENT(srcpad));
+	GstLibcameraSrcState *state = self->state;
+	bool stop = false;
+
+	GstFlowReturn ret = gst_libcamera_pad_push_pending(srcpad);
+
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		ret = gst_flow_combiner_update_pad_flow(self->flow_combiner,
+							srcpad, ret);
+
+		/* Only the first pad to hit a fatal flow return handles it. */
+		if (ret != GST_FLOW_OK &&
+		    gst_task_get_state(self->task) != GST_TASK_STOPPED) {
+			gst_task_stop(self->task);
+			stop = true;
+		}
+	}
+
+	if (ret != GST_FLOW_OK) {
+		if (stop) {
+			if (ret == GST_FLOW_EOS) {
+				g_autoptr(GstEvent) eos = gst_event_new_eos();
+				guint32 seqnum = gst_util_seqnum_next();
+				gst_event_set_seqnum(eos, seqnum);
+				for (GstPad *pad : state->srcpads_)
+					gst_pad_push_event(pad, gst_event_ref(eos));
+			} else if (ret != GST_FLOW_FLUSHING) {
+				GST_ELEMENT_FLOW_ERROR(self, ret);
+			}
+		}
+
+		gst_pad_pause_task(srcpad);
+		return;
+	}
+
+	/* Capture may have been throttled by this pad, resume it. */
+	gst_libcamera_resume_task(self->task);
+
+	gst_libcamera_pad_pause_task_if_idle(srcpad);
+}
+
+/*
+ * Pause the task, unless a pad streaming thread has requested it to stop in
+ * the meantime.
+ */
+static void
+gst_libcamera_src_pause_task(GstLibcameraSrc *self)
+{
+	GLibLocker lock(GST_OBJECT(self->task));
+	if (GST_TASK_STATE(self->task) == GST_TASK_STARTED)
+		GST_TASK_STATE(self->task) = GST_TASK_PAUSED;
+}
+
+/*
+ * Update the minimum interval between requests from the QoS events received
+ * on all pads, the slowest pad wins. The interval is raised immediately when
+ * downstream reports it can't keep up, and decays slowly as requests are
+ * queued to probe for a higher rate. Return 0 if QoS is disabled.
+ */
+static GstClockTime
+gst_libcamera_src_update_qos_interval(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = self->state;
+	GstClockTime interval = 0;
+
+	for (GstPad *srcpad : state->srcpads_)
+		interval = std::max(interval, gst_libcamera_pad_take_qos_interval(srcpad));
+
+	GLibLocker lock(GST_OBJECT(self));
+
+	if (!self->qos)
+		state->qosInterval_ = 0;
+	else if (interval > state->qosInterval_)
+		state->qosInterval_ = interval;
+
+	return state->qosInterval_;
+}
+
+static gboolean
+gst_libcamera_src_qos_wakeup([[maybe_unused]] GstClock *clock,
+			     [[maybe_unused]] GstClockTime time,
+			     GstClockID id, gpointer user_data)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
+	GstLibcameraSrcState *state = self->state;
+	GLibLocker lock(GST_OBJECT(self));
+
+	if (state->qosClockId_ == id) {
+		gst_clock_id_unref(state->qosClockId_);
+		state->qosClockId_ = nullptr;
+	}
+
+	gst_libcamera_resume_task(self->task);
+
+	return TRUE;
+}
+
+/*
+ * Delay the submission of the next request until the QoS interval has elapsed
+ * since the previous one. Frames captured while no request is queued are
+ * dropped by the camera before being processed, which sheds load at the
+ * source. Return false if the request must be delayed, the task is then
+ * paused and resumed when the interval elapses.
+ */
+static bool
+gst_libcamera_src_pace(GstLibcameraSrc *self, GstClockTime interval)
+{
+	GstLibcameraSrcState *state = self->state;
+	GLibLocker lock(GST_OBJECT(self));
+
+	if (!interval || !GST_CLOCK_TIME_IS_VALID(state->lastQueueTime_))
+		return true;
+
+	GstClockTime deadline = state->lastQueueTime_ + interval;
+	if (gst_clock_get_time(state->qosClock_) >= deadline)
+		return true;
+
+	if (!state->qosClockId_) {
+		state->qosClockId_ = gst_clock_new_single_shot_id(state->qosClock_,
+								  deadline);
+		gst_clock_id_wait_async(state->qosClockId_,
+					gst_libcamera_src_qos_wakeup, self, nullptr);
+	}
+
+	gst_libcamera_src_pause_task(self);
+	return false;
+}
+
 static void
 gst_libcamera_src_task_run(gpointer user_data)
 {
 	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
 	GstLibcameraSrcState *state = self->state;
 
-	std::unique_ptr<Request> request = state->cam_->createRequest();
-	if (!request) {
-		GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
-				  ("Failed to allocate request for camera '%s'.",
-				   state->cam_->id().c_str()),
-				  ("libcamera::Camera::createRequest() failed"));
-		gst_task_stop(self->task);
-		return;
+	/*
+	 * Throttle capture while a non-leaky pad has too many buffers waiting
+	 * to be pushed. The pad streaming thread resumes the task.
+	 */
+	for (GstPad *srcpad : state->srcpads_) {
+		if (gst_libcamera_pad_is_full(srcpad)) {
+			gst_libcamera_src_pause_task(self);
+
+			/* The pad may have been drained in the meantime. */
+			if (!gst_libcamera_pad_is_full(srcpad))
+				gst_libcamera_resume_task(self->task);
+			return;
+		}
 	}
 
-	std::unique_ptr<RequestWrap> wrap =
-		std::make_unique<RequestWrap>(std::move(request));
+	GstClockTime interval = gst_libcamera_src_update_qos_interval(self);
+	if (!state->hasFrameDurationLimits_ && !gst_libcamera_src_pace(self, interval))
+		return;
+
+	/*
+	 * Pick a request from the pool. If none is available, all of them are
+	 * queued to the camera, and the task will be resumed when one of them
+	 * completes. Pausing in lock step with the completion handler ensures
+	 * the resume isn't missed.
+	 */
+	RequestWrap *wrap;
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		if (state->freeRequests_.empty()) {
+			gst_libcamera_src_pause_task(self);
+			return;
+		}
+
+		wrap = state->freeRequests_.front();
+		state->freeRequests_.pop();
+	}
 
 	for (GstPad *srcpad : state->srcpads_) {
 		GstLibcameraPool *pool = gst_libcamera_pad_get_pool(srcpad);
@@ -284,65 +539,38 @@ gst_libcamera_src_task_run(gpointer user_data)
 						     &buffer, nullptr);
 		if (ret != GST_FLOW_OK) {
 			/*
-			 * RequestWrap has ownership of the rquest, and we
-			 * won't be queueing this one due to lack of buffers.
+			 * We won't be queueing this request due to lack of
+			 * buffers, return it to the pool and wait for the
+			 * buffer-notify signal to resume the task.
 			 */
-			wrap.release();
-			break;
+			GLibLocker lock(GST_OBJECT(self));
+			state->recycleRequest(wrap);
+			gst_libcamera_src_pause_task(self);
+			return;
 		}
 
 		wrap->attachBuffer(buffer);
 	}
 
-	if (wrap) {
-		GLibLocker lock(GST_OBJECT(self));
-		GST_TRACE_OBJECT(self, "Requesting buffers");
-		state->cam_->queueRequest(wrap->request_.get());
-		state->requests_.push(std::move(wrap));
+	GLibLocker lock(GST_OBJECT(self));
+	GST_TRACE_OBJECT(self, "Requesting buffers");
 
-		/* The RequestWrap will be deleted in the completion handler. */
-	}
+	if (state->hasFrameDurationLimits_)
+		state->applyQosInterval(wrap->request_.get(), interval);
 
-	GstFlowReturn ret = GST_FLOW_OK;
-	gst_flow_combiner_reset(self->flow_combiner);
-	for (GstPad *srcpad : state->srcpads_) {
-		ret = gst_libcamera_pad_push_pending(srcpad);
-		ret = gst_flow_combiner_update_pad_flow(self->flow_combiner,
-							srcpad, ret);
+	int ret = state->cam_->queueRequest(wrap->request_.get());
+	if (ret < 0) {
+		GST_WARNING_OBJECT(self, "Failed to queue request: %s",
+				   g_strerror(-ret));
+		state->recycleRequest(wrap);
+		gst_libcamera_src_pause_task(self);
+		return;
 	}
 
-	{
-		if (ret != GST_FLOW_OK) {
-			if (ret == GST_FLOW_EOS) {
-				g_autoptr(GstEvent) eos = gst_event_new_eos();
-				guint32 seqnum = gst_util_seqnum_next();
-				gst_event_set_seqnum(eos, seqnum);
-				for (GstPad *srcpad : state->srcpads_)
-					gst_pad_push_event(srcpad, gst_event_ref(eos));
-			} else if (ret != GST_FLOW_FLUSHING) {
-				GST_ELEMENT_FLOW_ERROR(self, ret);
-			}
-			gst_task_stop(self->task);
-			return;
-		}
-
-		/*
-		 * Here we need to decide if we want to pause. This needs to
-		 * happen in lock step with the callback thread which may want
-		 * to resume the task and might push pending buffers.
-		 */
-		GLibLocker lock(GST_OBJECT(self));
-		bool do_pause = true;
-		for (GstPad *srcpad : state->srcpads_) {
-			if (gst_libcamera_pad_has_pending(srcpad)) {
-				do_pause = false;
-				break;
-			}
-		}
-
-		if (do_pause)
-			gst_task_pause(self->task);
-	}
+	/* The request is recycled in the completion handler. */
+	state->queuedRequests_.push(wrap);
+	state->lastQueueTime_ = gst_clock_get_time(state->qosClock_);
+	state->qosInterval_ -= state->qosInterval_ / 16;
 }
 
 static void
@@ -382,12 +610,19 @@ gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 	}
 	g_assert(state->config_->size() == state->srcpads_.size());
 
+	std::vector<bool> use_dmabuf(state->srcpads_.size());
+	std::vector<guint> extra_buffers(state->srcpads_.size());
+	gsize num_requests = G_MAXSIZE;
 	for (gsize i = 0; i < state->srcpads_.size(); i++) {
 		GstPad *srcpad = state->srcpads_[i];
 		StreamConfiguration &stream_cfg = state->config_->at(i);
 
-		/* Retrieve the supported caps. */
-		g_autoptr(GstCaps) filter = gst_libcamera_stream_formats_to_caps(stream_cfg.formats());
+		/*
+		 * Retrieve the supported caps. The buffers are backed by
+		 * dmabufs, offer them with the memory:DMABuf feature too.
+		 */
+		g_autoptr(GstCaps) formats = gst_libcamera_stream_formats_to_caps(stream_cfg.formats());
+		g_autoptr(GstCaps) filter = gst_libcamera_caps_add_dmabuf_feature(formats);
 		g_autoptr(GstCaps) caps = gst_pad_peer_query_caps(srcpad, filter);
 		if (gst_caps_is_empty(caps)) {
 			flow_ret = GST_FLOW_NOT_NEGOTIATED;
@@ -396,7 +631,9 @@ gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 
 		/* Fixate caps and configure the stream. */
 		caps = gst_caps_make_writable(caps);
-		gst_libcamera_configure_stream_from_caps(stream_cfg, caps);
+		bool dmabuf = false;
+		gst_libcamera_configure_stream_from_caps(stream_cfg, caps, &dmabuf);
+		use_dmabuf[i] = dmabuf;
 	}
 
 	if (flow_ret != GST_FLOW_OK)
@@ -416,7 +653,8 @@ gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 		GstPad *srcpad = state->srcpads_[i];
 		const StreamConfiguration &stream_cfg = state->config_->at(i);
 
-		g_autoptr(GstCaps) caps = gst_libcamera_stream_configuration_to_caps(stream_cfg);
+		g_autoptr(GstCaps) caps = gst_libcamera_stream_configuration_to_caps(stream_cfg,
+										      use_dmabuf[i]);
 		if (!gst_pad_push_event(srcpad, gst_event_new_caps(caps))) {
 			flow_ret = GST_FLOW_NOT_NEGOTIATED;
 			break;
@@ -437,7 +675,53 @@ gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 		return;
 	}
 
-	self->allocator = gst_libcamera_allocator_new(state->cam_, state->config_.get());
+	/* No need to lock here, the camera isn't started yet. */
+	{
+		const ControlInfoMap &infoMap = state->cam_->controls();
+		auto iter = infoMap.find(&controls::FrameDurationLimits);
+
+		state->hasFrameDurationLimits_ = iter != infoMap.end();
+		if (state->hasFrameDurationLimits_) {
+			state->minFrameDuration_ = iter->second.min().get<int64_t>();
+			state->maxFrameDuration_ = iter->second.max().get<int64_t>();
+			state->qosFrameDuration_ = state->minFrameDuration_;
+		}
+
+		state->qosInterval_ = 0;
+		state->qosClock_ = gst_system_clock_obtain();
+		state->qosClockId_ = nullptr;
+		state->lastQueueTime_ = GST_CLOCK_TIME_NONE;
+	}
+
+	/*
+	 * Query downstream for the number of buffers it needs to hold, to
+	 * allocate them on top of the ones queued to the camera.
+	 */
+	for (gsize i = 0; i < state->srcpads_.size(); i++) {
+		GstPad *srcpad = state->srcpads_[i];
+		g_autoptr(GstCaps) caps = gst_pad_get_current_caps(srcpad);
+		if (!caps)
+			continue;
+
+		g_autoptr(GstQuery) query = gst_query_new_allocation(caps, FALSE);
+		if (!gst_pad_peer_query(srcpad, query))
+			continue;
+
+		for (guint j = 0; j < gst_query_get_n_allocation_pools(query); j++) {
+			guint min_buffers;
+
+			gst_query_parse_nth_allocation_pool(query, j, nullptr,
+							    nullptr, &min_buffers,
+							    nullptr);
+			extra_buffers[i] = std::max(extra_buffers[i], min_buffers);
+		}
+
+		GST_DEBUG_OBJECT(srcpad, "Downstream requires %u buffers",
+				 extra_buffers[i]);
+	}
+
+	self->allocator = gst_libcamera_allocator_new(state->cam_, state->config_.get(),
+						      extra_buffers);
 	if (!self->allocator) {
 		GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
 				  ("Failed to allocate memory"),
@@ -457,6 +741,33 @@ gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 
 		gst_libcamera_pad_set_pool(srcpad, pool);
 		gst_flow_combiner_add_pad(self->flow_combiner, srcpad);
+
+		gsize pool_size = gst_libcamera_allocator_get_pool_size(self->allocator,
+									stream_cfg.stream());
+		num_requests = std::min({ num_requests, pool_size,
+					  static_cast<gsize>(stream_cfg.bufferCount) });
+	}
+
+	/*
+	 * Allocate the requests upfront and recycle them for the whole
+	 * streaming session. More requests than buffers would never be queued,
+	 * and the buffers beyond the stream buffer count are left for
+	 * downstream to hold. No need to lock here, the camera isn't started
+	 * yet.
+	 */
+	for (gsize i = 0; i < num_requests; i++) {
+		std::unique_ptr<Request> request = state->cam_->createRequest();
+		if (!request) {
+			GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
+					  ("Failed to allocate request for camera '%s'.",
+					   state->cam_->id().c_str()),
+					  ("libcamera::Camera::createRequest() failed"));
+			gst_task_stop(task);
+			return;
+		}
+
+		state->requestPool_.push_back(std::make_unique<RequestWrap>(std::move(request)));
+		state->freeRequests_.push(state->requestPool_.back().get());
 	}
 
 	ret = state->cam_->start();
@@ -468,6 +779,12 @@ gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 		return;
 	}
 
+	for (GstPad *srcpad : state->srcpads_) {
+		gst_pad_start_task(srcpad, gst_libcamera_src_pad_task_run,
+				   srcpad, nullptr);
+		gst_libcamera_pad_pause_task_if_idle(srcpad);
+	}
+
 done:
 	switch (flow_ret) {
 	case GST_FLOW_NOT_NEGOTIATED:
@@ -491,8 +808,30 @@ gst_libcamera_src_task_leave([[maybe_unused]] GstTask *task,
 
 	state->cam_->stop();
 
-	for (GstPad *srcpad : state->srcpads_)
+	for (GstPad *srcpad : state->srcpads_) {
+		gst_pad_stop_task(srcpad);
+		gst_libcamera_pad_clear_pending(srcpad);
+	}
+
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		state->queuedRequests_ = {};
+		state->freeRequests_ = {};
+		state->requestPool_.clear();
+
+		if (state->qosClockId_) {
+			gst_clock_id_unschedule(state->qosClockId_);
+			gst_clock_id_unref(state->qosClockId_);
+			state->qosClockId_ = nullptr;
+		}
+	}
+
+	g_clear_object(&state->qosClock_);
+
+	for (GstPad *srcpad : state->srcpads_) {
 		gst_libcamera_pad_set_pool(srcpad, nullptr);
+		gst_libcamera_pad_reset_qos(srcpad);
+	}
 
 	g_clear_object(&self->allocator);
 	g_clear_pointer(&self->flow_combiner,
@@ -532,6 +871,9 @@ gst_libcamera_src_set_property(GObject *object, guint prop_id,
 		g_free(self->camera_name);
 		self->camera_name = g_value_dup_string(value);
 		break;
+	case PROP_QOS:
+		self->qos = g_value_get_boolean(value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -549,6 +891,9 @@ gst_libcamera_src_get_property(GObject *object, guint prop_id, GValue *value,
 	case PROP_CAMERA_NAME:
 		g_value_set_string(value, self->camera_name);
 		break;
+	case PROP_QOS:
+		g_value_set_boolean(value, self->qos);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -717,4 +1062,14 @@ gst_libcamera_src_class_init(GstLibcameraSrcClass *klass)
 							     | G_PARAM_READWRITE
 							     | G_PARAM_STATIC_STRINGS));
 	g_object_class_install_property(object_class, PROP_CAMERA_NAME, spec);
+
+	spec = g_param_spec_boolean("qos", "QoS",
+				    "Lower the capture rate when downstream reports "
+				    "through QoS events that it can't keep up",
+				    TRUE,
+				    (GParamFlags)(GST_PARAM_MUTABLE_PLAYING
+						  | G_PARAM_CONSTRUCT
+						  | G_PARAM_READWRITE
+						  | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_QOS, spec);
 }
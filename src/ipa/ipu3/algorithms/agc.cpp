@@ -116,17 +116,14 @@ double Agc::measureBrightness(const ipu3_uapi_stats_3a *stats,
 	/* Initialise the histogram array */
 	uint32_t hist[knumHistogramBins] = { 0 };
 
+	const ipu3_uapi_awb_set_item *cells = stats->awb_raw_buffer.meta_data;
+
 	for (unsigned int cellY = 0; cellY < grid.height; cellY++) {
 		for (unsigned int cellX = 0; cellX < grid.width; cellX++) {
-			uint32_t cellPosition = cellY * stride_ + cellX;
-
-			const ipu3_uapi_awb_set_item *cell =
-				reinterpret_cast<const ipu3_uapi_awb_set_item *>(
-					&stats->awb_raw_buffer.meta_data[cellPosition]
-				);
+			const ipu3_uapi_awb_set_item &cell = cells[cellX];
 
-			uint8_t gr = cell->Gr_avg;
-			uint8_t gb = cell->Gb_avg;
+			uint8_t gr = cell.Gr_avg;
+			uint8_t gb = cell.Gb_avg;
 			/*
 			 * Store the average green value to estimate the
 			 * brightness. Even the overexposed pixels are
@@ -134,6 +131,8 @@ double Agc::measureBrightness(const ipu3_uapi_stats_3a *stats,
 			 */
 			hist[(gr + gb) / 2]++;
 		}
+
+		cells += stride_;
 	}
 
 	/* Estimate the quantile mean of the top 2% of the histogram. */
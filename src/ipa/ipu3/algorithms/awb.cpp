@@ -213,6 +213,17 @@ int Awb::configure(IPAContext &context,
 	cellsPerZoneThreshold_ = cellsPerZoneX_ * cellsPerZoneY_ * kMaxCellSaturationRatio;
 	LOG(IPU3Awb, Debug) << "Threshold for AWB is set to " << cellsPerZoneThreshold_;
 
+	/*
+	 * The grid doesn't change until the next configuration, locate the
+	 * cells of each zone once instead of for every frame.
+	 */
+	for (unsigned int zoneY = 0; zoneY < kAwbStatsSizeY; zoneY++) {
+		for (unsigned int zoneX = 0; zoneX < kAwbStatsSizeX; zoneX++) {
+			zoneOffsets_[zoneY * kAwbStatsSizeX + zoneX] =
+				zoneY * cellsPerZoneY_ * stride_ + zoneX * cellsPerZoneX_;
+		}
+	}
+
 	return 0;
 }
 
@@ -270,51 +281,50 @@ void Awb::generateAwbStats(const ipu3_uapi_stats_3a *stats)
 {
 	/*
 	 * Generate a (kAwbStatsSizeX x kAwbStatsSizeY) array from the IPU3 grid which is
-	 * (grid.width x grid.height).
+	 * (grid.width x grid.height). Each zone is accumulated in one go, reading
+	 * its cells row by row directly from the statistics buffer.
 	 */
-	for (unsigned int cellY = 0; cellY < kAwbStatsSizeY * cellsPerZoneY_; cellY++) {
-		for (unsigned int cellX = 0; cellX < kAwbStatsSizeX * cellsPerZoneX_; cellX++) {
-			uint32_t cellPosition = cellY * stride_ + cellX;
-			uint32_t zoneX = cellX / cellsPerZoneX_;
-			uint32_t zoneY = cellY / cellsPerZoneY_;
-
-			uint32_t awbZonePosition = zoneY * kAwbStatsSizeX + zoneX;
-
-			/* Cast the initial IPU3 structure to simplify the reading */
-			const ipu3_uapi_awb_set_item *currentCell =
-				reinterpret_cast<const ipu3_uapi_awb_set_item *>(
-					&stats->awb_raw_buffer.meta_data[cellPosition]
-				);
-
-			/*
-			 * Use cells which have less than 90%
-			 * saturation as an initial means to include
-			 * otherwise bright cells which are not fully
-			 * saturated.
-			 *
-			 * \todo The 90% saturation rate may require
-			 * further empirical measurements and
-			 * optimisation during camera tuning phases.
-			 */
-			if (currentCell->sat_ratio <= kMinCellsPerZoneRatio) {
-				/* The cell is not saturated, use the current cell */
-				awbStats_[awbZonePosition].counted++;
-				uint32_t greenValue = currentCell->Gr_avg + currentCell->Gb_avg;
-				awbStats_[awbZonePosition].sum.green += greenValue / 2;
-				awbStats_[awbZonePosition].sum.red += currentCell->R_avg;
-				awbStats_[awbZonePosition].sum.blue += currentCell->B_avg;
+	for (unsigned int i = 0; i < kAwbStatsSizeX * kAwbStatsSizeY; i++) {
+		const ipu3_uapi_awb_set_item *cells =
+			&stats->awb_raw_buffer.meta_data[zoneOffsets_[i]];
+		uint32_t counted = 0;
+		uint32_t red = 0;
+		uint32_t green = 0;
+		uint32_t blue = 0;
+
+		for (unsigned int cellY = 0; cellY < cellsPerZoneY_; cellY++) {
+			for (unsigned int cellX = 0; cellX < cellsPerZoneX_; cellX++) {
+				const ipu3_uapi_awb_set_item &cell = cells[cellX];
+
+				/*
+				 * Use cells which have less than 90%
+				 * saturation as an initial means to include
+				 * otherwise bright cells which are not fully
+				 * saturated.
+				 *
+				 * The test is folded into the sums instead of
+				 * branching, to let the compiler vectorise
+				 * the loop.
+				 *
+				 * \todo The 90% saturation rate may require
+				 * further empirical measurements and
+				 * optimisation during camera tuning phases.
+				 */
+				uint32_t valid = cell.sat_ratio <= kMinCellsPerZoneRatio;
+
+				counted += valid;
+				green += valid * ((cell.Gr_avg + cell.Gb_avg) / 2);
+				red += valid * cell.R_avg;
+				blue += valid * cell.B_avg;
 			}
+
+			cells += stride_;
 		}
-	}
-}
 
-void Awb::clearAwbStats()
-{
-	for (unsigned int i = 0; i < kAwbStatsSizeX * kAwbStatsSizeY; i++) {
-		awbStats_[i].sum.blue = 0;
-		awbStats_[i].sum.red = 0;
-		awbStats_[i].sum.green = 0;
-		awbStats_[i].counted = 0;
+		awbStats_[i].counted = counted;
+		awbStats_[i].sum.red = red;
+		awbStats_[i].sum.green = green;
+		awbStats_[i].sum.blue = blue;
 	}
 }
 
@@ -363,7 +373,6 @@ void Awb::calculateWBGains(const ipu3_uapi_stats_3a *stats)
 {
 	ASSERT(stats->stats_3a_status.awb_en);
 
-	clearAwbStats();
 	generateAwbStats(stats);
 	generateZones();
 
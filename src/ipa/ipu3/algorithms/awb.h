@@ -68,13 +68,14 @@ private:
 	void calculateWBGains(const ipu3_uapi_stats_3a *stats);
 	void generateZones();
 	void generateAwbStats(const ipu3_uapi_stats_3a *stats);
-	void clearAwbStats();
 	void awbGreyWorld();
 	uint32_t estimateCCT(double red, double green, double blue);
 	static constexpr uint16_t threshold(float value);
 
 	std::vector<RGB> zones_;
 	Accumulator awbStats_[kAwbStatsSizeX * kAwbStatsSizeY];
+	/* Position of the top-left cell of each zone in the statistics grid */
+	uint32_t zoneOffsets_[kAwbStatsSizeX * kAwbStatsSizeY];
 	AwbStatus asyncResults_;
 
 	uint32_t stride_;
@@ -27,7 +27,7 @@ namespace ipa::ipu3::algorithms {
  */
 
 ToneMapping::ToneMapping()
-	: gamma_(1.0)
+	: gamma_(1.0), programmedGamma_(0.0)
 {
 }
 
@@ -44,6 +44,9 @@ int ToneMapping::configure(IPAContext &context,
 	/* Initialise tone mapping gamma value. */
 	context.frameContext.toneMapping.gamma = 0.0;
 
+	/* The ImgU is reinitialised, the LUT has to be programmed again. */
+	programmedGamma_ = 0.0;
+
 	return 0;
 }
 
@@ -54,10 +57,20 @@ int ToneMapping::configure(IPAContext &context,
  *
  * Populate the IPU3 parameter structure with our tone mapping look up table and
  * enable the gamma control module in the processing blocks.
+ *
+ * The ImgU retains the gamma configuration until the next parameters buffer
+ * with the gamma use flag set. The LUT is thus only copied when it has changed
+ * since it was last programmed, which leaves the gamma block untouched in
+ * steady state.
  */
-void ToneMapping::prepare([[maybe_unused]] IPAContext &context,
-			  ipu3_uapi_params *params)
+void ToneMapping::prepare(IPAContext &context, ipu3_uapi_params *params)
 {
+	double gamma = context.frameContext.toneMapping.gamma;
+
+	/* Skip until the LUT has been computed, and when it hasn't changed. */
+	if (gamma == 0.0 || gamma == programmedGamma_)
+		return;
+
 	/* Copy the calculated LUT into the parameters buffer. */
 	memcpy(params->acc_param.gamma.gc_lut.lut,
 	       context.frameContext.toneMapping.gammaCorrection.lut,
@@ -67,6 +80,8 @@ void ToneMapping::prepare([[maybe_unused]] IPAContext &context,
 	/* Enable the custom gamma table. */
 	params->use.acc_gamma = 1;
 	params->acc_param.gamma.gc_ctrl.enable = 1;
+
+	programmedGamma_ = gamma;
 }
 
 /**
@@ -24,6 +24,7 @@ public:
 
 private:
 	double gamma_;
+	double programmedGamma_;
 };
 
 } /* namespace ipa::ipu3::algorithms */
@@ -36,6 +36,7 @@
 #include "algorithms/blc.h"
 #include "algorithms/tone_mapping.h"
 #include "libipa/camera_sensor_helper.h"
+#include "libipa/converged_state.h"
 
 /* Minimum grid width, expressed as a number of cells */
 static constexpr uint32_t kMinGridWidth = 16;
@@ -134,7 +135,7 @@ public:
 		 const ControlInfoMap &sensorControls,
 		 ControlInfoMap *ipaControls) override;
 
-	int start() override;
+	int start(const ControlList &controls) override;
 	void stop() override;
 
 	int configure(const IPAConfigInfo &configInfo,
@@ -156,6 +157,7 @@ private:
 			     const ipu3_uapi_stats_3a *stats);
 
 	void setControls(unsigned int frame);
+	void restoreConvergedState(Span<const uint8_t> data);
 	void calculateBdsGrid(const Size &bdsOutputSize);
 
 	std::map<unsigned int, MappedFrameBuffer> buffers_;
@@ -181,6 +183,16 @@ private:
 	/* Maintain the algorithms used by the IPA */
 	std::list<std::unique_ptr<ipa::ipu3::Algorithm>> algorithms_;
 
+	/* Processing time of each algorithm, in the order of algorithms_ */
+	struct AlgorithmTimings {
+		const char *name;
+		utils::Duration prepare;
+		utils::Duration process;
+	};
+	std::list<AlgorithmTimings> timings_;
+	unsigned int preparedFrames_;
+	unsigned int processedFrames_;
+
 	/* Local parameter storage */
 	struct IPAContext context_;
 };
@@ -223,6 +235,8 @@ void IPAIPU3::updateSessionConfiguration(const ControlInfoMap &sensorControls)
  * This function computes:
  * - controls::ExposureTime
  * - controls::FrameDurationLimits
+ *
+ * It also reports support for controls::draft::ConvergedState.
  */
 void IPAIPU3::updateControls(const IPACameraSensorInfo &sensorInfo,
 			     const ControlInfoMap &sensorControls,
@@ -270,6 +284,9 @@ void IPAIPU3::updateControls(const IPACameraSensorInfo &sensorInfo,
 							       frameDurations[1],
 							       frameDurations[2]);
 
+	controls[&controls::draft::ConvergedState] = ControlInfo(static_cast<uint8_t>(0),
+								  static_cast<uint8_t>(255));
+
 	*ipaControls = ControlInfoMap(std::move(controls), controls::controls);
 }
 
@@ -295,9 +312,13 @@ int IPAIPU3::init(const IPASettings &settings,
 
 	/* Construct our Algorithms */
 	algorithms_.push_back(std::make_unique<algorithms::Agc>());
+	timings_.push_back({ "Agc", {}, {} });
 	algorithms_.push_back(std::make_unique<algorithms::Awb>());
+	timings_.push_back({ "Awb", {}, {} });
 	algorithms_.push_back(std::make_unique<algorithms::BlackLevelCorrection>());
+	timings_.push_back({ "BlackLevelCorrection", {}, {} });
 	algorithms_.push_back(std::make_unique<algorithms::ToneMapping>());
+	timings_.push_back({ "ToneMapping", {}, {} });
 
 	/* Initialize controls. */
 	updateControls(sensorInfo, sensorControls, ipaControls);
@@ -307,23 +328,56 @@ int IPAIPU3::init(const IPASettings &settings,
 
 /**
  * \brief Perform any processing required before the first frame
+ * \param[in] controls The controls passed to Camera::start()
+ *
+ * The algorithms are seeded with the converged state of a previous session
+ * when the \a controls contain a valid controls::draft::ConvergedState.
  */
-int IPAIPU3::start()
+int IPAIPU3::start(const ControlList &controls)
 {
+	if (controls.contains(controls::CONVERGED_STATE))
+		restoreConvergedState(controls.get(controls::draft::ConvergedState));
+
 	/*
 	 * Set the sensors V4L2 controls before the first frame to ensure that
 	 * we have an expected and known configuration from the start.
 	 */
 	setControls(0);
 
+	for (AlgorithmTimings &timing : timings_) {
+		timing.prepare = {};
+		timing.process = {};
+	}
+
+	preparedFrames_ = 0;
+	processedFrames_ = 0;
+
 	return 0;
 }
 
 /**
  * \brief Ensure that all processing has completed
+ *
+ * The average processing time of each algorithm since start() is reported at
+ * the Debug log level.
  */
 void IPAIPU3::stop()
 {
+	for (const AlgorithmTimings &timing : timings_) {
+		utils::Duration prepare;
+		utils::Duration process;
+
+		if (preparedFrames_)
+			prepare = timing.prepare / preparedFrames_;
+		if (processedFrames_)
+			process = timing.process / processedFrames_;
+
+		LOG(IPAIPU3, Debug)
+			<< timing.name << ": prepare " << prepare.get<std::micro>()
+			<< "us (" << preparedFrames_ << " frames), process "
+			<< process.get<std::micro>() << "us ("
+			<< processedFrames_ << " frames)";
+	}
 }
 
 /**
@@ -525,7 +579,7 @@ void IPAIPU3::processEvent(const IPU3Event &event)
 	case EventFillParams: {
 		auto it = buffers_.find(event.bufferId);
 		if (it == buffers_.end()) {
-			LOG(IPAIPU3, Error) << "Could not find param buffer!";
+			LOG_RATELIMITED(IPAIPU3, Error) << "Could not find param buffer!";
 			return;
 		}
 
@@ -539,7 +593,7 @@ void IPAIPU3::processEvent(const IPU3Event &event)
 	case EventStatReady: {
 		auto it = buffers_.find(event.bufferId);
 		if (it == buffers_.end()) {
-			LOG(IPAIPU3, Error) << "Could not find stats buffer!";
+			LOG_RATELIMITED(IPAIPU3, Error) << "Could not find stats buffer!";
 			return;
 		}
 
@@ -594,8 +648,15 @@ void IPAIPU3::fillParams(unsigned int frame, ipu3_uapi_params *params)
 	 */
 	params->use = {};
 
-	for (auto const &algo : algorithms_)
+	auto timing = timings_.begin();
+	for (auto const &algo : algorithms_) {
+		utils::time_point begin = utils::clock::now();
 		algo->prepare(context_, params);
+		timing->prepare += utils::clock::now() - begin;
+		++timing;
+	}
+
+	preparedFrames_++;
 
 	IPU3Action op;
 	op.op = ActionParamFilled;
@@ -619,8 +680,15 @@ void IPAIPU3::parseStatistics(unsigned int frame,
 {
 	ControlList ctrls(controls::controls);
 
-	for (auto const &algo : algorithms_)
+	auto timing = timings_.begin();
+	for (auto const &algo : algorithms_) {
+		utils::time_point begin = utils::clock::now();
 		algo->process(context_, stats);
+		timing->process += utils::clock::now() - begin;
+		++timing;
+	}
+
+	processedFrames_++;
 
 	setControls(frame);
 
@@ -634,6 +702,20 @@ void IPAIPU3::parseStatistics(unsigned int frame,
 
 	ctrls.set(controls::ExposureTime, context_.frameContext.sensor.exposure * lineDuration_.get<std::micro>());
 
+	const IPAFrameContext &frameContext = context_.frameContext;
+	if (frameContext.awb.gains.green) {
+		ConvergedState state;
+		state.exposureTime = frameContext.agc.exposure * lineDuration_;
+		state.analogueGain = frameContext.agc.gain;
+		state.redGain = frameContext.awb.gains.red / frameContext.awb.gains.green;
+		state.blueGain = frameContext.awb.gains.blue / frameContext.awb.gains.green;
+		state.colourTemperature = frameContext.awb.temperatureK;
+
+		std::vector<uint8_t> stateData = state.serialize();
+		ctrls.set(controls::draft::ConvergedState,
+			  Span<const uint8_t>(stateData));
+	}
+
 	/*
 	 * \todo The Metadata provides a path to getting extended data
 	 * out to the application. Further data such as a simplifed Histogram
@@ -649,6 +731,38 @@ void IPAIPU3::parseStatistics(unsigned int frame,
 	queueFrameAction.emit(frame, op);
 }
 
+/**
+ * \brief Seed the algorithms with the converged state of a previous session
+ * \param[in] data The serialized converged state
+ *
+ * The exposure and gain are clamped to the limits of the current sensor
+ * configuration. Invalid states are ignored.
+ */
+void IPAIPU3::restoreConvergedState(Span<const uint8_t> data)
+{
+	std::optional<ConvergedState> state = ConvergedState::deserialize(data);
+	if (!state)
+		return;
+
+	const IPASessionConfiguration &configuration = context_.configuration;
+	IPAFrameContext &frameContext = context_.frameContext;
+
+	utils::Duration exposureTime =
+		std::clamp(state->exposureTime, configuration.agc.minShutterSpeed,
+			   configuration.agc.maxShutterSpeed);
+	frameContext.agc.exposure = exposureTime / lineDuration_;
+	frameContext.agc.gain = std::clamp(state->analogueGain,
+					   configuration.agc.minAnalogueGain,
+					   configuration.agc.maxAnalogueGain);
+
+	frameContext.awb.gains.red = state->redGain;
+	frameContext.awb.gains.green = 1.0;
+	frameContext.awb.gains.blue = state->blueGain;
+	frameContext.awb.temperatureK = state->colourTemperature;
+
+	LOG(IPAIPU3, Debug) << "Restored converged state";
+}
+
 /**
  * \brief Handle sensor controls for a given \a frame number
  * \param[in] frame The frame on which the sensor controls should be set
@@ -0,0 +1,404 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipu3-ipa-replay.cpp - Replay recorded IPU3 IPA calls offline
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/base/span.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/ipa/ipu3_ipa_interface.h>
+#include <libcamera/ipa/ipu3_ipa_serializer.h>
+
+#include "libcamera/internal/control_serializer.h"
+#include "libcamera/internal/ipa_module.h"
+#include "libcamera/internal/ipa_recorder.h"
+
+using namespace libcamera;
+using namespace libcamera::ipa::ipu3;
+
+namespace {
+
+struct Buffer {
+	FileDescriptor fd;
+	Span<uint8_t> mem;
+};
+
+struct Timings {
+	unsigned int count = 0;
+	utils::Duration total;
+	utils::Duration max;
+};
+
+unsigned int actionCount = 0;
+
+void queueFrameAction([[maybe_unused]] unsigned int frame,
+		      [[maybe_unused]] const IPU3Action &action)
+{
+	actionCount++;
+}
+
+const char *eventName(uint32_t op)
+{
+	switch (op) {
+	case EventProcessControls:
+		return "processControls";
+	case EventStatReady:
+		return "processStatistics";
+	case EventFillParams:
+		return "fillParams";
+	default:
+		return "unknown";
+	}
+}
+
+class Replay
+{
+public:
+	Replay(IPAIPU3Interface *ipa)
+		: ipa_(ipa), cs_(ControlSerializer::Role::Proxy)
+	{
+	}
+
+	~Replay()
+	{
+		for (auto &[id, buffer] : buffers_)
+			munmap(buffer.mem.data(), buffer.mem.size());
+	}
+
+	int run(IPARecording &recording);
+	void report() const;
+
+private:
+	int init(const IPARecording::Record &record);
+	int configure(const IPARecording::Record &record);
+	int mapBuffers(const IPARecording::Record &record);
+	int unmapBuffers(const IPARecording::Record &record);
+	int start(const IPARecording::Record &record);
+	int processEvent(const IPARecording::Record &record);
+
+	IPAIPU3Interface *ipa_;
+	ControlSerializer cs_;
+
+	ControlInfoMap sensorControls_;
+	std::map<unsigned int, Buffer> buffers_;
+	std::map<uint32_t, Timings> timings_;
+};
+
+int Replay::run(IPARecording &recording)
+{
+	IPARecording::Record record;
+	int ret;
+
+	while ((ret = recording.read(&record)) == 0) {
+		switch (record.type) {
+		case IPARecorder::Init:
+			ret = init(record);
+			break;
+		case IPARecorder::Configure:
+			ret = configure(record);
+			break;
+		case IPARecorder::MapBuffers:
+			ret = mapBuffers(record);
+			break;
+		case IPARecorder::UnmapBuffers:
+			ret = unmapBuffers(record);
+			break;
+		case IPARecorder::Start:
+			ret = start(record);
+			break;
+		case IPARecorder::Stop:
+			ipa_->stop();
+			break;
+		case IPARecorder::Event:
+			ret = processEvent(record);
+			break;
+		default:
+			std::cerr << "Unknown record type " << record.type << std::endl;
+			ret = -EINVAL;
+			break;
+		}
+
+		if (ret < 0)
+			return ret;
+	}
+
+	return ret == -ENODATA ? 0 : ret;
+}
+
+int Replay::init(const IPARecording::Record &record)
+{
+	if (record.fields.size() != 3)
+		return -EINVAL;
+
+	IPASettings settings =
+		IPADataSerializer<IPASettings>::deserialize(record.fields[0], &cs_);
+	IPACameraSensorInfo sensorInfo =
+		IPADataSerializer<IPACameraSensorInfo>::deserialize(record.fields[1], &cs_);
+	sensorControls_ =
+		IPADataSerializer<ControlInfoMap>::deserialize(record.fields[2], &cs_);
+
+	std::cout << "Replaying " << settings.sensorModel << " recording"
+		  << std::endl;
+
+	ControlInfoMap ipaControls;
+	int ret = ipa_->init(settings, sensorInfo, sensorControls_, &ipaControls);
+	if (ret < 0)
+		std::cerr << "Failed to initialize the IPA: " << strerror(-ret)
+			  << std::endl;
+
+	return ret;
+}
+
+int Replay::configure(const IPARecording::Record &record)
+{
+	if (record.fields.size() != 1)
+		return -EINVAL;
+
+	IPAConfigInfo configInfo =
+		IPADataSerializer<IPAConfigInfo>::deserialize(record.fields[0], &cs_);
+
+	/*
+	 * The serializer skips ControlInfoMap instances it has already
+	 * serialized, the sensor controls recorded at init time are then used.
+	 */
+	if (configInfo.sensorControls.empty())
+		configInfo.sensorControls = sensorControls_;
+
+	ControlInfoMap ipaControls;
+	int ret = ipa_->configure(configInfo, &ipaControls);
+	if (ret < 0)
+		std::cerr << "Failed to configure the IPA: " << strerror(-ret)
+			  << std::endl;
+
+	return ret;
+}
+
+int Replay::mapBuffers(const IPARecording::Record &record)
+{
+	std::vector<IPABuffer> ipaBuffers;
+
+	for (const std::vector<uint8_t> &field : record.fields) {
+		IPARecorder::BufferInfo info;
+		if (field.size() != sizeof(info))
+			return -EINVAL;
+
+		memcpy(&info, field.data(), sizeof(info));
+
+		int fd = memfd_create("ipu3-ipa-replay", MFD_CLOEXEC);
+		if (fd < 0 || ftruncate(fd, info.length) < 0) {
+			int ret = -errno;
+			std::cerr << "Failed to allocate buffer: " << strerror(-ret)
+				  << std::endl;
+			if (fd >= 0)
+				close(fd);
+			return ret;
+		}
+
+		void *mem = mmap(nullptr, info.length, PROT_READ | PROT_WRITE,
+				 MAP_SHARED, fd, 0);
+		if (mem == MAP_FAILED) {
+			int ret = -errno;
+			close(fd);
+			return ret;
+		}
+
+		Buffer &buffer = buffers_[info.id];
+		buffer.fd = FileDescriptor(std::move(fd));
+		buffer.mem = { static_cast<uint8_t *>(mem), info.length };
+
+		FrameBuffer::Plane plane;
+		plane.fd = buffer.fd;
+		plane.offset = 0;
+		plane.length = info.length;
+
+		ipaBuffers.emplace_back(info.id, std::vector<FrameBuffer::Plane>{ plane });
+	}
+
+	ipa_->mapBuffers(ipaBuffers);
+
+	return 0;
+}
+
+int Replay::unmapBuffers(const IPARecording::Record &record)
+{
+	if (record.fields.size() != 1 ||
+	    record.fields[0].size() % sizeof(unsigned int))
+		return -EINVAL;
+
+	std::vector<unsigned int> ids(record.fields[0].size() / sizeof(unsigned int));
+	memcpy(ids.data(), record.fields[0].data(), record.fields[0].size());
+
+	ipa_->unmapBuffers(ids);
+
+	for (unsigned int id : ids) {
+		auto it = buffers_.find(id);
+		if (it == buffers_.end())
+			continue;
+
+		munmap(it->second.mem.data(), it->second.mem.size());
+		buffers_.erase(it);
+	}
+
+	return 0;
+}
+
+int Replay::start(const IPARecording::Record &record)
+{
+	/* Recordings made before start controls were recorded have no field. */
+	if (record.fields.size() > 1)
+		return -EINVAL;
+
+	ControlList controls(controls::controls);
+	if (!record.fields.empty())
+		controls = IPADataSerializer<ControlList>::deserialize(record.fields[0], &cs_);
+
+	return ipa_->start(controls);
+}
+
+int Replay::processEvent(const IPARecording::Record &record)
+{
+	if (record.fields.size() != 2)
+		return -EINVAL;
+
+	IPU3Event ev = IPADataSerializer<IPU3Event>::deserialize(record.fields[0], &cs_);
+
+	/* Restore the content of the statistics buffer. */
+	const std::vector<uint8_t> &content = record.fields[1];
+	if (!content.empty()) {
+		auto it = buffers_.find(ev.bufferId);
+		if (it == buffers_.end() || it->second.mem.size() < content.size()) {
+			std::cerr << "Invalid buffer " << ev.bufferId
+				  << " for frame " << ev.frame << std::endl;
+			return -EINVAL;
+		}
+
+		memcpy(it->second.mem.data(), content.data(), content.size());
+	}
+
+	utils::time_point begin = utils::clock::now();
+	ipa_->processEvent(ev);
+	utils::Duration duration = utils::clock::now() - begin;
+
+	Timings &timing = timings_[ev.op];
+	timing.count++;
+	timing.total += duration;
+	timing.max = std::max(timing.max, duration);
+
+	return 0;
+}
+
+void Replay::report() const
+{
+	std::cout << std::left << std::setw(20) << "event"
+		  << std::right << std::setw(8) << "count"
+		  << std::setw(12) << "mean (us)"
+		  << std::setw(12) << "max (us)" << std::endl;
+
+	for (const auto &[op, timing] : timings_) {
+		utils::Duration mean = timing.total / timing.count;
+
+		std::cout << std::left << std::setw(20) << eventName(op)
+			  << std::right << std::setw(8) << timing.count
+			  << std::fixed << std::setprecision(2)
+			  << std::setw(12) << mean.get<std::micro>()
+			  << std::setw(12) << timing.max.get<std::micro>()
+			  << std::endl;
+	}
+
+	std::cout << actionCount << " actions queued by the IPA" << std::endl;
+}
+
+void usage(const char *argv0)
+{
+	std::cout
+		<< "Usage: " << argv0 << " [options] <recording>" << std::endl
+		<< std::endl
+		<< "Replay the IPA calls recorded by the IPU3 pipeline handler when the" << std::endl
+		<< "LIBCAMERA_IPU3_IPA_RECORD environment variable is set, and report the" << std::endl
+		<< "processing time of each event type." << std::endl
+		<< std::endl
+		<< "Options:" << std::endl
+		<< "  -m, --module <path>    Path to the IPU3 IPA module" << std::endl
+		<< "                         (default: " << IPU3_IPA_MODULE_PATH << ")" << std::endl
+		<< "  -h, --help             Display this help message" << std::endl;
+}
+
+} /* namespace */
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{ "module", required_argument, nullptr, 'm' },
+		{ "help", no_argument, nullptr, 'h' },
+		{},
+	};
+
+	std::string modulePath = IPU3_IPA_MODULE_PATH;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "m:h", options, nullptr)) != -1) {
+		switch (opt) {
+		case 'm':
+			modulePath = optarg;
+			break;
+
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	IPARecording recording;
+	if (recording.open(argv[optind]) < 0)
+		return EXIT_FAILURE;
+
+	IPAModule module(modulePath);
+	if (!module.isValid() || !module.load()) {
+		std::cerr << "Failed to load IPA module " << modulePath << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::unique_ptr<IPAIPU3Interface> ipa{
+		static_cast<IPAIPU3Interface *>(module.createInterface())
+	};
+	if (!ipa) {
+		std::cerr << "Failed to create the IPA interface" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	ipa->queueFrameAction.connect(&queueFrameAction);
+
+	Replay replay(ipa.get());
+	int ret = replay.run(recording);
+	if (ret < 0) {
+		std::cerr << "Replay failed: " << strerror(-ret) << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	replay.report();
+
+	return EXIT_SUCCESS;
+}
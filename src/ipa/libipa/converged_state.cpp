@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * converged_state.cpp - Persistable state of converged 3A algorithms
+ */
+
+#include "converged_state.h"
+
+#include <cmath>
+
+#include <libcamera/base/log.h>
+
+#include "libcamera/internal/byte_stream_buffer.h"
+
+/**
+ * \file converged_state.h
+ * \brief Persistable state of converged 3A algorithms
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPAConvergedState)
+
+namespace ipa {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x33414c43; /* "CLA3" */
+constexpr uint32_t kVersion = 1;
+
+} /* namespace */
+
+/**
+ * \struct ConvergedState
+ * \brief The converged state of the AGC and AWB algorithms
+ *
+ * The 3A algorithms need several frames to converge when a camera starts from
+ * default settings. IPA modules report the state of their algorithms in the
+ * draft::ConvergedState control of the request metadata, and seed the
+ * algorithms with the state passed to Camera::start(), to deliver usable
+ * frames right after a restart in a similar scene.
+ *
+ * The state is stored in a compact, versioned binary format. Colour shading
+ * tables are not stored, as IPA modules derive them from the colour
+ * temperature.
+ *
+ * \var ConvergedState::exposureTime
+ * \brief The exposure time
+ *
+ * \var ConvergedState::analogueGain
+ * \brief The analogue gain
+ *
+ * \var ConvergedState::redGain
+ * \brief The red colour gain, relative to the green gain
+ *
+ * \var ConvergedState::blueGain
+ * \brief The blue colour gain, relative to the green gain
+ *
+ * \var ConvergedState::colourTemperature
+ * \brief The estimated colour temperature, in Kelvin, or 0 if unknown
+ */
+
+/**
+ * \brief Serialize the state to a binary blob
+ * \return The serialized state
+ */
+std::vector<uint8_t> ConvergedState::serialize() const
+{
+	std::vector<uint8_t> data;
+	ByteStreamBuffer buffer(data);
+
+	const float values[] = {
+		static_cast<float>(exposureTime.get<std::micro>()),
+		static_cast<float>(analogueGain),
+		static_cast<float>(redGain),
+		static_cast<float>(blueGain),
+		static_cast<float>(colourTemperature),
+	};
+
+	buffer.write(&kMagic);
+	buffer.write(&kVersion);
+	buffer.write(Span<const float>(values));
+
+	return data;
+}
+
+/**
+ * \brief Deserialize a state from a binary blob
+ * \param[in] data The serialized state
+ *
+ * Blobs produced by a different version of the format, or containing invalid
+ * values, are rejected.
+ *
+ * \return The deserialized state, or std::nullopt if the \a data is invalid
+ */
+std::optional<ConvergedState> ConvergedState::deserialize(Span<const uint8_t> data)
+{
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	float values[5];
+
+	if (data.size() != sizeof(magic) + sizeof(version) + sizeof(values)) {
+		LOG(IPAConvergedState, Warning) << "Invalid converged state size";
+		return std::nullopt;
+	}
+
+	ByteStreamBuffer buffer(data.data(), data.size());
+	buffer.read(&magic);
+	buffer.read(&version);
+	buffer.read(Span<float>(values));
+
+	if (magic != kMagic || version != kVersion) {
+		LOG(IPAConvergedState, Warning) << "Invalid converged state";
+		return std::nullopt;
+	}
+
+	ConvergedState state;
+	state.exposureTime = std::chrono::duration<double, std::micro>(values[0]);
+	state.analogueGain = values[1];
+	state.redGain = values[2];
+	state.blueGain = values[3];
+	state.colourTemperature = values[4];
+
+	/* All values but the colour temperature must be positive. */
+	auto isPositive = [](double value) {
+		return std::isfinite(value) && value > 0.0;
+	};
+
+	if (!isPositive(state.exposureTime.get<std::micro>()) ||
+	    !isPositive(state.analogueGain) || !isPositive(state.redGain) ||
+	    !isPositive(state.blueGain) ||
+	    !(isPositive(state.colourTemperature) || state.colourTemperature == 0.0)) {
+		LOG(IPAConvergedState, Warning) << "Invalid converged state values";
+		return std::nullopt;
+	}
+
+	return state;
+}
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * converged_state.h - Persistable state of converged 3A algorithms
+ */
+
+#pragma once
+
+#include <optional>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/span.h>
+#include <libcamera/base/utils.h>
+
+namespace libcamera {
+
+namespace ipa {
+
+struct ConvergedState {
+	utils::Duration exposureTime;
+	double analogueGain;
+	double redGain;
+	double blueGain;
+	double colourTemperature;
+
+	std::vector<uint8_t> serialize() const;
+	static std::optional<ConvergedState> deserialize(Span<const uint8_t> data);
+};
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
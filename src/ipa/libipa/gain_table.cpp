@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * gain_table.cpp - Precomputed sensor analogue gain model
+ */
+
+#include "gain_table.h"
+
+#include <algorithm>
+
+#include <libcamera/base/log.h>
+
+/**
+ * \file gain_table.h
+ * \brief Precomputed sensor analogue gain model
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(GainTable)
+
+namespace ipa {
+
+/**
+ * \class GainTable
+ * \brief Table of the analogue gains of all the gain codes of a sensor
+ *
+ * Some sensors have analogue gain models that are expensive to evaluate, such
+ * as exponential models computed with pow() and log10(). The GainTable class
+ * evaluates the model once for every gain code in a range, and then converts
+ * between gain codes and gains with a table lookup, or a binary search for the
+ * inverse conversion.
+ *
+ * The gain model shall be monotonically non-decreasing over the code range.
+ */
+
+/**
+ * \typedef GainTable::Model
+ * \brief Function computing the analogue gain of a gain code
+ */
+
+/**
+ * \brief Construct an empty GainTable
+ */
+GainTable::GainTable()
+	: minCode_(0)
+{
+}
+
+/**
+ * \brief Construct a GainTable from a gain model
+ * \param[in] minCode The smallest gain code
+ * \param[in] maxCode The largest gain code
+ * \param[in] model The function computing the gain of a gain code
+ */
+GainTable::GainTable(uint32_t minCode, uint32_t maxCode, const Model &model)
+	: minCode_(minCode)
+{
+	ASSERT(minCode <= maxCode);
+
+	gains_.reserve(maxCode - minCode + 1);
+	for (uint32_t code = minCode; code <= maxCode; ++code)
+		gains_.push_back(model(code));
+
+	if (!std::is_sorted(gains_.begin(), gains_.end()))
+		LOG(GainTable, Error) << "Gain model is not monotonic";
+}
+
+/**
+ * \fn GainTable::empty()
+ * \brief Check if the table is empty
+ * \return True if the table has been default-constructed, false otherwise
+ */
+
+/**
+ * \fn GainTable::minCode()
+ * \brief Retrieve the smallest gain code of the table
+ * \return The smallest gain code
+ */
+
+/**
+ * \fn GainTable::maxCode()
+ * \brief Retrieve the largest gain code of the table
+ * \return The largest gain code
+ */
+
+/**
+ * \brief Retrieve the analogue gain of a gain code
+ * \param[in] gainCode The gain code
+ *
+ * The \a gainCode is clamped to the range of the table.
+ *
+ * \return The analogue gain, or 0.0 if the table is empty
+ */
+double GainTable::gain(uint32_t gainCode) const
+{
+	if (gains_.empty())
+		return 0.0;
+
+	gainCode = std::clamp(gainCode, minCode(), maxCode());
+	return gains_[gainCode - minCode_];
+}
+
+/**
+ * \brief Retrieve the gain code of an analogue gain
+ * \param[in] gain The analogue gain
+ *
+ * Find the largest gain code whose gain doesn't exceed the \a gain. Gains
+ * smaller than the gain of the smallest code result in the smallest code.
+ *
+ * \return The gain code, or 0 if the table is empty
+ */
+uint32_t GainTable::gainCode(double gain) const
+{
+	if (gains_.empty())
+		return 0;
+
+	auto it = std::upper_bound(gains_.begin(), gains_.end(), gain);
+	if (it == gains_.begin())
+		return minCode_;
+
+	return minCode_ + (it - gains_.begin()) - 1;
+}
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * gain_table.h - Precomputed sensor analogue gain model
+ */
+
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+namespace libcamera {
+
+namespace ipa {
+
+class GainTable
+{
+public:
+	using Model = std::function<double(uint32_t)>;
+
+	GainTable();
+	GainTable(uint32_t minCode, uint32_t maxCode, const Model &model);
+
+	bool empty() const { return gains_.empty(); }
+	uint32_t minCode() const { return minCode_; }
+	uint32_t maxCode() const { return minCode_ + gains_.size() - 1; }
+
+	double gain(uint32_t gainCode) const;
+	uint32_t gainCode(double gain) const;
+
+private:
+	uint32_t minCode_;
+	std::vector<double> gains_;
+};
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
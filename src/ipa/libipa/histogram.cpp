@@ -6,6 +6,7 @@
  */
 #include "histogram.h"
 
+#include <algorithm>
 #include <cmath>
 
 #include <libcamera/base/log.h>
@@ -31,13 +32,22 @@ namespace ipa {
 /**
  * \brief Create a cumulative histogram
  * \param[in] data A pre-sorted histogram to be passed
+ *
+ * The cumulative frequencies are computed once at construction time, all the
+ * queries then only look them up.
  */
-Histogram::Histogram(Span<uint32_t> data)
+Histogram::Histogram(Span<const uint32_t> data)
 {
-	cumulative_.reserve(data.size());
-	cumulative_.push_back(0);
-	for (const uint32_t &value : data)
-		cumulative_.push_back(cumulative_.back() + value);
+	ASSERT(!data.empty());
+
+	cumulative_.resize(data.size() + 1);
+
+	uint64_t sum = 0;
+	cumulative_[0] = 0;
+	for (size_t i = 0; i < data.size(); i++) {
+		sum += data[i];
+		cumulative_[i + 1] = sum;
+	}
 }
 
 /**
@@ -108,10 +118,34 @@ double Histogram::quantile(double q, uint32_t first, uint32_t last) const
 	if (cumulative_[first + 1] == cumulative_[first])
 		frac = 0;
 	else
-		frac = (item - cumulative_[first]) / (cumulative_[first + 1] - cumulative_[first]);
+		frac = static_cast<double>(item - cumulative_[first]) /
+		       (cumulative_[first + 1] - cumulative_[first]);
 	return first + frac;
 }
 
+/**
+ * \brief Compute several quantiles at once
+ * \param[in] q The desired points (0 <= q <= 1)
+ * \param[out] points The (fractional) bins of the points
+ *
+ * This function is equivalent to calling quantile() for each entry of \a q,
+ * and stores the results in the corresponding entries of \a points. When the
+ * entries of \a q are in increasing order, each search starts from the bin
+ * of the previous result.
+ */
+void Histogram::quantiles(Span<const double> q, Span<double> points) const
+{
+	ASSERT(q.size() == points.size());
+
+	for (size_t i = 0; i < q.size(); i++) {
+		/* A point may be at the very end of the last bin. */
+		uint32_t first = 0;
+		if (i && q[i] >= q[i - 1])
+			first = std::min<uint32_t>(points[i - 1], bins() - 1);
+		points[i] = quantile(q[i], first);
+	}
+}
+
 /**
  * \brief Calculate the mean between two quantiles
  * \param[in] lowQuantile low Quantile
@@ -22,11 +22,12 @@ namespace ipa {
 class Histogram
 {
 public:
-	Histogram(Span<uint32_t> data);
+	Histogram(Span<const uint32_t> data);
 	size_t bins() const { return cumulative_.size() - 1; }
 	uint64_t total() const { return cumulative_[cumulative_.size() - 1]; }
 	uint64_t cumulativeFrequency(double bin) const;
 	double quantile(double q, uint32_t first = 0, uint32_t last = UINT_MAX) const;
+	void quantiles(Span<const double> q, Span<double> points) const;
 	double interQuantileMean(double lowQuantile, double hiQuantile) const;
 
 private:
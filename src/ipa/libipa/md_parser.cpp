@@ -0,0 +1,317 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2019-2021, Raspberry Pi (Trading) Limited
+ *
+ * md_parser.cpp - image sensor embedded data parsers
+ */
+
+#include "md_parser.h"
+
+#include <libcamera/base/log.h>
+
+/**
+ * \file md_parser.h
+ * \brief Parsers for the embedded data produced by image sensors
+ */
+
+namespace libcamera {
+
+namespace ipa {
+
+/**
+ * \class MdParser
+ * \brief Base class for image sensor embedded data parsers
+ *
+ * Many sensors output, alongside each frame, a few lines of embedded data that
+ * contain the values of the registers the frame was captured with. Parsing
+ * them gives the exact exposure and gain of every frame, instead of having to
+ * assume when the controls set by the IPA took effect.
+ *
+ * A parser is created for the registers of interest, for instance for a SMIA
+ * sensor:
+ *
+ * \code
+ * std::unique_ptr<MdParser> parser =
+ * 	std::make_unique<MdParserSmia>({ expHiReg, expLoReg, gainReg });
+ * parser->setBitsPerPixel(bpp);
+ * parser->setLineLengthBytes(pitch);
+ * parser->setNumLines(2);
+ * \endcode
+ *
+ * If the number of lines isn't known, the size of the input buffer is used as
+ * a limit instead. If the line length isn't known, it can be left unset (or
+ * set to zero) and the parser will hunt for the line start instead.
+ *
+ * Then on every frame:
+ *
+ * \code
+ * MdParser::RegisterMap registers;
+ * if (parser->parse(buffer, registers) != MdParser::Status::OK)
+ * 	...
+ * \endcode
+ *
+ * The IPA then converts the register values to exposure times and gains with
+ * its sensor helper.
+ *
+ * If the layout of the embedded data may have changed, for instance after a
+ * sensor mode switch, any line length, number of lines or bits per pixel that
+ * differ shall be updated and reset() called before parsing again.
+ */
+
+/**
+ * \typedef MdParser::RegisterMap
+ * \brief Map of register addresses to the register values
+ */
+
+/**
+ * \enum MdParser::Status
+ * \brief The parser status codes
+ * \var MdParser::OK
+ * \brief All the registers have been found
+ * \var MdParser::NotFound
+ * \brief A register such as the exposure or gain was not found
+ * \var MdParser::Error
+ * \brief The embedded data could not be parsed
+ */
+
+/**
+ * \fn MdParser::MdParser()
+ * \brief Construct an MdParser
+ */
+
+/**
+ * \fn MdParser::reset()
+ * \brief Force the next parse() call to search for the registers again
+ */
+
+/**
+ * \fn MdParser::setBitsPerPixel()
+ * \brief Set the bit depth of the embedded data lines
+ * \param[in] bpp The number of bits per pixel
+ */
+
+/**
+ * \fn MdParser::setNumLines()
+ * \brief Set the number of lines of embedded data
+ * \param[in] numLines The number of lines, 0 if unknown
+ */
+
+/**
+ * \fn MdParser::setLineLengthBytes()
+ * \brief Set the length of the embedded data lines
+ * \param[in] numBytes The line length in bytes, 0 if unknown
+ */
+
+/**
+ * \fn MdParser::parse()
+ * \brief Parse the embedded data of a frame
+ * \param[in] buffer The embedded data buffer
+ * \param[out] registers The values of the registers of interest
+ * \return The parser status code
+ */
+
+/**
+ * \var MdParser::reset_
+ * \brief The registers must be searched for on the next parse() call
+ */
+
+/**
+ * \var MdParser::bitsPerPixel_
+ * \brief The bit depth of the embedded data lines
+ */
+
+/**
+ * \var MdParser::numLines_
+ * \brief The number of lines of embedded data, 0 if unknown
+ */
+
+/**
+ * \var MdParser::lineLengthBytes_
+ * \brief The length of the embedded data lines in bytes, 0 if unknown
+ */
+
+/**
+ * \class MdParserSmia
+ * \brief Embedded data parser for sensors following the SMIA specification
+ *
+ * The parser searches the embedded data for the offsets (not values!) of the
+ * requested registers once, and reuses them for subsequent frames. The tags at
+ * those offsets are checked on every frame, and the registers searched for
+ * again if they don't match.
+ */
+
+namespace {
+
+/*
+ * Embedded data tag bytes, from Sony IMX219 datasheet but general to all SMIA
+ * sensors, I think.
+ */
+constexpr unsigned int LineStart = 0x0a;
+constexpr unsigned int LineEndTag = 0x07;
+constexpr unsigned int RegHiBits = 0xaa;
+constexpr unsigned int RegLowBits = 0xa5;
+constexpr unsigned int RegValue = 0x5a;
+constexpr unsigned int RegSkip = 0x55;
+
+} /* namespace */
+
+/**
+ * \brief Construct a parser for SMIA embedded data
+ * \param[in] registerList The addresses of the registers to parse
+ */
+MdParserSmia::MdParserSmia(std::initializer_list<uint32_t> registerList)
+{
+	for (auto r : registerList)
+		offsets_[r] = {};
+}
+
+/**
+ * \copydoc MdParser::parse()
+ */
+MdParser::Status MdParserSmia::parse(Span<const uint8_t> buffer,
+				     RegisterMap &registers)
+{
+	/*
+	 * The register offsets found by the previous search are reused until
+	 * the embedded data layout changes. Check that the tags found at those
+	 * offsets are still register value tags, and search again if not.
+	 */
+	if (!reset_ && !checkRegs(buffer))
+		reset_ = true;
+
+	if (reset_) {
+		/*
+		 * Search again through the metadata for all the registers
+		 * requested.
+		 */
+		ASSERT(bitsPerPixel_);
+
+		for (const auto &kv : offsets_)
+			offsets_[kv.first] = {};
+		tagOffsets_.clear();
+
+		ParseStatus ret = findRegs(buffer);
+		/*
+		 * > 0 means "worked partially but parse again next time",
+		 * < 0 means "hard error".
+		 *
+		 * In either case, we retry parsing on the next frame.
+		 */
+		if (ret != ParseOk)
+			return Error;
+
+		reset_ = false;
+	}
+
+	/* Populate the register values requested. */
+	registers.clear();
+	for (const auto &[reg, offset] : offsets_) {
+		if (!offset) {
+			reset_ = true;
+			return NotFound;
+		}
+		registers[reg] = buffer[offset.value()];
+	}
+
+	return OK;
+}
+
+bool MdParserSmia::checkRegs(Span<const uint8_t> buffer) const
+{
+	if (buffer.empty() || buffer[0] != LineStart)
+		return false;
+
+	for (uint32_t offset : tagOffsets_) {
+		if (offset >= buffer.size() || buffer[offset] != RegValue)
+			return false;
+	}
+
+	for (const auto &[reg, offset] : offsets_) {
+		if (!offset || offset.value() >= buffer.size())
+			return false;
+	}
+
+	return true;
+}
+
+MdParserSmia::ParseStatus MdParserSmia::findRegs(Span<const uint8_t> buffer)
+{
+	ASSERT(offsets_.size());
+
+	if (buffer[0] != LineStart)
+		return NoLineStart;
+
+	unsigned int currentOffset = 1; /* after the LineStart */
+	unsigned int currentLineStart = 0, currentLine = 0;
+	unsigned int regNum = 0, regsDone = 0;
+
+	while (1) {
+		unsigned int tagOffset = currentOffset;
+		int tag = buffer[currentOffset++];
+
+		if ((bitsPerPixel_ == 10 &&
+		     (currentOffset + 1 - currentLineStart) % 5 == 0) ||
+		    (bitsPerPixel_ == 12 &&
+		     (currentOffset + 1 - currentLineStart) % 3 == 0)) {
+			if (buffer[currentOffset++] != RegSkip)
+				return BadDummy;
+		}
+
+		int dataByte = buffer[currentOffset++];
+
+		if (tag == LineEndTag) {
+			if (dataByte != LineEndTag)
+				return BadLineEnd;
+
+			if (numLines_ && ++currentLine == numLines_)
+				return MissingRegs;
+
+			if (lineLengthBytes_) {
+				currentOffset = currentLineStart + lineLengthBytes_;
+
+				/* Require whole line to be in the buffer (if buffer size set). */
+				if (buffer.size() &&
+				    currentOffset + lineLengthBytes_ > buffer.size())
+					return MissingRegs;
+
+				if (buffer[currentOffset] != LineStart)
+					return NoLineStart;
+			} else {
+				/* Allow a zero line length to mean "hunt for the next line". */
+				while (currentOffset < buffer.size() &&
+				       buffer[currentOffset] != LineStart)
+					currentOffset++;
+
+				if (currentOffset == buffer.size())
+					return NoLineStart;
+			}
+
+			/* Increment currentOffset to after LineStart. */
+			currentLineStart = currentOffset++;
+		} else {
+			if (tag == RegHiBits)
+				regNum = (regNum & 0xff) | (dataByte << 8);
+			else if (tag == RegLowBits)
+				regNum = (regNum & 0xff00) | dataByte;
+			else if (tag == RegSkip)
+				regNum++;
+			else if (tag == RegValue) {
+				auto reg = offsets_.find(regNum);
+
+				if (reg != offsets_.end()) {
+					offsets_[regNum] = currentOffset - 1;
+					tagOffsets_.push_back(tagOffset);
+
+					if (++regsDone == offsets_.size())
+						return ParseOk;
+				}
+				regNum++;
+			} else
+				return IllegalTag;
+		}
+	}
+}
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2019, Raspberry Pi (Trading) Limited
+ *
+ * md_parser.h - image sensor embedded data parser interface
+ */
+
+#pragma once
+
+#include <initializer_list>
+#include <map>
+#include <optional>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+namespace libcamera {
+
+namespace ipa {
+
+class MdParser
+{
+public:
+	using RegisterMap = std::map<uint32_t, uint32_t>;
+
+	enum Status {
+		OK = 0,
+		NotFound = 1,
+		Error = 2
+	};
+
+	MdParser()
+		: reset_(true), bitsPerPixel_(0), numLines_(0), lineLengthBytes_(0)
+	{
+	}
+
+	virtual ~MdParser() = default;
+
+	void reset()
+	{
+		reset_ = true;
+	}
+
+	void setBitsPerPixel(int bpp)
+	{
+		bitsPerPixel_ = bpp;
+	}
+
+	void setNumLines(unsigned int numLines)
+	{
+		numLines_ = numLines;
+	}
+
+	void setLineLengthBytes(unsigned int numBytes)
+	{
+		lineLengthBytes_ = numBytes;
+	}
+
+	virtual Status parse(Span<const uint8_t> buffer,
+			     RegisterMap &registers) = 0;
+
+protected:
+	bool reset_;
+	int bitsPerPixel_;
+	unsigned int numLines_;
+	unsigned int lineLengthBytes_;
+};
+
+class MdParserSmia final : public MdParser
+{
+public:
+	MdParserSmia(std::initializer_list<uint32_t> registerList);
+
+	MdParser::Status parse(Span<const uint8_t> buffer,
+			       RegisterMap &registers) override;
+
+private:
+	/* Maps register address to offset in the buffer. */
+	using OffsetMap = std::map<uint32_t, std::optional<uint32_t>>;
+
+	/*
+	 * Note that error codes > 0 are regarded as non-fatal; codes < 0
+	 * indicate a bad data buffer. Status codes are:
+	 * ParseOk     - found all registers, much happiness
+	 * MissingRegs - some registers found; should this be a hard error?
+	 * The remaining codes are all hard errors.
+	 */
+	enum ParseStatus {
+		ParseOk      =  0,
+		MissingRegs  =  1,
+		NoLineStart  = -1,
+		IllegalTag   = -2,
+		BadDummy     = -3,
+		BadLineEnd   = -4,
+		BadPadding   = -5
+	};
+
+	bool checkRegs(Span<const uint8_t> buffer) const;
+	ParseStatus findRegs(Span<const uint8_t> buffer);
+
+	OffsetMap offsets_;
+	/* Offsets of the tags preceding the register values, for checkRegs(). */
+	std::vector<uint32_t> tagOffsets_;
+};
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
@@ -14,7 +14,6 @@
 #include "libcamera/internal/v4l2_videodevice.h"
 
 #include "cam_helper.hpp"
-#include "md_parser.hpp"
 
 using namespace RPiController;
 using namespace libcamera;
@@ -106,8 +105,8 @@ void CamHelper::SetCameraMode(const CameraMode &mode)
 {
 	mode_ = mode;
 	if (parser_) {
-		parser_->SetBitsPerPixel(mode.bitdepth);
-		parser_->SetLineLengthBytes(0); /* We use SetBufferSize. */
+		parser_->setBitsPerPixel(mode.bitdepth);
+		parser_->setLineLengthBytes(0); /* We use SetBufferSize. */
 	}
 	initialized_ = true;
 }
@@ -124,6 +123,15 @@ void CamHelper::GetDelays(int &exposure_delay, int &gain_delay,
 	vblank_delay = 2;
 }
 
+unsigned int CamHelper::LensDelay() const
+{
+	/*
+	 * Voice coil motors settle within a frame time, so a lens position
+	 * written at the start of a frame is in effect for the next frame.
+	 */
+	return 1;
+}
+
 bool CamHelper::SensorEmbeddedDataPresent() const
 {
 	return false;
@@ -176,7 +184,7 @@ void CamHelper::parseEmbeddedData(Span<const uint8_t> buffer,
 	if (buffer.empty())
 		return;
 
-	if (parser_->Parse(buffer, registers) != MdParser::Status::OK) {
+	if (parser_->parse(buffer, registers) != MdParser::Status::OK) {
 		LOG(IPARPI, Error) << "Embedded data buffer parsing failed";
 		return;
 	}
@@ -190,8 +198,8 @@ void CamHelper::parseEmbeddedData(Span<const uint8_t> buffer,
 	 * other fields were set meaningfully.
 	 */
 	DeviceStatus deviceStatus, parsedDeviceStatus;
-	if (metadata.Get("device.status", deviceStatus) ||
-	    parsedMetadata.Get("device.status", parsedDeviceStatus)) {
+	if (metadata.Get(deviceStatus) ||
+	    parsedMetadata.Get(parsedDeviceStatus)) {
 		LOG(IPARPI, Error) << "DeviceStatus not found";
 		return;
 	}
@@ -202,7 +210,7 @@ void CamHelper::parseEmbeddedData(Span<const uint8_t> buffer,
 
 	LOG(IPARPI, Debug) << "Metadata updated - " << deviceStatus;
 
-	metadata.Set("device.status", deviceStatus);
+	metadata.Set(deviceStatus);
 }
 
 void CamHelper::PopulateMetadata([[maybe_unused]] const MdParser::RegisterMap &registers,
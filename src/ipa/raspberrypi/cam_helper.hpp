@@ -15,12 +15,16 @@
 #include "camera_mode.h"
 #include "controller/controller.hpp"
 #include "controller/metadata.hpp"
-#include "md_parser.hpp"
 
 #include "libcamera/internal/v4l2_videodevice.h"
 
+#include "libipa/md_parser.h"
+
 namespace RPiController {
 
+using libcamera::ipa::MdParser;
+using libcamera::ipa::MdParserSmia;
+
 // The CamHelper class provides a number of facilities that anyone trying
 // to drive a camera will need to know, but which are not provided by the
 // standard driver framework. Specifically, it provides:
@@ -39,6 +43,10 @@ namespace RPiController {
 // sensors these take the values 2, 1 and 2 respectively, but sensors that are
 // different will need to over-ride the default function provided.
 //
+// A function to return the number of frames of delay between updating the
+// position of the focus lens, if the module has one, and the frame being
+// exposed with the lens at that position.
+//
 // A function to query if the sensor outputs embedded data that can be parsed.
 //
 // A function to return the sensitivity of a given camera mode.
@@ -85,6 +93,7 @@ public:
 	virtual double Gain(uint32_t gain_code) const = 0;
 	virtual void GetDelays(int &exposure_delay, int &gain_delay,
 			       int &vblank_delay) const;
+	virtual unsigned int LensDelay() const;
 	virtual bool SensorEmbeddedDataPresent() const;
 	virtual double GetModeSensitivity(const CameraMode &mode) const;
 	virtual unsigned int HideFramesStartup() const;
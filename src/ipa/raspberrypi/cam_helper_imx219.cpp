@@ -18,7 +18,6 @@
 
 #include "cam_helper.hpp"
 #if ENABLE_EMBEDDED_DATA
-#include "md_parser.hpp"
 #endif
 
 using namespace RPiController;
@@ -98,7 +97,7 @@ void CamHelperImx219::PopulateMetadata(const MdParser::RegisterMap &registers,
 	deviceStatus.analogue_gain = Gain(registers.at(gainReg));
 	deviceStatus.frame_length = registers.at(frameLengthHiReg) * 256 + registers.at(frameLengthLoReg);
 
-	metadata.Set("device.status", deviceStatus);
+	metadata.Set(deviceStatus);
 }
 
 static CamHelper *Create()
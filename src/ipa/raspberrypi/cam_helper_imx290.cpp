@@ -7,9 +7,12 @@
 
 #include <math.h>
 
+#include "libipa/gain_table.h"
+
 #include "cam_helper.hpp"
 
 using namespace RPiController;
+using libcamera::ipa::GainTable;
 
 class CamHelperImx290 : public CamHelper
 {
@@ -27,22 +30,25 @@ private:
 	 * in units of lines.
 	 */
 	static constexpr int frameIntegrationDiff = 2;
+
+	/* The gain is in steps of 0.3dB, avoid computing it on every frame. */
+	GainTable gainTable_;
 };
 
 CamHelperImx290::CamHelperImx290()
-	: CamHelper({}, frameIntegrationDiff)
+	: CamHelper({}, frameIntegrationDiff),
+	  gainTable_(0, 0xf0, [](uint32_t code) { return pow(10, 0.015 * code); })
 {
 }
 
 uint32_t CamHelperImx290::GainCode(double gain) const
 {
-	int code = 66.6667 * log10(gain);
-	return std::max(0, std::min(code, 0xf0));
+	return gainTable_.gainCode(gain);
 }
 
 double CamHelperImx290::Gain(uint32_t gain_code) const
 {
-	return pow(10, 0.015 * gain_code);
+	return gainTable_.gain(gain_code);
 }
 
 void CamHelperImx290::GetDelays(int &exposure_delay, int &gain_delay,
@@ -14,7 +14,6 @@
 #include <libcamera/base/log.h>
 
 #include "cam_helper.hpp"
-#include "md_parser.hpp"
 
 using namespace RPiController;
 using namespace libcamera;
@@ -85,7 +84,7 @@ void CamHelperImx477::Prepare(libcamera::Span<const uint8_t> buffer, Metadata &m
 	MdParser::RegisterMap registers;
 	DeviceStatus deviceStatus;
 
-	if (metadata.Get("device.status", deviceStatus)) {
+	if (metadata.Get(deviceStatus)) {
 		LOG(IPARPI, Error) << "DeviceStatus not found from DelayedControls";
 		return;
 	}
@@ -106,10 +105,10 @@ void CamHelperImx477::Prepare(libcamera::Span<const uint8_t> buffer, Metadata &m
 	if (deviceStatus.frame_length > frameLengthMax) {
 		DeviceStatus parsedDeviceStatus;
 
-		metadata.Get("device.status", parsedDeviceStatus);
+		metadata.Get(parsedDeviceStatus);
 		parsedDeviceStatus.shutter_speed = deviceStatus.shutter_speed;
 		parsedDeviceStatus.frame_length = deviceStatus.frame_length;
-		metadata.Set("device.status", parsedDeviceStatus);
+		metadata.Set(parsedDeviceStatus);
 
 		LOG(IPARPI, Debug) << "Metadata updated for long exposure: "
 				   << parsedDeviceStatus;
@@ -172,7 +171,7 @@ void CamHelperImx477::PopulateMetadata(const MdParser::RegisterMap &registers,
 	deviceStatus.analogue_gain = Gain(registers.at(gainHiReg) * 256 + registers.at(gainLoReg));
 	deviceStatus.frame_length = registers.at(frameLengthHiReg) * 256 + registers.at(frameLengthLoReg);
 
-	metadata.Set("device.status", deviceStatus);
+	metadata.Set(deviceStatus);
 }
 
 static CamHelper *Create()
@@ -16,7 +16,6 @@
 #include <libcamera/base/log.h>
 
 #include "cam_helper.hpp"
-#include "md_parser.hpp"
 
 using namespace RPiController;
 using namespace libcamera;
@@ -87,7 +86,7 @@ void CamHelperImx519::Prepare(libcamera::Span<const uint8_t> buffer, Metadata &m
 	MdParser::RegisterMap registers;
 	DeviceStatus deviceStatus;
 
-	if (metadata.Get("device.status", deviceStatus)) {
+	if (metadata.Get(deviceStatus)) {
 		LOG(IPARPI, Error) << "DeviceStatus not found from DelayedControls";
 		return;
 	}
@@ -108,10 +107,10 @@ void CamHelperImx519::Prepare(libcamera::Span<const uint8_t> buffer, Metadata &m
 	if (deviceStatus.frame_length > frameLengthMax) {
 		DeviceStatus parsedDeviceStatus;
 
-		metadata.Get("device.status", parsedDeviceStatus);
+		metadata.Get(parsedDeviceStatus);
 		parsedDeviceStatus.shutter_speed = deviceStatus.shutter_speed;
 		parsedDeviceStatus.frame_length = deviceStatus.frame_length;
-		metadata.Set("device.status", parsedDeviceStatus);
+		metadata.Set(parsedDeviceStatus);
 
 		LOG(IPARPI, Debug) << "Metadata updated for long exposure: "
 				   << parsedDeviceStatus;
@@ -174,7 +173,7 @@ void CamHelperImx519::PopulateMetadata(const MdParser::RegisterMap &registers,
 	deviceStatus.analogue_gain = Gain(registers.at(gainHiReg) * 256 + registers.at(gainLoReg));
 	deviceStatus.frame_length = registers.at(frameLengthHiReg) * 256 + registers.at(frameLengthLoReg);
 
-	metadata.Set("device.status", deviceStatus);
+	metadata.Set(deviceStatus);
 }
 
 static CamHelper *Create()
@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * af_algorithm.hpp - autofocus control algorithm interface
+ */
+#pragma once
+
+#include "af_status.h"
+#include "algorithm.hpp"
+
+namespace RPiController {
+
+class AfAlgorithm : public Algorithm
+{
+public:
+	AfAlgorithm(Controller *controller) : Algorithm(controller) {}
+	// An autofocus algorithm must provide the following:
+	virtual void SetMode(AfMode mode) = 0;
+	// Lens positions are normalised to the [0, 1] range of the actuator.
+	virtual void SetLensPosition(double position) = 0;
+	virtual void Trigger() = 0;
+	virtual void Cancel() = 0;
+};
+
+} // namespace RPiController
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * af_status.h - autofocus control algorithm status
+ */
+#pragma once
+
+// The AF algorithm should post the following structure into the image's
+// "af.status" metadata.
+
+namespace RPiController {
+
+enum class AfMode { Manual, Auto, Continuous };
+
+enum class AfState {
+	Idle, // not scanning, lens under manual control or scan cancelled
+	Scanning, // a focus scan is in progress
+	Focused, // the last scan found a focus peak
+	Failed // the last scan did not find a usable peak
+};
+
+} // namespace RPiController
+
+struct AfStatus {
+	RPiController::AfMode mode;
+	RPiController::AfState state;
+	// normalised lens position the lens must be moved to
+	double lens_setting;
+};
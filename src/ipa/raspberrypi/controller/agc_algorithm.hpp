@@ -23,6 +23,8 @@ public:
 	virtual void SetFixedShutter(libcamera::utils::Duration fixed_shutter) = 0;
 	virtual void SetMaxShutter(libcamera::utils::Duration max_shutter) = 0;
 	virtual void SetFixedAnalogueGain(double fixed_analogue_gain) = 0;
+	virtual void SetInitialExposure(libcamera::utils::Duration shutter,
+					double analogue_gain) = 0;
 	virtual void SetMeteringMode(std::string const &metering_mode_name) = 0;
 	virtual void SetExposureMode(std::string const &exposure_mode_name) = 0;
 	virtual void
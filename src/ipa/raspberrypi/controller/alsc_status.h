@@ -6,6 +6,8 @@
  */
 #pragma once
 
+#include <libcamera/base/utils.h>
+
 // The ALSC algorithm should post the following structure into the image's
 // "alsc.status" metadata.
 
@@ -20,6 +22,10 @@ struct AlscStatus {
 	double r[ALSC_CELLS_Y][ALSC_CELLS_X];
 	double g[ALSC_CELLS_Y][ALSC_CELLS_X];
 	double b[ALSC_CELLS_Y][ALSC_CELLS_X];
+	// time taken by the last adaptive calculation that produced the tables
+	libcamera::utils::Duration solve_time;
+	// incremented whenever the tables above change
+	unsigned int generation;
 };
 
 #ifdef __cplusplus
@@ -18,6 +18,8 @@ public:
 	virtual unsigned int GetConvergenceFrames() const = 0;
 	virtual void SetMode(std::string const &mode_name) = 0;
 	virtual void SetManualGains(double manual_r, double manual_b) = 0;
+	virtual void SetInitialGains(double gain_r, double gain_b,
+				     double temperature_K) = 0;
 };
 
 } // namespace RPiController
@@ -5,36 +5,75 @@
  * controller.cpp - ISP controller
  */
 
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
 #include <libcamera/base/log.h>
 
 #include "algorithm.hpp"
 #include "controller.hpp"
+#include "tuning_cache.hpp"
 
-#include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 using namespace RPiController;
 using namespace libcamera;
+using namespace std::literals::chrono_literals;
 
 LOG_DEFINE_CATEGORY(RPiController)
 
+// Number of frames a deferrable algorithm may be skipped for in a row.
+static const unsigned int DEFAULT_MAX_DEFERRED = 4;
+
+AlgorithmTiming::AlgorithmTiming()
+	: count(0), total(0s), max(0s), histogram{}, deferred(0),
+	  total_deferred(0)
+{
+}
+
+void AlgorithmTiming::Record(utils::Duration duration)
+{
+	count++;
+	total += duration;
+	max = std::max(max, duration);
+	unsigned int us = duration.get<std::micro>();
+	unsigned int bin = 0;
+	while (us && bin < NUM_BINS - 1)
+		us >>= 1, bin++;
+	histogram[bin]++;
+}
+
 Controller::Controller()
-	: switch_mode_called_(false) {}
+	: executor_(Executor::Get()), prepare_budget_(0s), process_budget_(0s),
+	  max_deferred_(DEFAULT_MAX_DEFERRED), switch_mode_called_(false) {}
 
 Controller::Controller(char const *json_filename)
-	: switch_mode_called_(false)
+	: executor_(Executor::Get()), prepare_budget_(0s), process_budget_(0s),
+	  max_deferred_(DEFAULT_MAX_DEFERRED), switch_mode_called_(false)
 {
 	Read(json_filename);
 	Initialise();
 }
 
-Controller::~Controller() {}
+Controller::~Controller()
+{
+	ReportTimings();
+}
 
 void Controller::Read(char const *filename)
 {
 	boost::property_tree::ptree root;
-	boost::property_tree::read_json(filename, root);
+	ReadTuningFile(filename, root);
 	for (auto const &key_and_value : root) {
+		if (key_and_value.first == "rpi.executor") {
+			executor_->Read(key_and_value.second);
+			continue;
+		}
+		if (key_and_value.first == "rpi.budget") {
+			readBudget(key_and_value.second);
+			continue;
+		}
 		Algorithm *algo = CreateAlgorithm(key_and_value.first.c_str());
 		if (algo) {
 			algo->Read(key_and_value.second);
@@ -51,10 +90,38 @@ Algorithm *Controller::CreateAlgorithm(char const *name)
 	return it != GetAlgorithms().end() ? (*it->second)(this) : nullptr;
 }
 
+void Controller::readBudget(boost::property_tree::ptree const &params)
+{
+	prepare_budget_ = params.get<double>("prepare", 0) * 1us;
+	process_budget_ = params.get<double>("process", 0) * 1us;
+	max_deferred_ = params.get<unsigned int>("max_deferred",
+						 DEFAULT_MAX_DEFERRED);
+	deferrable_.clear();
+	if (params.get_child_optional("deferrable")) {
+		for (auto &p : params.get_child("deferrable"))
+			deferrable_.push_back(p.second.get_value<std::string>());
+	}
+}
+
 void Controller::Initialise()
 {
 	for (auto &algo : algorithms_)
 		algo->Initialise();
+	// The budget may come before the algorithms in the tuning file, so the
+	// deferrable ones can only be looked up now.
+	algorithm_state_.assign(algorithms_.size(), AlgorithmState());
+	for (std::string const &name : deferrable_) {
+		Algorithm *algo = GetAlgorithm(name);
+		if (!algo) {
+			LOG(RPiController, Warning)
+				<< "Deferrable algorithm \"" << name << "\" not found";
+			continue;
+		}
+		for (unsigned int i = 0; i < algorithms_.size(); i++) {
+			if (algorithms_[i].get() == algo)
+				algorithm_state_[i].deferrable = true;
+		}
+	}
 }
 
 void Controller::SwitchMode(CameraMode const &camera_mode, Metadata *metadata)
@@ -67,17 +134,47 @@ void Controller::SwitchMode(CameraMode const &camera_mode, Metadata *metadata)
 void Controller::Prepare(Metadata *image_metadata)
 {
 	assert(switch_mode_called_);
-	for (auto &algo : algorithms_)
-		if (!algo->IsPaused())
-			algo->Prepare(image_metadata);
+	runAlgorithms(prepare_budget_, false, [&](Algorithm *algo) {
+		algo->Prepare(image_metadata);
+	});
 }
 
 void Controller::Process(StatisticsPtr stats, Metadata *image_metadata)
 {
 	assert(switch_mode_called_);
-	for (auto &algo : algorithms_)
-		if (!algo->IsPaused())
-			algo->Process(stats, image_metadata);
+	runAlgorithms(process_budget_, true, [&](Algorithm *algo) {
+		algo->Process(stats, image_metadata);
+	});
+}
+
+void Controller::runAlgorithms(utils::Duration budget, bool process,
+			       std::function<void(Algorithm *)> const &func)
+{
+	if (algorithm_state_.size() != algorithms_.size())
+		algorithm_state_.resize(algorithms_.size());
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < algorithms_.size(); i++) {
+		Algorithm *algo = algorithms_[i].get();
+		if (algo->IsPaused())
+			continue;
+		AlgorithmState &state = algorithm_state_[i];
+		AlgorithmTiming &timing = process ? state.process : state.prepare;
+		auto now = std::chrono::steady_clock::now();
+		// Once the stage is over budget, deferrable algorithms are skipped,
+		// though never for more than max_deferred_ frames in a row.
+		if (budget && state.deferrable && now - start > budget &&
+		    timing.deferred < max_deferred_) {
+			timing.deferred++;
+			timing.total_deferred++;
+			LOG(RPiController, Debug)
+				<< "Over budget, deferring " << algo->Name()
+				<< (process ? " Process" : " Prepare");
+			continue;
+		}
+		timing.deferred = 0;
+		func(algo);
+		timing.Record(std::chrono::steady_clock::now() - now);
+	}
 }
 
 Metadata &Controller::GetGlobalMetadata()
@@ -102,3 +199,41 @@ Algorithm *Controller::GetAlgorithm(std::string const &name) const
 	}
 	return nullptr;
 }
+
+AlgorithmTiming const *Controller::GetTiming(std::string const &name,
+					     bool process) const
+{
+	Algorithm *algo = GetAlgorithm(name);
+	for (unsigned int i = 0; i < algorithm_state_.size(); i++) {
+		if (algorithms_[i].get() == algo)
+			return process ? &algorithm_state_[i].process
+				       : &algorithm_state_[i].prepare;
+	}
+	return nullptr;
+}
+
+static std::string timingString(AlgorithmTiming const &timing)
+{
+	std::stringstream ss;
+	ss << timing.count << " calls";
+	if (timing.count)
+		ss << ", mean " << utils::Duration(timing.total / timing.count).get<std::micro>()
+		   << "us, max " << timing.max.get<std::micro>() << "us";
+	if (timing.total_deferred)
+		ss << ", " << timing.total_deferred << " deferred";
+	ss << ", histogram";
+	for (unsigned int count : timing.histogram)
+		ss << " " << count;
+	return ss.str();
+}
+
+void Controller::ReportTimings() const
+{
+	for (unsigned int i = 0; i < algorithm_state_.size(); i++) {
+		AlgorithmState const &state = algorithm_state_[i];
+		LOG(RPiController, Debug)
+			<< algorithms_[i]->Name()
+			<< ": Prepare " << timingString(state.prepare)
+			<< "; Process " << timingString(state.process);
+	}
+}
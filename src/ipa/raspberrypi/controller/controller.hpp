@@ -10,25 +10,55 @@
 // "control algorithms" (such as AWB etc.) and for running them all in a
 // convenient manner.
 
+#include <array>
+#include <functional>
 #include <vector>
 #include <string>
 
+#include <libcamera/base/utils.h>
+
 #include <linux/bcm2835-isp.h>
 
 #include "camera_mode.h"
 #include "device_status.h"
+#include "executor.hpp"
 #include "metadata.hpp"
 
+#include <boost/property_tree/ptree.hpp>
+
 namespace RPiController {
 
 class Algorithm;
 typedef std::unique_ptr<Algorithm> AlgorithmPtr;
 typedef std::shared_ptr<bcm2835_isp_stats> StatisticsPtr;
 
+// Time spent by an algorithm in its Prepare or Process calls. The histogram
+// has logarithmic bins: bin 0 counts the calls under 1us, and bin i the calls
+// in [2^(i-1), 2^i) us, with the last bin also counting any longer call.
+
+struct AlgorithmTiming {
+	static constexpr unsigned int NUM_BINS = 16;
+	AlgorithmTiming();
+	void Record(libcamera::utils::Duration duration);
+	unsigned int count;
+	libcamera::utils::Duration total;
+	libcamera::utils::Duration max;
+	std::array<unsigned int, NUM_BINS> histogram;
+	// number of frames the algorithm was deferred for, in a row and overall
+	unsigned int deferred;
+	unsigned int total_deferred;
+};
+
 // The Controller holds a pointer to some global_metadata, which is how
 // different controllers and control algorithms within them can exchange
 // information. The Prepare function returns a pointer to metadata for this
 // specific image, and which should be passed on to the Process function.
+//
+// The Prepare and Process calls of every algorithm are timed. Optionally, the
+// "rpi.budget" section of the tuning file gives the time the Prepare and
+// Process stages may take, and a list of "deferrable" algorithms that are
+// skipped for the frame (up to "max_deferred" frames in a row) once the stage
+// has used its budget.
 
 class Controller
 {
@@ -44,10 +74,33 @@ public:
 	void Process(StatisticsPtr stats, Metadata *image_metadata);
 	Metadata &GetGlobalMetadata();
 	Algorithm *GetAlgorithm(std::string const &name) const;
+	// Return the timing of the named algorithm's Prepare or Process calls.
+	AlgorithmTiming const *GetTiming(std::string const &name,
+					 bool process) const;
+	// Log the timings of all the algorithms.
+	void ReportTimings() const;
 
 protected:
+	struct AlgorithmState {
+		AlgorithmTiming prepare;
+		AlgorithmTiming process;
+		bool deferrable = false;
+	};
+
+	void readBudget(boost::property_tree::ptree const &params);
+	void runAlgorithms(libcamera::utils::Duration budget, bool process,
+			   std::function<void(Algorithm *)> const &func);
+
 	Metadata global_metadata_;
+	// keeps the shared executor, and the configuration we give it, alive
+	std::shared_ptr<Executor> executor_;
 	std::vector<AlgorithmPtr> algorithms_;
+	// per-algorithm timing and budget state, in the same order as algorithms_
+	std::vector<AlgorithmState> algorithm_state_;
+	libcamera::utils::Duration prepare_budget_;
+	libcamera::utils::Duration process_budget_;
+	std::vector<std::string> deferrable_;
+	unsigned int max_deferred_;
 	bool switch_mode_called_;
 };
 
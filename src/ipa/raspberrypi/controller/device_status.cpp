@@ -15,6 +15,7 @@ std::ostream &operator<<(std::ostream &out, const DeviceStatus &d)
 	    << " Gain: " << d.analogue_gain
 	    << " Aperture: " << d.aperture
 	    << " Lens: " << d.lens_position
+	    << " Lens setting: " << d.lens_setting
 	    << " Flash: " << d.flash_intensity;
 
 	return out;
@@ -18,8 +18,8 @@
 struct DeviceStatus {
 	DeviceStatus()
 		: shutter_speed(std::chrono::seconds(0)), frame_length(0),
-		  analogue_gain(0.0), lens_position(0.0), aperture(0.0),
-		  flash_intensity(0.0)
+		  analogue_gain(0.0), lens_position(0.0), lens_setting(-1.0),
+		  aperture(0.0), flash_intensity(0.0)
 	{
 	}
 
@@ -32,6 +32,8 @@ struct DeviceStatus {
 	double analogue_gain;
 	/* 1.0/distance-in-metres, or 0 if unknown */
 	double lens_position;
+	/* normalised lens actuator position, or -1 if there is no lens */
+	double lens_setting;
 	/* 1/f so that brightness quadruples when this doubles, or 0 if unknown */
 	double aperture;
 	/* proportional to brightness with 0 = no flash, 1 = maximum flash */
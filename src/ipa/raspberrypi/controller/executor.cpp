@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * executor.cpp - pool of threads running the asynchronous algorithm jobs
+ */
+
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
+
+#include "executor.hpp"
+
+using namespace RPiController;
+using namespace libcamera;
+
+LOG_DEFINE_CATEGORY(RPiExecutor)
+
+// Enough for the AWB and ALSC of one camera to run in parallel, as they did
+// when each had its own thread.
+static const unsigned int DEFAULT_WORKERS = 2;
+
+Executor::Job::Job(std::function<void()> const &func)
+	: executor_(Executor::Get()), func_(func), state_(Idle)
+{
+}
+
+Executor::Job::~Job()
+{
+	Cancel();
+}
+
+void Executor::Job::Start(utils::Duration budget)
+{
+	std::lock_guard<std::mutex> lock(executor_->mutex_);
+	if (state_ == Queued || state_ == Running) {
+		LOG(RPiExecutor, Error) << "Job started while still pending";
+		return;
+	}
+	deadline_ = budget ? Clock::now() +
+				     std::chrono::duration_cast<Clock::duration>(budget)
+			   : Clock::time_point::max();
+	executor_->queueJob(this);
+}
+
+bool Executor::Job::Finished()
+{
+	std::lock_guard<std::mutex> lock(executor_->mutex_);
+	return state_ == Done;
+}
+
+void Executor::Job::Wait()
+{
+	std::unique_lock<std::mutex> lock(executor_->mutex_);
+	executor_->done_signal_.wait(lock, [&] {
+		return state_ != Queued && state_ != Running;
+	});
+}
+
+void Executor::Job::Cancel()
+{
+	std::unique_lock<std::mutex> lock(executor_->mutex_);
+	if (state_ == Queued) {
+		auto &queue = executor_->queue_;
+		queue.erase(std::find(queue.begin(), queue.end(), this));
+		state_ = Idle;
+		return;
+	}
+	executor_->done_signal_.wait(lock, [&] {
+		return state_ != Running;
+	});
+}
+
+Executor::Executor()
+	: idle_workers_(0), num_workers_(DEFAULT_WORKERS), abort_(false)
+{
+}
+
+Executor::~Executor()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		abort_ = true;
+	}
+	work_signal_.notify_all();
+	for (std::thread &worker : workers_)
+		worker.join();
+}
+
+std::shared_ptr<Executor> Executor::Get()
+{
+	// The executor lives for as long as something uses it, so that it
+	// doesn't leave threads behind when the IPA is unloaded.
+	static std::mutex mutex;
+	static std::weak_ptr<Executor> instance;
+	std::lock_guard<std::mutex> lock(mutex);
+	std::shared_ptr<Executor> executor = instance.lock();
+	if (!executor) {
+		executor = std::shared_ptr<Executor>(new Executor());
+		instance = executor;
+	}
+	return executor;
+}
+
+void Executor::Read(boost::property_tree::ptree const &params)
+{
+	unsigned int num_workers =
+		params.get<unsigned int>("workers", DEFAULT_WORKERS);
+	std::vector<unsigned int> cpus;
+	if (params.get_child_optional("cpus")) {
+		for (auto &p : params.get_child("cpus"))
+			cpus.push_back(p.second.get_value<unsigned int>());
+	}
+	Configure(num_workers, cpus);
+}
+
+void Executor::Configure(unsigned int num_workers,
+			 std::vector<unsigned int> const &cpus)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	// The pool is shared with the other cameras, so don't disturb it once
+	// it's running. All the tuning files normally agree anyway.
+	if (!workers_.empty()) {
+		if (num_workers != num_workers_ || cpus != cpus_)
+			LOG(RPiExecutor, Warning)
+				<< "Executor already running, configuration ignored";
+		return;
+	}
+	num_workers_ = std::max(num_workers, 1u);
+	cpus_ = cpus;
+	LOG(RPiExecutor, Debug)
+		<< "Using " << num_workers_ << " worker thread(s)";
+}
+
+// Must be called with the mutex held.
+void Executor::queueJob(Job *job)
+{
+	// Earliest deadline first, jobs with the same deadline in the order
+	// they were started.
+	auto it = std::upper_bound(queue_.begin(), queue_.end(), job,
+				   [](Job const *a, Job const *b) {
+					   return a->deadline_ < b->deadline_;
+				   });
+	queue_.insert(it, job);
+	job->state_ = Job::Queued;
+	// Workers are only created when no idle one can take the job, a single
+	// camera with few asynchronous algorithms may never use them all.
+	if (queue_.size() > idle_workers_ && workers_.size() < num_workers_)
+		startWorker();
+	work_signal_.notify_one();
+}
+
+// Must be called with the mutex held.
+void Executor::startWorker()
+{
+	workers_.emplace_back(std::bind(&Executor::workerFunc, this));
+	if (cpus_.empty())
+		return;
+
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	for (unsigned int cpu : cpus_)
+		CPU_SET(cpu, &cpuset);
+	int ret = pthread_setaffinity_np(workers_.back().native_handle(),
+					 sizeof(cpuset), &cpuset);
+	if (ret)
+		LOG(RPiExecutor, Warning)
+			<< "Failed to set worker CPU affinity: " << strerror(ret);
+}
+
+void Executor::workerFunc()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	// Taking the mutex guarantees the affinity from the tuning file has been
+	// set, the thread configuration from the environment then overrides it.
+	Thread::setCurrentName("RPiExecutor");
+	while (true) {
+		idle_workers_++;
+		work_signal_.wait(lock, [&] {
+			return abort_ || !queue_.empty();
+		});
+		idle_workers_--;
+		if (abort_)
+			break;
+		Job *job = queue_.front();
+		queue_.pop_front();
+		job->state_ = Job::Running;
+		lock.unlock();
+		job->func_();
+		Clock::time_point now = Clock::now();
+		lock.lock();
+		if (now > job->deadline_)
+			LOG(RPiExecutor, Debug)
+				<< "Job overran its deadline by "
+				<< utils::Duration(now - job->deadline_).get<std::milli>()
+				<< "ms";
+		job->state_ = Job::Done;
+		done_signal_.notify_all();
+	}
+}
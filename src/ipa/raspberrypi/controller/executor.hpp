@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * executor.hpp - pool of threads running the asynchronous algorithm jobs
+ */
+#pragma once
+
+// The Executor is a small pool of worker threads, shared by the control
+// algorithms of all the cameras in the process, to which the algorithms hand
+// their asynchronous calculations (such as the AWB and ALSC searches).
+//
+// Each algorithm owns a Job which it starts with a time budget, normally the
+// number of frames until it next wants to run, converted to a duration using
+// the frame period. Queued jobs are run in order of their deadlines, and jobs
+// overrunning their deadline are reported.
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <libcamera/base/utils.h>
+
+#include <boost/property_tree/ptree.hpp>
+
+namespace RPiController {
+
+class Executor
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	class Job
+	{
+	public:
+		Job(std::function<void()> const &func);
+		~Job();
+		// Queue the job, to be finished within the given budget. A zero
+		// budget means the job has no deadline.
+		void Start(libcamera::utils::Duration budget);
+		// Check whether the job has run since it was last started.
+		bool Finished();
+		// Wait until the job has run, if it was started.
+		void Wait();
+		// Remove the job from the queue, or wait for it if it's running.
+		void Cancel();
+
+	private:
+		friend class Executor;
+
+		enum State { Idle, Queued, Running, Done };
+
+		std::shared_ptr<Executor> executor_;
+		std::function<void()> func_;
+		// the following are protected by the executor's mutex
+		Clock::time_point deadline_;
+		State state_;
+	};
+
+	~Executor();
+
+	// Return the executor shared by all the algorithms in the process.
+	static std::shared_ptr<Executor> Get();
+
+	// Read the "workers" count and the "cpus" the workers may run on.
+	void Read(boost::property_tree::ptree const &params);
+	void Configure(unsigned int num_workers,
+		       std::vector<unsigned int> const &cpus);
+
+private:
+	Executor();
+
+	void queueJob(Job *job);
+	void startWorker();
+	void workerFunc();
+
+	std::mutex mutex_;
+	// condvar for the workers to wait for jobs on
+	std::condition_variable work_signal_;
+	// condvar for the algorithms to wait for their job to finish on
+	std::condition_variable done_signal_;
+	// queued jobs, in order of increasing deadline
+	std::deque<Job *> queue_;
+	std::vector<std::thread> workers_;
+	unsigned int idle_workers_;
+	unsigned int num_workers_;
+	std::vector<unsigned int> cpus_;
+	bool abort_;
+};
+
+} // namespace RPiController
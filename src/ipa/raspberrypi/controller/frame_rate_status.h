@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * frame_rate_status.h - scene adaptive frame rate control algorithm status
+ */
+#pragma once
+
+#include <libcamera/base/utils.h>
+
+// The "frame rate" algorithm watches how much the statistics change from one
+// frame to the next. When the scene stays static it lets the frame duration
+// grow, to save power and bandwidth, and it asks for the shortest frame
+// duration again as soon as the scene changes. The IPA clips the frame
+// duration to the limits set by the application.
+
+struct FrameRateStatus {
+	// frame duration the scene allows, or 0 if it mustn't be lengthened
+	libcamera::utils::Duration frame_duration;
+	// relative change of the statistics since the previous frame
+	double scene_change;
+};
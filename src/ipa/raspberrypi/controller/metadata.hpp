@@ -6,12 +6,38 @@
  */
 #pragma once
 
-// A simple class for carrying arbitrary metadata, for example about an image.
-
-#include <any>
-#include <map>
-#include <mutex>
-#include <string>
+// A simple class for carrying metadata, for example about an image.
+//
+// The metadata has a fixed layout with one slot for each status type
+// (DeviceStatus, AgcStatus, ...), selected at compile time by the type. Each
+// slot records the generation in which it was last written, and only holds a
+// valid item if that matches the generation of the metadata. Clearing the
+// metadata therefore only bumps the generation, and looking up an item
+// involves no string comparison, allocation or type erasure.
+//
+// Metadata is only accessed from the IPA thread (the asynchronous algorithm
+// jobs exchange their results through their own synchronisation), so no
+// locking is needed.
+
+#include <stdint.h>
+#include <tuple>
+
+#include "af_status.h"
+#include "agc_status.h"
+#include "alsc_status.h"
+#include "awb_status.h"
+#include "black_level_status.h"
+#include "ccm_status.h"
+#include "contrast_status.h"
+#include "denoise_status.h"
+#include "device_status.h"
+#include "dpc_status.h"
+#include "focus_status.h"
+#include "frame_rate_status.h"
+#include "geq_status.h"
+#include "lux_status.h"
+#include "noise_status.h"
+#include "sharpen_status.h"
 
 namespace RPiController {
 
@@ -20,91 +46,106 @@ class Metadata
 public:
 	Metadata() = default;
 
-	Metadata(Metadata const &other)
-	{
-		std::scoped_lock other_lock(other.mutex_);
-		data_ = other.data_;
-	}
+	Metadata(Metadata const &other) = default;
 
 	Metadata(Metadata &&other)
+		: slots_(other.slots_), generation_(other.generation_)
 	{
-		std::scoped_lock other_lock(other.mutex_);
-		data_ = std::move(other.data_);
-		other.data_.clear();
+		other.Clear();
 	}
 
 	template<typename T>
-	void Set(std::string const &tag, T const &value)
+	void Set(T const &value)
 	{
-		std::scoped_lock lock(mutex_);
-		data_[tag] = value;
+		Slot<T> &slot = std::get<Slot<T>>(slots_);
+		slot.value = value;
+		slot.generation = generation_;
 	}
 
 	template<typename T>
-	int Get(std::string const &tag, T &value) const
+	int Get(T &value) const
 	{
-		std::scoped_lock lock(mutex_);
-		auto it = data_.find(tag);
-		if (it == data_.end())
+		T const *item = Get<T>();
+		if (!item)
 			return -1;
-		value = std::any_cast<T>(it->second);
+		value = *item;
 		return 0;
 	}
 
-	void Clear()
+	// This allows in-place access to the Metadata contents. The pointer
+	// remains valid until the next Clear() or Merge().
+	template<typename T>
+	T *Get()
 	{
-		std::scoped_lock lock(mutex_);
-		data_.clear();
+		Slot<T> &slot = std::get<Slot<T>>(slots_);
+		return slot.generation == generation_ ? &slot.value : nullptr;
 	}
 
-	Metadata &operator=(Metadata const &other)
+	template<typename T>
+	T const *Get() const
 	{
-		std::scoped_lock lock(mutex_, other.mutex_);
-		data_ = other.data_;
-		return *this;
+		Slot<T> const &slot = std::get<Slot<T>>(slots_);
+		return slot.generation == generation_ ? &slot.value : nullptr;
+	}
+
+	void Clear()
+	{
+		// Slots written in the previous generations are now stale.
+		generation_++;
 	}
 
+	Metadata &operator=(Metadata const &other) = default;
+
 	Metadata &operator=(Metadata &&other)
 	{
-		std::scoped_lock lock(mutex_, other.mutex_);
-		data_ = std::move(other.data_);
-		other.data_.clear();
+		if (this != &other) {
+			slots_ = other.slots_;
+			generation_ = other.generation_;
+			other.Clear();
+		}
 		return *this;
 	}
 
 	void Merge(Metadata &other)
 	{
-		std::scoped_lock lock(mutex_, other.mutex_);
-		data_.merge(other.data_);
+		// Move the items of other that we don't have, leaving the
+		// others in place, like std::map::merge() does.
+		std::apply([&](auto &...slots) { (MergeSlot(slots, other), ...); },
+			   slots_);
 	}
 
+private:
 	template<typename T>
-	T *GetLocked(std::string const &tag)
-	{
-		// This allows in-place access to the Metadata contents,
-		// for which you should be holding the lock.
-		auto it = data_.find(tag);
-		if (it == data_.end())
-			return nullptr;
-		return std::any_cast<T>(&it->second);
-	}
+	struct Slot {
+		// Generation 0 is never current, the slot starts empty.
+		Slot()
+			: value{}, generation(0)
+		{
+		}
+
+		T value;
+		uint64_t generation;
+	};
 
 	template<typename T>
-	void SetLocked(std::string const &tag, T const &value)
+	void MergeSlot(Slot<T> &slot, Metadata &other)
 	{
-		// Use this only if you're holding the lock yourself.
-		data_[tag] = value;
+		Slot<T> &other_slot = std::get<Slot<T>>(other.slots_);
+		if (slot.generation == generation_ ||
+		    other_slot.generation != other.generation_)
+			return;
+		slot.value = other_slot.value;
+		slot.generation = generation_;
+		other_slot.generation = 0;
 	}
 
-	// Note: use of (lowercase) lock and unlock means you can create scoped
-	// locks with the standard lock classes.
-	// e.g. std::lock_guard<RPiController::Metadata> lock(metadata)
-	void lock() { mutex_.lock(); }
-	void unlock() { mutex_.unlock(); }
-
-private:
-	mutable std::mutex mutex_;
-	std::map<std::string, std::any> data_;
+	std::tuple<Slot<AfStatus>, Slot<AgcStatus>, Slot<AlscStatus>,
+		   Slot<AwbStatus>, Slot<BlackLevelStatus>, Slot<CcmStatus>,
+		   Slot<ContrastStatus>, Slot<DenoiseStatus>, Slot<DeviceStatus>,
+		   Slot<DpcStatus>, Slot<FocusStatus>, Slot<FrameRateStatus>,
+		   Slot<GeqStatus>, Slot<LuxStatus>, Slot<NoiseStatus>,
+		   Slot<SharpenStatus>> slots_;
+	uint64_t generation_ = 1;
 };
 
 } // namespace RPiController
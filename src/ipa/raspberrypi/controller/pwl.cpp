@@ -5,6 +5,7 @@
  * pwl.cpp - piecewise linear functions
  */
 
+#include <algorithm>
 #include <cassert>
 #include <stdexcept>
 
@@ -56,9 +57,8 @@ bool Pwl::Empty() const
 
 double Pwl::Eval(double x, int *span_ptr, bool update_span) const
 {
-	int span = findSpan(x, span_ptr && *span_ptr != -1
-				       ? *span_ptr
-				       : points_.size() / 2 - 1);
+	int span = span_ptr && *span_ptr != -1 ? findSpan(x, *span_ptr)
+					       : findSpan(x);
 	if (span_ptr && update_span)
 		*span_ptr = span;
 	return points_[span].y +
@@ -66,10 +66,19 @@ double Pwl::Eval(double x, int *span_ptr, bool update_span) const
 		       (points_[span + 1].x - points_[span].x);
 }
 
+void Pwl::Eval(libcamera::Span<const double> x,
+	       libcamera::Span<double> y) const
+{
+	assert(x.size() == y.size());
+	int span = -1;
+	for (unsigned int i = 0; i < x.size(); i++)
+		y[i] = Eval(x[i], &span);
+}
+
 int Pwl::findSpan(double x, int span) const
 {
-	// Pwls are generally small, so linear search may well be faster than
-	// binary, though could review this if large PWls start turning up.
+	// Starting from a nearby span, which the caller normally knows, a linear
+	// search only has a step or two to take.
 	int last_span = points_.size() - 2;
 	// some algorithms may call us with span pointing directly at the last
 	// control point
@@ -81,6 +90,17 @@ int Pwl::findSpan(double x, int span) const
 	return span;
 }
 
+int Pwl::findSpan(double x) const
+{
+	// Without a hint, binary search for the first point beyond x. The span
+	// starts at the point before it.
+	auto it = std::upper_bound(points_.begin(), points_.end(), x,
+				   [](double v, Point const &p) { return v < p.x; });
+	int last_span = points_.size() - 2;
+	int span = it - points_.begin() - 1;
+	return std::max(0, std::min(last_span, span));
+}
+
 Pwl::PerpType Pwl::Invert(Point const &xy, Point &perp, int &span,
 			  const double eps) const
 {
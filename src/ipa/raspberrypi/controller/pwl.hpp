@@ -9,6 +9,8 @@
 #include <math.h>
 #include <vector>
 
+#include <libcamera/base/span.h>
+
 #include <boost/property_tree/ptree.hpp>
 
 namespace RPiController {
@@ -67,6 +69,11 @@ public:
 	// -1.
 	double Eval(double x, int *span_ptr = nullptr,
 		    bool update_span = true) const;
+	// Evaluate Pwl at every value in x, writing the results to y. Each
+	// search starts from the span of the previous value, so this is
+	// cheapest when x is sorted.
+	void Eval(libcamera::Span<const double> x,
+		  libcamera::Span<double> y) const;
 	// Find perpendicular closest to xy, starting from span+1 so you can
 	// call it repeatedly to check for multiple closest points (set span to
 	// -1 on the first call). Also returns "pseudo" perpendiculars; see
@@ -106,6 +113,7 @@ public:
 
 private:
 	int findSpan(double x, int span) const;
+	int findSpan(double x) const;
 	std::vector<Point> points_;
 };
 
@@ -0,0 +1,358 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * af.cpp - contrast detect autofocus control algorithm
+ */
+
+#include <algorithm>
+#include <math.h>
+#include <stdexcept>
+#include <string>
+
+#include <libcamera/base/log.h>
+
+#include "../device_status.h"
+
+#include "af.hpp"
+
+using namespace RPiController;
+using namespace libcamera;
+
+LOG_DEFINE_CATEGORY(RPiAf)
+
+#define NAME "rpi.af"
+
+// Give up waiting for the lens to report the end of a sweep after this many
+// frames, in case the frames showing it were not processed.
+static constexpr unsigned int kMaxEndFrames = 8;
+
+Af::Af(Controller *controller)
+	: AfAlgorithm(controller), mode_(AfMode::Continuous),
+	  state_(AfState::Idle), phase_(Phase::Idle), lens_setting_(-1.0),
+	  manual_position_(-1.0), sweep_start_(0.0), sweep_end_(0.0),
+	  step_(0.0), end_frames_(0), reference_fom_(0.0), drop_count_(0)
+{
+}
+
+char const *Af::Name() const
+{
+	return NAME;
+}
+
+void Af::Read(boost::property_tree::ptree const &params)
+{
+	coarse_step_ = params.get<double>("coarse_step", 0.05);
+	fine_step_ = params.get<double>("fine_step", 0.01);
+	drop_ratio_ = params.get<double>("drop_ratio", 0.75);
+	min_contrast_ = params.get<double>("min_contrast", 0.1);
+	retrigger_ratio_ = params.get<double>("retrigger_ratio", 0.8);
+	retrigger_frames_ = params.get<unsigned int>("retrigger_frames", 10);
+
+	// By default, measure the contrast in the two central regions of the
+	// 4x3 grid of focus regions.
+	regions_.clear();
+	if (params.get_child_optional("regions")) {
+		for (auto &p : params.get_child("regions")) {
+			unsigned int region = p.second.get_value<unsigned int>();
+			if (region >= FOCUS_REGIONS)
+				throw std::runtime_error("Af: bad focus region " +
+							 std::to_string(region));
+			regions_.push_back(region);
+		}
+	}
+	if (regions_.empty())
+		regions_ = { 5, 6 };
+
+	if (coarse_step_ <= 0.0 || fine_step_ <= 0.0)
+		throw std::runtime_error("Af: sweep steps must be positive");
+
+	LOG(RPiAf, Debug)
+		<< "Read coarse step " << coarse_step_
+		<< " fine step " << fine_step_
+		<< " drop ratio " << drop_ratio_
+		<< " retrigger ratio " << retrigger_ratio_;
+}
+
+void Af::SetMode(AfMode mode)
+{
+	if (mode == mode_)
+		return;
+
+	mode_ = mode;
+	phase_ = Phase::Idle;
+	state_ = AfState::Idle;
+
+	// A continuous scan is started by the next call to Process.
+	if (mode_ == AfMode::Manual && manual_position_ >= 0.0)
+		lens_setting_ = manual_position_;
+}
+
+void Af::SetLensPosition(double position)
+{
+	// The position is remembered, but only takes effect in manual mode.
+	manual_position_ = std::clamp(position, 0.0, 1.0);
+	if (mode_ == AfMode::Manual)
+		lens_setting_ = manual_position_;
+}
+
+void Af::Trigger()
+{
+	if (mode_ == AfMode::Auto)
+		startScan();
+}
+
+void Af::Cancel()
+{
+	if (mode_ == AfMode::Manual)
+		return;
+
+	// In continuous mode, this restarts the search from scratch.
+	phase_ = Phase::Idle;
+	state_ = AfState::Idle;
+}
+
+void Af::Prepare(Metadata *image_metadata)
+{
+	// Report the state early so that it is there even if Process doesn't
+	// run on this frame.
+	if (lens_setting_ >= 0.0)
+		image_metadata->Set(AfStatus{ mode_, state_, lens_setting_ });
+}
+
+void Af::Process(StatisticsPtr &stats, Metadata *image_metadata)
+{
+	// The lens position the frame was exposed with is reported by the
+	// pipeline together with the sensor controls, with the lens delay
+	// already accounted for. This lets us move the lens on every frame
+	// and still attribute each contrast measurement to the right place.
+	DeviceStatus *device_status = image_metadata->Get<DeviceStatus>();
+	double position = device_status ? device_status->lens_setting : -1.0;
+	if (position < 0.0)
+		return;
+
+	if (lens_setting_ < 0.0)
+		lens_setting_ = manual_position_ >= 0.0 && mode_ == AfMode::Manual
+				? manual_position_ : position;
+
+	if (mode_ == AfMode::Continuous && phase_ == Phase::Idle)
+		startScan();
+
+	double fom = figureOfMerit(stats);
+
+	switch (phase_) {
+	case Phase::Coarse:
+	case Phase::Fine:
+		recordSample(position, fom);
+		if (sweepDone()) {
+			finishSweep();
+		} else if (!samePosition(lens_setting_, sweep_end_)) {
+			lens_setting_ += step_;
+			if ((step_ > 0.0 && lens_setting_ > sweep_end_) ||
+			    (step_ < 0.0 && lens_setting_ < sweep_end_))
+				lens_setting_ = sweep_end_;
+		} else {
+			end_frames_++;
+		}
+		break;
+
+	case Phase::Monitor:
+		monitor(position, fom);
+		break;
+
+	case Phase::Idle:
+		break;
+	}
+
+	image_metadata->Set(AfStatus{ mode_, state_, lens_setting_ });
+
+	LOG(RPiAf, Debug)
+		<< "Lens " << position << " contrast " << fom
+		<< " next lens " << lens_setting_;
+}
+
+double Af::figureOfMerit(StatisticsPtr &stats) const
+{
+	// Use the output of the second filter for the pixels above the noise
+	// threshold, which is what rpi.focus reports too.
+	double fom = 0.0;
+	for (unsigned int region : regions_)
+		fom += stats->focus_stats[region].contrast_val[1][1];
+	return fom;
+}
+
+bool Af::samePosition(double a, double b) const
+{
+	// The positions reported back have been quantised to the actuator
+	// codes, compare them with a tolerance of half the fine step, which
+	// must thus be larger than an actuator code.
+	return fabs(a - b) < fine_step_ / 2;
+}
+
+void Af::startScan()
+{
+	// Sweep from the end of the range closest to the lens, to save the
+	// time of moving it across.
+	double from = 0.0, to = 1.0;
+	if (lens_setting_ > 0.5)
+		std::swap(from, to);
+
+	startSweep(Phase::Coarse, from, to, coarse_step_);
+	state_ = AfState::Scanning;
+}
+
+void Af::startSweep(Phase phase, double from, double to, double step)
+{
+	phase_ = phase;
+	sweep_start_ = std::clamp(from, 0.0, 1.0);
+	sweep_end_ = std::clamp(to, 0.0, 1.0);
+	step_ = sweep_end_ >= sweep_start_ ? step : -step;
+	samples_.clear();
+	end_frames_ = 0;
+	lens_setting_ = sweep_start_;
+}
+
+void Af::recordSample(double position, double fom)
+{
+	// Frames exposed while the lens was still on its way to the start of
+	// the sweep are of no use.
+	double tolerance = fine_step_ / 2;
+	double low = std::min(sweep_start_, sweep_end_) - tolerance;
+	double high = std::max(sweep_start_, sweep_end_) + tolerance;
+	if (position < low || position > high)
+		return;
+
+	// A later frame at the same position had more time to settle.
+	for (Sample &sample : samples_) {
+		if (samePosition(sample.position, position)) {
+			sample.fom = fom;
+			return;
+		}
+	}
+
+	samples_.push_back({ position, fom });
+}
+
+bool Af::sweepDone() const
+{
+	if (samples_.empty())
+		return end_frames_ >= kMaxEndFrames;
+
+	if (samePosition(samples_.back().position, sweep_end_) ||
+	    end_frames_ >= kMaxEndFrames)
+		return true;
+
+	// Stop early once the contrast has clearly dropped past a peak. Two
+	// consecutive samples are required to be robust against noise.
+	if (samples_.size() < 3)
+		return false;
+
+	double best = 0.0;
+	for (const Sample &sample : samples_)
+		best = std::max(best, sample.fom);
+
+	unsigned int n = samples_.size();
+	return samples_[n - 1].fom < drop_ratio_ * best &&
+	       samples_[n - 2].fom < drop_ratio_ * best;
+}
+
+double Af::findPeak() const
+{
+	std::vector<Sample> samples = samples_;
+	std::sort(samples.begin(), samples.end(),
+		  [](const Sample &a, const Sample &b) { return a.position < b.position; });
+
+	auto best = std::max_element(samples.begin(), samples.end(),
+				     [](const Sample &a, const Sample &b) { return a.fom < b.fom; });
+	if (best == samples.begin() || best == samples.end() - 1)
+		return best->position;
+
+	// Refine the peak by fitting a parabola through it and its neighbours.
+	double x0 = (best - 1)->position, y0 = (best - 1)->fom;
+	double x1 = best->position, y1 = best->fom;
+	double x2 = (best + 1)->position, y2 = (best + 1)->fom;
+	double denom = (x0 - x1) * (x0 - x2) * (x1 - x2);
+	double a = (x2 * (y1 - y0) + x1 * (y0 - y2) + x0 * (y2 - y1)) / denom;
+	double b = (x2 * x2 * (y0 - y1) + x1 * x1 * (y2 - y0) + x0 * x0 * (y1 - y2)) / denom;
+	if (a >= 0.0)
+		return x1;
+
+	return std::clamp(-b / (2 * a), x0, x2);
+}
+
+void Af::finishSweep()
+{
+	double best = 0.0, worst = 0.0;
+	if (!samples_.empty()) {
+		auto [min, max] = std::minmax_element(samples_.begin(), samples_.end(),
+						      [](const Sample &a, const Sample &b) { return a.fom < b.fom; });
+		worst = min->fom;
+		best = max->fom;
+	}
+
+	bool found = best > 0.0 && best - worst >= min_contrast_ * best;
+
+	if (phase_ == Phase::Coarse && found) {
+		// Sweep the neighbourhood of the peak again, more finely,
+		// starting from the side the lens is closest to.
+		double peak = findPeak();
+		double from = peak - coarse_step_, to = peak + coarse_step_;
+		if (fabs(lens_setting_ - to) < fabs(lens_setting_ - from))
+			std::swap(from, to);
+		startSweep(Phase::Fine, from, to, fine_step_);
+		return;
+	}
+
+	if (found) {
+		lens_setting_ = findPeak();
+		state_ = AfState::Focused;
+	} else {
+		// Leave the lens where the scene was the least blurry, if
+		// anywhere.
+		if (!samples_.empty())
+			lens_setting_ = findPeak();
+		state_ = AfState::Failed;
+	}
+
+	LOG(RPiAf, Debug)
+		<< (found ? "Focused" : "Failed to focus")
+		<< " at lens position " << lens_setting_;
+
+	samples_.clear();
+	reference_fom_ = 0.0;
+	drop_count_ = 0;
+	phase_ = mode_ == AfMode::Continuous ? Phase::Monitor : Phase::Idle;
+}
+
+void Af::monitor(double position, double fom)
+{
+	// Wait for the lens to reach the focus position before watching the
+	// contrast.
+	if (!samePosition(position, lens_setting_))
+		return;
+
+	if (reference_fom_ == 0.0) {
+		reference_fom_ = fom;
+		return;
+	}
+
+	// Rescan when the contrast departs from the reference for long enough,
+	// because the scene or its distance has changed.
+	if (fom < retrigger_ratio_ * reference_fom_ ||
+	    fom * retrigger_ratio_ > reference_fom_)
+		drop_count_++;
+	else
+		drop_count_ = 0;
+
+	if (drop_count_ >= retrigger_frames_) {
+		LOG(RPiAf, Debug) << "Contrast changed, rescanning";
+		startScan();
+	}
+}
+
+// Register algorithm with the system.
+static Algorithm *Create(Controller *controller)
+{
+	return new Af(controller);
+}
+static RegisterAlgorithm reg(NAME, &Create);
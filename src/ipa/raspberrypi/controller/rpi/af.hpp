@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * af.hpp - contrast detect autofocus control algorithm
+ */
+#pragma once
+
+#include <vector>
+
+#include "../af_algorithm.hpp"
+#include "../af_status.h"
+
+// This is our implementation of the "af algorithm". Focus is found by sweeping
+// the lens across its range while measuring the contrast of the image with the
+// ISP focus statistics, first with a coarse step and then with a fine step
+// around the best position of the coarse sweep.
+
+namespace RPiController {
+
+class Af : public AfAlgorithm
+{
+public:
+	Af(Controller *controller);
+	char const *Name() const override;
+	void Read(boost::property_tree::ptree const &params) override;
+	void SetMode(AfMode mode) override;
+	void SetLensPosition(double position) override;
+	void Trigger() override;
+	void Cancel() override;
+	void Prepare(Metadata *image_metadata) override;
+	void Process(StatisticsPtr &stats, Metadata *image_metadata) override;
+
+private:
+	enum class Phase { Idle, Coarse, Fine, Monitor };
+	struct Sample {
+		double position;
+		double fom;
+	};
+
+	double figureOfMerit(StatisticsPtr &stats) const;
+	bool samePosition(double a, double b) const;
+	void startScan();
+	void startSweep(Phase phase, double from, double to, double step);
+	void recordSample(double position, double fom);
+	bool sweepDone() const;
+	double findPeak() const;
+	void finishSweep();
+	void monitor(double position, double fom);
+
+	// tuning parameters
+	double coarse_step_;
+	double fine_step_;
+	double drop_ratio_;
+	double min_contrast_;
+	double retrigger_ratio_;
+	unsigned int retrigger_frames_;
+	std::vector<unsigned int> regions_;
+
+	AfMode mode_;
+	AfState state_;
+	Phase phase_;
+	// lens position requested from the pipeline, -1 until known
+	double lens_setting_;
+	// lens position set by the application, -1 if none
+	double manual_position_;
+	// current sweep, running from sweep_start_ to sweep_end_
+	double sweep_start_;
+	double sweep_end_;
+	double step_;
+	std::vector<Sample> samples_;
+	// frames waited for the lens to report the end of the sweep
+	unsigned int end_frames_;
+	// contrast at the focus position, watched in continuous mode
+	double reference_fom_;
+	unsigned int drop_count_;
+};
+
+} // namespace RPiController
@@ -5,15 +5,18 @@
  * agc.cpp - AGC/AEC control algorithm
  */
 
+#include <algorithm>
+#include <array>
 #include <map>
 
 #include <linux/bcm2835-isp.h>
 
 #include <libcamera/base/log.h>
 
+#include "libipa/histogram.h"
+
 #include "../awb_status.h"
 #include "../device_status.h"
-#include "../histogram.hpp"
 #include "../lux_status.h"
 #include "../metadata.hpp"
 
@@ -172,7 +175,8 @@ Agc::Agc(Controller *controller)
 	  frame_count_(0), lock_count_(0),
 	  last_target_exposure_(0s), last_sensitivity_(0.0),
 	  ev_(1.0), flicker_period_(0s),
-	  max_shutter_(0s), fixed_shutter_(0s), fixed_analogue_gain_(0.0)
+	  max_shutter_(0s), fixed_shutter_(0s), fixed_analogue_gain_(0.0),
+	  initial_shutter_(0s), initial_analogue_gain_(0.0)
 {
 	memset(&awb_, 0, sizeof(awb_));
 	// Setting status_.total_exposure_value_ to zero initially tells us
@@ -260,6 +264,14 @@ void Agc::SetFixedAnalogueGain(double fixed_analogue_gain)
 	status_.analogue_gain = fixed_analogue_gain;
 }
 
+void Agc::SetInitialExposure(Duration shutter, double analogue_gain)
+{
+	// These are only used on startup, to resume from a previously
+	// converged exposure instead of the defaults.
+	initial_shutter_ = shutter;
+	initial_analogue_gain_ = analogue_gain;
+}
+
 void Agc::SetMeteringMode(std::string const &metering_mode_name)
 {
 	metering_mode_name_ = metering_mode_name;
@@ -317,6 +329,23 @@ void Agc::SwitchMode(CameraMode const &camera_mode,
 		filtered_.total_exposure *= ratio;
 
 		divideUpExposure();
+	} else if (initial_shutter_ && initial_analogue_gain_) {
+		// We're starting up with the exposure of a previous session. This
+		// behaves like a mode switch from a converged state, except that
+		// the exposure is divided up according to the current profile.
+
+		fetchAwbStatus(metadata);
+		double min_colour_gain = std::min({ awb_.gain_r, awb_.gain_g, awb_.gain_b, 1.0 });
+		ASSERT(min_colour_gain != 0.0);
+
+		target_.total_exposure_no_dg = initial_shutter_ * initial_analogue_gain_;
+		target_.total_exposure = target_.total_exposure_no_dg / min_colour_gain;
+		filtered_ = target_;
+
+		divideUpExposure();
+
+		initial_shutter_ = 0s;
+		initial_analogue_gain_ = 0.0;
 	} else {
 		// We come through here on startup, when at least one of the shutter
 		// or gain has not been fixed. We must still write those values out so
@@ -342,7 +371,7 @@ void Agc::Prepare(Metadata *image_metadata)
 	if (status_.total_exposure_value) {
 		// Process has run, so we have meaningful values.
 		DeviceStatus device_status;
-		if (image_metadata->Get("device.status", device_status) == 0) {
+		if (image_metadata->Get(device_status) == 0) {
 			Duration actual_exposure = device_status.shutter_speed *
 						   device_status.analogue_gain;
 			if (actual_exposure) {
@@ -364,7 +393,7 @@ void Agc::Prepare(Metadata *image_metadata)
 			}
 		} else
 			LOG(RPiAgc, Warning) << Name() << ": no device metadata";
-		image_metadata->Set("agc.status", status_);
+		image_metadata->Set(status_);
 	}
 }
 
@@ -485,15 +514,14 @@ void Agc::housekeepConfig()
 
 void Agc::fetchCurrentExposure(Metadata *image_metadata)
 {
-	std::unique_lock<Metadata> lock(*image_metadata);
 	DeviceStatus *device_status =
-		image_metadata->GetLocked<DeviceStatus>("device.status");
+		image_metadata->Get<DeviceStatus>();
 	if (!device_status)
 		throw std::runtime_error("Agc: no device metadata");
 	current_.shutter = device_status->shutter_speed;
 	current_.analogue_gain = device_status->analogue_gain;
 	AgcStatus *agc_status =
-		image_metadata->GetLocked<AgcStatus>("agc.status");
+		image_metadata->Get<AgcStatus>();
 	current_.total_exposure = agc_status ? agc_status->total_exposure_value : 0s;
 	current_.total_exposure_no_dg = current_.shutter * current_.analogue_gain;
 }
@@ -503,37 +531,106 @@ void Agc::fetchAwbStatus(Metadata *image_metadata)
 	awb_.gain_r = 1.0; // in case not found in metadata
 	awb_.gain_g = 1.0;
 	awb_.gain_b = 1.0;
-	if (image_metadata->Get("awb.status", awb_) != 0)
+	if (image_metadata->Get(awb_) != 0)
 		LOG(RPiAgc, Debug) << "Agc: no AWB status found";
 }
 
-static double compute_initial_Y(bcm2835_isp_stats *stats, AwbStatus const &awb,
-				double weights[], double gain)
+namespace {
+
+// The Y value of the metering regions is a piecewise linear function of the
+// gain: every colour channel of every region grows linearly with the gain
+// until it saturates. The region statistics are turned once per frame into
+// the slope and the saturated value of each channel, sorted by the gain at
+// which the channel saturates. Evaluating Y for a gain is then a binary
+// search and two prefix sums, instead of a pass over all the regions for
+// every iteration of the gain search.
+
+class InitialYEstimator
 {
-	bcm2835_isp_stats_region *regions = stats->agc_stats;
+public:
+	InitialYEstimator(bcm2835_isp_stats *stats, AwbStatus const &awb,
+			  double weights[]);
+
+	double Eval(double gain) const;
+
+private:
+	static constexpr unsigned int NUM_TERMS = AGC_STATS_SIZE * 3;
+
+	unsigned int num_terms_;
+	// Gains at which the terms saturate, in ascending order.
+	std::array<double, NUM_TERMS> saturation_;
+	// Sum of the saturated values of the terms [0, i).
+	std::array<double, NUM_TERMS + 1> saturated_sum_;
+	// Sum of the slopes of the terms [i, num_terms_).
+	std::array<double, NUM_TERMS + 1> slope_sum_;
+	double pixel_sum_;
+};
+
+InitialYEstimator::InitialYEstimator(bcm2835_isp_stats *stats,
+				     AwbStatus const &awb, double weights[])
+	: num_terms_(0), pixel_sum_(0)
+{
+	struct Term {
+		double saturation;
+		double slope;
+		double saturated;
+	};
+	std::array<Term, NUM_TERMS> terms;
+
 	// Note how the calculation below means that equal weights give you
 	// "average" metering (i.e. all pixels equally important).
-	double R_sum = 0, G_sum = 0, B_sum = 0, pixel_sum = 0;
+	bcm2835_isp_stats_region *regions = stats->agc_stats;
+	double const coeffs[3] = { awb.gain_r * .299, awb.gain_g * .587,
+				   awb.gain_b * .114 };
 	for (int i = 0; i < AGC_STATS_SIZE; i++) {
 		double counted = regions[i].counted;
-		double r_sum = std::min(regions[i].r_sum * gain, ((1 << PIPELINE_BITS) - 1) * counted);
-		double g_sum = std::min(regions[i].g_sum * gain, ((1 << PIPELINE_BITS) - 1) * counted);
-		double b_sum = std::min(regions[i].b_sum * gain, ((1 << PIPELINE_BITS) - 1) * counted);
-		R_sum += r_sum * weights[i];
-		G_sum += g_sum * weights[i];
-		B_sum += b_sum * weights[i];
-		pixel_sum += counted * weights[i];
+		double max_sum = ((1 << PIPELINE_BITS) - 1) * counted;
+		double const sums[3] = { (double)regions[i].r_sum,
+					 (double)regions[i].g_sum,
+					 (double)regions[i].b_sum };
+		pixel_sum_ += counted * weights[i];
+		for (int c = 0; c < 3; c++) {
+			// Channels without signal contribute nothing at any gain.
+			double slope = sums[c] * weights[i] * coeffs[c];
+			if (slope == 0.0)
+				continue;
+			terms[num_terms_++] = { max_sum / sums[c], slope,
+						max_sum * weights[i] * coeffs[c] };
+		}
+	}
+
+	std::sort(terms.begin(), terms.begin() + num_terms_,
+		  [](Term const &a, Term const &b) {
+			  return a.saturation < b.saturation;
+		  });
+
+	saturated_sum_[0] = 0;
+	slope_sum_[num_terms_] = 0;
+	for (unsigned int i = 0; i < num_terms_; i++) {
+		saturation_[i] = terms[i].saturation;
+		saturated_sum_[i + 1] = saturated_sum_[i] + terms[i].saturated;
 	}
-	if (pixel_sum == 0.0) {
+	for (unsigned int i = num_terms_; i > 0; i--)
+		slope_sum_[i - 1] = slope_sum_[i] + terms[i - 1].slope;
+}
+
+double InitialYEstimator::Eval(double gain) const
+{
+	if (pixel_sum_ == 0.0) {
 		LOG(RPiAgc, Warning) << "compute_initial_Y: pixel_sum is zero";
 		return 0;
 	}
-	double Y_sum = R_sum * awb.gain_r * .299 +
-		       G_sum * awb.gain_g * .587 +
-		       B_sum * awb.gain_b * .114;
-	return Y_sum / pixel_sum / (1 << PIPELINE_BITS);
+	// Terms whose saturation gain is below the gain are clipped.
+	unsigned int saturated =
+		std::upper_bound(saturation_.begin(),
+				 saturation_.begin() + num_terms_, gain) -
+		saturation_.begin();
+	double Y_sum = saturated_sum_[saturated] + slope_sum_[saturated] * gain;
+	return Y_sum / pixel_sum_ / (1 << PIPELINE_BITS);
 }
 
+} // namespace
+
 // We handle extra gain through EV by adjusting our Y targets. However, you
 // simply can't monitor histograms once they get very close to (or beyond!)
 // saturation, so we clamp the Y targets to this value. It does mean that EV
@@ -542,13 +639,13 @@ static double compute_initial_Y(bcm2835_isp_stats *stats, AwbStatus const &awb,
 
 #define EV_GAIN_Y_TARGET_LIMIT 0.9
 
-static double constraint_compute_gain(AgcConstraint &c, Histogram &h,
+static double constraint_compute_gain(AgcConstraint &c, ipa::Histogram &h,
 				      double lux, double ev_gain,
 				      double &target_Y)
 {
 	target_Y = c.Y_target.Eval(c.Y_target.Domain().Clip(lux));
 	target_Y = std::min(EV_GAIN_Y_TARGET_LIMIT, target_Y * ev_gain);
-	double iqm = h.InterQuantileMean(c.q_lo, c.q_hi);
+	double iqm = h.interQuantileMean(c.q_lo, c.q_hi);
 	return (target_Y * NUM_HISTOGRAM_BINS) / iqm;
 }
 
@@ -557,9 +654,9 @@ void Agc::computeGain(bcm2835_isp_stats *statistics, Metadata *image_metadata,
 {
 	struct LuxStatus lux = {};
 	lux.lux = 400; // default lux level to 400 in case no metadata found
-	if (image_metadata->Get("lux.status", lux) != 0)
+	if (image_metadata->Get(lux) != 0)
 		LOG(RPiAgc, Warning) << "Agc: no lux level found";
-	Histogram h(statistics->hist[0].g_hist, NUM_HISTOGRAM_BINS);
+	ipa::Histogram h(statistics->hist[0].g_hist);
 	double ev_gain = status_.ev * config_.base_ev;
 	// The initial gain and target_Y come from some of the regions. After
 	// that we consider the histogram constraints.
@@ -569,10 +666,11 @@ void Agc::computeGain(bcm2835_isp_stats *statistics, Metadata *image_metadata,
 
 	// Do this calculation a few times as brightness increase can be
 	// non-linear when there are saturated regions.
+	InitialYEstimator initial_Y_estimator(statistics, awb_,
+					      metering_mode_->weights);
 	gain = 1.0;
 	for (int i = 0; i < 8; i++) {
-		double initial_Y = compute_initial_Y(statistics, awb_,
-						     metering_mode_->weights, gain);
+		double initial_Y = initial_Y_estimator.Eval(gain);
 		double extra_gain = std::min(10.0, target_Y / (initial_Y + .001));
 		gain *= extra_gain;
 		LOG(RPiAgc, Debug) << "Initial Y " << initial_Y << " target " << target_Y
@@ -775,7 +873,7 @@ void Agc::writeAndFinish(Metadata *image_metadata, bool desaturate)
 	status_.analogue_gain = filtered_.analogue_gain;
 	// Write to metadata as well, in case anyone wants to update the camera
 	// immediately.
-	image_metadata->Set("agc.status", status_);
+	image_metadata->Set(status_);
 	LOG(RPiAgc, Debug) << "Output written, total exposure requested is "
 			   << filtered_.total_exposure;
 	LOG(RPiAgc, Debug) << "Camera exposure update: shutter time " << filtered_.shutter
@@ -83,6 +83,8 @@ public:
 	void SetMaxShutter(libcamera::utils::Duration max_shutter) override;
 	void SetFixedShutter(libcamera::utils::Duration fixed_shutter) override;
 	void SetFixedAnalogueGain(double fixed_analogue_gain) override;
+	void SetInitialExposure(libcamera::utils::Duration shutter,
+				double analogue_gain) override;
 	void SetMeteringMode(std::string const &metering_mode_name) override;
 	void SetExposureMode(std::string const &exposure_mode_name) override;
 	void SetConstraintMode(std::string const &contraint_mode_name) override;
@@ -134,6 +136,8 @@ private:
 	libcamera::utils::Duration max_shutter_;
 	libcamera::utils::Duration fixed_shutter_;
 	double fixed_analogue_gain_;
+	libcamera::utils::Duration initial_shutter_;
+	double initial_analogue_gain_;
 };
 
 } // namespace RPiController
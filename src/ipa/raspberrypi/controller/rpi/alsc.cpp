@@ -4,11 +4,14 @@
  *
  * alsc.cpp - ALSC (auto lens shading correction) control algorithm
  */
+#include <algorithm>
+#include <chrono>
 #include <math.h>
 
 #include <libcamera/base/log.h>
 
 #include "../awb_status.h"
+#include "../device_status.h"
 #include "alsc.hpp"
 
 // Raspberry Pi ALSC (Auto Lens Shading Correction) algorithm.
@@ -24,22 +27,21 @@ static const int X = ALSC_CELLS_X;
 static const int Y = ALSC_CELLS_Y;
 static const int XY = X * Y;
 static const double INSUFFICIENT_DATA = -1.0;
+// Upper bound of the number of cached calibration tables for each colour
+// channel, the step is enlarged as needed.
+static const int MAX_CAL_CACHE_SIZE = 256;
 
 Alsc::Alsc(Controller *controller)
-	: Algorithm(controller)
+	: Algorithm(controller), async_job_(std::bind(&Alsc::doAlsc, this)),
+	  cal_cache_ct_min_(0), cal_cache_ct_step_(0)
 {
-	async_abort_ = async_start_ = async_started_ = async_finished_ = false;
-	async_thread_ = std::thread(std::bind(&Alsc::asyncFunc, this));
+	async_started_ = false;
 }
 
 Alsc::~Alsc()
 {
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		async_abort_ = true;
-	}
-	async_signal_.notify_one();
-	async_thread_.join();
+	// Members the job uses are destroyed before the job itself.
+	async_job_.Cancel();
 }
 
 char const *Alsc::Name() const
@@ -149,6 +151,9 @@ void Alsc::Read(boost::property_tree::ptree const &params)
 	read_calibrations(config_.calibrations_Cb, params, "calibrations_Cb");
 	config_.default_ct = params.get<double>("default_ct", 4500.0);
 	config_.threshold = params.get<double>("threshold", 1e-3);
+	config_.ct_cache_step = params.get<double>("ct_cache_step", 50.0);
+	if (config_.ct_cache_step < 0)
+		throw std::runtime_error("Alsc: negative ct_cache_step");
 }
 
 static double get_ct(Metadata *metadata, double default_ct);
@@ -171,6 +176,8 @@ void Alsc::Initialise()
 {
 	frame_count2_ = frame_count_ = frame_phase_ = 0;
 	first_time_ = true;
+	solve_time_ = async_solve_time_ = {};
+	generation_ = 0;
 	ct_ = config_.default_ct;
 	// The lambdas are initialised in the SwitchMode.
 }
@@ -179,11 +186,7 @@ void Alsc::waitForAysncThread()
 {
 	if (async_started_) {
 		async_started_ = false;
-		std::unique_lock<std::mutex> lock(mutex_);
-		sync_signal_.wait(lock, [&] {
-			return async_finished_;
-		});
-		async_finished_ = false;
+		async_job_.Wait();
 	}
 }
 
@@ -227,6 +230,9 @@ void Alsc::SwitchMode(CameraMode const &camera_mode,
 	// fixed so we can simply do it up front here.
 	resample_cal_table(config_.luminance_lut, camera_mode_, luminance_table_);
 
+	// The calibration tables depend on the mode too, so rebuild the cache.
+	buildCalCache();
+
 	if (reset_tables) {
 		// Upon every "table reset", arrange for something sensible to be
 		// generated. Construct the tables for the previous recorded colour
@@ -235,11 +241,8 @@ void Alsc::SwitchMode(CameraMode const &camera_mode,
 		// doAlsc, without the adaptive algorithm.
 		for (int i = 0; i < XY; i++)
 			lambda_r_[i] = lambda_b_[i] = 1.0;
-		double cal_table_r[XY], cal_table_b[XY], cal_table_tmp[XY];
-		get_cal_table(ct_, config_.calibrations_Cr, cal_table_tmp);
-		resample_cal_table(cal_table_tmp, camera_mode_, cal_table_r);
-		get_cal_table(ct_, config_.calibrations_Cb, cal_table_tmp);
-		resample_cal_table(cal_table_tmp, camera_mode_, cal_table_b);
+		double cal_table_r[XY], cal_table_b[XY];
+		getCalTables(ct_, cal_table_r, cal_table_b);
 		compensate_lambdas_for_cal(cal_table_r, lambda_r_,
 					   async_lambda_r_);
 		compensate_lambdas_for_cal(cal_table_b, lambda_b_,
@@ -249,24 +252,83 @@ void Alsc::SwitchMode(CameraMode const &camera_mode,
 					config_.luminance_strength);
 		memcpy(prev_sync_results_, sync_results_,
 		       sizeof(prev_sync_results_));
+		generation_++;
 		frame_phase_ = config_.frame_period; // run the algo again asap
 		first_time_ = false;
 	}
 }
 
+void Alsc::buildCalCache()
+{
+	cal_cache_r_.clear();
+	cal_cache_b_.clear();
+	if (config_.ct_cache_step == 0)
+		return;
+	// Cover the colour temperatures of both sets of calibrations, the
+	// tables are clamped to the extreme ones outside their own range.
+	double ct_min = 0, ct_max = 0;
+	bool found = false;
+	for (auto const *calibrations :
+	     { &config_.calibrations_Cr, &config_.calibrations_Cb }) {
+		if (calibrations->empty())
+			continue;
+		ct_min = found ? std::min(ct_min, calibrations->front().ct)
+			       : calibrations->front().ct;
+		ct_max = found ? std::max(ct_max, calibrations->back().ct)
+			       : calibrations->back().ct;
+		found = true;
+	}
+	cal_cache_ct_min_ = ct_min;
+	cal_cache_ct_step_ = std::max(config_.ct_cache_step,
+				      (ct_max - ct_min) / (MAX_CAL_CACHE_SIZE - 1));
+	int size = ceil((ct_max - ct_min) / cal_cache_ct_step_) + 1;
+	cal_cache_r_.resize(size);
+	cal_cache_b_.resize(size);
+	double cal_table_tmp[XY];
+	for (int i = 0; i < size; i++) {
+		double ct = ct_min + i * cal_cache_ct_step_;
+		get_cal_table(ct, config_.calibrations_Cr, cal_table_tmp);
+		resample_cal_table(cal_table_tmp, camera_mode_,
+				   cal_cache_r_[i].data());
+		get_cal_table(ct, config_.calibrations_Cb, cal_table_tmp);
+		resample_cal_table(cal_table_tmp, camera_mode_,
+				   cal_cache_b_[i].data());
+	}
+	LOG(RPiAlsc, Debug)
+		<< "Cached " << size << " calibration tables every "
+		<< cal_cache_ct_step_ << "K";
+}
+
+void Alsc::getCalTables(double ct, double *cal_table_r,
+			double *cal_table_b) const
+{
+	if (cal_cache_r_.empty()) {
+		double cal_table_tmp[XY];
+		get_cal_table(ct, config_.calibrations_Cr, cal_table_tmp);
+		resample_cal_table(cal_table_tmp, camera_mode_, cal_table_r);
+		get_cal_table(ct, config_.calibrations_Cb, cal_table_tmp);
+		resample_cal_table(cal_table_tmp, camera_mode_, cal_table_b);
+		return;
+	}
+	int idx = lround((ct - cal_cache_ct_min_) / cal_cache_ct_step_);
+	idx = std::clamp(idx, 0, (int)cal_cache_r_.size() - 1);
+	memcpy(cal_table_r, cal_cache_r_[idx].data(), XY * sizeof(double));
+	memcpy(cal_table_b, cal_cache_b_[idx].data(), XY * sizeof(double));
+}
+
 void Alsc::fetchAsyncResults()
 {
 	LOG(RPiAlsc, Debug) << "Fetch ALSC results";
-	async_finished_ = false;
 	async_started_ = false;
 	memcpy(sync_results_, async_results_, sizeof(sync_results_));
+	solve_time_ = async_solve_time_;
 }
 
 double get_ct(Metadata *metadata, double default_ct)
 {
 	AwbStatus awb_status;
 	awb_status.temperature_K = default_ct; // in case nothing found
-	if (metadata->Get("awb.status", awb_status) != 0)
+	if (metadata->Get(awb_status) != 0)
 		LOG(RPiAlsc, Debug) << "no AWB results found, using "
 				    << awb_status.temperature_K;
 	else
@@ -300,7 +362,7 @@ void Alsc::restartAsync(StatisticsPtr &stats, Metadata *image_metadata)
 	// We have to copy the statistics here, dividing out our best guess of
 	// the LSC table that the pipeline applied to them.
 	AlscStatus alsc_status;
-	if (image_metadata->Get("alsc.status", alsc_status) != 0) {
+	if (image_metadata->Get(alsc_status) != 0) {
 		LOG(RPiAlsc, Warning)
 			<< "No ALSC status found for applied gains!";
 		for (int y = 0; y < Y; y++)
@@ -311,13 +373,15 @@ void Alsc::restartAsync(StatisticsPtr &stats, Metadata *image_metadata)
 			}
 	}
 	copy_stats(statistics_, stats, alsc_status);
+	// The results are wanted by the time the next calculation is due.
+	DeviceStatus device_status;
+	utils::Duration frame_duration{};
+	if (image_metadata->Get(device_status) == 0)
+		frame_duration = device_status.frame_length *
+				 camera_mode_.line_length;
 	frame_phase_ = 0;
 	async_started_ = true;
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		async_start_ = true;
-	}
-	async_signal_.notify_one();
+	async_job_.Start(config_.frame_period * frame_duration);
 }
 
 void Alsc::Prepare(Metadata *image_metadata)
@@ -331,23 +395,30 @@ void Alsc::Prepare(Metadata *image_metadata)
 			       : config_.speed;
 	LOG(RPiAlsc, Debug)
 		<< "frame_count " << frame_count_ << " speed " << speed;
-	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		if (async_started_ && async_finished_)
-			fetchAsyncResults();
-	}
-	// Apply IIR filter to results and program into the pipeline.
+	if (async_started_ && async_job_.Finished())
+		fetchAsyncResults();
+	// Apply IIR filter to results and program into the pipeline. Once the
+	// filter has settled the tables stop changing, and the generation lets
+	// the pipeline know it needn't reprogram them.
 	double *ptr = (double *)sync_results_,
 	       *pptr = (double *)prev_sync_results_;
+	bool changed = false;
 	for (unsigned int i = 0;
-	     i < sizeof(sync_results_) / sizeof(double); i++)
-		pptr[i] = speed * ptr[i] + (1.0 - speed) * pptr[i];
+	     i < sizeof(sync_results_) / sizeof(double); i++) {
+		double value = speed * ptr[i] + (1.0 - speed) * pptr[i];
+		changed |= value != pptr[i];
+		pptr[i] = value;
+	}
+	if (changed)
+		generation_++;
 	// Put output values into status metadata.
 	AlscStatus status;
 	memcpy(status.r, prev_sync_results_[0], sizeof(status.r));
 	memcpy(status.g, prev_sync_results_[1], sizeof(status.g));
 	memcpy(status.b, prev_sync_results_[2], sizeof(status.b));
-	image_metadata->Set("alsc.status", status);
+	status.solve_time = solve_time_;
+	status.generation = generation_;
+	image_metadata->Set(status);
 }
 
 void Alsc::Process(StatisticsPtr &stats, Metadata *image_metadata)
@@ -366,27 +437,6 @@ void Alsc::Process(StatisticsPtr &stats, Metadata *image_metadata)
 	}
 }
 
-void Alsc::asyncFunc()
-{
-	while (true) {
-		{
-			std::unique_lock<std::mutex> lock(mutex_);
-			async_signal_.wait(lock, [&] {
-				return async_start_ || async_abort_;
-			});
-			async_start_ = false;
-			if (async_abort_)
-				break;
-		}
-		doAlsc();
-		{
-			std::lock_guard<std::mutex> lock(mutex_);
-			async_finished_ = true;
-		}
-		sync_signal_.notify_one();
-	}
-}
-
 void get_cal_table(double ct, std::vector<AlscCalibration> const &calibrations,
 		   double cal_table[XY])
 {
@@ -472,8 +522,8 @@ void resample_cal_table(double const cal_table_in[XY],
 
 // Calculate chrominance statistics (R/G and B/G) for each region.
 static_assert(XY == AWB_REGIONS, "ALSC/AWB statistics region mismatch");
-static void calculate_Cr_Cb(bcm2835_isp_stats_region *awb_region, double Cr[XY],
-			    double Cb[XY], uint32_t min_count, uint16_t min_G)
+static void calculate_Cr_Cb(bcm2835_isp_stats_region *awb_region, float Cr[XY],
+			    float Cb[XY], uint32_t min_count, uint16_t min_G)
 {
 	for (int i = 0; i < XY; i++) {
 		bcm2835_isp_stats_region &zone = awb_region[i];
@@ -487,7 +537,7 @@ static void calculate_Cr_Cb(bcm2835_isp_stats_region *awb_region, double Cr[XY],
 	}
 }
 
-static void apply_cal_table(double const cal_table[XY], double C[XY])
+static void apply_cal_table(double const cal_table[XY], float C[XY])
 {
 	for (int i = 0; i < XY; i++)
 		if (C[i] != INSUFFICIENT_DATA)
@@ -523,122 +573,102 @@ void compensate_lambdas_for_cal(double const cal_table[XY],
 
 // Compute weight out of 1.0 which reflects how similar we wish to make the
 // colours of these two regions.
-static double compute_weight(double C_i, double C_j, double sigma)
+static float compute_weight(float C_i, float C_j, float sigma)
 {
 	if (C_i == INSUFFICIENT_DATA || C_j == INSUFFICIENT_DATA)
 		return 0;
-	double diff = (C_i - C_j) / sigma;
-	return exp(-diff * diff / 2);
+	float diff = (C_i - C_j) / sigma;
+	return expf(-diff * diff / 2);
 }
 
 // Compute all weights.
-static void compute_W(double const C[XY], double sigma, double W[XY][4])
+static void compute_W(float const C[XY], float sigma, float W[4][XY])
 {
 	for (int i = 0; i < XY; i++) {
 		// Start with neighbour above and go clockwise.
-		W[i][0] = i >= X ? compute_weight(C[i], C[i - X], sigma) : 0;
-		W[i][1] = i % X < X - 1 ? compute_weight(C[i], C[i + 1], sigma)
+		W[0][i] = i >= X ? compute_weight(C[i], C[i - X], sigma) : 0;
+		W[1][i] = i % X < X - 1 ? compute_weight(C[i], C[i + 1], sigma)
 					: 0;
-		W[i][2] =
+		W[2][i] =
 			i < XY - X ? compute_weight(C[i], C[i + X], sigma) : 0;
-		W[i][3] = i % X ? compute_weight(C[i], C[i - 1], sigma) : 0;
+		W[3][i] = i % X ? compute_weight(C[i], C[i - 1], sigma) : 0;
 	}
 }
 
 // Compute M, the large but sparse matrix such that M * lambdas = 0.
-static void construct_M(double const C[XY], double const W[XY][4],
-			double M[XY][4])
+static void construct_M(float const C[XY], float const W[4][XY],
+			float M[4][XY])
 {
-	double epsilon = 0.001;
+	float epsilon = 0.001;
 	for (int i = 0; i < XY; i++) {
 		// Note how, if C[i] == INSUFFICIENT_DATA, the weights will all
 		// be zero so the equation is still set up correctly.
 		int m = !!(i >= X) + !!(i % X < X - 1) + !!(i < XY - X) +
 			!!(i % X); // total number of neighbours
 		// we'll divide the diagonal out straight away
-		double diagonal =
-			(epsilon + W[i][0] + W[i][1] + W[i][2] + W[i][3]) *
+		float diagonal =
+			(epsilon + W[0][i] + W[1][i] + W[2][i] + W[3][i]) *
 			C[i];
-		M[i][0] = i >= X ? (W[i][0] * C[i - X] + epsilon / m * C[i]) /
+		M[0][i] = i >= X ? (W[0][i] * C[i - X] + epsilon / m * C[i]) /
 					   diagonal
 				 : 0;
-		M[i][1] = i % X < X - 1
-				  ? (W[i][1] * C[i + 1] + epsilon / m * C[i]) /
+		M[1][i] = i % X < X - 1
+				  ? (W[1][i] * C[i + 1] + epsilon / m * C[i]) /
 					    diagonal
 				  : 0;
-		M[i][2] = i < XY - X
-				  ? (W[i][2] * C[i + X] + epsilon / m * C[i]) /
+		M[2][i] = i < XY - X
+				  ? (W[2][i] * C[i + X] + epsilon / m * C[i]) /
 					    diagonal
 				  : 0;
-		M[i][3] = i % X ? (W[i][3] * C[i - 1] + epsilon / m * C[i]) /
+		M[3][i] = i % X ? (W[3][i] * C[i - 1] + epsilon / m * C[i]) /
 					  diagonal
 				: 0;
 	}
 }
 
-// In the compute_lambda_ functions, note that the matrix coefficients for the
-// left/right neighbours are zero down the left/right edges, so we don't need
-// need to test the i value to exclude them.
-static double compute_lambda_bottom(int i, double const M[XY][4],
-				    double lambda[XY])
-{
-	return M[i][1] * lambda[i + 1] + M[i][2] * lambda[i + X] +
-	       M[i][3] * lambda[i - 1];
-}
-static double compute_lambda_bottom_start(int i, double const M[XY][4],
-					  double lambda[XY])
-{
-	return M[i][1] * lambda[i + 1] + M[i][2] * lambda[i + X];
-}
-static double compute_lambda_interior(int i, double const M[XY][4],
-				      double lambda[XY])
-{
-	return M[i][0] * lambda[i - X] + M[i][1] * lambda[i + 1] +
-	       M[i][2] * lambda[i + X] + M[i][3] * lambda[i - 1];
-}
-static double compute_lambda_top(int i, double const M[XY][4],
-				 double lambda[XY])
-{
-	return M[i][0] * lambda[i - X] + M[i][1] * lambda[i + 1] +
-	       M[i][3] * lambda[i - 1];
-}
-static double compute_lambda_top_end(int i, double const M[XY][4],
-				     double lambda[XY])
-{
-	return M[i][0] * lambda[i - X] + M[i][3] * lambda[i - 1];
-}
-
-// Gauss-Seidel iteration with over-relaxation.
-static double gauss_seidel2_SOR(double const M[XY][4], double omega,
-				double lambda[XY])
-{
-	double old_lambda[XY];
-	int i;
-	for (i = 0; i < XY; i++)
-		old_lambda[i] = lambda[i];
-	lambda[0] = compute_lambda_bottom_start(0, M, lambda);
-	for (i = 1; i < X; i++)
-		lambda[i] = compute_lambda_bottom(i, M, lambda);
-	for (; i < XY - X; i++)
-		lambda[i] = compute_lambda_interior(i, M, lambda);
-	for (; i < XY - 1; i++)
-		lambda[i] = compute_lambda_top(i, M, lambda);
-	lambda[i] = compute_lambda_top_end(i, M, lambda);
-	// Also solve the system from bottom to top, to help spread the updates
+// Gauss-Seidel iteration with over-relaxation. The lambda array must be padded
+// with a row of zeros before and after it. The matrix coefficients are zero
+// for the missing neighbours of the edge cells, so the padding (or the
+// wrapping to the adjacent row) contributes nothing there.
+//
+// Each row is swept in two steps. The contributions of the rows above and
+// below, and of the neighbour within the row that hasn't been updated yet,
+// are independent of each other and are computed first in a loop that can be
+// vectorised. Only the dependency on the neighbour just updated remains for
+// the second, sequential loop.
+static float gauss_seidel2_SOR(float const M[4][XY], float omega,
+			       float *lambda)
+{
+	float old_lambda[XY];
+	float t[X];
+	memcpy(old_lambda, lambda, sizeof(old_lambda));
+	// Sweep from bottom to top, left to right.
+	for (int y = 0; y < Y; y++) {
+		float *l = lambda + y * X;
+		float const *m0 = M[0] + y * X, *m1 = M[1] + y * X,
+			    *m2 = M[2] + y * X, *m3 = M[3] + y * X;
+		for (int x = 0; x < X; x++)
+			t[x] = m0[x] * l[x - X] + m1[x] * l[x + 1] +
+			       m2[x] * l[x + X];
+		for (int x = 0; x < X; x++)
+			l[x] = t[x] + m3[x] * l[x - 1];
+	}
+	// Also solve the system from top to bottom, to help spread the updates
 	// better.
-	lambda[i] = compute_lambda_top_end(i, M, lambda);
-	for (i = XY - 2; i >= XY - X; i--)
-		lambda[i] = compute_lambda_top(i, M, lambda);
-	for (; i >= X; i--)
-		lambda[i] = compute_lambda_interior(i, M, lambda);
-	for (; i >= 1; i--)
-		lambda[i] = compute_lambda_bottom(i, M, lambda);
-	lambda[0] = compute_lambda_bottom_start(0, M, lambda);
-	double max_diff = 0;
-	for (i = 0; i < XY; i++) {
+	for (int y = Y - 1; y >= 0; y--) {
+		float *l = lambda + y * X;
+		float const *m0 = M[0] + y * X, *m1 = M[1] + y * X,
+			    *m2 = M[2] + y * X, *m3 = M[3] + y * X;
+		for (int x = 0; x < X; x++)
+			t[x] = m0[x] * l[x - X] + m2[x] * l[x + X] +
+			       m3[x] * l[x - 1];
+		for (int x = X - 1; x >= 0; x--)
+			l[x] = t[x] + m1[x] * l[x + 1];
+	}
+	float max_diff = 0;
+	for (int i = 0; i < XY; i++) {
 		lambda[i] = old_lambda[i] + (lambda[i] - old_lambda[i]) * omega;
-		if (fabs(lambda[i] - old_lambda[i]) > fabs(max_diff))
-			max_diff = lambda[i] - old_lambda[i];
+		max_diff = std::max(max_diff, fabsf(lambda[i] - old_lambda[i]));
 	}
 	return max_diff;
 }
@@ -653,15 +683,21 @@ static void normalise(double *ptr, size_t n)
 		ptr[i] /= minval;
 }
 
-static void run_matrix_iterations(double const C[XY], double lambda[XY],
-				  double const W[XY][4], double omega,
+// Solve for the lambdas, starting from their current values. These are the
+// previous run's solution, so only a few iterations are normally needed before
+// the updates fall below the threshold and the iterations stop.
+static void run_matrix_iterations(float const C[XY], double lambda[XY],
+				  AlscWorkspace &workspace, double omega,
 				  int n_iter, double threshold)
 {
-	double M[XY][4];
-	construct_M(C, W, M);
-	double last_max_diff = std::numeric_limits<double>::max();
+	construct_M(C, workspace.W, workspace.M);
+	float *work_lambda = workspace.lambda + X;
+	std::fill(workspace.lambda, work_lambda, 0.0f);
+	std::fill(work_lambda + XY, work_lambda + XY + X, 0.0f);
+	std::copy(lambda, lambda + XY, work_lambda);
+	float last_max_diff = std::numeric_limits<float>::max();
 	for (int i = 0; i < n_iter; i++) {
-		double max_diff = fabs(gauss_seidel2_SOR(M, omega, lambda));
+		float max_diff = gauss_seidel2_SOR(workspace.M, omega, work_lambda);
 		if (max_diff < threshold) {
 			LOG(RPiAlsc, Debug)
 				<< "Stop after " << i + 1 << " iterations";
@@ -675,6 +711,7 @@ static void run_matrix_iterations(double const C[XY], double lambda[XY],
 				<< last_max_diff << " to " << max_diff;
 		last_max_diff = max_diff;
 	}
+	std::copy(work_lambda, work_lambda + XY, lambda);
 	// We're going to normalise the lambdas so the smallest is 1. Not sure
 	// this is really necessary as they get renormalised later, but I
 	// suppose it does stop these quantities from wandering off...
@@ -715,31 +752,31 @@ void add_luminance_to_tables(double results[3][Y][X], double const lambda_r[XY],
 
 void Alsc::doAlsc()
 {
-	double Cr[XY], Cb[XY], Wr[XY][4], Wb[XY][4], cal_table_r[XY],
-		cal_table_b[XY], cal_table_tmp[XY];
+	auto start = std::chrono::steady_clock::now();
+	AlscWorkspace &ws = workspace_;
+	double cal_table_r[XY], cal_table_b[XY];
 	// Calculate our R/B ("Cr"/"Cb") colour statistics, and assess which are
 	// usable.
-	calculate_Cr_Cb(statistics_, Cr, Cb, config_.min_count, config_.min_G);
-	// Fetch the new calibrations (if any) for this CT. Resample them in
-	// case the camera mode is not full-frame.
-	get_cal_table(ct_, config_.calibrations_Cr, cal_table_tmp);
-	resample_cal_table(cal_table_tmp, camera_mode_, cal_table_r);
-	get_cal_table(ct_, config_.calibrations_Cb, cal_table_tmp);
-	resample_cal_table(cal_table_tmp, camera_mode_, cal_table_b);
+	calculate_Cr_Cb(statistics_, ws.Cr, ws.Cb, config_.min_count,
+			config_.min_G);
+	// Fetch the new calibrations (if any) for this CT, resampled in case
+	// the camera mode is not full-frame. They come from the cache built
+	// for the mode, unless it has been disabled.
+	getCalTables(ct_, cal_table_r, cal_table_b);
 	// You could print out the cal tables for this image here, if you're
 	// tuning the algorithm...
 	// Apply any calibration to the statistics, so the adaptive algorithm
 	// makes only the extra adjustments.
-	apply_cal_table(cal_table_r, Cr);
-	apply_cal_table(cal_table_b, Cb);
-	// Compute weights between zones.
-	compute_W(Cr, config_.sigma_Cr, Wr);
-	compute_W(Cb, config_.sigma_Cb, Wb);
-	// Run Gauss-Seidel iterations over the resulting matrix, for R and B.
-	run_matrix_iterations(Cr, lambda_r_, Wr, config_.omega, config_.n_iter,
-			      config_.threshold);
-	run_matrix_iterations(Cb, lambda_b_, Wb, config_.omega, config_.n_iter,
-			      config_.threshold);
+	apply_cal_table(cal_table_r, ws.Cr);
+	apply_cal_table(cal_table_b, ws.Cb);
+	// Compute weights between zones and run Gauss-Seidel iterations over
+	// the resulting matrix, for R and B.
+	compute_W(ws.Cr, config_.sigma_Cr, ws.W);
+	run_matrix_iterations(ws.Cr, lambda_r_, ws, config_.omega,
+			      config_.n_iter, config_.threshold);
+	compute_W(ws.Cb, config_.sigma_Cb, ws.W);
+	run_matrix_iterations(ws.Cb, lambda_b_, ws, config_.omega,
+			      config_.n_iter, config_.threshold);
 	// Fold the calibrated gains into our final lambda values. (Note that on
 	// the next run, we re-start with the lambda values that don't have the
 	// calibration gains included.)
@@ -749,6 +786,10 @@ void Alsc::doAlsc()
 	add_luminance_to_tables(async_results_, async_lambda_r_, 1.0,
 				async_lambda_b_, luminance_table_,
 				config_.luminance_strength);
+	async_solve_time_ = std::chrono::steady_clock::now() - start;
+	LOG(RPiAlsc, Debug)
+		<< "ALSC calculation took "
+		<< async_solve_time_.get<std::micro>() << "us";
 }
 
 // Register algorithm with the system.
@@ -6,12 +6,12 @@
  */
 #pragma once
 
-#include <mutex>
-#include <condition_variable>
-#include <thread>
+#include <array>
+#include <vector>
 
 #include "../algorithm.hpp"
 #include "../alsc_status.h"
+#include "../executor.hpp"
 
 namespace RPiController {
 
@@ -41,6 +41,21 @@ struct AlscConfig {
 	std::vector<AlscCalibration> calibrations_Cb;
 	double default_ct; // colour temperature if no metadata found
 	double threshold; // iteration termination threshold
+	// colour temperature step of the calibration table cache, 0 to disable
+	double ct_cache_step;
+};
+
+// Scratch storage for the adaptive algorithm, reused on every run. Values are
+// held in single precision with one array per neighbour (above, right, below,
+// left) so that the loops over the cells can be vectorised. The lambdas are
+// padded with a row of zeros at each end so that the edge cells need no
+// special handling.
+struct AlscWorkspace {
+	alignas(16) float Cr[ALSC_CELLS_X * ALSC_CELLS_Y];
+	alignas(16) float Cb[ALSC_CELLS_X * ALSC_CELLS_Y];
+	alignas(16) float W[4][ALSC_CELLS_X * ALSC_CELLS_Y];
+	alignas(16) float M[4][ALSC_CELLS_X * ALSC_CELLS_Y];
+	alignas(16) float lambda[ALSC_CELLS_X * (ALSC_CELLS_Y + 2)];
 };
 
 class Alsc : public Algorithm
@@ -61,19 +76,8 @@ private:
 	bool first_time_;
 	CameraMode camera_mode_;
 	double luminance_table_[ALSC_CELLS_X * ALSC_CELLS_Y];
-	std::thread async_thread_;
-	void asyncFunc(); // asynchronous thread function
-	std::mutex mutex_;
-	// condvar for async thread to wait on
-	std::condition_variable async_signal_;
-	// condvar for synchronous thread to wait on
-	std::condition_variable sync_signal_;
-	// for sync thread to check  if async thread finished (requires mutex)
-	bool async_finished_;
-	// for async thread to check if it's been told to run (requires mutex)
-	bool async_start_;
-	// for async thread to check if it's been told to quit (requires mutex)
-	bool async_abort_;
+	// the asynchronous calculation, run by the shared executor
+	Executor::Job async_job_;
 
 	// The following are only for the synchronous thread to use:
 	// for sync thread to note its has asked async thread to run
@@ -86,6 +90,9 @@ private:
 	int frame_count2_;
 	double sync_results_[3][ALSC_CELLS_Y][ALSC_CELLS_X];
 	double prev_sync_results_[3][ALSC_CELLS_Y][ALSC_CELLS_X];
+	libcamera::utils::Duration solve_time_;
+	// bumped whenever the filtered tables we output change
+	unsigned int generation_;
 	void waitForAysncThread();
 	// The following are for the asynchronous thread to use, though the main
 	// thread can set/reset them if the async thread is known to be idle:
@@ -97,9 +104,22 @@ private:
 	double async_results_[3][ALSC_CELLS_Y][ALSC_CELLS_X];
 	double async_lambda_r_[ALSC_CELLS_X * ALSC_CELLS_Y];
 	double async_lambda_b_[ALSC_CELLS_X * ALSC_CELLS_Y];
+	libcamera::utils::Duration async_solve_time_;
+	AlscWorkspace workspace_;
 	void doAlsc();
 	double lambda_r_[ALSC_CELLS_X * ALSC_CELLS_Y];
 	double lambda_b_[ALSC_CELLS_X * ALSC_CELLS_Y];
+	// Calibration tables interpolated and resampled for the camera mode at
+	// colour temperatures quantised to ct_cache_step. They are rebuilt by
+	// SwitchMode while the async thread is idle, and only read otherwise.
+	void buildCalCache();
+	void getCalTables(double ct, double *cal_table_r,
+			  double *cal_table_b) const;
+	typedef std::array<double, ALSC_CELLS_X * ALSC_CELLS_Y> CalTable;
+	double cal_cache_ct_min_;
+	double cal_cache_ct_step_;
+	std::vector<CalTable> cal_cache_r_;
+	std::vector<CalTable> cal_cache_b_;
 };
 
 } // namespace RPiController
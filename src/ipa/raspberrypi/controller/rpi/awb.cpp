@@ -7,6 +7,7 @@
 
 #include <libcamera/base/log.h>
 
+#include "../device_status.h"
 #include "../lux_status.h"
 
 #include "awb.hpp"
@@ -114,29 +115,27 @@ void AwbConfig::Read(boost::property_tree::ptree const &params)
 		"fast", bayes); // default to fast for Bayesian, otherwise slow
 	whitepoint_r = params.get<double>("whitepoint_r", 0.0);
 	whitepoint_b = params.get<double>("whitepoint_b", 0.0);
+	search_window = params.get<unsigned int>("search_window", 3);
+	scene_change_lux = params.get<double>("scene_change_lux", 0.2);
+	scene_change_rb = params.get<double>("scene_change_rb", 0.02);
 	if (bayes == false)
 		sensitivity_r = sensitivity_b =
 			1.0; // nor do sensitivities make any sense
 }
 
 Awb::Awb(Controller *controller)
-	: AwbAlgorithm(controller)
+	: AwbAlgorithm(controller), async_job_(std::bind(&Awb::doAwb, this))
 {
-	async_abort_ = async_start_ = async_started_ = async_finished_ = false;
+	async_started_ = false;
 	mode_ = nullptr;
 	manual_r_ = manual_b_ = 0.0;
 	first_switch_mode_ = true;
-	async_thread_ = std::thread(std::bind(&Awb::asyncFunc, this));
 }
 
 Awb::~Awb()
 {
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		async_abort_ = true;
-	}
-	async_signal_.notify_one();
-	async_thread_.join();
+	// Members the job uses are destroyed before the job itself.
+	async_job_.Cancel();
 }
 
 char const *Awb::Name() const
@@ -170,6 +169,9 @@ void Awb::Initialise()
 	}
 	prev_sync_results_ = sync_results_;
 	async_results_ = sync_results_;
+	// Start with full searches.
+	prior_zones_ = 0;
+	prev_valid_ = false;
 }
 
 unsigned int Awb::GetConvergenceFrames() const
@@ -201,9 +203,24 @@ void Awb::SetManualGains(double manual_r, double manual_b)
 	}
 }
 
-void Awb::SwitchMode([[maybe_unused]] CameraMode const &camera_mode,
-		     Metadata *metadata)
+void Awb::SetInitialGains(double gain_r, double gain_b, double temperature_K)
 {
+	// Start filtering from the gains of a previous session, instead of the
+	// defaults. This is only meaningful before the first frame in auto mode.
+	if (!isAutoEnabled())
+		return;
+	if (temperature_K)
+		sync_results_.temperature_K = temperature_K;
+	sync_results_.gain_r = gain_r;
+	sync_results_.gain_g = 1.0;
+	sync_results_.gain_b = gain_b;
+	prev_sync_results_ = sync_results_;
+	async_results_ = sync_results_;
+}
+
+void Awb::SwitchMode(CameraMode const &camera_mode, Metadata *metadata)
+{
+	line_length_ = camera_mode.line_length;
 	// On the first mode switch we'll have no meaningful colour
 	// temperature, so try to dead reckon one if in manual mode.
 	if (!isAutoEnabled() && first_switch_mode_ && config_.bayes) {
@@ -215,7 +232,7 @@ void Awb::SwitchMode([[maybe_unused]] CameraMode const &camera_mode,
 		sync_results_.temperature_K = prev_sync_results_.temperature_K;
 	}
 	// Let other algorithms know the current white balance values.
-	metadata->Set("awb.status", prev_sync_results_);
+	metadata->Set(prev_sync_results_);
 	first_switch_mode_ = false;
 }
 
@@ -227,7 +244,6 @@ bool Awb::isAutoEnabled() const
 void Awb::fetchAsyncResults()
 {
 	LOG(RPiAwb, Debug) << "Fetch AWB results";
-	async_finished_ = false;
 	async_started_ = false;
 	// It's possible manual gains could be set even while the async
 	// thread was running, so only copy the results if still in auto mode.
@@ -235,7 +251,8 @@ void Awb::fetchAsyncResults()
 		sync_results_ = async_results_;
 }
 
-void Awb::restartAsync(StatisticsPtr &stats, double lux)
+void Awb::restartAsync(StatisticsPtr &stats, double lux,
+		       utils::Duration frame_duration)
 {
 	LOG(RPiAwb, Debug) << "Starting AWB calculation";
 	// this makes a new reference which belongs to the asynchronous thread
@@ -251,11 +268,8 @@ void Awb::restartAsync(StatisticsPtr &stats, double lux)
 	size_t len = mode_name_.copy(async_results_.mode,
 				     sizeof(async_results_.mode) - 1);
 	async_results_.mode[len] = '\0';
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		async_start_ = true;
-	}
-	async_signal_.notify_one();
+	// The results are wanted by the time the next calculation is due.
+	async_job_.Start(config_.frame_period * frame_duration);
 }
 
 void Awb::Prepare(Metadata *image_metadata)
@@ -267,11 +281,8 @@ void Awb::Prepare(Metadata *image_metadata)
 			       : config_.speed;
 	LOG(RPiAwb, Debug)
 		<< "frame_count " << frame_count_ << " speed " << speed;
-	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		if (async_started_ && async_finished_)
-			fetchAsyncResults();
-	}
+	if (async_started_ && async_job_.Finished())
+		fetchAsyncResults();
 	// Finally apply IIR filter to results and put into metadata.
 	memcpy(prev_sync_results_.mode, sync_results_.mode,
 	       sizeof(prev_sync_results_.mode));
@@ -284,7 +295,7 @@ void Awb::Prepare(Metadata *image_metadata)
 				    (1.0 - speed) * prev_sync_results_.gain_g;
 	prev_sync_results_.gain_b = speed * sync_results_.gain_b +
 				    (1.0 - speed) * prev_sync_results_.gain_b;
-	image_metadata->Set("awb.status", prev_sync_results_);
+	image_metadata->Set(prev_sync_results_);
 	LOG(RPiAwb, Debug)
 		<< "Using AWB gains r " << prev_sync_results_.gain_r << " g "
 		<< prev_sync_results_.gain_g << " b "
@@ -304,33 +315,16 @@ void Awb::Process(StatisticsPtr &stats, Metadata *image_metadata)
 		// Update any settings and any image metadata that we need.
 		struct LuxStatus lux_status = {};
 		lux_status.lux = 400; // in case no metadata
-		if (image_metadata->Get("lux.status", lux_status) != 0)
+		if (image_metadata->Get(lux_status) != 0)
 			LOG(RPiAwb, Debug) << "No lux metadata found";
 		LOG(RPiAwb, Debug) << "Awb lux value is " << lux_status.lux;
+		DeviceStatus device_status;
+		utils::Duration frame_duration{};
+		if (image_metadata->Get(device_status) == 0)
+			frame_duration = device_status.frame_length * line_length_;
 
 		if (async_started_ == false)
-			restartAsync(stats, lux_status.lux);
-	}
-}
-
-void Awb::asyncFunc()
-{
-	while (true) {
-		{
-			std::unique_lock<std::mutex> lock(mutex_);
-			async_signal_.wait(lock, [&] {
-				return async_start_ || async_abort_;
-			});
-			async_start_ = false;
-			if (async_abort_)
-				break;
-		}
-		doAwb();
-		{
-			std::lock_guard<std::mutex> lock(mutex_);
-			async_finished_ = true;
-		}
-		sync_signal_.notify_one();
+			restartAsync(stats, lux_status.lux, frame_duration);
 	}
 }
 
@@ -372,15 +366,19 @@ void Awb::prepareStats()
 double Awb::computeDelta2Sum(double gain_r, double gain_b)
 {
 	// Compute the sum of the squared colour error (non-greyness) as it
-	// appears in the log likelihood equation.
+	// appears in the log likelihood equation. This is evaluated hundreds of
+	// times per search, so it loops over plain arrays of the normalised
+	// zone values.
+	double const offset_r = 1 + config_.whitepoint_r;
+	double const offset_b = 1 + config_.whitepoint_b;
+	double const *zone_r = zone_r_.data(), *zone_b = zone_b_.data();
+	size_t num_zones = zone_r_.size();
 	double delta2_sum = 0;
-	for (auto &z : zones_) {
-		double delta_r = gain_r * z.R - 1 - config_.whitepoint_r;
-		double delta_b = gain_b * z.B - 1 - config_.whitepoint_b;
+	for (size_t i = 0; i < num_zones; i++) {
+		double delta_r = gain_r * zone_r[i] - offset_r;
+		double delta_b = gain_b * zone_b[i] - offset_b;
 		double delta2 = delta_r * delta_r + delta_b * delta_b;
-		//LOG(RPiAwb, Debug) << "delta_r " << delta_r << " delta_b " << delta_b << " delta2 " << delta2;
-		delta2 = std::min(delta2, config_.delta_limit);
-		delta2_sum += delta2;
+		delta2_sum += std::min(delta2, config_.delta_limit);
 	}
 	return delta2_sum;
 }
@@ -426,11 +424,24 @@ static double interpolate_quadatric(Pwl::Point const &A, Pwl::Point const &B,
 	return A.y < C.y - eps ? A.x : (C.y < A.y - eps ? C.x : B.x);
 }
 
-double Awb::coarseSearch(Pwl const &prior)
+bool Awb::isSteadyScene(double mean_r, double mean_b) const
+{
+	if (!config_.search_window || !prev_valid_ || mode_ != prev_mode_)
+		return false;
+	return fabs(lux_ - prev_lux_) <= config_.scene_change_lux * prev_lux_ &&
+	       fabs(mean_r - prev_mean_r_) <= config_.scene_change_rb &&
+	       fabs(mean_b - prev_mean_b_) <= config_.scene_change_rb;
+}
+
+// Search the CT curve between ct_lo and ct_hi. If on_edge is given, it reports
+// whether the best point was found on an end of the range that doesn't match
+// the end of the mode's range, meaning the true optimum may lie outside it.
+double Awb::coarseSearch(Pwl const &prior, double ct_lo, double ct_hi,
+			 bool *on_edge)
 {
 	points_.clear(); // assume doesn't deallocate memory
 	size_t best_point = 0;
-	double t = mode_->ct_lo;
+	double t = ct_lo;
 	int span_r = 0, span_b = 0;
 	// Step down the CT curve evaluating log likelihood.
 	while (true) {
@@ -449,14 +460,17 @@ double Awb::coarseSearch(Pwl const &prior)
 		points_.push_back(Pwl::Point(t, final_log_likelihood));
 		if (points_.back().y < points_[best_point].y)
 			best_point = points_.size() - 1;
-		if (t == mode_->ct_hi)
+		if (t == ct_hi)
 			break;
 		// for even steps along the r/b curve scale them by the current t
-		t = std::min(t + t / 10 * config_.coarse_step,
-			     mode_->ct_hi);
+		t = std::min(t + t / 10 * config_.coarse_step, ct_hi);
 	}
 	t = points_[best_point].x;
 	LOG(RPiAwb, Debug) << "Coarse search found CT " << t;
+	if (on_edge)
+		*on_edge = (best_point == 0 && ct_lo > mode_->ct_lo) ||
+			   (best_point == points_.size() - 1 &&
+			    ct_hi < mode_->ct_hi);
 	// We have the best point of the search, but refine it with a quadratic
 	// interpolation around its neighbours.
 	if (points_.size() > 2) {
@@ -472,8 +486,13 @@ double Awb::coarseSearch(Pwl const &prior)
 	return t;
 }
 
-void Awb::fineSearch(double &t, double &r, double &b, Pwl const &prior)
+// In a narrow search, only the points closest to t along the CT curve are
+// tried. The full search is done anyway if the best result is at the end of
+// the narrowed range.
+void Awb::fineSearch(double &t, double &r, double &b, Pwl const &prior,
+		     bool narrow)
 {
+	double const t_start = t;
 	int span_r = -1, span_b = -1;
 	config_.ct_r.Eval(t, &span_r);
 	config_.ct_b.Eval(t, &span_b);
@@ -498,8 +517,10 @@ void Awb::fineSearch(double &t, double &r, double &b, Pwl const &prior)
 	num_deltas = num_deltas < 3 ? 3 :
 		     (num_deltas > MAX_NUM_DELTAS ? MAX_NUM_DELTAS : num_deltas);
 	// Step down CT curve. March a bit further if the transverse range is
-	// large.
-	nsteps += num_deltas;
+	// large, unless the previous result tells us we're already close.
+	if (!narrow)
+		nsteps += num_deltas;
+	int best_i = 0;
 	for (int i = -nsteps; i <= nsteps; i++) {
 		double t_test = t + i * step;
 		double prior_log_likelihood =
@@ -545,7 +566,14 @@ void Awb::fineSearch(double &t, double &r, double &b, Pwl const &prior)
 			<< (final_log_likelihood < best_log_likelihood ? " BEST" : "");
 		if (best_t == 0 || final_log_likelihood < best_log_likelihood)
 			best_log_likelihood = final_log_likelihood,
-			best_t = t_test, best_r = r_test, best_b = b_test;
+			best_t = t_test, best_r = r_test, best_b = b_test,
+			best_i = i;
+	}
+	if (narrow && (best_i == -nsteps || best_i == nsteps)) {
+		LOG(RPiAwb, Debug) << "Narrow fine search hit its limit";
+		t = t_start;
+		fineSearch(t, r, b, prior, false);
+		return;
 	}
 	t = best_t, r = best_r, b = best_b;
 	LOG(RPiAwb, Debug)
@@ -555,17 +583,47 @@ void Awb::fineSearch(double &t, double &r, double &b, Pwl const &prior)
 void Awb::awbBayes()
 {
 	// May as well divide out G to save computeDelta2Sum from doing it over
-	// and over.
-	for (auto &z : zones_)
-		z.R = z.R / (z.G + 1), z.B = z.B / (z.G + 1);
+	// and over. The averages tell us whether the scene has changed.
+	zone_r_.clear();
+	zone_b_.clear();
+	double mean_r = 0, mean_b = 0;
+	for (auto &z : zones_) {
+		zone_r_.push_back(z.R / (z.G + 1));
+		zone_b_.push_back(z.B / (z.G + 1));
+		mean_r += zone_r_.back(), mean_b += zone_b_.back();
+	}
+	mean_r /= zones_.size(), mean_b /= zones_.size();
 	// Get the current prior, and scale according to how many zones are
 	// valid... not entirely sure about this.
-	Pwl prior = interpolatePrior();
-	prior *= zones_.size() / (double)(AWB_STATS_SIZE_X * AWB_STATS_SIZE_Y);
-	prior.Map([](double x, double y) {
-		LOG(RPiAwb, Debug) << "(" << x << "," << y << ")";
-	});
-	double t = coarseSearch(prior);
+	if (lux_ != prior_lux_ || zones_.size() != prior_zones_) {
+		prior_ = interpolatePrior();
+		prior_ *= zones_.size() / (double)(AWB_STATS_SIZE_X * AWB_STATS_SIZE_Y);
+		prior_.Map([](double x, double y) {
+			LOG(RPiAwb, Debug) << "(" << x << "," << y << ")";
+		});
+		prior_lux_ = lux_;
+		prior_zones_ = zones_.size();
+	}
+	Pwl const &prior = prior_;
+	// If the scene hasn't changed much, only search around the previous
+	// result, unless the best point is at the end of that window in which
+	// case the scene has changed after all.
+	bool steady = isSteadyScene(mean_r, mean_b);
+	double t = 0;
+	if (steady) {
+		double ratio = pow(1 + config_.coarse_step / 10,
+				   config_.search_window);
+		double prev_t = std::clamp(prev_t_, mode_->ct_lo, mode_->ct_hi);
+		bool on_edge;
+		t = coarseSearch(prior, std::max(mode_->ct_lo, prev_t / ratio),
+				 std::min(mode_->ct_hi, prev_t * ratio), &on_edge);
+		if (on_edge) {
+			LOG(RPiAwb, Debug) << "Result outside search window";
+			steady = false;
+		}
+	}
+	if (!steady)
+		t = coarseSearch(prior, mode_->ct_lo, mode_->ct_hi, nullptr);
 	double r = config_.ct_r.Eval(t);
 	double b = config_.ct_b.Eval(t);
 	LOG(RPiAwb, Debug)
@@ -577,7 +635,7 @@ void Awb::awbBayes()
 	// there may be more or less green light, this may prove beneficial,
 	// though I probably need more real datasets before deciding exactly how
 	// this should be controlled and tuned.
-	fineSearch(t, r, b, prior);
+	fineSearch(t, r, b, prior, steady);
 	LOG(RPiAwb, Debug)
 		<< "After fine search: r " << r << " b " << b << " (gains r "
 		<< 1 / r << " b " << 1 / b << ")";
@@ -588,6 +646,12 @@ void Awb::awbBayes()
 	async_results_.gain_r = 1.0 / r * config_.sensitivity_r;
 	async_results_.gain_g = 1.0;
 	async_results_.gain_b = 1.0 / b * config_.sensitivity_b;
+	prev_valid_ = true;
+	prev_mode_ = mode_;
+	prev_t_ = t;
+	prev_lux_ = lux_;
+	prev_mean_r_ = mean_r;
+	prev_mean_b_ = mean_b;
 }
 
 void Awb::awbGrey()
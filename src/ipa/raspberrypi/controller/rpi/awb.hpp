@@ -6,11 +6,10 @@
  */
 #pragma once
 
-#include <mutex>
-#include <condition_variable>
-#include <thread>
+#include <libcamera/base/utils.h>
 
 #include "../awb_algorithm.hpp"
+#include "../executor.hpp"
 #include "../pwl.hpp"
 #include "../awb_status.h"
 
@@ -73,6 +72,13 @@ struct AwbConfig {
 	double whitepoint_r;
 	double whitepoint_b;
 	bool bayes; // use Bayesian algorithm
+	// In steady scenes, the number of coarse steps either side of the
+	// previous result to search (0 to always do full searches)
+	unsigned int search_window;
+	// relative change in lux regarded as a scene change
+	double scene_change_lux;
+	// change in the average zone r or b regarded as a scene change
+	double scene_change_rb;
 };
 
 class Awb : public AwbAlgorithm
@@ -86,6 +92,8 @@ public:
 	unsigned int GetConvergenceFrames() const override;
 	void SetMode(std::string const &name) override;
 	void SetManualGains(double manual_r, double manual_b) override;
+	void SetInitialGains(double gain_r, double gain_b,
+			     double temperature_K) override;
 	void SwitchMode(CameraMode const &camera_mode, Metadata *metadata) override;
 	void Prepare(Metadata *image_metadata) override;
 	void Process(StatisticsPtr &stats, Metadata *image_metadata) override;
@@ -106,19 +114,8 @@ private:
 	bool isAutoEnabled() const;
 	// configuration is read-only, and available to both threads
 	AwbConfig config_;
-	std::thread async_thread_;
-	void asyncFunc(); // asynchronous thread function
-	std::mutex mutex_;
-	// condvar for async thread to wait on
-	std::condition_variable async_signal_;
-	// condvar for synchronous thread to wait on
-	std::condition_variable sync_signal_;
-	// for sync thread to check  if async thread finished (requires mutex)
-	bool async_finished_;
-	// for async thread to check if it's been told to run (requires mutex)
-	bool async_start_;
-	// for async thread to check if it's been told to quit (requires mutex)
-	bool async_abort_;
+	// the asynchronous calculation, run by the shared executor
+	Executor::Job async_job_;
 
 	// The following are only for the synchronous thread to use:
 	// for sync thread to note its has asked async thread to run
@@ -129,9 +126,12 @@ private:
 	AwbStatus sync_results_;
 	AwbStatus prev_sync_results_;
 	std::string mode_name_;
+	// to convert frame counts to the durations the executor works with
+	libcamera::utils::Duration line_length_;
 	// The following are for the asynchronous thread to use, though the main
 	// thread can set/reset them if the async thread is known to be idle:
-	void restartAsync(StatisticsPtr &stats, double lux);
+	void restartAsync(StatisticsPtr &stats, double lux,
+			  libcamera::utils::Duration frame_duration);
 	// copy out the results from the async thread so that it can be restarted
 	void fetchAsyncResults();
 	StatisticsPtr statistics_;
@@ -144,10 +144,28 @@ private:
 	void prepareStats();
 	double computeDelta2Sum(double gain_r, double gain_b);
 	Pwl interpolatePrior();
-	double coarseSearch(Pwl const &prior);
-	void fineSearch(double &t, double &r, double &b, Pwl const &prior);
+	bool isSteadyScene(double mean_r, double mean_b) const;
+	double coarseSearch(Pwl const &prior, double ct_lo, double ct_hi,
+			    bool *on_edge);
+	void fineSearch(double &t, double &r, double &b, Pwl const &prior,
+			bool narrow);
 	std::vector<RGB> zones_;
+	// normalised zone statistics, the inputs to computeDelta2Sum
+	std::vector<double> zone_r_;
+	std::vector<double> zone_b_;
 	std::vector<Pwl::Point> points_;
+	// the prior, cached for as long as the lux and zone count don't change
+	Pwl prior_;
+	double prior_lux_;
+	size_t prior_zones_;
+	// the previous result and the scene it was found for, used to narrow
+	// the searches when the scene doesn't change
+	bool prev_valid_;
+	AwbMode *prev_mode_;
+	double prev_t_;
+	double prev_lux_;
+	double prev_mean_r_;
+	double prev_mean_b_;
 	// manual r setting
 	double manual_r_;
 	// manual b setting
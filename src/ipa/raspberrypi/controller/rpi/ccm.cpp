@@ -5,6 +5,9 @@
  * ccm.cpp - CCM (colour correction matrix) control algorithm
  */
 
+#include <algorithm>
+#include <math.h>
+
 #include <libcamera/base/log.h>
 
 #include "../awb_status.h"
@@ -24,9 +27,17 @@ LOG_DEFINE_CATEGORY(RPiCcm)
 // necessary). Additionally the amount of colour saturation can be controlled
 // both according to the current estimated lux level and according to a
 // saturation setting that is exposed to applications.
+//
+// The CCMs are interpolated once for colour temperatures quantised to
+// ct_cache_step, and the saturation matrix is only recalculated when the
+// saturation changes, so that every frame costs a table lookup and a single
+// matrix multiply.
 
 #define NAME "rpi.ccm"
 
+// Upper bound of the number of cached CCMs, the step is enlarged as needed.
+#define MAX_CCM_CACHE_SIZE 1024
+
 Matrix::Matrix()
 {
 	memset(m, 0, sizeof(m));
@@ -51,7 +62,8 @@ void Matrix::Read(boost::property_tree::ptree const &params)
 }
 
 Ccm::Ccm(Controller *controller)
-	: CcmAlgorithm(controller), saturation_(1.0) {}
+	: CcmAlgorithm(controller), saturation_(1.0), ct_cache_min_(0),
+	  ct_cache_step_(0), last_saturation_(-1) {}
 
 char const *Ccm::Name() const
 {
@@ -74,6 +86,9 @@ void Ccm::Read(boost::property_tree::ptree const &params)
 	}
 	if (config_.ccms.empty())
 		throw std::runtime_error("Ccm: no CCMs specified");
+	config_.ct_cache_step = params.get<double>("ct_cache_step", 50.0);
+	if (config_.ct_cache_step < 0)
+		throw std::runtime_error("Ccm: negative ct_cache_step");
 }
 
 void Ccm::SetSaturation(double saturation)
@@ -81,16 +96,36 @@ void Ccm::SetSaturation(double saturation)
 	saturation_ = saturation;
 }
 
-void Ccm::Initialise() {}
+Matrix calculate_ccm(std::vector<CtCcm> const &ccms, double ct);
+
+void Ccm::Initialise()
+{
+	// The CCMs depend on the tuning only, so the cache is built once here
+	// rather than on every mode switch.
+	ccm_cache_.clear();
+	last_saturation_ = -1;
+	if (config_.ct_cache_step == 0)
+		return;
+	ct_cache_min_ = config_.ccms.front().ct;
+	double range = config_.ccms.back().ct - ct_cache_min_;
+	ct_cache_step_ = std::max(config_.ct_cache_step,
+				  range / (MAX_CCM_CACHE_SIZE - 1));
+	int size = ceil(range / ct_cache_step_) + 1;
+	ccm_cache_.reserve(size);
+	for (int i = 0; i < size; i++)
+		ccm_cache_.push_back(calculate_ccm(config_.ccms,
+						   ct_cache_min_ + i * ct_cache_step_));
+	LOG(RPiCcm, Debug)
+		<< "Cached " << size << " CCMs every " << ct_cache_step_ << "K";
+}
 
-template<typename T>
-static bool get_locked(Metadata *metadata, std::string const &tag, T &value)
+Matrix Ccm::lookupCcm(double ct) const
 {
-	T *ptr = metadata->GetLocked<T>(tag);
-	if (ptr == nullptr)
-		return false;
-	value = *ptr;
-	return true;
+	if (ccm_cache_.empty())
+		return calculate_ccm(config_.ccms, ct);
+	int idx = lround((ct - ct_cache_min_) / ct_cache_step_);
+	idx = std::clamp(idx, 0, (int)ccm_cache_.size() - 1);
+	return ccm_cache_[idx];
 }
 
 Matrix calculate_ccm(std::vector<CtCcm> const &ccms, double ct)
@@ -109,41 +144,40 @@ Matrix calculate_ccm(std::vector<CtCcm> const &ccms, double ct)
 	}
 }
 
-Matrix apply_saturation(Matrix const &ccm, double saturation)
+Matrix calculate_saturation_matrix(double saturation)
 {
 	Matrix RGB2Y(0.299, 0.587, 0.114, -0.169, -0.331, 0.500, 0.500, -0.419,
 		     -0.081);
 	Matrix Y2RGB(1.000, 0.000, 1.402, 1.000, -0.345, -0.714, 1.000, 1.771,
 		     0.000);
 	Matrix S(1, 0, 0, 0, saturation, 0, 0, 0, saturation);
-	return Y2RGB * S * RGB2Y * ccm;
+	return Y2RGB * S * RGB2Y;
 }
 
 void Ccm::Prepare(Metadata *image_metadata)
 {
-	bool awb_ok = false, lux_ok = false;
 	struct AwbStatus awb = {};
 	awb.temperature_K = 4000; // in case no metadata
 	struct LuxStatus lux = {};
 	lux.lux = 400; // in case no metadata
-	{
-		// grab mutex just once to get everything
-		std::lock_guard<Metadata> lock(*image_metadata);
-		awb_ok = get_locked(image_metadata, "awb.status", awb);
-		lux_ok = get_locked(image_metadata, "lux.status", lux);
-	}
+	bool awb_ok = image_metadata->Get(awb) == 0;
+	bool lux_ok = image_metadata->Get(lux) == 0;
 	if (!awb_ok)
 		LOG(RPiCcm, Warning) << "no colour temperature found";
 	if (!lux_ok)
 		LOG(RPiCcm, Warning) << "no lux value found";
-	Matrix ccm = calculate_ccm(config_.ccms, awb.temperature_K);
+	Matrix ccm = lookupCcm(awb.temperature_K);
 	double saturation = saturation_;
 	struct CcmStatus ccm_status;
 	ccm_status.saturation = saturation;
 	if (!config_.saturation.Empty())
 		saturation *= config_.saturation.Eval(
 			config_.saturation.Domain().Clip(lux.lux));
-	ccm = apply_saturation(ccm, saturation);
+	if (saturation != last_saturation_) {
+		saturation_matrix_ = calculate_saturation_matrix(saturation);
+		last_saturation_ = saturation;
+	}
+	ccm = saturation_matrix_ * ccm;
 	for (int j = 0; j < 3; j++)
 		for (int i = 0; i < 3; i++)
 			ccm_status.matrix[j * 3 + i] =
@@ -157,7 +191,7 @@ void Ccm::Prepare(Metadata *image_metadata)
 		<< " " << ccm_status.matrix[5] << "     "
 		<< ccm_status.matrix[6] << " " << ccm_status.matrix[7]
 		<< " " << ccm_status.matrix[8];
-	image_metadata->Set("ccm.status", ccm_status);
+	image_metadata->Set(ccm_status);
 }
 
 // Register algorithm with the system.
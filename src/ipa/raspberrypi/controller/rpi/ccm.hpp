@@ -55,6 +55,8 @@ struct CtCcm {
 struct CcmConfig {
 	std::vector<CtCcm> ccms;
 	Pwl saturation;
+	// colour temperature step of the interpolated CCM cache, 0 to disable
+	double ct_cache_step;
 };
 
 class Ccm : public CcmAlgorithm
@@ -68,8 +70,18 @@ public:
 	void Prepare(Metadata *image_metadata) override;
 
 private:
+	Matrix lookupCcm(double ct) const;
 	CcmConfig config_;
 	double saturation_;
+	// CCMs interpolated at colour temperatures quantised to ct_cache_step,
+	// so that the steady state needs only a lookup
+	double ct_cache_min_;
+	double ct_cache_step_;
+	std::vector<Matrix> ccm_cache_;
+	// saturation matrix for the last saturation value, reused while the
+	// saturation doesn't change
+	double last_saturation_;
+	Matrix saturation_matrix_;
 };
 
 } // namespace RPiController
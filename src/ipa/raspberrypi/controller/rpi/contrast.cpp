@@ -8,8 +8,9 @@
 
 #include <libcamera/base/log.h>
 
+#include "libipa/histogram.h"
+
 #include "../contrast_status.h"
-#include "../histogram.hpp"
 
 #include "contrast.hpp"
 
@@ -68,12 +69,16 @@ static void fill_in_status(ContrastStatus &status, double brightness,
 {
 	status.brightness = brightness;
 	status.contrast = contrast;
+	double x[CONTRAST_NUM_POINTS - 1], y[CONTRAST_NUM_POINTS - 1];
+	for (int i = 0; i < CONTRAST_NUM_POINTS - 1; i++)
+		x[i] = i < 16 ? i * 1024
+			      : (i < 24 ? (i - 16) * 2048 + 16384
+					: (i - 24) * 4096 + 32768);
+	// The points are in increasing order, evaluate them in one sweep.
+	gamma_curve.Eval(x, y);
 	for (int i = 0; i < CONTRAST_NUM_POINTS - 1; i++) {
-		int x = i < 16 ? i * 1024
-			       : (i < 24 ? (i - 16) * 2048 + 16384
-					 : (i - 24) * 4096 + 32768);
-		status.points[i].x = x;
-		status.points[i].y = std::min(65535.0, gamma_curve.Eval(x));
+		status.points[i].x = x[i];
+		status.points[i].y = std::min(65535.0, y[i]);
 	}
 	status.points[CONTRAST_NUM_POINTS - 1].x = 65535;
 	status.points[CONTRAST_NUM_POINTS - 1].y = 65535;
@@ -89,18 +94,20 @@ void Contrast::Initialise()
 void Contrast::Prepare(Metadata *image_metadata)
 {
 	std::unique_lock<std::mutex> lock(mutex_);
-	image_metadata->Set("contrast.status", status_);
+	image_metadata->Set(status_);
 }
 
-Pwl compute_stretch_curve(Histogram const &histogram,
+Pwl compute_stretch_curve(ipa::Histogram const &histogram,
 			  ContrastConfig const &config)
 {
 	Pwl enhance;
 	enhance.Append(0, 0);
+	const double q[3] = { config.lo_histogram, 0.5, config.hi_histogram };
+	double points[3];
+	histogram.quantiles(q, points);
 	// If the start of the histogram is rather empty, try to pull it down a
 	// bit.
-	double hist_lo = histogram.Quantile(config.lo_histogram) *
-			 (65536 / NUM_HISTOGRAM_BINS);
+	double hist_lo = points[0] * (65536 / NUM_HISTOGRAM_BINS);
 	double level_lo = config.lo_level * 65536;
 	LOG(RPiContrast, Debug)
 		<< "Move histogram point " << hist_lo << " to " << level_lo;
@@ -112,13 +119,12 @@ Pwl compute_stretch_curve(Histogram const &histogram,
 	enhance.Append(hist_lo, level_lo);
 	// Keep the mid-point (median) in the same place, though, to limit the
 	// apparent amount of global brightness shift.
-	double mid = histogram.Quantile(0.5) * (65536 / NUM_HISTOGRAM_BINS);
+	double mid = points[1] * (65536 / NUM_HISTOGRAM_BINS);
 	enhance.Append(mid, mid);
 
 	// If the top to the histogram is empty, try to pull the pixel values
 	// there up.
-	double hist_hi = histogram.Quantile(config.hi_histogram) *
-			 (65536 / NUM_HISTOGRAM_BINS);
+	double hist_hi = points[2] * (65536 / NUM_HISTOGRAM_BINS);
 	double level_hi = config.hi_level * 65536;
 	LOG(RPiContrast, Debug)
 		<< "Move histogram point " << hist_hi << " to " << level_hi;
@@ -150,7 +156,7 @@ Pwl apply_manual_contrast(Pwl const &gamma_curve, double brightness,
 void Contrast::Process(StatisticsPtr &stats,
 		       [[maybe_unused]] Metadata *image_metadata)
 {
-	Histogram histogram(stats->hist[0].g_hist, NUM_HISTOGRAM_BINS);
+	ipa::Histogram histogram(stats->hist[0].g_hist);
 	// We look at the histogram and adjust the gamma curve in the following
 	// ways: 1. Adjust the gamma curve so as to pull the start of the
 	// histogram down, and possibly push the end up.
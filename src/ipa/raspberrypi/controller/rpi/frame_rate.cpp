@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * frame_rate.cpp - scene adaptive frame rate control algorithm
+ */
+
+#include <algorithm>
+#include <math.h>
+#include <stdexcept>
+
+#include <libcamera/base/log.h>
+
+#include "../device_status.h"
+
+#include "frame_rate.hpp"
+
+using namespace RPiController;
+using namespace libcamera;
+using namespace std::literals::chrono_literals;
+
+LOG_DEFINE_CATEGORY(RPiFrameRate)
+
+#define NAME "rpi.frame_rate"
+
+FrameRate::FrameRate(Controller *controller)
+	: Algorithm(controller), line_length_(0s), zones_{},
+	  zones_valid_(false), static_count_(0), frame_duration_(0s)
+{
+}
+
+char const *FrameRate::Name() const
+{
+	return NAME;
+}
+
+void FrameRate::Read(boost::property_tree::ptree const &params)
+{
+	static_threshold_ = params.get<double>("static_threshold", 0.02);
+	static_frames_ = params.get<unsigned int>("static_frames", 30);
+	step_ = params.get<double>("step", 1.25);
+	step_frames_ = std::max(params.get<unsigned int>("step_frames", 4), 1u);
+	max_frame_duration_ = params.get<double>("max_frame_duration", 200000) * 1us;
+
+	if (step_ < 1.0)
+		throw std::runtime_error("FrameRate: step must be at least 1");
+
+	LOG(RPiFrameRate, Debug)
+		<< "Read static threshold " << static_threshold_
+		<< " static frames " << static_frames_
+		<< " max frame duration " << max_frame_duration_;
+}
+
+void FrameRate::SwitchMode(CameraMode const &camera_mode,
+			   [[maybe_unused]] Metadata *metadata)
+{
+	line_length_ = camera_mode.line_length;
+
+	// Start again from the full frame rate in the new mode.
+	zones_valid_ = false;
+	static_count_ = 0;
+	frame_duration_ = 0s;
+}
+
+void FrameRate::Process(StatisticsPtr &stats, Metadata *image_metadata)
+{
+	double change = sceneChange(stats);
+
+	if (change > static_threshold_) {
+		if (frame_duration_)
+			LOG(RPiFrameRate, Debug)
+				<< "Scene changed (" << change
+				<< "), restoring frame rate";
+		static_count_ = 0;
+		frame_duration_ = 0s;
+	} else if (++static_count_ >= static_frames_ &&
+		   (static_count_ - static_frames_) % step_frames_ == 0) {
+		// Lengthen the frames progressively, starting from the frame
+		// duration in use, so that a scene that only changes slowly
+		// still gets noticed before the frame rate gets very low.
+		utils::Duration current = frame_duration_;
+		DeviceStatus *device_status = image_metadata->Get<DeviceStatus>();
+		if (!current && device_status)
+			current = device_status->frame_length * line_length_;
+
+		if (current)
+			frame_duration_ = std::min<utils::Duration>(current * step_, max_frame_duration_);
+	}
+
+	FrameRateStatus status;
+	status.frame_duration = frame_duration_;
+	status.scene_change = change;
+	image_metadata->Set(status);
+}
+
+double FrameRate::sceneChange(StatisticsPtr &stats)
+{
+	// Compare the mean green level of each AGC region with the previous
+	// frame. The frame durations don't affect the exposure, so in a static
+	// scene these only vary with noise.
+	double diff = 0.0, total = 0.0;
+	for (unsigned int i = 0; i < AGC_REGIONS; i++) {
+		const bcm2835_isp_stats_region &region = stats->agc_stats[i];
+		double mean = region.counted ? static_cast<double>(region.g_sum) / region.counted : 0.0;
+
+		diff += fabs(mean - zones_[i]);
+		total += zones_[i];
+		zones_[i] = mean;
+	}
+
+	bool valid = zones_valid_;
+	zones_valid_ = true;
+
+	// Report the first frame as a change, there is nothing to compare it to.
+	if (!valid || total == 0.0)
+		return 1.0;
+
+	return diff / total;
+}
+
+// Register algorithm with the system.
+static Algorithm *Create(Controller *controller)
+{
+	return new FrameRate(controller);
+}
+static RegisterAlgorithm reg(NAME, &Create);
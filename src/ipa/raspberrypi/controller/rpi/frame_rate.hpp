@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * frame_rate.hpp - scene adaptive frame rate control algorithm
+ */
+#pragma once
+
+#include <array>
+
+#include <libcamera/base/utils.h>
+
+#include "../algorithm.hpp"
+#include "../frame_rate_status.h"
+
+// This is our implementation of the "frame rate algorithm".
+
+namespace RPiController {
+
+class FrameRate : public Algorithm
+{
+public:
+	FrameRate(Controller *controller);
+	char const *Name() const override;
+	void Read(boost::property_tree::ptree const &params) override;
+	void SwitchMode(CameraMode const &camera_mode, Metadata *metadata) override;
+	void Process(StatisticsPtr &stats, Metadata *image_metadata) override;
+
+private:
+	double sceneChange(StatisticsPtr &stats);
+
+	// tuning parameters
+	double static_threshold_;
+	unsigned int static_frames_;
+	double step_;
+	unsigned int step_frames_;
+	libcamera::utils::Duration max_frame_duration_;
+
+	libcamera::utils::Duration line_length_;
+	// mean green level of the AGC regions in the previous frame
+	std::array<double, AGC_REGIONS> zones_;
+	bool zones_valid_;
+	unsigned int static_count_;
+	libcamera::utils::Duration frame_duration_;
+};
+
+} // namespace RPiController
@@ -55,13 +55,13 @@ void Lux::SetCurrentAperture(double aperture)
 void Lux::Prepare(Metadata *image_metadata)
 {
 	std::unique_lock<std::mutex> lock(mutex_);
-	image_metadata->Set("lux.status", status_);
+	image_metadata->Set(status_);
 }
 
 void Lux::Process(StatisticsPtr &stats, Metadata *image_metadata)
 {
 	DeviceStatus device_status;
-	if (image_metadata->Get("device.status", device_status) == 0) {
+	if (image_metadata->Get(device_status) == 0) {
 		double current_gain = device_status.analogue_gain;
 		double current_aperture = device_status.aperture;
 		if (current_aperture == 0)
@@ -93,7 +93,7 @@ void Lux::Process(StatisticsPtr &stats, Metadata *image_metadata)
 		}
 		// Overwrite the metadata here as well, so that downstream
 		// algorithms get the latest value.
-		image_metadata->Set("lux.status", status);
+		image_metadata->Set(status);
 	} else
 		LOG(RPiLux, Warning) << ": no device metadata";
 }
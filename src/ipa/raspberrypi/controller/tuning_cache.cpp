@@ -0,0 +1,275 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * tuning_cache.cpp - binary cache of the parsed tuning files
+ */
+
+#include <errno.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/global_configuration.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+#include "tuning_cache.hpp"
+
+#include <boost/property_tree/json_parser.hpp>
+
+using namespace RPiController;
+using namespace libcamera;
+
+LOG_DEFINE_CATEGORY(RPiTuningCache)
+
+// Bump whenever the layout below changes, old caches are then rebuilt.
+static const uint32_t CACHE_VERSION = 1;
+static const char CACHE_MAGIC[8] = { 'R', 'P', 'I', 'T', 'U', 'N', 'E', '\0' };
+
+// The cache is only ever read on the machine that wrote it, so everything is
+// stored in native byte order. The header is followed by the root node. A node
+// is its value and its number of children, followed by the key and node of
+// each child. Strings are stored as a 32-bit length and the characters.
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t json_size;
+	uint64_t json_checksum;
+	uint64_t data_size;
+};
+
+// Trees nested deeper than this are rejected, rather than risking the stack on
+// a corrupted cache file.
+static const unsigned int MAX_DEPTH = 64;
+
+static uint64_t checksum(std::string const &data)
+{
+	// 64-bit FNV-1a.
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (char c : data) {
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static std::string cache_directory()
+{
+	char const *dir = GlobalConfiguration::option("LIBCAMERA_RPI_TUNING_CACHE");
+	if (dir)
+		return dir;
+	char const *xdg = utils::secure_getenv("XDG_CACHE_HOME");
+	if (xdg && *xdg)
+		return std::string(xdg) + "/libcamera";
+	char const *home = utils::secure_getenv("HOME");
+	if (home && *home)
+		return std::string(home) + "/.cache/libcamera";
+	return "";
+}
+
+static std::string cache_file_name(char const *filename)
+{
+	std::string dir = cache_directory();
+	if (dir.empty())
+		return "";
+	// Tuning files of the same name exist for different platforms, so the
+	// cache is named after a hash of the whole path.
+	std::stringstream ss;
+	ss << dir << "/rpi-tuning-" << std::hex << std::setw(16)
+	   << std::setfill('0') << checksum(filename) << ".bin";
+	return ss.str();
+}
+
+static bool make_directories(std::string const &path)
+{
+	for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+		std::string dir = path.substr(0, pos);
+		if (mkdir(dir.c_str(), 0755) && errno != EEXIST)
+			return false;
+		if (pos == std::string::npos)
+			return true;
+	}
+}
+
+namespace {
+
+class CacheReader
+{
+public:
+	CacheReader(Span<const uint8_t> data)
+		: data_(data), pos_(0)
+	{
+	}
+
+	bool ReadNode(boost::property_tree::ptree &node, unsigned int depth)
+	{
+		std::string value;
+		uint32_t num_children;
+		if (depth > MAX_DEPTH || !readString(value) ||
+		    !read(&num_children, sizeof(num_children)))
+			return false;
+		node.data() = std::move(value);
+		for (uint32_t i = 0; i < num_children; i++) {
+			std::string key;
+			if (!readString(key))
+				return false;
+			auto it = node.push_back(
+				std::make_pair(std::move(key),
+					       boost::property_tree::ptree()));
+			if (!ReadNode(it->second, depth + 1))
+				return false;
+		}
+		return true;
+	}
+
+	bool AtEnd() const { return pos_ == data_.size(); }
+
+private:
+	bool read(void *dst, size_t size)
+	{
+		if (data_.size() - pos_ < size)
+			return false;
+		memcpy(dst, data_.data() + pos_, size);
+		pos_ += size;
+		return true;
+	}
+
+	bool readString(std::string &str)
+	{
+		uint32_t len;
+		if (!read(&len, sizeof(len)) || data_.size() - pos_ < len)
+			return false;
+		str.assign(reinterpret_cast<char const *>(data_.data() + pos_), len);
+		pos_ += len;
+		return true;
+	}
+
+	Span<const uint8_t> data_;
+	size_t pos_;
+};
+
+} // namespace
+
+static void write_string(std::string &out, std::string const &str)
+{
+	uint32_t len = str.size();
+	out.append(reinterpret_cast<char const *>(&len), sizeof(len));
+	out.append(str);
+}
+
+static void write_node(std::string &out, boost::property_tree::ptree const &node)
+{
+	write_string(out, node.data());
+	uint32_t num_children = node.size();
+	out.append(reinterpret_cast<char const *>(&num_children),
+		   sizeof(num_children));
+	for (auto const &child : node) {
+		write_string(out, child.first);
+		write_node(out, child.second);
+	}
+}
+
+static bool load_cache(std::string const &cache_name, std::string const &json,
+		       boost::property_tree::ptree &root)
+{
+	File file(cache_name);
+	if (!file.open(File::OpenModeFlag::ReadOnly))
+		return false;
+	Span<const uint8_t> data = file.map(0, -1, File::MapFlag::Sequential |
+						   File::MapFlag::WillNeed);
+	if (data.size() < sizeof(CacheHeader))
+		return false;
+
+	CacheHeader header;
+	memcpy(&header, data.data(), sizeof(header));
+	if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) ||
+	    header.version != CACHE_VERSION ||
+	    header.data_size != data.size() - sizeof(header)) {
+		LOG(RPiTuningCache, Debug) << "Ignoring invalid cache " << cache_name;
+		return false;
+	}
+	if (header.json_size != json.size() ||
+	    header.json_checksum != checksum(json)) {
+		LOG(RPiTuningCache, Debug) << "Cache " << cache_name << " is stale";
+		return false;
+	}
+
+	boost::property_tree::ptree tree;
+	CacheReader reader(data.subspan(sizeof(header)));
+	if (!reader.ReadNode(tree, 0) || !reader.AtEnd()) {
+		LOG(RPiTuningCache, Warning) << "Corrupted cache " << cache_name;
+		return false;
+	}
+	root.swap(tree);
+	return true;
+}
+
+static void store_cache(std::string const &cache_name, std::string const &json,
+			boost::property_tree::ptree const &root)
+{
+	std::string data;
+	write_node(data, root);
+
+	CacheHeader header = {};
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.json_size = json.size();
+	header.json_checksum = checksum(json);
+	header.data_size = data.size();
+	data.insert(0, reinterpret_cast<char const *>(&header), sizeof(header));
+
+	// Write to a temporary file renamed over the cache at the end, so that a
+	// concurrent or interrupted write never leaves a partial cache behind.
+	std::string tmp_name = cache_name + "." + std::to_string(getpid());
+	unlink(tmp_name.c_str());
+	File file(tmp_name);
+	bool ok = make_directories(cache_name.substr(0, cache_name.rfind('/'))) &&
+		  file.open(File::OpenModeFlag::WriteOnly);
+	if (ok)
+		ok = file.write({ reinterpret_cast<uint8_t const *>(data.data()),
+				  data.size() }) == static_cast<ssize_t>(data.size());
+	file.close();
+	if (ok)
+		ok = rename(tmp_name.c_str(), cache_name.c_str()) == 0;
+	if (!ok) {
+		unlink(tmp_name.c_str());
+		LOG(RPiTuningCache, Debug) << "Unable to write cache " << cache_name;
+		return;
+	}
+	LOG(RPiTuningCache, Debug) << "Wrote cache " << cache_name;
+}
+
+void RPiController::ReadTuningFile(char const *filename,
+				   boost::property_tree::ptree &root)
+{
+	std::ifstream stream(filename, std::ios::binary);
+	if (!stream)
+		throw boost::property_tree::json_parser_error("cannot open file",
+							      filename, 0);
+	std::string json((std::istreambuf_iterator<char>(stream)),
+			 std::istreambuf_iterator<char>());
+
+	std::string cache_name = cache_file_name(filename);
+	if (!cache_name.empty() && load_cache(cache_name, json, root)) {
+		LOG(RPiTuningCache, Debug)
+			<< "Loaded " << filename << " from " << cache_name;
+		return;
+	}
+
+	std::istringstream json_stream(json);
+	try {
+		boost::property_tree::read_json(json_stream, root);
+	} catch (boost::property_tree::json_parser_error const &e) {
+		// Report the real file name rather than the string stream's.
+		throw boost::property_tree::json_parser_error(e.message(), filename,
+							      e.line());
+	}
+	if (!cache_name.empty())
+		store_cache(cache_name, json, root);
+}
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * tuning_cache.hpp - binary cache of the parsed tuning files
+ */
+#pragma once
+
+// Parsing a large tuning file (the ALSC tables especially) into a property tree
+// is slow on the smaller Pis. The first time a tuning file is read, the tree is
+// written to a binary cache file, which later reads load back without any JSON
+// parsing. The cache records the size and checksum of the JSON file it was made
+// from, and is rebuilt whenever they don't match.
+//
+// Cache files live in the directory given by the LIBCAMERA_RPI_TUNING_CACHE
+// environment variable, or else in $XDG_CACHE_HOME/libcamera or
+// $HOME/.cache/libcamera. Setting LIBCAMERA_RPI_TUNING_CACHE to an empty string
+// disables the cache.
+
+#include <boost/property_tree/ptree.hpp>
+
+namespace RPiController {
+
+// Read the JSON tuning file into root, through the cache when possible. Throws
+// boost::property_tree::json_parser_error if the file can't be read or parsed,
+// just like boost::property_tree::read_json.
+void ReadTuningFile(char const *filename, boost::property_tree::ptree &root);
+
+} // namespace RPiController
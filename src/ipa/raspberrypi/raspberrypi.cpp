@@ -30,6 +30,10 @@
 
 #include "libcamera/internal/mapped_framebuffer.h"
 
+#include "libipa/converged_state.h"
+
+#include "af_algorithm.hpp"
+#include "af_status.h"
 #include "agc_algorithm.hpp"
 #include "agc_status.h"
 #include "alsc_status.h"
@@ -46,6 +50,7 @@
 #include "denoise_status.h"
 #include "dpc_status.h"
 #include "focus_status.h"
+#include "frame_rate_status.h"
 #include "geq_status.h"
 #include "lux_status.h"
 #include "metadata.hpp"
@@ -79,7 +84,9 @@ class IPARPi : public ipa::RPi::IPARPiInterface
 public:
 	IPARPi()
 		: controller_(), frameCount_(0), checkCount_(0), mistrustCount_(0),
-		  lastRunTimestamp_(0), lsTable_(nullptr), firstStart_(true)
+		  lastRunTimestamp_(0), lsTable_(nullptr), lsTableValid_(false),
+		  lsTableGeneration_(0), ispTables_(nullptr),
+		  ispTablesGeneration_(0), firstStart_(true)
 	{
 	}
 
@@ -87,6 +94,8 @@ public:
 	{
 		if (lsTable_)
 			munmap(lsTable_, ipa::RPi::MaxLsGridSize);
+		if (ispTables_)
+			munmap(ispTables_, RPi::IspTablesSize);
 	}
 
 	int init(const IPASettings &settings, ipa::RPi::SensorConfig *sensorConfig) override;
@@ -109,11 +118,13 @@ private:
 	bool validateSensorControls();
 	bool validateIspControls();
 	void queueRequest(const ControlList &controls);
+	bool restoreConvergedState(Span<const uint8_t> data);
 	void returnEmbeddedBuffer(unsigned int bufferId);
 	void prepareISP(const ipa::RPi::ISPConfig &data);
 	void reportMetadata();
 	void fillDeviceStatus(const ControlList &sensorControls);
 	void processStats(unsigned int bufferId);
+	void applyAF(const struct AfStatus *afStatus, ControlList &ctrls);
 	void applyFrameDurations(Duration minFrameDuration, Duration maxFrameDuration);
 	void applyAGC(const struct AgcStatus *agcStatus, ControlList &ctrls);
 	void applyAWB(const struct AwbStatus *awbStatus, ControlList &ctrls);
@@ -126,12 +137,17 @@ private:
 	void applySharpen(const struct SharpenStatus *sharpenStatus, ControlList &ctrls);
 	void applyDPC(const struct DpcStatus *dpcStatus, ControlList &ctrls);
 	void applyLS(const struct AlscStatus *lsStatus, ControlList &ctrls);
-	void resampleTable(uint16_t dest[], double const src[12][16], int destW, int destH);
+	void setLsGrid(unsigned int width, unsigned int height);
+	void resampleTable(uint16_t dest[], double const src[12][16]);
+	template<typename T>
+	void setIspTable(unsigned int id, const T &table, ControlList &ctrls);
 
 	std::map<unsigned int, MappedFrameBuffer> buffers_;
 
 	ControlInfoMap sensorCtrls_;
 	ControlInfoMap ispCtrls_;
+	/* Controls of the focus lens, empty if the camera has none. */
+	ControlInfoMap lensCtrls_;
 	ControlList libcameraMetadata_;
 
 	/* Camera sensor params. */
@@ -167,12 +183,39 @@ private:
 	FileDescriptor lsTableHandle_;
 	void *lsTable_;
 
+	/*
+	 * Sampling locations and phases of the LS grid in the ALSC tables,
+	 * computed when the grid size changes, and the ALSC generation of the
+	 * tables currently written to the LS table.
+	 */
+	struct LsGrid {
+		unsigned int width;
+		unsigned int height;
+		std::array<unsigned int, 64> xLo;
+		std::array<unsigned int, 64> xHi;
+		std::array<float, 64> xf;
+		std::array<unsigned int, 49> yLo;
+		std::array<unsigned int, 49> yHi;
+		std::array<float, 49> yf;
+	};
+	LsGrid lsGrid_ = {};
+	bool lsTableValid_;
+	unsigned int lsTableGeneration_;
+
+	/* ISP tables allocation passed in from the pipeline handler. */
+	FileDescriptor ispTablesHandle_;
+	RPi::IspTable *ispTables_;
+	uint32_t ispTablesGeneration_;
+
 	/* Distinguish the first camera start from others. */
 	bool firstStart_;
 
 	/* Frame duration (1/fps) limits. */
 	Duration minFrameDuration_;
 	Duration maxFrameDuration_;
+
+	/* Frame duration the scene allows, within the limits above. */
+	Duration sceneFrameDuration_;
 };
 
 int IPARPi::init(const IPASettings &settings, ipa::RPi::SensorConfig *sensorConfig)
@@ -200,6 +243,7 @@ int IPARPi::init(const IPASettings &settings, ipa::RPi::SensorConfig *sensorConf
 	sensorConfig->gainDelay = gainDelay;
 	sensorConfig->exposureDelay = exposureDelay;
 	sensorConfig->vblankDelay = vblankDelay;
+	sensorConfig->lensDelay = helper_->LensDelay();
 	sensorConfig->sensorMetadata = sensorMetadata;
 
 	/* Load the tuning file for this sensor. */
@@ -219,6 +263,14 @@ void IPARPi::start(const ControlList &controls, ipa::RPi::StartConfig *startConf
 		queueRequest(controls);
 	}
 
+	/*
+	 * Seed the algorithms with the converged state of a previous session,
+	 * if provided by the application.
+	 */
+	bool restored = false;
+	if (controls.contains(controls::CONVERGED_STATE))
+		restored = restoreConvergedState(controls.get(controls::draft::ConvergedState));
+
 	controller_.SwitchMode(mode_, &metadata);
 
 	/* SwitchMode may supply updated exposure/gain values to use. */
@@ -226,7 +278,7 @@ void IPARPi::start(const ControlList &controls, ipa::RPi::StartConfig *startConf
 	agcStatus.shutter_time = 0.0s;
 	agcStatus.analogue_gain = 0.0;
 
-	metadata.Get("agc.status", agcStatus);
+	metadata.Get(agcStatus);
 	if (agcStatus.shutter_time && agcStatus.analogue_gain) {
 		ControlList ctrls(sensorCtrls_);
 		applyAGC(&agcStatus, ctrls);
@@ -236,11 +288,13 @@ void IPARPi::start(const ControlList &controls, ipa::RPi::StartConfig *startConf
 	/*
 	 * Initialise frame counts, and decide how many frames must be hidden or
 	 * "mistrusted", which depends on whether this is a startup from cold,
-	 * or merely a mode switch in a running system.
+	 * or merely a mode switch in a running system. A startup with a
+	 * restored converged state is handled as a mode switch, as the
+	 * algorithms don't need to converge from defaults.
 	 */
 	frameCount_ = 0;
 	checkCount_ = 0;
-	if (firstStart_) {
+	if (firstStart_ && !restored) {
 		dropFrameCount_ = helper_->HideFramesStartup();
 		mistrustCount_ = helper_->MistrustFramesStartup();
 
@@ -339,7 +393,7 @@ int IPARPi::configure(const IPACameraSensorInfo &sensorInfo,
 		      const ipa::RPi::IPAConfig &ipaConfig,
 		      ControlList *controls)
 {
-	if (entityControls.size() != 2) {
+	if (!entityControls.count(0) || !entityControls.count(1)) {
 		LOG(IPARPI, Error) << "No ISP or sensor controls found.";
 		return -1;
 	}
@@ -347,6 +401,14 @@ int IPARPi::configure(const IPACameraSensorInfo &sensorInfo,
 	sensorCtrls_ = entityControls.at(0);
 	ispCtrls_ = entityControls.at(1);
 
+	/* The lens controls are only present if the camera has a focus lens. */
+	auto lens = entityControls.find(2);
+	if (lens != entityControls.end() &&
+	    lens->second.find(V4L2_CID_FOCUS_ABSOLUTE) != lens->second.end())
+		lensCtrls_ = lens->second;
+	else
+		lensCtrls_ = {};
+
 	if (!validateSensorControls()) {
 		LOG(IPARPI, Error) << "Sensor control validation failed.";
 		return -1;
@@ -375,6 +437,7 @@ int IPARPi::configure(const IPACameraSensorInfo &sensorInfo,
 
 		/* Map the LS table buffer into user space. */
 		lsTableHandle_ = std::move(ipaConfig.lsTableHandle);
+		lsTableValid_ = false;
 		if (lsTableHandle_.isValid()) {
 			lsTable_ = mmap(nullptr, ipa::RPi::MaxLsGridSize, PROT_READ | PROT_WRITE,
 					MAP_SHARED, lsTableHandle_.fd(), 0);
@@ -386,9 +449,28 @@ int IPARPi::configure(const IPACameraSensorInfo &sensorInfo,
 		}
 	}
 
+	/* Map the ISP tables buffer if available. */
+	if (ipaConfig.ispTablesHandle.isValid()) {
+		if (ispTables_) {
+			munmap(ispTables_, RPi::IspTablesSize);
+			ispTables_ = nullptr;
+		}
+
+		ispTablesHandle_ = std::move(ipaConfig.ispTablesHandle);
+		void *mem = mmap(nullptr, RPi::IspTablesSize, PROT_READ | PROT_WRITE,
+				 MAP_SHARED, ispTablesHandle_.fd(), 0);
+		if (mem == MAP_FAILED)
+			LOG(IPARPI, Error) << "dmaHeap mmap failure for ISP tables.";
+		else
+			ispTables_ = static_cast<RPi::IspTable *>(mem);
+	}
+
 	/* Pass the camera mode to the CamHelper to setup algorithms. */
 	helper_->SetCameraMode(mode_);
 
+	/* The frame rate algorithm restarts from the full rate in a new mode. */
+	sceneFrameDuration_ = 0.0s;
+
 	/*
 	 * Initialise this ControlList correctly, even if empty, in case the IPA is
 	 * running is isolation mode (passing the ControlList through the IPC layer).
@@ -465,14 +547,12 @@ void IPARPi::signalIspPrepare(const ipa::RPi::ISPConfig &data)
 
 void IPARPi::reportMetadata()
 {
-	std::unique_lock<RPiController::Metadata> lock(rpiMetadata_);
-
 	/*
 	 * Certain information about the current frame and how it will be
 	 * processed can be extracted and placed into the libcamera metadata
 	 * buffer, where an application could query it.
 	 */
-	DeviceStatus *deviceStatus = rpiMetadata_.GetLocked<DeviceStatus>("device.status");
+	DeviceStatus *deviceStatus = rpiMetadata_.Get<DeviceStatus>();
 	if (deviceStatus) {
 		libcameraMetadata_.set(controls::ExposureTime,
 				       deviceStatus->shutter_speed.get<std::micro>());
@@ -481,24 +561,37 @@ void IPARPi::reportMetadata()
 				       helper_->Exposure(deviceStatus->frame_length).get<std::micro>());
 	}
 
-	AgcStatus *agcStatus = rpiMetadata_.GetLocked<AgcStatus>("agc.status");
+	AgcStatus *agcStatus = rpiMetadata_.Get<AgcStatus>();
 	if (agcStatus) {
 		libcameraMetadata_.set(controls::AeLocked, agcStatus->locked);
 		libcameraMetadata_.set(controls::DigitalGain, agcStatus->digital_gain);
 	}
 
-	LuxStatus *luxStatus = rpiMetadata_.GetLocked<LuxStatus>("lux.status");
+	LuxStatus *luxStatus = rpiMetadata_.Get<LuxStatus>();
 	if (luxStatus)
 		libcameraMetadata_.set(controls::Lux, luxStatus->lux);
 
-	AwbStatus *awbStatus = rpiMetadata_.GetLocked<AwbStatus>("awb.status");
+	AwbStatus *awbStatus = rpiMetadata_.Get<AwbStatus>();
 	if (awbStatus) {
 		libcameraMetadata_.set(controls::ColourGains, { static_cast<float>(awbStatus->gain_r),
 								static_cast<float>(awbStatus->gain_b) });
 		libcameraMetadata_.set(controls::ColourTemperature, awbStatus->temperature_K);
 	}
 
-	BlackLevelStatus *blackLevelStatus = rpiMetadata_.GetLocked<BlackLevelStatus>("black_level.status");
+	if (agcStatus && awbStatus) {
+		ipa::ConvergedState state;
+		state.exposureTime = agcStatus->shutter_time;
+		state.analogueGain = agcStatus->analogue_gain;
+		state.redGain = awbStatus->gain_r;
+		state.blueGain = awbStatus->gain_b;
+		state.colourTemperature = awbStatus->temperature_K;
+
+		std::vector<uint8_t> data = state.serialize();
+		libcameraMetadata_.set(controls::draft::ConvergedState,
+				       Span<const uint8_t>(data));
+	}
+
+	BlackLevelStatus *blackLevelStatus = rpiMetadata_.Get<BlackLevelStatus>();
 	if (blackLevelStatus)
 		libcameraMetadata_.set(controls::SensorBlackLevels,
 				       { static_cast<int32_t>(blackLevelStatus->black_level_r),
@@ -506,7 +599,7 @@ void IPARPi::reportMetadata()
 					 static_cast<int32_t>(blackLevelStatus->black_level_g),
 					 static_cast<int32_t>(blackLevelStatus->black_level_b) });
 
-	FocusStatus *focusStatus = rpiMetadata_.GetLocked<FocusStatus>("focus.status");
+	FocusStatus *focusStatus = rpiMetadata_.Get<FocusStatus>();
 	if (focusStatus && focusStatus->num == 12) {
 		/*
 		 * We get a 4x3 grid of regions by default. Calculate the average
@@ -517,7 +610,35 @@ void IPARPi::reportMetadata()
 		libcameraMetadata_.set(controls::FocusFoM, focusFoM);
 	}
 
-	CcmStatus *ccmStatus = rpiMetadata_.GetLocked<CcmStatus>("ccm.status");
+	AfStatus *afStatus = rpiMetadata_.Get<AfStatus>();
+	if (afStatus && !lensCtrls_.empty()) {
+		static const std::map<RPiController::AfState, int32_t> autoStates = {
+			{ RPiController::AfState::Idle, controls::draft::AfStateInactive },
+			{ RPiController::AfState::Scanning, controls::draft::AfStateActiveScan },
+			{ RPiController::AfState::Focused, controls::draft::AfStateFocusedLock },
+			{ RPiController::AfState::Failed, controls::draft::AfStateNotFocusedLock },
+		};
+		static const std::map<RPiController::AfState, int32_t> continuousStates = {
+			{ RPiController::AfState::Idle, controls::draft::AfStateInactive },
+			{ RPiController::AfState::Scanning, controls::draft::AfStatePassiveScan },
+			{ RPiController::AfState::Focused, controls::draft::AfStatePassiveFocused },
+			{ RPiController::AfState::Failed, controls::draft::AfStatePassiveUnfocused },
+		};
+
+		int32_t state = controls::draft::AfStateInactive;
+		if (afStatus->mode == RPiController::AfMode::Auto)
+			state = autoStates.at(afStatus->state);
+		else if (afStatus->mode == RPiController::AfMode::Continuous)
+			state = continuousStates.at(afStatus->state);
+
+		libcameraMetadata_.set(controls::draft::AfState, state);
+	}
+
+	if (deviceStatus && deviceStatus->lens_setting >= 0.0)
+		libcameraMetadata_.set(controls::draft::LensPosition,
+				       static_cast<float>(deviceStatus->lens_setting));
+
+	CcmStatus *ccmStatus = rpiMetadata_.Get<CcmStatus>();
 	if (ccmStatus) {
 		float m[9];
 		for (unsigned int i = 0; i < 9; i++)
@@ -609,6 +730,12 @@ static const std::map<int32_t, std::string> AwbModeTable = {
 	{ controls::AwbCustom, "custom" },
 };
 
+static const std::map<int32_t, RPiController::AfMode> AfModeTable = {
+	{ controls::draft::AfModeManual, RPiController::AfMode::Manual },
+	{ controls::draft::AfModeAuto, RPiController::AfMode::Auto },
+	{ controls::draft::AfModeContinuous, RPiController::AfMode::Continuous },
+};
+
 static const std::map<int32_t, RPiController::DenoiseMode> DenoiseModeTable = {
 	{ controls::draft::NoiseReductionModeOff, RPiController::DenoiseMode::Off },
 	{ controls::draft::NoiseReductionModeFast, RPiController::DenoiseMode::ColourFast },
@@ -873,8 +1000,61 @@ void IPARPi::queueRequest(const ControlList &controls)
 			break;
 		}
 
-		case controls::SCALER_CROP: {
-			/* We do nothing with this, but should avoid the warning below. */
+		case controls::SCALER_CROP:
+		case controls::REPROCESS_TIMESTAMP:
+		case controls::CONVERGED_STATE: {
+			/* We do nothing with these, but should avoid the warning below. */
+			break;
+		}
+
+		case controls::AF_MODE: {
+			RPiController::AfAlgorithm *af = dynamic_cast<RPiController::AfAlgorithm *>(
+				controller_.GetAlgorithm("af"));
+			if (!af) {
+				LOG(IPARPI, Warning)
+					<< "Could not set AF_MODE - no AF algorithm";
+				break;
+			}
+
+			int32_t idx = ctrl.second.get<int32_t>();
+			auto mode = AfModeTable.find(idx);
+			if (mode != AfModeTable.end()) {
+				af->SetMode(mode->second);
+				libcameraMetadata_.set(controls::draft::AfMode, idx);
+			} else {
+				LOG(IPARPI, Error) << "AF mode " << idx
+						   << " not recognised";
+			}
+			break;
+		}
+
+		case controls::AF_TRIGGER: {
+			RPiController::AfAlgorithm *af = dynamic_cast<RPiController::AfAlgorithm *>(
+				controller_.GetAlgorithm("af"));
+			if (!af) {
+				LOG(IPARPI, Warning)
+					<< "Could not set AF_TRIGGER - no AF algorithm";
+				break;
+			}
+
+			int32_t trigger = ctrl.second.get<int32_t>();
+			if (trigger == controls::draft::AfTriggerStart)
+				af->Trigger();
+			else if (trigger == controls::draft::AfTriggerCancel)
+				af->Cancel();
+			break;
+		}
+
+		case controls::LENS_POSITION: {
+			RPiController::AfAlgorithm *af = dynamic_cast<RPiController::AfAlgorithm *>(
+				controller_.GetAlgorithm("af"));
+			if (!af) {
+				LOG(IPARPI, Warning)
+					<< "Could not set LENS_POSITION - no AF algorithm";
+				break;
+			}
+
+			af->SetLensPosition(ctrl.second.get<float>());
 			break;
 		}
 
@@ -920,6 +1100,32 @@ void IPARPi::queueRequest(const ControlList &controls)
 	}
 }
 
+bool IPARPi::restoreConvergedState(Span<const uint8_t> data)
+{
+	std::optional<ipa::ConvergedState> state = ipa::ConvergedState::deserialize(data);
+	if (!state)
+		return false;
+
+	RPiController::AgcAlgorithm *agc = dynamic_cast<RPiController::AgcAlgorithm *>(
+		controller_.GetAlgorithm("agc"));
+	if (agc)
+		agc->SetInitialExposure(state->exposureTime, state->analogueGain);
+
+	/*
+	 * ALSC derives its initial tables from the colour temperature reported
+	 * by AWB, there's no need to restore them separately.
+	 */
+	RPiController::AwbAlgorithm *awb = dynamic_cast<RPiController::AwbAlgorithm *>(
+		controller_.GetAlgorithm("awb"));
+	if (awb)
+		awb->SetInitialGains(state->redGain, state->blueGain,
+				     state->colourTemperature);
+
+	LOG(IPARPI, Debug) << "Restored converged state";
+
+	return true;
+}
+
 void IPARPi::returnEmbeddedBuffer(unsigned int bufferId)
 {
 	embeddedComplete.emit(bufferId & ipa::RPi::MaskID);
@@ -973,49 +1179,47 @@ void IPARPi::prepareISP(const ipa::RPi::ISPConfig &data)
 	processPending_ = true;
 
 	ControlList ctrls(ispCtrls_);
+	ispTablesGeneration_++;
 
 	controller_.Prepare(&rpiMetadata_);
 
-	/* Lock the metadata buffer to avoid constant locks/unlocks. */
-	std::unique_lock<RPiController::Metadata> lock(rpiMetadata_);
-
-	AwbStatus *awbStatus = rpiMetadata_.GetLocked<AwbStatus>("awb.status");
+	AwbStatus *awbStatus = rpiMetadata_.Get<AwbStatus>();
 	if (awbStatus)
 		applyAWB(awbStatus, ctrls);
 
-	CcmStatus *ccmStatus = rpiMetadata_.GetLocked<CcmStatus>("ccm.status");
+	CcmStatus *ccmStatus = rpiMetadata_.Get<CcmStatus>();
 	if (ccmStatus)
 		applyCCM(ccmStatus, ctrls);
 
-	AgcStatus *dgStatus = rpiMetadata_.GetLocked<AgcStatus>("agc.status");
+	AgcStatus *dgStatus = rpiMetadata_.Get<AgcStatus>();
 	if (dgStatus)
 		applyDG(dgStatus, ctrls);
 
-	AlscStatus *lsStatus = rpiMetadata_.GetLocked<AlscStatus>("alsc.status");
+	AlscStatus *lsStatus = rpiMetadata_.Get<AlscStatus>();
 	if (lsStatus)
 		applyLS(lsStatus, ctrls);
 
-	ContrastStatus *contrastStatus = rpiMetadata_.GetLocked<ContrastStatus>("contrast.status");
+	ContrastStatus *contrastStatus = rpiMetadata_.Get<ContrastStatus>();
 	if (contrastStatus)
 		applyGamma(contrastStatus, ctrls);
 
-	BlackLevelStatus *blackLevelStatus = rpiMetadata_.GetLocked<BlackLevelStatus>("black_level.status");
+	BlackLevelStatus *blackLevelStatus = rpiMetadata_.Get<BlackLevelStatus>();
 	if (blackLevelStatus)
 		applyBlackLevel(blackLevelStatus, ctrls);
 
-	GeqStatus *geqStatus = rpiMetadata_.GetLocked<GeqStatus>("geq.status");
+	GeqStatus *geqStatus = rpiMetadata_.Get<GeqStatus>();
 	if (geqStatus)
 		applyGEQ(geqStatus, ctrls);
 
-	DenoiseStatus *denoiseStatus = rpiMetadata_.GetLocked<DenoiseStatus>("denoise.status");
+	DenoiseStatus *denoiseStatus = rpiMetadata_.Get<DenoiseStatus>();
 	if (denoiseStatus)
 		applyDenoise(denoiseStatus, ctrls);
 
-	SharpenStatus *sharpenStatus = rpiMetadata_.GetLocked<SharpenStatus>("sharpen.status");
+	SharpenStatus *sharpenStatus = rpiMetadata_.Get<SharpenStatus>();
 	if (sharpenStatus)
 		applySharpen(sharpenStatus, ctrls);
 
-	DpcStatus *dpcStatus = rpiMetadata_.GetLocked<DpcStatus>("dpc.status");
+	DpcStatus *dpcStatus = rpiMetadata_.Get<DpcStatus>();
 	if (dpcStatus)
 		applyDPC(dpcStatus, ctrls);
 
@@ -1035,9 +1239,23 @@ void IPARPi::fillDeviceStatus(const ControlList &sensorControls)
 	deviceStatus.analogue_gain = helper_->Gain(gainCode);
 	deviceStatus.frame_length = mode_.height + vblank;
 
+	/*
+	 * The lens position is handled by the delayed controls along with the
+	 * sensor controls, and reported in the same list.
+	 */
+	if (!lensCtrls_.empty() && sensorControls.contains(V4L2_CID_FOCUS_ABSOLUTE)) {
+		const ControlInfo &info = lensCtrls_.at(V4L2_CID_FOCUS_ABSOLUTE);
+		int32_t min = info.min().get<int32_t>();
+		int32_t max = info.max().get<int32_t>();
+		int32_t code = sensorControls.get(V4L2_CID_FOCUS_ABSOLUTE).get<int32_t>();
+
+		if (max > min)
+			deviceStatus.lens_setting = static_cast<double>(code - min) / (max - min);
+	}
+
 	LOG(IPARPI, Debug) << "Metadata - " << deviceStatus;
 
-	rpiMetadata_.Set("device.status", deviceStatus);
+	rpiMetadata_.Set(deviceStatus);
 }
 
 void IPARPi::processStats(unsigned int bufferId)
@@ -1054,13 +1272,43 @@ void IPARPi::processStats(unsigned int bufferId)
 	helper_->Process(statistics, rpiMetadata_);
 	controller_.Process(statistics, &rpiMetadata_);
 
+	ControlList ctrls(sensorCtrls_);
+
+	FrameRateStatus *frameRateStatus = rpiMetadata_.Get<FrameRateStatus>();
+	if (frameRateStatus)
+		sceneFrameDuration_ = frameRateStatus->frame_duration;
+
 	struct AgcStatus agcStatus;
-	if (rpiMetadata_.Get("agc.status", agcStatus) == 0) {
-		ControlList ctrls(sensorCtrls_);
+	if (rpiMetadata_.Get(agcStatus) == 0)
 		applyAGC(&agcStatus, ctrls);
 
+	AfStatus *afStatus = rpiMetadata_.Get<AfStatus>();
+	if (afStatus)
+		applyAF(afStatus, ctrls);
+
+	if (!ctrls.empty())
 		setDelayedControls.emit(ctrls);
-	}
+}
+
+void IPARPi::applyAF(const struct AfStatus *afStatus, ControlList &ctrls)
+{
+	if (lensCtrls_.empty())
+		return;
+
+	const ControlInfo &info = lensCtrls_.at(V4L2_CID_FOCUS_ABSOLUTE);
+	int32_t min = info.min().get<int32_t>();
+	int32_t max = info.max().get<int32_t>();
+	int32_t code = min + lround(afStatus->lens_setting * (max - min));
+
+	LOG(IPARPI, Debug) << "Applying lens position " << afStatus->lens_setting
+			   << " (code " << code << ")";
+
+	/*
+	 * The lens control isn't part of the sensor ControlInfoMap, it is
+	 * carried in the same list by numerical id and dispatched to the lens
+	 * by the pipeline handler.
+	 */
+	ctrls.set(V4L2_CID_FOCUS_ABSOLUTE, std::clamp(code, min, max));
 }
 
 void IPARPi::applyAWB(const struct AwbStatus *awbStatus, ControlList &ctrls)
@@ -1113,9 +1361,17 @@ void IPARPi::applyAGC(const struct AgcStatus *agcStatus, ControlList &ctrls)
 {
 	int32_t gainCode = helper_->GainCode(agcStatus->analogue_gain);
 
+	/*
+	 * Static scenes may be captured with longer frames, within the limits
+	 * set by the application. The exposure doesn't depend on it, so that
+	 * going back to the shortest frames on a scene change is immediate.
+	 */
+	Duration minFrameDuration = std::clamp(sceneFrameDuration_, minFrameDuration_,
+					       maxFrameDuration_);
+
 	/* GetVBlanking might clip exposure time to the fps limits. */
 	Duration exposure = agcStatus->shutter_time;
-	int32_t vblanking = helper_->GetVBlanking(exposure, minFrameDuration_, maxFrameDuration_);
+	int32_t vblanking = helper_->GetVBlanking(exposure, minFrameDuration, maxFrameDuration_);
 	int32_t exposureLines = helper_->ExposureLines(exposure);
 
 	LOG(IPARPI, Debug) << "Applying AGC Exposure: " << exposure
@@ -1152,9 +1408,7 @@ void IPARPi::applyCCM(const struct CcmStatus *ccmStatus, ControlList &ctrls)
 	ccm.enabled = 1;
 	ccm.ccm.offsets[0] = ccm.ccm.offsets[1] = ccm.ccm.offsets[2] = 0;
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&ccm),
-					    sizeof(ccm) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_CC_MATRIX, c);
+	setIspTable(V4L2_CID_USER_BCM2835_ISP_CC_MATRIX, ccm, ctrls);
 }
 
 void IPARPi::applyGamma(const struct ContrastStatus *contrastStatus, ControlList &ctrls)
@@ -1167,9 +1421,7 @@ void IPARPi::applyGamma(const struct ContrastStatus *contrastStatus, ControlList
 		gamma.y[i] = contrastStatus->points[i].y;
 	}
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&gamma),
-					    sizeof(gamma) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_GAMMA, c);
+	setIspTable(V4L2_CID_USER_BCM2835_ISP_GAMMA, gamma, ctrls);
 }
 
 void IPARPi::applyBlackLevel(const struct BlackLevelStatus *blackLevelStatus, ControlList &ctrls)
@@ -1181,9 +1433,7 @@ void IPARPi::applyBlackLevel(const struct BlackLevelStatus *blackLevelStatus, Co
 	blackLevel.black_level_g = blackLevelStatus->black_level_g;
 	blackLevel.black_level_b = blackLevelStatus->black_level_b;
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&blackLevel),
-					    sizeof(blackLevel) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_BLACK_LEVEL, c);
+	setIspTable(V4L2_CID_USER_BCM2835_ISP_BLACK_LEVEL, blackLevel, ctrls);
 }
 
 void IPARPi::applyGEQ(const struct GeqStatus *geqStatus, ControlList &ctrls)
@@ -1195,9 +1445,7 @@ void IPARPi::applyGEQ(const struct GeqStatus *geqStatus, ControlList &ctrls)
 	geq.slope.den = 1000;
 	geq.slope.num = 1000 * geqStatus->slope;
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&geq),
-					    sizeof(geq) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_GEQ, c);
+	setIspTable(V4L2_CID_USER_BCM2835_ISP_GEQ, geq, ctrls);
 }
 
 void IPARPi::applyDenoise(const struct DenoiseStatus *denoiseStatus, ControlList &ctrls)
@@ -1229,13 +1477,8 @@ void IPARPi::applyDenoise(const struct DenoiseStatus *denoiseStatus, ControlList
 		cdn.enabled = 0;
 	}
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&denoise),
-					    sizeof(denoise) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_DENOISE, c);
-
-	c = ControlValue(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&cdn),
-					      sizeof(cdn) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_CDN, c);
+	setIspTable(V4L2_CID_USER_BCM2835_ISP_DENOISE, denoise, ctrls);
+	setIspTable(V4L2_CID_USER_BCM2835_ISP_CDN, cdn, ctrls);
 }
 
 void IPARPi::applySharpen(const struct SharpenStatus *sharpenStatus, ControlList &ctrls)
@@ -1250,9 +1493,7 @@ void IPARPi::applySharpen(const struct SharpenStatus *sharpenStatus, ControlList
 	sharpen.limit.num = 1000 * sharpenStatus->limit;
 	sharpen.limit.den = 1000;
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&sharpen),
-					    sizeof(sharpen) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_SHARPEN, c);
+	setIspTable(V4L2_CID_USER_BCM2835_ISP_SHARPEN, sharpen, ctrls);
 }
 
 void IPARPi::applyDPC(const struct DpcStatus *dpcStatus, ControlList &ctrls)
@@ -1262,9 +1503,7 @@ void IPARPi::applyDPC(const struct DpcStatus *dpcStatus, ControlList &ctrls)
 	dpc.enabled = 1;
 	dpc.strength = dpcStatus->strength;
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&dpc),
-					    sizeof(dpc) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_DPC, c);
+	setIspTable(V4L2_CID_USER_BCM2835_ISP_DPC, dpc, ctrls);
 }
 
 void IPARPi::applyLS(const struct AlscStatus *lsStatus, ControlList &ctrls)
@@ -1309,61 +1548,121 @@ void IPARPi::applyLS(const struct AlscStatus *lsStatus, ControlList &ctrls)
 		return;
 	}
 
-	if (lsStatus) {
+	/*
+	 * The ALSC tables only change while the algorithm is converging, skip
+	 * the resampling when neither they nor the grid have changed since the
+	 * LS table was last written.
+	 */
+	if (lsStatus && (!lsTableValid_ || lsStatus->generation != lsTableGeneration_ ||
+			 w != lsGrid_.width || h != lsGrid_.height)) {
+		if (w != lsGrid_.width || h != lsGrid_.height)
+			setLsGrid(w, h);
+
 		/* Format will be u4.10 */
 		uint16_t *grid = static_cast<uint16_t *>(lsTable_);
 
-		resampleTable(grid, lsStatus->r, w, h);
-		resampleTable(grid + w * h, lsStatus->g, w, h);
+		resampleTable(grid, lsStatus->r);
+		resampleTable(grid + w * h, lsStatus->g);
 		std::memcpy(grid + 2 * w * h, grid + w * h, w * h * sizeof(uint16_t));
-		resampleTable(grid + 3 * w * h, lsStatus->b, w, h);
+		resampleTable(grid + 3 * w * h, lsStatus->b);
+
+		lsTableGeneration_ = lsStatus->generation;
+		lsTableValid_ = true;
+	}
+
+	setIspTable(V4L2_CID_USER_BCM2835_ISP_LENS_SHADING, ls, ctrls);
+}
+
+/*
+ * Precalculate the sampling locations and phases of a width x height corner
+ * sampled grid in the 16x12 centrally sampled ALSC tables. This only depends
+ * on the sensor mode, so it is shared by all the tables resampled for it.
+ */
+void IPARPi::setLsGrid(unsigned int width, unsigned int height)
+{
+	assert(width > 1 && height > 1 &&
+	       width <= lsGrid_.xf.size() && height <= lsGrid_.yf.size());
+
+	lsGrid_.width = width;
+	lsGrid_.height = height;
+
+	double x = -0.5, xInc = 16.0 / (width - 1);
+	for (unsigned int i = 0; i < width; i++, x += xInc) {
+		int xLo = floor(x);
+		lsGrid_.xf[i] = x - xLo;
+		lsGrid_.xHi[i] = xLo < 15 ? xLo + 1 : 15;
+		lsGrid_.xLo[i] = xLo > 0 ? xLo : 0;
 	}
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&ls),
-					    sizeof(ls) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_LENS_SHADING, c);
+	double y = -0.5, yInc = 12.0 / (height - 1);
+	for (unsigned int j = 0; j < height; j++, y += yInc) {
+		int yLo = floor(y);
+		lsGrid_.yf[j] = y - yLo;
+		lsGrid_.yHi[j] = yLo < 11 ? yLo + 1 : 11;
+		lsGrid_.yLo[j] = yLo > 0 ? yLo : 0;
+	}
 }
 
 /*
- * Resamples a 16x12 table with central sampling to destW x destH with corner
+ * Resamples a 16x12 table with central sampling to the LS grid with corner
  * sampling.
  */
-void IPARPi::resampleTable(uint16_t dest[], double const src[12][16],
-			   int destW, int destH)
+void IPARPi::resampleTable(uint16_t dest[], double const src[12][16])
 {
+	const unsigned int destW = lsGrid_.width;
+	const unsigned int destH = lsGrid_.height;
+
 	/*
-	 * Precalculate and cache the x sampling locations and phases to
-	 * save recomputing them on every row.
+	 * Interpolate horizontally once per source row, so that each output
+	 * row only blends two contiguous rows. Both loops are kept free of
+	 * branches and in single precision to let the compiler vectorise them.
 	 */
-	assert(destW > 1 && destH > 1 && destW <= 64);
-	int xLo[64], xHi[64];
-	double xf[64];
-	double x = -0.5, xInc = 16.0 / (destW - 1);
-	for (int i = 0; i < destW; i++, x += xInc) {
-		xLo[i] = floor(x);
-		xf[i] = x - xLo[i];
-		xHi[i] = xLo[i] < 15 ? xLo[i] + 1 : 15;
-		xLo[i] = xLo[i] > 0 ? xLo[i] : 0;
+	float columns[12][64];
+	for (unsigned int y = 0; y < 12; y++) {
+		for (unsigned int i = 0; i < destW; i++) {
+			float lo = src[y][lsGrid_.xLo[i]];
+			float hi = src[y][lsGrid_.xHi[i]];
+			columns[y][i] = lo + (hi - lo) * lsGrid_.xf[i];
+		}
 	}
 
-	/* Now march over the output table generating the new values. */
-	double y = -0.5, yInc = 12.0 / (destH - 1);
-	for (int j = 0; j < destH; j++, y += yInc) {
-		int yLo = floor(y);
-		double yf = y - yLo;
-		int yHi = yLo < 11 ? yLo + 1 : 11;
-		yLo = yLo > 0 ? yLo : 0;
-		double const *rowAbove = src[yLo];
-		double const *rowBelow = src[yHi];
-		for (int i = 0; i < destW; i++) {
-			double above = rowAbove[xLo[i]] * (1 - xf[i]) + rowAbove[xHi[i]] * xf[i];
-			double below = rowBelow[xLo[i]] * (1 - xf[i]) + rowBelow[xHi[i]] * xf[i];
-			int result = floor(1024 * (above * (1 - yf) + below * yf) + .5);
-			*(dest++) = result > 16383 ? 16383 : result; /* want u4.10 */
+	for (unsigned int j = 0; j < destH; j++) {
+		const float *above = columns[lsGrid_.yLo[j]];
+		const float *below = columns[lsGrid_.yHi[j]];
+		const float yf = lsGrid_.yf[j];
+		for (unsigned int i = 0; i < destW; i++) {
+			float value = above[i] + (below[i] - above[i]) * yf;
+			int result = static_cast<int>(1024 * value + 0.5f);
+			*(dest++) = std::min(result, 16383); /* want u4.10 */
 		}
 	}
 }
 
+/*
+ * Write an ISP configuration structure to the tables shared with the pipeline
+ * handler, and pass its generation number in the ISP controls. Fall back to
+ * passing the structure in the controls if the tables are not available.
+ */
+template<typename T>
+void IPARPi::setIspTable(unsigned int id, const T &table, ControlList &ctrls)
+{
+	static_assert(sizeof(T) <= sizeof(RPi::IspTable::data));
+
+	RPi::IspTable *ispTable = RPi::ispTable(ispTables_, id);
+	if (!ispTable) {
+		ControlValue c(Span<const uint8_t>{ reinterpret_cast<const uint8_t *>(&table),
+						    sizeof(table) });
+		ctrls.set(id, c);
+		return;
+	}
+
+	std::memcpy(ispTable->data, &table, sizeof(table));
+	ispTable->size = sizeof(table);
+	ispTable->generation = ispTablesGeneration_;
+
+	ctrls.set(id, static_cast<int32_t>(ispTablesGeneration_));
+}
+
 /*
  * External IPA module interface
  */
@@ -10,11 +10,14 @@
 #include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <vector>
 
 #include <libcamera/base/log.h>
 
 #include <libcamera/ipa/core_ipa_interface.h>
 
+#include "libipa/histogram.h"
+
 /**
  * \file agc.h
  */
@@ -52,6 +55,13 @@ static constexpr uint32_t kNumStartupFrames = 10;
  */
 static constexpr double kRelativeLuminanceTarget = 0.4;
 
+/*
+ * Maximum mean value of the brightest 2% of the histogram, expressed as a
+ * fraction of the histogram range. This upper quantile constraint prevents the
+ * bright regions of the scene from being saturated.
+ */
+static constexpr double kEvGainTarget = 0.5;
+
 Agc::Agc()
 	: frameCount_(0), filteredExposure_(0s)
 {
@@ -64,8 +74,7 @@ Agc::Agc()
  *
  * \return 0
  */
-int Agc::configure(IPAContext &context,
-		   [[maybe_unused]] const IPACameraSensorInfo &configInfo)
+int Agc::configure(IPAContext &context, const IPACameraSensorInfo &configInfo)
 {
 	/* Configure the default exposure and gain. */
 	context.frameContext.agc.gain = std::max(context.configuration.agc.minAnalogueGain, kMinAnalogueGain);
@@ -74,12 +83,27 @@ int Agc::configure(IPAContext &context,
 	/*
 	 * According to the RkISP1 documentation:
 	 * - versions < V12 have RKISP1_CIF_ISP_AE_MEAN_MAX_V10 entries,
-	 * - versions >= V12 have RKISP1_CIF_ISP_AE_MEAN_MAX_V12 entries.
+	 *   RKISP1_CIF_ISP_HIST_BIN_N_MAX_V10 histogram bins and
+	 *   RKISP1_CIF_ISP_HISTOGRAM_WEIGHT_GRIDS_SIZE_V10 histogram weights,
+	 * - versions >= V12 have RKISP1_CIF_ISP_AE_MEAN_MAX_V12 entries,
+	 *   RKISP1_CIF_ISP_HIST_BIN_N_MAX_V12 histogram bins and
+	 *   RKISP1_CIF_ISP_HISTOGRAM_WEIGHT_GRIDS_SIZE_V12 histogram weights.
 	 */
-	if (context.configuration.hw.revision < RKISP1_V12)
+	if (context.configuration.hw.revision < RKISP1_V12) {
 		numCells_ = RKISP1_CIF_ISP_AE_MEAN_MAX_V10;
-	else
+		numHistBins_ = RKISP1_CIF_ISP_HIST_BIN_N_MAX_V10;
+		numHistWeights_ = RKISP1_CIF_ISP_HISTOGRAM_WEIGHT_GRIDS_SIZE_V10;
+	} else {
 		numCells_ = RKISP1_CIF_ISP_AE_MEAN_MAX_V12;
+		numHistBins_ = RKISP1_CIF_ISP_HIST_BIN_N_MAX_V12;
+		numHistWeights_ = RKISP1_CIF_ISP_HISTOGRAM_WEIGHT_GRIDS_SIZE_V12;
+	}
+
+	/* Measure the histogram over the whole frame. */
+	context.configuration.agc.measureWindow.h_offs = 0;
+	context.configuration.agc.measureWindow.v_offs = 0;
+	context.configuration.agc.measureWindow.h_size = configInfo.outputSize.width;
+	context.configuration.agc.measureWindow.v_size = configInfo.outputSize.height;
 
 	/* \todo Use actual frame index by populating it in the frameContext. */
 	frameCount_ = 0;
@@ -239,6 +263,29 @@ double Agc::estimateLuminance(const rkisp1_cif_isp_ae_stat *ae,
 	return ySum / numCells_ / 255;
 }
 
+/**
+ * \brief Estimate the mean value of the brightest regions of the frame
+ * \param[in] hist The RkISP1 histogram statistics
+ *
+ * The histogram bins are stored by the hardware as fixed-point values with 4
+ * fractional bits, which are dropped as the histogram only needs relative
+ * frequencies.
+ *
+ * \return The mean value of the top 2% of the histogram, in bins
+ */
+double Agc::measureBrightness(const rkisp1_cif_isp_hist_stat *hist) const
+{
+	std::vector<uint32_t> bins(numHistBins_);
+	std::transform(hist->hist_bins, hist->hist_bins + numHistBins_,
+		       bins.begin(), [](uint32_t x) { return x >> 4; });
+
+	Histogram histogram{ Span<const uint32_t>(bins) };
+	if (!histogram.total())
+		return 0.0;
+
+	return histogram.interQuantileMean(0.98, 1.0);
+}
+
 /**
  * \brief Process RkISP1 statistics, and run AGC operations
  * \param[in] context The shared IPA context
@@ -246,6 +293,10 @@ double Agc::estimateLuminance(const rkisp1_cif_isp_ae_stat *ae,
  *
  * Identify the current image brightness, and use that to estimate the optimal
  * new exposure and gain for the scene.
+ *
+ * The gain is computed from the AE cell means to reach the relative luminance
+ * target, and is then constrained by the histogram so that the brightest
+ * regions of the frame don't end up saturated.
  */
 void Agc::process(IPAContext &context, const rkisp1_stat_buffer *stats)
 {
@@ -276,15 +327,51 @@ void Agc::process(IPAContext &context, const rkisp1_stat_buffer *stats)
 			break;
 	}
 
+	if (stats->meas_type & RKISP1_CIF_ISP_STAT_HIST) {
+		/*
+		 * Apply the upper quantile constraint: the mean of the top 2%
+		 * of the histogram shall reach at least kEvGainTarget of the
+		 * histogram range.
+		 */
+		double iqMean = measureBrightness(&params->hist);
+		double iqMeanGain = kEvGainTarget * numHistBins_ / (iqMean + .001);
+		LOG(RkISP1Agc, Debug) << "Upper quantile mean: " << iqMean
+				      << ", gives gain " << iqMeanGain;
+
+		yGain = std::max(yGain, std::min(10.0, iqMeanGain));
+	}
+
 	computeExposure(context, yGain);
 	frameCount_++;
 }
 
-void Agc::prepare([[maybe_unused]] IPAContext &context,
-		  rkisp1_params_cfg *params)
+/**
+ * \brief Enable the AEC and histogram measurement modules
+ * \param[in] context The shared IPA context
+ * \param[out] params The RkISP1 parameters buffer
+ *
+ * The measurement configuration doesn't change during the capture session,
+ * and is thus only programmed for the first frame.
+ */
+void Agc::prepare(IPAContext &context, rkisp1_params_cfg *params)
 {
+	if (context.frameContext.frameCount > 0)
+		return;
+
 	params->module_ens |= RKISP1_CIF_ISP_MODULE_AEC;
 	params->module_en_update |= RKISP1_CIF_ISP_MODULE_AEC;
+
+	/* Produce a luminance histogram with equally weighted sub-windows. */
+	rkisp1_cif_isp_hst_config &hst = params->meas.hst_config;
+	hst.mode = RKISP1_CIF_ISP_HISTOGRAM_MODE_Y_HISTOGRAM;
+	hst.meas_window = context.configuration.agc.measureWindow;
+	std::fill(hst.hist_weight, hst.hist_weight + numHistWeights_, 1);
+	/* The step size can't be less than 3. */
+	hst.histogram_predivider = 4;
+
+	params->module_cfg_update |= RKISP1_CIF_ISP_MODULE_HST;
+	params->module_en_update |= RKISP1_CIF_ISP_MODULE_HST;
+	params->module_ens |= RKISP1_CIF_ISP_MODULE_HST;
 }
 
 } /* namespace ipa::rkisp1::algorithms */
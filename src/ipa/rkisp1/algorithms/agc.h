@@ -35,10 +35,13 @@ private:
 	void computeExposure(IPAContext &Context, double yGain);
 	utils::Duration filterExposure(utils::Duration exposureValue);
 	double estimateLuminance(const rkisp1_cif_isp_ae_stat *ae, double gain);
+	double measureBrightness(const rkisp1_cif_isp_hist_stat *hist) const;
 
 	uint64_t frameCount_;
 
 	uint32_t numCells_;
+	uint32_t numHistBins_;
+	uint32_t numHistWeights_;
 
 	utils::Duration filteredExposure_;
 };
@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Ideas On Board
+ *
+ * awb.cpp - AWB control algorithm
+ */
+
+#include "awb.h"
+
+#include <algorithm>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/ipa/core_ipa_interface.h>
+
+/**
+ * \file awb.h
+ */
+
+namespace libcamera {
+
+namespace ipa::rkisp1::algorithms {
+
+/**
+ * \class Awb
+ * \brief A Grey world white balance correction algorithm
+ *
+ * The algorithm uses the YCbCr means measured by the ISP AWB module over a
+ * centered window, converts them to RGB, and computes the red and blue gains
+ * that equalise the colour channels, assuming the scene averages to grey. The
+ * gains are programmed in the ISP AWB gain module, no pixel data is processed
+ * on the CPU.
+ */
+
+LOG_DEFINE_CATEGORY(RkISP1Awb)
+
+/* Speed of the gain filter, to avoid oscillations. */
+static constexpr double kAwbSpeed = 0.2;
+
+/*
+ * Maximum value of the AWB gains, the gains are 10-bit unsigned values with 8
+ * fractional bits.
+ */
+static constexpr double kMaxGain = 1023.0 / 256;
+
+/**
+ * \copydoc libcamera::ipa::Algorithm::configure
+ */
+int Awb::configure(IPAContext &context,
+		   const IPACameraSensorInfo &configInfo)
+{
+	context.frameContext.awb.gains.red = 1.0;
+	context.frameContext.awb.gains.blue = 1.0;
+	context.frameContext.awb.gains.green = 1.0;
+
+	/*
+	 * Define the measurement window for AWB as a centered rectangle
+	 * covering 3/4 of the image width and height.
+	 */
+	context.configuration.awb.measureWindow.h_offs = configInfo.outputSize.width / 8;
+	context.configuration.awb.measureWindow.v_offs = configInfo.outputSize.height / 8;
+	context.configuration.awb.measureWindow.h_size = 3 * configInfo.outputSize.width / 4;
+	context.configuration.awb.measureWindow.v_size = 3 * configInfo.outputSize.height / 4;
+
+	return 0;
+}
+
+/**
+ * \copydoc libcamera::ipa::Algorithm::prepare
+ */
+void Awb::prepare(IPAContext &context, rkisp1_params_cfg *params)
+{
+	const IPAFrameContext &frameContext = context.frameContext;
+	rkisp1_cif_isp_awb_gain_config &gains = params->others.awb_gain_config;
+
+	gains.gain_green_b = 256 * frameContext.awb.gains.green;
+	gains.gain_blue = 256 * frameContext.awb.gains.blue;
+	gains.gain_red = 256 * frameContext.awb.gains.red;
+	gains.gain_green_r = 256 * frameContext.awb.gains.green;
+
+	/* Update the gains. */
+	params->module_cfg_update |= RKISP1_CIF_ISP_MODULE_AWB_GAIN;
+
+	/* If we already have configured the gains and window, return. */
+	if (frameContext.frameCount > 0)
+		return;
+
+	/* Enable the gains. */
+	params->module_en_update |= RKISP1_CIF_ISP_MODULE_AWB_GAIN;
+	params->module_ens |= RKISP1_CIF_ISP_MODULE_AWB_GAIN;
+
+	rkisp1_cif_isp_awb_meas_config &meas = params->meas.awb_meas_config;
+
+	/* Configure the measure window for AWB. */
+	meas.awb_wnd = context.configuration.awb.measureWindow;
+	/* Measure Y, Cr and Cb means. */
+	meas.awb_mode = RKISP1_CIF_ISP_AWB_MODE_YCBCR;
+	/* Reference Cr and Cb. */
+	meas.awb_ref_cb = 128;
+	meas.awb_ref_cr = 128;
+	/* Y values to include are between min_y and max_y only. */
+	meas.min_y = 16;
+	meas.max_y = 250;
+	/* Maximum Cr+Cb value to take into account for awb. */
+	meas.max_csum = 250;
+	/* Minimum Cr and Cb values to take into account. */
+	meas.min_c = 16;
+	/* Number of frames to use to estimate the mean (0 means 1 frame). */
+	meas.frames = 0;
+
+	/* Configure and enable the AWB measurement module. */
+	params->module_cfg_update |= RKISP1_CIF_ISP_MODULE_AWB;
+	params->module_en_update |= RKISP1_CIF_ISP_MODULE_AWB;
+	params->module_ens |= RKISP1_CIF_ISP_MODULE_AWB;
+}
+
+/**
+ * \copydoc libcamera::ipa::Algorithm::process
+ */
+void Awb::process(IPAContext &context, const rkisp1_stat_buffer *stats)
+{
+	/* The AWB measurements are only available once the module runs. */
+	if (!(stats->meas_type & RKISP1_CIF_ISP_STAT_AWB))
+		return;
+
+	const rkisp1_cif_isp_awb_meas &awb = stats->params.awb.awb_mean[0];
+	IPAFrameContext &frameContext = context.frameContext;
+
+	/* No pixel passed the measurement thresholds, keep the current gains. */
+	if (!awb.cnt)
+		return;
+
+	/* Get the YCbCr mean values. */
+	double yMean = awb.mean_y_or_g;
+	double cbMean = awb.mean_cb_or_b;
+	double crMean = awb.mean_cr_or_r;
+
+	/*
+	 * Convert from YCbCr to RGB.
+	 * The hardware uses the following formulas:
+	 * Y = 16 + 0.2500 R + 0.5000 G + 0.1094 B
+	 * Cb = 128 - 0.1406 R - 0.2969 G + 0.4375 B
+	 * Cr = 128 + 0.4375 R - 0.3750 G - 0.0625 B
+	 *
+	 * The inverse matrix is thus:
+	 * [[1,1636, -0,0623,  1,6008]
+	 *  [1,1636, -0,4045, -0,7949]
+	 *  [1,1636,  1,9912, -0,0250]]
+	 */
+	yMean -= 16;
+	cbMean -= 128;
+	crMean -= 128;
+	double redMean = 1.1636 * yMean - 0.0623 * cbMean + 1.6008 * crMean;
+	double greenMean = 1.1636 * yMean - 0.4045 * cbMean - 0.7949 * crMean;
+	double blueMean = 1.1636 * yMean + 1.9912 * cbMean - 0.0250 * crMean;
+
+	/*
+	 * The ISP measures the means after applying the AWB gains, divide by
+	 * the gains programmed for the frame to get the sensor means.
+	 */
+	redMean /= frameContext.awb.gains.red;
+	greenMean /= frameContext.awb.gains.green;
+	blueMean /= frameContext.awb.gains.blue;
+
+	/* Estimate the red and blue gains to apply in a grey world. */
+	double redGain = greenMean / (std::max(redMean, 0.0) + 1);
+	double blueGain = greenMean / (std::max(blueMean, 0.0) + 1);
+
+	/* Filter the values to avoid oscillations. */
+	redGain = kAwbSpeed * redGain + (1 - kAwbSpeed) * frameContext.awb.gains.red;
+	blueGain = kAwbSpeed * blueGain + (1 - kAwbSpeed) * frameContext.awb.gains.blue;
+
+	frameContext.awb.gains.red = std::clamp(redGain, 0.0, kMaxGain);
+	frameContext.awb.gains.blue = std::clamp(blueGain, 0.0, kMaxGain);
+	/* Hardcode the green gain to 1.0. */
+	frameContext.awb.gains.green = 1.0;
+
+	LOG(RkISP1Awb, Debug) << "Gain found for red: " << frameContext.awb.gains.red
+			      << " and for blue: " << frameContext.awb.gains.blue;
+}
+
+} /* namespace ipa::rkisp1::algorithms */
+
+} /* namespace libcamera */
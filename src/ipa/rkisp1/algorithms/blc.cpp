@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Ideas On Board
+ *
+ * blc.cpp - RkISP1 Black Level Correction control
+ */
+
+#include "blc.h"
+
+/**
+ * \file blc.h
+ */
+
+namespace libcamera {
+
+namespace ipa::rkisp1::algorithms {
+
+/**
+ * \class BlackLevelCorrection
+ * \brief RkISP1 Black Level Correction control
+ *
+ * The pixels output by the camera normally include a black level, because
+ * sensors do not always report a signal level of '0' for black. Pixels at or
+ * below this level should be considered black. To achieve that, the RkISP BLC
+ * algorithm subtracts a configurable offset from all pixels.
+ *
+ * The black level is subtracted before the AWB gains are applied and before
+ * the statistics are measured, so that both operate on linear pixel values.
+ */
+
+/**
+ * \copydoc libcamera::ipa::Algorithm::prepare
+ */
+void BlackLevelCorrection::prepare(IPAContext &context,
+				   rkisp1_params_cfg *params)
+{
+	/* The black level doesn't change, program it for the first frame only. */
+	if (context.frameContext.frameCount > 0)
+		return;
+
+	/*
+	 * Subtract fixed values taken from the imx219 tuning file, expressed
+	 * on 12 bits.
+	 * \todo Use a tuning file for it
+	 */
+	params->others.bls_config.enable_auto = 0;
+	params->others.bls_config.fixed_val.r = 256;
+	params->others.bls_config.fixed_val.gr = 256;
+	params->others.bls_config.fixed_val.gb = 256;
+	params->others.bls_config.fixed_val.b = 256;
+
+	params->module_en_update |= RKISP1_CIF_ISP_MODULE_BLS;
+	params->module_ens |= RKISP1_CIF_ISP_MODULE_BLS;
+	params->module_cfg_update |= RKISP1_CIF_ISP_MODULE_BLS;
+}
+
+} /* namespace ipa::rkisp1::algorithms */
+
+} /* namespace libcamera */
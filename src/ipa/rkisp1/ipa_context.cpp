@@ -71,6 +71,15 @@ namespace libcamera::ipa::rkisp1 {
  * \var IPASessionConfiguration::agc.maxAnalogueGain
  * \brief Maximum analogue gain supported with the configured sensor
  *
+ * \var IPASessionConfiguration::agc.measureWindow
+ * \brief AGC histogram measure window
+ *
+ * \var IPASessionConfiguration::awb
+ * \brief AWB parameters configuration of the IPA
+ *
+ * \var IPASessionConfiguration::awb.measureWindow
+ * \brief AWB means measure window
+ *
  * \var IPASessionConfiguration::hw
  * \brief RkISP1-specific hardware information
  *
@@ -86,6 +95,16 @@ namespace libcamera::ipa::rkisp1 {
  * \brief Line duration in microseconds
  */
 
+/**
+ * \var IPAFrameContext::frameCount
+ * \brief Number of frames whose parameters have been prepared since start
+ *
+ * The ISP driver only applies the parameter blocks flagged as updated in a
+ * parameters buffer, and retains the other blocks from the previous frames.
+ * Algorithms program their static ISP configuration when the frame count is
+ * zero only, and then update the blocks that change.
+ */
+
 /**
  * \var IPAFrameContext::agc
  * \brief Context for the Automatic Gain Control algorithm
@@ -102,6 +121,23 @@ namespace libcamera::ipa::rkisp1 {
  * The gain should be adapted to the sensor specific gain code before applying.
  */
 
+/**
+ * \var IPAFrameContext::awb
+ * \brief Context for the Automatic White Balance algorithm
+ *
+ * \struct IPAFrameContext::awb.gains
+ * \brief White balance gains
+ *
+ * \var IPAFrameContext::awb.gains.red
+ * \brief White balance gain for R channel
+ *
+ * \var IPAFrameContext::awb.gains.green
+ * \brief White balance gain for G channel
+ *
+ * \var IPAFrameContext::awb.gains.blue
+ * \brief White balance gain for B channel
+ */
+
 /**
  * \var IPAFrameContext::sensor
  * \brief Effective sensor values
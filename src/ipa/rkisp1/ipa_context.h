@@ -22,8 +22,13 @@ struct IPASessionConfiguration {
 		utils::Duration maxShutterSpeed;
 		double minAnalogueGain;
 		double maxAnalogueGain;
+		struct rkisp1_cif_isp_window measureWindow;
 	} agc;
 
+	struct {
+		struct rkisp1_cif_isp_window measureWindow;
+	} awb;
+
 	struct {
 		utils::Duration lineDuration;
 	} sensor;
@@ -34,11 +39,21 @@ struct IPASessionConfiguration {
 };
 
 struct IPAFrameContext {
+	unsigned int frameCount;
+
 	struct {
 		uint32_t exposure;
 		double gain;
 	} agc;
 
+	struct {
+		struct {
+			double red;
+			double green;
+			double blue;
+		} gains;
+	} awb;
+
 	struct {
 		uint32_t exposure;
 		double gain;
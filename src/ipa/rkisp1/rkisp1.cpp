@@ -27,7 +27,10 @@
 
 #include "algorithms/agc.h"
 #include "algorithms/algorithm.h"
+#include "algorithms/awb.h"
+#include "algorithms/blc.h"
 #include "libipa/camera_sensor_helper.h"
+#include "libipa/converged_state.h"
 
 #include "ipa_context.h"
 
@@ -43,7 +46,7 @@ class IPARkISP1 : public IPARkISP1Interface
 {
 public:
 	int init(const IPASettings &settings, unsigned int hwRevision) override;
-	int start() override;
+	int start(const ControlList &controls) override;
 	void stop() override {}
 
 	int configure(const IPACameraSensorInfo &info,
@@ -60,6 +63,7 @@ private:
 			      const rkisp1_stat_buffer *stats);
 
 	void setControls(unsigned int frame);
+	void restoreConvergedState(Span<const uint8_t> data);
 	void metadataReady(unsigned int frame, unsigned int aeState);
 
 	std::map<unsigned int, FrameBuffer> buffers_;
@@ -126,12 +130,20 @@ int IPARkISP1::init(const IPASettings &settings, unsigned int hwRevision)
 
 	/* Construct our Algorithms */
 	algorithms_.push_back(std::make_unique<algorithms::Agc>());
+	algorithms_.push_back(std::make_unique<algorithms::Awb>());
+	algorithms_.push_back(std::make_unique<algorithms::BlackLevelCorrection>());
 
 	return 0;
 }
 
-int IPARkISP1::start()
+int IPARkISP1::start(const ControlList &controls)
 {
+	/* The ISP configuration is reset when streaming starts. */
+	context_.frameContext.frameCount = 0;
+
+	if (controls.contains(controls::CONVERGED_STATE))
+		restoreConvergedState(controls.get(controls::draft::ConvergedState));
+
 	setControls(0);
 
 	return 0;
@@ -274,12 +286,21 @@ void IPARkISP1::processEvent(const RkISP1Event &event)
 void IPARkISP1::queueRequest(unsigned int frame, rkisp1_params_cfg *params,
 			     [[maybe_unused]] const ControlList &controls)
 {
-	/* Prepare parameters buffer. */
-	memset(params, 0, sizeof(*params));
+	/*
+	 * Prepare the parameters buffer. The driver only applies the blocks
+	 * flagged in the update fields, clear them and let the algorithms fill
+	 * and flag the blocks they change instead of rewriting the whole
+	 * buffer.
+	 */
+	params->module_en_update = 0;
+	params->module_ens = 0;
+	params->module_cfg_update = 0;
 
 	for (auto const &algo : algorithms_)
 		algo->prepare(context_, params);
 
+	context_.frameContext.frameCount++;
+
 	RkISP1Action op;
 	op.op = ActionParamFilled;
 
@@ -315,6 +336,30 @@ void IPARkISP1::setControls(unsigned int frame)
 	queueFrameAction.emit(frame, op);
 }
 
+void IPARkISP1::restoreConvergedState(Span<const uint8_t> data)
+{
+	std::optional<ConvergedState> state = ConvergedState::deserialize(data);
+	if (!state)
+		return;
+
+	const IPASessionConfiguration &configuration = context_.configuration;
+	IPAFrameContext &frameContext = context_.frameContext;
+
+	utils::Duration exposureTime =
+		std::clamp(state->exposureTime, configuration.agc.minShutterSpeed,
+			   configuration.agc.maxShutterSpeed);
+	frameContext.agc.exposure = exposureTime / configuration.sensor.lineDuration;
+	frameContext.agc.gain = std::clamp(state->analogueGain,
+					   configuration.agc.minAnalogueGain,
+					   configuration.agc.maxAnalogueGain);
+
+	frameContext.awb.gains.red = state->redGain;
+	frameContext.awb.gains.green = 1.0;
+	frameContext.awb.gains.blue = state->blueGain;
+
+	LOG(IPARkISP1, Debug) << "Restored converged state";
+}
+
 void IPARkISP1::metadataReady(unsigned int frame, unsigned int aeState)
 {
 	ControlList ctrls(controls::controls);
@@ -322,6 +367,18 @@ void IPARkISP1::metadataReady(unsigned int frame, unsigned int aeState)
 	if (aeState)
 		ctrls.set(controls::AeLocked, aeState == 2);
 
+	/* The colour temperature isn't estimated, report it as unknown. */
+	const IPAFrameContext &frameContext = context_.frameContext;
+	ConvergedState state;
+	state.exposureTime = frameContext.agc.exposure * context_.configuration.sensor.lineDuration;
+	state.analogueGain = frameContext.agc.gain;
+	state.redGain = frameContext.awb.gains.red / frameContext.awb.gains.green;
+	state.blueGain = frameContext.awb.gains.blue / frameContext.awb.gains.green;
+	state.colourTemperature = 0.0;
+
+	std::vector<uint8_t> stateData = state.serialize();
+	ctrls.set(controls::draft::ConvergedState, Span<const uint8_t>(stateData));
+
 	RkISP1Action op;
 	op.op = ActionMetadata;
 	op.controls = ctrls;
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * allocation_counter.cpp - Count the memory allocations of the process
+ */
+
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+namespace {
+
+std::atomic<uint64_t> allocations{ 0 };
+
+} /* namespace */
+
+uint64_t allocationCount()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+/*
+ * Replace the global allocation functions to count the allocations of the
+ * whole process, including the ones made by libcamera and its threads. The
+ * malloc hooks have been removed from glibc, and libcamera allocates through
+ * the C++ allocator, so counting here covers the capture path. The array and
+ * nothrow variants call these functions.
+ */
+void *operator new(std::size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, [[maybe_unused]] std::size_t size) noexcept
+{
+	free(ptr);
+}
@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * allocation_counter.h - Count the memory allocations of the process
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+uint64_t allocationCount();
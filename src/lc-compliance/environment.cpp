@@ -20,3 +20,15 @@ void Environment::setup(CameraManager *cm, std::string cameraId)
 	cm_ = cm;
 	cameraId_ = cameraId;
 }
+
+void Environment::setPerformance(std::chrono::seconds duration,
+				 std::string reportFile)
+{
+	captureDuration_ = duration;
+	reportFile_ = reportFile;
+}
+
+void Environment::setSoak(std::chrono::seconds duration)
+{
+	soakDuration_ = duration;
+}
@@ -7,6 +7,9 @@
 
 #pragma once
 
+#include <chrono>
+#include <string>
+
 #include <libcamera/libcamera.h>
 
 class Environment
@@ -16,12 +19,25 @@ public:
 
 	void setup(libcamera::CameraManager *cm, std::string cameraId);
 
+	void setPerformance(std::chrono::seconds duration, std::string reportFile);
+	void setSoak(std::chrono::seconds duration);
+
 	const std::string &cameraId() const { return cameraId_; }
 	libcamera::CameraManager *cm() const { return cm_; }
 
+	std::chrono::seconds captureDuration() const { return captureDuration_; }
+	const std::string &reportFile() const { return reportFile_; }
+
+	std::chrono::seconds soakDuration() const { return soakDuration_; }
+
 private:
 	Environment() = default;
 
 	std::string cameraId_;
 	libcamera::CameraManager *cm_;
+
+	std::chrono::seconds captureDuration_{ 0 };
+	std::string reportFile_;
+
+	std::chrono::seconds soakDuration_{ 0 };
 };
@@ -6,6 +6,7 @@
  * main.cpp - lc-compliance - The libcamera compliance tool
  */
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <string.h>
@@ -21,9 +22,12 @@ using namespace libcamera;
 
 enum {
 	OptCamera = 'c',
+	OptDuration = 'd',
 	OptList = 'l',
 	OptFilter = 'f',
 	OptHelp = 'h',
+	OptReport = 'r',
+	OptSoak = 's',
 };
 
 /*
@@ -74,6 +78,14 @@ static int initCamera(CameraManager *cm, OptionsParser::Options options)
 
 	Environment::get()->setup(cm, cameraId);
 
+	int duration = options.isSet(OptDuration) ? options[OptDuration].toInteger() : 0;
+	std::string report = options.isSet(OptReport) ? options[OptReport].toString() : "";
+	Environment::get()->setPerformance(std::chrono::seconds(std::max(duration, 0)),
+					   report);
+
+	int soak = options.isSet(OptSoak) ? options[OptSoak].toInteger() : 0;
+	Environment::get()->setSoak(std::chrono::seconds(std::max(soak, 0)));
+
 	std::cout << "Using camera " << cameraId << std::endl;
 
 	return 0;
@@ -141,12 +153,21 @@ static int parseOptions(int argc, char **argv, OptionsParser::Options *options)
 	parser.addOption(OptCamera, OptionString,
 			 "Specify which camera to operate on, by id", "camera",
 			 ArgumentRequired, "camera");
+	parser.addOption(OptDuration, OptionInteger,
+			 "Run the performance tests, capturing for the given duration in seconds",
+			 "duration", ArgumentRequired, "seconds");
 	parser.addOption(OptList, OptionNone, "List all tests and exit", "list");
 	parser.addOption(OptFilter, OptionString,
 			 "Specify which tests to run", "filter",
 			 ArgumentRequired, "filter");
 	parser.addOption(OptHelp, OptionNone, "Display this help message",
 			 "help");
+	parser.addOption(OptReport, OptionString,
+			 "Write the performance test results to a JSON file",
+			 "report", ArgumentRequired, "file");
+	parser.addOption(OptSoak, OptionInteger,
+			 "Run the soak test, cycling the camera for the given duration in seconds",
+			 "soak", ArgumentRequired, "seconds");
 
 	*options = parser.parse(argc, argv);
 	if (!options->valid())
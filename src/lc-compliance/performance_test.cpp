@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * performance_test.cpp - Test camera capture performance
+ */
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "environment.h"
+#include "simple_capture.h"
+
+using namespace libcamera;
+
+namespace {
+
+const std::vector<StreamRole> PERFORMANCE_ROLES = { Raw, StillCapture, VideoRecording, Viewfinder };
+
+const std::map<StreamRole, std::string> ROLE_NAMES = { { Raw, "Raw" },
+						       { StillCapture, "StillCapture" },
+						       { VideoRecording, "VideoRecording" },
+						       { Viewfinder, "Viewfinder" } };
+
+/*
+ * Collect the results of all performance tests, and write them to the report
+ * file once all tests have run.
+ */
+class PerformanceReport : public testing::Environment
+{
+public:
+	static void add(const std::string &name, const std::string &json)
+	{
+		results_.emplace_back(name, json);
+	}
+
+	void TearDown() override
+	{
+		const std::string &file = ::Environment::get()->reportFile();
+		if (file.empty() || results_.empty())
+			return;
+
+		std::ofstream out(file);
+		if (!out) {
+			std::cerr << "Failed to open report file " << file << std::endl;
+			return;
+		}
+
+		out << "{" << std::endl
+		    << "  \"camera\": \"" << ::Environment::get()->cameraId() << "\"," << std::endl
+		    << "  \"tests\": {" << std::endl;
+
+		for (auto it = results_.begin(); it != results_.end(); ++it) {
+			out << "    \"" << it->first << "\": " << it->second;
+			if (std::next(it) != results_.end())
+				out << ",";
+			out << std::endl;
+		}
+
+		out << "  }" << std::endl
+		    << "}" << std::endl;
+	}
+
+private:
+	static std::vector<std::pair<std::string, std::string>> results_;
+};
+
+std::vector<std::pair<std::string, std::string>> PerformanceReport::results_;
+
+[[maybe_unused]] testing::Environment *const performanceReport =
+	testing::AddGlobalTestEnvironment(new PerformanceReport);
+
+} /* namespace */
+
+class Performance : public testing::TestWithParam<StreamRole>
+{
+public:
+	static std::string nameParameters(const testing::TestParamInfo<Performance::ParamType> &info);
+
+protected:
+	void SetUp() override;
+	void TearDown() override;
+
+	std::shared_ptr<Camera> camera_;
+};
+
+void Performance::SetUp()
+{
+	Environment *env = Environment::get();
+
+	if (!env->captureDuration().count())
+		GTEST_SKIP() << "Performance tests require a capture duration";
+
+	camera_ = env->cm()->get(env->cameraId());
+
+	ASSERT_EQ(camera_->acquire(), 0);
+}
+
+void Performance::TearDown()
+{
+	if (!camera_)
+		return;
+
+	camera_->release();
+	camera_.reset();
+}
+
+std::string Performance::nameParameters(const testing::TestParamInfo<Performance::ParamType> &info)
+{
+	return ROLE_NAMES.at(info.param);
+}
+
+/*
+ * Test sustained capture performance
+ *
+ * Capture continuously for the configured duration, keeping all buffers
+ * queued, and report the achieved frame rate, the frame interval jitter, the
+ * request latency, the number of frames dropped by the camera, and the CPU time
+ * and memory allocations per frame. The only failure condition is requests
+ * completing with an error, the performance figures are meant to be compared
+ * with a baseline.
+ */
+TEST_P(Performance, SustainedCapture)
+{
+	StreamRole role = GetParam();
+
+	SimpleCapturePerformance capture(camera_);
+
+	capture.configure(role);
+
+	capture.capture(Environment::get()->captureDuration());
+
+	const SimpleCapturePerformance::Results &results = capture.results();
+
+	std::cout << std::fixed << std::setprecision(2)
+		  << ROLE_NAMES.at(role) << ": " << results.frames << " frames in "
+		  << results.duration << "s, " << results.fps << " fps, interval "
+		  << results.intervalMean << "us +/- " << results.intervalStdDev
+		  << "us (max " << results.intervalMax << "us), latency p50/p90/p99/max "
+		  << results.latencyP50 << "/" << results.latencyP90 << "/"
+		  << results.latencyP99 << "/" << results.latencyMax << "us, "
+		  << results.dropped << " dropped, " << results.cpuPerFrame
+		  << "us CPU per frame, " << results.allocationsPerFrame
+		  << " allocations per frame" << std::endl;
+
+	const testing::TestInfo *info = testing::UnitTest::GetInstance()->current_test_info();
+	PerformanceReport::add(std::string(info->test_suite_name()) + "." + info->name(),
+			       results.toJson());
+
+	EXPECT_EQ(results.failed, 0u) << "Requests completed with errors";
+}
+
+INSTANTIATE_TEST_SUITE_P(PerformanceTests,
+			 Performance,
+			 testing::ValuesIn(PERFORMANCE_ROLES),
+			 Performance::nameParameters);
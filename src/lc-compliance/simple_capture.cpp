@@ -5,8 +5,16 @@
  * simple_capture.cpp - Simple capture helper
  */
 
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+#include <time.h>
+
 #include <gtest/gtest.h>
 
+#include "allocation_counter.h"
 #include "simple_capture.h"
 
 using namespace libcamera;
@@ -189,3 +197,199 @@ void SimpleCaptureUnbalanced::requestComplete(Request *request)
 	if (camera_->queueRequest(request))
 		loop_->exit(-EINVAL);
 }
+
+/* SimpleCapturePerformance */
+
+namespace {
+
+double cpuTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double percentile(std::vector<double> &values, unsigned int p)
+{
+	if (values.empty())
+		return 0.0;
+
+	auto it = values.begin() + (values.size() - 1) * p / 100;
+	std::nth_element(values.begin(), it, values.end());
+	return *it;
+}
+
+} /* namespace */
+
+std::string SimpleCapturePerformance::Results::toJson() const
+{
+	std::stringstream ss;
+
+	ss << std::fixed << std::setprecision(3)
+	   << "{ \"frames\": " << frames
+	   << ", \"failed\": " << failed
+	   << ", \"dropped\": " << dropped
+	   << ", \"duration_s\": " << duration
+	   << ", \"fps\": " << fps
+	   << ", \"interval_us\": { \"mean\": " << intervalMean
+	   << ", \"stddev\": " << intervalStdDev
+	   << ", \"max\": " << intervalMax << " }"
+	   << ", \"latency_us\": { \"p50\": " << latencyP50
+	   << ", \"p90\": " << latencyP90
+	   << ", \"p99\": " << latencyP99
+	   << ", \"max\": " << latencyMax << " }"
+	   << ", \"cpu_per_frame_us\": " << cpuPerFrame
+	   << ", \"allocations_per_frame\": " << allocationsPerFrame << " }";
+
+	return ss.str();
+}
+
+SimpleCapturePerformance::SimpleCapturePerformance(std::shared_ptr<Camera> camera)
+	: SimpleCapture(camera)
+{
+}
+
+void SimpleCapturePerformance::capture(std::chrono::milliseconds duration)
+{
+	Results &results = results_;
+	results = {};
+
+	start();
+
+	Stream *stream = config_->at(0).stream();
+	const std::vector<std::unique_ptr<FrameBuffer>> &buffers = allocator_->buffers(stream);
+
+	stopping_ = false;
+	queued_ = 0;
+	failed_ = 0;
+	allocationsStart_ = 0;
+	allocationsEnd_ = 0;
+	queueTimes_.clear();
+	latencies_.clear();
+	timestamps_.clear();
+	sequences_.clear();
+
+	std::vector<std::unique_ptr<libcamera::Request>> requests;
+	for (const std::unique_ptr<FrameBuffer> &buffer : buffers) {
+		std::unique_ptr<Request> request = camera_->createRequest();
+		ASSERT_TRUE(request) << "Can't create request";
+
+		ASSERT_EQ(request->addBuffer(stream, buffer.get()), 0) << "Can't set buffer for request";
+
+		requests.push_back(std::move(request));
+	}
+
+	double cpuStart = cpuTime();
+	end_ = Clock::now() + duration;
+
+	/* Queue all the requests, they are requeued until the end. */
+	for (const std::unique_ptr<Request> &request : requests)
+		ASSERT_EQ(queueRequest(request.get()), 0) << "Failed to queue request";
+
+	/* Run capture session. */
+	loop_ = new EventLoop();
+	int status = loop_->exec();
+	stop();
+	delete loop_;
+
+	double cpuEnd = cpuTime();
+
+	ASSERT_EQ(status, 0);
+
+	/* Compute the results. */
+	results.frames = timestamps_.size();
+	results.failed = failed_;
+
+	for (unsigned int i = 1; i < sequences_.size(); i++) {
+		if (sequences_[i] > sequences_[i - 1] + 1)
+			results.dropped += sequences_[i] - sequences_[i - 1] - 1;
+	}
+
+	std::vector<double> intervals;
+	for (unsigned int i = 1; i < timestamps_.size(); i++)
+		intervals.push_back((timestamps_[i] - timestamps_[i - 1]) / 1000.0);
+
+	if (!intervals.empty()) {
+		double sum = std::accumulate(intervals.begin(), intervals.end(), 0.0);
+		double mean = sum / intervals.size();
+		double variance = 0.0;
+		for (double interval : intervals)
+			variance += (interval - mean) * (interval - mean);
+
+		results.duration = sum / 1e6;
+		results.fps = intervals.size() / results.duration;
+		results.intervalMean = mean;
+		results.intervalStdDev = std::sqrt(variance / intervals.size());
+		results.intervalMax = *std::max_element(intervals.begin(), intervals.end());
+	}
+
+	if (!latencies_.empty()) {
+		results.latencyMax = *std::max_element(latencies_.begin(), latencies_.end());
+		results.latencyP50 = percentile(latencies_, 50);
+		results.latencyP90 = percentile(latencies_, 90);
+		results.latencyP99 = percentile(latencies_, 99);
+	}
+
+	if (results.frames)
+		results.cpuPerFrame = (cpuEnd - cpuStart) * 1e6 / results.frames;
+
+	if (results.frames > kWarmupFrames)
+		results.allocationsPerFrame =
+			static_cast<double>(allocationsEnd_ - allocationsStart_) /
+			(results.frames - kWarmupFrames);
+}
+
+int SimpleCapturePerformance::queueRequest(Request *request)
+{
+	queueTimes_[request] = Clock::now();
+	queued_++;
+
+	return camera_->queueRequest(request);
+}
+
+void SimpleCapturePerformance::requestComplete(Request *request)
+{
+	Clock::time_point now = Clock::now();
+
+	auto it = queueTimes_.find(request);
+	if (it != queueTimes_.end()) {
+		latencies_.push_back(std::chrono::duration<double, std::micro>(now - it->second).count());
+		queueTimes_.erase(it);
+	}
+
+	queued_--;
+
+	if (request->status() == Request::RequestComplete) {
+		const FrameMetadata &metadata =
+			request->buffers().begin()->second->metadata();
+		timestamps_.push_back(metadata.timestamp);
+		sequences_.push_back(metadata.sequence);
+
+		/*
+		 * Count the allocations made by the whole process in steady
+		 * state, once the first frames have been captured.
+		 */
+		if (timestamps_.size() == kWarmupFrames)
+			allocationsStart_ = allocationCount();
+		allocationsEnd_ = allocationCount();
+	} else if (!stopping_) {
+		failed_++;
+	}
+
+	/*
+	 * Once the duration has elapsed, stop requeuing requests and wait for
+	 * the queued ones to complete, to measure all of them.
+	 */
+	if (now >= end_)
+		stopping_ = true;
+
+	if (stopping_) {
+		if (!queued_)
+			loop_->exit(0);
+		return;
+	}
+
+	request->reuse(Request::ReuseBuffers);
+	if (queueRequest(request))
+		loop_->exit(-EINVAL);
+}
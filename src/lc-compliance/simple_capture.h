@@ -7,7 +7,11 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <libcamera/libcamera.h>
 
@@ -63,3 +67,56 @@ private:
 	unsigned int captureCount_;
 	unsigned int captureLimit_;
 };
+
+class SimpleCapturePerformance : public SimpleCapture
+{
+public:
+	struct Results {
+		std::string toJson() const;
+
+		unsigned int frames;
+		unsigned int failed;
+		unsigned int dropped;
+		double duration;
+		double fps;
+		double intervalMean;
+		double intervalStdDev;
+		double intervalMax;
+		double latencyP50;
+		double latencyP90;
+		double latencyP99;
+		double latencyMax;
+		double cpuPerFrame;
+		double allocationsPerFrame;
+	};
+
+	SimpleCapturePerformance(std::shared_ptr<libcamera::Camera> camera);
+
+	void capture(std::chrono::milliseconds duration);
+
+	const Results &results() const { return results_; }
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	/* Frames completed before measuring steady state allocations. */
+	static constexpr unsigned int kWarmupFrames = 10;
+
+	int queueRequest(libcamera::Request *request);
+	void requestComplete(libcamera::Request *request) override;
+
+	Clock::time_point end_;
+	bool stopping_;
+	unsigned int queued_;
+
+	std::unordered_map<libcamera::Request *, Clock::time_point> queueTimes_;
+	std::vector<double> latencies_;
+	std::vector<uint64_t> timestamps_;
+	std::vector<unsigned int> sequences_;
+	unsigned int failed_;
+
+	uint64_t allocationsStart_;
+	uint64_t allocationsEnd_;
+
+	Results results_;
+};
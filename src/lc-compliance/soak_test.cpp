@@ -0,0 +1,224 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * soak_test.cpp - Test camera resource usage over long runs
+ */
+
+#include <chrono>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "environment.h"
+#include "simple_capture.h"
+
+using namespace libcamera;
+
+namespace {
+
+const std::vector<StreamRole> SOAK_ROLES = { Viewfinder, VideoRecording, StillCapture, Raw };
+
+const std::map<StreamRole, std::string> SOAK_ROLE_NAMES = { { Raw, "Raw" },
+							    { StillCapture, "StillCapture" },
+							    { VideoRecording, "VideoRecording" },
+							    { Viewfinder, "Viewfinder" } };
+
+/* Capture duration of each start/stop cycle. */
+constexpr std::chrono::seconds kCycleDuration{ 5 };
+
+/*
+ * Drift thresholds, relative to the baseline sampled once all roles have been
+ * cycled once. File descriptors and dmabufs must be returned when the camera
+ * is stopped, the small fd margin accounts for lazily opened files such as
+ * log outputs. The RSS margin accounts for allocator fragmentation.
+ */
+constexpr unsigned int kFdMargin = 4;
+constexpr unsigned int kDmabufMargin = 0;
+constexpr uint64_t kRssMargin = 16 << 20;
+constexpr double kLatencyDrift = 1.5;
+
+struct Sample {
+	uint64_t rss;
+	unsigned int fds;
+	unsigned int dmabufs;
+};
+
+uint64_t residentSetSize()
+{
+	std::ifstream statm("/proc/self/statm");
+	uint64_t size = 0;
+	uint64_t resident = 0;
+
+	statm >> size >> resident;
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * Count the open file descriptors of the process, and the dmabufs among them.
+ * The descriptor used to list the directory isn't counted.
+ */
+void countFds(Sample *sample)
+{
+	sample->fds = 0;
+	sample->dmabufs = 0;
+
+	DIR *dir = opendir("/proc/self/fd");
+	if (!dir)
+		return;
+
+	struct dirent *entry;
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] == '.')
+			continue;
+
+		if (atoi(entry->d_name) == dirfd(dir))
+			continue;
+
+		sample->fds++;
+
+		std::string path = std::string("/proc/self/fd/") + entry->d_name;
+		char target[64] = {};
+		ssize_t ret = readlink(path.c_str(), target, sizeof(target) - 1);
+		if (ret < 0)
+			continue;
+
+		if (!strncmp(target, "/dmabuf:", 8) ||
+		    !strncmp(target, "anon_inode:dmabuf", 17))
+			sample->dmabufs++;
+	}
+
+	closedir(dir);
+}
+
+Sample sampleResources()
+{
+	Sample sample;
+
+	sample.rss = residentSetSize();
+	countFds(&sample);
+
+	return sample;
+}
+
+} /* namespace */
+
+class Soak : public testing::Test
+{
+protected:
+	void SetUp() override;
+	void TearDown() override;
+
+	std::shared_ptr<Camera> camera_;
+};
+
+void Soak::SetUp()
+{
+	Environment *env = Environment::get();
+
+	if (!env->soakDuration().count())
+		GTEST_SKIP() << "Soak test requires a soak duration";
+
+	camera_ = env->cm()->get(env->cameraId());
+
+	ASSERT_EQ(camera_->acquire(), 0);
+}
+
+void Soak::TearDown()
+{
+	if (!camera_)
+		return;
+
+	camera_->release();
+	camera_.reset();
+}
+
+/*
+ * Test resource usage over long runs
+ *
+ * Cycle the camera through configure, start, capture and stop for the soak
+ * duration, switching stream role on every cycle. After each cycle, sample the
+ * process RSS and its open file descriptors and dmabufs, and fail when they
+ * drift beyond thresholds from the baseline sampled once all roles have been
+ * cycled. Also fail when the median request latency of a role drifts from its
+ * first cycle, or when requests complete with errors. The allocations per
+ * frame in steady state are reported for each cycle.
+ */
+TEST_F(Soak, StartStopCapture)
+{
+	std::vector<StreamRole> roles;
+	for (StreamRole role : SOAK_ROLES) {
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ role });
+		if (config && config->validate() != CameraConfiguration::Invalid)
+			roles.push_back(role);
+	}
+
+	if (roles.empty())
+		GTEST_SKIP() << "No stream role supported by camera";
+
+	using Clock = std::chrono::steady_clock;
+	const Clock::time_point end = Clock::now() + Environment::get()->soakDuration();
+
+	std::map<StreamRole, double> baselineLatency;
+	Sample baseline = {};
+
+	for (unsigned int cycle = 0; Clock::now() < end; ++cycle) {
+		StreamRole role = roles[cycle % roles.size()];
+		SimpleCapturePerformance::Results results;
+
+		{
+			SimpleCapturePerformance capture(camera_);
+
+			capture.configure(role);
+			capture.capture(kCycleDuration);
+
+			results = capture.results();
+		}
+
+		Sample current = sampleResources();
+
+		std::cout << std::fixed << std::setprecision(2)
+			  << "cycle " << cycle << " " << SOAK_ROLE_NAMES.at(role)
+			  << ": " << results.frames << " frames, rss "
+			  << (current.rss >> 10) << " KiB, " << current.fds
+			  << " fds, " << current.dmabufs << " dmabufs, latency p50 "
+			  << results.latencyP50 << "us, " << results.allocationsPerFrame
+			  << " allocations per frame" << std::endl;
+
+		ASSERT_EQ(results.failed, 0u) << "Requests completed with errors";
+
+		auto latency = baselineLatency.find(role);
+		if (latency == baselineLatency.end()) {
+			baselineLatency[role] = results.latencyP50;
+		} else {
+			EXPECT_LE(results.latencyP50, latency->second * kLatencyDrift)
+				<< "Request latency drifted for cycle " << cycle;
+		}
+
+		/* Sample the baseline once all roles have been cycled. */
+		if (cycle + 1 < roles.size())
+			continue;
+
+		if (cycle + 1 == roles.size()) {
+			baseline = current;
+			continue;
+		}
+
+		ASSERT_LE(current.fds, baseline.fds + kFdMargin)
+			<< "File descriptors leaked after " << cycle << " cycles";
+		ASSERT_LE(current.dmabufs, baseline.dmabufs + kDmabufMargin)
+			<< "Dmabufs leaked after " << cycle << " cycles";
+		ASSERT_LE(current.rss, baseline.rss + kRssMargin)
+			<< "Memory usage grew after " << cycle << " cycles";
+	}
+}
@@ -55,17 +55,16 @@ namespace libcamera {
  * \param[in] deleteMethod True to delete \a this bound method instance when
  * method invocation completes
  *
- * The bound method stores its return value, if any, in the arguments \a pack.
- * For direct and blocking invocations, this is performed synchronously, and
- * the return value contained in the pack may be used. For queued invocations,
- * the return value is stored at an undefined point of time and shall thus not
- * be used by the caller.
+ * The \a pack is owned by the caller, and is typically allocated on its
+ * stack. For direct and blocking invocations, the method is invoked
+ * synchronously, and stores its return value, if any, in the \a pack. For
+ * queued invocations, the arguments are moved out of the \a pack to the
+ * posted message, and the return value is discarded.
  *
  * \return True if the return value contained in the \a pack may be used by the
  * caller, false otherwise
  */
-bool BoundMethodBase::activatePack(std::shared_ptr<BoundMethodPackBase> pack,
-				   bool deleteMethod)
+bool BoundMethodBase::activatePack(BoundMethodPackBase *pack, bool deleteMethod)
 {
 	ConnectionType type = connectionType_;
 	if (type == ConnectionTypeAuto) {
@@ -81,7 +80,7 @@ bool BoundMethodBase::activatePack(std::shared_ptr<BoundMethodPackBase> pack,
 	switch (type) {
 	case ConnectionTypeDirect:
 	default:
-		invokePack(pack.get());
+		invokePack(pack);
 		if (deleteMethod)
 			delete this;
 		return true;
@@ -0,0 +1,412 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * event_dispatcher_epoll.cpp - Epoll-based event dispatcher
+ */
+
+#include <libcamera/base/event_dispatcher_epoll.h>
+
+#include <iomanip>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <libcamera/base/event_notifier.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+/**
+ * \file base/event_dispatcher_epoll.h
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Event)
+
+namespace {
+
+/* Number of events retrieved from the kernel by a single epoll_wait() call. */
+constexpr unsigned int kMaxEvents = 32;
+
+const char *notifierType(EventNotifier::Type type)
+{
+	if (type == EventNotifier::Read)
+		return "read";
+	if (type == EventNotifier::Write)
+		return "write";
+	if (type == EventNotifier::Exception)
+		return "exception";
+
+	return "";
+}
+
+} /* namespace */
+
+/**
+ * \class EventDispatcherEpoll
+ * \brief An epoll-based event dispatcher
+ *
+ * The EventDispatcherEpoll is an alternative to the EventDispatcherPoll that
+ * scales better with the number of event notifiers and timers. File
+ * descriptors are registered persistently with the kernel when notifiers are
+ * registered, instead of being passed to the kernel at every iteration of the
+ * event loop, and only the file descriptors that have pending events are
+ * processed.
+ *
+ * Timers are stored in containers sorted by deadline and by latest expiration
+ * time allowed by their slack. The earliest of the latter is programmed in a
+ * timerfd monitored along with the event notifiers, and all timers whose
+ * deadline has passed are processed on wakeup. Registering and unregistering
+ * timers are O(log n) operations.
+ */
+
+EventDispatcherEpoll::EventDispatcherEpoll()
+	: processingEvents_(false)
+{
+	/*
+	 * Create the epoll instance, the event fd and the timer fd. Failures
+	 * are fatal as we can't implement an interruptible dispatcher with
+	 * timers without them.
+	 */
+	epollfd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epollfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create epoll instance";
+
+	eventfd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create eventfd";
+
+	timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (timerfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create timerfd";
+
+	for (int fd : { eventfd_, timerfd_ }) {
+		struct epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+
+		if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, fd, &event) < 0)
+			LOG(Event, Fatal)
+				<< "Unable to monitor internal fd: "
+				<< strerror(errno);
+	}
+
+	events_.resize(kMaxEvents);
+}
+
+EventDispatcherEpoll::~EventDispatcherEpoll()
+{
+	close(timerfd_);
+	close(eventfd_);
+	close(epollfd_);
+}
+
+void EventDispatcherEpoll::registerEventNotifier(EventNotifier *notifier)
+{
+	auto [iter, added] = notifiers_.try_emplace(notifier->fd());
+	EventNotifierSetEpoll &set = iter->second;
+	EventNotifier::Type type = notifier->type();
+
+	/*
+	 * An entry without notifiers may be left when the last notifier has
+	 * been unregistered during event processing. Its file descriptor has
+	 * been removed from the epoll set already, and must be added again.
+	 */
+	bool monitored = !added && set.events();
+
+	if (set.notifiers[type] && set.notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< "Ignoring duplicate " << notifierType(type)
+			<< " notifier for fd " << notifier->fd();
+		return;
+	}
+
+	set.notifiers[type] = notifier;
+
+	updateNotifiers(notifier->fd(), set,
+			monitored ? EPOLL_CTL_MOD : EPOLL_CTL_ADD);
+}
+
+void EventDispatcherEpoll::unregisterEventNotifier(EventNotifier *notifier)
+{
+	auto iter = notifiers_.find(notifier->fd());
+	if (iter == notifiers_.end())
+		return;
+
+	EventNotifierSetEpoll &set = iter->second;
+	EventNotifier::Type type = notifier->type();
+
+	if (!set.notifiers[type])
+		return;
+
+	if (set.notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< notifierType(type) << " notifier for fd "
+			<< notifier->fd() << " is not registered";
+		return;
+	}
+
+	set.notifiers[type] = nullptr;
+
+	if (set.events()) {
+		updateNotifiers(notifier->fd(), set, EPOLL_CTL_MOD);
+		return;
+	}
+
+	/*
+	 * The file descriptor may have been closed already, in which case the
+	 * kernel has removed it from the epoll set automatically. Ignore
+	 * errors.
+	 */
+	epoll_ctl(epollfd_, EPOLL_CTL_DEL, notifier->fd(), nullptr);
+
+	/*
+	 * Don't race with event processing if this function is called from an
+	 * event notifier. The notifiers_ entry will be erased once all the
+	 * events have been processed.
+	 */
+	if (processingEvents_) {
+		staleFds_.push_back(notifier->fd());
+		return;
+	}
+
+	notifiers_.erase(iter);
+}
+
+void EventDispatcherEpoll::registerTimer(Timer *timer)
+{
+	TimerEntry entry;
+	entry.deadline = timers_.emplace(timer->deadline(), timer);
+	entry.wakeup = wakeups_.emplace(timer->deadline() + timer->slack(), timer);
+	timerEntries_[timer] = entry;
+
+	if (entry.wakeup == wakeups_.begin())
+		armTimer();
+}
+
+void EventDispatcherEpoll::unregisterTimer(Timer *timer)
+{
+	/*
+	 * The timer deadline may have been updated already when restarting a
+	 * running timer, look up the timer by pointer instead of deadline.
+	 */
+	auto entry = timerEntries_.find(timer);
+	if (entry == timerEntries_.end())
+		return;
+
+	bool first = entry->second.wakeup == wakeups_.begin();
+
+	timers_.erase(entry->second.deadline);
+	wakeups_.erase(entry->second.wakeup);
+	timerEntries_.erase(entry);
+
+	if (first)
+		armTimer();
+}
+
+void EventDispatcherEpoll::processEvents()
+{
+	int ret;
+
+	Thread::current()->dispatchMessages();
+
+	/* Wait for events and process notifiers and timers. */
+	do {
+		ret = epoll_wait(epollfd_, events_.data(), events_.size(), -1);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret < 0) {
+		ret = -errno;
+		LOG(Event, Warning) << "epoll_wait() failed with " << strerror(-ret);
+		return;
+	}
+
+	bool timeout = false;
+
+	processingEvents_ = true;
+
+	for (int i = 0; i < ret; ++i) {
+		const struct epoll_event &event = events_[i];
+
+		if (event.data.fd == eventfd_)
+			processInterrupt();
+		else if (event.data.fd == timerfd_)
+			timeout = true;
+		else
+			processNotifiers(event);
+	}
+
+	processingEvents_ = false;
+
+	/* Erase the entries emptied by notifiers unregistered in the loop. */
+	for (int fd : staleFds_) {
+		auto iter = notifiers_.find(fd);
+		if (iter != notifiers_.end() && !iter->second.events())
+			notifiers_.erase(iter);
+	}
+
+	staleFds_.clear();
+
+	if (timeout)
+		processTimers();
+}
+
+void EventDispatcherEpoll::interrupt()
+{
+	uint64_t value = 1;
+	ssize_t ret = write(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to interrupt event dispatcher ("
+			<< ret << ")";
+	}
+}
+
+uint32_t EventDispatcherEpoll::EventNotifierSetEpoll::events() const
+{
+	uint32_t events = 0;
+
+	if (notifiers[EventNotifier::Read])
+		events |= EPOLLIN;
+	if (notifiers[EventNotifier::Write])
+		events |= EPOLLOUT;
+	if (notifiers[EventNotifier::Exception])
+		events |= EPOLLPRI;
+
+	return events;
+}
+
+void EventDispatcherEpoll::updateNotifiers(int fd, const EventNotifierSetEpoll &set,
+					   int op)
+{
+	struct epoll_event event = {};
+	event.events = set.events();
+	event.data.fd = fd;
+
+	if (epoll_ctl(epollfd_, op, fd, &event) < 0)
+		LOG(Event, Error)
+			<< "Failed to update notifiers for fd " << fd << ": "
+			<< strerror(errno);
+}
+
+void EventDispatcherEpoll::processInterrupt()
+{
+	uint64_t value;
+	ssize_t ret = read(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to process interrupt (" << ret << ")";
+	}
+}
+
+void EventDispatcherEpoll::processNotifiers(const struct epoll_event &event)
+{
+	static const struct {
+		EventNotifier::Type type;
+		uint32_t events;
+	} types[] = {
+		{ EventNotifier::Read, EPOLLIN },
+		{ EventNotifier::Write, EPOLLOUT },
+		{ EventNotifier::Exception, EPOLLPRI },
+	};
+
+	/*
+	 * The notifiers for the file descriptor may have been unregistered by
+	 * a previously processed event.
+	 */
+	auto iter = notifiers_.find(event.data.fd);
+	if (iter == notifiers_.end())
+		return;
+
+	EventNotifierSetEpoll &set = iter->second;
+
+	for (const auto &type : types) {
+		EventNotifier *notifier = set.notifiers[type.type];
+
+		if (notifier && event.events & type.events)
+			notifier->activated.emit();
+	}
+}
+
+void EventDispatcherEpoll::processTimers()
+{
+	uint64_t expirations;
+	ssize_t ret = read(timerfd_, &expirations, sizeof(expirations));
+	if (ret < 0 && errno != EAGAIN)
+		LOG(Event, Error)
+			<< "Failed to read timerfd: " << strerror(errno);
+
+	/* The timerfd has been disarmed by the expiration. */
+	armedDeadline_ = utils::time_point();
+
+	/*
+	 * Process all timers whose deadline has passed, including the ones
+	 * whose slack would allow a later expiration, to coalesce them with
+	 * the timer that caused the wakeup.
+	 */
+	utils::time_point now = utils::clock::now();
+
+	while (!timers_.empty()) {
+		auto iter = timers_.begin();
+		Timer *timer = iter->second;
+		if (timer->deadline() > now)
+			break;
+
+		auto entry = timerEntries_.find(timer);
+		timers_.erase(iter);
+		wakeups_.erase(entry->second.wakeup);
+		timerEntries_.erase(entry);
+		timer->stop();
+		timer->timeout.emit();
+	}
+
+	armTimer();
+}
+
+void EventDispatcherEpoll::armTimer()
+{
+	utils::time_point deadline = !wakeups_.empty()
+				   ? wakeups_.begin()->first
+				   : utils::time_point();
+
+	if (deadline == armedDeadline_)
+		return;
+
+	/*
+	 * The steady clock is based on CLOCK_MONOTONIC, program the deadline
+	 * as an absolute time. A zero value disarms the timer. Deadlines in the
+	 * past expire immediately, a deadline at the clock epoch is bumped by
+	 * a nanosecond to avoid disarming the timer.
+	 */
+	struct itimerspec spec = {};
+
+	if (!wakeups_.empty()) {
+		spec.it_value = utils::duration_to_timespec(deadline.time_since_epoch());
+		if (!spec.it_value.tv_sec && !spec.it_value.tv_nsec)
+			spec.it_value.tv_nsec = 1;
+
+		LOG(Event, Debug)
+			<< "timeout " << spec.it_value.tv_sec << "."
+			<< std::setfill('0') << std::setw(9)
+			<< spec.it_value.tv_nsec;
+	}
+
+	if (timerfd_settime(timerfd_, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+		LOG(Event, Error)
+			<< "Failed to program timerfd: " << strerror(errno);
+		return;
+	}
+
+	armedDeadline_ = deadline;
+}
+
+} /* namespace libcamera */
@@ -9,6 +9,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -50,6 +51,19 @@ LOG_DEFINE_CATEGORY(File)
  * \var File::MapFlag::Private
  * \brief The memory region is mapped as private, changes are not reflected in
  * the file constents
+ * \var File::MapFlag::Populate
+ * \brief Prefault the whole memory region when mapping it, to avoid page faults
+ * on first access
+ * \var File::MapFlag::Sequential
+ * \brief The memory region will be accessed sequentially, allowing aggressive
+ * read-ahead
+ * \var File::MapFlag::WillNeed
+ * \brief The memory region will be accessed soon, start reading it ahead
+ * \var File::MapFlag::HugePages
+ * \brief Back the memory region with transparent huge pages when supported
+ *
+ * The Sequential, WillNeed and HugePages flags are hints to the kernel. They
+ * don't affect the mapping contents, and are ignored when not supported.
  */
 
 /**
@@ -377,6 +391,10 @@ ssize_t File::write(const Span<const uint8_t> &data)
  * flags contains MapFlag::Private in which case the region is mapped in
  * read/write mode.
  *
+ * Large mappings read in full, such as files that are parsed or hashed, should
+ * set the MapFlag::Sequential and MapFlag::WillNeed hints to avoid taking a
+ * page fault for every page.
+ *
  * The error() status is updated.
  *
  * \return The mapped memory on success, or an empty span otherwise
@@ -399,6 +417,8 @@ Span<uint8_t> File::map(off_t offset, ssize_t size, File::MapFlags flags)
 	}
 
 	int mmapFlags = flags & MapFlag::Private ? MAP_PRIVATE : MAP_SHARED;
+	if (flags & MapFlag::Populate)
+		mmapFlags |= MAP_POPULATE;
 
 	int prot = 0;
 	if (mode_ & OpenModeFlag::ReadOnly)
@@ -414,6 +434,25 @@ Span<uint8_t> File::map(off_t offset, ssize_t size, File::MapFlags flags)
 		return {};
 	}
 
+	int advice[] = {
+		flags & MapFlag::Sequential ? MADV_SEQUENTIAL : -1,
+		flags & MapFlag::WillNeed ? MADV_WILLNEED : -1,
+#ifdef MADV_HUGEPAGE
+		flags & MapFlag::HugePages ? MADV_HUGEPAGE : -1,
+#endif
+	};
+
+	for (int adv : advice) {
+		if (adv < 0)
+			continue;
+
+		/* The advice is a hint only, failures are not fatal. */
+		if (madvise(map, size, adv) < 0)
+			LOG(File, Debug)
+				<< "Failed to set map advice " << adv << " for "
+				<< name_ << ": " << strerror(errno);
+	}
+
 	maps_.emplace(map, size);
 
 	error_ = 0;
@@ -0,0 +1,255 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * global_configuration.cpp - System-wide libcamera configuration
+ */
+
+#include <libcamera/base/global_configuration.h>
+
+#include <errno.h>
+#include <fstream>
+#include <utility>
+#include <vector>
+
+#include <libcamera/base/utils.h>
+
+/**
+ * \file base/global_configuration.h
+ * \brief System-wide libcamera configuration
+ */
+
+namespace libcamera {
+
+namespace {
+
+std::string trim(const std::string &str)
+{
+	size_t start = str.find_first_not_of(' ');
+	if (start == std::string::npos)
+		return {};
+
+	size_t end = str.find_last_not_of(' ');
+	return str.substr(start, end - start + 1);
+}
+
+std::string unquote(const std::string &str)
+{
+	if (str.size() >= 2 && (str.front() == '"' || str.front() == '\'') &&
+	    str.back() == str.front())
+		return str.substr(1, str.size() - 2);
+
+	return str;
+}
+
+/* Strip a comment, starting with a '#' outside of quotes and after a space. */
+std::string stripComment(const std::string &line)
+{
+	char quote = 0;
+
+	for (size_t i = 0; i < line.size(); ++i) {
+		char c = line[i];
+
+		if (quote) {
+			if (c == quote)
+				quote = 0;
+		} else if (c == '"' || c == '\'') {
+			quote = c;
+		} else if (c == '#' && (i == 0 || line[i - 1] == ' ')) {
+			return line.substr(0, i);
+		}
+	}
+
+	return line;
+}
+
+} /* namespace */
+
+/**
+ * \class GlobalConfiguration
+ * \brief System-wide configuration of libcamera
+ *
+ * The libcamera behaviour can be tuned through options, named after the
+ * LIBCAMERA_* environment variables that historically controlled them, such
+ * as the number of pipeline handler threads, the thread priorities, the IPA
+ * isolation or the log levels. Tuning a deployment for latency, throughput or
+ * memory usage through environment variables requires setting them for every
+ * process, the GlobalConfiguration class additionally reads them from a
+ * system-wide configuration file.
+ *
+ * The configuration file is read from the path set in the
+ * LIBCAMERA_CONFIG_FILE environment variable, or from config.yaml in the
+ * libcamera system configuration directory otherwise. It uses a subset of the
+ * YAML syntax, limited to nested mappings of scalar values:
+ *
+ * \code{.yaml}
+ * version: 1
+ * profile: low-latency
+ * options:
+ *   LIBCAMERA_LOG_LEVELS: "*:WARN"
+ * profiles:
+ *   low-latency:
+ *     LIBCAMERA_PIPELINE_THREADS: 1
+ *     LIBCAMERA_BUSY_POLL: 200
+ *     LIBCAMERA_THREADS: "CameraManager:fifo=10;Pipeline-*:fifo=10"
+ *   high-throughput:
+ *     LIBCAMERA_PIPELINE_THREADS: 4
+ *     LIBCAMERA_IPA_PROXY_POOL_SIZE: 4
+ * \endcode
+ *
+ * The options of the top-level "options" mapping apply to all profiles. The
+ * options of the selected profile, named by the LIBCAMERA_PROFILE environment
+ * variable or by the top-level "profile" key otherwise, override them. The
+ * environment variables take precedence over the configuration file.
+ *
+ * The configuration file is parsed once, the first time an option is looked
+ * up. As this happens when the logger is initialized, parse errors can't be
+ * logged directly, they are stored and reported by the CameraManager when it
+ * starts.
+ */
+
+GlobalConfiguration::GlobalConfiguration()
+{
+	const char *path = utils::secure_getenv("LIBCAMERA_CONFIG_FILE");
+	path_ = path ? path : LIBCAMERA_SYSCONF_DIR "/config.yaml";
+
+	std::ifstream file(path_);
+	if (!file.is_open()) {
+		/* The configuration file is optional. */
+		if (path)
+			error_ = "Failed to open " + path_;
+		return;
+	}
+
+	std::map<std::string, std::string> values;
+	int ret = parse(file, &values);
+	if (ret)
+		return;
+
+	const char *profile = utils::secure_getenv("LIBCAMERA_PROFILE");
+	profile_ = profile ? profile : values["profile"];
+
+	/* Apply the options of a scope, return false if it doesn't exist. */
+	auto apply = [&](const std::string &scope) {
+		bool found = false;
+
+		for (const auto &[key, value] : values) {
+			if (key.compare(0, scope.size(), scope))
+				continue;
+
+			found = true;
+
+			std::string name = key.substr(scope.size());
+			if (name.find('.') == std::string::npos)
+				options_[name] = value;
+		}
+
+		return found;
+	};
+
+	apply("options.");
+
+	if (!profile_.empty() && !apply("profiles." + profile_ + ".")) {
+		error_ = "Unknown profile '" + profile_ + "'";
+		profile_.clear();
+	}
+}
+
+/**
+ * \brief Retrieve the global configuration instance
+ * \return The global configuration
+ */
+const GlobalConfiguration &GlobalConfiguration::instance()
+{
+	static GlobalConfiguration config;
+	return config;
+}
+
+/**
+ * \brief Retrieve the value of a configuration option
+ * \param[in] name The option name
+ *
+ * The value is retrieved from the environment variable \a name if set, or from
+ * the configuration file otherwise.
+ *
+ * \return A pointer to the option value, or nullptr if the option isn't set
+ */
+const char *GlobalConfiguration::option(const char *name)
+{
+	const char *value = utils::secure_getenv(name);
+	if (value)
+		return value;
+
+	const GlobalConfiguration &config = instance();
+	auto iter = config.options_.find(name);
+	if (iter == config.options_.end())
+		return nullptr;
+
+	return iter->second.c_str();
+}
+
+/**
+ * \fn GlobalConfiguration::path()
+ * \brief Retrieve the path of the configuration file
+ * \return The configuration file path
+ */
+
+/**
+ * \fn GlobalConfiguration::profile()
+ * \brief Retrieve the name of the selected profile
+ * \return The profile name, or an empty string if no profile is selected
+ */
+
+/**
+ * \fn GlobalConfiguration::error()
+ * \brief Retrieve the error that occurred when reading the configuration file
+ * \return The error message, or an empty string if no error occurred
+ */
+
+int GlobalConfiguration::parse(std::istream &file,
+			       std::map<std::string, std::string> *values)
+{
+	/* The indentation and path of the enclosing mappings. */
+	std::vector<std::pair<size_t, std::string>> scopes;
+	unsigned int lineNumber = 0;
+	std::string line;
+
+	while (std::getline(file, line)) {
+		lineNumber++;
+
+		line = stripComment(line);
+		std::string content = trim(line);
+		if (content.empty())
+			continue;
+
+		size_t indent = line.find_first_not_of(' ');
+		size_t colon = content.find(": ");
+		if (colon == std::string::npos && content.back() == ':')
+			colon = content.size() - 1;
+
+		if (line[indent] == '\t' || content[0] == '-' ||
+		    colon == std::string::npos || !colon) {
+			error_ = path_ + ":" + std::to_string(lineNumber) +
+				 ": Unsupported syntax";
+			return -EINVAL;
+		}
+
+		std::string key = unquote(trim(content.substr(0, colon)));
+		std::string value = unquote(trim(content.substr(colon + 1)));
+
+		while (!scopes.empty() && scopes.back().first >= indent)
+			scopes.pop_back();
+
+		std::string path = scopes.empty() ? key
+						  : scopes.back().second + "." + key;
+
+		if (value.empty())
+			scopes.emplace_back(indent, path);
+		else
+			(*values)[path] = value;
+	}
+
+	return 0;
+}
+
+} /* namespace libcamera */
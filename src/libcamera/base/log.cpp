@@ -5,18 +5,26 @@
  * log.cpp - Logging infrastructure
  */
 
+#include <libcamera/base/global_configuration.h>
 #include <libcamera/base/log.h>
 
 #include <array>
+#include <atomic>
+#include <condition_variable>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <thread>
 #include <time.h>
 #include <unordered_set>
+#include <vector>
 
 #include <libcamera/logging.h>
 
@@ -51,6 +59,14 @@
  * the file. The file must be writable and is truncated if it exists. If any
  * error occurs when opening the file, the file is ignored and the log is output
  * to stderr.
+ *
+ * Log messages are written synchronously by default, in the context of the
+ * thread that logs them. Appending the ",async" option to the
+ * LIBCAMERA_LOG_FILE value moves writing to a dedicated thread, to avoid
+ * stalling time-sensitive threads on slow log destinations. When the log
+ * message queue is full, messages are dropped by default, and the number of
+ * dropped messages is reported in the log. The ",overflow=block" option makes
+ * the logging thread wait for space in the queue instead.
  */
 
 /**
@@ -96,6 +112,217 @@ static const char *log_severity_name(LogSeverity severity)
 		return "UNKWN";
 }
 
+/**
+ * \brief Asynchronous log message queue
+ *
+ * The LogQueue class decouples formatting of log messages, performed in the
+ * context of the thread that logs the message, from writing them to the log
+ * destination, performed by a dedicated writer thread. This prevents threads
+ * from stalling on slow log destinations.
+ *
+ * Formatted messages are passed to the writer thread through a bounded
+ * lock-free multiple producers single consumer ring buffer. Every slot stores
+ * a sequence number that tells whether the slot is free, for the producer that
+ * claimed the slot position, or holds a message, for the writer thread. The
+ * writer thread goes to sleep when the queue is empty, and is woken up by
+ * producers only when sleeping.
+ *
+ * When the queue is full, messages are either dropped or the producer waits
+ * for space to become available, depending on the overflow policy. The number
+ * of dropped messages is reported in the log once the queue has been drained.
+ */
+class LogQueue
+{
+public:
+	enum class Overflow {
+		Drop,
+		Block,
+	};
+
+	using WriteFunction = std::function<void(LogSeverity, const std::string &)>;
+
+	LogQueue(const WriteFunction &write, Overflow overflow);
+	~LogQueue();
+
+	void write(LogSeverity severity, std::string &&str, bool sync = false);
+
+private:
+	struct Slot {
+		std::atomic<size_t> sequence;
+		LogSeverity severity;
+		std::string str;
+	};
+
+	/* Number of slots in the queue, must be a power of two. */
+	static constexpr size_t kQueueSize = 1024;
+
+	bool push(LogSeverity severity, std::string &&str);
+	bool ready() const;
+	void flush();
+	void run();
+
+	WriteFunction write_;
+	Overflow overflow_;
+
+	std::unique_ptr<Slot[]> slots_;
+	std::atomic<size_t> head_;
+	std::atomic<size_t> tail_;
+	std::atomic<unsigned int> dropped_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::atomic<bool> sleeping_;
+	std::atomic<bool> exit_;
+
+	std::thread thread_;
+};
+
+/**
+ * \brief Construct a log queue and start its writer thread
+ * \param[in] write The function that writes messages to the log destination
+ * \param[in] overflow The policy applied when the queue is full
+ */
+LogQueue::LogQueue(const WriteFunction &write, Overflow overflow)
+	: write_(write), overflow_(overflow), slots_(new Slot[kQueueSize]),
+	  head_(0), tail_(0), dropped_(0), sleeping_(false), exit_(false)
+{
+	for (size_t i = 0; i < kQueueSize; ++i)
+		slots_[i].sequence.store(i, std::memory_order_relaxed);
+
+	thread_ = std::thread(&LogQueue::run, this);
+}
+
+/**
+ * \brief Destroy the log queue
+ *
+ * All queued messages are written to the log destination before the writer
+ * thread is stopped.
+ */
+LogQueue::~LogQueue()
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		exit_.store(true);
+	}
+
+	cv_.notify_one();
+	thread_.join();
+}
+
+/**
+ * \brief Queue a message for writing
+ * \param[in] severity The message severity
+ * \param[in] str The formatted message
+ * \param[in] sync Wait until the message has been written
+ *
+ * Synchronous messages are never dropped. They are used for fatal messages
+ * that must reach the log destination before the process aborts.
+ */
+void LogQueue::write(LogSeverity severity, std::string &&str, bool sync)
+{
+	if (!sync && overflow_ == Overflow::Drop) {
+		if (!push(severity, std::move(str)))
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	while (!push(severity, std::move(str)))
+		std::this_thread::yield();
+
+	if (sync)
+		flush();
+}
+
+bool LogQueue::push(LogSeverity severity, std::string &&str)
+{
+	size_t pos = head_.load(std::memory_order_relaxed);
+	Slot *slot;
+
+	while (true) {
+		slot = &slots_[pos & (kQueueSize - 1)];
+		size_t seq = slot->sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+		if (diff == 0) {
+			if (head_.compare_exchange_weak(pos, pos + 1,
+							std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			/* The queue is full. */
+			return false;
+		} else {
+			pos = head_.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->severity = severity;
+	slot->str = std::move(str);
+
+	/*
+	 * Publish the message and check if the writer thread needs to be woken
+	 * up. Both operations, and their counterparts in run(), are sequentially
+	 * consistent to guarantee that either the writer thread sees the
+	 * message before going to sleep, or the producer sees the writer thread
+	 * sleeping. In the latter case, acquiring the mutex ensures that the
+	 * writer thread is waiting on the condition variable before notifying
+	 * it.
+	 */
+	slot->sequence.store(pos + 1);
+
+	if (sleeping_.load()) {
+		{
+			std::lock_guard<std::mutex> locker(mutex_);
+		}
+		cv_.notify_one();
+	}
+
+	return true;
+}
+
+bool LogQueue::ready() const
+{
+	size_t pos = tail_.load(std::memory_order_relaxed);
+	return slots_[pos & (kQueueSize - 1)].sequence.load() == pos + 1;
+}
+
+void LogQueue::flush()
+{
+	size_t head = head_.load();
+
+	while (static_cast<intptr_t>(tail_.load(std::memory_order_acquire) - head) < 0)
+		std::this_thread::yield();
+}
+
+void LogQueue::run()
+{
+	while (true) {
+		size_t pos = tail_.load(std::memory_order_relaxed);
+		Slot &slot = slots_[pos & (kQueueSize - 1)];
+
+		if (ready()) {
+			write_(slot.severity, slot.str);
+			slot.str.clear();
+
+			slot.sequence.store(pos + kQueueSize, std::memory_order_release);
+			tail_.store(pos + 1, std::memory_order_release);
+			continue;
+		}
+
+		unsigned int dropped = dropped_.exchange(0, std::memory_order_relaxed);
+		if (dropped)
+			write_(LogWarning, std::to_string(dropped) +
+					   " log messages dropped\n");
+
+		std::unique_lock<std::mutex> locker(mutex_);
+		if (exit_.load())
+			break;
+
+		sleeping_.store(true);
+		cv_.wait(locker, [&] { return exit_.load() || ready(); });
+		sleeping_.store(false);
+	}
+}
+
 /**
  * \brief Log output
  *
@@ -110,15 +337,20 @@ public:
 	~LogOutput();
 
 	bool isValid() const;
+	void setAsync(LogQueue::Overflow overflow);
 	void write(const LogMessage &msg);
 	void write(const std::string &msg);
 
 private:
+	void output(LogSeverity severity, std::string &&str, bool sync);
+	void writeString(LogSeverity severity, const std::string &str);
 	void writeSyslog(LogSeverity severity, const std::string &msg);
 	void writeStream(const std::string &msg);
 
 	std::ostream *stream_;
 	LoggingTarget target_;
+
+	std::unique_ptr<LogQueue> queue_;
 };
 
 /**
@@ -151,6 +383,9 @@ LogOutput::LogOutput()
 
 LogOutput::~LogOutput()
 {
+	/* Drain the queue before closing the log destination. */
+	queue_.reset();
+
 	switch (target_) {
 	case LoggingTargetFile:
 		delete stream_;
@@ -179,6 +414,25 @@ bool LogOutput::isValid() const
 	}
 }
 
+/**
+ * \brief Write log messages asynchronously
+ * \param[in] overflow The policy applied when the message queue is full
+ *
+ * Switch the log output to asynchronous mode. Messages are formatted by the
+ * thread that logs them, and written to the log destination by a dedicated
+ * writer thread. Fatal messages and backtraces are written synchronously to
+ * guarantee they reach the log destination before the process aborts.
+ *
+ * This function shall be called before the log output is used.
+ */
+void LogOutput::setAsync(LogQueue::Overflow overflow)
+{
+	queue_ = std::make_unique<LogQueue>(
+		[this](LogSeverity severity, const std::string &str) {
+			writeString(severity, str);
+		}, overflow);
+}
+
 /**
  * \brief Write message to log output
  * \param[in] msg Message to write
@@ -192,7 +446,6 @@ void LogOutput::write(const LogMessage &msg)
 		str = std::string(log_severity_name(msg.severity())) + " "
 		    + msg.category().name() + " " + msg.fileInfo() + " "
 		    + msg.msg();
-		writeSyslog(msg.severity(), str);
 		break;
 	case LoggingTargetStream:
 	case LoggingTargetFile:
@@ -201,11 +454,12 @@ void LogOutput::write(const LogMessage &msg)
 		    + log_severity_name(msg.severity()) + " "
 		    + msg.category().name() + " " + msg.fileInfo() + " "
 		    + msg.msg();
-		writeStream(str);
 		break;
 	default:
-		break;
+		return;
 	}
+
+	output(msg.severity(), std::move(str), msg.severity() == LogFatal);
 }
 
 /**
@@ -213,10 +467,23 @@ void LogOutput::write(const LogMessage &msg)
  * \param[in] str String to write
  */
 void LogOutput::write(const std::string &str)
+{
+	output(LogDebug, std::string(str), true);
+}
+
+void LogOutput::output(LogSeverity severity, std::string &&str, bool sync)
+{
+	if (queue_)
+		queue_->write(severity, std::move(str), sync);
+	else
+		writeString(severity, str);
+}
+
+void LogOutput::writeString(LogSeverity severity, const std::string &str)
 {
 	switch (target_) {
 	case LoggingTargetSyslog:
-		writeSyslog(LogDebug, str);
+		writeSyslog(severity, str);
 		break;
 	case LoggingTargetStream:
 	case LoggingTargetFile:
@@ -532,21 +799,58 @@ Logger::Logger()
  * points to and redirect the logger output to it. If the environment variable
  * is set to "syslog", then the logger output will be directed to syslog. Errors
  * are silently ignored and don't affect the logger output (set to stderr).
+ *
+ * The destination can be followed by a comma-separated list of options. The
+ * "async" option enables asynchronous writing of log messages, and the
+ * "overflow=drop" (default) and "overflow=block" options select the behaviour
+ * when the asynchronous message queue is full. Options are parsed from the end
+ * of the variable, unrecognized trailing elements are considered part of the
+ * file name.
  */
 void Logger::parseLogFile()
 {
-	const char *file = utils::secure_getenv("LIBCAMERA_LOG_FILE");
+	const char *file = GlobalConfiguration::option("LIBCAMERA_LOG_FILE");
 	if (!file) {
 		logSetStream(&std::cerr);
 		return;
 	}
 
-	if (!strcmp(file, "syslog")) {
-		logSetTarget(LoggingTargetSyslog);
-		return;
+	std::string destination(file);
+	LogQueue::Overflow overflow = LogQueue::Overflow::Drop;
+	bool async = false;
+
+	while (true) {
+		size_t pos = destination.rfind(',');
+		if (pos == std::string::npos)
+			break;
+
+		std::string option = destination.substr(pos + 1);
+		if (option == "async")
+			async = true;
+		else if (option == "overflow=drop")
+			overflow = LogQueue::Overflow::Drop;
+		else if (option == "overflow=block")
+			overflow = LogQueue::Overflow::Block;
+		else
+			break;
+
+		destination.erase(pos);
+	}
+
+	std::shared_ptr<LogOutput> output;
+
+	if (destination == "syslog") {
+		output = std::make_shared<LogOutput>();
+	} else {
+		output = std::make_shared<LogOutput>(destination.c_str());
+		if (!output->isValid())
+			return;
 	}
 
-	logSetFile(file);
+	if (async)
+		output->setAsync(overflow);
+
+	std::atomic_store(&output_, output);
 }
 
 /**
@@ -558,7 +862,7 @@ void Logger::parseLogFile()
  */
 void Logger::parseLogLevels()
 {
-	const char *debug = utils::secure_getenv("LIBCAMERA_LOG_LEVELS");
+	const char *debug = GlobalConfiguration::option("LIBCAMERA_LOG_LEVELS");
 	if (!debug)
 		return;
 
@@ -743,6 +1047,59 @@ const LogCategory &LogCategory::defaultCategory()
 	return *category;
 }
 
+namespace {
+
+/*
+ * Constructing a std::ostringstream is costly, recycle the streams of log
+ * messages in a per-thread cache. A small number of streams are cached, to
+ * support messages created while formatting another message.
+ */
+constexpr unsigned int kStreamCacheSize = 4;
+
+struct LogStreamCache {
+	~LogStreamCache();
+
+	std::vector<std::unique_ptr<std::ostringstream>> streams;
+};
+
+thread_local bool streamCacheDestroyed = false;
+thread_local LogStreamCache streamCache;
+
+LogStreamCache::~LogStreamCache()
+{
+	streamCacheDestroyed = true;
+}
+
+std::unique_ptr<std::ostringstream> acquireStream()
+{
+	if (streamCacheDestroyed || streamCache.streams.empty())
+		return std::make_unique<std::ostringstream>();
+
+	std::unique_ptr<std::ostringstream> stream =
+		std::move(streamCache.streams.back());
+	streamCache.streams.pop_back();
+	return stream;
+}
+
+void releaseStream(std::unique_ptr<std::ostringstream> stream)
+{
+	if (!stream || streamCacheDestroyed ||
+	    streamCache.streams.size() >= kStreamCacheSize)
+		return;
+
+	/* Reset the contents and formatting state to the defaults. */
+	stream->str({});
+	stream->clear();
+	stream->flags(std::ios_base::skipws | std::ios_base::dec);
+	stream->fill(' ');
+	stream->precision(6);
+	stream->width(0);
+
+	streamCache.streams.push_back(std::move(stream));
+}
+
+} /* namespace */
+
 /**
  * \class LogMessage
  * \brief Internal log message representation.
@@ -767,7 +1124,7 @@ const LogCategory &LogCategory::defaultCategory()
  */
 LogMessage::LogMessage(const char *fileName, unsigned int line,
 		       const LogCategory &category, LogSeverity severity)
-	: category_(category), severity_(severity)
+	: msgStream_(acquireStream()), category_(category), severity_(severity)
 {
 	init(fileName, line);
 }
@@ -796,9 +1153,8 @@ void LogMessage::init(const char *fileName, unsigned int line)
 	/* Log the timestamp, severity and file information. */
 	timestamp_ = utils::clock::now();
 
-	std::ostringstream ossFileInfo;
-	ossFileInfo << utils::basename(fileName) << ":" << line;
-	fileInfo_ = ossFileInfo.str();
+	fileInfo_ = std::string(utils::basename(fileName)) + ":"
+		  + std::to_string(line);
 }
 
 LogMessage::~LogMessage()
@@ -808,10 +1164,12 @@ LogMessage::~LogMessage()
 		return;
 
 	Logger *logger = Logger::instance();
-	if (!logger)
+	if (!logger) {
+		releaseStream(std::move(msgStream_));
 		return;
+	}
 
-	msgStream_ << std::endl;
+	*msgStream_ << std::endl;
 
 	if (severity_ >= category_.severity())
 		logger->write(*this);
@@ -820,6 +1178,8 @@ LogMessage::~LogMessage()
 		logger->backtrace();
 		std::abort();
 	}
+
+	releaseStream(std::move(msgStream_));
 }
 
 /**
@@ -971,6 +1331,11 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
  * absent the default category is used. The  \a severity controls whether the
  * message is printed or discarded, depending on the log level for the category.
  *
+ * The severity is checked before the message is created. When the message is
+ * discarded, the operands of the stream insertion operators are not evaluated,
+ * and logging has no cost beyond the check. Debug messages are compiled out
+ * when libcamera is built with the log_debug option disabled.
+ *
  * If the severity is set to Fatal, execution is aborted and the program
  * terminates immediately after printing the message.
  *
@@ -981,6 +1346,127 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
  * possible extent
  */
 
+/**
+ * \def LOG_RATELIMITED(category, severity)
+ * \hideinitializer
+ * \brief Log a message, limiting the rate of messages from the call site
+ * \param[in] category Category (optional)
+ * \param[in] severity Severity
+ *
+ * This macro behaves as LOG(), but limits the number of messages logged from
+ * the call site to LogRateLimiter::kBurst messages every
+ * LogRateLimiter::kInterval. The other messages are discarded without
+ * evaluating the operands of the stream insertion operators. The first message
+ * logged after messages have been discarded reports how many of them have
+ * been suppressed.
+ *
+ * The macro is meant for messages that can be logged for every frame under
+ * fault conditions, to avoid flooding the log and amplifying the load of the
+ * system when it is already in trouble.
+ */
+
+/**
+ * \class LogRateLimiter
+ * \brief Limit the rate of the messages logged from a call site
+ *
+ * The LogRateLimiter class implements the rate limiting of the
+ * LOG_RATELIMITED() macro. Each call site has its own instance, which allows
+ * kBurst messages per kInterval time window. The class is thread-safe. As the
+ * counters are updated without locking, the limit is approximate when threads
+ * race at the boundary of a time window.
+ */
+
+/**
+ * \var LogRateLimiter::kBurst
+ * \brief The number of messages allowed in a time window
+ */
+
+/**
+ * \var LogRateLimiter::kInterval
+ * \brief The duration of a time window
+ */
+
+/**
+ * \struct LogRateLimiter::Summary
+ * \brief Summary of the messages suppressed before a logged message
+ *
+ * \var LogRateLimiter::Summary::suppressed
+ * \brief The number of messages suppressed
+ */
+
+/**
+ * \fn LogRateLimiter::LogRateLimiter()
+ * \brief Construct a rate limiter that allows a full burst of messages
+ */
+
+namespace {
+
+/* The number of messages suppressed before the last allowed message. */
+thread_local unsigned int lastSuppressed = 0;
+
+} /* namespace */
+
+/**
+ * \brief Check if a message can be logged
+ *
+ * When the message can be logged, the number of messages suppressed since the
+ * previous logged message is recorded for the calling thread, and can be
+ * retrieved with summary().
+ *
+ * \return True if the message can be logged, false if it shall be discarded
+ */
+bool LogRateLimiter::check()
+{
+	int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		utils::clock::now().time_since_epoch()).count();
+	int64_t start = windowStart_.load(std::memory_order_relaxed);
+
+	if (now - start >= std::chrono::nanoseconds(kInterval).count() &&
+	    windowStart_.compare_exchange_strong(start, now,
+						 std::memory_order_relaxed))
+		count_.store(0, std::memory_order_relaxed);
+
+	if (count_.fetch_add(1, std::memory_order_relaxed) >= kBurst) {
+		suppressed_.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	lastSuppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+	return true;
+}
+
+/**
+ * \brief Retrieve the summary of the last message allowed by check()
+ *
+ * The summary is stored per thread, it is only valid when retrieved from the
+ * thread that called check(), right after the call.
+ *
+ * \return The summary of the messages suppressed before the last allowed
+ * message
+ */
+LogRateLimiter::Summary LogRateLimiter::summary()
+{
+	return { lastSuppressed };
+}
+
+/**
+ * \brief Insert a text representation of a LogRateLimiter::Summary into an
+ * output stream
+ * \param[in] out The output stream
+ * \param[in] summary The summary
+ *
+ * Nothing is inserted when no message has been suppressed.
+ *
+ * \return The output stream \a out
+ */
+std::ostream &operator<<(std::ostream &out, const LogRateLimiter::Summary &summary)
+{
+	if (summary.suppressed)
+		out << "(" << summary.suppressed << " similar messages suppressed) ";
+
+	return out;
+}
+
 /**
  * \def ASSERT(condition)
  * \hideinitializer
@@ -7,8 +7,11 @@
 
 #include <libcamera/base/message.h>
 
+#include <new>
+
 #include <libcamera/base/log.h>
 #include <libcamera/base/signal.h>
+#include <libcamera/base/thread.h>
 
 /**
  * \file base/message.h
@@ -34,6 +37,83 @@ LOG_DEFINE_CATEGORY(Message)
 
 std::atomic_uint Message::nextUserType_{ Message::UserMessage };
 
+namespace {
+
+/*
+ * InvokeMessage instances are allocated in the sender thread and deleted in
+ * the receiver thread once delivered. To avoid heap allocations in steady
+ * state, freed messages are cached in a per-thread free list, and handed over
+ * to a process-wide free list when the per-thread list is full. Allocation
+ * takes messages from the per-thread list first, and then from the
+ * process-wide list, which balances the message flow between threads.
+ */
+struct FreeInvokeMessage {
+	FreeInvokeMessage *next;
+};
+
+constexpr unsigned int kLocalPoolSize = 16;
+constexpr unsigned int kGlobalPoolSize = 256;
+
+thread_local FreeInvokeMessage *localPool = nullptr;
+thread_local unsigned int localPoolCount = 0;
+
+struct GlobalInvokeMessagePool {
+	Mutex mutex;
+	FreeInvokeMessage *head = nullptr;
+	unsigned int count = 0;
+};
+
+GlobalInvokeMessagePool &globalPool()
+{
+	/*
+	 * The pool is never destroyed, as messages may be freed during static
+	 * destruction.
+	 */
+	static GlobalInvokeMessagePool *pool = new GlobalInvokeMessagePool();
+	return *pool;
+}
+
+void releaseToGlobalPool(FreeInvokeMessage *msg)
+{
+	GlobalInvokeMessagePool &pool = globalPool();
+
+	{
+		MutexLocker locker(pool.mutex);
+		if (pool.count < kGlobalPoolSize) {
+			msg->next = pool.head;
+			pool.head = msg;
+			pool.count++;
+			return;
+		}
+	}
+
+	::operator delete(msg);
+}
+
+/*
+ * Flush the per-thread free list when the thread exits. The list is marked as
+ * full afterwards, to hand messages freed later during thread destruction to
+ * the process-wide free list.
+ */
+class LocalInvokeMessagePoolFlusher
+{
+public:
+	~LocalInvokeMessagePoolFlusher()
+	{
+		while (localPool) {
+			FreeInvokeMessage *msg = localPool;
+			localPool = msg->next;
+			releaseToGlobalPool(msg);
+		}
+
+		localPoolCount = kLocalPoolSize;
+	}
+};
+
+thread_local LocalInvokeMessagePoolFlusher localPoolFlusher;
+
+} /* namespace */
+
 /**
  * \class Message
  * \brief A message that can be posted to a Thread
@@ -59,7 +139,8 @@ std::atomic_uint Message::nextUserType_{ Message::UserMessage };
  * \param[in] type The message type
  */
 Message::Message(Message::Type type)
-	: type_(type)
+	: type_(type), receiver_(nullptr), next_(nullptr),
+	  receiverPrev_(nullptr), receiverNext_(nullptr), slot_(nullptr)
 {
 }
 
@@ -116,6 +197,11 @@ Message::Type Message::registerMessageType()
  * \brief A message carrying a method invocation across threads
  */
 
+/**
+ * \var InvokeMessage::kInlinePackSize
+ * \brief The maximum size of packed arguments stored inline in the message
+ */
+
 /**
  * \brief Construct an InvokeMessage for method invocation on an Object
  * \param[in] method The bound method
@@ -123,21 +209,102 @@ Message::Type Message::registerMessageType()
  * \param[in] semaphore The semaphore used to signal message delivery
  * \param[in] deleteMethod True to delete the \a method when the message is
  * destroyed
+ *
+ * When a \a semaphore is given, the caller waits for the message to be
+ * delivered, and the message references the \a pack without taking ownership
+ * of it. Otherwise, the arguments are moved out of the \a pack to storage
+ * owned by the message. Packs that fit in kInlinePackSize bytes are stored in
+ * the message itself, avoiding a separate heap allocation.
  */
 InvokeMessage::InvokeMessage(BoundMethodBase *method,
-			     std::shared_ptr<BoundMethodPackBase> pack,
+			     BoundMethodPackBase *pack,
 			     Semaphore *semaphore, bool deleteMethod)
 	: Message(Message::InvokeMessage), method_(method), pack_(pack),
 	  semaphore_(semaphore), deleteMethod_(deleteMethod)
 {
+	if (!semaphore_)
+		pack_ = pack->moveTo(packStorage_, sizeof(packStorage_));
 }
 
 InvokeMessage::~InvokeMessage()
 {
+	if (!semaphore_) {
+		if (static_cast<void *>(pack_) == packStorage_)
+			pack_->~BoundMethodPackBase();
+		else
+			delete pack_;
+	}
+
 	if (deleteMethod_)
 		delete method_;
 }
 
+/**
+ * \brief Allocate memory for an InvokeMessage
+ * \param[in] size The allocation size
+ *
+ * InvokeMessage instances are allocated from a pool of previously freed
+ * messages when possible, to avoid heap allocations for every method
+ * invocation across threads.
+ *
+ * \return A pointer to the allocated memory
+ */
+void *InvokeMessage::operator new(std::size_t size)
+{
+	if (size != sizeof(InvokeMessage))
+		return ::operator new(size);
+
+	if (localPool) {
+		FreeInvokeMessage *msg = localPool;
+		localPool = msg->next;
+		localPoolCount--;
+		return msg;
+	}
+
+	GlobalInvokeMessagePool &pool = globalPool();
+
+	{
+		MutexLocker locker(pool.mutex);
+		if (pool.head) {
+			FreeInvokeMessage *msg = pool.head;
+			pool.head = msg->next;
+			pool.count--;
+			return msg;
+		}
+	}
+
+	return ::operator new(size);
+}
+
+/**
+ * \brief Free memory allocated for an InvokeMessage
+ * \param[in] ptr The memory to free
+ * \param[in] size The allocation size
+ *
+ * The memory is returned to the pool of free messages for later reuse.
+ */
+void InvokeMessage::operator delete(void *ptr, std::size_t size)
+{
+	if (size != sizeof(InvokeMessage)) {
+		::operator delete(ptr);
+		return;
+	}
+
+	FreeInvokeMessage *msg = static_cast<FreeInvokeMessage *>(ptr);
+
+	if (localPoolCount < kLocalPoolSize) {
+		/* Ensure the free list gets flushed when the thread exits. */
+		static_cast<void>(&localPoolFlusher);
+
+		msg->next = localPool;
+		localPool = msg;
+		localPoolCount++;
+		return;
+	}
+
+	releaseToGlobalPool(msg);
+}
+
 /**
  * \fn InvokeMessage::semaphore()
  * \brief Retrieve the message semaphore passed to the constructor
@@ -150,7 +317,7 @@ InvokeMessage::~InvokeMessage()
  */
 void InvokeMessage::invoke()
 {
-	method_->invokePack(pack_.get());
+	method_->invokePack(pack_);
 }
 
 /**
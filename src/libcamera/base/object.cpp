@@ -58,7 +58,8 @@ LOG_DEFINE_CATEGORY(Object)
  * current thread if the \a parent is nullptr.
  */
 Object::Object(Object *parent)
-	: parent_(parent), pendingMessages_(0)
+	: parent_(parent), pendingMessages_(0), queuedMessagesHead_(nullptr),
+	  queuedMessagesTail_(nullptr)
 {
 	thread_ = parent ? parent->thread() : Thread::current();
 
@@ -19,9 +19,12 @@ namespace libcamera {
 namespace {
 
 /*
- * Mutex to protect the SignalBase::slots_ and Object::signals_ lists. If lock
- * contention needs to be decreased, this could be replaced with locks in
- * Object and SignalBase, or with a mutex pool.
+ * Mutex to serialize updates of the SignalBase::slots_ and Object::signals_
+ * lists. The SignalBase::slots_ lists are copy-on-write and are read without
+ * taking this lock, signal emission thus never contends with connect() and
+ * disconnect() on it. Note that std::atomic_load() and std::atomic_store() on
+ * std::shared_ptr are not lock-free, libstdc++ protects them with a pool of
+ * internal mutexes held only for the duration of the pointer copy.
  */
 Mutex signalsLock;
 
@@ -29,43 +32,76 @@ Mutex signalsLock;
 
 void SignalBase::connect(BoundMethodBase *slot)
 {
+	std::shared_ptr<BoundMethodBase> newSlot(slot);
+
 	MutexLocker locker(signalsLock);
 
 	Object *object = slot->object();
 	if (object)
 		object->connect(this);
-	slots_.push_back(slot);
+
+	auto slots = std::make_shared<SlotList>();
+	if (slots_) {
+		slots->reserve(slots_->size() + 1);
+		slots->assign(slots_->begin(), slots_->end());
+	}
+
+	slots->push_back(std::move(newSlot));
+	std::atomic_store(&slots_, std::shared_ptr<const SlotList>(std::move(slots)));
 }
 
 void SignalBase::disconnect(Object *object)
 {
-	disconnect([object](SlotList::iterator &iter) {
-		return (*iter)->match(object);
+	disconnect([object](BoundMethodBase *slot) {
+		return slot->match(object);
 	});
 }
 
-void SignalBase::disconnect(std::function<bool(SlotList::iterator &)> match)
+void SignalBase::disconnect(std::function<bool(BoundMethodBase *)> match)
 {
+	/*
+	 * The removed slots are destroyed when the last reference to the old
+	 * list is released, after the lock is released and once all emitters
+	 * still iterating over the old list are done.
+	 */
+	std::shared_ptr<const SlotList> oldSlots;
+
 	MutexLocker locker(signalsLock);
 
-	for (auto iter = slots_.begin(); iter != slots_.end(); ) {
-		if (match(iter)) {
-			Object *object = (*iter)->object();
+	if (!slots_)
+		return;
+
+	auto slots = std::make_shared<SlotList>();
+	slots->reserve(slots_->size());
+
+	for (const std::shared_ptr<BoundMethodBase> &slot : *slots_) {
+		if (match(slot.get())) {
+			/*
+			 * Mark the slot as disconnected for the emitters still
+			 * iterating over the old list.
+			 */
+			slot->disconnect();
+
+			Object *object = slot->object();
 			if (object)
 				object->disconnect(this);
-
-			delete *iter;
-			iter = slots_.erase(iter);
 		} else {
-			++iter;
+			slots->push_back(slot);
 		}
 	}
+
+	if (slots->size() == slots_->size())
+		return;
+
+	oldSlots = slots_;
+	std::atomic_store(&slots_, slots->empty()
+			  ? std::shared_ptr<const SlotList>()
+			  : std::shared_ptr<const SlotList>(std::move(slots)));
 }
 
-SignalBase::SlotList SignalBase::slots()
+std::shared_ptr<const SignalBase::SlotList> SignalBase::slots() const
 {
-	MutexLocker locker(signalsLock);
-	return slots_;
+	return std::atomic_load(&slots_);
 }
 
 /**
@@ -196,8 +232,16 @@ SignalBase::SlotList SignalBase::slots()
  * of the arguments (when passed by pointer or reference), the modification is
  * thus visible to all subsequently called slots.
  *
+ * Slots connected while the signal is being emitted, from a slot or from
+ * another thread, are called from the next emission. Slots disconnected by a
+ * previously called slot are not called anymore, which allows a slot to delete
+ * the receiver of another slot connected to the same signal. A slot
+ * disconnected concurrently from another thread may still be called once if
+ * its activation has already started.
+ *
  * This function is not \threadsafe, but thread-safety is guaranteed against
- * concurrent connect() and disconnect() calls.
+ * concurrent connect() and disconnect() calls, which never block emission on
+ * the signals lock.
  */
 
 } /* namespace libcamera */
@@ -5,16 +5,23 @@
  * thread.cpp - Thread support
  */
 
+#include <libcamera/base/global_configuration.h>
 #include <libcamera/base/thread.h>
 
 #include <atomic>
 #include <condition_variable>
 #include <list>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/event_dispatcher_epoll.h>
 #include <libcamera/base/event_dispatcher_poll.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/message.h>
@@ -114,10 +121,107 @@ class ThreadMain;
 
 /**
  * \brief A queue of posted messages
+ *
+ * Messages are posted to the queue without locking, by pushing them to a
+ * lock-free singly-linked list of incoming messages. The incoming messages are
+ * moved to the \ref list_ in posting order by collect(), which is called by
+ * the thread that processes the queue with the \ref mutex_ held.
+ *
+ * Messages in the \ref list_ are additionally linked in a per-receiver list,
+ * in posting order, to remove or move the messages of a receiver without
+ * scanning the whole queue. Removing a message from the queue replaces its
+ * \ref list_ entry with a null pointer, which is erased lazily when
+ * dispatching messages.
  */
 class MessageQueue
 {
 public:
+	~MessageQueue()
+	{
+		collect();
+
+		for (std::unique_ptr<Message> &msg : list_) {
+			if (msg)
+				unlink(msg.get());
+		}
+	}
+
+	/**
+	 * \brief Push a message to the incoming messages list
+	 * \param[in] msg The message
+	 *
+	 * \context This function is \threadsafe.
+	 */
+	void push(std::unique_ptr<Message> msg)
+	{
+		Message *message = msg.release();
+		Message *head = incoming_.load(std::memory_order_relaxed);
+
+		do {
+			message->next_ = head;
+		} while (!incoming_.compare_exchange_weak(head, message,
+							  std::memory_order_release,
+							  std::memory_order_relaxed));
+	}
+
+	/**
+	 * \brief Move all incoming messages to the \ref list_
+	 *
+	 * The caller shall hold the \ref mutex_.
+	 */
+	void collect()
+	{
+		Message *head = incoming_.exchange(nullptr, std::memory_order_acquire);
+		if (!head)
+			return;
+
+		/* The incoming list is in reverse posting order. */
+		Message *message = nullptr;
+		while (head) {
+			Message *next = head->next_;
+			head->next_ = message;
+			message = head;
+			head = next;
+		}
+
+		while (message) {
+			Message *next = message->next_;
+			message->next_ = nullptr;
+			message->slot_ = &list_.emplace_back(message);
+			link(message);
+			message = next;
+		}
+	}
+
+	/**
+	 * \brief Remove a message from the queue
+	 * \param[in] msg The message
+	 *
+	 * The caller shall hold the \ref mutex_.
+	 *
+	 * \return The message
+	 */
+	std::unique_ptr<Message> take(Message *msg)
+	{
+		unlink(msg);
+
+		std::unique_ptr<Message> message = std::move(*msg->slot_);
+		msg->slot_ = nullptr;
+		return message;
+	}
+
+	/**
+	 * \brief Move a message from another queue to this queue
+	 * \param[in] msg The message
+	 *
+	 * The message stays in the list of messages of its receiver. The caller
+	 * shall hold the \ref mutex_ of both queues.
+	 */
+	void adopt(Message *msg)
+	{
+		msg->slot_ = &list_.emplace_back(std::move(*msg->slot_));
+	}
+
 	/**
 	 * \brief List of queued Message instances
 	 */
@@ -131,16 +235,66 @@ public:
 	 * calls
 	 */
 	unsigned int recursion_ = 0;
+
+private:
+	static void link(Message *msg)
+	{
+		Object *receiver = msg->receiver_;
+
+		msg->receiverPrev_ = receiver->queuedMessagesTail_;
+		msg->receiverNext_ = nullptr;
+
+		if (receiver->queuedMessagesTail_)
+			receiver->queuedMessagesTail_->receiverNext_ = msg;
+		else
+			receiver->queuedMessagesHead_ = msg;
+		receiver->queuedMessagesTail_ = msg;
+	}
+
+	static void unlink(Message *msg)
+	{
+		Object *receiver = msg->receiver_;
+
+		if (msg->receiverPrev_)
+			msg->receiverPrev_->receiverNext_ = msg->receiverNext_;
+		else
+			receiver->queuedMessagesHead_ = msg->receiverNext_;
+
+		if (msg->receiverNext_)
+			msg->receiverNext_->receiverPrev_ = msg->receiverPrev_;
+		else
+			receiver->queuedMessagesTail_ = msg->receiverPrev_;
+
+		msg->receiverPrev_ = nullptr;
+		msg->receiverNext_ = nullptr;
+	}
+
+	std::atomic<Message *> incoming_ = nullptr;
 };
 
 /**
  * \brief Thread-local internal data
  */
+/*
+ * Attributes of a thread, applied when it starts. An empty name or CPU list,
+ * and the Default scheduling policy, leave the corresponding attributes of the
+ * thread untouched.
+ */
+struct ThreadAttributes {
+	std::string name;
+	std::vector<unsigned int> cpus;
+	Thread::SchedulingPolicy policy = Thread::SchedulingPolicy::Default;
+	int priority = 0;
+
+	void resolve();
+	void apply(pid_t tid, const pthread_t *handle) const;
+};
+
 class ThreadData
 {
 public:
 	ThreadData()
-		: thread_(nullptr), running_(false), dispatcher_(nullptr)
+		: thread_(nullptr), running_(false), tid_(0), dispatcher_(nullptr)
 	{
 	}
 
@@ -150,10 +304,14 @@ private:
 	friend class Thread;
 	friend class ThreadMain;
 
+	void applyAttributes();
+
 	Thread *thread_;
 	bool running_;
 	pid_t tid_;
 
+	ThreadAttributes attributes_;
+
 	Mutex mutex_;
 
 	std::atomic<EventDispatcher *> dispatcher_;
@@ -205,6 +363,227 @@ ThreadData *ThreadData::current()
 	return data;
 }
 
+namespace {
+
+/*
+ * Parse a list of CPUs, made of comma-separated CPU numbers or ranges of CPU
+ * numbers, such as "0,4-7".
+ */
+bool parseCpuList(const std::string &list, std::vector<unsigned int> *cpus)
+{
+	for (const std::string &item : utils::split(list, ",")) {
+		const char *str = item.c_str();
+		char *end;
+
+		unsigned long first = strtoul(str, &end, 10);
+		unsigned long last = first;
+		if (end == str)
+			return false;
+
+		if (*end == '-') {
+			str = end + 1;
+			last = strtoul(str, &end, 10);
+			if (end == str || last < first)
+				return false;
+		}
+
+		if (*end != '\0' || last >= CPU_SETSIZE)
+			return false;
+
+		for (unsigned long cpu = first; cpu <= last; ++cpu)
+			cpus->push_back(cpu);
+	}
+
+	return !cpus->empty();
+}
+
+/*
+ * Parse the thread attributes from the LIBCAMERA_THREADS environment
+ * variable. The variable stores semicolon-separated entries, each made of a
+ * thread name, optionally ending with a '*' wildcard, followed by a list of
+ * colon-separated attributes:
+ *
+ * - "cpus=<list>" sets the CPU affinity of the thread to the CPUs in the list
+ * - "nice=<value>" selects the SCHED_OTHER policy with the given nice value
+ * - "fifo=<priority>" selects the SCHED_FIFO policy with the given priority
+ *
+ * For instance "CameraManager:cpus=4-7:fifo=10;IPA*:cpus=4-7:nice=-5".
+ * Invalid entries are ignored.
+ */
+std::vector<std::pair<std::string, ThreadAttributes>> parseThreadConfiguration()
+{
+	std::vector<std::pair<std::string, ThreadAttributes>> config;
+
+	const char *env = GlobalConfiguration::option("LIBCAMERA_THREADS");
+	if (!env)
+		return config;
+
+	for (const std::string &entry : utils::split(env, ";")) {
+		std::vector<std::string> fields;
+		for (const std::string &field : utils::split(entry, ":"))
+			fields.push_back(field);
+
+		if (fields.size() < 2 || fields[0].empty())
+			continue;
+
+		ThreadAttributes attributes;
+		bool valid = true;
+
+		for (unsigned int i = 1; i < fields.size() && valid; ++i) {
+			const std::string &field = fields[i];
+			size_t pos = field.find('=');
+			if (pos == std::string::npos) {
+				valid = false;
+				break;
+			}
+
+			std::string key = field.substr(0, pos);
+			std::string value = field.substr(pos + 1);
+
+			if (key == "cpus") {
+				valid = parseCpuList(value, &attributes.cpus);
+				continue;
+			}
+
+			char *end;
+			long priority = strtol(value.c_str(), &end, 10);
+			if (value.empty() || *end != '\0') {
+				valid = false;
+			} else if (key == "nice") {
+				attributes.policy = Thread::SchedulingPolicy::Normal;
+				attributes.priority = priority;
+			} else if (key == "fifo") {
+				attributes.policy = Thread::SchedulingPolicy::Fifo;
+				attributes.priority = priority;
+			} else {
+				valid = false;
+			}
+		}
+
+		if (!valid) {
+			LOG(Thread, Warning)
+				<< "Invalid thread configuration '" << entry << "'";
+			continue;
+		}
+
+		config.emplace_back(fields[0], std::move(attributes));
+	}
+
+	return config;
+}
+
+} /* namespace */
+
+/*
+ * Override the attributes with the configuration from the environment. The
+ * first entry of the LIBCAMERA_THREADS environment variable matching the
+ * thread name overrides the attributes it specifies.
+ */
+void ThreadAttributes::resolve()
+{
+	static const std::vector<std::pair<std::string, ThreadAttributes>> config =
+		parseThreadConfiguration();
+
+	if (name.empty())
+		return;
+
+	for (const auto &[pattern, attributes] : config) {
+		size_t wildcard = pattern.find('*');
+		bool match = wildcard == std::string::npos
+			   ? pattern == name
+			   : !name.compare(0, wildcard, pattern, 0, wildcard);
+		if (!match)
+			continue;
+
+		if (!attributes.cpus.empty())
+			cpus = attributes.cpus;
+
+		if (attributes.policy != Thread::SchedulingPolicy::Default) {
+			policy = attributes.policy;
+			priority = attributes.priority;
+		}
+
+		break;
+	}
+}
+
+/*
+ * Apply the attributes to the thread \a tid. The name is only set if the
+ * pthread \a handle of the thread is known. Failures are logged but not fatal,
+ * the thread keeps running with its current attributes. Selecting the
+ * SCHED_FIFO policy or negative nice values typically requires the
+ * CAP_SYS_NICE capability.
+ */
+void ThreadAttributes::apply(pid_t tid, const pthread_t *handle) const
+{
+	if (!name.empty() && handle) {
+		/* Thread names are limited to 15 characters. */
+		int ret = pthread_setname_np(*handle, name.substr(0, 15).c_str());
+		if (ret)
+			LOG(Thread, Warning)
+				<< "Failed to set thread name '" << name
+				<< "': " << strerror(ret);
+	}
+
+	if (!cpus.empty()) {
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		for (unsigned int cpu : cpus)
+			CPU_SET(cpu, &cpuset);
+
+		if (sched_setaffinity(tid, sizeof(cpuset), &cpuset))
+			LOG(Thread, Warning)
+				<< "Failed to set CPU affinity of thread '" << name
+				<< "': " << strerror(errno);
+	}
+
+	struct sched_param param = {};
+	int ret = 0;
+
+	switch (policy) {
+	case Thread::SchedulingPolicy::Default:
+		break;
+
+	case Thread::SchedulingPolicy::Normal:
+		ret = sched_setscheduler(tid, SCHED_OTHER, &param);
+		if (!ret)
+			ret = setpriority(PRIO_PROCESS, tid, priority);
+		break;
+
+	case Thread::SchedulingPolicy::Fifo:
+		param.sched_priority = priority;
+		ret = sched_setscheduler(tid, SCHED_FIFO, &param);
+		break;
+	}
+
+	if (ret)
+		LOG(Thread, Warning)
+			<< "Failed to set scheduling policy of thread '" << name
+			<< "': " << strerror(errno);
+}
+
+/* Apply the thread attributes if the thread is running, with the mutex held. */
+void ThreadData::applyAttributes()
+{
+	if (!running_ || !tid_)
+		return;
+
+	ThreadAttributes attributes = attributes_;
+	attributes.resolve();
+
+	pthread_t handle;
+	const pthread_t *handlePtr = nullptr;
+	if (currentThreadData == this) {
+		handle = pthread_self();
+		handlePtr = &handle;
+	} else if (thread_->thread_.joinable()) {
+		handle = thread_->thread_.native_handle();
+		handlePtr = &handle;
+	}
+
+	attributes.apply(tid_, handlePtr);
+}
+
 /**
  * \typedef Mutex
  * \brief An alias for std::mutex
@@ -267,6 +646,29 @@ ThreadData *ThreadData::current()
  * as messages posted after the thread has stopped. They will be processed when
  * the thread is restarted. If the thread is never restarted, they will be
  * deleted without being processed when the Thread instance is destroyed.
+ *
+ * \section thread-attributes Thread Attributes
+ *
+ * Threads can be given a name, a CPU affinity and a scheduling policy with
+ * setName(), setCpuAffinity() and setScheduling(). The attributes are applied
+ * when the thread starts, or immediately if it is already running. The name
+ * identifies the role of the thread, and the attributes can be overridden per
+ * role by the user through the LIBCAMERA_THREADS environment variable, which
+ * stores a semicolon-separated list of entries. Each entry contains a thread
+ * name, optionally ending with a '*' wildcard, and a list of colon-separated
+ * attributes:
+ *
+ * - "cpus=<list>" sets the CPU affinity to a comma-separated list of CPU
+ *   numbers or CPU ranges
+ * - "nice=<value>" selects the SCHED_OTHER policy with the given nice value
+ * - "fifo=<priority>" selects the SCHED_FIFO policy with the given priority
+ *
+ * For instance, "CameraManager:cpus=4-7:fifo=10;IPA*:cpus=4-7:nice=-5" keeps
+ * the camera manager and IPA threads on CPUs 4 to 7, and runs the camera
+ * manager thread with real-time priority.
+ *
+ * Threads not created through the Thread class can be named, and receive the
+ * attributes configured for their role, with setCurrentName().
  */
 
 /**
@@ -323,8 +725,12 @@ void Thread::startThread()
 	 */
 	thread_local ThreadCleaner cleaner(this, &Thread::finishThread);
 
-	data_->tid_ = syscall(SYS_gettid);
-	currentThreadData = data_;
+	{
+		MutexLocker locker(data_->mutex_);
+		data_->tid_ = syscall(SYS_gettid);
+		currentThreadData = data_;
+		data_->applyAttributes();
+	}
 
 	run();
 }
@@ -467,6 +873,108 @@ bool Thread::isRunning()
  * \brief Signal the end of thread execution
  */
 
+/**
+ * \brief Set the name of the thread
+ * \param[in] name The thread name
+ *
+ * The name identifies the role of the thread. It is visible to system tools,
+ * truncated to 15 characters, and selects the attributes configured for the
+ * thread in the LIBCAMERA_THREADS environment variable. See \ref
+ * thread-attributes for more information.
+ *
+ * \context This function is \threadsafe.
+ */
+void Thread::setName(const std::string &name)
+{
+	MutexLocker locker(data_->mutex_);
+	data_->attributes_.name = name;
+	data_->applyAttributes();
+}
+
+/**
+ * \brief Retrieve the name of the thread
+ * \context This function is \threadsafe.
+ * \return The thread name set with setName(), or an empty string if no name
+ * has been set
+ */
+std::string Thread::name() const
+{
+	MutexLocker locker(data_->mutex_);
+	return data_->attributes_.name;
+}
+
+/**
+ * \brief Set the CPUs the thread is allowed to run on
+ * \param[in] cpus The CPU numbers
+ *
+ * An empty \a cpus list leaves the CPU affinity inherited from the thread
+ * that starts the thread untouched. The affinity configured in the
+ * LIBCAMERA_THREADS environment variable, if any, takes precedence over
+ * \a cpus.
+ *
+ * \context This function is \threadsafe.
+ */
+void Thread::setCpuAffinity(const std::vector<unsigned int> &cpus)
+{
+	MutexLocker locker(data_->mutex_);
+	data_->attributes_.cpus = cpus;
+	data_->applyAttributes();
+}
+
+/**
+ * \enum Thread::SchedulingPolicy
+ * \brief The scheduling policy of a thread
+ * \var Thread::SchedulingPolicy::Default
+ * \brief Keep the scheduling policy inherited from the thread that starts the
+ * thread
+ * \var Thread::SchedulingPolicy::Normal
+ * \brief The SCHED_OTHER time-sharing policy, the priority is a nice value
+ * \var Thread::SchedulingPolicy::Fifo
+ * \brief The SCHED_FIFO real-time policy, the priority is a real-time
+ * priority between 1 and 99
+ */
+
+/**
+ * \brief Set the scheduling policy and priority of the thread
+ * \param[in] policy The scheduling policy
+ * \param[in] priority The nice value or real-time priority, depending on
+ * \a policy
+ *
+ * The scheduling configured in the LIBCAMERA_THREADS environment variable, if
+ * any, takes precedence over \a policy and \a priority. Failures to apply
+ * the scheduling policy, usually due to missing privileges, are logged and
+ * otherwise ignored.
+ *
+ * \context This function is \threadsafe.
+ */
+void Thread::setScheduling(SchedulingPolicy policy, int priority)
+{
+	MutexLocker locker(data_->mutex_);
+	data_->attributes_.policy = policy;
+	data_->attributes_.priority = priority;
+	data_->applyAttributes();
+}
+
+/**
+ * \brief Set the name of the current thread
+ * \param[in] name The thread name
+ *
+ * This function names the calling thread, and applies the attributes
+ * configured for \a name in the LIBCAMERA_THREADS environment variable. It is
+ * meant for threads that are not managed by a Thread instance, such as
+ * std::thread workers, to participate in the thread configuration. Threads
+ * managed by a Thread instance shall use setName() instead.
+ */
+void Thread::setCurrentName(const std::string &name)
+{
+	ThreadAttributes attributes;
+	attributes.name = name;
+	attributes.resolve();
+
+	pthread_t handle = pthread_self();
+	attributes.apply(syscall(SYS_gettid), &handle);
+}
+
 /**
  * \brief Retrieve the Thread instance for the current thread
  * \context This function is \threadsafe.
@@ -500,6 +1008,12 @@ pid_t Thread::currentId()
  * This function retrieves the internal event dispatcher for the thread. The
  * returned event dispatcher is valid until the thread is destroyed.
  *
+ * Unless an event dispatcher has been set with setEventDispatcher(), a default
+ * event dispatcher is created the first time this function is called. The
+ * EventDispatcherPoll is used by default, the EventDispatcherEpoll can be
+ * selected instead by setting the LIBCAMERA_EVENT_DISPATCHER environment
+ * variable to "epoll".
+ *
  * \context This function is \threadsafe.
  *
  * \return Pointer to the event dispatcher
@@ -507,12 +1021,52 @@ pid_t Thread::currentId()
 EventDispatcher *Thread::eventDispatcher()
 {
 	if (!data_->dispatcher_.load(std::memory_order_relaxed))
-		data_->dispatcher_.store(new EventDispatcherPoll(),
+		data_->dispatcher_.store(createEventDispatcher(),
 					 std::memory_order_release);
 
 	return data_->dispatcher_.load(std::memory_order_relaxed);
 }
 
+/**
+ * \brief Set the event dispatcher for the thread
+ * \param[in] dispatcher The event dispatcher
+ *
+ * This function sets the event dispatcher used by the thread, overriding the
+ * default event dispatcher. It takes ownership of the \a dispatcher, which
+ * will be destroyed along with the thread.
+ *
+ * The event dispatcher can't be changed once it has been created or set. This
+ * function shall thus be called before the thread is started and before
+ * eventDispatcher() is called for the first time. Otherwise it logs an error
+ * and destroys \a dispatcher.
+ */
+void Thread::setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher)
+{
+	if (data_->dispatcher_.load(std::memory_order_relaxed)) {
+		LOG(Thread, Error) << "Event dispatcher already set";
+		return;
+	}
+
+	data_->dispatcher_.store(dispatcher.release(),
+				 std::memory_order_release);
+}
+
+EventDispatcher *Thread::createEventDispatcher()
+{
+	const char *name = GlobalConfiguration::option("LIBCAMERA_EVENT_DISPATCHER");
+	if (!name || !strcmp(name, "poll"))
+		return new EventDispatcherPoll();
+
+	if (!strcmp(name, "epoll"))
+		return new EventDispatcherEpoll();
+
+	LOG(Thread, Warning)
+		<< "Unknown event dispatcher '" << name
+		<< "', using poll";
+
+	return new EventDispatcherPoll();
+}
+
 /**
  * \brief Post a message to the thread for the \a receiver
  * \param[in] msg The message
@@ -541,10 +1095,12 @@ void Thread::postMessage(std::unique_ptr<Message> msg, Object *receiver)
 
 	ASSERT(data_ == receiver->thread()->data_);
 
-	MutexLocker locker(data_->messages_.mutex_);
-	data_->messages_.list_.push_back(std::move(msg));
+	/*
+	 * Increment the pending messages counter first, to ensure it can't
+	 * underflow if the message gets dispatched right after being pushed.
+	 */
 	receiver->pendingMessages_++;
-	locker.unlock();
+	data_->messages_.push(std::move(msg));
 
 	EventDispatcher *dispatcher =
 		data_->dispatcher_.load(std::memory_order_acquire);
@@ -562,24 +1118,22 @@ void Thread::removeMessages(Object *receiver)
 {
 	ASSERT(data_ == receiver->thread()->data_);
 
-	MutexLocker locker(data_->messages_.mutex_);
 	if (!receiver->pendingMessages_)
 		return;
 
+	MutexLocker locker(data_->messages_.mutex_);
+	data_->messages_.collect();
+
+	/*
+	 * Move the messages to the pending deletion list to delete them after
+	 * releasing the lock. The messages list elements will contain a null
+	 * pointer, and will be removed when dispatching messages.
+	 */
 	std::vector<std::unique_ptr<Message>> toDelete;
-	for (std::unique_ptr<Message> &msg : data_->messages_.list_) {
-		if (!msg)
-			continue;
-		if (msg->receiver_ != receiver)
-			continue;
+	toDelete.reserve(receiver->pendingMessages_);
 
-		/*
-		 * Move the message to the pending deletion list to delete it
-		 * after releasing the lock. The messages list element will
-		 * contain a null pointer, and will be removed when dispatching
-		 * messages.
-		 */
-		toDelete.push_back(std::move(msg));
+	while (Message *msg = receiver->queuedMessagesHead_) {
+		toDelete.push_back(data_->messages_.take(msg));
 		receiver->pendingMessages_--;
 	}
 
@@ -612,6 +1166,7 @@ void Thread::dispatchMessages(Message::Type type)
 	++data_->messages_.recursion_;
 
 	MutexLocker locker(data_->messages_.mutex_);
+	data_->messages_.collect();
 
 	std::list<std::unique_ptr<Message>> &messages = data_->messages_.list_;
 
@@ -627,7 +1182,7 @@ void Thread::dispatchMessages(Message::Type type)
 		 * will cause recursive calls to ignore the entry, and the erase
 		 * loop at the end of the function to delete it from the list.
 		 */
-		std::unique_ptr<Message> message = std::move(msg);
+		std::unique_ptr<Message> message = data_->messages_.take(msg.get());
 
 		Object *receiver = message->receiver_;
 		ASSERT(data_ == receiver->thread()->data_);
@@ -637,6 +1192,12 @@ void Thread::dispatchMessages(Message::Type type)
 		receiver->message(message.get());
 		message.reset();
 		locker.lock();
+
+		/*
+		 * Collect messages posted in the meantime to deliver them
+		 * in the same call.
+		 */
+		data_->messages_.collect();
 	}
 
 	/*
@@ -675,19 +1236,14 @@ void Thread::moveObject(Object *object, ThreadData *currentData,
 {
 	/* Move pending messages to the message queue of the new thread. */
 	if (object->pendingMessages_) {
-		unsigned int movedMessages = 0;
-
-		for (std::unique_ptr<Message> &msg : currentData->messages_.list_) {
-			if (!msg)
-				continue;
-			if (msg->receiver_ != object)
-				continue;
+		currentData->messages_.collect();
+		targetData->messages_.collect();
 
-			targetData->messages_.list_.push_back(std::move(msg));
-			movedMessages++;
-		}
+		for (Message *msg = object->queuedMessagesHead_; msg;
+		     msg = msg->receiverNext_)
+			targetData->messages_.adopt(msg);
 
-		if (movedMessages) {
+		if (object->queuedMessagesHead_) {
 			EventDispatcher *dispatcher =
 				targetData->dispatcher_.load(std::memory_order_acquire);
 			if (dispatcher)
@@ -42,6 +42,12 @@ LOG_DEFINE_CATEGORY(Timer)
  * past, the timer will time out immediately when execution returns to the
  * event loop of the timer's thread.
  *
+ * Timers that don't need to time out precisely, such as watchdogs, can be
+ * given a slack with setSlack(). The timer may then time out at any time
+ * between its deadline and the deadline plus the slack, which allows the event
+ * dispatcher to coalesce the expiration of nearby timers and reduce the number
+ * of wakeups.
+ *
  * Timers run in the thread they belong to, and thus emit the \a ref timeout
  * signal from that thread. To avoid race conditions they must not be started
  * or stopped from a different thread, attempts to do so will be rejected and
@@ -53,7 +59,7 @@ LOG_DEFINE_CATEGORY(Timer)
  * \param[in] parent The parent Object
  */
 Timer::Timer(Object *parent)
-	: Object(parent), running_(false)
+	: Object(parent), running_(false), slack_(0)
 {
 }
 
@@ -162,6 +168,23 @@ bool Timer::isRunning() const
  * \return The timer deadline
  */
 
+/**
+ * \fn Timer::setSlack()
+ * \brief Set the timer slack
+ * \param[in] slack The maximum delay after the deadline at which the timer may
+ * time out
+ *
+ * The slack defaults to zero, making the timer time out as close to its
+ * deadline as possible. The new slack takes effect the next time the timer is
+ * started.
+ */
+
+/**
+ * \fn Timer::slack()
+ * \brief Retrieve the timer slack
+ * \return The timer slack
+ */
+
 /**
  * \var Timer::timeout
  * \brief Signal emitted when the timer times out
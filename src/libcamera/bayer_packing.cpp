@@ -0,0 +1,406 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * bayer_packing.cpp - Conversion of raw Bayer lines between packings
+ */
+
+#include "libcamera/internal/bayer_packing.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+
+/**
+ * \file bayer_packing.h
+ * \brief Conversion of raw Bayer lines between packings
+ *
+ * Raw Bayer formats store their samples with different packings, described by
+ * BayerFormat::Packing. The functions in this file convert lines of raw
+ * samples between their packed representation in memory and arrays of
+ * samples, for software processing of raw frames.
+ *
+ * The functions operate on full pixel groups (4 pixels for 10-bit CSI-2
+ * packing, 2 pixels for 12-bit CSI-2 packing and 25 pixels for IPU3 packing),
+ * in the natural unit of the packing instead of pixel by pixel. When the
+ * width isn't a multiple of the group size, the last group is read in full
+ * from the packed line, as the hardware always writes complete groups, and
+ * only the pixels within the requested width are written to the output.
+ * Packing functions write complete groups, padding them with zeros.
+ *
+ * Bytes in unpacked formats with more than 8 bits per sample are stored in
+ * little-endian order.
+ */
+
+namespace libcamera {
+
+/**
+ * \namespace libcamera::bayer
+ * \brief Raw Bayer line conversion functions
+ */
+
+namespace bayer {
+
+namespace {
+
+/* Number of pixels and bytes in a packed group of pixels. */
+constexpr unsigned int kCSI2P10GroupPixels = 4;
+constexpr unsigned int kCSI2P10GroupBytes = 5;
+constexpr unsigned int kCSI2P12GroupPixels = 2;
+constexpr unsigned int kCSI2P12GroupBytes = 3;
+constexpr unsigned int kIPU3GroupPixels = 25;
+constexpr unsigned int kIPU3GroupBytes = 32;
+
+enum class Layout {
+	Invalid,
+	U8,
+	U16,
+	CSI2P10,
+	CSI2P12,
+	IPU3,
+};
+
+Layout layout(const BayerFormat &format)
+{
+	switch (format.packing) {
+	case BayerFormat::Packing::None:
+		if (format.bitDepth == 8)
+			return Layout::U8;
+		if (format.bitDepth > 8 && format.bitDepth <= 16)
+			return Layout::U16;
+		break;
+
+	case BayerFormat::Packing::CSI2:
+		if (format.bitDepth == 10)
+			return Layout::CSI2P10;
+		if (format.bitDepth == 12)
+			return Layout::CSI2P12;
+		break;
+
+	case BayerFormat::Packing::IPU3:
+		if (format.bitDepth == 10)
+			return Layout::IPU3;
+		break;
+	}
+
+	return Layout::Invalid;
+}
+
+/*
+ * Unpack a group of pixels to an array of samples, calling a function for
+ * each sample. Groups are always unpacked in full, to let the compiler keep
+ * the whole group in registers, the caller handles the last partial group.
+ */
+template<typename Out>
+inline void unpackGroupCSI2P10(const uint8_t *in, Out out)
+{
+	uint8_t lsbs = in[4];
+
+	out(0, in[0] << 2 | (lsbs & 0x03));
+	out(1, in[1] << 2 | ((lsbs >> 2) & 0x03));
+	out(2, in[2] << 2 | ((lsbs >> 4) & 0x03));
+	out(3, in[3] << 2 | (lsbs >> 6));
+}
+
+template<typename Out>
+inline void unpackGroupCSI2P12(const uint8_t *in, Out out)
+{
+	out(0, in[0] << 4 | (in[2] & 0x0f));
+	out(1, in[1] << 4 | (in[2] >> 4));
+}
+
+/*
+ * The IPU3 packs 25 pixels in 32 bytes, as six groups of four pixels in five
+ * bytes, with the least significant bits first, followed by a last pixel in two
+ * bytes and unused padding.
+ */
+template<typename Out>
+inline void unpackGroupIPU3(const uint8_t *in, Out out)
+{
+	for (unsigned int i = 0; i < 24; i += 4, in += 5) {
+		out(i + 0, (in[1] & 0x03) << 8 | in[0]);
+		out(i + 1, (in[2] & 0x0f) << 6 | in[1] >> 2);
+		out(i + 2, (in[3] & 0x3f) << 4 | in[2] >> 4);
+		out(i + 3, in[4] << 2 | in[3] >> 6);
+	}
+
+	out(24, (in[1] & 0x03) << 8 | in[0]);
+}
+
+/*
+ * Unpack a line of packed groups, storing the samples returned by the group
+ * unpacking function through the store function.
+ */
+template<unsigned int GroupPixels, unsigned int GroupBytes,
+	 typename Unpack, typename T, typename Store>
+void unpackGroups(const uint8_t *src, T *dst, unsigned int width,
+		  Unpack unpack, Store store)
+{
+	unsigned int groups = width / GroupPixels;
+
+	for (unsigned int i = 0; i < groups; i++) {
+		unpack(src, [dst, store](unsigned int x, unsigned int value) {
+			dst[x] = store(value);
+		});
+		src += GroupBytes;
+		dst += GroupPixels;
+	}
+
+	unsigned int remaining = width % GroupPixels;
+	if (!remaining)
+		return;
+
+	T last[GroupPixels];
+	unpack(src, [&last, store](unsigned int x, unsigned int value) {
+		last[x] = store(value);
+	});
+	std::copy(last, last + remaining, dst);
+}
+
+/*
+ * Pack a line of samples in groups, padding the last partial group with
+ * zeros.
+ */
+template<unsigned int GroupPixels, unsigned int GroupBytes, typename Pack>
+void packGroups(const uint16_t *src, uint8_t *dst, unsigned int width,
+		Pack pack)
+{
+	unsigned int groups = width / GroupPixels;
+
+	for (unsigned int i = 0; i < groups; i++) {
+		pack(src, dst);
+		src += GroupPixels;
+		dst += GroupBytes;
+	}
+
+	unsigned int remaining = width % GroupPixels;
+	if (!remaining)
+		return;
+
+	uint16_t last[GroupPixels] = {};
+	std::copy(src, src + remaining, last);
+	pack(last, dst);
+}
+
+template<typename T, typename Store>
+int unpack(const BayerFormat &format, const uint8_t *src, T *dst,
+	   unsigned int width, Store store)
+{
+	switch (layout(format)) {
+	case Layout::U8:
+		for (unsigned int x = 0; x < width; x++)
+			dst[x] = store(src[x]);
+		return 0;
+
+	case Layout::U16:
+		for (unsigned int x = 0; x < width; x++, src += 2)
+			dst[x] = store(src[0] | src[1] << 8);
+		return 0;
+
+	case Layout::CSI2P10:
+		unpackGroups<kCSI2P10GroupPixels, kCSI2P10GroupBytes>(
+			src, dst, width,
+			[](const uint8_t *in, auto out) { unpackGroupCSI2P10(in, out); },
+			store);
+		return 0;
+
+	case Layout::CSI2P12:
+		unpackGroups<kCSI2P12GroupPixels, kCSI2P12GroupBytes>(
+			src, dst, width,
+			[](const uint8_t *in, auto out) { unpackGroupCSI2P12(in, out); },
+			store);
+		return 0;
+
+	case Layout::IPU3:
+		unpackGroups<kIPU3GroupPixels, kIPU3GroupBytes>(
+			src, dst, width,
+			[](const uint8_t *in, auto out) { unpackGroupIPU3(in, out); },
+			store);
+		return 0;
+
+	case Layout::Invalid:
+		break;
+	}
+
+	return -EINVAL;
+}
+
+} /* namespace */
+
+/**
+ * \brief Compute the size of a packed line
+ * \param[in] format The Bayer format
+ * \param[in] width The line width in pixels
+ *
+ * The size is rounded up to complete pixel groups, but doesn't include any
+ * additional padding a device may require at the end of lines.
+ *
+ * \return The minimum number of bytes needed to store a line of \a width
+ * pixels in \a format, or 0 if the format isn't supported
+ */
+unsigned int lineSize(const BayerFormat &format, unsigned int width)
+{
+	switch (layout(format)) {
+	case Layout::U8:
+		return width;
+	case Layout::U16:
+		return width * 2;
+	case Layout::CSI2P10:
+		return (width + kCSI2P10GroupPixels - 1) / kCSI2P10GroupPixels
+		       * kCSI2P10GroupBytes;
+	case Layout::CSI2P12:
+		return (width + kCSI2P12GroupPixels - 1) / kCSI2P12GroupPixels
+		       * kCSI2P12GroupBytes;
+	case Layout::IPU3:
+		return (width + kIPU3GroupPixels - 1) / kIPU3GroupPixels
+		       * kIPU3GroupBytes;
+	case Layout::Invalid:
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Unpack a line of raw pixels to 16-bit samples
+ * \param[in] format The Bayer format of the source line
+ * \param[in] src The source line
+ * \param[out] dst The unpacked samples, \a width entries
+ * \param[in] width The number of pixels to unpack
+ *
+ * The samples are stored with their least significant bit in bit 0, in the
+ * [0, 2^bitDepth - 1] range.
+ *
+ * \return 0 on success, or -EINVAL if the format isn't supported
+ */
+int unpackLine(const BayerFormat &format, const uint8_t *src, uint16_t *dst,
+	       unsigned int width)
+{
+	return unpack(format, src, dst, width,
+		      [](unsigned int value) { return static_cast<uint16_t>(value); });
+}
+
+/**
+ * \brief Unpack the 8 most significant bits of a line of raw pixels
+ * \param[in] format The Bayer format of the source line
+ * \param[in] src The source line
+ * \param[out] dst The unpacked samples, \a width entries
+ * \param[in] width The number of pixels to unpack
+ *
+ * This function is meant for processing that doesn't need the full precision
+ * of the samples, such as previews or thumbnails. For the CSI-2 packings, the
+ * most significant bits of each pixels are stored in a byte of their own,
+ * and are copied directly without unpacking the least significant bits.
+ *
+ * \return 0 on success, or -EINVAL if the format isn't supported
+ */
+int unpackLineMsb8(const BayerFormat &format, const uint8_t *src, uint8_t *dst,
+		   unsigned int width)
+{
+	switch (layout(format)) {
+	case Layout::U8:
+		memcpy(dst, src, width);
+		return 0;
+
+	case Layout::CSI2P10: {
+		unsigned int x;
+
+		for (x = 0; x + 4 <= width; x += 4, src += 5) {
+			dst[x + 0] = src[0];
+			dst[x + 1] = src[1];
+			dst[x + 2] = src[2];
+			dst[x + 3] = src[3];
+		}
+
+		memcpy(dst + x, src, width - x);
+		return 0;
+	}
+
+	case Layout::CSI2P12: {
+		unsigned int x;
+
+		for (x = 0; x + 2 <= width; x += 2, src += 3) {
+			dst[x + 0] = src[0];
+			dst[x + 1] = src[1];
+		}
+
+		if (x < width)
+			dst[x] = src[0];
+		return 0;
+	}
+
+	default:
+		break;
+	}
+
+	unsigned int shift = format.bitDepth - 8;
+	return unpack(format, src, dst, width, [shift](unsigned int value) {
+		return static_cast<uint8_t>(value >> shift);
+	});
+}
+
+/**
+ * \brief Pack a line of 16-bit samples to raw pixels
+ * \param[in] format The Bayer format of the destination line
+ * \param[in] src The samples to pack, \a width entries
+ * \param[out] dst The destination line, at least lineSize(format, width) bytes
+ * \param[in] width The number of pixels to pack
+ *
+ * The samples are expected in the [0, 2^bitDepth - 1] range, with their least
+ * significant bit in bit 0. Higher bits are ignored. The last group of pixels
+ * is padded with zeros if \a width isn't a multiple of the group size.
+ *
+ * Packing to the IPU3 format isn't supported.
+ *
+ * \return 0 on success, or -EINVAL if the format isn't supported
+ */
+int packLine(const BayerFormat &format, const uint16_t *src, uint8_t *dst,
+	     unsigned int width)
+{
+	switch (layout(format)) {
+	case Layout::U8:
+		for (unsigned int x = 0; x < width; x++)
+			dst[x] = src[x];
+		return 0;
+
+	case Layout::U16: {
+		uint16_t mask = (1U << format.bitDepth) - 1;
+		for (unsigned int x = 0; x < width; x++, dst += 2) {
+			uint16_t value = src[x] & mask;
+			dst[0] = value;
+			dst[1] = value >> 8;
+		}
+		return 0;
+	}
+
+	case Layout::CSI2P10:
+		packGroups<kCSI2P10GroupPixels, kCSI2P10GroupBytes>(
+			src, dst, width, [](const uint16_t *in, uint8_t *out) {
+				out[0] = in[0] >> 2;
+				out[1] = in[1] >> 2;
+				out[2] = in[2] >> 2;
+				out[3] = in[3] >> 2;
+				out[4] = (in[0] & 0x03) | (in[1] & 0x03) << 2 |
+					 (in[2] & 0x03) << 4 | (in[3] & 0x03) << 6;
+			});
+		return 0;
+
+	case Layout::CSI2P12:
+		packGroups<kCSI2P12GroupPixels, kCSI2P12GroupBytes>(
+			src, dst, width, [](const uint16_t *in, uint8_t *out) {
+				out[0] = in[0] >> 4;
+				out[1] = in[1] >> 4;
+				out[2] = (in[0] & 0x0f) | (in[1] & 0x0f) << 4;
+			});
+		return 0;
+
+	default:
+		break;
+	}
+
+	return -EINVAL;
+}
+
+} /* namespace bayer */
+
+} /* namespace libcamera */
@@ -48,6 +48,12 @@ LOG_DEFINE_CATEGORY(Serialization)
  * advances the internal access location, but allows the carved out memory to
  * be accessed at a later time.
  *
+ * A write buffer can also be created from a std::vector, in which case it
+ * appends data to the vector and grows it as needed. This allows serializing
+ * data in a single pass, without first computing the size of the serialized
+ * data to allocate a large enough memory area. Buffers carved out of a growable
+ * buffer have a fixed size, and stay valid when the vector is later grown.
+ *
  * All accesses beyond the end of the buffer (read, write, skip or carve out)
  * are blocked. The first of such accesses causes a message to be logged, and
  * the buffer being marked as having overflown. If the buffer has been carved
@@ -63,8 +69,9 @@ LOG_DEFINE_CATEGORY(Serialization)
  * \param[in] size The size of the memory area to wrap
  */
 ByteStreamBuffer::ByteStreamBuffer(const uint8_t *base, size_t size)
-	: parent_(nullptr), base_(base), size_(size), overflow_(false),
-	  read_(base), write_(nullptr)
+	: parent_(nullptr), base_(base), storage_(nullptr), start_(0),
+	  size_(size), offset_(0), overflow_(false), write_(false),
+	  growable_(false)
 {
 }
 
@@ -75,8 +82,26 @@ ByteStreamBuffer::ByteStreamBuffer(const uint8_t *base, size_t size)
  * \param[in] size The size of the memory area to wrap
  */
 ByteStreamBuffer::ByteStreamBuffer(uint8_t *base, size_t size)
-	: parent_(nullptr), base_(base), size_(size), overflow_(false),
-	  read_(nullptr), write_(base)
+	: parent_(nullptr), base_(base), storage_(nullptr), start_(0),
+	  size_(size), offset_(0), overflow_(false), write_(true),
+	  growable_(false)
+{
+}
+
+/**
+ * \brief Construct a growable write ByteStreamBuffer appending to \a storage
+ * \param[in] storage The vector to append data to
+ *
+ * The buffer starts at the end of the current contents of \a storage, and
+ * grows the vector as data is written, skipped or carved out. The size() of the
+ * buffer is the amount of data appended so far. The \a storage vector must not
+ * be modified by other means as long as the buffer, or any buffer carved out of
+ * it, is in use.
+ */
+ByteStreamBuffer::ByteStreamBuffer(std::vector<uint8_t> &storage)
+	: parent_(nullptr), base_(nullptr), storage_(&storage),
+	  start_(storage.size()), size_(0), offset_(0), overflow_(false),
+	  write_(true), growable_(true)
 {
 }
 
@@ -105,26 +130,38 @@ ByteStreamBuffer &ByteStreamBuffer::operator=(ByteStreamBuffer &&other)
 {
 	parent_ = other.parent_;
 	base_ = other.base_;
+	storage_ = other.storage_;
+	start_ = other.start_;
 	size_ = other.size_;
+	offset_ = other.offset_;
 	overflow_ = other.overflow_;
-	read_ = other.read_;
 	write_ = other.write_;
+	growable_ = other.growable_;
 
 	other.parent_ = nullptr;
 	other.base_ = nullptr;
+	other.storage_ = nullptr;
+	other.start_ = 0;
 	other.size_ = 0;
+	other.offset_ = 0;
 	other.overflow_ = false;
-	other.read_ = nullptr;
-	other.write_ = nullptr;
+	other.write_ = false;
+	other.growable_ = false;
 
 	return *this;
 }
 
 /**
- * \fn ByteStreamBuffer::base()
  * \brief Retrieve a pointer to the start location of the managed memory buffer
+ *
+ * For growable buffers, the pointer is invalidated when the buffer grows.
+ *
  * \return A pointer to the managed memory buffer
  */
+const uint8_t *ByteStreamBuffer::base() const
+{
+	return storage_ ? storage_->data() + start_ : base_;
+}
 
 /**
  * \fn ByteStreamBuffer::offset()
@@ -152,6 +189,29 @@ void ByteStreamBuffer::setOverflow()
 	overflow_ = true;
 }
 
+/*
+ * Check if \a size bytes can be accessed at the current location, growing the
+ * buffer if possible.
+ */
+bool ByteStreamBuffer::reserve(size_t size)
+{
+	if (size <= size_ - offset_)
+		return true;
+
+	if (!growable_)
+		return false;
+
+	size_ = offset_ + size;
+	storage_->resize(start_ + size_);
+	return true;
+}
+
+uint8_t *ByteStreamBuffer::writeLocation()
+{
+	/* Write buffers are always constructed from non-const memory. */
+	return const_cast<uint8_t *>(base()) + offset_;
+}
+
 /**
  * \brief Carve out an area of \a size bytes into a new ByteStreamBuffer
  * \param[in] size The size of the newly created memory buffer
@@ -166,11 +226,10 @@ void ByteStreamBuffer::setOverflow()
  */
 ByteStreamBuffer ByteStreamBuffer::carveOut(size_t size)
 {
-	if (!size_ || overflow_)
+	if ((!size_ && !growable_) || overflow_)
 		return ByteStreamBuffer(static_cast<const uint8_t *>(nullptr), 0);
 
-	const uint8_t *curr = read_ ? read_ : write_;
-	if (curr + size > base_ + size_) {
+	if (!reserve(size)) {
 		LOG(Serialization, Error)
 			<< "Unable to reserve " << size << " bytes";
 		setOverflow();
@@ -178,17 +237,22 @@ ByteStreamBuffer ByteStreamBuffer::carveOut(size_t size)
 		return ByteStreamBuffer(static_cast<const uint8_t *>(nullptr), 0);
 	}
 
-	if (read_) {
-		ByteStreamBuffer b(read_, size);
-		b.parent_ = this;
-		read_ += size;
-		return b;
-	} else {
-		ByteStreamBuffer b(write_, size);
-		b.parent_ = this;
-		write_ += size;
-		return b;
+	ByteStreamBuffer b(base() + offset_, size);
+	b.parent_ = this;
+	b.write_ = write_;
+
+	/*
+	 * Buffers carved out of a storage vector locate their data by offset,
+	 * as the vector may be reallocated when the parent grows.
+	 */
+	if (storage_) {
+		b.base_ = nullptr;
+		b.storage_ = storage_;
+		b.start_ = start_ + offset_;
 	}
+
+	offset_ += size;
+	return b;
 }
 
 /**
@@ -205,8 +269,7 @@ int ByteStreamBuffer::skip(size_t size)
 	if (overflow_)
 		return -ENOSPC;
 
-	const uint8_t *curr = read_ ? read_ : write_;
-	if (curr + size > base_ + size_) {
+	if (!reserve(size)) {
 		LOG(Serialization, Error)
 			<< "Unable to skip " << size << " bytes";
 		setOverflow();
@@ -214,12 +277,10 @@ int ByteStreamBuffer::skip(size_t size)
 		return -ENOSPC;
 	}
 
-	if (read_) {
-		read_ += size;
-	} else {
-		memset(write_, 0, size);
-		write_ += size;
-	}
+	if (write_)
+		memset(writeLocation(), 0, size);
+
+	offset_ += size;
 
 	return 0;
 }
@@ -275,7 +336,7 @@ int ByteStreamBuffer::skip(size_t size)
 
 const uint8_t *ByteStreamBuffer::read(size_t size, size_t count)
 {
-	if (!read_)
+	if (write_)
 		return nullptr;
 
 	if (overflow_)
@@ -287,35 +348,35 @@ const uint8_t *ByteStreamBuffer::read(size_t size, size_t count)
 		return nullptr;
 	}
 
-	if (read_ + bytes > base_ + size_) {
+	if (bytes > size_ - offset_) {
 		LOG(Serialization, Error)
 			<< "Unable to read " << bytes << " bytes: out of bounds";
 		setOverflow();
 		return nullptr;
 	}
 
-	const uint8_t *data = read_;
-	read_ += bytes;
+	const uint8_t *data = base_ + offset_;
+	offset_ += bytes;
 	return data;
 }
 
 int ByteStreamBuffer::read(uint8_t *data, size_t size)
 {
-	if (!read_)
+	if (write_)
 		return -EACCES;
 
 	if (overflow_)
 		return -ENOSPC;
 
-	if (read_ + size > base_ + size_) {
+	if (size > size_ - offset_) {
 		LOG(Serialization, Error)
 			<< "Unable to read " << size << " bytes: out of bounds";
 		setOverflow();
 		return -ENOSPC;
 	}
 
-	memcpy(data, read_, size);
-	read_ += size;
+	memcpy(data, base_ + offset_, size);
+	offset_ += size;
 
 	return 0;
 }
@@ -328,15 +389,15 @@ int ByteStreamBuffer::write(const uint8_t *data, size_t size)
 	if (overflow_)
 		return -ENOSPC;
 
-	if (write_ + size > base_ + size_) {
+	if (!reserve(size)) {
 		LOG(Serialization, Error)
 			<< "Unable to write " << size << " bytes: no space left";
 		setOverflow();
 		return -ENOSPC;
 	}
 
-	memcpy(write_, data, size);
-	write_ += size;
+	memcpy(writeLocation(), data, size);
+	offset_ += size;
 
 	return 0;
 }
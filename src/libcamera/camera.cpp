@@ -7,20 +7,31 @@
 
 #include <libcamera/camera.h>
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <iomanip>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <utility>
 
+#include <libcamera/base/global_configuration.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/thread.h>
+#include <libcamera/base/utils.h>
 
+#include <libcamera/framebuffer.h>
 #include <libcamera/framebuffer_allocator.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
 #include "libcamera/internal/camera.h"
 #include "libcamera/internal/camera_controls.h"
+#include "libcamera/internal/framebuffer.h"
 #include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/request.h"
+#include "libcamera/internal/session_recording.h"
 
 /**
  * \file libcamera/camera.h
@@ -157,7 +168,8 @@ LOG_DECLARE_CATEGORY(Camera)
  * \brief Create an empty camera configuration
  */
 CameraConfiguration::CameraConfiguration()
-	: transform(Transform::Identity), config_({})
+	: transform(Transform::Identity), keepAllocations(false),
+	  pipelineDepth(0), zslFrames(0), minFrameDuration(0), config_({})
 {
 }
 
@@ -328,6 +340,128 @@ std::size_t CameraConfiguration::size() const
  * may adjust this field at its discretion if the selection is not supported.
  */
 
+/**
+ * \var CameraConfiguration::keepAllocations
+ * \brief Hint to keep internal allocations across stop() and start()
+ *
+ * Starting a camera allocates the buffers used internally by the pipeline
+ * handler and maps them to the IPA, and stopping it frees them. When this hint
+ * is set, pipeline handlers that support it keep those resources allocated
+ * when the camera is stopped, and reuse them when the camera is started again,
+ * making restarts faster at the expense of keeping memory allocated while the
+ * camera is stopped.
+ *
+ * The resources are freed when the camera is reconfigured or released. The
+ * hint is ignored by pipeline handlers that don't support it, and defaults to
+ * false.
+ */
+
+/**
+ * \var CameraConfiguration::pipelineDepth
+ * \brief Hint for the number of frames in flight in the pipeline handler
+ *
+ * Pipeline handlers size their internal buffer pools, such as the ISP
+ * parameters and statistics buffers or the raw buffers captured for processed
+ * streams, and the buffer count of the streams, for a number of frames being
+ * processed concurrently. A deeper pipeline absorbs larger scheduling
+ * variations and sustains the frame rate with a slow application, at the
+ * expense of memory and, when all buffers are queued, of latency. A shallower
+ * pipeline reduces memory usage and the latency between queuing a request and
+ * its completion.
+ *
+ * When this hint is set, pipeline handlers that support it size their internal
+ * queues for this depth, clamped to the range they support, and report the
+ * resulting stream buffer counts through StreamConfiguration::bufferCount
+ * after validation. The hint defaults to 0, which selects the default depth
+ * of the pipeline handler.
+ *
+ * Memory-constrained systems can lower the depth to reduce the size of the
+ * internal buffer pools, as reported by Camera::bufferUsage().
+ */
+
+/**
+ * \var CameraConfiguration::zslFrames
+ * \brief Number of raw frames kept for zero shutter lag reprocessing
+ *
+ * Pipeline handlers that process raw frames internally can keep the most
+ * recent ones after processing them, for applications to reprocess any of
+ * them later with the controls::draft::ReprocessTimestamp control. This
+ * allows capturing the frame that the user saw when pressing the shutter
+ * button, without stopping the other streams or waiting for new frames.
+ *
+ * Each kept frame holds an additional raw buffer allocated internally. The
+ * hint is ignored by pipeline handlers that don't support it, and defaults to
+ * 0, which disables reprocessing.
+ */
+
+/**
+ * \var CameraConfiguration::minFrameDuration
+ * \brief Shortest frame duration the application intends to use, in
+ * microseconds
+ *
+ * The sensor mode selected when configuring the camera limits the frame rates
+ * that can later be set with controls::FrameDurationLimits. Applications that
+ * need a high frame rate should set this hint to the shortest frame duration
+ * they will request, for the pipeline handler to select the cheapest sensor
+ * mode able to reach that rate, possibly at a lower resolution. When no mode
+ * can reach it, the fastest mode is preferred.
+ *
+ * The hint defaults to 0, in which case the sensor mode is selected based on
+ * the requested sizes only.
+ */
+
+/**
+ * \var CameraConfiguration::sensorCrop
+ * \brief Region of the pixel array to be read out by the camera sensor
+ *
+ * The controls::ScalerCrop control crops the images in the ISP, while the
+ * sensor still reads out and transmits its full field of view. Applications
+ * that only need a region of the field of view, for instance when zooming or
+ * capturing a window at a low resolution, can set the sensor crop to restrict
+ * readout to that region. This lowers the bus bandwidth and the processing
+ * load, and allows higher frame rates on most sensors.
+ *
+ * The rectangle is expressed in the same coordinates as the ScalerCrop
+ * control, relatively to the pixel array active area. The ScalerCrop control
+ * remains available to further crop the images within the sensor crop, and
+ * properties::ScalerCropMaximum reports the sensor crop once the camera is
+ * configured.
+ *
+ * The sensor crop can't be changed while the camera is running. Pipeline
+ * handlers adjust the rectangle to the sensor constraints when validating the
+ * configuration, and reset it to an empty rectangle if the camera doesn't
+ * support sensor crop. An empty rectangle, the default, reads out the full
+ * field of view of the selected sensor mode.
+ */
+
+/**
+ * \brief Reset the buffer layout constraints of a stream configuration
+ * \param[in] cfg The stream configuration
+ *
+ * This function is meant for pipeline handlers that can't honour the
+ * StreamConfiguration::strideAlign, StreamConfiguration::heightAlign and
+ * StreamConfiguration::planeAlign constraints for a stream, to reset them from
+ * the validate() implementation.
+ *
+ * \return True if any constraint has been reset, in which case validate()
+ * shall return Adjusted, false otherwise
+ */
+bool CameraConfiguration::resetBufferConstraints(StreamConfiguration *cfg)
+{
+	if (!cfg->strideAlign && !cfg->heightAlign && !cfg->planeAlign)
+		return false;
+
+	LOG(Camera, Debug)
+		<< "Buffer layout constraints not supported for "
+		<< cfg->toString();
+
+	cfg->strideAlign = 0;
+	cfg->heightAlign = 0;
+	cfg->planeAlign = 0;
+
+	return true;
+}
+
 /**
  * \var CameraConfiguration::config_
  * \brief The vector of stream configurations
@@ -351,7 +485,9 @@ std::size_t CameraConfiguration::size() const
  */
 Camera::Private::Private(PipelineHandler *pipe)
 	: requestSequence_(0), pipe_(pipe->shared_from_this()),
-	  disconnected_(false), state_(CameraAvailable)
+	  disconnected_(false), state_(CameraAvailable),
+	  pendingRequests_(nullptr), latencyIndex_(0), batchCount_(0),
+	  batchWindow_(0), completionQueueDepth_(0), completionFd_(-1)
 {
 }
 
@@ -359,6 +495,9 @@ Camera::Private::~Private()
 {
 	if (state_.load(std::memory_order_acquire) != Private::CameraAvailable)
 		LOG(Camera, Error) << "Removing camera while still in use";
+
+	if (completionFd_ != -1)
+		close(completionFd_);
 }
 
 /**
@@ -373,6 +512,78 @@ Camera::Private::~Private()
  * \return The control validator associated with this camera
  */
 
+/**
+ * \struct Camera::Private::Metrics
+ * \brief The runtime metrics of a camera
+ *
+ * \var Camera::Private::Metrics::requestsQueued
+ * \brief Number of requests queued to the pipeline handler
+ *
+ * \var Camera::Private::Metrics::requestsCompleted
+ * \brief Number of requests completed successfully, from which the frame rate
+ * is derived
+ *
+ * \var Camera::Private::Metrics::requestsCancelled
+ * \brief Number of requests cancelled
+ *
+ * \var Camera::Private::Metrics::framesDropped
+ * \brief Number of buffers completed with an error
+ *
+ * \var Camera::Private::Metrics::requestsDiscarded
+ * \brief Number of completed requests recycled by the completion queue instead
+ * of being delivered to the application
+ *
+ * \var Camera::Private::Metrics::requestsInFlight
+ * \brief Number of requests queued to the pipeline handler and not delivered
+ * to the application yet
+ *
+ * \var Camera::Private::Metrics::requestLatency
+ * \brief Time between queuing a request and its successful completion, in
+ * microseconds
+ */
+
+/**
+ * \brief Create the metrics of a camera
+ * \param[in] id The camera ID
+ */
+Camera::Private::Metrics::Metrics(const std::string &id)
+	: requestsQueued("libcamera_camera_requests_queued_total",
+			 "Requests queued to the camera", Metric::label("camera", id)),
+	  requestsCompleted("libcamera_camera_requests_completed_total",
+			    "Requests completed successfully", Metric::label("camera", id)),
+	  requestsCancelled("libcamera_camera_requests_cancelled_total",
+			    "Requests cancelled", Metric::label("camera", id)),
+	  framesDropped("libcamera_camera_frames_dropped_total",
+			"Buffers completed with an error", Metric::label("camera", id)),
+	  requestsDiscarded("libcamera_camera_requests_discarded_total",
+			    "Completed requests recycled by the completion queue",
+			    Metric::label("camera", id)),
+	  requestsInFlight("libcamera_camera_requests_in_flight",
+			   "Requests queued and not completed yet", Metric::label("camera", id)),
+	  requestLatency("libcamera_camera_request_latency_us",
+			 "Time from request queuing to completion, in microseconds",
+			 Metric::label("camera", id),
+			 MetricHistogram::exponentialBounds(1000, 2, 12))
+{
+}
+
+/**
+ * \fn Camera::Private::metrics()
+ * \brief Retrieve the runtime metrics of the camera
+ * \return The camera metrics
+ */
+
+/**
+ * \fn Camera::Private::configurationCache()
+ * \brief Retrieve the cache of validated configurations for this camera
+ *
+ * Pipeline handlers with costly configuration validation can use the cache
+ * to skip validating configurations identical to previously validated ones.
+ * The cache is cleared when the camera is disconnected.
+ *
+ * \return The configuration cache associated with this camera
+ */
+
 /**
  * \var Camera::Private::queuedRequests_
  * \brief The list of queued and not yet completed requests
@@ -384,6 +595,17 @@ Camera::Private::~Private()
  * PipelineHandler::completeRequest()
  */
 
+/**
+ * \var Camera::Private::waitingRequests_
+ * \brief The queue of requests waiting for their fences to be signalled
+ *
+ * Requests queued to the pipeline handler are held in this queue until all
+ * the fences of their buffers have been signalled, before being queued to the
+ * device in order.
+ *
+ * \sa PipelineHandler::queueRequest(), PipelineHandler::cancelWaitingRequests()
+ */
+
 /**
  * \var Camera::Private::controlInfo_
  * \brief The set of controls supported by the camera
@@ -416,6 +638,82 @@ Camera::Private::~Private()
  * over its lifetime.
  */
 
+/**
+ * \var Camera::Private::kLatencyStages
+ * \brief The number of request processing stages whose latency is measured
+ *
+ * \sa controls::draft::RequestLatencies
+ */
+
+/*
+ * Number of requests over which the latency percentiles are computed. Older
+ * samples are dropped.
+ */
+static constexpr unsigned int kLatencySamples = 1024;
+
+/**
+ * \brief Record the processing stage latencies of a completed request
+ * \param[in] latencies The latency of each stage, in nanoseconds
+ *
+ * The latencies of the most recent requests are kept, to report statistics
+ * with reportLatencies().
+ */
+void Camera::Private::recordLatencies(const std::array<int64_t, kLatencyStages> &latencies)
+{
+	for (unsigned int i = 0; i < kLatencyStages; i++) {
+		std::vector<int64_t> &samples = latencySamples_[i];
+		if (samples.size() < kLatencySamples)
+			samples.push_back(latencies[i]);
+		else
+			samples[latencyIndex_ % kLatencySamples] = latencies[i];
+	}
+
+	latencyIndex_++;
+}
+
+/**
+ * \brief Log and reset the request processing latency statistics
+ *
+ * Log the median, 90th and 99th percentiles and the maximum of the latency of
+ * each processing stage over the most recent requests, and clear the recorded
+ * samples.
+ */
+void Camera::Private::reportLatencies()
+{
+	static const char *const stageNames[kLatencyStages] = {
+		"queue", "buffers", "complete", "delivery",
+	};
+
+	if (latencySamples_[0].empty())
+		return;
+
+	LOG(Camera, Debug)
+		<< "Request latencies over the last "
+		<< latencySamples_[0].size() << " requests (p50/p90/p99/max, us):";
+
+	for (unsigned int i = 0; i < kLatencyStages; i++) {
+		std::vector<int64_t> &samples = latencySamples_[i];
+		auto percentile = [&](unsigned int p) {
+			auto it = samples.begin() + (samples.size() - 1) * p / 100;
+			std::nth_element(samples.begin(), it, samples.end());
+			return *it / 1000;
+		};
+
+		int64_t p50 = percentile(50);
+		int64_t p90 = percentile(90);
+		int64_t p99 = percentile(99);
+		int64_t max = *std::max_element(samples.begin(), samples.end()) / 1000;
+
+		LOG(Camera, Debug)
+			<< "  " << stageNames[i] << ": " << p50 << "/" << p90
+			<< "/" << p99 << "/" << max;
+
+		samples.clear();
+	}
+
+	latencyIndex_ = 0;
+}
+
 static const char *const camera_state_names[] = {
 	"Available",
 	"Acquired",
@@ -482,6 +780,9 @@ void Camera::Private::disconnect()
 		state_.store(Private::CameraConfigured, std::memory_order_release);
 
 	disconnected_ = true;
+
+	/* Configurations validated against the removed hardware are stale. */
+	configurationCache_.clear();
 }
 
 void Camera::Private::setState(State state)
@@ -489,6 +790,290 @@ void Camera::Private::setState(State state)
 	state_.store(state, std::memory_order_release);
 }
 
+int Camera::Private::validateRequest(const Request *request) const
+{
+	if (request->buffers().empty()) {
+		LOG(Camera, Error) << "Request contains no buffers";
+		return -EINVAL;
+	}
+
+	for (auto const &it : request->buffers()) {
+		const Stream *stream = it.first;
+
+		if (activeStreams_.find(stream) == activeStreams_.end()) {
+			LOG(Camera, Error) << "Invalid request";
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Add requests to the pending list
+ * \param[in] requests The requests, in queuing order
+ *
+ * The pending list is a lock-free singly-linked list of requests, linked
+ * through their Request::Private::pendingNext_ field in reverse queuing order. Multiple
+ * application threads can add requests concurrently without contending on a
+ * lock, the \a requests are linked together first and published to the list
+ * with a single atomic operation, which keeps them contiguous. The pipeline
+ * handler thread empties the list with takePendingRequests().
+ *
+ * \context This function is \threadsafe.
+ */
+void Camera::Private::queuePendingRequests(Span<Request *const> requests)
+{
+	if (requests.empty())
+		return;
+
+	Request *first = requests.front();
+	Request *last = requests.back();
+
+	for (unsigned int i = requests.size() - 1; i > 0; --i)
+		requests[i]->_d()->pendingNext_ = requests[i - 1];
+
+	Request *head = pendingRequests_.load(std::memory_order_relaxed);
+
+	do {
+		first->_d()->pendingNext_ = head;
+	} while (!pendingRequests_.compare_exchange_weak(head, last,
+							 std::memory_order_release,
+							 std::memory_order_relaxed));
+
+	/*
+	 * Only wake up the pipeline handler thread when the pending list was
+	 * empty. Requests queued before it runs are handed over with the same
+	 * message, which avoids a wakeup and a message allocation per request
+	 * at high frame rates.
+	 */
+	if (!head)
+		pipe_->invokeMethod(&PipelineHandler::queuePendingRequests,
+				    ConnectionTypeQueued, _o<Camera>());
+}
+
+/**
+ * \brief Remove the oldest requests from the completion queue
+ *
+ * When the completion queue depth is limited and the camera is running, remove
+ * the oldest requests exceeding the depth from the completion queue. The frames
+ * they contain are accounted for in the FrameMetadata::discarded field of the
+ * oldest remaining frame of the same stream.
+ *
+ * The caller shall hold the completedLock_.
+ *
+ * \return The requests removed from the completion queue
+ */
+std::vector<Request *> Camera::Private::trimCompletedQueue()
+{
+	if (!completionQueueDepth_ || completedQueue_.size() <= completionQueueDepth_ ||
+	    !isRunning())
+		return {};
+
+	auto end = completedQueue_.end() - completionQueueDepth_;
+	std::vector<Request *> discarded(completedQueue_.begin(), end);
+	completedQueue_.erase(completedQueue_.begin(), end);
+
+	for (Request *request : discarded) {
+		for (const auto &[stream, buffer] : request->buffers()) {
+			unsigned int count = buffer->metadata().discarded + 1;
+
+			for (Request *next : completedQueue_) {
+				auto it = next->buffers().find(stream);
+				if (it == next->buffers().end())
+					continue;
+
+				it->second->_d()->metadata().discarded += count;
+				break;
+			}
+		}
+	}
+
+	metrics_->requestsDiscarded.inc(discarded.size());
+
+	return discarded;
+}
+
+/**
+ * \brief Retrieve the requests queued by the application
+ *
+ * Requests queued to the camera are stored in a pending list and handed over
+ * to the pipeline handler thread in batches. This function empties the list
+ * and returns its content, in queuing order.
+ *
+ * The requests are stored in a vector owned by the camera, reused by every
+ * call to avoid allocating memory. The returned reference is valid until the
+ * next call.
+ *
+ * \context This function is \threadsafe, but shall only be called from a
+ * single thread at a time, the pipeline handler thread.
+ *
+ * \return The requests queued since the last call
+ */
+const std::vector<Request *> &Camera::Private::takePendingRequests()
+{
+	Request *head = pendingRequests_.exchange(nullptr, std::memory_order_acquire);
+
+	takenRequests_.clear();
+
+	/* The pending list is in reverse queuing order. */
+	for (Request *request = head; request; request = request->_d()->pendingNext_)
+		takenRequests_.push_back(request);
+
+	std::reverse(takenRequests_.begin(), takenRequests_.end());
+
+	return takenRequests_;
+}
+
+/**
+ * \brief Check if buffers can be allocated for a stream
+ * \param[in] stream The stream to allocate buffers for
+ *
+ * Buffers can only be allocated for streams of the active configuration, when
+ * the camera is configured and stopped.
+ *
+ * \return 0 if buffers can be allocated for \a stream or a negative error code
+ * otherwise
+ * \retval -EACCES The camera is not in a state where buffers can be allocated
+ * \retval -EINVAL The \a stream does not belong to the camera or the stream is
+ * not part of the active camera configuration
+ */
+int Camera::Private::validateBufferAllocation(const Stream *stream) const
+{
+	int ret = isAccessAllowed(Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	if (activeStreams_.find(stream) == activeStreams_.end())
+		return -EINVAL;
+
+	return 0;
+}
+
+/**
+ * \brief Record the size of a buffer pool allocated for the camera
+ * \param[in] name The pool name
+ * \param[in] stream The stream the pool belongs to, or nullptr
+ * \param[in] count The number of buffers in the pool
+ * \param[in] size The total size of the buffers in the pool, in bytes
+ *
+ * Pipeline handlers shall call this function when they allocate buffers for
+ * internal use, such as raw buffers or ISP parameters and statistics buffers,
+ * to report the memory used by the camera through Camera::bufferUsage(). The
+ * \a name identifies the pool in combination with the \a stream, and setting
+ * a pool that has already been set replaces its size. The \a stream shall be
+ * set when the buffers belong to a stream of the camera, and be nullptr
+ * otherwise.
+ *
+ * Only memory allocated by libcamera shall be accounted, buffers imported from
+ * other pools shall not be reported again.
+ *
+ * \context This function is \threadsafe.
+ */
+void Camera::Private::setBufferPool(const std::string &name, const Stream *stream,
+				    unsigned int count, size_t size)
+{
+	MutexLocker locker(bufferPoolsLock_);
+
+	auto pool = std::find_if(bufferPools_.begin(), bufferPools_.end(),
+				 [&](const BufferPoolUsage &usage) {
+					 return usage.name == name &&
+						usage.stream == stream;
+				 });
+	if (pool == bufferPools_.end())
+		pool = bufferPools_.insert(bufferPools_.end(), { name, stream, 0, 0 });
+
+	pool->count = count;
+	pool->size = size;
+}
+
+/**
+ * \brief Record the size of a buffer pool allocated for the camera
+ * \param[in] name The pool name
+ * \param[in] stream The stream the pool belongs to, or nullptr
+ * \param[in] buffers The buffers in the pool
+ *
+ * This function computes the size of the pool from the length of the planes
+ * of the \a buffers. An empty \a buffers vector clears the pool.
+ *
+ * \context This function is \threadsafe.
+ */
+void Camera::Private::setBufferPool(const std::string &name, const Stream *stream,
+				    const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
+{
+	if (buffers.empty()) {
+		clearBufferPool(name, stream);
+		return;
+	}
+
+	size_t size = 0;
+	for (const std::unique_ptr<FrameBuffer> &buffer : buffers) {
+		for (const FrameBuffer::Plane &plane : buffer->planes())
+			size += plane.length;
+	}
+
+	setBufferPool(name, stream, buffers.size(), size);
+}
+
+/**
+ * \brief Remove a buffer pool previously recorded with setBufferPool()
+ * \param[in] name The pool name
+ * \param[in] stream The stream the pool belongs to, or nullptr
+ *
+ * Pipeline handlers shall call this function when they free the buffers of the
+ * pool.
+ *
+ * \context This function is \threadsafe.
+ */
+void Camera::Private::clearBufferPool(const std::string &name, const Stream *stream)
+{
+	MutexLocker locker(bufferPoolsLock_);
+
+	bufferPools_.erase(std::remove_if(bufferPools_.begin(), bufferPools_.end(),
+					  [&](const BufferPoolUsage &usage) {
+						  return usage.name == name &&
+							 usage.stream == stream;
+					  }),
+			   bufferPools_.end());
+}
+
+/**
+ * \brief Retrieve the buffer pools recorded with setBufferPool()
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return The buffer pools currently allocated for the camera
+ */
+std::vector<BufferPoolUsage> Camera::Private::bufferPools() const
+{
+	MutexLocker locker(bufferPoolsLock_);
+
+	return bufferPools_;
+}
+
+/**
+ * \struct BufferPoolUsage
+ * \brief Memory used by a pool of buffers allocated for a camera
+ *
+ * \var BufferPoolUsage::name
+ * \brief The pool name
+ *
+ * Pools allocated by the pipeline handlers for internal use are named after
+ * their purpose, for instance "raw", "params" or "stats". Pools allocated for
+ * the application with a FrameBufferAllocator are named "application". The
+ * names are informative, and specific to each pipeline handler.
+ *
+ * \var BufferPoolUsage::stream
+ * \brief The stream the buffers belong to, or nullptr for internal pools not
+ * associated with a stream of the camera
+ *
+ * \var BufferPoolUsage::count
+ * \brief The number of buffers in the pool
+ *
+ * \var BufferPoolUsage::size
+ * \brief The total size of the buffers in the pool, in bytes
+ */
+
 /**
  * \class Camera
  * \brief Camera device
@@ -649,11 +1234,42 @@ const std::string &Camera::id() const
  * completed
  */
 
+/**
+ * \var Camera::metadataAvailable
+ * \brief Signal emitted when metadata for a request queued to the camera is
+ * available
+ *
+ * This signal is emitted when the pipeline handler produces metadata for a
+ * request before the request completes, typically when the IPA has processed
+ * the statistics of the frame. The ControlList carries the metadata produced
+ * by that step only, it has already been merged into Request::metadata() when
+ * the signal is emitted. A request may see this signal multiple times, or not
+ * at all for pipeline handlers that only produce metadata at completion time.
+ *
+ * This allows applications to act on the results of the 3A algorithms without
+ * waiting for all the request buffers to complete.
+ */
+
 /**
  * \var Camera::requestCompleted
  * \brief Signal emitted when a request queued to the camera has completed
  */
 
+/**
+ * \var Camera::requestsCompleted
+ * \brief Signal emitted when a batch of requests has completed
+ *
+ * This signal is emitted when request batching is enabled with
+ * setRequestBatching(), with all the requests completed since the previous
+ * batch, in completion order. The requestCompleted signal is still emitted for
+ * every request, applications shall handle completion through one of the two
+ * signals only.
+ *
+ * Coalescing completions reduces the number of cross-thread messages and
+ * thread wakeups for receivers connected with ConnectionTypeQueued, at the
+ * expense of the latency configured with setRequestBatching().
+ */
+
 /**
  * \var Camera::disconnected
  * \brief Signal emitted when the camera is disconnected from the system
@@ -666,6 +1282,30 @@ const std::string &Camera::id() const
  * application API calls by returning errors immediately.
  */
 
+/**
+ * \var Camera::configureCompleted
+ * \brief Signal emitted when an asynchronous configuration completes
+ *
+ * This signal is emitted when the configuration started by configureAsync()
+ * completes. The signal parameter is the value configure() would have returned.
+ */
+
+/**
+ * \var Camera::startCompleted
+ * \brief Signal emitted when an asynchronous start completes
+ *
+ * This signal is emitted when the start operation initiated by startAsync()
+ * completes. The signal parameter is the value start() would have returned.
+ */
+
+/**
+ * \var Camera::stopCompleted
+ * \brief Signal emitted when an asynchronous stop completes
+ *
+ * This signal is emitted when the stop operation initiated by stopAsync()
+ * completes. The signal parameter is the value stop() would have returned.
+ */
+
 Camera::Camera(std::unique_ptr<Private> d, const std::string &id,
 	       const std::set<Stream *> &streams)
 	: Extensible(std::move(d))
@@ -673,6 +1313,8 @@ Camera::Camera(std::unique_ptr<Private> d, const std::string &id,
 	_d()->id_ = id;
 	_d()->streams_ = streams;
 	_d()->validator_ = std::make_unique<CameraControlValidator>(this);
+	_d()->metrics_ = std::make_unique<Private::Metrics>(id);
+	_d()->batchTimer_.timeout.connect(this, &Camera::flushCompletedRequests);
 }
 
 Camera::~Camera()
@@ -704,16 +1346,10 @@ int Camera::exportFrameBuffers(Stream *stream,
 {
 	Private *const d = _d();
 
-	int ret = d->isAccessAllowed(Private::CameraConfigured);
+	int ret = d->validateBufferAllocation(stream);
 	if (ret < 0)
 		return ret;
 
-	if (streams().find(stream) == streams().end())
-		return -EINVAL;
-
-	if (d->activeStreams_.find(stream) == d->activeStreams_.end())
-		return -EINVAL;
-
 	return d->pipe_->invokeMethod(&PipelineHandler::exportFrameBuffers,
 				      ConnectionTypeBlocking, this, stream,
 				      buffers);
@@ -789,6 +1425,9 @@ int Camera::release()
 	if (ret < 0)
 		return ret == -EACCES ? -EBUSY : ret;
 
+	d->pipe_->invokeMethod(&PipelineHandler::releaseDevice,
+			       ConnectionTypeBlocking, this);
+
 	d->pipe_->unlock();
 
 	d->setState(Private::CameraAvailable);
@@ -840,6 +1479,30 @@ const std::set<Stream *> &Camera::streams() const
 	return _d()->streams_;
 }
 
+/**
+ * \brief Retrieve the memory used by the buffers allocated for the camera
+ *
+ * Report the buffer pools currently allocated for the camera, both by the
+ * pipeline handler for internal use, and by FrameBufferAllocator instances for
+ * the application. Internal pools are typically allocated when the camera is
+ * started and freed when it is stopped, unless
+ * CameraConfiguration::keepAllocations is set. The sum of the pool sizes is
+ * the total memory, usually allocated from CMA or as dma-buf, allocated by
+ * libcamera for the camera.
+ *
+ * Memory allocated by IPA modules for their own use isn't reported. The
+ * internal memory usage can be reduced by setting a lower
+ * CameraConfiguration::pipelineDepth.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return The buffer pools allocated for the camera
+ */
+std::vector<BufferPoolUsage> Camera::bufferUsage() const
+{
+	return _d()->bufferPools();
+}
+
 /**
  * \brief Generate a default camera configuration according to stream roles
  * \param[in] roles A list of stream roles
@@ -968,6 +1631,50 @@ int Camera::configure(CameraConfiguration *config)
 	return 0;
 }
 
+/**
+ * \brief Configure the camera asynchronously
+ * \param[in] config The camera configurations to setup
+ *
+ * This function performs the same operation as configure(), without blocking
+ * the caller while the pipeline handler configures the device. The function
+ * checks that the camera is in a state where it can be configured and returns
+ * immediately. The configuration is then applied in the pipeline handler
+ * thread, and its result is reported through the \ref configureCompleted
+ * signal.
+ *
+ * The \a config shall remain valid until the \ref configureCompleted signal is
+ * emitted. The camera state shall not be modified by any other function until
+ * then. Configuring several cameras asynchronously allows the operations to
+ * proceed concurrently if their pipeline handlers run in separate threads.
+ *
+ * \context This function may only be called when the camera is in the Acquired
+ * or Configured state as defined in \ref camera_operation, and shall be
+ * synchronized by the caller with other functions that affect the camera
+ * state.
+ *
+ * \return 0 if the configuration has been initiated or a negative error code
+ * otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not in a state where it can be configured
+ */
+int Camera::configureAsync(CameraConfiguration *config)
+{
+	int ret = _d()->isAccessAllowed(Private::CameraAcquired,
+					Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	invokeMethod(&Camera::configureAsyncHandler, ConnectionTypeQueued,
+		     config);
+
+	return 0;
+}
+
+void Camera::configureAsyncHandler(CameraConfiguration *config)
+{
+	configureCompleted.emit(configure(config));
+}
+
 /**
  * \brief Create a request object for the camera
  * \param[in] cookie Opaque cookie for application use
@@ -1022,6 +1729,39 @@ std::unique_ptr<Request> Camera::createRequest(uint64_t cookie)
  * \retval -ENOMEM No buffer memory was available to handle the request
  */
 int Camera::queueRequest(Request *request)
+{
+	return queueRequests({ &request, 1 });
+}
+
+/**
+ * \brief Queue multiple requests to the camera
+ * \param[in] requests The requests to queue to the camera
+ *
+ * This function queues all the \a requests to the camera for capture, in
+ * order, as if queueRequest() was called for each of them. All requests are
+ * validated first, and if any of them is invalid none of them is queued.
+ *
+ * Queuing multiple requests at once is more efficient than queuing them
+ * individually, as they are handed over to the pipeline handler in one
+ * operation.
+ *
+ * Requests can be queued concurrently from multiple threads without
+ * contention, as they are handed over to the pipeline handler thread through a
+ * lock-free list. The requests queued by one call are kept contiguous, and
+ * calls made from different threads are ordered in the order they reach the
+ * list. Applications should give each thread its own set of requests and
+ * recycle them with Request::reuse() from the thread that owns them, a
+ * request shall not be queued by two threads at the same time.
+ *
+ * \context This function is \threadsafe. It may only be called when the camera
+ * is in the Running state as defined in \ref camera_operation.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not running so requests can't be queued
+ * \retval -EINVAL One of the requests is invalid
+ */
+int Camera::queueRequests(Span<Request *const> requests)
 {
 	Private *const d = _d();
 
@@ -1035,26 +1775,168 @@ int Camera::queueRequest(Request *request)
 	 * this.
 	 */
 
-	if (request->buffers().empty()) {
-		LOG(Camera, Error) << "Request contains no buffers";
-		return -EINVAL;
+	for (const Request *request : requests) {
+		ret = d->validateRequest(request);
+		if (ret < 0)
+			return ret;
 	}
 
-	for (auto const &it : request->buffers()) {
-		const Stream *stream = it.first;
+	d->queuePendingRequests(requests);
 
-		if (d->activeStreams_.find(stream) == d->activeStreams_.end()) {
-			LOG(Camera, Error) << "Invalid request";
-			return -EINVAL;
-		}
+	return 0;
+}
+
+/**
+ * \brief Configure batched delivery of completed requests
+ * \param[in] count The maximum number of requests in a batch
+ * \param[in] window The maximum time a completed request waits in a batch
+ *
+ * When batching is enabled, completed requests are accumulated and delivered
+ * together through the \ref requestsCompleted signal, and through the
+ * completion queue if enabled with completionFd(). A batch is delivered when
+ * it contains \a count requests, or \a window after completion of its first
+ * request if \a window is not zero. Remaining requests are delivered when the
+ * camera is stopped.
+ *
+ * A \a count of 0 disables batching, which is the default.
+ *
+ * \context This function may only be called when the camera is in the Acquired
+ * or Configured state as defined in \ref camera_operation.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not in a state where batching can be configured
+ */
+int Camera::setRequestBatching(unsigned int count,
+			       std::chrono::microseconds window)
+{
+	Private *const d = _d();
+
+	int ret = d->isAccessAllowed(Private::CameraAcquired,
+				     Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	d->batchCount_ = count;
+	d->batchWindow_ = window;
+
+	return 0;
+}
+
+/**
+ * \brief Enable the completion queue and retrieve its file descriptor
+ *
+ * The completion queue allows event-driven applications to retrieve completed
+ * requests from their own event loop without connecting to any signal. Once
+ * enabled, every completed request, or every batch of requests if batching is
+ * enabled with setRequestBatching(), is added to the queue and the returned
+ * file descriptor becomes readable. Applications poll the file descriptor and
+ * call takeCompletedRequests() when it is readable.
+ *
+ * The file descriptor is owned by the camera and stays valid until the camera
+ * is deleted.
+ *
+ * \context This function may only be called when the camera is in the Acquired
+ * or Configured state as defined in \ref camera_operation.
+ *
+ * \return The completion queue file descriptor, or a negative error code
+ * otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not in a state where the queue can be enabled
+ */
+int Camera::completionFd()
+{
+	Private *const d = _d();
+
+	int ret = d->isAccessAllowed(Private::CameraAcquired,
+				     Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	if (d->completionFd_ != -1)
+		return d->completionFd_;
+
+	int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd < 0) {
+		ret = -errno;
+		LOG(Camera, Error)
+			<< "Failed to create completion queue: " << strerror(-ret);
+		return ret;
 	}
 
-	d->pipe_->invokeMethod(&PipelineHandler::queueRequest,
-			       ConnectionTypeQueued, request);
+	d->completionFd_ = fd;
+
+	return fd;
+}
+
+/**
+ * \brief Limit the number of requests in the completion queue
+ * \param[in] depth The maximum number of requests in the completion queue
+ *
+ * When an application falls behind, completed requests accumulate in the
+ * completion queue enabled by completionFd(), and the application processes
+ * frames that get older and older. Limiting the queue depth bounds the
+ * end-to-end latency: when more than \a depth requests are waiting in the
+ * queue, the oldest ones are reused with Request::ReuseBuffers and queued back
+ * to the camera instead of being delivered. The frames they contained are
+ * lost, and are accounted for in the FrameMetadata::discarded field of the next
+ * frame delivered for the same stream.
+ *
+ * Recycled requests keep their buffers but lose their controls, applications
+ * using this mode shall not rely on per-request controls being applied to a
+ * particular frame. Requests are only recycled while the camera is running,
+ * the requests cancelled by stop() are all delivered.
+ *
+ * A \a depth of 0 disables the limit, which is the default.
+ *
+ * \context This function may only be called when the camera is in the Acquired
+ * or Configured state as defined in \ref camera_operation.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not in a state where the depth can be set
+ */
+int Camera::setCompletionQueueDepth(unsigned int depth)
+{
+	Private *const d = _d();
+
+	int ret = d->isAccessAllowed(Private::CameraAcquired,
+				     Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	d->completionQueueDepth_ = depth;
 
 	return 0;
 }
 
+/**
+ * \brief Retrieve the requests from the completion queue
+ *
+ * This function empties the completion queue enabled by completionFd(), and
+ * clears the readable state of its file descriptor.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return The completed requests, in completion order
+ */
+std::vector<Request *> Camera::takeCompletedRequests()
+{
+	Private *const d = _d();
+
+	if (d->completionFd_ == -1)
+		return {};
+
+	MutexLocker locker(d->completedLock_);
+
+	uint64_t value;
+	if (read(d->completionFd_, &value, sizeof(value)) < 0 && errno != EAGAIN)
+		LOG(Camera, Error)
+			<< "Failed to read completion queue: " << strerror(errno);
+
+	return std::exchange(d->completedQueue_, {});
+}
+
 /**
  * \brief Start capture from camera
  * \param[in] controls Controls to be applied before starting the Camera
@@ -1083,16 +1965,69 @@ int Camera::start(const ControlList *controls)
 
 	LOG(Camera, Debug) << "Starting capture";
 
+	const char *record = GlobalConfiguration::option("LIBCAMERA_SESSION_RECORD");
+	if (record && *record) {
+		std::vector<const Stream *> streams(d->activeStreams_.begin(),
+						    d->activeStreams_.end());
+		d->recorder_ = std::make_unique<SessionRecorder>();
+		if (d->recorder_->open(record, this, streams) < 0)
+			d->recorder_.reset();
+	}
+
 	ret = d->pipe_->invokeMethod(&PipelineHandler::start,
 				     ConnectionTypeBlocking, this, controls);
-	if (ret)
+	if (ret) {
+		d->recorder_.reset();
 		return ret;
+	}
 
 	d->setState(Private::CameraRunning);
 
 	return 0;
 }
 
+/**
+ * \brief Start capture from camera asynchronously
+ * \param[in] controls Controls to be applied before starting the Camera
+ *
+ * This function performs the same operation as start(), without blocking the
+ * caller while the pipeline handler starts the device. The function checks
+ * that the camera can be started and returns immediately. The camera is then
+ * started in the pipeline handler thread, and the result is reported through
+ * the \ref startCompleted signal.
+ *
+ * The \a controls are copied and don't need to remain valid after this
+ * function returns. Requests shall not be queued, and the camera state shall
+ * not be modified by any other function, until the \ref startCompleted signal
+ * is emitted.
+ *
+ * \context This function may only be called when the camera is in the
+ * Configured state as defined in \ref camera_operation, and shall be
+ * synchronized by the caller with other functions that affect the camera
+ * state.
+ *
+ * \return 0 if the start operation has been initiated or a negative error code
+ * otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not in a state where it can be started
+ */
+int Camera::startAsync(const ControlList *controls)
+{
+	int ret = _d()->isAccessAllowed(Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	invokeMethod(&Camera::startAsyncHandler, ConnectionTypeQueued,
+		     controls ? *controls : ControlList());
+
+	return 0;
+}
+
+void Camera::startAsyncHandler(const ControlList &controls)
+{
+	startCompleted.emit(start(controls.empty() ? nullptr : &controls));
+}
+
 /**
  * \brief Stop capture from camera
  *
@@ -1127,16 +2062,56 @@ int Camera::stop()
 
 	d->setState(Private::CameraStopping);
 
+	d->pipe_->invokeMethod(&PipelineHandler::cancelWaitingRequests,
+			       ConnectionTypeBlocking, this);
 	d->pipe_->invokeMethod(&PipelineHandler::stop, ConnectionTypeBlocking,
 			       this);
 
 	ASSERT(!d->pipe_->hasPendingRequests(this));
 
+	/* Deliver the requests cancelled by the pipeline handler. */
+	invokeMethod(&Camera::flushCompletedRequests, ConnectionTypeBlocking);
+
+	d->reportLatencies();
+	d->recorder_.reset();
+
 	d->setState(Private::CameraConfigured);
 
 	return 0;
 }
 
+/**
+ * \brief Stop capture from camera asynchronously
+ *
+ * This function performs the same operation as stop(), without blocking the
+ * caller while the pipeline handler stops the device. The camera is stopped in
+ * the pipeline handler thread, and the result is reported through the
+ * \ref stopCompleted signal. Pending requests are cancelled and complete
+ * before the signal is emitted.
+ *
+ * The camera state shall not be modified by any other function until the
+ * \ref stopCompleted signal is emitted.
+ *
+ * \context This function may be called in any camera state as defined in \ref
+ * camera_operation, and shall be synchronized by the caller with other
+ * functions that affect the camera state. If called when the camera isn't
+ * running, the \ref stopCompleted signal is emitted without any other action.
+ *
+ * \return 0 as the stop operation is always initiated, errors are reported
+ * through the \ref stopCompleted signal
+ */
+int Camera::stopAsync()
+{
+	invokeMethod(&Camera::stopAsyncHandler, ConnectionTypeQueued);
+
+	return 0;
+}
+
+void Camera::stopAsyncHandler()
+{
+	stopCompleted.emit(stop());
+}
+
 /**
  * \brief Handle request completion and notify application
  * \param[in] request The request that has completed
@@ -1151,7 +2126,74 @@ void Camera::requestComplete(Request *request)
 				  true))
 		LOG(Camera, Fatal) << "Trying to complete a request when stopped";
 
+	Private *const d = _d();
+
+	if (d->recorder_)
+		d->recorder_->write(request);
+
 	requestCompleted.emit(request);
+
+	if (!d->batchCount_) {
+		if (d->completionFd_ != -1) {
+			d->completedBatch_.push_back(request);
+			flushCompletedRequests();
+		}
+		return;
+	}
+
+	d->completedBatch_.push_back(request);
+
+	if (d->completedBatch_.size() >= d->batchCount_)
+		flushCompletedRequests();
+	else if (d->completedBatch_.size() == 1 && d->batchWindow_.count())
+		d->batchTimer_.start(std::chrono::steady_clock::now() +
+				     d->batchWindow_);
+}
+
+/**
+ * \brief Deliver the batch of completed requests
+ *
+ * This function emits the requestsCompleted signal for the requests completed
+ * since the last batch, and adds them to the completion queue if enabled.
+ */
+void Camera::flushCompletedRequests()
+{
+	Private *const d = _d();
+
+	d->batchTimer_.stop();
+
+	if (d->completedBatch_.empty())
+		return;
+
+	std::vector<Request *> batch = std::exchange(d->completedBatch_, {});
+
+	if (d->batchCount_)
+		requestsCompleted.emit(batch);
+
+	if (d->completionFd_ == -1)
+		return;
+
+	std::vector<Request *> discarded;
+
+	{
+		MutexLocker locker(d->completedLock_);
+		d->completedQueue_.insert(d->completedQueue_.end(),
+					  batch.begin(), batch.end());
+		discarded = d->trimCompletedQueue();
+	}
+
+	/* Recycle the requests discarded from the completion queue. */
+	if (!discarded.empty()) {
+		for (Request *request : discarded)
+			request->reuse(Request::ReuseBuffers);
+
+		d->queuePendingRequests(discarded);
+	}
+
+	uint64_t value = 1;
+	if (write(d->completionFd_, &value, sizeof(value)) < 0)
+		LOG(Camera, Error)
+			<< "Failed to signal completion queue: " << strerror(errno);
 }
 
 } /* namespace libcamera */
@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera_configuration_cache.cpp - Cache of validated camera configurations
+ */
+
+#include "libcamera/internal/camera_configuration_cache.h"
+
+#include <sstream>
+
+#include <libcamera/stream.h>
+
+/**
+ * \file camera_configuration_cache.h
+ * \brief Cache of validated camera configurations
+ */
+
+namespace libcamera {
+
+/**
+ * \class CameraConfigurationCache
+ * \brief Memoise the result of CameraConfiguration::validate()
+ *
+ * Validating a configuration on complex pipelines requires enumerating sensor
+ * formats and computing pipeline parameters, which is costly. Applications
+ * commonly validate the same configuration repeatedly, for instance when
+ * reconfiguring a camera between sessions. The CameraConfigurationCache
+ * stores, per camera, the outcome of previous validations keyed by the
+ * content of the configuration, and replays them without invoking the
+ * pipeline handler validation logic.
+ *
+ * The cache key covers all fields of the configuration that the application
+ * can set, and the cached value is a full copy of the validated configuration,
+ * including the pipeline-specific data computed by the validation. It is thus
+ * only suitable for pipeline handlers whose validation depends solely on the
+ * configuration and on static properties of the camera. The cache holds a
+ * bounded number of entries and evicts the least recently used ones.
+ *
+ * The cache is cleared when the camera is disconnected.
+ */
+
+/**
+ * \var CameraConfigurationCache::kDefaultSize
+ * \brief The default maximum number of cached configurations
+ */
+
+/**
+ * \brief Construct a CameraConfigurationCache
+ * \param[in] size The maximum number of cached configurations
+ */
+CameraConfigurationCache::CameraConfigurationCache(unsigned int size)
+	: size_(size)
+{
+}
+
+/**
+ * \fn CameraConfigurationCache::validate()
+ * \brief Validate a configuration, using the cached result when available
+ * \tparam T The pipeline-specific CameraConfiguration type
+ * \tparam Func The type of the validation function
+ * \param[inout] config The configuration to validate
+ * \param[in] func The function performing the validation
+ *
+ * Look up \a config in the cache. On a hit, \a config is replaced with the
+ * cached validated configuration and the cached status is returned. Otherwise
+ * \a func is called to validate \a config, and the result is stored in the
+ * cache.
+ *
+ * The \a func function is called without holding the cache lock.
+ *
+ * \return The validation status of the configuration
+ */
+
+/**
+ * \brief Remove all entries from the cache
+ */
+void CameraConfigurationCache::clear()
+{
+	MutexLocker locker(mutex_);
+	entries_.clear();
+}
+
+std::string CameraConfigurationCache::key(const CameraConfiguration &config)
+{
+	std::stringstream ss;
+
+	for (const StreamConfiguration &cfg : config) {
+		ss << cfg.pixelFormat.fourcc() << ':' << cfg.pixelFormat.modifier()
+		   << ':' << cfg.size.width << 'x' << cfg.size.height
+		   << ':' << cfg.stride << ':' << cfg.frameSize
+		   << ':' << cfg.bufferCount << ':' << cfg.strideAlign
+		   << ':' << cfg.heightAlign << ':' << cfg.planeAlign << ';';
+	}
+
+	ss << static_cast<int>(config.transform) << ':' << config.keepAllocations
+	   << ':' << config.pipelineDepth << ':' << config.zslFrames
+	   << ':' << config.minFrameDuration
+	   << ':' << config.sensorCrop.toString();
+
+	return ss.str();
+}
+
+const CameraConfigurationCache::Entry *
+CameraConfigurationCache::find(const std::string &key)
+{
+	for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+		if (it->key != key)
+			continue;
+
+		/* Move the entry to the front to keep the list in LRU order. */
+		entries_.splice(entries_.begin(), entries_, it);
+		return &entries_.front();
+	}
+
+	return nullptr;
+}
+
+void CameraConfigurationCache::store(const std::string &key,
+				     std::unique_ptr<CameraConfiguration> config,
+				     CameraConfiguration::Status status)
+{
+	MutexLocker locker(mutex_);
+
+	/* Another thread may have stored the same configuration meanwhile. */
+	if (find(key))
+		return;
+
+	entries_.push_front({ key, std::move(config), status });
+
+	while (entries_.size() > size_)
+		entries_.pop_back();
+}
+
+} /* namespace libcamera */
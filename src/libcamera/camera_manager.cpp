@@ -7,17 +7,26 @@
 
 #include <libcamera/camera_manager.h>
 
+#include <chrono>
 #include <condition_variable>
+#include <functional>
 #include <map>
+#include <string.h>
+#include <string>
+#include <vector>
 
 #include <libcamera/camera.h>
 
+#include <libcamera/base/event_dispatcher_poll.h>
+#include <libcamera/base/global_configuration.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/thread.h>
 #include <libcamera/base/utils.h>
 
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/ipa_manager.h"
+#include "libcamera/internal/ipa_proxy_worker_pool.h"
+#include "libcamera/internal/metrics.h"
 #include "libcamera/internal/pipeline_handler.h"
 #include "libcamera/internal/process.h"
 
@@ -33,6 +42,59 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(Camera)
 
+namespace {
+
+class PipelineHandlerThread : public Thread
+{
+public:
+	PipelineHandlerThread(std::string name)
+	{
+		std::string::size_type pos = name.find("PipelineHandler");
+		if (pos != std::string::npos)
+			name.erase(pos, strlen("PipelineHandler"));
+
+		setName("Pipeline-" + name);
+	}
+
+protected:
+	void run() override
+	{
+		exec();
+
+		/*
+		 * Process the deletion of the cameras released by the camera
+		 * manager when stopping, as the event loop is not in action
+		 * anymore.
+		 */
+		dispatchMessages(Message::Type::DeferredDelete);
+	}
+};
+
+/*
+ * Thread matching the pipeline handlers of one factory, to match the factories
+ * in parallel.
+ */
+class PipelineHandlerMatcher : public Thread
+{
+public:
+	PipelineHandlerMatcher(std::string name, std::function<void()> match)
+		: match_(std::move(match))
+	{
+		setName("Match-" + name);
+	}
+
+protected:
+	void run() override
+	{
+		match_();
+	}
+
+private:
+	std::function<void()> match_;
+};
+
+} /* namespace */
+
 class CameraManager::Private : public Extensible::Private, public Thread
 {
 	LIBCAMERA_DECLARE_PUBLIC(CameraManager)
@@ -61,21 +123,66 @@ protected:
 private:
 	int init();
 	void createPipelineHandlers();
+	void matchPipelineHandlers(PipelineHandlerFactory *factory,
+				   std::vector<std::unique_ptr<Thread>> *threads);
 	void cleanup();
 
 	std::condition_variable cv_;
 	bool initialized_;
 	int status_;
 
+	bool pipelineThreads_;
+	std::vector<std::unique_ptr<Thread>> threads_;
+
 	std::unique_ptr<DeviceEnumerator> enumerator_;
 
 	IPAManager ipaManager_;
 	ProcessManager processManager_;
+	IPAProxyWorkerPool proxyWorkerPool_;
+
+	std::unique_ptr<MetricsServer> metricsServer_;
 };
 
 CameraManager::Private::Private()
 	: initialized_(false)
 {
+	setName("CameraManager");
+
+	/*
+	 * Run each pipeline handler instance in a dedicated thread if
+	 * requested, to let multi-camera processes scale across CPUs.
+	 */
+	const char *pipelineThreads = GlobalConfiguration::option("LIBCAMERA_PIPELINE_THREADS");
+	pipelineThreads_ = pipelineThreads && *pipelineThreads;
+
+	/*
+	 * Enable busy polling of the event loop if requested. The variable
+	 * stores the busy polling duration in microseconds, optionally
+	 * followed by the CPU budget in percent.
+	 */
+	const char *busyPoll = GlobalConfiguration::option("LIBCAMERA_BUSY_POLL");
+	if (busyPoll && *busyPoll) {
+		char *end;
+		unsigned long duration = strtoul(busyPoll, &end, 10);
+		unsigned long budget = 10;
+		if (*end == ':')
+			budget = strtoul(end + 1, &end, 10);
+
+		if (*end != '\0' || !duration) {
+			LOG(Camera, Warning)
+				<< "Invalid busy polling configuration '"
+				<< busyPoll << "'";
+		} else {
+			auto dispatcher = std::make_unique<EventDispatcherPoll>();
+			dispatcher->setBusyPoll(std::chrono::microseconds(duration),
+						budget);
+			setEventDispatcher(std::move(dispatcher));
+
+			LOG(Camera, Debug)
+				<< "Busy polling for " << duration << "us, "
+				<< budget << "% CPU budget";
+		}
+	}
 }
 
 int CameraManager::Private::start()
@@ -130,13 +237,22 @@ int CameraManager::Private::init()
 
 	createPipelineHandlers();
 
+	/*
+	 * Serve the metrics on a Unix socket if requested. Failures are not
+	 * fatal, the metrics remain available through the API.
+	 */
+	const char *metricsSocket = GlobalConfiguration::option("LIBCAMERA_METRICS_SOCKET");
+	if (metricsSocket && *metricsSocket) {
+		metricsServer_ = std::make_unique<MetricsServer>();
+		if (metricsServer_->listen(metricsSocket) < 0)
+			metricsServer_.reset();
+	}
+
 	return 0;
 }
 
 void CameraManager::Private::createPipelineHandlers()
 {
-	CameraManager *const o = LIBCAMERA_O_PTR();
-
 	/*
 	 * \todo Try to read handlers and order from configuration
 	 * file and only fallback on all handlers if there is no
@@ -145,30 +261,105 @@ void CameraManager::Private::createPipelineHandlers()
 	std::vector<PipelineHandlerFactory *> &factories =
 		PipelineHandlerFactory::factories();
 
-	for (PipelineHandlerFactory *factory : factories) {
-		LOG(Camera, Debug)
-			<< "Found registered pipeline handler '"
-			<< factory->name() << "'";
+	if (!pipelineThreads_) {
+		for (PipelineHandlerFactory *factory : factories)
+			matchPipelineHandlers(factory, nullptr);
+	} else {
 		/*
-		 * Try each pipeline handler until it exhaust
-		 * all pipelines it can provide.
+		 * Match the factories in parallel. The pipeline handlers don't
+		 * run in the camera manager thread, which only waits for all
+		 * the matches to complete. The media devices can thus not be
+		 * added or removed concurrently.
 		 */
-		while (1) {
-			std::shared_ptr<PipelineHandler> pipe = factory->create(o);
-			if (!pipe->match(enumerator_.get()))
-				break;
+		std::vector<std::unique_ptr<Thread>> matchers;
+		std::vector<std::vector<std::unique_ptr<Thread>>> threads(factories.size());
+
+		for (unsigned int i = 0; i < factories.size(); ++i) {
+			PipelineHandlerFactory *factory = factories[i];
+			std::vector<std::unique_ptr<Thread>> *factoryThreads = &threads[i];
+
+			matchers.push_back(std::make_unique<PipelineHandlerMatcher>(
+				factory->name(), [this, factory, factoryThreads]() {
+					matchPipelineHandlers(factory, factoryThreads);
+				}));
+			matchers.back()->start();
+		}
 
-			LOG(Camera, Debug)
-				<< "Pipeline handler \"" << factory->name()
-				<< "\" matched";
+		for (unsigned int i = 0; i < factories.size(); ++i) {
+			matchers[i]->wait();
+
+			for (std::unique_ptr<Thread> &thread : threads[i])
+				threads_.push_back(std::move(thread));
 		}
 	}
 
 	enumerator_->devicesAdded.connect(this, &Private::createPipelineHandlers);
 }
 
+/*
+ * Create pipeline handlers from a factory until they exhaust all the devices
+ * the factory supports. When \a threads is not null, each pipeline handler is
+ * matched in a dedicated thread, added to \a threads.
+ */
+void CameraManager::Private::matchPipelineHandlers(PipelineHandlerFactory *factory,
+						   std::vector<std::unique_ptr<Thread>> *threads)
+{
+	CameraManager *const o = LIBCAMERA_O_PTR();
+
+	LOG(Camera, Debug)
+		<< "Found registered pipeline handler '"
+		<< factory->name() << "'";
+
+	while (1) {
+		utils::time_point start = utils::clock::now();
+
+		std::unique_ptr<Thread> thread;
+		std::shared_ptr<PipelineHandler> pipe = factory->create(o);
+		bool matched;
+
+		if (threads) {
+			/*
+			 * Match in the pipeline handler thread to bind all the
+			 * objects it creates to that thread.
+			 */
+			thread = std::make_unique<PipelineHandlerThread>(factory->name());
+			thread->start();
+
+			pipe->moveToThread(thread.get());
+			matched = pipe->invokeMethod(&PipelineHandler::match,
+						     ConnectionTypeBlocking,
+						     enumerator_.get());
+		} else {
+			matched = pipe->match(enumerator_.get());
+		}
+
+		if (!matched) {
+			/*
+			 * Stop the thread before destroying the pipeline
+			 * handler, which goes out of scope first.
+			 */
+			if (thread) {
+				thread->exit();
+				thread->wait();
+			}
+			break;
+		}
+
+		if (thread)
+			threads->push_back(std::move(thread));
+
+		auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+			utils::clock::now() - start);
+		LOG(Camera, Debug)
+			<< "Pipeline handler \"" << factory->name()
+			<< "\" matched in " << duration.count() << "ms";
+	}
+}
+
 void CameraManager::Private::cleanup()
 {
+	metricsServer_.reset();
+
 	enumerator_->devicesAdded.disconnect(this);
 
 	/*
@@ -181,6 +372,22 @@ void CameraManager::Private::cleanup()
 	cameras_.clear();
 	dispatchMessages(Message::Type::DeferredDelete);
 
+	/*
+	 * Cameras created in pipeline handler threads are deleted by those
+	 * threads when they stop.
+	 */
+	for (std::unique_ptr<Thread> &thread : threads_) {
+		thread->exit();
+		thread->wait();
+	}
+
+	/*
+	 * Spare proxy workers are bound to the pipeline handler threads, stop
+	 * them before destroying the threads.
+	 */
+	proxyWorkerPool_.clear();
+	threads_.clear();
+
 	enumerator_.reset(nullptr);
 }
 
@@ -292,6 +499,15 @@ int CameraManager::start()
 {
 	LOG(Camera, Info) << "libcamera " << version_;
 
+	const GlobalConfiguration &config = GlobalConfiguration::instance();
+	if (!config.error().empty())
+		LOG(Camera, Warning)
+			<< "Invalid configuration file: " << config.error();
+	else if (!config.profile().empty())
+		LOG(Camera, Info)
+			<< "Using profile '" << config.profile() << "' from "
+			<< config.path();
+
 	int ret = _d()->start();
 	if (ret)
 		LOG(Camera, Error) << "Failed to start camera manager: "
@@ -401,9 +617,11 @@ std::shared_ptr<Camera> CameraManager::get(dev_t devnum)
  * connected to the system. When the signal is emitted the new camera is already
  * available from the list of cameras().
  *
- * The signal is emitted from the CameraManager thread. Applications shall
- * minimize the time spent in the signal handler and shall in particular not
- * perform any blocking operation.
+ * The signal is emitted from the thread of the pipeline handler that handles
+ * the camera, which is the CameraManager thread unless pipeline handler
+ * threads have been enabled with the LIBCAMERA_PIPELINE_THREADS environment
+ * variable. Applications shall minimize the time spent in the signal handler
+ * and shall in particular not perform any blocking operation.
  */
 
 /**
@@ -414,9 +632,11 @@ std::shared_ptr<Camera> CameraManager::get(dev_t devnum)
  * signal is emitted the camera is not available from the list of cameras()
  * anymore.
  *
- * The signal is emitted from the CameraManager thread. Applications shall
- * minimize the time spent in the signal handler and shall in particular not
- * perform any blocking operation.
+ * The signal is emitted from the thread of the pipeline handler that handles
+ * the camera, which is the CameraManager thread unless pipeline handler
+ * threads have been enabled with the LIBCAMERA_PIPELINE_THREADS environment
+ * variable. Applications shall minimize the time spent in the signal handler
+ * and shall in particular not perform any blocking operation.
  */
 
 /**
@@ -431,14 +651,15 @@ std::shared_ptr<Camera> CameraManager::get(dev_t devnum)
  * \a devnums are used by the V4L2 compatibility layer to map V4L2 device nodes
  * to Camera instances.
  *
- * \context This function shall be called from the CameraManager thread.
+ * \context This function shall be called from the pipeline handler thread
+ * that created \a camera.
  */
 void CameraManager::addCamera(std::shared_ptr<Camera> camera,
 			      const std::vector<dev_t> &devnums)
 {
 	Private *const d = _d();
 
-	ASSERT(Thread::current() == d);
+	ASSERT(Thread::current() == camera->thread());
 
 	d->addCamera(camera, devnums);
 	cameraAdded.emit(camera);
@@ -452,18 +673,41 @@ void CameraManager::addCamera(std::shared_ptr<Camera> camera,
  * camera manager. Unregistered cameras won't be reported anymore by the
  * cameras() and get() calls, but references may still exist in applications.
  *
- * \context This function shall be called from the CameraManager thread.
+ * \context This function shall be called from the pipeline handler thread
+ * that created \a camera.
  */
 void CameraManager::removeCamera(std::shared_ptr<Camera> camera)
 {
 	Private *const d = _d();
 
-	ASSERT(Thread::current() == d);
+	ASSERT(Thread::current() == camera->thread());
 
 	d->removeCamera(camera.get());
 	cameraRemoved.emit(camera);
 }
 
+/**
+ * \brief Retrieve the libcamera metrics
+ *
+ * libcamera maintains counters, gauges and histograms describing the operation
+ * of all cameras, such as the number of requests and frames processed, the
+ * dropped frames, the request latencies, the V4L2 buffer cache misses, the
+ * request and buffer queue depths and the time spent in IPA calls. This
+ * function returns their current value in the Prometheus text exposition
+ * format, with the camera or device each metric relates to in its labels.
+ *
+ * The metrics can also be served on a Unix socket by setting the
+ * LIBCAMERA_METRICS_SOCKET environment variable.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return The metrics in the Prometheus text exposition format
+ */
+std::string CameraManager::metrics() const
+{
+	return MetricsRegistry::instance()->format();
+}
+
 /**
  * \fn const std::string &CameraManager::version()
  * \brief Retrieve the libcamera version string
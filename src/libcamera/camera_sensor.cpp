@@ -54,7 +54,9 @@ LOG_DEFINE_CATEGORY(CameraSensor)
  * Once constructed the instance must be initialized with init().
  */
 CameraSensor::CameraSensor(const MediaEntity *entity)
-	: entity_(entity), pad_(UINT_MAX), bayerFormat_(nullptr),
+	: entity_(entity), pad_(UINT_MAX), embeddedDataPad_(UINT_MAX),
+	  analogCropSupported_(false),
+	  bayerFormat_(nullptr),
 	  properties_(properties::properties)
 {
 }
@@ -76,9 +78,19 @@ CameraSensor::~CameraSensor()
  */
 int CameraSensor::init()
 {
+	/*
+	 * The first source pad carries the image data. Sensors that output
+	 * embedded data expose it on a second source pad.
+	 */
+	unsigned int embeddedDataPad = UINT_MAX;
 	for (const MediaPad *pad : entity_->pads()) {
-		if (pad->flags() & MEDIA_PAD_FL_SOURCE) {
+		if (!(pad->flags() & MEDIA_PAD_FL_SOURCE))
+			continue;
+
+		if (pad_ == UINT_MAX) {
 			pad_ = pad->index();
+		} else {
+			embeddedDataPad = pad->index();
 			break;
 		}
 	}
@@ -129,6 +141,20 @@ int CameraSensor::init()
 	auto last = std::unique(sizes_.begin(), sizes_.end());
 	sizes_.erase(last, sizes_.end());
 
+	/*
+	 * Only consider the embedded data pad usable if the driver reports a
+	 * format for it.
+	 */
+	if (embeddedDataPad != UINT_MAX) {
+		V4L2SubdeviceFormat format;
+		ret = subdev_->getFormat(embeddedDataPad, &format);
+		if (!ret && !format.size.isNull())
+			embeddedDataPad_ = embeddedDataPad;
+		else
+			LOG(CameraSensor, Debug)
+				<< "Ignoring embedded data pad " << embeddedDataPad;
+	}
+
 	/*
 	 * VIMC is a bit special, as it does not yet support all the mandatory
 	 * requirements regular sensors have to respect.
@@ -243,6 +269,14 @@ int CameraSensor::validateSensorDriver()
 		LOG(CameraSensor, Warning)
 			<< "Failed to retrieve the sensor crop rectangle";
 		err = -EINVAL;
+	} else {
+		/*
+		 * Many drivers report the crop rectangle but don't allow
+		 * changing it. Probe the TRY crop to find out without
+		 * affecting the sensor configuration.
+		 */
+		analogCropSupported_ = !subdev_->setSelection(pad_, V4L2_SEL_TGT_CROP,
+							      &rect, V4L2Subdevice::TryFormat);
 	}
 
 	if (err) {
@@ -535,6 +569,7 @@ Size CameraSensor::resolution() const
  * \brief Retrieve the best sensor format for a desired output
  * \param[in] mbusCodes The list of acceptable media bus codes
  * \param[in] size The desired size
+ * \param[in] frameDuration The desired minimum frame duration
  *
  * Media bus codes are selected from \a mbusCodes, which lists all acceptable
  * codes in decreasing order of preference. Media bus codes supported by the
@@ -557,6 +592,13 @@ Size CameraSensor::resolution() const
  * When multiple media bus codes can produce the same size, the code at the
  * lowest position in \a mbusCodes is selected.
  *
+ * If \a frameDuration is not zero, the sizes whose minimum frame duration, as
+ * estimated by minFrameDuration(), is longer than \a frameDuration can't reach
+ * the desired frame rate. The above criteria are then only applied to the sizes
+ * that can reach it, preferring for instance a smaller binned mode to a full
+ * resolution mode that would cap the frame rate. If no size can reach the
+ * desired frame rate, the fastest sizes are selected.
+ *
  * The use of this function is optional, as the above criteria may not match the
  * needs of all pipeline handlers. Pipeline handlers may implement custom
  * sensor format selection when needed.
@@ -568,12 +610,15 @@ Size CameraSensor::resolution() const
  * and size on success, or an empty format otherwise.
  */
 V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbusCodes,
-					    const Size &size) const
+					    const Size &size,
+					    utils::Duration frameDuration) const
 {
 	unsigned int desiredArea = size.width * size.height;
 	unsigned int bestArea = UINT_MAX;
 	float desiredRatio = static_cast<float>(size.width) / size.height;
 	float bestRatio = FLT_MAX;
+	utils::Duration bestDuration;
+	bool bestIsFast = false;
 	const Size *bestSize = nullptr;
 	uint32_t bestCode = 0;
 
@@ -593,12 +638,32 @@ V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbu
 			unsigned int area = sz.width * sz.height;
 			unsigned int areaDiff = area - desiredArea;
 
-			if (ratioDiff > bestRatio)
+			/*
+			 * When a frame duration is requested, sizes that can
+			 * reach it always win over the ones that can't, and
+			 * faster sizes win among the latter.
+			 */
+			utils::Duration duration = minFrameDuration(sz);
+			bool isFast = !frameDuration || duration <= frameDuration;
+			bool faster = false;
+
+			if (bestSize && frameDuration) {
+				if (bestIsFast && !isFast)
+					continue;
+				if (!bestIsFast && !isFast && duration > bestDuration)
+					continue;
+
+				faster = !bestIsFast && (isFast || duration < bestDuration);
+			}
+
+			if (!faster && ratioDiff > bestRatio)
 				continue;
 
-			if (ratioDiff < bestRatio || areaDiff < bestArea) {
+			if (faster || ratioDiff < bestRatio || areaDiff < bestArea) {
 				bestRatio = ratioDiff;
 				bestArea = areaDiff;
+				bestDuration = duration;
+				bestIsFast = isFast;
 				bestSize = &sz;
 				bestCode = code;
 			}
@@ -618,6 +683,43 @@ V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbu
 	return format;
 }
 
+/**
+ * \brief Estimate the minimum frame duration for a sensor output size
+ * \param[in] size The sensor output size
+ *
+ * The minimum frame duration is computed from the sensor pixel rate and the
+ * minimum horizontal and vertical blanking reported by the V4L2_CID_PIXEL_RATE,
+ * V4L2_CID_HBLANK and V4L2_CID_VBLANK controls. As the controls reflect the
+ * currently configured sensor format, the value is an estimate for other sizes,
+ * which assumes that the pixel rate and blanking limits don't depend on the
+ * sensor mode.
+ *
+ * \return The estimated minimum frame duration, or 0 if the sensor doesn't
+ * report the required controls
+ */
+utils::Duration CameraSensor::minFrameDuration(const Size &size) const
+{
+	const ControlInfoMap &ctrls = subdev_->controls();
+
+	auto pixelRate = ctrls.find(V4L2_CID_PIXEL_RATE);
+	auto hblank = ctrls.find(V4L2_CID_HBLANK);
+	auto vblank = ctrls.find(V4L2_CID_VBLANK);
+	if (pixelRate == ctrls.end() || hblank == ctrls.end() ||
+	    vblank == ctrls.end())
+		return {};
+
+	/* The pixel rate control is read-only, its range is its value. */
+	int64_t rate = pixelRate->second.max().get<int64_t>();
+	if (rate <= 0)
+		return {};
+
+	uint64_t lineLength = size.width + hblank->second.min().get<int32_t>();
+	uint64_t frameLength = size.height + vblank->second.min().get<int32_t>();
+
+	return std::chrono::duration<double>(static_cast<double>(lineLength) *
+					     frameLength / rate);
+}
+
 /**
  * \brief Set the sensor output format
  * \param[in] format The desired sensor output format
@@ -636,6 +738,81 @@ int CameraSensor::setFormat(V4L2SubdeviceFormat *format)
 	return 0;
 }
 
+/**
+ * \fn CameraSensor::supportsEmbeddedData()
+ * \brief Check if the sensor outputs embedded data
+ *
+ * Sensors supporting embedded data output, alongside every frame, a few lines
+ * of metadata on a separate source pad, typically containing the values of the
+ * registers the frame was captured with. Pipeline handlers that can capture it
+ * pass it to their IPA, which parses it to retrieve the exact exposure and gain
+ * of every frame instead of relying on the control delays.
+ *
+ * \return True if the sensor outputs embedded data, false otherwise
+ */
+
+/**
+ * \brief Retrieve the embedded data format of the sensor
+ * \param[out] format The embedded data format
+ *
+ * The embedded data format depends on the image format, and shall thus be
+ * retrieved after setting the sensor image format with setFormat().
+ *
+ * \return 0 on success, -ENOTSUP if the sensor doesn't output embedded data,
+ * or a negative error code otherwise
+ */
+int CameraSensor::embeddedDataFormat(V4L2SubdeviceFormat *format) const
+{
+	if (embeddedDataPad_ == UINT_MAX)
+		return -ENOTSUP;
+
+	return subdev_->getFormat(embeddedDataPad_, format);
+}
+
+/**
+ * \fn CameraSensor::supportsAnalogCrop()
+ * \brief Check if the sensor supports reading out a region of its pixel array
+ *
+ * Sensors supporting analogue crop can be configured with setAnalogCrop() to
+ * only read out and transmit a region of their pixel array. This reduces the
+ * bus bandwidth and the processing load, and typically allows higher frame
+ * rates.
+ *
+ * \return True if the analogue crop rectangle can be changed, false otherwise
+ */
+
+/**
+ * \brief Set the region of the pixel array read out by the sensor
+ * \param[inout] crop The analogue crop rectangle
+ *
+ * The \a crop rectangle is expressed relatively to the pixel array active area,
+ * as the ScalerCrop control. It is adjusted by the sensor driver to satisfy its
+ * constraints, and updated with the rectangle actually applied.
+ *
+ * The crop rectangle can't be changed while the sensor is streaming. As it
+ * may affect the sensor output size and the controls limits, pipeline handlers
+ * shall call this function after setFormat(), and update their configuration
+ * with the sensor format retrieved from the device.
+ *
+ * \return 0 on success, -ENOTSUP if the sensor doesn't support analogue crop,
+ * or a negative error code otherwise
+ */
+int CameraSensor::setAnalogCrop(Rectangle *crop)
+{
+	if (!analogCropSupported_)
+		return -ENOTSUP;
+
+	Rectangle rect = crop->translatedBy(activeArea_.topLeft());
+	int ret = subdev_->setSelection(pad_, V4L2_SEL_TGT_CROP, &rect);
+	if (ret)
+		return ret;
+
+	*crop = rect.translatedBy(-activeArea_.topLeft());
+
+	updateControlInfo();
+	return 0;
+}
+
 /**
  * \brief Retrieve the supported V4L2 controls and their information
  *
@@ -31,6 +31,13 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(Serializer)
 
+namespace {
+
+/* Flag for the keys of ControlList streams identified by their id map type. */
+constexpr uint32_t kIdMapKey = 0x80000000;
+
+} /* namespace */
+
 /**
  * \class ControlSerializer
  * \brief Serializer and deserializer for control-related classes
@@ -77,6 +84,20 @@ LOG_DEFINE_CATEGORY(Serializer)
  * that constraint results in serialization or deserialization failure of the
  * ControlList.
  *
+ * To reduce the size of the serialized data when the same controls are
+ * exchanged repeatedly, as with per-frame controls and metadata, ControlList
+ * instances are serialized as the difference with the previous list
+ * serialized for the same ControlInfoMap, or for the same id map when the list
+ * has no ControlInfoMap, when that is smaller than the full list. The
+ * deserializer keeps the last list it has deserialized for each of them to
+ * reconstruct the full list. This requires all serialized lists to be
+ * deserialized, in the same order, by a single ControlSerializer instance.
+ * Lists that can't be reconstructed fail to deserialize.
+ *
+ * Serialization buffers can be sized with binarySize() beforehand. Serializing
+ * to a growable ByteStreamBuffer instead avoids walking the data twice, the
+ * buffer then grows to the size of the serialized data.
+ *
  * The serializer can be reset() to clear its internal state. This may be
  * performed when reconfiguring an IPA to avoid constant growth of the internal
  * state, especially if the contents of the ControlInfoMap instances change at
@@ -140,6 +161,39 @@ void ControlSerializer::reset()
 	infoMaps_.clear();
 	controlIds_.clear();
 	controlIdMaps_.clear();
+
+	/*
+	 * The next lists will be serialized in full. Lists serialized by the
+	 * peer before it gets reset may still be in flight, keep the lists
+	 * received for the global id maps to reconstruct them. Lists related
+	 * to a ControlInfoMap can't be deserialized anymore.
+	 */
+	sentLists_.clear();
+	for (auto it = receivedLists_.begin(); it != receivedLists_.end();) {
+		if (it->first & kIdMapKey)
+			++it;
+		else
+			it = receivedLists_.erase(it);
+	}
+}
+
+/*
+ * Identify the stream of lists that a ControlList belongs to for delta
+ * serialization, by its ControlInfoMap handle if any, or by its id map type.
+ */
+uint32_t ControlSerializer::listKey(uint32_t handle, uint32_t idMapType)
+{
+	return handle ? handle : kIdMapKey | idMapType;
+}
+
+/*
+ * Scalar values that fit in the entry are stored inline, without using the
+ * data section.
+ */
+bool ControlSerializer::isInline(const ControlValue &value)
+{
+	return !value.isArray() &&
+	       value.data().size_bytes() <= sizeof(ipa_control_value_entry::value);
 }
 
 size_t ControlSerializer::binarySize(const ControlValue &value)
@@ -177,7 +231,8 @@ size_t ControlSerializer::binarySize(const ControlInfoMap &infoMap)
  * \param[in] list The control list
  *
  * Compute and return the size in bytes required to store the serialized
- * ControlList.
+ * ControlList. The list may be serialized in less space if it is stored as a
+ * difference with the previous list.
  *
  * \return The size in bytes required to store the serialized ControlList
  */
@@ -186,8 +241,10 @@ size_t ControlSerializer::binarySize(const ControlList &list)
 	size_t size = sizeof(struct ipa_controls_header)
 		    + list.size() * sizeof(struct ipa_control_value_entry);
 
-	for (const auto &ctrl : list)
-		size += binarySize(ctrl.second);
+	for (const auto &ctrl : list) {
+		if (!isInline(ctrl.second))
+			size += binarySize(ctrl.second);
+	}
 
 	return size;
 }
@@ -252,6 +309,8 @@ int ControlSerializer::serialize(const ControlInfoMap &infoMap,
 	hdr.size = sizeof(hdr) + entriesSize + valuesSize;
 	hdr.data_offset = sizeof(hdr) + entriesSize;
 	hdr.id_map_type = idMapType;
+	hdr.sequence = 0;
+	hdr.base = 0;
 
 	buffer.write(&hdr);
 
@@ -338,19 +397,73 @@ int ControlSerializer::serialize(const ControlList &list,
 	else
 		idMapType = IPA_CONTROL_ID_MAP_V4L2;
 
-	size_t entriesSize = list.size() * sizeof(struct ipa_control_value_entry);
+	/*
+	 * Compute the difference with the last list serialized for the same
+	 * stream, as a list of added or modified controls and of removed
+	 * controls (with a null value), in increasing id order.
+	 */
+	ListState &sent = sentLists_[listKey(infoMapHandle, idMapType)];
+	bool delta = sent.sequence != 0;
+
+	delta_.clear();
+	if (delta) {
+		auto ctrl = list.begin();
+		auto base = sent.list.begin();
+
+		while (ctrl != list.end() || base != sent.list.end()) {
+			if (base == sent.list.end() ||
+			    (ctrl != list.end() && ctrl->first < base->first)) {
+				delta_.emplace_back(ctrl->first, &ctrl->second);
+				++ctrl;
+			} else if (ctrl == list.end() || base->first < ctrl->first) {
+				delta_.emplace_back(base->first, nullptr);
+				++base;
+			} else {
+				if (ctrl->second != base->second)
+					delta_.emplace_back(ctrl->first, &ctrl->second);
+				++ctrl;
+				++base;
+			}
+		}
+
+		/*
+		 * Removed controls are encoded with the ControlTypeNone type,
+		 * a changed control with no value can't be told apart.
+		 */
+		delta = delta_.size() < list.size() &&
+			std::none_of(delta_.begin(), delta_.end(), [](const auto &entry) {
+				return entry.second && entry.second->isNone();
+			});
+	}
+
+	if (!delta) {
+		delta_.clear();
+		for (const auto &ctrl : list)
+			delta_.emplace_back(ctrl.first, &ctrl.second);
+	}
+
+	size_t entriesSize = delta_.size() * sizeof(struct ipa_control_value_entry);
 	size_t valuesSize = 0;
-	for (const auto &ctrl : list)
-		valuesSize += binarySize(ctrl.second);
+	for (const auto &ctrl : delta_) {
+		if (ctrl.second && !isInline(*ctrl.second))
+			valuesSize += binarySize(*ctrl.second);
+	}
+
+	/* Sequence numbers are non-zero, 0 means no base packet. */
+	uint32_t sequence = sent.sequence + 1;
+	if (!sequence)
+		sequence = 1;
 
 	/* Prepare the packet header. */
 	struct ipa_controls_header hdr;
 	hdr.version = IPA_CONTROLS_FORMAT_VERSION;
 	hdr.handle = infoMapHandle;
-	hdr.entries = list.size();
+	hdr.entries = delta_.size();
 	hdr.size = sizeof(hdr) + entriesSize + valuesSize;
 	hdr.data_offset = sizeof(hdr) + entriesSize;
 	hdr.id_map_type = idMapType;
+	hdr.sequence = sequence;
+	hdr.base = delta ? sent.sequence : 0;
 
 	buffer.write(&hdr);
 
@@ -358,24 +471,38 @@ int ControlSerializer::serialize(const ControlList &list,
 	ByteStreamBuffer values = buffer.carveOut(valuesSize);
 
 	/* Serialize all entries. */
-	for (const auto &ctrl : list) {
-		unsigned int id = ctrl.first;
-		const ControlValue &value = ctrl.second;
+	for (const auto &ctrl : delta_) {
+		struct ipa_control_value_entry entry = {};
+		entry.id = ctrl.first;
+
+		if (!ctrl.second) {
+			entry.type = ControlTypeNone;
+			entries.write(&entry);
+			continue;
+		}
 
-		struct ipa_control_value_entry entry;
-		entry.id = id;
+		const ControlValue &value = *ctrl.second;
 		entry.type = value.type();
 		entry.is_array = value.isArray();
 		entry.count = value.numElements();
-		entry.offset = values.offset();
-		entries.write(&entry);
 
-		store(value, values);
+		if (isInline(value)) {
+			Span<const uint8_t> data = value.data();
+			std::copy(data.begin(), data.end(), entry.value);
+			entries.write(&entry);
+		} else {
+			entry.offset = values.offset();
+			entries.write(&entry);
+			store(value, values);
+		}
 	}
 
 	if (buffer.overflow())
 		return -ENOSPC;
 
+	sent.sequence = sequence;
+	sent.list = list;
+
 	return 0;
 }
 
@@ -499,7 +626,7 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 			 */
 			controlIds_.emplace_back(std::make_unique<ControlId>(entry->id,
 									     "", type));
-			(*localIdMap)[entry->id] = controlIds_.back().get();
+			localIdMap->set(entry->id, controlIds_.back().get());
 		}
 
 		const ControlId *controlId = idMap->at(entry->id);
@@ -601,6 +728,22 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 		}
 	}
 
+	/* Delta packets require the base packet to have been deserialized. */
+	uint32_t key = listKey(hdr->handle, hdr->id_map_type);
+	const ControlList *base = nullptr;
+	if (hdr->base) {
+		auto iter = receivedLists_.find(key);
+		if (iter == receivedLists_.end() ||
+		    iter->second.sequence != hdr->base) {
+			LOG(Serializer, Error)
+				<< "Can't deserialize ControlList: unknown base list "
+				<< hdr->base;
+			return {};
+		}
+
+		base = &iter->second.list;
+	}
+
 	/*
 	 * \todo When available, initialize the list with the ControlInfoMap
 	 * so that controls can be validated against their limits.
@@ -609,6 +752,12 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 	 */
 	ControlList ctrls(*idMap);
 
+	/*
+	 * Entries are stored in increasing id order. For delta packets, merge
+	 * them with the controls of the base list.
+	 */
+	auto baseCtrl = base ? base->begin() : ControlList::const_iterator{};
+
 	for (unsigned int i = 0; i < hdr->entries; ++i) {
 		const struct ipa_control_value_entry *entry =
 			entries.read<decltype(*entry)>();
@@ -617,19 +766,49 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 			return {};
 		}
 
-		if (entry->offset != values.offset()) {
-			LOG(Serializer, Error)
-				<< "Bad data, entry offset mismatch (entry "
-				<< i << ")";
-			return {};
+		ControlType type = static_cast<ControlType>(entry->type);
+
+		if (base) {
+			for (; baseCtrl != base->end() && baseCtrl->first < entry->id; ++baseCtrl)
+				ctrls.set(baseCtrl->first, baseCtrl->second);
+			if (baseCtrl != base->end() && baseCtrl->first == entry->id)
+				++baseCtrl;
+
+			/* The control has been removed from the list. */
+			if (type == ControlTypeNone)
+				continue;
 		}
 
-		ControlType type = static_cast<ControlType>(entry->type);
-		ctrls.set(entry->id,
-			  loadControlValue(type, values, entry->is_array,
-					   entry->count));
+		ControlValue value;
+		value.reserve(type, entry->is_array, entry->count);
+
+		if (isInline(value)) {
+			Span<uint8_t> data = value.data();
+			std::copy(entry->value, entry->value + data.size(), data.begin());
+		} else {
+			if (entry->offset != values.offset()) {
+				LOG(Serializer, Error)
+					<< "Bad data, entry offset mismatch (entry "
+					<< i << ")";
+				return {};
+			}
+
+			values.read(value.data());
+		}
+
+		ctrls.set(entry->id, value);
 	}
 
+	if (base) {
+		for (; baseCtrl != base->end(); ++baseCtrl)
+			ctrls.set(baseCtrl->first, baseCtrl->second);
+	}
+
+	/* Keep the list to reconstruct the next delta packets. */
+	ListState &received = receivedLists_[key];
+	received.sequence = hdr->sequence;
+	received.list = ctrls;
+
 	return ctrls;
 }
 
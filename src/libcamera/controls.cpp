@@ -7,7 +7,9 @@
 
 #include <libcamera/controls.h>
 
+#include <algorithm>
 #include <iomanip>
+#include <iterator>
 #include <sstream>
 #include <string>
 #include <string.h>
@@ -63,6 +65,9 @@ static constexpr size_t ControlValueSize[] = {
 	[ControlTypeSize]		= sizeof(Size),
 };
 
+/* Number of controls a ControlList reserves space for on first insertion. */
+static constexpr size_t kControlListCapacity = 16;
+
 } /* namespace */
 
 /**
@@ -89,8 +94,15 @@ static constexpr size_t ControlValueSize[] = {
  * \brief Abstract type representing the value of a control
  */
 
-/** \todo Revisit the ControlValue layout when stabilizing the ABI */
-static_assert(sizeof(ControlValue) == 16, "Invalid size of ControlValue class");
+/**
+ * \todo Revisit the ControlValue layout when stabilizing the ABI
+ *
+ * Values up to 40 bytes are stored inline, to avoid memory allocations for the
+ * array controls commonly reported in request metadata, such as
+ * ColourCorrectionMatrix (36 bytes) or ScalerCrop (16 bytes). Larger values
+ * are stored in memory allocated on the heap.
+ */
+static_assert(sizeof(ControlValue) == 48, "Invalid size of ControlValue class");
 
 /**
  * \brief Construct an empty ControlValue.
@@ -150,6 +162,53 @@ ControlValue &ControlValue::operator=(const ControlValue &other)
 	return *this;
 }
 
+/**
+ * \brief Construct a ControlValue by moving the content of \a other
+ * \param[in] other The ControlValue to move content from
+ *
+ * The storage of \a other is transferred to the new instance without copying
+ * the data. \a other is left with a ControlTypeNone type.
+ */
+ControlValue::ControlValue(ControlValue &&other) noexcept
+	: type_(other.type_), isArray_(other.isArray_),
+	  numElements_(other.numElements_)
+{
+	memcpy(value_, other.value_, sizeof(value_));
+
+	other.type_ = ControlTypeNone;
+	other.isArray_ = false;
+	other.numElements_ = 0;
+}
+
+/**
+ * \brief Replace the content of the ControlValue by moving the content of
+ * \a other
+ * \param[in] other The ControlValue to move content from
+ *
+ * The storage of \a other is transferred to this instance without copying the
+ * data. \a other is left with a ControlTypeNone type.
+ *
+ * \return The ControlValue with its content replaced with the one of \a other
+ */
+ControlValue &ControlValue::operator=(ControlValue &&other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	release();
+
+	type_ = other.type_;
+	isArray_ = other.isArray_;
+	numElements_ = other.numElements_;
+	memcpy(value_, other.value_, sizeof(value_));
+
+	other.type_ = ControlTypeNone;
+	other.isArray_ = false;
+	other.numElements_ = 0;
+
+	return *this;
+}
+
 /**
  * \fn ControlValue::type()
  * \brief Retrieve the data type of the value
@@ -188,7 +247,7 @@ Span<const uint8_t> ControlValue::data() const
 	std::size_t size = numElements_ * ControlValueSize[type_];
 	const uint8_t *data = size > sizeof(value_)
 			    ? reinterpret_cast<const uint8_t *>(storage_)
-			    : reinterpret_cast<const uint8_t *>(&value_);
+			    : value_;
 	return { data, size };
 }
 
@@ -607,14 +666,111 @@ std::string ControlInfo::toString() const
  */
 
 /**
- * \typedef ControlIdMap
+ * \class ControlIdMap
  * \brief A map of numerical control ID to ControlId
  *
  * The map is used by ControlList instances to access controls by numerical
  * IDs. A global map of all libcamera controls is provided by
  * controls::controls.
+ *
+ * Numerical IDs are looked up once per control for every request, and the
+ * libcamera control and property IDs are small consecutive integers. The map
+ * thus stores IDs lower than an internal limit in a dense array indexed by
+ * the ID, making the lookup() and at() functions O(1) without hashing. Larger
+ * IDs, such as V4L2 control IDs, are looked up in the underlying
+ * std::unordered_map<>.
+ *
+ * Like ControlInfoMap, the class only exposes the read accessors of the
+ * std::unordered_map<> base class. Entries are added with set().
+ */
+
+/**
+ * \typedef ControlIdMap::Map
+ * \brief The base std::unordered_map<> container
+ */
+
+/**
+ * \brief Construct a ControlIdMap from an initializer list
+ * \param[in] init The initializer list
+ */
+ControlIdMap::ControlIdMap(std::initializer_list<Map::value_type> init)
+{
+	for (const Map::value_type &entry : init)
+		set(entry.first, entry.second);
+}
+
+/**
+ * \fn ControlIdMap::begin()
+ * \brief Retrieve an iterator to the first element of the map
+ * \return A const iterator to the first element
+ */
+
+/**
+ * \fn ControlIdMap::end()
+ * \brief Retrieve an iterator past the last element of the map
+ * \return A const iterator past the last element
+ */
+
+/**
+ * \fn ControlIdMap::find()
+ * \brief Find the element matching a numerical ID
+ * \param[in] id The numerical ID
+ *
+ * This function always performs a hash lookup, use lookup() when an iterator
+ * isn't needed.
+ *
+ * \return A const iterator pointing to the element matching the numerical
+ * \a id, or end() if no such element exists
  */
 
+/**
+ * \fn ControlIdMap::lookup()
+ * \brief Retrieve the ControlId matching a numerical ID
+ * \param[in] id The numerical ID
+ * \return The ControlId matching the numerical \a id, or nullptr if no such
+ * element exists
+ */
+
+/**
+ * \brief Access specified element by numerical ID
+ * \param[in] id The numerical ID
+ * \return The ControlId whose ID is equal to \a id
+ * \exception std::out_of_range No element matches \a id
+ */
+const ControlId *ControlIdMap::at(unsigned int id) const
+{
+	const ControlId *control = lookup(id);
+	if (control)
+		return control;
+
+	return Map::at(id);
+}
+
+/**
+ * \fn ControlIdMap::count()
+ * \brief Count the number of elements matching a numerical ID
+ * \param[in] id The numerical ID
+ * \return The number of elements matching the numerical \a id
+ */
+
+/**
+ * \brief Add or replace the ControlId for a numerical ID
+ * \param[in] id The numerical ID
+ * \param[in] control The ControlId
+ */
+void ControlIdMap::set(unsigned int id, const ControlId *control)
+{
+	Map::operator[](id) = control;
+
+	if (id >= kMaxDenseId)
+		return;
+
+	if (id >= dense_.size())
+		dense_.resize(id + 1, nullptr);
+
+	dense_[id] = control;
+}
+
 /**
  * \class ControlInfoMap
  * \brief A map of ControlId to ControlInfo
@@ -679,13 +835,12 @@ bool ControlInfoMap::validate()
 {
 	for (const auto &ctrl : *this) {
 		const ControlId *id = ctrl.first;
-		auto it = idmap_->find(id->id());
 
 		/*
 		 * Make sure all control ids are part of the idmap and verify
 		 * the control info matches the expected type.
 		 */
-		if (it == idmap_->end() || it->second != id) {
+		if (idmap_->lookup(id->id()) != id) {
 			LOG(Controls, Error)
 				<< "Control " << utils::hex(id->id())
 				<< " not in the idmap";
@@ -755,11 +910,11 @@ ControlInfoMap::size_type ControlInfoMap::count(unsigned int id) const
  */
 ControlInfoMap::iterator ControlInfoMap::find(unsigned int id)
 {
-	auto iter = idmap_->find(id);
-	if (iter == idmap_->end())
+	const ControlId *controlId = idmap_->lookup(id);
+	if (!controlId)
 		return end();
 
-	return find(iter->second);
+	return find(controlId);
 }
 
 /**
@@ -770,11 +925,11 @@ ControlInfoMap::iterator ControlInfoMap::find(unsigned int id)
  */
 ControlInfoMap::const_iterator ControlInfoMap::find(unsigned int id) const
 {
-	auto iter = idmap_->find(id);
-	if (iter == idmap_->end())
+	const ControlId *controlId = idmap_->lookup(id);
+	if (!controlId)
 		return end();
 
-	return find(iter->second);
+	return find(controlId);
 }
 
 /**
@@ -799,6 +954,11 @@ ControlInfoMap::const_iterator ControlInfoMap::find(unsigned int id) const
  * Control lists are constructed with a map of all the controls supported by
  * their object, and an optional ControlValidator to further validate the
  * controls.
+ *
+ * Controls are stored in a contiguous array sorted by numerical ID. As lists
+ * typically contain a small number of controls, this is cheaper to create,
+ * copy, look up and merge than a hash table. Iterating over the list visits
+ * controls in increasing numerical ID order.
  */
 
 /**
@@ -902,8 +1062,7 @@ ControlList::ControlList(const ControlInfoMap &infoMap,
  * Only control lists created from the same ControlIdMap or ControlInfoMap may
  * be merged. Attempting to do otherwise results in undefined behaviour.
  *
- * \todo Reimplement or implement an overloaded version which internally uses
- * std::unordered_map::merge() and accepts a non-const argument.
+ * As both lists are sorted, they are merged in a single linear pass.
  */
 void ControlList::merge(const ControlList &source)
 {
@@ -919,16 +1078,44 @@ void ControlList::merge(const ControlList &source)
 	 * See https://bugs.libcamera.org/show_bug.cgi?id=31 for further details
 	 */
 
-	for (const auto &ctrl : source) {
-		if (contains(ctrl.first)) {
-			const ControlId *id = idmap_->at(ctrl.first);
+	if (source.empty())
+		return;
+
+	ControlListMap controls;
+	controls.reserve(controls_.size() + source.size());
+
+	auto dst = controls_.begin();
+	auto src = source.controls_.begin();
+
+	while (src != source.controls_.end()) {
+		if (dst != controls_.end() && dst->first < src->first) {
+			controls.push_back(std::move(*dst++));
+			continue;
+		}
+
+		if (dst != controls_.end() && dst->first == src->first) {
+			const ControlId *id = idmap_->at(src->first);
 			LOG(Controls, Warning)
 				<< "Control " << id->name() << " not overwritten";
+			controls.push_back(std::move(*dst++));
+			src++;
 			continue;
 		}
 
-		set(ctrl.first, ctrl.second);
+		if (validator_ && !validator_->validate(src->first)) {
+			LOG(Controls, Error)
+				<< "Control " << utils::hex(src->first)
+				<< " is not valid for " << validator_->name();
+			src++;
+			continue;
+		}
+
+		controls.push_back(*src++);
 	}
+
+	std::move(dst, controls_.end(), std::back_inserter(controls));
+
+	controls_ = std::move(controls);
 }
 
 /**
@@ -939,7 +1126,7 @@ void ControlList::merge(const ControlList &source)
  */
 bool ControlList::contains(const ControlId &id) const
 {
-	return controls_.find(id.id()) != controls_.end();
+	return contains(id.id());
 }
 
 /**
@@ -950,7 +1137,7 @@ bool ControlList::contains(const ControlId &id) const
  */
 bool ControlList::contains(unsigned int id) const
 {
-	return controls_.find(id) != controls_.end();
+	return lookup(id) != controls_.end();
 }
 
 /**
@@ -1050,7 +1237,7 @@ void ControlList::set(unsigned int id, const ControlValue &value)
 
 const ControlValue *ControlList::find(unsigned int id) const
 {
-	const auto iter = controls_.find(id);
+	const auto iter = lookup(id);
 	if (iter == controls_.end()) {
 		LOG(Controls, Error)
 			<< "Control " << utils::hex(id) << " not found";
@@ -1070,7 +1257,34 @@ ControlValue *ControlList::find(unsigned int id)
 		return nullptr;
 	}
 
-	return &controls_[id];
+	/*
+	 * Most lists hold a handful of controls, reserve space for them on the
+	 * first insertion to avoid repeated reallocations.
+	 */
+	if (controls_.empty())
+		controls_.reserve(kControlListCapacity);
+
+	auto iter = std::lower_bound(controls_.begin(), controls_.end(), id,
+				     [](const auto &ctrl, unsigned int key) {
+					     return ctrl.first < key;
+				     });
+	if (iter != controls_.end() && iter->first == id)
+		return &iter->second;
+
+	iter = controls_.emplace(iter, id, ControlValue{});
+	return &iter->second;
+}
+
+ControlList::ControlListMap::const_iterator ControlList::lookup(unsigned int id) const
+{
+	auto iter = std::lower_bound(controls_.begin(), controls_.end(), id,
+				     [](const auto &ctrl, unsigned int key) {
+					     return ctrl.first < key;
+				     });
+	if (iter == controls_.end() || iter->first != id)
+		return controls_.end();
+
+	return iter;
 }
 
 } /* namespace libcamera */
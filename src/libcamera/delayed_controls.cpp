@@ -7,6 +7,8 @@
 
 #include "libcamera/internal/delayed_controls.h"
 
+#include <errno.h>
+
 #include <libcamera/base/log.h>
 
 #include <libcamera/controls.h>
@@ -73,9 +75,55 @@ LOG_DEFINE_CATEGORY(DelayedControls)
  */
 DelayedControls::DelayedControls(V4L2Device *device,
 				 const std::unordered_map<uint32_t, ControlParams> &controlParams)
-	: device_(device), maxDelay_(0)
+	: maxDelay_(0)
+{
+	devices_.push_back({ device, ControlList(device->controls()) });
+	registerControls(0, controlParams);
+
+	reset();
+}
+
+/**
+ * \brief Add a secondary device whose controls are handled by the helper
+ * \param[in] device The V4L2 device the controls have to be applied to
+ * \param[in] controlParams Map of the numerical V4L2 control ids to their
+ * associated control parameters
+ *
+ * Some controls that need to be synchronised with the sensor controls are
+ * exposed by a different device, for instance the focus position of a lens
+ * voice coil motor. This function registers such a device and its controls
+ * with the helper. The controls are then pushed, read back and applied along
+ * with the controls of the device passed to the constructor, with their delay
+ * counted in frames of the same sensor.
+ *
+ * The numerical ids of the controls must be unique across all devices handled
+ * by the helper. Adding a device resets the state machine, and should thus be
+ * done before the helper is started.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int DelayedControls::addDevice(V4L2Device *device,
+			       const std::unordered_map<uint32_t, ControlParams> &controlParams)
 {
-	const ControlInfoMap &controls = device_->controls();
+	devices_.push_back({ device, ControlList(device->controls()) });
+
+	unsigned int count = registerControls(devices_.size() - 1, controlParams);
+	if (!count) {
+		devices_.pop_back();
+		return -EINVAL;
+	}
+
+	reset();
+
+	return 0;
+}
+
+unsigned int DelayedControls::registerControls(unsigned int device,
+					       const std::unordered_map<uint32_t, ControlParams> &controlParams)
+{
+	V4L2Device *dev = devices_[device].device;
+	const ControlInfoMap &controls = dev->controls();
+	unsigned int count = 0;
 
 	/*
 	 * Create a map of control ids to delays for controls exposed by the
@@ -88,23 +136,32 @@ DelayedControls::DelayedControls(V4L2Device *device,
 				<< "Delay request for control id "
 				<< utils::hex(param.first)
 				<< " but control is not exposed by device "
-				<< device_->deviceNode();
+				<< dev->deviceNode();
 			continue;
 		}
 
 		const ControlId *id = it->first;
 
-		controlParams_[id] = param.second;
+		if (indices_.count(id->id())) {
+			LOG(DelayedControls, Error)
+				<< "Control " << id->name()
+				<< " is already handled for another device";
+			continue;
+		}
+
+		indices_[id->id()] = controls_.size();
+		controls_.push_back({ id, param.second, device, {} });
+		count++;
 
 		LOG(DelayedControls, Debug)
-			<< "Set a delay of " << controlParams_[id].delay
-			<< " and priority write flag " << controlParams_[id].priorityWrite
+			<< "Set a delay of " << param.second.delay
+			<< " and priority write flag " << param.second.priorityWrite
 			<< " for " << id->name();
 
-		maxDelay_ = std::max(maxDelay_, controlParams_[id].delay);
+		maxDelay_ = std::max(maxDelay_, param.second.delay);
 	}
 
-	reset();
+	return count;
 }
 
 /**
@@ -120,22 +177,30 @@ void DelayedControls::reset()
 	queueCount_ = 1;
 	writeCount_ = 0;
 
-	/* Retrieve control as reported by the device. */
-	std::vector<uint32_t> ids;
-	for (auto const &param : controlParams_)
-		ids.push_back(param.first->id());
-
-	ControlList controls = device_->getControls(ids);
-
-	/* Seed the control queue with the controls reported by the device. */
-	values_.clear();
-	for (const auto &ctrl : controls) {
-		const ControlId *id = device_->controls().idmap().at(ctrl.first);
-		/*
-		 * Do not mark this control value as updated, it does not need
-		 * to be written to to device on startup.
-		 */
-		values_[id][0] = Info(ctrl.second, false);
+	for (unsigned int i = 0; i < devices_.size(); i++) {
+		/* Retrieve control as reported by the device. */
+		std::vector<uint32_t> ids;
+		for (const Control &ctrl : controls_) {
+			if (ctrl.device == i)
+				ids.push_back(ctrl.id->id());
+		}
+
+		ControlList controls = devices_[i].device->getControls(ids);
+
+		/* Seed the control queue with the controls reported by the device. */
+		for (Control &ctrl : controls_) {
+			if (ctrl.device != i)
+				continue;
+
+			ctrl.values = {};
+
+			/*
+			 * Do not mark this control value as updated, it does
+			 * not need to be written to to device on startup.
+			 */
+			if (controls.contains(ctrl.id->id()))
+				ctrl.values[0] = Info(controls.get(ctrl.id->id()), false);
+		}
 	}
 }
 
@@ -151,33 +216,32 @@ void DelayedControls::reset()
 bool DelayedControls::push(const ControlList &controls)
 {
 	/* Copy state from previous frame. */
-	for (auto &ctrl : values_) {
-		Info &info = ctrl.second[queueCount_];
-		info = values_[ctrl.first][queueCount_ - 1];
+	for (Control &ctrl : controls_) {
+		Info &info = ctrl.values[queueCount_];
+		info = ctrl.values[queueCount_ - 1];
 		info.updated = false;
 	}
 
 	/* Update with new controls. */
-	const ControlIdMap &idmap = device_->controls().idmap();
 	for (const auto &control : controls) {
-		const auto &it = idmap.find(control.first);
-		if (it == idmap.end()) {
-			LOG(DelayedControls, Warning)
-				<< "Unknown control " << control.first;
+		const auto it = indices_.find(control.first);
+		if (it == indices_.end()) {
+			bool known = false;
+			for (const Device &device : devices_)
+				known |= device.device->controls().idmap().count(control.first) != 0;
+			if (!known)
+				LOG(DelayedControls, Warning)
+					<< "Unknown control " << control.first;
 			return false;
 		}
 
-		const ControlId *id = it->second;
-
-		if (controlParams_.find(id) == controlParams_.end())
-			return false;
-
-		Info &info = values_[id][queueCount_];
+		Control &ctrl = controls_[it->second];
+		Info &info = ctrl.values[queueCount_];
 
 		info = Info(control.second);
 
 		LOG(DelayedControls, Debug)
-			<< "Queuing " << id->name()
+			<< "Queuing " << ctrl.id->name()
 			<< " to " << info.toString()
 			<< " at index " << queueCount_;
 	}
@@ -200,6 +264,10 @@ bool DelayedControls::push(const ControlList &controls)
  * push(). The max history from the current sequence number that yields valid
  * values are thus 16 minus number of controls pushed.
  *
+ * The returned list is associated with the controls of the device passed to
+ * the constructor. Controls of devices added with addDevice() are stored in
+ * the same list by numerical id.
+ *
  * \return The controls at \a sequence number
  */
 ControlList DelayedControls::get(uint32_t sequence)
@@ -207,15 +275,18 @@ ControlList DelayedControls::get(uint32_t sequence)
 	uint32_t adjustedSeq = sequence - firstSequence_;
 	unsigned int index = std::max<int>(0, adjustedSeq - maxDelay_);
 
-	ControlList out(device_->controls());
-	for (const auto &ctrl : values_) {
-		const ControlId *id = ctrl.first;
-		const Info &info = ctrl.second[index];
+	ControlList out(devices_[0].device->controls());
+	for (const Control &ctrl : controls_) {
+		const Info &info = ctrl.values[index];
+
+		/* Skip controls the device failed to report at reset time. */
+		if (info.isNone())
+			continue;
 
-		out.set(id->id(), info);
+		out.set(ctrl.id->id(), info);
 
 		LOG(DelayedControls, Debug)
-			<< "Reading " << id->name()
+			<< "Reading " << ctrl.id->name()
 			<< " to " << info.toString()
 			<< " at index " << index;
 	}
@@ -243,30 +314,35 @@ void DelayedControls::applyControls(uint32_t sequence)
 
 	/*
 	 * Create control list peeking ahead in the value queue to ensure
-	 * values are set in time to satisfy the sensor delay.
+	 * values are set in time to satisfy the sensor delay. Only the
+	 * controls whose value changed are written, the batch list is reused
+	 * across frames to avoid reallocating it.
 	 */
-	ControlList out(device_->controls());
-	for (auto &ctrl : values_) {
-		const ControlId *id = ctrl.first;
-		unsigned int delayDiff = maxDelay_ - controlParams_[id].delay;
+	for (Device &device : devices_)
+		device.batch.clear();
+
+	for (Control &ctrl : controls_) {
+		Device &device = devices_[ctrl.device];
+		const ControlId *id = ctrl.id;
+		unsigned int delayDiff = maxDelay_ - ctrl.params.delay;
 		unsigned int index = std::max<int>(0, writeCount_ - delayDiff);
-		Info &info = ctrl.second[index];
+		Info &info = ctrl.values[index];
 
 		if (info.updated) {
-			if (controlParams_[id].priorityWrite) {
+			if (ctrl.params.priorityWrite) {
 				/*
 				 * This control must be written now, it could
 				 * affect validity of the other controls.
 				 */
-				ControlList priority(device_->controls());
+				ControlList priority(device.device->controls());
 				priority.set(id->id(), info);
-				device_->setControls(&priority);
+				device.device->setControls(&priority);
 			} else {
 				/*
 				 * Batch up the list of controls and write them
 				 * at the end of the function.
 				 */
-				out.set(id->id(), info);
+				device.batch.set(id->id(), info);
 			}
 
 			LOG(DelayedControls, Debug)
@@ -287,7 +363,8 @@ void DelayedControls::applyControls(uint32_t sequence)
 		push({});
 	}
 
-	device_->setControls(&out);
+	for (Device &device : devices_)
+		device.device->setControls(&device.batch);
 }
 
 } /* namespace libcamera */
@@ -7,6 +7,7 @@
 
 #include "libcamera/internal/device_enumerator.h"
 
+#include <chrono>
 #include <string.h>
 
 #include <libcamera/base/log.h>
@@ -159,6 +160,14 @@ std::unique_ptr<DeviceEnumerator> DeviceEnumerator::create()
 	return nullptr;
 }
 
+/**
+ * \brief Construct a DeviceEnumerator
+ */
+DeviceEnumerator::DeviceEnumerator()
+{
+	addTimer_.timeout.connect(this, &DeviceEnumerator::addTimeout);
+}
+
 DeviceEnumerator::~DeviceEnumerator()
 {
 	for (std::shared_ptr<MediaDevice> media : devices_) {
@@ -233,9 +242,10 @@ std::unique_ptr<MediaDevice> DeviceEnumerator::createDevice(const std::string &d
 * \brief Notify of new media devices being found
 *
 * This signal is emitted when the device enumerator finds new media devices in
-* the system. It may be emitted for every newly detected device, or once for
-* multiple devices, at the discretion of the device enumerator. Not all device
-* enumerator types may support dynamic detection of new devices.
+* the system. Devices are often added in bursts, for instance when a USB hub
+* with multiple cameras is plugged in, so the signal is emitted once shortly
+* after the last device of a burst is added. Not all device enumerator types
+* may support dynamic detection of new devices.
 */
 
 /**
@@ -254,7 +264,15 @@ void DeviceEnumerator::addDevice(std::unique_ptr<MediaDevice> media)
 
 	devices_.push_back(std::move(media));
 
-	/* \todo To batch multiple additions, emit with a small delay here. */
+	/*
+	 * Delay the notification, restarting the timer with every new device,
+	 * to match all the devices of a burst with pipeline handlers at once.
+	 */
+	addTimer_.start(kAddDelay);
+}
+
+void DeviceEnumerator::addTimeout()
+{
 	devicesAdded.emit();
 }
 
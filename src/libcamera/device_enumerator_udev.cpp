@@ -329,22 +329,29 @@ int DeviceEnumeratorUdev::addV4L2Device(dev_t devnum)
 
 void DeviceEnumeratorUdev::udevNotify()
 {
-	struct udev_device *dev = udev_monitor_receive_device(monitor_);
-	std::string action(udev_device_get_action(dev));
-	std::string deviceNode(udev_device_get_devnode(dev));
-
-	LOG(DeviceEnumerator, Debug)
-		<< action << " device " << udev_device_get_devnode(dev);
-
-	if (action == "add") {
-		addUdevDevice(dev);
-	} else if (action == "remove") {
-		const char *subsystem = udev_device_get_subsystem(dev);
-		if (subsystem && !strcmp(subsystem, "media"))
-			removeDevice(deviceNode);
-	}
+	/*
+	 * Process all the queued events at once, as hotplugged devices
+	 * usually come in bursts. The monitor socket is non-blocking, the loop
+	 * ends when the queue is empty.
+	 */
+	struct udev_device *dev;
+	while ((dev = udev_monitor_receive_device(monitor_))) {
+		std::string action(udev_device_get_action(dev));
+		std::string deviceNode(udev_device_get_devnode(dev));
+
+		LOG(DeviceEnumerator, Debug)
+			<< action << " device " << deviceNode;
+
+		if (action == "add") {
+			addUdevDevice(dev);
+		} else if (action == "remove") {
+			const char *subsystem = udev_device_get_subsystem(dev);
+			if (subsystem && !strcmp(subsystem, "media"))
+				removeDevice(deviceNode);
+		}
 
-	udev_device_unref(dev);
+		udev_device_unref(dev);
+	}
 }
 
 } /* namespace libcamera */
@@ -0,0 +1,383 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Raspberry Pi (Trading) Limited
+ *
+ * dma_heaps.cpp - Helper class for dma-heap allocations.
+ */
+
+#include "libcamera/internal/dma_heaps.h"
+
+#include <algorithm>
+#include <array>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/base/global_configuration.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/framebuffer.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/formats.h"
+
+/**
+ * \file dma_heaps.h
+ * \brief dma-heap allocator
+ */
+
+namespace {
+
+/*
+ * /dev/dma_heap/linux,cma is the CMA dma-heap allocator, which allocates
+ * physically contiguous memory.
+ *
+ * Annoyingly, should the cma heap size be specified on the kernel command line
+ * instead of DT, the heap gets named "reserved" instead.
+ *
+ * /dev/dma_heap/system allocates memory from the page allocator. It is not
+ * physically contiguous, and mapped cached to the CPU.
+ */
+struct DmaHeapInfo {
+	libcamera::DmaHeap::DmaHeapFlag type;
+	const char *name;
+};
+
+constexpr std::array<DmaHeapInfo, 3> heapInfos = { {
+	{ libcamera::DmaHeap::DmaHeapFlag::Cma, "/dev/dma_heap/linux,cma" },
+	{ libcamera::DmaHeap::DmaHeapFlag::Cma, "/dev/dma_heap/reserved" },
+	{ libcamera::DmaHeap::DmaHeapFlag::System, "/dev/dma_heap/system" },
+} };
+
+} /* namespace */
+
+/*
+ * Default maximum size of the released buffers retained for reuse, and the
+ * maximum size overhead accepted when reusing a larger buffer, expressed as a
+ * fraction of the requested size.
+ */
+static constexpr std::size_t kDefaultRetentionLimit = 32 * 1024 * 1024;
+static constexpr std::size_t kMaxSizeOverheadShift = 2;
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(DmaHeap)
+
+/**
+ * \class DmaHeap
+ * \brief Helper class for dma-heap allocations
+ *
+ * The DmaHeap allocates buffers from a dma-heap. Buffers that are not needed
+ * anymore can be released to the DmaHeap, which keeps them in a pool for reuse
+ * by later allocations of a similar size, up to a retention limit. This avoids
+ * fragmenting the CMA area and the associated allocation stalls when cameras
+ * are repeatedly configured, started and stopped.
+ *
+ * A single DmaHeap per heap type is shared by all users in the process, see
+ * instance(). The retention limit defaults to 32MiB and can be overridden with
+ * the LIBCAMERA_DMA_HEAP_POOL_SIZE environment variable, expressed in bytes, or
+ * with setRetentionLimit().
+ */
+
+/**
+ * \enum DmaHeap::DmaHeapFlag
+ * \brief Type of the dma-heap
+ * \var DmaHeap::Cma
+ * \brief Allocate from a CMA dma-heap, providing physically-contiguous memory
+ * \var DmaHeap::System
+ * \brief Allocate from the system dma-heap, using the page allocator
+ */
+
+/**
+ * \typedef DmaHeap::DmaHeapFlags
+ * \brief A bitwise combination of DmaHeap::DmaHeapFlag values
+ */
+
+/**
+ * \brief Construct a DmaHeap of a given type
+ * \param[in] type The type(s) of the dma-heap(s) to allocate from
+ *
+ * When multiple types are specified, the DmaHeap uses the first available
+ * heap, in the order listed in the DmaHeap::DmaHeapFlag enumeration.
+ */
+DmaHeap::DmaHeap(DmaHeapFlags type)
+	: dmaHeapHandle_(-1), poolSize_(0),
+	  retentionLimit_(kDefaultRetentionLimit)
+{
+	for (const DmaHeapInfo &info : heapInfos) {
+		if (!(type & info.type))
+			continue;
+
+		int ret = ::open(info.name, O_RDWR | O_CLOEXEC, 0);
+		if (ret < 0) {
+			ret = errno;
+			LOG(DmaHeap, Debug) << "Failed to open " << info.name
+					    << ": " << strerror(ret);
+			continue;
+		}
+
+		LOG(DmaHeap, Debug) << "Using " << info.name;
+		dmaHeapHandle_ = ret;
+		break;
+	}
+
+	if (dmaHeapHandle_ < 0)
+		LOG(DmaHeap, Error) << "Could not open any dmaHeap device";
+
+	/* Accept the previous Raspberry Pi specific name for compatibility. */
+	const char *limit = GlobalConfiguration::option("LIBCAMERA_DMA_HEAP_POOL_SIZE");
+	if (!limit)
+		limit = GlobalConfiguration::option("LIBCAMERA_RPI_DMA_HEAP_POOL_SIZE");
+	if (limit) {
+		char *end;
+		unsigned long long value = strtoull(limit, &end, 10);
+		if (*limit && !*end)
+			retentionLimit_ = value;
+		else
+			LOG(DmaHeap, Warning)
+				<< "Invalid dmaHeap pool size '" << limit << "'";
+	}
+}
+
+DmaHeap::~DmaHeap()
+{
+	pool_.clear();
+
+	if (dmaHeapHandle_ > -1)
+		::close(dmaHeapHandle_);
+}
+
+/**
+ * \brief Retrieve the process-wide DmaHeap instance for a heap type
+ * \param[in] type The type(s) of the dma-heap(s) to allocate from
+ *
+ * The instance is created if needed. It is destroyed, and all the pooled
+ * buffers freed, when the last reference to it is released.
+ *
+ * \return The DmaHeap instance for \a type
+ */
+std::shared_ptr<DmaHeap> DmaHeap::instance(DmaHeapFlags type)
+{
+	static std::mutex mutex;
+	static std::map<DmaHeapFlags::Type, std::weak_ptr<DmaHeap>> heaps;
+
+	std::lock_guard<std::mutex> locker(mutex);
+
+	std::weak_ptr<DmaHeap> &heap = heaps[static_cast<DmaHeapFlags::Type>(type)];
+	std::shared_ptr<DmaHeap> instance = heap.lock();
+	if (!instance) {
+		instance = std::make_shared<DmaHeap>(type);
+		heap = instance;
+	}
+
+	return instance;
+}
+
+/**
+ * \fn DmaHeap::isValid()
+ * \brief Check if the DmaHeap instance is valid
+ * \return True if the DmaHeap is valid, false otherwise
+ */
+
+/**
+ * \brief Allocate a dma-buf from the DmaHeap
+ * \param[in] name The name to set for the allocated buffer
+ * \param[in] size The size of the buffer to allocate
+ *
+ * A buffer previously released to the pool is reused if one of a similar size
+ * is available.
+ *
+ * \return The file descriptor of the allocated buffer, or an invalid file
+ * descriptor on failure
+ */
+FileDescriptor DmaHeap::alloc(const char *name, std::size_t size)
+{
+	int ret;
+
+	if (!name || !isValid())
+		return FileDescriptor();
+
+	FileDescriptor fd;
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+
+		/*
+		 * Reuse the smallest pooled buffer large enough for the
+		 * allocation, if it doesn't waste too much memory.
+		 */
+		auto it = pool_.lower_bound(size);
+		if (it != pool_.end() &&
+		    it->first <= size + (size >> kMaxSizeOverheadShift)) {
+			fd = std::move(it->second);
+			poolSize_ -= it->first;
+			pool_.erase(it);
+		}
+	}
+
+	if (fd.isValid()) {
+		/*
+		 * Renaming a buffer that is still attached to devices may fail,
+		 * this isn't fatal as the name is only used for debugging.
+		 */
+		ret = ::ioctl(fd.fd(), DMA_BUF_SET_NAME, name);
+		if (ret < 0)
+			LOG(DmaHeap, Debug) << "dmaHeap renaming failure for "
+					    << name;
+
+		LOG(DmaHeap, Debug) << "Reusing pooled dmaHeap buffer for " << name;
+		return fd;
+	}
+
+	struct dma_heap_allocation_data alloc = {};
+
+	alloc.len = size;
+	alloc.fd_flags = O_CLOEXEC | O_RDWR;
+
+	ret = ::ioctl(dmaHeapHandle_, DMA_HEAP_IOCTL_ALLOC, &alloc);
+
+	if (ret < 0) {
+		LOG(DmaHeap, Error) << "dmaHeap allocation failure for "
+				    << name;
+		return FileDescriptor();
+	}
+
+	ret = ::ioctl(alloc.fd, DMA_BUF_SET_NAME, name);
+	if (ret < 0) {
+		LOG(DmaHeap, Error) << "dmaHeap naming failure for "
+				    << name;
+		::close(alloc.fd);
+		return FileDescriptor();
+	}
+
+	return FileDescriptor(std::move(alloc.fd));
+}
+
+/**
+ * \brief Allocate a frame buffer for a stream configuration
+ * \param[in] name The name to set for the allocated buffer
+ * \param[in] cfg The stream configuration
+ *
+ * The planes of the frame buffer are laid out contiguously in a single
+ * dma-buf, according to the pixel format, stride and frame size of the stream
+ * configuration \a cfg. The planes are sized to a multiple of the
+ * StreamConfiguration::heightAlign lines, and their offsets aligned to
+ * StreamConfiguration::planeAlign bytes, when set. Formats unknown to
+ * libcamera, such as compressed formats, are stored in a single plane of the
+ * frame size.
+ *
+ * \return The allocated frame buffer, or nullptr if the frame size can't be
+ * computed or the allocation fails
+ */
+std::unique_ptr<FrameBuffer> DmaHeap::allocFrameBuffer(const char *name,
+						       const StreamConfiguration &cfg)
+{
+	const PixelFormatInfo &info = PixelFormatInfo::info(cfg.pixelFormat);
+	unsigned int height = cfg.heightAlign
+			    ? utils::alignUp(cfg.size.height, cfg.heightAlign)
+			    : cfg.size.height;
+	unsigned int planeAlign = std::max(cfg.planeAlign, 1U);
+
+	std::vector<unsigned int> planeSizes;
+	if (info.isValid()) {
+		for (unsigned int i = 0; i < info.numPlanes(); ++i) {
+			unsigned int stride = cfg.stride * info.planes[i].bytesPerGroup
+					    / info.planes[0].bytesPerGroup;
+			planeSizes.push_back(info.planeSize(height, i, stride));
+		}
+	} else {
+		planeSizes.push_back(0);
+	}
+
+	std::vector<unsigned int> planeOffsets;
+	unsigned int frameSize = 0;
+	for (unsigned int size : planeSizes) {
+		frameSize = utils::alignUp(frameSize, planeAlign);
+		planeOffsets.push_back(frameSize);
+		frameSize += size;
+	}
+
+	if (frameSize < cfg.frameSize) {
+		planeSizes.back() += cfg.frameSize - frameSize;
+		frameSize = cfg.frameSize;
+	}
+
+	if (!frameSize) {
+		LOG(DmaHeap, Error)
+			<< "Can't compute the frame size of " << cfg.toString();
+		return nullptr;
+	}
+
+	FileDescriptor fd = alloc(name, frameSize);
+	if (!fd.isValid())
+		return nullptr;
+
+	std::vector<FrameBuffer::Plane> planes;
+
+	for (unsigned int i = 0; i < planeSizes.size(); ++i) {
+		FrameBuffer::Plane plane;
+		plane.fd = fd;
+		plane.offset = planeOffsets[i];
+		plane.length = planeSizes[i];
+		planes.push_back(std::move(plane));
+	}
+
+	return std::make_unique<FrameBuffer>(std::move(planes));
+}
+
+/**
+ * \brief Release a buffer allocated with alloc()
+ * \param[in] fd The buffer file descriptor
+ * \param[in] size The buffer size
+ *
+ * The buffer is retained for reuse if the pool has space for it, and freed
+ * otherwise. The caller shall not access the buffer after releasing it.
+ */
+void DmaHeap::release(FileDescriptor fd, std::size_t size)
+{
+	if (!fd.isValid())
+		return;
+
+	std::lock_guard<std::mutex> locker(lock_);
+
+	if (size > retentionLimit_)
+		return;
+
+	trim(retentionLimit_ - size);
+
+	pool_.emplace(size, std::move(fd));
+	poolSize_ += size;
+}
+
+/**
+ * \brief Set the maximum total size of the buffers retained in the pool
+ * \param[in] limit The size limit, in bytes
+ *
+ * Pooled buffers are freed if needed to fit the new limit.
+ */
+void DmaHeap::setRetentionLimit(std::size_t limit)
+{
+	std::lock_guard<std::mutex> locker(lock_);
+
+	retentionLimit_ = limit;
+	trim(limit);
+}
+
+void DmaHeap::trim(std::size_t limit)
+{
+	/* Free the largest buffers first. */
+	while (poolSize_ > limit) {
+		auto it = std::prev(pool_.end());
+		poolSize_ -= it->first;
+		pool_.erase(it);
+	}
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * fence.cpp - Synchronization fence
+ */
+
+#include <libcamera/fence.h>
+
+/**
+ * \file fence.h
+ * \brief Definition of the Fence class
+ */
+
+namespace libcamera {
+
+/**
+ * \class Fence
+ * \brief Synchronization primitive to manage resources
+ *
+ * The Fence class models a synchronization primitive that can be used by
+ * applications to explicitly synchronize resource usage, and can be shared by
+ * multiple processes.
+ *
+ * Fences are most commonly used in association with frame buffers. A
+ * FrameBuffer can be associated with a Fence so that the library can wait for
+ * the Fence to be signalled before allowing the camera device to actually
+ * access the memory area described by the FrameBuffer. Applications can then
+ * synchronize frame buffer consumers and producers, such as a display device
+ * or a GPU and a camera, without waiting for the fences on the CPU.
+ *
+ * The only fence mechanism currently supported by libcamera is the
+ * <a href="https://www.kernel.org/doc/html/latest/driver-api/sync_file.html">kernel sync file</a>,
+ * which is signalled when it becomes readable.
+ *
+ * \sa Request::addBuffer()
+ *
+ * \internal
+ *
+ * The Fence class is a thin abstraction around a file descriptor. The file
+ * descriptor is waited on by the core library with an EventNotifier, in the
+ * thread of the pipeline handler, before the request the buffer belongs to is
+ * queued to the pipeline handler.
+ */
+
+/**
+ * \brief Create a Fence
+ * \param[in] fd The fence file descriptor
+ *
+ * The file descriptor ownership is moved to the Fence.
+ */
+Fence::Fence(FileDescriptor fd)
+	: fd_(std::move(fd))
+{
+}
+
+/**
+ * \fn Fence::isValid()
+ * \brief Check if a Fence is valid
+ *
+ * A Fence is valid if the file descriptor it wraps is valid.
+ *
+ * \return True if the Fence is valid, false otherwise
+ */
+
+/**
+ * \fn Fence::fd()
+ * \brief Retrieve a constant reference to the file descriptor
+ * \return A const reference to the fence file descriptor
+ */
+
+/**
+ * \fn Fence::release()
+ * \brief Release the ownership of the file descriptor
+ *
+ * Release the ownership of the wrapped file descriptor by returning it to the
+ * caller. The Fence is invalid after this function returns.
+ *
+ * \return The wrapped file descriptor
+ */
+
+} /* namespace libcamera */
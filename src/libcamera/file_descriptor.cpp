@@ -53,6 +53,11 @@ LOG_DEFINE_CATEGORY(FileDescriptor)
  * other FileDescriptor invalid. When the last FileDescriptor that references a
  * Descriptor is destroyed, the file descriptor is closed.
  *
+ * The Descriptor is reference-counted intrusively. Copying a FileDescriptor
+ * only increments the reference count and never allocates memory or duplicates
+ * the numerical file descriptor, while moving it doesn't touch the reference
+ * count at all. Only dup() creates a new numerical file descriptor.
+ *
  * The numerical file descriptor is available through the fd() function. All
  * FileDescriptor instances created as copies of a FileDescriptor will report
  * the same fd() value. Callers can perform operations on the fd(), but shall
@@ -73,13 +78,14 @@ LOG_DEFINE_CATEGORY(FileDescriptor)
  * the fd() function will return -1.
  */
 FileDescriptor::FileDescriptor(const int &fd)
+	: fd_(nullptr)
 {
 	if (fd < 0)
 		return;
 
-	fd_ = std::make_shared<Descriptor>(fd, true);
+	fd_ = new Descriptor(fd, true);
 	if (fd_->fd() < 0)
-		fd_.reset();
+		release();
 }
 
 /**
@@ -97,11 +103,12 @@ FileDescriptor::FileDescriptor(const int &fd)
  * the fd() function will return -1.
  */
 FileDescriptor::FileDescriptor(int &&fd)
+	: fd_(nullptr)
 {
 	if (fd < 0)
 		return;
 
-	fd_ = std::make_shared<Descriptor>(fd, false);
+	fd_ = new Descriptor(fd, false);
 	/*
 	 * The Descriptor constructor can't have failed here, as it took over
 	 * the fd without duplicating it. Just set the original fd to -1 to
@@ -123,6 +130,8 @@ FileDescriptor::FileDescriptor(int &&fd)
 FileDescriptor::FileDescriptor(const FileDescriptor &other)
 	: fd_(other.fd_)
 {
+	if (fd_)
+		fd_->ref();
 }
 
 /**
@@ -134,9 +143,11 @@ FileDescriptor::FileDescriptor(const FileDescriptor &other)
  * invalidated and its fd() function will return -1. The wrapped file descriptor
  * will be closed automatically when all FileDescriptor instances that
  * reference it are destroyed.
+ *
+ * Moving doesn't touch the reference count of the wrapped descriptor.
  */
-FileDescriptor::FileDescriptor(FileDescriptor &&other)
-	: fd_(std::move(other.fd_))
+FileDescriptor::FileDescriptor(FileDescriptor &&other) noexcept
+	: fd_(std::exchange(other.fd_, nullptr))
 {
 }
 
@@ -149,6 +160,7 @@ FileDescriptor::FileDescriptor(FileDescriptor &&other)
  */
 FileDescriptor::~FileDescriptor()
 {
+	release();
 }
 
 /**
@@ -167,7 +179,13 @@ FileDescriptor::~FileDescriptor()
  */
 FileDescriptor &FileDescriptor::operator=(const FileDescriptor &other)
 {
-	fd_ = other.fd_;
+	/* Take the new reference first to handle self-assignment. */
+	Descriptor *fd = other.fd_;
+	if (fd)
+		fd->ref();
+
+	release();
+	fd_ = fd;
 
 	return *this;
 }
@@ -186,9 +204,12 @@ FileDescriptor &FileDescriptor::operator=(const FileDescriptor &other)
  *
  * \return A reference to this FileDescriptor
  */
-FileDescriptor &FileDescriptor::operator=(FileDescriptor &&other)
+FileDescriptor &FileDescriptor::operator=(FileDescriptor &&other) noexcept
 {
-	fd_ = std::move(other.fd_);
+	if (this != &other) {
+		release();
+		fd_ = std::exchange(other.fd_, nullptr);
+	}
 
 	return *this;
 }
@@ -226,6 +247,11 @@ FileDescriptor FileDescriptor::dup() const
 /**
  * \brief Retrieve the file descriptor inode
  *
+ * The inode identifies the file the descriptor refers to, and can be used to
+ * check if two different file descriptors refer to the same file, such as the
+ * same dmabuf instance. It is retrieved once and cached in the wrapped
+ * descriptor, shared by all copies of the FileDescriptor.
+ *
  * \todo Should this move to the File class ?
  *
  * \return The file descriptor inode on success, or 0 on error
@@ -235,11 +261,30 @@ ino_t FileDescriptor::inode() const
 	if (!isValid())
 		return 0;
 
+	return fd_->inode();
+}
+
+/**
+ * \brief Retrieve the inode of a numerical file descriptor
+ * \param[in] fd The numerical file descriptor
+ *
+ * This function allows comparing the identity of a numerical file descriptor
+ * with the one of a FileDescriptor without duplicating \a fd to construct a
+ * FileDescriptor. The \a fd may come from an application and is thus not
+ * trusted, an invalid \a fd is reported as an error.
+ *
+ * \return The file descriptor inode on success, or 0 on error
+ */
+ino_t FileDescriptor::inode(int fd)
+{
+	if (fd < 0)
+		return 0;
+
 	struct stat st;
-	int ret = fstat(fd_->fd(), &st);
+	int ret = fstat(fd, &st);
 	if (ret < 0) {
 		ret = -errno;
-		LOG(FileDescriptor, Fatal)
+		LOG(FileDescriptor, Error)
 			<< "Failed to fstat() fd: " << strerror(-ret);
 		return 0;
 	}
@@ -247,7 +292,16 @@ ino_t FileDescriptor::inode() const
 	return st.st_ino;
 }
 
+void FileDescriptor::release()
+{
+	if (fd_ && fd_->unref())
+		delete fd_;
+
+	fd_ = nullptr;
+}
+
 FileDescriptor::Descriptor::Descriptor(int fd, bool duplicate)
+	: refs_(1), inode_(0)
 {
 	if (!duplicate) {
 		fd_ = fd;
@@ -269,4 +323,19 @@ FileDescriptor::Descriptor::~Descriptor()
 		close(fd_);
 }
 
+ino_t FileDescriptor::Descriptor::inode()
+{
+	/*
+	 * The inode of an open file descriptor never changes. Concurrent
+	 * callers may race to retrieve it, but will all store the same value.
+	 */
+	ino_t inode = inode_.load(std::memory_order_relaxed);
+	if (!inode) {
+		inode = FileDescriptor::inode(fd_);
+		inode_.store(inode, std::memory_order_relaxed);
+	}
+
+	return inode;
+}
+
 } /* namespace libcamera */
@@ -9,6 +9,7 @@
 
 #include <algorithm>
 #include <errno.h>
+#include <unordered_map>
 
 #include <libcamera/base/log.h>
 #include <libcamera/base/utils.h>
@@ -49,6 +50,11 @@ LOG_DEFINE_CATEGORY(Formats)
  * multiplanar format, or if no corresponding non-contiguous V4L2 format
  * exists, the second entry is invalid.
  *
+ * Both entries are invalid for formats that have no V4L2 equivalent, such as
+ * the Arm Framebuffer Compression (AFBC) formats, for which no V4L2 4CC is
+ * defined. Such formats can be produced by devices that report them through
+ * other means, and consumed by display and GPU drivers.
+ *
  * \var PixelFormatInfo::bitsPerPixel
  * \brief The average number of bits per pixel
  *
@@ -905,8 +911,119 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.pixelsPerGroup = 1,
 		.planes = {{ { 1, 1 }, { 0, 0 }, { 0, 0 } }},
 	} },
+	{ formats::XBGR8888_AFBC, {
+		.name = "XBGR8888_AFBC",
+		.format = formats::XBGR8888_AFBC,
+		.v4l2Formats = {
+			.single = V4L2PixelFormat(),
+			.multi = V4L2PixelFormat(),
+		},
+		.bitsPerPixel = 32,
+		.colourEncoding = PixelFormatInfo::ColourEncodingRGB,
+		.packed = false,
+		.pixelsPerGroup = 1,
+		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
+	} },
+	{ formats::YUV420_8BIT_AFBC, {
+		.name = "YUV420_8BIT_AFBC",
+		.format = formats::YUV420_8BIT_AFBC,
+		.v4l2Formats = {
+			.single = V4L2PixelFormat(),
+			.multi = V4L2PixelFormat(),
+		},
+		.bitsPerPixel = 12,
+		.colourEncoding = PixelFormatInfo::ColourEncodingYUV,
+		.packed = false,
+		.pixelsPerGroup = 2,
+		.planes = {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }},
+	} },
 };
 
+/*
+ * Index of the pixelFormatInfo entries by V4L2 pixel format, for both the
+ * single and multi planar variants. When multiple entries share a V4L2 format,
+ * the first one in the pixelFormatInfo order is indexed.
+ */
+const std::unordered_map<uint32_t, const PixelFormatInfo *> &v4l2PixelFormatInfo()
+{
+	static const auto index = []() {
+		std::unordered_map<uint32_t, const PixelFormatInfo *> map;
+
+		for (const auto &[format, info] : pixelFormatInfo) {
+			for (V4L2PixelFormat v4l2Format : { info.v4l2Formats.single,
+							    info.v4l2Formats.multi }) {
+				if (v4l2Format.isValid())
+					map.emplace(v4l2Format, &info);
+			}
+		}
+
+		return map;
+	}();
+
+	return index;
+}
+
+/*
+ * Layout of an Arm Framebuffer Compression (AFBC) buffer, as decoded from the
+ * format modifier. Buffers are made of a header block for each superblock of
+ * pixels, followed by the superblocks payload. The frame size is aligned to a
+ * multiple of the superblock size, or of the tile size for tiled layouts.
+ */
+struct AfbcLayout {
+	unsigned int blockWidth;
+	unsigned int blockHeight;
+	unsigned int widthAlignment;
+	unsigned int heightAlignment;
+	unsigned int headerAlignment;
+};
+
+/* AFBC modifier fields, as defined in drm_fourcc.h. */
+constexpr unsigned int kModVendorArm = 0x08;
+constexpr unsigned int kModArmTypeAfbc = 0x00;
+constexpr uint64_t kAfbcBlockSizeMask = 0xf;
+constexpr uint64_t kAfbcBlockSize16x16 = 1;
+constexpr uint64_t kAfbcBlockSize32x8 = 2;
+constexpr uint64_t kAfbcBlockSize64x4 = 3;
+constexpr uint64_t kAfbcTiled = 1ULL << 8;
+
+constexpr unsigned int kAfbcHeaderSize = 16;
+constexpr unsigned int kAfbcSuperblockAlignment = 128;
+
+bool afbcLayout(const PixelFormat &format, AfbcLayout *layout)
+{
+	uint64_t modifier = format.modifier();
+
+	if ((modifier >> 56) != kModVendorArm ||
+	    ((modifier >> 52) & 0xf) != kModArmTypeAfbc)
+		return false;
+
+	switch (modifier & kAfbcBlockSizeMask) {
+	case kAfbcBlockSize16x16:
+		layout->blockWidth = 16;
+		layout->blockHeight = 16;
+		break;
+	case kAfbcBlockSize32x8:
+		layout->blockWidth = 32;
+		layout->blockHeight = 8;
+		break;
+	case kAfbcBlockSize64x4:
+		layout->blockWidth = 64;
+		layout->blockHeight = 4;
+		break;
+	default:
+		return false;
+	}
+
+	/* Tiled layouts group superblocks in 8x8 tiles. */
+	unsigned int tile = modifier & kAfbcTiled ? 8 : 1;
+
+	layout->widthAlignment = layout->blockWidth * tile;
+	layout->heightAlignment = layout->blockHeight * tile;
+	layout->headerAlignment = modifier & kAfbcTiled ? 4096 : 64;
+
+	return true;
+}
+
 } /* namespace */
 
 /**
@@ -942,15 +1059,12 @@ const PixelFormatInfo &PixelFormatInfo::info(const PixelFormat &format)
  */
 const PixelFormatInfo &PixelFormatInfo::info(const V4L2PixelFormat &format)
 {
-	const auto &info = std::find_if(pixelFormatInfo.begin(), pixelFormatInfo.end(),
-					[format](auto pair) {
-						return pair.second.v4l2Formats.single == format ||
-						       pair.second.v4l2Formats.multi == format;
-					});
-	if (info == pixelFormatInfo.end())
+	const auto &index = v4l2PixelFormatInfo();
+	const auto iter = index.find(format);
+	if (iter == index.end())
 		return pixelFormatInfoInvalid;
 
-	return info->second;
+	return *iter->second;
 }
 
 /**
@@ -986,6 +1100,11 @@ const PixelFormatInfo &PixelFormatInfo::info(const std::string &name)
  * For multi-planar formats, different planes may have different stride values.
  * The \a plane parameter selects which plane to compute the stride for.
  *
+ * For Arm Framebuffer Compression (AFBC) formats, the width is first rounded
+ * up to the superblock size (or tile size for tiled layouts) specified by the
+ * format modifier, and the stride is the size of an uncompressed line of
+ * that width.
+ *
  * \return The number of bytes necessary to store a line, or 0 if the
  * PixelFormatInfo instance or the \a plane is not valid
  */
@@ -1002,6 +1121,11 @@ unsigned int PixelFormatInfo::stride(unsigned int width, unsigned int plane,
 		return 0;
 	}
 
+	/* AFBC buffers store whole superblocks. */
+	AfbcLayout afbc;
+	if (afbcLayout(format, &afbc))
+		width = utils::alignUp(width, afbc.widthAlignment);
+
 	/* ceil(width / pixelsPerGroup) * bytesPerGroup */
 	unsigned int stride = (width + pixelsPerGroup - 1) / pixelsPerGroup
 			    * planes[plane].bytesPerGroup;
@@ -1046,6 +1170,11 @@ unsigned int PixelFormatInfo::planeSize(const Size &size, unsigned int plane,
  * height, taking subsampling and other format characteristics into account.
  * Stride alignment constraints may be specified through the \a align parameter.
  *
+ * For Arm Framebuffer Compression (AFBC) formats, the plane size is the size
+ * of the superblock headers and of the uncompressed superblock payloads, which
+ * is the maximum size of a compressed frame. The \a stride shall then be
+ * computed by stride().
+ *
  * \return The number of bytes necessary to store the plane, or 0 if the
  * PixelFormatInfo instance is not valid or the plane number isn't valid for the
  * format
@@ -1057,6 +1186,27 @@ unsigned int PixelFormatInfo::planeSize(unsigned int height, unsigned int plane,
 	if (!vertSubSample)
 		return 0;
 
+	/*
+	 * AFBC buffers store a header for each superblock, followed by the
+	 * superblocks payload. The sparse layout reserves the size of an
+	 * uncompressed superblock for each of them, which is also the worst
+	 * case for the other layouts.
+	 */
+	AfbcLayout afbc;
+	if (afbcLayout(format, &afbc)) {
+		unsigned int width = stride / planes[plane].bytesPerGroup
+				   * pixelsPerGroup;
+		height = utils::alignUp(height, afbc.heightAlignment);
+
+		unsigned int blockPixels = afbc.blockWidth * afbc.blockHeight;
+		unsigned int blocks = width * height / blockPixels;
+		unsigned int blockSize = utils::alignUp(bitsPerPixel * blockPixels / 8,
+							kAfbcSuperblockAlignment);
+
+		return utils::alignUp(blocks * kAfbcHeaderSize, afbc.headerAlignment)
+		       + blocks * blockSize;
+	}
+
 	/* stride * ceil(height / verticalSubSampling) */
 	return stride * ((height + vertSubSample - 1) / vertSubSample);
 }
@@ -1106,15 +1256,9 @@ unsigned int
 PixelFormatInfo::frameSize(const Size &size,
 			   const std::array<unsigned int, 3> &strides) const
 {
-	/* stride * ceil(height / verticalSubSampling) */
 	unsigned int sum = 0;
-	for (unsigned int i = 0; i < 3; i++) {
-		unsigned int vertSubSample = planes[i].verticalSubSampling;
-		if (!vertSubSample)
-			continue;
-		sum += strides[i]
-		     * ((size.height + vertSubSample - 1) / vertSubSample);
-	}
+	for (unsigned int i = 0; i < 3; i++)
+		sum += planeSize(size.height, i, strides[i]);
 
 	return sum;
 }
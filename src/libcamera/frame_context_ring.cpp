@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * frame_context_ring.cpp - Fixed-capacity per-frame context storage
+ */
+
+#include "libcamera/internal/frame_context_ring.h"
+
+/**
+ * \file frame_context_ring.h
+ * \brief Fixed-capacity storage for per-frame contexts
+ */
+
+namespace libcamera {
+
+/**
+ * \class FrameContextRing
+ * \brief Store per-frame contexts indexed by frame number
+ * \tparam T The context type
+ *
+ * Pipeline handlers need to track information for every frame in flight, from
+ * the time a request is queued to the hardware until it completes. The
+ * FrameContextRing stores those per-frame contexts in a fixed number of slots
+ * allocated when the ring is reset, and indexes them by frame number modulo
+ * the capacity. Allocating, looking up and releasing a context are constant
+ * time operations, and none of them allocates memory.
+ *
+ * The capacity should be set to the maximum number of frames in flight, which
+ * is typically bounded by the number of internal buffers used by the pipeline
+ * handler. As frames may complete out of order, a slot may still be in use by
+ * an older frame when a new frame needs it. The alloc() function fails in that
+ * case, and callers shall defer processing of the new frame until the slot
+ * gets released, as they would in case of internal buffers underrun.
+ *
+ * Contexts are not reinitialized when allocated, in order to allow reusing
+ * memory allocated by previous frames. Callers shall initialize all the
+ * context fields they use.
+ */
+
+/**
+ * \fn FrameContextRing::FrameContextRing()
+ * \brief Construct a FrameContextRing with a given \a capacity
+ * \param[in] capacity The number of slots
+ */
+
+/**
+ * \fn FrameContextRing::reset()
+ * \brief Reset the ring to contain \a capacity free slots
+ * \param[in] capacity The number of slots
+ *
+ * All contexts are destroyed and new default-constructed contexts are created.
+ */
+
+/**
+ * \fn FrameContextRing::clear()
+ * \brief Release all contexts
+ *
+ * The capacity is preserved and the contexts are not destroyed.
+ */
+
+/**
+ * \fn FrameContextRing::capacity()
+ * \brief Retrieve the number of slots in the ring
+ * \return The number of slots in the ring
+ */
+
+/**
+ * \fn FrameContextRing::alloc()
+ * \brief Allocate the context for \a frame
+ * \param[in] frame The frame number
+ * \return A pointer to the context, or nullptr if the slot for \a frame is in
+ * use by another frame
+ */
+
+/**
+ * \fn FrameContextRing::release()
+ * \brief Release the context for \a frame
+ * \param[in] frame The frame number
+ *
+ * Releasing a frame that has no allocated context is a no-op.
+ */
+
+/**
+ * \fn FrameContextRing::get()
+ * \brief Retrieve the context for \a frame
+ * \param[in] frame The frame number
+ * \return A pointer to the context, or nullptr if no context is allocated for
+ * \a frame
+ */
+
+} /* namespace libcamera */
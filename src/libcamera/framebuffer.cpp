@@ -90,6 +90,26 @@ LOG_DEFINE_CATEGORY(Buffer)
  * \todo Be more precise on what timestamps refer to.
  */
 
+/**
+ * \var FrameMetadata::discarded
+ * \brief Number of frames discarded before this frame
+ *
+ * When the camera completion queue is limited with
+ * Camera::setCompletionQueueDepth(), the oldest completed requests are
+ * recycled instead of being delivered to the application. This field counts
+ * the frames of the same stream that have been discarded that way since the
+ * previous frame delivered for the stream. It is zero otherwise.
+ */
+
+/**
+ * \var FrameMetadata::kMaxPlanes
+ * \brief The maximum number of planes of a frame buffer
+ *
+ * The per-plane metadata is stored inline, avoiding memory allocations when
+ * frame buffers are created. This bounds the number of planes a FrameBuffer
+ * can have.
+ */
+
 /**
  * \fn FrameMetadata::planes()
  * \copydoc FrameMetadata::planes() const
@@ -137,6 +157,39 @@ FrameBuffer::Private::Private()
  * \return True if the planes are stored contiguously in memory, false otherwise
  */
 
+/**
+ * \fn FrameBuffer::Private::fence()
+ * \brief Retrieve a pointer to the Fence
+ *
+ * Retrieve a pointer to the Fence associated with the FrameBuffer. The fence
+ * is owned by the FrameBuffer and the returned pointer is valid until the
+ * fence is reset with setFence() or released with FrameBuffer::releaseFence().
+ *
+ * \return A pointer to the Fence if any, nullptr otherwise
+ */
+
+/**
+ * \fn FrameBuffer::Private::setFence()
+ * \brief Move a \a fence in this buffer
+ * \param[in] fence The Fence
+ *
+ * This function associates a Fence with this FrameBuffer. The intended caller
+ * is the Request::addBuffer() function. The core library resets the fence
+ * once it has been signalled.
+ */
+
+/**
+ * \fn FrameBuffer::Private::metadata()
+ * \brief Retrieve the dynamic metadata of the buffer for modification
+ *
+ * Buffers filled by V4L2 devices have their metadata updated by the
+ * V4L2VideoDevice class. This function allows pipeline handlers that fill
+ * buffers by other means, such as with a CPU, to report the metadata of the
+ * frame they have produced.
+ *
+ * \return The dynamic metadata of the buffer
+ */
+
 /**
  * \class FrameBuffer
  * \brief Frame buffer data and its associated dynamic metadata
@@ -211,12 +264,18 @@ FrameBuffer::Private::Private()
  * \brief Construct a FrameBuffer with an array of planes
  * \param[in] planes The frame memory planes
  * \param[in] cookie Cookie
+ *
+ * The number of \a planes shall not exceed FrameMetadata::kMaxPlanes. Callers
+ * that don't need \a planes after constructing the frame buffer should move it
+ * in, to avoid copying the vector.
  */
-FrameBuffer::FrameBuffer(const std::vector<Plane> &planes, unsigned int cookie)
-	: Extensible(std::make_unique<Private>()), planes_(planes),
+FrameBuffer::FrameBuffer(std::vector<Plane> planes, unsigned int cookie)
+	: Extensible(std::make_unique<Private>()), planes_(std::move(planes)),
 	  cookie_(cookie)
 {
-	metadata_.planes_.resize(planes_.size());
+	ASSERT(planes_.size() <= FrameMetadata::kMaxPlanes);
+
+	metadata_.numPlanes_ = planes_.size();
 
 	unsigned int offset = 0;
 	bool isContiguous = true;
@@ -305,6 +364,26 @@ Request *FrameBuffer::request() const
  * libcamera core never modifies the buffer cookie.
  */
 
+/**
+ * \brief Extract the Fence associated with this FrameBuffer
+ *
+ * This function moves the buffer's fence ownership to the caller. After the
+ * fence has been released, calling this function always return nullptr.
+ *
+ * If buffer with a Fence completes with errors due to a failure in handling
+ * the fence, applications are responsible for releasing the Fence before
+ * calling Request::addBuffer() again.
+ *
+ * \sa Request::addBuffer()
+ *
+ * \return A unique pointer to the Fence if set, or nullptr if the fence has
+ * been released already
+ */
+std::unique_ptr<Fence> FrameBuffer::releaseFence()
+{
+	return std::move(_d()->fence_);
+}
+
 /**
  * \fn FrameBuffer::cancel()
  * \brief Marks the buffer as cancelled
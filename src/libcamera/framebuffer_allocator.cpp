@@ -8,6 +8,7 @@
 #include <libcamera/framebuffer_allocator.h>
 
 #include <errno.h>
+#include <string>
 
 #include <libcamera/base/log.h>
 
@@ -15,6 +16,8 @@
 #include <libcamera/framebuffer.h>
 #include <libcamera/stream.h>
 
+#include "libcamera/internal/camera.h"
+#include "libcamera/internal/dma_heaps.h"
 #include "libcamera/internal/pipeline_handler.h"
 
 /**
@@ -52,6 +55,23 @@ LOG_DEFINE_CATEGORY(Allocator)
  *
  * Usage of the FrameBufferAllocator is optional, if all buffers for a camera
  * are provided externally applications shall not use this class.
+ *
+ * By default buffers are exported by the pipeline handler from the video
+ * device that captures the stream. Applications that need buffers with
+ * specific memory properties, or more buffers than the video device supports,
+ * can instead allocate them directly from a dma-heap, see
+ * allocate(Stream *, Heap, unsigned int).
+ */
+
+/**
+ * \enum FrameBufferAllocator::Heap
+ * \brief The dma-heap to allocate buffers from
+ * \var FrameBufferAllocator::Cma
+ * \brief Allocate physically contiguous memory from the CMA heap, for devices
+ * without an IOMMU
+ * \var FrameBufferAllocator::System
+ * \brief Allocate memory from the system heap, which is CPU cached and not
+ * physically contiguous
  */
 
 /**
@@ -65,6 +85,9 @@ FrameBufferAllocator::FrameBufferAllocator(std::shared_ptr<Camera> camera)
 
 FrameBufferAllocator::~FrameBufferAllocator()
 {
+	for (const auto &[stream, buffers] : buffers_)
+		camera_->_d()->clearBufferPool("application", stream);
+
 	buffers_.clear();
 }
 
@@ -98,9 +121,89 @@ int FrameBufferAllocator::allocate(Stream *stream)
 		LOG(Allocator, Error)
 			<< "Stream is not part of " << camera_->id()
 			<< " active configuration";
+	if (ret < 0)
+		return ret;
+
+	camera_->_d()->setBufferPool("application", stream, buffers_[stream]);
+
 	return ret;
 }
 
+/**
+ * \brief Allocate buffers for a configured stream from a dma-heap
+ * \param[in] stream The stream to allocate buffers for
+ * \param[in] heap The dma-heap to allocate from
+ * \param[in] count The number of buffers to allocate
+ *
+ * Allocate \a count buffers suitable for capturing frames from the \a stream
+ * directly from a dma-heap, bypassing the pipeline handler. If \a count is 0,
+ * the number of buffers specified in the stream configuration is allocated.
+ * The Camera shall have been previously configured with Camera::configure()
+ * and shall be stopped, and the stream shall be part of the active camera
+ * configuration.
+ *
+ * The planes of each buffer are laid out contiguously in a single dma-buf,
+ * according to the pixel format, stride, frame size and buffer layout
+ * constraints of the stream configuration. dma-heap buffers are page-aligned.
+ *
+ * Buffers allocated from a dma-heap are not retained for reuse when they are
+ * freed, as applications may have shared their file descriptors.
+ *
+ * \return The number of allocated buffers on success or a negative error code
+ * otherwise
+ * \retval -EACCES The camera is not in a state where buffers can be allocated
+ * \retval -EINVAL The \a stream does not belong to the camera or the stream is
+ * not part of the active camera configuration
+ * \retval -EBUSY Buffers are already allocated for the \a stream
+ * \retval -ENODEV The dma-heap is not available
+ * \retval -ENOMEM The buffers can't be allocated
+ */
+int FrameBufferAllocator::allocate(Stream *stream, Heap heap, unsigned int count)
+{
+	if (buffers_.count(stream)) {
+		LOG(Allocator, Error) << "Buffers already allocated for stream";
+		return -EBUSY;
+	}
+
+	int ret = camera_->_d()->validateBufferAllocation(stream);
+	if (ret == -EINVAL)
+		LOG(Allocator, Error)
+			<< "Stream is not part of " << camera_->id()
+			<< " active configuration";
+	if (ret < 0)
+		return ret;
+
+	const StreamConfiguration &cfg = stream->configuration();
+
+	std::shared_ptr<DmaHeap> dmaHeap =
+		DmaHeap::instance(heap == Heap::Cma ? DmaHeap::DmaHeapFlag::Cma
+						    : DmaHeap::DmaHeapFlag::System);
+	if (!dmaHeap->isValid())
+		return -ENODEV;
+
+	if (!count)
+		count = cfg.bufferCount;
+
+	std::vector<std::unique_ptr<FrameBuffer>> buffers;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		std::string name = camera_->id() + "-" + cfg.toString() + "-"
+				 + std::to_string(i);
+		std::unique_ptr<FrameBuffer> buffer =
+			dmaHeap->allocFrameBuffer(name.c_str(), cfg);
+		if (!buffer)
+			return -ENOMEM;
+
+		buffers.push_back(std::move(buffer));
+	}
+
+	buffers_[stream] = std::move(buffers);
+
+	camera_->_d()->setBufferPool("application", stream, buffers_[stream]);
+
+	return count;
+}
+
 /**
  * \brief Free buffers previously allocated for a \a stream
  * \param[in] stream The stream
@@ -123,6 +226,8 @@ int FrameBufferAllocator::free(Stream *stream)
 	buffers.clear();
 	buffers_.erase(iter);
 
+	camera_->_d()->clearBufferPool("application", stream);
+
 	return 0;
 }
 
@@ -59,14 +59,27 @@
  * Entries are described by the ipa_control_value_entry structure. They contain
  * the numerical ID of the control, its type, and the number of control values.
  *
- * The control values are stored in the data section in the platform's native
- * format. The ipa_control_value_entry::offset field stores the offset from the
- * beginning of the data section to the values.
+ * The control values are stored in the platform's native format. Values of
+ * scalar controls that fit in 8 bytes are stored directly in the
+ * ipa_control_value_entry::value field. Other values are stored in the data
+ * section, and the ipa_control_value_entry::offset field stores the offset from
+ * the beginning of the data section to the values.
  *
  * All control values in the data section shall be stored in the same order as
  * the respective control entries, shall be aligned to a multiple of 8 bytes,
  * and shall be contiguous in memory.
  *
+ * Entries are stored in increasing control ID order. A ControlList packet
+ * either contains all the controls of the list, or only the differences with a
+ * previous packet of the same stream, called the base packet. Packets are
+ * numbered with a per-stream sequence number in ipa_controls_header::sequence,
+ * and delta packets reference their base packet through its sequence number in
+ * ipa_controls_header::base. Streams are identified by the ControlInfoMap
+ * handle, or by the id map type for lists without a ControlInfoMap. The
+ * entries of a delta packet store the controls added or modified compared to
+ * the base packet, as well as the controls removed from the base packet, which
+ * are stored with the ControlTypeNone type and no value.
+ *
  * Empty spaces may be present between the end of the entries array and the
  * data section, and after the data section. They shall be ignored when parsing
  * the packet.
@@ -180,8 +193,13 @@
  * Offset in bytes from the beginning of the packet of the data section start
  * \var ipa_controls_header::id_map_type
  * The id map type as defined by the ipa_controls_id_map_type enumeration
- * \var ipa_controls_header::reserved
- * Reserved for future extensions
+ * \var ipa_controls_header::sequence
+ * For ControlList packets, the non-zero sequence number of the packet in its
+ * stream. Shall be set to 0 for ControlInfoMap packets.
+ * \var ipa_controls_header::base
+ * For ControlList delta packets, the sequence number of the base packet. Shall
+ * be set to 0 for packets that contain the full ControlList, and for
+ * ControlInfoMap packets.
  */
 
 static_assert(sizeof(ipa_controls_header) == 32,
@@ -200,9 +218,11 @@ static_assert(sizeof(ipa_controls_header) == 32,
  * The number of control array entries for array controls (1 otherwise)
  * \var ipa_control_value_entry::offset
  * The offset in bytes from the beginning of the data section to the control
- * value data (shall be a multiple of 8 bytes).
- * \var ipa_control_value_entry::padding
- * Padding bytes (shall be set to 0)
+ * value data (shall be a multiple of 8 bytes), for values stored in the data
+ * section
+ * \var ipa_control_value_entry::value
+ * The control value data, for scalar values of up to 8 bytes (unused bytes
+ * shall be set to 0)
  */
 
 static_assert(sizeof(ipa_control_value_entry) == 16,
@@ -314,8 +314,10 @@ IPADataSerializer<ControlList>::serialize(const ControlList &data, ControlSerial
 		LOG(IPADataSerializer, Fatal)
 			<< "ControlSerializer not provided for serialization of ControlList";
 
-	size_t size;
-	std::vector<uint8_t> infoData;
+	std::vector<uint8_t> dataVec;
+	ByteStreamBuffer buffer(dataVec);
+	ByteStreamBuffer sizes = buffer.carveOut(8);
+	uint32_t infoDataSize = 0;
 	int ret;
 
 	/*
@@ -323,20 +325,16 @@ IPADataSerializer<ControlList>::serialize(const ControlList &data, ControlSerial
 	 * ControlInfoMap, as it could be fragile
 	 */
 	if (data.infoMap() && !cs->isCached(*data.infoMap())) {
-		size = cs->binarySize(*data.infoMap());
-		infoData.resize(size);
-		ByteStreamBuffer buffer(infoData.data(), infoData.size());
 		ret = cs->serialize(*data.infoMap(), buffer);
 
 		if (ret < 0 || buffer.overflow()) {
 			LOG(IPADataSerializer, Error) << "Failed to serialize ControlList's ControlInfoMap";
 			return { {}, {} };
 		}
+
+		infoDataSize = buffer.offset() - sizes.size();
 	}
 
-	size = cs->binarySize(data);
-	std::vector<uint8_t> listData(size);
-	ByteStreamBuffer buffer(listData.data(), listData.size());
 	ret = cs->serialize(data, buffer);
 
 	if (ret < 0 || buffer.overflow()) {
@@ -344,12 +342,9 @@ IPADataSerializer<ControlList>::serialize(const ControlList &data, ControlSerial
 		return { {}, {} };
 	}
 
-	std::vector<uint8_t> dataVec;
-	dataVec.reserve(8 + infoData.size() + listData.size());
-	appendPOD<uint32_t>(dataVec, infoData.size());
-	appendPOD<uint32_t>(dataVec, listData.size());
-	dataVec.insert(dataVec.end(), infoData.begin(), infoData.end());
-	dataVec.insert(dataVec.end(), listData.begin(), listData.end());
+	uint32_t listDataSize = buffer.offset() - sizes.size() - infoDataSize;
+	sizes.write(&infoDataSize);
+	sizes.write(&listDataSize);
 
 	return { dataVec, {} };
 }
@@ -439,9 +434,9 @@ IPADataSerializer<ControlInfoMap>::serialize(const ControlInfoMap &map,
 		LOG(IPADataSerializer, Fatal)
 			<< "ControlSerializer not provided for serialization of ControlInfoMap";
 
-	size_t size = cs->binarySize(map);
-	std::vector<uint8_t> infoData(size);
-	ByteStreamBuffer buffer(infoData.data(), infoData.size());
+	std::vector<uint8_t> dataVec;
+	ByteStreamBuffer buffer(dataVec);
+	ByteStreamBuffer sizes = buffer.carveOut(4);
 	int ret = cs->serialize(map, buffer);
 
 	if (ret < 0 || buffer.overflow()) {
@@ -449,9 +444,8 @@ IPADataSerializer<ControlInfoMap>::serialize(const ControlInfoMap &map,
 		return { {}, {} };
 	}
 
-	std::vector<uint8_t> dataVec;
-	appendPOD<uint32_t>(dataVec, infoData.size());
-	dataVec.insert(dataVec.end(), infoData.begin(), infoData.end());
+	uint32_t infoDataSize = buffer.offset() - sizes.size();
+	sizes.write(&infoDataSize);
 
 	return { dataVec, {} };
 }
@@ -9,10 +9,18 @@
 
 #include <algorithm>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <libcamera/base/file.h>
+#include <libcamera/base/global_configuration.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/utils.h>
 
@@ -112,7 +120,7 @@ IPAManager::IPAManager()
 	unsigned int ipaCount = 0;
 
 	/* User-specified paths take precedence. */
-	const char *modulePaths = utils::secure_getenv("LIBCAMERA_IPA_MODULE_PATH");
+	const char *modulePaths = GlobalConfiguration::option("LIBCAMERA_IPA_MODULE_PATH");
 	if (modulePaths) {
 		for (const auto &dir : utils::split(modulePaths, ":")) {
 			if (dir.empty())
@@ -154,6 +162,10 @@ IPAManager::IPAManager()
 
 IPAManager::~IPAManager()
 {
+	/* Wait for the prefetches still in progress to use the modules. */
+	for (auto &[module, prefetch] : prefetches_)
+		prefetch.wait();
+
 	for (IPAModule *module : modules_)
 		delete module;
 
@@ -274,10 +286,78 @@ IPAModule *IPAManager::module(PipelineHandler *pipe, uint32_t minVersion,
  * found or if the IPA proxy fails to initialize
  */
 
+/**
+ * \brief Prepare the creation of an IPA proxy for a pipeline handler
+ * \param[in] pipe The pipeline handler that will create the IPA proxy
+ * \param[in] minVersion Minimum acceptable version of IPA module
+ * \param[in] maxVersion Maximum acceptable version of IPA module
+ *
+ * Creating an IPA proxy requires verifying the signature of the IPA module,
+ * which hashes the whole module, and loading the module when it runs in the
+ * libcamera process. This function starts those operations in the background
+ * for the IPA module matching \a pipe, to overlap them with the rest of the
+ * pipeline handler initialization, such as media graph setup and sensor
+ * probing. A subsequent call to createIPA() with the same parameters waits for
+ * their completion.
+ *
+ * Pipeline handlers should call this function as soon as they have matched
+ * the devices they support. Calling it multiple times for the same module has
+ * no effect.
+ */
+void IPAManager::prefetch(PipelineHandler *pipe, uint32_t minVersion,
+			  uint32_t maxVersion)
+{
+	IPAModule *m = self_->module(pipe, minVersion, maxVersion);
+	if (!m)
+		return;
+
+	MutexLocker locker(self_->prefetchLock_);
+
+	if (self_->prefetches_.count(m))
+		return;
+
+	self_->prefetches_[m] = std::async(std::launch::async, [m]() {
+		bool valid = self_->isSignatureValid(m);
+
+		/* Only modules with a valid signature are loaded in-process. */
+		if (valid)
+			m->load();
+
+		return valid;
+	}).share();
+}
+
+/**
+ * \brief Check if an IPA module signature is valid
+ * \param[in] ipa The IPA module
+ *
+ * Wait for the completion of the prefetch of \a ipa if one has been started by
+ * prefetch(), or verify the signature synchronously otherwise.
+ *
+ * \return True if the IPA module signature is valid, false otherwise
+ */
+bool IPAManager::checkSignature(IPAModule *ipa)
+{
+	std::shared_future<bool> prefetch;
+
+	{
+		MutexLocker locker(prefetchLock_);
+
+		auto it = prefetches_.find(ipa);
+		if (it != prefetches_.end())
+			prefetch = it->second;
+	}
+
+	if (prefetch.valid())
+		return prefetch.get();
+
+	return isSignatureValid(ipa);
+}
+
 bool IPAManager::isSignatureValid([[maybe_unused]] IPAModule *ipa) const
 {
 #if HAVE_IPA_PUBKEY
-	char *force = utils::secure_getenv("LIBCAMERA_IPA_FORCE_ISOLATION");
+	const char *force = GlobalConfiguration::option("LIBCAMERA_IPA_FORCE_ISOLATION");
 	if (force && force[0] != '\0') {
 		LOG(IPAManager, Debug)
 			<< "Isolation of IPA module " << ipa->path()
@@ -285,11 +365,28 @@ bool IPAManager::isSignatureValid([[maybe_unused]] IPAModule *ipa) const
 		return false;
 	}
 
+	/* Signatures may be verified concurrently by prefetch(). */
+	MutexLocker locker(signatureLock_);
+
+	loadSignatureCache();
+
+	std::string key = signatureCacheKey(ipa);
+	if (!key.empty()) {
+		auto it = signatureCache_.find(key);
+		if (it != signatureCache_.end()) {
+			LOG(IPAManager, Debug)
+				<< "IPA module " << ipa->path() << " signature is "
+				<< (it->second ? "valid" : "not valid") << " (cached)";
+			return it->second;
+		}
+	}
+
 	File file{ ipa->path() };
 	if (!file.open(File::OpenModeFlag::ReadOnly))
 		return false;
 
-	Span<uint8_t> data = file.map();
+	Span<uint8_t> data = file.map(0, -1, File::MapFlag::Sequential |
+					     File::MapFlag::WillNeed);
 	if (data.empty())
 		return false;
 
@@ -299,10 +396,175 @@ bool IPAManager::isSignatureValid([[maybe_unused]] IPAModule *ipa) const
 		<< "IPA module " << ipa->path() << " signature is "
 		<< (valid ? "valid" : "not valid");
 
+	if (!key.empty())
+		storeSignatureCache(key, valid);
+
 	return valid;
 #else
 	return false;
 #endif
 }
 
+#if HAVE_IPA_PUBKEY
+namespace {
+
+uint64_t fnv1a(const uint8_t *data, size_t size,
+	       uint64_t hash = 0xcbf29ce484222325ULL)
+{
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+int64_t timespecToNs(const struct timespec &ts)
+{
+	return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+} /* namespace */
+
+/**
+ * \brief Compute the key identifying an IPA module in the signature cache
+ * \param[in] ipa The IPA module
+ *
+ * The key identifies the module file by its device, inode, size, modification
+ * and status change times. The status change time can't be set from userspace,
+ * any modification of the file, including restoring its modification time,
+ * thus invalidates the key. The key also covers the module signature and the
+ * public key it is verified against.
+ *
+ * \return The cache key, or an empty string if the module file can't be
+ * accessed
+ */
+std::string IPAManager::signatureCacheKey(IPAModule *ipa) const
+{
+	struct stat st;
+	if (stat(ipa->path().c_str(), &st))
+		return {};
+
+	const std::vector<uint8_t> signature = ipa->signature();
+	uint64_t hash = fnv1a(signature.data(), signature.size());
+	hash = fnv1a(publicKeyData_, publicKeySize_, hash);
+
+	std::stringstream ss;
+	ss << st.st_dev << " " << st.st_ino << " " << st.st_size << " "
+	   << timespecToNs(st.st_mtim) << " " << timespecToNs(st.st_ctim) << " "
+	   << std::hex << std::setw(16) << std::setfill('0') << hash << " "
+	   << ipa->path();
+	return ss.str();
+}
+
+/**
+ * \brief Load the persistent IPA module signature cache
+ *
+ * Verifying the signature of an IPA module requires hashing the whole module,
+ * which is costly for short-lived processes. The verification results are
+ * thus stored in a cache file, located by the LIBCAMERA_IPA_SIGNATURE_CACHE
+ * environment variable, or in the user's cache directory. The cache is only
+ * trusted if it belongs to the current user and is only writable by them.
+ *
+ * The cache is loaded on the first signature verification only.
+ */
+void IPAManager::loadSignatureCache() const
+{
+	if (signatureCacheLoaded_)
+		return;
+
+	signatureCacheLoaded_ = true;
+
+	const char *path = GlobalConfiguration::option("LIBCAMERA_IPA_SIGNATURE_CACHE");
+	if (path) {
+		signatureCachePath_ = path;
+	} else {
+		const char *cacheDir = utils::secure_getenv("XDG_CACHE_HOME");
+		const char *home = utils::secure_getenv("HOME");
+		if (cacheDir && cacheDir[0] != '\0')
+			signatureCachePath_ = std::string(cacheDir) + "/libcamera";
+		else if (home && home[0] != '\0')
+			signatureCachePath_ = std::string(home) + "/.cache/libcamera";
+		else
+			return;
+
+		signatureCachePath_ += "/ipa-signatures";
+	}
+
+	if (signatureCachePath_.empty())
+		return;
+
+	int fd = open(signatureCachePath_.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_uid != geteuid() ||
+	    (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		LOG(IPAManager, Warning)
+			<< "Ignoring untrusted signature cache "
+			<< signatureCachePath_;
+		signatureCachePath_.clear();
+		::close(fd);
+		return;
+	}
+
+	std::string contents(st.st_size, '\0');
+	ssize_t ret = read(fd, contents.data(), contents.size());
+	::close(fd);
+	if (ret != st.st_size)
+		return;
+
+	for (const auto &line : utils::split(contents, "\n")) {
+		if (line.size() < 2 || line[1] != ' ' ||
+		    (line[0] != '0' && line[0] != '1'))
+			continue;
+
+		/* Later entries take precedence. */
+		signatureCache_[line.substr(2)] = line[0] == '1';
+	}
+
+	LOG(IPAManager, Debug)
+		<< "Loaded " << signatureCache_.size()
+		<< " entries from signature cache " << signatureCachePath_;
+}
+
+/**
+ * \brief Store an IPA module signature verification result in the cache
+ * \param[in] key The IPA module key
+ * \param[in] valid The verification result
+ *
+ * The entry is appended to the cache file with a single write, so that
+ * concurrent processes can't interleave their entries.
+ */
+void IPAManager::storeSignatureCache(const std::string &key, bool valid) const
+{
+	signatureCache_[key] = valid;
+
+	if (signatureCachePath_.empty())
+		return;
+
+	/* Create the parent directories, private to the user. */
+	for (size_t pos = signatureCachePath_.find('/', 1);
+	     pos != std::string::npos;
+	     pos = signatureCachePath_.find('/', pos + 1)) {
+		std::string dir = signatureCachePath_.substr(0, pos);
+		if (mkdir(dir.c_str(), 0700) && errno != EEXIST)
+			return;
+	}
+
+	int fd = open(signatureCachePath_.c_str(),
+		      O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return;
+
+	std::string line = (valid ? "1 " : "0 ") + key + "\n";
+	if (write(fd, line.data(), line.size()) != static_cast<ssize_t>(line.size()))
+		LOG(IPAManager, Debug)
+			<< "Failed to update signature cache "
+			<< signatureCachePath_;
+
+	::close(fd);
+}
+#endif /* HAVE_IPA_PUBKEY */
+
 } /* namespace libcamera */
@@ -12,6 +12,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <libcamera/base/global_configuration.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/utils.h>
 
@@ -51,7 +52,12 @@ LOG_DEFINE_CATEGORY(IPAProxy)
  * \param[in] ipam The IPA module
  */
 IPAProxy::IPAProxy(IPAModule *ipam)
-	: valid_(false), state_(ProxyStopped), ipam_(ipam)
+	: valid_(false), state_(ProxyStopped),
+	  callDuration_("libcamera_ipa_call_duration_us",
+			"Duration of the calls from the pipeline handler to the IPA, in microseconds",
+			Metric::label("ipa", ipam->info().name),
+			MetricHistogram::exponentialBounds(10, 2, 14)),
+	  ipam_(ipam)
 {
 }
 
@@ -104,7 +110,7 @@ std::string IPAProxy::configurationFile(const std::string &name) const
 	std::string ipaName = ipam_->info().name;
 
 	/* Check the environment variable first. */
-	const char *confPaths = utils::secure_getenv("LIBCAMERA_IPA_CONFIG_PATH");
+	const char *confPaths = GlobalConfiguration::option("LIBCAMERA_IPA_CONFIG_PATH");
 	if (confPaths) {
 		for (const auto &dir : utils::split(confPaths, ":")) {
 			if (dir.empty())
@@ -172,7 +178,7 @@ std::string IPAProxy::resolvePath(const std::string &file) const
 	std::string proxyFile = "/" + file;
 
 	/* Check env variable first. */
-	const char *execPaths = utils::secure_getenv("LIBCAMERA_IPA_PROXY_PATH");
+	const char *execPaths = GlobalConfiguration::option("LIBCAMERA_IPA_PROXY_PATH");
 	if (execPaths) {
 		for (const auto &dir : utils::split(execPaths, ":")) {
 			if (dir.empty())
@@ -238,4 +244,12 @@ std::string IPAProxy::resolvePath(const std::string &file) const
  * while still enabling events to complete when the IPAProxy is stopping.
  */
 
+/**
+ * \var IPAProxy::callDuration_
+ * \brief Histogram of the duration of the calls to the IPA
+ *
+ * The generated proxies record the duration of every call to the IPA
+ * interface functions, including the IPC round trip for isolated IPAs.
+ */
+
 } /* namespace libcamera */
@@ -0,0 +1,216 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_proxy_worker_pool.cpp - Pool of pre-started IPA proxy worker processes
+ */
+
+#include "libcamera/internal/ipa_proxy_worker_pool.h"
+
+#include <stdlib.h>
+#include <vector>
+
+#include <libcamera/base/global_configuration.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+#include "libcamera/internal/ipc_unixsocket.h"
+#include "libcamera/internal/process.h"
+
+/**
+ * \file ipa_proxy_worker_pool.h
+ * \brief Pool of pre-started IPA proxy worker processes
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(IPCPipe)
+
+/**
+ * \class IPAProxyWorkerPool
+ * \brief Keep spare IPA proxy worker processes ready for isolated IPAs
+ *
+ * Starting the proxy worker of an isolated IPA module involves forking and
+ * executing the worker, which then loads the IPA module before it can process
+ * messages. The IPAProxyWorkerPool hides that latency by keeping spare workers,
+ * started in advance, for the IPA modules that have been isolated before.
+ *
+ * The first worker for a given IPA module and proxy worker executable is
+ * started on demand. When a worker is acquired, the pool starts new spare
+ * workers for the same module in the background, so that the next acquire()
+ * call for that module returns a worker that has already loaded the module.
+ * Spare workers are isolated in the same way as the on-demand workers, and are
+ * only ever handed out once.
+ *
+ * The number of spare workers kept for each module is set by the
+ * LIBCAMERA_IPA_PROXY_POOL_SIZE environment variable, and defaults to 0, which
+ * disables the pool.
+ *
+ * The IPAProxyWorkerPool is constructed by the CameraManager. Spare workers
+ * are bound to the thread that acquired the previous worker, and are only
+ * handed out to callers running in that thread, which is the pipeline handler
+ * thread.
+ */
+
+/**
+ * \struct IPAProxyWorkerPool::Worker
+ * \brief A started proxy worker and the socket to communicate with it
+ *
+ * Both members are null if the worker failed to start.
+ *
+ * \var IPAProxyWorkerPool::Worker::process
+ * \brief The worker process
+ *
+ * \var IPAProxyWorkerPool::Worker::socket
+ * \brief The IPC socket bound to the worker
+ */
+
+IPAProxyWorkerPool *IPAProxyWorkerPool::self_ = nullptr;
+
+/**
+ * \brief Construct an IPAProxyWorkerPool instance
+ *
+ * The IPAProxyWorkerPool class is meant to only be instantiated once, by the
+ * CameraManager.
+ */
+IPAProxyWorkerPool::IPAProxyWorkerPool()
+	: size_(0)
+{
+	if (self_)
+		LOG(IPCPipe, Fatal)
+			<< "Multiple IPAProxyWorkerPool objects are not allowed";
+
+	const char *size = GlobalConfiguration::option("LIBCAMERA_IPA_PROXY_POOL_SIZE");
+	if (size) {
+		char *end;
+		unsigned long value = strtoul(size, &end, 10);
+		if (*size && !*end)
+			size_ = value;
+		else
+			LOG(IPCPipe, Warning)
+				<< "Invalid proxy worker pool size '" << size << "'";
+	}
+
+	self_ = this;
+}
+
+IPAProxyWorkerPool::~IPAProxyWorkerPool()
+{
+	clear();
+
+	self_ = nullptr;
+}
+
+/**
+ * \brief Retrieve the proxy worker pool instance
+ * \return The proxy worker pool instance, or nullptr if no CameraManager exists
+ */
+IPAProxyWorkerPool *IPAProxyWorkerPool::instance()
+{
+	return self_;
+}
+
+/**
+ * \brief Start a proxy worker process, bypassing the pool
+ * \param[in] modulePath The path to the IPA module
+ * \param[in] workerPath The path to the proxy worker executable
+ *
+ * Create an IPC socket and start the proxy worker at \a workerPath for the IPA
+ * module at \a modulePath, passing it the remote side of the socket.
+ *
+ * \return The started worker, or a worker with null members on failure
+ */
+IPAProxyWorkerPool::Worker IPAProxyWorkerPool::start(const std::string &modulePath,
+						     const std::string &workerPath)
+{
+	Worker worker;
+
+	std::unique_ptr<IPCUnixSocket> socket = std::make_unique<IPCUnixSocket>();
+	int fd = socket->create();
+	if (fd < 0) {
+		LOG(IPCPipe, Error) << "Failed to create socket";
+		return worker;
+	}
+
+	std::vector<std::string> args = { modulePath, std::to_string(fd) };
+	std::vector<int> fds = { fd };
+
+	std::unique_ptr<Process> process = std::make_unique<Process>();
+	int ret = process->start(workerPath, args, fds);
+	if (ret) {
+		LOG(IPCPipe, Error)
+			<< "Failed to start proxy worker process";
+		return worker;
+	}
+
+	worker.process = std::move(process);
+	worker.socket = std::move(socket);
+
+	return worker;
+}
+
+/**
+ * \brief Acquire a proxy worker process
+ * \param[in] modulePath The path to the IPA module
+ * \param[in] workerPath The path to the proxy worker executable
+ *
+ * Return a spare worker for the IPA module at \a modulePath if one is
+ * available, or start a new one otherwise, and replenish the spare workers for
+ * the module. The caller takes ownership of the returned worker.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return The acquired worker, or a worker with null members on failure
+ */
+IPAProxyWorkerPool::Worker IPAProxyWorkerPool::acquire(const std::string &modulePath,
+						       const std::string &workerPath)
+{
+	if (!size_)
+		return start(modulePath, workerPath);
+
+	MutexLocker locker(mutex_);
+
+	std::list<Worker> &spares =
+		spares_[{ Thread::current(), modulePath, workerPath }];
+	Worker worker;
+
+	/* Skip the spare workers that have died in the meantime. */
+	while (!spares.empty() && !worker.process) {
+		if (spares.front().process->exitStatus() == Process::NotExited)
+			worker = std::move(spares.front());
+		spares.pop_front();
+	}
+
+	if (worker.process)
+		LOG(IPCPipe, Debug) << "Using spare proxy worker for " << modulePath;
+	else
+		worker = start(modulePath, workerPath);
+
+	while (spares.size() < size_) {
+		Worker spare = start(modulePath, workerPath);
+		if (!spare.process)
+			break;
+
+		spares.push_back(std::move(spare));
+	}
+
+	return worker;
+}
+
+/**
+ * \brief Stop all the spare proxy worker processes
+ */
+void IPAProxyWorkerPool::clear()
+{
+	MutexLocker locker(mutex_);
+
+	spares_.clear();
+}
+
+/**
+ * \fn IPAProxyWorkerPool::size()
+ * \brief Retrieve the number of spare workers kept for each IPA module
+ * \return The number of spare workers, 0 if the pool is disabled
+ */
+
+} /* namespace libcamera */
@@ -0,0 +1,234 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_recorder.cpp - Recording of the calls to an IPA module
+ */
+
+#include "libcamera/internal/ipa_recorder.h"
+
+#include <errno.h>
+
+#include <libcamera/base/log.h>
+
+/**
+ * \file ipa_recorder.h
+ * \brief Recording of the calls to an IPA module
+ *
+ * Tuning and optimizing IPA algorithms on the target is slow and hard to
+ * reproduce, as the statistics depend on the scene in front of the camera.
+ * The IPARecorder lets a pipeline handler store the data it passes to its IPA
+ * module, including the content of the statistics buffers, in a file. The
+ * IPARecording reads the file back, to replay the exact same sequence of
+ * calls offline, for instance on a development machine or in continuous
+ * integration.
+ *
+ * A recording starts with a header made of the kMagic and kVersion 32-bit
+ * values. It is followed by a sequence of records, each made of a 32-bit
+ * RecordType, a 32-bit number of fields, and the fields themselves, each
+ * stored as a 32-bit size followed by the field data. All values are stored
+ * in the native byte order.
+ *
+ * The content of the fields is defined by the pipeline handler, usually as
+ * data serialized with the IPADataSerializer. File descriptors can't be
+ * recorded, buffers are described by their size and their content is
+ * recorded when the IPA module is expected to read it.
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPARecorder)
+
+/**
+ * \class IPARecorder
+ * \brief Write the calls to an IPA module to a file
+ */
+
+/**
+ * \enum IPARecorder::RecordType
+ * \brief The IPA module call recorded by a record
+ * \var IPARecorder::Init
+ * \brief The IPA module has been initialized
+ * \var IPARecorder::Configure
+ * \brief The IPA module has been configured
+ * \var IPARecorder::MapBuffers
+ * \brief Buffers have been mapped, with one BufferInfo field per buffer
+ * \var IPARecorder::UnmapBuffers
+ * \brief Buffers have been unmapped
+ * \var IPARecorder::Start
+ * \brief The IPA module has been started, with the start controls if any
+ * \var IPARecorder::Stop
+ * \brief The IPA module has been stopped
+ * \var IPARecorder::Event
+ * \brief An event has been sent to the IPA module
+ */
+
+/**
+ * \struct IPARecorder::BufferInfo
+ * \brief Description of a single-plane buffer shared with the IPA module
+ * \var IPARecorder::BufferInfo::id
+ * \brief The buffer ID
+ * \var IPARecorder::BufferInfo::length
+ * \brief The buffer length in bytes
+ */
+
+/**
+ * \var IPARecorder::kMagic
+ * \brief The value that starts a recording
+ */
+
+/**
+ * \var IPARecorder::kVersion
+ * \brief The version of the recording format
+ */
+
+/**
+ * \brief Create the recording file
+ * \param[in] path The path of the file
+ *
+ * The file is truncated if it exists.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPARecorder::open(const std::string &path)
+{
+	file_.open(path, std::ios::binary | std::ios::trunc);
+	if (!file_.is_open()) {
+		LOG(IPARecorder, Error) << "Failed to create " << path;
+		return -EIO;
+	}
+
+	file_.write(reinterpret_cast<const char *>(&kMagic), sizeof(kMagic));
+	file_.write(reinterpret_cast<const char *>(&kVersion), sizeof(kVersion));
+
+	LOG(IPARecorder, Info) << "Recording IPA calls to " << path;
+
+	return 0;
+}
+
+/**
+ * \fn IPARecorder::isOpen()
+ * \brief Check if the recording file is open
+ * \return True if the recording file is open, false otherwise
+ */
+
+/**
+ * \brief Close the recording file
+ */
+void IPARecorder::close()
+{
+	file_.close();
+}
+
+/**
+ * \brief Write a record
+ * \param[in] type The record type
+ * \param[in] fields The record fields
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPARecorder::write(RecordType type,
+		       const std::vector<std::vector<uint8_t>> &fields)
+{
+	if (!file_.is_open())
+		return -EBADF;
+
+	uint32_t count = fields.size();
+	file_.write(reinterpret_cast<const char *>(&type), sizeof(type));
+	file_.write(reinterpret_cast<const char *>(&count), sizeof(count));
+
+	for (const std::vector<uint8_t> &field : fields) {
+		uint32_t size = field.size();
+		file_.write(reinterpret_cast<const char *>(&size), sizeof(size));
+		file_.write(reinterpret_cast<const char *>(field.data()), size);
+	}
+
+	if (!file_) {
+		LOG(IPARecorder, Error) << "Failed to write record, stopping";
+		file_.close();
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/**
+ * \class IPARecording
+ * \brief Read the calls to an IPA module from a file written by IPARecorder
+ */
+
+/**
+ * \struct IPARecording::Record
+ * \brief A record read from a recording
+ * \var IPARecording::Record::type
+ * \brief The record type
+ * \var IPARecording::Record::fields
+ * \brief The record fields
+ */
+
+/**
+ * \brief Open a recording
+ * \param[in] path The path of the recording
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The file isn't a recording in a supported format
+ */
+int IPARecording::open(const std::string &path)
+{
+	file_.open(path, std::ios::binary);
+	if (!file_.is_open()) {
+		LOG(IPARecorder, Error) << "Failed to open " << path;
+		return -ENOENT;
+	}
+
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	file_.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+	file_.read(reinterpret_cast<char *>(&version), sizeof(version));
+
+	if (!file_ || magic != IPARecorder::kMagic ||
+	    version != IPARecorder::kVersion) {
+		LOG(IPARecorder, Error) << path << " is not a supported recording";
+		file_.close();
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Read the next record
+ * \param[out] record The record
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODATA The end of the recording has been reached
+ * \retval -EINVAL The record is truncated
+ */
+int IPARecording::read(Record *record)
+{
+	uint32_t type;
+	uint32_t count;
+
+	file_.read(reinterpret_cast<char *>(&type), sizeof(type));
+	if (file_.eof())
+		return -ENODATA;
+
+	file_.read(reinterpret_cast<char *>(&count), sizeof(count));
+
+	record->type = static_cast<IPARecorder::RecordType>(type);
+	record->fields.resize(count);
+
+	for (std::vector<uint8_t> &field : record->fields) {
+		uint32_t size = 0;
+		file_.read(reinterpret_cast<char *>(&size), sizeof(size));
+
+		field.resize(size);
+		file_.read(reinterpret_cast<char *>(field.data()), size);
+	}
+
+	if (!file_) {
+		LOG(IPARecorder, Error) << "Truncated record";
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+} /* namespace libcamera */
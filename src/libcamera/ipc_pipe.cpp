@@ -7,7 +7,12 @@
 
 #include "libcamera/internal/ipc_pipe.h"
 
+#include <algorithm>
+#include <array>
+#include <string.h>
+
 #include <libcamera/base/log.h>
+#include <libcamera/base/span.h>
 
 /**
  * \file ipc_pipe.h
@@ -18,6 +23,24 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(IPCPipe)
 
+namespace {
+
+/*
+ * The message header is stored at the end of the payload, after the message
+ * data, for the receiver to strip it by shrinking the payload instead of
+ * moving the data.
+ *
+ * Flag set in the command of messages whose file descriptors are described by
+ * an IPCFdTable. The header is then preceded by the number of table entries,
+ * itself preceded by the entries, after the message data.
+ */
+constexpr uint32_t kFdTableFlag = 1U << 31;
+
+/* Maximum number of file descriptors cached by an IPCFdTable sender. */
+constexpr unsigned int kMaxCachedFds = 64;
+
+} /* namespace */
+
 /**
  * \struct IPCMessage::Header
  * \brief Container for an IPCMessage header
@@ -74,26 +97,81 @@ IPCMessage::IPCMessage(const Header &header)
 /**
  * \brief Construct an IPCMessage instance from an IPC payload
  * \param[in] payload The IPCUnixSocket payload to construct from
+ * \param[in] fdTable The table to resolve cached file descriptors (optional)
  *
  * This essentially converts an IPCUnixSocket payload into an IPCMessage.
  * The header is extracted from the payload into the IPCMessage's header field.
  *
- * If the IPCUnixSocket payload had any valid file descriptors, then they will
- * all be invalidated.
+ * The payload data is moved to the IPCMessage without copying or moving its
+ * bytes, and the payload is left empty. If the IPCUnixSocket payload had any valid file
+ * descriptors, then they will all be invalidated.
+ *
+ * Messages sent with an IPCFdTable may refer to file descriptors transferred
+ * by previous messages. They are resolved through the \a fdTable, which must
+ * be the same table for all the messages received from the peer.
  */
-IPCMessage::IPCMessage(IPCUnixSocket::Payload &payload)
+IPCMessage::IPCMessage(IPCUnixSocket::Payload &payload, IPCFdTable *fdTable)
+	: header_(Header{ 0, 0 })
 {
-	memcpy(&header_, payload.data.data(), sizeof(header_));
-	data_ = std::vector<uint8_t>(payload.data.begin() + sizeof(header_),
-				     payload.data.end());
-	for (int32_t &fd : payload.fds)
-		fds_.push_back(FileDescriptor(std::move(fd)));
+	size_t size = payload.data.size();
+
+	if (size < sizeof(header_)) {
+		LOG(IPCPipe, Error) << "Truncated message header";
+		size = 0;
+	} else {
+		size -= sizeof(header_);
+		memcpy(&header_, payload.data.data() + size, sizeof(header_));
+	}
+
+	if (header_.cmd & kFdTableFlag) {
+		header_.cmd &= ~kFdTableFlag;
+
+		uint32_t count = 0;
+		if (size >= sizeof(count)) {
+			size -= sizeof(count);
+			memcpy(&count, payload.data.data() + size, sizeof(count));
+		}
+
+		size_t length = count * sizeof(IPCFdTable::Entry);
+		if (size < length) {
+			LOG(IPCPipe, Error) << "Truncated file descriptor table";
+			length = size;
+			count = 0;
+		}
+		size -= length;
+
+		/* The entries may not be suitably aligned in the payload. */
+		std::vector<IPCFdTable::Entry> entries(count);
+		memcpy(entries.data(), payload.data.data() + size,
+		       count * sizeof(IPCFdTable::Entry));
+
+		if (fdTable)
+			fdTable->decode(entries, payload.fds, &fds_);
+		else
+			LOG(IPCPipe, Error)
+				<< "Received cached file descriptors without a table";
+	}
+
+	/* Shrinking the vector drops the trailer without touching the data. */
+	data_ = std::move(payload.data);
+	data_.resize(size);
+	payload.data.clear();
+
+	/* Take ownership of the file descriptors not consumed by the table. */
+	fds_.reserve(fds_.size() + payload.fds.size());
+	for (int32_t &fd : payload.fds) {
+		if (fd >= 0)
+			fds_.push_back(FileDescriptor(std::move(fd)));
+	}
+	payload.fds.clear();
 }
 
 /**
  * \brief Create an IPCUnixSocket payload from the IPCMessage
  *
  * This essentially converts the IPCMessage into an IPCUnixSocket payload.
+ * The message data is copied to the payload, use send() to transmit the
+ * message without copying it.
  *
  * \todo Resolve the layering violation (add other converters later?)
  */
@@ -104,13 +182,10 @@ IPCUnixSocket::Payload IPCMessage::payload() const
 	payload.data.resize(sizeof(Header) + data_.size());
 	payload.fds.reserve(fds_.size());
 
-	memcpy(payload.data.data(), &header_, sizeof(Header));
+	if (data_.size() > 0)
+		memcpy(payload.data.data(), data_.data(), data_.size());
 
-	if (data_.size() > 0) {
-		/* \todo Make this work without copy */
-		memcpy(payload.data.data() + sizeof(Header),
-		       data_.data(), data_.size());
-	}
+	memcpy(payload.data.data() + data_.size(), &header_, sizeof(Header));
 
 	for (const FileDescriptor &fd : fds_)
 		payload.fds.push_back(fd.fd());
@@ -118,6 +193,69 @@ IPCUnixSocket::Payload IPCMessage::payload() const
 	return payload;
 }
 
+/**
+ * \brief Send the IPCMessage over an IPCUnixSocket
+ * \param[in] socket The socket to send the message on
+ * \param[in] fdTable The table to cache file descriptors in (optional)
+ *
+ * The message header and data are passed to the socket as separate buffers
+ * and gathered by the kernel, avoiding the copy to an intermediate payload.
+ *
+ * When an \a fdTable is given, file descriptors already transferred to the
+ * peer by previous messages are referenced by their handle instead of being
+ * transferred again. The peer must then receive all the messages with its own
+ * IPCFdTable.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCMessage::send(IPCUnixSocket *socket, IPCFdTable *fdTable) const
+{
+	if (!fdTable || !fdTable->pending(fds_)) {
+		const std::array<Span<const uint8_t>, 2> data = {
+			Span<const uint8_t>{ data_ },
+			Span<const uint8_t>{ reinterpret_cast<const uint8_t *>(&header_),
+					     sizeof(header_) },
+		};
+
+		std::vector<int32_t> fds;
+		fds.reserve(fds_.size());
+		for (const FileDescriptor &fd : fds_)
+			fds.push_back(fd.fd());
+
+		return socket->send(data, fds);
+	}
+
+	std::vector<IPCFdTable::Entry> entries;
+	std::vector<int32_t> fds;
+	fdTable->encode(fds_, &entries, &fds);
+
+	Header header = header_;
+	header.cmd |= kFdTableFlag;
+	uint32_t count = entries.size();
+
+	const std::array<Span<const uint8_t>, 4> data = {
+		Span<const uint8_t>{ data_ },
+		Span<const uint8_t>{ reinterpret_cast<const uint8_t *>(entries.data()),
+				     entries.size() * sizeof(IPCFdTable::Entry) },
+		Span<const uint8_t>{ reinterpret_cast<const uint8_t *>(&count),
+				     sizeof(count) },
+		Span<const uint8_t>{ reinterpret_cast<const uint8_t *>(&header),
+				     sizeof(header) },
+	};
+
+	int ret = socket->send(data, fds);
+
+	/*
+	 * The peer hasn't received the new file descriptors, start over with a
+	 * clean table. Handles are never reused, so the stale entries of the
+	 * peer's table can't be referenced.
+	 */
+	if (ret)
+		fdTable->reset();
+
+	return ret;
+}
+
 /**
  * \fn IPCMessage::header()
  * \brief Returns a reference to the header
@@ -148,6 +286,148 @@ IPCUnixSocket::Payload IPCMessage::payload() const
  * \brief Returns a const reference to the vector containing file descriptors
  */
 
+/**
+ * \class IPCFdTable
+ * \brief Cache of the file descriptors exchanged over an IPC channel
+ *
+ * Transferring a file descriptor over a Unix socket installs a new file
+ * descriptor in the receiving process, which then has to close it. Buffers
+ * are however mostly exchanged repeatedly. The IPCFdTable assigns a handle to
+ * each file descriptor the first time it is sent, and keeps a reference to it
+ * on both sides. Later messages carrying the same file descriptor then only
+ * carry its handle.
+ *
+ * Each side of the channel uses its own table, to send messages with
+ * IPCMessage::send() and to receive them with the IPCMessage constructor.
+ *
+ * Cached file descriptors keep the underlying files, and thus buffer memory,
+ * alive. The sender releases them explicitly with release() or releaseAll(),
+ * for instance when buffers are unmapped, and the release is signalled to
+ * the receiver with the next message. The least recently used file
+ * descriptors are also released when the cache exceeds its maximum size.
+ */
+
+IPCFdTable::IPCFdTable()
+	: nextHandle_(0), lastUse_(0)
+{
+}
+
+/**
+ * \brief Release the cached reference to a file descriptor
+ * \param[in] fd The file descriptor to release
+ *
+ * The next message sent with the table notifies the peer of the release.
+ */
+void IPCFdTable::release(const FileDescriptor &fd)
+{
+	auto it = sent_.find(fd.fd());
+	if (it == sent_.end())
+		return;
+
+	released_.push_back(it->second.handle);
+	sent_.erase(it);
+}
+
+/**
+ * \brief Release the cached references to all file descriptors
+ *
+ * The next message sent with the table notifies the peer of the release.
+ */
+void IPCFdTable::releaseAll()
+{
+	for (const auto &[fd, sent] : sent_)
+		released_.push_back(sent.handle);
+
+	sent_.clear();
+}
+
+bool IPCFdTable::pending(const std::vector<FileDescriptor> &fds) const
+{
+	return !fds.empty() || !released_.empty();
+}
+
+void IPCFdTable::encode(const std::vector<FileDescriptor> &fds,
+			std::vector<Entry> *entries, std::vector<int32_t> *sendFds)
+{
+	for (uint32_t handle : released_)
+		entries->push_back({ handle, EntryRelease });
+	released_.clear();
+
+	for (const FileDescriptor &fd : fds) {
+		auto it = sent_.find(fd.fd());
+		if (it != sent_.end()) {
+			it->second.lastUse = ++lastUse_;
+			entries->push_back({ it->second.handle, EntryCached });
+			continue;
+		}
+
+		uint32_t handle = nextHandle_++;
+		entries->push_back({ handle, EntryNew });
+		sendFds->push_back(fd.fd());
+
+		if (!fd.isValid())
+			continue;
+
+		if (sent_.size() >= kMaxCachedFds) {
+			auto lru = std::min_element(sent_.begin(), sent_.end(),
+						    [](const auto &a, const auto &b) {
+							    return a.second.lastUse < b.second.lastUse;
+						    });
+			entries->push_back({ lru->second.handle, EntryRelease });
+			sent_.erase(lru);
+		}
+
+		sent_.emplace(fd.fd(), SentFd{ handle, ++lastUse_, fd });
+	}
+}
+
+void IPCFdTable::decode(Span<const Entry> entries, std::vector<int32_t> &fds,
+			std::vector<FileDescriptor> *decodedFds)
+{
+	auto fd = fds.begin();
+
+	for (const Entry &entry : entries) {
+		switch (entry.type) {
+		case EntryRelease:
+			received_.erase(entry.handle);
+			break;
+
+		case EntryNew:
+			if (fd == fds.end()) {
+				LOG(IPCPipe, Error) << "Missing file descriptor";
+				decodedFds->push_back(FileDescriptor());
+				break;
+			}
+
+			decodedFds->push_back(FileDescriptor(std::move(*fd++)));
+			if (decodedFds->back().isValid())
+				received_[entry.handle] = decodedFds->back();
+			break;
+
+		case EntryCached:
+		default: {
+			auto it = received_.find(entry.handle);
+			if (it == received_.end()) {
+				LOG(IPCPipe, Error)
+					<< "Unknown file descriptor handle "
+					<< entry.handle;
+				decodedFds->push_back(FileDescriptor());
+				break;
+			}
+
+			decodedFds->push_back(it->second);
+			break;
+		}
+		}
+	}
+}
+
+void IPCFdTable::reset()
+{
+	sent_.clear();
+	released_.clear();
+}
+
 /**
  * \class IPCPipe
  * \brief IPC message pipe for IPA isolation
@@ -204,6 +484,16 @@ IPCPipe::~IPCPipe()
  * \return Zero on success, negative error code otherwise
  */
 
+/**
+ * \fn IPCPipe::releaseFds()
+ * \brief Release the file descriptors cached by the pipe
+ *
+ * IPCPipe implementations may cache the file descriptors they transfer, to
+ * avoid transferring them again with later messages. This function releases
+ * all the cached file descriptors, and shall be called when the buffers they
+ * refer to are not used anymore. The default implementation does nothing.
+ */
+
 /**
  * \var IPCPipe::recv
  * \brief Signal to be emitted when a message is received over IPC
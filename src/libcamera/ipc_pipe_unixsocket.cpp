@@ -7,6 +7,7 @@
 
 #include "libcamera/internal/ipc_pipe_unixsocket.h"
 
+#include <string.h>
 #include <vector>
 
 #include <libcamera/base/event_dispatcher.h>
@@ -14,6 +15,7 @@
 #include <libcamera/base/thread.h>
 #include <libcamera/base/timer.h>
 
+#include "libcamera/internal/ipa_proxy_worker_pool.h"
 #include "libcamera/internal/ipc_pipe.h"
 #include "libcamera/internal/ipc_unixsocket.h"
 #include "libcamera/internal/process.h"
@@ -22,31 +24,38 @@ namespace libcamera {
 
 LOG_DECLARE_CATEGORY(IPCPipe)
 
+namespace {
+
+/* Size of the shared memory ring buffer for each direction, in bytes. */
+constexpr unsigned int kSharedMemorySize = 256 * 1024;
+
+} /* namespace */
+
 IPCPipeUnixSocket::IPCPipeUnixSocket(const char *ipaModulePath,
 				     const char *ipaProxyWorkerPath)
 	: IPCPipe()
 {
-	std::vector<int> fds;
-	std::vector<std::string> args;
-	args.push_back(ipaModulePath);
-
-	socket_ = std::make_unique<IPCUnixSocket>();
-	int fd = socket_->create();
-	if (fd < 0) {
-		LOG(IPCPipe, Error) << "Failed to create socket";
+	IPAProxyWorkerPool *pool = IPAProxyWorkerPool::instance();
+	IPAProxyWorkerPool::Worker worker = pool
+		? pool->acquire(ipaModulePath, ipaProxyWorkerPath)
+		: IPAProxyWorkerPool::start(ipaModulePath, ipaProxyWorkerPath);
+	if (!worker.process)
 		return;
-	}
+
+	proc_ = std::move(worker.process);
+	socket_ = std::move(worker.socket);
 	socket_->readyRead.connect(this, &IPCPipeUnixSocket::readyRead);
-	args.push_back(std::to_string(fd));
-	fds.push_back(fd);
 
-	proc_ = std::make_unique<Process>();
-	int ret = proc_->start(ipaProxyWorkerPath, args, fds);
-	if (ret) {
-		LOG(IPCPipe, Error)
-			<< "Failed to start proxy worker process";
-		return;
-	}
+	/*
+	 * Transport the message data through shared memory to save system
+	 * calls and copies. The socket is used as a fallback if shared memory
+	 * isn't available.
+	 */
+	int ret = socket_->enableSharedMemory(kSharedMemorySize);
+	if (ret)
+		LOG(IPCPipe, Warning)
+			<< "Shared memory transport not available: "
+			<< strerror(-ret);
 
 	connected_ = true;
 }
@@ -59,21 +68,21 @@ int IPCPipeUnixSocket::sendSync(const IPCMessage &in, IPCMessage *out)
 {
 	IPCUnixSocket::Payload response;
 
-	int ret = call(in.payload(), &response, in.header().cookie);
+	int ret = call(in, &response);
 	if (ret) {
 		LOG(IPCPipe, Error) << "Failed to call sync";
 		return ret;
 	}
 
 	if (out)
-		*out = IPCMessage(response);
+		*out = IPCMessage(response, &fdTable_);
 
 	return 0;
 }
 
 int IPCPipeUnixSocket::sendAsync(const IPCMessage &data)
 {
-	int ret = socket_->send(data.payload());
+	int ret = data.send(socket_.get(), &fdTable_);
 	if (ret) {
 		LOG(IPCPipe, Error) << "Failed to call async";
 		return ret;
@@ -82,6 +91,11 @@ int IPCPipeUnixSocket::sendAsync(const IPCMessage &data)
 	return 0;
 }
 
+void IPCPipeUnixSocket::releaseFds()
+{
+	fdTable_.releaseAll();
+}
+
 void IPCPipeUnixSocket::readyRead()
 {
 	IPCUnixSocket::Payload payload;
@@ -91,15 +105,21 @@ void IPCPipeUnixSocket::readyRead()
 		return;
 	}
 
-	/* \todo Use span to avoid the double copy when callData is found. */
 	if (payload.data.size() < sizeof(IPCMessage::Header)) {
 		LOG(IPCPipe, Error) << "Not enough data received";
 		return;
 	}
 
-	IPCMessage ipcMessage(payload);
+	/*
+	 * Look up the cookie before converting the payload to an IPCMessage,
+	 * to hand replies over to call() without copying them. The header is
+	 * stored at the end of the payload.
+	 */
+	IPCMessage::Header header;
+	memcpy(&header, payload.data.data() + payload.data.size() - sizeof(header),
+	       sizeof(header));
 
-	auto callData = callData_.find(ipcMessage.header().cookie);
+	auto callData = callData_.find(header.cookie);
 	if (callData != callData_.end()) {
 		*callData->second.response = std::move(payload);
 		callData->second.done = true;
@@ -107,19 +127,21 @@ void IPCPipeUnixSocket::readyRead()
 	}
 
 	/* Received unexpected data, this means it's a call from the IPA. */
+	IPCMessage ipcMessage(payload, &fdTable_);
 	recv.emit(ipcMessage);
 }
 
-int IPCPipeUnixSocket::call(const IPCUnixSocket::Payload &message,
-			    IPCUnixSocket::Payload *response, uint32_t cookie)
+int IPCPipeUnixSocket::call(const IPCMessage &message,
+			    IPCUnixSocket::Payload *response)
 {
 	Timer timeout;
 	int ret;
 
-	const auto result = callData_.insert({ cookie, { response, false } });
+	const auto result = callData_.insert({ message.header().cookie,
+					       { response, false } });
 	const auto &iter = result.first;
 
-	ret = socket_->send(message);
+	ret = message.send(socket_.get(), &fdTable_);
 	if (ret) {
 		callData_.erase(iter);
 		return ret;
@@ -129,7 +151,7 @@ int IPCPipeUnixSocket::call(const IPCUnixSocket::Payload &message,
 	timeout.start(2000);
 	while (!iter->second.done) {
 		if (!timeout.isRunning()) {
-			LOG(IPCPipe, Error) << "Call timeout!";
+			LOG_RATELIMITED(IPCPipe, Error) << "Call timeout!";
 			callData_.erase(iter);
 			return -ETIMEDOUT;
 		}
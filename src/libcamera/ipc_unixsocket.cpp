@@ -7,9 +7,12 @@
 
 #include "libcamera/internal/ipc_unixsocket.h"
 
+#include <fcntl.h>
 #include <poll.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <libcamera/base/event_notifier.h>
@@ -24,6 +27,27 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(IPCUnixSocket)
 
+namespace {
+
+/*
+ * Size of the shared memory control area, which stores the consumer position
+ * of each ring in its own cache line.
+ */
+constexpr size_t kSharedMemoryControlSize = 4096;
+constexpr size_t kSharedMemoryCounterStride = 64;
+
+/*
+ * Maximum size of the data of messages sent in the same datagram as their
+ * header. Larger messages are sent in two datagrams, as the receiver needs to
+ * know their size before receiving them.
+ */
+constexpr size_t kMaxInlineDataSize = 64 * 1024;
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+	      "Shared memory rings require lock-free 32-bit atomics");
+
+} /* namespace */
+
 /**
  * \struct IPCUnixSocket::Payload
  * \brief Container for an IPC payload
@@ -64,11 +88,18 @@ LOG_DEFINE_CATEGORY(IPCUnixSocket)
  * it to the other side by passing the file descriptor to bind(). At that point
  * the channel is operation and communication is bidirectional and symmmetrical.
  *
+ * The message data can optionally be transported through shared memory, see
+ * enableSharedMemory().
+ *
+ * When the remote side closes the channel, the \ref disconnected signal is
+ * emitted and no further message is received.
+ *
  * \context This class is \threadbound.
  */
 
 IPCUnixSocket::IPCUnixSocket()
-	: fd_(-1), headerReceived_(false), notifier_(nullptr)
+	: fd_(-1), headerReceived_(false), notifier_(nullptr), shm_(nullptr),
+	  shmSize_(0), ringSize_(0)
 {
 }
 
@@ -124,6 +155,7 @@ int IPCUnixSocket::bind(int fd)
 		return -EINVAL;
 
 	fd_ = fd;
+	rxBuffer_.resize(kMaxInlineDataSize);
 	notifier_ = new EventNotifier(fd_, EventNotifier::Read);
 	notifier_->activated.connect(this, &IPCUnixSocket::dataNotifier);
 
@@ -147,6 +179,15 @@ void IPCUnixSocket::close()
 
 	fd_ = -1;
 	headerReceived_ = false;
+
+	for (int32_t fd : headerFds_)
+		::close(fd);
+	headerFds_.clear();
+
+	rxBuffer_.clear();
+	rxBuffer_.shrink_to_fit();
+
+	unmapSharedMemory();
 }
 
 /**
@@ -158,6 +199,83 @@ bool IPCUnixSocket::isBound() const
 	return fd_ != -1;
 }
 
+/**
+ * \brief Transport message data through shared memory
+ * \param[in] size The size of the ring buffer for each direction, in bytes
+ *
+ * This function creates a shared memory area holding one ring buffer for each
+ * direction of the IPC channel, and passes it to the remote side. Once the
+ * remote side has received the shared memory, both sides write the data of
+ * subsequent messages to their ring buffer, and only send a small header
+ * datagram, along with the file descriptors of the message, over the socket.
+ * This saves one system call and the copies of the data through the kernel
+ * for every message.
+ *
+ * Messages that don't fit in the free space of the ring buffer are sent
+ * through the socket transparently. Message ordering is preserved in all
+ * cases, as the header datagrams are delivered in order.
+ *
+ * The shared memory is sealed against resizing before being passed to the
+ * remote side. This function shall be called on one side of the channel only,
+ * typically by the side that created the channel.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTCONN The socket is not connected
+ * \retval -EBUSY Shared memory is already enabled
+ * \retval -EINVAL The \a size is not a power of two
+ */
+int IPCUnixSocket::enableSharedMemory(unsigned int size)
+{
+	int ret;
+
+	if (!isBound())
+		return -ENOTCONN;
+
+	if (shm_)
+		return -EBUSY;
+
+	if (!size || size & (size - 1) || size > (1U << 31))
+		return -EINVAL;
+
+	int fd = memfd_create("libcamera-ipc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		ret = -errno;
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to create shared memory: " << strerror(-ret);
+		return ret;
+	}
+
+	if (ftruncate(fd, kSharedMemoryControlSize + 2 * size) < 0 ||
+	    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		ret = -errno;
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to prepare shared memory: " << strerror(-ret);
+		::close(fd);
+		return ret;
+	}
+
+	ret = mapSharedMemory(fd, size, 0);
+	if (ret) {
+		::close(fd);
+		return ret;
+	}
+
+	Header hdr = {};
+	hdr.data = size;
+	hdr.fds = 1;
+	hdr.type = MessageSetup;
+
+	ret = sendData(&hdr, {}, &fd, 1);
+	::close(fd);
+
+	if (ret) {
+		unmapSharedMemory();
+		return ret;
+	}
+
+	return 0;
+}
+
 /**
  * \brief Send a message payload
  * \param[in] payload Message payload to send
@@ -169,6 +287,25 @@ bool IPCUnixSocket::isBound() const
  * \return 0 on success or a negative error code otherwise
  */
 int IPCUnixSocket::send(const Payload &payload)
+{
+	const Span<const uint8_t> data{ payload.data };
+	return send({ &data, 1 }, payload.fds);
+}
+
+/**
+ * \brief Send a message payload from scattered buffers
+ * \param[in] data Buffers holding the message data
+ * \param[in] fds File descriptors to send with the message
+ *
+ * This function queues a message payload for transmission to the other end of
+ * the IPC channel, similarly to send(const Payload &payload). The message data
+ * is gathered from the \a data buffers, in order, without copying them to an
+ * intermediate buffer.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCUnixSocket::send(Span<const Span<const uint8_t>> data,
+			Span<const int32_t> fds)
 {
 	int ret;
 
@@ -176,12 +313,30 @@ int IPCUnixSocket::send(const Payload &payload)
 		return -ENOTCONN;
 
 	Header hdr = {};
-	hdr.data = payload.data.size();
-	hdr.fds = payload.fds.size();
+	for (const Span<const uint8_t> &buffer : data)
+		hdr.data += buffer.size();
+	hdr.fds = fds.size();
 
 	if (!hdr.data && !hdr.fds)
 		return -EINVAL;
 
+	if (shm_) {
+		ret = sendShared(data, fds, hdr.data);
+		if (ret != -ENOSPC)
+			return ret;
+	}
+
+	/*
+	 * Send small messages along with their header in a single datagram,
+	 * and larger messages in a separate datagram following the header.
+	 */
+	if (hdr.data <= kMaxInlineDataSize) {
+		hdr.type = MessageInline;
+		return sendData(&hdr, data, fds.data(), hdr.fds);
+	}
+
+	hdr.type = MessageSeparate;
+
 	ret = ::send(fd_, &hdr, sizeof(hdr), 0);
 	if (ret < 0) {
 		ret = -errno;
@@ -190,7 +345,7 @@ int IPCUnixSocket::send(const Payload &payload)
 		return ret;
 	}
 
-	return sendData(payload.data.data(), hdr.data, payload.fds.data(), hdr.fds);
+	return sendData(nullptr, data, fds.data(), hdr.fds);
 }
 
 /**
@@ -218,18 +373,31 @@ int IPCUnixSocket::receive(Payload *payload)
 	if (!headerReceived_)
 		return -EAGAIN;
 
-	payload->data.resize(header_.data);
-	payload->fds.resize(header_.fds);
+	int ret;
 
-	int ret = recvData(payload->data.data(), header_.data,
-			   payload->fds.data(), header_.fds);
-	if (ret < 0)
-		return ret;
+	if (header_.type == MessageShared) {
+		/* Drop invalid messages instead of retrying. */
+		ret = receiveShared(payload);
+	} else if (header_.type == MessageInline) {
+		payload->data.assign(rxBuffer_.begin(),
+				     rxBuffer_.begin() + header_.data);
+		payload->fds = std::move(headerFds_);
+		headerFds_.clear();
+		ret = 0;
+	} else {
+		payload->data.resize(header_.data);
+		payload->fds.resize(header_.fds);
+
+		ret = recvData(payload->data.data(), header_.data,
+			       payload->fds.data(), header_.fds);
+		if (ret < 0)
+			return ret;
+	}
 
 	headerReceived_ = false;
 	notifier_->setEnabled(true);
 
-	return 0;
+	return ret;
 }
 
 /**
@@ -237,12 +405,29 @@ int IPCUnixSocket::receive(Payload *payload)
  * \brief A Signal emitted when a message is ready to be read
  */
 
-int IPCUnixSocket::sendData(const void *buffer, size_t length,
+/**
+ * \var IPCUnixSocket::disconnected
+ * \brief A Signal emitted when the remote side has closed the channel
+ */
+
+int IPCUnixSocket::sendData(const Header *hdr,
+			    Span<const Span<const uint8_t>> data,
 			    const int32_t *fds, unsigned int num)
 {
-	struct iovec iov[1];
-	iov[0].iov_base = const_cast<void *>(buffer);
-	iov[0].iov_len = length;
+	struct iovec iov[data.size() + 1];
+	unsigned int iovlen = 0;
+
+	if (hdr) {
+		iov[iovlen].iov_base = const_cast<Header *>(hdr);
+		iov[iovlen].iov_len = sizeof(*hdr);
+		iovlen++;
+	}
+
+	for (const Span<const uint8_t> &buffer : data) {
+		iov[iovlen].iov_base = const_cast<uint8_t *>(buffer.data());
+		iov[iovlen].iov_len = buffer.size();
+		iovlen++;
+	}
 
 	char buf[CMSG_SPACE(num * sizeof(uint32_t))];
 	memset(buf, 0, sizeof(buf));
@@ -256,7 +441,7 @@ int IPCUnixSocket::sendData(const void *buffer, size_t length,
 	msg.msg_name = nullptr;
 	msg.msg_namelen = 0;
 	msg.msg_iov = iov;
-	msg.msg_iovlen = 1;
+	msg.msg_iovlen = iovlen;
 	msg.msg_control = cmsg;
 	msg.msg_controllen = cmsg->cmsg_len;
 	msg.msg_flags = 0;
@@ -311,38 +496,274 @@ int IPCUnixSocket::recvData(void *buffer, size_t length,
 	return 0;
 }
 
-void IPCUnixSocket::dataNotifier()
+int IPCUnixSocket::recvHeader()
 {
-	int ret;
+	/*
+	 * Receive the header along with the data of inline messages, the
+	 * receive buffer is large enough for the largest inline message.
+	 */
+	struct iovec iov[2] = {
+		{ &header_, sizeof(header_) },
+		{ rxBuffer_.data(), rxBuffer_.size() },
+	};
+	char buf[CMSG_SPACE(UINT8_MAX * sizeof(int32_t))];
 
-	if (!headerReceived_) {
-		/* Receive the header. */
-		ret = ::recv(fd_, &header_, sizeof(header_), 0);
-		if (ret < 0) {
-			ret = -errno;
-			LOG(IPCUnixSocket, Error)
-				<< "Failed to receive header: " << strerror(-ret);
-			return;
+	struct msghdr msg = {};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof(buf);
+
+	ssize_t ret = recvmsg(fd_, &msg, MSG_CMSG_CLOEXEC);
+	if (ret < 0)
+		return -errno;
+
+	/* Headers are never empty, an empty read signals a hangup. */
+	if (ret == 0)
+		return -ECONNRESET;
+
+	/*
+	 * Headers of messages transported through shared memory carry the
+	 * message file descriptors.
+	 */
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		unsigned int num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int32_t);
+		const uint8_t *data = CMSG_DATA(cmsg);
+
+		for (unsigned int i = 0; i < num; ++i) {
+			int32_t fd;
+			memcpy(&fd, data + i * sizeof(fd), sizeof(fd));
+			headerFds_.push_back(fd);
 		}
+	}
+
+	size_t length = static_cast<size_t>(ret);
+	size_t expected = sizeof(header_);
+	if (length >= sizeof(header_) && header_.type == MessageInline)
+		expected += header_.data;
 
-		headerReceived_ = true;
+	if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC) || length != expected ||
+	    headerFds_.size() != (header_.type == MessageSeparate ? 0 : header_.fds)) {
+		for (int32_t fd : headerFds_)
+			::close(fd);
+		headerFds_.clear();
+
+		return -EPROTO;
 	}
 
+	return 0;
+}
+
+int IPCUnixSocket::mapSharedMemory(int fd, unsigned int size, unsigned int index)
+{
+	/* The size is received from the remote side, validate it. */
+	if (!size || size & (size - 1) || size > (1U << 31))
+		return -EINVAL;
+
+	size_t shmSize = kSharedMemoryControlSize + 2 * static_cast<size_t>(size);
+
 	/*
-	 * If the payload has arrived, disable the notifier and emit the
-	 * readyRead signal. The notifier will be reenabled by the receive()
-	 * function.
+	 * Make sure the remote side can't shrink the shared memory, which
+	 * would cause accesses beyond its end to raise SIGBUS.
 	 */
-	struct pollfd fds = { fd_, POLLIN, 0 };
-	ret = poll(&fds, 1, 0);
-	if (ret < 0)
-		return;
+	struct stat st;
+	int seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(fd, &st) < 0 ||
+	    static_cast<size_t>(st.st_size) < shmSize) {
+		LOG(IPCUnixSocket, Error) << "Invalid shared memory";
+		return -EINVAL;
+	}
+
+	void *mem = mmap(nullptr, shmSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 fd, 0);
+	if (mem == MAP_FAILED) {
+		int ret = -errno;
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to map shared memory: " << strerror(-ret);
+		return ret;
+	}
+
+	uint8_t *base = static_cast<uint8_t *>(mem);
+	auto ring = [&](unsigned int i) {
+		return Ring{
+			base + kSharedMemoryControlSize + i * size,
+			reinterpret_cast<std::atomic<uint32_t> *>(base + i * kSharedMemoryCounterStride),
+			0,
+		};
+	};
+
+	shm_ = mem;
+	shmSize_ = shmSize;
+	ringSize_ = size;
+	tx_ = ring(index);
+	rx_ = ring(!index);
+
+	return 0;
+}
 
-	if (!(fds.revents & POLLIN))
+void IPCUnixSocket::unmapSharedMemory()
+{
+	if (!shm_)
 		return;
 
-	notifier_->setEnabled(false);
-	readyRead.emit();
+	munmap(shm_, shmSize_);
+	shm_ = nullptr;
+	shmSize_ = 0;
+	ringSize_ = 0;
+}
+
+int IPCUnixSocket::sendShared(Span<const Span<const uint8_t>> data,
+			      Span<const int32_t> fds, uint32_t length)
+{
+	if (length > ringSize_)
+		return -ENOSPC;
+
+	/*
+	 * Messages are stored contiguously. If the message doesn't fit at the
+	 * end of the ring, skip to the beginning.
+	 */
+	uint32_t pos = tx_.position & (ringSize_ - 1);
+	uint32_t skip = length > ringSize_ - pos ? ringSize_ - pos : 0;
+	uint32_t used = tx_.position - tx_.consumed->load(std::memory_order_acquire);
+
+	if (used > ringSize_ || ringSize_ - used < skip + length)
+		return -ENOSPC;
+
+	uint32_t offset = skip ? 0 : pos;
+	uint8_t *dst = tx_.data + offset;
+
+	for (const Span<const uint8_t> &buffer : data) {
+		memcpy(dst, buffer.data(), buffer.size());
+		dst += buffer.size();
+	}
+
+	Header hdr = {};
+	hdr.data = length;
+	hdr.fds = fds.size();
+	hdr.type = MessageShared;
+	hdr.offset = offset;
+
+	int ret = sendData(&hdr, {}, fds.data(), fds.size());
+	if (ret)
+		return ret;
+
+	tx_.position += skip + length;
+
+	return 0;
+}
+
+int IPCUnixSocket::receiveShared(Payload *payload)
+{
+	uint32_t length = header_.data;
+	uint32_t pos = rx_.position & (ringSize_ - 1);
+	uint32_t skip;
+
+	/*
+	 * The data position is fully determined by the previous messages,
+	 * validate it to guard against a misbehaving remote side.
+	 */
+	if (shm_ && header_.offset == pos && length <= ringSize_ - pos) {
+		skip = 0;
+	} else if (shm_ && header_.offset == 0 && length > ringSize_ - pos &&
+		   length <= ringSize_) {
+		skip = ringSize_ - pos;
+	} else {
+		LOG(IPCUnixSocket, Error) << "Invalid shared memory message";
+
+		for (int32_t fd : headerFds_)
+			::close(fd);
+		headerFds_.clear();
+
+		return -EPROTO;
+	}
+
+	const uint8_t *src = rx_.data + header_.offset;
+	payload->data.assign(src, src + length);
+	payload->fds = std::move(headerFds_);
+	headerFds_.clear();
+
+	rx_.position += skip + length;
+	rx_.consumed->store(rx_.position, std::memory_order_release);
+
+	return 0;
+}
+
+void IPCUnixSocket::dataNotifier()
+{
+	int ret;
+
+	/*
+	 * Process all the available messages in one go instead of returning to
+	 * the event loop after each of them. Stop when no message is available
+	 * or when a message hasn't been received by the readyRead handler, in
+	 * which case the receive() function will reenable the notifier.
+	 */
+	while (isBound()) {
+		if (!headerReceived_) {
+			/* Receive the header. */
+			ret = recvHeader();
+			if (ret == -EAGAIN)
+				return;
+
+			if (ret == -ECONNRESET) {
+				notifier_->setEnabled(false);
+				disconnected.emit();
+				return;
+			}
+
+			if (ret < 0) {
+				LOG(IPCUnixSocket, Error)
+					<< "Failed to receive header: " << strerror(-ret);
+				return;
+			}
+
+			if (header_.type == MessageSetup) {
+				if (!shm_ && headerFds_.size() == 1 &&
+				    !mapSharedMemory(headerFds_[0], header_.data, 1))
+					LOG(IPCUnixSocket, Debug) << "Shared memory enabled";
+				else
+					LOG(IPCUnixSocket, Error)
+						<< "Failed to enable shared memory";
+
+				for (int32_t fd : headerFds_)
+					::close(fd);
+				headerFds_.clear();
+
+				continue;
+			}
+
+			headerReceived_ = true;
+		}
+
+		/*
+		 * The data of messages sent in a separate datagram may not
+		 * have arrived yet, wait for it before emitting readyRead.
+		 */
+		if (header_.type == MessageSeparate) {
+			struct pollfd fds = { fd_, POLLIN, 0 };
+			ret = poll(&fds, 1, 0);
+			if (ret < 0)
+				return;
+
+			if (!(fds.revents & POLLIN))
+				return;
+		}
+
+		/*
+		 * Disable the notifier and emit the readyRead signal. The
+		 * notifier will be reenabled by the receive() function.
+		 */
+		notifier_->setEnabled(false);
+		readyRead.emit();
+
+		if (headerReceived_)
+			return;
+	}
 }
 
 } /* namespace libcamera */
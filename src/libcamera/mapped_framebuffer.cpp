@@ -9,12 +9,17 @@
 
 #include <algorithm>
 #include <errno.h>
+#include <linux/dma-buf.h>
 #include <map>
+#include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include <libcamera/base/log.h>
 
+#include "libcamera/internal/framebuffer.h"
+
 /**
  * \file libcamera/internal/mapped_framebuffer.h
  * \brief Frame buffer memory mapping support
@@ -24,6 +29,72 @@ namespace libcamera {
 
 LOG_DECLARE_CATEGORY(Buffer)
 
+namespace {
+
+int syncDmaBuf(int fd, uint64_t flags)
+{
+	struct dma_buf_sync sync = {};
+	sync.flags = flags;
+
+	int ret;
+	do {
+		ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+	if (ret < 0) {
+		ret = -errno;
+
+		/* Not all buffers are dmabufs, skip synchronization silently. */
+		if (ret != -ENOTTY)
+			LOG(Buffer, Warning)
+				<< "Failed to synchronize dmabuf: "
+				<< strerror(-ret);
+	}
+
+	return ret;
+}
+
+/*
+ * Resources held by a MappedFrameBuffer: references to the mappings cached in
+ * the FrameBuffer, and the dmabufs for which CPU access has been started. The
+ * CPU access is ended before the mappings are released.
+ */
+class DmaBufAccess
+{
+public:
+	DmaBufAccess(uint64_t flags)
+		: flags_(flags)
+	{
+	}
+
+	~DmaBufAccess()
+	{
+		for (const FileDescriptor &fd : fds_)
+			syncDmaBuf(fd.fd(), DMA_BUF_SYNC_END | flags_);
+	}
+
+	void addMapping(const std::shared_ptr<uint8_t> &mapping)
+	{
+		mappings_.push_back(mapping);
+	}
+
+	void begin(const FileDescriptor &fd)
+	{
+		if (!flags_)
+			return;
+
+		if (!syncDmaBuf(fd.fd(), DMA_BUF_SYNC_START | flags_))
+			fds_.push_back(fd);
+	}
+
+private:
+	uint64_t flags_;
+	std::vector<FileDescriptor> fds_;
+	std::vector<std::shared_ptr<uint8_t>> mappings_;
+};
+
+} /* namespace */
+
 /**
  * \class MappedBuffer
  * \brief Provide an interface to support managing memory mapped buffers
@@ -84,6 +155,7 @@ MappedBuffer &MappedBuffer::operator=(MappedBuffer &&other)
 	error_ = other.error_;
 	planes_ = std::move(other.planes_);
 	maps_ = std::move(other.maps_);
+	resources_ = std::move(other.resources_);
 	other.error_ = -ENOENT;
 
 	return *this;
@@ -147,6 +219,16 @@ MappedBuffer::~MappedBuffer()
  * completed successfully.
  */
 
+/**
+ * \var MappedBuffer::resources_
+ * \brief Stores resources that back the mappings
+ *
+ * MappedBuffer derived classes that don't own their memory mappings, but share
+ * them with other instances, shall store a reference to the shared resources
+ * in this variable instead of storing the mappings in maps_. The resources are
+ * released when the MappedBuffer is destroyed, after unmapping maps_.
+ */
+
 /**
  * \class MappedFrameBuffer
  * \brief Map a FrameBuffer using the MappedBuffer interface
@@ -176,6 +258,18 @@ MappedBuffer::~MappedBuffer()
  * Construct an object to map a frame buffer for CPU access. The mapping can be
  * made as Read only, Write only or support Read and Write operations by setting
  * the MapFlag flags accordingly.
+ *
+ * Memory mappings are cached in the FrameBuffer and shared between all the
+ * MappedFrameBuffer instances that map it. The first mapping of a dmabuf
+ * covers the whole dmabuf and stays alive until the FrameBuffer and all the
+ * MappedFrameBuffer instances that reference it are destroyed, to avoid the
+ * cost of repeatedly mapping and unmapping buffers that are accessed by the CPU
+ * for every frame. A mapping is only recreated when the protection flags it has
+ * been created with don't cover the requested \a flags.
+ *
+ * CPU access to the dmabufs is started with DMA_BUF_IOCTL_SYNC when the
+ * MappedFrameBuffer is constructed, and ended when it is destroyed. Instances
+ * shall thus be kept alive only for the duration of the CPU access.
  */
 MappedFrameBuffer::MappedFrameBuffer(const FrameBuffer *buffer, MapFlags flags)
 {
@@ -183,28 +277,84 @@ MappedFrameBuffer::MappedFrameBuffer(const FrameBuffer *buffer, MapFlags flags)
 	planes_.reserve(buffer->planes().size());
 
 	int mmapFlags = 0;
+	uint64_t syncFlags = 0;
 
-	if (flags & MapFlag::Read)
+	if (flags & MapFlag::Read) {
 		mmapFlags |= PROT_READ;
+		syncFlags |= DMA_BUF_SYNC_READ;
+	}
 
-	if (flags & MapFlag::Write)
+	if (flags & MapFlag::Write) {
 		mmapFlags |= PROT_WRITE;
+		syncFlags |= DMA_BUF_SYNC_WRITE;
+	}
+
+	const FrameBuffer::Private *d = buffer->_d();
+	auto access = std::make_shared<DmaBufAccess>(syncFlags);
+	std::map<int, Span<uint8_t>> mappings;
+
+	{
+		std::lock_guard<std::mutex> locker(d->mappingsLock_);
+
+		for (const FrameBuffer::Plane &plane : buffer->planes()) {
+			const int fd = plane.fd.fd();
+			if (mappings.find(fd) != mappings.end())
+				continue;
+
+			/*
+			 * The file descriptors are owned by the FrameBuffer and
+			 * their numbers are thus stable for its whole lifetime,
+			 * they can be used as keys in the mappings cache.
+			 */
+			FrameBuffer::Private::Mapping &mapping = d->mappings_[fd];
+			if (!mapping.address) {
+				off_t length = lseek(fd, 0, SEEK_END);
+				if (length < 0) {
+					error_ = -errno;
+					LOG(Buffer, Error)
+						<< "Failed to get dmabuf size: "
+						<< strerror(-error_);
+					d->mappings_.erase(fd);
+					return;
+				}
+
+				mapping.length = length;
+				mapping.prot = 0;
+			}
 
-	struct MappedBufferInfo {
-		uint8_t *address = nullptr;
-		size_t mapLength = 0;
-		size_t dmabufLength = 0;
-	};
-	std::map<int, MappedBufferInfo> mappedBuffers;
+			if ((mapping.prot & mmapFlags) != mmapFlags) {
+				int prot = mapping.prot | mmapFlags;
+				void *address = mmap(nullptr, mapping.length, prot,
+						     MAP_SHARED, fd, 0);
+				if (address == MAP_FAILED) {
+					error_ = -errno;
+					LOG(Buffer, Error) << "Failed to mmap plane: "
+							   << strerror(-error_);
+					if (!mapping.address)
+						d->mappings_.erase(fd);
+					return;
+				}
+
+				/*
+				 * Replace the cached mapping. Instances that
+				 * reference the previous one keep it alive
+				 * until they get destroyed.
+				 */
+				size_t length = mapping.length;
+				mapping.address = std::shared_ptr<uint8_t>(
+					static_cast<uint8_t *>(address),
+					[length](uint8_t *addr) { munmap(addr, length); });
+				mapping.prot = prot;
+			}
 
-	for (const FrameBuffer::Plane &plane : buffer->planes()) {
-		const int fd = plane.fd.fd();
-		if (mappedBuffers.find(fd) == mappedBuffers.end()) {
-			const size_t length = lseek(fd, 0, SEEK_END);
-			mappedBuffers[fd] = MappedBufferInfo{ nullptr, 0, length };
+			access->addMapping(mapping.address);
+			mappings[fd] = { mapping.address.get(), mapping.length };
 		}
+	}
 
-		const size_t length = mappedBuffers[fd].dmabufLength;
+	for (const FrameBuffer::Plane &plane : buffer->planes()) {
+		const Span<uint8_t> &mapping = mappings[plane.fd.fd()];
+		const size_t length = mapping.size();
 
 		if (plane.offset > length ||
 		    plane.offset + plane.length > length) {
@@ -214,30 +364,20 @@ MappedFrameBuffer::MappedFrameBuffer(const FrameBuffer *buffer, MapFlags flags)
 					   << ", plane length=" << plane.length;
 			return;
 		}
-		size_t &mapLength = mappedBuffers[fd].mapLength;
-		mapLength = std::max(mapLength,
-				     static_cast<size_t>(plane.offset + plane.length));
+
+		planes_.emplace_back(mapping.data() + plane.offset, plane.length);
 	}
 
 	for (const FrameBuffer::Plane &plane : buffer->planes()) {
-		const int fd = plane.fd.fd();
-		auto &info = mappedBuffers[fd];
-		if (!info.address) {
-			void *address = mmap(nullptr, info.mapLength, mmapFlags,
-					     MAP_SHARED, fd, 0);
-			if (address == MAP_FAILED) {
-				error_ = -errno;
-				LOG(Buffer, Error) << "Failed to mmap plane: "
-						   << strerror(-error_);
-				return;
-			}
+		auto iter = mappings.find(plane.fd.fd());
+		if (iter == mappings.end())
+			continue;
 
-			info.address = static_cast<uint8_t *>(address);
-			maps_.emplace_back(info.address, info.mapLength);
-		}
-
-		planes_.emplace_back(info.address + plane.offset, plane.length);
+		access->begin(plane.fd);
+		mappings.erase(iter);
 	}
+
+	resources_ = std::move(access);
 }
 
 } /* namespace libcamera */
@@ -20,6 +20,8 @@
 
 #include <libcamera/base/log.h>
 
+#include "libcamera/internal/media_request.h"
+
 /**
  * \file media_device.h
  * \brief Provide a representation of a Linux kernel Media Controller device
@@ -64,7 +66,8 @@ LOG_DEFINE_CATEGORY(MediaDevice)
  */
 MediaDevice::MediaDevice(const std::string &deviceNode)
 	: deviceNode_(deviceNode), fd_(-1), valid_(false), acquired_(false),
-	  lockOwner_(false)
+	  lockOwner_(false), topologyVersion_(0), numLinks_(0),
+	  linksSynced_(false)
 {
 }
 
@@ -96,7 +99,8 @@ std::string MediaDevice::logPrefix() const
  *
  * Exclusive access is only guaranteed if all users of the media device abide by
  * the device claiming mechanism, as it isn't enforced by the media device
- * itself.
+ * itself. Only one of multiple users claiming the device concurrently from
+ * different threads succeeds.
  *
  * \return true if the device was successfully claimed, or false if it was
  * already in use
@@ -104,13 +108,14 @@ std::string MediaDevice::logPrefix() const
  */
 bool MediaDevice::acquire()
 {
-	if (acquired_)
+	if (acquired_.exchange(true))
 		return false;
 
-	if (open())
+	if (open()) {
+		acquired_ = false;
 		return false;
+	}
 
-	acquired_ = true;
 	return true;
 }
 
@@ -138,6 +143,11 @@ void MediaDevice::release()
  * directly, as the base PipelineHandler implementation handles this on the
  * behalf of the specified implementation.
  *
+ * Once locked, the device can't be reconfigured by other instances of
+ * libcamera. The link flags are refreshed from the kernel at that point, which
+ * allows MediaLink::setEnabled() to skip links that are already in the
+ * requested state until the device is unlocked.
+ *
  * \return True if the device could be locked, false otherwise
  * \sa unlock()
  */
@@ -154,6 +164,7 @@ bool MediaDevice::lock()
 		return false;
 
 	lockOwner_ = true;
+	linksSynced_ = syncLinks() == 0;
 
 	return true;
 }
@@ -176,6 +187,7 @@ void MediaDevice::unlock()
 		return;
 
 	lockOwner_ = false;
+	linksSynced_ = false;
 
 	lockf(fd_, F_ULOCK, 0);
 }
@@ -268,6 +280,9 @@ int MediaDevice::populate()
 		version = topology.topology_version;
 	}
 
+	topologyVersion_ = version;
+	numLinks_ = topology.num_links;
+
 	/* Populate entities, pads and links. */
 	if (populateEntities(topology) &&
 	    populatePads(topology) &&
@@ -437,7 +452,8 @@ MediaLink *MediaDevice::link(const MediaPad *source, const MediaPad *sink)
  * \brief Disable all links in the media device
  *
  * Disable all the media device links, clearing the MEDIA_LNK_FL_ENABLED flag
- * on links which are not flagged as IMMUTABLE.
+ * on links which are not flagged as IMMUTABLE. While the device is locked, only
+ * the links that are currently enabled are touched.
  *
  * \return 0 on success or a negative error code otherwise
  */
@@ -462,6 +478,41 @@ int MediaDevice::disableLinks()
 	return 0;
 }
 
+/**
+ * \brief Allocate media requests
+ * \param[in] count Number of requests to allocate
+ * \param[out] requests Vector to store the allocated requests
+ *
+ * Allocate \a count requests from the media device and append them to \a
+ * requests. The requests are meant to be pooled by the caller and reused for
+ * successive frames with MediaRequest::reinit(). The media device shall be
+ * open, which is the case when it has been acquired.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTTY The media device doesn't support the Request API
+ */
+int MediaDevice::allocateRequests(unsigned int count,
+				  std::vector<std::unique_ptr<MediaRequest>> *requests)
+{
+	if (fd_ == -1)
+		return -EBADF;
+
+	for (unsigned int i = 0; i < count; i++) {
+		int fd;
+		int ret = ioctl(fd_, MEDIA_IOC_REQUEST_ALLOC, &fd);
+		if (ret < 0) {
+			ret = -errno;
+			LOG(MediaDevice, Error)
+				<< "Failed to allocate request: " << strerror(-ret);
+			return ret;
+		}
+
+		requests->push_back(std::make_unique<MediaRequest>(fd));
+	}
+
+	return 0;
+}
+
 /**
  * \var MediaDevice::disconnected
  * \brief Signal emitted when the media device is disconnected from the system
@@ -581,6 +632,7 @@ void MediaDevice::clear()
 	objects_.clear();
 	entities_.clear();
 	valid_ = false;
+	linksSynced_ = false;
 }
 
 /**
@@ -821,4 +873,49 @@ int MediaDevice::setupLink(const MediaLink *link, unsigned int flags)
 	return 0;
 }
 
+/**
+ * \brief Refresh the flags of all links from the kernel
+ *
+ * Retrieve the state of the links with a single MEDIA_IOC_G_TOPOLOGY call and
+ * update the cached link flags accordingly. The media graph must not have
+ * changed since it was populated, as links are matched by their object id.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The media graph has changed since it was populated
+ */
+int MediaDevice::syncLinks()
+{
+	std::vector<struct media_v2_link> links(numLinks_);
+	struct media_v2_topology topology = {};
+
+	topology.num_links = links.size();
+	topology.ptr_links = reinterpret_cast<uintptr_t>(links.data());
+
+	int ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, &topology);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to retrieve links: " << strerror(-ret);
+		return ret;
+	}
+
+	if (topology.topology_version != topologyVersion_) {
+		LOG(MediaDevice, Warning)
+			<< "Media graph changed since it was populated";
+		return -ENODEV;
+	}
+
+	for (const struct media_v2_link &mediaLink : links) {
+		if ((mediaLink.flags & MEDIA_LNK_FL_LINK_TYPE) ==
+		    MEDIA_LNK_FL_INTERFACE_LINK)
+			continue;
+
+		MediaLink *link = dynamic_cast<MediaLink *>(object(mediaLink.id));
+		if (link)
+			link->flags_ = mediaLink.flags;
+	}
+
+	return 0;
+}
+
 } /* namespace libcamera */
@@ -117,6 +117,9 @@ LOG_DECLARE_CATEGORY(MediaDevice)
  * Enabling a link establishes a data connection between two pads, while
  * disabling it interrupts that connection.
  *
+ * When the media device is locked, its link flags are known to match the
+ * kernel's, and setting a link to its current state is a no-op.
+ *
  * \return 0 on success or a negative error code otherwise
  */
 int MediaLink::setEnabled(bool enable)
@@ -124,6 +127,9 @@ int MediaLink::setEnabled(bool enable)
 	unsigned int flags = (flags_ & ~MEDIA_LNK_FL_ENABLED)
 			   | (enable ? MEDIA_LNK_FL_ENABLED : 0);
 
+	if (flags == flags_ && dev_->linksSynced_)
+		return 0;
+
 	int ret = dev_->setupLink(this, flags);
 	if (ret)
 		return ret;
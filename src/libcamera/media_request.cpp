@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * media_request.cpp - Media Controller request
+ */
+
+#include "libcamera/internal/media_request.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/media.h>
+
+#include <libcamera/base/event_notifier.h>
+#include <libcamera/base/log.h>
+
+/**
+ * \file media_request.h
+ * \brief Media Controller request
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(MediaDevice)
+
+/**
+ * \class MediaRequest
+ * \brief A Media Controller request
+ *
+ * Media requests bind together buffers and control values for the devices of
+ * a media graph, that the kernel then applies atomically for the same frame.
+ * They are supported by drivers that implement the Media Request API.
+ *
+ * Requests are allocated from the media device with
+ * MediaDevice::allocateRequests(). Control values are added to a request with
+ * V4L2Device::setControls() and buffers with V4L2VideoDevice::queueBuffer(),
+ * passing the request as an argument. The request is then submitted to the
+ * kernel with queue(). When the kernel has completed the request, the
+ * completed signal is emitted. The request can then be reinitialized with
+ * reinit() and reused for a later frame, which avoids allocating a new
+ * request for every frame.
+ */
+
+/**
+ * \brief Construct a MediaRequest
+ * \param[in] fd The request file descriptor
+ *
+ * The MediaRequest takes ownership of \a fd and closes it when destroyed.
+ */
+MediaRequest::MediaRequest(int fd)
+	: fd_(fd)
+{
+	/* The kernel signals request completion with POLLPRI. */
+	notifier_ = new EventNotifier(fd_, EventNotifier::Exception);
+	notifier_->setEnabled(false);
+	notifier_->activated.connect(this, &MediaRequest::requestCompleted);
+}
+
+MediaRequest::~MediaRequest()
+{
+	delete notifier_;
+	::close(fd_);
+}
+
+/**
+ * \fn MediaRequest::fd()
+ * \brief Retrieve the file descriptor of the request
+ * \return The request file descriptor
+ */
+
+/**
+ * \brief Queue the request to the kernel
+ *
+ * The request shall contain at least one buffer. Once queued, the request can't
+ * be modified until it completes.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaRequest::queue()
+{
+	if (::ioctl(fd_, MEDIA_REQUEST_IOC_QUEUE) < 0) {
+		int ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to queue request: " << strerror(-ret);
+		return ret;
+	}
+
+	notifier_->setEnabled(true);
+
+	return 0;
+}
+
+/**
+ * \brief Reinitialize the request for reuse
+ *
+ * Clear the buffers and control values of a request that has completed, or
+ * that hasn't been queued yet, to reuse it for a new frame.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaRequest::reinit()
+{
+	if (::ioctl(fd_, MEDIA_REQUEST_IOC_REINIT) < 0) {
+		int ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to reinitialize request: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \var MediaRequest::completed
+ * \brief Signal emitted when the kernel has completed the request
+ *
+ * The buffers of the request are then ready to be dequeued from their video
+ * devices, and the request can be reinitialized with reinit().
+ */
+
+void MediaRequest::requestCompleted()
+{
+	/*
+	 * The request stays in the completed state, and thus keeps polling
+	 * with POLLPRI, until it's reinitialized.
+	 */
+	notifier_->setEnabled(false);
+
+	completed.emit(this);
+}
+
+} /* namespace libcamera */
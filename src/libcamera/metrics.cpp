@@ -0,0 +1,593 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * metrics.cpp - Runtime metrics registry
+ */
+
+#include "libcamera/internal/metrics.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <sstream>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <libcamera/base/event_notifier.h>
+#include <libcamera/base/log.h>
+
+/**
+ * \file metrics.h
+ * \brief Runtime metrics registry
+ *
+ * libcamera maintains counters, gauges and histograms describing the operation
+ * of the cameras, such as the number of requests and frames processed, the
+ * request latencies, the V4L2 buffer cache misses or the time spent in the IPA
+ * calls. They are always enabled, and cheap enough to be updated on every
+ * frame: updating a metric is a single relaxed atomic operation, without any
+ * lock.
+ *
+ * All metrics register themselves with the MetricsRegistry on construction,
+ * and unregister on destruction. The registry formats the current value of
+ * all metrics in the Prometheus text exposition format, which applications
+ * retrieve with CameraManager::metrics(). When the LIBCAMERA_METRICS_SOCKET
+ * environment variable is set, the CameraManager additionally serves the
+ * metrics on a Unix socket at that path, for collection by monitoring agents
+ * without any change to the application.
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Metrics)
+
+/**
+ * \class Metric
+ * \brief Base class for all metrics
+ *
+ * A metric is identified by its name and labels. Metrics sharing the same name
+ * form a family, and shall have the same type and help text. The labels
+ * distinguish the members of a family, typically with the name of the camera
+ * or device they relate to, and are formatted with label().
+ *
+ * Metric names shall follow the Prometheus naming conventions, with a
+ * libcamera_ prefix, a unit suffix where applicable, and a _total suffix for
+ * counters.
+ */
+
+/**
+ * \enum Metric::Type
+ * \brief The metric type
+ * \var Metric::Type::Counter
+ * \brief A monotonically increasing counter
+ * \var Metric::Type::Gauge
+ * \brief A value that can increase and decrease
+ * \var Metric::Type::Histogram
+ * \brief A distribution of observed values
+ */
+
+/**
+ * \brief Construct a metric
+ * \param[in] type The metric type
+ * \param[in] name The metric name
+ * \param[in] help The metric description
+ * \param[in] labels The metric labels, formatted with label()
+ */
+Metric::Metric(Type type, const std::string &name, const std::string &help,
+	       const std::string &labels)
+	: type_(type), name_(name), help_(help), labels_(labels)
+{
+}
+
+/**
+ * \brief Destroy the metric
+ */
+Metric::~Metric()
+{
+}
+
+/**
+ * \brief Register the metric with the registry
+ *
+ * The registry may format the metric concurrently as soon as it is
+ * registered. Derived classes shall thus call this function at the end of
+ * their constructor, once fully constructed, and unregisterMetric() at the
+ * beginning of their destructor.
+ */
+void Metric::registerMetric()
+{
+	MetricsRegistry::instance()->add(this);
+}
+
+/**
+ * \brief Unregister the metric from the registry
+ */
+void Metric::unregisterMetric()
+{
+	MetricsRegistry::instance()->remove(this);
+}
+
+/**
+ * \brief Format a metric label
+ * \param[in] name The label name
+ * \param[in] value The label value
+ *
+ * Multiple labels are combined by joining them with a comma.
+ *
+ * \return The label, with its value quoted and escaped
+ */
+std::string Metric::label(const std::string &name, const std::string &value)
+{
+	std::string label = name + "=\"";
+
+	for (char c : value) {
+		switch (c) {
+		case '\\':
+			label += "\\\\";
+			break;
+		case '"':
+			label += "\\\"";
+			break;
+		case '\n':
+			label += "\\n";
+			break;
+		default:
+			label += c;
+			break;
+		}
+	}
+
+	return label + "\"";
+}
+
+/**
+ * \fn Metric::type()
+ * \brief Retrieve the metric type
+ * \return The metric type
+ */
+
+/**
+ * \fn Metric::name()
+ * \brief Retrieve the metric name
+ * \return The metric name
+ */
+
+/**
+ * \fn Metric::help()
+ * \brief Retrieve the metric description
+ * \return The metric description
+ */
+
+/**
+ * \fn Metric::labels()
+ * \brief Retrieve the metric labels
+ * \return The metric labels
+ */
+
+namespace {
+
+void formatSample(std::ostream &out, const std::string &name,
+		  const std::string &labels, const std::string &extraLabel,
+		  const std::string &value)
+{
+	out << name;
+
+	if (!labels.empty() || !extraLabel.empty()) {
+		out << "{" << labels;
+		if (!labels.empty() && !extraLabel.empty())
+			out << ",";
+		out << extraLabel << "}";
+	}
+
+	out << " " << value << "\n";
+}
+
+} /* namespace */
+
+/**
+ * \class MetricCounter
+ * \brief A monotonically increasing counter
+ */
+
+/**
+ * \brief Construct a counter
+ * \param[in] name The counter name
+ * \param[in] help The counter description
+ * \param[in] labels The counter labels, formatted with Metric::label()
+ */
+MetricCounter::MetricCounter(const std::string &name, const std::string &help,
+			     const std::string &labels)
+	: Metric(Type::Counter, name, help, labels), value_(0)
+{
+	registerMetric();
+}
+
+/**
+ * \brief Destroy the counter
+ */
+MetricCounter::~MetricCounter()
+{
+	unregisterMetric();
+}
+
+/**
+ * \fn MetricCounter::inc()
+ * \brief Increment the counter
+ * \param[in] value The increment
+ */
+
+/**
+ * \fn MetricCounter::value()
+ * \brief Retrieve the counter value
+ * \return The counter value
+ */
+
+void MetricCounter::format(std::ostream &out) const
+{
+	formatSample(out, name(), labels(), {}, std::to_string(value()));
+}
+
+/**
+ * \class MetricGauge
+ * \brief A value that can increase and decrease
+ */
+
+/**
+ * \brief Construct a gauge
+ * \param[in] name The gauge name
+ * \param[in] help The gauge description
+ * \param[in] labels The gauge labels, formatted with Metric::label()
+ */
+MetricGauge::MetricGauge(const std::string &name, const std::string &help,
+			 const std::string &labels)
+	: Metric(Type::Gauge, name, help, labels), value_(0)
+{
+	registerMetric();
+}
+
+/**
+ * \brief Destroy the gauge
+ */
+MetricGauge::~MetricGauge()
+{
+	unregisterMetric();
+}
+
+/**
+ * \fn MetricGauge::set()
+ * \brief Set the gauge value
+ * \param[in] value The new value
+ */
+
+/**
+ * \fn MetricGauge::add()
+ * \brief Add to the gauge value
+ * \param[in] value The value to add, negative to decrease the gauge
+ */
+
+/**
+ * \fn MetricGauge::value()
+ * \brief Retrieve the gauge value
+ * \return The gauge value
+ */
+
+void MetricGauge::format(std::ostream &out) const
+{
+	formatSample(out, name(), labels(), {}, std::to_string(value()));
+}
+
+/**
+ * \class MetricHistogram
+ * \brief A distribution of observed values
+ *
+ * The histogram counts the observed values in buckets delimited by a fixed
+ * set of upper bounds, and records the number and sum of all observations.
+ */
+
+/**
+ * \class MetricHistogram::Timer
+ * \brief Record the lifetime of the timer, in microseconds, in a histogram
+ *
+ * This helper is meant to measure the duration of a scope, by creating the
+ * timer at the beginning of the scope.
+ */
+
+/**
+ * \fn MetricHistogram::Timer::Timer()
+ * \brief Start a timer
+ * \param[in] histogram The histogram to record the duration in
+ */
+
+/**
+ * \fn MetricHistogram::Timer::~Timer()
+ * \brief Stop the timer and record its duration
+ */
+
+/**
+ * \brief Generate exponentially spaced histogram bucket bounds
+ * \param[in] start The first bound
+ * \param[in] factor The ratio between consecutive bounds
+ * \param[in] count The number of bounds
+ * \return The bucket bounds
+ */
+std::vector<uint64_t> MetricHistogram::exponentialBounds(uint64_t start,
+							 unsigned int factor,
+							 unsigned int count)
+{
+	std::vector<uint64_t> bounds;
+	bounds.reserve(count);
+
+	for (uint64_t bound = start; bounds.size() < count; bound *= factor)
+		bounds.push_back(bound);
+
+	return bounds;
+}
+
+/**
+ * \brief Construct a histogram
+ * \param[in] name The histogram name
+ * \param[in] help The histogram description
+ * \param[in] labels The histogram labels, formatted with Metric::label()
+ * \param[in] bounds The upper bounds of the buckets, in increasing order
+ */
+MetricHistogram::MetricHistogram(const std::string &name, const std::string &help,
+				 const std::string &labels,
+				 const std::vector<uint64_t> &bounds)
+	: Metric(Type::Histogram, name, help, labels), bounds_(bounds),
+	  buckets_(std::make_unique<std::atomic<uint64_t>[]>(bounds.size())),
+	  count_(0), sum_(0)
+{
+	ASSERT(std::is_sorted(bounds_.begin(), bounds_.end()));
+
+	for (unsigned int i = 0; i < bounds_.size(); ++i)
+		buckets_[i].store(0, std::memory_order_relaxed);
+
+	registerMetric();
+}
+
+/**
+ * \brief Destroy the histogram
+ */
+MetricHistogram::~MetricHistogram()
+{
+	unregisterMetric();
+}
+
+/**
+ * \brief Record an observation
+ * \param[in] value The observed value
+ */
+void MetricHistogram::observe(uint64_t value)
+{
+	auto bound = std::lower_bound(bounds_.begin(), bounds_.end(), value);
+	if (bound != bounds_.end())
+		buckets_[bound - bounds_.begin()].fetch_add(1, std::memory_order_relaxed);
+
+	count_.fetch_add(1, std::memory_order_relaxed);
+	sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+/**
+ * \fn MetricHistogram::count()
+ * \brief Retrieve the number of observations
+ * \return The number of observations
+ */
+
+/**
+ * \fn MetricHistogram::sum()
+ * \brief Retrieve the sum of all observations
+ * \return The sum of all observations
+ */
+
+void MetricHistogram::format(std::ostream &out) const
+{
+	uint64_t cumulative = 0;
+
+	for (unsigned int i = 0; i < bounds_.size(); ++i) {
+		cumulative += buckets_[i].load(std::memory_order_relaxed);
+		formatSample(out, name() + "_bucket", labels(),
+			     label("le", std::to_string(bounds_[i])),
+			     std::to_string(cumulative));
+	}
+
+	/*
+	 * The observations are recorded without a lock, the total count may
+	 * thus briefly lag behind the buckets.
+	 */
+	uint64_t total = std::max(count(), cumulative);
+	formatSample(out, name() + "_bucket", labels(), label("le", "+Inf"),
+		     std::to_string(total));
+	formatSample(out, name() + "_sum", labels(), {}, std::to_string(sum()));
+	formatSample(out, name() + "_count", labels(), {}, std::to_string(total));
+}
+
+/**
+ * \class MetricsRegistry
+ * \brief Registry of all the metrics of the process
+ *
+ * The registry keeps track of all the existing metrics. Registration and
+ * formatting are serialized by a mutex, while the metrics are updated
+ * without locking the registry.
+ */
+
+/**
+ * \brief Retrieve the metrics registry
+ * \return The metrics registry
+ */
+MetricsRegistry *MetricsRegistry::instance()
+{
+	/*
+	 * The registry is intentionally never destroyed, to let metrics owned
+	 * by static objects unregister after the end of main().
+	 */
+	static MetricsRegistry *registry = new MetricsRegistry();
+	return registry;
+}
+
+void MetricsRegistry::add(Metric *metric)
+{
+	MutexLocker locker(mutex_);
+	metrics_.push_back(metric);
+}
+
+void MetricsRegistry::remove(Metric *metric)
+{
+	MutexLocker locker(mutex_);
+	metrics_.erase(std::remove(metrics_.begin(), metrics_.end(), metric),
+		       metrics_.end());
+}
+
+/**
+ * \brief Format all metrics in the Prometheus text exposition format
+ *
+ * The metrics are grouped by family, each family being preceded by its HELP
+ * and TYPE comments.
+ *
+ * \return The formatted metrics
+ */
+std::string MetricsRegistry::format() const
+{
+	static const char *const typeNames[] = {
+		"counter",
+		"gauge",
+		"histogram",
+	};
+
+	std::ostringstream out;
+	MutexLocker locker(mutex_);
+
+	std::vector<const Metric *> metrics(metrics_.begin(), metrics_.end());
+	std::stable_sort(metrics.begin(), metrics.end(),
+			 [](const Metric *a, const Metric *b) {
+				 return a->name() < b->name();
+			 });
+
+	const std::string *family = nullptr;
+	for (const Metric *metric : metrics) {
+		if (!family || *family != metric->name()) {
+			family = &metric->name();
+			out << "# HELP " << metric->name() << " " << metric->help() << "\n"
+			    << "# TYPE " << metric->name() << " "
+			    << typeNames[static_cast<unsigned int>(metric->type())] << "\n";
+		}
+
+		metric->format(out);
+	}
+
+	return out.str();
+}
+
+/**
+ * \class MetricsServer
+ * \brief Serve the metrics on a Unix socket
+ *
+ * The server listens on a Unix stream socket, and writes the formatted metrics
+ * to every client that connects before closing the connection. The metrics
+ * can then be collected with standard tools, for instance with
+ * `socat - UNIX-CONNECT:<path>`.
+ *
+ * The server runs in the thread it has been created in, which must run an
+ * event loop.
+ */
+
+/**
+ * \brief Construct a MetricsServer
+ */
+MetricsServer::MetricsServer()
+	: fd_(-1)
+{
+}
+
+/**
+ * \brief Stop serving the metrics and remove the socket
+ */
+MetricsServer::~MetricsServer()
+{
+	notifier_.reset();
+
+	if (fd_ < 0)
+		return;
+
+	::close(fd_);
+	unlink(path_.c_str());
+}
+
+/**
+ * \brief Listen for connections on a Unix socket
+ * \param[in] path The socket path
+ *
+ * Any existing file at \a path is replaced.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MetricsServer::listen(const std::string &path)
+{
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+
+	if (path.empty() || path.size() >= sizeof(addr.sun_path))
+		return -EINVAL;
+
+	path.copy(addr.sun_path, path.size());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	unlink(path.c_str());
+
+	if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+	    ::listen(fd, 4) < 0) {
+		int ret = -errno;
+		LOG(Metrics, Error)
+			<< "Failed to listen on " << path << ": " << strerror(-ret);
+		::close(fd);
+		return ret;
+	}
+
+	fd_ = fd;
+	path_ = path;
+
+	notifier_ = std::make_unique<EventNotifier>(fd_, EventNotifier::Read);
+	notifier_->activated.connect(this, &MetricsServer::connectionRequested);
+
+	LOG(Metrics, Info) << "Serving metrics on " << path;
+
+	return 0;
+}
+
+void MetricsServer::connectionRequested()
+{
+	int fd = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	/* Don't let a stalled client block the event loop. */
+	struct timeval timeout = { 0, 100000 };
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	std::string metrics = MetricsRegistry::instance()->format();
+	const char *data = metrics.data();
+	size_t size = metrics.size();
+
+	while (size) {
+		ssize_t ret = send(fd, data, size, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			LOG(Metrics, Debug) << "Failed to send metrics: "
+					    << strerror(errno);
+			break;
+		}
+
+		data += ret;
+		size -= ret;
+	}
+
+	::close(fd);
+}
+
+} /* namespace libcamera */
@@ -336,16 +336,22 @@ int CIO2Device::exportBuffers(unsigned int count,
 	return output_->exportBuffers(count, buffers);
 }
 
-int CIO2Device::start()
+int CIO2Device::start(unsigned int bufferCount)
 {
-	int ret = output_->exportBuffers(kBufferCount, &buffers_);
-	if (ret < 0)
-		return ret;
+	int ret;
 
-	ret = output_->importBuffers(kBufferCount);
-	if (ret)
-		LOG(IPU3, Error) << "Failed to import CIO2 buffers";
+	/* Buffers may have been kept allocated by a previous stop(). */
+	if (buffers_.empty()) {
+		ret = output_->exportBuffers(bufferCount, &buffers_);
+		if (ret < 0)
+			return ret;
+
+		ret = output_->importBuffers(bufferCount);
+		if (ret)
+			LOG(IPU3, Error) << "Failed to import CIO2 buffers";
+	}
 
+	availableBuffers_ = {};
 	for (std::unique_ptr<FrameBuffer> &buffer : buffers_)
 		availableBuffers_.push(buffer.get());
 
@@ -372,7 +378,7 @@ int CIO2Device::stop()
 
 	ret = output_->streamOff();
 
-	freeBuffers();
+	availableBuffers_ = {};
 
 	return ret;
 }
@@ -420,6 +426,9 @@ void CIO2Device::tryReturnBuffer(FrameBuffer *buffer)
 
 void CIO2Device::freeBuffers()
 {
+	if (buffers_.empty())
+		return;
+
 	availableBuffers_ = {};
 	buffers_.clear();
 
@@ -7,6 +7,8 @@
 
 #include "frames.h"
 
+#include <algorithm>
+
 #include <libcamera/framebuffer.h>
 #include <libcamera/request.h>
 
@@ -14,6 +16,8 @@
 #include "libcamera/internal/pipeline_handler.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
+#include "imgu.h"
+
 namespace libcamera {
 
 LOG_DECLARE_CATEGORY(IPU3)
@@ -22,71 +26,97 @@ IPU3Frames::IPU3Frames()
 {
 }
 
-void IPU3Frames::init(const std::vector<std::unique_ptr<FrameBuffer>> &paramBuffers,
-		      const std::vector<std::unique_ptr<FrameBuffer>> &statBuffers)
+void IPU3Frames::init(const std::vector<ImgUDevice *> &imgus)
 {
-	for (const std::unique_ptr<FrameBuffer> &buffer : paramBuffers)
-		availableParamBuffers_.push(buffer.get());
+	unsigned int frames = 0;
 
-	for (const std::unique_ptr<FrameBuffer> &buffer : statBuffers)
-		availableStatBuffers_.push(buffer.get());
+	/*
+	 * Each ImgU in use by the camera contributes its own parameters and
+	 * statistics buffers, which can only be queued to that ImgU.
+	 */
+	for (ImgUDevice *imgu : imgus) {
+		BufferPool &pool = pools_[imgu];
 
-	frameInfo_.clear();
+		for (const std::unique_ptr<FrameBuffer> &buffer : imgu->paramBuffers_)
+			pool.paramBuffers.push(buffer.get());
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : imgu->statBuffers_)
+			pool.statBuffers.push(buffer.get());
+
+		frames += std::min(imgu->paramBuffers_.size(),
+				   imgu->statBuffers_.size());
+	}
+
+	/*
+	 * The number of frames in flight is bounded by the number of
+	 * parameters and statistics buffers.
+	 */
+	frameInfo_.reset(frames);
 }
 
 void IPU3Frames::clear()
 {
-	availableParamBuffers_ = {};
-	availableStatBuffers_ = {};
+	pools_.clear();
+
+	frameInfo_.clear();
 }
 
-IPU3Frames::Info *IPU3Frames::create(Request *request)
+IPU3Frames::Info *IPU3Frames::create(Request *request, ImgUDevice *imgu)
 {
 	unsigned int id = request->sequence();
+	BufferPool &pool = pools_[imgu];
 
-	if (availableParamBuffers_.empty()) {
+	if (pool.paramBuffers.empty()) {
 		LOG(IPU3, Debug) << "Parameters buffer underrun";
 		return nullptr;
 	}
 
-	if (availableStatBuffers_.empty()) {
+	if (pool.statBuffers.empty()) {
 		LOG(IPU3, Debug) << "Statistics buffer underrun";
 		return nullptr;
 	}
 
-	FrameBuffer *paramBuffer = availableParamBuffers_.front();
-	FrameBuffer *statBuffer = availableStatBuffers_.front();
+	/*
+	 * Frames can complete out of order, the slot for this frame may still
+	 * be used by an older frame.
+	 */
+	Info *info = frameInfo_.alloc(id);
+	if (!info) {
+		LOG(IPU3, Debug) << "Frame tracking underrun";
+		return nullptr;
+	}
+
+	FrameBuffer *paramBuffer = pool.paramBuffers.front();
+	FrameBuffer *statBuffer = pool.statBuffers.front();
 
 	paramBuffer->_d()->setRequest(request);
 	statBuffer->_d()->setRequest(request);
 
-	availableParamBuffers_.pop();
-	availableStatBuffers_.pop();
-
-	/* \todo Remove the dynamic allocation of Info */
-	std::unique_ptr<Info> info = std::make_unique<Info>();
+	pool.paramBuffers.pop();
+	pool.statBuffers.pop();
 
 	info->id = id;
 	info->request = request;
+	info->imgu = imgu;
 	info->rawBuffer = nullptr;
 	info->paramBuffer = paramBuffer;
 	info->statBuffer = statBuffer;
+	info->effectiveSensorControls.clear();
 	info->paramDequeued = false;
 	info->metadataProcessed = false;
 
-	frameInfo_[id] = std::move(info);
-
-	return frameInfo_[id].get();
+	return info;
 }
 
 void IPU3Frames::remove(IPU3Frames::Info *info)
 {
 	/* Return params and stat buffer for reuse. */
-	availableParamBuffers_.push(info->paramBuffer);
-	availableStatBuffers_.push(info->statBuffer);
+	BufferPool &pool = pools_[info->imgu];
+	pool.paramBuffers.push(info->paramBuffer);
+	pool.statBuffers.push(info->statBuffer);
 
-	/* Delete the extended frame information. */
-	frameInfo_.erase(info->id);
+	/* Release the extended frame information. */
+	frameInfo_.release(info->id);
 }
 
 bool IPU3Frames::tryComplete(IPU3Frames::Info *info)
@@ -111,10 +141,9 @@ bool IPU3Frames::tryComplete(IPU3Frames::Info *info)
 
 IPU3Frames::Info *IPU3Frames::find(unsigned int id)
 {
-	const auto &itInfo = frameInfo_.find(id);
-
-	if (itInfo != frameInfo_.end())
-		return itInfo->second.get();
+	Info *info = frameInfo_.get(id);
+	if (info)
+		return info;
 
 	LOG(IPU3, Fatal) << "Can't find tracking information for frame " << id;
 
@@ -123,15 +152,15 @@ IPU3Frames::Info *IPU3Frames::find(unsigned int id)
 
 IPU3Frames::Info *IPU3Frames::find(FrameBuffer *buffer)
 {
-	for (auto const &itInfo : frameInfo_) {
-		Info *info = itInfo.second.get();
-
-		for (auto const itBuffers : info->request->buffers())
-			if (itBuffers.second == buffer)
-				return info;
-
-		if (info->rawBuffer == buffer || info->paramBuffer == buffer ||
-		    info->statBuffer == buffer)
+	/*
+	 * All buffers tracked by a frame are associated with its request,
+	 * either by the application for request buffers, or when allocating
+	 * internal buffers. Use the request sequence to look up the frame.
+	 */
+	Request *request = buffer->request();
+	if (request) {
+		Info *info = frameInfo_.get(request->sequence());
+		if (info && info->request == request)
 			return info;
 	}
 
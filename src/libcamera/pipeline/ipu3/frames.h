@@ -16,10 +16,13 @@
 
 #include <libcamera/controls.h>
 
+#include "libcamera/internal/frame_context_ring.h"
+
 namespace libcamera {
 
 class FrameBuffer;
 class IPAProxy;
+class ImgUDevice;
 class PipelineHandler;
 class Request;
 class V4L2VideoDevice;
@@ -31,6 +34,7 @@ public:
 	struct Info {
 		unsigned int id;
 		Request *request;
+		ImgUDevice *imgu;
 
 		FrameBuffer *rawBuffer;
 		FrameBuffer *paramBuffer;
@@ -44,11 +48,10 @@ public:
 
 	IPU3Frames();
 
-	void init(const std::vector<std::unique_ptr<FrameBuffer>> &paramBuffers,
-		  const std::vector<std::unique_ptr<FrameBuffer>> &statBuffers);
+	void init(const std::vector<ImgUDevice *> &imgus);
 	void clear();
 
-	Info *create(Request *request);
+	Info *create(Request *request, ImgUDevice *imgu);
 	void remove(Info *info);
 	bool tryComplete(Info *info);
 
@@ -58,10 +61,14 @@ public:
 	Signal<> bufferAvailable;
 
 private:
-	std::queue<FrameBuffer *> availableParamBuffers_;
-	std::queue<FrameBuffer *> availableStatBuffers_;
+	struct BufferPool {
+		std::queue<FrameBuffer *> paramBuffers;
+		std::queue<FrameBuffer *> statBuffers;
+	};
+
+	std::map<ImgUDevice *, BufferPool> pools_;
 
-	std::map<unsigned int, std::unique_ptr<Info>> frameInfo_;
+	FrameContextRing<Info> frameInfo_;
 };
 
 } /* namespace libcamera */
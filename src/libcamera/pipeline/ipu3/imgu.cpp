@@ -14,6 +14,7 @@
 #include <linux/media-bus-format.h>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
 #include <libcamera/base/utils.h>
 
 #include <libcamera/formats.h>
@@ -53,7 +54,11 @@ const std::vector<float> gdcScalingFactors = {
 	14.25, 14.5, 14.75, 15, 15.25, 15.5, 15.75, 16,
 };
 
-std::vector<ImgUDevice::PipeConfig> pipeConfigs;
+/*
+ * Margin applied to the field of view bounds when pruning the search, to
+ * account for rounding errors between the bounds and calcFOV().
+ */
+constexpr float kFOVMargin = 1e-4;
 
 struct FOV {
 	float w;
@@ -105,8 +110,80 @@ bool isSameRatio(const Size &in, const Size &out)
 	return true;
 }
 
-void calculateBDSHeight(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc,
-			unsigned int bdsWidth, float bdsSF)
+FOV calcFOV(const Size &in, const ImgUDevice::PipeConfig &pipe)
+{
+	FOV fov{};
+
+	float inW = static_cast<float>(in.width);
+	float inH = static_cast<float>(in.height);
+	float ifCropW = static_cast<float>(in.width - pipe.iif.width);
+	float ifCropH = static_cast<float>(in.height - pipe.iif.height);
+	float gdcCropW = static_cast<float>(pipe.bds.width - pipe.gdc.width) * pipe.bds_sf;
+	float gdcCropH = static_cast<float>(pipe.bds.height - pipe.gdc.height) * pipe.bds_sf;
+
+	fov.w = (inW - (ifCropW + gdcCropW)) / inW;
+	fov.h = (inH - (ifCropH + gdcCropH)) / inH;
+
+	return fov;
+}
+
+/*
+ * Keep the largest field of view pipe configuration found by the search. The
+ * first of equivalent configurations is kept, as the search order prefers the
+ * smallest crops.
+ */
+class PipeConfigSearch
+{
+public:
+	PipeConfigSearch(const Size &input)
+		: input_(input), found_(false)
+	{
+	}
+
+	void add(const ImgUDevice::PipeConfig &config)
+	{
+		FOV fov = calcFOV(input_, config);
+		if (found_ && !fov.isLarger(bestFov_))
+			return;
+
+		best_ = config;
+		bestFov_ = fov;
+		found_ = true;
+	}
+
+	/*
+	 * The horizontal field of view of a configuration is
+	 * gdc.width * bds_sf / input.width, as the BDS output width is
+	 * iif.width / bds_sf. It is also bounded by the IF width, as the BDS
+	 * output is at least 2 * kFilterWidth larger than the GDC. A candidate
+	 * whose bound is below the best horizontal field of view can't
+	 * improve the result.
+	 */
+	bool canImproveBDS(const Size &gdc, float bdsSF) const
+	{
+		return !found_ ||
+		       gdc.width * bdsSF / input_.width >= bestFov_.w - kFOVMargin;
+	}
+
+	bool canImproveIF(unsigned int ifWidth) const
+	{
+		float width = static_cast<float>(ifWidth) - ImgUDevice::kFilterWidth * 2;
+		return !found_ || width / input_.width >= bestFov_.w - kFOVMargin;
+	}
+
+	bool found() const { return found_; }
+	const ImgUDevice::PipeConfig &best() const { return best_; }
+
+private:
+	const Size &input_;
+	ImgUDevice::PipeConfig best_;
+	FOV bestFov_;
+	bool found_;
+};
+
+void calculateBDSHeight(PipeConfigSearch &search, ImgUDevice::Pipe *pipe,
+			const Size &iif, const Size &gdc, unsigned int bdsWidth,
+			float bdsSF)
 {
 	unsigned int minIFHeight = iif.height - ImgUDevice::kIFMaxCropHeight;
 	unsigned int minBDSHeight = gdc.height + ImgUDevice::kFilterHeight * 2;
@@ -158,8 +235,8 @@ void calculateBDSHeight(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc
 		if (foundIfHeight) {
 			unsigned int bdsIntHeight = static_cast<unsigned int>(bdsHeight);
 
-			pipeConfigs.push_back({ bdsSF, { iif.width, foundIfHeight },
-						{ bdsWidth, bdsIntHeight }, gdc });
+			search.add({ bdsSF, { iif.width, foundIfHeight },
+				     { bdsWidth, bdsIntHeight }, gdc });
 			return;
 		}
 	} else {
@@ -172,8 +249,8 @@ void calculateBDSHeight(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc
 
 				if (!(ifHeight % ImgUDevice::kIFAlignHeight) &&
 				    !(bdsIntHeight % ImgUDevice::kBDSAlignHeight)) {
-					pipeConfigs.push_back({ bdsSF, { iif.width, ifHeight },
-								{ bdsWidth, bdsIntHeight }, gdc });
+					search.add({ bdsSF, { iif.width, ifHeight },
+						     { bdsWidth, bdsIntHeight }, gdc });
 				}
 			}
 
@@ -182,13 +259,24 @@ void calculateBDSHeight(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc
 	}
 }
 
-void calculateBDS(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc, float bdsSF)
+void calculateBDS(PipeConfigSearch &search, ImgUDevice::Pipe *pipe,
+		  const Size &iif, const Size &gdc, float bdsSF)
 {
 	unsigned int minBDSWidth = gdc.width + ImgUDevice::kFilterWidth * 2;
 	unsigned int minBDSHeight = gdc.height + ImgUDevice::kFilterHeight * 2;
 
+	/*
+	 * The field of view grows with the BDS scaling factor, skip the
+	 * factors that can't improve the best configuration when scaling up,
+	 * and stop when scaling down.
+	 */
 	float sf = bdsSF;
 	while (sf <= ImgUDevice::kBDSSfMax && sf >= ImgUDevice::kBDSSfMin) {
+		if (!search.canImproveBDS(gdc, sf)) {
+			sf += ImgUDevice::kBDSSfStep;
+			continue;
+		}
+
 		float bdsWidth = static_cast<float>(iif.width) / sf;
 		float bdsHeight = static_cast<float>(iif.height) / sf;
 
@@ -198,7 +286,7 @@ void calculateBDS(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc, floa
 			unsigned int bdsIntHeight = static_cast<unsigned int>(bdsHeight);
 			if (!(bdsIntWidth % ImgUDevice::kBDSAlignWidth) && bdsWidth >= minBDSWidth &&
 			    !(bdsIntHeight % ImgUDevice::kBDSAlignHeight) && bdsHeight >= minBDSHeight)
-				calculateBDSHeight(pipe, iif, gdc, bdsIntWidth, sf);
+				calculateBDSHeight(search, pipe, iif, gdc, bdsIntWidth, sf);
 		}
 
 		sf += ImgUDevice::kBDSSfStep;
@@ -206,6 +294,9 @@ void calculateBDS(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc, floa
 
 	sf = bdsSF;
 	while (sf <= ImgUDevice::kBDSSfMax && sf >= ImgUDevice::kBDSSfMin) {
+		if (!search.canImproveBDS(gdc, sf))
+			break;
+
 		float bdsWidth = static_cast<float>(iif.width) / sf;
 		float bdsHeight = static_cast<float>(iif.height) / sf;
 
@@ -215,7 +306,7 @@ void calculateBDS(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc, floa
 			unsigned int bdsIntHeight = static_cast<unsigned int>(bdsHeight);
 			if (!(bdsIntWidth % ImgUDevice::kBDSAlignWidth) && bdsWidth >= minBDSWidth &&
 			    !(bdsIntHeight % ImgUDevice::kBDSAlignHeight) && bdsHeight >= minBDSHeight)
-				calculateBDSHeight(pipe, iif, gdc, bdsIntWidth, sf);
+				calculateBDSHeight(search, pipe, iif, gdc, bdsIntWidth, sf);
 		}
 
 		sf -= ImgUDevice::kBDSSfStep;
@@ -254,21 +345,78 @@ Size calculateGDC(ImgUDevice::Pipe *pipe)
 	return gdc;
 }
 
-FOV calcFOV(const Size &in, const ImgUDevice::PipeConfig &pipe)
+ImgUDevice::PipeConfig searchPipeConfig(ImgUDevice::Pipe *pipe)
 {
-	FOV fov{};
+	LOG(IPU3, Debug) << "Calculating pipe configuration for: ";
+	LOG(IPU3, Debug) << "input: " << pipe->input.toString();
+	LOG(IPU3, Debug) << "main: " << pipe->main.toString();
+	LOG(IPU3, Debug) << "vf: " << pipe->viewfinder.toString();
 
-	float inW = static_cast<float>(in.width);
-	float inH = static_cast<float>(in.height);
-	float ifCropW = static_cast<float>(in.width - pipe.iif.width);
-	float ifCropH = static_cast<float>(in.height - pipe.iif.height);
-	float gdcCropW = static_cast<float>(pipe.bds.width - pipe.gdc.width) * pipe.bds_sf;
-	float gdcCropH = static_cast<float>(pipe.bds.height - pipe.gdc.height) * pipe.bds_sf;
+	const Size &in = pipe->input;
 
-	fov.w = (inW - (ifCropW + gdcCropW)) / inW;
-	fov.h = (inH - (ifCropH + gdcCropH)) / inH;
+	/*
+	 * \todo Filter out all resolutions < IF_CROP_MAX.
+	 * See https://bugs.libcamera.org/show_bug.cgi?id=32
+	 */
+	if (in.width < ImgUDevice::kIFMaxCropWidth || in.height < ImgUDevice::kIFMaxCropHeight) {
+		LOG(IPU3, Error) << "Input resolution " << in.toString()
+				 << " not supported";
+		return {};
+	}
 
-	return fov;
+	Size gdc = calculateGDC(pipe);
+	PipeConfigSearch search(in);
+
+	float bdsSF = static_cast<float>(in.width) / gdc.width;
+	float sf = findScaleFactor(bdsSF, bdsScalingFactors, true);
+
+	/* Search the configurations by scaling width and height. */
+	unsigned int ifWidth = utils::alignUp(in.width, ImgUDevice::kIFAlignWidth);
+	unsigned int ifHeight = utils::alignUp(in.height, ImgUDevice::kIFAlignHeight);
+	unsigned int minIfWidth = in.width - ImgUDevice::kIFMaxCropWidth;
+	unsigned int minIfHeight = in.height - ImgUDevice::kIFMaxCropHeight;
+	while (ifWidth >= minIfWidth && search.canImproveIF(ifWidth)) {
+		while (ifHeight >= minIfHeight) {
+			Size iif{ ifWidth, ifHeight };
+			calculateBDS(search, pipe, iif, gdc, sf);
+			ifHeight -= ImgUDevice::kIFAlignHeight;
+		}
+
+		ifWidth -= ImgUDevice::kIFAlignWidth;
+	}
+
+	/* Repeat search by scaling width first. */
+	ifWidth = utils::alignUp(in.width, ImgUDevice::kIFAlignWidth);
+	ifHeight = utils::alignUp(in.height, ImgUDevice::kIFAlignHeight);
+	minIfWidth = in.width - ImgUDevice::kIFMaxCropWidth;
+	minIfHeight = in.height - ImgUDevice::kIFMaxCropHeight;
+	while (ifHeight >= minIfHeight) {
+		/*
+		 * \todo This procedure is probably broken:
+		 * https://github.com/intel/intel-ipu3-pipecfg/issues/2
+		 */
+		while (ifWidth >= minIfWidth && search.canImproveIF(ifWidth)) {
+			Size iif{ ifWidth, ifHeight };
+			calculateBDS(search, pipe, iif, gdc, sf);
+			ifWidth -= ImgUDevice::kIFAlignWidth;
+		}
+
+		ifHeight -= ImgUDevice::kIFAlignHeight;
+	}
+
+	if (!search.found()) {
+		LOG(IPU3, Error) << "Failed to calculate pipe configuration";
+		return {};
+	}
+
+	const ImgUDevice::PipeConfig &best = search.best();
+
+	LOG(IPU3, Debug) << "Computed pipe configuration: ";
+	LOG(IPU3, Debug) << "IF: " << best.iif.toString();
+	LOG(IPU3, Debug) << "BDS: " << best.bds.toString();
+	LOG(IPU3, Debug) << "GDC: " << best.gdc.toString();
+
+	return best;
 }
 
 } /* namespace */
@@ -372,99 +520,54 @@ int ImgUDevice::init(MediaDevice *media, unsigned int index)
 	if (ret)
 		return ret;
 
+	/*
+	 * The IPA only reads statistics and writes parameters, skip the
+	 * unneeded cache maintenance operations.
+	 */
+	param_->setCacheHint(V4L2VideoDevice::CacheHint::CpuWrite);
+	stat_->setCacheHint(V4L2VideoDevice::CacheHint::CpuRead);
+
 	return 0;
 }
 
 /**
  * \brief Calculate the ImgU pipe configuration parameters
  * \param[in] pipe The requested ImgU configuration
+ *
+ * The configuration is searched for among the IF, BDS and GDC sizes that the
+ * ImgU supports, skipping the candidates that can't improve the field of view
+ * of the best configuration found so far. As validating a camera
+ * configuration calculates the same pipe configurations repeatedly, the
+ * results are cached per input, main and viewfinder sizes.
+ *
+ * This function is thread-safe.
+ *
  * \return An ImgUDevice::PipeConfig instance on success, an empty configuration
  * otherwise
  */
 ImgUDevice::PipeConfig ImgUDevice::calculatePipeConfig(Pipe *pipe)
 {
-	pipeConfigs.clear();
-
-	LOG(IPU3, Debug) << "Calculating pipe configuration for: ";
-	LOG(IPU3, Debug) << "input: " << pipe->input.toString();
-	LOG(IPU3, Debug) << "main: " << pipe->main.toString();
-	LOG(IPU3, Debug) << "vf: " << pipe->viewfinder.toString();
-
-	const Size &in = pipe->input;
-
-	/*
-	 * \todo Filter out all resolutions < IF_CROP_MAX.
-	 * See https://bugs.libcamera.org/show_bug.cgi?id=32
-	 */
-	if (in.width < ImgUDevice::kIFMaxCropWidth || in.height < ImgUDevice::kIFMaxCropHeight) {
-		LOG(IPU3, Error) << "Input resolution " << in.toString()
-				 << " not supported";
-		return {};
-	}
-
-	Size gdc = calculateGDC(pipe);
-
-	float bdsSF = static_cast<float>(in.width) / gdc.width;
-	float sf = findScaleFactor(bdsSF, bdsScalingFactors, true);
-
-	/* Populate the configurations vector by scaling width and height. */
-	unsigned int ifWidth = utils::alignUp(in.width, ImgUDevice::kIFAlignWidth);
-	unsigned int ifHeight = utils::alignUp(in.height, ImgUDevice::kIFAlignHeight);
-	unsigned int minIfWidth = in.width - ImgUDevice::kIFMaxCropWidth;
-	unsigned int minIfHeight = in.height - ImgUDevice::kIFMaxCropHeight;
-	while (ifWidth >= minIfWidth) {
-		while (ifHeight >= minIfHeight) {
-			Size iif{ ifWidth, ifHeight };
-			calculateBDS(pipe, iif, gdc, sf);
-			ifHeight -= ImgUDevice::kIFAlignHeight;
-		}
-
-		ifWidth -= ImgUDevice::kIFAlignWidth;
-	}
+	const auto key = std::make_tuple(pipe->input, pipe->main, pipe->viewfinder);
 
-	/* Repeat search by scaling width first. */
-	ifWidth = utils::alignUp(in.width, ImgUDevice::kIFAlignWidth);
-	ifHeight = utils::alignUp(in.height, ImgUDevice::kIFAlignHeight);
-	minIfWidth = in.width - ImgUDevice::kIFMaxCropWidth;
-	minIfHeight = in.height - ImgUDevice::kIFMaxCropHeight;
-	while (ifHeight >= minIfHeight) {
-		/*
-		 * \todo This procedure is probably broken:
-		 * https://github.com/intel/intel-ipu3-pipecfg/issues/2
-		 */
-		while (ifWidth >= minIfWidth) {
-			Size iif{ ifWidth, ifHeight };
-			calculateBDS(pipe, iif, gdc, sf);
-			ifWidth -= ImgUDevice::kIFAlignWidth;
-		}
+	{
+		MutexLocker locker(pipeConfigsMutex_);
 
-		ifHeight -= ImgUDevice::kIFAlignHeight;
+		auto it = pipeConfigs_.find(key);
+		if (it != pipeConfigs_.end())
+			return it->second;
 	}
 
-	if (pipeConfigs.size() == 0) {
-		LOG(IPU3, Error) << "Failed to calculate pipe configuration";
-		return {};
-	}
+	PipeConfig pipeConfig = searchPipeConfig(pipe);
 
-	FOV bestFov = calcFOV(pipe->input, pipeConfigs[0]);
-	unsigned int bestIndex = 0;
-	unsigned int p = 0;
-	for (auto pipeConfig : pipeConfigs) {
-		FOV fov = calcFOV(pipe->input, pipeConfig);
-		if (fov.isLarger(bestFov)) {
-			bestFov = fov;
-			bestIndex = p;
-		}
+	MutexLocker locker(pipeConfigsMutex_);
 
-		++p;
-	}
+	/* Applications only use a handful of configurations, keep it simple. */
+	if (pipeConfigs_.size() >= kMaxCachedPipeConfigs)
+		pipeConfigs_.clear();
 
-	LOG(IPU3, Debug) << "Computed pipe configuration: ";
-	LOG(IPU3, Debug) << "IF: " << pipeConfigs[bestIndex].iif.toString();
-	LOG(IPU3, Debug) << "BDS: " << pipeConfigs[bestIndex].bds.toString();
-	LOG(IPU3, Debug) << "GDC: " << pipeConfigs[bestIndex].gdc.toString();
+	pipeConfigs_[key] = pipeConfig;
 
-	return pipeConfigs[bestIndex];
+	return pipeConfig;
 }
 
 /**
@@ -7,8 +7,12 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
 #include <string>
+#include <tuple>
+
+#include <libcamera/base/thread.h>
 
 #include "libcamera/internal/v4l2_subdevice.h"
 #include "libcamera/internal/v4l2_videodevice.h"
@@ -117,8 +121,13 @@ private:
 				 const StreamConfiguration &cfg,
 				 V4L2DeviceFormat *outputFormat);
 
+	static constexpr unsigned int kMaxCachedPipeConfigs = 32;
+
 	std::string name_;
 	MediaDevice *media_;
+
+	Mutex pipeConfigsMutex_;
+	std::map<std::tuple<Size, Size, Size>, PipeConfig> pipeConfigs_;
 };
 
 } /* namespace libcamera */
@@ -11,6 +11,7 @@
 #include <queue>
 #include <vector>
 
+#include <libcamera/base/global_configuration.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/utils.h>
 
@@ -19,15 +20,19 @@
 #include <libcamera/formats.h>
 #include <libcamera/ipa/ipu3_ipa_interface.h>
 #include <libcamera/ipa/ipu3_ipa_proxy.h>
+#include <libcamera/ipa/ipu3_ipa_serializer.h>
 #include <libcamera/property_ids.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
 #include "libcamera/internal/camera.h"
 #include "libcamera/internal/camera_sensor.h"
+#include "libcamera/internal/control_serializer.h"
 #include "libcamera/internal/delayed_controls.h"
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/ipa_manager.h"
+#include "libcamera/internal/ipa_recorder.h"
+#include "libcamera/internal/mapped_framebuffer.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
 
@@ -47,12 +52,17 @@ class IPU3CameraData : public Camera::Private
 {
 public:
 	IPU3CameraData(PipelineHandler *pipe)
-		: Camera::Private(pipe), supportsFlips_(false)
+		: Camera::Private(pipe), imgu_(nullptr), stillImgu_(nullptr),
+		  supportsFlips_(false), keepAllocations_(false),
+		  buffersAllocated_(false)
 	{
 	}
 
 	int loadIPA();
 
+	void connectImgU(ImgUDevice *imgu);
+	std::vector<ImgUDevice *> imgus() const;
+
 	void imguOutputBufferReady(FrameBuffer *buffer);
 	void cio2BufferReady(FrameBuffer *buffer);
 	void paramBufferReady(FrameBuffer *buffer);
@@ -60,8 +70,14 @@ public:
 	void queuePendingRequests();
 	void cancelPendingRequests();
 
+	void processIPAEvent(const ipa::ipu3::IPU3Event &ev,
+			     FrameBuffer *buffer = nullptr);
+	void recordIPA(IPARecorder::RecordType type,
+		       const std::vector<std::vector<uint8_t>> &fields = {});
+
 	CIO2Device cio2_;
 	ImgUDevice *imgu_;
+	ImgUDevice *stillImgu_;
 
 	Stream outStream_;
 	Stream vfStream_;
@@ -71,11 +87,17 @@ public:
 	bool supportsFlips_;
 	Transform rotationTransform_;
 
+	bool keepAllocations_;
+	bool buffersAllocated_;
+
 	std::unique_ptr<DelayedControls> delayedCtrls_;
 	IPU3Frames frameInfos_;
 
 	std::unique_ptr<ipa::ipu3::IPAProxyIPU3> ipa_;
 
+	IPARecorder ipaRecorder_;
+	std::unique_ptr<ControlSerializer> ipaRecordSerializer_;
+
 	std::queue<Request *> pendingRequests_;
 
 	ControlInfoMap ipaControls_;
@@ -89,6 +111,8 @@ class IPU3CameraConfiguration : public CameraConfiguration
 {
 public:
 	static constexpr unsigned int kBufferCount = 4;
+	static constexpr unsigned int kMinBufferCount = 2;
+	static constexpr unsigned int kMaxBufferCount = 8;
 	static constexpr unsigned int kMaxStreams = 3;
 
 	IPU3CameraConfiguration(IPU3CameraData *data);
@@ -102,6 +126,8 @@ public:
 	Transform combinedTransform_;
 
 private:
+	Status validateConfiguration();
+
 	/*
 	 * The IPU3CameraData instance is guaranteed to be valid as long as the
 	 * corresponding Camera instance is valid. In order to borrow a
@@ -135,6 +161,7 @@ public:
 
 	int start(Camera *camera, const ControlList *controls) override;
 	void stop(Camera *camera) override;
+	void releaseDevice(Camera *camera) override;
 
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
@@ -150,6 +177,12 @@ private:
 	int updateControls(IPU3CameraData *data);
 	int registerCameras();
 
+	int configureImgU(ImgUDevice *imgu,
+			  const ImgUDevice::PipeConfig &pipeConfig,
+			  V4L2DeviceFormat *cio2Format,
+			  const StreamConfiguration *mainCfg,
+			  const StreamConfiguration *vfCfg);
+
 	int allocateBuffers(Camera *camera);
 	int freeBuffers(Camera *camera);
 
@@ -168,6 +201,13 @@ IPU3CameraConfiguration::IPU3CameraConfiguration(IPU3CameraData *data)
 }
 
 CameraConfiguration::Status IPU3CameraConfiguration::validate()
+{
+	return data_->configurationCache()->validate(this, [this]() {
+		return validateConfiguration();
+	});
+}
+
+CameraConfiguration::Status IPU3CameraConfiguration::validateConfiguration()
 {
 	Status status = Valid;
 
@@ -291,6 +331,15 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 	if (!cio2Configuration_.pixelFormat.isValid())
 		return Invalid;
 
+	/*
+	 * All streams share the pipeline depth, which bounds the number of
+	 * internal raw, parameters and statistics buffers.
+	 */
+	if (pipelineDepth)
+		cio2Configuration_.bufferCount = std::clamp(pipelineDepth,
+							    kMinBufferCount,
+							    kMaxBufferCount);
+
 	LOG(IPU3, Debug) << "CIO2 configuration: " << cio2Configuration_.toString();
 
 	ImgUDevice::Pipe pipe{};
@@ -356,7 +405,7 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 					      ImgUDevice::kOutputAlignHeight);
 
 			cfg->pixelFormat = formats::NV12;
-			cfg->bufferCount = kBufferCount;
+			cfg->bufferCount = cio2Configuration_.bufferCount;
 			cfg->stride = info.stride(cfg->size.width, 0, 1);
 			cfg->frameSize = info.frameSize(cfg->size, 1);
 
@@ -385,6 +434,10 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 			}
 		}
 
+		/* \todo Support buffer layout constraints. */
+		if (resetBufferConstraints(cfg))
+			status = Adjusted;
+
 		if (cfg->pixelFormat != originalCfg.pixelFormat ||
 		    cfg->size != originalCfg.size) {
 			LOG(IPU3, Debug)
@@ -508,10 +561,17 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	Stream *outStream = &data->outStream_;
 	Stream *vfStream = &data->vfStream_;
 	CIO2Device *cio2 = &data->cio2_;
-	ImgUDevice *imgu = data->imgu_;
-	V4L2DeviceFormat outputFormat;
 	int ret;
 
+	/*
+	 * Formats can't be changed while buffers are allocated, release the
+	 * buffers kept allocated by the previous capture session.
+	 */
+	if (data->buffersAllocated_)
+		freeBuffers(camera);
+
+	data->keepAllocations_ = config->keepAllocations;
+
 	/*
 	 * FIXME: enabled links in one ImgU pipe interfere with capture
 	 * operations on the other one. This can be easily triggered by
@@ -554,6 +614,48 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	if (ret)
 		return ret;
 
+	/* Find the main output and viewfinder stream configurations. */
+	StreamConfiguration *mainCfg = nullptr;
+	StreamConfiguration *vfCfg = nullptr;
+
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		StreamConfiguration &cfg = (*config)[i];
+		Stream *stream = cfg.stream();
+
+		if (stream == outStream)
+			mainCfg = &cfg;
+		else if (stream == vfStream)
+			vfCfg = &cfg;
+	}
+
+	/*
+	 * When both the main output and the viewfinder are requested, use the
+	 * ImgU instance not associated with the camera to process requests
+	 * that capture from the main output, typically full resolution still
+	 * captures. The camera's own ImgU then keeps processing the
+	 * viewfinder-only requests, and a long still capture processing time
+	 * doesn't delay the viewfinder frames that follow it.
+	 *
+	 * Only one camera can be acquired at a time, as all cameras share the
+	 * same media devices, the other ImgU is thus guaranteed to be idle.
+	 * Both ImgU instances are configured identically, which allows the
+	 * IPA to compute parameters and process statistics without knowing
+	 * which ImgU a frame has been processed by.
+	 */
+	ImgUDevice *otherImgu = data->imgu_ == &imgu0_ ? &imgu1_ : &imgu0_;
+	data->stillImgu_ = mainCfg && vfCfg && !config->imguConfig().isNull()
+			 ? otherImgu : nullptr;
+
+	if (data->stillImgu_) {
+		ret = data->stillImgu_->enableLinks(true);
+		if (ret)
+			return ret;
+	}
+
+	/* Route the ImgU buffer completion signals to this camera. */
+	for (ImgUDevice *imgu : data->imgus())
+		data->connectImgU(imgu);
+
 	/*
 	 * Pass the requested stream size to the CIO2 unit and get back the
 	 * adjusted format to be propagated to the ImgU output devices.
@@ -600,29 +702,52 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	if (imguConfig.isNull())
 		return 0;
 
-	ret = imgu->configure(imguConfig, &cio2Format);
-	if (ret)
+	for (ImgUDevice *imgu : data->imgus()) {
+		ret = configureImgU(imgu, imguConfig, &cio2Format, mainCfg, vfCfg);
+		if (ret)
+			return ret;
+	}
+
+	ipa::ipu3::IPAConfigInfo configInfo;
+	configInfo.sensorControls = data->cio2_.sensor()->controls();
+	configInfo.sensorInfo = sensorInfo;
+	configInfo.bdsOutputSize = config->imguConfig().bds;
+	configInfo.iif = config->imguConfig().iif;
+
+	if (data->ipaRecorder_.isOpen()) {
+		auto [configData, fds] = IPADataSerializer<ipa::ipu3::IPAConfigInfo>::serialize(
+			configInfo, data->ipaRecordSerializer_.get());
+		data->recordIPA(IPARecorder::Configure, { configData });
+	}
+
+	ret = data->ipa_->configure(configInfo, &data->ipaControls_);
+	if (ret) {
+		LOG(IPU3, Error) << "Failed to configure IPA: "
+				 << strerror(-ret);
 		return ret;
+	}
 
-	/* Apply the format to the configured streams output devices. */
-	StreamConfiguration *mainCfg = nullptr;
-	StreamConfiguration *vfCfg = nullptr;
+	return updateControls(data);
+}
 
-	for (unsigned int i = 0; i < config->size(); ++i) {
-		StreamConfiguration &cfg = (*config)[i];
-		Stream *stream = cfg.stream();
+int PipelineHandlerIPU3::configureImgU(ImgUDevice *imgu,
+				       const ImgUDevice::PipeConfig &pipeConfig,
+				       V4L2DeviceFormat *cio2Format,
+				       const StreamConfiguration *mainCfg,
+				       const StreamConfiguration *vfCfg)
+{
+	V4L2DeviceFormat outputFormat;
+	int ret;
 
-		if (stream == outStream) {
-			mainCfg = &cfg;
-			ret = imgu->configureOutput(cfg, &outputFormat);
-			if (ret)
-				return ret;
-		} else if (stream == vfStream) {
-			vfCfg = &cfg;
-			ret = imgu->configureViewfinder(cfg, &outputFormat);
-			if (ret)
-				return ret;
-		}
+	ret = imgu->configure(pipeConfig, cio2Format);
+	if (ret)
+		return ret;
+
+	/* Apply the format to the configured streams output devices. */
+	if (mainCfg) {
+		ret = imgu->configureOutput(*mainCfg, &outputFormat);
+		if (ret)
+			return ret;
 	}
 
 	/*
@@ -630,11 +755,9 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	 * the configuration of the active one for that purpose (there should
 	 * be at least one active stream in the configuration request).
 	 */
-	if (!vfCfg) {
-		ret = imgu->configureViewfinder(*mainCfg, &outputFormat);
-		if (ret)
-			return ret;
-	}
+	ret = imgu->configureViewfinder(vfCfg ? *vfCfg : *mainCfg, &outputFormat);
+	if (ret)
+		return ret;
 
 	/* Apply the "pipe_mode" control to the ImgU subdevice. */
 	ControlList ctrls(imgu->imgu_->controls());
@@ -653,20 +776,7 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 		return ret;
 	}
 
-	ipa::ipu3::IPAConfigInfo configInfo;
-	configInfo.sensorControls = data->cio2_.sensor()->controls();
-	configInfo.sensorInfo = sensorInfo;
-	configInfo.bdsOutputSize = config->imguConfig().bds;
-	configInfo.iif = config->imguConfig().iif;
-
-	ret = data->ipa_->configure(configInfo, &data->ipaControls_);
-	if (ret) {
-		LOG(IPU3, Error) << "Failed to configure IPA: "
-				 << strerror(-ret);
-		return ret;
-	}
-
-	return updateControls(data);
+	return 0;
 }
 
 int PipelineHandlerIPU3::exportFrameBuffers(Camera *camera, Stream *stream,
@@ -696,7 +806,6 @@ int PipelineHandlerIPU3::exportFrameBuffers(Camera *camera, Stream *stream,
 int PipelineHandlerIPU3::allocateBuffers(Camera *camera)
 {
 	IPU3CameraData *data = cameraData(camera);
-	ImgUDevice *imgu = data->imgu_;
 	unsigned int bufferCount;
 	int ret;
 
@@ -706,28 +815,54 @@ int PipelineHandlerIPU3::allocateBuffers(Camera *camera)
 		data->rawStream_.configuration().bufferCount,
 	});
 
-	ret = imgu->allocateBuffers(bufferCount);
-	if (ret < 0)
-		return ret;
+	for (ImgUDevice *imgu : data->imgus()) {
+		ret = imgu->allocateBuffers(bufferCount);
+		if (ret < 0) {
+			for (ImgUDevice *other : data->imgus())
+				other->freeBuffers();
+			return ret;
+		}
+	}
+
+	/* Report the parameters and statistics buffers of each ImgU. */
+	unsigned int index = 0;
+
+	for (ImgUDevice *imgu : data->imgus()) {
+		std::string prefix = "imgu" + std::to_string(index++) + "-";
+		data->setBufferPool(prefix + "params", nullptr, imgu->paramBuffers_);
+		data->setBufferPool(prefix + "stats", nullptr, imgu->statBuffers_);
+	}
 
 	/* Map buffers to the IPA. */
 	unsigned int ipaBufferId = 1;
 
-	for (const std::unique_ptr<FrameBuffer> &buffer : imgu->paramBuffers_) {
-		buffer->setCookie(ipaBufferId++);
-		ipaBuffers_.emplace_back(buffer->cookie(), buffer->planes());
-	}
+	for (ImgUDevice *imgu : data->imgus()) {
+		for (const std::unique_ptr<FrameBuffer> &buffer : imgu->paramBuffers_) {
+			buffer->setCookie(ipaBufferId++);
+			ipaBuffers_.emplace_back(buffer->cookie(), buffer->planes());
+		}
 
-	for (const std::unique_ptr<FrameBuffer> &buffer : imgu->statBuffers_) {
-		buffer->setCookie(ipaBufferId++);
-		ipaBuffers_.emplace_back(buffer->cookie(), buffer->planes());
+		for (const std::unique_ptr<FrameBuffer> &buffer : imgu->statBuffers_) {
+			buffer->setCookie(ipaBufferId++);
+			ipaBuffers_.emplace_back(buffer->cookie(), buffer->planes());
+		}
 	}
 
 	data->ipa_->mapBuffers(ipaBuffers_);
 
-	data->frameInfos_.init(imgu->paramBuffers_, imgu->statBuffers_);
-	data->frameInfos_.bufferAvailable.connect(
-		data, &IPU3CameraData::queuePendingRequests);
+	if (data->ipaRecorder_.isOpen()) {
+		std::vector<std::vector<uint8_t>> fields;
+		for (const IPABuffer &ipabuf : ipaBuffers_) {
+			IPARecorder::BufferInfo info{ ipabuf.id,
+						      ipabuf.planes[0].length };
+			const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&info);
+			fields.emplace_back(bytes, bytes + sizeof(info));
+		}
+
+		data->recordIPA(IPARecorder::MapBuffers, fields);
+	}
+
+	data->buffersAllocated_ = true;
 
 	return 0;
 }
@@ -736,8 +871,6 @@ int PipelineHandlerIPU3::freeBuffers(Camera *camera)
 {
 	IPU3CameraData *data = cameraData(camera);
 
-	data->frameInfos_.clear();
-
 	std::vector<unsigned int> ids;
 	for (IPABuffer &ipabuf : ipaBuffers_)
 		ids.push_back(ipabuf.id);
@@ -745,24 +878,65 @@ int PipelineHandlerIPU3::freeBuffers(Camera *camera)
 	data->ipa_->unmapBuffers(ids);
 	ipaBuffers_.clear();
 
-	data->imgu_->freeBuffers();
+	if (data->ipaRecorder_.isOpen()) {
+		const uint8_t *begin = reinterpret_cast<const uint8_t *>(ids.data());
+		data->recordIPA(IPARecorder::UnmapBuffers,
+				{ { begin, begin + ids.size() * sizeof(ids[0]) } });
+	}
+
+	unsigned int index = 0;
+	for (ImgUDevice *imgu : data->imgus()) {
+		std::string prefix = "imgu" + std::to_string(index++) + "-";
+		data->clearBufferPool(prefix + "params");
+		data->clearBufferPool(prefix + "stats");
+		imgu->freeBuffers();
+	}
+	data->cio2_.freeBuffers();
+	data->clearBufferPool("raw");
+
+	data->buffersAllocated_ = false;
 
 	return 0;
 }
 
-int PipelineHandlerIPU3::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+void PipelineHandlerIPU3::releaseDevice(Camera *camera)
+{
+	IPU3CameraData *data = cameraData(camera);
+
+	if (data->buffersAllocated_)
+		freeBuffers(camera);
+}
+
+int PipelineHandlerIPU3::start(Camera *camera, const ControlList *controls)
 {
 	IPU3CameraData *data = cameraData(camera);
 	CIO2Device *cio2 = &data->cio2_;
-	ImgUDevice *imgu = data->imgu_;
+	unsigned int frames = 0;
 	int ret;
 
-	/* Allocate buffers for internal pipeline usage. */
-	ret = allocateBuffers(camera);
-	if (ret)
-		return ret;
+	/*
+	 * Allocate buffers for internal pipeline usage, unless they have been
+	 * kept allocated when the camera was last stopped.
+	 */
+	if (!data->buffersAllocated_) {
+		ret = allocateBuffers(camera);
+		if (ret)
+			return ret;
+	}
+
+	data->frameInfos_.init(data->imgus());
+
+	ControlList startControls(controls::controls);
+	if (controls)
+		startControls.merge(*controls);
+
+	if (data->ipaRecorder_.isOpen()) {
+		auto [controlsData, fds] = IPADataSerializer<ControlList>::serialize(
+			startControls, data->ipaRecordSerializer_.get());
+		data->recordIPA(IPARecorder::Start, { controlsData });
+	}
 
-	ret = data->ipa_->start();
+	ret = data->ipa_->start(startControls);
 	if (ret)
 		goto error;
 
@@ -770,22 +944,33 @@ int PipelineHandlerIPU3::start(Camera *camera, [[maybe_unused]] const ControlLis
 
 	/*
 	 * Start the ImgU video devices, buffers will be queued to the
-	 * ImgU output and viewfinder when requests will be queued.
+	 * ImgU output and viewfinder when requests will be queued. Allocate as
+	 * many internal raw buffers as there are frames in flight.
 	 */
-	ret = cio2->start();
-	if (ret)
-		goto error;
+	for (ImgUDevice *imgu : data->imgus())
+		frames += imgu->paramBuffers_.size();
 
-	ret = imgu->start();
+	ret = cio2->start(frames);
 	if (ret)
 		goto error;
 
+	data->setBufferPool("raw", nullptr, cio2->buffers());
+
+	for (ImgUDevice *imgu : data->imgus()) {
+		ret = imgu->start();
+		if (ret)
+			goto error;
+	}
+
 	return 0;
 
 error:
-	imgu->stop();
+	for (ImgUDevice *imgu : data->imgus())
+		imgu->stop();
 	cio2->stop();
 	data->ipa_->stop();
+	data->recordIPA(IPARecorder::Stop);
+	data->frameInfos_.clear();
 	freeBuffers(camera);
 	LOG(IPU3, Error) << "Failed to start camera " << camera->id();
 
@@ -800,13 +985,18 @@ void PipelineHandlerIPU3::stop(Camera *camera)
 	data->cancelPendingRequests();
 
 	data->ipa_->stop();
+	data->recordIPA(IPARecorder::Stop);
 
-	ret |= data->imgu_->stop();
+	for (ImgUDevice *imgu : data->imgus())
+		ret |= imgu->stop();
 	ret |= data->cio2_.stop();
 	if (ret)
 		LOG(IPU3, Warning) << "Failed to stop camera " << camera->id();
 
-	freeBuffers(camera);
+	data->frameInfos_.clear();
+
+	if (!data->keepAllocations_)
+		freeBuffers(camera);
 }
 
 void IPU3CameraData::cancelPendingRequests()
@@ -830,7 +1020,14 @@ void IPU3CameraData::queuePendingRequests()
 	while (!pendingRequests_.empty()) {
 		Request *request = pendingRequests_.front();
 
-		IPU3Frames::Info *info = frameInfos_.create(request);
+		/*
+		 * Process requests that capture from the main output on the
+		 * still capture ImgU, if any.
+		 */
+		ImgUDevice *imgu = stillImgu_ && request->findBuffer(&outStream_)
+				 ? stillImgu_ : imgu_;
+
+		IPU3Frames::Info *info = frameInfos_.create(request, imgu);
 		if (!info)
 			break;
 
@@ -857,7 +1054,7 @@ void IPU3CameraData::queuePendingRequests()
 		ev.op = ipa::ipu3::EventProcessControls;
 		ev.frame = info->id;
 		ev.controls = request->controls();
-		ipa_->processEvent(ev);
+		processIPAEvent(ev);
 
 		pendingRequests_.pop();
 	}
@@ -909,6 +1106,9 @@ bool PipelineHandlerIPU3::match(DeviceEnumerator *enumerator)
 	if (!imguMediaDev_)
 		return false;
 
+	/* Prepare the IPA while the media graph and sensors are set up. */
+	IPAManager::prefetch(this, 1, 1);
+
 	/*
 	 * Disable all links that are enabled by default on CIO2, as camera
 	 * creation enables all valid links it finds.
@@ -1163,16 +1363,9 @@ int PipelineHandlerIPU3::registerCameras()
 					&IPU3CameraData::cio2BufferReady);
 		data->cio2_.bufferAvailable.connect(
 			data.get(), &IPU3CameraData::queuePendingRequests);
-		data->imgu_->input_->bufferReady.connect(&data->cio2_,
-					&CIO2Device::tryReturnBuffer);
-		data->imgu_->output_->bufferReady.connect(data.get(),
-					&IPU3CameraData::imguOutputBufferReady);
-		data->imgu_->viewfinder_->bufferReady.connect(data.get(),
-					&IPU3CameraData::imguOutputBufferReady);
-		data->imgu_->param_->bufferReady.connect(data.get(),
-					&IPU3CameraData::paramBufferReady);
-		data->imgu_->stat_->bufferReady.connect(data.get(),
-					&IPU3CameraData::statBufferReady);
+		data->frameInfos_.bufferAvailable.connect(
+			data.get(), &IPU3CameraData::queuePendingRequests);
+		data->connectImgU(data->imgu_);
 
 		/* Create and register the Camera instance. */
 		const std::string &cameraId = cio2->sensor()->id();
@@ -1192,6 +1385,49 @@ int PipelineHandlerIPU3::registerCameras()
 	return numCameras ? 0 : -ENODEV;
 }
 
+/**
+ * \brief Connect the ImgU buffer completion signals to the camera
+ * \param[in] imgu The ImgU instance
+ *
+ * An ImgU instance can be used by different cameras, as the primary ImgU of
+ * one camera and the still capture ImgU of another one. Disconnect the slots
+ * of any other camera before connecting the ones of this camera.
+ */
+void IPU3CameraData::connectImgU(ImgUDevice *imgu)
+{
+	imgu->input_->bufferReady.disconnect();
+	imgu->output_->bufferReady.disconnect();
+	imgu->viewfinder_->bufferReady.disconnect();
+	imgu->param_->bufferReady.disconnect();
+	imgu->stat_->bufferReady.disconnect();
+
+	/*
+	 * Input buffers are returned to the CIO2 once processed, and the ImgU
+	 * outputs complete the request buffers.
+	 */
+	imgu->input_->bufferReady.connect(&cio2_, &CIO2Device::tryReturnBuffer);
+	imgu->output_->bufferReady.connect(this,
+					   &IPU3CameraData::imguOutputBufferReady);
+	imgu->viewfinder_->bufferReady.connect(this,
+					       &IPU3CameraData::imguOutputBufferReady);
+	imgu->param_->bufferReady.connect(this, &IPU3CameraData::paramBufferReady);
+	imgu->stat_->bufferReady.connect(this, &IPU3CameraData::statBufferReady);
+}
+
+/**
+ * \brief Retrieve the ImgU instances in use by the camera
+ *
+ * \return The camera's primary ImgU, followed by the still capture ImgU if
+ * the current configuration uses one
+ */
+std::vector<ImgUDevice *> IPU3CameraData::imgus() const
+{
+	if (stillImgu_)
+		return { imgu_, stillImgu_ };
+
+	return { imgu_ };
+}
+
 int IPU3CameraData::loadIPA()
 {
 	ipa_ = IPAManager::createIPA<ipa::ipu3::IPAProxyIPU3>(pipe(), 1, 1);
@@ -1223,8 +1459,30 @@ int IPU3CameraData::loadIPA()
 	if (ret)
 		return ret;
 
-	ret = ipa_->init(IPASettings{ "", sensor->model() }, sensorInfo,
-			 sensor->controls(), &ipaControls_);
+	IPASettings settings{ "", sensor->model() };
+
+	/*
+	 * Record the calls to the IPA if requested, to replay them offline
+	 * with the ipu3-ipa-replay tool.
+	 */
+	const char *recordPath = GlobalConfiguration::option("LIBCAMERA_IPU3_IPA_RECORD");
+	if (recordPath && *recordPath &&
+	    !ipaRecorder_.open(std::string(recordPath) + "." + sensor->model())) {
+		ipaRecordSerializer_ =
+			std::make_unique<ControlSerializer>(ControlSerializer::Role::Proxy);
+		ControlSerializer *cs = ipaRecordSerializer_.get();
+
+		auto [settingsData, settingsFds] =
+			IPADataSerializer<IPASettings>::serialize(settings, cs);
+		auto [sensorInfoData, sensorInfoFds] =
+			IPADataSerializer<IPACameraSensorInfo>::serialize(sensorInfo, cs);
+		auto [controlsData, controlsFds] =
+			IPADataSerializer<ControlInfoMap>::serialize(sensor->controls(), cs);
+
+		recordIPA(IPARecorder::Init, { settingsData, sensorInfoData, controlsData });
+	}
+
+	ret = ipa_->init(settings, sensorInfo, sensor->controls(), &ipaControls_);
 	if (ret) {
 		LOG(IPU3, Error) << "Failed to initialise the IPU3 IPA";
 		return ret;
@@ -1248,19 +1506,21 @@ void IPU3CameraData::queueFrameAction(unsigned int id,
 			break;
 
 		/* Queue all buffers from the request aimed for the ImgU. */
+		ImgUDevice *imgu = info->imgu;
+
 		for (auto it : info->request->buffers()) {
 			const Stream *stream = it.first;
 			FrameBuffer *outbuffer = it.second;
 
 			if (stream == &outStream_)
-				imgu_->output_->queueBuffer(outbuffer);
+				imgu->output_->queueBuffer(outbuffer);
 			else if (stream == &vfStream_)
-				imgu_->viewfinder_->queueBuffer(outbuffer);
+				imgu->viewfinder_->queueBuffer(outbuffer);
 		}
 
-		imgu_->param_->queueBuffer(info->paramBuffer);
-		imgu_->stat_->queueBuffer(info->statBuffer);
-		imgu_->input_->queueBuffer(info->rawBuffer);
+		imgu->param_->queueBuffer(info->paramBuffer);
+		imgu->stat_->queueBuffer(info->statBuffer);
+		imgu->input_->queueBuffer(info->rawBuffer);
 
 		break;
 	}
@@ -1270,7 +1530,7 @@ void IPU3CameraData::queueFrameAction(unsigned int id,
 			break;
 
 		Request *request = info->request;
-		request->metadata().merge(action.controls);
+		pipe()->metadataAvailable(request, action.controls);
 
 		info->metadataProcessed = true;
 		if (frameInfos_.tryComplete(info))
@@ -1360,7 +1620,7 @@ void IPU3CameraData::cio2BufferReady(FrameBuffer *buffer)
 	ev.op = ipa::ipu3::EventFillParams;
 	ev.frame = info->id;
 	ev.bufferId = info->paramBuffer->cookie();
-	ipa_->processEvent(ev);
+	processIPAEvent(ev);
 }
 
 void IPU3CameraData::paramBufferReady(FrameBuffer *buffer)
@@ -1410,9 +1670,42 @@ void IPU3CameraData::statBufferReady(FrameBuffer *buffer)
 	ev.bufferId = info->statBuffer->cookie();
 	ev.frameTimestamp = request->metadata().get(controls::SensorTimestamp);
 	ev.sensorControls = info->effectiveSensorControls;
+	processIPAEvent(ev, info->statBuffer);
+}
+
+/*
+ * Send an event to the IPA, recording it first if IPA recording is enabled.
+ * The content of the \a buffer, if any, is recorded along with the event.
+ */
+void IPU3CameraData::processIPAEvent(const ipa::ipu3::IPU3Event &ev,
+				     FrameBuffer *buffer)
+{
+	if (ipaRecorder_.isOpen()) {
+		auto [event, fds] = IPADataSerializer<ipa::ipu3::IPU3Event>::serialize(
+			ev, ipaRecordSerializer_.get());
+
+		std::vector<uint8_t> content;
+		if (buffer) {
+			MappedFrameBuffer mapped(buffer, MappedFrameBuffer::MapFlag::Read);
+			if (mapped.isValid()) {
+				Span<uint8_t> plane = mapped.planes()[0];
+				content.assign(plane.begin(), plane.end());
+			}
+		}
+
+		recordIPA(IPARecorder::Event, { event, content });
+	}
+
 	ipa_->processEvent(ev);
 }
 
+void IPU3CameraData::recordIPA(IPARecorder::RecordType type,
+			       const std::vector<std::vector<uint8_t>> &fields)
+{
+	if (ipaRecorder_.isOpen())
+		ipaRecorder_.write(type, fields);
+}
+
 REGISTER_PIPELINE_HANDLER(PipelineHandlerIPU3)
 
 } /* namespace libcamera */
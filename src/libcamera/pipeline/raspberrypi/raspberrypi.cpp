@@ -6,10 +6,18 @@
  */
 #include <algorithm>
 #include <assert.h>
+#include <chrono>
+#include <deque>
 #include <fcntl.h>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <libcamera/camera.h>
@@ -23,6 +31,7 @@
 #include <libcamera/property_ids.h>
 #include <libcamera/request.h>
 
+#include <libcamera/base/global_configuration.h>
 #include <libcamera/base/utils.h>
 
 #include <linux/bcm2835-isp.h>
@@ -34,13 +43,14 @@
 #include "libcamera/internal/camera_sensor.h"
 #include "libcamera/internal/delayed_controls.h"
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/dma_heaps.h"
 #include "libcamera/internal/framebuffer.h"
 #include "libcamera/internal/ipa_manager.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/v4l2_subdevice.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
-#include "dma_heaps.h"
 #include "rpi_stream.h"
 
 namespace libcamera {
@@ -49,6 +59,15 @@ LOG_DEFINE_CATEGORY(RPI)
 
 namespace {
 
+/*
+ * Maximum number of bayer frames waiting for their embedded data buffer. When
+ * exceeded, the oldest bayer frame is processed without embedded data.
+ */
+constexpr unsigned int kMaxEmbeddedLookahead = 2;
+
+/* Maximum number of raw frames kept for zero shutter lag reprocessing. */
+constexpr unsigned int kMaxZslFrames = 8;
+
 /* Map of mbus codes to supported sizes reported by the sensor. */
 using SensorFormats = std::map<unsigned int, std::vector<Size>>;
 
@@ -125,7 +144,9 @@ double scoreFormat(double desired, double actual)
 	return score;
 }
 
-V4L2SubdeviceFormat findBestFormat(const SensorFormats &formatsMap, const Size &req)
+V4L2SubdeviceFormat findBestFormat(const SensorFormats &formatsMap, const Size &req,
+				   const CameraSensor *sensor = nullptr,
+				   utils::Duration frameDuration = {})
 {
 	double bestScore = std::numeric_limits<double>::max(), score;
 	V4L2SubdeviceFormat bestFormat;
@@ -134,6 +155,7 @@ V4L2SubdeviceFormat findBestFormat(const SensorFormats &formatsMap, const Size &
 #define PENALTY_8BIT		2000.0
 #define PENALTY_10BIT		1000.0
 #define PENALTY_12BIT		   0.0
+#define PENALTY_FRAME_DURATION	50000.0
 
 	/* Calculate the closest/best mode from the user requested size. */
 	for (const auto &iter : formatsMap) {
@@ -159,6 +181,16 @@ V4L2SubdeviceFormat findBestFormat(const SensorFormats &formatsMap, const Size &
 			else if (info.bitsPerPixel == 8)
 				score += PENALTY_8BIT;
 
+			/*
+			 * Modes that can't reach the requested frame rate lose
+			 * over all the others, the slower the worse.
+			 */
+			if (sensor && frameDuration) {
+				utils::Duration duration = sensor->minFrameDuration(size);
+				if (duration > frameDuration)
+					score += PENALTY_FRAME_DURATION * duration / frameDuration;
+			}
+
 			if (score <= bestScore) {
 				bestScore = score;
 				bestFormat.mbus_code = mbusCode;
@@ -175,6 +207,12 @@ V4L2SubdeviceFormat findBestFormat(const SensorFormats &formatsMap, const Size &
 	return bestFormat;
 }
 
+/*
+ * Internal buffers allocated on demand are freed when they haven't been used
+ * for this long.
+ */
+constexpr std::chrono::seconds kOnDemandBuffersIdleTimeout{ 10 };
+
 enum class Unicam : unsigned int { Image, Embedded };
 enum class Isp : unsigned int { Input, Output0, Output1, Stats };
 
@@ -184,12 +222,29 @@ class RPiCameraData : public Camera::Private
 {
 public:
 	RPiCameraData(PipelineHandler *pipe)
-		: Camera::Private(pipe), state_(State::Stopped),
-		  supportsFlips_(false), flipsAlterBayerOrder_(false),
-		  dropFrameCount_(0), ispOutputCount_(0)
+		: Camera::Private(pipe), dmaHeap_(DmaHeap::instance()),
+		  state_(State::Stopped), supportsFlips_(false),
+		  flipsAlterBayerOrder_(false), dropFrameCount_(0),
+		  keepAllocations_(false), buffersAllocated_(false),
+		  pipelineDepth_(0), zslFrames_(0), zslReprocess_(false),
+		  ispOutputCount_(0), ispTablesMem_(nullptr)
 	{
 	}
 
+	~RPiCameraData()
+	{
+		/*
+		 * Stop the IPA before returning the lens shading table to the
+		 * dma-heap pool, as it may still access the table otherwise.
+		 */
+		ipa_.reset();
+		dmaHeap_->release(std::move(lsTable_), ipa::RPi::MaxLsGridSize);
+
+		if (ispTablesMem_)
+			munmap(ispTablesMem_, RPi::IspTablesSize);
+		dmaHeap_->release(std::move(ispTables_), RPi::IspTablesSize);
+	}
+
 	void frameStarted(uint32_t sequence);
 
 	int loadIPA(ipa::RPi::SensorConfig *sensorConfig);
@@ -210,6 +265,8 @@ public:
 	void clearIncompleteRequests();
 	void handleStreamBuffer(FrameBuffer *buffer, RPi::Stream *stream);
 	void handleExternalBuffer(FrameBuffer *buffer, RPi::Stream *stream);
+	int allocateOnDemandBuffers(RPi::Stream *stream);
+	void releaseIdleBuffers();
 	void handleState();
 	void applyScalerCrop(const ControlList &controls);
 
@@ -217,17 +274,26 @@ public:
 
 	std::unique_ptr<CameraSensor> sensor_;
 	SensorFormats sensorFormats_;
+	/* Focus lens actuator, if the camera module has one. */
+	std::unique_ptr<V4L2Subdevice> lens_;
 	/* Array of Unicam and ISP device streams and associated buffers/streams. */
 	RPi::Device<Unicam, 2> unicam_;
 	RPi::Device<Isp, 4> isp_;
+	/* Formats supported by the ISP outputs, enumerated once at match time. */
+	V4L2VideoDevice::Formats ispOutput0Formats_;
+	V4L2VideoDevice::Formats ispOutput1Formats_;
 	/* The vector below is just for convenience when iterating over all streams. */
 	std::vector<RPi::Stream *> streams_;
 	/* Stores the ids of the buffers mapped in the IPA. */
 	std::unordered_set<unsigned int> ipaBuffers_;
 
-	/* DMAHEAP allocation helper. */
-	RPi::DmaHeap dmaHeap_;
+	/* DMAHEAP allocation helper, shared by all cameras. */
+	std::shared_ptr<DmaHeap> dmaHeap_;
 	FileDescriptor lsTable_;
+	/* ISP configuration tables written by the IPA. */
+	FileDescriptor ispTables_;
+	/* Values of the ISP controls last applied. */
+	std::unordered_map<unsigned int, ControlValue> ispControlsCache_;
 
 	std::unique_ptr<DelayedControls> delayedCtrls_;
 	bool sensorMetadata_;
@@ -246,7 +312,7 @@ public:
 	};
 
 	std::queue<BayerFrame> bayerQueue_;
-	std::queue<FrameBuffer *> embeddedQueue_;
+	std::multimap<uint64_t, FrameBuffer *> embeddedQueue_;
 	std::deque<Request *> requestQueue_;
 
 	/*
@@ -266,14 +332,44 @@ public:
 
 	unsigned int dropFrameCount_;
 
+	/* Keep internal buffers allocated across stop() and start(). */
+	bool keepAllocations_;
+	bool buffersAllocated_;
+
+	/* Requested number of frames in flight, 0 for the default. */
+	unsigned int pipelineDepth_;
+
+	/*
+	 * Zero shutter lag support. The Unicam image and embedded buffers of
+	 * the last zslFrames_ frames processed by the ISP are kept in
+	 * zslRing_, oldest first, instead of being re-queued to Unicam, for
+	 * requests to reprocess them.
+	 */
+	struct ZslFrame {
+		FrameBuffer *buffer;
+		FrameBuffer *embeddedBuffer;
+		ControlList controls;
+	};
+
+	unsigned int zslFrames_;
+	std::deque<ZslFrame> zslRing_;
+	/* The frame being processed, added to the ring once done. */
+	ZslFrame zslPending_;
+	/* True when the frame being processed is reprocessed from the ring. */
+	bool zslReprocess_;
+
 private:
 	void checkRequestCompleted();
 	void fillRequestMetadata(const ControlList &bufferControls,
 				 Request *request);
 	void tryRunPipeline();
 	bool findMatchingBuffers(BayerFrame &bayerFrame, FrameBuffer *&embeddedBuffer);
+	bool findZslFrame(const ControlList &controls, BayerFrame &bayerFrame,
+			  FrameBuffer *&embeddedBuffer);
+	void returnZslFrames(unsigned int count);
 
 	unsigned int ispOutputCount_;
+	RPi::IspTable *ispTablesMem_;
 };
 
 class RPiCameraConfiguration : public CameraConfiguration
@@ -287,6 +383,8 @@ public:
 	Transform combinedTransform_;
 
 private:
+	Status validateConfiguration();
+
 	const RPiCameraData *data_;
 };
 
@@ -303,6 +401,7 @@ public:
 
 	int start(Camera *camera, const ControlList *controls) override;
 	void stop(Camera *camera) override;
+	void releaseDevice(Camera *camera) override;
 
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
@@ -327,6 +426,13 @@ RPiCameraConfiguration::RPiCameraConfiguration(const RPiCameraData *data)
 }
 
 CameraConfiguration::Status RPiCameraConfiguration::validate()
+{
+	return data_->configurationCache()->validate(this, [this]() {
+		return validateConfiguration();
+	});
+}
+
+CameraConfiguration::Status RPiCameraConfiguration::validateConfiguration()
 {
 	Status status = Valid;
 
@@ -382,6 +488,30 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 		status = Adjusted;
 	}
 
+	/*
+	 * Restricting the sensor readout requires a sensor driver that allows
+	 * changing its crop rectangle. The rectangle must also lie within the
+	 * sensor active area.
+	 */
+	if (!sensorCrop.isNull()) {
+		Rectangle crop;
+		if (data_->sensor_->supportsAnalogCrop()) {
+			Rectangle bounds(data_->sensor_->resolution());
+			crop = sensorCrop.size().boundedTo(bounds.size())
+					    .expandedTo({ 1, 1 })
+					    .centeredTo(sensorCrop.center())
+					    .enclosedIn(bounds);
+		}
+
+		if (crop != sensorCrop) {
+			LOG(RPI, Debug) << "Adjusting sensor crop from "
+					<< sensorCrop.toString() << " to "
+					<< crop.toString();
+			sensorCrop = crop;
+			status = Adjusted;
+		}
+	}
+
 	/*
 	 * Store the final combined transform that configure() will need to
 	 * apply to the sensor to save us working it out again.
@@ -397,7 +527,9 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 			 * Calculate the best sensor mode we can use based on
 			 * the user request.
 			 */
-			V4L2SubdeviceFormat sensorFormat = findBestFormat(data_->sensorFormats_, cfg.size);
+			V4L2SubdeviceFormat sensorFormat = findBestFormat(data_->sensorFormats_, cfg.size,
+									   data_->sensor_.get(),
+									   std::chrono::microseconds(minFrameDuration));
 			V4L2DeviceFormat unicamFormat = toV4L2DeviceFormat(sensorFormat,
 									   BayerFormat::Packing::CSI2);
 			int ret = data_->unicam_[Unicam::Image].dev()->tryFormat(&unicamFormat);
@@ -431,6 +563,10 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 			cfg.stride = unicamFormat.planes[0].bpl;
 			cfg.frameSize = unicamFormat.planes[0].size;
 
+			/* The Unicam format is shared with the ISP input. */
+			if (resetBufferConstraints(&cfg))
+				status = Adjusted;
+
 			rawCount++;
 		} else {
 			outSize[outCount] = std::make_pair(count, cfg.size);
@@ -484,7 +620,9 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 		else
 			dev = data_->isp_[Isp::Output1].dev();
 
-		V4L2VideoDevice::Formats fmts = dev->formats();
+		const V4L2VideoDevice::Formats &fmts = i == maxIndex
+						     ? data_->ispOutput0Formats_
+						     : data_->ispOutput1Formats_;
 
 		if (fmts.find(V4L2PixelFormat::fromPixelFormat(cfgPixFmt)) == fmts.end()) {
 			/* If we cannot find a native format, use a default one. */
@@ -495,11 +633,15 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 		V4L2DeviceFormat format;
 		format.fourcc = V4L2PixelFormat::fromPixelFormat(cfg.pixelFormat);
 		format.size = cfg.size;
+		format.applyConstraints(cfg);
 
 		int ret = dev->tryFormat(&format);
 		if (ret)
 			return Invalid;
 
+		if (format.adjustConstraints(&cfg))
+			status = Adjusted;
+
 		cfg.stride = format.planes[0].bpl;
 		cfg.frameSize = format.planes[0].size;
 
@@ -542,7 +684,7 @@ CameraConfiguration *PipelineHandlerRPi::generateConfiguration(Camera *camera,
 			break;
 
 		case StreamRole::StillCapture:
-			fmts = data->isp_[Isp::Output0].dev()->formats();
+			fmts = data->ispOutput0Formats_;
 			pixelFormat = formats::NV12;
 			/* Return the largest sensor resolution. */
 			size = data->sensor_->resolution();
@@ -559,7 +701,7 @@ CameraConfiguration *PipelineHandlerRPi::generateConfiguration(Camera *camera,
 			 * applications and enable usage of the colour denoise
 			 * algorithm.
 			 */
-			fmts = data->isp_[Isp::Output0].dev()->formats();
+			fmts = data->ispOutput0Formats_;
 			pixelFormat = formats::YUV420;
 			size = { 1920, 1080 };
 			bufferCount = 4;
@@ -567,7 +709,7 @@ CameraConfiguration *PipelineHandlerRPi::generateConfiguration(Camera *camera,
 			break;
 
 		case StreamRole::Viewfinder:
-			fmts = data->isp_[Isp::Output0].dev()->formats();
+			fmts = data->ispOutput0Formats_;
 			pixelFormat = formats::ARGB8888;
 			size = { 800, 600 };
 			bufferCount = 4;
@@ -614,6 +756,17 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 	RPiCameraData *data = cameraData(camera);
 	int ret;
 
+	/*
+	 * Release the buffers kept allocated by the previous capture session,
+	 * they don't match the new configuration.
+	 */
+	if (data->buffersAllocated_)
+		freeBuffers(camera);
+
+	data->keepAllocations_ = config->keepAllocations;
+	data->pipelineDepth_ = config->pipelineDepth;
+	data->zslFrames_ = std::min(config->zslFrames, kMaxZslFrames);
+
 	/* Start by resetting the Unicam and ISP stream states. */
 	for (auto const stream : data->streams_)
 		stream->reset();
@@ -663,12 +816,46 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 		data->setSensorControls(controls);
 	}
 
+	/*
+	 * Raw buffers kept for reprocessing can't be handed to the application
+	 * at the same time.
+	 */
+	if (rawStream && data->zslFrames_) {
+		LOG(RPI, Warning)
+			<< "Zero shutter lag is not supported with a raw stream";
+		data->zslFrames_ = 0;
+	}
+
 	/* First calculate the best sensor mode we can use based on the user request. */
-	V4L2SubdeviceFormat sensorFormat = findBestFormat(data->sensorFormats_, rawStream ? sensorSize : maxSize);
+	V4L2SubdeviceFormat sensorFormat = findBestFormat(data->sensorFormats_, rawStream ? sensorSize : maxSize,
+							   data->sensor_.get(),
+							   std::chrono::microseconds(config->minFrameDuration));
 	ret = data->sensor_->setFormat(&sensorFormat);
 	if (ret)
 		return ret;
 
+	/*
+	 * Restrict the sensor readout if requested. This may change the sensor
+	 * output size, which is read back to configure Unicam accordingly. The
+	 * IPA and the ScalerCrop handling pick the crop up through the sensor
+	 * info retrieved below.
+	 */
+	if (!config->sensorCrop.isNull()) {
+		Rectangle crop = config->sensorCrop;
+		ret = data->sensor_->setAnalogCrop(&crop);
+		if (ret) {
+			LOG(RPI, Error) << "Failed to set sensor crop "
+					<< config->sensorCrop.toString();
+			return ret;
+		}
+
+		ret = data->sensor_->device()->getFormat(0, &sensorFormat);
+		if (ret)
+			return ret;
+
+		LOG(RPI, Debug) << "Sensor crop set to " << crop.toString();
+	}
+
 	V4L2DeviceFormat unicamFormat = toV4L2DeviceFormat(sensorFormat, packing);
 	ret = data->unicam_[Unicam::Image].dev()->setFormat(&unicamFormat);
 	if (ret)
@@ -702,8 +889,10 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 						    : &data->isp_[Isp::Output1];
 
 		V4L2PixelFormat fourcc = V4L2PixelFormat::fromPixelFormat(cfg.pixelFormat);
+		format = {};
 		format.size = cfg.size;
 		format.fourcc = fourcc;
+		format.applyConstraints(cfg);
 
 		LOG(RPI, Debug) << "Setting " << stream->name() << " to "
 				<< format.toString();
@@ -817,7 +1006,12 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 	if (data->sensorMetadata_) {
 		V4L2SubdeviceFormat embeddedFormat;
 
-		data->sensor_->device()->getFormat(1, &embeddedFormat);
+		ret = data->sensor_->embeddedDataFormat(&embeddedFormat);
+		if (ret) {
+			LOG(RPI, Error) << "Failed to get sensor embedded data format";
+			return ret;
+		}
+
 		format.fourcc = V4L2PixelFormat(V4L2_META_FMT_SENSOR_DATA);
 		format.planes[0].size = embeddedFormat.size.width * embeddedFormat.size.height;
 
@@ -868,18 +1062,31 @@ int PipelineHandlerRPi::start(Camera *camera, const ControlList *controls)
 	RPiCameraData *data = cameraData(camera);
 	int ret;
 
-	/* Allocate buffers for internal pipeline usage. */
-	ret = prepareBuffers(camera);
-	if (ret) {
-		LOG(RPI, Error) << "Failed to allocate buffers";
-		stop(camera);
-		return ret;
+	/*
+	 * Allocate buffers for internal pipeline usage, or reuse the ones kept
+	 * allocated when the camera was last stopped.
+	 */
+	if (!data->buffersAllocated_) {
+		ret = prepareBuffers(camera);
+		if (ret) {
+			LOG(RPI, Error) << "Failed to allocate buffers";
+			stop(camera);
+			if (data->keepAllocations_)
+				freeBuffers(camera);
+			return ret;
+		}
+	} else {
+		for (auto const stream : data->streams_)
+			stream->resetBufferQueues();
 	}
 
 	/* Check if a ScalerCrop control was specified. */
 	if (controls)
 		data->applyScalerCrop(*controls);
 
+	/* Apply all ISP controls on the first frame. */
+	data->ispControlsCache_.clear();
+
 	/* Start the IPA. */
 	ipa::RPi::StartConfig startConfig;
 	data->ipa_->start(controls ? *controls : ControlList{ controls::controls },
@@ -938,11 +1145,22 @@ void PipelineHandlerRPi::stop(Camera *camera)
 	data->clearIncompleteRequests();
 	data->bayerQueue_ = {};
 	data->embeddedQueue_ = {};
+	data->zslRing_.clear();
+	data->zslReprocess_ = false;
 
 	/* Stop the IPA. */
 	data->ipa_->stop();
 
-	freeBuffers(camera);
+	if (!data->keepAllocations_)
+		freeBuffers(camera);
+}
+
+void PipelineHandlerRPi::releaseDevice(Camera *camera)
+{
+	RPiCameraData *data = cameraData(camera);
+
+	if (data->buffersAllocated_)
+		freeBuffers(camera);
 }
 
 int PipelineHandlerRPi::queueRequestDevice(Camera *camera, Request *request)
@@ -979,11 +1197,19 @@ int PipelineHandlerRPi::queueRequestDevice(Camera *camera, Request *request)
 		 * enough internal buffers allocated, but this will be handled by
 		 * queuing the request for buffers in the RPiStream object.
 		 */
+		if (!buffer) {
+			int ret = data->allocateOnDemandBuffers(stream);
+			if (ret)
+				return ret;
+		}
+
 		int ret = stream->queueBuffer(buffer);
 		if (ret)
 			return ret;
 	}
 
+	data->releaseIdleBuffers();
+
 	/* Push the request to the back of the queue. */
 	data->requestQueue_.push_back(request);
 	data->handleState();
@@ -1009,6 +1235,9 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 		return false;
 	}
 
+	/* Prepare the IPA while the media graph and sensor are set up. */
+	IPAManager::prefetch(this, 1, 1);
+
 	int ret = registerCamera(unicamDevice, ispDevice);
 	if (ret) {
 		LOG(RPI, Error) << "Failed to register camera: " << ret;
@@ -1022,7 +1251,7 @@ int PipelineHandlerRPi::registerCamera(MediaDevice *unicam, MediaDevice *isp)
 {
 	std::unique_ptr<RPiCameraData> data = std::make_unique<RPiCameraData>(this);
 
-	if (!data->dmaHeap_.isValid())
+	if (!data->dmaHeap_->isValid())
 		return -ENOMEM;
 
 	MediaEntity *unicamImage = unicam->getEntityByName("unicam-image");
@@ -1075,14 +1304,38 @@ int PipelineHandlerRPi::registerCamera(MediaDevice *unicam, MediaDevice *isp)
 
 	data->sensorFormats_ = populateSensorFormats(data->sensor_);
 
+	/*
+	 * Identify the focus lens, if any. Only lenses exposing an absolute
+	 * focus position control can be driven by the IPA.
+	 */
+	for (MediaEntity *entity : unicam->entities()) {
+		if (entity->function() != MEDIA_ENT_F_LENS)
+			continue;
+
+		auto lens = std::make_unique<V4L2Subdevice>(entity);
+		if (lens->open() < 0)
+			break;
+
+		const ControlInfoMap &lensControls = lens->controls();
+		if (lensControls.find(V4L2_CID_FOCUS_ABSOLUTE) == lensControls.end()) {
+			LOG(RPI, Warning) << "Lens " << entity->name()
+					  << " has no absolute focus control";
+			break;
+		}
+
+		data->lens_ = std::move(lens);
+		break;
+	}
+
 	ipa::RPi::SensorConfig sensorConfig;
 	if (data->loadIPA(&sensorConfig)) {
 		LOG(RPI, Error) << "Failed to load a suitable IPA library";
 		return -EINVAL;
 	}
 
-	if (sensorConfig.sensorMetadata ^ !!unicamEmbedded) {
-		LOG(RPI, Warning) << "Mismatch between Unicam and CamHelper for embedded data usage!";
+	if (sensorConfig.sensorMetadata ^
+	    (unicamEmbedded && data->sensor_->supportsEmbeddedData())) {
+		LOG(RPI, Warning) << "Mismatch between Unicam, sensor and CamHelper for embedded data usage!";
 		sensorConfig.sensorMetadata = false;
 		if (unicamEmbedded)
 			data->unicam_[Unicam::Embedded].dev()->bufferReady.disconnect();
@@ -1109,6 +1362,15 @@ int PipelineHandlerRPi::registerCamera(MediaDevice *unicam, MediaDevice *isp)
 			return ret;
 	}
 
+	/*
+	 * The formats supported by the ISP outputs don't depend on the ISP
+	 * configuration. Enumerate them once here instead of issuing the
+	 * enumeration ioctls every time a configuration is generated or
+	 * validated.
+	 */
+	data->ispOutput0Formats_ = data->isp_[Isp::Output0].dev()->formats();
+	data->ispOutput1Formats_ = data->isp_[Isp::Output1].dev()->formats();
+
 	if (!data->unicam_[Unicam::Image].dev()->caps().hasMediaController()) {
 		LOG(RPI, Error) << "Unicam driver does not use the MediaController, please update your kernel!";
 		return -EINVAL;
@@ -1126,8 +1388,33 @@ int PipelineHandlerRPi::registerCamera(MediaDevice *unicam, MediaDevice *isp)
 	data->delayedCtrls_ = std::make_unique<DelayedControls>(data->sensor_->device(), params);
 	data->sensorMetadata_ = sensorConfig.sensorMetadata;
 
-	/* Register the controls that the Raspberry Pi IPA can handle. */
-	data->controlInfo_ = RPi::Controls;
+	/*
+	 * The lens position is written along with the sensor controls, so that
+	 * the IPA knows which frames were exposed at which position.
+	 */
+	if (data->lens_) {
+		std::unordered_map<uint32_t, DelayedControls::ControlParams> lensParams = {
+			{ V4L2_CID_FOCUS_ABSOLUTE, { sensorConfig.lensDelay, false } }
+		};
+		if (data->delayedCtrls_->addDevice(data->lens_.get(), lensParams))
+			data->lens_.reset();
+	}
+
+	/*
+	 * Register the controls that the Raspberry Pi IPA can handle, and the
+	 * ones handled by the pipeline handler.
+	 */
+	ControlInfoMap::Map controlInfo(RPi::Controls.begin(), RPi::Controls.end());
+	controlInfo[&controls::draft::ReprocessTimestamp] =
+		ControlInfo(INT64_C(0), std::numeric_limits<int64_t>::max());
+	if (data->lens_) {
+		controlInfo[&controls::draft::AfMode] =
+			ControlInfo(controls::draft::AfModeValues);
+		controlInfo[&controls::draft::AfTrigger] =
+			ControlInfo(controls::draft::AfTriggerValues);
+		controlInfo[&controls::draft::LensPosition] = ControlInfo(0.0f, 1.0f);
+	}
+	data->controlInfo_ = ControlInfoMap(std::move(controlInfo), controls::controls);
 	/* Initialize the camera properties. */
 	data->properties_ = data->sensor_->properties();
 
@@ -1220,6 +1507,12 @@ int PipelineHandlerRPi::queueAllBuffers(Camera *camera)
 			 * be handled by queuing the request for buffers in the
 			 * RPiStream object.
 			 */
+			if (data->dropFrameCount_) {
+				ret = data->allocateOnDemandBuffers(stream);
+				if (ret)
+					return ret;
+			}
+
 			unsigned int i;
 			for (i = 0; i < data->dropFrameCount_; i++) {
 				ret = stream->queueBuffer(nullptr);
@@ -1256,10 +1549,25 @@ int PipelineHandlerRPi::prepareBuffers(Camera *camera)
 			 * to avoid any frame drops. If an application has configured
 			 * a RAW stream, allocate additional buffers to make up the
 			 * minimum, but ensure we have at least 2 sets of internal
-			 * buffers to use to minimise frame drops.
+			 * buffers to use to minimise frame drops. The minimum
+			 * follows the pipeline depth when the application sets
+			 * it. The frames kept for zero shutter lag need buffers
+			 * of their own on top of that.
 			 */
-			constexpr unsigned int minBuffers = 4;
+			unsigned int minBuffers = 4;
+			if (data->pipelineDepth_)
+				minBuffers = std::clamp(data->pipelineDepth_, 2U, 8U);
 			numBuffers = std::max<int>(2, minBuffers - numRawBuffers);
+			numBuffers += data->zslFrames_;
+		} else if (stream->isExternal()) {
+			/*
+			 * The ISP outputs used by the application only need an
+			 * internal buffer for the requests that don't contain a
+			 * buffer for them. Allocate it on first use, to save the
+			 * memory when the application always provides buffers.
+			 */
+			stream->setOnDemandBuffers(1);
+			numBuffers = 0;
 		} else {
 			/*
 			 * Since the ISP runs synchronous with the IPA and requests,
@@ -1273,6 +1581,10 @@ int PipelineHandlerRPi::prepareBuffers(Camera *camera)
 		ret = stream->prepareBuffers(numBuffers);
 		if (ret < 0)
 			return ret;
+
+		data->setBufferPool(stream->name(),
+				    stream->isExternal() ? stream : nullptr,
+				    stream->internalBuffers());
 	}
 
 	/*
@@ -1284,6 +1596,8 @@ int PipelineHandlerRPi::prepareBuffers(Camera *camera)
 		mapBuffers(camera, data->unicam_[Unicam::Embedded].getBuffers(),
 			   ipa::RPi::MaskEmbeddedData);
 
+	data->buffersAllocated_ = true;
+
 	return 0;
 }
 
@@ -1316,8 +1630,13 @@ void PipelineHandlerRPi::freeBuffers(Camera *camera)
 	data->ipa_->unmapBuffers(ipaBuffers);
 	data->ipaBuffers_.clear();
 
-	for (auto const stream : data->streams_)
+	for (auto const stream : data->streams_) {
+		data->clearBufferPool(stream->name(),
+				      stream->isExternal() ? stream : nullptr);
 		stream->releaseBuffers();
+	}
+
+	data->buffersAllocated_ = false;
 }
 
 void RPiCameraData::frameStarted(uint32_t sequence)
@@ -1346,7 +1665,7 @@ int RPiCameraData::loadIPA(ipa::RPi::SensorConfig *sensorConfig)
 	 * the environment variable overrides it.
 	 */
 	std::string configurationFile;
-	char const *configFromEnv = utils::secure_getenv("LIBCAMERA_RPI_TUNING_FILE");
+	char const *configFromEnv = GlobalConfiguration::option("LIBCAMERA_RPI_TUNING_FILE");
 	if (!configFromEnv || *configFromEnv == '\0')
 		configurationFile = ipa_->configurationFile(sensor_->model() + ".json");
 	else
@@ -1375,16 +1694,20 @@ int RPiCameraData::configureIPA(const CameraConfiguration *config)
 
 	entityControls.emplace(0, sensor_->controls());
 	entityControls.emplace(1, isp_[Isp::Input].dev()->controls());
+	if (lens_)
+		entityControls.emplace(2, lens_->controls());
 
 	/* Always send the user transform to the IPA. */
 	ipaConfig.transform = static_cast<unsigned int>(config->transform);
 
 	/* Allocate the lens shading table via dmaHeap and pass to the IPA. */
 	if (!lsTable_.isValid()) {
-		lsTable_ = dmaHeap_.alloc("ls_grid", ipa::RPi::MaxLsGridSize);
+		lsTable_ = dmaHeap_->alloc("ls_grid", ipa::RPi::MaxLsGridSize);
 		if (!lsTable_.isValid())
 			return -ENOMEM;
 
+		setBufferPool("ls_grid", nullptr, 1, ipa::RPi::MaxLsGridSize);
+
 		/* Allow the IPA to mmap the LS table via the file descriptor. */
 		/*
 		 * \todo Investigate if mapping the lens shading table buffer
@@ -1393,6 +1716,27 @@ int RPiCameraData::configureIPA(const CameraConfiguration *config)
 		ipaConfig.lsTableHandle = lsTable_;
 	}
 
+	/*
+	 * Allocate the ISP tables buffer in the same way. If it can't be
+	 * mapped, the IPA passes the tables in the ISP controls instead.
+	 */
+	if (!ispTables_.isValid()) {
+		ispTables_ = dmaHeap_->alloc("isp_tables", RPi::IspTablesSize);
+		if (!ispTables_.isValid())
+			return -ENOMEM;
+
+		setBufferPool("isp_tables", nullptr, 1, RPi::IspTablesSize);
+
+		void *mem = mmap(nullptr, RPi::IspTablesSize, PROT_READ,
+				 MAP_SHARED, ispTables_.fd(), 0);
+		if (mem != MAP_FAILED) {
+			ispTablesMem_ = static_cast<RPi::IspTable *>(mem);
+			ipaConfig.ispTablesHandle = ispTables_;
+		} else {
+			LOG(RPI, Warning) << "Failed to map the ISP tables";
+		}
+	}
+
 	/* We store the IPACameraSensorInfo for digital zoom calculations. */
 	int ret = sensor_->sensorInfo(&sensorInfo_);
 	if (ret) {
@@ -1426,7 +1770,7 @@ void RPiCameraData::statsMetadataComplete(uint32_t bufferId, const ControlList &
 
 	/* Add to the Request metadata buffer what the IPA has provided. */
 	Request *request = requestQueue_.front();
-	request->metadata().merge(controls);
+	pipe()->metadataAvailable(request, controls);
 
 	state_ = State::IpaComplete;
 	handleState();
@@ -1453,31 +1797,89 @@ void RPiCameraData::embeddedComplete(uint32_t bufferId)
 		return;
 
 	FrameBuffer *buffer = unicam_[Unicam::Embedded].getBuffers().at(bufferId);
+
+	/*
+	 * Keep the embedded buffer along with its Bayer buffer in the zero
+	 * shutter lag ring, it will be re-queued when evicted from the ring.
+	 */
+	if (zslFrames_ && (zslReprocess_ || buffer == zslPending_.embeddedBuffer)) {
+		handleState();
+		return;
+	}
+
 	handleStreamBuffer(buffer, &unicam_[Unicam::Embedded]);
 	handleState();
 }
 
 void RPiCameraData::setIspControls(const ControlList &controls)
 {
-	ControlList ctrls = controls;
+	ControlList ctrls(isp_[Isp::Input].dev()->controls());
+
+	for (const auto &[id, value] : controls) {
+		ControlValue ctrlValue = value;
+
+		/*
+		 * Controls passed through the ISP tables carry the table
+		 * generation number, replace them with the table content.
+		 */
+		const RPi::IspTable *table = RPi::ispTable(ispTablesMem_, id);
+		if (table && value.type() != ControlTypeByte) {
+			if (table->size > sizeof(table->data)) {
+				LOG_RATELIMITED(RPI, Error)
+					<< "Invalid ISP table for control "
+					<< utils::hex(id);
+				continue;
+			}
+
+			if (table->generation != static_cast<uint32_t>(value.get<int32_t>()))
+				LOG_RATELIMITED(RPI, Warning)
+					<< "ISP table for control " << utils::hex(id)
+					<< " overwritten before being applied";
+
+			ctrlValue = ControlValue(Span<const uint8_t>{ table->data, table->size });
+		}
+
+		if (id == V4L2_CID_USER_BCM2835_ISP_LENS_SHADING) {
+			/*
+			 * The ISP reloads the lens shading grid from the
+			 * dmabuf when the control is set, it must thus be
+			 * applied even if its parameters haven't changed.
+			 */
+			Span<uint8_t> s = ctrlValue.data();
+			bcm2835_isp_lens_shading *ls =
+				reinterpret_cast<bcm2835_isp_lens_shading *>(s.data());
+			ls->dmabuf = lsTable_.fd();
+		} else {
+			/*
+			 * Skip the controls that haven't changed since they
+			 * have last been applied, which is the common case in
+			 * steady scenes.
+			 */
+			auto iter = ispControlsCache_.find(id);
+			if (iter != ispControlsCache_.end() && iter->second == ctrlValue)
+				continue;
 
-	if (ctrls.contains(V4L2_CID_USER_BCM2835_ISP_LENS_SHADING)) {
-		ControlValue &value =
-			const_cast<ControlValue &>(ctrls.get(V4L2_CID_USER_BCM2835_ISP_LENS_SHADING));
-		Span<uint8_t> s = value.data();
-		bcm2835_isp_lens_shading *ls =
-			reinterpret_cast<bcm2835_isp_lens_shading *>(s.data());
-		ls->dmabuf = lsTable_.fd();
+			ispControlsCache_[id] = ctrlValue;
+		}
+
+		ctrls.set(id, ctrlValue);
+	}
+
+	if (!ctrls.empty()) {
+		int ret = isp_[Isp::Input].dev()->setControls(&ctrls);
+		if (ret) {
+			/* The ISP state is unknown, apply all controls next time. */
+			ispControlsCache_.clear();
+		}
 	}
 
-	isp_[Isp::Input].dev()->setControls(&ctrls);
 	handleState();
 }
 
 void RPiCameraData::setDelayedControls(const ControlList &controls)
 {
 	if (!delayedCtrls_->push(controls))
-		LOG(RPI, Error) << "V4L2 DelayedControl set failed";
+		LOG_RATELIMITED(RPI, Error) << "V4L2 DelayedControl set failed";
 	handleState();
 }
 
@@ -1539,7 +1941,7 @@ void RPiCameraData::unicamBufferDequeue(FrameBuffer *buffer)
 		ctrl.set(controls::SensorTimestamp, buffer->metadata().timestamp);
 		bayerQueue_.push({ buffer, std::move(ctrl) });
 	} else {
-		embeddedQueue_.push(buffer);
+		embeddedQueue_.emplace(buffer->metadata().timestamp, buffer);
 	}
 
 	handleState();
@@ -1554,8 +1956,28 @@ void RPiCameraData::ispInputDequeue(FrameBuffer *buffer)
 			<< ", buffer id " << unicam_[Unicam::Image].getBufferId(buffer)
 			<< ", timestamp: " << buffer->metadata().timestamp;
 
-	/* The ISP input buffer gets re-queued into Unicam. */
-	handleStreamBuffer(buffer, &unicam_[Unicam::Image]);
+	if (!zslFrames_) {
+		/* The ISP input buffer gets re-queued into Unicam. */
+		handleStreamBuffer(buffer, &unicam_[Unicam::Image]);
+		handleState();
+		return;
+	}
+
+	/*
+	 * Add the frame to the zero shutter lag ring, unless it was reprocessed
+	 * from the ring, and re-queue the frames that don't fit in the ring
+	 * anymore into Unicam.
+	 */
+	if (!zslReprocess_) {
+		ASSERT(buffer == zslPending_.buffer);
+		zslRing_.push_back(std::move(zslPending_));
+		zslPending_ = {};
+
+		if (zslRing_.size() > zslFrames_)
+			returnZslFrames(zslRing_.size() - zslFrames_);
+	}
+
+	zslReprocess_ = false;
 	handleState();
 }
 
@@ -1672,6 +2094,43 @@ void RPiCameraData::handleExternalBuffer(FrameBuffer *buffer, RPi::Stream *strea
 	stream->removeExternalBuffer(buffer);
 }
 
+int RPiCameraData::allocateOnDemandBuffers(RPi::Stream *stream)
+{
+	if (!stream->needsOnDemandBuffers())
+		return 0;
+
+	utils::time_point start = utils::clock::now();
+
+	int ret = stream->allocateOnDemandBuffers(dmaHeap_.get());
+	if (ret) {
+		LOG(RPI, Error) << "Failed to allocate internal buffers for "
+				<< stream->name();
+		return ret;
+	}
+
+	auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+		utils::clock::now() - start);
+	LOG(RPI, Info) << "Allocated internal buffers for " << stream->name()
+		       << " in " << duration.count() << "us";
+
+	setBufferPool(stream->name(), stream, stream->internalBuffers());
+
+	return 0;
+}
+
+void RPiCameraData::releaseIdleBuffers()
+{
+	for (auto const stream : streams_) {
+		if (!stream->releaseIdleBuffers(kOnDemandBuffersIdleTimeout))
+			continue;
+
+		LOG(RPI, Debug) << "Released idle internal buffers for "
+				<< stream->name();
+
+		clearBufferPool(stream->name(), stream);
+	}
+}
+
 void RPiCameraData::handleState()
 {
 	switch (state_) {
@@ -1783,17 +2242,25 @@ void RPiCameraData::tryRunPipeline()
 	FrameBuffer *embeddedBuffer;
 	BayerFrame bayerFrame;
 
-	/* If any of our request or buffer queues are empty, we cannot proceed. */
-	if (state_ != State::Idle || requestQueue_.empty() ||
-	    bayerQueue_.empty() || (embeddedQueue_.empty() && sensorMetadata_))
-		return;
-
-	if (!findMatchingBuffers(bayerFrame, embeddedBuffer))
+	/*
+	 * If the request queue is empty, we cannot proceed. An empty bayer
+	 * queue or a missing embedded buffer are handled by
+	 * findMatchingBuffers(), unless the request reprocesses a frame.
+	 */
+	if (state_ != State::Idle || requestQueue_.empty())
 		return;
 
 	/* Take the first request from the queue and action the IPA. */
 	Request *request = requestQueue_.front();
 
+	if (!findZslFrame(request->controls(), bayerFrame, embeddedBuffer) &&
+	    !findMatchingBuffers(bayerFrame, embeddedBuffer))
+		return;
+
+	/* Remember the new frame to add it to the zero shutter lag ring. */
+	if (zslFrames_ && !zslReprocess_)
+		zslPending_ = { bayerFrame.buffer, embeddedBuffer, bayerFrame.controls };
+
 	/* See if a new ScalerCrop value needs to be applied. */
 	applyScalerCrop(request->controls());
 
@@ -1837,124 +2304,123 @@ void RPiCameraData::tryRunPipeline()
 	ipa_->signalIspPrepare(ispPrepare);
 }
 
+bool RPiCameraData::findZslFrame(const ControlList &controls, BayerFrame &bayerFrame,
+				 FrameBuffer *&embeddedBuffer)
+{
+	if (zslRing_.empty() ||
+	    !controls.contains(controls::draft::ReprocessTimestamp))
+		return false;
+
+	int64_t timestamp = controls.get(controls::draft::ReprocessTimestamp);
+
+	/* Pick the most recent frame, or the closest one to the timestamp. */
+	auto frame = std::prev(zslRing_.end());
+	if (timestamp) {
+		auto distance = [timestamp](const ZslFrame &f) {
+			return std::abs(f.controls.get(controls::SensorTimestamp) - timestamp);
+		};
+
+		frame = std::min_element(zslRing_.begin(), zslRing_.end(),
+					 [&](const ZslFrame &a, const ZslFrame &b) {
+						 return distance(a) < distance(b);
+					 });
+	}
+
+	LOG(RPI, Debug) << "Reprocessing frame with timestamp "
+			<< frame->controls.get(controls::SensorTimestamp);
+
+	bayerFrame = { frame->buffer, frame->controls };
+	embeddedBuffer = frame->embeddedBuffer;
+	zslReprocess_ = true;
+
+	return true;
+}
+
+void RPiCameraData::returnZslFrames(unsigned int count)
+{
+	for (; count && !zslRing_.empty(); --count) {
+		ZslFrame &frame = zslRing_.front();
+
+		handleStreamBuffer(frame.buffer, &unicam_[Unicam::Image]);
+		if (frame.embeddedBuffer)
+			handleStreamBuffer(frame.embeddedBuffer, &unicam_[Unicam::Embedded]);
+
+		zslRing_.pop_front();
+	}
+}
+
 bool RPiCameraData::findMatchingBuffers(BayerFrame &bayerFrame, FrameBuffer *&embeddedBuffer)
 {
-	unsigned int embeddedRequeueCount = 0, bayerRequeueCount = 0;
+	if (bayerQueue_.empty())
+		return false;
 
-	/* Loop until we find a matching bayer and embedded data buffer. */
-	while (!bayerQueue_.empty()) {
-		/* Start with the front of the bayer queue. */
-		FrameBuffer *bayerBuffer = bayerQueue_.front().buffer;
+	embeddedBuffer = nullptr;
 
+	/*
+	 * If there is no sensor metadata, simply return the first bayer frame
+	 * in the queue.
+	 */
+	if (!sensorMetadata_) {
+		bayerFrame = std::move(bayerQueue_.front());
+		bayerQueue_.pop();
+		return true;
+	}
+
+	uint64_t ts = bayerQueue_.front().buffer->metadata().timestamp;
+
+	if (unicam_[Unicam::Embedded].isExternal()) {
 		/*
-		 * Find the embedded data buffer with a matching timestamp to pass to
-		 * the IPA. Any embedded buffers with a timestamp lower than the
-		 * current bayer buffer will be removed and re-queued to the driver.
+		 * External embedded buffers are returned to the application,
+		 * pair them with bayer frames in order.
 		 */
-		uint64_t ts = bayerBuffer->metadata().timestamp;
-		embeddedBuffer = nullptr;
-		while (!embeddedQueue_.empty()) {
-			FrameBuffer *b = embeddedQueue_.front();
-			if (!unicam_[Unicam::Embedded].isExternal() && b->metadata().timestamp < ts) {
-				embeddedQueue_.pop();
-				unicam_[Unicam::Embedded].queueBuffer(b);
-				embeddedRequeueCount++;
-				LOG(RPI, Warning) << "Dropping unmatched input frame in stream "
-						  << unicam_[Unicam::Embedded].name();
-			} else if (unicam_[Unicam::Embedded].isExternal() || b->metadata().timestamp == ts) {
-				/* We pop the item from the queue lower down. */
-				embeddedBuffer = b;
-				break;
-			} else {
-				break; /* Only higher timestamps from here. */
-			}
+		if (!embeddedQueue_.empty()) {
+			auto it = embeddedQueue_.begin();
+			embeddedBuffer = it->second;
+			embeddedQueue_.erase(it);
 		}
+	} else {
+		/*
+		 * Buffers are queued in capture order. Embedded buffers older
+		 * than the first bayer frame are orphaned and will never find
+		 * a match: requeue them to the device.
+		 */
+		auto end = embeddedQueue_.lower_bound(ts);
+		for (auto it = embeddedQueue_.begin(); it != end; ++it) {
+			LOG_RATELIMITED(RPI, Warning)
+				<< "Dropping unmatched input frame in stream "
+				<< unicam_[Unicam::Embedded].name();
+			unicam_[Unicam::Embedded].queueBuffer(it->second);
+		}
+		embeddedQueue_.erase(embeddedQueue_.begin(), end);
 
-		if (!embeddedBuffer) {
-			bool flushedBuffers = false;
-
-			LOG(RPI, Debug) << "Could not find matching embedded buffer";
-
-			if (!sensorMetadata_) {
-				/*
-				 * If there is no sensor metadata, simply return the
-				 * first bayer frame in the queue.
-				 */
-				LOG(RPI, Debug) << "Returning bayer frame without a match";
-				bayerFrame = std::move(bayerQueue_.front());
-				bayerQueue_.pop();
-				embeddedBuffer = nullptr;
-				return true;
-			}
-
-			if (!embeddedQueue_.empty()) {
-				/*
-				 * Not found a matching embedded buffer for the bayer buffer in
-				 * the front of the queue. This buffer is now orphaned, so requeue
-				 * it back to the device.
-				 */
-				unicam_[Unicam::Image].queueBuffer(bayerQueue_.front().buffer);
-				bayerQueue_.pop();
-				bayerRequeueCount++;
-				LOG(RPI, Warning) << "Dropping unmatched input frame in stream "
-						  << unicam_[Unicam::Image].name();
-			}
-
-			/*
-			 * If we have requeued all available embedded data buffers in this loop,
-			 * then we are fully out of sync, so might as well requeue all the pending
-			 * bayer buffers.
-			 */
-			if (embeddedRequeueCount == unicam_[Unicam::Embedded].getBuffers().size()) {
-				/* The embedded queue must be empty at this point! */
-				ASSERT(embeddedQueue_.empty());
-
-				LOG(RPI, Warning) << "Flushing bayer stream!";
-				while (!bayerQueue_.empty()) {
-					unicam_[Unicam::Image].queueBuffer(bayerQueue_.front().buffer);
-					bayerQueue_.pop();
-				}
-				flushedBuffers = true;
-			}
+		if (!embeddedQueue_.empty() && embeddedQueue_.begin()->first == ts) {
+			auto it = embeddedQueue_.begin();
+			embeddedBuffer = it->second;
+			embeddedQueue_.erase(it);
+		}
+	}
 
-			/*
-			 * Similar to the above, if we have requeued all available bayer buffers in
-			 * the loop, then we are fully out of sync, so might as well requeue all the
-			 * pending embedded data buffers.
-			 */
-			if (bayerRequeueCount == unicam_[Unicam::Image].getBuffers().size()) {
-				/* The bayer queue must be empty at this point! */
-				ASSERT(bayerQueue_.empty());
-
-				LOG(RPI, Warning) << "Flushing embedded data stream!";
-				while (!embeddedQueue_.empty()) {
-					unicam_[Unicam::Embedded].queueBuffer(embeddedQueue_.front());
-					embeddedQueue_.pop();
-				}
-				flushedBuffers = true;
-			}
+	if (!embeddedBuffer) {
+		/*
+		 * The embedded buffer for the bayer frame may not have been
+		 * dequeued yet. Wait for it, unless embedded data for a later
+		 * frame has been received already, in which case the embedded
+		 * buffer for this frame has been lost, or too many bayer frames
+		 * are waiting. Process the bayer frame without embedded data in
+		 * those cases instead of dropping it, the IPA will then use the
+		 * sensor controls recorded by DelayedControls.
+		 */
+		if (embeddedQueue_.empty() &&
+		    bayerQueue_.size() <= kMaxEmbeddedLookahead)
+			return false;
 
-			/*
-			 * If the embedded queue has become empty, we cannot do any more.
-			 * Similarly, if we have flushed any one of our queues, we cannot do
-			 * any more. Return from here without a buffer pair.
-			 */
-			if (embeddedQueue_.empty() || flushedBuffers)
-				return false;
-		} else {
-			/*
-			 * We have found a matching bayer and embedded data buffer, so
-			 * nothing more to do apart from assigning the bayer frame and
-			 * popping the buffers from the queue.
-			 */
-			bayerFrame = std::move(bayerQueue_.front());
-			bayerQueue_.pop();
-			embeddedQueue_.pop();
-			return true;
-		}
+		LOG(RPI, Debug) << "Returning bayer frame without a match";
 	}
 
-	return false;
+	bayerFrame = std::move(bayerQueue_.front());
+	bayerQueue_.pop();
+
+	return true;
 }
 
 REGISTER_PIPELINE_HANDLER(PipelineHandlerRPi)
@@ -10,6 +10,8 @@
 
 #include <libcamera/ipa/raspberrypi_ipa_interface.h>
 
+#include "libcamera/internal/dma_heaps.h"
+
 namespace libcamera {
 
 LOG_DEFINE_CATEGORY(RPISTREAM)
@@ -55,6 +57,11 @@ const BufferMap &Stream::getBuffers() const
 	return bufferMap_;
 }
 
+const std::vector<std::unique_ptr<FrameBuffer>> &Stream::internalBuffers() const
+{
+	return internalBuffers_;
+}
+
 int Stream::getBufferId(FrameBuffer *buffer) const
 {
 	if (importOnly_)
@@ -84,6 +91,82 @@ void Stream::removeExternalBuffer(FrameBuffer *buffer)
 	bufferMap_.erase(id);
 }
 
+void Stream::setOnDemandBuffers(unsigned int count)
+{
+	/* Import streams have no internal buffers. */
+	ASSERT(!count || !importOnly_);
+	onDemandCount_ = count;
+}
+
+bool Stream::needsOnDemandBuffers() const
+{
+	return onDemandCount_ && internalBuffers_.empty();
+}
+
+int Stream::allocateOnDemandBuffers(DmaHeap *dmaHeap)
+{
+	if (!needsOnDemandBuffers())
+		return 0;
+
+	/*
+	 * The buffers can't be exported from the device while it is
+	 * streaming, allocate them from the dma-heap instead, with the layout
+	 * of the stream configuration.
+	 */
+	for (unsigned int i = 0; i < onDemandCount_; ++i) {
+		std::unique_ptr<FrameBuffer> buffer =
+			dmaHeap->allocFrameBuffer(name_.c_str(), configuration());
+		if (!buffer) {
+			internalBuffers_.clear();
+			return -ENOMEM;
+		}
+
+		internalBuffers_.push_back(std::move(buffer));
+	}
+
+	/*
+	 * Track the buffers with the ids of the buffers previously released,
+	 * if any, to avoid running out of ids.
+	 */
+	for (unsigned int i = 0; i < internalBuffers_.size(); ++i) {
+		if (i == onDemandIds_.size())
+			onDemandIds_.push_back(id_.get());
+
+		FrameBuffer *buffer = internalBuffers_[i].get();
+		bufferMap_.emplace(onDemandIds_[i], buffer);
+		availableBuffers_.push(buffer);
+	}
+
+	lastInternalUse_ = utils::clock::now();
+
+	return 0;
+}
+
+bool Stream::releaseIdleBuffers(utils::Duration timeout)
+{
+	if (!onDemandCount_ || internalBuffers_.empty())
+		return false;
+
+	/*
+	 * The buffers can only be freed when none of them is queued to the
+	 * device or waited for by a request.
+	 */
+	if (availableBuffers_.size() != internalBuffers_.size() ||
+	    !requestBuffers_.empty())
+		return false;
+
+	if (utils::clock::now() - lastInternalUse_ < timeout)
+		return false;
+
+	for (unsigned int id : onDemandIds_)
+		bufferMap_.erase(id);
+
+	availableBuffers_ = std::queue<FrameBuffer *>{};
+	internalBuffers_.clear();
+
+	return true;
+}
+
 int Stream::prepareBuffers(unsigned int count)
 {
 	int ret;
@@ -103,8 +186,11 @@ int Stream::prepareBuffers(unsigned int count)
 				availableBuffers_.push(buffer.get());
 		}
 
-		/* We must import all internal/external exported buffers. */
-		count = bufferMap_.size();
+		/*
+		 * We must import all internal/external exported buffers, and
+		 * the internal buffers allocated on demand.
+		 */
+		count = bufferMap_.size() + onDemandCount_;
 	}
 
 	/*
@@ -129,6 +215,8 @@ int Stream::queueBuffer(FrameBuffer *buffer)
 	 * availableBuffers_ queue.
 	 */
 	if (!buffer) {
+		lastInternalUse_ = utils::clock::now();
+
 		if (availableBuffers_.empty()) {
 			LOG(RPISTREAM, Info) << "No buffers available for "
 						<< name_;
@@ -217,6 +305,21 @@ int Stream::queueAllBuffers()
 	return 0;
 }
 
+void Stream::resetBufferQueues()
+{
+	/*
+	 * Return all internal buffers to the available queue, as they are
+	 * all dequeued from the device once streaming has stopped. Buffers
+	 * still pending from requests are dropped, the requests themselves
+	 * have been cancelled.
+	 */
+	availableBuffers_ = std::queue<FrameBuffer *>{};
+	for (auto const &buffer : internalBuffers_)
+		availableBuffers_.push(buffer.get());
+
+	requestBuffers_ = std::queue<FrameBuffer *>{};
+}
+
 void Stream::releaseBuffers()
 {
 	dev_->releaseBuffers();
@@ -230,6 +333,8 @@ void Stream::clearBuffers()
 	internalBuffers_.clear();
 	bufferMap_.clear();
 	id_.reset();
+	onDemandCount_ = 0;
+	onDemandIds_.clear();
 }
 
 int Stream::queueToDevice(FrameBuffer *buffer)
@@ -12,6 +12,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include <libcamera/base/utils.h>
+
 #include <libcamera/ipa/raspberrypi.h>
 #include <libcamera/ipa/raspberrypi_ipa_interface.h>
 #include <libcamera/stream.h>
@@ -20,6 +22,8 @@
 
 namespace libcamera {
 
+class DmaHeap;
+
 namespace RPi {
 
 using BufferMap = std::unordered_map<unsigned int, FrameBuffer *>;
@@ -32,13 +36,14 @@ class Stream : public libcamera::Stream
 {
 public:
 	Stream()
-		: id_(ipa::RPi::MaskID)
+		: id_(ipa::RPi::MaskID), onDemandCount_(0)
 	{
 	}
 
 	Stream(const char *name, MediaEntity *dev, bool importOnly = false)
 		: external_(false), importOnly_(importOnly), name_(name),
-		  dev_(std::make_unique<V4L2VideoDevice>(dev)), id_(ipa::RPi::MaskID)
+		  dev_(std::make_unique<V4L2VideoDevice>(dev)), id_(ipa::RPi::MaskID),
+		  onDemandCount_(0)
 	{
 	}
 
@@ -52,16 +57,23 @@ public:
 
 	void setExportedBuffers(std::vector<std::unique_ptr<FrameBuffer>> *buffers);
 	const BufferMap &getBuffers() const;
+	const std::vector<std::unique_ptr<FrameBuffer>> &internalBuffers() const;
 	int getBufferId(FrameBuffer *buffer) const;
 
 	void setExternalBuffer(FrameBuffer *buffer);
 	void removeExternalBuffer(FrameBuffer *buffer);
 
+	void setOnDemandBuffers(unsigned int count);
+	bool needsOnDemandBuffers() const;
+	int allocateOnDemandBuffers(DmaHeap *dmaHeap);
+	bool releaseIdleBuffers(utils::Duration timeout);
+
 	int prepareBuffers(unsigned int count);
 	int queueBuffer(FrameBuffer *buffer);
 	void returnBuffer(FrameBuffer *buffer);
 
 	int queueAllBuffers();
+	void resetBufferQueues();
 	void releaseBuffers();
 
 private:
@@ -149,6 +161,15 @@ private:
 	 * as the stream needs to maintain ownership of these buffers.
 	 */
 	std::vector<std::unique_ptr<FrameBuffer>> internalBuffers_;
+
+	/*
+	 * Number of internal buffers allocated on first use instead of in
+	 * prepareBuffers(), the ids they are tracked with in the bufferMap_,
+	 * and the last time an internal buffer was requested.
+	 */
+	unsigned int onDemandCount_;
+	std::vector<unsigned int> onDemandIds_;
+	utils::time_point lastInternalUse_;
 };
 
 /*
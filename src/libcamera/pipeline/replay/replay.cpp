@@ -0,0 +1,518 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * replay.cpp - Pipeline handler replaying recorded capture sessions
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <queue>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include <libcamera/base/global_configuration.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/timer.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/camera_manager.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/formats.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/camera.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+#include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/session_recording.h"
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Replay)
+
+class ReplayCameraData : public Camera::Private
+{
+public:
+	ReplayCameraData(PipelineHandler *pipe)
+		: Camera::Private(pipe), fast_(false), index_(0), sequence_(0)
+	{
+	}
+
+	int init(const std::string &path);
+
+	int streamIndex(const Stream *stream) const;
+	const session::Plane *planes(unsigned int stream) const;
+
+	void start();
+	void stop();
+	void queueRequest(Request *request);
+
+	SessionRecording recording_;
+	std::vector<std::unique_ptr<Stream>> streams_;
+
+private:
+	utils::time_point deadline() const;
+	void schedule();
+	void completeRequest(Request *request);
+	void timeout();
+
+	bool fast_;
+	Timer timer_;
+	std::queue<Request *> queue_;
+
+	std::vector<utils::Duration> offsets_;
+	utils::Duration period_;
+
+	utils::time_point startTime_;
+	uint64_t index_;
+	unsigned int sequence_;
+};
+
+class ReplayCameraConfiguration : public CameraConfiguration
+{
+public:
+	ReplayCameraConfiguration(ReplayCameraData *data);
+
+	Status validate() override;
+
+private:
+	ReplayCameraData *data_;
+};
+
+class PipelineHandlerReplay : public PipelineHandler
+{
+public:
+	PipelineHandlerReplay(CameraManager *manager);
+
+	CameraConfiguration *generateConfiguration(Camera *camera,
+		const StreamRoles &roles) override;
+	int configure(Camera *camera, CameraConfiguration *config) override;
+
+	int exportFrameBuffers(Camera *camera, Stream *stream,
+			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+
+	int start(Camera *camera, const ControlList *controls) override;
+	void stop(Camera *camera) override;
+
+	int queueRequestDevice(Camera *camera, Request *request) override;
+
+	bool match(DeviceEnumerator *enumerator) override;
+
+private:
+	ReplayCameraData *cameraData(Camera *camera)
+	{
+		return static_cast<ReplayCameraData *>(camera->_d());
+	}
+};
+
+int ReplayCameraData::init(const std::string &path)
+{
+	int ret = recording_.open(path);
+	if (ret < 0)
+		return ret;
+
+	const std::vector<const session::Request *> &requests = recording_.requests();
+	if (recording_.streams().empty() || requests.empty()) {
+		LOG(Replay, Error) << "Session " << path << " has no frame";
+		return -EINVAL;
+	}
+
+	for (unsigned int i = 0; i < recording_.streams().size(); ++i)
+		streams_.push_back(std::make_unique<Stream>());
+
+	controlInfo_ = recording_.controls();
+	properties_ = recording_.properties();
+
+	/*
+	 * Compute the time of each frame relative to the first one, and the
+	 * duration of the session, used to loop over the recording. The
+	 * session is considered to last one more frame interval after the last
+	 * frame.
+	 */
+	uint64_t first = requests.front()->timestamp;
+	for (const session::Request *request : requests)
+		offsets_.push_back(std::chrono::nanoseconds(request->timestamp - first));
+
+	if (requests.size() > 1)
+		period_ = offsets_.back() * requests.size() / (requests.size() - 1);
+	else
+		period_ = std::chrono::milliseconds(33);
+
+	const char *pacing = GlobalConfiguration::option("LIBCAMERA_REPLAY_PACING");
+	fast_ = pacing && !strcmp(pacing, "fast");
+
+	timer_.timeout.connect(this, &ReplayCameraData::timeout);
+
+	LOG(Replay, Info)
+		<< "Replaying " << requests.size() << " frames of "
+		<< recording_.cameraId() << (fast_ ? " as fast as possible" : "");
+
+	return 0;
+}
+
+int ReplayCameraData::streamIndex(const Stream *stream) const
+{
+	for (unsigned int i = 0; i < streams_.size(); ++i) {
+		if (streams_[i].get() == stream)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Find the planes layout of the buffers of a stream, from the first recorded
+ * buffer of the stream.
+ */
+const session::Plane *ReplayCameraData::planes(unsigned int stream) const
+{
+	for (const session::Request *request : recording_.requests()) {
+		const session::Buffer *buffers = recording_.buffers(request);
+
+		for (unsigned int i = 0; i < request->buffers; ++i) {
+			if (buffers[i].stream == stream)
+				return buffers[i].planes ? buffers[i].plane : nullptr;
+		}
+	}
+
+	return nullptr;
+}
+
+void ReplayCameraData::start()
+{
+	startTime_ = utils::clock::now();
+	index_ = 0;
+	sequence_ = 0;
+}
+
+void ReplayCameraData::stop()
+{
+	timer_.stop();
+
+	while (!queue_.empty()) {
+		Request *request = queue_.front();
+		queue_.pop();
+
+		for (auto it : request->buffers()) {
+			FrameBuffer *buffer = it.second;
+			buffer->cancel();
+			pipe()->completeBuffer(request, buffer);
+		}
+
+		pipe()->completeRequest(request);
+	}
+}
+
+void ReplayCameraData::queueRequest(Request *request)
+{
+	queue_.push(request);
+
+	if (queue_.size() == 1)
+		schedule();
+}
+
+/*
+ * Compute the time at which the next recorded frame completes, offset by the
+ * number of times the recording has been looped over.
+ */
+utils::time_point ReplayCameraData::deadline() const
+{
+	uint64_t count = offsets_.size();
+	utils::Duration offset = period_ * static_cast<double>(index_ / count)
+			       + offsets_[index_ % count];
+
+	return startTime_ + std::chrono::duration_cast<utils::clock::duration>(offset);
+}
+
+void ReplayCameraData::schedule()
+{
+	if (queue_.empty())
+		return;
+
+	if (fast_) {
+		timer_.start(0);
+		return;
+	}
+
+	timer_.start(deadline());
+}
+
+void ReplayCameraData::timeout()
+{
+	if (queue_.empty())
+		return;
+
+	Request *request = queue_.front();
+	queue_.pop();
+
+	completeRequest(request);
+
+	schedule();
+}
+
+void ReplayCameraData::completeRequest(Request *request)
+{
+	const session::Request *record =
+		recording_.requests()[index_ % recording_.requests().size()];
+	const session::Buffer *buffers = recording_.buffers(record);
+
+	index_++;
+
+	uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		utils::clock::now().time_since_epoch()).count();
+
+	for (auto it : request->buffers()) {
+		FrameBuffer *buffer = it.second;
+		FrameMetadata &metadata = buffer->_d()->metadata();
+		int stream = streamIndex(it.first);
+
+		const session::Buffer *recorded =
+			std::find_if(buffers, buffers + record->buffers,
+				     [&](const session::Buffer &b) {
+					     return static_cast<int>(b.stream) == stream;
+				     });
+
+		metadata.sequence = sequence_;
+		metadata.timestamp = timestamp;
+
+		if (recorded == buffers + record->buffers ||
+		    recorded->planes != buffer->planes().size()) {
+			metadata.status = FrameMetadata::FrameError;
+			pipe()->completeBuffer(request, buffer);
+			continue;
+		}
+
+		MappedFrameBuffer mapped(buffer, MappedFrameBuffer::MapFlag::Write);
+		if (!mapped.isValid()) {
+			metadata.status = FrameMetadata::FrameError;
+			pipe()->completeBuffer(request, buffer);
+			continue;
+		}
+
+		for (unsigned int i = 0; i < recorded->planes; ++i) {
+			Span<const uint8_t> data = recording_.data(record, recorded->plane[i]);
+			Span<uint8_t> plane = mapped.planes()[i];
+			size_t size = std::min(data.size(), plane.size());
+
+			memcpy(plane.data(), data.data(), size);
+			metadata.planes()[i].bytesused = size;
+		}
+
+		metadata.status = FrameMetadata::FrameSuccess;
+		pipe()->completeBuffer(request, buffer);
+	}
+
+	sequence_++;
+
+	request->metadata().merge(recording_.metadata(record));
+	request->metadata().set(controls::SensorTimestamp, timestamp);
+
+	pipe()->completeRequest(request);
+}
+
+ReplayCameraConfiguration::ReplayCameraConfiguration(ReplayCameraData *data)
+	: CameraConfiguration(), data_(data)
+{
+}
+
+CameraConfiguration::Status ReplayCameraConfiguration::validate()
+{
+	const std::vector<session::Stream> &streams = data_->recording_.streams();
+	Status status = Valid;
+
+	if (config_.empty())
+		return Invalid;
+
+	if (transform != Transform::Identity) {
+		transform = Transform::Identity;
+		status = Adjusted;
+	}
+
+	/* Cap the number of entries to the recorded streams. */
+	if (config_.size() > streams.size()) {
+		config_.resize(streams.size());
+		status = Adjusted;
+	}
+
+	/* Each entry replays the recorded stream with the same index. */
+	for (unsigned int i = 0; i < config_.size(); ++i) {
+		StreamConfiguration &cfg = config_[i];
+		const session::Stream &stream = streams[i];
+		const StreamConfiguration original = cfg;
+
+		cfg.pixelFormat = PixelFormat(stream.pixelFormat, stream.modifier);
+		cfg.size = Size(stream.width, stream.height);
+		cfg.stride = stream.stride;
+		cfg.frameSize = stream.frameSize;
+		cfg.bufferCount = std::max(cfg.bufferCount, stream.bufferCount);
+
+		/* The layout of the recorded buffers can't be changed. */
+		if (resetBufferConstraints(&cfg))
+			status = Adjusted;
+
+		if (cfg.pixelFormat != original.pixelFormat ||
+		    cfg.size != original.size ||
+		    cfg.bufferCount != original.bufferCount) {
+			LOG(Replay, Debug)
+				<< "Adjusting stream " << i << " to "
+				<< cfg.toString();
+			status = Adjusted;
+		}
+	}
+
+	return status;
+}
+
+PipelineHandlerReplay::PipelineHandlerReplay(CameraManager *manager)
+	: PipelineHandler(manager)
+{
+}
+
+CameraConfiguration *PipelineHandlerReplay::generateConfiguration(Camera *camera,
+	const StreamRoles &roles)
+{
+	ReplayCameraData *data = cameraData(camera);
+	CameraConfiguration *config = new ReplayCameraConfiguration(data);
+	const std::vector<session::Stream> &streams = data->recording_.streams();
+
+	/* Roles are ignored, the recorded streams are used in order. */
+	for (unsigned int i = 0; i < roles.size() && i < streams.size(); ++i) {
+		const session::Stream &stream = streams[i];
+		PixelFormat pixelFormat(stream.pixelFormat, stream.modifier);
+		Size size(stream.width, stream.height);
+
+		std::map<PixelFormat, std::vector<SizeRange>> formats{
+			{ pixelFormat, { SizeRange(size) } },
+		};
+
+		StreamConfiguration cfg(formats);
+		cfg.pixelFormat = pixelFormat;
+		cfg.size = size;
+		cfg.bufferCount = stream.bufferCount;
+
+		config->addConfiguration(cfg);
+	}
+
+	config->validate();
+
+	return config;
+}
+
+int PipelineHandlerReplay::configure(Camera *camera, CameraConfiguration *config)
+{
+	ReplayCameraData *data = cameraData(camera);
+
+	for (unsigned int i = 0; i < config->size(); ++i)
+		config->at(i).setStream(data->streams_[i].get());
+
+	return 0;
+}
+
+int PipelineHandlerReplay::exportFrameBuffers(Camera *camera, Stream *stream,
+					      std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	ReplayCameraData *data = cameraData(camera);
+	const StreamConfiguration &cfg = stream->configuration();
+	int index = data->streamIndex(stream);
+	if (index < 0)
+		return -EINVAL;
+
+	/*
+	 * Allocate buffers with the planes layout of the recorded buffers, or
+	 * a single plane if no buffer has been recorded for the stream.
+	 */
+	const session::Plane *recorded = data->planes(index);
+	std::vector<unsigned int> lengths;
+	for (unsigned int i = 0; recorded && i < session::kMaxPlanes && recorded[i].length; ++i)
+		lengths.push_back(recorded[i].length);
+	if (lengths.empty())
+		lengths.push_back(cfg.frameSize);
+
+	for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+		std::vector<FrameBuffer::Plane> planes;
+
+		for (unsigned int length : lengths) {
+			int fd = memfd_create("libcamera-replay", MFD_CLOEXEC);
+			if (fd < 0 || ftruncate(fd, length) < 0) {
+				int ret = -errno;
+				LOG(Replay, Error)
+					<< "Failed to allocate buffer: " << strerror(-ret);
+				if (fd >= 0)
+					close(fd);
+				return ret;
+			}
+
+			FrameBuffer::Plane plane;
+			plane.fd = FileDescriptor(std::move(fd));
+			plane.offset = 0;
+			plane.length = length;
+			planes.push_back(std::move(plane));
+		}
+
+		buffers->push_back(std::make_unique<FrameBuffer>(planes));
+	}
+
+	return cfg.bufferCount;
+}
+
+int PipelineHandlerReplay::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+{
+	cameraData(camera)->start();
+
+	return 0;
+}
+
+void PipelineHandlerReplay::stop(Camera *camera)
+{
+	cameraData(camera)->stop();
+}
+
+int PipelineHandlerReplay::queueRequestDevice(Camera *camera, Request *request)
+{
+	/*
+	 * The request controls are ignored, the recorded metadata are
+	 * reported instead.
+	 */
+	cameraData(camera)->queueRequest(request);
+
+	return 0;
+}
+
+bool PipelineHandlerReplay::match([[maybe_unused]] DeviceEnumerator *enumerator)
+{
+	const char *path = GlobalConfiguration::option("LIBCAMERA_REPLAY_SESSION");
+	if (!path || !*path)
+		return false;
+
+	std::unique_ptr<ReplayCameraData> data =
+		std::make_unique<ReplayCameraData>(this);
+	if (data->init(path))
+		return false;
+
+	/*
+	 * The pipeline handler is matched again when devices are hotplugged,
+	 * register the camera once only.
+	 */
+	const std::string id = "replay:" + data->recording_.cameraId();
+	if (manager_->get(id))
+		return false;
+
+	std::set<Stream *> streams;
+	for (const std::unique_ptr<Stream> &stream : data->streams_)
+		streams.insert(stream.get());
+
+	std::shared_ptr<Camera> camera =
+		Camera::create(std::move(data), id, streams);
+	registerCamera(std::move(camera));
+
+	return true;
+}
+
+REGISTER_PIPELINE_HANDLER(PipelineHandlerReplay)
+
+} /* namespace libcamera */
@@ -31,6 +31,8 @@
 #include "libcamera/internal/camera_sensor.h"
 #include "libcamera/internal/delayed_controls.h"
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/frame_context_ring.h"
+#include "libcamera/internal/framebuffer.h"
 #include "libcamera/internal/ipa_manager.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
@@ -64,6 +66,8 @@ class RkISP1Frames
 public:
 	RkISP1Frames(PipelineHandler *pipe);
 
+	void reset(unsigned int capacity);
+
 	RkISP1FrameInfo *create(const RkISP1CameraData *data, Request *request);
 	int destroy(unsigned int frame);
 	void clear();
@@ -74,7 +78,7 @@ public:
 
 private:
 	PipelineHandlerRkISP1 *pipe_;
-	std::map<unsigned int, RkISP1FrameInfo *> frameInfo_;
+	FrameContextRing<RkISP1FrameInfo> frameInfo_;
 };
 
 class RkISP1CameraData : public Camera::Private
@@ -82,8 +86,9 @@ class RkISP1CameraData : public Camera::Private
 public:
 	RkISP1CameraData(PipelineHandler *pipe, RkISP1MainPath *mainPath,
 			 RkISP1SelfPath *selfPath)
-		: Camera::Private(pipe), frame_(0), frameInfo_(pipe),
-		  mainPath_(mainPath), selfPath_(selfPath)
+		: Camera::Private(pipe), frameInfo_(pipe),
+		  mainPath_(mainPath), selfPath_(selfPath),
+		  keepAllocations_(false)
 	{
 	}
 
@@ -94,13 +99,14 @@ public:
 	Stream selfPathStream_;
 	std::unique_ptr<CameraSensor> sensor_;
 	std::unique_ptr<DelayedControls> delayedCtrls_;
-	unsigned int frame_;
 	std::vector<IPABuffer> ipaBuffers_;
 	RkISP1Frames frameInfo_;
 
 	RkISP1MainPath *mainPath_;
 	RkISP1SelfPath *selfPath_;
 
+	bool keepAllocations_;
+
 	std::unique_ptr<ipa::rkisp1::IPAProxyRkISP1> ipa_;
 
 private:
@@ -120,7 +126,11 @@ public:
 	const V4L2SubdeviceFormat &sensorFormat() { return sensorFormat_; }
 
 private:
-	bool fitsAllPaths(const StreamConfiguration &cfg);
+	static constexpr unsigned int kMinBufferCount = 2;
+	static constexpr unsigned int kMaxBufferCount = 8;
+
+	bool fitsAllPaths(const StreamConfiguration &cfg,
+			  unsigned int maxBufferCount);
 
 	/*
 	 * The RkISP1CameraData instance is guaranteed to be valid as long as the
@@ -147,6 +157,7 @@ public:
 
 	int start(Camera *camera, const ControlList *controls) override;
 	void stop(Camera *camera) override;
+	void releaseDevice(Camera *camera) override;
 
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
@@ -187,6 +198,7 @@ private:
 	std::queue<FrameBuffer *> availableStatBuffers_;
 
 	Camera *activeCamera_;
+	Camera *allocatedCamera_;
 };
 
 RkISP1Frames::RkISP1Frames(PipelineHandler *pipe)
@@ -194,30 +206,42 @@ RkISP1Frames::RkISP1Frames(PipelineHandler *pipe)
 {
 }
 
+void RkISP1Frames::reset(unsigned int capacity)
+{
+	frameInfo_.reset(capacity);
+}
+
 RkISP1FrameInfo *RkISP1Frames::create(const RkISP1CameraData *data, Request *request)
 {
-	unsigned int frame = data->frame_;
+	unsigned int frame = request->sequence();
 
 	if (pipe_->availableParamBuffers_.empty()) {
-		LOG(RkISP1, Error) << "Parameters buffer underrun";
+		LOG_RATELIMITED(RkISP1, Error) << "Parameters buffer underrun";
 		return nullptr;
 	}
 	FrameBuffer *paramBuffer = pipe_->availableParamBuffers_.front();
 
 	if (pipe_->availableStatBuffers_.empty()) {
-		LOG(RkISP1, Error) << "Statisitc buffer underrun";
+		LOG_RATELIMITED(RkISP1, Error) << "Statisitc buffer underrun";
 		return nullptr;
 	}
 	FrameBuffer *statBuffer = pipe_->availableStatBuffers_.front();
 
+	RkISP1FrameInfo *info = frameInfo_.alloc(frame);
+	if (!info) {
+		LOG_RATELIMITED(RkISP1, Error) << "Frame tracking underrun";
+		return nullptr;
+	}
+
 	FrameBuffer *mainPathBuffer = request->findBuffer(&data->mainPathStream_);
 	FrameBuffer *selfPathBuffer = request->findBuffer(&data->selfPathStream_);
 
+	paramBuffer->_d()->setRequest(request);
+	statBuffer->_d()->setRequest(request);
+
 	pipe_->availableParamBuffers_.pop();
 	pipe_->availableStatBuffers_.pop();
 
-	RkISP1FrameInfo *info = new RkISP1FrameInfo;
-
 	info->frame = frame;
 	info->request = request;
 	info->paramBuffer = paramBuffer;
@@ -227,8 +251,6 @@ RkISP1FrameInfo *RkISP1Frames::create(const RkISP1CameraData *data, Request *req
 	info->paramDequeued = false;
 	info->metadataProcessed = false;
 
-	frameInfo_[frame] = info;
-
 	return info;
 }
 
@@ -241,33 +263,26 @@ int RkISP1Frames::destroy(unsigned int frame)
 	pipe_->availableParamBuffers_.push(info->paramBuffer);
 	pipe_->availableStatBuffers_.push(info->statBuffer);
 
-	frameInfo_.erase(info->frame);
-
-	delete info;
+	frameInfo_.release(info->frame);
 
 	return 0;
 }
 
 void RkISP1Frames::clear()
 {
-	for (const auto &entry : frameInfo_) {
-		RkISP1FrameInfo *info = entry.second;
-
-		pipe_->availableParamBuffers_.push(info->paramBuffer);
-		pipe_->availableStatBuffers_.push(info->statBuffer);
-
-		delete info;
-	}
-
+	/*
+	 * All frames have completed when the camera is stopped, and the buffers
+	 * queues are emptied when freeing buffers, no need to return the
+	 * parameters and statistics buffers.
+	 */
 	frameInfo_.clear();
 }
 
 RkISP1FrameInfo *RkISP1Frames::find(unsigned int frame)
 {
-	auto itInfo = frameInfo_.find(frame);
-
-	if (itInfo != frameInfo_.end())
-		return itInfo->second;
+	RkISP1FrameInfo *info = frameInfo_.get(frame);
+	if (info)
+		return info;
 
 	LOG(RkISP1, Fatal) << "Can't locate info from frame";
 
@@ -276,13 +291,15 @@ RkISP1FrameInfo *RkISP1Frames::find(unsigned int frame)
 
 RkISP1FrameInfo *RkISP1Frames::find(FrameBuffer *buffer)
 {
-	for (auto &itInfo : frameInfo_) {
-		RkISP1FrameInfo *info = itInfo.second;
-
-		if (info->paramBuffer == buffer ||
-		    info->statBuffer == buffer ||
-		    info->mainPathBuffer == buffer ||
-		    info->selfPathBuffer == buffer)
+	/*
+	 * All buffers tracked by a frame are associated with its request,
+	 * either by the application for the main and self path buffers, or
+	 * when creating the frame for the parameters and statistics buffers.
+	 */
+	Request *request = buffer->request();
+	if (request) {
+		RkISP1FrameInfo *info = frameInfo_.get(request->sequence());
+		if (info && info->request == request)
 			return info;
 	}
 
@@ -293,12 +310,9 @@ RkISP1FrameInfo *RkISP1Frames::find(FrameBuffer *buffer)
 
 RkISP1FrameInfo *RkISP1Frames::find(Request *request)
 {
-	for (auto &itInfo : frameInfo_) {
-		RkISP1FrameInfo *info = itInfo.second;
-
-		if (info->request == request)
-			return info;
-	}
+	RkISP1FrameInfo *info = frameInfo_.get(request->sequence());
+	if (info && info->request == request)
+		return info;
 
 	LOG(RkISP1, Fatal) << "Can't locate info from request";
 
@@ -369,7 +383,7 @@ void RkISP1CameraData::metadataReady(unsigned int frame, const ControlList &meta
 	if (!info)
 		return;
 
-	info->request->metadata().merge(metadata);
+	pipe()->metadataAvailable(info->request, metadata);
 	info->metadataProcessed = true;
 
 	pipe()->tryCompleteRequest(info->request);
@@ -383,16 +397,17 @@ RkISP1CameraConfiguration::RkISP1CameraConfiguration(Camera *camera,
 	data_ = data;
 }
 
-bool RkISP1CameraConfiguration::fitsAllPaths(const StreamConfiguration &cfg)
+bool RkISP1CameraConfiguration::fitsAllPaths(const StreamConfiguration &cfg,
+					     unsigned int maxBufferCount)
 {
 	StreamConfiguration config;
 
 	config = cfg;
-	if (data_->mainPath_->validate(&config) != Valid)
+	if (data_->mainPath_->validate(&config, maxBufferCount) != Valid)
 		return false;
 
 	config = cfg;
-	if (data_->selfPath_->validate(&config) != Valid)
+	if (data_->selfPath_->validate(&config, maxBufferCount) != Valid)
 		return false;
 
 	return true;
@@ -417,6 +432,16 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 		status = Adjusted;
 	}
 
+	/*
+	 * The pipeline depth bounds the number of buffers of each stream. The
+	 * parameters and statistics pools are sized accordingly in
+	 * allocateBuffers().
+	 */
+	unsigned int maxBufferCount = RkISP1Path::RKISP1_BUFFER_COUNT;
+	if (pipelineDepth)
+		maxBufferCount = std::clamp(pipelineDepth, kMinBufferCount,
+					    kMaxBufferCount);
+
 	/*
 	 * If there are more than one stream in the configuration figure out the
 	 * order to evaluate the streams. The first stream has the highest
@@ -426,7 +451,7 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 	 */
 	std::vector<unsigned int> order(config_.size());
 	std::iota(order.begin(), order.end(), 0);
-	if (config_.size() == 2 && fitsAllPaths(config_[0]))
+	if (config_.size() == 2 && fitsAllPaths(config_[0], maxBufferCount))
 		std::reverse(order.begin(), order.end());
 
 	bool mainPathAvailable = true;
@@ -437,7 +462,7 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 		/* Try to match stream without adjusting configuration. */
 		if (mainPathAvailable) {
 			StreamConfiguration tryCfg = cfg;
-			if (data_->mainPath_->validate(&tryCfg) == Valid) {
+			if (data_->mainPath_->validate(&tryCfg, maxBufferCount) == Valid) {
 				mainPathAvailable = false;
 				cfg = tryCfg;
 				cfg.setStream(const_cast<Stream *>(&data_->mainPathStream_));
@@ -447,7 +472,7 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 
 		if (selfPathAvailable) {
 			StreamConfiguration tryCfg = cfg;
-			if (data_->selfPath_->validate(&tryCfg) == Valid) {
+			if (data_->selfPath_->validate(&tryCfg, maxBufferCount) == Valid) {
 				selfPathAvailable = false;
 				cfg = tryCfg;
 				cfg.setStream(const_cast<Stream *>(&data_->selfPathStream_));
@@ -458,7 +483,7 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 		/* Try to match stream allowing adjusting configuration. */
 		if (mainPathAvailable) {
 			StreamConfiguration tryCfg = cfg;
-			if (data_->mainPath_->validate(&tryCfg) == Adjusted) {
+			if (data_->mainPath_->validate(&tryCfg, maxBufferCount) == Adjusted) {
 				mainPathAvailable = false;
 				cfg = tryCfg;
 				cfg.setStream(const_cast<Stream *>(&data_->mainPathStream_));
@@ -469,7 +494,7 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 
 		if (selfPathAvailable) {
 			StreamConfiguration tryCfg = cfg;
-			if (data_->selfPath_->validate(&tryCfg) == Adjusted) {
+			if (data_->selfPath_->validate(&tryCfg, maxBufferCount) == Adjusted) {
 				selfPathAvailable = false;
 				cfg = tryCfg;
 				cfg.setStream(const_cast<Stream *>(&data_->selfPathStream_));
@@ -501,7 +526,8 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 					    MEDIA_BUS_FMT_SGBRG8_1X8,
 					    MEDIA_BUS_FMT_SGRBG8_1X8,
 					    MEDIA_BUS_FMT_SRGGB8_1X8 },
-					  maxSize);
+					  maxSize,
+					  std::chrono::microseconds(minFrameDuration));
 	if (sensorFormat_.size.isNull())
 		sensorFormat_.size = sensor->resolution();
 
@@ -509,7 +535,7 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 }
 
 PipelineHandlerRkISP1::PipelineHandlerRkISP1(CameraManager *manager)
-	: PipelineHandler(manager)
+	: PipelineHandler(manager), allocatedCamera_(nullptr)
 {
 }
 
@@ -574,6 +600,16 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 	CameraSensor *sensor = data->sensor_.get();
 	int ret;
 
+	/*
+	 * Formats can't be changed while buffers are allocated, release the
+	 * buffers kept allocated by the previous capture session, which may
+	 * belong to another camera sharing the ISP.
+	 */
+	if (allocatedCamera_)
+		freeBuffers(allocatedCamera_);
+
+	data->keepAllocations_ = config->keepAllocations;
+
 	ret = initLinks(camera, sensor, *config);
 	if (ret)
 		return ret;
@@ -692,16 +728,23 @@ int PipelineHandlerRkISP1::allocateBuffers(Camera *camera)
 	unsigned int ipaBufferId = 1;
 	int ret;
 
-	unsigned int maxCount = std::max({
-		data->mainPathStream_.configuration().bufferCount,
-		data->selfPathStream_.configuration().bufferCount,
-	});
+	/*
+	 * Requests don't have to carry buffers for all streams, which lets
+	 * applications capture each stream at its own rate. Every request
+	 * consumes a parameters and a statistics buffer though, size the pools
+	 * for the worst case where no request carries buffers for both paths.
+	 */
+	unsigned int count = 0;
+	if (data->mainPath_->isEnabled())
+		count += data->mainPathStream_.configuration().bufferCount;
+	if (data->selfPath_->isEnabled())
+		count += data->selfPathStream_.configuration().bufferCount;
 
-	ret = param_->allocateBuffers(maxCount, &paramBuffers_);
+	ret = param_->allocateBuffers(count, &paramBuffers_);
 	if (ret < 0)
 		goto error;
 
-	ret = stat_->allocateBuffers(maxCount, &statBuffers_);
+	ret = stat_->allocateBuffers(count, &statBuffers_);
 	if (ret < 0)
 		goto error;
 
@@ -709,18 +752,27 @@ int PipelineHandlerRkISP1::allocateBuffers(Camera *camera)
 		buffer->setCookie(ipaBufferId++);
 		data->ipaBuffers_.emplace_back(buffer->cookie(),
 					       buffer->planes());
-		availableParamBuffers_.push(buffer.get());
 	}
 
 	for (std::unique_ptr<FrameBuffer> &buffer : statBuffers_) {
 		buffer->setCookie(ipaBufferId++);
 		data->ipaBuffers_.emplace_back(buffer->cookie(),
 					       buffer->planes());
-		availableStatBuffers_.push(buffer.get());
 	}
 
 	data->ipa_->mapBuffers(data->ipaBuffers_);
 
+	data->setBufferPool("params", nullptr, paramBuffers_);
+	data->setBufferPool("stats", nullptr, statBuffers_);
+
+	allocatedCamera_ = camera;
+
+	/*
+	 * The number of frames in flight is bounded by the number of
+	 * parameters and statistics buffers.
+	 */
+	data->frameInfo_.reset(count);
+
 	return 0;
 
 error:
@@ -743,6 +795,9 @@ int PipelineHandlerRkISP1::freeBuffers(Camera *camera)
 	paramBuffers_.clear();
 	statBuffers_.clear();
 
+	data->clearBufferPool("params");
+	data->clearBufferPool("stats");
+
 	std::vector<unsigned int> ids;
 	for (IPABuffer &ipabuf : data->ipaBuffers_)
 		ids.push_back(ipabuf.id);
@@ -756,20 +811,44 @@ int PipelineHandlerRkISP1::freeBuffers(Camera *camera)
 	if (stat_->releaseBuffers())
 		LOG(RkISP1, Error) << "Failed to release stat buffers";
 
+	mainPath_.releaseBuffers();
+	selfPath_.releaseBuffers();
+
+	allocatedCamera_ = nullptr;
+
 	return 0;
 }
 
-int PipelineHandlerRkISP1::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+void PipelineHandlerRkISP1::releaseDevice(Camera *camera)
+{
+	if (allocatedCamera_ == camera)
+		freeBuffers(camera);
+}
+
+int PipelineHandlerRkISP1::start(Camera *camera, const ControlList *controls)
 {
 	RkISP1CameraData *data = cameraData(camera);
 	int ret;
 
-	/* Allocate buffers for internal pipeline usage. */
-	ret = allocateBuffers(camera);
-	if (ret)
-		return ret;
+	/*
+	 * Allocate buffers for internal pipeline usage, unless they have been
+	 * kept allocated when the camera was last stopped.
+	 */
+	if (allocatedCamera_ != camera) {
+		ret = allocateBuffers(camera);
+		if (ret)
+			return ret;
+	}
+
+	availableParamBuffers_ = {};
+	for (std::unique_ptr<FrameBuffer> &buffer : paramBuffers_)
+		availableParamBuffers_.push(buffer.get());
 
-	ret = data->ipa_->start();
+	availableStatBuffers_ = {};
+	for (std::unique_ptr<FrameBuffer> &buffer : statBuffers_)
+		availableStatBuffers_.push(buffer.get());
+
+	ret = data->ipa_->start(controls ? *controls : ControlList{ controls::controls });
 	if (ret) {
 		freeBuffers(camera);
 		LOG(RkISP1, Error)
@@ -777,8 +856,6 @@ int PipelineHandlerRkISP1::start(Camera *camera, [[maybe_unused]] const ControlL
 		return ret;
 	}
 
-	data->frame_ = 0;
-
 	ret = param_->streamOn();
 	if (ret) {
 		data->ipa_->stop();
@@ -852,7 +929,8 @@ void PipelineHandlerRkISP1::stop(Camera *camera)
 	ASSERT(data->queuedRequests_.empty());
 	data->frameInfo_.clear();
 
-	freeBuffers(camera);
+	if (!data->keepAllocations_)
+		freeBuffers(camera);
 
 	activeCamera_ = nullptr;
 }
@@ -867,13 +945,11 @@ int PipelineHandlerRkISP1::queueRequestDevice(Camera *camera, Request *request)
 
 	ipa::rkisp1::RkISP1Event ev;
 	ev.op = ipa::rkisp1::EventQueueRequest;
-	ev.frame = data->frame_;
+	ev.frame = info->frame;
 	ev.bufferId = info->paramBuffer->cookie();
 	ev.controls = request->controls();
 	data->ipa_->processEvent(ev);
 
-	data->frame_++;
-
 	return 0;
 }
 
@@ -937,6 +1013,10 @@ int PipelineHandlerRkISP1::createCamera(MediaEntity *sensor)
 	ctrls.emplace(std::piecewise_construct,
 		      std::forward_as_tuple(&controls::AeEnable),
 		      std::forward_as_tuple(false, true));
+	ctrls.emplace(std::piecewise_construct,
+		      std::forward_as_tuple(&controls::draft::ConvergedState),
+		      std::forward_as_tuple(static_cast<uint8_t>(0),
+					    static_cast<uint8_t>(255)));
 
 	data->controlInfo_ = ControlInfoMap(std::move(ctrls),
 					    controls::controls);
@@ -1004,6 +1084,9 @@ bool PipelineHandlerRkISP1::match(DeviceEnumerator *enumerator)
 		return false;
 	}
 
+	/* Prepare the IPA while the media graph and sensors are set up. */
+	IPAManager::prefetch(this, 1, 1);
+
 	/* Create the V4L2 subdevices we will need. */
 	isp_ = V4L2Subdevice::fromEntityName(media_, "rkisp1_isp");
 	if (isp_->open() < 0)
@@ -1018,6 +1101,13 @@ bool PipelineHandlerRkISP1::match(DeviceEnumerator *enumerator)
 	if (param_->open() < 0)
 		return false;
 
+	/*
+	 * The IPA only reads statistics and writes parameters, skip the
+	 * unneeded cache maintenance operations.
+	 */
+	stat_->setCacheHint(V4L2VideoDevice::CacheHint::CpuRead);
+	param_->setCacheHint(V4L2VideoDevice::CacheHint::CpuWrite);
+
 	/* Locate and open the ISP main and self paths. */
 	if (!mainPath_.init(media_))
 		return false;
@@ -1117,9 +1207,6 @@ void PipelineHandlerRkISP1::statReady(FrameBuffer *buffer)
 		return;
 	}
 
-	if (data->frame_ <= buffer->metadata().sequence)
-		data->frame_ = buffer->metadata().sequence + 1;
-
 	ipa::rkisp1::RkISP1Event ev;
 	ev.op = ipa::rkisp1::EventSignalStatBuffer;
 	ev.frame = info->frame;
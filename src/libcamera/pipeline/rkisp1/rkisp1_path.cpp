@@ -22,7 +22,8 @@ LOG_DECLARE_CATEGORY(RkISP1)
 
 RkISP1Path::RkISP1Path(const char *name, const Span<const PixelFormat> &formats,
 		       const Size &minResolution, const Size &maxResolution)
-	: name_(name), running_(false), formats_(formats),
+	: name_(name), running_(false), buffersImported_(false),
+	  bufferCount_(RKISP1_BUFFER_COUNT), formats_(formats),
 	  minResolution_(minResolution), maxResolution_(maxResolution),
 	  link_(nullptr)
 {
@@ -66,7 +67,8 @@ StreamConfiguration RkISP1Path::generateConfiguration(const Size &resolution)
 	return cfg;
 }
 
-CameraConfiguration::Status RkISP1Path::validate(StreamConfiguration *cfg)
+CameraConfiguration::Status RkISP1Path::validate(StreamConfiguration *cfg,
+						 unsigned int maxBufferCount)
 {
 	const StreamConfiguration reqCfg = *cfg;
 	CameraConfiguration::Status status = CameraConfiguration::Valid;
@@ -77,16 +79,28 @@ CameraConfiguration::Status RkISP1Path::validate(StreamConfiguration *cfg)
 
 	cfg->size.boundTo(maxResolution_);
 	cfg->size.expandTo(minResolution_);
-	cfg->bufferCount = RKISP1_BUFFER_COUNT;
+
+	/*
+	 * Streams captured at a fraction of the frame rate, such as a
+	 * full-resolution snapshot stream next to a viewfinder, don't need as
+	 * many buffers as the streams captured for every frame. Honour smaller
+	 * buffer counts to save memory.
+	 */
+	if (!cfg->bufferCount || cfg->bufferCount > maxBufferCount)
+		cfg->bufferCount = maxBufferCount;
 
 	V4L2DeviceFormat format;
 	format.fourcc = V4L2PixelFormat::fromPixelFormat(cfg->pixelFormat);
 	format.size = cfg->size;
+	format.applyConstraints(*cfg);
 
 	int ret = video_->tryFormat(&format);
 	if (ret)
 		return CameraConfiguration::Invalid;
 
+	if (format.adjustConstraints(cfg))
+		status = CameraConfiguration::Adjusted;
+
 	cfg->stride = format.planes[0].bpl;
 	cfg->frameSize = format.planes[0].size;
 
@@ -149,6 +163,7 @@ int RkISP1Path::configure(const StreamConfiguration &config,
 	outputFormat.fourcc = V4L2PixelFormat::fromPixelFormat(config.pixelFormat);
 	outputFormat.size = config.size;
 	outputFormat.planesCount = info.numPlanes();
+	outputFormat.applyConstraints(config);
 
 	ret = video_->setFormat(&outputFormat);
 	if (ret)
@@ -161,6 +176,8 @@ int RkISP1Path::configure(const StreamConfiguration &config,
 		return -EINVAL;
 	}
 
+	bufferCount_ = config.bufferCount;
+
 	return 0;
 }
 
@@ -171,17 +188,21 @@ int RkISP1Path::start()
 	if (running_)
 		return -EBUSY;
 
-	/* \todo Make buffer count user configurable. */
-	ret = video_->importBuffers(RKISP1_BUFFER_COUNT);
-	if (ret)
-		return ret;
+	/* Buffers may have been kept imported when the path was last stopped. */
+	if (!buffersImported_) {
+		ret = video_->importBuffers(bufferCount_);
+		if (ret)
+			return ret;
+
+		buffersImported_ = true;
+	}
 
 	ret = video_->streamOn();
 	if (ret) {
 		LOG(RkISP1, Error)
 			<< "Failed to start " << name_ << " path";
 
-		video_->releaseBuffers();
+		releaseBuffers();
 		return ret;
 	}
 
@@ -198,11 +219,18 @@ void RkISP1Path::stop()
 	if (video_->streamOff())
 		LOG(RkISP1, Warning) << "Failed to stop " << name_ << " path";
 
-	video_->releaseBuffers();
-
 	running_ = false;
 }
 
+void RkISP1Path::releaseBuffers()
+{
+	if (!buffersImported_)
+		return;
+
+	video_->releaseBuffers();
+	buffersImported_ = false;
+}
+
 namespace {
 constexpr Size RKISP1_RSZ_MP_SRC_MIN{ 32, 16 };
 constexpr Size RKISP1_RSZ_MP_SRC_MAX{ 4416, 3312 };
@@ -30,6 +30,8 @@ struct V4L2SubdeviceFormat;
 class RkISP1Path
 {
 public:
+	static constexpr unsigned int RKISP1_BUFFER_COUNT = 4;
+
 	RkISP1Path(const char *name, const Span<const PixelFormat> &formats,
 		   const Size &minResolution, const Size &maxResolution);
 
@@ -39,7 +41,8 @@ public:
 	bool isEnabled() const { return link_->flags() & MEDIA_LNK_FL_ENABLED; }
 
 	StreamConfiguration generateConfiguration(const Size &resolution);
-	CameraConfiguration::Status validate(StreamConfiguration *cfg);
+	CameraConfiguration::Status validate(StreamConfiguration *cfg,
+					     unsigned int maxBufferCount);
 
 	int configure(const StreamConfiguration &config,
 		      const V4L2SubdeviceFormat &inputFormat);
@@ -52,15 +55,16 @@ public:
 
 	int start();
 	void stop();
+	void releaseBuffers();
 
 	int queueBuffer(FrameBuffer *buffer) { return video_->queueBuffer(buffer); }
 	Signal<FrameBuffer *> &bufferReady() { return video_->bufferReady; }
 
 private:
-	static constexpr unsigned int RKISP1_BUFFER_COUNT = 4;
-
 	const char *name_;
 	bool running_;
+	bool buffersImported_;
+	unsigned int bufferCount_;
 
 	const Span<const PixelFormat> formats_;
 	const Size minResolution_;
@@ -9,7 +9,9 @@
 
 #include <algorithm>
 #include <limits.h>
+#include <stdlib.h>
 
+#include <libcamera/base/global_configuration.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/signal.h>
 #include <libcamera/base/utils.h>
@@ -26,11 +28,11 @@ namespace libcamera {
 LOG_DECLARE_CATEGORY(SimplePipeline)
 
 /* -----------------------------------------------------------------------------
- * SimpleConverter::Stream
+ * SimpleM2MConverter::Stream
  */
 
-SimpleConverter::Stream::Stream(SimpleConverter *converter, unsigned int index)
-	: converter_(converter), index_(index)
+SimpleM2MConverter::Stream::Stream(SimpleM2MConverter *converter, unsigned int index)
+	: converter_(converter), index_(index), jobsInFlight_(0)
 {
 	m2m_ = std::make_unique<V4L2M2MDevice>(converter->deviceNode_);
 
@@ -42,7 +44,7 @@ SimpleConverter::Stream::Stream(SimpleConverter *converter, unsigned int index)
 		m2m_.reset();
 }
 
-int SimpleConverter::Stream::configure(const StreamConfiguration &inputCfg,
+int SimpleM2MConverter::Stream::configure(const StreamConfiguration &inputCfg,
 				       const StreamConfiguration &outputCfg)
 {
 	V4L2PixelFormat videoFormat =
@@ -95,14 +97,16 @@ int SimpleConverter::Stream::configure(const StreamConfiguration &inputCfg,
 	return 0;
 }
 
-int SimpleConverter::Stream::exportBuffers(unsigned int count,
+int SimpleM2MConverter::Stream::exportBuffers(unsigned int count,
 					   std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
 	return m2m_->capture()->exportBuffers(count, buffers);
 }
 
-int SimpleConverter::Stream::start()
+int SimpleM2MConverter::Stream::start()
 {
+	jobsInFlight_ = 0;
+
 	int ret = m2m_->output()->importBuffers(inputBufferCount_);
 	if (ret < 0)
 		return ret;
@@ -128,16 +132,53 @@ int SimpleConverter::Stream::start()
 	return 0;
 }
 
-void SimpleConverter::Stream::stop()
+void SimpleM2MConverter::Stream::stop()
 {
+	/*
+	 * Take the pending jobs out of the queue before stopping the device,
+	 * to prevent the completion handlers from submitting them.
+	 */
+	std::queue<Job> pendingJobs;
+	std::swap(pendingJobs, pendingJobs_);
+
 	m2m_->capture()->streamOff();
 	m2m_->output()->streamOff();
 	m2m_->capture()->releaseBuffers();
 	m2m_->output()->releaseBuffers();
+
+	/*
+	 * Cancel the jobs that never reached the device, after the ones that
+	 * did, to complete the buffers in the order they have been queued.
+	 */
+	while (!pendingJobs.empty()) {
+		Job &job = pendingJobs.front();
+
+		job.output->cancel();
+		converter_->outputBufferReady.emit(job.output);
+		outputBufferReady(job.input);
+
+		pendingJobs.pop();
+	}
 }
 
-int SimpleConverter::Stream::queueBuffers(FrameBuffer *input,
+int SimpleM2MConverter::Stream::queueBuffers(FrameBuffer *input,
 					  FrameBuffer *output)
+{
+	/*
+	 * Keep at most queueDepth() jobs queued to the device, and defer the
+	 * other ones until a conversion completes. This bounds the latency of
+	 * each stream while still allowing the device to process the next
+	 * frame without waiting for the CPU to queue it.
+	 */
+	if (jobsInFlight_ >= converter_->queueDepth()) {
+		pendingJobs_.push({ input, output });
+		return 0;
+	}
+
+	return submit(input, output);
+}
+
+int SimpleM2MConverter::Stream::submit(FrameBuffer *input, FrameBuffer *output)
 {
 	int ret = m2m_->output()->queueBuffer(input);
 	if (ret < 0)
@@ -147,15 +188,17 @@ int SimpleConverter::Stream::queueBuffers(FrameBuffer *input,
 	if (ret < 0)
 		return ret;
 
+	jobsInFlight_++;
+
 	return 0;
 }
 
-std::string SimpleConverter::Stream::logPrefix() const
+std::string SimpleM2MConverter::Stream::logPrefix() const
 {
 	return "stream" + std::to_string(index_);
 }
 
-void SimpleConverter::Stream::outputBufferReady(FrameBuffer *buffer)
+void SimpleM2MConverter::Stream::outputBufferReady(FrameBuffer *buffer)
 {
 	auto it = converter_->queue_.find(buffer);
 	if (it == converter_->queue_.end())
@@ -167,17 +210,48 @@ void SimpleConverter::Stream::outputBufferReady(FrameBuffer *buffer)
 	}
 }
 
-void SimpleConverter::Stream::captureBufferReady(FrameBuffer *buffer)
+void SimpleM2MConverter::Stream::captureBufferReady(FrameBuffer *buffer)
 {
+	if (jobsInFlight_)
+		jobsInFlight_--;
+
+	/* Keep the device busy by submitting the next job first. */
+	while (!pendingJobs_.empty() &&
+	       jobsInFlight_ < converter_->queueDepth()) {
+		Job job = pendingJobs_.front();
+		pendingJobs_.pop();
+
+		int ret = submit(job.input, job.output);
+		if (ret < 0) {
+			LOG(SimplePipeline, Error)
+				<< "Failed to queue buffers: " << strerror(-ret);
+			job.output->cancel();
+			converter_->outputBufferReady.emit(job.output);
+			outputBufferReady(job.input);
+		}
+	}
+
 	converter_->outputBufferReady.emit(buffer);
 }
 
 /* -----------------------------------------------------------------------------
- * SimpleConverter
+ * SimpleM2MConverter
  */
 
-SimpleConverter::SimpleConverter(MediaDevice *media)
+SimpleM2MConverter::SimpleM2MConverter(MediaDevice *media)
+	: queueDepth_(kDefaultQueueDepth)
 {
+	const char *depth = GlobalConfiguration::option("LIBCAMERA_SIMPLE_CONVERTER_QUEUE_DEPTH");
+	if (depth) {
+		char *end;
+		unsigned long value = strtoul(depth, &end, 10);
+		if (*depth && !*end && value > 0 && value <= 16)
+			queueDepth_ = value;
+		else
+			LOG(SimplePipeline, Warning)
+				<< "Invalid converter queue depth '" << depth << "'";
+	}
+
 	/*
 	 * Locate the video node. There's no need to validate the pipeline
 	 * further, the caller guarantees that this is a V4L2 mem2mem device.
@@ -200,7 +274,7 @@ SimpleConverter::SimpleConverter(MediaDevice *media)
 	}
 }
 
-std::vector<PixelFormat> SimpleConverter::formats(PixelFormat input)
+std::vector<PixelFormat> SimpleM2MConverter::formats(PixelFormat input)
 {
 	if (!m2m_)
 		return {};
@@ -231,7 +305,7 @@ std::vector<PixelFormat> SimpleConverter::formats(PixelFormat input)
 	return pixelFormats;
 }
 
-SizeRange SimpleConverter::sizes(const Size &input)
+SizeRange SimpleM2MConverter::sizes(const Size &input)
 {
 	if (!m2m_)
 		return {};
@@ -277,7 +351,7 @@ SizeRange SimpleConverter::sizes(const Size &input)
 }
 
 std::tuple<unsigned int, unsigned int>
-SimpleConverter::strideAndFrameSize(const PixelFormat &pixelFormat,
+SimpleM2MConverter::strideAndFrameSize(const PixelFormat &pixelFormat,
 				    const Size &size)
 {
 	V4L2DeviceFormat format;
@@ -291,7 +365,7 @@ SimpleConverter::strideAndFrameSize(const PixelFormat &pixelFormat,
 	return std::make_tuple(format.planes[0].bpl, format.planes[0].size);
 }
 
-int SimpleConverter::configure(const StreamConfiguration &inputCfg,
+int SimpleM2MConverter::configure(const StreamConfiguration &inputCfg,
 			       const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs)
 {
 	int ret = 0;
@@ -322,7 +396,7 @@ int SimpleConverter::configure(const StreamConfiguration &inputCfg,
 	return 0;
 }
 
-int SimpleConverter::exportBuffers(unsigned int output, unsigned int count,
+int SimpleM2MConverter::exportBuffers(unsigned int output, unsigned int count,
 				   std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
 	if (output >= streams_.size())
@@ -331,7 +405,7 @@ int SimpleConverter::exportBuffers(unsigned int output, unsigned int count,
 	return streams_[output].exportBuffers(count, buffers);
 }
 
-int SimpleConverter::start()
+int SimpleM2MConverter::start()
 {
 	int ret;
 
@@ -346,13 +420,13 @@ int SimpleConverter::start()
 	return 0;
 }
 
-void SimpleConverter::stop()
+void SimpleM2MConverter::stop()
 {
 	for (Stream &stream : utils::reverse(streams_))
 		stream.stop();
 }
 
-int SimpleConverter::queueBuffers(FrameBuffer *input,
+int SimpleM2MConverter::queueBuffers(FrameBuffer *input,
 				  const std::map<unsigned int, FrameBuffer *> &outputs)
 {
 	unsigned int mask = 0;
@@ -10,6 +10,7 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <queue>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -31,35 +32,66 @@ class V4L2M2MDevice;
 class SimpleConverter
 {
 public:
-	SimpleConverter(MediaDevice *media);
+	virtual ~SimpleConverter() = default;
 
-	bool isValid() const { return m2m_ != nullptr; }
+	virtual bool isValid() const = 0;
 
-	std::vector<PixelFormat> formats(PixelFormat input);
-	SizeRange sizes(const Size &input);
+	virtual unsigned int queueDepth() const = 0;
+
+	virtual std::vector<PixelFormat> formats(PixelFormat input) = 0;
+	virtual SizeRange sizes(const Size &input) = 0;
+
+	virtual std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size) = 0;
+
+	virtual int configure(const StreamConfiguration &inputCfg,
+			      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfg) = 0;
+	virtual int exportBuffers(unsigned int ouput, unsigned int count,
+				  std::vector<std::unique_ptr<FrameBuffer>> *buffers) = 0;
+
+	virtual int start() = 0;
+	virtual void stop() = 0;
+
+	virtual int queueBuffers(FrameBuffer *input,
+				 const std::map<unsigned int, FrameBuffer *> &outputs) = 0;
+
+	Signal<FrameBuffer *> inputBufferReady;
+	Signal<FrameBuffer *> outputBufferReady;
+};
+
+class SimpleM2MConverter : public SimpleConverter
+{
+public:
+	SimpleM2MConverter(MediaDevice *media);
+
+	static constexpr unsigned int kDefaultQueueDepth = 2;
+
+	bool isValid() const override { return m2m_ != nullptr; }
+
+	unsigned int queueDepth() const override { return queueDepth_; }
+
+	std::vector<PixelFormat> formats(PixelFormat input) override;
+	SizeRange sizes(const Size &input) override;
 
 	std::tuple<unsigned int, unsigned int>
-	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size);
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size) override;
 
 	int configure(const StreamConfiguration &inputCfg,
-		      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfg);
+		      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfg) override;
 	int exportBuffers(unsigned int ouput, unsigned int count,
-			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 
-	int start();
-	void stop();
+	int start() override;
+	void stop() override;
 
 	int queueBuffers(FrameBuffer *input,
-			 const std::map<unsigned int, FrameBuffer *> &outputs);
-
-	Signal<FrameBuffer *> inputBufferReady;
-	Signal<FrameBuffer *> outputBufferReady;
+			 const std::map<unsigned int, FrameBuffer *> &outputs) override;
 
 private:
 	class Stream : protected Loggable
 	{
 	public:
-		Stream(SimpleConverter *converter, unsigned int index);
+		Stream(SimpleM2MConverter *converter, unsigned int index);
 
 		bool isValid() const { return m2m_ != nullptr; }
 
@@ -77,19 +109,29 @@ private:
 		std::string logPrefix() const override;
 
 	private:
+		struct Job {
+			FrameBuffer *input;
+			FrameBuffer *output;
+		};
+
+		int submit(FrameBuffer *input, FrameBuffer *output);
 		void captureBufferReady(FrameBuffer *buffer);
 		void outputBufferReady(FrameBuffer *buffer);
 
-		SimpleConverter *converter_;
+		SimpleM2MConverter *converter_;
 		unsigned int index_;
 		std::unique_ptr<V4L2M2MDevice> m2m_;
 
 		unsigned int inputBufferCount_;
 		unsigned int outputBufferCount_;
+
+		unsigned int jobsInFlight_;
+		std::queue<Job> pendingJobs_;
 	};
 
 	std::string deviceNode_;
 	std::unique_ptr<V4L2M2MDevice> m2m_;
+	unsigned int queueDepth_;
 
 	std::vector<Stream> streams_;
 	std::map<FrameBuffer *, unsigned int> queue_;
@@ -0,0 +1,1200 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * gpu_converter.cpp - GPU-based Bayer to RGB converter for simple pipeline
+ */
+
+#include "gpu_converter.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <sstream>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utility>
+
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/dma_heaps.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(SimplePipeline)
+
+namespace {
+
+/* Indices of the colour components in the statistics and gains. */
+enum Component {
+	Red = 0,
+	Green = 1,
+	Blue = 2,
+};
+
+/* Resolution of the grid of Bayer quads sampled for the statistics. */
+constexpr unsigned int kStatsWidth = 64;
+constexpr unsigned int kStatsHeight = 48;
+
+constexpr char kVertexShader[] = R"(
+attribute vec2 position;
+
+void main()
+{
+	gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+/*
+ * The fragment shader computes one output pixel from the input pixel closest
+ * to its center. Input samples are fetched from a texture holding the raw
+ * bytes of the frame, one byte per texel, and unpacked to normalized values by
+ * fetch(). The borders are mirrored, preserving the Bayer pattern.
+ *
+ * The debayering uses the same bilinear interpolation as the CPU converter.
+ * With STATS defined, the shader instead outputs the red, average green and
+ * blue values of the Bayer quad at the output pixel location.
+ */
+constexpr char kFragmentShader[] = R"(
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#else
+precision mediump float;
+#endif
+
+uniform sampler2D tex;
+uniform vec2 texelSize;
+uniform vec2 inputSize;
+uniform vec2 scale;
+uniform vec2 redPos;
+uniform vec3 gains;
+uniform float swapRedBlue;
+uniform vec4 redMask;
+uniform vec4 blueMask;
+
+float sampleByte(float x, float y)
+{
+	return texture2D(tex, vec2(x + 0.5, y + 0.5) * texelSize).r;
+}
+
+float fetch(vec2 p)
+{
+	p = inputSize - 1.0 - abs(inputSize - 1.0 - abs(p));
+
+#if defined(CSI2_GROUP)
+	return sampleByte(p.x + floor(p.x / CSI2_GROUP), p.y);
+#elif defined(MAX_VALUE)
+	float lo = sampleByte(p.x * 2.0, p.y);
+	float hi = sampleByte(p.x * 2.0 + 1.0, p.y);
+	return min((hi * 256.0 + lo) * 255.0 / MAX_VALUE, 1.0);
+#else
+	return sampleByte(p.x, p.y);
+#endif
+}
+
+#ifdef STATS
+
+void main()
+{
+	vec2 pos = floor(gl_FragCoord.xy * scale * 0.5) * 2.0;
+	vec4 quad = vec4(fetch(pos), fetch(pos + vec2(1.0, 0.0)),
+			 fetch(pos + vec2(0.0, 1.0)), fetch(pos + vec2(1.0, 1.0)));
+	vec4 greenMask = vec4(1.0) - redMask - blueMask;
+
+	gl_FragColor = vec4(dot(quad, redMask), dot(quad, greenMask) * 0.5,
+			    dot(quad, blueMask), 1.0);
+}
+
+#else
+
+void main()
+{
+	vec2 pos = floor(gl_FragCoord.xy * scale);
+	vec2 site = abs(mod(pos, 2.0) - redPos);
+
+	float c = fetch(pos);
+	float h = (fetch(pos + vec2(-1.0, 0.0)) + fetch(pos + vec2(1.0, 0.0))) * 0.5;
+	float v = (fetch(pos + vec2(0.0, -1.0)) + fetch(pos + vec2(0.0, 1.0))) * 0.5;
+	float d = (fetch(pos + vec2(-1.0, -1.0)) + fetch(pos + vec2(1.0, -1.0)) +
+		   fetch(pos + vec2(-1.0, 1.0)) + fetch(pos + vec2(1.0, 1.0))) * 0.25;
+	float x = (h + v) * 0.5;
+
+	vec3 rgb;
+	if (site.x < 0.5 && site.y < 0.5)
+		rgb = vec3(c, x, d);
+	else if (site.x > 0.5 && site.y > 0.5)
+		rgb = vec3(d, x, c);
+	else if (site.y < 0.5)
+		rgb = vec3(h, c, v);
+	else
+		rgb = vec3(v, c, h);
+
+	rgb = pow(clamp(rgb * gains, 0.0, 1.0), vec3(1.0 / 2.2));
+	gl_FragColor = vec4(mix(rgb, rgb.bgr, swapRedBlue), 1.0);
+}
+
+#endif
+)";
+
+bool hasExtension(const char *extensions, const char *name)
+{
+	if (!extensions)
+		return false;
+
+	for (const std::string &extension : utils::split(extensions, " ")) {
+		if (extension == name)
+			return true;
+	}
+
+	return false;
+}
+
+} /* namespace */
+
+/*
+ * The GpuRenderer wraps the EGL context and the OpenGL ES objects used by the
+ * converter. The context is created with the renderer, and must be made
+ * current in the calling thread with makeCurrent() before calling any other
+ * function.
+ */
+class GpuRenderer
+{
+public:
+	GpuRenderer();
+	~GpuRenderer();
+
+	bool isValid() const { return context_ != EGL_NO_CONTEXT; }
+	bool canImport() const { return importOutput_; }
+
+	bool makeCurrent();
+	void releaseCurrent();
+
+	int configure(const BayerFormat &format, const Size &size,
+		      unsigned int stride);
+	void reset();
+
+	int setInput(FrameBuffer *buffer);
+	int render(FrameBuffer *buffer, const PixelFormat &pixelFormat,
+		   const Size &size, const std::array<float, 3> &gains);
+	void flush();
+	void statistics(std::array<uint64_t, 3> *sum, unsigned int *count);
+	void wait();
+
+private:
+	struct Image {
+		EGLImageKHR image;
+		GLuint texture;
+		GLuint framebuffer;
+	};
+
+	struct Readback {
+		GLuint texture;
+		GLuint framebuffer;
+	};
+
+	GLuint compileProgram(const std::string &defines);
+	EGLImageKHR importBuffer(FrameBuffer *buffer, uint32_t fourcc,
+				 unsigned int width, unsigned int height,
+				 unsigned int stride);
+	Image *importOutput(FrameBuffer *buffer, const PixelFormat &pixelFormat,
+			    const Size &size);
+	GLuint createFramebuffer(GLuint texture, unsigned int width,
+				 unsigned int height);
+	void destroyImage(Image &image);
+	void draw(GLuint program);
+
+	EGLDisplay display_;
+	EGLContext context_;
+
+	PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR_;
+	PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR_;
+	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES_;
+	PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR_;
+	PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHR_;
+	PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR_;
+
+	bool importInput_;
+	bool importOutput_;
+	EGLSyncKHR fence_;
+
+	Size size_;
+	unsigned int stride_;
+	Size statsSize_;
+
+	GLuint debayerProgram_;
+	GLuint statsProgram_;
+	GLuint uploadTexture_;
+	GLuint inputTexture_;
+	Readback stats_;
+
+	std::map<FrameBuffer *, Image> images_;
+	std::map<std::pair<unsigned int, unsigned int>, Readback> readbacks_;
+};
+
+GpuRenderer::GpuRenderer()
+	: display_(EGL_NO_DISPLAY), context_(EGL_NO_CONTEXT),
+	  importInput_(false), importOutput_(false), fence_(EGL_NO_SYNC_KHR),
+	  stride_(0), debayerProgram_(0), statsProgram_(0), uploadTexture_(0),
+	  inputTexture_(0), stats_{}
+{
+	const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+	/* Prefer the surfaceless platform, as no window system is needed. */
+	auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+		eglGetProcAddress("eglGetPlatformDisplayEXT"));
+	if (getPlatformDisplay &&
+	    hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+		display_ = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+					      EGL_DEFAULT_DISPLAY, nullptr);
+	if (display_ == EGL_NO_DISPLAY)
+		display_ = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	if (display_ == EGL_NO_DISPLAY || !eglInitialize(display_, nullptr, nullptr)) {
+		LOG(SimplePipeline, Error) << "Failed to initialize EGL display";
+		display_ = EGL_NO_DISPLAY;
+		return;
+	}
+
+	const char *extensions = eglQueryString(display_, EGL_EXTENSIONS);
+	if (!hasExtension(extensions, "EGL_KHR_surfaceless_context")) {
+		LOG(SimplePipeline, Error) << "EGL surfaceless contexts not supported";
+		return;
+	}
+
+	EGLConfig config = EGL_NO_CONFIG_KHR;
+	if (!hasExtension(extensions, "EGL_KHR_no_config_context")) {
+		static const EGLint configAttribs[] = {
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+			EGL_NONE
+		};
+		EGLint numConfigs;
+
+		if (!eglChooseConfig(display_, configAttribs, &config, 1, &numConfigs) ||
+		    !numConfigs) {
+			LOG(SimplePipeline, Error) << "No suitable EGL configuration";
+			return;
+		}
+	}
+
+	static const EGLint contextAttribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+
+	if (!eglBindAPI(EGL_OPENGL_ES_API))
+		return;
+
+	context_ = eglCreateContext(display_, config, EGL_NO_CONTEXT, contextAttribs);
+	if (context_ == EGL_NO_CONTEXT) {
+		LOG(SimplePipeline, Error)
+			<< "Failed to create EGL context: "
+			<< utils::hex(eglGetError());
+		return;
+	}
+
+	/*
+	 * Frames are imported as EGL images when dma-bufs can be imported,
+	 * and copied through mapped memory otherwise.
+	 */
+	eglCreateImageKHR_ = reinterpret_cast<PFNEGLCREATEIMAGEKHRPROC>(
+		eglGetProcAddress("eglCreateImageKHR"));
+	eglDestroyImageKHR_ = reinterpret_cast<PFNEGLDESTROYIMAGEKHRPROC>(
+		eglGetProcAddress("eglDestroyImageKHR"));
+	glEGLImageTargetTexture2DOES_ = reinterpret_cast<PFNGLEGLIMAGETARGETTEXTURE2DOESPROC>(
+		eglGetProcAddress("glEGLImageTargetTexture2DOES"));
+
+	importInput_ = hasExtension(extensions, "EGL_EXT_image_dma_buf_import") &&
+		       eglCreateImageKHR_ && eglDestroyImageKHR_ &&
+		       glEGLImageTargetTexture2DOES_;
+	importOutput_ = importInput_;
+
+	if (hasExtension(extensions, "EGL_KHR_fence_sync")) {
+		eglCreateSyncKHR_ = reinterpret_cast<PFNEGLCREATESYNCKHRPROC>(
+			eglGetProcAddress("eglCreateSyncKHR"));
+		eglClientWaitSyncKHR_ = reinterpret_cast<PFNEGLCLIENTWAITSYNCKHRPROC>(
+			eglGetProcAddress("eglClientWaitSyncKHR"));
+		eglDestroySyncKHR_ = reinterpret_cast<PFNEGLDESTROYSYNCKHRPROC>(
+			eglGetProcAddress("eglDestroySyncKHR"));
+	} else {
+		eglCreateSyncKHR_ = nullptr;
+		eglClientWaitSyncKHR_ = nullptr;
+		eglDestroySyncKHR_ = nullptr;
+	}
+
+	LOG(SimplePipeline, Debug)
+		<< "GPU converter using " << eglQueryString(display_, EGL_VENDOR)
+		<< ", dma-buf import " << (importInput_ ? "enabled" : "disabled");
+}
+
+GpuRenderer::~GpuRenderer()
+{
+	if (context_ == EGL_NO_CONTEXT)
+		return;
+
+	if (makeCurrent()) {
+		reset();
+
+		glDeleteProgram(debayerProgram_);
+		glDeleteProgram(statsProgram_);
+		glDeleteTextures(1, &uploadTexture_);
+		glDeleteTextures(1, &stats_.texture);
+		glDeleteFramebuffers(1, &stats_.framebuffer);
+
+		releaseCurrent();
+	}
+
+	/*
+	 * The display is shared with all other EGL users in the process and
+	 * is thus not terminated.
+	 */
+	eglDestroyContext(display_, context_);
+}
+
+bool GpuRenderer::makeCurrent()
+{
+	if (!eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, context_)) {
+		LOG(SimplePipeline, Error)
+			<< "Failed to make EGL context current: "
+			<< utils::hex(eglGetError());
+		return false;
+	}
+
+	return true;
+}
+
+void GpuRenderer::releaseCurrent()
+{
+	eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+GLuint GpuRenderer::compileProgram(const std::string &defines)
+{
+	auto compile = [](GLenum type, const std::string &source) -> GLuint {
+		GLuint shader = glCreateShader(type);
+		const char *src = source.c_str();
+		GLint status;
+
+		glShaderSource(shader, 1, &src, nullptr);
+		glCompileShader(shader);
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+		if (!status) {
+			char log[1024];
+			glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+			LOG(SimplePipeline, Error)
+				<< "Failed to compile shader: " << log;
+			glDeleteShader(shader);
+			return 0;
+		}
+
+		return shader;
+	};
+
+	GLuint vertex = compile(GL_VERTEX_SHADER, kVertexShader);
+	GLuint fragment = compile(GL_FRAGMENT_SHADER,
+				  "#version 100\n" + defines + kFragmentShader);
+	if (!vertex || !fragment) {
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vertex);
+	glAttachShader(program, fragment);
+	glBindAttribLocation(program, 0, "position");
+	glLinkProgram(program);
+
+	/* The shaders are freed along with the program. */
+	glDeleteShader(vertex);
+	glDeleteShader(fragment);
+
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		char log[1024];
+		glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+		LOG(SimplePipeline, Error) << "Failed to link program: " << log;
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	return program;
+}
+
+int GpuRenderer::configure(const BayerFormat &format, const Size &size,
+			   unsigned int stride)
+{
+	std::stringstream defines;
+
+	if (format.packing == BayerFormat::Packing::CSI2 &&
+	    (format.bitDepth == 10 || format.bitDepth == 12))
+		defines << "#define CSI2_GROUP " << (format.bitDepth == 10 ? "4.0" : "2.0")
+			<< "\n";
+	else if (format.packing == BayerFormat::Packing::None && format.bitDepth > 8)
+		defines << "#define MAX_VALUE " << ((1 << format.bitDepth) - 1)
+			<< ".0\n";
+	else if (format.packing != BayerFormat::Packing::None || format.bitDepth != 8)
+		return -EINVAL;
+
+	GLint maxSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	if (stride > static_cast<unsigned int>(maxSize) ||
+	    size.height > static_cast<unsigned int>(maxSize)) {
+		LOG(SimplePipeline, Error)
+			<< "Input frame exceeds the maximum texture size "
+			<< maxSize;
+		return -EINVAL;
+	}
+
+	glDeleteProgram(debayerProgram_);
+	glDeleteProgram(statsProgram_);
+
+	debayerProgram_ = compileProgram(defines.str());
+	statsProgram_ = compileProgram(defines.str() + "#define STATS\n");
+	if (!debayerProgram_ || !statsProgram_)
+		return -EINVAL;
+
+	size_ = size;
+	stride_ = stride;
+	statsSize_ = Size(std::min(kStatsWidth, size.width / 2),
+			  std::min(kStatsHeight, size.height / 2));
+
+	/* Red and blue sites, in the Bayer quad and as weights of its pixels. */
+	static const std::map<BayerFormat::Order, std::pair<float, float>> redPositions = {
+		{ BayerFormat::RGGB, { 0.0f, 0.0f } },
+		{ BayerFormat::GRBG, { 1.0f, 0.0f } },
+		{ BayerFormat::GBRG, { 0.0f, 1.0f } },
+		{ BayerFormat::BGGR, { 1.0f, 1.0f } },
+	};
+	auto [redX, redY] = redPositions.at(format.order);
+	unsigned int redIndex = static_cast<unsigned int>(redX + redY * 2);
+	GLfloat redMask[4] = {};
+	GLfloat blueMask[4] = {};
+	redMask[redIndex] = 1.0f;
+	blueMask[3 - redIndex] = 1.0f;
+
+	for (GLuint program : { debayerProgram_, statsProgram_ }) {
+		glUseProgram(program);
+		glUniform1i(glGetUniformLocation(program, "tex"), 0);
+		glUniform2f(glGetUniformLocation(program, "texelSize"),
+			    1.0f / stride, 1.0f / size.height);
+		glUniform2f(glGetUniformLocation(program, "inputSize"),
+			    size.width, size.height);
+		glUniform2f(glGetUniformLocation(program, "redPos"), redX, redY);
+		glUniform4fv(glGetUniformLocation(program, "redMask"), 1, redMask);
+		glUniform4fv(glGetUniformLocation(program, "blueMask"), 1, blueMask);
+	}
+
+	glUseProgram(statsProgram_);
+	glUniform2f(glGetUniformLocation(statsProgram_, "scale"),
+		    static_cast<float>(size.width) / statsSize_.width,
+		    static_cast<float>(size.height) / statsSize_.height);
+
+	/* Textures used to upload the input frames when they can't be imported. */
+	glDeleteTextures(1, &uploadTexture_);
+	glGenTextures(1, &uploadTexture_);
+	glBindTexture(GL_TEXTURE_2D, uploadTexture_);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, stride, size.height, 0,
+		     GL_LUMINANCE, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glDeleteTextures(1, &stats_.texture);
+	glDeleteFramebuffers(1, &stats_.framebuffer);
+	glGenTextures(1, &stats_.texture);
+	stats_.framebuffer = createFramebuffer(stats_.texture, statsSize_.width,
+					       statsSize_.height);
+	if (!stats_.framebuffer)
+		return -EINVAL;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	return 0;
+}
+
+void GpuRenderer::reset()
+{
+	wait();
+
+	for (auto &[buffer, image] : images_)
+		destroyImage(image);
+	images_.clear();
+
+	for (auto &[size, readback] : readbacks_) {
+		glDeleteFramebuffers(1, &readback.framebuffer);
+		glDeleteTextures(1, &readback.texture);
+	}
+	readbacks_.clear();
+}
+
+EGLImageKHR GpuRenderer::importBuffer(FrameBuffer *buffer, uint32_t fourcc,
+				      unsigned int width, unsigned int height,
+				      unsigned int stride)
+{
+	const FrameBuffer::Plane &plane = buffer->planes()[0];
+	const EGLint attribs[] = {
+		EGL_WIDTH, static_cast<EGLint>(width),
+		EGL_HEIGHT, static_cast<EGLint>(height),
+		EGL_LINUX_DRM_FOURCC_EXT, static_cast<EGLint>(fourcc),
+		EGL_DMA_BUF_PLANE0_FD_EXT, plane.fd.fd(),
+		EGL_DMA_BUF_PLANE0_OFFSET_EXT, static_cast<EGLint>(plane.offset),
+		EGL_DMA_BUF_PLANE0_PITCH_EXT, static_cast<EGLint>(stride),
+		EGL_NONE
+	};
+
+	return eglCreateImageKHR_(display_, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT,
+				  nullptr, attribs);
+}
+
+GLuint GpuRenderer::createFramebuffer(GLuint texture, unsigned int width,
+				      unsigned int height)
+{
+	glBindTexture(GL_TEXTURE_2D, texture);
+	if (width)
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+			     GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	GLuint framebuffer;
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, texture, 0);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		glDeleteFramebuffers(1, &framebuffer);
+		return 0;
+	}
+
+	return framebuffer;
+}
+
+void GpuRenderer::destroyImage(Image &image)
+{
+	glDeleteFramebuffers(1, &image.framebuffer);
+	glDeleteTextures(1, &image.texture);
+	eglDestroyImageKHR_(display_, image.image);
+}
+
+int GpuRenderer::setInput(FrameBuffer *buffer)
+{
+	if (importInput_) {
+		auto it = images_.find(buffer);
+		if (it != images_.end()) {
+			inputTexture_ = it->second.texture;
+			return 0;
+		}
+
+		/* Import the raw frame as an image of one byte per texel. */
+		Image image{};
+		image.image = importBuffer(buffer, formats::R8.fourcc(), stride_,
+					   size_.height, stride_);
+		if (image.image != EGL_NO_IMAGE_KHR) {
+			glGenTextures(1, &image.texture);
+			glBindTexture(GL_TEXTURE_2D, image.texture);
+			glEGLImageTargetTexture2DOES_(GL_TEXTURE_2D, image.image);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+			images_[buffer] = image;
+			inputTexture_ = image.texture;
+			return 0;
+		}
+
+		LOG(SimplePipeline, Warning)
+			<< "Failed to import input buffer, falling back to copies";
+		importInput_ = false;
+	}
+
+	MappedFrameBuffer in(buffer, MappedFrameBuffer::MapFlag::Read);
+	if (!in.isValid() || in.planes()[0].size() < stride_ * size_.height) {
+		LOG(SimplePipeline, Error) << "Failed to map input buffer";
+		return -EINVAL;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, uploadTexture_);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, stride_, size_.height,
+			GL_LUMINANCE, GL_UNSIGNED_BYTE, in.planes()[0].data());
+	inputTexture_ = uploadTexture_;
+
+	return 0;
+}
+
+GpuRenderer::Image *GpuRenderer::importOutput(FrameBuffer *buffer,
+					      const PixelFormat &pixelFormat,
+					      const Size &size)
+{
+	auto it = images_.find(buffer);
+	if (it != images_.end())
+		return &it->second;
+
+	/* The libcamera pixel format 4CCs match their DRM counterpart. */
+	Image image{};
+	image.image = importBuffer(buffer, pixelFormat.fourcc(), size.width,
+				   size.height, size.width * 4);
+	if (image.image == EGL_NO_IMAGE_KHR)
+		return nullptr;
+
+	glGenTextures(1, &image.texture);
+	glBindTexture(GL_TEXTURE_2D, image.texture);
+	glEGLImageTargetTexture2DOES_(GL_TEXTURE_2D, image.image);
+
+	image.framebuffer = createFramebuffer(image.texture, 0, 0);
+	if (!image.framebuffer) {
+		destroyImage(image);
+		return nullptr;
+	}
+
+	return &(images_[buffer] = image);
+}
+
+void GpuRenderer::draw(GLuint program)
+{
+	static const GLfloat vertices[] = {
+		-1.0f, -1.0f,
+		1.0f, -1.0f,
+		-1.0f, 1.0f,
+		1.0f, 1.0f,
+	};
+
+	glUseProgram(program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, inputTexture_);
+
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, vertices);
+	glEnableVertexAttribArray(0);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+int GpuRenderer::render(FrameBuffer *buffer, const PixelFormat &pixelFormat,
+			const Size &size, const std::array<float, 3> &gains)
+{
+	Image *image = nullptr;
+
+	if (importOutput_) {
+		image = importOutput(buffer, pixelFormat, size);
+		if (!image) {
+			LOG(SimplePipeline, Warning)
+				<< "Failed to import output buffer, falling back to copies";
+			importOutput_ = false;
+		}
+	}
+
+	/*
+	 * When rendering to an intermediate texture, the RGBA texels are read
+	 * back in memory order. Swap red and blue for XRGB8888, stored as BGRX.
+	 */
+	float swapRedBlue = 0.0f;
+	if (image) {
+		glBindFramebuffer(GL_FRAMEBUFFER, image->framebuffer);
+	} else {
+		auto key = std::make_pair(size.width, size.height);
+		auto it = readbacks_.find(key);
+		if (it == readbacks_.end()) {
+			Readback readback;
+			glGenTextures(1, &readback.texture);
+			readback.framebuffer = createFramebuffer(readback.texture,
+								 size.width,
+								 size.height);
+			if (!readback.framebuffer) {
+				LOG(SimplePipeline, Error)
+					<< "Failed to create framebuffer";
+				glDeleteTextures(1, &readback.texture);
+				return -EINVAL;
+			}
+
+			it = readbacks_.emplace(key, readback).first;
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, it->second.framebuffer);
+
+		if (pixelFormat == formats::XRGB8888)
+			swapRedBlue = 1.0f;
+	}
+
+	glUseProgram(debayerProgram_);
+	glUniform2f(glGetUniformLocation(debayerProgram_, "scale"),
+		    static_cast<float>(size_.width) / size.width,
+		    static_cast<float>(size_.height) / size.height);
+	glUniform3fv(glGetUniformLocation(debayerProgram_, "gains"), 1, gains.data());
+	glUniform1f(glGetUniformLocation(debayerProgram_, "swapRedBlue"), swapRedBlue);
+
+	glViewport(0, 0, size.width, size.height);
+	draw(debayerProgram_);
+
+	if (image)
+		return 0;
+
+	MappedFrameBuffer out(buffer, MappedFrameBuffer::MapFlag::Write);
+	if (!out.isValid() || out.planes()[0].size() < size.width * 4 * size.height) {
+		LOG(SimplePipeline, Error) << "Failed to map output buffer";
+		return -EINVAL;
+	}
+
+	glReadPixels(0, 0, size.width, size.height, GL_RGBA, GL_UNSIGNED_BYTE,
+		     out.planes()[0].data());
+
+	return 0;
+}
+
+void GpuRenderer::flush()
+{
+	/*
+	 * Insert a fence after the output rendering, to wait for its
+	 * completion only after the statistics have been read back.
+	 */
+	if (eglCreateSyncKHR_)
+		fence_ = eglCreateSyncKHR_(display_, EGL_SYNC_FENCE_KHR, nullptr);
+
+	glFlush();
+}
+
+void GpuRenderer::statistics(std::array<uint64_t, 3> *sum, unsigned int *count)
+{
+	std::vector<uint8_t> pixels(statsSize_.width * statsSize_.height * 4);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, stats_.framebuffer);
+	glViewport(0, 0, statsSize_.width, statsSize_.height);
+	draw(statsProgram_);
+
+	glReadPixels(0, 0, statsSize_.width, statsSize_.height, GL_RGBA,
+		     GL_UNSIGNED_BYTE, pixels.data());
+
+	sum->fill(0);
+	for (unsigned int i = 0; i < pixels.size(); i += 4) {
+		(*sum)[Red] += pixels[i];
+		(*sum)[Green] += pixels[i + 1];
+		(*sum)[Blue] += pixels[i + 2];
+	}
+
+	*count = statsSize_.width * statsSize_.height;
+}
+
+void GpuRenderer::wait()
+{
+	if (fence_ == EGL_NO_SYNC_KHR) {
+		glFinish();
+		return;
+	}
+
+	eglClientWaitSyncKHR_(display_, fence_, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+			      EGL_FOREVER_KHR);
+	eglDestroySyncKHR_(display_, fence_);
+	fence_ = EGL_NO_SYNC_KHR;
+}
+
+/**
+ * \class SimpleGpuConverter
+ * \brief Convert raw Bayer frames to RGB on the GPU
+ *
+ * The GPU converter is an alternative to the SimpleSoftwareConverter for
+ * platforms that have a GPU supporting OpenGL ES 2.0. It supports 8-bit,
+ * unpacked and CSI-2 packed 10- and 12-bit Bayer formats, and produces
+ * XRGB8888 and XBGR8888 output, optionally downscaled.
+ *
+ * Frames are imported as EGL images from their dma-buf when the EGL
+ * implementation supports it, and rendered to by a fragment shader that
+ * performs debayering, scaling, white balance, digital gain and gamma
+ * correction in a single pass. The frames are otherwise uploaded and read back
+ * through mapped memory. Completion of the rendering is waited for with a
+ * fence on a worker thread.
+ *
+ * A second pass samples a low resolution grid of Bayer quads, read back to
+ * compute the same grey-world white balance and digital gain control as the
+ * CPU converter, applied to the next frame.
+ *
+ * \todo Filter the input when downscaling by more than a factor of two
+ * \todo Support YUV output formats
+ */
+
+SimpleGpuConverter::SimpleGpuConverter()
+	: renderer_(std::make_unique<GpuRenderer>()), running_(false),
+	  digitalGain_(1.0f)
+{
+	awbGains_.fill(1.0f);
+
+	/* Output buffers are only worth allocating as dma-bufs if imported. */
+	if (renderer_->isValid() && renderer_->canImport())
+		dmaHeap_ = DmaHeap::instance(DmaHeap::DmaHeapFlag::Cma |
+					     DmaHeap::DmaHeapFlag::System);
+}
+
+SimpleGpuConverter::~SimpleGpuConverter()
+{
+	stop();
+}
+
+bool SimpleGpuConverter::isValid() const
+{
+	return renderer_->isValid();
+}
+
+std::vector<PixelFormat> SimpleGpuConverter::formats(PixelFormat input)
+{
+	BayerFormat bayer = BayerFormat::fromPixelFormat(input);
+	if (!bayer.isValid() || bayer.order == BayerFormat::MONO)
+		return {};
+
+	switch (bayer.packing) {
+	case BayerFormat::Packing::None:
+		break;
+	case BayerFormat::Packing::CSI2:
+		if (bayer.bitDepth != 10 && bayer.bitDepth != 12)
+			return {};
+		break;
+	default:
+		return {};
+	}
+
+	return {
+		formats::XRGB8888,
+		formats::XBGR8888,
+	};
+}
+
+SizeRange SimpleGpuConverter::sizes(const Size &input)
+{
+	return SizeRange(Size(16, 16), input, 2, 2);
+}
+
+std::tuple<unsigned int, unsigned int>
+SimpleGpuConverter::strideAndFrameSize([[maybe_unused]] const PixelFormat &pixelFormat,
+				       const Size &size)
+{
+	unsigned int stride = size.width * 4;
+
+	return std::make_tuple(stride, stride * size.height);
+}
+
+int SimpleGpuConverter::configure(const StreamConfiguration &inputCfg,
+				  const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs)
+{
+	std::vector<PixelFormat> outputFormats = formats(inputCfg.pixelFormat);
+	if (outputFormats.empty()) {
+		LOG(SimplePipeline, Error)
+			<< "Unsupported input format " << inputCfg.pixelFormat.toString();
+		return -EINVAL;
+	}
+
+	if (inputCfg.size.width < 2 || inputCfg.size.height < 2 ||
+	    inputCfg.size.width % 2 || inputCfg.size.height % 2) {
+		LOG(SimplePipeline, Error)
+			<< "Unsupported input size " << inputCfg.size.toString();
+		return -EINVAL;
+	}
+
+	inputFormat_ = BayerFormat::fromPixelFormat(inputCfg.pixelFormat);
+	size_ = inputCfg.size;
+
+	outputs_.clear();
+
+	SizeRange outputSizes = sizes(size_);
+
+	for (const StreamConfiguration &outputCfg : outputCfgs) {
+		if (std::find(outputFormats.begin(), outputFormats.end(),
+			      outputCfg.pixelFormat) == outputFormats.end() ||
+		    !outputSizes.contains(outputCfg.size)) {
+			LOG(SimplePipeline, Error)
+				<< "Output format not supported";
+			outputs_.clear();
+			return -EINVAL;
+		}
+
+		Output output;
+		output.pixelFormat = outputCfg.pixelFormat;
+		output.size = outputCfg.size;
+		std::tie(output.stride, output.frameSize) =
+			strideAndFrameSize(output.pixelFormat, output.size);
+		outputs_.push_back(output);
+	}
+
+	if (!renderer_->makeCurrent())
+		return -EIO;
+
+	int ret = renderer_->configure(inputFormat_, size_, inputCfg.stride);
+	renderer_->releaseCurrent();
+	if (ret) {
+		LOG(SimplePipeline, Error) << "Failed to configure GPU converter";
+		outputs_.clear();
+		return ret;
+	}
+
+	return 0;
+}
+
+int SimpleGpuConverter::exportBuffers(unsigned int output, unsigned int count,
+				      std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	if (output >= outputs_.size())
+		return -EINVAL;
+
+	const Output &out = outputs_[output];
+
+	StreamConfiguration cfg;
+	cfg.pixelFormat = out.pixelFormat;
+	cfg.size = out.size;
+	cfg.stride = out.stride;
+	cfg.frameSize = out.frameSize;
+
+	/*
+	 * Allocate the buffers from a dma-heap when available, for the GPU to
+	 * render to them directly, and fall back to memfd otherwise.
+	 */
+	for (unsigned int i = 0; i < count; ++i) {
+		if (dmaHeap_ && dmaHeap_->isValid()) {
+			std::unique_ptr<FrameBuffer> buffer =
+				dmaHeap_->allocFrameBuffer("libcamera-gpuconv", cfg);
+			if (buffer) {
+				buffers->push_back(std::move(buffer));
+				continue;
+			}
+		}
+
+		int fd = memfd_create("libcamera-gpuconv", MFD_CLOEXEC);
+		if (fd < 0) {
+			int ret = -errno;
+			LOG(SimplePipeline, Error)
+				<< "Failed to allocate buffer: " << strerror(-ret);
+			return ret;
+		}
+
+		if (ftruncate(fd, out.frameSize) < 0) {
+			int ret = -errno;
+			LOG(SimplePipeline, Error)
+				<< "Failed to size buffer: " << strerror(-ret);
+			close(fd);
+			return ret;
+		}
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(std::move(fd));
+		plane.offset = 0;
+		plane.length = out.frameSize;
+
+		buffers->push_back(std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane }));
+	}
+
+	return count;
+}
+
+int SimpleGpuConverter::start()
+{
+	if (running_)
+		return 0;
+
+	awbGains_.fill(1.0f);
+	digitalGain_ = 1.0f;
+
+	running_ = true;
+	thread_ = std::thread(&SimpleGpuConverter::run, this);
+
+	return 0;
+}
+
+void SimpleGpuConverter::stop()
+{
+	if (!thread_.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		running_ = false;
+	}
+	cv_.notify_all();
+	thread_.join();
+
+	/*
+	 * Complete the jobs processed by the worker thread, and cancel the
+	 * ones it hasn't processed yet, in order.
+	 */
+	std::deque<Job> completedJobs = std::move(completedJobs_);
+	std::deque<Job> pendingJobs = std::move(pendingJobs_);
+	completedJobs_.clear();
+	pendingJobs_.clear();
+
+	for (Job &job : completedJobs)
+		completeJob(job);
+
+	for (Job &job : pendingJobs) {
+		job.status = FrameMetadata::FrameCancelled;
+		completeJob(job);
+	}
+}
+
+int SimpleGpuConverter::queueBuffers(FrameBuffer *input,
+				     const std::map<unsigned int, FrameBuffer *> &outputs)
+{
+	if (outputs.empty())
+		return -EINVAL;
+
+	for (auto [index, buffer] : outputs) {
+		if (!buffer || index >= outputs_.size())
+			return -EINVAL;
+	}
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		pendingJobs_.push_back({ input, outputs, FrameMetadata::FrameError });
+	}
+	cv_.notify_one();
+
+	return 0;
+}
+
+void SimpleGpuConverter::run()
+{
+	/* The context is current in the worker thread while it runs. */
+	const bool current = renderer_->makeCurrent();
+
+	std::unique_lock<std::mutex> locker(lock_);
+
+	while (true) {
+		cv_.wait(locker, [&] { return !running_ || !pendingJobs_.empty(); });
+		if (!running_)
+			break;
+
+		Job job = std::move(pendingJobs_.front());
+		pendingJobs_.pop_front();
+
+		locker.unlock();
+		if (current)
+			process(job);
+		locker.lock();
+
+		completedJobs_.push_back(std::move(job));
+
+		/* Signal completion from the thread the converter lives in. */
+		invokeMethod(&SimpleGpuConverter::jobDone,
+			     ConnectionTypeQueued);
+	}
+
+	locker.unlock();
+
+	/* The imported buffers may be freed once the converter is stopped. */
+	if (current) {
+		renderer_->reset();
+		renderer_->releaseCurrent();
+	}
+}
+
+void SimpleGpuConverter::process(Job &job)
+{
+	int ret = renderer_->setInput(job.input);
+	if (ret)
+		return;
+
+	const std::array<float, 3> gains = {
+		awbGains_[Red] * digitalGain_,
+		awbGains_[Green] * digitalGain_,
+		awbGains_[Blue] * digitalGain_,
+	};
+
+	for (auto [index, buffer] : job.outputs) {
+		const Output &output = outputs_[index];
+
+		ret = renderer_->render(buffer, output.pixelFormat, output.size,
+					gains);
+		if (ret) {
+			renderer_->wait();
+			return;
+		}
+	}
+
+	renderer_->flush();
+
+	std::array<uint64_t, 3> sum;
+	unsigned int count;
+	renderer_->statistics(&sum, &count);
+	updateGains(sum, count);
+
+	renderer_->wait();
+
+	const FrameMetadata &inputMetadata = job.input->metadata();
+
+	for (auto [index, buffer] : job.outputs) {
+		FrameMetadata &metadata = buffer->_d()->metadata();
+
+		metadata.status = FrameMetadata::FrameSuccess;
+		metadata.sequence = inputMetadata.sequence;
+		metadata.timestamp = inputMetadata.timestamp;
+		metadata.planes()[0].bytesused = outputs_[index].frameSize;
+	}
+
+	job.status = FrameMetadata::FrameSuccess;
+}
+
+void SimpleGpuConverter::updateGains(const std::array<uint64_t, 3> &sum,
+				     unsigned int count)
+{
+	/* Speed at which the gains converge towards their target values. */
+	constexpr float kSpeed = 0.2f;
+	/* Target mean luminance, in linear space. */
+	constexpr float kTargetLuminance = 0.18f;
+	constexpr float kMaxGain = 8.0f;
+
+	if (!count || !sum[Red] || !sum[Green] || !sum[Blue])
+		return;
+
+	/* Grey-world white balance, relative to the green component. */
+	const float mean[3] = {
+		static_cast<float>(sum[Red]) / count,
+		static_cast<float>(sum[Green]) / count,
+		static_cast<float>(sum[Blue]) / count,
+	};
+
+	for (unsigned int i : { Red, Blue }) {
+		float target = std::clamp(mean[Green] / mean[i],
+					  1.0f / kMaxGain, kMaxGain);
+		awbGains_[i] += (target - awbGains_[i]) * kSpeed;
+	}
+
+	float luminance = (0.299f * mean[Red] * awbGains_[Red] +
+			   0.587f * mean[Green] +
+			   0.114f * mean[Blue] * awbGains_[Blue]) / 255.0f;
+	float target = std::clamp(kTargetLuminance / luminance, 1.0f, kMaxGain);
+	digitalGain_ += (target - digitalGain_) * kSpeed;
+}
+
+void SimpleGpuConverter::jobDone()
+{
+	std::deque<Job> completedJobs;
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		std::swap(completedJobs, completedJobs_);
+	}
+
+	for (Job &job : completedJobs)
+		completeJob(job);
+}
+
+void SimpleGpuConverter::completeJob(Job &job)
+{
+	for (auto [index, buffer] : job.outputs) {
+		buffer->_d()->metadata().status = job.status;
+		outputBufferReady.emit(buffer);
+	}
+
+	inputBufferReady.emit(job.input);
+}
+
+} /* namespace libcamera */
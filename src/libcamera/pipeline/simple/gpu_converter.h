@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * gpu_converter.h - GPU-based Bayer to RGB converter for simple pipeline
+ */
+
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <libcamera/base/object.h>
+
+#include <libcamera/framebuffer.h>
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "libcamera/internal/bayer_format.h"
+
+#include "converter.h"
+
+namespace libcamera {
+
+class DmaHeap;
+class GpuRenderer;
+
+class SimpleGpuConverter : public SimpleConverter, public Object
+{
+public:
+	SimpleGpuConverter();
+	~SimpleGpuConverter();
+
+	bool isValid() const override;
+
+	unsigned int queueDepth() const override { return kQueueDepth; }
+
+	std::vector<PixelFormat> formats(PixelFormat input) override;
+	SizeRange sizes(const Size &input) override;
+
+	std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size) override;
+
+	int configure(const StreamConfiguration &inputCfg,
+		      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfg) override;
+	int exportBuffers(unsigned int output, unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+
+	int start() override;
+	void stop() override;
+
+	int queueBuffers(FrameBuffer *input,
+			 const std::map<unsigned int, FrameBuffer *> &outputs) override;
+
+private:
+	static constexpr unsigned int kQueueDepth = 2;
+
+	struct Output {
+		PixelFormat pixelFormat;
+		Size size;
+		unsigned int stride;
+		unsigned int frameSize;
+	};
+
+	struct Job {
+		FrameBuffer *input;
+		std::map<unsigned int, FrameBuffer *> outputs;
+		FrameMetadata::Status status;
+	};
+
+	void run();
+	void process(Job &job);
+	void updateGains(const std::array<uint64_t, 3> &sum, unsigned int count);
+
+	void jobDone();
+	void completeJob(Job &job);
+
+	std::unique_ptr<GpuRenderer> renderer_;
+	std::shared_ptr<DmaHeap> dmaHeap_;
+
+	BayerFormat inputFormat_;
+	Size size_;
+	std::vector<Output> outputs_;
+
+	/* Worker thread and the list of jobs shared with it. */
+	std::thread thread_;
+	std::mutex lock_;
+	std::condition_variable cv_;
+	std::deque<Job> pendingJobs_;
+	std::deque<Job> completedJobs_;
+	bool running_;
+
+	/* Accessed by the worker thread only. */
+	std::array<float, 3> awbGains_;
+	float digitalGain_;
+};
+
+} /* namespace libcamera */
@@ -16,12 +16,15 @@
 #include <string>
 #include <string.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include <linux/media-bus-format.h>
 
+#include <libcamera/base/global_configuration.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
@@ -33,10 +36,16 @@
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/software_statistics.h"
 #include "libcamera/internal/v4l2_subdevice.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
 #include "converter.h"
+#include "software_converter.h"
+
+#if HAVE_GLES
+#include "gpu_converter.h"
+#endif
 
 namespace libcamera {
 
@@ -165,6 +174,26 @@ static const SimplePipelineInfo supportedDevices[] = {
 	{ "sun6i-csi", {} },
 };
 
+enum class SoftwareIsp {
+	Disabled,
+	Cpu,
+	Gpu,
+};
+
+SoftwareIsp softwareIsp()
+{
+	const char *isp = GlobalConfiguration::option("LIBCAMERA_SIMPLE_SOFTWARE_ISP");
+	if (!isp)
+		return SoftwareIsp::Disabled;
+
+	if (!strcmp(isp, "1") || !strcmp(isp, "cpu"))
+		return SoftwareIsp::Cpu;
+	if (!strcmp(isp, "gpu"))
+		return SoftwareIsp::Gpu;
+
+	return SoftwareIsp::Disabled;
+}
+
 } /* namespace */
 
 class SimpleCameraData : public Camera::Private
@@ -182,6 +211,7 @@ public:
 	int setupFormats(V4L2SubdeviceFormat *format,
 			 V4L2Subdevice::Whence whence);
 	void bufferReady(FrameBuffer *buffer);
+	void completeBuffer(FrameBuffer *buffer);
 
 	unsigned int streamIndex(const Stream *stream) const
 	{
@@ -228,15 +258,28 @@ public:
 
 	std::vector<Configuration> configs_;
 	std::map<PixelFormat, const Configuration *> formats_;
+	StreamFormats streamFormats_;
 
 	std::unique_ptr<SimpleConverter> converter_;
 	std::vector<std::unique_ptr<FrameBuffer>> converterBuffers_;
+	bool softwareConverter_;
 	bool useConverter_;
 	std::queue<std::map<unsigned int, FrameBuffer *>> converterQueue_;
 
+	/*
+	 * Statistics are computed on the buffers of the first stream in a
+	 * supported format. The grid selected by the last StatsGrid control is
+	 * stored for the queued requests that have statistics enabled.
+	 */
+	std::unique_ptr<SoftwareStatistics> stats_;
+	const Stream *statsStream_;
+	std::unordered_map<Request *, Size> statsGrids_;
+	Size statsGrid_;
+
 private:
 	void converterInputDone(FrameBuffer *buffer);
 	void converterOutputDone(FrameBuffer *buffer);
+	void statisticsReady(FrameBuffer *buffer, const ControlList &stats);
 };
 
 class SimpleCameraConfiguration : public CameraConfiguration
@@ -291,7 +334,17 @@ protected:
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
 private:
-	static constexpr unsigned int kNumInternalBuffers = 3;
+	/*
+	 * Number of internal buffers kept for capture when using the converter,
+	 * in addition to the buffers in flight in the converter. This allows
+	 * capturing the next frames while the previous ones are being converted.
+	 */
+	static constexpr unsigned int kNumCaptureBuffers = 2;
+
+	static unsigned int numInternalBuffers(SimpleCameraData *data)
+	{
+		return kNumCaptureBuffers + data->converter_->queueDepth();
+	}
 
 	struct EntityData {
 		std::unique_ptr<V4L2VideoDevice> video;
@@ -322,7 +375,8 @@ private:
 SimpleCameraData::SimpleCameraData(SimplePipelineHandler *pipe,
 				   unsigned int numStreams,
 				   MediaEntity *sensor)
-	: Camera::Private(pipe), streams_(numStreams)
+	: Camera::Private(pipe), streams_(numStreams),
+	  softwareConverter_(false), statsStream_(nullptr)
 {
 	int ret;
 
@@ -425,18 +479,38 @@ int SimpleCameraData::init()
 	SimplePipelineHandler *pipe = SimpleCameraData::pipe();
 	int ret;
 
-	/* Open the converter, if any. */
+	/*
+	 * Open the converter, if any, or fall back to the software converter
+	 * when enabled.
+	 */
 	MediaDevice *converter = pipe->converter();
 	if (converter) {
-		converter_ = std::make_unique<SimpleConverter>(converter);
+		converter_ = std::make_unique<SimpleM2MConverter>(converter);
 		if (!converter_->isValid()) {
 			LOG(SimplePipeline, Warning)
 				<< "Failed to create converter, disabling format conversion";
 			converter_.reset();
-		} else {
-			converter_->inputBufferReady.connect(this, &SimpleCameraData::converterInputDone);
-			converter_->outputBufferReady.connect(this, &SimpleCameraData::converterOutputDone);
 		}
+	} else if (SoftwareIsp isp = softwareIsp(); isp != SoftwareIsp::Disabled) {
+		if (isp == SoftwareIsp::Gpu) {
+#if HAVE_GLES
+			converter_ = std::make_unique<SimpleGpuConverter>();
+			if (!converter_->isValid())
+				converter_.reset();
+#endif
+			if (!converter_)
+				LOG(SimplePipeline, Warning)
+					<< "GPU converter not available, falling back to CPU";
+		}
+
+		if (!converter_)
+			converter_ = std::make_unique<SimpleSoftwareConverter>();
+		softwareConverter_ = true;
+	}
+
+	if (converter_) {
+		converter_->inputBufferReady.connect(this, &SimpleCameraData::converterInputDone);
+		converter_->outputBufferReady.connect(this, &SimpleCameraData::converterOutputDone);
 	}
 
 	video_ = pipe->video(entities_.back().entity);
@@ -493,6 +567,15 @@ int SimpleCameraData::init()
 			if (!converter_) {
 				config.outputFormats = { pixelFormat };
 				config.outputSizes = config.captureSize;
+			} else if (softwareConverter_) {
+				/*
+				 * The software converters only support Bayer
+				 * formats, keep the capture format available
+				 * for raw capture.
+				 */
+				config.outputFormats = converter_->formats(pixelFormat);
+				config.outputFormats.push_back(pixelFormat);
+				config.outputSizes = converter_->sizes(format.size);
 			} else {
 				config.outputFormats = converter_->formats(pixelFormat);
 				config.outputSizes = converter_->sizes(format.size);
@@ -519,8 +602,32 @@ int SimpleCameraData::init()
 			formats_[fmt] = &config;
 	}
 
+	/*
+	 * Create the stream formats once, they are shared by all the generated
+	 * configurations.
+	 */
+	std::map<PixelFormat, std::vector<SizeRange>> formats;
+	std::transform(formats_.begin(), formats_.end(),
+		       std::inserter(formats, formats.end()),
+		       [](const auto &format) -> decltype(formats)::value_type {
+			       const PixelFormat &pixelFormat = format.first;
+			       const Size &size = format.second->captureSize;
+			       return { pixelFormat, { size } };
+		       });
+	streamFormats_ = StreamFormats(formats);
+
 	properties_ = sensor_->properties();
 
+	stats_ = std::make_unique<SoftwareStatistics>();
+	stats_->statisticsReady.connect(this, &SimpleCameraData::statisticsReady);
+
+	ControlInfoMap::Map controls;
+	controls.emplace(std::piecewise_construct,
+			 std::forward_as_tuple(&controls::draft::StatsGrid),
+			 std::forward_as_tuple(Size{}, SoftwareStatistics::kMaxGrid,
+					       Size{}));
+	controlInfo_ = ControlInfoMap(std::move(controls), controls::controls);
+
 	return 0;
 }
 
@@ -626,8 +733,6 @@ int SimpleCameraData::setupFormats(V4L2SubdeviceFormat *format,
 
 void SimpleCameraData::bufferReady(FrameBuffer *buffer)
 {
-	SimplePipelineHandler *pipe = SimpleCameraData::pipe();
-
 	/*
 	 * If an error occurred during capture, or if the buffer was cancelled,
 	 * complete the request, even if the converter is in use as there's no
@@ -636,9 +741,7 @@ void SimpleCameraData::bufferReady(FrameBuffer *buffer)
 	if (buffer->metadata().status != FrameMetadata::FrameSuccess) {
 		if (!useConverter_) {
 			/* No conversion, just complete the request. */
-			Request *request = buffer->request();
-			pipe->completeBuffer(request, buffer);
-			pipe->completeRequest(request);
+			completeBuffer(buffer);
 			return;
 		}
 
@@ -653,16 +756,9 @@ void SimpleCameraData::bufferReady(FrameBuffer *buffer)
 		if (converterQueue_.empty())
 			return;
 
-		Request *request = nullptr;
-		for (auto &item : converterQueue_.front()) {
-			FrameBuffer *outputBuffer = item.second;
-			request = outputBuffer->request();
-			pipe->completeBuffer(request, outputBuffer);
-		}
+		for (auto &item : converterQueue_.front())
+			completeBuffer(item.second);
 		converterQueue_.pop();
-
-		if (request)
-			pipe->completeRequest(request);
 		return;
 	}
 
@@ -707,7 +803,34 @@ void SimpleCameraData::bufferReady(FrameBuffer *buffer)
 	}
 
 	/* Otherwise simply complete the request. */
-	pipe->completeBuffer(request, buffer);
+	completeBuffer(buffer);
+}
+
+void SimpleCameraData::completeBuffer(FrameBuffer *buffer)
+{
+	SimplePipelineHandler *pipe = SimpleCameraData::pipe();
+	Request *request = buffer->request();
+
+	if (!pipe->completeBuffer(request, buffer))
+		return;
+
+	/*
+	 * All the buffers of the request have completed. Delay the completion
+	 * of the request until the statistics have been computed, if they are
+	 * enabled.
+	 */
+	auto it = statsGrids_.find(request);
+	if (it != statsGrids_.end()) {
+		Size grid = it->second;
+		statsGrids_.erase(it);
+
+		FrameBuffer *statsBuffer = request->findBuffer(statsStream_);
+		if (statsBuffer &&
+		    statsBuffer->metadata().status == FrameMetadata::FrameSuccess &&
+		    !stats_->queueBuffer(statsBuffer, grid))
+			return;
+	}
+
 	pipe->completeRequest(request);
 }
 
@@ -719,12 +842,16 @@ void SimpleCameraData::converterInputDone(FrameBuffer *buffer)
 
 void SimpleCameraData::converterOutputDone(FrameBuffer *buffer)
 {
-	SimplePipelineHandler *pipe = SimpleCameraData::pipe();
-
 	/* Complete the buffer and the request. */
+	completeBuffer(buffer);
+}
+
+void SimpleCameraData::statisticsReady(FrameBuffer *buffer, const ControlList &stats)
+{
 	Request *request = buffer->request();
-	if (pipe->completeBuffer(request, buffer))
-		pipe->completeRequest(request);
+
+	request->metadata().merge(stats);
+	pipe()->completeRequest(request);
 }
 
 /* -----------------------------------------------------------------------------
@@ -804,7 +931,15 @@ CameraConfiguration::Status SimpleCameraConfiguration::validate()
 			status = Adjusted;
 		}
 
-		if (!pipeConfig_->outputSizes.contains(cfg.size)) {
+		/*
+		 * The software converters can't output raw formats, which are
+		 * thus only available at the capture size.
+		 */
+		bool rawCapture = data_->softwareConverter_ &&
+				  cfg.pixelFormat == pipeConfig_->captureFormat;
+
+		if (!pipeConfig_->outputSizes.contains(cfg.size) ||
+		    (rawCapture && cfg.size != pipeConfig_->captureSize)) {
 			LOG(SimplePipeline, Debug)
 				<< "Adjusting size from " << cfg.size.toString()
 				<< " to " << pipeConfig_->captureSize.toString();
@@ -824,15 +959,23 @@ CameraConfiguration::Status SimpleCameraConfiguration::validate()
 								      cfg.size);
 			if (cfg.stride == 0)
 				return Invalid;
+
+			/* \todo Support buffer layout constraints in converters. */
+			if (resetBufferConstraints(&cfg))
+				status = Adjusted;
 		} else {
 			V4L2DeviceFormat format;
 			format.fourcc = V4L2PixelFormat::fromPixelFormat(cfg.pixelFormat);
 			format.size = cfg.size;
+			format.applyConstraints(cfg);
 
 			int ret = data_->video_->tryFormat(&format);
 			if (ret < 0)
 				return Invalid;
 
+			if (format.adjustConstraints(&cfg))
+				status = Adjusted;
+
 			cfg.stride = format.planes[0].bpl;
 			cfg.frameSize = format.planes[0].size;
 		}
@@ -862,16 +1005,6 @@ CameraConfiguration *SimplePipelineHandler::generateConfiguration(Camera *camera
 	if (roles.empty())
 		return config;
 
-	/* Create the formats map. */
-	std::map<PixelFormat, std::vector<SizeRange>> formats;
-	std::transform(data->formats_.begin(), data->formats_.end(),
-		       std::inserter(formats, formats.end()),
-		       [](const auto &format) -> decltype(formats)::value_type {
-			       const PixelFormat &pixelFormat = format.first;
-			       const Size &size = format.second->captureSize;
-			       return { pixelFormat, { size } };
-		       });
-
 	/*
 	 * Create the stream configurations. Take the first entry in the formats
 	 * map as the default, for lack of a better option.
@@ -879,9 +1012,9 @@ CameraConfiguration *SimplePipelineHandler::generateConfiguration(Camera *camera
 	 * \todo Implement a better way to pick the default format
 	 */
 	for ([[maybe_unused]] StreamRole role : roles) {
-		StreamConfiguration cfg{ StreamFormats{ formats } };
-		cfg.pixelFormat = formats.begin()->first;
-		cfg.size = formats.begin()->second[0].max;
+		StreamConfiguration cfg{ data->streamFormats_ };
+		cfg.pixelFormat = data->formats_.begin()->first;
+		cfg.size = data->formats_.begin()->second->captureSize;
 
 		config->addConfiguration(cfg);
 	}
@@ -920,6 +1053,8 @@ int SimplePipelineHandler::configure(Camera *camera, CameraConfiguration *c)
 	V4L2DeviceFormat captureFormat;
 	captureFormat.fourcc = videoFormat;
 	captureFormat.size = pipeConfig->captureSize;
+	if (!config->needConversion())
+		captureFormat.applyConstraints(config->at(0));
 
 	ret = video->setFormat(&captureFormat);
 	if (ret)
@@ -943,12 +1078,19 @@ int SimplePipelineHandler::configure(Camera *camera, CameraConfiguration *c)
 	/* Configure the converter if needed. */
 	std::vector<std::reference_wrapper<StreamConfiguration>> outputCfgs;
 	data->useConverter_ = config->needConversion();
+	data->statsStream_ = nullptr;
 
 	for (unsigned int i = 0; i < config->size(); ++i) {
 		StreamConfiguration &cfg = config->at(i);
 
 		cfg.setStream(&data->streams_[i]);
 
+		/* Compute statistics on the first supported stream. */
+		if (!data->statsStream_ &&
+		    SoftwareStatistics::isSupported(cfg.pixelFormat) &&
+		    !data->stats_->configure(cfg.pixelFormat, cfg.size, cfg.stride))
+			data->statsStream_ = &data->streams_[i];
+
 		if (data->useConverter_)
 			outputCfgs.push_back(cfg);
 	}
@@ -960,7 +1102,7 @@ int SimplePipelineHandler::configure(Camera *camera, CameraConfiguration *c)
 	inputCfg.pixelFormat = pipeConfig->captureFormat;
 	inputCfg.size = pipeConfig->captureSize;
 	inputCfg.stride = captureFormat.planes[0].bpl;
-	inputCfg.bufferCount = kNumInternalBuffers;
+	inputCfg.bufferCount = numInternalBuffers(data);
 
 	return data->converter_->configure(inputCfg, outputCfgs);
 }
@@ -982,7 +1124,7 @@ int SimplePipelineHandler::exportFrameBuffers(Camera *camera, Stream *stream,
 		return data->video_->exportBuffers(count, buffers);
 }
 
-int SimplePipelineHandler::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+int SimplePipelineHandler::start(Camera *camera, const ControlList *controls)
 {
 	SimpleCameraData *data = cameraData(camera);
 	V4L2VideoDevice *video = data->video_;
@@ -1001,7 +1143,7 @@ int SimplePipelineHandler::start(Camera *camera, [[maybe_unused]] const ControlL
 		 * When using the converter allocate a fixed number of internal
 		 * buffers.
 		 */
-		ret = video->allocateBuffers(kNumInternalBuffers,
+		ret = video->allocateBuffers(numInternalBuffers(data),
 					     &data->converterBuffers_);
 	} else {
 		/* Otherwise, prepare for using buffers from the only stream. */
@@ -1033,6 +1175,13 @@ int SimplePipelineHandler::start(Camera *camera, [[maybe_unused]] const ControlL
 			video->queueBuffer(buffer.get());
 	}
 
+	data->statsGrid_ = {};
+	if (controls && controls->contains(controls::draft::StatsGrid))
+		data->statsGrid_ = controls->get(controls::draft::StatsGrid);
+
+	if (data->statsStream_)
+		data->stats_->start();
+
 	return 0;
 }
 
@@ -1049,6 +1198,9 @@ void SimplePipelineHandler::stop(Camera *camera)
 
 	video->bufferReady.disconnect(data, &SimpleCameraData::bufferReady);
 
+	data->stats_->stop();
+	data->statsGrids_.clear();
+
 	data->converterBuffers_.clear();
 
 	releasePipeline(data);
@@ -1079,6 +1231,12 @@ int SimplePipelineHandler::queueRequestDevice(Camera *camera, Request *request)
 	if (data->useConverter_)
 		data->converterQueue_.push(std::move(buffers));
 
+	if (request->controls().contains(controls::draft::StatsGrid))
+		data->statsGrid_ = request->controls().get(controls::draft::StatsGrid);
+	if (data->statsStream_ && !data->statsGrid_.isNull() &&
+	    request->findBuffer(data->statsStream_))
+		data->statsGrids_[request] = data->statsGrid_;
+
 	return 0;
 }
 
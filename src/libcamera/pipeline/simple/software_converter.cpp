@@ -0,0 +1,607 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * software_converter.cpp - CPU-based Bayer to RGB converter for simple pipeline
+ */
+
+#include "software_converter.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/bayer_packing.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(SimplePipeline)
+
+namespace {
+
+/* Indices of the colour components in the statistics and lookup tables. */
+enum Component {
+	Red = 0,
+	Green = 1,
+	Blue = 2,
+};
+
+unsigned int bytesPerPixel(const PixelFormat &format)
+{
+	if (format == formats::RGB888 || format == formats::BGR888)
+		return 3;
+	if (format == formats::XRGB8888 || format == formats::XBGR8888)
+		return 4;
+
+	return 0;
+}
+
+/*
+ * Interpolate one line of Bayer data to RGB. The prev, cur and next pointers
+ * point to the first pixel of the three input lines centered on the output
+ * line. They are padded with one pixel on each side, so that the pixels at
+ * offsets -1 and width are valid.
+ *
+ * The line alternates between a native colour component (red or blue) and
+ * green pixels. Green values at the native sites are interpolated from the
+ * four direct neighbours, the other colour component from the four diagonal
+ * neighbours, and the two missing components at green sites from the two
+ * horizontal or vertical neighbours.
+ */
+template<unsigned int Bpp>
+inline void debayerLine(uint8_t *dst, const uint8_t *prev, const uint8_t *cur,
+		 const uint8_t *next, unsigned int width, bool redLine,
+		 bool firstGreen, unsigned int redOffset, unsigned int blueOffset,
+		 const std::array<std::array<uint8_t, 256>, 3> &lut)
+{
+	const uint8_t *lutN = lut[redLine ? Red : Blue].data();
+	const uint8_t *lutG = lut[Green].data();
+	const uint8_t *lutO = lut[redLine ? Blue : Red].data();
+	const unsigned int nOffset = redLine ? redOffset : blueOffset;
+	const unsigned int oOffset = redLine ? blueOffset : redOffset;
+
+	for (int x = 0; x < static_cast<int>(width); x += 2) {
+		const int g = firstGreen ? x : x + 1;
+		const int n = firstGreen ? x + 1 : x;
+		uint8_t *p;
+
+		p = dst + g * Bpp;
+		p[nOffset] = lutN[(cur[g - 1] + cur[g + 1] + 1) >> 1];
+		p[1] = lutG[cur[g]];
+		p[oOffset] = lutO[(prev[g] + next[g] + 1) >> 1];
+		if (Bpp == 4)
+			p[3] = 0xff;
+
+		p = dst + n * Bpp;
+		p[nOffset] = lutN[cur[n]];
+		p[1] = lutG[(cur[n - 1] + cur[n + 1] + prev[n] + next[n] + 2) >> 2];
+		p[oOffset] = lutO[(prev[n - 1] + prev[n + 1] +
+				   next[n - 1] + next[n + 1] + 2) >> 2];
+		if (Bpp == 4)
+			p[3] = 0xff;
+	}
+}
+
+/*
+ * Instantiate the interpolation for each output pixel size, compiled for all
+ * the instruction sets selected by LIBCAMERA_TARGET_CLONES.
+ */
+LIBCAMERA_TARGET_CLONES
+void debayerLine3(uint8_t *dst, const uint8_t *prev, const uint8_t *cur,
+		  const uint8_t *next, unsigned int width, bool redLine,
+		  bool firstGreen, unsigned int redOffset, unsigned int blueOffset,
+		  const std::array<std::array<uint8_t, 256>, 3> &lut)
+{
+	debayerLine<3>(dst, prev, cur, next, width, redLine, firstGreen,
+		       redOffset, blueOffset, lut);
+}
+
+LIBCAMERA_TARGET_CLONES
+void debayerLine4(uint8_t *dst, const uint8_t *prev, const uint8_t *cur,
+		  const uint8_t *next, unsigned int width, bool redLine,
+		  bool firstGreen, unsigned int redOffset, unsigned int blueOffset,
+		  const std::array<std::array<uint8_t, 256>, 3> &lut)
+{
+	debayerLine<4>(dst, prev, cur, next, width, redLine, firstGreen,
+		       redOffset, blueOffset, lut);
+}
+
+/*
+ * Accumulate the green and native colour samples of one unpacked Bayer line,
+ * for the white balance and gain statistics.
+ */
+LIBCAMERA_TARGET_CLONES
+void accumulateLine(const uint8_t *line, unsigned int width, bool firstGreen,
+		    uint64_t *green, uint64_t *native)
+{
+	const unsigned int g = !firstGreen;
+	const unsigned int n = firstGreen;
+	uint32_t sumGreen = 0;
+	uint32_t sumNative = 0;
+
+	/* The sums fit in 32 bits for lines of up to 16M pixels. */
+	for (unsigned int x = 0; x < width; x += 2) {
+		sumGreen += line[x + g];
+		sumNative += line[x + n];
+	}
+
+	*green += sumGreen;
+	*native += sumNative;
+}
+
+} /* namespace */
+
+/**
+ * \class SimpleSoftwareConverter
+ * \brief Convert raw Bayer frames to RGB on the CPU
+ *
+ * The software converter is used by the simple pipeline handler on platforms
+ * that have no hardware format converter, to produce processed RGB images from
+ * raw Bayer sensors. It supports all the Bayer input formats handled by
+ * bayer::unpackLineMsb8(), and produces RGB888, BGR888, XRGB8888 and XBGR8888
+ * output at the input resolution.
+ *
+ * Frames are processed on a worker thread, and split in tiles of lines
+ * processed in parallel by the TileProcessor. The statistics needed by the
+ * grey-world white balance and the digital gain control are gathered in the
+ * same pass, and applied to the next frame through per-component lookup
+ * tables that also include gamma correction.
+ *
+ * \todo Control the sensor exposure time and analogue gain instead of relying
+ * on digital gain only
+ * \todo Subtract the sensor black level
+ */
+
+SimpleSoftwareConverter::SimpleSoftwareConverter()
+	: inputStride_(0), running_(false), digitalGain_(1.0f)
+{
+	awbGains_.fill(1.0f);
+}
+
+SimpleSoftwareConverter::~SimpleSoftwareConverter()
+{
+	stop();
+}
+
+std::vector<PixelFormat> SimpleSoftwareConverter::formats(PixelFormat input)
+{
+	BayerFormat bayer = BayerFormat::fromPixelFormat(input);
+	if (!bayer.isValid() || bayer.order == BayerFormat::MONO)
+		return {};
+
+	/* Any packing that can be unpacked to 8-bit samples is supported. */
+	if (!bayer::lineSize(bayer, 1))
+		return {};
+
+	return {
+		formats::XRGB8888,
+		formats::XBGR8888,
+		formats::RGB888,
+		formats::BGR888,
+	};
+}
+
+SizeRange SimpleSoftwareConverter::sizes(const Size &input)
+{
+	return SizeRange(input);
+}
+
+std::tuple<unsigned int, unsigned int>
+SimpleSoftwareConverter::strideAndFrameSize(const PixelFormat &pixelFormat,
+					    const Size &size)
+{
+	unsigned int bpp = bytesPerPixel(pixelFormat);
+	unsigned int stride = size.width * bpp;
+
+	return std::make_tuple(stride, stride * size.height);
+}
+
+int SimpleSoftwareConverter::configure(const StreamConfiguration &inputCfg,
+				       const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs)
+{
+	std::vector<PixelFormat> outputFormats = formats(inputCfg.pixelFormat);
+	if (outputFormats.empty()) {
+		LOG(SimplePipeline, Error)
+			<< "Unsupported input format " << inputCfg.pixelFormat.toString();
+		return -EINVAL;
+	}
+
+	if (inputCfg.size.width < 2 || inputCfg.size.height < 2 ||
+	    inputCfg.size.width % 4 || inputCfg.size.height % 2) {
+		LOG(SimplePipeline, Error)
+			<< "Unsupported input size " << inputCfg.size.toString();
+		return -EINVAL;
+	}
+
+	inputFormat_ = BayerFormat::fromPixelFormat(inputCfg.pixelFormat);
+	size_ = inputCfg.size;
+	inputStride_ = inputCfg.stride;
+
+	outputs_.clear();
+
+	for (const StreamConfiguration &outputCfg : outputCfgs) {
+		if (std::find(outputFormats.begin(), outputFormats.end(),
+			      outputCfg.pixelFormat) == outputFormats.end() ||
+		    outputCfg.size != size_) {
+			LOG(SimplePipeline, Error)
+				<< "Output format not supported";
+			outputs_.clear();
+			return -EINVAL;
+		}
+
+		Output output;
+		output.pixelFormat = outputCfg.pixelFormat;
+		std::tie(output.stride, output.frameSize) =
+			strideAndFrameSize(output.pixelFormat, size_);
+		outputs_.push_back(output);
+	}
+
+	/*
+	 * Size the tiles based on the input and output data accessed for each
+	 * line. Keep them aligned to the Bayer pattern.
+	 */
+	unsigned int lineBytes = inputStride_;
+	for (const Output &output : outputs_)
+		lineBytes += output.stride;
+
+	tiles_ = TileProcessor(size_.height, lineBytes, 2);
+
+	return 0;
+}
+
+int SimpleSoftwareConverter::exportBuffers(unsigned int output, unsigned int count,
+					   std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	if (output >= outputs_.size())
+		return -EINVAL;
+
+	const unsigned int frameSize = outputs_[output].frameSize;
+
+	/*
+	 * \todo Allocate the buffers from a dma-heap when available, to allow
+	 * importing them in other devices
+	 */
+	for (unsigned int i = 0; i < count; ++i) {
+		int fd = memfd_create("libcamera-swconv", MFD_CLOEXEC);
+		if (fd < 0) {
+			int ret = -errno;
+			LOG(SimplePipeline, Error)
+				<< "Failed to allocate buffer: " << strerror(-ret);
+			return ret;
+		}
+
+		if (ftruncate(fd, frameSize) < 0) {
+			int ret = -errno;
+			LOG(SimplePipeline, Error)
+				<< "Failed to size buffer: " << strerror(-ret);
+			close(fd);
+			return ret;
+		}
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(std::move(fd));
+		plane.offset = 0;
+		plane.length = frameSize;
+
+		buffers->push_back(std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane }));
+	}
+
+	return count;
+}
+
+int SimpleSoftwareConverter::start()
+{
+	if (running_)
+		return 0;
+
+	awbGains_.fill(1.0f);
+	digitalGain_ = 1.0f;
+	updateGains();
+
+	running_ = true;
+	thread_ = std::thread(&SimpleSoftwareConverter::run, this);
+
+	return 0;
+}
+
+void SimpleSoftwareConverter::stop()
+{
+	if (!thread_.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		running_ = false;
+	}
+	cv_.notify_all();
+	thread_.join();
+
+	/*
+	 * Complete the jobs processed by the worker thread, and cancel the
+	 * ones it hasn't processed yet, in order.
+	 */
+	std::deque<Job> completedJobs = std::move(completedJobs_);
+	std::deque<Job> pendingJobs = std::move(pendingJobs_);
+	completedJobs_.clear();
+	pendingJobs_.clear();
+
+	for (Job &job : completedJobs)
+		completeJob(job);
+
+	for (Job &job : pendingJobs) {
+		job.status = FrameMetadata::FrameCancelled;
+		completeJob(job);
+	}
+}
+
+int SimpleSoftwareConverter::queueBuffers(FrameBuffer *input,
+					  const std::map<unsigned int, FrameBuffer *> &outputs)
+{
+	if (outputs.empty())
+		return -EINVAL;
+
+	for (auto [index, buffer] : outputs) {
+		if (!buffer || index >= outputs_.size())
+			return -EINVAL;
+	}
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		pendingJobs_.push_back({ input, outputs, FrameMetadata::FrameError });
+	}
+	cv_.notify_one();
+
+	return 0;
+}
+
+void SimpleSoftwareConverter::run()
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	while (true) {
+		cv_.wait(locker, [&] { return !running_ || !pendingJobs_.empty(); });
+		if (!running_)
+			break;
+
+		Job job = std::move(pendingJobs_.front());
+		pendingJobs_.pop_front();
+
+		locker.unlock();
+		process(job);
+		locker.lock();
+
+		completedJobs_.push_back(std::move(job));
+
+		/* Signal completion from the thread the converter lives in. */
+		invokeMethod(&SimpleSoftwareConverter::jobDone,
+			     ConnectionTypeQueued);
+	}
+}
+
+void SimpleSoftwareConverter::process(Job &job)
+{
+	MappedFrameBuffer in(job.input, MappedFrameBuffer::MapFlag::Read);
+	if (!in.isValid()) {
+		LOG(SimplePipeline, Error) << "Failed to map input buffer";
+		return;
+	}
+
+	std::vector<MappedFrameBuffer> outs;
+	std::vector<uint8_t *> dsts(outputs_.size(), nullptr);
+
+	outs.reserve(job.outputs.size());
+	for (auto [index, buffer] : job.outputs) {
+		MappedFrameBuffer &out =
+			outs.emplace_back(buffer, MappedFrameBuffer::MapFlag::Write);
+		if (!out.isValid() ||
+		    out.planes()[0].size() < outputs_[index].frameSize) {
+			LOG(SimplePipeline, Error) << "Failed to map output buffer";
+			return;
+		}
+
+		dsts[index] = out.planes()[0].data();
+	}
+
+	const uint8_t *src = in.planes()[0].data();
+	if (in.planes()[0].size() < inputStride_ * size_.height) {
+		LOG(SimplePipeline, Error) << "Input buffer too small";
+		return;
+	}
+
+	tileStats_.assign(tiles_.tileCount(), {});
+
+	tiles_.run([&](const TileProcessor::Tile &tile) {
+		processTile(tile, src, dsts);
+	});
+
+	updateGains();
+
+	const FrameMetadata &inputMetadata = job.input->metadata();
+
+	for (auto [index, buffer] : job.outputs) {
+		FrameMetadata &metadata = buffer->_d()->metadata();
+
+		metadata.status = FrameMetadata::FrameSuccess;
+		metadata.sequence = inputMetadata.sequence;
+		metadata.timestamp = inputMetadata.timestamp;
+		metadata.planes()[0].bytesused = outputs_[index].frameSize;
+	}
+
+	job.status = FrameMetadata::FrameSuccess;
+}
+
+void SimpleSoftwareConverter::unpackLine(const uint8_t *src, uint8_t *line) const
+{
+	const unsigned int width = size_.width;
+
+	/* Keep the 8 most significant bits of each pixel. */
+	bayer::unpackLineMsb8(inputFormat_, src, line + 1, width);
+
+	/* Mirror the border pixels, preserving the Bayer pattern. */
+	line[0] = line[2];
+	line[width + 1] = line[width - 1];
+}
+
+void SimpleSoftwareConverter::processTile(const TileProcessor::Tile &tile,
+					  const uint8_t *src,
+					  const std::vector<uint8_t *> &dsts)
+{
+	const unsigned int width = size_.width;
+	const unsigned int height = size_.height;
+	const unsigned int yStart = tile.start;
+	const unsigned int yEnd = tile.end;
+
+	/* Mirror the first and last lines, preserving the Bayer pattern. */
+	auto inputLine = [&](int y) {
+		if (y < 0)
+			y = 1;
+		else if (y >= static_cast<int>(height))
+			y = height - 2;
+		return src + y * inputStride_;
+	};
+
+	std::vector<uint8_t> lines[3] = {
+		std::vector<uint8_t>(width + 2),
+		std::vector<uint8_t>(width + 2),
+		std::vector<uint8_t>(width + 2),
+	};
+	uint8_t *prev = lines[0].data();
+	uint8_t *cur = lines[1].data();
+	uint8_t *next = lines[2].data();
+
+	unpackLine(inputLine(static_cast<int>(yStart) - 1), prev);
+	unpackLine(inputLine(yStart), cur);
+
+	/*
+	 * Identify the colour of the first two pixels of the first line. The
+	 * pattern is inverted on odd lines.
+	 */
+	const BayerFormat::Order order = inputFormat_.order;
+	const bool firstLineRed = order == BayerFormat::GRBG ||
+				  order == BayerFormat::RGGB;
+	const bool firstLineGreen = order == BayerFormat::GBRG ||
+				    order == BayerFormat::GRBG;
+
+	Statistics &stats = tileStats_[tile.index];
+
+	for (unsigned int y = yStart; y < yEnd; ++y) {
+		unpackLine(inputLine(y + 1), next);
+
+		const bool redLine = firstLineRed ^ (y & 1);
+		const bool firstGreen = firstLineGreen ^ (y & 1);
+
+		/* Accumulate the native samples for the statistics. */
+		accumulateLine(cur + 1, width, firstGreen, &stats.sum[Green],
+			       &stats.sum[redLine ? Red : Blue]);
+
+		for (unsigned int i = 0; i < outputs_.size(); ++i) {
+			if (!dsts[i])
+				continue;
+
+			const Output &output = outputs_[i];
+			uint8_t *dst = dsts[i] + y * output.stride;
+			const bool rgb = output.pixelFormat == formats::RGB888 ||
+					 output.pixelFormat == formats::XRGB8888;
+			const unsigned int redOffset = rgb ? 2 : 0;
+			const unsigned int blueOffset = rgb ? 0 : 2;
+
+			if (bytesPerPixel(output.pixelFormat) == 4)
+				debayerLine4(dst, prev + 1, cur + 1, next + 1,
+					     width, redLine, firstGreen,
+					     redOffset, blueOffset, lut_);
+			else
+				debayerLine3(dst, prev + 1, cur + 1, next + 1,
+					     width, redLine, firstGreen,
+					     redOffset, blueOffset, lut_);
+		}
+
+		std::swap(prev, cur);
+		std::swap(cur, next);
+	}
+}
+
+void SimpleSoftwareConverter::updateGains()
+{
+	/* Speed at which the gains converge towards their target values. */
+	constexpr float kSpeed = 0.2f;
+	/* Target mean luminance, in linear space. */
+	constexpr float kTargetLuminance = 0.18f;
+	constexpr float kMaxGain = 8.0f;
+	constexpr float kGamma = 1.0f / 2.2f;
+
+	uint64_t sum[3] = {};
+	for (const Statistics &stats : tileStats_) {
+		for (unsigned int i = 0; i < 3; ++i)
+			sum[i] += stats.sum[i];
+	}
+
+	const uint64_t pixels = static_cast<uint64_t>(size_.width) * size_.height;
+
+	if (pixels && sum[Red] && sum[Green] && sum[Blue]) {
+		/* Grey-world white balance, relative to the green component. */
+		const float mean[3] = {
+			static_cast<float>(sum[Red]) / (pixels / 4),
+			static_cast<float>(sum[Green]) / (pixels / 2),
+			static_cast<float>(sum[Blue]) / (pixels / 4),
+		};
+
+		for (unsigned int i : { Red, Blue }) {
+			float target = std::clamp(mean[Green] / mean[i],
+						  1.0f / kMaxGain, kMaxGain);
+			awbGains_[i] += (target - awbGains_[i]) * kSpeed;
+		}
+
+		float luminance = (0.299f * mean[Red] * awbGains_[Red] +
+				   0.587f * mean[Green] +
+				   0.114f * mean[Blue] * awbGains_[Blue]) / 255.0f;
+		float target = std::clamp(kTargetLuminance / luminance,
+					  1.0f, kMaxGain);
+		digitalGain_ += (target - digitalGain_) * kSpeed;
+	}
+
+	for (unsigned int i = 0; i < 3; ++i) {
+		const float gain = awbGains_[i] * digitalGain_;
+
+		for (unsigned int value = 0; value < 256; ++value) {
+			float x = std::min(value * gain / 255.0f, 1.0f);
+			lut_[i][value] = static_cast<uint8_t>(powf(x, kGamma) * 255.0f + 0.5f);
+		}
+	}
+}
+
+void SimpleSoftwareConverter::jobDone()
+{
+	std::deque<Job> completedJobs;
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		std::swap(completedJobs, completedJobs_);
+	}
+
+	for (Job &job : completedJobs)
+		completeJob(job);
+}
+
+void SimpleSoftwareConverter::completeJob(Job &job)
+{
+	for (auto [index, buffer] : job.outputs) {
+		buffer->_d()->metadata().status = job.status;
+		outputBufferReady.emit(buffer);
+	}
+
+	inputBufferReady.emit(job.input);
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * software_converter.h - CPU-based Bayer to RGB converter for simple pipeline
+ */
+
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <libcamera/base/object.h>
+
+#include <libcamera/framebuffer.h>
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "libcamera/internal/bayer_format.h"
+#include "libcamera/internal/tile_processor.h"
+
+#include "converter.h"
+
+namespace libcamera {
+
+class SimpleSoftwareConverter : public SimpleConverter, public Object
+{
+public:
+	SimpleSoftwareConverter();
+	~SimpleSoftwareConverter();
+
+	bool isValid() const override { return true; }
+
+	unsigned int queueDepth() const override { return kQueueDepth; }
+
+	std::vector<PixelFormat> formats(PixelFormat input) override;
+	SizeRange sizes(const Size &input) override;
+
+	std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size) override;
+
+	int configure(const StreamConfiguration &inputCfg,
+		      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfg) override;
+	int exportBuffers(unsigned int output, unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+
+	int start() override;
+	void stop() override;
+
+	int queueBuffers(FrameBuffer *input,
+			 const std::map<unsigned int, FrameBuffer *> &outputs) override;
+
+private:
+	static constexpr unsigned int kQueueDepth = 2;
+
+	struct Output {
+		PixelFormat pixelFormat;
+		unsigned int stride;
+		unsigned int frameSize;
+	};
+
+	struct Job {
+		FrameBuffer *input;
+		std::map<unsigned int, FrameBuffer *> outputs;
+		FrameMetadata::Status status;
+	};
+
+	struct Statistics {
+		uint64_t sum[3];
+	};
+
+	using Lut = std::array<std::array<uint8_t, 256>, 3>;
+
+	void run();
+	void process(Job &job);
+	void processTile(const TileProcessor::Tile &tile, const uint8_t *src,
+			 const std::vector<uint8_t *> &dsts);
+	void unpackLine(const uint8_t *src, uint8_t *line) const;
+	void updateGains();
+
+	void jobDone();
+	void completeJob(Job &job);
+
+	BayerFormat inputFormat_;
+	Size size_;
+	unsigned int inputStride_;
+	std::vector<Output> outputs_;
+
+	/* Worker thread and the list of jobs shared with it. */
+	std::thread thread_;
+	std::mutex lock_;
+	std::condition_variable cv_;
+	std::deque<Job> pendingJobs_;
+	std::deque<Job> completedJobs_;
+	bool running_;
+
+	TileProcessor tiles_;
+
+	/* Accessed by the worker thread and the tile operations only. */
+	std::vector<Statistics> tileStats_;
+	std::array<float, 3> awbGains_;
+	float digitalGain_;
+	Lut lut_;
+};
+
+} /* namespace libcamera */
@@ -0,0 +1,443 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * mjpeg_decoder.cpp - MJPEG decoder for the uvcvideo pipeline handler
+ */
+
+#include "mjpeg_decoder.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/base/global_configuration.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+#include "libcamera/internal/v4l2_videodevice.h"
+
+#if HAVE_LIBJPEG
+#include "mjpeg_software_decoder.h"
+#endif
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(UVC)
+
+namespace {
+
+/*
+ * Check if a video device node is a memory-to-memory device, without going
+ * through V4L2VideoDevice to avoid logging errors for unrelated devices.
+ */
+bool isM2MDevice(const std::string &deviceNode)
+{
+	int fd = open(deviceNode.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	struct v4l2_capability caps = {};
+	int ret = ioctl(fd, VIDIOC_QUERYCAP, &caps);
+	close(fd);
+	if (ret < 0)
+		return false;
+
+	uint32_t deviceCaps = caps.capabilities & V4L2_CAP_DEVICE_CAPS
+			    ? caps.device_caps : caps.capabilities;
+
+	return deviceCaps & (V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE);
+}
+
+} /* namespace */
+
+/* -----------------------------------------------------------------------------
+ * MJPEGDecoder
+ */
+
+/**
+ * \class MJPEGDecoder
+ * \brief Decode the MJPEG frames captured from a UVC device
+ *
+ * Most UVC cameras only produce their largest resolutions and highest frame
+ * rates in MJPEG. The decoder lets the uvcvideo pipeline handler expose
+ * uncompressed formats for those sizes, capturing MJPEG internally and
+ * decoding it to the buffers of the request.
+ *
+ * A V4L2 memory-to-memory JPEG decoder is used when the platform has one,
+ * otherwise the frames are decoded on the CPU with libjpeg, if available. The
+ * LIBCAMERA_UVC_MJPEG_DECODER environment variable selects the software
+ * decoder when set to "software", and disables decoding when set to "none".
+ *
+ * Input buffers are signalled through inputBufferReady once the decoder
+ * doesn't need them anymore, and output buffers through outputBufferReady
+ * when decoded, in the order they have been queued.
+ */
+
+std::unique_ptr<MJPEGDecoder> MJPEGDecoder::create()
+{
+	const char *mode = GlobalConfiguration::option("LIBCAMERA_UVC_MJPEG_DECODER");
+	if (mode && !strcmp(mode, "none"))
+		return nullptr;
+
+	if (!mode || strcmp(mode, "software")) {
+		std::unique_ptr<MJPEGM2MDecoder> decoder = MJPEGM2MDecoder::probe();
+		if (decoder)
+			return decoder;
+	}
+
+#if HAVE_LIBJPEG
+	return std::make_unique<MJPEGSoftwareDecoder>();
+#else
+	return nullptr;
+#endif
+}
+
+/* -----------------------------------------------------------------------------
+ * MJPEGM2MDecoder
+ */
+
+/*
+ * Look for a V4L2 M2M device that accepts JPEG on its output queue and
+ * produces at least one uncompressed format on its capture queue.
+ */
+std::unique_ptr<MJPEGM2MDecoder> MJPEGM2MDecoder::probe()
+{
+	DIR *dir = opendir("/dev");
+	if (!dir)
+		return nullptr;
+
+	std::vector<std::string> nodes;
+	struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		if (!strncmp(ent->d_name, "video", 5))
+			nodes.push_back(std::string("/dev/") + ent->d_name);
+	}
+
+	closedir(dir);
+
+	std::sort(nodes.begin(), nodes.end());
+
+	for (const std::string &node : nodes) {
+		if (!isM2MDevice(node))
+			continue;
+
+		V4L2M2MDevice m2m(node);
+		if (m2m.open() < 0)
+			continue;
+
+		V4L2VideoDevice::Formats formats = m2m.output()->formats();
+		m2m.close();
+
+		for (uint32_t fourcc : { V4L2_PIX_FMT_JPEG, V4L2_PIX_FMT_MJPEG }) {
+			V4L2PixelFormat jpegFormat{ fourcc };
+			if (!formats.count(jpegFormat))
+				continue;
+
+			auto decoder = std::make_unique<MJPEGM2MDecoder>(node, jpegFormat);
+			if (!decoder->isValid() || decoder->formats().empty())
+				break;
+
+			LOG(UVC, Info) << "Using V4L2 JPEG decoder " << node;
+			return decoder;
+		}
+	}
+
+	return nullptr;
+}
+
+MJPEGM2MDecoder::MJPEGM2MDecoder(const std::string &deviceNode,
+				 const V4L2PixelFormat &jpegFormat)
+	: deviceNode_(deviceNode), jpegFormat_(jpegFormat), outputBufferCount_(0)
+{
+	m2m_ = std::make_unique<V4L2M2MDevice>(deviceNode_);
+
+	m2m_->output()->bufferReady.connect(this, &MJPEGM2MDecoder::bitstreamBufferReady);
+	m2m_->capture()->bufferReady.connect(this, &MJPEGM2MDecoder::captureBufferReady);
+
+	int ret = m2m_->open();
+	if (ret < 0)
+		m2m_.reset();
+}
+
+MJPEGM2MDecoder::~MJPEGM2MDecoder()
+{
+	stop();
+}
+
+int MJPEGM2MDecoder::setInputFormat(const Size &size)
+{
+	V4L2DeviceFormat format;
+	format.fourcc = jpegFormat_;
+	format.size = size;
+
+	int ret = m2m_->output()->setFormat(&format);
+	if (ret < 0)
+		return ret;
+
+	if (format.fourcc != jpegFormat_ || format.size != size)
+		return -EINVAL;
+
+	return 0;
+}
+
+std::vector<PixelFormat> MJPEGM2MDecoder::formats()
+{
+	/*
+	 * Set the format on the output queue to enumerate the decoded formats
+	 * on the capture queue.
+	 */
+	if (setInputFormat({ 640, 480 }) < 0)
+		return {};
+
+	std::vector<PixelFormat> pixelFormats;
+
+	for (const auto &format : m2m_->capture()->formats()) {
+		PixelFormat pixelFormat = format.first.toPixelFormat();
+		if (pixelFormat && pixelFormat != formats::MJPEG)
+			pixelFormats.push_back(pixelFormat);
+	}
+
+	return pixelFormats;
+}
+
+std::tuple<unsigned int, unsigned int>
+MJPEGM2MDecoder::strideAndFrameSize(const PixelFormat &pixelFormat,
+				    const Size &size)
+{
+	/* Decoders don't scale, the capture format depends on the input size. */
+	if (setInputFormat(size) < 0)
+		return std::make_tuple(0, 0);
+
+	V4L2DeviceFormat format;
+	format.fourcc = V4L2PixelFormat::fromPixelFormat(pixelFormat);
+	format.size = size;
+
+	int ret = m2m_->capture()->tryFormat(&format);
+	if (ret < 0 || format.size != size)
+		return std::make_tuple(0, 0);
+
+	return std::make_tuple(format.planes[0].bpl, format.planes[0].size);
+}
+
+int MJPEGM2MDecoder::configure(const PixelFormat &pixelFormat, const Size &size,
+			       unsigned int bufferCount)
+{
+	int ret = setInputFormat(size);
+	if (ret < 0) {
+		LOG(UVC, Error)
+			<< "Failed to set decoder input format: " << strerror(-ret);
+		return ret;
+	}
+
+	V4L2PixelFormat videoFormat = V4L2PixelFormat::fromPixelFormat(pixelFormat);
+
+	V4L2DeviceFormat format;
+	format.fourcc = videoFormat;
+	format.size = size;
+
+	ret = m2m_->capture()->setFormat(&format);
+	if (ret < 0) {
+		LOG(UVC, Error)
+			<< "Failed to set decoder output format: " << strerror(-ret);
+		return ret;
+	}
+
+	if (format.fourcc != videoFormat || format.size != size) {
+		LOG(UVC, Error)
+			<< "Decoder output format not supported (requested "
+			<< size.toString() << "-" << videoFormat.toString()
+			<< ", got " << format.toString() << ")";
+		return -EINVAL;
+	}
+
+	pixelFormat_ = pixelFormat;
+	size_ = size;
+	outputBufferCount_ = bufferCount;
+
+	return 0;
+}
+
+int MJPEGM2MDecoder::exportBuffers(unsigned int count,
+				   std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	return m2m_->capture()->exportBuffers(count, buffers);
+}
+
+int MJPEGM2MDecoder::start()
+{
+	/*
+	 * The compressed frames are copied to buffers allocated by the
+	 * decoder, as the buffers of the uvcvideo driver are allocated from
+	 * vmalloc memory that most decoders can't import. Copying a JPEG frame
+	 * is cheap compared to decoding it.
+	 */
+	int ret = m2m_->output()->allocateBuffers(kQueueDepth, &bitstreamBuffers_);
+	if (ret < 0)
+		return ret;
+
+	for (std::unique_ptr<FrameBuffer> &buffer : bitstreamBuffers_)
+		freeBitstreamBuffers_.push(buffer.get());
+
+	ret = m2m_->capture()->importBuffers(outputBufferCount_);
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	ret = m2m_->output()->streamOn();
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	ret = m2m_->capture()->streamOn();
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	return 0;
+}
+
+void MJPEGM2MDecoder::stop()
+{
+	if (!m2m_)
+		return;
+
+	/*
+	 * Take the pending jobs out of the queue before stopping the device,
+	 * to prevent the completion handlers from submitting them.
+	 */
+	std::queue<std::pair<FrameBuffer *, FrameBuffer *>> pendingJobs;
+	std::swap(pendingJobs, pendingJobs_);
+
+	m2m_->capture()->streamOff();
+	m2m_->output()->streamOff();
+	m2m_->capture()->releaseBuffers();
+	m2m_->output()->releaseBuffers();
+
+	queuedJobs_.clear();
+	freeBitstreamBuffers_ = {};
+	bitstreamBuffers_.clear();
+
+	/*
+	 * Cancel the jobs that never reached the device, after the ones that
+	 * did, to complete the buffers in the order they have been queued.
+	 */
+	while (!pendingJobs.empty()) {
+		auto [input, output] = pendingJobs.front();
+		pendingJobs.pop();
+
+		cancel(input, output);
+	}
+}
+
+int MJPEGM2MDecoder::queueBuffers(FrameBuffer *input, FrameBuffer *output)
+{
+	if (freeBitstreamBuffers_.empty()) {
+		pendingJobs_.push({ input, output });
+		return 0;
+	}
+
+	return submit(input, output);
+}
+
+int MJPEGM2MDecoder::submit(FrameBuffer *input, FrameBuffer *output)
+{
+	FrameBuffer *bitstream = freeBitstreamBuffers_.front();
+	const FrameMetadata &inputMetadata = input->metadata();
+	size_t size = inputMetadata.planes()[0].bytesused;
+
+	{
+		MappedFrameBuffer src(input, MappedFrameBuffer::MapFlag::Read);
+		MappedFrameBuffer dst(bitstream, MappedFrameBuffer::MapFlag::Write);
+		if (!src.isValid() || !dst.isValid()) {
+			LOG(UVC, Error) << "Failed to map MJPEG buffer";
+			return -EINVAL;
+		}
+
+		if (size > src.planes()[0].size() || size > dst.planes()[0].size()) {
+			LOG(UVC, Error)
+				<< "MJPEG frame of " << size
+				<< " bytes exceeds buffer size";
+			return -ENOSPC;
+		}
+
+		memcpy(dst.planes()[0].data(), src.planes()[0].data(), size);
+	}
+
+	bitstream->_d()->metadata().planes()[0].bytesused = size;
+
+	int ret = m2m_->capture()->queueBuffer(output);
+	if (ret < 0)
+		return ret;
+
+	ret = m2m_->output()->queueBuffer(bitstream);
+	if (ret < 0)
+		return ret;
+
+	freeBitstreamBuffers_.pop();
+	queuedJobs_.push_back({ input, output, inputMetadata.sequence,
+				inputMetadata.timestamp });
+
+	/* The input buffer has been copied, give it back right away. */
+	inputBufferReady.emit(input);
+
+	return 0;
+}
+
+void MJPEGM2MDecoder::cancel(FrameBuffer *input, FrameBuffer *output)
+{
+	output->cancel();
+	outputBufferReady.emit(output);
+	inputBufferReady.emit(input);
+}
+
+void MJPEGM2MDecoder::bitstreamBufferReady(FrameBuffer *buffer)
+{
+	freeBitstreamBuffers_.push(buffer);
+
+	/* Keep the device busy by submitting the next job right away. */
+	while (!pendingJobs_.empty() && !freeBitstreamBuffers_.empty()) {
+		auto [input, output] = pendingJobs_.front();
+		pendingJobs_.pop();
+
+		int ret = submit(input, output);
+		if (ret < 0) {
+			LOG(UVC, Error)
+				<< "Failed to queue buffers: " << strerror(-ret);
+			cancel(input, output);
+		}
+	}
+}
+
+void MJPEGM2MDecoder::captureBufferReady(FrameBuffer *buffer)
+{
+	auto it = std::find_if(queuedJobs_.begin(), queuedJobs_.end(),
+			       [&](const Job &job) { return job.output == buffer; });
+	if (it == queuedJobs_.end())
+		return;
+
+	/* Report the capture time, not the time the frame was decoded at. */
+	FrameMetadata &metadata = buffer->_d()->metadata();
+	metadata.sequence = it->sequence;
+	metadata.timestamp = it->timestamp;
+
+	queuedJobs_.erase(it);
+
+	outputBufferReady.emit(buffer);
+}
+
+} /* namespace libcamera */
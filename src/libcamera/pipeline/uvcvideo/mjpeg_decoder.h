@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * mjpeg_decoder.h - MJPEG decoder for the uvcvideo pipeline handler
+ */
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <queue>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <libcamera/base/signal.h>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "libcamera/internal/v4l2_pixelformat.h"
+
+namespace libcamera {
+
+class FrameBuffer;
+class V4L2M2MDevice;
+
+class MJPEGDecoder
+{
+public:
+	virtual ~MJPEGDecoder() = default;
+
+	static std::unique_ptr<MJPEGDecoder> create();
+
+	virtual const char *name() const = 0;
+
+	virtual unsigned int queueDepth() const = 0;
+
+	virtual std::vector<PixelFormat> formats() = 0;
+
+	virtual std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size) = 0;
+
+	virtual int configure(const PixelFormat &pixelFormat, const Size &size,
+			      unsigned int bufferCount) = 0;
+	virtual int exportBuffers(unsigned int count,
+				  std::vector<std::unique_ptr<FrameBuffer>> *buffers) = 0;
+
+	virtual int start() = 0;
+	virtual void stop() = 0;
+
+	virtual int queueBuffers(FrameBuffer *input, FrameBuffer *output) = 0;
+
+	Signal<FrameBuffer *> inputBufferReady;
+	Signal<FrameBuffer *> outputBufferReady;
+};
+
+class MJPEGM2MDecoder : public MJPEGDecoder
+{
+public:
+	static std::unique_ptr<MJPEGM2MDecoder> probe();
+
+	MJPEGM2MDecoder(const std::string &deviceNode,
+			const V4L2PixelFormat &jpegFormat);
+	~MJPEGM2MDecoder();
+
+	bool isValid() const { return m2m_ != nullptr; }
+
+	const char *name() const override { return "hardware"; }
+
+	unsigned int queueDepth() const override { return kQueueDepth; }
+
+	std::vector<PixelFormat> formats() override;
+
+	std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size) override;
+
+	int configure(const PixelFormat &pixelFormat, const Size &size,
+		      unsigned int bufferCount) override;
+	int exportBuffers(unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+
+	int start() override;
+	void stop() override;
+
+	int queueBuffers(FrameBuffer *input, FrameBuffer *output) override;
+
+private:
+	static constexpr unsigned int kQueueDepth = 2;
+
+	struct Job {
+		FrameBuffer *input;
+		FrameBuffer *output;
+		unsigned int sequence;
+		uint64_t timestamp;
+	};
+
+	int setInputFormat(const Size &size);
+	int submit(FrameBuffer *input, FrameBuffer *output);
+	void cancel(FrameBuffer *input, FrameBuffer *output);
+
+	void bitstreamBufferReady(FrameBuffer *buffer);
+	void captureBufferReady(FrameBuffer *buffer);
+
+	std::string deviceNode_;
+	V4L2PixelFormat jpegFormat_;
+	std::unique_ptr<V4L2M2MDevice> m2m_;
+
+	PixelFormat pixelFormat_;
+	Size size_;
+	unsigned int outputBufferCount_;
+
+	std::vector<std::unique_ptr<FrameBuffer>> bitstreamBuffers_;
+	std::queue<FrameBuffer *> freeBitstreamBuffers_;
+
+	std::queue<std::pair<FrameBuffer *, FrameBuffer *>> pendingJobs_;
+	std::deque<Job> queuedJobs_;
+};
+
+} /* namespace libcamera */
@@ -0,0 +1,434 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * mjpeg_software_decoder.cpp - CPU-based MJPEG decoder for the uvcvideo pipeline
+ */
+
+#include "mjpeg_software_decoder.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <jpeglib.h>
+#include <jerror.h>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/formats.h>
+
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(UVC)
+
+namespace {
+
+struct JpegErrorManager {
+	struct jpeg_error_mgr pub;
+	jmp_buf escape;
+	bool truncated;
+};
+
+void jpegErrorExit(j_common_ptr cinfo)
+{
+	JpegErrorManager *err = reinterpret_cast<JpegErrorManager *>(cinfo->err);
+
+	(*cinfo->err->output_message)(cinfo);
+	longjmp(err->escape, 1);
+}
+
+void jpegOutputMessage(j_common_ptr cinfo)
+{
+	char message[JMSG_LENGTH_MAX];
+
+	(*cinfo->err->format_message)(cinfo, message);
+	LOG(UVC, Debug) << "libjpeg: " << message;
+}
+
+/*
+ * Frames truncated by USB transfer errors are decoded by libjpeg with a
+ * warning, and padded with grey. Record the warning to report them as
+ * erroneous, the other warnings are harmless.
+ */
+void jpegEmitMessage(j_common_ptr cinfo, int level)
+{
+	JpegErrorManager *err = reinterpret_cast<JpegErrorManager *>(cinfo->err);
+
+	if (level >= 0)
+		return;
+
+	if (cinfo->err->msg_code == JWRN_JPEG_EOF)
+		err->truncated = true;
+
+	if (!cinfo->err->num_warnings++)
+		(*cinfo->err->output_message)(cinfo);
+}
+
+/*
+ * Pack one line of interleaved YCbCr 4:4:4, as output by libjpeg, to YUYV or
+ * to the luma and, on even lines, the chroma planes of NV12. The chroma
+ * samples of the even pixels are used, libjpeg replicates them when
+ * upsampling the 4:2:2 and 4:2:0 frames that UVC cameras produce.
+ */
+void packLineYUYV(const uint8_t *src, uint8_t *dst, unsigned int width)
+{
+	for (unsigned int x = 0; x < width; x += 2, src += 6, dst += 4) {
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[3];
+		dst[3] = src[2];
+	}
+}
+
+void packLineNV12(const uint8_t *src, uint8_t *y, uint8_t *uv,
+		  unsigned int width)
+{
+	for (unsigned int x = 0; x < width; x += 2, src += 6, y += 2) {
+		y[0] = src[0];
+		y[1] = src[3];
+	}
+
+	if (!uv)
+		return;
+
+	src -= width * 3;
+	for (unsigned int x = 0; x < width; x += 2, src += 6, uv += 2) {
+		uv[0] = src[1];
+		uv[1] = src[2];
+	}
+}
+
+/*
+ * Decode a JPEG frame and pack it to dst. This function must not create
+ * objects with non-trivial destructors, as libjpeg errors longjmp() out of it.
+ */
+bool decodeFrame(struct jpeg_decompress_struct *cinfo, const uint8_t *src,
+		 size_t size, uint8_t *dst, const PixelFormat &pixelFormat,
+		 const Size &outputSize, unsigned int stride)
+{
+	JpegErrorManager *err = reinterpret_cast<JpegErrorManager *>(cinfo->err);
+	JSAMPARRAY lines;
+
+	err->truncated = false;
+
+	if (setjmp(err->escape)) {
+		jpeg_abort_decompress(cinfo);
+		return false;
+	}
+
+	jpeg_mem_src(cinfo, const_cast<uint8_t *>(src), size);
+
+	if (jpeg_read_header(cinfo, TRUE) != JPEG_HEADER_OK ||
+	    cinfo->num_components != 3 ||
+	    cinfo->image_width != outputSize.width ||
+	    cinfo->image_height != outputSize.height) {
+		jpeg_abort_decompress(cinfo);
+		return false;
+	}
+
+	/*
+	 * Skip the colour conversion and use the cheapest upsampling, the
+	 * chroma is subsampled again when packing.
+	 */
+	cinfo->out_color_space = JCS_YCbCr;
+	cinfo->do_fancy_upsampling = FALSE;
+	cinfo->dct_method = JDCT_ISLOW;
+
+	jpeg_start_decompress(cinfo);
+
+	lines = (*cinfo->mem->alloc_sarray)(reinterpret_cast<j_common_ptr>(cinfo),
+					    JPOOL_IMAGE,
+					    cinfo->output_width * 3,
+					    cinfo->rec_outbuf_height);
+
+	const unsigned int width = outputSize.width;
+	uint8_t *uvPlane = dst + stride * outputSize.height;
+
+	while (cinfo->output_scanline < cinfo->output_height) {
+		unsigned int y = cinfo->output_scanline;
+		unsigned int count = jpeg_read_scanlines(cinfo, lines,
+							 cinfo->rec_outbuf_height);
+
+		for (unsigned int i = 0; i < count; ++i, ++y) {
+			if (pixelFormat == formats::YUYV) {
+				packLineYUYV(lines[i], dst + y * stride, width);
+			} else {
+				uint8_t *uv = y % 2 ? nullptr
+					    : uvPlane + y / 2 * stride;
+				packLineNV12(lines[i], dst + y * stride, uv, width);
+			}
+		}
+	}
+
+	jpeg_finish_decompress(cinfo);
+
+	return !err->truncated;
+}
+
+} /* namespace */
+
+/**
+ * \class MJPEGSoftwareDecoder
+ * \brief Decode MJPEG frames on the CPU with libjpeg
+ *
+ * The software decoder is used when the platform has no hardware JPEG
+ * decoder. It produces NV12 and YUYV at the input resolution.
+ *
+ * A JPEG frame can't easily be split for parallel decoding, frames are thus
+ * decoded concurrently by a pool of worker threads, one frame per thread.
+ * The decoder queue depth matches the number of threads, to keep them all
+ * busy at the full frame rate of the camera. Decoded frames are completed in
+ * the order they have been queued.
+ */
+
+MJPEGSoftwareDecoder::MJPEGSoftwareDecoder()
+	: stride_(0), frameSize_(0), running_(false)
+{
+	threadCount_ = std::clamp(std::thread::hardware_concurrency(), 1U,
+				  kMaxThreads);
+}
+
+MJPEGSoftwareDecoder::~MJPEGSoftwareDecoder()
+{
+	stop();
+}
+
+std::vector<PixelFormat> MJPEGSoftwareDecoder::formats()
+{
+	return { formats::NV12, formats::YUYV };
+}
+
+std::tuple<unsigned int, unsigned int>
+MJPEGSoftwareDecoder::strideAndFrameSize(const PixelFormat &pixelFormat,
+					 const Size &size)
+{
+	if (pixelFormat != formats::NV12 && pixelFormat != formats::YUYV)
+		return std::make_tuple(0, 0);
+
+	if (size.width % 2 || size.height % 2)
+		return std::make_tuple(0, 0);
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat);
+	return std::make_tuple(info.stride(size.width, 0), info.frameSize(size));
+}
+
+int MJPEGSoftwareDecoder::configure(const PixelFormat &pixelFormat,
+				   const Size &size,
+				   [[maybe_unused]] unsigned int bufferCount)
+{
+	std::tie(stride_, frameSize_) = strideAndFrameSize(pixelFormat, size);
+	if (!frameSize_) {
+		LOG(UVC, Error)
+			<< "Unsupported decoder output " << size.toString()
+			<< "-" << pixelFormat.toString();
+		return -EINVAL;
+	}
+
+	pixelFormat_ = pixelFormat;
+	size_ = size;
+
+	return 0;
+}
+
+int MJPEGSoftwareDecoder::exportBuffers(unsigned int count,
+					std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	for (unsigned int i = 0; i < count; ++i) {
+		int fd = memfd_create("libcamera-mjpeg", MFD_CLOEXEC);
+		if (fd < 0) {
+			int ret = -errno;
+			LOG(UVC, Error)
+				<< "Failed to allocate buffer: " << strerror(-ret);
+			return ret;
+		}
+
+		if (ftruncate(fd, frameSize_) < 0) {
+			int ret = -errno;
+			LOG(UVC, Error)
+				<< "Failed to size buffer: " << strerror(-ret);
+			close(fd);
+			return ret;
+		}
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(std::move(fd));
+		plane.offset = 0;
+		plane.length = frameSize_;
+
+		buffers->push_back(std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane }));
+	}
+
+	return count;
+}
+
+int MJPEGSoftwareDecoder::start()
+{
+	if (running_)
+		return 0;
+
+	running_ = true;
+	for (unsigned int i = 0; i < threadCount_; ++i)
+		threads_.emplace_back(&MJPEGSoftwareDecoder::run, this);
+
+	return 0;
+}
+
+void MJPEGSoftwareDecoder::stop()
+{
+	if (threads_.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		running_ = false;
+	}
+	cv_.notify_all();
+
+	for (std::thread &thread : threads_)
+		thread.join();
+	threads_.clear();
+
+	/*
+	 * Complete the jobs decoded by the worker threads, and cancel the
+	 * ones they haven't started yet. The workers pick the jobs in order,
+	 * so all the decoded jobs come first.
+	 */
+	std::deque<Job> jobs = std::move(jobs_);
+	jobs_.clear();
+
+	for (Job &job : jobs) {
+		if (job.state != Job::Done)
+			job.status = FrameMetadata::FrameCancelled;
+		completeJob(job);
+	}
+}
+
+int MJPEGSoftwareDecoder::queueBuffers(FrameBuffer *input, FrameBuffer *output)
+{
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		jobs_.push_back({ input, output, Job::Queued,
+				  FrameMetadata::FrameError });
+	}
+	cv_.notify_one();
+
+	return 0;
+}
+
+void MJPEGSoftwareDecoder::run()
+{
+	struct jpeg_decompress_struct cinfo;
+	JpegErrorManager err;
+
+	cinfo.err = jpeg_std_error(&err.pub);
+	err.pub.error_exit = jpegErrorExit;
+	err.pub.output_message = jpegOutputMessage;
+	err.pub.emit_message = jpegEmitMessage;
+	jpeg_create_decompress(&cinfo);
+
+	auto nextJob = [this]() {
+		return std::find_if(jobs_.begin(), jobs_.end(), [](const Job &job) {
+			return job.state == Job::Queued;
+		});
+	};
+
+	std::unique_lock<std::mutex> locker(lock_);
+
+	while (true) {
+		cv_.wait(locker, [&] { return !running_ || nextJob() != jobs_.end(); });
+		if (!running_)
+			break;
+
+		/*
+		 * The deque doesn't invalidate references when adding and
+		 * removing elements at its ends, the job can be accessed
+		 * without the lock.
+		 */
+		Job &job = *nextJob();
+		job.state = Job::Decoding;
+		locker.unlock();
+
+		bool success = decode(job, &cinfo);
+
+		locker.lock();
+		job.status = success ? FrameMetadata::FrameSuccess
+				     : FrameMetadata::FrameError;
+		job.state = Job::Done;
+
+		/* Signal completion from the thread the decoder lives in. */
+		if (&job == &jobs_.front())
+			invokeMethod(&MJPEGSoftwareDecoder::jobDone,
+				     ConnectionTypeQueued);
+	}
+
+	locker.unlock();
+
+	jpeg_destroy_decompress(&cinfo);
+}
+
+bool MJPEGSoftwareDecoder::decode(Job &job, struct jpeg_decompress_struct *cinfo) const
+{
+	const FrameMetadata &inputMetadata = job.input->metadata();
+	FrameMetadata &metadata = job.output->_d()->metadata();
+	metadata.sequence = inputMetadata.sequence;
+	metadata.timestamp = inputMetadata.timestamp;
+
+	MappedFrameBuffer in(job.input, MappedFrameBuffer::MapFlag::Read);
+	MappedFrameBuffer out(job.output, MappedFrameBuffer::MapFlag::Write);
+	if (!in.isValid() || !out.isValid() ||
+	    out.planes()[0].size() < frameSize_) {
+		LOG(UVC, Error) << "Failed to map decoder buffers";
+		return false;
+	}
+
+	size_t size = std::min<size_t>(inputMetadata.planes()[0].bytesused,
+				       in.planes()[0].size());
+
+	if (!decodeFrame(cinfo, in.planes()[0].data(), size,
+			 out.planes()[0].data(), pixelFormat_, size_, stride_)) {
+		LOG(UVC, Debug)
+			<< "Failed to decode frame " << inputMetadata.sequence;
+		return false;
+	}
+
+	metadata.planes()[0].bytesused = frameSize_;
+
+	return true;
+}
+
+void MJPEGSoftwareDecoder::jobDone()
+{
+	/* Complete the decoded jobs at the front of the queue, in order. */
+	while (true) {
+		Job job;
+
+		{
+			std::lock_guard<std::mutex> locker(lock_);
+			if (jobs_.empty() || jobs_.front().state != Job::Done)
+				break;
+
+			job = jobs_.front();
+			jobs_.pop_front();
+		}
+
+		completeJob(job);
+	}
+}
+
+void MJPEGSoftwareDecoder::completeJob(Job &job)
+{
+	job.output->_d()->metadata().status = job.status;
+	outputBufferReady.emit(job.output);
+	inputBufferReady.emit(job.input);
+}
+
+} /* namespace libcamera */
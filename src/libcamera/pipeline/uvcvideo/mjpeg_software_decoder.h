@@ -0,0 +1,95 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * mjpeg_software_decoder.h - CPU-based MJPEG decoder for the uvcvideo pipeline
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <libcamera/base/object.h>
+
+#include <libcamera/framebuffer.h>
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "mjpeg_decoder.h"
+
+struct jpeg_decompress_struct;
+
+namespace libcamera {
+
+class MJPEGSoftwareDecoder : public MJPEGDecoder, public Object
+{
+public:
+	MJPEGSoftwareDecoder();
+	~MJPEGSoftwareDecoder();
+
+	const char *name() const override { return "software"; }
+
+	unsigned int queueDepth() const override { return threadCount_; }
+
+	std::vector<PixelFormat> formats() override;
+
+	std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size) override;
+
+	int configure(const PixelFormat &pixelFormat, const Size &size,
+		      unsigned int bufferCount) override;
+	int exportBuffers(unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+
+	int start() override;
+	void stop() override;
+
+	int queueBuffers(FrameBuffer *input, FrameBuffer *output) override;
+
+private:
+	static constexpr unsigned int kMaxThreads = 4;
+
+	struct Job {
+		enum State {
+			Queued,
+			Decoding,
+			Done,
+		};
+
+		FrameBuffer *input;
+		FrameBuffer *output;
+		State state;
+		FrameMetadata::Status status;
+	};
+
+	void run();
+	bool decode(Job &job, struct jpeg_decompress_struct *cinfo) const;
+
+	void jobDone();
+	void completeJob(Job &job);
+
+	PixelFormat pixelFormat_;
+	Size size_;
+	unsigned int stride_;
+	unsigned int frameSize_;
+	unsigned int threadCount_;
+
+	/*
+	 * Frames are decoded by a pool of worker threads, one frame per
+	 * thread, and completed in the order they have been queued. The jobs
+	 * are kept in the queue until they are completed.
+	 */
+	std::vector<std::thread> threads_;
+	std::mutex lock_;
+	std::condition_variable cv_;
+	std::deque<Job> jobs_;
+	bool running_;
+};
+
+} /* namespace libcamera */
@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * usb_bandwidth.cpp - USB isochronous bandwidth accounting for UVC cameras
+ */
+
+#include "usb_bandwidth.h"
+
+#include <algorithm>
+
+#include <libcamera/formats.h>
+
+#include "libcamera/internal/formats.h"
+
+namespace libcamera {
+
+using namespace std::literals::chrono_literals;
+
+namespace {
+
+/*
+ * Maximum isochronous bandwidth of a single endpoint, and of all periodic
+ * transfers on a bus, in bytes per second. The per-endpoint limits are the
+ * largest wMaxPacketSize allowed by the USB specifications, and the bus limits
+ * account for the share of each (micro)frame reserved for periodic transfers.
+ */
+struct SpeedLimits {
+	unsigned int speed;
+	uint64_t endpoint;
+	uint64_t bus;
+};
+
+constexpr SpeedLimits kSpeedLimits[] = {
+	/* Full speed: 1023 bytes per 1ms frame, 90% of 12Mbps. */
+	{ 12, 1023 * 1000, 1350000 },
+	/* High speed: 3 * 1024 bytes per 125µs microframe, 80% of 480Mbps. */
+	{ 480, 3 * 1024 * 8000, 48000000 },
+	/* SuperSpeed: 48 * 1024 bytes per 125µs bus interval, 90% of 5Gbps. */
+	{ 5000, 48 * 1024 * 8000, 562500000 },
+};
+
+/*
+ * MJPEG frame sizes depend on the scene content and on the camera's encoder.
+ * Estimate them with a typical compression ratio relative to a 16bpp YUV 4:2:2
+ * frame, which is what UVC cameras encode from.
+ */
+constexpr unsigned int kMJPEGCompressionRatio = 8;
+
+/* Each UVC payload carries a header of up to 12 bytes. */
+constexpr unsigned int kPayloadHeaderSize = 12;
+
+const SpeedLimits &speedLimits(unsigned int speed)
+{
+	for (const SpeedLimits &limits : kSpeedLimits) {
+		if (speed <= limits.speed)
+			return limits;
+	}
+
+	return kSpeedLimits[std::size(kSpeedLimits) - 1];
+}
+
+} /* namespace */
+
+/**
+ * \class USBBandwidth
+ * \brief Book-keeping of the isochronous bandwidth used by UVC cameras
+ *
+ * All UVC cameras connected to the same USB bus share its periodic
+ * bandwidth. Cameras reserve bandwidth with the USBBandwidth instance when
+ * they are configured, and release it when they are released. The bandwidth
+ * is handed out on a first-come, first-served basis: configurations are
+ * validated against the bandwidth left by the cameras configured before them.
+ *
+ * The bandwidth figures are estimates only. The kernel and the camera
+ * firmware pick the actual alternate setting when streaming starts, based
+ * on the camera's own bandwidth requirements.
+ */
+
+/**
+ * \brief Retrieve the process-wide USBBandwidth instance
+ * \return The USBBandwidth instance
+ */
+USBBandwidth &USBBandwidth::instance()
+{
+	static USBBandwidth bandwidth;
+	return bandwidth;
+}
+
+/**
+ * \brief Estimate the bandwidth required to capture a stream
+ * \param[in] pixelFormat The pixel format produced by the camera
+ * \param[in] size The frame size
+ * \param[in] interval The frame interval, or 0 if unknown
+ *
+ * When the frame interval is unknown, a frame rate of 30fps is assumed.
+ *
+ * \return The estimated bandwidth in bytes per second
+ */
+uint64_t USBBandwidth::estimate(const PixelFormat &pixelFormat, const Size &size,
+				utils::Duration interval)
+{
+	uint64_t frameSize;
+
+	if (pixelFormat == formats::MJPEG) {
+		frameSize = static_cast<uint64_t>(size.width) * size.height * 2
+			  / kMJPEGCompressionRatio;
+	} else {
+		const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat);
+		frameSize = info.isValid() ? info.frameSize(size)
+			  : static_cast<uint64_t>(size.width) * size.height * 2;
+	}
+
+	double fps = interval > 0s ? 1.0 / interval.get<std::ratio<1>>()
+		   : 30.0;
+
+	/* Account for one payload header per kilobyte of data. */
+	frameSize += frameSize / 1024 * kPayloadHeaderSize;
+
+	return static_cast<uint64_t>(frameSize * fps);
+}
+
+/**
+ * \brief Retrieve the bandwidth available to a camera
+ * \param[in] bus The USB bus number the camera is connected to
+ * \param[in] speed The USB speed of the camera in Mbps
+ * \param[in] owner The camera, to exclude its own reservation
+ *
+ * \return The bandwidth in bytes per second the camera can use, limited by
+ * both the maximum isochronous endpoint bandwidth and the bus bandwidth not
+ * reserved by other cameras
+ */
+uint64_t USBBandwidth::available(unsigned int bus, unsigned int speed,
+				 const void *owner)
+{
+	const SpeedLimits &limits = speedLimits(speed);
+
+	MutexLocker locker(mutex_);
+
+	uint64_t reserved = 0;
+	for (const auto &[other, reservation] : reservations_) {
+		if (other != owner && reservation.bus == bus)
+			reserved += reservation.bandwidth;
+	}
+
+	uint64_t busAvailable = reserved < limits.bus ? limits.bus - reserved : 0;
+
+	return std::min(limits.endpoint, busAvailable);
+}
+
+/**
+ * \brief Reserve bandwidth for a camera
+ * \param[in] bus The USB bus number the camera is connected to
+ * \param[in] owner The camera reserving the bandwidth
+ * \param[in] bandwidth The bandwidth in bytes per second
+ *
+ * Any previous reservation by \a owner is replaced.
+ */
+void USBBandwidth::reserve(unsigned int bus, const void *owner, uint64_t bandwidth)
+{
+	MutexLocker locker(mutex_);
+
+	reservations_[owner] = { bus, bandwidth };
+}
+
+/**
+ * \brief Release the bandwidth reserved by a camera
+ * \param[in] owner The camera that reserved the bandwidth
+ */
+void USBBandwidth::release(const void *owner)
+{
+	MutexLocker locker(mutex_);
+
+	reservations_.erase(owner);
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * usb_bandwidth.h - USB isochronous bandwidth accounting for UVC cameras
+ */
+
+#pragma once
+
+#include <map>
+#include <stdint.h>
+
+#include <libcamera/base/thread.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+namespace libcamera {
+
+class USBBandwidth
+{
+public:
+	static USBBandwidth &instance();
+
+	static uint64_t estimate(const PixelFormat &pixelFormat, const Size &size,
+				 utils::Duration interval);
+
+	uint64_t available(unsigned int bus, unsigned int speed,
+			   const void *owner);
+	void reserve(unsigned int bus, const void *owner, uint64_t bandwidth);
+	void release(const void *owner);
+
+private:
+	struct Reservation {
+		unsigned int bus;
+		uint64_t bandwidth;
+	};
+
+	USBBandwidth() = default;
+
+	Mutex mutex_;
+	std::map<const void *, Reservation> reservations_;
+};
+
+} /* namespace libcamera */
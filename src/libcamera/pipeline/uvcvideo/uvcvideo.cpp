@@ -10,7 +10,9 @@
 #include <iomanip>
 #include <math.h>
 #include <memory>
+#include <queue>
 #include <tuple>
+#include <unordered_map>
 
 #include <libcamera/base/log.h>
 #include <libcamera/base/utils.h>
@@ -18,6 +20,7 @@
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
+#include <libcamera/formats.h>
 #include <libcamera/property_ids.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
@@ -26,28 +29,75 @@
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/software_statistics.h"
 #include "libcamera/internal/sysfs.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
+#include "mjpeg_decoder.h"
+#include "usb_bandwidth.h"
+
 namespace libcamera {
 
 LOG_DEFINE_CATEGORY(UVC)
 
+using namespace std::literals::chrono_literals;
+
 class UVCCameraData : public Camera::Private
 {
 public:
 	UVCCameraData(PipelineHandler *pipe)
-		: Camera::Private(pipe)
+		: Camera::Private(pipe), usbBus_(0), usbSpeed_(0),
+		  useDecoder_(false), useStats_(false)
+	{
+	}
+
+	~UVCCameraData()
 	{
+		USBBandwidth::instance().release(this);
 	}
 
 	int init(MediaDevice *media);
 	void addControl(uint32_t cid, const ControlInfo &v4l2info,
 			ControlInfoMap::Map *ctrls);
+	bool needsDecoding(const PixelFormat &pixelFormat, const Size &size) const;
+	bool canDecode(const PixelFormat &pixelFormat, const Size &size) const;
+	bool selectFrameInterval(const PixelFormat &captureFormat, const Size &size,
+				 uint64_t available, utils::Duration *interval,
+				 uint64_t *bandwidth) const;
 	void bufferReady(FrameBuffer *buffer);
+	void completeBuffer(FrameBuffer *buffer);
 
 	std::unique_ptr<V4L2VideoDevice> video_;
 	Stream stream_;
+	std::map<PixelFormat, std::vector<SizeRange>> nativeFormats_;
+	std::map<PixelFormat, std::vector<SizeRange>> formats_;
+	StreamFormats nativeStreamFormats_;
+	StreamFormats streamFormats_;
+	std::map<std::pair<PixelFormat, Size>, std::vector<utils::Duration>> frameIntervals_;
+
+	unsigned int usbBus_;
+	unsigned int usbSpeed_;
+
+	std::unique_ptr<MJPEGDecoder> decoder_;
+	std::vector<std::unique_ptr<FrameBuffer>> decoderBuffers_;
+	std::queue<FrameBuffer *> decoderQueue_;
+	bool useDecoder_;
+
+	/*
+	 * The statistics grid selected by the last StatsGrid control, and the
+	 * grid of the queued requests that have statistics enabled.
+	 */
+	std::unique_ptr<SoftwareStatistics> stats_;
+	std::unordered_map<Request *, Size> statsGrids_;
+	Size statsGrid_;
+	bool useStats_;
+
+private:
+	void initUSB();
+	void initDecoder();
+	void decoderInputDone(FrameBuffer *buffer);
+	void decoderOutputDone(FrameBuffer *buffer);
+	void statisticsReady(FrameBuffer *buffer, const ControlList &stats);
 };
 
 class UVCCameraConfiguration : public CameraConfiguration
@@ -57,7 +107,15 @@ public:
 
 	Status validate() override;
 
+	/* Cache the parameters computed by validate() for configure(). */
+	bool decode_;
+	utils::Duration frameInterval_;
+	uint64_t bandwidth_;
+
 private:
+	bool selectMode(const PixelFormat &pixelFormat, const Size &size,
+			uint64_t available);
+
 	UVCCameraData *data_;
 };
 
@@ -80,7 +138,15 @@ public:
 
 	bool match(DeviceEnumerator *enumerator) override;
 
+	void releaseDevice(Camera *camera) override;
+
 private:
+	/*
+	 * Number of internal MJPEG buffers kept for capture when decoding, in
+	 * addition to the buffers in flight in the decoder.
+	 */
+	static constexpr unsigned int kNumCaptureBuffers = 2;
+
 	std::string generateId(const UVCCameraData *data);
 
 	int processControl(ControlList *controls, unsigned int id,
@@ -94,7 +160,8 @@ private:
 };
 
 UVCCameraConfiguration::UVCCameraConfiguration(UVCCameraData *data)
-	: CameraConfiguration(), data_(data)
+	: CameraConfiguration(), decode_(false), frameInterval_(0s),
+	  bandwidth_(0), data_(data)
 {
 }
 
@@ -150,20 +217,127 @@ CameraConfiguration::Status UVCCameraConfiguration::validate()
 
 	cfg.bufferCount = 4;
 
+	/*
+	 * All UVC cameras on a USB bus share its isochronous bandwidth. If the
+	 * stream doesn't fit in the bandwidth left by the cameras configured
+	 * before this one at any frame rate, fall back to the largest smaller
+	 * size that fits. If none does, keep the requested size and let the
+	 * device decide, STREAMON will fail if the bandwidth really is
+	 * insufficient.
+	 */
+	uint64_t available = USBBandwidth::instance().available(data_->usbBus_,
+								data_->usbSpeed_,
+								data_);
+	if (!selectMode(cfg.pixelFormat, cfg.size, available)) {
+		bool found = false;
+
+		for (auto it = formatSizes.rbegin(); it != formatSizes.rend(); ++it) {
+			if (!(*it < cfg.size) ||
+			    !selectMode(cfg.pixelFormat, *it, available))
+				continue;
+
+			LOG(UVC, Debug)
+				<< "Adjusting size from " << cfg.size.toString()
+				<< " to " << it->toString()
+				<< " to fit in the USB bandwidth";
+			cfg.size = *it;
+			status = Adjusted;
+			found = true;
+			break;
+		}
+
+		if (!found) {
+			selectMode(cfg.pixelFormat, cfg.size, available);
+			LOG(UVC, Warning)
+				<< "Insufficient USB bandwidth for "
+				<< cfg.toString() << ", " << bandwidth_
+				<< " bytes/s needed, " << available
+				<< " bytes/s available";
+		}
+	}
+
+	/*
+	 * When decoding from MJPEG, the decoder determines the buffer
+	 * layout.
+	 */
 	V4L2DeviceFormat format;
-	format.fourcc = V4L2PixelFormat::fromPixelFormat(cfg.pixelFormat);
+	format.fourcc = decode_ ? V4L2PixelFormat::fromPixelFormat(formats::MJPEG)
+				: V4L2PixelFormat::fromPixelFormat(cfg.pixelFormat);
 	format.size = cfg.size;
+	if (!decode_)
+		format.applyConstraints(cfg);
 
 	int ret = data_->video_->tryFormat(&format);
 	if (ret)
 		return Invalid;
 
-	cfg.stride = format.planes[0].bpl;
-	cfg.frameSize = format.planes[0].size;
+	if (decode_) {
+		std::tie(cfg.stride, cfg.frameSize) =
+			data_->decoder_->strideAndFrameSize(cfg.pixelFormat,
+							    cfg.size);
+		if (!cfg.frameSize)
+			return Invalid;
+
+		if (resetBufferConstraints(&cfg))
+			status = Adjusted;
+	} else {
+		if (format.adjustConstraints(&cfg))
+			status = Adjusted;
+
+		cfg.stride = format.planes[0].bpl;
+		cfg.frameSize = format.planes[0].size;
+	}
 
 	return status;
 }
 
+/*
+ * Select how to capture \a pixelFormat at \a size, at the fastest frame rate
+ * that fits in the \a available bandwidth. Formats not produced natively by
+ * the device are decoded from MJPEG. Uncompressed formats are also decoded
+ * from MJPEG when this allows a faster frame rate than the bandwidth permits
+ * for the uncompressed format.
+ *
+ * Return true if the stream fits in the available bandwidth, or false
+ * otherwise, in which case the slowest frame rate is selected.
+ */
+bool UVCCameraConfiguration::selectMode(const PixelFormat &pixelFormat,
+					const Size &size, uint64_t available)
+{
+	decode_ = data_->needsDecoding(pixelFormat, size);
+	PixelFormat captureFormat = decode_ ? formats::MJPEG : pixelFormat;
+
+	bool fits = data_->selectFrameInterval(captureFormat, size, available,
+					       &frameInterval_, &bandwidth_);
+	if (decode_ || !data_->canDecode(pixelFormat, size))
+		return fits;
+
+	/* Don't decode if the bandwidth doesn't limit the frame rate. */
+	auto it = data_->frameIntervals_.find({ captureFormat, size });
+	if (fits && (it == data_->frameIntervals_.end() ||
+		     it->second.empty() || frameInterval_ == it->second.front()))
+		return true;
+
+	utils::Duration interval;
+	uint64_t bandwidth;
+	if (!data_->selectFrameInterval(formats::MJPEG, size, available,
+					&interval, &bandwidth))
+		return fits;
+
+	if (fits && interval >= frameInterval_)
+		return true;
+
+	LOG(UVC, Debug)
+		<< "Decoding " << pixelFormat.toString() << " from MJPEG at "
+		<< size.toString() << " to fit in the USB bandwidth";
+
+	decode_ = true;
+	frameInterval_ = interval;
+	bandwidth_ = bandwidth;
+
+	return true;
+}
+
 PipelineHandlerUVC::PipelineHandlerUVC(CameraManager *manager)
 	: PipelineHandler(manager)
 {
@@ -178,19 +352,15 @@ CameraConfiguration *PipelineHandlerUVC::generateConfiguration(Camera *camera,
 	if (roles.empty())
 		return config;
 
-	V4L2VideoDevice::Formats v4l2Formats = data->video_->formats();
-	std::map<PixelFormat, std::vector<SizeRange>> deviceFormats;
-	for (const auto &format : v4l2Formats) {
-		PixelFormat pixelFormat = format.first.toPixelFormat();
-		if (pixelFormat.isValid())
-			deviceFormats[pixelFormat] = format.second;
-	}
-
-	StreamFormats formats(deviceFormats);
-	StreamConfiguration cfg(formats);
+	StreamConfiguration cfg(data->streamFormats_);
 
-	cfg.pixelFormat = formats.pixelformats().front();
-	cfg.size = formats.sizes(cfg.pixelFormat).back();
+	/*
+	 * Default to the formats produced by the device, decoding MJPEG costs
+	 * more than letting the application pick a decoded format explicitly.
+	 */
+	const StreamFormats &nativeFormats = data->nativeStreamFormats_;
+	cfg.pixelFormat = nativeFormats.pixelformats().front();
+	cfg.size = nativeFormats.sizes(cfg.pixelFormat).back();
 	cfg.bufferCount = 4;
 
 	config->addConfiguration(cfg);
@@ -203,21 +373,65 @@ CameraConfiguration *PipelineHandlerUVC::generateConfiguration(Camera *camera,
 int PipelineHandlerUVC::configure(Camera *camera, CameraConfiguration *config)
 {
 	UVCCameraData *data = cameraData(camera);
+	UVCCameraConfiguration *uvcConfig = static_cast<UVCCameraConfiguration *>(config);
 	StreamConfiguration &cfg = config->at(0);
 	int ret;
 
+	bool decode = uvcConfig->decode_;
+	V4L2PixelFormat fourcc = decode
+			       ? V4L2PixelFormat::fromPixelFormat(formats::MJPEG)
+			       : V4L2PixelFormat::fromPixelFormat(cfg.pixelFormat);
+
 	V4L2DeviceFormat format;
-	format.fourcc = V4L2PixelFormat::fromPixelFormat(cfg.pixelFormat);
+	format.fourcc = fourcc;
 	format.size = cfg.size;
+	if (!decode)
+		format.applyConstraints(cfg);
 
 	ret = data->video_->setFormat(&format);
 	if (ret)
 		return ret;
 
-	if (format.size != cfg.size ||
-	    format.fourcc != V4L2PixelFormat::fromPixelFormat(cfg.pixelFormat))
+	if (format.size != cfg.size || format.fourcc != fourcc)
 		return -EINVAL;
 
+	if (uvcConfig->frameInterval_ > 0s) {
+		utils::Duration interval = uvcConfig->frameInterval_;
+		ret = data->video_->setFrameInterval(&interval);
+		if (ret < 0 && ret != -ENOTSUP)
+			return ret;
+
+		if (!ret)
+			LOG(UVC, Debug)
+				<< "Frame interval set to "
+				<< interval.get<std::micro>() << "us";
+	}
+
+	/*
+	 * Reserve the bandwidth estimated by validate(), the cameras
+	 * configured later will be validated against the remaining bandwidth.
+	 */
+	USBBandwidth::instance().reserve(data->usbBus_, data,
+					 uvcConfig->bandwidth_);
+
+	if (decode) {
+		ret = data->decoder_->configure(cfg.pixelFormat, cfg.size,
+						cfg.bufferCount);
+		if (ret)
+			return ret;
+
+		LOG(UVC, Debug)
+			<< "Decoding MJPEG to " << cfg.pixelFormat.toString()
+			<< " with the " << data->decoder_->name() << " decoder";
+	}
+
+	data->useDecoder_ = decode;
+
+	/* Compute statistics on the CPU when they are enabled by requests. */
+	data->useStats_ = SoftwareStatistics::isSupported(cfg.pixelFormat) &&
+			  !data->stats_->configure(cfg.pixelFormat, cfg.size,
+						   cfg.stride);
+
 	cfg.setStream(&data->stream_);
 
 	return 0;
@@ -229,32 +443,84 @@ int PipelineHandlerUVC::exportFrameBuffers(Camera *camera, Stream *stream,
 	UVCCameraData *data = cameraData(camera);
 	unsigned int count = stream->configuration().bufferCount;
 
+	if (data->useDecoder_)
+		return data->decoder_->exportBuffers(count, buffers);
+
 	return data->video_->exportBuffers(count, buffers);
 }
 
-int PipelineHandlerUVC::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+int PipelineHandlerUVC::start(Camera *camera, const ControlList *controls)
 {
 	UVCCameraData *data = cameraData(camera);
 	unsigned int count = data->stream_.configuration().bufferCount;
+	int ret;
+
+	data->statsGrid_ = {};
+	if (controls && controls->contains(controls::draft::StatsGrid))
+		data->statsGrid_ = controls->get(controls::draft::StatsGrid);
 
-	int ret = data->video_->importBuffers(count);
+	if (data->useStats_)
+		data->stats_->start();
+
+	/*
+	 * When decoding, capture to a fixed number of internal MJPEG buffers,
+	 * otherwise directly to the buffers of the requests.
+	 */
+	if (data->useDecoder_)
+		ret = data->video_->allocateBuffers(kNumCaptureBuffers +
+						    data->decoder_->queueDepth(),
+						    &data->decoderBuffers_);
+	else
+		ret = data->video_->importBuffers(count);
 	if (ret < 0)
 		return ret;
 
 	ret = data->video_->streamOn();
 	if (ret < 0) {
 		data->video_->releaseBuffers();
+		data->decoderBuffers_.clear();
 		return ret;
 	}
 
+	if (data->useDecoder_) {
+		ret = data->decoder_->start();
+		if (ret < 0) {
+			stop(camera);
+			return ret;
+		}
+
+		for (std::unique_ptr<FrameBuffer> &buffer : data->decoderBuffers_)
+			data->video_->queueBuffer(buffer.get());
+	}
+
 	return 0;
 }
 
 void PipelineHandlerUVC::stop(Camera *camera)
 {
 	UVCCameraData *data = cameraData(camera);
+
+	/*
+	 * Complete the requests in the order they have been queued, first the
+	 * ones in the decoder, then the ones still waiting for a frame.
+	 */
+	if (data->useDecoder_)
+		data->decoder_->stop();
+
 	data->video_->streamOff();
 	data->video_->releaseBuffers();
+	data->decoderBuffers_.clear();
+
+	data->stats_->stop();
+	data->statsGrids_.clear();
+
+	while (!data->decoderQueue_.empty()) {
+		FrameBuffer *buffer = data->decoderQueue_.front();
+		data->decoderQueue_.pop();
+
+		buffer->cancel();
+		data->completeBuffer(buffer);
+	}
 }
 
 int PipelineHandlerUVC::processControl(ControlList *controls, unsigned int id,
@@ -378,6 +644,20 @@ int PipelineHandlerUVC::queueRequestDevice(Camera *camera, Request *request)
 	if (ret < 0)
 		return ret;
 
+	if (request->controls().contains(controls::draft::StatsGrid))
+		data->statsGrid_ = request->controls().get(controls::draft::StatsGrid);
+	if (data->useStats_ && !data->statsGrid_.isNull())
+		data->statsGrids_[request] = data->statsGrid_;
+
+	/*
+	 * When decoding, the buffer is handed to the decoder with the next
+	 * captured frame.
+	 */
+	if (data->useDecoder_) {
+		data->decoderQueue_.push(buffer);
+		return 0;
+	}
+
 	ret = data->video_->queueBuffer(buffer);
 	if (ret < 0)
 		return ret;
@@ -385,6 +665,11 @@ int PipelineHandlerUVC::queueRequestDevice(Camera *camera, Request *request)
 	return 0;
 }
 
+void PipelineHandlerUVC::releaseDevice(Camera *camera)
+{
+	USBBandwidth::instance().release(cameraData(camera));
+}
+
 std::string PipelineHandlerUVC::generateId(const UVCCameraData *data)
 {
 	const std::string path = data->video_->devicePath();
@@ -511,7 +796,9 @@ int UVCCameraData::init(MediaDevice *media)
 	properties_.set(properties::Model, utils::toAscii(media->model()));
 
 	/*
-	 * Get the current format in order to initialize the sensor array
+	 * Enumerate the formats once, the frame sizes enumeration takes a
+	 * noticeable time on some cameras and the formats of a UVC device
+	 * never change. Use the largest size to initialize the sensor array
 	 * properties.
 	 */
 	Size resolution;
@@ -521,8 +808,22 @@ int UVCCameraData::init(MediaDevice *media)
 			if (sizeRange.max > resolution)
 				resolution = sizeRange.max;
 		}
+
+		PixelFormat pixelFormat = it.first.toPixelFormat();
+		if (pixelFormat.isValid())
+			nativeFormats_[pixelFormat] = sizeRanges;
 	}
 
+	formats_ = nativeFormats_;
+	if (formats_.count(formats::MJPEG))
+		initDecoder();
+
+	/* The formats are static, share them with all generated configurations. */
+	nativeStreamFormats_ = StreamFormats(nativeFormats_);
+	streamFormats_ = StreamFormats(formats_);
+
+	initUSB();
+
 	properties_.set(properties::PixelArraySize, resolution);
 	properties_.set(properties::PixelArrayActiveAreas, { Rectangle(resolution) });
 
@@ -536,6 +837,14 @@ int UVCCameraData::init(MediaDevice *media)
 		addControl(cid, info, &ctrls);
 	}
 
+	stats_ = std::make_unique<SoftwareStatistics>();
+	stats_->statisticsReady.connect(this, &UVCCameraData::statisticsReady);
+
+	ctrls.emplace(std::piecewise_construct,
+		      std::forward_as_tuple(&controls::draft::StatsGrid),
+		      std::forward_as_tuple(Size{}, SoftwareStatistics::kMaxGrid,
+					    Size{}));
+
 	controlInfo_ = ControlInfoMap(std::move(ctrls), controls::controls);
 
 	return 0;
@@ -659,15 +968,232 @@ void UVCCameraData::addControl(uint32_t cid, const ControlInfo &v4l2Info,
 	ctrls->emplace(id, info);
 }
 
+void UVCCameraData::initUSB()
+{
+	/*
+	 * The video device path points to the USB interface, the bus number
+	 * and speed are attributes of the USB device.
+	 */
+	const std::string path = video_->devicePath() + "/../";
+
+	for (auto [name, value] : { std::pair{ "busnum", &usbBus_ },
+				    std::pair{ "speed", &usbSpeed_ } }) {
+		std::ifstream file(path + name);
+		if (file.is_open())
+			file >> *value;
+	}
+
+	/*
+	 * Enumerate the frame intervals of the discrete native sizes, used to
+	 * estimate the bandwidth of the streams. The frame intervals of
+	 * uncompressed formats are typically limited by the bandwidth of the
+	 * USB link.
+	 */
+	for (const auto &[pixelFormat, sizes] : nativeFormats_) {
+		V4L2PixelFormat fourcc = V4L2PixelFormat::fromPixelFormat(pixelFormat);
+
+		for (const SizeRange &range : sizes) {
+			if (range.min != range.max)
+				continue;
+
+			std::vector<utils::Duration> intervals =
+				video_->frameIntervals(fourcc, range.min);
+			if (!intervals.empty())
+				frameIntervals_[{ pixelFormat, range.min }] =
+					std::move(intervals);
+		}
+	}
+
+	LOG(UVC, Debug)
+		<< "USB bus " << usbBus_ << ", speed " << usbSpeed_ << "Mbps";
+}
+
+void UVCCameraData::initDecoder()
+{
+	decoder_ = MJPEGDecoder::create();
+	if (!decoder_)
+		return;
+
+	decoder_->inputBufferReady.connect(this, &UVCCameraData::decoderInputDone);
+	decoder_->outputBufferReady.connect(this, &UVCCameraData::decoderOutputDone);
+
+	/*
+	 * Expose the decoded formats at all the MJPEG sizes, in addition to
+	 * the sizes at which the device produces them natively. Only
+	 * discrete sizes can be merged, which is all UVC devices report in
+	 * practice.
+	 */
+	const std::vector<SizeRange> &mjpegSizes = formats_[formats::MJPEG];
+
+	for (const PixelFormat &pixelFormat : decoder_->formats()) {
+		std::vector<SizeRange> &sizes = formats_[pixelFormat];
+		if (std::any_of(sizes.begin(), sizes.end(),
+				[](const SizeRange &range) { return range.min != range.max; }))
+			continue;
+
+		for (const SizeRange &range : mjpegSizes) {
+			if (range.min != range.max ||
+			    std::find(sizes.begin(), sizes.end(), range) != sizes.end())
+				continue;
+
+			unsigned int frameSize;
+			std::tie(std::ignore, frameSize) =
+				decoder_->strideAndFrameSize(pixelFormat, range.min);
+			if (frameSize)
+				sizes.push_back(range);
+		}
+
+		if (sizes.empty())
+			formats_.erase(pixelFormat);
+	}
+
+	LOG(UVC, Debug)
+		<< "Decoding MJPEG with the " << decoder_->name() << " decoder";
+}
+
+bool UVCCameraData::needsDecoding(const PixelFormat &pixelFormat,
+				  const Size &size) const
+{
+	if (!decoder_ || pixelFormat == formats::MJPEG)
+		return false;
+
+	auto it = nativeFormats_.find(pixelFormat);
+	if (it == nativeFormats_.end())
+		return true;
+
+	return std::none_of(it->second.begin(), it->second.end(),
+			    [&](const SizeRange &range) { return range.contains(size); });
+}
+
+bool UVCCameraData::canDecode(const PixelFormat &pixelFormat,
+			      const Size &size) const
+{
+	if (!decoder_ || pixelFormat == formats::MJPEG)
+		return false;
+
+	auto it = nativeFormats_.find(formats::MJPEG);
+	if (it == nativeFormats_.end() ||
+	    std::none_of(it->second.begin(), it->second.end(),
+			 [&](const SizeRange &range) { return range.contains(size); }))
+		return false;
+
+	unsigned int frameSize;
+	std::tie(std::ignore, frameSize) =
+		decoder_->strideAndFrameSize(pixelFormat, size);
+
+	return frameSize != 0;
+}
+
+bool UVCCameraData::selectFrameInterval(const PixelFormat &captureFormat,
+					const Size &size, uint64_t available,
+					utils::Duration *interval,
+					uint64_t *bandwidth) const
+{
+	/*
+	 * Pick the shortest frame interval that fits in the bandwidth, or the
+	 * longest one if none does. When the frame intervals are unknown,
+	 * leave the interval unset and assume the default frame rate.
+	 */
+	auto it = frameIntervals_.find({ captureFormat, size });
+	if (it == frameIntervals_.end() || it->second.empty()) {
+		*interval = 0s;
+		*bandwidth = USBBandwidth::estimate(captureFormat, size, *interval);
+		return *bandwidth <= available;
+	}
+
+	for (const utils::Duration &frameInterval : it->second) {
+		*interval = frameInterval;
+		*bandwidth = USBBandwidth::estimate(captureFormat, size, *interval);
+		if (*bandwidth <= available)
+			return true;
+	}
+
+	return false;
+}
+
 void UVCCameraData::bufferReady(FrameBuffer *buffer)
 {
+	if (useDecoder_) {
+		/*
+		 * The buffer is an internal MJPEG buffer, hand it to the
+		 * decoder with the buffer of the oldest request, or requeue
+		 * it right away if there's no request or the capture failed.
+		 */
+		FrameMetadata::Status status = buffer->metadata().status;
+		if (status == FrameMetadata::FrameCancelled)
+			return;
+
+		if (decoderQueue_.empty()) {
+			video_->queueBuffer(buffer);
+			return;
+		}
+
+		FrameBuffer *output = decoderQueue_.front();
+		decoderQueue_.pop();
+
+		Request *request = output->request();
+		request->metadata().set(controls::SensorTimestamp,
+					buffer->metadata().timestamp);
+
+		if (status == FrameMetadata::FrameSuccess &&
+		    !decoder_->queueBuffers(buffer, output))
+			return;
+
+		video_->queueBuffer(buffer);
+		output->cancel();
+		completeBuffer(output);
+		return;
+	}
+
 	Request *request = buffer->request();
 
 	/* \todo Use the UVC metadata to calculate a more precise timestamp */
 	request->metadata().set(controls::SensorTimestamp,
 				buffer->metadata().timestamp);
 
+	completeBuffer(buffer);
+}
+
+void UVCCameraData::completeBuffer(FrameBuffer *buffer)
+{
+	Request *request = buffer->request();
+
 	pipe()->completeBuffer(request, buffer);
+
+	/*
+	 * Delay the completion of the request until the statistics have been
+	 * computed, if they are enabled. The buffer is only read, there's no
+	 * need to hold it back from the application.
+	 */
+	auto it = statsGrids_.find(request);
+	if (it != statsGrids_.end()) {
+		Size grid = it->second;
+		statsGrids_.erase(it);
+
+		if (buffer->metadata().status == FrameMetadata::FrameSuccess &&
+		    !stats_->queueBuffer(buffer, grid))
+			return;
+	}
+
+	pipe()->completeRequest(request);
+}
+
+void UVCCameraData::decoderInputDone(FrameBuffer *buffer)
+{
+	/* Queue the MJPEG buffer back for capture. */
+	video_->queueBuffer(buffer);
+}
+
+void UVCCameraData::decoderOutputDone(FrameBuffer *buffer)
+{
+	completeBuffer(buffer);
+}
+
+void UVCCameraData::statisticsReady(FrameBuffer *buffer, const ControlList &stats)
+{
+	Request *request = buffer->request();
+
+	request->metadata().merge(stats);
 	pipe()->completeRequest(request);
 }
 
@@ -172,11 +172,15 @@ CameraConfiguration::Status VimcCameraConfiguration::validate()
 	V4L2DeviceFormat format;
 	format.fourcc = V4L2PixelFormat::fromPixelFormat(cfg.pixelFormat);
 	format.size = cfg.size;
+	format.applyConstraints(cfg);
 
 	int ret = data_->video_->tryFormat(&format);
 	if (ret)
 		return Invalid;
 
+	if (format.adjustConstraints(&cfg))
+		status = Adjusted;
+
 	cfg.stride = format.planes[0].bpl;
 	cfg.frameSize = format.planes[0].size;
 
@@ -276,6 +280,7 @@ int PipelineHandlerVimc::configure(Camera *camera, CameraConfiguration *config)
 	V4L2DeviceFormat format;
 	format.fourcc = V4L2PixelFormat::fromPixelFormat(cfg.pixelFormat);
 	format.size = cfg.size;
+	format.applyConstraints(cfg);
 
 	ret = data->video_->setFormat(&format);
 	if (ret)
@@ -7,18 +7,25 @@
 
 #include "libcamera/internal/pipeline_handler.h"
 
+#include <array>
+#include <chrono>
 #include <sys/sysmacros.h>
 
+#include <libcamera/base/global_configuration.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/utils.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/camera_manager.h>
+#include <libcamera/control_ids.h>
 #include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
 
 #include "libcamera/internal/camera.h"
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/framebuffer.h"
 #include "libcamera/internal/media_device.h"
+#include "libcamera/internal/trace_ring.h"
 #include "libcamera/internal/tracepoints.h"
 
 /**
@@ -37,8 +44,20 @@
 
 namespace libcamera {
 
+using namespace std::literals::chrono_literals;
+
 LOG_DEFINE_CATEGORY(Pipeline)
 
+namespace {
+
+uint64_t timestampNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		utils::clock::now().time_since_epoch()).count();
+}
+
+} /* namespace */
+
 /**
  * \class PipelineHandler
  * \brief Create and manage cameras based on a set of media devices
@@ -50,6 +69,17 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * They implement std::enable_shared_from_this<> in order to create new
  * std::shared_ptr<> in code paths originating from member functions of the
  * PipelineHandler class where only the 'this' pointer is available.
+ *
+ * All pipeline handler operations run in the pipeline handler thread, which
+ * is the thread the PipelineHandler instance is bound to. This is the
+ * CameraManager thread by default. When the LIBCAMERA_PIPELINE_THREADS
+ * environment variable is set, each pipeline handler instance runs in a
+ * dedicated thread instead, starting with the call to match(). The objects
+ * created by the pipeline handler, such as the video devices, their event
+ * notifiers and the cameras, are then bound to that thread, so that the
+ * processing for different cameras can run concurrently. The match() function
+ * of different pipeline handler types is then called concurrently, pipeline
+ * handlers shall thus not share state between types without locking.
  */
 
 /**
@@ -99,7 +129,7 @@ PipelineHandler::~PipelineHandler()
  * If this function returns true, a new instance of the pipeline handler will
  * be created and its match() function called.
  *
- * \context This function is called from the CameraManager thread.
+ * \context This function is called from the pipeline handler thread.
  *
  * \return true if media devices have been acquired and camera instances
  * created, or false otherwise
@@ -117,23 +147,30 @@ PipelineHandler::~PipelineHandler()
  * device explicitly, it will be automatically released when the pipeline
  * handler is destroyed.
  *
- * \context This function shall be called from the CameraManager thread.
+ * \context This function shall be called from the pipeline handler thread.
  *
  * \return A pointer to the matching MediaDevice, or nullptr if no match is found
  */
 MediaDevice *PipelineHandler::acquireMediaDevice(DeviceEnumerator *enumerator,
 						 const DeviceMatch &dm)
 {
-	std::shared_ptr<MediaDevice> media = enumerator->search(dm);
-	if (!media)
-		return nullptr;
+	std::shared_ptr<MediaDevice> media;
 
-	if (!media->acquire())
-		return nullptr;
+	/*
+	 * Pipeline handlers may be matched concurrently. If another pipeline
+	 * handler acquires the media device first, search for the next one.
+	 */
+	while ((media = enumerator->search(dm))) {
+		if (media->acquire()) {
+			mediaDevices_.push_back(media);
+			return media.get();
+		}
 
-	mediaDevices_.push_back(media);
+		if (!media->busy())
+			return nullptr;
+	}
 
-	return media.get();
+	return nullptr;
 }
 
 /**
@@ -142,6 +179,14 @@ MediaDevice *PipelineHandler::acquireMediaDevice(DeviceEnumerator *enumerator,
  * This function shall not be called from pipeline handler implementation, as
  * the Camera class handles locking directly.
  *
+ * As all media devices are locked, only one camera of a pipeline handler can
+ * be used at a time, and cameras never compete for a shared ISP.
+ *
+ * \todo Lock media devices per camera to allow cameras sharing an ISP to
+ * stream concurrently. This will require arbitrating ISP jobs between the
+ * cameras, based on their frame durations, to avoid one camera starving the
+ * other one.
+ *
  * \context This function is \threadsafe.
  *
  * \return True if the devices could be locked, false otherwise
@@ -220,7 +265,7 @@ void PipelineHandler::unlock()
  * instance to each StreamConfiguration entry in the CameraConfiguration using
  * the StreamConfiguration::setStream() function.
  *
- * \context This function is called from the CameraManager thread.
+ * \context This function is called from the pipeline handler thread.
  *
  * \return 0 on success or a negative error code otherwise
  */
@@ -243,7 +288,7 @@ void PipelineHandler::unlock()
  *
  * The only intended caller is Camera::exportFrameBuffers().
  *
- * \context This function is called from the CameraManager thread.
+ * \context This function is called from the pipeline handler thread.
  *
  * \return The number of allocated buffers on success or a negative error code
  * otherwise
@@ -260,7 +305,7 @@ void PipelineHandler::unlock()
  * which will in turn be called from the application to indicate that it has
  * configured the streams and is ready to capture.
  *
- * \context This function is called from the CameraManager thread.
+ * \context This function is called from the pipeline handler thread.
  *
  * \return 0 on success or a negative error code otherwise
  */
@@ -273,21 +318,38 @@ void PipelineHandler::unlock()
  * This function stops capturing and processing requests immediately. All
  * pending requests are cancelled and complete immediately in an error state.
  *
- * \context This function is called from the CameraManager thread.
+ * \context This function is called from the pipeline handler thread.
  */
 
+/**
+ * \brief Release resources kept allocated for a camera
+ * \param[in] camera The camera being released
+ *
+ * This function is called when the application releases the \a camera. Pipeline
+ * handlers that keep resources allocated across stop() and start() cycles, as
+ * requested by the CameraConfiguration::keepAllocations hint, shall release
+ * them here. The default implementation does nothing.
+ *
+ * \context This function is called from the pipeline handler thread.
+ */
+void PipelineHandler::releaseDevice([[maybe_unused]] Camera *camera)
+{
+}
+
 /**
  * \brief Determine if the camera has any requests pending
  * \param[in] camera The camera to check
  *
  * This function determines if there are any requests queued to the pipeline
- * awaiting processing.
+ * awaiting processing, including requests waiting for their fences to be
+ * signalled.
  *
  * \return True if there are pending requests, or false otherwise
  */
 bool PipelineHandler::hasPendingRequests(const Camera *camera) const
 {
-	return !camera->_d()->queuedRequests_.empty();
+	const Camera::Private *data = camera->_d();
+	return !data->queuedRequests_.empty() || !data->waitingRequests_.empty();
 }
 
 /**
@@ -296,27 +358,113 @@ bool PipelineHandler::hasPendingRequests(const Camera *camera) const
  * \param[in] request The request to queue
  *
  * This function queues a capture request to the pipeline handler for
- * processing. The request is first added to the internal list of queued
- * requests, and then passed to the pipeline handler with a call to
- * queueRequestDevice(). If the pipeline handler fails in queuing the request
- * to the hardware the request is cancelled.
+ * processing. The request is first added to the internal list of waiting
+ * requests which have to be prepared to make sure they are ready for being
+ * queued to the pipeline handler.
+ *
+ * The queue of waiting requests is iterated and all prepared requests are
+ * passed to the pipeline handler in the same order they have been queued by
+ * calling this function.
+ *
+ * If a Request fails during the preparation phase or if the pipeline handler
+ * fails in queuing the request to the hardware the request is cancelled.
  *
  * Keeping track of queued requests ensures automatic completion of all requests
  * when the pipeline handler is stopped with stop(). Request completion shall be
  * signalled by the pipeline handler using the completeRequest() function.
  *
- * \context This function is called from the CameraManager thread.
+ * \context This function is called from the pipeline handler thread.
  */
 void PipelineHandler::queueRequest(Request *request)
 {
 	LIBCAMERA_TRACEPOINT(request_queue, request);
+	TraceRing::record(TraceRing::RequestQueue, request, request->cookie());
+
+	Camera *camera = request->camera_;
+	camera->_d()->waitingRequests_.push(request);
+
+	Camera::Private::Metrics *metrics = camera->_d()->metrics();
+	metrics->requestsQueued.inc();
+	metrics->requestsInFlight.add(1);
+
+	request->queuedTime_ = timestampNs();
+	request->firstBufferTime_ = 0;
+
+	/*
+	 * \todo Better characterize the timeout. Currently equal to the one
+	 * used by the Rockchip Camera HAL on ChromeOS.
+	 */
+	request->prepared.connect(this, [this, camera]() {
+		doQueueRequests(camera);
+	});
+	request->prepare(300ms);
+}
+
+/**
+ * \brief Queue the requests pending for a camera
+ * \param[in] camera The camera
+ *
+ * This function retrieves the requests queued by the application to the
+ * \a camera since the last call, and queues them in order with queueRequest().
+ *
+ * \context This function is called from the pipeline handler thread.
+ */
+void PipelineHandler::queuePendingRequests(Camera *camera)
+{
+	for (Request *request : camera->_d()->takePendingRequests())
+		queueRequest(request);
+}
+
+/**
+ * \brief Cancel the requests waiting for their fences
+ * \param[in] camera The camera
+ *
+ * This function cancels all the requests of the \a camera that are still
+ * waiting for their fences to be signalled. The requests complete in an error
+ * state, after all the requests already queued to the device. Fences that
+ * haven't been signalled are left in the buffers, and can be retrieved by
+ * applications with FrameBuffer::releaseFence().
+ *
+ * It is called by the Camera class before stopping the pipeline handler with
+ * stop().
+ *
+ * \context This function is called from the pipeline handler thread.
+ */
+void PipelineHandler::cancelWaitingRequests(Camera *camera)
+{
+	std::queue<Request *> &waitingRequests = camera->_d()->waitingRequests_;
+
+	while (!waitingRequests.empty()) {
+		Request *request = waitingRequests.front();
+		waitingRequests.pop();
+
+		request->prepared.disconnect(this);
+		request->abortPrepare();
+
+		doQueueRequest(request);
+	}
+}
 
+/**
+ * \brief Queue one request to the device
+ * \param[in] request The request to queue
+ */
+void PipelineHandler::doQueueRequest(Request *request)
+{
 	Camera *camera = request->camera_;
 	Camera::Private *data = camera->_d();
 	data->queuedRequests_.push_back(request);
 
 	request->sequence_ = data->requestSequence_++;
 
+	if (request->cancelled_) {
+		request->cancel();
+		completeRequest(request);
+		return;
+	}
+
+	LIBCAMERA_TRACEPOINT(request_device_queue, request);
+
 	int ret = queueRequestDevice(camera, request);
 	if (ret) {
 		request->cancel();
@@ -324,6 +472,29 @@ void PipelineHandler::queueRequest(Request *request)
 	}
 }
 
+/**
+ * \brief Queue prepared requests to the device
+ * \param[in] camera The camera
+ *
+ * Iterate the list of waiting requests of the \a camera and queue them to the
+ * device one by one if they have been prepared.
+ */
+void PipelineHandler::doQueueRequests(Camera *camera)
+{
+	std::queue<Request *> &waitingRequests = camera->_d()->waitingRequests_;
+
+	while (!waitingRequests.empty()) {
+		Request *request = waitingRequests.front();
+		if (!request->prepared_)
+			break;
+
+		waitingRequests.pop();
+		request->prepared.disconnect(this);
+
+		doQueueRequest(request);
+	}
+}
+
 /**
  * \fn PipelineHandler::queueRequestDevice()
  * \brief Queue a request to the device
@@ -336,7 +507,7 @@ void PipelineHandler::queueRequest(Request *request)
  * parameters will be applied to the frames captured in the buffers provided in
  * the request.
  *
- * \context This function is called from the CameraManager thread.
+ * \context This function is called from the pipeline handler thread.
  *
  * \return 0 on success or a negative error code otherwise
  */
@@ -353,18 +524,48 @@ void PipelineHandler::queueRequest(Request *request)
  * pipeline handlers a chance to perform any operation that may still be
  * needed. They shall complete requests explicitly with completeRequest().
  *
- * \context This function shall be called from the CameraManager thread.
+ * \context This function shall be called from the pipeline handler thread.
  *
  * \return True if all buffers contained in the request have completed, false
  * otherwise
  */
 bool PipelineHandler::completeBuffer(Request *request, FrameBuffer *buffer)
 {
+	request->lastBufferTime_ = timestampNs();
+	if (!request->firstBufferTime_)
+		request->firstBufferTime_ = request->lastBufferTime_;
+
 	Camera *camera = request->camera_;
+	if (buffer->metadata().status == FrameMetadata::FrameError)
+		camera->_d()->metrics()->framesDropped.inc();
+
+	buffer->_d()->metadata().discarded = 0;
+
 	camera->bufferCompleted.emit(request, buffer);
 	return request->completeBuffer(buffer);
 }
 
+/**
+ * \brief Signal the availability of metadata for a request
+ * \param[in] request The request the metadata belongs to
+ * \param[in] metadata The metadata to add to the request
+ *
+ * This function shall be called by pipeline handlers to signal that metadata
+ * has been produced for \a request before it completes, typically when the IPA
+ * has processed the frame statistics. The \a metadata is merged into the
+ * request metadata and applications are notified through the
+ * Camera::metadataAvailable signal.
+ *
+ * \context This function shall be called from the pipeline handler thread.
+ */
+void PipelineHandler::metadataAvailable(Request *request, const ControlList &metadata)
+{
+	request->metadata().merge(metadata);
+
+	Camera *camera = request->camera_;
+	camera->metadataAvailable.emit(request, metadata);
+}
+
 /**
  * \brief Signal request completion
  * \param[in] request The request that has completed
@@ -377,12 +578,13 @@ bool PipelineHandler::completeBuffer(Request *request, FrameBuffer *buffer)
  * submission order, the pipeline handler may call it on any complete request
  * without any ordering constraint.
  *
- * \context This function shall be called from the CameraManager thread.
+ * \context This function shall be called from the pipeline handler thread.
  */
 void PipelineHandler::completeRequest(Request *request)
 {
 	Camera *camera = request->camera_;
 
+	request->completedTime_ = timestampNs();
 	request->complete();
 
 	Camera::Private *data = camera->_d();
@@ -394,10 +596,64 @@ void PipelineHandler::completeRequest(Request *request)
 
 		ASSERT(!req->hasPendingBuffers());
 		data->queuedRequests_.pop_front();
+
+		Camera::Private::Metrics *metrics = data->metrics();
+		metrics->requestsInFlight.add(-1);
+
+		if (req->status() == Request::RequestComplete) {
+			metrics->requestsCompleted.inc();
+			metrics->requestLatency.observe((req->completedTime_ - req->queuedTime_) / 1000);
+			recordLatencies(req);
+		} else {
+			metrics->requestsCancelled.inc();
+		}
+
+		LIBCAMERA_TRACEPOINT(request_deliver, req, camera->id().c_str());
+
 		camera->requestComplete(req);
 	}
 }
 
+/**
+ * \brief Compute and record the processing stage latencies of a request
+ * \param[in] request The request about to be delivered to the application
+ *
+ * The latencies are recorded for the camera statistics, and reported in the
+ * request metadata when the LIBCAMERA_LATENCY_METADATA environment variable is
+ * set.
+ */
+void PipelineHandler::recordLatencies(Request *request)
+{
+	static const bool reportMetadata = [] {
+		const char *env = GlobalConfiguration::option("LIBCAMERA_LATENCY_METADATA");
+		return env && *env;
+	}();
+
+	/*
+	 * Requests completed without any buffer going through completeBuffer()
+	 * spend no time in the buffers stage.
+	 */
+	uint64_t firstBufferTime = request->firstBufferTime_
+				 ? request->firstBufferTime_
+				 : request->completedTime_;
+	uint64_t lastBufferTime = request->firstBufferTime_
+				? request->lastBufferTime_
+				: request->completedTime_;
+
+	std::array<int64_t, Camera::Private::kLatencyStages> latencies = {
+		static_cast<int64_t>(firstBufferTime - request->queuedTime_),
+		static_cast<int64_t>(lastBufferTime - firstBufferTime),
+		static_cast<int64_t>(request->completedTime_ - lastBufferTime),
+		static_cast<int64_t>(timestampNs() - request->completedTime_),
+	};
+
+	request->camera_->_d()->recordLatencies(latencies);
+
+	if (reportMetadata)
+		request->metadata().set(controls::draft::RequestLatencies,
+					Span<const int64_t>(latencies));
+}
+
 /**
  * \brief Register a camera to the camera manager and pipeline handler
  * \param[in] camera The camera to be added
@@ -405,15 +661,20 @@ void PipelineHandler::completeRequest(Request *request)
  * This function is called by pipeline handlers to register the cameras they
  * handle with the camera manager.
  *
- * \context This function shall be called from the CameraManager thread.
+ * Cameras are normally backed by the media devices acquired by the pipeline
+ * handler. Virtual cameras, such as the cameras of the replay pipeline
+ * handler, have no media device and are not associated with any device node.
+ *
+ * \context This function shall be called from the pipeline handler thread.
  */
 void PipelineHandler::registerCamera(std::shared_ptr<Camera> camera)
 {
 	cameras_.push_back(camera);
 
 	if (mediaDevices_.empty())
-		LOG(Pipeline, Fatal)
-			<< "Registering camera with no media devices!";
+		LOG(Pipeline, Debug)
+			<< "Registering camera " << camera->id()
+			<< " with no media devices";
 
 	/*
 	 * Walk the entity list and map the devnums of all capture video nodes
@@ -76,6 +76,8 @@ void ProcessManager::sighandler()
 		return;
 	}
 
+	MutexLocker locker(mutex_);
+
 	for (auto it = processes_.begin(); it != processes_.end(); ) {
 		Process *process = *it;
 
@@ -89,6 +91,15 @@ void ProcessManager::sighandler()
 		it = processes_.erase(it);
 		process->died(wstatus);
 	}
+
+	/* Reap the processes whose Process instance has been destroyed. */
+	for (auto it = orphans_.begin(); it != orphans_.end(); ) {
+		int wstatus;
+		if (waitpid(*it, &wstatus, WNOHANG) == *it)
+			it = orphans_.erase(it);
+		else
+			++it;
+	}
 }
 
 /**
@@ -98,12 +109,38 @@ void ProcessManager::sighandler()
  * This function registers the \a proc with the process manager. It
  * shall be called by the parent process after successfully forking, in
  * order to let the parent signal process termination.
+ *
+ * \context This function is \threadsafe.
  */
 void ProcessManager::registerProcess(Process *proc)
 {
+	MutexLocker locker(mutex_);
+
 	processes_.push_back(proc);
 }
 
+/**
+ * \brief Unregister a running process from the process manager
+ * \param[in] proc Process to unregister
+ *
+ * This function unregisters the \a proc from the process manager when the
+ * Process instance is destroyed before the process terminates. The process is
+ * still reaped when it terminates, but without notifying \a proc.
+ *
+ * \context This function is \threadsafe.
+ */
+void ProcessManager::unregisterProcess(Process *proc)
+{
+	MutexLocker locker(mutex_);
+
+	auto it = std::find(processes_.begin(), processes_.end(), proc);
+	if (it == processes_.end())
+		return;
+
+	processes_.erase(it);
+	orphans_.push_back(proc->pid_);
+}
+
 ProcessManager *ProcessManager::self_ = nullptr;
 
 /**
@@ -213,7 +250,10 @@ Process::Process()
 Process::~Process()
 {
 	kill();
-	/* \todo wait for child process to exit */
+
+	/* Don't let the process manager notify this instance once destroyed. */
+	if (running_ && ProcessManager::instance())
+		ProcessManager::instance()->unregisterProcess(this);
 }
 
 /**
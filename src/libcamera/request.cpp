@@ -5,30 +5,40 @@
  * request.cpp - Capture request handling
  */
 
-#include <libcamera/request.h>
+#include "libcamera/internal/request.h"
 
+#include <algorithm>
 #include <map>
 #include <sstream>
 
+#include <libcamera/base/event_notifier.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/timer.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
+#include <libcamera/fence.h>
 #include <libcamera/framebuffer.h>
 #include <libcamera/stream.h>
 
 #include "libcamera/internal/camera.h"
 #include "libcamera/internal/camera_controls.h"
 #include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/trace_ring.h"
 #include "libcamera/internal/tracepoints.h"
 
 /**
- * \file request.h
+ * \file libcamera/request.h
  * \brief Describes a frame capture request to be processed by a camera
+ *
+ * \file libcamera/internal/request.h
+ * \brief Internal request handling support
  */
 
 namespace libcamera {
 
+using namespace std::literals::chrono_literals;
+
 LOG_DEFINE_CATEGORY(Request)
 
 /**
@@ -56,6 +66,31 @@ LOG_DEFINE_CATEGORY(Request)
  * \brief A map of Stream to FrameBuffer pointers
  */
 
+/**
+ * \class Request::Private
+ * \brief Request private data
+ *
+ * The Request::Private class stores the private data of a Request that is only
+ * used by the camera and the pipeline handlers.
+ */
+
+/**
+ * \brief Construct a Request::Private instance
+ */
+Request::Private::Private()
+	: pendingNext_(nullptr)
+{
+}
+
+/**
+ * \var Request::Private::pendingNext_
+ * \brief The next request in the camera pending list
+ *
+ * Requests queued to a camera are linked in a lock-free list through this
+ * field until the pipeline handler thread takes them, see
+ * Camera::Private::queuePendingRequests().
+ */
+
 /**
  * \class Request
  * \brief A frame capture request
@@ -75,7 +110,8 @@ LOG_DEFINE_CATEGORY(Request)
  * completely opaque to libcamera.
  */
 Request::Request(Camera *camera, uint64_t cookie)
-	: camera_(camera), sequence_(0), cookie_(cookie),
+	: Extensible(std::make_unique<Private>()), camera_(camera), prepared_(false), queuedTime_(0), firstBufferTime_(0),
+	  lastBufferTime_(0), completedTime_(0), sequence_(0), cookie_(cookie),
 	  status_(RequestPending), cancelled_(false)
 {
 	controls_ = new ControlList(controls::controls,
@@ -118,15 +154,21 @@ void Request::reuse(ReuseFlag flags)
 		for (auto pair : bufferMap_) {
 			FrameBuffer *buffer = pair.second;
 			buffer->_d()->setRequest(this);
-			pending_.insert(buffer);
+			pending_.push_back(buffer);
 		}
 	} else {
-		bufferMap_.clear();
+		/*
+		 * Keep the map nodes for the next calls to addBuffer(), to
+		 * avoid allocating memory every time the request is reused.
+		 */
+		while (!bufferMap_.empty())
+			spareNodes_.push_back(bufferMap_.extract(bufferMap_.begin()));
 	}
 
 	sequence_ = 0;
 	status_ = RequestPending;
 	cancelled_ = false;
+	prepared_ = false;
 
 	controls_->clear();
 	metadata_->clear();
@@ -162,6 +204,7 @@ void Request::reuse(ReuseFlag flags)
  * \brief Add a FrameBuffer with its associated Stream to the Request
  * \param[in] stream The stream the buffer belongs to
  * \param[in] buffer The FrameBuffer to add to the request
+ * \param[in] fence The optional fence
  *
  * A reference to the buffer is stored in the request. The caller is responsible
  * for ensuring that the buffer will remain valid until the request complete
@@ -170,11 +213,28 @@ void Request::reuse(ReuseFlag flags)
  * A request can only contain one buffer per stream. If a buffer has already
  * been added to the request for the same stream, this function returns -EEXIST.
  *
+ * A Fence can be optionally associated with the \a buffer.
+ *
+ * When a valid Fence is provided to this function, \a fence is moved to \a
+ * buffer and this Request will only be queued to the device once the
+ * fences of all its buffers have been correctly signalled.
+ *
+ * If the \a fence associated with \a buffer isn't signalled, the request will
+ * fail after a timeout. The buffer will still contain the fence, which
+ * applications must retrieve with FrameBuffer::releaseFence() before the buffer
+ * can be reused in another request. Attempting to add a buffer that still
+ * contains a fence to a request will result in this function returning
+ * -EEXIST.
+ *
+ * \sa FrameBuffer::releaseFence()
+ *
  * \return 0 on success or a negative error code otherwise
  * \retval -EEXIST The request already contains a buffer for the stream
+ * or the buffer still references a fence
  * \retval -EINVAL The buffer does not reference a valid Stream
  */
-int Request::addBuffer(const Stream *stream, FrameBuffer *buffer)
+int Request::addBuffer(const Stream *stream, FrameBuffer *buffer,
+		       std::unique_ptr<Fence> fence)
 {
 	if (!stream) {
 		LOG(Request, Error) << "Invalid stream reference";
@@ -187,9 +247,31 @@ int Request::addBuffer(const Stream *stream, FrameBuffer *buffer)
 		return -EEXIST;
 	}
 
+	/*
+	 * Make sure the fence has been extracted from the buffer
+	 * to avoid waiting on a stale fence.
+	 */
+	if (buffer->_d()->fence()) {
+		LOG(Request, Error) << "Can't add buffer that still references a fence";
+		return -EEXIST;
+	}
+
+	if (fence && fence->isValid())
+		buffer->_d()->setFence(std::move(fence));
+
 	buffer->_d()->setRequest(this);
-	pending_.insert(buffer);
-	bufferMap_[stream] = buffer;
+	pending_.push_back(buffer);
+
+	if (!spareNodes_.empty()) {
+		BufferMap::node_type node = std::move(spareNodes_.back());
+		spareNodes_.pop_back();
+
+		node.key() = stream;
+		node.mapped() = buffer;
+		bufferMap_.insert(it, std::move(node));
+	} else {
+		bufferMap_.emplace_hint(it, stream, buffer);
+	}
 
 	return 0;
 }
@@ -287,6 +369,7 @@ void Request::complete()
 	LOG(Request, Debug) << toString();
 
 	LIBCAMERA_TRACEPOINT(request_complete, this);
+	TraceRing::record(TraceRing::RequestComplete, this, status_);
 }
 
 /**
@@ -329,8 +412,9 @@ bool Request::completeBuffer(FrameBuffer *buffer)
 {
 	LIBCAMERA_TRACEPOINT(request_complete_buffer, this, buffer);
 
-	int ret = pending_.erase(buffer);
-	ASSERT(ret == 1);
+	auto it = std::find(pending_.begin(), pending_.end(), buffer);
+	ASSERT(it != pending_.end());
+	pending_.erase(it);
 
 	buffer->_d()->setRequest(nullptr);
 
@@ -340,6 +424,137 @@ bool Request::completeBuffer(FrameBuffer *buffer)
 	return !hasPendingBuffers();
 }
 
+/**
+ * \brief Prepare the request for being queued to the device
+ * \param[in] timeout Optional expiration timeout
+ *
+ * Prepare a Request to be queued to the hardware device by ensuring it is
+ * ready for the incoming memory transfers.
+ *
+ * This currently means waiting on each frame buffer acquire fence to be
+ * signalled. An optional expiration timeout can be specified. If not all the
+ * fences have been signalled correctly before the timeout expires the Request
+ * is cancelled.
+ *
+ * The function immediately emits the prepared signal if all the prepare
+ * operations have been completed synchronously. If instead the prepare
+ * operations require to wait the completion of asynchronous events, such as
+ * fences notifications or timer expiration, the prepared signal is emitted upon
+ * the asynchronous event completion.
+ *
+ * As we currently only handle fences, the function emits the prepared signal
+ * immediately if there are no fences to wait on. Otherwise the prepared signal
+ * is emitted when all fences have been signalled or the optional timeout has
+ * expired.
+ *
+ * If not all the fences have been correctly signalled or the optional timeout
+ * has expired the Request will be cancelled and the Request::prepared signal
+ * emitted.
+ *
+ * The intended user of this function is the PipelineHandler base class, which
+ * 'prepares' a Request before queuing it to the hardware device.
+ */
+void Request::prepare(std::chrono::milliseconds timeout)
+{
+	/* Create and connect EventNotifier for each fence to wait on. */
+	for (const auto &[stream, buffer] : bufferMap_) {
+		const Fence *fence = buffer->_d()->fence();
+		if (!fence)
+			continue;
+
+		std::unique_ptr<EventNotifier> notifier =
+			std::make_unique<EventNotifier>(fence->fd().fd(),
+							EventNotifier::Read);
+
+		notifier->activated.connect(this, [this, buffer = buffer] {
+			notifierActivated(buffer);
+		});
+
+		notifiers_[buffer] = std::move(notifier);
+	}
+
+	if (notifiers_.empty()) {
+		emitPrepareCompleted();
+		return;
+	}
+
+	/*
+	 * In case a timeout is specified, create a timer and set it up.
+	 *
+	 * The timer must be created here instead of in the Request constructor,
+	 * in order to be bound to the pipeline handler thread.
+	 */
+	if (timeout != 0ms) {
+		timer_ = std::make_unique<Timer>();
+		timer_->timeout.connect(this, &Request::timeout);
+		/* Precision isn't needed, allow coalescing with other timers. */
+		timer_->setSlack(timeout / 10);
+		timer_->start(timeout);
+	}
+}
+
+/**
+ * \var Request::prepared
+ * \brief Request preparation completed Signal
+ *
+ * The signal is emitted once the request preparation has completed and is ready
+ * for queuing. The Request might have failed the preparation phase, in which
+ * case it is marked as cancelled and shall be completed without being queued
+ * to the device.
+ */
+
+void Request::emitPrepareCompleted()
+{
+	prepared_ = true;
+	prepared.emit();
+}
+
+void Request::notifierActivated(FrameBuffer *buffer)
+{
+	/* Close the fence if successfully signalled. */
+	ASSERT(buffer);
+	buffer->releaseFence();
+
+	/* Remove the entry from the map and check if other fences are pending. */
+	auto it = notifiers_.find(buffer);
+	ASSERT(it != notifiers_.end());
+	notifiers_.erase(it);
+
+	if (!notifiers_.empty())
+		return;
+
+	/* All fences completed, delete the timer and emit the prepared signal. */
+	timer_.reset();
+	emitPrepareCompleted();
+}
+
+void Request::timeout()
+{
+	/* A timeout can only happen if there are fences not yet signalled. */
+	ASSERT(!notifiers_.empty());
+
+	LOG(Request, Debug) << "Request prepare timeout: " << cookie_;
+
+	abortPrepare();
+	prepared.emit();
+}
+
+/**
+ * \brief Abort the request preparation
+ *
+ * Stop waiting for the fences of the request and mark the request as prepared
+ * and cancelled, without emitting the prepared signal. Fences that haven't
+ * been signalled are left in their buffers.
+ */
+void Request::abortPrepare()
+{
+	notifiers_.clear();
+	timer_.reset();
+
+	cancelled_ = true;
+	prepared_ = true;
+}
+
 /**
  * \brief Generate a string representation of the Request internals
  *
@@ -0,0 +1,320 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * request_fan_out.cpp - Share completed requests between multiple consumers
+ */
+
+#include <libcamera/request_fan_out.h>
+
+#include <vector>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/request.h>
+
+/**
+ * \file request_fan_out.h
+ * \brief Share completed requests between multiple consumers
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(RequestFanOut)
+
+/**
+ * \class RequestFanOut
+ * \brief Hand completed requests to multiple consumers and requeue them
+ *
+ * Applications often feed the frames captured by a camera to multiple
+ * consumers in the same process, such as a preview, a video encoder and an
+ * analytics engine. A request and its buffers are owned by the application
+ * until it is queued again, so sharing them without copying frames requires
+ * tracking when all consumers are done with them. The RequestFanOut class
+ * implements that tracking.
+ *
+ * The fan-out is created for a fixed number of consumers, identified by an
+ * index in the [0, consumers()[ range. Every request completed successfully by
+ * the camera is reported through the \ref requestReady signal, and is held
+ * until each consumer has called release() for it. When the last consumer
+ * releases the request, it is reused with Request::ReuseBuffers and queued
+ * again to the camera. The buffers are never copied.
+ *
+ * Two policies protect the camera from slow consumers, which would otherwise
+ * starve it of buffers:
+ *
+ * - setMaxHeld() limits the number of requests held by consumers. Requests
+ *   that complete while the limit is reached are dropped: they are requeued
+ *   immediately without being reported through the \ref requestReady signal.
+ * - setTimeout() limits the time a request can be held. When a request isn't
+ *   released by all consumers within the timeout, the remaining consumers lose
+ *   their reference and the request is requeued. Consumers shall not access a
+ *   request after its timeout, and shall not release it anymore.
+ *
+ * Timeouts are checked when requests complete and when they are released, they
+ * are thus detected with a delay of up to one frame while the camera runs. The
+ * timeout should be combined with a held limit lower than the number of
+ * requests, as requests stop completing when consumers hold all of them.
+ *
+ * Requests that can't be requeued, because they have been cancelled or
+ * released after stop() has been called, are reported through the
+ * \ref requestReleased signal instead, for the application to dispose of them.
+ * Applications shall call stop() before stopping the camera, and start() after
+ * restarting it.
+ *
+ * The fan-out connects to the Camera::requestCompleted signal and emits its
+ * signals from the thread that emits it. The release() function may be called
+ * from any thread. Applications should connect to the fan-out signals instead
+ * of the Camera::requestCompleted signal.
+ */
+
+/**
+ * \var RequestFanOut::kMaxConsumers
+ * \brief The maximum number of consumers
+ */
+
+/**
+ * \brief Create a fan-out for the requests of a camera
+ * \param[in] camera The camera
+ * \param[in] consumers The number of consumers, up to kMaxConsumers
+ */
+RequestFanOut::RequestFanOut(std::shared_ptr<Camera> camera, unsigned int consumers)
+	: camera_(std::move(camera)), consumers_(consumers), requeue_(true),
+	  maxHeld_(0), timeout_(0), dropped_(0), timedOut_(0)
+{
+	if (consumers_ > kMaxConsumers) {
+		LOG(RequestFanOut, Warning)
+			<< "Limiting fan-out to " << kMaxConsumers << " consumers";
+		consumers_ = kMaxConsumers;
+	}
+
+	camera_->requestCompleted.connect(this, &RequestFanOut::requestCompleted);
+}
+
+RequestFanOut::~RequestFanOut()
+{
+	camera_->requestCompleted.disconnect(this);
+}
+
+/**
+ * \fn RequestFanOut::consumers()
+ * \brief Retrieve the number of consumers
+ * \return The number of consumers
+ */
+
+/**
+ * \brief Limit the number of requests held by consumers
+ * \param[in] count The maximum number of requests held by consumers, or 0 to
+ * disable the limit
+ *
+ * Requests that complete while \a count requests are held by consumers are
+ * requeued without being reported. Setting \a count lower than the number of
+ * requests queued to the camera ensures the camera always has buffers to
+ * capture frames to. The limit is disabled by default.
+ */
+void RequestFanOut::setMaxHeld(unsigned int count)
+{
+	std::lock_guard<std::mutex> locker(lock_);
+	maxHeld_ = count;
+}
+
+/**
+ * \brief Limit the time a request can be held by consumers
+ * \param[in] timeout The timeout, or 0 to disable the timeout
+ *
+ * The timeout applies to the requests that complete after this function is
+ * called. It is disabled by default.
+ */
+void RequestFanOut::setTimeout(std::chrono::milliseconds timeout)
+{
+	std::lock_guard<std::mutex> locker(lock_);
+	timeout_ = timeout;
+}
+
+/**
+ * \brief Resume requeuing released requests
+ *
+ * Requests are requeued when released by default. This function restores that
+ * behaviour after a call to stop(), it shall be called after restarting the
+ * camera.
+ */
+void RequestFanOut::start()
+{
+	std::lock_guard<std::mutex> locker(lock_);
+	requeue_ = true;
+}
+
+/**
+ * \brief Stop requeuing released requests
+ *
+ * Requests released after this function is called are reported through the
+ * \ref requestReleased signal instead of being requeued. This function shall
+ * be called before stopping the camera. Requests held by consumers are not
+ * affected and stay valid until released.
+ */
+void RequestFanOut::stop()
+{
+	std::lock_guard<std::mutex> locker(lock_);
+	requeue_ = false;
+}
+
+/**
+ * \brief Release the reference of a consumer to a request
+ * \param[in] consumer The consumer index
+ * \param[in] request The request
+ *
+ * Consumers call this function when they don't need to access the \a request
+ * and its buffers anymore. The request is requeued when released by the last
+ * consumer. Releasing a request not held by the \a consumer is ignored.
+ *
+ * \context This function is \threadsafe.
+ */
+void RequestFanOut::release(unsigned int consumer, Request *request)
+{
+	std::vector<Request *> released;
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+
+		auto iter = held_.find(request);
+		if (consumer < consumers_ && iter != held_.end() &&
+		    iter->second.holders & (1U << consumer)) {
+			iter->second.holders &= ~(1U << consumer);
+			if (!iter->second.holders) {
+				held_.erase(iter);
+				released.push_back(request);
+			}
+		} else {
+			LOG(RequestFanOut, Warning)
+				<< "Request " << request->toString()
+				<< " not held by consumer " << consumer;
+		}
+
+		expire(&released);
+	}
+
+	for (Request *req : released)
+		recycle(req);
+}
+
+/**
+ * \brief Retrieve the number of requests dropped because of the held limit
+ * \return The number of dropped requests
+ */
+unsigned int RequestFanOut::dropped() const
+{
+	std::lock_guard<std::mutex> locker(lock_);
+	return dropped_;
+}
+
+/**
+ * \brief Retrieve the number of requests not released within the timeout
+ * \return The number of timed out requests
+ */
+unsigned int RequestFanOut::timedOut() const
+{
+	std::lock_guard<std::mutex> locker(lock_);
+	return timedOut_;
+}
+
+/**
+ * \var RequestFanOut::requestReady
+ * \brief Signal emitted when a request is ready to be consumed
+ *
+ * The slots connected to this signal shall arrange for every consumer to call
+ * release() once for the request.
+ */
+
+/**
+ * \var RequestFanOut::requestReleased
+ * \brief Signal emitted for requests that can't be requeued
+ *
+ * The signal is emitted for requests that have been cancelled or released
+ * after the camera has been stopped. Their ownership returns to the
+ * application.
+ */
+
+void RequestFanOut::requestCompleted(Request *request)
+{
+	if (request->status() != Request::RequestComplete) {
+		requestReleased.emit(request);
+		return;
+	}
+
+	std::vector<Request *> released;
+	bool ready = false;
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+
+		expire(&released);
+
+		if (maxHeld_ && held_.size() >= maxHeld_) {
+			LOG(RequestFanOut, Debug)
+				<< "Dropping request " << request->toString();
+			dropped_++;
+		} else if (consumers_) {
+			Entry &entry = held_[request];
+			entry.holders = consumers_ == kMaxConsumers
+				      ? ~0U : (1U << consumers_) - 1;
+			entry.deadline = timeout_.count()
+				       ? std::chrono::steady_clock::now() + timeout_
+				       : std::chrono::steady_clock::time_point::max();
+			ready = true;
+		}
+	}
+
+	for (Request *req : released)
+		recycle(req);
+
+	if (ready)
+		requestReady.emit(request);
+	else
+		recycle(request);
+}
+
+/*
+ * Release the requests held past their deadline. The caller shall hold the
+ * lock_.
+ */
+void RequestFanOut::expire(std::vector<Request *> *released)
+{
+	auto now = std::chrono::steady_clock::now();
+
+	for (auto iter = held_.begin(); iter != held_.end();) {
+		if (iter->second.deadline > now) {
+			++iter;
+			continue;
+		}
+
+		LOG(RequestFanOut, Warning)
+			<< "Request " << iter->first->toString()
+			<< " timed out, held by consumers 0x" << std::hex
+			<< iter->second.holders;
+
+		timedOut_++;
+		released->push_back(iter->first);
+		iter = held_.erase(iter);
+	}
+}
+
+void RequestFanOut::recycle(Request *request)
+{
+	bool requeue;
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		requeue = requeue_;
+	}
+
+	if (requeue) {
+		request->reuse(Request::ReuseBuffers);
+		if (!camera_->queueRequest(request))
+			return;
+	}
+
+	requestReleased.emit(request);
+}
+
+} /* namespace libcamera */
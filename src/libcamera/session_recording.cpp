@@ -0,0 +1,497 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * session_recording.cpp - Recording of camera capture sessions
+ */
+
+#include "libcamera/internal/session_recording.h"
+
+#include <algorithm>
+#include <errno.h>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+
+#include "libcamera/internal/byte_stream_buffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+
+/**
+ * \file session_recording.h
+ * \brief Recording of camera capture sessions
+ *
+ * A session recording stores the frames and metadata produced by a camera
+ * during a capture session, along with the camera controls, properties and
+ * stream configurations. It is replayed by the replay pipeline handler, to
+ * benchmark applications and the libcamera core without camera hardware.
+ *
+ * The recording is designed to be memory-mapped. It starts with a
+ * session::Header, followed by the camera ID, an array of session::Stream, the
+ * serialized camera controls and the serialized camera properties. The
+ * requests follow, each stored as a session::Request, an array of
+ * session::Buffer, the serialized request metadata and the content of the
+ * buffer planes. All fields are stored in the native byte order, and all
+ * variable-size data is padded to a multiple of 8 bytes.
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Session)
+
+namespace {
+
+constexpr size_t alignedSize(size_t size)
+{
+	return (size + 7) & ~static_cast<size_t>(7);
+}
+
+} /* namespace */
+
+/**
+ * \namespace libcamera::session
+ * \brief Data structures stored in a session recording
+ */
+
+/**
+ * \var session::kMagic
+ * \brief The value that starts a session recording
+ *
+ * \var session::kVersion
+ * \brief The version of the session recording format
+ *
+ * \var session::kMaxPlanes
+ * \brief The maximum number of planes per recorded buffer
+ */
+
+/**
+ * \struct session::Header
+ * \brief The session recording header
+ * \var session::Header::magic
+ * \brief The session::kMagic value
+ * \var session::Header::version
+ * \brief The session::kVersion value
+ * \var session::Header::streams
+ * \brief The number of recorded streams
+ * \var session::Header::controlsSize
+ * \brief The size of the serialized camera controls
+ * \var session::Header::propertiesSize
+ * \brief The size of the serialized camera properties
+ * \var session::Header::idSize
+ * \brief The length of the camera ID
+ */
+
+/**
+ * \struct session::Stream
+ * \brief The configuration of a recorded stream
+ * \var session::Stream::pixelFormat
+ * \brief The pixel format FourCC
+ * \var session::Stream::width
+ * \brief The frame width
+ * \var session::Stream::height
+ * \brief The frame height
+ * \var session::Stream::stride
+ * \brief The image stride
+ * \var session::Stream::frameSize
+ * \brief The frame size
+ * \var session::Stream::bufferCount
+ * \brief The number of buffers
+ * \var session::Stream::modifier
+ * \brief The pixel format modifier
+ */
+
+/**
+ * \struct session::Plane
+ * \brief A recorded buffer plane
+ * \var session::Plane::length
+ * \brief The plane length
+ * \var session::Plane::bytesused
+ * \brief The number of bytes used in the plane, and recorded
+ * \var session::Plane::offset
+ * \brief The offset of the plane data from the start of the request record
+ */
+
+/**
+ * \struct session::Buffer
+ * \brief A recorded buffer
+ * \var session::Buffer::stream
+ * \brief The index of the buffer stream
+ * \var session::Buffer::sequence
+ * \brief The frame sequence number
+ * \var session::Buffer::planes
+ * \brief The number of planes
+ * \var session::Buffer::reserved
+ * \brief Reserved for future use, set to 0
+ * \var session::Buffer::plane
+ * \brief The buffer planes
+ */
+
+/**
+ * \struct session::Request
+ * \brief A recorded request
+ * \var session::Request::size
+ * \brief The size of the request record, including the buffers data
+ * \var session::Request::buffers
+ * \brief The number of buffers
+ * \var session::Request::timestamp
+ * \brief The sensor timestamp of the request, in nanoseconds
+ * \var session::Request::metadataSize
+ * \brief The size of the serialized metadata
+ * \var session::Request::reserved
+ * \brief Reserved for future use, set to 0
+ */
+
+/**
+ * \class SessionRecorder
+ * \brief Record the requests completed by a camera to a file
+ */
+
+SessionRecorder::SessionRecorder()
+	: serializer_(ControlSerializer::Role::Proxy)
+{
+}
+
+/**
+ * \brief Create a session recording for the \a camera
+ * \param[in] path The path of the recording file
+ * \param[in] camera The recorded camera
+ * \param[in] streams The streams of the capture session
+ *
+ * The file is truncated if it exists.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int SessionRecorder::open(const std::string &path, Camera *camera,
+			  const std::vector<const Stream *> &streams)
+{
+	file_.open(path, std::ios::binary | std::ios::trunc);
+	if (!file_.is_open()) {
+		LOG(Session, Error) << "Failed to create " << path;
+		return -EIO;
+	}
+
+	streams_ = streams;
+
+	const ControlInfoMap &controls = camera->controls();
+	const ControlList &properties = camera->properties();
+	const std::string &id = camera->id();
+
+	session::Header header{};
+	header.magic = session::kMagic;
+	header.version = session::kVersion;
+	header.streams = streams.size();
+	header.controlsSize = ControlSerializer::binarySize(controls);
+	header.propertiesSize = ControlSerializer::binarySize(properties);
+	header.idSize = id.size();
+
+	std::vector<uint8_t> data(alignedSize(header.idSize) +
+				  alignedSize(header.controlsSize) +
+				  alignedSize(header.propertiesSize));
+	std::copy(id.begin(), id.end(), data.begin());
+
+	ByteStreamBuffer buffer(data.data() + alignedSize(header.idSize),
+				data.size() - alignedSize(header.idSize));
+	serializer_.serialize(controls, buffer);
+	buffer.skip(alignedSize(header.controlsSize) - header.controlsSize);
+	serializer_.serialize(properties, buffer);
+
+	file_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	file_.write(reinterpret_cast<const char *>(data.data()),
+		    alignedSize(header.idSize));
+
+	for (const Stream *stream : streams) {
+		const StreamConfiguration &cfg = stream->configuration();
+
+		session::Stream info{};
+		info.pixelFormat = cfg.pixelFormat.fourcc();
+		info.modifier = cfg.pixelFormat.modifier();
+		info.width = cfg.size.width;
+		info.height = cfg.size.height;
+		info.stride = cfg.stride;
+		info.frameSize = cfg.frameSize;
+		info.bufferCount = cfg.bufferCount;
+
+		file_.write(reinterpret_cast<const char *>(&info), sizeof(info));
+	}
+
+	file_.write(reinterpret_cast<const char *>(data.data()) + alignedSize(header.idSize),
+		    data.size() - alignedSize(header.idSize));
+
+	if (!file_) {
+		LOG(Session, Error) << "Failed to write " << path;
+		file_.close();
+		return -EIO;
+	}
+
+	LOG(Session, Info) << "Recording " << id << " session to " << path;
+
+	return 0;
+}
+
+/**
+ * \brief Record a completed request
+ * \param[in] request The request
+ *
+ * Requests that have been cancelled are not recorded.
+ */
+void SessionRecorder::write(libcamera::Request *request)
+{
+	if (!file_.is_open() || request->status() != libcamera::Request::RequestComplete)
+		return;
+
+	std::vector<session::Buffer> buffers;
+	std::vector<MappedFrameBuffer> mappings;
+	size_t offset = sizeof(session::Request);
+
+	for (const auto &[stream, buffer] : request->buffers()) {
+		auto it = std::find(streams_.begin(), streams_.end(), stream);
+		if (it == streams_.end() ||
+		    buffer->planes().size() > session::kMaxPlanes)
+			continue;
+
+		session::Buffer info{};
+		info.stream = it - streams_.begin();
+		info.sequence = buffer->metadata().sequence;
+		info.planes = buffer->planes().size();
+
+		buffers.push_back(info);
+		mappings.emplace_back(buffer, MappedFrameBuffer::MapFlag::Read);
+	}
+
+	/* The metadata are serialized in full for each request. */
+	serializer_.reset();
+
+	const ControlList &metadata = request->metadata();
+	uint32_t metadataSize = ControlSerializer::binarySize(metadata);
+	std::vector<uint8_t> metadataData(alignedSize(metadataSize));
+	ByteStreamBuffer metadataBuffer(metadataData.data(), metadataData.size());
+	serializer_.serialize(metadata, metadataBuffer);
+
+	offset += buffers.size() * sizeof(session::Buffer) + metadataData.size();
+
+	for (unsigned int i = 0; i < buffers.size(); ++i) {
+		const FrameBuffer *buffer = request->findBuffer(streams_[buffers[i].stream]);
+
+		for (unsigned int j = 0; j < buffers[i].planes; ++j) {
+			session::Plane &plane = buffers[i].plane[j];
+			plane.length = buffer->planes()[j].length;
+			plane.bytesused = mappings[i].isValid()
+					? buffer->metadata().planes()[j].bytesused : 0;
+			plane.offset = offset;
+			offset += alignedSize(plane.bytesused);
+		}
+	}
+
+	session::Request info{};
+	info.size = offset;
+	info.buffers = buffers.size();
+	info.timestamp = metadata.get(controls::SensorTimestamp);
+	info.metadataSize = metadataSize;
+
+	file_.write(reinterpret_cast<const char *>(&info), sizeof(info));
+	file_.write(reinterpret_cast<const char *>(buffers.data()),
+		    buffers.size() * sizeof(session::Buffer));
+	file_.write(reinterpret_cast<const char *>(metadataData.data()),
+		    metadataData.size());
+
+	static const char padding[8] = {};
+
+	for (unsigned int i = 0; i < buffers.size(); ++i) {
+		for (unsigned int j = 0; j < buffers[i].planes; ++j) {
+			uint32_t bytesused = buffers[i].plane[j].bytesused;
+			if (!bytesused)
+				continue;
+
+			file_.write(reinterpret_cast<const char *>(mappings[i].planes()[j].data()),
+				    bytesused);
+			file_.write(padding, alignedSize(bytesused) - bytesused);
+		}
+	}
+
+	if (!file_) {
+		LOG(Session, Error) << "Failed to record request, stopping";
+		file_.close();
+	}
+}
+
+/**
+ * \class SessionRecording
+ * \brief Access the content of a session recording
+ *
+ * The recording is memory-mapped, the data returned by the SessionRecording
+ * points directly to the file content and is valid for the lifetime of the
+ * SessionRecording instance.
+ */
+
+SessionRecording::SessionRecording()
+	: serializer_(ControlSerializer::Role::Worker)
+{
+}
+
+/**
+ * \brief Open and index a session recording
+ * \param[in] path The path of the recording
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The file isn't a valid session recording
+ */
+int SessionRecording::open(const std::string &path)
+{
+	file_.setFileName(path);
+	if (!file_.open(File::OpenModeFlag::ReadOnly)) {
+		LOG(Session, Error) << "Failed to open " << path;
+		return file_.error();
+	}
+
+	mem_ = file_.map(0, -1, File::MapFlag::Private);
+	if (mem_.empty()) {
+		LOG(Session, Error) << "Failed to map " << path;
+		return -EINVAL;
+	}
+
+	size_t offset = sizeof(session::Header);
+	if (mem_.size() < offset)
+		return -EINVAL;
+
+	const session::Header *header =
+		reinterpret_cast<const session::Header *>(mem_.data());
+	if (header->magic != session::kMagic ||
+	    header->version != session::kVersion) {
+		LOG(Session, Error) << path << " is not a supported session recording";
+		return -EINVAL;
+	}
+
+	size_t idSize = alignedSize(header->idSize);
+	size_t controlsSize = alignedSize(header->controlsSize);
+	size_t propertiesSize = alignedSize(header->propertiesSize);
+	size_t streamsSize = header->streams * sizeof(session::Stream);
+
+	if (mem_.size() < offset + idSize + streamsSize + controlsSize + propertiesSize) {
+		LOG(Session, Error) << "Truncated session header";
+		return -EINVAL;
+	}
+
+	cameraId_.assign(reinterpret_cast<const char *>(mem_.data() + offset),
+			 header->idSize);
+	offset += idSize;
+
+	const session::Stream *streams =
+		reinterpret_cast<const session::Stream *>(mem_.data() + offset);
+	streams_.assign(streams, streams + header->streams);
+	offset += streamsSize;
+
+	const uint8_t *data = mem_.data();
+
+	ByteStreamBuffer controls(data + offset, header->controlsSize);
+	controls_ = serializer_.deserialize<ControlInfoMap>(controls);
+	offset += controlsSize;
+
+	ByteStreamBuffer properties(data + offset, header->propertiesSize);
+	properties_ = serializer_.deserialize<ControlList>(properties);
+	offset += propertiesSize;
+
+	while (offset + sizeof(session::Request) <= mem_.size()) {
+		const session::Request *request =
+			reinterpret_cast<const session::Request *>(mem_.data() + offset);
+
+		if (request->size < sizeof(*request) || request->size % 8 ||
+		    offset + request->size > mem_.size())
+			break;
+
+		size_t headerSize = sizeof(*request) +
+				    request->buffers * sizeof(session::Buffer) +
+				    alignedSize(request->metadataSize);
+		if (headerSize > request->size)
+			break;
+
+		requests_.push_back(request);
+		offset += request->size;
+	}
+
+	if (offset != mem_.size())
+		LOG(Session, Warning)
+			<< "Ignoring " << mem_.size() - offset
+			<< " bytes of truncated data";
+
+	LOG(Session, Debug)
+		<< "Session of camera " << cameraId_ << " with "
+		<< streams_.size() << " streams and " << requests_.size()
+		<< " requests";
+
+	return 0;
+}
+
+/**
+ * \fn SessionRecording::cameraId()
+ * \brief Retrieve the ID of the recorded camera
+ * \return The camera ID
+ */
+
+/**
+ * \fn SessionRecording::streams()
+ * \brief Retrieve the recorded streams configuration
+ * \return The recorded streams
+ */
+
+/**
+ * \fn SessionRecording::controls()
+ * \brief Retrieve the controls of the recorded camera
+ * \return The camera controls
+ */
+
+/**
+ * \fn SessionRecording::properties()
+ * \brief Retrieve the properties of the recorded camera
+ * \return The camera properties
+ */
+
+/**
+ * \fn SessionRecording::requests()
+ * \brief Retrieve the recorded requests, in completion order
+ * \return The recorded requests
+ */
+
+/**
+ * \brief Retrieve the buffers of a recorded \a request
+ * \param[in] request The recorded request
+ * \return A pointer to the array of session::Request::buffers buffers
+ */
+const session::Buffer *SessionRecording::buffers(const session::Request *request) const
+{
+	return reinterpret_cast<const session::Buffer *>(request + 1);
+}
+
+/**
+ * \brief Deserialize the metadata of a recorded \a request
+ * \param[in] request The recorded request
+ * \return The request metadata
+ */
+ControlList SessionRecording::metadata(const session::Request *request)
+{
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(buffers(request) +
+								request->buffers);
+	ByteStreamBuffer buffer(data, request->metadataSize);
+
+	serializer_.reset();
+	return serializer_.deserialize<ControlList>(buffer);
+}
+
+/**
+ * \brief Retrieve the recorded content of a buffer plane
+ * \param[in] request The recorded request
+ * \param[in] plane The buffer plane
+ * \return The plane data, or an empty span if the plane data is invalid
+ */
+Span<const uint8_t> SessionRecording::data(const session::Request *request,
+					   const session::Plane &plane) const
+{
+	if (plane.offset + plane.bytesused > request->size)
+		return {};
+
+	return { reinterpret_cast<const uint8_t *>(request) + plane.offset,
+		 plane.bytesused };
+}
+
+} /* namespace libcamera */
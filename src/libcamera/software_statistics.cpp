@@ -0,0 +1,510 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * software_statistics.cpp - CPU-based image statistics
+ */
+
+#include "libcamera/internal/software_statistics.h"
+
+#include <algorithm>
+#include <map>
+#include <stdlib.h>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+
+/**
+ * \file software_statistics.h
+ * \brief CPU-based image statistics for pipelines without hardware statistics
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(SoftwareStats)
+
+namespace {
+
+/*
+ * Maximum number of samples per line and lines per frame. Larger images are
+ * subsampled, which keeps the processing time bounded without noticeably
+ * affecting the statistics.
+ */
+constexpr unsigned int kMaxSamples = 320;
+
+float toUnit(double value)
+{
+	return std::clamp(value / 255.0, 0.0, 1.0);
+}
+
+} /* namespace */
+
+/**
+ * \class SoftwareStatistics
+ * \brief Compute image statistics on the CPU
+ *
+ * Some pipelines, such as the ones based on UVC cameras or on simple capture
+ * devices, have no ISP statistics engine. The SoftwareStatistics class
+ * computes basic statistics on the CPU from the captured frames, to save
+ * applications from scanning the full frames themselves:
+ *
+ * - a luminance histogram (controls::draft::StatsLumaHistogram)
+ * - the mean red, green and blue values of the zones of a grid
+ *   (controls::draft::StatsZoneMeans)
+ * - a sharpness figure (controls::draft::StatsSharpness)
+ *
+ * Large frames are subsampled to at most kMaxSamples samples horizontally
+ * and vertically. The statistics are computed on a worker thread, with the
+ * sampled lines split in tiles processed in parallel by the TileProcessor, and
+ * reported through the statisticsReady signal, emitted in the thread the
+ * SoftwareStatistics instance belongs to, in the order the buffers have been
+ * queued.
+ *
+ * The buffers are only read, and can thus be completed to the application
+ * before their statistics are computed, as long as the request they belong to
+ * isn't completed.
+ */
+
+/**
+ * \var SoftwareStatistics::kHistogramBins
+ * \brief The number of bins of the luminance histogram
+ */
+
+/**
+ * \var SoftwareStatistics::kMaxGrid
+ * \brief The largest supported zone grid
+ */
+
+/**
+ * \var SoftwareStatistics::statisticsReady
+ * \brief Signal emitted when the statistics of a buffer have been computed
+ *
+ * The signal carries the buffer and a list of the statistics controls. The
+ * list is empty if the statistics couldn't be computed, or if the buffer has
+ * been cancelled by stop().
+ */
+
+const std::map<PixelFormat, SoftwareStatistics::FormatLayout> SoftwareStatistics::formatLayouts_ = {
+	{ formats::YUYV, { Layout::Packed422, { 0, 1, 3 }, 2 } },
+	{ formats::YVYU, { Layout::Packed422, { 0, 3, 1 }, 2 } },
+	{ formats::UYVY, { Layout::Packed422, { 1, 0, 2 }, 2 } },
+	{ formats::VYUY, { Layout::Packed422, { 1, 2, 0 }, 2 } },
+	{ formats::NV12, { Layout::SemiPlanar, { 0, 0, 1 }, 1 } },
+	{ formats::NV21, { Layout::SemiPlanar, { 0, 1, 0 }, 1 } },
+	{ formats::NV16, { Layout::SemiPlanar, { 0, 0, 1 }, 1 } },
+	{ formats::NV61, { Layout::SemiPlanar, { 0, 1, 0 }, 1 } },
+	{ formats::YUV420, { Layout::Planar, { 0, 0, 0 }, 1 } },
+	{ formats::YVU420, { Layout::Planar, { 0, 0, 0 }, 1 } },
+	{ formats::YUV422, { Layout::Planar, { 0, 0, 0 }, 1 } },
+	{ formats::RGB888, { Layout::RGB, { 2, 1, 0 }, 3 } },
+	{ formats::BGR888, { Layout::RGB, { 0, 1, 2 }, 3 } },
+	{ formats::XRGB8888, { Layout::RGB, { 2, 1, 0 }, 4 } },
+	{ formats::ARGB8888, { Layout::RGB, { 2, 1, 0 }, 4 } },
+	{ formats::XBGR8888, { Layout::RGB, { 0, 1, 2 }, 4 } },
+	{ formats::ABGR8888, { Layout::RGB, { 0, 1, 2 }, 4 } },
+	{ formats::RGBX8888, { Layout::RGB, { 3, 2, 1 }, 4 } },
+	{ formats::RGBA8888, { Layout::RGB, { 3, 2, 1 }, 4 } },
+	{ formats::BGRX8888, { Layout::RGB, { 1, 2, 3 }, 4 } },
+	{ formats::BGRA8888, { Layout::RGB, { 1, 2, 3 }, 4 } },
+};
+
+SoftwareStatistics::SoftwareStatistics()
+	: layout_(Layout::RGB), components_{}, bytesPerPixel_(1), step_(1),
+	  numPlanes_(0), running_(false)
+{
+}
+
+SoftwareStatistics::~SoftwareStatistics()
+{
+	stop();
+}
+
+/**
+ * \brief Check if statistics can be computed for a pixel format
+ * \param[in] pixelFormat The pixel format
+ * \return True if \a pixelFormat is supported, false otherwise
+ */
+bool SoftwareStatistics::isSupported(const PixelFormat &pixelFormat)
+{
+	return formatLayouts_.find(pixelFormat) != formatLayouts_.end();
+}
+
+/**
+ * \brief Configure the format of the frames
+ * \param[in] pixelFormat The pixel format
+ * \param[in] size The frame size
+ * \param[in] stride The stride of the first plane, in bytes
+ *
+ * The strides of the other planes, if any, are derived from \a stride.
+ *
+ * \return 0 on success, or -EINVAL if the format is not supported
+ */
+int SoftwareStatistics::configure(const PixelFormat &pixelFormat,
+				  const Size &size, unsigned int stride)
+{
+	auto it = formatLayouts_.find(pixelFormat);
+	if (it == formatLayouts_.end() || size.isNull()) {
+		LOG(SoftwareStats, Error)
+			<< "Unsupported format " << pixelFormat.toString();
+		return -EINVAL;
+	}
+
+	const FormatLayout &layout = it->second;
+	const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat);
+
+	size_ = size;
+	layout_ = layout.layout;
+	components_ = layout.components;
+	bytesPerPixel_ = layout.bytesPerPixel;
+
+	/* The chroma planes of planar formats are swapped for YVU. */
+	planes_ = { 0, 1, 2 };
+	if (pixelFormat == formats::YVU420)
+		planes_ = { 0, 2, 1 };
+
+	unsigned int offset = 0;
+	for (unsigned int i = 0; i < info.numPlanes(); ++i) {
+		strides_[i] = stride * info.planes[i].bytesPerGroup
+			    / info.planes[0].bytesPerGroup;
+		verticalSubSampling_[i] = info.planes[i].verticalSubSampling;
+		planeOffsets_[i] = offset;
+		planeSizes_[i] = info.planeSize(size.height, i, strides_[i]);
+		offset += planeSizes_[i];
+	}
+	numPlanes_ = info.numPlanes();
+
+	step_ = std::max((std::max(size.width, size.height) + kMaxSamples - 1)
+			 / kMaxSamples, 1U);
+	grid_ = {};
+
+	/* Process the sampled lines in tiles, in parallel. */
+	tiles_ = TileProcessor((size.height + step_ - 1) / step_, stride);
+
+	return 0;
+}
+
+/**
+ * \brief Start the worker thread
+ * \return 0 on success or a negative error code otherwise
+ */
+int SoftwareStatistics::start()
+{
+	if (running_)
+		return 0;
+
+	running_ = true;
+	thread_ = std::thread(&SoftwareStatistics::run, this);
+
+	return 0;
+}
+
+/**
+ * \brief Stop the worker thread
+ *
+ * Statistics that have been computed are reported, and the statisticsReady
+ * signal is emitted with an empty list of controls for all the other queued
+ * buffers, before this function returns.
+ */
+void SoftwareStatistics::stop()
+{
+	if (!thread_.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		running_ = false;
+	}
+	cv_.notify_all();
+
+	thread_.join();
+
+	std::deque<Job> jobs = std::move(jobs_);
+	jobs_.clear();
+
+	for (Job &job : jobs) {
+		if (!job.done)
+			job.statistics.clear();
+		statisticsReady.emit(job.buffer, job.statistics);
+	}
+}
+
+/**
+ * \brief Queue a buffer for statistics computation
+ * \param[in] buffer The buffer
+ * \param[in] grid The number of zones of the grid for the zone means
+ *
+ * The \a grid is clamped to kMaxGrid and to the number of samples.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int SoftwareStatistics::queueBuffer(FrameBuffer *buffer, const Size &grid)
+{
+	if (!running_)
+		return -EINVAL;
+
+	Size samples{ (size_.width + step_ - 1) / step_,
+		      (size_.height + step_ - 1) / step_ };
+	Size zones = grid.boundedTo(kMaxGrid).boundedTo(samples)
+			 .expandedTo({ 1, 1 });
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		jobs_.push_back({ buffer, zones, ControlList(controls::controls),
+				  false });
+	}
+	cv_.notify_one();
+
+	return 0;
+}
+
+void SoftwareStatistics::run()
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	while (true) {
+		auto nextJob = [this]() {
+			return std::find_if(jobs_.begin(), jobs_.end(),
+					    [](const Job &job) { return !job.done; });
+		};
+
+		cv_.wait(locker, [&] { return !running_ || nextJob() != jobs_.end(); });
+		if (!running_)
+			break;
+
+		/*
+		 * Only the completed jobs are removed from the queue while the
+		 * thread runs, the job can be accessed without the lock.
+		 */
+		Job &job = *nextJob();
+		locker.unlock();
+
+		compute(job);
+
+		locker.lock();
+		job.done = true;
+
+		if (&job == &jobs_.front())
+			invokeMethod(&SoftwareStatistics::jobDone,
+				     ConnectionTypeQueued);
+	}
+}
+
+void SoftwareStatistics::compute(Job &job)
+{
+	MappedFrameBuffer mapped(job.buffer, MappedFrameBuffer::MapFlag::Read);
+	if (!mapped.isValid()) {
+		LOG(SoftwareStats, Error) << "Failed to map buffer";
+		return;
+	}
+
+	/*
+	 * Locate the planes, either in separate buffer planes or contiguous
+	 * in the first one.
+	 */
+	const std::vector<Span<uint8_t>> &planes = mapped.planes();
+	std::array<const uint8_t *, 3> data{};
+
+	for (unsigned int i = 0; i < numPlanes_; ++i) {
+		Span<uint8_t> plane;
+		size_t offset = 0;
+
+		if (planes.size() >= numPlanes_) {
+			plane = planes[i];
+		} else {
+			plane = planes[0];
+			offset = planeOffsets_[i];
+		}
+
+		if (plane.size() < offset + planeSizes_[i]) {
+			LOG(SoftwareStats, Error) << "Buffer too small";
+			return;
+		}
+
+		data[i] = plane.data() + offset;
+	}
+
+	if (job.grid != grid_) {
+		grid_ = job.grid;
+
+		zoneColumns_.clear();
+		for (unsigned int x = 0; x < size_.width; x += step_)
+			zoneColumns_.push_back(x * grid_.width / size_.width);
+	}
+
+	unsigned int zones = grid_.width * grid_.height;
+
+	/*
+	 * Accumulate the statistics of each tile of sampled lines separately,
+	 * and reduce them once all the tiles have been processed.
+	 */
+	std::vector<Accumulator> accumulators(tiles_.tileCount());
+	for (Accumulator &acc : accumulators) {
+		acc.sums.resize(zones * 3);
+		acc.counts.resize(zones);
+	}
+
+	tiles_.run([&](const TileProcessor::Tile &tile) {
+		Accumulator *acc = &accumulators[tile.index];
+
+		for (unsigned int sample = tile.start; sample < tile.end; ++sample) {
+			unsigned int y = sample * step_;
+			std::array<const uint8_t *, 3> lines{};
+			for (unsigned int i = 0; i < numPlanes_; ++i)
+				lines[i] = data[planes_[i]] + y / verticalSubSampling_[planes_[i]]
+					 * strides_[planes_[i]];
+
+			unsigned int row = y * grid_.height / size_.height;
+
+			switch (layout_) {
+			case Layout::Packed422:
+				accumulateLine<Layout::Packed422>(lines, acc, row);
+				break;
+			case Layout::SemiPlanar:
+				accumulateLine<Layout::SemiPlanar>(lines, acc, row);
+				break;
+			case Layout::Planar:
+				accumulateLine<Layout::Planar>(lines, acc, row);
+				break;
+			case Layout::RGB:
+				accumulateLine<Layout::RGB>(lines, acc, row);
+				break;
+			}
+		}
+	});
+
+	Accumulator acc{};
+	acc.sums.resize(zones * 3);
+	acc.counts.resize(zones);
+
+	for (const Accumulator &tile : accumulators) {
+		for (unsigned int i = 0; i < kHistogramBins; ++i)
+			acc.histogram[i] += tile.histogram[i];
+		for (unsigned int i = 0; i < zones * 3; ++i)
+			acc.sums[i] += tile.sums[i];
+		for (unsigned int i = 0; i < zones; ++i)
+			acc.counts[i] += tile.counts[i];
+		acc.gradient += tile.gradient;
+		acc.gradientCount += tile.gradientCount;
+	}
+
+	/* Compute the means, converting them to RGB for YUV formats. */
+	std::vector<float> means(zones * 3);
+
+	for (unsigned int i = 0; i < zones; ++i) {
+		uint32_t count = std::max(acc.counts[i], 1U);
+		double c0 = static_cast<double>(acc.sums[i * 3]) / count;
+		double c1 = static_cast<double>(acc.sums[i * 3 + 1]) / count;
+		double c2 = static_cast<double>(acc.sums[i * 3 + 2]) / count;
+
+		if (layout_ == Layout::RGB) {
+			means[i * 3] = toUnit(c0);
+			means[i * 3 + 1] = toUnit(c1);
+			means[i * 3 + 2] = toUnit(c2);
+			continue;
+		}
+
+		double y = 1.164 * (c0 - 16.0);
+		double u = c1 - 128.0;
+		double v = c2 - 128.0;
+
+		means[i * 3] = toUnit(y + 1.596 * v);
+		means[i * 3 + 1] = toUnit(y - 0.392 * u - 0.813 * v);
+		means[i * 3 + 2] = toUnit(y + 2.017 * u);
+	}
+
+	float sharpness = acc.gradientCount
+			? static_cast<float>(acc.gradient) / acc.gradientCount / 255.0f
+			: 0.0f;
+
+	job.statistics.set(controls::draft::StatsLumaHistogram,
+			   Span<const int32_t>(acc.histogram));
+	job.statistics.set(controls::draft::StatsZoneMeans,
+			   Span<const float>(means));
+	job.statistics.set(controls::draft::StatsSharpness, sharpness);
+}
+
+/*
+ * Accumulate the statistics for one line of samples. The function is
+ * specialized for each layout to keep the per-sample work minimal.
+ */
+template<SoftwareStatistics::Layout L>
+void SoftwareStatistics::accumulateLine(const std::array<const uint8_t *, 3> &lines,
+					Accumulator *acc, unsigned int row) const
+{
+	uint64_t *sums = &acc->sums[row * grid_.width * 3];
+	uint32_t *counts = &acc->counts[row * grid_.width];
+	unsigned int prevLuma = 0;
+	uint64_t gradient = 0;
+
+	for (unsigned int i = 0, x = 0; x < size_.width; ++i, x += step_) {
+		unsigned int c0, c1, c2, luma;
+
+		if constexpr (L == Layout::Packed422) {
+			const uint8_t *group = lines[0] + (x / 2) * 4;
+			c0 = group[components_[0] + (x & 1) * 2];
+			c1 = group[components_[1]];
+			c2 = group[components_[2]];
+			luma = c0;
+		} else if constexpr (L == Layout::SemiPlanar) {
+			const uint8_t *chroma = lines[1] + (x / 2) * 2;
+			c0 = lines[0][x];
+			c1 = chroma[components_[1]];
+			c2 = chroma[components_[2]];
+			luma = c0;
+		} else if constexpr (L == Layout::Planar) {
+			c0 = lines[0][x];
+			c1 = lines[1][x / 2];
+			c2 = lines[2][x / 2];
+			luma = c0;
+		} else {
+			const uint8_t *pixel = lines[0] + x * bytesPerPixel_;
+			c0 = pixel[components_[0]];
+			c1 = pixel[components_[1]];
+			c2 = pixel[components_[2]];
+			luma = (77 * c0 + 150 * c1 + 29 * c2) >> 8;
+		}
+
+		acc->histogram[luma * kHistogramBins / 256]++;
+
+		unsigned int zone = zoneColumns_[i];
+		sums[zone * 3] += c0;
+		sums[zone * 3 + 1] += c1;
+		sums[zone * 3 + 2] += c2;
+		counts[zone]++;
+
+		if (i)
+			gradient += abs(static_cast<int>(luma) - static_cast<int>(prevLuma));
+		prevLuma = luma;
+	}
+
+	acc->gradient += gradient;
+	if (zoneColumns_.size() > 1)
+		acc->gradientCount += zoneColumns_.size() - 1;
+}
+
+void SoftwareStatistics::jobDone()
+{
+	/* Report the statistics at the front of the queue, in order. */
+	while (true) {
+		Job job;
+
+		{
+			std::lock_guard<std::mutex> locker(lock_);
+			if (jobs_.empty() || !jobs_.front().done)
+				break;
+
+			job = std::move(jobs_.front());
+			jobs_.pop_front();
+		}
+
+		statisticsReady.emit(job.buffer, job.statistics);
+	}
+}
+
+} /* namespace libcamera */
@@ -11,6 +11,7 @@
 #include <array>
 #include <iomanip>
 #include <limits.h>
+#include <mutex>
 #include <sstream>
 
 #include <libcamera/request.h>
@@ -83,10 +84,178 @@ LOG_DEFINE_CATEGORY(Stream)
  * size shall be considered to be supported until it has been verified using
  * CameraConfiguration::validate().
  *
- * \todo Review the usage patterns of this class, and cache the computed
- * pixelformats(), sizes() and range() if this would improve performances.
+ * Copying a StreamFormats is cheap, as all copies share the same formats
+ * table. The pixelformats() and range() results are computed once when the
+ * StreamFormats is constructed, and the sizes() generated from a range are
+ * computed the first time they are requested.
  */
 
+namespace {
+
+/*
+ * Sizes to try and extract from ranges.
+ * \todo Verify list of resolutions are good, current list compiled
+ * from v4l2 documentation and source code as well as lists of
+ * common frame sizes.
+ */
+const std::array<Size, 53> rangeDiscreteSizes = {
+	Size(160, 120),
+	Size(240, 160),
+	Size(320, 240),
+	Size(400, 240),
+	Size(480, 320),
+	Size(640, 360),
+	Size(640, 480),
+	Size(720, 480),
+	Size(720, 576),
+	Size(768, 480),
+	Size(800, 600),
+	Size(854, 480),
+	Size(960, 540),
+	Size(960, 640),
+	Size(1024, 576),
+	Size(1024, 600),
+	Size(1024, 768),
+	Size(1152, 864),
+	Size(1280, 1024),
+	Size(1280, 1080),
+	Size(1280, 720),
+	Size(1280, 800),
+	Size(1360, 768),
+	Size(1366, 768),
+	Size(1400, 1050),
+	Size(1440, 900),
+	Size(1536, 864),
+	Size(1600, 1200),
+	Size(1600, 900),
+	Size(1680, 1050),
+	Size(1920, 1080),
+	Size(1920, 1200),
+	Size(2048, 1080),
+	Size(2048, 1152),
+	Size(2048, 1536),
+	Size(2160, 1080),
+	Size(2560, 1080),
+	Size(2560, 1440),
+	Size(2560, 1600),
+	Size(2560, 2048),
+	Size(2960, 1440),
+	Size(3200, 1800),
+	Size(3200, 2048),
+	Size(3200, 2400),
+	Size(3440, 1440),
+	Size(3840, 1080),
+	Size(3840, 1600),
+	Size(3840, 2160),
+	Size(3840, 2400),
+	Size(4096, 2160),
+	Size(5120, 2160),
+	Size(5120, 2880),
+	Size(7680, 4320),
+};
+
+} /* namespace */
+
+/*
+ * The formats table is immutable once constructed and shared between all
+ * copies of a StreamFormats, which are made every time a StreamConfiguration
+ * is copied. Discrete sizes are stored as a sorted list of unique sizes, and
+ * only the continuous ranges are stored as SizeRange. The range covering all
+ * sizes is computed at construction time, while the list of discrete sizes
+ * generated from a continuous range is computed on first use.
+ */
+class StreamFormats::Formats
+{
+public:
+	struct Entry {
+		std::vector<Size> discrete;
+		std::vector<SizeRange> ranges;
+		SizeRange range;
+
+		mutable std::once_flag generatedOnce;
+		mutable std::vector<Size> generated;
+	};
+
+	Formats(const std::map<PixelFormat, std::vector<SizeRange>> &formats);
+
+	const Entry *find(const PixelFormat &pixelformat) const;
+	const std::vector<Size> &sizes(const Entry &entry) const;
+
+	std::vector<PixelFormat> pixelformats_;
+
+private:
+	std::map<PixelFormat, Entry> entries_;
+};
+
+StreamFormats::Formats::Formats(const std::map<PixelFormat, std::vector<SizeRange>> &formats)
+{
+	for (const auto &[pixelformat, ranges] : formats) {
+		Entry &entry = entries_[pixelformat];
+
+		for (const SizeRange &range : ranges) {
+			if (range.min == range.max)
+				entry.discrete.push_back(range.min);
+			else
+				entry.ranges.push_back(range);
+		}
+
+		std::sort(entry.discrete.begin(), entry.discrete.end());
+		entry.discrete.erase(std::unique(entry.discrete.begin(),
+						 entry.discrete.end()),
+				     entry.discrete.end());
+
+		if (ranges.size() == 1) {
+			entry.range = ranges[0];
+		} else if (!ranges.empty()) {
+			SizeRange &range = entry.range;
+			range = SizeRange({ UINT_MAX, UINT_MAX }, { 0, 0 }, 0, 0);
+
+			for (const SizeRange &limit : ranges) {
+				if (limit.min < range.min)
+					range.min = limit.min;
+
+				if (limit.max > range.max)
+					range.max = limit.max;
+			}
+		}
+
+		pixelformats_.push_back(pixelformat);
+	}
+}
+
+const StreamFormats::Formats::Entry *
+StreamFormats::Formats::find(const PixelFormat &pixelformat) const
+{
+	auto it = entries_.find(pixelformat);
+	if (it == entries_.end())
+		return nullptr;
+
+	return &it->second;
+}
+
+const std::vector<Size> &StreamFormats::Formats::sizes(const Entry &entry) const
+{
+	if (entry.ranges.empty())
+		return entry.discrete;
+
+	std::call_once(entry.generatedOnce, [&entry]() {
+		if (entry.ranges.size() != 1 || !entry.discrete.empty()) {
+			LOG(Stream, Error) << "Range format is ambiguous";
+			return;
+		}
+
+		const SizeRange &limit = entry.ranges.front();
+
+		for (const Size &size : rangeDiscreteSizes)
+			if (limit.contains(size))
+				entry.generated.push_back(size);
+
+		std::sort(entry.generated.begin(), entry.generated.end());
+	});
+
+	return entry.generated;
+}
+
 StreamFormats::StreamFormats()
 {
 }
@@ -94,9 +263,14 @@ StreamFormats::StreamFormats()
 /**
  * \brief Construct a StreamFormats object with a map of image formats
  * \param[in] formats A map of pixel formats to a sizes description
+ *
+ * The formats are stored in an immutable table shared by all copies of the
+ * StreamFormats. Pipeline handlers should construct the StreamFormats once
+ * per camera and reuse it for all the configurations they generate, instead
+ * of constructing it from their formats map at every call.
  */
 StreamFormats::StreamFormats(const std::map<PixelFormat, std::vector<SizeRange>> &formats)
-	: formats_(formats)
+	: formats_(std::make_shared<const Formats>(formats))
 {
 }
 
@@ -106,12 +280,10 @@ StreamFormats::StreamFormats(const std::map<PixelFormat, std::vector<SizeRange>>
  */
 std::vector<PixelFormat> StreamFormats::pixelformats() const
 {
-	std::vector<PixelFormat> formats;
-
-	for (auto const &it : formats_)
-		formats.push_back(it.first);
+	if (!formats_)
+		return {};
 
-	return formats;
+	return formats_->pixelformats_;
 }
 
 /**
@@ -130,103 +302,15 @@ std::vector<PixelFormat> StreamFormats::pixelformats() const
  */
 std::vector<Size> StreamFormats::sizes(const PixelFormat &pixelformat) const
 {
-	/*
-	 * Sizes to try and extract from ranges.
-	 * \todo Verify list of resolutions are good, current list compiled
-	 * from v4l2 documentation and source code as well as lists of
-	 * common frame sizes.
-	 */
-	static const std::array<Size, 53> rangeDiscreteSizes = {
-		Size(160, 120),
-		Size(240, 160),
-		Size(320, 240),
-		Size(400, 240),
-		Size(480, 320),
-		Size(640, 360),
-		Size(640, 480),
-		Size(720, 480),
-		Size(720, 576),
-		Size(768, 480),
-		Size(800, 600),
-		Size(854, 480),
-		Size(960, 540),
-		Size(960, 640),
-		Size(1024, 576),
-		Size(1024, 600),
-		Size(1024, 768),
-		Size(1152, 864),
-		Size(1280, 1024),
-		Size(1280, 1080),
-		Size(1280, 720),
-		Size(1280, 800),
-		Size(1360, 768),
-		Size(1366, 768),
-		Size(1400, 1050),
-		Size(1440, 900),
-		Size(1536, 864),
-		Size(1600, 1200),
-		Size(1600, 900),
-		Size(1680, 1050),
-		Size(1920, 1080),
-		Size(1920, 1200),
-		Size(2048, 1080),
-		Size(2048, 1152),
-		Size(2048, 1536),
-		Size(2160, 1080),
-		Size(2560, 1080),
-		Size(2560, 1440),
-		Size(2560, 1600),
-		Size(2560, 2048),
-		Size(2960, 1440),
-		Size(3200, 1800),
-		Size(3200, 2048),
-		Size(3200, 2400),
-		Size(3440, 1440),
-		Size(3840, 1080),
-		Size(3840, 1600),
-		Size(3840, 2160),
-		Size(3840, 2400),
-		Size(4096, 2160),
-		Size(5120, 2160),
-		Size(5120, 2880),
-		Size(7680, 4320),
-	};
-	std::vector<Size> sizes;
+	if (!formats_)
+		return {};
 
 	/* Make sure pixel format exists. */
-	auto const &it = formats_.find(pixelformat);
-	if (it == formats_.end())
+	const Formats::Entry *entry = formats_->find(pixelformat);
+	if (!entry)
 		return {};
 
-	/* Try creating a list of discrete sizes. */
-	const std::vector<SizeRange> &ranges = it->second;
-	bool discrete = true;
-	for (const SizeRange &range : ranges) {
-		if (range.min != range.max) {
-			discrete = false;
-			break;
-		}
-		sizes.emplace_back(range.min);
-	}
-
-	/* If discrete not possible generate from range. */
-	if (!discrete) {
-		if (ranges.size() != 1) {
-			LOG(Stream, Error) << "Range format is ambiguous";
-			return {};
-		}
-
-		const SizeRange &limit = ranges.front();
-		sizes.clear();
-
-		for (const Size &size : rangeDiscreteSizes)
-			if (limit.contains(size))
-				sizes.push_back(size);
-	}
-
-	std::sort(sizes.begin(), sizes.end());
-
-	return sizes;
+	return formats_->sizes(*entry);
 }
 
 /**
@@ -243,28 +327,14 @@ std::vector<Size> StreamFormats::sizes(const PixelFormat &pixelformat) const
  */
 SizeRange StreamFormats::range(const PixelFormat &pixelformat) const
 {
-	auto const it = formats_.find(pixelformat);
-	if (it == formats_.end())
+	if (!formats_)
 		return {};
 
-	const std::vector<SizeRange> &ranges = it->second;
-	if (ranges.size() == 1)
-		return ranges[0];
-
-	LOG(Stream, Debug) << "Building range from discrete sizes";
-	SizeRange range({ UINT_MAX, UINT_MAX }, { 0, 0 });
-	for (const SizeRange &limit : ranges) {
-		if (limit.min < range.min)
-			range.min = limit.min;
-
-		if (limit.max > range.max)
-			range.max = limit.max;
-	}
-
-	range.hStep = 0;
-	range.vStep = 0;
+	const Formats::Entry *entry = formats_->find(pixelformat);
+	if (!entry)
+		return {};
 
-	return range;
+	return entry->range;
 }
 
 /**
@@ -281,7 +351,7 @@ SizeRange StreamFormats::range(const PixelFormat &pixelformat) const
  */
 StreamConfiguration::StreamConfiguration()
 	: pixelFormat(0), stride(0), frameSize(0), bufferCount(0),
-	  stream_(nullptr)
+	  strideAlign(0), heightAlign(0), planeAlign(0), stream_(nullptr)
 {
 }
 
@@ -290,7 +360,8 @@ StreamConfiguration::StreamConfiguration()
  */
 StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
 	: pixelFormat(0), stride(0), frameSize(0), bufferCount(0),
-	  stream_(nullptr), formats_(formats)
+	  strideAlign(0), heightAlign(0), planeAlign(0), stream_(nullptr),
+	  formats_(formats)
 {
 }
 
@@ -329,6 +400,44 @@ StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
  * \brief Requested number of buffers to allocate for the stream
  */
 
+/**
+ * \var StreamConfiguration::strideAlign
+ * \brief Alignment of the image stride requested by the application, in bytes
+ *
+ * Applications that pass buffers to other devices, such as encoders or GPUs,
+ * can set buffer layout constraints to make the buffers directly consumable
+ * by those devices without an intermediate copy. The strideAlign, heightAlign
+ * and planeAlign constraints are honoured by CameraConfiguration::validate()
+ * when computing the stride and frameSize of the stream, and by the buffers
+ * allocated by FrameBufferAllocator from a dma-heap.
+ *
+ * Constraints that the pipeline handler can't honour are reset to 0 by
+ * CameraConfiguration::validate(), which then returns
+ * CameraConfiguration::Adjusted.
+ *
+ * The stride of all planes of the buffer is a multiple of strideAlign when
+ * set. A value of 0 sets no constraint.
+ */
+
+/**
+ * \var StreamConfiguration::heightAlign
+ * \brief Alignment of the image height requested by the application, in lines
+ *
+ * When set, the planes of the buffer are sized to store a number of lines
+ * that is a multiple of heightAlign, padding the planes after the last line
+ * of the image. A value of 0 sets no constraint. See strideAlign for more
+ * information about buffer layout constraints.
+ */
+
+/**
+ * \var StreamConfiguration::planeAlign
+ * \brief Alignment of the offset of the planes in the buffer, in bytes
+ *
+ * When set, the offset of every plane from the beginning of the buffer memory
+ * is a multiple of planeAlign. A value of 0 sets no constraint. See
+ * strideAlign for more information about buffer layout constraints.
+ */
+
 /**
  * \fn StreamConfiguration::stream()
  * \brief Retrieve the stream associated with the configuration
@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * sync_group.cpp - Match requests across synchronised cameras
+ */
+
+#include <libcamera/sync_group.h>
+
+#include <algorithm>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+
+/**
+ * \file sync_group.h
+ * \brief Match requests across synchronised cameras
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(SyncGroup)
+
+/**
+ * \class SyncGroup
+ * \brief Group the requests of multiple cameras capturing the same instant
+ *
+ * Stereo and multi-view systems run multiple cameras whose sensors are
+ * synchronised, either by a hardware trigger or by starting them at the same
+ * time with the same frame rate. The SyncGroup matches the requests completed
+ * by those cameras by the timestamp at which their frames started exposing,
+ * and reports them together through the \ref groupCompleted signal.
+ *
+ * The start of exposure of a request is taken from its
+ * controls::SensorTimestamp metadata, or from the timestamp of its first
+ * buffer if the pipeline handler doesn't report it. Requests captured by all
+ * cameras within the group tolerance of each other are grouped. Requests that
+ * can't be matched, because a camera dropped the corresponding frame or
+ * because the request has been cancelled, are reported through the
+ * \ref requestUnmatched signal.
+ *
+ * The group matches requests as they complete, in the thread that emits the
+ * Camera::requestCompleted signal, and emits its signals from the same thread.
+ * Only pointers to the requests are stored, no data is copied. Applications
+ * should connect to the group signals instead of the Camera::requestCompleted
+ * signal of the cameras in the group.
+ *
+ * The SyncGroup doesn't configure the sensors for synchronised capture, there
+ * is no standard interface to do so. Applications are responsible for setting
+ * the cameras to the same frame rate, and for configuring hardware
+ * synchronisation through device-specific means where available.
+ */
+
+/**
+ * \brief Create a sync group for a set of cameras
+ * \param[in] cameras The cameras to synchronise
+ * \param[in] tolerance The maximum difference between the timestamps of the
+ * requests in a group
+ *
+ * The tolerance should be smaller than half the frame duration, to avoid
+ * matching consecutive frames of different cameras.
+ */
+SyncGroup::SyncGroup(const std::vector<std::shared_ptr<Camera>> &cameras,
+		     std::chrono::nanoseconds tolerance)
+	: cameras_(cameras), tolerance_(tolerance), queues_(cameras.size())
+{
+	for (unsigned int i = 0; i < cameras_.size(); ++i)
+		cameras_[i]->requestCompleted.connect(this, [this, i](Request *request) {
+			requestCompleted(i, request);
+		});
+}
+
+SyncGroup::~SyncGroup()
+{
+	for (std::shared_ptr<Camera> &camera : cameras_)
+		camera->requestCompleted.disconnect(this);
+}
+
+/**
+ * \fn SyncGroup::cameras()
+ * \brief Retrieve the cameras in the group
+ * \return The cameras in the group
+ */
+
+/**
+ * \fn SyncGroup::tolerance()
+ * \brief Retrieve the maximum timestamp difference between grouped requests
+ * \return The group tolerance
+ */
+
+/**
+ * \brief Report all the requests waiting to be matched as unmatched
+ *
+ * Requests are held by the group until a request from every camera can be
+ * matched with them. This function is meant to be called after stopping the
+ * cameras, to return requests that can't be matched anymore, through the
+ * \ref requestUnmatched signal.
+ */
+void SyncGroup::flush()
+{
+	std::vector<Request *> unmatched;
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+
+		for (std::deque<Entry> &queue : queues_) {
+			for (const Entry &entry : queue)
+				unmatched.push_back(entry.request);
+
+			queue.clear();
+		}
+	}
+
+	for (Request *request : unmatched)
+		requestUnmatched.emit(request);
+}
+
+/**
+ * \var SyncGroup::groupCompleted
+ * \brief Signal emitted when a request has completed on all cameras
+ *
+ * The requests are passed in the order of the cameras in the group.
+ */
+
+/**
+ * \var SyncGroup::requestUnmatched
+ * \brief Signal emitted for requests that can't be matched with other cameras
+ */
+
+void SyncGroup::requestCompleted(unsigned int index, Request *request)
+{
+	std::vector<std::vector<Request *>> groups;
+	std::vector<Request *> unmatched;
+
+	uint64_t timestamp = 0;
+	if (request->metadata().contains(controls::SensorTimestamp))
+		timestamp = request->metadata().get(controls::SensorTimestamp);
+	else if (!request->buffers().empty())
+		timestamp = request->buffers().begin()->second->metadata().timestamp;
+
+	if (request->status() != Request::RequestComplete || !timestamp) {
+		requestUnmatched.emit(request);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+
+		queues_[index].push_back({ request, timestamp });
+		match(&groups, &unmatched);
+	}
+
+	/* Emit the signals without holding the lock, slots may call flush(). */
+	for (Request *req : unmatched)
+		requestUnmatched.emit(req);
+
+	for (const std::vector<Request *> &group : groups)
+		groupCompleted.emit(group);
+}
+
+void SyncGroup::match(std::vector<std::vector<Request *>> *groups,
+		      std::vector<Request *> *unmatched)
+{
+	uint64_t tolerance = tolerance_.count();
+
+	/*
+	 * Requests complete in order on each camera. Compare the oldest
+	 * request of every camera: if they're all within the tolerance they
+	 * form a group, otherwise the oldest one can't match any request from
+	 * the camera with the newest timestamp, and is discarded.
+	 */
+	while (std::none_of(queues_.begin(), queues_.end(),
+			    [](const std::deque<Entry> &queue) { return queue.empty(); })) {
+		auto [min, max] = std::minmax_element(queues_.begin(), queues_.end(),
+						      [](const std::deque<Entry> &a,
+							 const std::deque<Entry> &b) {
+							      return a.front().timestamp < b.front().timestamp;
+						      });
+
+		if (max->front().timestamp - min->front().timestamp > tolerance) {
+			LOG(SyncGroup, Debug)
+				<< "Request with timestamp " << min->front().timestamp
+				<< " can't be matched";
+
+			unmatched->push_back(min->front().request);
+			min->pop_front();
+			continue;
+		}
+
+		std::vector<Request *> group;
+		group.reserve(queues_.size());
+
+		for (std::deque<Entry> &queue : queues_) {
+			group.push_back(queue.front().request);
+			queue.pop_front();
+		}
+
+		groups->push_back(std::move(group));
+	}
+}
+
+} /* namespace libcamera */
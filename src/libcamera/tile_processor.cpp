@@ -0,0 +1,347 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * tile_processor.cpp - Parallel tile-based processing of images on the CPU
+ */
+
+#include "libcamera/internal/tile_processor.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include <libcamera/base/global_configuration.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+/**
+ * \file tile_processor.h
+ * \brief Parallel tile-based processing of images on the CPU
+ */
+
+/**
+ * \def LIBCAMERA_TARGET_CLONES
+ * \brief Compile a function for multiple instruction sets
+ *
+ * Functions marked with this macro are compiled for the baseline instruction
+ * set and for AVX2 on x86-64, and the best version supported by the CPU is
+ * selected when the library is loaded. Per-pixel kernels of the software
+ * image stages should be written as plain loops the compiler can vectorize,
+ * and marked with this macro. The macro expands to nothing on other platforms.
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(TileProcessor)
+
+namespace {
+
+/*
+ * Target amount of data accessed when processing a tile, sized to fit in the
+ * L2 cache of most CPUs along with the data of the other processing stages.
+ */
+constexpr unsigned int kTileBytes = 256 * 1024;
+
+constexpr unsigned int kMaxWorkers = 16;
+
+class TileWorkerPool
+{
+public:
+	struct Job {
+		Span<const TileProcessor::Operation> operations;
+		unsigned int rows;
+		unsigned int tileRows;
+		unsigned int count;
+		unsigned int next;
+		unsigned int pending;
+	};
+
+	static TileWorkerPool &instance();
+
+	unsigned int size() const { return workers_.size(); }
+
+	void run(Job *job);
+
+private:
+	TileWorkerPool();
+	~TileWorkerPool();
+
+	static void execute(const Job &job, unsigned int index);
+	void processTile(std::unique_lock<std::mutex> &locker, Job *job);
+	void worker();
+
+	std::vector<std::thread> workers_;
+
+	std::mutex lock_;
+	std::condition_variable cv_;
+	std::condition_variable doneCv_;
+	std::deque<Job *> jobs_;
+	bool quit_;
+};
+
+TileWorkerPool &TileWorkerPool::instance()
+{
+	static TileWorkerPool pool;
+	return pool;
+}
+
+TileWorkerPool::TileWorkerPool()
+	: quit_(false)
+{
+	/* The threads calling TileProcessor::run() process tiles too. */
+	unsigned int workers = std::clamp(std::thread::hardware_concurrency(),
+					  1U, kMaxWorkers + 1) - 1;
+
+	const char *threads = GlobalConfiguration::option("LIBCAMERA_TILE_THREADS");
+	if (threads && *threads) {
+		char *end;
+		unsigned long value = strtoul(threads, &end, 10);
+		if (*end != '\0' || !value) {
+			LOG(TileProcessor, Warning)
+				<< "Invalid tile thread count '" << threads << "'";
+		} else {
+			workers = std::min<unsigned long>(value, kMaxWorkers + 1) - 1;
+		}
+	}
+
+	for (unsigned int i = 0; i < workers; ++i)
+		workers_.emplace_back(&TileWorkerPool::worker, this);
+
+	LOG(TileProcessor, Debug)
+		<< "Processing tiles with " << workers << " worker threads";
+}
+
+TileWorkerPool::~TileWorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		quit_ = true;
+	}
+	cv_.notify_all();
+
+	for (std::thread &worker : workers_)
+		worker.join();
+}
+
+void TileWorkerPool::run(Job *job)
+{
+	if (workers_.empty() || job->count == 1) {
+		for (unsigned int index = 0; index < job->count; ++index)
+			execute(*job, index);
+		return;
+	}
+
+	std::unique_lock<std::mutex> locker(lock_);
+
+	jobs_.push_back(job);
+	cv_.notify_all();
+
+	/* Process the tiles of the job in the calling thread too. */
+	while (job->next < job->count)
+		processTile(locker, job);
+
+	doneCv_.wait(locker, [&] { return !job->pending; });
+}
+
+/* Run all the operations on a tile, while its data is in the cache. */
+void TileWorkerPool::execute(const Job &job, unsigned int index)
+{
+	const TileProcessor::Tile tile{
+		index,
+		index * job.tileRows,
+		std::min((index + 1) * job.tileRows, job.rows),
+	};
+
+	for (const TileProcessor::Operation &operation : job.operations)
+		operation(tile);
+}
+
+/*
+ * Process the next tile of a job. The caller shall hold the lock_, and the job
+ * shall have tiles left to process.
+ */
+void TileWorkerPool::processTile(std::unique_lock<std::mutex> &locker, Job *job)
+{
+	unsigned int index = job->next++;
+	if (job->next == job->count)
+		jobs_.erase(std::find(jobs_.begin(), jobs_.end(), job));
+
+	locker.unlock();
+	execute(*job, index);
+	locker.lock();
+
+	if (!--job->pending)
+		doneCv_.notify_all();
+}
+
+void TileWorkerPool::worker()
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	while (true) {
+		cv_.wait(locker, [&] { return quit_ || !jobs_.empty(); });
+		if (quit_)
+			return;
+
+		processTile(locker, jobs_.front());
+	}
+}
+
+} /* namespace */
+
+/**
+ * \class TileProcessor
+ * \brief Split image processing in tiles processed in parallel
+ *
+ * The software image processing stages, such as format converters and
+ * statistics engines, process frames line by line. The TileProcessor class
+ * provides them with a common way to spread that work across CPUs, without
+ * each of them managing its own threads.
+ *
+ * An image is split in tiles of consecutive rows, sized so that the data
+ * accessed while processing a tile fits in the CPU cache. The tiles are
+ * processed by a pool of worker threads shared by all the users of the class
+ * in the process, and by the thread that calls run(). The total number of
+ * threads processing tiles defaults to the number of CPUs, and can be set with
+ * the LIBCAMERA_TILE_THREADS option.
+ *
+ * run() accepts multiple operations, which are all applied to a tile before
+ * moving to the next one. Stages that make multiple passes over an image,
+ * for instance to compute statistics and convert the format, should run them
+ * together to read the image from memory once. Operations that accumulate
+ * results should store them per tile, indexed by Tile::index, and reduce them
+ * once run() returns, to avoid synchronization between the threads.
+ *
+ * The TileProcessor instance only stores the tile geometry. It can be copied,
+ * and its run() function can be called from multiple threads concurrently.
+ */
+
+/**
+ * \struct TileProcessor::Tile
+ * \brief A tile of consecutive rows of an image
+ *
+ * \var TileProcessor::Tile::index
+ * \brief The tile index, in the [0, tileCount()[ range
+ *
+ * \var TileProcessor::Tile::start
+ * \brief The first row of the tile
+ *
+ * \var TileProcessor::Tile::end
+ * \brief The row following the last row of the tile
+ */
+
+/**
+ * \typedef TileProcessor::Operation
+ * \brief An operation applied to a tile
+ *
+ * Operations are called concurrently from different threads for different
+ * tiles, and shall thus not modify data shared between tiles.
+ */
+
+/**
+ * \brief Construct a TileProcessor for an empty image
+ */
+TileProcessor::TileProcessor()
+	: rows_(0), tileRows_(1), tileCount_(0)
+{
+}
+
+/**
+ * \brief Construct a TileProcessor for an image
+ * \param[in] rows The number of rows of the image
+ * \param[in] rowBytes The number of bytes accessed to process one row
+ * \param[in] alignment The alignment of the tile boundaries, in rows
+ *
+ * The \a rowBytes should include the data read and written by all the
+ * operations that will be run together, in all the planes. The \a alignment
+ * allows keeping tiles aligned to the vertical subsampling of the image or to
+ * its colour filter pattern.
+ */
+TileProcessor::TileProcessor(unsigned int rows, unsigned int rowBytes,
+			     unsigned int alignment)
+	: rows_(rows)
+{
+	alignment = std::max(alignment, 1U);
+
+	/*
+	 * Size the tiles to fit in the cache, but give each thread at least
+	 * one tile to process.
+	 */
+	unsigned int tileRows = kTileBytes / std::max(rowBytes, 1U);
+	tileRows = std::min(tileRows, (rows + concurrency() - 1) / concurrency());
+
+	tileRows_ = utils::alignUp(std::max(tileRows, 1U), alignment);
+	tileCount_ = (rows + tileRows_ - 1) / tileRows_;
+}
+
+/**
+ * \fn TileProcessor::rows()
+ * \brief Retrieve the number of rows of the image
+ * \return The number of rows
+ */
+
+/**
+ * \fn TileProcessor::tileRows()
+ * \brief Retrieve the number of rows of the tiles
+ *
+ * All tiles have the same number of rows, except the last one that may be
+ * smaller.
+ *
+ * \return The number of rows of the tiles
+ */
+
+/**
+ * \fn TileProcessor::tileCount()
+ * \brief Retrieve the number of tiles
+ * \return The number of tiles
+ */
+
+/**
+ * \brief Run operations on all the tiles of the image
+ * \param[in] operations The operations
+ *
+ * The \a operations are applied in order to each tile, and the tiles are
+ * processed in parallel in no specific order. This function returns when all
+ * the tiles have been processed.
+ *
+ * \context This function is \threadsafe.
+ */
+void TileProcessor::run(Span<const Operation> operations) const
+{
+	if (!tileCount_ || operations.empty())
+		return;
+
+	TileWorkerPool::Job job{ operations, rows_, tileRows_, tileCount_,
+				 0, tileCount_ };
+	TileWorkerPool::instance().run(&job);
+}
+
+/**
+ * \brief Run an operation on all the tiles of the image
+ * \param[in] operation The operation
+ *
+ * \context This function is \threadsafe.
+ */
+void TileProcessor::run(const Operation &operation) const
+{
+	run(Span<const Operation>(&operation, 1));
+}
+
+/**
+ * \brief Retrieve the number of threads that process tiles concurrently
+ *
+ * The number includes the worker threads and the thread calling run().
+ *
+ * \return The number of threads
+ */
+unsigned int TileProcessor::concurrency()
+{
+	return TileWorkerPool::instance().size() + 1;
+}
+
+} /* namespace libcamera */
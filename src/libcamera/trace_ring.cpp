@@ -0,0 +1,317 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * trace_ring.cpp - Built-in binary trace ring buffer
+ */
+
+#include "libcamera/internal/trace_ring.h"
+
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include <libcamera/base/global_configuration.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/utils.h>
+
+/**
+ * \file trace_ring.h
+ * \brief Built-in binary trace ring buffer
+ *
+ * The trace ring records a small set of events on the capture path, with a
+ * nanosecond timestamp, without depending on an external tracing framework.
+ * It complements the LTTng tracepoints for systems where LTTng can't be
+ * deployed.
+ *
+ * Tracing is enabled by setting the LIBCAMERA_TRACE_RING environment variable
+ * to the path of the file the trace is written to. Events are then recorded in
+ * a ring buffer per thread, which holds the most recent events only. The rings
+ * are written to the file when the process exits, and can be converted to the
+ * Chrome trace format, for viewing in Perfetto, with the
+ * utils/tracepoints/trace-ring-to-chrome.py script.
+ *
+ * Recording an event when tracing is disabled costs a single test of a
+ * boolean. When enabled, each thread writes to its own ring without any lock.
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(TraceRing)
+
+namespace {
+
+/* Number of events kept per thread, must be a power of two. */
+constexpr unsigned int kRingSize = 8192;
+
+/*
+ * The trace file starts with a header, followed by the rings and the string
+ * table. Each ring is made of its thread id, the length and characters of the
+ * thread name, the number of events and the events. The string table is made
+ * of the number of strings, followed by the length and characters of each
+ * string. All values are stored in native byte order.
+ */
+constexpr char kTraceMagic[8] = { 'L', 'C', 'T', 'R', 'A', 'C', 'E', '\0' };
+constexpr uint32_t kTraceVersion = 1;
+
+struct TraceEntry {
+	uint64_t timestamp;
+	uint32_t event;
+	uint32_t reserved;
+	uint64_t arg0;
+	uint64_t arg1;
+};
+
+struct Ring {
+	pid_t tid;
+	std::string name;
+	std::atomic<uint64_t> head{ 0 };
+	std::array<TraceEntry, kRingSize> entries;
+};
+
+class Tracer
+{
+public:
+	Tracer();
+
+	bool enabled() const { return !path_.empty(); }
+
+	Ring *ring();
+	void dump();
+
+private:
+
+	std::string path_;
+
+	std::mutex mutex_;
+	std::vector<std::unique_ptr<Ring>> rings_;
+};
+
+Tracer &tracer();
+
+Tracer::Tracer()
+{
+	const char *path = GlobalConfiguration::option("LIBCAMERA_TRACE_RING");
+	if (!path || !*path)
+		return;
+
+	path_ = path;
+	atexit([]() { tracer().dump(); });
+}
+
+Ring *Tracer::ring()
+{
+	thread_local Ring *ring = nullptr;
+	if (ring)
+		return ring;
+
+	std::unique_ptr<Ring> newRing = std::make_unique<Ring>();
+	newRing->tid = Thread::currentId();
+
+	char name[16] = {};
+	if (!pthread_getname_np(pthread_self(), name, sizeof(name)))
+		newRing->name = name;
+
+	ring = newRing.get();
+
+	std::lock_guard<std::mutex> locker(mutex_);
+	rings_.push_back(std::move(newRing));
+
+	return ring;
+}
+
+void writeValue(std::ofstream &file, uint32_t value)
+{
+	file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void writeString(std::ofstream &file, const std::string &str)
+{
+	writeValue(file, str.size());
+	file.write(str.data(), str.size());
+}
+
+void Tracer::dump()
+{
+	std::ofstream file(path_, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		LOG(TraceRing, Error) << "Failed to open trace file " << path_;
+		return;
+	}
+
+	file.write(kTraceMagic, sizeof(kTraceMagic));
+	writeValue(file, kTraceVersion);
+
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	std::map<uint64_t, uint32_t> strings;
+	std::vector<TraceEntry> entries;
+
+	writeValue(file, rings_.size());
+
+	for (const std::unique_ptr<Ring> &ring : rings_) {
+		/*
+		 * Threads may still be running, the most recent events could
+		 * thus be incomplete. This is acceptable for diagnostics.
+		 */
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		uint64_t tail = head > kRingSize ? head - kRingSize : 0;
+
+		entries.clear();
+		for (uint64_t i = tail; i < head; i++) {
+			TraceEntry entry = ring->entries[i % kRingSize];
+
+			/*
+			 * The IPA call events reference a string literal,
+			 * replace the pointer by an index in the string table.
+			 */
+			if (entry.event == TraceRing::IpaCallBegin ||
+			    entry.event == TraceRing::IpaCallEnd)
+				entry.arg0 = strings.emplace(entry.arg0, strings.size())
+						     .first->second;
+
+			entries.push_back(entry);
+		}
+
+		writeValue(file, ring->tid);
+		writeString(file, ring->name);
+		writeValue(file, entries.size());
+		file.write(reinterpret_cast<const char *>(entries.data()),
+			   entries.size() * sizeof(TraceEntry));
+	}
+
+	std::vector<const char *> table(strings.size());
+	for (const auto &[ptr, index] : strings)
+		table[index] = reinterpret_cast<const char *>(ptr);
+
+	writeValue(file, table.size());
+	for (const char *str : table)
+		writeString(file, str);
+
+	LOG(TraceRing, Info) << "Trace written to " << path_;
+}
+
+Tracer &tracer()
+{
+	/*
+	 * The tracer is never destroyed, as other threads may still record
+	 * events while the process exits.
+	 */
+	static Tracer *tracer = new Tracer();
+	return *tracer;
+}
+
+} /* namespace */
+
+/**
+ * \class TraceRing
+ * \brief Record events in the built-in trace ring buffer
+ *
+ * The TraceRing class only exposes static functions to record events. The
+ * event arguments are stored verbatim, their meaning depends on the event.
+ */
+
+/**
+ * \enum TraceRing::Event
+ * \brief The events recorded in the trace ring
+ *
+ * \var TraceRing::RequestQueue
+ * \brief A request is queued to the pipeline handler, with the request
+ * pointer and cookie as arguments
+ *
+ * \var TraceRing::RequestComplete
+ * \brief A request completes, with the request pointer and status as arguments
+ *
+ * \var TraceRing::BufferQueue
+ * \brief A buffer is queued to a video device, with the buffer pointer and
+ * V4L2 buffer index as arguments
+ *
+ * \var TraceRing::BufferDequeue
+ * \brief A buffer is dequeued from a video device, with the buffer pointer and
+ * frame sequence number as arguments
+ *
+ * \var TraceRing::IpaCallBegin
+ * \brief An IPA proxy function is entered, with a string literal naming the
+ * function as argument
+ *
+ * \var TraceRing::IpaCallEnd
+ * \brief An IPA proxy function returns, with a string literal naming the
+ * function as argument
+ *
+ * \var TraceRing::FrameStart
+ * \brief A frame start event is received from a V4L2 device, with the frame
+ * sequence number as argument
+ */
+
+/**
+ * \class TraceRing::Scope
+ * \brief Record an IPA call begin and end event for the lifetime of the object
+ *
+ * The \a name given to the constructor shall be a string literal, as it is
+ * only dereferenced when the trace is written.
+ */
+
+/**
+ * \fn TraceRing::Scope::Scope()
+ * \brief Record an IpaCallBegin event
+ * \param[in] name The name of the IPA function
+ */
+
+/**
+ * \fn TraceRing::Scope::~Scope()
+ * \brief Record an IpaCallEnd event
+ */
+
+/**
+ * \brief Check if the trace ring is enabled
+ * \return True if events are recorded, false otherwise
+ */
+bool TraceRing::enabled()
+{
+	static const bool enabled = tracer().enabled();
+	return enabled;
+}
+
+/**
+ * \fn TraceRing::record(Event event, uint64_t arg0, uint64_t arg1)
+ * \brief Record an event in the calling thread's ring
+ * \param[in] event The event
+ * \param[in] arg0 The first event argument
+ * \param[in] arg1 The second event argument
+ */
+
+/**
+ * \fn TraceRing::record(Event event, const void *arg0, uint64_t arg1)
+ * \copydoc TraceRing::record(Event event, uint64_t arg0, uint64_t arg1)
+ */
+
+void TraceRing::write(Event event, uint64_t arg0, uint64_t arg1)
+{
+	Ring *ring = tracer().ring();
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	/* Only the owner thread writes to the ring, no atomic RMW is needed. */
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	TraceEntry &entry = ring->entries[head % kRingSize];
+	entry.timestamp = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	entry.event = event;
+	entry.reserved = 0;
+	entry.arg0 = arg0;
+	entry.arg1 = arg1;
+
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+} /* namespace libcamera */
@@ -20,7 +20,10 @@
 #include <libcamera/base/log.h>
 #include <libcamera/base/utils.h>
 
+#include "libcamera/internal/media_request.h"
 #include "libcamera/internal/sysfs.h"
+#include "libcamera/internal/trace_ring.h"
+#include "libcamera/internal/tracepoints.h"
 
 /**
  * \file v4l2_device.h
@@ -91,8 +94,6 @@ int V4L2Device::open(unsigned int flags)
 
 	setFd(ret);
 
-	listControls();
-
 	return 0;
 }
 
@@ -108,7 +109,8 @@ int V4L2Device::open(unsigned int flags)
  * itself.
  *
  * This function and the open() function are mutually exclusive, only one of the
- * two shall be used for a V4L2Device instance.
+ * two shall be used for a V4L2Device instance. In both cases the controls
+ * exposed by the device are enumerated and made available through controls().
  *
  * \return 0 on success or a negative error code otherwise
  */
@@ -123,6 +125,8 @@ int V4L2Device::setFd(int fd)
 	fdEventNotifier_->activated.connect(this, &V4L2Device::eventAvailable);
 	fdEventNotifier_->setEnabled(false);
 
+	listControls();
+
 	return 0;
 }
 
@@ -255,11 +259,16 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
 /**
  * \brief Write controls to the device
  * \param[in] ctrls The list of controls to write
+ * \param[in] request The media request to store the controls in, if any
  *
  * This function writes the value of all controls contained in \a ctrls, and
  * stores the values actually applied to the device in the corresponding
  * \a ctrls entry.
  *
+ * If \a request is not null, the controls are not applied immediately, but
+ * stored in the media \a request. They are then applied by the kernel when the
+ * request is processed, atomically with the buffers of the request.
+ *
  * If any control in \a ctrls is not supported by the device, is disabled (i.e.
  * has the V4L2_CTRL_FLAG_DISABLED flag set), is read-only, if any other error
  * occurs during validation of the requested controls, no control is written and
@@ -274,7 +283,7 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
  * \retval -EINVAL One of the control is not supported or not accessible
  * \retval i The index of the control that failed
  */
-int V4L2Device::setControls(ControlList *ctrls)
+int V4L2Device::setControls(ControlList *ctrls, const MediaRequest *request)
 {
 	if (ctrls->empty())
 		return 0;
@@ -323,7 +332,12 @@ int V4L2Device::setControls(ControlList *ctrls)
 	}
 
 	struct v4l2_ext_controls v4l2ExtCtrls = {};
-	v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	if (request) {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+		v4l2ExtCtrls.request_fd = request->fd();
+	} else {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	}
 	v4l2ExtCtrls.controls = v4l2Ctrls.data();
 	v4l2ExtCtrls.count = v4l2Ctrls.size();
 
@@ -611,7 +625,7 @@ void V4L2Device::listControls()
 				 << " (" << utils::hex(ctrl.id) << ")";
 
 		controlIds_.emplace_back(v4l2ControlId(ctrl));
-		controlIdMap_[ctrl.id] = controlIds_.back().get();
+		controlIdMap_.set(ctrl.id, controlIds_.back().get());
 		controlInfo_.emplace(ctrl.id, ctrl);
 
 		ctrls.emplace(controlIds_.back().get(), v4l2ControlInfo(ctrl));
@@ -728,6 +742,10 @@ void V4L2Device::eventAvailable()
 		return;
 	}
 
+	TraceRing::record(TraceRing::FrameStart, event.u.frame_sync.frame_sequence);
+	LIBCAMERA_TRACEPOINT(pipeline_frame_start, deviceNode_.c_str(),
+			     event.u.frame_sync.frame_sequence);
+
 	frameStart.emit(event.u.frame_sync.frame_sequence);
 }
 
@@ -225,7 +225,8 @@ uint8_t V4L2SubdeviceFormat::bitsPerPixel() const
 
 /**
  * \enum V4L2Subdevice::Whence
- * \brief Specify the type of format for getFormat() and setFormat() operations
+ * \brief Specify the type of format for getFormat(), setFormat() and
+ * setSelection() operations
  * \var V4L2Subdevice::ActiveFormat
  * \brief The format operation applies to ACTIVE formats
  * \var V4L2Subdevice::TryFormat
@@ -302,17 +303,23 @@ int V4L2Subdevice::getSelection(unsigned int pad, unsigned int target,
  * \param[in] pad The 0-indexed pad number the rectangle is to be applied to
  * \param[in] target The selection target defined by the V4L2_SEL_TGT_* flags
  * \param[inout] rect The selection rectangle to be applied
+ * \param[in] whence The selection to set, \ref V4L2Subdevice::ActiveFormat
+ * "ActiveFormat" or \ref V4L2Subdevice::TryFormat "TryFormat"
+ *
+ * Failures to set a TRY selection are only logged at the debug level, as TRY
+ * operations are typically used to probe the capabilities of the subdevice.
  *
  * \todo Define a V4L2SelectionTarget enum for the selection target
  *
  * \return 0 on success or a negative error code otherwise
  */
 int V4L2Subdevice::setSelection(unsigned int pad, unsigned int target,
-				Rectangle *rect)
+				Rectangle *rect, Whence whence)
 {
 	struct v4l2_subdev_selection sel = {};
 
-	sel.which = V4L2_SUBDEV_FORMAT_ACTIVE;
+	sel.which = whence == ActiveFormat ? V4L2_SUBDEV_FORMAT_ACTIVE
+		  : V4L2_SUBDEV_FORMAT_TRY;
 	sel.pad = pad;
 	sel.target = target;
 	sel.flags = 0;
@@ -324,9 +331,14 @@ int V4L2Subdevice::setSelection(unsigned int pad, unsigned int target,
 
 	int ret = ioctl(VIDIOC_SUBDEV_S_SELECTION, &sel);
 	if (ret < 0) {
-		LOG(V4L2, Error)
-			<< "Unable to set rectangle " << target << " on pad "
-			<< pad << ": " << strerror(-ret);
+		if (whence == ActiveFormat)
+			LOG(V4L2, Error)
+				<< "Unable to set rectangle " << target
+				<< " on pad " << pad << ": " << strerror(-ret);
+		else
+			LOG(V4L2, Debug)
+				<< "Unable to set TRY rectangle " << target
+				<< " on pad " << pad << ": " << strerror(-ret);
 		return ret;
 	}
 
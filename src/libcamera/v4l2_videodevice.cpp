@@ -11,6 +11,7 @@
 #include <array>
 #include <fcntl.h>
 #include <iomanip>
+#include <numeric>
 #include <sstream>
 #include <string.h>
 #include <sys/ioctl.h>
@@ -26,11 +27,15 @@
 #include <libcamera/base/utils.h>
 
 #include <libcamera/file_descriptor.h>
+#include <libcamera/stream.h>
 
 #include "libcamera/internal/formats.h"
 #include "libcamera/internal/framebuffer.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/media_object.h"
+#include "libcamera/internal/media_request.h"
+#include "libcamera/internal/metrics.h"
+#include "libcamera/internal/trace_ring.h"
 
 /**
  * \file v4l2_videodevice.h
@@ -162,6 +167,29 @@ LOG_DECLARE_CATEGORY(V4L2)
  * index associations to help selecting V4L2 buffers. It tracks, for every
  * entry, if the V4L2 buffer is in use, and offers lookup of the best free V4L2
  * buffer for a set of dmabufs.
+ *
+ * Entries are indexed by a hash of the dmabuf file descriptors and lengths of
+ * the buffer planes, and free entries are kept in least recently used order.
+ * Both cache hits and selection of the entry to evict on a cache miss are thus
+ * performed in constant time, regardless of the number of entries.
+ *
+ * When buffers are imported from a pool larger than the number of V4L2
+ * buffers, the least recently used entry is always evicted and nearly every
+ * lookup misses. The cache detects this condition, reported by thrashing(),
+ * and can be grown with grow() once more V4L2 buffers have been created.
+ */
+
+/**
+ * \struct V4L2BufferCache::Stats
+ * \brief Cache usage statistics
+ *
+ * \var V4L2BufferCache::Stats::hits
+ * \brief Number of lookups that found a free V4L2 buffer previously used with
+ * the same dmabufs
+ *
+ * \var V4L2BufferCache::Stats::misses
+ * \brief Number of lookups that required associating new dmabufs with a V4L2
+ * buffer, or failed due to no free V4L2 buffer being available
  */
 
 /**
@@ -173,9 +201,9 @@ LOG_DECLARE_CATEGORY(V4L2)
  * buffer import, with buffers added to the cache as they are queued.
  */
 V4L2BufferCache::V4L2BufferCache(unsigned int numEntries)
-	: lastUsedCounter_(1), missCounter_(0)
+	: stats_{}, windowLookups_(0), windowMisses_(0), thrashing_(false)
 {
-	cache_.resize(numEntries);
+	init(numEntries);
 }
 
 /**
@@ -187,18 +215,24 @@ V4L2BufferCache::V4L2BufferCache(unsigned int numEntries)
  * allocated.
  */
 V4L2BufferCache::V4L2BufferCache(const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
-	: lastUsedCounter_(1), missCounter_(0)
+	: stats_{}, windowLookups_(0), windowMisses_(0), thrashing_(false)
 {
-	for (const std::unique_ptr<FrameBuffer> &buffer : buffers)
-		cache_.emplace_back(true,
-				    lastUsedCounter_.fetch_add(1, std::memory_order_acq_rel),
-				    *buffer.get());
+	init(buffers.size());
+
+	for (unsigned int index = 0; index < buffers.size(); index++) {
+		std::size_t key = hash(*buffers[index]);
+
+		cache_[index].assign(*buffers[index], key);
+		index_[key] = index;
+	}
 }
 
 V4L2BufferCache::~V4L2BufferCache()
 {
-	if (missCounter_ > cache_.size())
-		LOG(V4L2, Debug) << "Cache misses: " << missCounter_;
+	if (stats_.misses > cache_.size())
+		LOG(V4L2, Debug)
+			<< "Cache hits: " << stats_.hits
+			<< ", misses: " << stats_.misses;
 }
 
 /**
@@ -208,48 +242,53 @@ V4L2BufferCache::~V4L2BufferCache()
  * Find the best V4L2 buffer index to be used for the FrameBuffer \a buffer
  * based on previous mappings of frame buffers to V4L2 buffers. If a free V4L2
  * buffer previously used with the same dmabufs as \a buffer is found in the
- * cache, return its index. Otherwise return the index of the first free V4L2
- * buffer and record its association with the dmabufs of \a buffer.
+ * cache, return its index. Otherwise return the index of the least recently
+ * used free V4L2 buffer and record its association with the dmabufs of
+ * \a buffer.
  *
  * \return The index of the best V4L2 buffer, or -ENOENT if no free V4L2 buffer
  * is available
  */
 int V4L2BufferCache::get(const FrameBuffer &buffer)
 {
-	bool hit = false;
-	int use = -1;
-	uint64_t oldest = UINT64_MAX;
+	std::size_t key = hash(buffer);
 
-	for (unsigned int index = 0; index < cache_.size(); index++) {
-		const Entry &entry = cache_[index];
+	auto it = index_.find(key);
+	if (it != index_.end()) {
+		unsigned int index = it->second;
+		Entry &entry = cache_[index];
 
-		if (!entry.free_)
-			continue;
+		if (entry.free_ && entry == buffer) {
+			stats_.hits++;
+			account(true);
 
-		/* Try to find a cache hit by comparing the planes. */
-		if (entry == buffer) {
-			hit = true;
-			use = index;
-			break;
-		}
+			usedList_.splice(usedList_.end(), freeList_, entry.lru_);
+			entry.free_ = false;
 
-		if (entry.lastUsed_ < oldest) {
-			use = index;
-			oldest = entry.lastUsed_;
+			return index;
 		}
 	}
 
-	if (!hit)
-		missCounter_++;
+	stats_.misses++;
+	account(false);
 
-	if (use < 0)
+	if (freeList_.empty())
 		return -ENOENT;
 
-	cache_[use] = Entry(false,
-			    lastUsedCounter_.fetch_add(1, std::memory_order_acq_rel),
-			    buffer);
+	unsigned int index = freeList_.front();
+	Entry &entry = cache_[index];
 
-	return use;
+	/* Drop the association of the evicted entry with its old dmabufs. */
+	it = index_.find(entry.hash_);
+	if (it != index_.end() && it->second == index)
+		index_.erase(it);
+
+	usedList_.splice(usedList_.end(), freeList_, entry.lru_);
+	entry.free_ = false;
+	entry.assign(buffer, key);
+	index_[key] = index;
+
+	return index;
 }
 
 /**
@@ -259,17 +298,113 @@ int V4L2BufferCache::get(const FrameBuffer &buffer)
 void V4L2BufferCache::put(unsigned int index)
 {
 	ASSERT(index < cache_.size());
-	cache_[index].free_ = true;
+
+	Entry &entry = cache_[index];
+	if (entry.free_)
+		return;
+
+	freeList_.splice(freeList_.end(), usedList_, entry.lru_);
+	entry.free_ = true;
+}
+
+/**
+ * \fn V4L2BufferCache::size()
+ * \brief Retrieve the number of entries in the cache
+ * \return The number of entries in the cache
+ */
+
+/**
+ * \brief Grow the cache to \a numEntries entries
+ * \param[in] numEntries The new number of entries
+ *
+ * The new entries are marked as unused, and are picked first by the next cache
+ * misses. Existing associations are preserved. The thrashing state is reset.
+ * Shrinking the cache isn't supported, the function does nothing if
+ * \a numEntries is not larger than the current size.
+ */
+void V4L2BufferCache::grow(unsigned int numEntries)
+{
+	unsigned int size = cache_.size();
+	if (numEntries <= size)
+		return;
+
+	cache_.resize(numEntries);
+	index_.reserve(numEntries);
+
+	for (unsigned int index = size; index < numEntries; index++)
+		cache_[index].lru_ = freeList_.insert(freeList_.begin(), index);
+
+	windowLookups_ = 0;
+	windowMisses_ = 0;
+	thrashing_ = false;
+}
+
+/**
+ * \fn V4L2BufferCache::thrashing()
+ * \brief Check if the cache is too small for the buffers being looked up
+ *
+ * Lookups are accounted over windows of twice the cache size. The cache is
+ * considered to be thrashing when more than three quarters of the lookups in
+ * the last complete window missed, which means that the buffers rotate
+ * through more dmabufs than there are entries in the cache. The first use of
+ * every buffer misses, the threshold leaves room for the cache to be
+ * populated.
+ *
+ * \return True if the cache is thrashing, false otherwise
+ */
+
+/**
+ * \fn V4L2BufferCache::stats()
+ * \brief Retrieve the cache usage statistics
+ * \return The cache hit and miss counters
+ */
+
+void V4L2BufferCache::init(unsigned int numEntries)
+{
+	cache_.resize(numEntries);
+	index_.reserve(numEntries);
+
+	for (unsigned int index = 0; index < numEntries; index++)
+		cache_[index].lru_ = freeList_.insert(freeList_.end(), index);
+}
+
+void V4L2BufferCache::account(bool hit)
+{
+	windowLookups_++;
+	if (!hit)
+		windowMisses_++;
+
+	if (windowLookups_ < 2 * cache_.size())
+		return;
+
+	thrashing_ = windowMisses_ * 4 > windowLookups_ * 3;
+	windowLookups_ = 0;
+	windowMisses_ = 0;
+}
+
+std::size_t V4L2BufferCache::hash(const FrameBuffer &buffer)
+{
+	std::size_t key = 0;
+
+	for (const FrameBuffer::Plane &plane : buffer.planes()) {
+		std::size_t value = std::hash<int>{}(plane.fd.fd()) ^
+				    (std::hash<unsigned int>{}(plane.length) << 1);
+		key ^= value + 0x9e3779b9 + (key << 6) + (key >> 2);
+	}
+
+	return key;
 }
 
 V4L2BufferCache::Entry::Entry()
-	: free_(true), lastUsed_(0)
+	: free_(true), hash_(0)
 {
 }
 
-V4L2BufferCache::Entry::Entry(bool free, uint64_t lastUsed, const FrameBuffer &buffer)
-	: free_(free), lastUsed_(lastUsed)
+void V4L2BufferCache::Entry::assign(const FrameBuffer &buffer, std::size_t key)
 {
+	hash_ = key;
+
+	planes_.clear();
 	for (const FrameBuffer::Plane &plane : buffer.planes())
 		planes_.emplace_back(plane);
 }
@@ -398,6 +533,145 @@ bool V4L2BufferCache::Entry::operator==(const FrameBuffer &buffer) const
  * \brief The number of valid data planes
  */
 
+/**
+ * \brief Apply the buffer layout constraints of a stream configuration
+ * \param[in] cfg The stream configuration
+ *
+ * Set the line stride and size of the format planes to the smallest values
+ * that satisfy the StreamConfiguration::strideAlign and
+ * StreamConfiguration::heightAlign constraints of \a cfg, for the format
+ * fourcc and size. This function shall be called before trying or setting the
+ * format on the video device, which may adjust the values, and
+ * adjustConstraints() shall be called afterwards to check if the constraints
+ * have been honoured.
+ */
+void V4L2DeviceFormat::applyConstraints(const StreamConfiguration &cfg)
+{
+	if (!cfg.strideAlign && !cfg.heightAlign)
+		return;
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(fourcc);
+	if (!info.isValid())
+		return;
+
+	unsigned int stride = info.stride(size.width, 0,
+					  std::max(cfg.strideAlign, 1U));
+	unsigned int height = utils::alignUp(size.height,
+					     std::max(cfg.heightAlign, 1U));
+
+	if (info.numPlanes() > 1 && fourcc == info.v4l2Formats.multi) {
+		planesCount = info.numPlanes();
+		for (unsigned int i = 0; i < planesCount; ++i) {
+			planes[i].bpl = stride * info.planes[i].bytesPerGroup
+				      / info.planes[0].bytesPerGroup;
+			planes[i].size = info.planeSize(height, i, planes[i].bpl);
+		}
+
+		return;
+	}
+
+	/*
+	 * All planes are stored in a single memory plane, padding can only be
+	 * added after the last one.
+	 */
+	planesCount = 1;
+	planes[0].bpl = stride;
+	planes[0].size = 0;
+
+	for (unsigned int i = 0; i < info.numPlanes(); ++i) {
+		unsigned int planeStride = stride * info.planes[i].bytesPerGroup
+					 / info.planes[0].bytesPerGroup;
+		bool last = i == info.numPlanes() - 1;
+		planes[0].size += info.planeSize(last ? height : size.height,
+						 i, planeStride);
+	}
+}
+
+/**
+ * \brief Reset the buffer layout constraints that the format doesn't honour
+ * \param[in] cfg The stream configuration
+ *
+ * Check the format, as returned by the video device, against the buffer layout
+ * constraints of \a cfg, and reset to 0 the constraints that are not met. The
+ * plane offset and height constraints can only be met for formats that store
+ * multiple planes in a single memory plane if no padding is needed, as V4L2
+ * has no way to express padding between the planes.
+ *
+ * \return True if any constraint has been reset, false otherwise
+ */
+bool V4L2DeviceFormat::adjustConstraints(StreamConfiguration *cfg) const
+{
+	if (!cfg->strideAlign && !cfg->heightAlign && !cfg->planeAlign)
+		return false;
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(fourcc);
+	bool contiguous = planesCount == 1 && info.numPlanes() > 1;
+	bool adjusted = false;
+
+	if (cfg->strideAlign) {
+		bool aligned = info.isValid();
+		for (unsigned int i = 0; i < planesCount; ++i) {
+			if (planes[i].bpl % cfg->strideAlign)
+				aligned = false;
+		}
+
+		if (!aligned) {
+			LOG(V4L2, Debug)
+				<< "Stride " << planes[0].bpl
+				<< " not aligned to " << cfg->strideAlign;
+			cfg->strideAlign = 0;
+			adjusted = true;
+		}
+	}
+
+	if (cfg->heightAlign) {
+		unsigned int height = utils::alignUp(size.height, cfg->heightAlign);
+		bool aligned = info.isValid();
+
+		if (contiguous) {
+			aligned = aligned && height == size.height;
+		} else {
+			for (unsigned int i = 0; i < planesCount; ++i) {
+				if (planes[i].size < info.planeSize(height, i, planes[i].bpl))
+					aligned = false;
+			}
+		}
+
+		if (!aligned) {
+			LOG(V4L2, Debug)
+				<< "Height " << size.height << " can't be aligned to "
+				<< cfg->heightAlign;
+			cfg->heightAlign = 0;
+			adjusted = true;
+		}
+	}
+
+	if (cfg->planeAlign) {
+		bool aligned = info.isValid();
+
+		if (contiguous) {
+			unsigned int offset = 0;
+			for (unsigned int i = 0; i < info.numPlanes() - 1; ++i) {
+				unsigned int stride = planes[0].bpl
+						    * info.planes[i].bytesPerGroup
+						    / info.planes[0].bytesPerGroup;
+				offset += info.planeSize(size.height, i, stride);
+				if (offset % cfg->planeAlign)
+					aligned = false;
+			}
+		}
+
+		if (!aligned) {
+			LOG(V4L2, Debug)
+				<< "Plane offsets not aligned to " << cfg->planeAlign;
+			cfg->planeAlign = 0;
+			adjusted = true;
+		}
+	}
+
+	return adjusted;
+}
+
 /**
  * \brief Assemble and return a string describing the format
  * \return A string describing the V4L2DeviceFormat
@@ -486,13 +760,43 @@ const std::string V4L2DeviceFormat::toString() const
  * \brief A map of supported V4L2 pixel formats to frame sizes
  */
 
+struct V4L2VideoDevice::Metrics {
+	Metrics(const std::string &deviceNode)
+		: buffersQueued("libcamera_v4l2_buffers_queued_total",
+				"Buffers queued to the video device",
+				Metric::label("device", deviceNode)),
+		  buffersDequeued("libcamera_v4l2_buffers_dequeued_total",
+				  "Buffers dequeued from the video device",
+				  Metric::label("device", deviceNode)),
+		  bufferErrors("libcamera_v4l2_buffer_errors_total",
+			       "Buffers dequeued with the error flag set",
+			       Metric::label("device", deviceNode)),
+		  cacheMisses("libcamera_v4l2_buffer_cache_misses_total",
+			      "Queued buffers not matching their cached V4L2 buffer",
+			      Metric::label("device", deviceNode)),
+		  queueDepth("libcamera_v4l2_queued_buffers",
+			     "Buffers currently queued to the video device",
+			     Metric::label("device", deviceNode))
+	{
+	}
+
+	MetricCounter buffersQueued;
+	MetricCounter buffersDequeued;
+	MetricCounter bufferErrors;
+	MetricCounter cacheMisses;
+	MetricGauge queueDepth;
+};
+
 /**
  * \brief Construct a V4L2VideoDevice
  * \param[in] deviceNode The file-system path to the video device node
  */
 V4L2VideoDevice::V4L2VideoDevice(const std::string &deviceNode)
 	: V4L2Device(deviceNode), formatInfo_(nullptr), cache_(nullptr),
-	  fdBufferNotifier_(nullptr), streaming_(false)
+	  cacheGrowable_(false), fdBufferNotifier_(nullptr), streaming_(false),
+	  batchedDequeue_(false), supportsRequests_(false),
+	  supportsCacheHints_(false), cacheHint_(CacheHint::CpuReadWrite),
+	  metrics_(std::make_unique<Metrics>(deviceNode))
 {
 	/*
 	 * We default to an MMAP based CAPTURE video device, however this will
@@ -1112,6 +1416,102 @@ std::vector<SizeRange> V4L2VideoDevice::enumSizes(V4L2PixelFormat pixelFormat)
 	return sizes;
 }
 
+static utils::Duration fractionToDuration(const struct v4l2_fract &fract)
+{
+	return std::chrono::nanoseconds(static_cast<uint64_t>(fract.numerator) *
+					1000000000 / std::max(fract.denominator, 1U));
+}
+
+/**
+ * \brief Enumerate the frame intervals supported for a format
+ * \param[in] pixelFormat The pixel format
+ * \param[in] size The frame size
+ *
+ * Enumerate the frame intervals supported by the video device for the
+ * \a pixelFormat and \a size. Devices that support a continuous or stepwise
+ * range of intervals report the minimum and maximum intervals of the range
+ * only.
+ *
+ * \return The frame intervals sorted from the shortest to the longest, or an
+ * empty list if the device doesn't support frame interval enumeration
+ */
+std::vector<utils::Duration>
+V4L2VideoDevice::frameIntervals(V4L2PixelFormat pixelFormat, const Size &size)
+{
+	std::vector<utils::Duration> intervals;
+	int ret;
+
+	for (unsigned int index = 0;; index++) {
+		struct v4l2_frmivalenum frameInterval = {};
+		frameInterval.index = index;
+		frameInterval.pixel_format = pixelFormat;
+		frameInterval.width = size.width;
+		frameInterval.height = size.height;
+
+		ret = ioctl(VIDIOC_ENUM_FRAMEINTERVALS, &frameInterval);
+		if (ret)
+			break;
+
+		if (frameInterval.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+			intervals.push_back(fractionToDuration(frameInterval.discrete));
+			continue;
+		}
+
+		intervals.push_back(fractionToDuration(frameInterval.stepwise.min));
+		intervals.push_back(fractionToDuration(frameInterval.stepwise.max));
+		break;
+	}
+
+	if (ret && ret != -EINVAL && ret != -ENOTTY) {
+		LOG(V4L2, Error)
+			<< "Unable to enumerate frame intervals: "
+			<< strerror(-ret);
+		return {};
+	}
+
+	std::sort(intervals.begin(), intervals.end());
+
+	return intervals;
+}
+
+/**
+ * \brief Set the frame interval
+ * \param[inout] interval The frame interval
+ *
+ * Set the interval between frames captured by the device to the \a interval,
+ * and update it with the interval selected by the device, which may differ.
+ *
+ * \return 0 on success or a negative error code otherwise, -ENOTSUP if the
+ * device doesn't support setting the frame interval
+ */
+int V4L2VideoDevice::setFrameInterval(utils::Duration *interval)
+{
+	struct v4l2_streamparm parm = {};
+	parm.type = bufferType_;
+
+	int ret = ioctl(VIDIOC_G_PARM, &parm);
+	if (ret < 0 || !(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
+		return -ENOTSUP;
+
+	uint32_t numerator = std::chrono::duration_cast<std::chrono::nanoseconds>(*interval).count();
+	uint32_t denominator = 1000000000;
+	uint32_t divisor = std::gcd(numerator, denominator);
+
+	parm.parm.capture.timeperframe.numerator = numerator / divisor;
+	parm.parm.capture.timeperframe.denominator = denominator / divisor;
+
+	ret = ioctl(VIDIOC_S_PARM, &parm);
+	if (ret < 0) {
+		LOG(V4L2, Error)
+			<< "Unable to set frame interval: " << strerror(-ret);
+		return ret;
+	}
+
+	*interval = fractionToDuration(parm.parm.capture.timeperframe);
+
+	return 0;
+}
+
 /**
  * \brief Set a selection rectangle \a rect for \a target
  * \param[in] target The selection target defined by the V4L2_SEL_TGT_* flags
@@ -1174,6 +1574,9 @@ int V4L2VideoDevice::requestBuffers(unsigned int count,
 		return -ENOMEM;
 	}
 
+	supportsRequests_ = rb.capabilities & V4L2_BUF_CAP_SUPPORTS_REQUESTS;
+	supportsCacheHints_ = rb.capabilities & V4L2_BUF_CAP_SUPPORTS_MMAP_CACHE_HINTS;
+
 	LOG(V4L2, Debug) << rb.count << " buffers requested.";
 
 	return 0;
@@ -1382,7 +1785,7 @@ std::unique_ptr<FrameBuffer> V4L2VideoDevice::createBuffer(unsigned int index)
 		}
 	}
 
-	return std::make_unique<FrameBuffer>(planes);
+	return std::make_unique<FrameBuffer>(std::move(planes));
 }
 
 FileDescriptor V4L2VideoDevice::exportDmabufFd(unsigned int index,
@@ -1418,6 +1821,12 @@ FileDescriptor V4L2VideoDevice::exportDmabufFd(unsigned int index,
  * calls. The buffers to be imported are provided to queueBuffer(), and may be
  * supplied externally, or come from a previous exportBuffers() call.
  *
+ * If the buffers queued rotate through more dmabufs than \a count, every
+ * queueBuffer() call would remap dmabufs in the kernel. When this is detected,
+ * additional V4L2 buffers are created with VIDIOC_CREATE_BUFS, up to
+ * VIDEO_MAX_FRAME. If the driver doesn't support creating buffers, a warning
+ * reports the number of buffers that should be imported instead.
+ *
  * Device initialization performed by this function shall later be cleaned up
  * with releaseBuffers(). If buffers have already been allocated with
  * allocateBuffers() or imported with importBuffers(), this function returns
@@ -1440,12 +1849,52 @@ int V4L2VideoDevice::importBuffers(unsigned int count)
 		return ret;
 
 	cache_ = new V4L2BufferCache(count);
+	cacheGrowable_ = true;
 
 	LOG(V4L2, Debug) << "Prepared to import " << count << " buffers";
 
 	return 0;
 }
 
+/*
+ * Create additional V4L2 buffers for import when the buffer cache thrashes,
+ * doubling the number of buffers.
+ */
+void V4L2VideoDevice::growImportedBuffers()
+{
+	unsigned int current = cache_->size();
+	unsigned int count = std::min<unsigned int>(current * 2, VIDEO_MAX_FRAME);
+
+	struct v4l2_create_buffers create = {};
+	create.count = count - current;
+	create.memory = V4L2_MEMORY_DMABUF;
+	create.format.type = bufferType_;
+
+	int ret = create.count ? ioctl(VIDIOC_G_FMT, &create.format) : -ENOSPC;
+	if (!ret)
+		ret = ioctl(VIDIOC_CREATE_BUFS, &create);
+	if (!ret && create.index != current)
+		ret = -EINVAL;
+
+	if (ret < 0 || !create.count) {
+		/* Report the problem once, and stop trying. */
+		LOG(V4L2, Warning)
+			<< "Imported buffers rotate through more than "
+			<< current << " V4L2 buffers, "
+			<< (ret == -ENOSPC ? "use fewer buffers"
+					   : "import at least " + std::to_string(count) + " buffers")
+			<< " to avoid remapping dmabufs on every frame";
+		cacheGrowable_ = false;
+		return;
+	}
+
+	cache_->grow(create.index + create.count);
+
+	LOG(V4L2, Debug)
+		<< "Imported buffers cache thrashing, grew from " << current
+		<< " to " << cache_->size() << " buffers";
+}
+
 /**
  * \brief Release resources allocated by allocateBuffers() or importBuffers()
  *
@@ -1460,25 +1909,89 @@ int V4L2VideoDevice::releaseBuffers()
 
 	delete cache_;
 	cache_ = nullptr;
+	cacheGrowable_ = false;
 
 	return requestBuffers(0, memoryType_);
 }
 
+/**
+ * \fn V4L2VideoDevice::supportsRequests()
+ * \brief Check if the video device supports queueing buffers to media requests
+ *
+ * The information is only available once buffers have been allocated or
+ * imported.
+ *
+ * \return True if buffers can be queued to a MediaRequest, false otherwise
+ */
+
+/**
+ * \enum V4L2VideoDevice::CacheHint
+ * \brief How the CPU accesses the content of the buffers queued to the device
+ *
+ * The video device performs cache maintenance operations on buffers when they
+ * are queued and dequeued, to keep the CPU and device views of their content
+ * coherent. When the CPU doesn't read or write some of the buffers, part or all
+ * of those operations are unnecessary, and can be skipped by the device if it
+ * supports cache hints.
+ *
+ * \var V4L2VideoDevice::CacheHint::CpuReadWrite
+ * \brief The CPU reads and writes the buffers content
+ * \var V4L2VideoDevice::CacheHint::CpuRead
+ * \brief The CPU only reads the buffers content, the cache doesn't need to be
+ * cleaned when queueing buffers
+ * \var V4L2VideoDevice::CacheHint::CpuWrite
+ * \brief The CPU only writes the buffers content, the cache doesn't need to be
+ * invalidated when dequeuing buffers
+ * \var V4L2VideoDevice::CacheHint::DeviceOnly
+ * \brief The CPU doesn't access the buffers content, no cache maintenance is
+ * needed
+ */
+
+/**
+ * \fn V4L2VideoDevice::supportsCacheHints()
+ * \brief Check if the video device supports cache hints
+ *
+ * The information is only available once buffers have been allocated or
+ * imported.
+ *
+ * \return True if the device honours cache hints for MMAP buffers, false
+ * otherwise
+ */
+
+/**
+ * \fn V4L2VideoDevice::setCacheHint()
+ * \brief Set the cache hint applied to buffers queued to the device
+ * \param[in] hint The cache hint
+ *
+ * The hint is translated to the V4L2_BUF_FLAG_NO_CACHE_CLEAN and
+ * V4L2_BUF_FLAG_NO_CACHE_INVALIDATE flags when queueing buffers. It is only
+ * applied to buffers allocated by the device with allocateBuffers() and only
+ * when the device supports cache hints, and is ignored otherwise. The CPU
+ * shall not access the buffers in a way that contradicts the hint, as it may
+ * then observe stale data.
+ *
+ * The hint defaults to CacheHint::CpuReadWrite.
+ */
+
 /**
  * \brief Queue a buffer to the video device
  * \param[in] buffer The buffer to be queued
+ * \param[in] request The media request to add the buffer to, if any
  *
  * For capture video devices the \a buffer will be filled with data by the
  * device. For output video devices the \a buffer shall contain valid data and
  * will be processed by the device. Once the device has finished processing the
  * buffer, it will be available for dequeue.
  *
+ * If \a request is not null, the buffer is added to the media \a request and
+ * only handed to the device when the request is queued.
+ *
  * The best available V4L2 buffer is picked for \a buffer using the V4L2 buffer
  * cache.
  *
  * \return 0 on success or a negative error code otherwise
  */
-int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
+int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer, const MediaRequest *request)
 {
 	struct v4l2_plane v4l2Planes[VIDEO_MAX_PLANES] = {};
 	struct v4l2_buffer buf = {};
@@ -1494,7 +2007,14 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 		return -ENOENT;
 	}
 
+	unsigned int misses = cache_->stats().misses;
 	ret = cache_->get(*buffer);
+	if (cache_->stats().misses != misses)
+		metrics_->cacheMisses.inc();
+
+	if (cacheGrowable_ && cache_->thrashing())
+		growImportedBuffers();
+
 	if (ret < 0)
 		return ret;
 
@@ -1503,6 +2023,32 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 	buf.memory = memoryType_;
 	buf.field = V4L2_FIELD_NONE;
 
+	if (request) {
+		buf.flags |= V4L2_BUF_FLAG_REQUEST_FD;
+		buf.request_fd = request->fd();
+	}
+
+	/*
+	 * Cache hints are only honoured for MMAP buffers, the exporter takes
+	 * care of cache management for DMABUF buffers.
+	 */
+	if (memoryType_ == V4L2_MEMORY_MMAP && supportsCacheHints_) {
+		switch (cacheHint_) {
+		case CacheHint::CpuReadWrite:
+			break;
+		case CacheHint::CpuRead:
+			buf.flags |= V4L2_BUF_FLAG_NO_CACHE_CLEAN;
+			break;
+		case CacheHint::CpuWrite:
+			buf.flags |= V4L2_BUF_FLAG_NO_CACHE_INVALIDATE;
+			break;
+		case CacheHint::DeviceOnly:
+			buf.flags |= V4L2_BUF_FLAG_NO_CACHE_CLEAN |
+				     V4L2_BUF_FLAG_NO_CACHE_INVALIDATE;
+			break;
+		}
+	}
+
 	bool multiPlanar = V4L2_TYPE_IS_MULTIPLANAR(buf.type);
 	const std::vector<FrameBuffer::Plane> &planes = buffer->planes();
 	const unsigned int numV4l2Planes = format_.planesCount;
@@ -1605,6 +2151,11 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 
 	queuedBuffers_[buf.index] = buffer;
 
+	metrics_->buffersQueued.inc();
+	metrics_->queueDepth.set(queuedBuffers_.size());
+
+	TraceRing::record(TraceRing::BufferQueue, buffer, buf.index);
+
 	return 0;
 }
 
@@ -1612,19 +2163,45 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
  * \brief Slot to handle completed buffer events from the V4L2 video device
  *
  * When this slot is called, a Buffer has become available from the device, and
- * will be emitted through the bufferReady Signal.
+ * will be emitted through the bufferReady Signal. When batched dequeue is
+ * enabled, all the buffers ready at that time are dequeued and emitted one by
+ * one through the bufferReady signal.
+ *
+ * All the buffers dequeued by a single call are then emitted together through
+ * the buffersReady signal.
  *
  * For Capture video devices the FrameBuffer will contain valid data.
  * For Output video devices the FrameBuffer can be considered empty.
  */
 void V4L2VideoDevice::bufferAvailable()
 {
-	FrameBuffer *buffer = dequeueBuffer();
-	if (!buffer)
+	readyBuffers_.clear();
+
+	do {
+		FrameBuffer *buffer = dequeueBuffer();
+		if (!buffer)
+			break;
+
+		readyBuffers_.push_back(buffer);
+	} while (batchedDequeue_ && !queuedBuffers_.empty());
+
+	if (readyBuffers_.empty())
 		return;
 
+	/*
+	 * Slots may run the event loop, which could call this function
+	 * recursively. Move the buffers list out of the way before emitting the
+	 * signals to keep it stable.
+	 */
+	std::vector<FrameBuffer *> buffers = std::move(readyBuffers_);
+
 	/* Notify anyone listening to the device. */
-	bufferReady.emit(buffer);
+	for (FrameBuffer *buffer : buffers)
+		bufferReady.emit(buffer);
+
+	buffersReady.emit(buffers);
+
+	readyBuffers_ = std::move(buffers);
 }
 
 /**
@@ -1632,6 +2209,8 @@ void V4L2VideoDevice::bufferAvailable()
  *
  * This function dequeues the next available buffer from the device. If no
  * buffer is available to be dequeued it will return nullptr immediately.
+ * Running out of buffers while draining the queue in batched dequeue mode is
+ * expected and isn't reported as an error.
  *
  * \return A pointer to the dequeued buffer on success, or nullptr otherwise
  */
@@ -1653,8 +2232,9 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 
 	ret = ioctl(VIDIOC_DQBUF, &buf);
 	if (ret < 0) {
-		LOG(V4L2, Error)
-			<< "Failed to dequeue buffer: " << strerror(-ret);
+		if (ret != -EAGAIN || readyBuffers_.empty())
+			LOG_RATELIMITED(V4L2, Error)
+				<< "Failed to dequeue buffer: " << strerror(-ret);
 		return nullptr;
 	}
 
@@ -1674,7 +2254,7 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 	 */
 	auto it = queuedBuffers_.find(buf.index);
 	if (it == queuedBuffers_.end()) {
-		LOG(V4L2, Error)
+		LOG_RATELIMITED(V4L2, Error)
 			<< "Dequeued unexpected buffer index " << buf.index;
 
 		return nullptr;
@@ -1685,6 +2265,11 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 	FrameBuffer *buffer = it->second;
 	queuedBuffers_.erase(it);
 
+	metrics_->buffersDequeued.inc();
+	metrics_->queueDepth.set(queuedBuffers_.size());
+	if (buf.flags & V4L2_BUF_FLAG_ERROR)
+		metrics_->bufferErrors.inc();
+
 	if (queuedBuffers_.empty())
 		fdBufferNotifier_->setEnabled(false);
 
@@ -1695,6 +2280,8 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 	buffer->metadata_.timestamp = buf.timestamp.tv_sec * 1000000000ULL
 				    + buf.timestamp.tv_usec * 1000ULL;
 
+	TraceRing::record(TraceRing::BufferDequeue, buffer, buf.sequence);
+
 	if (V4L2_TYPE_IS_OUTPUT(buf.type))
 		return buffer;
 
@@ -1766,6 +2353,32 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
  * \brief A Signal emitted when a framebuffer completes
  */
 
+/**
+ * \var V4L2VideoDevice::buffersReady
+ * \brief A Signal emitted with all the framebuffers that completed together
+ *
+ * This signal is emitted after the bufferReady signal has been emitted for all
+ * the buffers dequeued in response to a single buffer available event. Without
+ * batched dequeue the span contains a single buffer.
+ *
+ * The span is only valid for the duration of the signal emission, the signal
+ * shall thus only be connected to slots in the thread of the video device.
+ */
+
+/**
+ * \fn V4L2VideoDevice::setBatchedDequeue()
+ * \brief Enable or disable batched buffer dequeue
+ * \param[in] enable True to enable batched dequeue
+ *
+ * By default, a single buffer is dequeued from the device every time the
+ * device signals that buffers are ready. When batched dequeue is enabled, all
+ * the buffers ready at that time are dequeued in one go. This saves round trips
+ * through the event loop when multiple buffers complete in a short time, at the
+ * cost of one additional VIDIOC_DQBUF call per event.
+ *
+ * Batched dequeue is disabled by default.
+ */
+
 /**
  * \brief Start the video stream
  * \return 0 on success or a negative error code otherwise
@@ -1817,11 +2430,13 @@ int V4L2VideoDevice::streamOff()
 	for (auto it : queuedBuffers_) {
 		FrameBuffer *buffer = it.second;
 
+		cache_->put(it.first);
 		buffer->metadata_.status = FrameMetadata::FrameCancelled;
 		bufferReady.emit(buffer);
 	}
 
 	queuedBuffers_.clear();
+	metrics_->queueDepth.set(0);
 	fdBufferNotifier_->setEnabled(false);
 	streaming_ = false;
 
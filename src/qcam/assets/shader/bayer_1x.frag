@@ -0,0 +1,147 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Based on the code from http://jgt.akpeters.com/papers/McGuire08/
+ *
+ * Efficient, High-Quality Bayer Demosaic Filtering on GPUs
+ *
+ * Morgan McGuire
+ *
+ * This paper appears in issue Volume 13, Number 4.
+ * ---------------------------------------------------------
+ * Copyright (c) 2008, Morgan McGuire. All rights reserved.
+ *
+ *
+ * Modified by Linaro Ltd for 10/12-bit packed vs 8-bit raw Bayer format,
+ * and for simpler demosaic algorithm.
+ * Copyright (C) 2020, Linaro
+ *
+ * bayer_1x.frag - Fragment shader code for raw Bayer formats stored in 16-bit
+ * containers and for the IPU3 packed raw Bayer formats
+ */
+
+/*
+ * The pixel and byte coordinates exceed the range of integers that mediump
+ * floats represent exactly, use highp when available.
+ */
+#ifdef GL_ES
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#else
+precision mediump float;
+#endif
+#endif
+
+varying vec2 textureOut;
+
+/* the image size in pixels */
+uniform vec2 tex_size;
+/* the size of a texel in texture coordinates */
+uniform vec2 tex_step;
+uniform vec2 tex_bayer_first_red;
+
+uniform sampler2D tex_y;
+
+/* Sample the byte-sized texel at the given coordinates in texels. */
+float byte_at(vec2 texel)
+{
+	return floor(texture2D(tex_y, (texel + 0.5) * tex_step).r * 255.0 + 0.5);
+}
+
+#if defined(RAW16)
+/*
+ * Pixels are stored in little-endian 16-bit containers, sampled from a
+ * GL_LUMINANCE_ALPHA texture with one texel per pixel. The luminance holds
+ * the LS byte and the alpha the MS byte. RAW16_MAX is the largest pixel
+ * value of the format.
+ */
+float fetch(vec2 pixel)
+{
+	vec2 bytes = texture2D(tex_y, (pixel + 0.5) * tex_step).ra;
+
+	return dot(bytes, vec2(255.0, 65280.0) / RAW16_MAX);
+}
+#elif defined(IPU3)
+/*
+ * Blocks of 25 pixels are stored in 32 bytes as a little-endian stream of
+ * 10-bit values, sampled from a GL_LUMINANCE texture with one texel per
+ * byte. The pixel spans the two bytes starting at the byte containing its
+ * first bit.
+ */
+float fetch(vec2 pixel)
+{
+	float block = floor((pixel.x + 0.5) / 25.0);
+	float bit = (pixel.x - block * 25.0) * 10.0;
+	float byte = block * 32.0 + floor(bit / 8.0);
+	float shift = exp2(mod(bit, 8.0));
+
+	float lo = byte_at(vec2(byte, pixel.y));
+	float hi = byte_at(vec2(byte + 1.0, pixel.y));
+
+	return (floor(lo / shift) + mod(hi, 4.0 * shift) * 256.0 / shift) / 1023.0;
+}
+#else
+#error Invalid raw format
+#endif
+
+void main(void)
+{
+	vec3 rgb;
+
+	/*
+	 * The pixel being sampled, in pixel units. The neighbouring pixels
+	 * are addressed directly, fetch() locates their data in the texture.
+	 */
+	vec2 center = floor(textureOut * tex_size);
+
+	vec2 alternate = mod(center + tex_bayer_first_red, 2.0);
+	bool even_col = alternate.x < 1.0;
+	bool even_row = alternate.y < 1.0;
+
+	/*
+	 * The neighbouring pixels and the colour equations are the same as in
+	 * bayer_1x_packed.frag, where C is the central pixel:
+	 *
+	 *   +----+----+----+----+
+	 *   | \ x|    |    |    |
+	 *   |y \ | -1 |  0 | +1 |
+	 *   +----+----+----+----+
+	 *   | +1 | D2 | A1 | D3 |
+	 *   +----+----+----+----+
+	 *   |  0 | B0 |  C | B1 |
+	 *   +----+----+----+----+
+	 *   | -1 | D0 | A0 | D1 |
+	 *   +----+----+----+----+
+	 *
+	 * Fetch the values and precalculate the terms:
+	 *   patterns.x = (A0 + A1) / 2.0
+	 *   patterns.y = (B0 + B1) / 2.0
+	 *   patterns.z = (A0 + A1 + B0 + B1) / 4.0
+	 *   patterns.w = (D0 + D1 + D2 + D3) / 4.0
+	 */
+	float C = fetch(center);
+	vec4 patterns = vec4(
+		fetch(center + vec2(0.0, -1.0)),	/* A0: (0,-1) */
+		fetch(center + vec2(-1.0, 0.0)),	/* B0: (-1,0) */
+		fetch(center + vec2(-1.0, -1.0)),	/* D0: (-1,-1) */
+		fetch(center + vec2(1.0, -1.0)));	/* D1: (1,-1) */
+	vec4 temp = vec4(
+		fetch(center + vec2(0.0, 1.0)),		/* A1: (0,1) */
+		fetch(center + vec2(1.0, 0.0)),		/* B1: (1,0) */
+		fetch(center + vec2(1.0, 1.0)),		/* D3: (1,1) */
+		fetch(center + vec2(-1.0, 1.0)));	/* D2: (-1,1) */
+	patterns = (patterns + temp) * 0.5;
+		/* .x = (A0 + A1) / 2.0, .y = (B0 + B1) / 2.0 */
+		/* .z = (D0 + D3) / 2.0, .w = (D1 + D2) / 2.0 */
+	patterns.w = (patterns.z + patterns.w) * 0.5;
+	patterns.z = (patterns.x + patterns.y) * 0.5;
+
+	rgb = even_col ?
+		(even_row ?
+			vec3(C, patterns.zw) :
+			vec3(patterns.x, C, patterns.y)) :
+		(even_row ?
+			vec3(patterns.y, C, patterns.x) :
+			vec3(patterns.wz, C));
+
+	gl_FragColor = vec4(rgb, 1.0);
+}
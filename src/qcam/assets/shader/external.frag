@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * external.frag - Fragment shader code for frames imported from dmabufs
+ */
+
+#extension GL_OES_EGL_image_external : require
+
+#ifdef GL_ES
+precision mediump float;
+#endif
+
+varying vec2 textureOut;
+uniform samplerExternalOES tex_y;
+
+void main(void)
+{
+	/* The external sampler converts the frame to RGB. */
+	gl_FragColor = vec4(texture2D(tex_y, textureOut).rgb, 1.0);
+}
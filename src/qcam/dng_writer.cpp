@@ -10,6 +10,8 @@
 #include <algorithm>
 #include <iostream>
 #include <map>
+#include <thread>
+#include <vector>
 
 #include <tiffio.h>
 
@@ -19,6 +21,13 @@
 
 using namespace libcamera;
 
+/*
+ * The RAW image is written in strips of about 1MiB. Rows are packed by worker
+ * threads in chunks of at least kMinRowsPerThread rows.
+ */
+static constexpr unsigned int kStripSize = 1 << 20;
+static constexpr unsigned int kMinRowsPerThread = 64;
+
 enum CFAPatternColour : uint8_t {
 	CFAPatternRed = 0,
 	CFAPatternGreen = 1,
@@ -175,6 +184,24 @@ void thumbScanlineSBGGRxxP(const FormatInfo &info, void *output,
 	}
 }
 
+/*
+ * Unpack a block of 25 pixels, stored in 32 bytes as six groups of four pixels
+ * in five bytes followed by a last pixel in two bytes.
+ */
+static void unpackBlockIPU3(uint16_t *out, const uint8_t *in)
+{
+	for (unsigned int i = 0; i < 6; i++) {
+		out[0] = (in[1] & 0x03) << 14 | (in[0] & 0xff) << 6;
+		out[1] = (in[2] & 0x0f) << 12 | (in[1] & 0xfc) << 4;
+		out[2] = (in[3] & 0x3f) << 10 | (in[2] & 0xf0) << 2;
+		out[3] = (in[4] & 0xff) <<  8 | (in[3] & 0xc0) << 0;
+		out += 4;
+		in += 5;
+	}
+
+	out[0] = (in[1] & 0x03) << 14 | (in[0] & 0xff) << 6;
+}
+
 void packScanlineIPU3(void *output, const void *input, unsigned int width)
 {
 	const uint8_t *in = static_cast<const uint8_t *>(input);
@@ -186,33 +213,23 @@ void packScanlineIPU3(void *output, const void *input, unsigned int width)
 	 *
 	 * \todo Improve packing to keep the 10-bit sample size.
 	 */
-	unsigned int x = 0;
-	while (true) {
-		for (unsigned int i = 0; i < 6; i++) {
-			*out++ = (in[1] & 0x03) << 14 | (in[0] & 0xff) << 6;
-			if (++x >= width)
-				return;
-
-			*out++ = (in[2] & 0x0f) << 12 | (in[1] & 0xfc) << 4;
-			if (++x >= width)
-				return;
-
-			*out++ = (in[3] & 0x3f) << 10 | (in[2] & 0xf0) << 2;
-			if (++x >= width)
-				return;
-
-			*out++ = (in[4] & 0xff) <<  8 | (in[3] & 0xc0) << 0;
-			if (++x >= width)
-				return;
-
-			in += 5;
-		}
+	unsigned int blocks = width / 25;
+	for (unsigned int i = 0; i < blocks; i++) {
+		unpackBlockIPU3(out, in);
+		out += 25;
+		in += 32;
+	}
 
-		*out++ = (in[1] & 0x03) << 14 | (in[0] & 0xff) << 6;
-		if (++x >= width)
-			return;
+	/*
+	 * Lines are padded to a multiple of 50 pixels, the whole block holding
+	 * the last pixels can thus be read.
+	 */
+	unsigned int remaining = width % 25;
+	if (remaining) {
+		uint16_t block[25];
 
-		in += 2;
+		unpackBlockIPU3(block, in);
+		std::copy(block, block + remaining, out);
 	}
 }
 
@@ -348,11 +365,43 @@ static const std::map<PixelFormat, FormatInfo> formatInfo = {
 	} },
 };
 
+/*
+ * Pack the RAW image rows in parallel, splitting the image in chunks of rows
+ * handled by worker threads and the calling thread.
+ */
+static void packImage(const FormatInfo &info, uint8_t *output,
+		      const uint8_t *input, const StreamConfiguration &config,
+		      unsigned int rowSize)
+{
+	auto packRows = [&](unsigned int yStart, unsigned int yEnd) {
+		for (unsigned int y = yStart; y < yEnd; y++)
+			info.packScanline(output + y * rowSize,
+					  input + y * config.stride,
+					  config.size.width);
+	};
+
+	unsigned int height = config.size.height;
+	unsigned int count = std::min(std::thread::hardware_concurrency(),
+				      height / kMinRowsPerThread);
+	count = std::max(count, 1U);
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < count; i++)
+		threads.emplace_back(packRows, height * i / count,
+				     height * (i + 1) / count);
+
+	packRows(0, height / count);
+
+	for (std::thread &thread : threads)
+		thread.join();
+}
+
 int DNGWriter::write(const char *filename, const Camera *camera,
 		     const StreamConfiguration &config,
 		     const ControlList &metadata,
 		     [[maybe_unused]] const FrameBuffer *buffer,
-		     const void *data)
+		     const void *data,
+		     const std::function<void(unsigned int)> &progress)
 {
 	const ControlList &cameraProperties = camera->properties();
 
@@ -370,11 +419,10 @@ int DNGWriter::write(const char *filename, const Camera *camera,
 	}
 
 	/*
-	 * Scanline buffer, has to be large enough to store both a RAW scanline
-	 * or a thumbnail scanline. The latter will always be much smaller than
-	 * the former as we downscale by 16 in both directions.
+	 * Scanline buffer for the thumbnail, which is downscaled by 16 in both
+	 * directions and stored as RGB.
 	 */
-	uint8_t scanline[(config.size.width * info->bitsPerSample + 7) / 8];
+	uint8_t scanline[config.size.width / 16 * 3];
 
 	toff_t rawIFDOffset = 0;
 	toff_t exifIFDOffset = 0;
@@ -510,6 +558,10 @@ int DNGWriter::write(const char *filename, const Camera *camera,
 	TIFFSetField(tif, TIFFTAG_CFAPLANECOLOR, 3, cfaPlaneColor);
 	TIFFSetField(tif, TIFFTAG_CFALAYOUT, 1);
 
+	unsigned int rowSize = (config.size.width * info->bitsPerSample + 7) / 8;
+	unsigned int rowsPerStrip = std::max(kStripSize / rowSize, 1U);
+	TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, rowsPerStrip);
+
 	const uint16_t blackLevelRepeatDim[] = { 2, 2 };
 	float blackLevel[] = { 0.0f, 0.0f, 0.0f, 0.0f };
 	uint32_t whiteLevel = (1 << info->bitsPerSample) - 1;
@@ -552,19 +604,28 @@ int DNGWriter::write(const char *filename, const Camera *camera,
 	TIFFSetField(tif, TIFFTAG_BLACKLEVEL, 4, &blackLevel);
 	TIFFSetField(tif, TIFFTAG_WHITELEVEL, 1, &whiteLevel);
 
-	/* Write RAW content. */
-	row = static_cast<const uint8_t *>(data);
-	for (unsigned int y = 0; y < config.size.height; y++) {
-		info->packScanline(&scanline, row, config.size.width);
-
-		if (TIFFWriteScanline(tif, &scanline, y, 0) != 1) {
-			std::cerr << "Failed to write RAW scanline"
-				  << std::endl;
+	/*
+	 * Write RAW content. The whole image is packed first, in parallel, and
+	 * then written one strip at a time.
+	 */
+	std::vector<uint8_t> raw(rowSize * config.size.height);
+	packImage(*info, raw.data(), static_cast<const uint8_t *>(data),
+		  config, rowSize);
+
+	unsigned int strips = (config.size.height + rowsPerStrip - 1) / rowsPerStrip;
+	for (unsigned int strip = 0; strip < strips; strip++) {
+		unsigned int y = strip * rowsPerStrip;
+		unsigned int rows = std::min(rowsPerStrip, config.size.height - y);
+
+		if (TIFFWriteEncodedStrip(tif, strip, raw.data() + y * rowSize,
+					  rows * rowSize) < 0) {
+			std::cerr << "Failed to write RAW strip" << std::endl;
 			TIFFClose(tif);
 			return -EINVAL;
 		}
 
-		row += config.stride;
+		if (progress)
+			progress((strip + 1) * 100 / strips);
 	}
 
 	/* Checkpoint the IFD to retrieve its offset, and write it out. */
@@ -10,6 +10,8 @@
 #ifdef HAVE_TIFF
 #define HAVE_DNG
 
+#include <functional>
+
 #include <libcamera/camera.h>
 #include <libcamera/controls.h>
 #include <libcamera/framebuffer.h>
@@ -21,7 +23,8 @@ public:
 	static int write(const char *filename, const libcamera::Camera *camera,
 			 const libcamera::StreamConfiguration &config,
 			 const libcamera::ControlList &metadata,
-			 const libcamera::FrameBuffer *buffer, const void *data);
+			 const libcamera::FrameBuffer *buffer, const void *data,
+			 const std::function<void(unsigned int)> &progress = {});
 };
 
 #endif /* HAVE_TIFF */
@@ -7,29 +7,205 @@
 
 #include "format_converter.h"
 
+#include <algorithm>
 #include <errno.h>
+#include <stdint.h>
 #include <utility>
 
 #include <QImage>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
 
 #include <libcamera/formats.h>
 
 #include "../cam/image.h"
 
-#define RGBSHIFT		8
-#ifndef MAX
-#define MAX(a,b)		((a)>(b)?(a):(b))
-#endif
-#ifndef MIN
-#define MIN(a,b)		((a)<(b)?(a):(b))
+/*
+ * The conversion kernels are written to be vectorized by the compiler. On
+ * x86-64, also build them for AVX2 and select the implementation at runtime
+ * based on the CPU features, as the default target only guarantees SSE2.
+ */
+#if defined(__x86_64__) && defined(__GLIBC__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define QCAM_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
 #endif
-#ifndef CLAMP
-#define CLAMP(a,low,high)	MAX((low),MIN((high),(a)))
 #endif
-#ifndef CLIP
-#define CLIP(x)			CLAMP(x,0,255)
+#ifndef QCAM_TARGET_CLONES
+#define QCAM_TARGET_CLONES
 #endif
 
+namespace {
+
+/* Minimum number of lines processed by a conversion thread. */
+constexpr unsigned int kMinStripHeight = 32;
+
+class StripTask : public QRunnable
+{
+public:
+	StripTask(const std::function<void(unsigned int, unsigned int)> &func,
+		  unsigned int yStart, unsigned int yEnd, QSemaphore *done)
+		: func_(func), yStart_(yStart), yEnd_(yEnd), done_(done)
+	{
+	}
+
+	void run() override
+	{
+		func_(yStart_, yEnd_);
+		done_->release();
+	}
+
+private:
+	const std::function<void(unsigned int, unsigned int)> &func_;
+	unsigned int yStart_;
+	unsigned int yEnd_;
+	QSemaphore *done_;
+};
+
+inline uint8_t clip(int value)
+{
+	return std::clamp(value, 0, 255);
+}
+
+/* Convert one pixel from limited range BT.601 YCbCr to XRGB8888. */
+inline void yuvToRgb(int y, int u, int v, uint8_t *dst)
+{
+	int c = 298 * (y - 16) + 128;
+	int d = u - 128;
+	int e = v - 128;
+
+	dst[0] = clip((c + 516 * d) >> 8);
+	dst[1] = clip((c - 100 * d - 208 * e) >> 8);
+	dst[2] = clip((c + 409 * e) >> 8);
+	dst[3] = 0xff;
+}
+
+/*
+ * The line conversion functions below use size_t indices, as the compiler
+ * can't vectorize accesses computed with unsigned int arithmetic that may
+ * wrap around.
+ */
+template<unsigned int Bpp>
+inline void rgbLine(const uint8_t *__restrict src, uint8_t *__restrict dst,
+		    unsigned int width, unsigned int rPos, unsigned int gPos,
+		    unsigned int bPos)
+{
+	for (size_t x = 0; x < width; x++) {
+		dst[4 * x + 0] = src[Bpp * x + bPos];
+		dst[4 * x + 1] = src[Bpp * x + gPos];
+		dst[4 * x + 2] = src[Bpp * x + rPos];
+		dst[4 * x + 3] = 0xff;
+	}
+}
+
+QCAM_TARGET_CLONES
+void convertRGBLine(const uint8_t *src, uint8_t *dst, unsigned int width,
+		    unsigned int bpp, unsigned int rPos, unsigned int gPos,
+		    unsigned int bPos)
+{
+	switch (bpp) {
+	case 1:
+		rgbLine<1>(src, dst, width, rPos, gPos, bPos);
+		break;
+	case 3:
+		rgbLine<3>(src, dst, width, rPos, gPos, bPos);
+		break;
+	case 4:
+		rgbLine<4>(src, dst, width, rPos, gPos, bPos);
+		break;
+	}
+}
+
+template<unsigned int YPos, unsigned int CbPos>
+inline void yuvPackedLine(const uint8_t *__restrict src, uint8_t *__restrict dst,
+			  unsigned int width)
+{
+	constexpr unsigned int CrPos = (CbPos + 2) % 4;
+
+	for (size_t x = 0; x < width / 2; x++) {
+		int cb = src[4 * x + CbPos];
+		int cr = src[4 * x + CrPos];
+
+		yuvToRgb(src[4 * x + YPos], cb, cr, dst + 8 * x);
+		yuvToRgb(src[4 * x + YPos + 2], cb, cr, dst + 8 * x + 4);
+	}
+}
+
+QCAM_TARGET_CLONES
+void convertYUVPackedLine(const uint8_t *src, uint8_t *dst, unsigned int width,
+			  unsigned int yPos, unsigned int cbPos)
+{
+	if (yPos == 0 && cbPos == 1)
+		yuvPackedLine<0, 1>(src, dst, width);
+	else if (yPos == 0 && cbPos == 3)
+		yuvPackedLine<0, 3>(src, dst, width);
+	else if (yPos == 1 && cbPos == 0)
+		yuvPackedLine<1, 0>(src, dst, width);
+	else
+		yuvPackedLine<1, 2>(src, dst, width);
+}
+
+QCAM_TARGET_CLONES
+void convertYUVPlanarLine(const uint8_t *__restrict srcY,
+			  const uint8_t *__restrict srcCb,
+			  const uint8_t *__restrict srcCr,
+			  uint8_t *__restrict dst, unsigned int width)
+{
+	/* All supported planar formats are horizontally subsampled. */
+	for (size_t x = 0; x < width / 2; x++) {
+		int cb = srcCb[x];
+		int cr = srcCr[x];
+
+		yuvToRgb(srcY[2 * x], cb, cr, dst + 8 * x);
+		yuvToRgb(srcY[2 * x + 1], cb, cr, dst + 8 * x + 4);
+	}
+}
+
+template<unsigned int HorzSubSample, bool Swap>
+inline void yuvSemiPlanarLine(const uint8_t *__restrict srcY,
+			      const uint8_t *__restrict srcC,
+			      uint8_t *__restrict dst, unsigned int width)
+{
+	constexpr unsigned int CbPos = Swap ? 1 : 0;
+	constexpr unsigned int CrPos = Swap ? 0 : 1;
+
+	for (size_t x = 0; x < width / HorzSubSample; x++) {
+		int cb = srcC[2 * x + CbPos];
+		int cr = srcC[2 * x + CrPos];
+
+		yuvToRgb(srcY[HorzSubSample * x], cb, cr,
+			 dst + 4 * HorzSubSample * x);
+		if (HorzSubSample == 2)
+			yuvToRgb(srcY[2 * x + 1], cb, cr, dst + 8 * x + 4);
+	}
+}
+
+QCAM_TARGET_CLONES
+void convertYUVSemiPlanarLine(const uint8_t *srcY, const uint8_t *srcC,
+			      uint8_t *dst, unsigned int width,
+			      unsigned int horzSubSample, bool swap)
+{
+	if (horzSubSample == 2) {
+		if (swap)
+			yuvSemiPlanarLine<2, true>(srcY, srcC, dst, width);
+		else
+			yuvSemiPlanarLine<2, false>(srcY, srcC, dst, width);
+	} else {
+		if (swap)
+			yuvSemiPlanarLine<1, true>(srcY, srcC, dst, width);
+		else
+			yuvSemiPlanarLine<1, false>(srcY, srcC, dst, width);
+	}
+}
+
+} /* namespace */
+
+FormatConverter::FormatConverter()
+{
+	/* The calling thread converts one strip of the image too. */
+	pool_.setMaxThreadCount(std::max(QThread::idealThreadCount() - 1, 1));
+}
+
 int FormatConverter::configure(const libcamera::PixelFormat &format,
 			       const QSize &size, unsigned int stride)
 {
@@ -179,177 +355,112 @@ int FormatConverter::configure(const libcamera::PixelFormat &format,
 
 void FormatConverter::convert(const Image *src, size_t size, QImage *dst)
 {
+	unsigned char *bits = dst->bits();
+
 	switch (formatFamily_) {
 	case MJPEG:
 		dst->loadFromData(src->data(0).data(), size, "JPEG");
 		break;
 	case RGB:
-		convertRGB(src, dst->bits());
+		runStrips([&](unsigned int yStart, unsigned int yEnd) {
+			convertRGB(src, bits, yStart, yEnd);
+		});
 		break;
 	case YUVPacked:
-		convertYUVPacked(src, dst->bits());
+		runStrips([&](unsigned int yStart, unsigned int yEnd) {
+			convertYUVPacked(src, bits, yStart, yEnd);
+		});
 		break;
 	case YUVSemiPlanar:
-		convertYUVSemiPlanar(src, dst->bits());
+		runStrips([&](unsigned int yStart, unsigned int yEnd) {
+			convertYUVSemiPlanar(src, bits, yStart, yEnd);
+		});
 		break;
 	case YUVPlanar:
-		convertYUVPlanar(src, dst->bits());
+		runStrips([&](unsigned int yStart, unsigned int yEnd) {
+			convertYUVPlanar(src, bits, yStart, yEnd);
+		});
 		break;
 	};
 }
 
-static void yuv_to_rgb(int y, int u, int v, int *r, int *g, int *b)
+void FormatConverter::runStrips(const std::function<void(unsigned int, unsigned int)> &func)
 {
-	int c = y - 16;
-	int d = u - 128;
-	int e = v - 128;
-	*r = CLIP(( 298 * c           + 409 * e + 128) >> RGBSHIFT);
-	*g = CLIP(( 298 * c - 100 * d - 208 * e + 128) >> RGBSHIFT);
-	*b = CLIP(( 298 * c + 516 * d           + 128) >> RGBSHIFT);
+	/*
+	 * Split the image in horizontal strips, converted in parallel by the
+	 * thread pool and the calling thread. Strips start on even lines to
+	 * keep vertically subsampled chroma lines in a single strip.
+	 */
+	unsigned int count = std::min<unsigned int>(pool_.maxThreadCount() + 1,
+						    height_ / kMinStripHeight);
+	count = std::max(count, 1U);
+
+	auto stripStart = [&](unsigned int index) {
+		return (height_ * index / count) & ~1U;
+	};
+
+	QSemaphore done;
+
+	for (unsigned int i = 1; i < count; i++) {
+		unsigned int yEnd = i == count - 1 ? height_ : stripStart(i + 1);
+		pool_.start(new StripTask(func, stripStart(i), yEnd, &done));
+	}
+
+	func(0, count > 1 ? stripStart(1) : height_);
+
+	done.acquire(count - 1);
 }
 
-void FormatConverter::convertRGB(const Image *srcImage, unsigned char *dst)
+void FormatConverter::convertRGB(const Image *srcImage, unsigned char *dst,
+				 unsigned int yStart, unsigned int yEnd)
 {
 	const unsigned char *src = srcImage->data(0).data();
-	unsigned int x, y;
-	int r, g, b;
-
-	for (y = 0; y < height_; y++) {
-		for (x = 0; x < width_; x++) {
-			r = src[bpp_ * x + r_pos_];
-			g = src[bpp_ * x + g_pos_];
-			b = src[bpp_ * x + b_pos_];
-
-			dst[4 * x + 0] = b;
-			dst[4 * x + 1] = g;
-			dst[4 * x + 2] = r;
-			dst[4 * x + 3] = 0xff;
-		}
-
-		src += stride_;
-		dst += width_ * 4;
-	}
+
+	for (unsigned int y = yStart; y < yEnd; y++)
+		convertRGBLine(src + y * stride_, dst + y * width_ * 4, width_,
+			       bpp_, r_pos_, g_pos_, b_pos_);
 }
 
-void FormatConverter::convertYUVPacked(const Image *srcImage, unsigned char *dst)
+void FormatConverter::convertYUVPacked(const Image *srcImage, unsigned char *dst,
+				       unsigned int yStart, unsigned int yEnd)
 {
 	const unsigned char *src = srcImage->data(0).data();
-	unsigned int src_x, src_y, dst_x, dst_y;
-	unsigned int src_stride;
-	unsigned int dst_stride;
-	unsigned int cr_pos;
-	int r, g, b, y, cr, cb;
-
-	cr_pos = (cb_pos_ + 2) % 4;
-	src_stride = stride_;
-	dst_stride = width_ * 4;
-
-	for (src_y = 0, dst_y = 0; dst_y < height_; src_y++, dst_y++) {
-		for (src_x = 0, dst_x = 0; dst_x < width_; ) {
-			cb = src[src_y * src_stride + src_x * 4 + cb_pos_];
-			cr = src[src_y * src_stride + src_x * 4 + cr_pos];
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_ + 2];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			src_x++;
-		}
-	}
+
+	for (unsigned int y = yStart; y < yEnd; y++)
+		convertYUVPackedLine(src + y * stride_, dst + y * width_ * 4,
+				     width_, y_pos_, cb_pos_);
 }
 
-void FormatConverter::convertYUVPlanar(const Image *srcImage, unsigned char *dst)
+void FormatConverter::convertYUVPlanar(const Image *srcImage, unsigned char *dst,
+				       unsigned int yStart, unsigned int yEnd)
 {
 	unsigned int c_stride = stride_ / horzSubSample_;
-	unsigned int c_inc = horzSubSample_ == 1 ? 1 : 0;
 	const unsigned char *src_y = srcImage->data(0).data();
 	const unsigned char *src_cb = srcImage->data(1).data();
 	const unsigned char *src_cr = srcImage->data(2).data();
-	int r, g, b;
 
 	if (nvSwap_)
 		std::swap(src_cb, src_cr);
 
-	for (unsigned int y = 0; y < height_; y++) {
-		const unsigned char *line_y = src_y + y * stride_;
-		const unsigned char *line_cb = src_cb + (y / vertSubSample_) *
-					       c_stride;
-		const unsigned char *line_cr = src_cr + (y / vertSubSample_) *
-					       c_stride;
-
-		for (unsigned int x = 0; x < width_; x += 2) {
-			yuv_to_rgb(*line_y, *line_cb, *line_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			line_y++;
-			line_cb += c_inc;
-			line_cr += c_inc;
-			dst += 4;
-
-			yuv_to_rgb(*line_y, *line_cb, *line_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			line_y++;
-			line_cb += 1;
-			line_cr += 1;
-			dst += 4;
-		}
+	for (unsigned int y = yStart; y < yEnd; y++) {
+		unsigned int c_offset = (y / vertSubSample_) * c_stride;
+
+		convertYUVPlanarLine(src_y + y * stride_, src_cb + c_offset,
+				     src_cr + c_offset, dst + y * width_ * 4,
+				     width_);
 	}
 }
 
-void FormatConverter::convertYUVSemiPlanar(const Image *srcImage, unsigned char *dst)
+void FormatConverter::convertYUVSemiPlanar(const Image *srcImage, unsigned char *dst,
+					   unsigned int yStart, unsigned int yEnd)
 {
 	unsigned int c_stride = stride_ * (2 / horzSubSample_);
-	unsigned int c_inc = horzSubSample_ == 1 ? 2 : 0;
-	unsigned int cb_pos = nvSwap_ ? 1 : 0;
-	unsigned int cr_pos = nvSwap_ ? 0 : 1;
 	const unsigned char *src = srcImage->data(0).data();
 	const unsigned char *src_c = srcImage->data(1).data();
-	int r, g, b;
-
-	for (unsigned int y = 0; y < height_; y++) {
-		const unsigned char *src_y = src + y * stride_;
-		const unsigned char *src_cb = src_c + (y / vertSubSample_) *
-					      c_stride + cb_pos;
-		const unsigned char *src_cr = src_c + (y / vertSubSample_) *
-					      c_stride + cr_pos;
-
-		for (unsigned int x = 0; x < width_; x += 2) {
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += c_inc;
-			src_cr += c_inc;
-			dst += 4;
-
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += 2;
-			src_cr += 2;
-			dst += 4;
-		}
-	}
+
+	for (unsigned int y = yStart; y < yEnd; y++)
+		convertYUVSemiPlanarLine(src + y * stride_,
+					 src_c + (y / vertSubSample_) * c_stride,
+					 dst + y * width_ * 4, width_,
+					 horzSubSample_, nvSwap_);
 }
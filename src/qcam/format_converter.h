@@ -7,9 +7,11 @@
 
 #pragma once
 
+#include <functional>
 #include <stddef.h>
 
 #include <QSize>
+#include <QThreadPool>
 
 #include <libcamera/pixel_format.h>
 
@@ -19,6 +21,8 @@ class QImage;
 class FormatConverter
 {
 public:
+	FormatConverter();
+
 	int configure(const libcamera::PixelFormat &format, const QSize &size,
 		      unsigned int stride);
 
@@ -33,10 +37,18 @@ private:
 		YUVSemiPlanar,
 	};
 
-	void convertRGB(const Image *src, unsigned char *dst);
-	void convertYUVPacked(const Image *src, unsigned char *dst);
-	void convertYUVPlanar(const Image *src, unsigned char *dst);
-	void convertYUVSemiPlanar(const Image *src, unsigned char *dst);
+	void convertRGB(const Image *src, unsigned char *dst,
+			unsigned int yStart, unsigned int yEnd);
+	void convertYUVPacked(const Image *src, unsigned char *dst,
+			      unsigned int yStart, unsigned int yEnd);
+	void convertYUVPlanar(const Image *src, unsigned char *dst,
+			      unsigned int yStart, unsigned int yEnd);
+	void convertYUVSemiPlanar(const Image *src, unsigned char *dst,
+				  unsigned int yStart, unsigned int yEnd);
+
+	void runStrips(const std::function<void(unsigned int, unsigned int)> &func);
+
+	QThreadPool pool_;
 
 	libcamera::PixelFormat format_;
 	unsigned int width_;
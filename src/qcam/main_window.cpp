@@ -18,7 +18,9 @@
 #include <QImageWriter>
 #include <QInputDialog>
 #include <QMutexLocker>
+#include <QRunnable>
 #include <QStandardPaths>
+#include <QStatusBar>
 #include <QStringList>
 #include <QTimer>
 #include <QToolBar>
@@ -95,6 +97,90 @@ private:
 	PlugEvent plugEvent_;
 };
 
+/**
+ * \brief Custom QEvent to signal DNG write progress or completion
+ */
+class DNGWriteEvent : public QEvent
+{
+public:
+	DNGWriteEvent(unsigned int progress)
+		: QEvent(type()), buffer_(nullptr), progress_(progress), ret_(0)
+	{
+	}
+
+	DNGWriteEvent(FrameBuffer *buffer, int ret)
+		: QEvent(type()), buffer_(buffer), progress_(100), ret_(ret)
+	{
+	}
+
+	static Type type()
+	{
+		static int type = QEvent::registerEventType();
+		return static_cast<Type>(type);
+	}
+
+	/* The buffer is only set when the write has completed. */
+	FrameBuffer *buffer() const { return buffer_; }
+	unsigned int progress() const { return progress_; }
+	int ret() const { return ret_; }
+
+private:
+	FrameBuffer *buffer_;
+	unsigned int progress_;
+	int ret_;
+};
+
+#ifdef HAVE_DNG
+/**
+ * \brief Task writing a RAW frame to a DNG file in the background
+ */
+class DNGWriteTask : public QRunnable
+{
+public:
+	DNGWriteTask(QObject *receiver, const QString &filename,
+		     std::shared_ptr<Camera> camera,
+		     const StreamConfiguration &config,
+		     const ControlList &metadata, FrameBuffer *buffer,
+		     Image *image)
+		: receiver_(receiver), filename_(filename.toStdString()),
+		  camera_(std::move(camera)), config_(config),
+		  metadata_(metadata), buffer_(buffer), image_(image)
+	{
+	}
+
+	void run() override
+	{
+		unsigned int lastProgress = 0;
+
+		image_->beginAccess();
+		int ret = DNGWriter::write(filename_.c_str(), camera_.get(),
+					   config_, metadata_, buffer_,
+					   image_->data(0).data(),
+					   [&](unsigned int progress) {
+						   if (progress == lastProgress)
+							   return;
+
+						   lastProgress = progress;
+						   QCoreApplication::postEvent(receiver_,
+									       new DNGWriteEvent(progress));
+					   });
+		image_->endAccess();
+
+		QCoreApplication::postEvent(receiver_,
+					    new DNGWriteEvent(buffer_, ret));
+	}
+
+private:
+	QObject *receiver_;
+	std::string filename_;
+	std::shared_ptr<Camera> camera_;
+	StreamConfiguration config_;
+	ControlList metadata_;
+	FrameBuffer *buffer_;
+	Image *image_;
+};
+#endif
+
 MainWindow::MainWindow(CameraManager *cm, const OptionsParser::Options &options)
 	: saveRaw_(nullptr), options_(options), cm_(cm), allocator_(nullptr),
 	  isCapturing_(false), captureRaw_(false)
@@ -111,6 +197,9 @@ MainWindow::MainWindow(CameraManager *cm, const OptionsParser::Options &options)
 	setWindowTitle(title_);
 	connect(&titleTimer_, SIGNAL(timeout()), this, SLOT(updateTitle()));
 
+	/* Keep the DNG files written in capture order. */
+	dngPool_.setMaxThreadCount(1);
+
 	/* Renderer type Qt or GLES, select Qt by default. */
 	std::string renderType = "qt";
 	if (options_.isSet(OptRenderer))
@@ -170,6 +259,9 @@ bool MainWindow::event(QEvent *e)
 	} else if (e->type() == HotplugEvent::type()) {
 		processHotplug(static_cast<HotplugEvent *>(e));
 		return true;
+	} else if (e->type() == DNGWriteEvent::type()) {
+		processDNGWrite(static_cast<DNGWriteEvent *>(e));
+		return true;
 	}
 
 	return QMainWindow::event(e);
@@ -571,6 +663,13 @@ void MainWindow::stopCapture()
 
 	camera_->requestCompleted.disconnect(this);
 
+	/*
+	 * Wait for the pending DNG writes before freeing the buffers, and drop
+	 * their events as the buffers are gone.
+	 */
+	dngPool_.waitForDone();
+	QCoreApplication::removePostedEvents(this, DNGWriteEvent::type());
+
 	mappedBuffers_.clear();
 
 	requests_.clear();
@@ -668,10 +767,18 @@ void MainWindow::processRaw(FrameBuffer *buffer,
 							"DNG Files (*.dng)");
 
 	if (!filename.isEmpty()) {
-		uint8_t *memory = mappedBuffers_[buffer]->data(0).data();
-		DNGWriter::write(filename.toStdString().c_str(), camera_.get(),
-				 rawStream_->configuration(), metadata, buffer,
-				 memory);
+		/*
+		 * Write the file in the background, as packing and writing a
+		 * large RAW frame takes long enough to freeze the UI. The
+		 * buffer is returned to the free queue once the write
+		 * completes.
+		 */
+		statusBar()->showMessage("Saving " + filename);
+		dngPool_.start(new DNGWriteTask(this, filename, camera_,
+						rawStream_->configuration(),
+						metadata, buffer,
+						mappedBuffers_[buffer].get()));
+		return;
 	}
 #endif
 
@@ -681,6 +788,23 @@ void MainWindow::processRaw(FrameBuffer *buffer,
 	}
 }
 
+void MainWindow::processDNGWrite(DNGWriteEvent *e)
+{
+	FrameBuffer *buffer = e->buffer();
+	if (!buffer) {
+		statusBar()->showMessage(QString("Saving DNG: %1%").arg(e->progress()));
+		return;
+	}
+
+	if (e->ret() < 0)
+		statusBar()->showMessage("Failed to save DNG", 5000);
+	else
+		statusBar()->showMessage("DNG saved", 5000);
+
+	QMutexLocker locker(&mutex_);
+	freeBuffers_[rawStream_].enqueue(buffer);
+}
+
 /* -----------------------------------------------------------------------------
  * Request Completion Handling
  */
@@ -706,19 +830,48 @@ void MainWindow::requestComplete(Request *request)
 void MainWindow::processCapture()
 {
 	/*
-	 * Retrieve the next buffer from the done queue. The queue may be empty
-	 * if stopCapture() has been called while a CaptureEvent was posted but
-	 * not processed yet. Return immediately in that case.
+	 * Retrieve the most recent request from the done queue. The queue may
+	 * be empty if stopCapture() has been called while a CaptureEvent was
+	 * posted but not processed yet, or if the request has been superseded
+	 * and handled by a previous CaptureEvent. Return immediately in that
+	 * case.
+	 *
+	 * When rendering is slower than capture, completed requests accumulate
+	 * in the queue. Only render the newest frame, to keep the preview
+	 * latency to one frame, and requeue the superseded requests to the
+	 * camera immediately to avoid starving it of buffers.
 	 */
+	QQueue<Request *> superseded;
 	Request *request;
 	{
 		QMutexLocker locker(&mutex_);
 		if (doneQueue_.isEmpty())
 			return;
 
+		while (doneQueue_.size() > 1)
+			superseded.enqueue(doneQueue_.dequeue());
+
 		request = doneQueue_.dequeue();
 	}
 
+	for (Request *old : superseded) {
+		/* Don't drop RAW captures requested by the user. */
+		if (old->buffers().count(rawStream_))
+			processRaw(old->buffers().at(rawStream_), old->metadata());
+
+		framesCaptured_++;
+
+		FrameBuffer *buffer = old->buffers().at(vfStream_);
+		old->reuse();
+
+		{
+			QMutexLocker locker(&mutex_);
+			freeQueue_.enqueue(old);
+		}
+
+		queueRequest(buffer);
+	}
+
 	/* Process buffers. */
 	if (request->buffers().count(vfStream_))
 		processViewfinder(request->buffers().at(vfStream_));
@@ -751,12 +904,21 @@ void MainWindow::processViewfinder(FrameBuffer *buffer)
 		<< "} timestamp:" << metadata.timestamp
 		<< "fps:" << Qt::fixed << qSetRealNumberPrecision(2) << fps;
 
-	/* Render the frame on the viewfinder. */
-	viewfinder_->render(buffer, mappedBuffers_[buffer].get());
+	/*
+	 * Render the frame on the viewfinder. CPU access to the frame ends
+	 * when the viewfinder releases it.
+	 */
+	Image *image = mappedBuffers_[buffer].get();
+	image->beginAccess();
+	viewfinder_->render(buffer, image);
 }
 
 void MainWindow::queueRequest(FrameBuffer *buffer)
 {
+	auto image = mappedBuffers_.find(buffer);
+	if (image != mappedBuffers_.end())
+		image->second->endAccess();
+
 	Request *request;
 	{
 		QMutexLocker locker(&mutex_);
@@ -16,6 +16,7 @@
 #include <QMutex>
 #include <QObject>
 #include <QQueue>
+#include <QThreadPool>
 #include <QTimer>
 
 #include <libcamera/camera.h>
@@ -32,6 +33,7 @@
 class QAction;
 class QComboBox;
 
+class DNGWriteEvent;
 class Image;
 class HotplugEvent;
 
@@ -83,6 +85,7 @@ private:
 	void requestComplete(libcamera::Request *request);
 	void processCapture();
 	void processHotplug(HotplugEvent *e);
+	void processDNGWrite(DNGWriteEvent *e);
 	void processViewfinder(libcamera::FrameBuffer *buffer);
 
 	/* UI elements */
@@ -125,4 +128,7 @@ private:
 	uint32_t framesCaptured_;
 
 	std::vector<std::unique_ptr<libcamera::Request>> requests_;
+
+	/* DNG files are written one at a time, in the background */
+	QThreadPool dngPool_;
 };
@@ -10,6 +10,7 @@
 #include <QByteArray>
 #include <QFile>
 #include <QImage>
+#include <QOpenGLContext>
 
 #include <libcamera/formats.h>
 
@@ -53,16 +54,101 @@ static const QList<libcamera::PixelFormat> supportedFormats{
 	libcamera::formats::SGBRG12_CSI2P,
 	libcamera::formats::SGRBG12_CSI2P,
 	libcamera::formats::SRGGB12_CSI2P,
+	/* Raw Bayer 10-bit, 12-bit and 16-bit in 16-bit containers */
+	libcamera::formats::SBGGR10,
+	libcamera::formats::SGBRG10,
+	libcamera::formats::SGRBG10,
+	libcamera::formats::SRGGB10,
+	libcamera::formats::SBGGR12,
+	libcamera::formats::SGBRG12,
+	libcamera::formats::SGRBG12,
+	libcamera::formats::SRGGB12,
+	libcamera::formats::SBGGR16,
+	libcamera::formats::SGBRG16,
+	libcamera::formats::SGRBG16,
+	libcamera::formats::SRGGB16,
+	/* Raw Bayer 10-bit IPU3 packed */
+	libcamera::formats::SBGGR10_IPU3,
+	libcamera::formats::SGBRG10_IPU3,
+	libcamera::formats::SGRBG10_IPU3,
+	libcamera::formats::SRGGB10_IPU3,
+	/* Compressed */
+	libcamera::formats::MJPEG,
 };
 
+#ifdef HAVE_EGL
+#ifndef GL_TEXTURE_EXTERNAL_OES
+#define GL_TEXTURE_EXTERNAL_OES 0x8D65
+#endif
+
+/*
+ * Raw Bayer formats have no DRM equivalent that EGL could sample from, they
+ * are always uploaded and demosaiced by the shaders. MJPEG frames are decoded
+ * before being uploaded.
+ */
+static bool isImportable(const libcamera::PixelFormat &format)
+{
+	switch (format) {
+	case libcamera::formats::SBGGR8:
+	case libcamera::formats::SGBRG8:
+	case libcamera::formats::SGRBG8:
+	case libcamera::formats::SRGGB8:
+	case libcamera::formats::SBGGR10_CSI2P:
+	case libcamera::formats::SGBRG10_CSI2P:
+	case libcamera::formats::SGRBG10_CSI2P:
+	case libcamera::formats::SRGGB10_CSI2P:
+	case libcamera::formats::SBGGR12_CSI2P:
+	case libcamera::formats::SGBRG12_CSI2P:
+	case libcamera::formats::SGRBG12_CSI2P:
+	case libcamera::formats::SRGGB12_CSI2P:
+	case libcamera::formats::SBGGR10:
+	case libcamera::formats::SGBRG10:
+	case libcamera::formats::SGRBG10:
+	case libcamera::formats::SRGGB10:
+	case libcamera::formats::SBGGR12:
+	case libcamera::formats::SGBRG12:
+	case libcamera::formats::SGRBG12:
+	case libcamera::formats::SRGGB12:
+	case libcamera::formats::SBGGR16:
+	case libcamera::formats::SGBRG16:
+	case libcamera::formats::SGRBG16:
+	case libcamera::formats::SRGGB16:
+	case libcamera::formats::SBGGR10_IPU3:
+	case libcamera::formats::SGBRG10_IPU3:
+	case libcamera::formats::SGRBG10_IPU3:
+	case libcamera::formats::SRGGB10_IPU3:
+	case libcamera::formats::MJPEG:
+		return false;
+	default:
+		return true;
+	}
+}
+#endif
+
 ViewFinderGL::ViewFinderGL(QWidget *parent)
 	: QOpenGLWidget(parent), buffer_(nullptr), image_(nullptr),
 	  vertexBuffer_(QOpenGLBuffer::VertexBuffer)
+#ifdef HAVE_EGL
+	  , dmabufImport_(false), dmabufModifiers_(false), dmabufFormat_(false),
+	  eglDisplay_(EGL_NO_DISPLAY), eglCreateImageKHR_(nullptr),
+	  eglDestroyImageKHR_(nullptr), glEGLImageTargetTexture2DOES_(nullptr),
+	  externalTexture_(0)
+#endif
 {
 }
 
 ViewFinderGL::~ViewFinderGL()
 {
+#ifdef HAVE_EGL
+	releaseImportedBuffers();
+
+	if (externalTexture_) {
+		makeCurrent();
+		glDeleteTextures(1, &externalTexture_);
+		doneCurrent();
+	}
+#endif
+
 	removeShader();
 }
 
@@ -89,6 +175,10 @@ int ViewFinderGL::setFormat(const libcamera::PixelFormat &format,
 			return -1;
 
 		format_ = format;
+
+#ifdef HAVE_EGL
+		dmabufFormat_ = isImportable(format);
+#endif
 	}
 
 	size_ = size;
@@ -105,6 +195,11 @@ void ViewFinderGL::stop()
 		buffer_ = nullptr;
 		image_ = nullptr;
 	}
+
+#ifdef HAVE_EGL
+	/* The frame buffers are freed once the viewfinder is stopped. */
+	releaseImportedBuffers();
+#endif
 }
 
 QImage ViewFinderGL::getCurrentImage()
@@ -307,6 +402,135 @@ bool ViewFinderGL::selectFormat(const libcamera::PixelFormat &format)
 		fragmentShaderFile_ = ":bayer_1x_packed.frag";
 		textureMinMagFilters_ = GL_NEAREST;
 		break;
+	case libcamera::formats::SBGGR10:
+		firstRed_.setX(1.0);
+		firstRed_.setY(1.0);
+		fragmentShaderDefines_.append("#define RAW16");
+		fragmentShaderDefines_.append("#define RAW16_MAX 1023.0");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SGBRG10:
+		firstRed_.setX(0.0);
+		firstRed_.setY(1.0);
+		fragmentShaderDefines_.append("#define RAW16");
+		fragmentShaderDefines_.append("#define RAW16_MAX 1023.0");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SGRBG10:
+		firstRed_.setX(1.0);
+		firstRed_.setY(0.0);
+		fragmentShaderDefines_.append("#define RAW16");
+		fragmentShaderDefines_.append("#define RAW16_MAX 1023.0");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SRGGB10:
+		firstRed_.setX(0.0);
+		firstRed_.setY(0.0);
+		fragmentShaderDefines_.append("#define RAW16");
+		fragmentShaderDefines_.append("#define RAW16_MAX 1023.0");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SBGGR12:
+		firstRed_.setX(1.0);
+		firstRed_.setY(1.0);
+		fragmentShaderDefines_.append("#define RAW16");
+		fragmentShaderDefines_.append("#define RAW16_MAX 4095.0");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SGBRG12:
+		firstRed_.setX(0.0);
+		firstRed_.setY(1.0);
+		fragmentShaderDefines_.append("#define RAW16");
+		fragmentShaderDefines_.append("#define RAW16_MAX 4095.0");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SGRBG12:
+		firstRed_.setX(1.0);
+		firstRed_.setY(0.0);
+		fragmentShaderDefines_.append("#define RAW16");
+		fragmentShaderDefines_.append("#define RAW16_MAX 4095.0");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SRGGB12:
+		firstRed_.setX(0.0);
+		firstRed_.setY(0.0);
+		fragmentShaderDefines_.append("#define RAW16");
+		fragmentShaderDefines_.append("#define RAW16_MAX 4095.0");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SBGGR16:
+		firstRed_.setX(1.0);
+		firstRed_.setY(1.0);
+		fragmentShaderDefines_.append("#define RAW16");
+		fragmentShaderDefines_.append("#define RAW16_MAX 65535.0");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SGBRG16:
+		firstRed_.setX(0.0);
+		firstRed_.setY(1.0);
+		fragmentShaderDefines_.append("#define RAW16");
+		fragmentShaderDefines_.append("#define RAW16_MAX 65535.0");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SGRBG16:
+		firstRed_.setX(1.0);
+		firstRed_.setY(0.0);
+		fragmentShaderDefines_.append("#define RAW16");
+		fragmentShaderDefines_.append("#define RAW16_MAX 65535.0");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SRGGB16:
+		firstRed_.setX(0.0);
+		firstRed_.setY(0.0);
+		fragmentShaderDefines_.append("#define RAW16");
+		fragmentShaderDefines_.append("#define RAW16_MAX 65535.0");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SBGGR10_IPU3:
+		firstRed_.setX(1.0);
+		firstRed_.setY(1.0);
+		fragmentShaderDefines_.append("#define IPU3");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SGBRG10_IPU3:
+		firstRed_.setX(0.0);
+		firstRed_.setY(1.0);
+		fragmentShaderDefines_.append("#define IPU3");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SGRBG10_IPU3:
+		firstRed_.setX(1.0);
+		firstRed_.setY(0.0);
+		fragmentShaderDefines_.append("#define IPU3");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::SRGGB10_IPU3:
+		firstRed_.setX(0.0);
+		firstRed_.setY(0.0);
+		fragmentShaderDefines_.append("#define IPU3");
+		fragmentShaderFile_ = ":bayer_1x.frag";
+		textureMinMagFilters_ = GL_NEAREST;
+		break;
+	case libcamera::formats::MJPEG:
+		/* Frames are decoded to RGBA by QImage. */
+		fragmentShaderDefines_.append("#define RGB_PATTERN rgb");
+		fragmentShaderFile_ = ":RGB.frag";
+		break;
 	default:
 		ret = false;
 		qWarning() << "[ViewFinderGL]:"
@@ -344,13 +568,27 @@ bool ViewFinderGL::createFragmentShader()
 	 */
 	fragmentShader_ = std::make_unique<QOpenGLShader>(QOpenGLShader::Fragment, this);
 
-	QFile file(fragmentShaderFile_);
+	QString fragmentShaderFile = fragmentShaderFile_;
+	QStringList fragmentShaderDefines = fragmentShaderDefines_;
+
+#ifdef HAVE_EGL
+	/*
+	 * Imported frames are sampled through an external texture, which
+	 * performs the format conversion in place of the format's own shader.
+	 */
+	if (dmabufImportEnabled()) {
+		fragmentShaderFile = ":external.frag";
+		fragmentShaderDefines.clear();
+	}
+#endif
+
+	QFile file(fragmentShaderFile);
 	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-		qWarning() << "Shader" << fragmentShaderFile_ << "not found";
+		qWarning() << "Shader" << fragmentShaderFile << "not found";
 		return false;
 	}
 
-	QString defines = fragmentShaderDefines_.join('\n') + "\n";
+	QString defines = fragmentShaderDefines.join('\n') + "\n";
 	QByteArray src = file.readAll();
 	src.prepend(defines.toUtf8());
 
@@ -460,11 +698,184 @@ void ViewFinderGL::initializeGL()
 	if (!createVertexShader())
 		qWarning() << "[ViewFinderGL]: create vertex shader failed.";
 
+#ifdef HAVE_EGL
+	initializeDmabufImport();
+#endif
+
 	glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
 }
 
+#ifdef HAVE_EGL
+void ViewFinderGL::initializeDmabufImport()
+{
+	/*
+	 * Importing dmabufs requires Qt to render through EGL, and sampling
+	 * them requires external textures, which only OpenGL ES provides.
+	 * Desktop OpenGL and GLX keep using the upload path.
+	 */
+	eglDisplay_ = eglGetCurrentDisplay();
+	if (eglDisplay_ == EGL_NO_DISPLAY || !context()->isOpenGLES() ||
+	    !context()->hasExtension("GL_OES_EGL_image_external"))
+		return;
+
+	const char *extensions = eglQueryString(eglDisplay_, EGL_EXTENSIONS);
+	QList<QByteArray> eglExtensions = QByteArray(extensions ? extensions : "").split(' ');
+	if (!eglExtensions.contains("EGL_KHR_image_base") ||
+	    !eglExtensions.contains("EGL_EXT_image_dma_buf_import"))
+		return;
+
+	dmabufModifiers_ = eglExtensions.contains("EGL_EXT_image_dma_buf_import_modifiers");
+
+	eglCreateImageKHR_ = reinterpret_cast<PFNEGLCREATEIMAGEKHRPROC>(
+		eglGetProcAddress("eglCreateImageKHR"));
+	eglDestroyImageKHR_ = reinterpret_cast<PFNEGLDESTROYIMAGEKHRPROC>(
+		eglGetProcAddress("eglDestroyImageKHR"));
+	glEGLImageTargetTexture2DOES_ = reinterpret_cast<decltype(glEGLImageTargetTexture2DOES_)>(
+		context()->getProcAddress("glEGLImageTargetTexture2DOES"));
+	if (!eglCreateImageKHR_ || !eglDestroyImageKHR_ ||
+	    !glEGLImageTargetTexture2DOES_)
+		return;
+
+	glGenTextures(1, &externalTexture_);
+	dmabufImport_ = true;
+
+	qInfo() << "[ViewFinderGL]:" << "importing frame buffers through EGL";
+}
+
+bool ViewFinderGL::dmabufImportEnabled() const
+{
+	return dmabufImport_ && dmabufFormat_;
+}
+
+EGLImageKHR ViewFinderGL::importBuffer(libcamera::FrameBuffer *buffer)
+{
+	static const EGLint planeAttributes[3][5] = {
+		{
+			EGL_DMA_BUF_PLANE0_FD_EXT,
+			EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+			EGL_DMA_BUF_PLANE0_PITCH_EXT,
+			EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT,
+			EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT,
+		}, {
+			EGL_DMA_BUF_PLANE1_FD_EXT,
+			EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+			EGL_DMA_BUF_PLANE1_PITCH_EXT,
+			EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+			EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT,
+		}, {
+			EGL_DMA_BUF_PLANE2_FD_EXT,
+			EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+			EGL_DMA_BUF_PLANE2_PITCH_EXT,
+			EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT,
+			EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT,
+		},
+	};
+
+	/*
+	 * The buffers are reused by the camera, import each of them once and
+	 * keep the image until the viewfinder is stopped.
+	 */
+	auto iter = importedBuffers_.find(buffer);
+	if (iter != importedBuffers_.end())
+		return iter->second;
+
+	const std::vector<libcamera::FrameBuffer::Plane> &planes = buffer->planes();
+	if (planes.empty() || planes.size() > std::size(planeAttributes))
+		return EGL_NO_IMAGE_KHR;
+
+	/* Without the modifiers extension only linear buffers can be imported. */
+	uint64_t modifier = format_.modifier();
+	if (modifier && !dmabufModifiers_)
+		return EGL_NO_IMAGE_KHR;
+
+	/*
+	 * Hint the BT.601 limited range encoding that the upload shaders
+	 * assume, for the conversions to match.
+	 */
+	std::vector<EGLint> attributes = {
+		EGL_WIDTH, size_.width(),
+		EGL_HEIGHT, size_.height(),
+		EGL_LINUX_DRM_FOURCC_EXT, static_cast<EGLint>(format_.fourcc()),
+		EGL_YUV_COLOR_SPACE_HINT_EXT, EGL_ITU_REC601_EXT,
+		EGL_SAMPLE_RANGE_HINT_EXT, EGL_YUV_NARROW_RANGE_EXT,
+	};
+
+	for (unsigned int i = 0; i < planes.size(); ++i) {
+		const EGLint *names = planeAttributes[i];
+		unsigned int pitch;
+
+		/*
+		 * The chroma planes of the semi-planar formats interleave two
+		 * components, the fully planar formats store them separately.
+		 */
+		if (i == 0)
+			pitch = stride_;
+		else if (planes.size() == 2)
+			pitch = stride_ * 2 / horzSubSample_;
+		else
+			pitch = stride_ / horzSubSample_;
+
+		attributes.insert(attributes.end(), {
+			names[0], planes[i].fd.fd(),
+			names[1], static_cast<EGLint>(planes[i].offset),
+			names[2], static_cast<EGLint>(pitch),
+		});
+
+		if (dmabufModifiers_)
+			attributes.insert(attributes.end(), {
+				names[3], static_cast<EGLint>(modifier & 0xffffffff),
+				names[4], static_cast<EGLint>(modifier >> 32),
+			});
+	}
+
+	attributes.push_back(EGL_NONE);
+
+	EGLImageKHR image = eglCreateImageKHR_(eglDisplay_, EGL_NO_CONTEXT,
+					       EGL_LINUX_DMA_BUF_EXT, nullptr,
+					       attributes.data());
+	if (image == EGL_NO_IMAGE_KHR)
+		return image;
+
+	importedBuffers_[buffer] = image;
+	return image;
+}
+
+void ViewFinderGL::releaseImportedBuffers()
+{
+	for (const auto &entry : importedBuffers_)
+		eglDestroyImageKHR_(eglDisplay_, entry.second);
+
+	importedBuffers_.clear();
+}
+
+void ViewFinderGL::doRenderImported(EGLImageKHR image)
+{
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_EXTERNAL_OES, externalTexture_);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glEGLImageTargetTexture2DOES_(GL_TEXTURE_EXTERNAL_OES, image);
+	shaderProgram_.setUniformValue(textureUniformY_, 0);
+
+	/*
+	 * The image is created with the frame size, the texture coordinates
+	 * cover the active portion of the frame only.
+	 */
+	shaderProgram_.setUniformValue(textureUniformStrideFactor_, 1.0f);
+}
+#endif
+
 void ViewFinderGL::doRender()
 {
+#ifdef HAVE_EGL
+	if (dmabufImportEnabled()) {
+		doRenderImported(importBuffer(buffer_));
+		return;
+	}
+#endif
+
 	/* Stride of the first plane, in pixels. */
 	unsigned int stridePixels;
 
@@ -716,6 +1127,109 @@ void ViewFinderGL::doRender()
 		stridePixels = size_.width();
 		break;
 
+	case libcamera::formats::SBGGR10:
+	case libcamera::formats::SGBRG10:
+	case libcamera::formats::SGRBG10:
+	case libcamera::formats::SRGGB10:
+	case libcamera::formats::SBGGR12:
+	case libcamera::formats::SGBRG12:
+	case libcamera::formats::SGRBG12:
+	case libcamera::formats::SRGGB12:
+	case libcamera::formats::SBGGR16:
+	case libcamera::formats::SGBRG16:
+	case libcamera::formats::SGRBG16:
+	case libcamera::formats::SRGGB16:
+		/*
+		 * Raw Bayer formats in 16-bit containers are stored in a
+		 * GL_LUMINANCE_ALPHA texture, with one texel per pixel holding
+		 * the LS byte in luminance and the MS byte in alpha.
+		 */
+		glActiveTexture(GL_TEXTURE0);
+		configureTexture(*textures_[0]);
+		glTexImage2D(GL_TEXTURE_2D,
+			     0,
+			     GL_LUMINANCE_ALPHA,
+			     stride_ / 2,
+			     size_.height(),
+			     0,
+			     GL_LUMINANCE_ALPHA,
+			     GL_UNSIGNED_BYTE,
+			     image_->data(0).data());
+		shaderProgram_.setUniformValue(textureUniformY_, 0);
+		shaderProgram_.setUniformValue(textureUniformBayerFirstRed_,
+					       firstRed_);
+		shaderProgram_.setUniformValue(textureUniformSize_,
+					       size_.width(), /* in pixels */
+					       size_.height());
+		shaderProgram_.setUniformValue(textureUniformStep_,
+					       1.0f / (stride_ / 2),
+					       1.0f / size_.height());
+
+		/* The shader addresses pixels directly. */
+		stridePixels = size_.width();
+		break;
+
+	case libcamera::formats::SBGGR10_IPU3:
+	case libcamera::formats::SGBRG10_IPU3:
+	case libcamera::formats::SGRBG10_IPU3:
+	case libcamera::formats::SRGGB10_IPU3:
+		/*
+		 * IPU3 packed raw Bayer formats are stored in a GL_LUMINANCE
+		 * texture with one texel per byte, unpacked by the shader.
+		 */
+		glActiveTexture(GL_TEXTURE0);
+		configureTexture(*textures_[0]);
+		glTexImage2D(GL_TEXTURE_2D,
+			     0,
+			     GL_LUMINANCE,
+			     stride_,
+			     size_.height(),
+			     0,
+			     GL_LUMINANCE,
+			     GL_UNSIGNED_BYTE,
+			     image_->data(0).data());
+		shaderProgram_.setUniformValue(textureUniformY_, 0);
+		shaderProgram_.setUniformValue(textureUniformBayerFirstRed_,
+					       firstRed_);
+		shaderProgram_.setUniformValue(textureUniformSize_,
+					       size_.width(), /* in pixels */
+					       size_.height());
+		shaderProgram_.setUniformValue(textureUniformStep_,
+					       1.0f / stride_,
+					       1.0f / size_.height());
+
+		/* The shader addresses pixels directly. */
+		stridePixels = size_.width();
+		break;
+
+	case libcamera::formats::MJPEG: {
+		/*
+		 * Decode the frame to RGBA, with the same decoder as the Qt
+		 * viewfinder, and upload the result.
+		 */
+		const libcamera::FrameMetadata::Plane &plane =
+			buffer_->metadata().planes()[0];
+		QImage frame;
+		frame.loadFromData(image_->data(0).data(), plane.bytesused, "JPEG");
+		frame = frame.convertToFormat(QImage::Format_RGBA8888);
+
+		glActiveTexture(GL_TEXTURE0);
+		configureTexture(*textures_[0]);
+		glTexImage2D(GL_TEXTURE_2D,
+			     0,
+			     GL_RGBA,
+			     frame.width(),
+			     frame.height(),
+			     0,
+			     GL_RGBA,
+			     GL_UNSIGNED_BYTE,
+			     frame.constBits());
+		shaderProgram_.setUniformValue(textureUniformY_, 0);
+
+		stridePixels = size_.width();
+		break;
+	}
+
 	default:
 		stridePixels = size_.width();
 		break;
@@ -733,6 +1247,25 @@ void ViewFinderGL::doRender()
 
 void ViewFinderGL::paintGL()
 {
+#ifdef HAVE_EGL
+	/*
+	 * Import the frame before creating the fragment shader, a failed
+	 * import falls back to uploading the frames with the format's shader.
+	 */
+	if (image_ && dmabufImportEnabled() &&
+	    importBuffer(buffer_) == EGL_NO_IMAGE_KHR) {
+		qWarning() << "[ViewFinderGL]:"
+			   << "failed to import frame buffer, uploading frames";
+		dmabufFormat_ = false;
+
+		if (fragmentShader_) {
+			shaderProgram_.release();
+			shaderProgram_.removeShader(fragmentShader_.get());
+			fragmentShader_.reset();
+		}
+	}
+#endif
+
 	if (!fragmentShader_)
 		if (!createFragmentShader()) {
 			qWarning() << "[ViewFinderGL]:"
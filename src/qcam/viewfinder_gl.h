@@ -9,6 +9,7 @@
 #pragma once
 
 #include <array>
+#include <map>
 #include <memory>
 
 #include <QImage>
@@ -24,6 +25,15 @@
 #include <libcamera/formats.h>
 #include <libcamera/framebuffer.h>
 
+#ifdef HAVE_EGL
+/* Keep the X11 headers, and their macros clashing with Qt, out. */
+#ifndef EGL_NO_X11
+#define EGL_NO_X11
+#endif
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 #include "viewfinder.h"
 
 class ViewFinderGL : public QOpenGLWidget,
@@ -63,6 +73,14 @@ private:
 	void removeShader();
 	void doRender();
 
+#ifdef HAVE_EGL
+	void initializeDmabufImport();
+	bool dmabufImportEnabled() const;
+	EGLImageKHR importBuffer(libcamera::FrameBuffer *buffer);
+	void releaseImportedBuffers();
+	void doRenderImported(EGLImageKHR image);
+#endif
+
 	/* Captured image size, format and buffer */
 	libcamera::FrameBuffer *buffer_;
 	libcamera::PixelFormat format_;
@@ -101,5 +119,18 @@ private:
 	GLuint textureUniformBayerFirstRed_;
 	QPointF firstRed_;
 
+#ifdef HAVE_EGL
+	/* dmabuf import parameters */
+	bool dmabufImport_;
+	bool dmabufModifiers_;
+	bool dmabufFormat_;
+	EGLDisplay eglDisplay_;
+	PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR_;
+	PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR_;
+	void (*glEGLImageTargetTexture2DOES_)(GLenum target, void *image);
+	GLuint externalTexture_;
+	std::map<libcamera::FrameBuffer *, EGLImageKHR> importedBuffers_;
+#endif
+
 	QMutex mutex_; /* Prevent concurrent access to image_ */
 };
@@ -8,9 +8,13 @@
 #include "v4l2_camera.h"
 
 #include <errno.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+#include "libcamera/internal/formats.h"
 
 using namespace libcamera;
 
@@ -18,7 +22,8 @@ LOG_DECLARE_CATEGORY(V4L2Compat)
 
 V4L2Camera::V4L2Camera(std::shared_ptr<Camera> camera)
 	: camera_(camera), isRunning_(false), bufferAllocator_(nullptr),
-	  efd_(-1), bufferAvailableCount_(0)
+	  maxInFlight_(0), inFlight_(0), completionHead_(0), completionTail_(0),
+	  efd_(-1), waiters_(0)
 {
 	camera_->requestCompleted.connect(this, &V4L2Camera::requestComplete);
 }
@@ -67,17 +72,46 @@ void V4L2Camera::unbind()
 	efd_ = -1;
 }
 
-std::vector<V4L2Camera::Buffer> V4L2Camera::completedBuffers()
+/*
+ * Append all the buffers completed since the last call to \a buffers. The
+ * caller must serialize calls to this function.
+ */
+void V4L2Camera::completedBuffers(std::vector<Buffer> *buffers)
 {
-	std::vector<Buffer> v;
+	uint64_t tail = completionTail_.load(std::memory_order_relaxed);
+	uint64_t head = completionHead_.load(std::memory_order_acquire);
 
-	bufferLock_.lock();
-	for (std::unique_ptr<Buffer> &metadata : completedBuffers_)
-		v.push_back(*metadata.get());
-	completedBuffers_.clear();
-	bufferLock_.unlock();
+	for (; tail != head; ++tail)
+		buffers->push_back(completions_[tail % completions_.size()]);
+
+	completionTail_.store(tail, std::memory_order_release);
+}
+
+bool V4L2Camera::hasCompletedBuffers() const
+{
+	return completionHead_.load(std::memory_order_acquire) !=
+	       completionTail_.load(std::memory_order_acquire);
+}
+
+/*
+ * Drop the completed buffers that haven't been consumed, and the matching
+ * eventfd counts, to keep poll() consistent with dqbuf. Must only be called
+ * when the camera is stopped.
+ */
+void V4L2Camera::resetCompletions()
+{
+	completionTail_.store(completionHead_.load());
 
-	return v;
+	int efd = efd_.load();
+	if (efd < 0)
+		return;
+
+	struct pollfd pfd = { efd, POLLIN, 0 };
+	uint64_t data;
+	while (::poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN)) {
+		if (::read(efd, &data, sizeof(data)) != sizeof(data))
+			break;
+	}
 }
 
 void V4L2Camera::requestComplete(Request *request)
@@ -86,24 +120,55 @@ void V4L2Camera::requestComplete(Request *request)
 		return;
 
 	/* We only have one stream at the moment. */
-	bufferLock_.lock();
 	FrameBuffer *buffer = request->buffers().begin()->second;
-	std::unique_ptr<Buffer> metadata =
-		std::make_unique<Buffer>(request->cookie(), buffer->metadata());
-	completedBuffers_.push_back(std::move(metadata));
+	uint64_t head = completionHead_.load(std::memory_order_relaxed);
+	Buffer &completion = completions_[head % completions_.size()];
+	completion.index_ = request->cookie();
+	completion.data_ = buffer->metadata();
+
+	/*
+	 * Publish the completion with sequential consistency, to order it
+	 * with the waiters_ check below.
+	 */
+	completionHead_.store(head + 1);
+
+	/* Queue the next request held back by the in-flight limit. */
+	Request *next = nullptr;
+	bufferLock_.lock();
+	inFlight_--;
+	if (!pendingRequests_.empty()) {
+		next = pendingRequests_.front();
+		pendingRequests_.pop_front();
+		inFlight_++;
+	}
 	bufferLock_.unlock();
 
-	uint64_t data = 1;
-	int ret = ::write(efd_, &data, sizeof(data));
-	if (ret != sizeof(data))
-		LOG(V4L2Compat, Error) << "Failed to signal eventfd POLLIN";
+	/*
+	 * Signal one eventfd count per buffer. The file eventfd is created in
+	 * semaphore mode, every write wakes up edge-triggered epoll waiters,
+	 * and level-triggered poll() stays readable until all completed
+	 * buffers have been dequeued.
+	 */
+	int efd = efd_.load();
+	if (efd >= 0) {
+		uint64_t data = 1;
+		int ret = ::write(efd, &data, sizeof(data));
+		if (ret != sizeof(data))
+			LOG(V4L2Compat, Error) << "Failed to signal eventfd POLLIN";
+	}
 
 	request->reuse();
-	{
-		MutexLocker locker(bufferMutex_);
-		bufferAvailableCount_++;
+
+	if (waiters_.load()) {
+		/* Synchronize with waiters between their check and their wait. */
+		{
+			MutexLocker locker(bufferMutex_);
+		}
+		bufferCV_.notify_all();
 	}
-	bufferCV_.notify_all();
+
+	if (next && camera_->queueRequest(next) < 0)
+		LOG(V4L2Compat, Error) << "Can't queue request";
 }
 
 int V4L2Camera::configure(StreamConfiguration *streamConfigOut,
@@ -157,13 +222,11 @@ int V4L2Camera::validateConfiguration(const PixelFormat &pixelFormat,
 	return 0;
 }
 
-int V4L2Camera::allocBuffers(unsigned int count)
+int V4L2Camera::createRequests(unsigned int count)
 {
-	Stream *stream = config_->at(0).stream();
-
-	int ret = bufferAllocator_->allocate(stream);
-	if (ret < 0)
-		return ret;
+	completions_.assign(count, Buffer(0, {}));
+	completionHead_ = 0;
+	completionTail_ = 0;
 
 	for (unsigned int i = 0; i < count; i++) {
 		std::unique_ptr<Request> request = camera_->createRequest(i);
@@ -174,13 +237,46 @@ int V4L2Camera::allocBuffers(unsigned int count)
 		requestPool_.push_back(std::move(request));
 	}
 
-	return ret;
+	return 0;
+}
+
+int V4L2Camera::allocBuffers(unsigned int count)
+{
+	Stream *stream = config_->at(0).stream();
+
+	int ret = bufferAllocator_->allocate(stream);
+	if (ret < 0)
+		return ret;
+
+	maxInFlight_ = count;
+
+	return createRequests(count);
+}
+
+/*
+ * Prepare \a count slots for buffers imported from dmabufs with
+ * setBufferFd(). The number of slots isn't bound by the buffer count of the
+ * stream configuration, requests beyond that count are held back until
+ * previous requests complete.
+ */
+int V4L2Camera::importBuffers(unsigned int count)
+{
+	importedBuffers_.resize(count);
+	maxInFlight_ = config_->at(0).bufferCount;
+
+	return createRequests(count);
 }
 
 void V4L2Camera::freeBuffers()
 {
-	pendingRequests_.clear();
+	{
+		MutexLocker locker(bufferLock_);
+		pendingRequests_.clear();
+	}
+
+	resetCompletions();
 	requestPool_.clear();
+	importedBuffers_.clear();
 
 	Stream *stream = config_->at(0).stream();
 	bufferAllocator_->free(stream);
@@ -198,6 +294,72 @@ FileDescriptor V4L2Camera::getBufferFd(unsigned int index)
 	return buffers[index]->planes()[0].fd;
 }
 
+/*
+ * Associate the dmabuf \a fd with the imported buffer slot \a index. The
+ * dmabuf is expected to store all colour planes contiguously, as for the V4L2
+ * single-planar API. The FrameBuffer is reused when the same dmabuf is queued
+ * again in the same slot.
+ */
+int V4L2Camera::setBufferFd(unsigned int index, int fd)
+{
+	if (index >= importedBuffers_.size())
+		return -EINVAL;
+
+	/* The fd comes from the application, validate it first. */
+	ino_t inode = FileDescriptor::inode(fd);
+	if (!inode)
+		return -EBADF;
+
+	/* Avoid duplicating the fd when the same dmabuf is queued again. */
+	std::unique_ptr<FrameBuffer> &buffer = importedBuffers_[index];
+	if (buffer && buffer->planes()[0].fd.inode() == inode)
+		return 0;
+
+	FileDescriptor dmabuf(fd);
+	if (!dmabuf.isValid())
+		return -EBADF;
+
+	const StreamConfiguration &cfg = config_->at(0);
+	const PixelFormatInfo &info = PixelFormatInfo::info(cfg.pixelFormat);
+	if (!info.isValid())
+		return -EINVAL;
+
+	off_t length = lseek(dmabuf.fd(), 0, SEEK_END);
+	if (length < 0 || static_cast<size_t>(length) < cfg.frameSize) {
+		LOG(V4L2Compat, Error)
+			<< "dmabuf too small for " << cfg.toString();
+		return -EINVAL;
+	}
+
+	std::vector<FrameBuffer::Plane> planes(info.numPlanes());
+	unsigned int offset = 0;
+
+	for (auto [i, plane] : utils::enumerate(planes)) {
+		/* Compute the stride of the chroma planes from the first one. */
+		unsigned int stride = cfg.stride
+				    * info.planes[i].bytesPerGroup
+				    / info.planes[0].bytesPerGroup;
+
+		plane.fd = dmabuf;
+		plane.offset = offset;
+		plane.length = info.planeSize(cfg.size.height, i, stride);
+		offset += plane.length;
+	}
+
+	buffer = std::make_unique<FrameBuffer>(std::move(planes), index);
+
+	return 0;
+}
+
+FrameBuffer *V4L2Camera::buffer(unsigned int index)
+{
+	if (!importedBuffers_.empty())
+		return importedBuffers_[index].get();
+
+	Stream *stream = config_->at(0).stream();
+	return bufferAllocator_->buffers(stream)[index].get();
+}
+
 int V4L2Camera::streamOn()
 {
 	if (isRunning_)
@@ -209,15 +371,26 @@ int V4L2Camera::streamOn()
 
 	isRunning_ = true;
 
-	for (Request *req : pendingRequests_) {
+	std::vector<Request *> requests;
+
+	{
+		MutexLocker locker(bufferLock_);
+
+		inFlight_ = 0;
+		while (!pendingRequests_.empty() && inFlight_ < maxInFlight_) {
+			requests.push_back(pendingRequests_.front());
+			pendingRequests_.pop_front();
+			inFlight_++;
+		}
+	}
+
+	for (Request *req : requests) {
 		/* \todo What should we do if this returns -EINVAL? */
 		ret = camera_->queueRequest(req);
 		if (ret < 0)
 			return ret == -EACCES ? -EBUSY : ret;
 	}
 
-	pendingRequests_.clear();
-
 	return 0;
 }
 
@@ -230,12 +403,19 @@ int V4L2Camera::streamOff()
 		return 0;
 	}
 
-	pendingRequests_.clear();
+	{
+		MutexLocker locker(bufferLock_);
+		pendingRequests_.clear();
+	}
 
 	int ret = camera_->stop();
 	if (ret < 0)
 		return ret == -EACCES ? -EBUSY : ret;
 
+	inFlight_ = 0;
+
+	resetCompletions();
+
 	{
 		MutexLocker locker(bufferMutex_);
 		isRunning_ = false;
@@ -253,22 +433,37 @@ int V4L2Camera::qbuf(unsigned int index)
 	}
 	Request *request = requestPool_[index].get();
 
+	FrameBuffer *frameBuffer = buffer(index);
+	if (!frameBuffer) {
+		LOG(V4L2Compat, Error) << "No buffer imported at index " << index;
+		return -EINVAL;
+	}
+
 	Stream *stream = config_->at(0).stream();
-	FrameBuffer *buffer = bufferAllocator_->buffers(stream)[index].get();
-	int ret = request->addBuffer(stream, buffer);
+	int ret = request->addBuffer(stream, frameBuffer);
 	if (ret < 0) {
 		LOG(V4L2Compat, Error) << "Can't set buffer for request";
 		return -ENOMEM;
 	}
 
-	if (!isRunning_) {
-		pendingRequests_.push_back(request);
-		return 0;
+	{
+		MutexLocker locker(bufferLock_);
+
+		if (!isRunning_ || inFlight_ >= maxInFlight_) {
+			pendingRequests_.push_back(request);
+			return 0;
+		}
+
+		inFlight_++;
 	}
 
 	ret = camera_->queueRequest(request);
 	if (ret < 0) {
 		LOG(V4L2Compat, Error) << "Can't queue request";
+
+		MutexLocker locker(bufferLock_);
+		inFlight_--;
+
 		return ret == -EACCES ? -EBUSY : ret;
 	}
 
@@ -278,21 +473,12 @@ int V4L2Camera::qbuf(unsigned int index)
 void V4L2Camera::waitForBufferAvailable()
 {
 	MutexLocker locker(bufferMutex_);
+
+	waiters_++;
 	bufferCV_.wait(locker, [&] {
-			       return bufferAvailableCount_ >= 1 || !isRunning_;
+			       return hasCompletedBuffers() || !isRunning_;
 		       });
-	if (isRunning_)
-		bufferAvailableCount_--;
-}
-
-bool V4L2Camera::isBufferAvailable()
-{
-	MutexLocker locker(bufferMutex_);
-	if (bufferAvailableCount_ < 1)
-		return false;
-
-	bufferAvailableCount_--;
-	return true;
+	waiters_--;
 }
 
 bool V4L2Camera::isRunning()
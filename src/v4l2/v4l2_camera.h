@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <deque>
 #include <mutex>
 #include <utility>
@@ -39,7 +40,8 @@ public:
 	void bind(int efd);
 	void unbind();
 
-	std::vector<Buffer> completedBuffers();
+	void completedBuffers(std::vector<Buffer> *buffers);
+	bool hasCompletedBuffers() const;
 
 	int configure(libcamera::StreamConfiguration *streamConfigOut,
 		      const libcamera::Size &size,
@@ -50,8 +52,10 @@ public:
 				  libcamera::StreamConfiguration *streamConfigOut);
 
 	int allocBuffers(unsigned int count);
+	int importBuffers(unsigned int count);
 	void freeBuffers();
 	libcamera::FileDescriptor getBufferFd(unsigned int index);
+	int setBufferFd(unsigned int index, int fd);
 
 	int streamOn();
 	int streamOff();
@@ -59,12 +63,15 @@ public:
 	int qbuf(unsigned int index);
 
 	void waitForBufferAvailable();
-	bool isBufferAvailable();
 
 	bool isRunning();
 
 private:
+	int createRequests(unsigned int count);
+	libcamera::FrameBuffer *buffer(unsigned int index);
+	int queueRequest(libcamera::Request *request);
 	void requestComplete(libcamera::Request *request);
+	void resetCompletions();
 
 	std::shared_ptr<libcamera::Camera> camera_;
 	std::unique_ptr<libcamera::CameraConfiguration> config_;
@@ -75,13 +82,36 @@ private:
 	libcamera::FrameBufferAllocator *bufferAllocator_;
 
 	std::vector<std::unique_ptr<libcamera::Request>> requestPool_;
-
+	std::vector<std::unique_ptr<libcamera::FrameBuffer>> importedBuffers_;
+
+	/*
+	 * Requests waiting to be queued to the camera, either because the
+	 * camera isn't running or because the maximum number of requests in
+	 * flight has been reached. Protected by bufferLock_, along with
+	 * inFlight_.
+	 */
 	std::deque<libcamera::Request *> pendingRequests_;
-	std::deque<std::unique_ptr<Buffer>> completedBuffers_;
-
-	int efd_;
-
+	unsigned int maxInFlight_;
+	unsigned int inFlight_;
+
+	/*
+	 * Single-producer single-consumer ring of completed buffers, sized to
+	 * the number of requests as a request can't complete again before its
+	 * buffer has been consumed. The camera thread produces at the head,
+	 * the proxy consumes at the tail with its own mutex held.
+	 */
+	std::vector<Buffer> completions_;
+	std::atomic<uint64_t> completionHead_;
+	std::atomic<uint64_t> completionTail_;
+
+	std::atomic<int> efd_;
+
+	/*
+	 * Blocking dequeue waits on bufferCV_. The condition variable is only
+	 * signalled when waiters_ is non-zero, to keep the mutex out of the
+	 * completion path of non-blocking applications.
+	 */
 	libcamera::Mutex bufferMutex_;
 	std::condition_variable bufferCV_;
-	unsigned int bufferAvailableCount_;
+	std::atomic<unsigned int> waiters_;
 };
@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <array>
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/videodev2.h>
 #include <numeric>
 #include <set>
@@ -38,7 +39,7 @@ LOG_DECLARE_CATEGORY(V4L2Compat)
 
 V4L2CameraProxy::V4L2CameraProxy(unsigned int index,
 				 std::shared_ptr<Camera> camera)
-	: refcount_(0), index_(index), bufferCount_(0), currentBuf_(0),
+	: refcount_(0), index_(index), bufferCount_(0), memory_(V4L2_MEMORY_MMAP),
 	  vcam_(std::make_unique<V4L2Camera>(camera)), owner_(nullptr)
 {
 	querycap(camera);
@@ -102,7 +103,7 @@ void *V4L2CameraProxy::mmap(void *addr, size_t length, int prot, int flags,
 	MutexLocker locker(proxyMutex_);
 
 	/* \todo Validate prot and flags properly. */
-	if (prot != (PROT_READ | PROT_WRITE)) {
+	if (prot != (PROT_READ | PROT_WRITE) || memory_ != V4L2_MEMORY_MMAP) {
 		errno = EINVAL;
 		return MAP_FAILED;
 	}
@@ -160,7 +161,7 @@ bool V4L2CameraProxy::validateBufferType(uint32_t type)
 
 bool V4L2CameraProxy::validateMemoryType(uint32_t memory)
 {
-	return memory == V4L2_MEMORY_MMAP;
+	return memory == V4L2_MEMORY_MMAP || memory == V4L2_MEMORY_DMABUF;
 }
 
 void V4L2CameraProxy::setFmtFromConfig(const StreamConfiguration &streamConfig)
@@ -205,8 +206,10 @@ void V4L2CameraProxy::querycap(std::shared_ptr<Camera> camera)
 
 void V4L2CameraProxy::updateBuffers()
 {
-	std::vector<V4L2Camera::Buffer> completedBuffers = vcam_->completedBuffers();
-	for (const V4L2Camera::Buffer &buffer : completedBuffers) {
+	completions_.clear();
+	vcam_->completedBuffers(&completions_);
+
+	for (const V4L2Camera::Buffer &buffer : completions_) {
 		const FrameMetadata &fmd = buffer.data_;
 		struct v4l2_buffer &buf = buffers_[buffer.index_];
 
@@ -230,6 +233,8 @@ void V4L2CameraProxy::updateBuffers()
 		default:
 			break;
 		}
+
+		completedBuffers_.push_back(buffer.index_);
 	}
 }
 
@@ -449,6 +454,7 @@ void V4L2CameraProxy::freeBuffers()
 
 	vcam_->freeBuffers();
 	buffers_.clear();
+	completedBuffers_.clear();
 	bufferCount_ = 0;
 }
 
@@ -468,7 +474,8 @@ int V4L2CameraProxy::vidioc_reqbufs(V4L2CameraFile *file, struct v4l2_requestbuf
 	if (!hasOwnership(file) && owner_)
 		return -EBUSY;
 
-	arg->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP;
+	arg->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP
+			  | V4L2_BUF_CAP_SUPPORTS_DMABUF;
 	memset(arg->reserved, 0, sizeof(arg->reserved));
 
 	if (arg->count == 0) {
@@ -497,22 +504,36 @@ int V4L2CameraProxy::vidioc_reqbufs(V4L2CameraFile *file, struct v4l2_requestbuf
 
 	setFmtFromConfig(streamConfig_);
 
-	arg->count = streamConfig_.bufferCount;
-	bufferCount_ = arg->count;
+	/*
+	 * Buffers allocated by libcamera are limited to the count of the
+	 * stream configuration, while any number of dmabufs can be imported as
+	 * requests are then held back until previous ones complete.
+	 */
+	if (arg->memory == V4L2_MEMORY_MMAP) {
+		arg->count = streamConfig_.bufferCount;
+		ret = vcam_->allocBuffers(arg->count);
+	} else {
+		arg->count = std::min<unsigned int>(arg->count, VIDEO_MAX_FRAME);
+		ret = vcam_->importBuffers(arg->count);
+	}
 
-	ret = vcam_->allocBuffers(arg->count);
 	if (ret < 0) {
+		vcam_->freeBuffers();
 		arg->count = 0;
 		return ret;
 	}
 
+	bufferCount_ = arg->count;
+	memory_ = arg->memory;
+
 	buffers_.resize(arg->count);
 	for (unsigned int i = 0; i < arg->count; i++) {
 		struct v4l2_buffer buf = {};
 		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		buf.length = v4l2PixFormat_.sizeimage;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.m.offset = i * v4l2PixFormat_.sizeimage;
+		buf.memory = memory_;
+		if (memory_ == V4L2_MEMORY_MMAP)
+			buf.m.offset = i * v4l2PixFormat_.sizeimage;
 		buf.index = i;
 		buf.flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
 
@@ -559,11 +580,20 @@ int V4L2CameraProxy::vidioc_qbuf(V4L2CameraFile *file, struct v4l2_buffer *arg)
 		return -EBUSY;
 
 	if (!validateBufferType(arg->type) ||
-	    !validateMemoryType(arg->memory) ||
+	    arg->memory != memory_ ||
 	    arg->index >= bufferCount_)
 		return -EINVAL;
 
-	int ret = vcam_->qbuf(arg->index);
+	int ret;
+	if (memory_ == V4L2_MEMORY_DMABUF) {
+		ret = vcam_->setBufferFd(arg->index, arg->m.fd);
+		if (ret < 0)
+			return ret;
+
+		buffers_[arg->index].m.fd = arg->m.fd;
+	}
+
+	ret = vcam_->qbuf(arg->index);
 	if (ret < 0)
 		return ret;
 
@@ -589,33 +619,47 @@ int V4L2CameraProxy::vidioc_dqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
 		return -EINVAL;
 
 	if (!validateBufferType(arg->type) ||
-	    !validateMemoryType(arg->memory))
+	    arg->memory != memory_)
 		return -EINVAL;
 
-	if (!file->nonBlocking()) {
+	/*
+	 * Collect all the buffers completed so far in one batch, subsequent
+	 * dequeues are then served without touching the camera completion
+	 * queue.
+	 */
+	if (completedBuffers_.empty())
+		updateBuffers();
+
+	while (completedBuffers_.empty()) {
+		if (file->nonBlocking())
+			return -EAGAIN;
+
 		locker->unlock();
 		vcam_->waitForBufferAvailable();
 		locker->lock();
-	} else if (!vcam_->isBufferAvailable())
-		return -EAGAIN;
+
+		/*
+		 * We need to check here again in case stream was turned off
+		 * while we were blocked on waitForBufferAvailable().
+		 */
+		if (!vcam_->isRunning())
+			return -EINVAL;
+
+		updateBuffers();
+	}
 
 	/*
-	 * We need to check here again in case stream was turned off while we
-	 * were blocked on waitForBufferAvailable().
+	 * Dequeue buffers in completion order, applications may queue them in
+	 * any order.
 	 */
-	if (!vcam_->isRunning())
-		return -EINVAL;
-
-	updateBuffers();
 
-	struct v4l2_buffer &buf = buffers_[currentBuf_];
+	struct v4l2_buffer &buf = buffers_[completedBuffers_.front()];
+	completedBuffers_.pop_front();
 
 	buf.flags &= ~(V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE);
 	buf.length = sizeimage_;
 	*arg = buf;
 
-	currentBuf_ = (currentBuf_ + 1) % bufferCount_;
-
 	uint64_t data;
 	int ret = ::read(file->efd(), &data, sizeof(data));
 	if (ret != sizeof(data))
@@ -643,7 +687,7 @@ int V4L2CameraProxy::vidioc_streamon(V4L2CameraFile *file, int *arg)
 	if (vcam_->isRunning())
 		return 0;
 
-	currentBuf_ = 0;
+	completedBuffers_.clear();
 
 	return vcam_->streamOn();
 }
@@ -666,9 +710,42 @@ int V4L2CameraProxy::vidioc_streamoff(V4L2CameraFile *file, int *arg)
 	for (struct v4l2_buffer &buf : buffers_)
 		buf.flags &= ~(V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE);
 
+	completedBuffers_.clear();
+
 	return ret;
 }
 
+int V4L2CameraProxy::vidioc_expbuf(V4L2CameraFile *file, struct v4l2_exportbuffer *arg)
+{
+	LOG(V4L2Compat, Debug) << "Servicing vidioc_expbuf fd = " << file->efd();
+
+	if (!hasOwnership(file))
+		return -EBUSY;
+
+	if (!validateBufferType(arg->type) ||
+	    memory_ != V4L2_MEMORY_MMAP ||
+	    arg->index >= bufferCount_ || arg->plane != 0 ||
+	    arg->flags & ~(O_CLOEXEC | O_ACCMODE))
+		return -EINVAL;
+
+	FileDescriptor fd = vcam_->getBufferFd(arg->index);
+	if (!fd.isValid())
+		return -EINVAL;
+
+	/*
+	 * Export a new file descriptor for the dmabuf backing the libcamera
+	 * FrameBuffer, the application owns it and closes it when done.
+	 */
+	int ret = fcntl(fd.fd(), arg->flags & O_CLOEXEC ? F_DUPFD_CLOEXEC : F_DUPFD, 0);
+	if (ret < 0)
+		return -errno;
+
+	arg->fd = ret;
+	memset(arg->reserved, 0, sizeof(arg->reserved));
+
+	return 0;
+}
+
 const std::set<unsigned long> V4L2CameraProxy::supportedIoctls_ = {
 	VIDIOC_QUERYCAP,
 	VIDIOC_ENUM_FRAMESIZES,
@@ -687,6 +764,7 @@ const std::set<unsigned long> V4L2CameraProxy::supportedIoctls_ = {
 	VIDIOC_DQBUF,
 	VIDIOC_STREAMON,
 	VIDIOC_STREAMOFF,
+	VIDIOC_EXPBUF,
 };
 
 int V4L2CameraProxy::ioctl(V4L2CameraFile *file, unsigned long request, void *arg)
@@ -761,6 +839,9 @@ int V4L2CameraProxy::ioctl(V4L2CameraFile *file, unsigned long request, void *ar
 	case VIDIOC_STREAMOFF:
 		ret = vidioc_streamoff(file, static_cast<int *>(arg));
 		break;
+	case VIDIOC_EXPBUF:
+		ret = vidioc_expbuf(file, static_cast<struct v4l2_exportbuffer *>(arg));
+		break;
 	default:
 		ret = -ENOTTY;
 		break;
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <deque>
 #include <linux/videodev2.h>
 #include <map>
 #include <memory>
@@ -60,6 +61,7 @@ private:
 			 libcamera::MutexLocker *locker);
 	int vidioc_streamon(V4L2CameraFile *file, int *arg);
 	int vidioc_streamoff(V4L2CameraFile *file, int *arg);
+	int vidioc_expbuf(V4L2CameraFile *file, struct v4l2_exportbuffer *arg);
 
 	bool hasOwnership(V4L2CameraFile *file);
 	int acquire(V4L2CameraFile *file);
@@ -72,13 +74,17 @@ private:
 
 	libcamera::StreamConfiguration streamConfig_;
 	unsigned int bufferCount_;
-	unsigned int currentBuf_;
+	uint32_t memory_;
 	unsigned int sizeimage_;
 
 	struct v4l2_capability capabilities_;
 	struct v4l2_pix_format v4l2PixFormat_;
 
 	std::vector<struct v4l2_buffer> buffers_;
+	/* Indices of the completed buffers, in completion order. */
+	std::deque<unsigned int> completedBuffers_;
+	/* Scratch storage to collect completions in batches. */
+	std::vector<V4L2Camera::Buffer> completions_;
 	std::map<void *, unsigned int> mmaps_;
 
 	std::set<V4L2CameraFile *> files_;
@@ -40,7 +40,7 @@ void get_symbol(T &func, const char *name)
 } /* namespace */
 
 V4L2CompatManager::V4L2CompatManager()
-	: cm_(nullptr)
+	: cm_(nullptr), cameraFds_{}, mmapCount_(0)
 {
 	get_symbol(fops_.openat, "openat64");
 	get_symbol(fops_.dup, "dup");
@@ -99,6 +99,15 @@ V4L2CompatManager *V4L2CompatManager::instance()
 
 std::shared_ptr<V4L2CameraFile> V4L2CompatManager::cameraFile(int fd)
 {
+	/*
+	 * All ioctl() and mmap() calls of the process are intercepted. Keep
+	 * the overhead for unrelated fds to a single atomic load.
+	 */
+	if (!mayBeCameraFd(fd))
+		return nullptr;
+
+	MutexLocker locker(mutex_);
+
 	auto file = files_.find(fd);
 	if (file == files_.end())
 		return nullptr;
@@ -106,6 +115,19 @@ std::shared_ptr<V4L2CameraFile> V4L2CompatManager::cameraFile(int fd)
 	return file->second;
 }
 
+void V4L2CompatManager::setCameraFd(int fd, bool camera)
+{
+	if (fd < 0 || static_cast<unsigned int>(fd) >= kFdBitmapSize)
+		return;
+
+	uint64_t bit = 1ULL << (fd % 64);
+
+	if (camera)
+		cameraFds_[fd / 64].fetch_or(bit, std::memory_order_release);
+	else
+		cameraFds_[fd / 64].fetch_and(~bit, std::memory_order_release);
+}
+
 int V4L2CompatManager::getCameraIndex(int fd)
 {
 	struct stat statbuf;
@@ -156,7 +178,10 @@ int V4L2CompatManager::openat(int dirfd, const char *path, int oflag, mode_t mod
 		return efd;
 
 	V4L2CameraProxy *proxy = proxies_[ret].get();
+
+	MutexLocker locker(mutex_);
 	files_.emplace(efd, std::make_shared<V4L2CameraFile>(efd, oflag & O_NONBLOCK, proxy));
+	setCameraFd(efd, true);
 
 	return efd;
 }
@@ -167,18 +192,37 @@ int V4L2CompatManager::dup(int oldfd)
 	if (newfd < 0)
 		return newfd;
 
+	if (!mayBeCameraFd(oldfd))
+		return newfd;
+
+	MutexLocker locker(mutex_);
+
 	auto file = files_.find(oldfd);
-	if (file != files_.end())
+	if (file != files_.end()) {
 		files_[newfd] = file->second;
+		setCameraFd(newfd, true);
+	}
 
 	return newfd;
 }
 
 int V4L2CompatManager::close(int fd)
 {
-	auto file = files_.find(fd);
-	if (file != files_.end())
-		files_.erase(file);
+	if (mayBeCameraFd(fd)) {
+		std::shared_ptr<V4L2CameraFile> file;
+
+		{
+			MutexLocker locker(mutex_);
+
+			auto it = files_.find(fd);
+			if (it != files_.end()) {
+				/* Release the file after unlocking the mutex. */
+				file = std::move(it->second);
+				files_.erase(it);
+				setCameraFd(fd, false);
+			}
+		}
+	}
 
 	/* We still need to close the eventfd. */
 	return fops_.close(fd);
@@ -199,23 +243,39 @@ void *V4L2CompatManager::mmap(void *addr, size_t length, int prot, int flags,
 	 * Map to V4L2CameraProxy directly to prevent adding more references
 	 * to V4L2CameraFile.
 	 */
+	MutexLocker locker(mutex_);
 	mmaps_[map] = file->proxy();
+	mmapCount_.store(mmaps_.size(), std::memory_order_release);
+
 	return map;
 }
 
 int V4L2CompatManager::munmap(void *addr, size_t length)
 {
-	auto device = mmaps_.find(addr);
-	if (device == mmaps_.end())
+	/* Skip the lookup when no camera buffer is mapped. */
+	if (!mmapCount_.load(std::memory_order_acquire))
 		return fops_.munmap(addr, length);
 
-	V4L2CameraProxy *proxy = device->second;
+	V4L2CameraProxy *proxy = nullptr;
+
+	{
+		MutexLocker locker(mutex_);
+
+		auto device = mmaps_.find(addr);
+		if (device != mmaps_.end())
+			proxy = device->second;
+	}
+
+	if (!proxy)
+		return fops_.munmap(addr, length);
 
 	int ret = proxy->munmap(addr, length);
 	if (ret < 0)
 		return ret;
 
-	mmaps_.erase(device);
+	MutexLocker locker(mutex_);
+	mmaps_.erase(addr);
+	mmapCount_.store(mmaps_.size(), std::memory_order_release);
 
 	return 0;
 }
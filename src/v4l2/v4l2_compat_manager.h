@@ -7,12 +7,17 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <fcntl.h>
 #include <map>
 #include <memory>
+#include <stdint.h>
 #include <sys/types.h>
 #include <vector>
 
+#include <libcamera/base/thread.h>
+
 #include <libcamera/camera_manager.h>
 
 #include "v4l2_camera_proxy.h"
@@ -55,15 +60,38 @@ private:
 	V4L2CompatManager();
 	~V4L2CompatManager();
 
+	static constexpr unsigned int kFdBitmapSize = 65536;
+
 	int start();
 	int getCameraIndex(int fd);
 	std::shared_ptr<V4L2CameraFile> cameraFile(int fd);
 
+	bool mayBeCameraFd(int fd) const
+	{
+		if (fd < 0)
+			return false;
+		if (static_cast<unsigned int>(fd) >= kFdBitmapSize)
+			return true;
+
+		uint64_t bits = cameraFds_[fd / 64].load(std::memory_order_acquire);
+		return bits & (1ULL << (fd % 64));
+	}
+	void setCameraFd(int fd, bool camera);
+
 	FileOperations fops_;
 
 	libcamera::CameraManager *cm_;
 
 	std::vector<std::unique_ptr<V4L2CameraProxy>> proxies_;
+
+	/*
+	 * The cameraFds_ bitmap flags the fds present in files_, to skip the
+	 * lookup without locking for the fds that are not camera files.
+	 * Similarly, mmapCount_ tracks the size of mmaps_.
+	 */
+	libcamera::Mutex mutex_; /* Protects files_ and mmaps_ */
 	std::map<int, std::shared_ptr<V4L2CameraFile>> files_;
 	std::map<void *, V4L2CameraProxy *> mmaps_;
+	std::array<std::atomic<uint64_t>, kFdBitmapSize / 64> cameraFds_;
+	std::atomic<unsigned int> mmapCount_;
 };
@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * bayer-packing.cpp - Raw Bayer line packing tests
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include "libcamera/internal/bayer_packing.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class BayerPackingTest : public Test
+{
+protected:
+	int checkRoundTrip(const BayerFormat &format, unsigned int width)
+	{
+		vector<uint16_t> samples(width);
+		for (unsigned int x = 0; x < width; x++)
+			samples[x] = (x * 2654435761U >> 7) & ((1U << format.bitDepth) - 1);
+
+		vector<uint8_t> packed(bayer::lineSize(format, width), 0xff);
+		if (bayer::packLine(format, samples.data(), packed.data(), width)) {
+			cerr << "Failed to pack " << format.toString() << endl;
+			return TestFail;
+		}
+
+		vector<uint16_t> unpacked(width);
+		if (bayer::unpackLine(format, packed.data(), unpacked.data(), width)) {
+			cerr << "Failed to unpack " << format.toString() << endl;
+			return TestFail;
+		}
+
+		if (unpacked != samples) {
+			cerr << "Round trip mismatch for " << format.toString()
+			     << " with width " << width << endl;
+			return TestFail;
+		}
+
+		vector<uint8_t> msb(width);
+		if (bayer::unpackLineMsb8(format, packed.data(), msb.data(), width)) {
+			cerr << "Failed to unpack MSBs of " << format.toString() << endl;
+			return TestFail;
+		}
+
+		for (unsigned int x = 0; x < width; x++) {
+			if (msb[x] != samples[x] >> (format.bitDepth - 8)) {
+				cerr << "MSB mismatch for " << format.toString()
+				     << " at pixel " << x << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		/* Known CSI-2 packed values. */
+		const uint8_t csi2p10[] = { 0x12, 0x34, 0x56, 0x78, 0xe4 };
+		const uint16_t csi2p10Samples[] = { 0x048, 0x0d1, 0x15a, 0x1e3 };
+		uint16_t samples[4];
+
+		BayerFormat format(BayerFormat::RGGB, 10, BayerFormat::Packing::CSI2);
+		if (bayer::unpackLine(format, csi2p10, samples, 4) ||
+		    !equal(samples, samples + 4, csi2p10Samples)) {
+			cerr << "Invalid 10-bit CSI-2 unpacking" << endl;
+			return TestFail;
+		}
+
+		const uint8_t csi2p12[] = { 0x12, 0x34, 0x65 };
+		const uint16_t csi2p12Samples[] = { 0x125, 0x346 };
+
+		format = BayerFormat(BayerFormat::RGGB, 12, BayerFormat::Packing::CSI2);
+		if (bayer::unpackLine(format, csi2p12, samples, 2) ||
+		    !equal(samples, samples + 2, csi2p12Samples)) {
+			cerr << "Invalid 12-bit CSI-2 unpacking" << endl;
+			return TestFail;
+		}
+
+		/* The IPU3 packs 25 pixels in 32 bytes, LSBs first. */
+		vector<uint8_t> ipu3(32, 0);
+		ipu3[0] = 0xff;
+		ipu3[1] = 0x06;
+		ipu3[30] = 0x01;
+		ipu3[31] = 0x02;
+
+		format = BayerFormat(BayerFormat::GRBG, 10, BayerFormat::Packing::IPU3);
+		vector<uint16_t> ipu3Samples(25);
+		if (bayer::unpackLine(format, ipu3.data(), ipu3Samples.data(), 25) ||
+		    ipu3Samples[0] != 0x2ff || ipu3Samples[1] != 0x001 ||
+		    ipu3Samples[24] != 0x201) {
+			cerr << "Invalid IPU3 unpacking" << endl;
+			return TestFail;
+		}
+
+		if (bayer::lineSize(format, 26) != 64) {
+			cerr << "Invalid IPU3 line size" << endl;
+			return TestFail;
+		}
+
+		/* Packing to IPU3 isn't supported. */
+		if (bayer::packLine(format, ipu3Samples.data(), ipu3.data(), 25) != -EINVAL) {
+			cerr << "IPU3 packing should fail" << endl;
+			return TestFail;
+		}
+
+		/* Round trip through all the supported packings. */
+		const BayerFormat formats[] = {
+			{ BayerFormat::BGGR, 8, BayerFormat::Packing::None },
+			{ BayerFormat::BGGR, 10, BayerFormat::Packing::None },
+			{ BayerFormat::BGGR, 12, BayerFormat::Packing::None },
+			{ BayerFormat::BGGR, 16, BayerFormat::Packing::None },
+			{ BayerFormat::BGGR, 10, BayerFormat::Packing::CSI2 },
+			{ BayerFormat::BGGR, 12, BayerFormat::Packing::CSI2 },
+		};
+
+		for (const BayerFormat &fmt : formats) {
+			for (unsigned int width : { 1U, 3U, 640U, 643U }) {
+				int ret = checkRoundTrip(fmt, width);
+				if (ret != TestPass)
+					return ret;
+			}
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(BayerPackingTest)
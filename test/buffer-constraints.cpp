@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * buffer-constraints.cpp - Buffer layout constraints test
+ */
+
+#include <iostream>
+
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/v4l2_videodevice.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class BufferConstraintsTest : public Test
+{
+protected:
+	int run()
+	{
+		StreamConfiguration cfg;
+		cfg.size = { 1920, 1080 };
+		cfg.strideAlign = 256;
+		cfg.heightAlign = 16;
+		cfg.planeAlign = 4096;
+
+		/* Multi-planar formats can honour all constraints. */
+		V4L2DeviceFormat format;
+		format.fourcc = V4L2PixelFormat(V4L2_PIX_FMT_NV12M);
+		format.size = cfg.size;
+		format.applyConstraints(cfg);
+
+		if (format.planesCount != 2 ||
+		    format.planes[0].bpl != 2048 || format.planes[1].bpl != 2048 ||
+		    format.planes[0].size != 2048 * 1088 ||
+		    format.planes[1].size != 2048 * 544) {
+			cerr << "Invalid multi-planar constraints" << endl;
+			return TestFail;
+		}
+
+		if (format.adjustConstraints(&cfg) || cfg.strideAlign != 256 ||
+		    cfg.heightAlign != 16 || cfg.planeAlign != 4096) {
+			cerr << "Multi-planar constraints should be honoured" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Contiguous planar formats can't pad between planes, the height
+		 * constraint must be reset. The plane offsets are aligned without
+		 * padding.
+		 */
+		format = {};
+		format.fourcc = V4L2PixelFormat(V4L2_PIX_FMT_NV12);
+		format.size = cfg.size;
+		format.applyConstraints(cfg);
+
+		if (format.planesCount != 1 || format.planes[0].bpl != 2048 ||
+		    format.planes[0].size != 2048 * 1080 + 2048 * 544) {
+			cerr << "Invalid contiguous constraints" << endl;
+			return TestFail;
+		}
+
+		if (!format.adjustConstraints(&cfg) || cfg.strideAlign != 256 ||
+		    cfg.heightAlign || cfg.planeAlign != 4096) {
+			cerr << "Contiguous constraints should be adjusted" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Reset the stride constraint if the device doesn't honour it,
+		 * the plane offsets are then misaligned.
+		 */
+		format.planes[0].bpl = 1920;
+
+		if (!format.adjustConstraints(&cfg) || cfg.strideAlign ||
+		    cfg.planeAlign) {
+			cerr << "Stride constraint should be reset" << endl;
+			return TestFail;
+		}
+
+		/* Padding can be added after the last plane. */
+		cfg = {};
+		cfg.size = { 640, 470 };
+		cfg.heightAlign = 16;
+
+		format = {};
+		format.fourcc = V4L2PixelFormat(V4L2_PIX_FMT_YUYV);
+		format.size = cfg.size;
+		format.applyConstraints(cfg);
+
+		if (format.planes[0].bpl != 1280 ||
+		    format.planes[0].size != 1280 * 480) {
+			cerr << "Invalid packed constraints" << endl;
+			return TestFail;
+		}
+
+		if (format.adjustConstraints(&cfg) || cfg.heightAlign != 16) {
+			cerr << "Packed constraints should be honoured" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(BufferConstraintsTest)
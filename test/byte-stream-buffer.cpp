@@ -7,6 +7,7 @@
 
 #include <array>
 #include <iostream>
+#include <vector>
 
 #include "libcamera/internal/byte_stream_buffer.h"
 
@@ -171,6 +172,58 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Growable write mode.
+		 */
+		std::vector<uint8_t> storage(2, 0xff);
+		ByteStreamBuffer gbuf(storage);
+
+		if (gbuf.base() != storage.data() + 2 || gbuf.size() != 0 ||
+		    gbuf.offset() != 0 || gbuf.overflow()) {
+			cerr << "Growable buffer incorrectly constructed" << endl;
+			return TestFail;
+		}
+
+		/* Test carve out, the carved out buffer must survive growth. */
+		ByteStreamBuffer gco = gbuf.carveOut(4);
+		if (gco.size() != 4 || gco.overflow() || gbuf.offset() != 4 ||
+		    gbuf.size() != 4 || storage.size() != 6) {
+			cerr << "Carving out growable buffer failed" << endl;
+			return TestFail;
+		}
+
+		/* Test write, the buffer and storage should grow. */
+		for (i = 0; i < 64; ++i) {
+			value = i;
+			ret = gbuf.write(&value);
+			if (ret)
+				break;
+		}
+
+		if (i != 64 || gbuf.overflow() || gbuf.offset() != 260 ||
+		    gbuf.size() != 260 || storage.size() != 262 ||
+		    storage[0] != 0xff || storage[1] != 0xff) {
+			cerr << "Write failed on growable buffer" << endl;
+			return TestFail;
+		}
+
+		value = 0x12345678;
+		ret = gco.write(&value);
+		if (ret || gco.overflow() || gco.base() != storage.data() + 2 ||
+		    *reinterpret_cast<uint32_t *>(storage.data() + 2) != 0x12345678 ||
+		    *reinterpret_cast<uint32_t *>(storage.data() + 258) != 63) {
+			cerr << "Write failed on growable carve out buffer" << endl;
+			return TestFail;
+		}
+
+		/* Test overflow on the carved out buffer, which doesn't grow. */
+		ret = gco.write(&value);
+		if (!ret || !gco.overflow() || !gbuf.overflow()) {
+			cerr << "Write on growable carve out buffer failed to overflow"
+			     << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
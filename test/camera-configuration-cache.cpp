@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera-configuration-cache.cpp - CameraConfigurationCache tests
+ */
+
+#include <iostream>
+
+#include <libcamera/formats.h>
+
+#include "libcamera/internal/camera_configuration_cache.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+class TestConfiguration : public CameraConfiguration
+{
+public:
+	TestConfiguration(const Size &size)
+		: CameraConfiguration(), computed_(0)
+	{
+		StreamConfiguration cfg;
+		cfg.pixelFormat = formats::NV12;
+		cfg.size = size;
+		cfg.bufferCount = 4;
+		addConfiguration(cfg);
+	}
+
+	Status validate() override
+	{
+		return Invalid;
+	}
+
+	Status adjust()
+	{
+		computed_ = config_[0].size.width;
+		config_[0].size.alignDownTo(64, 1);
+
+		return computed_ == config_[0].size.width ? Valid : Adjusted;
+	}
+
+	unsigned int computed_;
+};
+
+class CameraConfigurationCacheTest : public Test
+{
+protected:
+	int run()
+	{
+		CameraConfigurationCache cache(2);
+		unsigned int calls = 0;
+
+		auto validate = [&](TestConfiguration &config) {
+			return cache.validate(&config, [&]() {
+				calls++;
+				return config.adjust();
+			});
+		};
+
+		/* A miss runs the validation and stores its result. */
+		TestConfiguration first({ 650, 480 });
+		if (validate(first) != CameraConfiguration::Adjusted ||
+		    first.at(0).size != Size(640, 480) || calls != 1) {
+			cerr << "Invalid validation result" << endl;
+			return TestFail;
+		}
+
+		/* A hit returns the cached configuration and status. */
+		TestConfiguration second({ 650, 480 });
+		if (validate(second) != CameraConfiguration::Adjusted ||
+		    second.at(0).size != Size(640, 480) ||
+		    second.computed_ != 650 || calls != 1) {
+			cerr << "Cached validation result not used" << endl;
+			return TestFail;
+		}
+
+		/* Any difference in the configuration results in a miss. */
+		TestConfiguration third({ 650, 480 });
+		third.transform = Transform::HFlip;
+		validate(third);
+
+		TestConfiguration fourth({ 640, 480 });
+		if (validate(fourth) != CameraConfiguration::Valid || calls != 3) {
+			cerr << "Different configuration hit the cache" << endl;
+			return TestFail;
+		}
+
+		/* The least recently used entry has been evicted. */
+		TestConfiguration fifth({ 650, 480 });
+		validate(fifth);
+		if (calls != 4) {
+			cerr << "Cache size not enforced" << endl;
+			return TestFail;
+		}
+
+		/* Clearing the cache drops all entries. */
+		cache.clear();
+
+		TestConfiguration sixth({ 640, 480 });
+		validate(sixth);
+		if (calls != 5) {
+			cerr << "Cache not cleared" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+} /* namespace */
+
+TEST_REGISTER(CameraConfigurationCacheTest)
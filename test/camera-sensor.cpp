@@ -104,6 +104,13 @@ protected:
 			return TestFail;
 		}
 
+		/* The vimc sensor has a single source pad, without embedded data. */
+		if (sensor_->supportsEmbeddedData() ||
+		    sensor_->embeddedDataFormat(&format) != -ENOTSUP) {
+			cerr << "Sensor reports unexpected embedded data support" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera buffer memory accounting test
+ */
+
+#include <iostream>
+
+#include <libcamera/framebuffer.h>
+#include <libcamera/framebuffer_allocator.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+namespace {
+
+class BufferUsageTest : public CameraTest, public Test
+{
+public:
+	BufferUsageTest()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		unique_ptr<FrameBufferAllocator> allocator =
+			make_unique<FrameBufferAllocator>(camera_);
+
+		if (allocator->allocate(stream) < 0) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		size_t size = 0;
+		for (const unique_ptr<FrameBuffer> &buffer : allocator->buffers(stream)) {
+			for (const FrameBuffer::Plane &plane : buffer->planes())
+				size += plane.length;
+		}
+
+		/* The application buffers must be reported for the stream. */
+		const BufferPoolUsage *pool = nullptr;
+		vector<BufferPoolUsage> usage = camera_->bufferUsage();
+		for (const BufferPoolUsage &entry : usage) {
+			if (entry.stream == stream)
+				pool = &entry;
+		}
+
+		if (!pool || pool->count != allocator->buffers(stream).size() ||
+		    pool->size != size) {
+			cout << "Application buffers not reported" << endl;
+			return TestFail;
+		}
+
+		/* Freeing the buffers must remove the pool. */
+		allocator->free(stream);
+
+		for (const BufferPoolUsage &entry : camera_->bufferUsage()) {
+			if (entry.stream == stream) {
+				cout << "Freed buffers still reported" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Destroying the allocator must remove its pools. */
+		if (allocator->allocate(stream) < 0) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		allocator.reset();
+
+		if (!camera_->bufferUsage().empty()) {
+			cout << "Buffers of destroyed allocator still reported" << endl;
+			return TestFail;
+		}
+
+		camera_->release();
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(BufferUsageTest)
@@ -0,0 +1,188 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera Camera asynchronous configure, start and stop test
+ */
+
+#include <atomic>
+#include <iostream>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include <libcamera/framebuffer_allocator.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+namespace {
+
+class CameraAsync : public CameraTest, public Test
+{
+public:
+	CameraAsync()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	void operationCompleted(int result)
+	{
+		result_ = result;
+		completed_ = true;
+		dispatcher_->interrupt();
+	}
+
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		const Stream *stream = request->buffers().begin()->first;
+		FrameBuffer *buffer = request->buffers().begin()->second;
+
+		request->reuse();
+		request->addBuffer(stream, buffer);
+		camera_->queueRequest(request);
+	}
+
+	int waitForCompletion()
+	{
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning() && !completed_)
+			dispatcher_->processEvents();
+
+		if (!completed_) {
+			cerr << "Asynchronous operation timed out" << endl;
+			return -ETIMEDOUT;
+		}
+
+		completed_ = false;
+		return result_;
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		dispatcher_ = Thread::current()->eventDispatcher();
+		completed_ = false;
+		completeRequestsCount_ = 0;
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		/* Asynchronous operations must check the state synchronously. */
+		if (camera_->configureAsync(config_.get()) != -EACCES) {
+			cout << "Configuring an unacquired camera succeeded" << endl;
+			return TestFail;
+		}
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->startAsync() != -EACCES) {
+			cout << "Starting an unconfigured camera succeeded" << endl;
+			return TestFail;
+		}
+
+		camera_->configureCompleted.connect(this, &CameraAsync::operationCompleted);
+		camera_->startCompleted.connect(this, &CameraAsync::operationCompleted);
+		camera_->stopCompleted.connect(this, &CameraAsync::operationCompleted);
+		camera_->requestCompleted.connect(this, &CameraAsync::requestComplete);
+
+		if (camera_->configureAsync(config_.get()) ||
+		    waitForCompletion()) {
+			cout << "Failed to configure the camera" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (!stream) {
+			cout << "Configuration has no stream" << endl;
+			return TestFail;
+		}
+
+		FrameBufferAllocator allocator(camera_);
+		if (allocator.allocate(stream) < 0) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		vector<unique_ptr<Request>> requests;
+		for (const unique_ptr<FrameBuffer> &buffer : allocator.buffers(stream)) {
+			unique_ptr<Request> request = camera_->createRequest();
+			if (!request || request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(move(request));
+		}
+
+		if (camera_->startAsync() || waitForCompletion()) {
+			cout << "Failed to start the camera" << endl;
+			return TestFail;
+		}
+
+		for (unique_ptr<Request> &request : requests) {
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher_->processEvents();
+
+		if (camera_->stopAsync() || waitForCompletion()) {
+			cout << "Failed to stop the camera" << endl;
+			return TestFail;
+		}
+
+		if (!completeRequestsCount_) {
+			cout << "No request completed" << endl;
+			return TestFail;
+		}
+
+		if (camera_->release()) {
+			cout << "Failed to release the camera" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	unique_ptr<CameraConfiguration> config_;
+	EventDispatcher *dispatcher_;
+
+	atomic<bool> completed_;
+	atomic<int> result_;
+	atomic<unsigned int> completeRequestsCount_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CameraAsync)
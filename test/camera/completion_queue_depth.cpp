@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera Camera completion queue depth test
+ */
+
+#include <iostream>
+#include <poll.h>
+#include <thread>
+
+#include <libcamera/framebuffer_allocator.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+using namespace std::chrono_literals;
+
+namespace {
+
+class CompletionQueueDepth : public CameraTest, public Test
+{
+public:
+	CompletionQueueDepth()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		int fd = camera_->completionFd();
+		if (fd < 0) {
+			cout << "Failed to enable the completion queue" << endl;
+			return TestFail;
+		}
+
+		if (camera_->setCompletionQueueDepth(1)) {
+			cout << "Failed to set the completion queue depth" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		FrameBufferAllocator allocator(camera_);
+		if (allocator.allocate(stream) < 0) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		vector<unique_ptr<Request>> requests;
+		for (const unique_ptr<FrameBuffer> &buffer : allocator.buffers(stream)) {
+			unique_ptr<Request> request = camera_->createRequest();
+			if (!request || request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(move(request));
+		}
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (unique_ptr<Request> &request : requests) {
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		/*
+		 * Fall behind for long enough for all requests to complete
+		 * multiple times. Only the most recent one shall be delivered,
+		 * the other ones being recycled.
+		 */
+		this_thread::sleep_for(500ms);
+
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 1000) != 1) {
+			cout << "Completion queue timed out" << endl;
+			return TestFail;
+		}
+
+		vector<Request *> completed = camera_->takeCompletedRequests();
+		if (completed.size() != 1) {
+			cout << "Completion queue holds " << completed.size()
+			     << " requests" << endl;
+			return TestFail;
+		}
+
+		const FrameMetadata &metadata =
+			completed[0]->buffers().begin()->second->metadata();
+		if (metadata.status != FrameMetadata::FrameSuccess ||
+		    !metadata.discarded) {
+			cout << "No frame reported as discarded" << endl;
+			return TestFail;
+		}
+
+		/* The requests cancelled by stop() are all delivered. */
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		completed = camera_->takeCompletedRequests();
+		if (completed.size() != requests.size() - 1) {
+			cout << "Requests lost in the completion queue" << endl;
+			return TestFail;
+		}
+
+		if (camera_->release()) {
+			cout << "Failed to release the camera" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	unique_ptr<CameraConfiguration> config_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CompletionQueueDepth)
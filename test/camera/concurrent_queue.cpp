@@ -0,0 +1,196 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera Camera concurrent request queuing test
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <libcamera/framebuffer_allocator.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+using namespace std::chrono_literals;
+
+namespace {
+
+class ConcurrentQueue : public CameraTest, public Test
+{
+public:
+	ConcurrentQueue()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	static constexpr unsigned int kThreads = 2;
+	static constexpr unsigned int kIterations = 10;
+
+	/* The requests owned by one submitter thread. */
+	struct Submitter {
+		vector<unique_ptr<Request>> requests;
+		unsigned int completed = 0;
+		unsigned int failed = 0;
+	};
+
+	void requestComplete(Request *request)
+	{
+		Submitter *submitter = &submitters_[request->cookie()];
+
+		{
+			lock_guard<mutex> locker(lock_);
+			if (request->status() != Request::RequestComplete)
+				submitter->failed++;
+			submitter->completed++;
+		}
+
+		cv_.notify_all();
+	}
+
+	/*
+	 * Queue the requests of a submitter from its own thread, and requeue them
+	 * from the same thread once they all complete.
+	 */
+	void submit(unsigned int index)
+	{
+		Submitter &submitter = submitters_[index];
+
+		for (unsigned int i = 0; i < kIterations; ++i) {
+			for (unique_ptr<Request> &request : submitter.requests) {
+				request->reuse(Request::ReuseBuffers);
+				if (camera_->queueRequest(request.get()))
+					queueErrors_++;
+			}
+
+			unique_lock<mutex> locker(lock_);
+			unsigned int expected = (i + 1) * submitter.requests.size();
+			bool done = cv_.wait_for(locker, 5s, [&] {
+				return submitter.completed >= expected;
+			});
+			if (!done) {
+				timeouts_++;
+				return;
+			}
+		}
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		queueErrors_ = 0;
+		timeouts_ = 0;
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		FrameBufferAllocator allocator(camera_);
+		if (allocator.allocate(stream) < 0) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		/* Split the buffers between the submitter threads. */
+		const vector<unique_ptr<FrameBuffer>> &buffers = allocator.buffers(stream);
+		if (buffers.size() < kThreads) {
+			cout << "Not enough buffers" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < buffers.size(); ++i) {
+			unsigned int index = i % kThreads;
+			unique_ptr<Request> request = camera_->createRequest(index);
+			if (!request || request->addBuffer(stream, buffers[i].get())) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			submitters_[index].requests.push_back(move(request));
+		}
+
+		camera_->requestCompleted.connect(this, &ConcurrentQueue::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		vector<thread> threads;
+		for (unsigned int i = 0; i < kThreads; ++i)
+			threads.emplace_back(&ConcurrentQueue::submit, this, i);
+
+		for (thread &t : threads)
+			t.join();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (queueErrors_ || timeouts_) {
+			cout << "Concurrent queuing failed: " << queueErrors_
+			     << " errors, " << timeouts_ << " timeouts" << endl;
+			return TestFail;
+		}
+
+		for (const Submitter &submitter : submitters_) {
+			if (submitter.completed != kIterations * submitter.requests.size() ||
+			    submitter.failed) {
+				cout << "Invalid completion: " << submitter.completed
+				     << " requests, " << submitter.failed << " failed"
+				     << endl;
+				return TestFail;
+			}
+		}
+
+		if (camera_->release()) {
+			cout << "Failed to release the camera" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	unique_ptr<CameraConfiguration> config_;
+
+	Submitter submitters_[kThreads];
+
+	mutex lock_;
+	condition_variable cv_;
+
+	atomic<unsigned int> queueErrors_;
+	atomic<unsigned int> timeouts_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(ConcurrentQueue)
@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera Camera batched request completion test
+ */
+
+#include <atomic>
+#include <iostream>
+#include <poll.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include <libcamera/framebuffer_allocator.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+using namespace std::chrono_literals;
+
+namespace {
+
+class RequestBatching : public CameraTest, public Test
+{
+public:
+	RequestBatching()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	static constexpr unsigned int kBatchCount = 2;
+
+	void requestsComplete(Span<Request *const> requests)
+	{
+		if (requests.size() > kBatchCount)
+			invalidBatches_++;
+
+		batches_++;
+		completedRequests_ += requests.size();
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		batches_ = 0;
+		completedRequests_ = 0;
+		invalidBatches_ = 0;
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->setRequestBatching(kBatchCount, 100ms)) {
+			cout << "Failed to enable request batching" << endl;
+			return TestFail;
+		}
+
+		int fd = camera_->completionFd();
+		if (fd < 0) {
+			cout << "Failed to enable the completion queue" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		FrameBufferAllocator allocator(camera_);
+		if (allocator.allocate(stream) < 0) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		vector<unique_ptr<Request>> requests;
+		for (const unique_ptr<FrameBuffer> &buffer : allocator.buffers(stream)) {
+			unique_ptr<Request> request = camera_->createRequest();
+			if (!request || request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(move(request));
+		}
+
+		camera_->requestsCompleted.connect(this, &RequestBatching::requestsComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (unique_ptr<Request> &request : requests) {
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Wait for all requests to be reported through the queue. */
+		unsigned int queued = 0;
+		while (queued < requests.size()) {
+			struct pollfd pfd = { fd, POLLIN, 0 };
+			if (poll(&pfd, 1, 1000) != 1) {
+				cout << "Completion queue timed out" << endl;
+				return TestFail;
+			}
+
+			queued += camera_->takeCompletedRequests().size();
+		}
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->takeCompletedRequests().size()) {
+			cout << "Unexpected requests in the completion queue" << endl;
+			return TestFail;
+		}
+
+		if (completedRequests_ != requests.size() || invalidBatches_) {
+			cout << "Invalid batches: " << completedRequests_
+			     << " requests in " << batches_ << " batches" << endl;
+			return TestFail;
+		}
+
+		if (camera_->release()) {
+			cout << "Failed to release the camera" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	unique_ptr<CameraConfiguration> config_;
+
+	atomic<unsigned int> batches_;
+	atomic<unsigned int> completedRequests_;
+	atomic<unsigned int> invalidBatches_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(RequestBatching)
@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera request fan-out test
+ */
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include <libcamera/framebuffer_allocator.h>
+#include <libcamera/request_fan_out.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+using namespace std::chrono_literals;
+
+namespace {
+
+class RequestFanOutTest : public CameraTest, public Test
+{
+public:
+	RequestFanOutTest()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	/*
+	 * Consumer 0 releases requests synchronously, consumer 1 from a worker
+	 * thread, and consumer 2 never releases them and relies on the timeout.
+	 */
+	static constexpr unsigned int kConsumers = 3;
+
+	void requestReady(Request *request)
+	{
+		readyCount_++;
+
+		fanOut_->release(0, request);
+
+		lock_guard<mutex> locker(lock_);
+		deferred_.push(request);
+	}
+
+	void worker()
+	{
+		while (!done_) {
+			this_thread::sleep_for(5ms);
+
+			lock_guard<mutex> locker(lock_);
+			while (!deferred_.empty()) {
+				fanOut_->release(1, deferred_.front());
+				deferred_.pop();
+			}
+		}
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		readyCount_ = 0;
+		done_ = false;
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		FrameBufferAllocator allocator(camera_);
+		if (allocator.allocate(stream) < 0) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		vector<unique_ptr<Request>> requests;
+		for (const unique_ptr<FrameBuffer> &buffer : allocator.buffers(stream)) {
+			unique_ptr<Request> request = camera_->createRequest();
+			if (!request || request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(move(request));
+		}
+
+		fanOut_ = make_unique<RequestFanOut>(camera_, kConsumers);
+		fanOut_->setMaxHeld(requests.size() - 1);
+		fanOut_->setTimeout(50ms);
+		fanOut_->requestReady.connect(this, &RequestFanOutTest::requestReady);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		thread workerThread(&RequestFanOutTest::worker, this);
+
+		for (unique_ptr<Request> &request : requests) {
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		fanOut_->stop();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		done_ = true;
+		workerThread.join();
+
+		/*
+		 * Requests are requeued when released, the camera keeps capturing
+		 * frames while consumers hold some of them.
+		 */
+		if (readyCount_ < requests.size() * 2) {
+			cout << "Failed to fan out enough requests (got "
+			     << readyCount_ << ")" << endl;
+			return TestFail;
+		}
+
+		if (!fanOut_->timedOut()) {
+			cout << "Held requests should time out" << endl;
+			return TestFail;
+		}
+
+		fanOut_.reset();
+
+		if (camera_->release()) {
+			cout << "Failed to release the camera" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	unique_ptr<CameraConfiguration> config_;
+	unique_ptr<RequestFanOut> fanOut_;
+
+	mutex lock_;
+	queue<Request *> deferred_;
+
+	atomic<unsigned int> readyCount_;
+	atomic<bool> done_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(RequestFanOutTest)
@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera capture session record and replay test
+ */
+
+#include <atomic>
+#include <iostream>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/camera_manager.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/framebuffer_allocator.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+namespace {
+
+class SessionReplay : public Test
+{
+protected:
+	static constexpr const char *kCameraName = "platform/vimc.0 Sensor B";
+	static constexpr unsigned int kRecordedFrames = 10;
+	static constexpr unsigned int kReplayedFrames = 25;
+
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		const Stream *stream = request->buffers().begin()->first;
+		FrameBuffer *buffer = request->buffers().begin()->second;
+
+		if (buffer->metadata().status != FrameMetadata::FrameSuccess ||
+		    !buffer->metadata().planes()[0].bytesused ||
+		    !request->metadata().contains(controls::SensorTimestamp))
+			invalidFrames_++;
+
+		completedFrames_++;
+
+		request->reuse();
+		request->addBuffer(stream, buffer);
+		camera_->queueRequest(request);
+	}
+
+	int capture(unsigned int frames)
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire " << camera_->id() << endl;
+			return TestFail;
+		}
+
+		unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config || config->size() != 1 ||
+		    config->validate() == CameraConfiguration::Invalid ||
+		    camera_->configure(config.get())) {
+			cout << "Failed to configure " << camera_->id() << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config->at(0).stream();
+		FrameBufferAllocator allocator(camera_);
+		if (allocator.allocate(stream) < 0) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		vector<unique_ptr<Request>> requests;
+		for (const unique_ptr<FrameBuffer> &buffer : allocator.buffers(stream)) {
+			unique_ptr<Request> request = camera_->createRequest();
+			if (!request || request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(move(request));
+		}
+
+		completedFrames_ = 0;
+		invalidFrames_ = 0;
+
+		camera_->requestCompleted.connect(this, &SessionReplay::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start " << camera_->id() << endl;
+			return TestFail;
+		}
+
+		for (unique_ptr<Request> &request : requests) {
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(5000);
+		while (timer.isRunning() && completedFrames_ < frames)
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop " << camera_->id() << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.disconnect(this);
+		camera_->release();
+
+		if (completedFrames_ < frames || invalidFrames_) {
+			cout << "Captured " << completedFrames_.load() << " frames from "
+			     << camera_->id() << ", " << invalidFrames_.load()
+			     << " invalid" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int init() override
+	{
+		char path[] = "/tmp/libcamera.session.XXXXXX";
+		int fd = mkstemp(path);
+		if (fd < 0) {
+			cout << "Failed to create session file" << endl;
+			return TestFail;
+		}
+
+		close(fd);
+		path_ = path;
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		/* Record a session from the vimc camera. */
+		setenv("LIBCAMERA_SESSION_RECORD", path_.c_str(), 1);
+
+		unique_ptr<CameraManager> cm = make_unique<CameraManager>();
+		if (cm->start()) {
+			cout << "Failed to start camera manager" << endl;
+			return TestFail;
+		}
+
+		camera_ = cm->get(kCameraName);
+		if (!camera_) {
+			cout << "Can not find '" << kCameraName << "' camera" << endl;
+			return TestSkip;
+		}
+
+		int ret = capture(kRecordedFrames);
+
+		camera_.reset();
+		cm->stop();
+		cm.reset();
+
+		unsetenv("LIBCAMERA_SESSION_RECORD");
+
+		if (ret != TestPass)
+			return ret;
+
+		/* Replay it, looping over the recording. */
+		setenv("LIBCAMERA_REPLAY_SESSION", path_.c_str(), 1);
+		setenv("LIBCAMERA_REPLAY_PACING", "fast", 1);
+
+		cm = make_unique<CameraManager>();
+		if (cm->start()) {
+			cout << "Failed to start camera manager" << endl;
+			return TestFail;
+		}
+
+		string name = string("replay:") + kCameraName;
+		camera_ = cm->get(name);
+		if (!camera_) {
+			cout << "Can not find '" << name << "' camera" << endl;
+			return TestSkip;
+		}
+
+		ret = capture(kReplayedFrames);
+
+		camera_.reset();
+		cm->stop();
+
+		return ret;
+	}
+
+	void cleanup() override
+	{
+		unsetenv("LIBCAMERA_REPLAY_SESSION");
+		unsetenv("LIBCAMERA_REPLAY_PACING");
+		unlink(path_.c_str());
+	}
+
+private:
+	string path_;
+	shared_ptr<Camera> camera_;
+
+	atomic<unsigned int> completedFrames_;
+	atomic<unsigned int> invalidFrames_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(SessionReplay)
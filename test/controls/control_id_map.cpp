@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * control_id_map.cpp - ControlIdMap tests
+ */
+
+#include <iostream>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ControlIdMapTest : public Test
+{
+protected:
+	int run()
+	{
+		/* Test lookups of libcamera controls in the dense table. */
+		const ControlIdMap &idmap = controls::controls;
+
+		if (idmap.lookup(controls::BRIGHTNESS) != &controls::Brightness ||
+		    idmap.at(controls::BRIGHTNESS) != &controls::Brightness ||
+		    idmap.count(controls::BRIGHTNESS) != 1) {
+			cerr << "Failed to look up Brightness" << endl;
+			return TestFail;
+		}
+
+		if (idmap.find(controls::BRIGHTNESS) == idmap.end() ||
+		    idmap.find(controls::BRIGHTNESS)->second != &controls::Brightness) {
+			cerr << "Failed to find Brightness" << endl;
+			return TestFail;
+		}
+
+		if (idmap.lookup(0) || idmap.count(0)) {
+			cerr << "Invalid control ID found" << endl;
+			return TestFail;
+		}
+
+		/* Test IDs outside of the dense table. */
+		Control<int32_t> large(0x00980900, "Large");
+		Control<int32_t> small(2, "Small");
+		ControlIdMap map;
+
+		map.set(large.id(), &large);
+		map.set(small.id(), &small);
+
+		if (map.size() != 2 || map.lookup(large.id()) != &large ||
+		    map.lookup(small.id()) != &small || map.lookup(1) ||
+		    map.lookup(large.id() + 1) || map.count(3)) {
+			cerr << "Invalid lookup results" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ControlIdMapTest)
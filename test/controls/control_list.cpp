@@ -196,6 +196,18 @@ protected:
 			return TestFail;
 		}
 
+		/* Controls shall be iterated in increasing numerical ID order. */
+		unsigned int prevId = 0;
+		for (const auto &[id, value] : mergeList) {
+			if (id <= prevId) {
+				cout << "Merged list is not sorted by control ID"
+				     << endl;
+				return TestFail;
+			}
+
+			prevId = id;
+		}
+
 		return TestPass;
 	}
 };
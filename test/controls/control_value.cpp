@@ -257,6 +257,21 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Move construction and assignment.
+		 */
+		ControlValue moved(std::move(value));
+		if (!value.isNone() || moved.get<std::string>() != string) {
+			cerr << "Control value mismatch after move construction" << endl;
+			return TestFail;
+		}
+
+		value = std::move(moved);
+		if (!moved.isNone() || value.get<std::string>() != string) {
+			cerr << "Control value mismatch after move assignment" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
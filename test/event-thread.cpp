@@ -10,6 +10,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <libcamera/base/event_dispatcher_poll.h>
 #include <libcamera/base/event_notifier.h>
 #include <libcamera/base/thread.h>
 #include <libcamera/base/timer.h>
@@ -50,6 +51,7 @@ public:
 
 		memset(data_, 0, sizeof(data_));
 		size_ = 0;
+		notified_ = false;
 
 		ret = write(pipefd_[1], data.data(), data.size());
 		if (ret < 0) {
@@ -112,6 +114,40 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Test event and message delivery to a thread that busy-polls,
+		 * including the wakeup on exit.
+		 */
+		Thread busyThread;
+		auto dispatcher = std::make_unique<EventDispatcherPoll>();
+		dispatcher->setBusyPoll(chrono::milliseconds(10), 50);
+		busyThread.setEventDispatcher(std::move(dispatcher));
+		busyThread.start();
+
+		EventHandler busyHandler;
+		busyHandler.moveToThread(&busyThread);
+
+		for (unsigned int i = 0; i < 10; ++i) {
+			busyHandler.invokeMethod(&EventHandler::notify,
+						 ConnectionTypeBlocking);
+
+			this_thread::sleep_for(chrono::milliseconds(i % 2 ? 1 : 20));
+
+			if (!busyHandler.notified()) {
+				cout << "Busy polling event handling test failed"
+				     << endl;
+				busyThread.exit(0);
+				busyThread.wait();
+				return TestFail;
+			}
+		}
+
+		busyThread.exit(0);
+		if (!busyThread.wait(chrono::seconds(1))) {
+			cout << "Busy polling thread failed to exit" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
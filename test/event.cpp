@@ -28,9 +28,28 @@ protected:
 		notified_ = true;
 	}
 
+	/* Unregister the notifier of the second pipe from a slot. */
+	void readReadyUnregister()
+	{
+		size_ = read(notifier_->fd(), data_, sizeof(data_));
+		delete other_;
+		other_ = nullptr;
+	}
+
+	void otherReady()
+	{
+		char buf[16];
+		if (read(other_->fd(), buf, sizeof(buf)) > 0)
+			otherNotified_ = true;
+	}
+
 	int init()
 	{
 		notifier_ = nullptr;
+		other_ = nullptr;
+
+		if (pipe(otherfd_))
+			return TestFail;
 
 		return pipe(pipefd_);
 	}
@@ -108,22 +127,71 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Test registering a notifier again for a file descriptor whose
+		 * notifier has been unregistered while processing the events of
+		 * another file descriptor.
+		 */
+		other_ = new EventNotifier(otherfd_[0], EventNotifier::Read);
+		notifier_->activated.disconnect(this);
+		notifier_->activated.connect(this, &EventTest::readReadyUnregister);
+
+		ret = write(pipefd_[1], data.data(), data.size());
+		if (ret < 0) {
+			cout << "Pipe write failed" << endl;
+			return TestFail;
+		}
+
+		timeout.start(100);
+		dispatcher->processEvents();
+		timeout.stop();
+
+		if (other_) {
+			cout << "Event notifier not unregistered" << endl;
+			return TestFail;
+		}
+
+		otherNotified_ = false;
+		other_ = new EventNotifier(otherfd_[0], EventNotifier::Read);
+		other_->activated.connect(this, &EventTest::otherReady);
+
+		ret = write(otherfd_[1], data.data(), data.size());
+		if (ret < 0) {
+			cout << "Pipe write failed" << endl;
+			return TestFail;
+		}
+
+		timeout.start(100);
+		dispatcher->processEvents();
+		timeout.stop();
+
+		if (!otherNotified_) {
+			cout << "Event notifier re-registration test failed" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
 	void cleanup()
 	{
 		delete notifier_;
+		delete other_;
 
 		close(pipefd_[0]);
 		close(pipefd_[1]);
+		close(otherfd_[0]);
+		close(otherfd_[1]);
 	}
 
 private:
 	int pipefd_[2];
+	int otherfd_[2];
 
 	EventNotifier *notifier_;
+	EventNotifier *other_;
 	bool notified_;
+	bool otherNotified_;
 	char data_[16];
 	ssize_t size_;
 };
@@ -213,6 +213,49 @@ protected:
 		delete desc2_;
 		desc2_ = nullptr;
 
+		/* Test self-assignment and inode retrieval of copies. */
+		desc1_ = new FileDescriptor(fd_);
+		fd = desc1_->fd();
+
+		FileDescriptor &self = *desc1_;
+		*desc1_ = self;
+
+		if (desc1_->fd() != fd || !isValidFd(desc1_->fd())) {
+			std::cout << "Failed fd validity after self-assignment"
+				  << std::endl;
+			return TestFail;
+		}
+
+		desc2_ = new FileDescriptor(*desc1_);
+
+		if (desc1_->inode() != inodeNr_ || desc2_->inode() != inodeNr_ ||
+		    FileDescriptor::inode(fd_) != inodeNr_) {
+			std::cout << "Failed inode check" << std::endl;
+			return TestFail;
+		}
+
+		delete desc1_;
+		desc1_ = nullptr;
+
+		if (!isValidFd(desc2_->fd())) {
+			std::cout << "Failed fd validity after releasing a copy"
+				  << std::endl;
+			return TestFail;
+		}
+
+		delete desc2_;
+		desc2_ = nullptr;
+
+		/* Test inode retrieval of invalid numerical fds. */
+		int closedFd = dup(fd_);
+		close(closedFd);
+
+		if (FileDescriptor::inode(-1) || FileDescriptor::inode(closedFd)) {
+			std::cout << "Failed inode check of invalid fds"
+				  << std::endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -312,6 +312,21 @@ protected:
 			return TestFail;
 		}
 
+		/* Test mapping with access hints. */
+		data = file.map(0, -1, File::MapFlag::Populate |
+				       File::MapFlag::Sequential |
+				       File::MapFlag::WillNeed |
+				       File::MapFlag::HugePages);
+		if (data.size() != static_cast<size_t>(size)) {
+			cerr << "Mapping with access hints failed" << endl;
+			return TestFail;
+		}
+
+		if (!file.unmap(data.data())) {
+			cerr << "Unmapping of hinted mapping failed" << endl;
+			return TestFail;
+		}
+
 		file.close();
 
 		/* Test private mapping. */
@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * frame-context-ring.cpp - FrameContextRing tests
+ */
+
+#include <iostream>
+
+#include "libcamera/internal/frame_context_ring.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class FrameContextRingTest : public Test
+{
+protected:
+	struct Context {
+		unsigned int value;
+	};
+
+	int run()
+	{
+		FrameContextRing<Context> ring;
+
+		/* An empty ring can't store anything. */
+		if (ring.alloc(0) || ring.get(0)) {
+			cerr << "Empty ring returned a context" << endl;
+			return TestFail;
+		}
+
+		ring.reset(4);
+
+		if (ring.capacity() != 4) {
+			cerr << "Invalid capacity " << ring.capacity() << endl;
+			return TestFail;
+		}
+
+		/* Fill the ring. */
+		for (unsigned int frame = 0; frame < 4; ++frame) {
+			Context *context = ring.alloc(frame);
+			if (!context) {
+				cerr << "Failed to allocate frame " << frame << endl;
+				return TestFail;
+			}
+
+			context->value = frame;
+		}
+
+		/* The slot of frame 4 is in use by frame 0. */
+		if (ring.alloc(4)) {
+			cerr << "Allocated a slot in use" << endl;
+			return TestFail;
+		}
+
+		if (ring.get(4)) {
+			cerr << "Frame 4 found before being allocated" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int frame = 0; frame < 4; ++frame) {
+			Context *context = ring.get(frame);
+			if (!context || context->value != frame) {
+				cerr << "Failed to retrieve frame " << frame << endl;
+				return TestFail;
+			}
+		}
+
+		/* Release frames out of order and reuse the slots. */
+		ring.release(2);
+		ring.release(4);
+
+		if (ring.get(2) || !ring.get(0)) {
+			cerr << "Incorrect frame released" << endl;
+			return TestFail;
+		}
+
+		if (ring.alloc(4)) {
+			cerr << "Allocated a slot in use" << endl;
+			return TestFail;
+		}
+
+		Context *context = ring.alloc(6);
+		if (!context) {
+			cerr << "Failed to allocate a released slot" << endl;
+			return TestFail;
+		}
+
+		/* Contexts are not reinitialized when reused. */
+		if (context->value != 2) {
+			cerr << "Context reinitialized" << endl;
+			return TestFail;
+		}
+
+		ring.clear();
+
+		for (unsigned int frame = 0; frame < 8; ++frame) {
+			if (ring.get(frame)) {
+				cerr << "Frame " << frame << " found after clear" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(FrameContextRingTest)
@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * global-configuration.cpp - System-wide configuration file test
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libcamera/base/global_configuration.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+static const char *configuration =
+	"# libcamera configuration\n"
+	"version: 1\n"
+	"profile: high-throughput\n"
+	"options:\n"
+	"  LIBCAMERA_TEST_COMMON: common\n"
+	"  LIBCAMERA_TEST_OVERRIDE: common\n"
+	"profiles:\n"
+	"  low-latency:\n"
+	"    LIBCAMERA_TEST_OVERRIDE: low-latency # comment\n"
+	"    LIBCAMERA_TEST_QUOTED: \"CameraManager:fifo=10;IPA-*:nice=-5\"\n"
+	"  high-throughput:\n"
+	"    LIBCAMERA_TEST_OVERRIDE: high-throughput\n";
+
+class GlobalConfigurationTest : public Test
+{
+protected:
+	int init()
+	{
+		/*
+		 * The configuration is parsed when the first option is looked up,
+		 * which happens while initializing the logger. Restart the test
+		 * with the environment pointing to the test configuration file.
+		 */
+		if (getenv("LIBCAMERA_CONFIG_FILE"))
+			return TestPass;
+
+		char path[] = "/tmp/libcamera.config.XXXXXX";
+		int fd = mkstemp(path);
+		if (fd < 0) {
+			cerr << "Failed to create configuration file" << endl;
+			return TestFail;
+		}
+
+		ssize_t ret = write(fd, configuration, strlen(configuration));
+		close(fd);
+		if (ret != static_cast<ssize_t>(strlen(configuration))) {
+			unlink(path);
+			return TestFail;
+		}
+
+		setenv("LIBCAMERA_CONFIG_FILE", path, 1);
+		setenv("LIBCAMERA_PROFILE", "low-latency", 1);
+
+		execl("/proc/self/exe", "/proc/self/exe", nullptr);
+
+		/* Only get here if exec fails. */
+		unlink(path);
+		return TestFail;
+	}
+
+	int check(const char *name, const char *expected)
+	{
+		const char *value = GlobalConfiguration::option(name);
+
+		if (!value && !expected)
+			return TestPass;
+
+		if (!value || !expected || strcmp(value, expected)) {
+			cerr << "Invalid value for " << name << ": "
+			     << (value ? value : "(null)") << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		const GlobalConfiguration &config = GlobalConfiguration::instance();
+
+		if (!config.error().empty()) {
+			cerr << "Failed to parse configuration: " << config.error()
+			     << endl;
+			return TestFail;
+		}
+
+		/* The environment selects the profile. */
+		if (config.profile() != "low-latency") {
+			cerr << "Invalid profile " << config.profile() << endl;
+			return TestFail;
+		}
+
+		if (check("LIBCAMERA_TEST_COMMON", "common") != TestPass)
+			return TestFail;
+
+		if (check("LIBCAMERA_TEST_OVERRIDE", "low-latency") != TestPass)
+			return TestFail;
+
+		if (check("LIBCAMERA_TEST_QUOTED",
+			  "CameraManager:fifo=10;IPA-*:nice=-5") != TestPass)
+			return TestFail;
+
+		/* The environment takes precedence over the file. */
+		setenv("LIBCAMERA_TEST_COMMON", "environment", 1);
+		if (check("LIBCAMERA_TEST_COMMON", "environment") != TestPass)
+			return TestFail;
+
+		if (check("LIBCAMERA_TEST_UNSET", nullptr) != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		unlink(GlobalConfiguration::instance().path().c_str());
+	}
+};
+
+TEST_REGISTER(GlobalConfigurationTest)
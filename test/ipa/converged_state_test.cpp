@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * converged_state_test.cpp - Test serialization of the converged 3A state
+ */
+
+#include <cmath>
+#include <iostream>
+#include <optional>
+#include <vector>
+
+#include "libipa/converged_state.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class ConvergedStateTest : public Test
+{
+protected:
+	int run() override
+	{
+		ConvergedState state;
+		state.exposureTime = std::chrono::microseconds(33000);
+		state.analogueGain = 4.0;
+		state.redGain = 1.5;
+		state.blueGain = 2.25;
+		state.colourTemperature = 5600.0;
+
+		std::vector<uint8_t> data = state.serialize();
+
+		std::optional<ConvergedState> restored = ConvergedState::deserialize(data);
+		if (!restored) {
+			cerr << "Failed to deserialize converged state" << endl;
+			return TestFail;
+		}
+
+		if (std::abs(restored->exposureTime.get<std::micro>() - 33000.0) > 0.5 ||
+		    restored->analogueGain != state.analogueGain ||
+		    restored->redGain != state.redGain ||
+		    restored->blueGain != state.blueGain ||
+		    restored->colourTemperature != state.colourTemperature) {
+			cerr << "Converged state mismatch" << endl;
+			return TestFail;
+		}
+
+		/* Truncated blobs must be rejected. */
+		std::vector<uint8_t> truncated(data.begin(), data.end() - 1);
+		if (ConvergedState::deserialize(truncated)) {
+			cerr << "Truncated converged state accepted" << endl;
+			return TestFail;
+		}
+
+		/* Blobs with a different magic or version must be rejected. */
+		std::vector<uint8_t> corrupted = data;
+		corrupted[0] ^= 0xff;
+		if (ConvergedState::deserialize(corrupted)) {
+			cerr << "Corrupted converged state accepted" << endl;
+			return TestFail;
+		}
+
+		/* Invalid values must be rejected. */
+		state.analogueGain = 0.0;
+		if (ConvergedState::deserialize(state.serialize())) {
+			cerr << "Invalid converged state accepted" << endl;
+			return TestFail;
+		}
+
+		/* An unknown colour temperature is valid. */
+		state.analogueGain = 4.0;
+		state.colourTemperature = 0.0;
+		if (!ConvergedState::deserialize(state.serialize())) {
+			cerr << "Unknown colour temperature rejected" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ConvergedStateTest)
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * gain_table_test.cpp - Test the precomputed analogue gain model
+ */
+
+#include <cmath>
+#include <iostream>
+
+#include "libipa/gain_table.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class GainTableTest : public Test
+{
+protected:
+	int run() override
+	{
+		GainTable empty;
+		if (!empty.empty() || empty.gainCode(2.0) != 0 || empty.gain(0) != 0.0) {
+			cerr << "Empty table not handled" << endl;
+			return TestFail;
+		}
+
+		GainTable table(16, 240, [](uint32_t code) {
+			return pow(10, 0.015 * code);
+		});
+
+		if (table.minCode() != 16 || table.maxCode() != 240) {
+			cerr << "Invalid code range" << endl;
+			return TestFail;
+		}
+
+		for (uint32_t code = 16; code <= 240; ++code) {
+			double gain = pow(10, 0.015 * code);
+
+			if (table.gain(code) != gain) {
+				cerr << "Invalid gain for code " << code << endl;
+				return TestFail;
+			}
+
+			/* Gains round down to the closest code. */
+			if (table.gainCode(gain) != code ||
+			    (code < 240 && table.gainCode(gain * 1.01) != code)) {
+				cerr << "Invalid code for gain " << gain << endl;
+				return TestFail;
+			}
+		}
+
+		/* Out of range codes and gains are clamped. */
+		if (table.gain(0) != table.gain(16) || table.gain(1000) != table.gain(240) ||
+		    table.gainCode(0.5) != 16 || table.gainCode(1e6) != 240) {
+			cerr << "Out of range values not clamped" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(GainTableTest)
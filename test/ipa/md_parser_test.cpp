@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * md_parser_test.cpp - Test the SMIA embedded data parser
+ */
+
+#include <iostream>
+#include <vector>
+
+#include "libipa/md_parser.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class MdParserTest : public Test
+{
+protected:
+	int run() override
+	{
+		/*
+		 * A single line of 8-bit SMIA embedded data, with registers
+		 * 0x0157, 0x015a and 0x015b set to 0x40, 0x12 and 0x34.
+		 */
+		vector<uint8_t> data = {
+			0x0a,				/* Line start */
+			0xaa, 0x01, 0xa5, 0x57,		/* Address 0x0157 */
+			0x5a, 0x40,			/* 0x0157 */
+			0x55, 0x00,			/* Skip 0x0158 */
+			0x5a, 0x22,			/* 0x0159 */
+			0x5a, 0x12,			/* 0x015a */
+			0x5a, 0x34,			/* 0x015b */
+			0x07, 0x07,			/* Line end */
+		};
+
+		MdParserSmia parser({ 0x0157, 0x015a, 0x015b });
+		parser.setBitsPerPixel(8);
+
+		MdParser::RegisterMap registers;
+		if (parser.parse(data, registers) != MdParser::Status::OK) {
+			cerr << "Failed to parse embedded data" << endl;
+			return TestFail;
+		}
+
+		if (registers.size() != 3 || registers[0x0157] != 0x40 ||
+		    registers[0x015a] != 0x12 || registers[0x015b] != 0x34) {
+			cerr << "Invalid register values" << endl;
+			return TestFail;
+		}
+
+		/* The offsets found on the first frame are reused. */
+		data[6] = 0x80;
+		if (parser.parse(data, registers) != MdParser::Status::OK ||
+		    registers[0x0157] != 0x80) {
+			cerr << "Failed to parse updated embedded data" << endl;
+			return TestFail;
+		}
+
+		/* Corrupted data must be detected. */
+		data[5] = 0xff;
+		if (parser.parse(data, registers) == MdParser::Status::OK) {
+			cerr << "Corrupted embedded data accepted" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(MdParserTest)
@@ -253,6 +253,54 @@ protected:
 		return 0;
 	}
 
+	int testScatter()
+	{
+		IPCUnixSocket::Payload response;
+		int ret;
+
+		static const uint8_t cmd[] = { CMD_REVERSE };
+		static const uint8_t first[] = { 1, 2, 3 };
+		static const uint8_t second[] = { 4, 5 };
+		const std::array<Span<const uint8_t>, 3> data = {
+			Span<const uint8_t>{ cmd },
+			Span<const uint8_t>{ first },
+			Span<const uint8_t>{ second },
+		};
+
+		ret = call(data, &response);
+		if (ret)
+			return ret;
+
+		const std::vector<uint8_t> expected = { CMD_REVERSE, 5, 4, 3, 2, 1 };
+		if (response.data != expected)
+			return TestFail;
+
+		return 0;
+	}
+
+	int testSizes()
+	{
+		for (unsigned int size : { 1000, 3000, 3000, 5000, 2000, 100000, 3000 }) {
+			IPCUnixSocket::Payload message, response;
+			int ret;
+
+			message.data.resize(size);
+			message.data[0] = CMD_REVERSE;
+			for (unsigned int i = 1; i < size; ++i)
+				message.data[i] = i;
+
+			ret = call(message, &response);
+			if (ret)
+				return ret;
+
+			std::reverse(response.data.begin() + 1, response.data.end());
+			if (message.data != response.data)
+				return TestFail;
+		}
+
+		return 0;
+	}
+
 	int testEmptyFail()
 	{
 		IPCUnixSocket::Payload message;
@@ -371,12 +419,54 @@ protected:
 
 		ipc_.readyRead.connect(this, &UnixSocketTest::readyRead);
 
+		if (runTests())
+			return TestFail;
+
+		/*
+		 * Run the tests again with the message data transported
+		 * through shared memory. Use a small ring to exercise
+		 * wrap-around and fallback to the socket.
+		 */
+		if (ipc_.enableSharedMemory(4096)) {
+			cerr << "Failed to enable shared memory" << endl;
+			return TestFail;
+		}
+
+		if (runTests())
+			return TestFail;
+
+		/* Close slave connection. */
+		IPCUnixSocket::Payload close;
+		close.data.push_back(CMD_CLOSE);
+		if (ipc_.send(close)) {
+			cerr << "Closing IPC channel failed" << endl;
+			return TestFail;
+		}
+
+		ipc_.close();
+		if (slaveStop()) {
+			cerr << "Failed to stop slave" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	int runTests()
+	{
 		/* Test reversing a string, this test sending only data. */
 		if (testReverse()) {
 			cerr << "Reverse array test failed" << endl;
 			return TestFail;
 		}
 
+		/* Test sending data gathered from multiple buffers. */
+		if (testScatter()) {
+			cerr << "Scatter test failed" << endl;
+			return TestFail;
+		}
+
 		/* Test that an empty message fails. */
 		if (testEmptyFail()) {
 			cerr << "Empty message test failed" << endl;
@@ -401,27 +491,17 @@ protected:
 			return TestFail;
 		}
 
-		/* Close slave connection. */
-		IPCUnixSocket::Payload close;
-		close.data.push_back(CMD_CLOSE);
-		if (ipc_.send(close)) {
-			cerr << "Closing IPC channel failed" << endl;
-			return TestFail;
-		}
-
-		ipc_.close();
-		if (slaveStop()) {
-			cerr << "Failed to stop slave" << endl;
+		/* Test sending messages of different sizes. */
+		if (testSizes()) {
+			cerr << "Message sizes test failed" << endl;
 			return TestFail;
 		}
 
-		return TestPass;
+		return 0;
 	}
 
-private:
 	int call(const IPCUnixSocket::Payload &message, IPCUnixSocket::Payload *response)
 	{
-		Timer timeout;
 		int ret;
 
 		callDone_ = false;
@@ -431,6 +511,27 @@ private:
 		if (ret)
 			return ret;
 
+		return wait();
+	}
+
+	int call(Span<const Span<const uint8_t>> data, IPCUnixSocket::Payload *response)
+	{
+		int ret;
+
+		callDone_ = false;
+		callResponse_ = response;
+
+		ret = ipc_.send(data, {});
+		if (ret)
+			return ret;
+
+		return wait();
+	}
+
+	int wait()
+	{
+		Timer timeout;
+
 		timeout.start(200);
 		while (!callDone_) {
 			if (!timeout.isRunning()) {
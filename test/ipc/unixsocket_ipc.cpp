@@ -34,6 +34,7 @@ enum {
 	CmdExit = 0,
 	CmdGetSync = 1,
 	CmdSetAsync = 2,
+	CmdGetInodes = 3,
 };
 
 const int32_t kInitialValue = 1337;
@@ -76,7 +77,7 @@ private:
 			return;
 		}
 
-		IPCMessage ipcMessage(message);
+		IPCMessage ipcMessage(message, &fdTable_);
 		uint32_t cmd = ipcMessage.header().cmd;
 
 		switch (cmd) {
@@ -105,6 +106,25 @@ private:
 			value_ = IPADataSerializer<int32_t>::deserialize(ipcMessage.data());
 			break;
 		}
+
+		case CmdGetInodes: {
+			IPCMessage::Header header = { cmd, ipcMessage.header().cookie };
+			IPCMessage response(header);
+
+			vector<uint32_t> inodes;
+			for (const FileDescriptor &fd : ipcMessage.fds())
+				inodes.push_back(fd.inode());
+
+			tie(response.data(), ignore) =
+				IPADataSerializer<vector<uint32_t>>::serialize(inodes);
+
+			ret = ipc_.send(response.payload());
+			if (ret < 0) {
+				cerr << "Reply failed" << endl;
+				stop(ret);
+			}
+			break;
+		}
 		}
 	}
 
@@ -117,6 +137,7 @@ private:
 	int32_t value_;
 
 	IPCUnixSocket ipc_;
+	IPCFdTable fdTable_;
 	EventDispatcher *dispatcher_;
 	int exitCode_;
 	bool exit_;
@@ -158,6 +179,37 @@ protected:
 		return IPADataSerializer<int32_t>::deserialize(buf.data());
 	}
 
+	int checkInodes(const vector<FileDescriptor> &fds)
+	{
+		IPCMessage msg(CmdGetInodes);
+		IPCMessage buf;
+
+		msg.fds() = fds;
+
+		int ret = ipc_->sendSync(msg, &buf);
+		if (ret < 0) {
+			cerr << "Failed to call get inodes" << endl;
+			return ret;
+		}
+
+		vector<uint32_t> inodes =
+			IPADataSerializer<vector<uint32_t>>::deserialize(buf.data());
+		if (inodes.size() != fds.size()) {
+			cerr << "Wrong number of file descriptors, expected "
+			     << fds.size() << ", got " << inodes.size() << endl;
+			return -EINVAL;
+		}
+
+		for (unsigned int i = 0; i < fds.size(); i++) {
+			if (inodes[i] != fds[i].inode()) {
+				cerr << "Wrong file descriptor " << i << endl;
+				return -EINVAL;
+			}
+		}
+
+		return 0;
+	}
+
 	int exit()
 	{
 		IPCMessage msg(CmdExit);
@@ -199,6 +251,25 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Send file descriptors several times, they should be cached
+		 * and resolved by the slave, including after being released.
+		 */
+		FileDescriptor fd1(open("/tmp", O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR));
+		FileDescriptor fd2(open("/tmp", O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR));
+		if (!fd1.isValid() || !fd2.isValid()) {
+			cerr << "Failed to create temporary files" << endl;
+			return TestFail;
+		}
+
+		if (checkInodes({ fd1, fd2 }) || checkInodes({ fd2, fd1, fd2 }))
+			return TestFail;
+
+		ipc_->releaseFds();
+
+		if (checkInodes({}) || checkInodes({ fd1 }) || checkInodes({ fd2 }))
+			return TestFail;
+
 		ret = exit();
 		if (ret < 0) {
 			cerr << "Failed to exit: " << strerror(-ret) << endl;
@@ -118,6 +118,32 @@ protected:
 		return verifyOutput(log);
 	}
 
+	int testRateLimited()
+	{
+		stringstream log;
+		logSetStream(&log);
+		logSetLevel("LogAPITest", "DEBUG");
+
+		/* Operands of suppressed messages must not be evaluated. */
+		unsigned int evaluated = 0;
+		for (unsigned int i = 0; i < LogRateLimiter::kBurst * 2; ++i)
+			LOG_RATELIMITED(LogAPITest, Warning)
+				<< "message " << ++evaluated;
+
+		unsigned int lines = 0;
+		string line;
+		while (getline(log, line))
+			lines++;
+
+		if (lines != LogRateLimiter::kBurst ||
+		    evaluated != LogRateLimiter::kBurst) {
+			cout << "Rate-limited messages not suppressed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
 	int testTarget()
 	{
 		logSetTarget(LoggingTargetNone);
@@ -143,6 +169,10 @@ protected:
 		if (ret != TestPass)
 			return TestFail;
 
+		ret = testRateLimited();
+		if (ret != TestPass)
+			return TestFail;
+
 		ret = testTarget();
 		if (ret != TestPass)
 			return TestFail;
@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * log_async.cpp - Asynchronous log output test
+ */
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/logging.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+LOG_DEFINE_CATEGORY(LogAsyncTest)
+
+/*
+ * The test is run with LIBCAMERA_LOG_FILE set to a file path followed by the
+ * "async" and "overflow=block" options. Messages logged from multiple threads
+ * must all reach the log file, in order for each thread.
+ */
+class LogAsyncTest : public Test
+{
+protected:
+	static constexpr unsigned int kNumThreads = 4;
+	static constexpr unsigned int kNumMessages = 2000;
+
+	int init()
+	{
+		const char *file = getenv("LIBCAMERA_LOG_FILE");
+		if (!file) {
+			cout << "LIBCAMERA_LOG_FILE not set, skipping" << endl;
+			return TestSkip;
+		}
+
+		logPath_ = file;
+		size_t pos = logPath_.find(',');
+		if (pos == string::npos) {
+			cout << "Asynchronous logging not enabled, skipping" << endl;
+			return TestSkip;
+		}
+
+		logPath_.erase(pos);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		vector<thread> threads;
+
+		for (unsigned int i = 0; i < kNumThreads; ++i) {
+			threads.emplace_back([i]() {
+				for (unsigned int j = 0; j < kNumMessages; ++j)
+					LOG(LogAsyncTest, Info)
+						<< "thread " << i << " message " << j;
+			});
+		}
+
+		for (thread &t : threads)
+			t.join();
+
+		/*
+		 * Switch to a different log output to drain the asynchronous
+		 * queue and close the log file.
+		 */
+		logSetStream(&cerr);
+
+		ifstream log(logPath_);
+		if (!log.good()) {
+			cerr << "Failed to open log file " << logPath_ << endl;
+			return TestFail;
+		}
+
+		vector<unsigned int> next(kNumThreads, 0);
+		string line;
+
+		while (getline(log, line)) {
+			size_t pos = line.find("thread ");
+			if (pos == string::npos)
+				continue;
+
+			istringstream iss(line.substr(pos));
+			string word;
+			unsigned int thread, message;
+			iss >> word >> thread >> word >> message;
+
+			if (thread >= kNumThreads) {
+				cerr << "Invalid log line: " << line << endl;
+				return TestFail;
+			}
+
+			if (message != next[thread]) {
+				cerr << "Thread " << thread << ": expected message "
+				     << next[thread] << ", got " << message << endl;
+				return TestFail;
+			}
+
+			next[thread]++;
+		}
+
+		for (unsigned int i = 0; i < kNumThreads; ++i) {
+			if (next[i] != kNumMessages) {
+				cerr << "Thread " << i << ": only " << next[i]
+				     << " messages logged" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		if (!logPath_.empty())
+			unlink(logPath_.c_str());
+	}
+
+private:
+	string logPath_;
+};
+
+TEST_REGISTER(LogAsyncTest)
@@ -90,6 +90,18 @@ protected:
 			return TestFail;
 		}
 
+		/* Mappings with identical flags should be shared. */
+		MappedFrameBuffer read_map(buffer.get(), MappedFrameBuffer::MapFlag::Read);
+		if (!read_map.isValid()) {
+			cout << "Failed to map read buffer" << endl;
+			return TestFail;
+		}
+
+		if (read_map.planes()[0].data() != maps[0].planes()[0].data()) {
+			cout << "Read mappings are not shared" << endl;
+			return TestFail;
+		}
+
 		/* Test for multiple successful maps on the same buffer. */
 		MappedFrameBuffer write_map(buffer.get(), MappedFrameBuffer::MapFlag::Write);
 		if (!write_map.isValid()) {
@@ -53,6 +53,31 @@ private:
 	Status status_;
 };
 
+class CountingMessageReceiver : public Object
+{
+public:
+	CountingMessageReceiver()
+		: count_(0)
+	{
+	}
+
+	unsigned int count() const { return count_; }
+
+protected:
+	void message(Message *msg)
+	{
+		if (msg->type() != Message::None) {
+			Object::message(msg);
+			return;
+		}
+
+		count_++;
+	}
+
+private:
+	unsigned int count_;
+};
+
 class RecursiveMessageReceiver : public Object
 {
 public:
@@ -182,6 +207,29 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Test that deleting a receiver removes its messages only,
+		 * leaving the messages of other receivers interleaved with
+		 * them in the queue.
+		 */
+		CountingMessageReceiver keptReceiver;
+		std::unique_ptr<CountingMessageReceiver> deletedReceiver =
+			std::make_unique<CountingMessageReceiver>();
+
+		for (unsigned int i = 0; i < 10; ++i) {
+			keptReceiver.postMessage(std::make_unique<Message>(Message::None));
+			deletedReceiver->postMessage(std::make_unique<Message>(Message::None));
+		}
+
+		deletedReceiver.reset();
+
+		Thread::current()->dispatchMessages();
+
+		if (keptReceiver.count() != 10) {
+			cout << "Messages lost on receiver deletion" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
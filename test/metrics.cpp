@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * metrics.cpp - Metrics registry tests
+ */
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "libcamera/internal/metrics.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class MetricsTest : public Test
+{
+protected:
+	bool contains(const string &metrics, const string &line)
+	{
+		if (metrics.find(line + "\n") != string::npos)
+			return true;
+
+		cerr << "Missing '" << line << "' in metrics:" << endl
+		     << metrics << endl;
+		return false;
+	}
+
+	int run()
+	{
+		MetricsRegistry *registry = MetricsRegistry::instance();
+
+		MetricCounter counterA("test_frames_total", "Frames",
+				       Metric::label("camera", "A"));
+		MetricCounter counterB("test_frames_total", "Frames",
+				       Metric::label("camera", "B \"2\""));
+		MetricGauge gauge("test_depth", "Depth");
+		MetricHistogram histogram("test_latency_us", "Latency",
+					  Metric::label("camera", "A"),
+					  MetricHistogram::exponentialBounds(10, 10, 2));
+
+		counterA.inc();
+		counterA.inc(2);
+		counterB.inc();
+		gauge.set(4);
+		gauge.add(-1);
+		histogram.observe(5);
+		histogram.observe(50);
+		histogram.observe(5000);
+
+		string metrics = registry->format();
+
+		if (!contains(metrics, "# TYPE test_frames_total counter") ||
+		    !contains(metrics, "test_frames_total{camera=\"A\"} 3") ||
+		    !contains(metrics, "test_frames_total{camera=\"B \\\"2\\\"\"} 1") ||
+		    !contains(metrics, "# TYPE test_depth gauge") ||
+		    !contains(metrics, "test_depth 3") ||
+		    !contains(metrics, "# TYPE test_latency_us histogram") ||
+		    !contains(metrics, "test_latency_us_bucket{camera=\"A\",le=\"10\"} 1") ||
+		    !contains(metrics, "test_latency_us_bucket{camera=\"A\",le=\"100\"} 2") ||
+		    !contains(metrics, "test_latency_us_bucket{camera=\"A\",le=\"+Inf\"} 3") ||
+		    !contains(metrics, "test_latency_us_sum{camera=\"A\"} 5055") ||
+		    !contains(metrics, "test_latency_us_count{camera=\"A\"} 3"))
+			return TestFail;
+
+		/* Each family must be described once only. */
+		string type = "# TYPE test_frames_total";
+		size_t pos = metrics.find(type);
+		if (metrics.find(type, pos + 1) != string::npos) {
+			cerr << "Duplicated metric family" << endl;
+			return TestFail;
+		}
+
+		/* Destroyed metrics must be unregistered. */
+		{
+			MetricCounter counter("test_temporary_total", "Temporary");
+		}
+
+		if (registry->format().find("test_temporary_total") != string::npos) {
+			cerr << "Destroyed metric still reported" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(MetricsTest)
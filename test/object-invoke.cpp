@@ -5,6 +5,7 @@
  * object-invoke.cpp - Cross-thread Object method invocation test
  */
 
+#include <array>
 #include <iostream>
 #include <thread>
 
@@ -49,6 +50,11 @@ public:
 		value_ = value;
 	}
 
+	void methodWithLargeArgument(const std::array<int, 64> &values)
+	{
+		method(values.back());
+	}
+
 	void methodWithReference([[maybe_unused]] const int &value)
 	{
 	}
@@ -100,6 +106,26 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Test queued invocation with arguments too large to be stored
+		 * in the message.
+		 */
+		object_.reset();
+
+		std::array<int, 64> values{};
+		values.back() = 42;
+		object_.invokeMethod(&InvokedObject::methodWithLargeArgument,
+				     ConnectionTypeQueued, values);
+		values.back() = 0;
+
+		dispatcher->processEvents();
+
+		if (object_.status() != InvokedObject::CallReceived ||
+		    object_.value() != 42) {
+			cout << "Method with large argument invoked incorrectly" << endl;
+			return TestFail;
+		}
+
 		/*
 		 * Test that blocking invocation is delivered directly when the
 		 * caller and callee live in the same thread.
@@ -12,6 +12,8 @@
 
 #include <libcamera/base/utils.h>
 
+#include "libcamera/internal/formats.h"
+
 #include "test.h"
 
 using namespace std;
@@ -44,6 +46,58 @@ protected:
 			return TestFail;
 		}
 
+		/* Test the lookup of the format information by V4L2 format. */
+		for (const PixelFormat &format : { formats::NV12, formats::YUYV,
+						   formats::SRGGB10_CSI2P }) {
+			const PixelFormatInfo &info = PixelFormatInfo::info(format);
+
+			for (const V4L2PixelFormat &v4l2Format : { info.v4l2Formats.single,
+								   info.v4l2Formats.multi }) {
+				if (!v4l2Format.isValid())
+					continue;
+
+				if (PixelFormatInfo::info(v4l2Format).format != format) {
+					cerr << "Failed to look up " << format.toString()
+					     << " from V4L2 format " << v4l2Format.toString()
+					     << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		/*
+		 * Test the size of AFBC compressed frames, which include the
+		 * superblock headers, with the frame height aligned to the
+		 * superblock height.
+		 */
+		struct {
+			PixelFormat format;
+			unsigned int stride;
+			unsigned int frameSize;
+		} afbcSizes[] = {
+			{ formats::XBGR8888_AFBC, 7680, 8486400 },
+			{ formats::YUV420_8BIT_AFBC, 2880, 3264000 },
+		};
+
+		for (const auto &afbc : afbcSizes) {
+			const PixelFormatInfo &info = PixelFormatInfo::info(afbc.format);
+			unsigned int stride = info.stride(1920, 0);
+			unsigned int frameSize = info.frameSize({ 1920, 1080 });
+
+			if (stride != afbc.stride || frameSize != afbc.frameSize) {
+				cerr << "Invalid " << afbc.format.toString()
+				     << " stride " << stride << " or frame size "
+				     << frameSize << endl;
+				return TestFail;
+			}
+		}
+
+		if (PixelFormatInfo::info(V4L2PixelFormat()).isValid()) {
+			cerr << "Invalid V4L2 format should have no information"
+			     << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
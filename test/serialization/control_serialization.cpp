@@ -169,6 +169,45 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Modify a single control and serialize the list again, this
+		 * should only store the modified control.
+		 */
+		list.set(controls::Contrast, 1.5f);
+
+		size = serializer.binarySize(list);
+		listData.resize(size);
+		buffer = ByteStreamBuffer(listData.data(), listData.size());
+
+		ret = serializer.serialize(list, buffer);
+		if (ret) {
+			cerr << "Failed to serialize modified ControlList" << endl;
+			return TestFail;
+		}
+
+		if (buffer.offset() >= size) {
+			cerr << "Modified ControlList not serialized as a delta"
+			     << endl;
+			return TestFail;
+		}
+
+		/* Deserialize the delta and verify the contents. */
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(listData.data()),
+					  buffer.offset());
+
+		newList = deserializer.deserialize<ControlList>(buffer);
+		if (buffer.overflow()) {
+			cerr << "Overflow when deserializing modified ControlList"
+			     << endl;
+			return TestFail;
+		}
+
+		if (!equals(list, newList)) {
+			cerr << "Deserialized delta doesn't match modified list"
+			     << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
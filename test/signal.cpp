@@ -63,6 +63,12 @@ public:
 class SignalTest : public Test
 {
 protected:
+	void slotDeleteObject()
+	{
+		delete slotObject_;
+		slotObject_ = nullptr;
+	}
+
 	void slotVoid()
 	{
 		called_ = true;
@@ -336,6 +342,24 @@ protected:
 
 		delete slotMulti;
 
+		/*
+		 * Test that a slot deleting the receiver of a slot connected
+		 * after it prevents that slot from being called.
+		 */
+		signalVoid_.disconnect();
+
+		slotObject_ = new SlotObject();
+		signalVoid_.connect(this, &SignalTest::slotDeleteObject);
+		signalVoid_.connect(slotObject_, &SlotObject::slot);
+		valueStatic_ = 0;
+		signalVoid_.emit();
+		if (valueStatic_ != 0 || slotObject_) {
+			cout << "Signal slot deleted by a previous slot called" << endl;
+			return TestFail;
+		}
+
+		signalVoid_.disconnect();
+
 		return TestPass;
 	}
 
@@ -348,6 +372,8 @@ private:
 	Signal<int> signalInt_;
 	Signal<int, const std::string &> signalMultiArgs_;
 
+	SlotObject *slotObject_;
+
 	bool called_;
 	int values_[3];
 	std::string name_;
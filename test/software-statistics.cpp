@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * software-statistics.cpp - SoftwareStatistics tests
+ */
+
+#include <iostream>
+#include <math.h>
+#include <memory>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/software_statistics.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class SoftwareStatisticsTest : public Test
+{
+protected:
+	static constexpr Size kSize{ 64, 32 };
+	static constexpr unsigned int kStride = kSize.width * 2;
+
+	void statisticsReady(FrameBuffer *buffer, const ControlList &stats)
+	{
+		if (buffer != buffer_.get())
+			return;
+
+		results_ = stats;
+		done_ = true;
+	}
+
+	int init()
+	{
+		unsigned int length = kStride * kSize.height;
+
+		int fd = memfd_create("libcamera-test", MFD_CLOEXEC);
+		if (fd < 0 || ftruncate(fd, length) < 0) {
+			cerr << "Failed to allocate buffer" << endl;
+			return TestFail;
+		}
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(std::move(fd));
+		plane.offset = 0;
+		plane.length = length;
+		buffer_ = make_unique<FrameBuffer>(vector<FrameBuffer::Plane>{ plane });
+
+		void *mem = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+				 MAP_SHARED, plane.fd.fd(), 0);
+		if (mem == MAP_FAILED) {
+			cerr << "Failed to map buffer" << endl;
+			return TestFail;
+		}
+
+		/* Fill a YUYV frame with a dark left half and a bright right half. */
+		uint8_t *data = static_cast<uint8_t *>(mem);
+		for (unsigned int y = 0; y < kSize.height; ++y) {
+			for (unsigned int x = 0; x < kSize.width; x += 2) {
+				uint8_t *group = data + y * kStride + x * 2;
+				uint8_t luma = x < kSize.width / 2 ? 16 : 235;
+				group[0] = luma;
+				group[1] = 128;
+				group[2] = luma;
+				group[3] = 128;
+			}
+		}
+
+		munmap(mem, length);
+
+		return TestPass;
+	}
+
+	int compute(const Size &grid)
+	{
+		done_ = false;
+
+		if (statistics_->queueBuffer(buffer_.get(), grid)) {
+			cerr << "Failed to queue buffer" << endl;
+			return TestFail;
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning() && !done_)
+			dispatcher->processEvents();
+
+		if (!done_) {
+			cerr << "Statistics not computed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		SoftwareStatistics stats;
+
+		if (!SoftwareStatistics::isSupported(formats::YUYV) ||
+		    SoftwareStatistics::isSupported(formats::MJPEG)) {
+			cerr << "Invalid supported formats" << endl;
+			return TestFail;
+		}
+
+		if (stats.configure(formats::YUYV, kSize, kStride)) {
+			cerr << "Failed to configure statistics" << endl;
+			return TestFail;
+		}
+
+		stats.statisticsReady.connect(this, &SoftwareStatisticsTest::statisticsReady);
+		stats.start();
+		statistics_ = &stats;
+
+		int ret = compute({ 2, 1 });
+		if (ret != TestPass)
+			return ret;
+
+		/* Half of the samples are dark, half are bright. */
+		Span<const int32_t> histogram =
+			results_.get(controls::draft::StatsLumaHistogram);
+		unsigned int samples = kSize.width * kSize.height;
+		if (histogram.size() != SoftwareStatistics::kHistogramBins ||
+		    static_cast<unsigned int>(histogram[16 / 4]) != samples / 2 ||
+		    static_cast<unsigned int>(histogram[235 / 4]) != samples / 2) {
+			cerr << "Invalid luma histogram" << endl;
+			return TestFail;
+		}
+
+		/* The left zone is black and the right zone white. */
+		Span<const float> means = results_.get(controls::draft::StatsZoneMeans);
+		if (means.size() != 6) {
+			cerr << "Invalid number of zone means " << means.size() << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < 3; ++i) {
+			if (fabs(means[i]) > 0.01 || fabs(means[3 + i] - 1.0) > 0.01) {
+				cerr << "Invalid zone means" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Only one transition per line contributes to the sharpness. */
+		float sharpness = results_.get(controls::draft::StatsSharpness);
+		float expected = (235.0f - 16.0f) / 255.0f / (kSize.width - 1);
+		if (fabs(sharpness - expected) > 0.001) {
+			cerr << "Invalid sharpness " << sharpness << endl;
+			return TestFail;
+		}
+
+		stats.stop();
+
+		/* Buffers can't be queued once stopped. */
+		if (!stats.queueBuffer(buffer_.get(), { 1, 1 })) {
+			cerr << "Buffer queued while stopped" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	unique_ptr<FrameBuffer> buffer_;
+	SoftwareStatistics *statistics_;
+	ControlList results_;
+	bool done_;
+};
+
+TEST_REGISTER(SoftwareStatisticsTest)
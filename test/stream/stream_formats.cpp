@@ -94,6 +94,41 @@ protected:
 			      Size(2560, 2048), Size(3200, 2048), }))
 			return TestFail;
 
+		/* Test duplicated discrete sizes are merged and sorted */
+		StreamFormats duplicates({
+			{ PixelFormat(1), { SizeRange({ 200, 200 }), SizeRange({ 100, 100 }),
+					    SizeRange({ 200, 200 }) } },
+		});
+
+		std::vector<Size> sizes = duplicates.sizes(PixelFormat(1));
+		if (sizes != std::vector<Size>{ Size(100, 100), Size(200, 200) }) {
+			cout << "Failed to merge duplicated sizes" << endl;
+			return TestFail;
+		}
+
+		SizeRange limits = duplicates.range(PixelFormat(1));
+		if (limits.min != Size(100, 100) || limits.max != Size(200, 200) ||
+		    limits.hStep || limits.vStep) {
+			cout << "Invalid range from discrete sizes" << endl;
+			return TestFail;
+		}
+
+		/* Test copies report the same formats */
+		StreamFormats copy = range;
+		if (copy.pixelformats() != range.pixelformats() ||
+		    copy.sizes(PixelFormat(2)) != range.sizes(PixelFormat(2)) ||
+		    copy.range(PixelFormat(4)) != range.range(PixelFormat(4))) {
+			cout << "Copied formats differ" << endl;
+			return TestFail;
+		}
+
+		/* Test empty formats */
+		StreamFormats empty;
+		if (!empty.pixelformats().empty() || !empty.sizes(PixelFormat(1)).empty()) {
+			cout << "Empty formats report sizes" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
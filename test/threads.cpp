@@ -8,6 +8,9 @@
 #include <chrono>
 #include <iostream>
 #include <memory>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
 #include <thread>
 
 #include <libcamera/base/thread.h>
@@ -35,6 +38,34 @@ private:
 	chrono::steady_clock::duration duration_;
 };
 
+class AttributesThread : public Thread
+{
+public:
+	AttributesThread()
+		: cpu0_(false)
+	{
+		name_[0] = '\0';
+	}
+
+	const char *threadName() const { return name_; }
+	bool cpu0() const { return cpu0_; }
+
+protected:
+	void run()
+	{
+		pthread_getname_np(pthread_self(), name_, sizeof(name_));
+
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		sched_getaffinity(0, sizeof(cpuset), &cpuset);
+		cpu0_ = CPU_COUNT(&cpuset) == 1 && CPU_ISSET(0, &cpuset);
+	}
+
+private:
+	char name_[16];
+	bool cpu0_;
+};
+
 class ThreadTest : public Test
 {
 protected:
@@ -118,6 +149,30 @@ protected:
 			return TestFail;
 		}
 
+		/* Test the thread attributes. */
+		std::unique_ptr<AttributesThread> attrThread =
+			std::make_unique<AttributesThread>();
+		attrThread->setName("LibcameraTestThread");
+		attrThread->setCpuAffinity({ 0 });
+		attrThread->start();
+		attrThread->wait();
+
+		if (attrThread->name() != "LibcameraTestThread") {
+			cout << "Thread name not stored" << endl;
+			return TestFail;
+		}
+
+		if (strcmp(attrThread->threadName(), "LibcameraTestTh")) {
+			cout << "Thread name not applied: "
+			     << attrThread->threadName() << endl;
+			return TestFail;
+		}
+
+		if (!attrThread->cpu0()) {
+			cout << "Thread CPU affinity not applied" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * tile-processor.cpp - TileProcessor tests
+ */
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "libcamera/internal/tile_processor.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class TileProcessorTest : public Test
+{
+protected:
+	/* Run two fused operations and check that they cover all the rows. */
+	int runImage(unsigned int rows, unsigned int rowBytes, unsigned int alignment)
+	{
+		TileProcessor tiles(rows, rowBytes, alignment);
+
+		if (tiles.tileRows() % alignment) {
+			cerr << "Tiles of " << tiles.tileRows()
+			     << " rows not aligned to " << alignment << endl;
+			return TestFail;
+		}
+
+		if (tiles.tileCount() * tiles.tileRows() < rows ||
+		    (tiles.tileCount() - 1) * tiles.tileRows() >= rows) {
+			cerr << "Invalid tile count " << tiles.tileCount()
+			     << " for " << rows << " rows" << endl;
+			return TestFail;
+		}
+
+		vector<unsigned int> visits(rows, 0);
+		vector<unsigned int> sums(tiles.tileCount(), 0);
+		atomic<unsigned int> errors = 0;
+
+		const TileProcessor::Operation operations[] = {
+			[&](const TileProcessor::Tile &tile) {
+				if (tile.start != tile.index * tiles.tileRows() ||
+				    tile.end > rows || tile.start >= tile.end)
+					errors++;
+
+				for (unsigned int y = tile.start; y < tile.end; ++y)
+					visits[y]++;
+			},
+			[&](const TileProcessor::Tile &tile) {
+				/* The first operation has processed the tile. */
+				for (unsigned int y = tile.start; y < tile.end; ++y) {
+					if (visits[y] != 1)
+						errors++;
+					sums[tile.index] += y;
+				}
+			},
+		};
+
+		tiles.run(operations);
+
+		if (errors) {
+			cerr << "Invalid tiles or operation order" << endl;
+			return TestFail;
+		}
+
+		uint64_t sum = 0;
+		for (unsigned int value : sums)
+			sum += value;
+
+		if (sum != static_cast<uint64_t>(rows) * (rows - 1) / 2) {
+			cerr << "Rows not processed exactly once" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (TileProcessor::concurrency() < 1) {
+			cerr << "Invalid concurrency" << endl;
+			return TestFail;
+		}
+
+		/* An empty image has no tiles. */
+		TileProcessor empty;
+		bool called = false;
+		empty.run([&](const TileProcessor::Tile &) { called = true; });
+		if (empty.tileCount() || called) {
+			cerr << "Empty image processed" << endl;
+			return TestFail;
+		}
+
+		/* Process images of different sizes. */
+		if (runImage(1, 64, 1) != TestPass ||
+		    runImage(1080, 1920 * 4, 1) != TestPass ||
+		    runImage(1081, 640, 2) != TestPass ||
+		    runImage(4001, 16, 4) != TestPass)
+			return TestFail;
+
+		/* Large rows still produce tiles of at least one row. */
+		TileProcessor large(16, 1 << 30);
+		if (large.tileRows() < 1 || large.tileCount() > 16) {
+			cerr << "Invalid tiles for large rows" << endl;
+			return TestFail;
+		}
+
+		/* Run images from multiple threads concurrently. */
+		atomic<unsigned int> failures = 0;
+		vector<thread> threads;
+
+		for (unsigned int i = 0; i < 4; ++i) {
+			threads.emplace_back([&, i]() {
+				for (unsigned int j = 0; j < 50; ++j) {
+					if (runImage(480 + i * 7 + j, 640 * 4, 2) != TestPass)
+						failures++;
+				}
+			});
+		}
+
+		for (thread &t : threads)
+			t.join();
+
+		if (failures) {
+			cerr << "Concurrent processing failed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(TileProcessorTest)
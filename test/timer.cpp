@@ -189,6 +189,42 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Timer slack. The first timer has a deadline before the second
+		 * one, but its slack allows it to time out with the second
+		 * timer with a single wakeup.
+		 */
+		timer.setSlack(std::chrono::milliseconds(300));
+		timer.start(100);
+		timer2.start(200);
+
+		dispatcher->processEvents();
+
+		if (timer.isRunning() || timer2.isRunning()) {
+			cout << "Timer slack test failed" << endl;
+			return TestFail;
+		}
+
+		if (timer2.jitter() > 50) {
+			cout << "Timer slack test failed" << endl;
+			return TestFail;
+		}
+
+		/* The slack doesn't delay a timer past its own limit. */
+		timer.start(100);
+		timer2.start(1000);
+
+		dispatcher->processEvents();
+
+		if (timer.isRunning() || !timer2.isRunning() ||
+		    timer.jitter() < 250 || timer.jitter() > 350) {
+			cout << "Timer slack limit test failed" << endl;
+			return TestFail;
+		}
+
+		timer.setSlack(std::chrono::microseconds(0));
+		timer2.stop();
+
 		/*
 		 * Test that dynamically allocated timers are stopped when
 		 * deleted. This will result in a crash on failure.
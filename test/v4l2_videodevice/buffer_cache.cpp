@@ -171,6 +171,13 @@ public:
 		if (testSequential(&cacheFromBuffers, buffers) != TestPass)
 			return TestFail;
 
+		/* A pre-populated cache shall not miss on sequential usage. */
+		if (cacheFromBuffers.stats().misses != 0) {
+			std::cout << "Unexpected cache misses: "
+				  << cacheFromBuffers.stats().misses << std::endl;
+			return TestFail;
+		}
+
 		if (testRandom(&cacheFromBuffers, buffers) != TestPass)
 			return TestFail;
 
@@ -186,6 +193,14 @@ public:
 		if (testSequential(&cacheFromNumbers, buffers) != TestPass)
 			return TestFail;
 
+		/* Only the first use of each buffer shall miss. */
+		if (cacheFromNumbers.stats().misses != numBuffers) {
+			std::cout << "Expected " << numBuffers
+				  << " cache misses, got "
+				  << cacheFromNumbers.stats().misses << std::endl;
+			return TestFail;
+		}
+
 		if (testRandom(&cacheFromNumbers, buffers) != TestPass)
 			return TestFail;
 
@@ -204,6 +219,44 @@ public:
 		if (testHot(&cacheHalf, buffers, numBuffers / 2) != TestPass)
 			return TestFail;
 
+		/*
+		 * Rotating through more buffers than the cache size shall be
+		 * detected, and growing the cache shall stop the misses.
+		 */
+		V4L2BufferCache cacheSmall(numBuffers / 2);
+
+		for (unsigned int i = 0; i < numBuffers * 2; i++)
+			cacheSmall.put(cacheSmall.get(*buffers[i % numBuffers].get()));
+
+		if (!cacheSmall.thrashing()) {
+			std::cout << "Cache thrashing not detected" << std::endl;
+			return TestFail;
+		}
+
+		cacheSmall.grow(numBuffers);
+
+		if (cacheSmall.size() != numBuffers || cacheSmall.thrashing()) {
+			std::cout << "Failed to grow the cache" << std::endl;
+			return TestFail;
+		}
+
+		unsigned int misses = cacheSmall.stats().misses;
+
+		for (unsigned int i = 0; i < numBuffers * 4; i++)
+			cacheSmall.put(cacheSmall.get(*buffers[i % numBuffers].get()));
+
+		if (cacheSmall.stats().misses - misses > numBuffers ||
+		    cacheSmall.thrashing()) {
+			std::cout << "Cache still thrashing after growing" << std::endl;
+			return TestFail;
+		}
+
+		/* A well-sized cache shall not be reported as thrashing. */
+		if (cacheFromNumbers.thrashing()) {
+			std::cout << "Unexpected thrashing" << std::endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
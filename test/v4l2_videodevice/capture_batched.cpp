@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera V4L2 API tests
+ *
+ * Test batched dequeue of buffers from a V4L2 video device
+ */
+
+#include <iostream>
+#include <unistd.h>
+
+#include <libcamera/framebuffer.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include "v4l2_videodevice_test.h"
+
+using namespace libcamera;
+
+class CaptureBatchedTest : public V4L2VideoDeviceTest
+{
+public:
+	CaptureBatchedTest()
+		: V4L2VideoDeviceTest("vimc", "Raw Capture 0"), frames(0),
+		  batchedFrames(0), batches(0)
+	{
+	}
+
+	void receiveBuffer([[maybe_unused]] FrameBuffer *buffer)
+	{
+		frames++;
+	}
+
+	void receiveBuffers(Span<FrameBuffer *const> buffers)
+	{
+		batches++;
+		batchedFrames += buffers.size();
+
+		/* Requeue the buffers for further use. */
+		for (FrameBuffer *buffer : buffers)
+			capture_->queueBuffer(buffer);
+	}
+
+protected:
+	int run()
+	{
+		const unsigned int bufferCount = 8;
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+		int ret;
+
+		ret = capture_->allocateBuffers(bufferCount, &buffers_);
+		if (ret < 0) {
+			std::cout << "Failed to allocate buffers" << std::endl;
+			return TestFail;
+		}
+
+		capture_->setBatchedDequeue(true);
+		capture_->bufferReady.connect(this, &CaptureBatchedTest::receiveBuffer);
+		capture_->buffersReady.connect(this, &CaptureBatchedTest::receiveBuffers);
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : buffers_) {
+			if (capture_->queueBuffer(buffer.get())) {
+				std::cout << "Failed to queue buffer" << std::endl;
+				return TestFail;
+			}
+		}
+
+		ret = capture_->streamOn();
+		if (ret)
+			return TestFail;
+
+		/*
+		 * Sleep between event loop iterations to let multiple buffers
+		 * complete before they get dequeued.
+		 */
+		timeout.start(10000);
+		while (timeout.isRunning()) {
+			dispatcher->processEvents();
+			if (frames > 30)
+				break;
+
+			usleep(100000);
+		}
+
+		if (frames < 30) {
+			std::cout << "Failed to capture 30 frames within timeout." << std::endl;
+			return TestFail;
+		}
+
+		if (frames != batchedFrames) {
+			std::cout << "Received " << frames << " buffers but "
+				  << batchedFrames << " batched buffers" << std::endl;
+			return TestFail;
+		}
+
+		std::cout << "Processed " << frames << " frames in "
+			  << batches << " batches" << std::endl;
+
+		ret = capture_->streamOff();
+		if (ret)
+			return TestFail;
+
+		return TestPass;
+	}
+
+private:
+	unsigned int frames;
+	unsigned int batchedFrames;
+	unsigned int batches;
+};
+
+TEST_REGISTER(CaptureBatchedTest)
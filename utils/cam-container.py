@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-or-later
+# Copyright (C) 2021, Google Inc.
+#
+# cam-container.py - Inspect and extract frames from cam container files
+#
+# Container files are written by 'cam --file=<name> --container'. They start
+# with a header block describing the streams, followed by one record per
+# frame. Each record is made of a header block, with the frame metadata,
+# followed by the frame data padded to the block size.
+
+import argparse
+import os
+import struct
+import sys
+
+FILE_MAGIC = b'LCAMRAW\0'
+RECORD_MAGIC = b'LCFR'
+
+FILE_HEADER = struct.Struct('=8sIIII')
+STREAM = struct.Struct('=32sIIIIQII')
+RECORD_HEADER = struct.Struct('=4sIQQIIII4I2I')
+
+STATUS = {0: 'success', 1: 'error', 2: 'cancelled'}
+
+
+def fourcc_to_string(fourcc):
+    return ''.join(chr((fourcc >> (8 * i)) & 0xff) for i in range(4))
+
+
+class Stream(object):
+    def __init__(self, data):
+        (name, self.fourcc, self.width, self.height, self.stride,
+         self.modifier, self.frame_size, _) = STREAM.unpack(data)
+        self.name = name.rstrip(b'\0').decode('utf-8')
+
+    def __str__(self):
+        s = f'{self.name}: {self.width}x{self.height}-{fourcc_to_string(self.fourcc)}'
+        if self.modifier:
+            s += f' (modifier {self.modifier:#x})'
+        return s + f' stride {self.stride} frame size {self.frame_size}'
+
+
+class Record(object):
+    def __init__(self, offset, data):
+        (magic, self.stream, self.size, self.timestamp, self.sequence,
+         self.status, num_planes, metadata_size,
+         *lengths) = RECORD_HEADER.unpack_from(data)
+
+        if magic != RECORD_MAGIC:
+            raise ValueError(f'Invalid record at offset {offset}')
+
+        self.offset = offset
+        self.plane_lengths = lengths[:num_planes]
+        self.metadata = data[RECORD_HEADER.size:RECORD_HEADER.size + metadata_size].decode('utf-8')
+
+
+class Container(object):
+    def __init__(self, filename):
+        self.file = open(filename, 'rb')
+        self.file_size = os.fstat(self.file.fileno()).st_size
+
+        (magic, self.version, self.block_size, num_streams,
+         _) = FILE_HEADER.unpack(self.file.read(FILE_HEADER.size))
+        if magic != FILE_MAGIC:
+            raise ValueError(f'{filename} is not a cam container file')
+
+        self.streams = [Stream(self.file.read(STREAM.size)) for i in range(num_streams)]
+        self.__records = None
+
+    @property
+    def records(self):
+        # The records are indexed on first use by walking the headers only,
+        # the frame data is never read.
+        if self.__records is None:
+            self.__records = []
+            offset = self.block_size
+
+            while offset + self.block_size <= self.file_size:
+                self.file.seek(offset)
+                record = Record(offset, self.file.read(self.block_size))
+                if offset + record.size > self.file_size:
+                    print(f'Truncated record at offset {offset}', file=sys.stderr)
+                    break
+
+                self.__records.append(record)
+                offset += record.size
+
+        return self.__records
+
+    def read(self, record):
+        self.file.seek(record.offset + self.block_size)
+        return self.file.read(sum(record.plane_lengths))
+
+
+def select(container, args):
+    records = container.records
+    if args.stream is not None:
+        records = [r for r in records if container.streams[r.stream].name == args.stream]
+    if args.sequence is not None:
+        records = [r for r in records if r.sequence == args.sequence]
+    if args.index is not None:
+        records = records[args.index:args.index + 1]
+    return records
+
+
+def cmd_info(container, args):
+    print(f'Version {container.version}, block size {container.block_size}')
+    for stream in container.streams:
+        print(f'  {stream}')
+    print(f'{len(container.records)} frames')
+    return 0
+
+
+def cmd_list(container, args):
+    for record in select(container, args):
+        stream = container.streams[record.stream].name
+        lengths = '/'.join(str(length) for length in record.plane_lengths)
+        print(f'{stream} seq: {record.sequence:06} '
+              f'timestamp: {record.timestamp / 1000000000:.6f} '
+              f'status: {STATUS.get(record.status, record.status)} '
+              f'bytesused: {lengths}')
+        if args.metadata:
+            for line in record.metadata.splitlines():
+                print(f'\t{line}')
+    return 0
+
+
+def cmd_extract(container, args):
+    records = select(container, args)
+    if not records:
+        print('No matching frame', file=sys.stderr)
+        return 1
+
+    for record in records:
+        stream = container.streams[record.stream].name
+        filename = args.output.replace('#', f'{stream}-{record.sequence:06}', 1)
+        with open(filename, 'wb') as f:
+            f.write(container.read(record))
+
+    return 0
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description='Inspect and extract frames from cam container files')
+    parser.add_argument('--stream', type=str, help='Only consider frames from the named stream')
+    parser.add_argument('--sequence', type=int, help='Only consider the frame with the given sequence number')
+    parser.add_argument('--index', type=int, help='Only consider the n-th matching frame')
+
+    subparsers = parser.add_subparsers(dest='command', required=True)
+
+    info = subparsers.add_parser('info', help='Print the streams and number of frames')
+    info.add_argument('input', type=str, help='Container file')
+    info.set_defaults(func=cmd_info)
+
+    list_ = subparsers.add_parser('list', help='List the frames')
+    list_.add_argument('--metadata', action='store_true', help='Print the frame metadata')
+    list_.add_argument('input', type=str, help='Container file')
+    list_.set_defaults(func=cmd_list)
+
+    extract = subparsers.add_parser('extract', help='Extract frames to raw files')
+    extract.add_argument('input', type=str, help='Container file')
+    extract.add_argument('output', type=str,
+                         help="Output file name, the first '#' is expanded to the stream name and sequence")
+    extract.set_defaults(func=cmd_extract)
+
+    args = parser.parse_args(argv[1:])
+
+    try:
+        container = Container(args.input)
+        return args.func(container, args)
+    except (OSError, ValueError) as e:
+        print(e, file=sys.stderr)
+        return 1
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
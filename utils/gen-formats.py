@@ -17,11 +17,14 @@ class DRMFourCC(object):
     format_regex = re.compile(r"#define (DRM_FORMAT_[A-Z0-9_]+)[ \t]+fourcc_code\(('.', '.', '.', '.')\)")
     mod_vendor_regex = re.compile(r"#define DRM_FORMAT_MOD_VENDOR_([A-Z0-9_]+)[ \t]+([0-9a-fA-Fx]+)")
     mod_regex = re.compile(r"#define ([A-Za-z0-9_]+)[ \t]+fourcc_mod_code\(([A-Z0-9_]+), ([0-9a-fA-Fx]+)\)")
+    afbc_flag_regex = re.compile(r"#define (AFBC_FORMAT_MOD_[A-Za-z0-9_]+)[ \t]+\((1ULL(?:[ \t]*<<[ \t]*[0-9]+)?|[0-9]+ULL)\)")
+    afbc_mod_regex = re.compile(r"DRM_FORMAT_MOD_ARM_AFBC\((.*)\)")
 
     def __init__(self, filename):
         self.formats = {}
         self.vendors = {}
         self.mods = {}
+        self.afbc_flags = {}
 
         for line in open(filename, 'rb').readlines():
             line = line.decode('utf-8')
@@ -44,10 +47,26 @@ class DRMFourCC(object):
                 self.mods[mod] = (vendor, int(value, 0))
                 continue
 
+            match = DRMFourCC.afbc_flag_regex.match(line)
+            if match:
+                flag, value = match.groups()
+                value = value.replace('ULL', '').split('<<')
+                self.afbc_flags[flag] = int(value[0]) << int(value[1] if len(value) > 1 else 0)
+                continue
+
     def fourcc(self, name):
         return self.formats[name]
 
     def mod(self, name):
+        # AFBC modifiers are parametrized by a set of flags, compute their
+        # value. The AFBC type code is 0, only the flags need to be stored.
+        match = DRMFourCC.afbc_mod_regex.match(name)
+        if match:
+            value = 0
+            for flag in match.group(1).split('|'):
+                value |= self.afbc_flags[flag.strip()]
+            return self.vendors['ARM'], value
+
         vendor, value = self.mods[name]
         return self.vendors[vendor], value
 
@@ -142,6 +142,39 @@ def HasFd(element):
         types = GetAllTypes(element.kind)
     return "FileDescriptor" in types or (attrs is not None and "hasFd" in attrs)
 
+# Get the offsets of the fields of a struct made of integer and floating point
+# fields only, laid out without any padding, or None if the struct doesn't
+# qualify. The in-memory and serialized representations of such structs are
+# identical, which allows (de)serializing them with a single memcpy(). bool is
+# excluded as not all byte values are valid bools.
+def PackedOffsets(struct):
+    if len(struct.fields) == 0 or HasFd(struct):
+        return None
+
+    offsets = []
+    offset = 0
+    alignment = 1
+    for field in struct.fields:
+        if field.kind == mojom.BOOL or field.kind not in _kind_to_cpp_type:
+            return None
+        size = int(_bit_widths[field.kind]) // 8
+        if offset % size != 0:
+            return None
+        offsets.append(offset)
+        offset += size
+        alignment = max(alignment, size)
+
+    if offset % alignment != 0:
+        return None
+
+    return offsets
+
+def PackedSize(struct):
+    return sum([int(_bit_widths[x.kind]) // 8 for x in struct.fields])
+
+def IsTriviallySerializable(struct):
+    return PackedOffsets(struct) is not None
+
 def WithDefaultValues(element):
     return [x for x in element if HasDefaultValue(x)]
 
@@ -210,6 +243,17 @@ def IsAsync(method):
             return True
     return False
 
+# Functions that don't return anything don't need to wait for the IPA to
+# complete them when it is isolated, as the proxy worker processes calls in
+# order. Only buffer mapping is sent asynchronously, as the other functions are
+# also used to synchronise the pipeline handler with the IPA state.
+def IsIPCAsync(method):
+    if IsAsync(method):
+        return True
+    if method.mojom_name not in ['mapBuffers', 'unmapBuffers']:
+        return False
+    return len(MethodParamOutputs(method)) == 0 and MethodReturnValue(method) == 'void'
+
 def IsArray(element):
     return mojom.IsArrayKind(element.kind)
 
@@ -404,6 +448,7 @@ class Generator(generator.Generator):
             'has_default_fields': HasDefaultFields,
             'has_fd': HasFd,
             'is_async': IsAsync,
+            'is_ipc_async': IsIPCAsync,
             'is_array': IsArray,
             'is_controls': IsControls,
             'is_enum': IsEnum,
@@ -412,6 +457,7 @@ class Generator(generator.Generator):
             'is_plain_struct': IsPlainStruct,
             'is_pod': IsPod,
             'is_str': IsStr,
+            'is_trivially_serializable': IsTriviallySerializable,
             'method_input_has_fd': MethodInputHasFd,
             'method_output_has_fd': MethodOutputHasFd,
             'method_param_names': MethodParamNames,
@@ -422,6 +468,8 @@ class Generator(generator.Generator):
             'name': GetNameForElement,
             'name_full': GetFullNameForElement,
             'needs_control_serializer': NeedsControlSerializer,
+            'packed_offsets': PackedOffsets,
+            'packed_size': PackedSize,
             'params_comma_sep': ParamsCommaSep,
             'with_default_values': WithDefaultValues,
             'with_fds': WithFds,
@@ -0,0 +1,331 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-or-later
+# Copyright (C) 2021, Google Inc.
+#
+# analyze-frame-timing.py - Frame time budget analysis of libcamera lttng traces
+#
+# The script follows every request through the pipeline using the request
+# lifetime tracepoints, and splits its latency in stages:
+#
+#  - prepare:    request_queue -> request_device_queue
+#  - capture:    request_device_queue -> first request_complete_buffer
+#  - buffers:    first -> last request_complete_buffer
+#  - completion: last request_complete_buffer -> request_deliver
+#  - total:      request_queue -> request_deliver
+#
+# IPA calls (ipa_call_begin/ipa_call_end) are reported as additional stages.
+#
+# Requests delivered to the application later than the frame period after the
+# previous request of the same camera are reported as late. Each late frame is
+# correlated with the IPA calls that overlapped it, and with the CPU migrations
+# of the libcamera threads during the frame, from the sched_migrate_task kernel
+# events if the kernel domain was traced, or from changes of the cpu_id context
+# of the userspace events otherwise. The cpu_id and vtid contexts need to be
+# enabled on the userspace channel for the latter:
+#
+#   lttng add-context -u -t vtid -t cpu_id
+
+import argparse
+import bt2
+import json
+import math
+import statistics as stats
+import sys
+
+
+class RequestTiming:
+    def __init__(self, cookie, queued):
+        self.cookie = cookie
+        self.queued = queued
+        self.device_queued = None
+        self.first_buffer = None
+        self.last_buffer = None
+        self.delivered = None
+        self.camera = None
+        self.sequence = None
+        self.sensor_timestamp = None
+        self.status = None
+
+    def stages(self):
+        points = [('prepare', self.queued, self.device_queued),
+                  ('capture', self.device_queued, self.first_buffer),
+                  ('buffers', self.first_buffer, self.last_buffer),
+                  ('completion', self.last_buffer, self.delivered),
+                  ('total', self.queued, self.delivered)]
+
+        return {name: end - begin for name, begin, end in points
+                if begin is not None and end is not None}
+
+
+class Analyzer:
+    def __init__(self, pipeline):
+        self.pipeline = pipeline
+
+        # request address -> RequestTiming of the request in flight
+        self.inflight = {}
+        # camera -> [RequestTiming] in delivery order
+        self.delivered = {}
+
+        # pipeline:function -> stack(timestamps)
+        self.ipa_pending = {}
+        # [(begin, end, pipeline:function)]
+        self.ipa_calls = []
+
+        # [(timestamp, tid, comm, orig_cpu, dest_cpu)]
+        self.migrations = []
+        # vtid -> last cpu_id
+        self.thread_cpu = {}
+        # set of libcamera thread ids, used to filter kernel migrations
+        self.threads = set()
+
+    def process(self, msg):
+        event = msg.event
+        name = event.name
+        ts = msg.default_clock_snapshot.ns_from_origin
+
+        if name == 'sched_migrate_task':
+            payload = event.payload_field
+            self.migrations.append((ts, int(payload['tid']), str(payload['comm']),
+                                    int(payload['orig_cpu']), int(payload['dest_cpu'])))
+            return
+
+        if not name.startswith('libcamera:'):
+            return
+
+        self.track_cpu(msg, ts)
+
+        name = name[len('libcamera:'):]
+        payload = event.payload_field
+
+        if name in ('ipa_call_begin', 'ipa_call_end'):
+            pipeline = str(payload['pipeline_name'])
+            if self.pipeline is not None and pipeline != self.pipeline:
+                return
+
+            key = f'{pipeline}:{payload["function_name"]}'
+            if name == 'ipa_call_begin':
+                self.ipa_pending.setdefault(key, []).append(ts)
+            elif self.ipa_pending.get(key):
+                self.ipa_calls.append((self.ipa_pending[key].pop(), ts, key))
+            return
+
+        if 'request' not in payload:
+            return
+
+        request = int(payload['request'])
+
+        if name == 'request_queue':
+            self.inflight[request] = RequestTiming(int(payload['cookie']), ts)
+            return
+
+        timing = self.inflight.get(request)
+        if timing is None:
+            return
+
+        if name == 'request_device_queue':
+            timing.device_queued = ts
+        elif name == 'request_complete_buffer':
+            if timing.first_buffer is None:
+                timing.first_buffer = ts
+            timing.last_buffer = ts
+        elif name == 'request_deliver':
+            timing.delivered = ts
+            timing.camera = str(payload['camera_id'])
+            timing.sequence = int(payload['sequence'])
+            timing.sensor_timestamp = int(payload['sensor_timestamp']) or None
+            timing.status = str(payload['status'].labels[0]) \
+                if payload['status'].labels else int(payload['status'])
+            self.delivered.setdefault(timing.camera, []).append(timing)
+            del self.inflight[request]
+        elif name == 'request_cancel':
+            del self.inflight[request]
+
+    def track_cpu(self, msg, ts):
+        try:
+            context = msg.event.common_context_field
+            vtid = int(context['vtid'])
+            cpu = int(context['cpu_id'])
+        except (KeyError, TypeError, AttributeError):
+            try:
+                cpu = int(msg.event.packet.context_field['cpu_id'])
+                vtid = None
+            except (KeyError, TypeError, AttributeError):
+                return
+
+        if vtid is None:
+            return
+
+        self.threads.add(vtid)
+
+        prev = self.thread_cpu.get(vtid)
+        if prev is not None and prev != cpu:
+            self.migrations.append((ts, vtid, 'libcamera', prev, cpu))
+        self.thread_cpu[vtid] = cpu
+
+    def frame_period(self, timings, period):
+        if period is not None:
+            return period
+
+        intervals = [b.delivered - a.delivered
+                     for a, b in zip(timings, timings[1:])]
+        if not intervals:
+            return None
+
+        return stats.median(intervals)
+
+    def late_frames(self, period, tolerance):
+        late = []
+
+        for camera, timings in self.delivered.items():
+            camera_period = self.frame_period(timings, period)
+            if camera_period is None:
+                continue
+
+            budget = camera_period * (1 + tolerance)
+
+            for prev, timing in zip(timings, timings[1:]):
+                interval = timing.delivered - prev.delivered
+                if interval <= budget:
+                    continue
+
+                begin = timing.device_queued or timing.queued
+                begin = max(begin, prev.delivered)
+                end = timing.delivered
+
+                ipa = [{'function': key, 'duration': e - b}
+                       for b, e, key in self.ipa_calls if b < end and e > begin]
+
+                migrations = [{'timestamp': t, 'tid': tid, 'comm': comm,
+                               'orig_cpu': orig, 'dest_cpu': dest}
+                              for t, tid, comm, orig, dest in self.migrations
+                              if begin <= t <= end and
+                              (not self.threads or tid in self.threads)]
+
+                late.append({
+                    'camera': camera,
+                    'cookie': timing.cookie,
+                    'sequence': timing.sequence,
+                    'sensor_timestamp': timing.sensor_timestamp,
+                    'status': timing.status,
+                    'interval': interval,
+                    'period': int(camera_period),
+                    'overrun': int(interval - camera_period),
+                    'stages': timing.stages(),
+                    'ipa_calls': ipa,
+                    'migrations': migrations,
+                })
+
+        return late
+
+    def stage_samples(self):
+        samples = {}
+
+        for timings in self.delivered.values():
+            for timing in timings:
+                for stage, value in timing.stages().items():
+                    samples.setdefault(stage, []).append(value)
+
+        for begin, end, key in self.ipa_calls:
+            samples.setdefault(f'ipa {key}', []).append(end - begin)
+
+        return samples
+
+
+def percentile(values, p):
+    # Nearest-rank percentile, values must be sorted.
+    rank = max(math.ceil(p / 100 * len(values)), 1)
+    return values[rank - 1]
+
+
+def distribution(values):
+    values = sorted(values)
+
+    return {
+        'count': len(values),
+        'min': values[0],
+        'max': values[-1],
+        'mean': int(stats.mean(values)),
+        'stddev': int(stats.stdev(values)) if len(values) > 1 else 0,
+        'p50': percentile(values, 50),
+        'p90': percentile(values, 90),
+        'p99': percentile(values, 99),
+    }
+
+
+def print_table(rows):
+    # Get maximum string width for every column
+    widths = [max([len(row[i]) for row in rows]) for i in range(len(rows[0]))]
+
+    for row in rows:
+        fmt = [row[i].rjust(widths[i]) for i in range(1, len(row))]
+        print(' '.join([row[0].ljust(widths[0])] + fmt))
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+            description='Compute per-stage latencies and frame time budget violations')
+    parser.add_argument('-p', '--pipeline', type=str,
+                        help='Name of pipeline to filter IPA calls for')
+    parser.add_argument('-f', '--frame-period', type=float,
+                        help='Expected frame period in milliseconds (default: median delivery interval per camera)')
+    parser.add_argument('-t', '--tolerance', type=float, default=0.25,
+                        help='Fraction of the frame period a frame may be late by before being reported (default: 0.25)')
+    parser.add_argument('-j', '--json', type=str,
+                        help='Write the summary as JSON to the given file (\'-\' for stdout)')
+    parser.add_argument('trace_path', type=str,
+                        help='Path to lttng trace (eg. ~/lttng-traces/demo-20201029-184003)')
+    args = parser.parse_args(argv[1:])
+
+    analyzer = Analyzer(args.pipeline)
+
+    traces = bt2.TraceCollectionMessageIterator(args.trace_path)
+    for msg in traces:
+        if type(msg) is bt2._EventMessageConst:
+            analyzer.process(msg)
+
+    period = int(args.frame_period * 1000000) if args.frame_period else None
+
+    samples = analyzer.stage_samples()
+    late = analyzer.late_frames(period, args.tolerance)
+
+    summary = {
+        'frames': {camera: len(timings) for camera, timings in analyzer.delivered.items()},
+        'stages': {stage: distribution(values) for stage, values in samples.items()},
+        'late_frames': late,
+        'late_with_migrations': sum(1 for frame in late if frame['migrations']),
+    }
+
+    if args.json == '-':
+        json.dump(summary, sys.stdout, indent=2)
+        print()
+        return 0
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(summary, f, indent=2)
+
+    columns = ['count', 'min', 'max', 'mean', 'stddev', 'p50', 'p90', 'p99']
+    rows = [['stage (ns)'] + columns]
+    for stage, dist in summary['stages'].items():
+        rows.append([stage] + [str(dist[c]) for c in columns])
+    print_table(rows)
+
+    print()
+    print(f'{len(late)} late frames, {summary["late_with_migrations"]} with CPU migrations')
+
+    if late:
+        print()
+        rows = [['camera', 'cookie', 'sequence', 'interval', 'overrun', 'ipa', 'migrations']]
+        for frame in late:
+            ipa = max(frame['ipa_calls'], key=lambda call: call['duration'], default=None)
+            rows.append([frame['camera'], str(frame['cookie']), str(frame['sequence']),
+                         str(frame['interval']), str(frame['overrun']),
+                         f'{ipa["function"]} ({ipa["duration"]})' if ipa else '-',
+                         str(len(frame['migrations']))])
+        print_table(rows)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-or-later
+# Copyright (C) 2021, Google Inc.
+#
+# trace-ring-to-chrome.py - Convert libcamera trace ring files to Chrome traces
+#
+# Trace ring files are written by libcamera when the LIBCAMERA_TRACE_RING
+# environment variable is set. The output JSON file can be loaded in
+# chrome://tracing or https://ui.perfetto.dev.
+
+import argparse
+import json
+import struct
+import sys
+
+TRACE_MAGIC = b'LCTRACE\0'
+TRACE_VERSION = 1
+
+ENTRY = struct.Struct('=QIIQQ')
+UINT32 = struct.Struct('=I')
+
+REQUEST_QUEUE = 0
+REQUEST_COMPLETE = 1
+BUFFER_QUEUE = 2
+BUFFER_DEQUEUE = 3
+IPA_CALL_BEGIN = 4
+IPA_CALL_END = 5
+FRAME_START = 6
+
+
+class Reader(object):
+    def __init__(self, data):
+        self.data = data
+        self.offset = 0
+
+    def read(self, size):
+        if self.offset + size > len(self.data):
+            raise ValueError('Truncated trace file')
+        data = self.data[self.offset:self.offset + size]
+        self.offset += size
+        return data
+
+    def uint32(self):
+        return UINT32.unpack(self.read(UINT32.size))[0]
+
+    def string(self):
+        return self.read(self.uint32()).decode('utf-8', errors='replace')
+
+
+def parse(data):
+    reader = Reader(data)
+    if reader.read(len(TRACE_MAGIC)) != TRACE_MAGIC:
+        raise ValueError('Not a libcamera trace ring file')
+
+    version = reader.uint32()
+    if version != TRACE_VERSION:
+        raise ValueError(f'Unsupported trace version {version}')
+
+    rings = []
+    for i in range(reader.uint32()):
+        tid = reader.uint32()
+        name = reader.string()
+        count = reader.uint32()
+        entries = [ENTRY.unpack(reader.read(ENTRY.size)) for j in range(count)]
+        rings.append((tid, name, entries))
+
+    strings = [reader.string() for i in range(reader.uint32())]
+
+    return rings, strings
+
+
+def convert(rings, strings, pid):
+    events = []
+
+    for tid, name, entries in rings:
+        if name:
+            events.append({'ph': 'M', 'name': 'thread_name', 'pid': pid,
+                           'tid': tid, 'args': {'name': name}})
+
+        for timestamp, event, _, arg0, arg1 in entries:
+            ev = {'pid': pid, 'tid': tid, 'ts': timestamp / 1000}
+
+            if event == REQUEST_QUEUE:
+                ev.update({'ph': 'b', 'cat': 'request', 'name': 'Request',
+                           'id': hex(arg0), 'args': {'cookie': arg1}})
+            elif event == REQUEST_COMPLETE:
+                ev.update({'ph': 'e', 'cat': 'request', 'name': 'Request',
+                           'id': hex(arg0), 'args': {'status': arg1}})
+            elif event == BUFFER_QUEUE:
+                ev.update({'ph': 'b', 'cat': 'buffer', 'name': 'Buffer',
+                           'id': hex(arg0), 'args': {'index': arg1}})
+            elif event == BUFFER_DEQUEUE:
+                ev.update({'ph': 'e', 'cat': 'buffer', 'name': 'Buffer',
+                           'id': hex(arg0), 'args': {'sequence': arg1}})
+            elif event in (IPA_CALL_BEGIN, IPA_CALL_END):
+                ev.update({'ph': 'B' if event == IPA_CALL_BEGIN else 'E',
+                           'cat': 'ipa', 'name': strings[arg0]})
+            elif event == FRAME_START:
+                ev.update({'ph': 'i', 's': 't', 'cat': 'frame',
+                           'name': 'FrameStart', 'args': {'sequence': arg0}})
+            else:
+                print(f'Unknown event {event}, skipping', file=sys.stderr)
+                continue
+
+            events.append(ev)
+
+    # Rings are per thread, sort the events globally by time.
+    events.sort(key=lambda ev: ev.get('ts', 0))
+
+    return {'traceEvents': events, 'displayTimeUnit': 'ns'}
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description='Convert libcamera trace ring files to the Chrome trace format')
+    parser.add_argument('--pid', type=int, default=1, help='Process id to report in the trace')
+    parser.add_argument('input', type=str, help='Trace ring file')
+    parser.add_argument('output', type=str, help='Output JSON file')
+    args = parser.parse_args(argv[1:])
+
+    try:
+        with open(args.input, 'rb') as f:
+            rings, strings = parse(f.read())
+    except (OSError, ValueError) as e:
+        print(e, file=sys.stderr)
+        return 1
+
+    with open(args.output, 'w') as f:
+        json.dump(convert(rings, strings, args.pid), f)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))